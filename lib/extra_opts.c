@@ -24,6 +24,8 @@
 #include "utils_base.h"
 #include "parse_ini.h"
 #include "extra_opts.h"
+#include "utils_timing.h"
+#include "utils_metrics.h"
 
 /* FIXME: copied from utils.h; we should move a bunch of libs! */
 int
@@ -37,8 +39,7 @@ is_option2 (char *str)
 		return FALSE;
 }
 
-/* this is the externally visible function used by plugins */
-char **np_extra_opts(int *argc, char **argv, const char *plugin_name){
+static char **extra_opts(int *argc, char **argv, const char *plugin_name){
 	np_arg_list *extra_args=NULL, *ea1=NULL, *ea_tmp=NULL;
 	char **argv_new=NULL;
 	char *argptr=NULL;
@@ -134,3 +135,10 @@ char **np_extra_opts(int *argc, char **argv, const char *plugin_name){
 	return argv_new;
 }
 
+/* this is the externally visible function used by plugins */
+char **np_extra_opts(int *argc, char **argv, const char *plugin_name){
+	np_metrics_name(plugin_name);
+	/* the timing options are known to all plugins, and may come from an
+	 * ini file as well */
+	return np_timing_opts(argc, extra_opts(argc, argv, plugin_name));
+}
@@ -27,9 +27,14 @@
 #include "parse_ini.h"
 
 #include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 /* np_ini_info contains the result of parsing a "locator" in the format
  * [stanza_name][@config_filename] (check_foo@/etc/foo.ini, for example)
@@ -65,6 +70,41 @@ static char *default_ini_path_names[] = {
 /* eat all characters from a FILE pointer until n is encountered */
 #define GOBBLE_TO(f, c, n) do { (c)=fgetc((f)); } while((c)!=EOF && (c)!=(n))
 
+/*
+ * The stanza index of an ini file is kept in the state directory, under
+ * ini/ and a hash of the file name. It maps each stanza name to where its
+ * options start in the file, so that a plugin reads those lines only
+ * instead of parsing the whole file. It is built again when the size,
+ * mtime or inode of the file change. Layout: an ini_index_header, the
+ * buckets of the hash table, the entries, then their names.
+ */
+#define INI_INDEX_MAGIC "NPINIX01"
+#define INI_INDEX_NONE UINT32_MAX
+
+typedef struct {
+	char magic[8];
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime;
+	uint32_t nbuckets;	/* even, so that the entries are aligned */
+	uint32_t nentries;
+	uint32_t names_len;
+	uint32_t unused;
+} ini_index_header;
+
+typedef struct {
+	uint32_t next;		/* the next entry in the bucket */
+	uint32_t name;		/* offset in the names */
+	uint32_t name_len;
+	uint32_t hash;
+	uint64_t offset;	/* the first byte after the stanza's ']' */
+} ini_index_entry;
+
+/* internal functions for the stanza index */
+static int read_indexed_defaults(FILE *f, const char *file, const char *stanza, np_arg_list **opts);
+static int read_stanza(FILE *f, np_arg_list **opts);
+
 /* internal function that returns the constructed defaults options */
 static int read_defaults(FILE *f, const char *stanza, np_arg_list **opts);
 
@@ -131,7 +171,7 @@ np_get_defaults(const char *locator, const char *default_section)
 	if (inifile == NULL)
 		die(STATE_UNKNOWN, _("Can't read config file: %s\n"),
 		    strerror(errno));
-	if (read_defaults(inifile, i.stanza, &defaults) == FALSE)
+	if (read_indexed_defaults(inifile, i.file, i.stanza, &defaults) == FALSE)
 		die(STATE_UNKNOWN,
 		    _("Invalid section '%s' in config file '%s'\n"), i.stanza,
 		    i.file);
@@ -228,6 +268,327 @@ read_defaults(FILE *f, const char *stanza, np_arg_list **opts)
 	return status;
 }
 
+/*
+ * Reads the options of a stanza from its first line on, up to the next
+ * stanza. Returns TRUE if there were any.
+ */
+static int
+read_stanza(FILE *f, np_arg_list **opts)
+{
+	int c, status = FALSE;
+
+	while ((c = fgetc(f)) != EOF) {
+		if (isspace(c))
+			continue;
+		if (c == ';' || c == '#') {
+			GOBBLE_TO(f, c, '\n');
+			continue;
+		}
+		if (c == '[')
+			break;
+		ungetc(c, f);
+		if (add_option(f, opts))
+			die(STATE_UNKNOWN, "%s\n", _("Config file error"));
+		status = TRUE;
+	}
+	return status;
+}
+
+static uint32_t
+ini_hash(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	return hash;
+}
+
+static char *
+ini_index_file(const char *file)
+{
+	struct sha1_ctx ctx;
+	unsigned char digest[20];
+	char key[41];
+	char *index_file;
+	int i;
+
+	sha1_init_ctx(&ctx);
+	sha1_process_bytes(file, strlen(file), &ctx);
+	sha1_finish_ctx(&ctx, digest);
+	for (i = 0; i < 20; i++)
+		sprintf(&key[2 * i], "%02x", digest[i]);
+	key[40] = '\0';
+
+	if (asprintf(&index_file, "%s/%lu/ini/%s",
+	    _np_state_calculate_location_prefix(), (unsigned long)geteuid(),
+	    key) < 0)
+		return NULL;
+	return index_file;
+}
+
+/* Returns TRUE if the index is whole and was built from this version of
+ * the file */
+static int
+ini_index_valid(const char *index, size_t len, const struct stat *st)
+{
+	const ini_index_header *h = (const ini_index_header *)index;
+
+	if (len < sizeof(*h) || memcmp(h->magic, INI_INDEX_MAGIC, 8) != 0)
+		return FALSE;
+	if (h->dev != (uint64_t)st->st_dev || h->ino != (uint64_t)st->st_ino ||
+	    h->size != (uint64_t)st->st_size || h->mtime != (int64_t)st->st_mtime)
+		return FALSE;
+	return h->nbuckets > 0 && len == sizeof(*h) +
+	    (size_t)h->nbuckets * sizeof(uint32_t) +
+	    (size_t)h->nentries * sizeof(ini_index_entry) + h->names_len;
+}
+
+/* Looks the stanza up in the index and reads the options of each of its
+ * occurrences from the file */
+static int
+ini_index_read(const char *index, FILE *f, const char *stanza, np_arg_list **opts)
+{
+	const ini_index_header *h = (const ini_index_header *)index;
+	const uint32_t *buckets = (const uint32_t *)(h + 1);
+	const ini_index_entry *entries =
+	    (const ini_index_entry *)(buckets + h->nbuckets);
+	const char *names = (const char *)(entries + h->nentries);
+	size_t len = strlen(stanza);
+	uint32_t hash = ini_hash(stanza, len), e;
+	int status = FALSE;
+
+	for (e = buckets[hash % h->nbuckets]; e != INI_INDEX_NONE && e < h->nentries;
+	    e = entries[e].next) {
+		if (entries[e].hash != hash || entries[e].name_len != len ||
+		    entries[e].name + len > h->names_len ||
+		    memcmp(names + entries[e].name, stanza, len) != 0)
+			continue;
+		if (fseeko(f, (off_t)entries[e].offset, SEEK_SET) != 0)
+			die(STATE_UNKNOWN, _("Can't read config file: %s\n"),
+			    strerror(errno));
+		if (read_stanza(f, opts))
+			status = TRUE;
+	}
+	return status;
+}
+
+/*
+ * Builds the index of the stanzas in the file, the same way read_defaults()
+ * finds them. Returns NULL if the file has options before the first stanza,
+ * read_defaults() then reports the error.
+ */
+static char *
+ini_index_build(FILE *f, const struct stat *st, size_t *index_len)
+{
+	ini_index_header h;
+	ini_index_entry *entries = NULL;
+	uint32_t *buckets;
+	char *names = NULL, *index;
+	size_t nentries = 0, entries_size = 0, names_len = 0, names_size = 0;
+	size_t name_len, i;
+	uint64_t pos = 0, name_start;
+	int c, in_stanza = FALSE;
+	char name[MAX_INPUT_BUFFER];
+
+	rewind(f);
+	while ((c = fgetc(f)) != EOF) {
+		pos++;
+		if (isspace(c))
+			continue;
+		if (c == '[') {
+			/* the name ends at the ']' on the same line */
+			name_len = 0;
+			name_start = pos;
+			while ((c = fgetc(f)) != EOF && c != ']' && c != '\n') {
+				pos++;
+				if (name_len < sizeof(name))
+					name[name_len++] = c;
+			}
+			if (c != EOF)
+				pos++;
+			in_stanza = TRUE;
+			if (c != ']' || pos - name_start > sizeof(name))
+				continue;
+			for (i = 0; i < name_len && isspace(name[i]); i++)
+				continue;
+			while (name_len > i && isspace(name[name_len - 1]))
+				name_len--;
+
+			if (nentries == entries_size) {
+				entries_size = entries_size ? entries_size * 2 : 64;
+				if ((entries = realloc(entries, entries_size * sizeof(*entries))) == NULL)
+					die(STATE_UNKNOWN, _("malloc() failed!\n"));
+			}
+			while (names_len + name_len - i > names_size) {
+				names_size = names_size ? names_size * 2 : 1024;
+				if ((names = realloc(names, names_size)) == NULL)
+					die(STATE_UNKNOWN, _("malloc() failed!\n"));
+			}
+			memcpy(names + names_len, name + i, name_len - i);
+			entries[nentries].name = names_len;
+			entries[nentries].name_len = name_len - i;
+			entries[nentries].hash = ini_hash(name + i, name_len - i);
+			entries[nentries].offset = pos;
+			names_len += name_len - i;
+			nentries++;
+			continue;
+		}
+		/* comments and options, the latter only after a stanza */
+		if (c != ';' && c != '#' && !in_stanza) {
+			free(entries);
+			free(names);
+			return NULL;
+		}
+		while ((c = fgetc(f)) != EOF) {
+			pos++;
+			if (c == '\n')
+				break;
+		}
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, INI_INDEX_MAGIC, 8);
+	h.dev = st->st_dev;
+	h.ino = st->st_ino;
+	h.size = st->st_size;
+	h.mtime = st->st_mtime;
+	h.nbuckets = (nentries + 2) & ~(size_t)1;
+	h.nentries = nentries;
+	h.names_len = names_len;
+
+	*index_len = sizeof(h) + h.nbuckets * sizeof(uint32_t) +
+	    nentries * sizeof(ini_index_entry) + names_len;
+	if ((index = malloc(*index_len)) == NULL)
+		die(STATE_UNKNOWN, _("malloc() failed!\n"));
+	memcpy(index, &h, sizeof(h));
+	buckets = (uint32_t *)(index + sizeof(h));
+	for (i = 0; i < h.nbuckets; i++)
+		buckets[i] = INI_INDEX_NONE;
+	/* chained from the last one, so that a stanza given twice is read
+	 * in the order of the file */
+	for (i = nentries; i-- > 0;) {
+		entries[i].next = buckets[entries[i].hash % h.nbuckets];
+		buckets[entries[i].hash % h.nbuckets] = i;
+	}
+	if (nentries > 0)
+		memcpy(buckets + h.nbuckets, entries, nentries * sizeof(ini_index_entry));
+	if (names_len > 0)
+		memcpy((char *)(buckets + h.nbuckets) + nentries * sizeof(ini_index_entry),
+		    names, names_len);
+	free(entries);
+	free(names);
+	return index;
+}
+
+/* Writes the index like np_state_write_string() writes state files, but
+ * quietly gives up on errors: the next run just builds it again */
+static void
+ini_index_save(const char *index_file, const char *index, size_t len)
+{
+	char *directories, *temp_file, *p;
+	int fd;
+	ssize_t written;
+
+	if ((directories = strdup(index_file)) != NULL) {
+		for (p = directories + 1; *p; p++) {
+			if (*p == '/') {
+				*p = '\0';
+				if (access(directories, F_OK) != 0)
+					mkdir(directories, S_IRWXU);
+				*p = '/';
+			}
+		}
+		free(directories);
+	}
+
+	if (asprintf(&temp_file, "%s.XXXXXX", index_file) < 0)
+		return;
+	if ((fd = mkstemp(temp_file)) == -1) {
+		free(temp_file);
+		return;
+	}
+	written = write(fd, index, len);
+	if (close(fd) != 0 || written != (ssize_t)len ||
+	    rename(temp_file, index_file) != 0)
+		unlink(temp_file);
+	free(temp_file);
+}
+
+/*
+ * Reads the options of the stanza through the index of the file, building
+ * it first if there is none for this version of the file. Falls back to
+ * read_defaults() for what isn't a regular file and files with errors.
+ */
+static int
+read_indexed_defaults(FILE *f, const char *file, const char *stanza, np_arg_list **opts)
+{
+	struct stat st, index_st;
+	char *index_file, *index = NULL;
+	size_t index_len = 0;
+	int fd, status, mapped = FALSE;
+
+	if (f == stdin || fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) ||
+	    (index_file = ini_index_file(file)) == NULL)
+		return read_defaults(f, stanza, opts);
+
+	if ((fd = open(index_file, O_RDONLY)) >= 0) {
+		if (fstat(fd, &index_st) == 0 && index_st.st_uid == geteuid() &&
+		    index_st.st_size > 0) {
+			index_len = index_st.st_size;
+#ifdef HAVE_MMAP
+			index = mmap(NULL, index_len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (index == MAP_FAILED)
+				index = NULL;
+			else
+				mapped = TRUE;
+#else
+			if ((index = malloc(index_len)) != NULL &&
+			    read(fd, index, index_len) != (ssize_t)index_len) {
+				free(index);
+				index = NULL;
+			}
+#endif
+		}
+		close(fd);
+	}
+
+	if (index != NULL && !ini_index_valid(index, index_len, &st)) {
+#ifdef HAVE_MMAP
+		if (mapped)
+			munmap(index, index_len);
+		else
+#endif
+			free(index);
+		index = NULL;
+		mapped = FALSE;
+	}
+
+	if (index == NULL) {
+		if ((index = ini_index_build(f, &st, &index_len)) == NULL) {
+			free(index_file);
+			rewind(f);
+			return read_defaults(f, stanza, opts);
+		}
+		/* a file changed within the current second could change again
+		 * without a new mtime, its index is not kept */
+		if (st.st_mtime < time(NULL))
+			ini_index_save(index_file, index, index_len);
+	}
+
+	status = ini_index_read(index, f, stanza, opts);
+
+#ifdef HAVE_MMAP
+	if (mapped)
+		munmap(index, index_len);
+	else
+#endif
+		free(index);
+	free(index_file);
+	return status;
+}
+
 /*
  * Read one line of input in the format
  * 	^option[[:space:]]*(=[[:space:]]*value)?
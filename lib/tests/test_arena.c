@@ -0,0 +1,84 @@
+/*****************************************************************************
+* 
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+* 
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+* 
+* 
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_arena.h"
+#include "tap.h"
+
+int
+main(void)
+{
+	np_str s = NP_STR_INIT, t = NP_STR_INIT;
+	char *a, *b, *big;
+	const char *buf;
+	int i, right;
+
+	plan_tests(12);
+
+	ok(strcmp(np_str_string(&s), "") == 0, "Empty string before anything was added");
+
+	a = np_arena_alloc(3);
+	b = np_arena_alloc(1);
+	ok(((size_t)a % 16) == 0 && ((size_t)b % 16) == 0, "Allocations are aligned");
+	ok(b - a >= 3, "Allocations do not overlap");
+
+	ok(strcmp(np_arena_strdup("check_disk"), "check_disk") == 0, "np_arena_strdup");
+	ok(strcmp(np_arena_printf("%s (inodes)", "/var"), "/var (inodes)") == 0, "np_arena_printf");
+
+	np_str_puts(&s, "DISK");
+	np_str_printf(&s, " %s %d%%", "/", 84);
+	np_str_append(&s, ";xyz", 1);
+	ok(strcmp(np_str_string(&s), "DISK / 84%;") == 0 && s.len == 11, "Pieces are added in order");
+
+	/* grows in place while it is the last thing in the arena */
+	buf = np_str_string(&s);
+	for (i = 0; i < 100; i++)
+		np_str_printf(&s, " /mnt/%d", i);
+	ok(np_str_string(&s) == buf, "The last string grows in place");
+
+	/* and is copied when something else came after it */
+	np_str_puts(&t, "other");
+	np_str_puts(&s, " /end of the list of mounts");
+	ok(np_str_string(&s) != buf && strncmp(np_str_string(&s), "DISK / 84%; /mnt/0 /mnt/1 ", 26) == 0 &&
+	   strcmp(np_str_string(&s) + s.len - 35, " /mnt/99 /end of the list of mounts") == 0,
+	   "Moved string keeps what it had");
+	ok(strcmp(np_str_string(&t), "other") == 0, "Two strings built side by side");
+
+	/* more than a chunk at once */
+	big = malloc(100000);
+	memset(big, 'x', 99999);
+	big[99999] = '\0';
+	np_str_printf(&t, "%s", big);
+	ok(t.len == 100004 && np_str_string(&t)[100003] == 'x' && np_str_string(&t)[100004] == '\0',
+	   "Formatted string larger than a chunk");
+	right = 1;
+	for (i = 0; i < 2000; i++)
+		np_str_puts(&t, "0123456789");
+	for (i = 0; i < 2000; i++)
+		if (memcmp(np_str_string(&t) + 100004 + 10 * i, "0123456789", 10) != 0)
+			right = 0;
+	ok(right && t.len == 120004, "Long string built from many pieces");
+
+	np_arena_free();
+	s.buf = NULL; s.len = s.size = 0;
+	np_str_puts(&s, "again");
+	ok(strcmp(np_str_string(&s), "again") == 0, "The arena can be used again after np_arena_free");
+
+	return exit_status();
+}
@@ -0,0 +1,510 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_cmd.h"
+#include "utils_disk.h"
+#include "utils_tcp.h"
+#include "utils_json.h"
+#include "utils_num.h"
+#include "utils_ps.h"
+#include "parse_ini.h"
+#include "extra_opts.h"
+#include "tap.h"
+#include <sys/time.h>
+#include <utime.h>
+
+/* Calls of each parser in the benchmark, NP_BENCH_ITERATIONS overrides it.
+ * The ini file has BENCH_STANZAS stanzas, the file for the line splitter
+ * BENCH_LINES lines. The fuzz pass feeds FUZZ_INPUTS random inputs to
+ * each parser, NP_FUZZ_INPUTS and NP_FUZZ_SEED override it and the seed. */
+#define BENCH_ITERATIONS 20000
+#define BENCH_STANZAS 5000
+#define BENCH_MOUNTS 1000
+#define BENCH_LINES 20000
+#define FUZZ_INPUTS 20000
+#define FUZZ_MAXLEN 64
+
+/* glibc lets a program count the allocations of everything it runs,
+ * the library's and libc's own, by taking over malloc() */
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t);
+extern void *__libc_calloc (size_t, size_t);
+extern void *__libc_realloc (void *, size_t);
+static unsigned long allocations = 0;
+#undef malloc
+#undef calloc
+#undef realloc
+void *malloc (size_t size) { allocations++; return __libc_malloc (size); }
+void *calloc (size_t n, size_t size) { allocations++; return __libc_calloc (n, size); }
+void *realloc (void *p, size_t size) { allocations++; return __libc_realloc (p, size); }
+#define COUNTS_ALLOCATIONS 1
+#endif
+
+static unsigned long iterations = BENCH_ITERATIONS;
+
+static double
+now_ns (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec * 1.0e9 + tv.tv_usec * 1.0e3;
+}
+
+typedef struct bench {
+	double start;
+	unsigned long allocations;
+} bench;
+
+static void
+bench_start (bench *b)
+{
+#ifdef COUNTS_ALLOCATIONS
+	b->allocations = allocations;
+#endif
+	b->start = now_ns ();
+}
+
+static void
+bench_end (bench *b, const char *name, unsigned long ops)
+{
+	double ns = (now_ns () - b->start) / ops;
+
+#ifdef COUNTS_ALLOCATIONS
+	diag ("%-24s %12.0f ns/op %10.1f allocs/op", name, ns,
+	      (double) (allocations - b->allocations) / ops);
+#else
+	diag ("%-24s %12.0f ns/op", name, ns);
+#endif
+}
+
+static void
+free_thresholds (thresholds *t)
+{
+	if (t == NULL)
+		return;
+	free (t->warning);
+	free (t->critical);
+	free (t);
+}
+
+static void
+free_arg_list (np_arg_list *l)
+{
+	np_arg_list *next;
+
+	for (; l; l = next) {
+		next = l->next;
+		free (l->arg);
+		free (l);
+	}
+}
+
+/* the options from the ini file come right after argv[0] */
+static void
+free_extra_opts (int argc, char **newargv)
+{
+	int i;
+
+	for (i = 1; i < argc; i++)
+		free (newargv[i]);
+	free (newargv);
+}
+
+static void
+bench_ini (const char *dir)
+{
+	char *ini = NULL, *locator = NULL, *option = NULL, *args[3], **newargv;
+	np_arg_list *opts, *o;
+	unsigned long i, runs = iterations / 10 ? iterations / 10 : 1;
+	int argc, count = 0;
+	struct utimbuf times;
+	bench b;
+	FILE *fp;
+
+	asprintf (&ini, "%s/bench.ini", dir);
+	if ((fp = fopen (ini, "w")) == NULL) {
+		ok (0, "Wrote the benchmark ini file");
+		return;
+	}
+	for (i = 0; i < BENCH_STANZAS; i++)
+		fprintf (fp, "[check_%lu]\n; stanza %lu\nwarning=%lu\ncritical=%lu\nhostname = host%lu.example.com\nverbose=\n\n",
+		         i, i, i, 2 * i, i);
+	fclose (fp);
+
+	/* the last stanza, a parser reading the whole file finds it last. The
+	 * index of a file changed within the second is not kept, so this reads
+	 * all of it every time. */
+	asprintf (&locator, "check_%d@%s", BENCH_STANZAS - 1, ini);
+	bench_start (&b);
+	for (i = 0; i < runs / 100 + 1; i++)
+		free_arg_list (np_get_defaults (locator, "bench"));
+	bench_end (&b, "np_get_defaults, parsed", runs / 100 + 1);
+
+	/* and from here on its stanza index is used */
+	times.actime = times.modtime = time (NULL) - 60;
+	utime (ini, &times);
+	free_arg_list (np_get_defaults (locator, "bench"));
+	bench_start (&b);
+	for (i = 0; i < runs; i++) {
+		opts = np_get_defaults (locator, "bench");
+		if (i == 0)
+			for (count = 0, o = opts; o; o = o->next)
+				count++;
+		free_arg_list (opts);
+	}
+	bench_end (&b, "np_get_defaults, indexed", runs);
+	ok (count == 4, "np_get_defaults found the last of %d stanzas", BENCH_STANZAS);
+
+	asprintf (&option, "--extra-opts=%s", locator);
+	bench_start (&b);
+	for (i = 0; i < runs; i++) {
+		args[0] = "test_bench";
+		args[1] = option;
+		args[2] = NULL;
+		argc = 2;
+		newargv = np_extra_opts (&argc, args, "test_bench");
+		if (i == 0)
+			count = argc;
+		free_extra_opts (argc, newargv);
+	}
+	bench_end (&b, "np_extra_opts", runs);
+	ok (count == 5, "np_extra_opts added the stanza's options");
+
+	unlink (ini);
+	free (ini);
+	free (locator);
+	free (option);
+}
+
+static void
+bench_parsers (void)
+{
+	char *expect[] = { "220", "ESMTP", "Postfix" };
+	char *varlist = "version=\"ntpd 4.2.8p15\", processor=\"x86_64\", system=\"Linux/6.1.0\", "
+	                "leap=00, stratum=2, precision=-23, rootdelay=1.234, rootdisp=5.678, "
+	                "refid=192.0.2.1, offset=0.123, frequency=-12.345, sys_jitter=0.045, jitter=0.012";
+	thresholds *t = NULL;
+	char *s;
+	unsigned long i;
+	int good = TRUE;
+	bench b;
+
+	bench_start (&b);
+	for (i = 0; i < iterations; i++) {
+		if (_set_thresholds (&t, "10:20", "@~:50") != 0)
+			good = FALSE;
+		free_thresholds (t);
+	}
+	bench_end (&b, "_set_thresholds", iterations);
+	ok (good, "_set_thresholds parsed every time");
+
+	bench_start (&b);
+	for (i = 0; i < iterations; i++)
+		if (np_expect_match ("220 mail.example.com ESMTP Postfix (Debian/GNU)", expect, 3, NP_MATCH_ALL) != NP_MATCH_SUCCESS)
+			good = FALSE;
+	bench_end (&b, "np_expect_match", iterations);
+	ok (good, "np_expect_match matched every time");
+
+	bench_start (&b);
+	for (i = 0; i < iterations; i++) {
+		s = np_escaped_string ("GET /index.html HTTP/1.1\\r\\nHost: www.example.com\\r\\nConnection: close\\r\\n\\r\\n");
+		if (strchr (s, '\\') != NULL || strchr (s, '\r') == NULL)
+			good = FALSE;
+		free (s);
+	}
+	bench_end (&b, "np_escaped_string", iterations);
+	ok (good, "np_escaped_string unescaped every time");
+
+	bench_start (&b);
+	for (i = 0; i < iterations; i++) {
+		s = np_extract_value (varlist, "jitter", ',');
+		if (s == NULL || strcmp (s, "0.012"))
+			good = FALSE;
+		free (s);
+	}
+	bench_end (&b, "np_extract_value", iterations);
+	ok (good, "np_extract_value found the last value every time");
+}
+
+/* The lines the plugins take numbers from, sscanf() and strtod() against
+ * the parsers of utils_num */
+static void
+bench_numbers (void)
+{
+	const char *stat = "S 1 1234 1234 0 -1 4194560 1523 0 12 0 2345 678 0 0 20 0 4 0 98765 123456789 4321 "
+	                   "18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0";
+	const char *mrtg = "1700000000 12345 67890 23456 78901";
+	const char *values[] = { "8388604 kB", "123.456", "-0.5", "98.6", "1.5e3", "42" };
+	int nvalues = sizeof (values) / sizeof (values[0]);
+	unsigned long i, utime, stime, vsize, mrtg_c[5];
+	unsigned long long starttime;
+	long long f[NP_STAT_FIELDS > 5 ? NP_STAT_FIELDS : 5];
+	long nice, nlwp, rss;
+	int ppid, pgrp, session, tpgid, good = TRUE;
+	double scanf_ns, num_ns, sum_c = 0, sum_np = 0;
+	char state;
+	bench b;
+
+	bench_start (&b);
+	for (i = 0; i < iterations; i++)
+		if (sscanf (stat, "%c %d %d %d %*d %d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %ld %ld %*d %llu %lu %ld",
+		            &state, &ppid, &pgrp, &session, &tpgid, &utime, &stime, &nice, &nlwp, &starttime,
+		            &vsize, &rss) != 12)
+			good = FALSE;
+	scanf_ns = now_ns () - b.start;
+	bench_end (&b, "sscanf /proc stat", iterations);
+	bench_start (&b);
+	for (i = 0; i < iterations; i++)
+		if (np_strtoll_fields (stat + 1, f, NP_STAT_FIELDS, NULL) != NP_STAT_FIELDS)
+			good = FALSE;
+	num_ns = now_ns () - b.start;
+	bench_end (&b, "np_strtoll_fields stat", iterations);
+	diag ("%-24s %12.1fx", "speedup", scanf_ns / num_ns);
+	ok (good && f[NP_STAT_PPID] == ppid && f[NP_STAT_TPGID] == tpgid && (unsigned long) f[NP_STAT_UTIME] == utime &&
+	    f[NP_STAT_NICE] == nice && (unsigned long long) f[NP_STAT_STARTTIME] == starttime &&
+	    f[NP_STAT_RSS] == rss, "np_strtoll_fields reads a /proc stat line as sscanf() does");
+
+	bench_start (&b);
+	for (i = 0; i < iterations; i++)
+		if (sscanf (mrtg, "%lu %lu %lu %lu %lu", &mrtg_c[0], &mrtg_c[1], &mrtg_c[2], &mrtg_c[3], &mrtg_c[4]) != 5)
+			good = FALSE;
+	scanf_ns = now_ns () - b.start;
+	bench_end (&b, "sscanf mrtg log", iterations);
+	bench_start (&b);
+	for (i = 0; i < iterations; i++)
+		if (np_strtoll_fields (mrtg, f, 5, NULL) != 5)
+			good = FALSE;
+	num_ns = now_ns () - b.start;
+	bench_end (&b, "np_strtoll_fields mrtg", iterations);
+	diag ("%-24s %12.1fx", "speedup", scanf_ns / num_ns);
+	ok (good && (unsigned long) f[0] == mrtg_c[0] && (unsigned long) f[4] == mrtg_c[4],
+	    "np_strtoll_fields reads an mrtg log line as sscanf() does");
+
+	bench_start (&b);
+	for (i = 0; i < iterations; i++)
+		sum_c += strtod (values[i % nvalues], NULL);
+	scanf_ns = now_ns () - b.start;
+	bench_end (&b, "strtod", iterations);
+	bench_start (&b);
+	for (i = 0; i < iterations; i++)
+		sum_np += np_strtod (values[i % nvalues], NULL);
+	num_ns = now_ns () - b.start;
+	bench_end (&b, "np_strtod", iterations);
+	diag ("%-24s %12.1fx", "speedup", scanf_ns / num_ns);
+	ok (sum_c == sum_np, "np_strtod reads meminfo and snmpget values as strtod() does");
+}
+
+static void
+bench_best_match (void)
+{
+	struct mount_entry *mount_list = NULL, **mtail = &mount_list, *me;
+	struct parameter_list *paths = NULL, *p;
+	char buf[MAX_INPUT_BUFFER];
+	unsigned long i, runs = iterations / 100 ? iterations / 100 : 1;
+	int good = TRUE;
+	bench b;
+
+	for (i = 0; i < BENCH_MOUNTS; i++) {
+		me = (struct mount_entry *) calloc (1, sizeof *me);
+		snprintf (buf, sizeof (buf), "server%lu:/export/vol%lu", i % 97, i);
+		me->me_devname = strdup (buf);
+		snprintf (buf, sizeof (buf), i ? "/net/host%lu/vol%lu" : "/", i / 10, i);
+		me->me_mountdir = strdup (buf);
+		*mtail = me;
+		mtail = &me->me_next;
+	}
+	for (i = 0; i < 100; i++) {
+		snprintf (buf, sizeof (buf), "/net/host%lu/vol%lu/data", i, i * 10);
+		np_add_parameter (&paths, strdup (buf));
+	}
+
+	bench_start (&b);
+	for (i = 0; i < runs; i++) {
+		for (p = paths; p; p = p->name_next)
+			p->best_match = NULL;
+		np_set_best_match (paths, mount_list, FALSE);
+	}
+	bench_end (&b, "np_set_best_match", runs);
+	for (p = paths; p; p = p->name_next)
+		if (p->best_match == NULL || strncmp (p->name, p->best_match->me_mountdir, strlen (p->best_match->me_mountdir)))
+			good = FALSE;
+	ok (good, "np_set_best_match matched %d paths against %d mounts", 100, BENCH_MOUNTS);
+}
+
+static void
+bench_lines (const char *dir)
+{
+	char *file = NULL;
+	unsigned long i, runs = iterations / 1000 ? iterations / 1000 : 1;
+	output out;
+	int lines = 0;
+	bench b;
+	FILE *fp;
+
+	asprintf (&file, "%s/bench.out", dir);
+	if ((fp = fopen (file, "w")) == NULL) {
+		ok (0, "Wrote the benchmark output file");
+		return;
+	}
+	for (i = 0; i < BENCH_LINES; i++)
+		fprintf (fp, "%5lu root      20   0  168352  13020   8400 S   0.0   0.1   0:%02lu.%02lu systemd\n",
+		         i, i % 60, i % 100);
+	fclose (fp);
+
+	bench_start (&b);
+	for (i = 0; i < runs; i++) {
+		cmd_file_read (file, &out, 0);
+		lines = out.lines;
+		free (out.buf);
+		free (out.line);
+		free (out.lens);
+	}
+	bench_end (&b, "cmd_fetch_output", runs);
+	ok (lines == BENCH_LINES, "cmd_fetch_output split %d lines", BENCH_LINES);
+
+	unlink (file);
+	free (file);
+}
+
+/* A random string of up to FUZZ_MAXLEN characters from the alphabet,
+ * or of any bytes but '\0' without one */
+static void
+fuzz_string (char *buf, const char *alphabet)
+{
+	size_t len = rand () % (FUZZ_MAXLEN + 1), n = alphabet ? strlen (alphabet) : 0, i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = n ? alphabet[rand () % n] : 1 + rand () % 255;
+	buf[len] = '\0';
+}
+
+static void
+fuzz_parsers (unsigned long inputs)
+{
+	char *expect[] = { "220", "OK", "" };
+	char *paths[] = { "a", "a.b", "a[1]", "$" };
+	char w[FUZZ_MAXLEN + 1], c[FUZZ_MAXLEN + 1], *s;
+	thresholds *t;
+	np_json *whole, *bytes;
+	unsigned long i;
+	size_t j;
+	int bad_range = 0, bad_escape = 0, bad_value = 0, bad_match = 0, bad_json = 0, r;
+
+	whole = np_json_new (paths, 4);
+	bytes = np_json_new (paths, 4);
+
+	for (i = 0; i < inputs; i++) {
+		/* a parsed range is one a value can be in */
+		fuzz_string (w, "0123456789.:~@-e ");
+		fuzz_string (c, i % 2 ? "0123456789.:~@-e " : NULL);
+		t = NULL;
+		if (_set_thresholds (&t, w, c) == 0) {
+			if ((!t->warning->start_infinity && !t->warning->end_infinity &&
+			     t->warning->start > t->warning->end) ||
+			    (!t->critical->start_infinity && !t->critical->end_infinity &&
+			     t->critical->start > t->critical->end))
+				bad_range++;
+			free_thresholds (t);
+		}
+
+		fuzz_string (w, i % 2 ? "\\nrt ab" : NULL);
+		s = np_escaped_string (w);
+		if (strlen (s) > strlen (w))
+			bad_escape++;
+		free (s);
+
+		fuzz_string (w, i % 2 ? "ab =,\" " : NULL);
+		if ((s = np_extract_value (w, "a", ',')) != NULL) {
+			if (*s == '\0' || strchr (s, ',') != NULL)
+				bad_value++;
+			free (s);
+		}
+
+		fuzz_string (w, i % 2 ? "220 OK" : NULL);
+		r = np_expect_match (w, expect, 1 + i % 3, (i % 2 ? NP_MATCH_ALL : 0) | (i % 3 ? NP_MATCH_EXACT : 0));
+		if (r != NP_MATCH_SUCCESS && r != NP_MATCH_FAILURE && r != NP_MATCH_RETRY)
+			bad_match++;
+
+		/* the parser must not care how the document is cut up */
+		fuzz_string (w, i % 2 ? "{}[]\":,ab1.e-tru \\" : NULL);
+		np_json_reset (whole);
+		np_json_reset (bytes);
+		np_json_feed (whole, w, strlen (w));
+		for (j = 0; w[j]; j++)
+			np_json_feed (bytes, w + j, 1);
+		if (np_json_end (whole) != np_json_end (bytes) || whole->error != bytes->error)
+			bad_json++;
+		for (j = 0; j < 4; j++)
+			if (whole->type[j] != bytes->type[j] || !whole->value[j] != !bytes->value[j] ||
+			    (whole->value[j] && strcmp (whole->value[j], bytes->value[j])))
+				bad_json++;
+	}
+
+	ok (bad_range == 0, "_set_thresholds: %lu random ranges", inputs);
+	ok (bad_escape == 0, "np_escaped_string: %lu random strings", inputs);
+	ok (bad_value == 0, "np_extract_value: %lu random lists", inputs);
+	ok (bad_match == 0, "np_expect_match: %lu random status lines", inputs);
+	ok (bad_json == 0, "np_json_feed: %lu random documents in one piece and byte by byte", inputs);
+
+	np_json_free (whole);
+	np_json_free (bytes);
+}
+
+int
+main (int argc, char **argv)
+{
+	char dir[] = "/tmp/test_bench.XXXXXX";
+	unsigned long inputs = FUZZ_INPUTS;
+	unsigned int seed = (unsigned int) time (NULL);
+	char *env;
+
+	plan_tests(16);
+
+	if ((env = getenv ("NP_BENCH_ITERATIONS")) != NULL && strtoul (env, NULL, 10) > 0)
+		iterations = strtoul (env, NULL, 10);
+	if ((env = getenv ("NP_FUZZ_INPUTS")) != NULL)
+		inputs = strtoul (env, NULL, 10);
+	if ((env = getenv ("NP_FUZZ_SEED")) != NULL)
+		seed = (unsigned int) strtoul (env, NULL, 10);
+
+	/* keep the stanza index out of the real state directory */
+	if (mkdtemp (dir) == NULL)
+		return 1;
+	setenv ("MP_STATE_PATH", dir, 1);
+	cmd_init ();
+
+	diag ("%lu iterations", iterations);
+	bench_ini (dir);
+	bench_parsers ();
+	bench_numbers ();
+	bench_best_match ();
+	bench_lines (dir);
+
+	diag ("fuzzing with NP_FUZZ_SEED=%u", seed);
+	srand (seed);
+	fuzz_parsers (inputs);
+
+	asprintf (&env, "rm -rf %s", dir);
+	system (env);
+	free (env);
+
+	return exit_status ();
+}
@@ -24,6 +24,36 @@
 #define COMMAND_LINE 1024
 #define UNSET 65530
 
+/* what the cmd_run_array_lines() callback saw */
+struct lines_seen {
+	int count;
+	char *first;
+	char *last;
+	struct timeval first_time;
+};
+
+static int
+count_line (char *line, void *data)
+{
+	struct lines_seen *seen = data;
+
+	if (seen->count++ == 0) {
+		seen->first = strdup (line);
+		gettimeofday (&seen->first_time, NULL);
+	}
+	free (seen->last);
+	seen->last = strdup (line);
+	return 0;
+}
+
+/* enough after the line "stop" */
+static int
+stop_line (char *line, void *data)
+{
+	count_line (line, data);
+	return strcmp (line, "stop") == 0;
+}
+
 char *
 get_command (char *const *line)
 {
@@ -49,7 +79,7 @@ main (int argc, char **argv)
 	int c;
 	int result = UNSET;
 
-	plan_tests(51);
+	plan_tests(87);
 
 	diag ("Running plain echo command, set one");
 
@@ -229,5 +259,172 @@ main (int argc, char **argv)
 	ok (result == 3, "Get return code 3 = UNKNOWN when command does not exist");
 
 
+	diag ("Output larger than the initial buffer");
+
+	/* 3000 lines of 8 or 9 bytes, so lines straddle the buffer growth */
+	command = (char *)malloc(COMMAND_LINE);
+	strcpy(command, "/bin/sh -c 'i=0; while [ $i -lt 3000 ]; do echo line$i; i=$((i+1)); done'");
+	result = cmd_run (command, &chld_out, NULL, 0);
+	ok (result == 0, "Big output: exit code 0");
+	ok (chld_out.lines == 3000, "Big output: 3000 lines");
+	ok (strcmp (chld_out.line[0], "line0") == 0 && chld_out.lens[0] == 5, "Big output: first line");
+	ok (strcmp (chld_out.line[2999], "line2999") == 0 && chld_out.lens[2999] == 8, "Big output: last line");
+
+	result = cmd_run (command, &chld_out, NULL, CMD_NO_ARRAYS);
+	ok (chld_out.line == NULL, "CMD_NO_ARRAYS: no line index");
+	ok (chld_out.buf[chld_out.buflen] == '\0', "CMD_NO_ARRAYS: buffer is terminated");
+	{
+		size_t pos = 0, len, n = 0, last = 0;
+		char *line;
+		while ((line = cmd_next_line (&chld_out, &pos, &len)) != NULL) {
+			n++;
+			last = len;
+		}
+		ok (n == 3000 && last == 8, "cmd_next_line walks all 3000 lines");
+	}
+
+	result = cmd_run (command, &chld_out, NULL, CMD_NO_ASSOC);
+	ok (chld_out.lines == 3000 && strcmp (chld_out.line[1234], "line1234") == 0,
+			"CMD_NO_ASSOC: lines are indexed");
+	ok (chld_out.buf[5] == '\n', "CMD_NO_ASSOC: buffer keeps its newlines");
+
+
+	diag ("Lines handed over while the command runs");
+	{
+		struct lines_seen seen;
+		struct timeval end;
+
+		memset (&seen, 0, sizeof (seen));
+		command_line[0] = strdup ("/bin/sh");
+		command_line[1] = strdup ("-c");
+		command_line[2] = strdup ("i=0; while [ $i -lt 3000 ]; do echo line$i; i=$((i+1)); done; sleep 1; printf last; echo oops >&2; exit 2");
+		command_line[3] = NULL;
+		result = cmd_run_array_lines (command_line, count_line, &seen, &chld_err, 0);
+		gettimeofday (&end, NULL);
+		ok (result == 2, "cmd_run_array_lines: exit code 2");
+		ok (seen.count == 3001, "cmd_run_array_lines: 3001 lines");
+		ok (seen.first && strcmp (seen.first, "line0") == 0, "cmd_run_array_lines: first line");
+		ok (seen.last && strcmp (seen.last, "last") == 0, "cmd_run_array_lines: unterminated last line");
+		ok (chld_err.lines == 1, "cmd_run_array_lines: stderr collected");
+		ok ((end.tv_sec - seen.first_time.tv_sec) * 1000 + (end.tv_usec - seen.first_time.tv_usec) / 1000 >= 900,
+		    "cmd_run_array_lines: first line came before the command ended");
+
+		/* what comes after "stop" is neither read nor waited for */
+		memset (&seen, 0, sizeof (seen));
+		command_line[2] = strdup ("echo one; echo stop; echo two; echo err >&2; sleep 5; echo three");
+		gettimeofday (&seen.first_time, NULL);
+		result = cmd_run_array_lines (command_line, stop_line, &seen, &chld_err, 0);
+		gettimeofday (&end, NULL);
+		ok (result == CMD_STOPPED, "cmd_run_array_lines: CMD_STOPPED when on_line had enough");
+		ok (seen.count == 2 && strcmp (seen.last, "stop") == 0, "cmd_run_array_lines: no lines after that");
+		ok ((end.tv_sec - seen.first_time.tv_sec) * 1000 + (end.tv_usec - seen.first_time.tv_usec) / 1000 < 2000,
+		    "cmd_run_array_lines: the command was killed");
+
+		/* more on stderr than the pipe holds, before any line on stdout */
+		command_line[2] = strdup ("head -c 200000 /dev/zero >&2; echo done");
+		result = cmd_run_array_lines (command_line, count_line, &seen, &chld_err, CMD_NO_ARRAYS);
+		ok (result == 0 && chld_err.buflen == 200000, "cmd_run_array_lines: large stderr read along");
+	}
+
+
+	diag ("Deadlines");
+	{
+		struct timeval start, end;
+
+		command_line[0] = strdup ("/bin/sh");
+		command_line[1] = strdup ("-c");
+		command_line[2] = strdup ("echo x; sleep 5");
+		command_line[3] = NULL;
+		gettimeofday (&start, NULL);
+		result = cmd_run_array_deadline (command_line, &chld_out, &chld_err, 0, np_deadline (0.3));
+		gettimeofday (&end, NULL);
+		ok (result == CMD_TIMEOUT, "cmd_run_array_deadline: CMD_TIMEOUT for a slow command");
+		ok ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000 < 2000,
+		    "cmd_run_array_deadline: killed at the deadline");
+		ok (chld_out.lines == 1 && strcmp (chld_out.line[0], "x") == 0,
+		    "cmd_run_array_deadline: output up to the deadline kept");
+
+		/* more than the pipe holds on stderr, with stdout read first */
+		command_line[2] = strdup ("head -c 200000 /dev/zero >&2; echo done");
+		result = cmd_run_array_deadline (command_line, &chld_out, &chld_err, CMD_NO_ARRAYS, np_deadline (10));
+		ok (result == 0 && chld_err.buflen == 200000, "cmd_run_array_deadline: large stderr read");
+		result = cmd_run_array (command_line, &chld_out, NULL, 0);
+		ok (result == 0 && chld_out.lines == 1, "cmd_run_array: large stderr nobody asked for does not stall");
+	}
+
+
+	diag ("Commands side by side");
+	{
+		char *const slow_out[] = { "/bin/sh", "-c", "sleep 1; echo a", NULL };
+		char *const slow_err[] = { "/bin/sh", "-c", "sleep 1; echo b >&2; exit 3", NULL };
+		char *const hung[] = { "/bin/sh", "-c", "echo c; sleep 5", NULL };
+		char *const detached[] = { "/bin/sh", "-c", "(sleep 5 &); echo d", NULL };
+		char *const nap[] = { "/bin/sh", "-c", "sleep 0.4", NULL };
+		cmd_job jobs[4];
+		struct timeval start, end;
+		long ms;
+
+		memset (jobs, 0, sizeof (jobs));
+		jobs[0].argv = slow_out;
+		jobs[1].argv = slow_err;
+		jobs[2].argv = hung;
+		jobs[2].deadline = np_deadline (0.5);
+		jobs[3].argv = detached;
+		gettimeofday (&start, NULL);
+		result = cmd_run_many (jobs, 4, 0, 0);
+		gettimeofday (&end, NULL);
+		ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+		ok (result == 1, "cmd_run_many: one command killed at its deadline");
+		ok (jobs[0].result == 0 && jobs[0].out.lines == 1 && strcmp (jobs[0].out.line[0], "a") == 0,
+		    "cmd_run_many: stdout of each");
+		ok (jobs[1].result == 3 && jobs[1].out.lines == 0 && jobs[1].err.lines == 1 &&
+		    strcmp (jobs[1].err.line[0], "b") == 0, "cmd_run_many: stderr and exit status of each");
+		ok (jobs[2].result == CMD_TIMEOUT && jobs[2].out.lines == 1 && strcmp (jobs[2].out.line[0], "c") == 0,
+		    "cmd_run_many: CMD_TIMEOUT, and the output up to the deadline kept");
+		ok (jobs[3].result == 0 && jobs[3].out.lines == 1 && strcmp (jobs[3].out.line[0], "d") == 0,
+		    "cmd_run_many: a command leaving something in the background");
+#ifdef __linux__
+		ok (ms < 2000, "cmd_run_many: all at the same time, done when they exit (%ld ms)", ms);
+#else
+		skip (1, "pidfds are only on Linux");
+#endif
+
+		memset (jobs, 0, sizeof (jobs));
+		for (c = 0; c < 4; c++)
+			jobs[c].argv = nap;
+		gettimeofday (&start, NULL);
+		cmd_run_many (jobs, 4, 2, 0);
+		gettimeofday (&end, NULL);
+		ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+		ok (ms >= 800 && ms < 1500 && jobs[3].result == 0, "cmd_run_many: two at a time (%ld ms)", ms);
+	}
+
+
+	diag ("The table of children");
+	{
+		cmd_children children;
+		int fd, found = 0;
+
+		memset (&children, 0, sizeof (children));
+		/* far more than the first table holds, and far apart */
+		for (fd = 3; fd < 3 + 100 * 997; fd += 997)
+			cmd_child_add (&children, fd, fd + 1, fd + 10000000);
+		ok (children.count == 100 && children.size < 1024, "cmd_child_add: the table grows with the children");
+		for (fd = 3; fd < 3 + 100 * 997; fd += 997)
+			if (cmd_child_find (&children, fd) && cmd_child_find (&children, fd)->pid == fd + 10000000)
+				found++;
+		ok (found == 100, "cmd_child_find: every child found");
+		ok (cmd_child_find (&children, 4) == NULL, "cmd_child_find: not a child");
+		for (fd = 3; fd < 3 + 50 * 997; fd += 997)
+			cmd_child_remove (&children, fd);
+		for (found = 0; fd < 3 + 100 * 997; fd += 997)
+			if (cmd_child_find (&children, fd) && cmd_child_find (&children, fd)->err_fd == fd + 1)
+				found++;
+		ok (children.count == 50 && found == 50, "cmd_child_remove: the others are still found");
+		ok (cmd_child_remove (&children, 3) == 0, "cmd_child_remove: 0 for what was removed");
+		free (children.slot);
+	}
+
+
 	return exit_status ();
 }
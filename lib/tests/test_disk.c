@@ -20,10 +20,17 @@
 #include "utils_disk.h"
 #include "tap.h"
 #include "regex.h"
+#include <sys/time.h>
+
+/* Size of the synthetic mount list and path selection of the benchmark.
+ * NP_DISK_BENCH_MOUNTS overrides it. */
+#define BENCH_MOUNTS 10000
 
 void np_test_mount_entry_regex (struct mount_entry *dummy_mount_list,
 	       			char *regstr, int cflags, int expect,
 			       	char *desc);
+void np_test_best_match_bench (size_t mounts);
+void np_test_disk_table_bench (size_t mounts);
 
 
 int
@@ -42,7 +49,7 @@ main (int argc, char **argv)
 	int cflags = REG_NOSUB | REG_EXTENDED;
 	int found = 0, count = 0;
 
-	plan_tests(33);
+	plan_tests(49);
 
 	ok( np_find_name(exclude_filesystem, "/var/log") == FALSE, "/var/log not in list");
 	np_add_name(&exclude_filesystem, "/var/log");
@@ -198,6 +205,55 @@ main (int argc, char **argv)
 	ok(found == 0, "last (/home) element successfully deleted");
 	ok(count == 2, "two elements remaining");
 
+	/* a mount over another one hides it */
+	me = (struct mount_entry *) calloc(1, sizeof *me);
+	me->me_devname = strdup("/dev/c3t0d0s0");
+	me->me_mountdir = strdup("/var");
+	*mtail = me;
+	mtail = &me->me_next;
+	paths = NULL;
+	np_add_parameter(&paths, "/var/tmp");
+	np_add_parameter(&paths, "/");
+	np_set_best_match(paths, dummy_mount_list, FALSE);
+	ok( paths->best_match && !strcmp(paths->best_match->me_devname, "/dev/c3t0d0s0"), "/var/tmp got the last mount on /var");
+	ok( paths->name_next->best_match && !strcmp(paths->name_next->best_match->me_mountdir, "/"), "/ got right best match: /");
+
+	/* the mount list survives a trip through the state file */
+	me = (struct mount_entry *) calloc(1, sizeof *me);
+	me->me_devname = strdup("//server/share name");
+	me->me_mountdir = strdup("/mnt/with\\back slash");
+	me->me_type = strdup("cifs");
+	me->me_dev = 42;
+	me->me_remote = 1;
+	me->me_next = (struct mount_entry *) calloc(1, sizeof *me);
+	me->me_next->me_devname = strdup("");
+	me->me_next->me_mountdir = strdup("/proc");
+	me->me_next->me_type = strdup("proc");
+	me->me_next->me_dummy = 1;
+	{
+		char *text = np_mount_list_to_string(me);
+		const char *rest;
+		struct mount_entry *copy;
+
+		ok( strchr(text, '\n') == NULL && !strncmp(text, "2 //server/share\\040name ", 25), "Mount list is one line of words" );
+		rest = text;
+		ok( np_mount_list_from_string(&rest, &copy) && *rest == '\0', "Mount list read back" );
+		ok( copy && !strcmp(copy->me_devname, me->me_devname) && !strcmp(copy->me_mountdir, me->me_mountdir)
+		    && !strcmp(copy->me_type, "cifs") && copy->me_dev == 42 && copy->me_remote && !copy->me_dummy,
+		    "First entry read back as written" );
+		ok( copy && copy->me_next && !strcmp(copy->me_next->me_devname, "") && copy->me_next->me_dummy
+		    && !copy->me_next->me_remote && copy->me_next->me_next == NULL, "Second entry read back as written" );
+		rest = "3 /dev/sda / ext4 0 0";
+		ok( np_mount_list_from_string(&rest, &copy) == FALSE && copy == NULL, "Short mount list is refused" );
+		rest = "x";
+		ok( np_mount_list_from_string(&rest, &copy) == FALSE, "Garbage is refused" );
+	}
+
+	np_test_best_match_bench (getenv ("NP_DISK_BENCH_MOUNTS") ?
+	                          strtoul (getenv ("NP_DISK_BENCH_MOUNTS"), NULL, 10) : BENCH_MOUNTS);
+	np_test_disk_table_bench (getenv ("NP_DISK_BENCH_MOUNTS") ?
+	                          strtoul (getenv ("NP_DISK_BENCH_MOUNTS"), NULL, 10) : BENCH_MOUNTS);
+
 
 	return exit_status();
 }
@@ -207,9 +263,9 @@ void
 np_test_mount_entry_regex (struct mount_entry *dummy_mount_list, char *regstr, int cflags, int expect, char *desc)
 {	
 	int matches = 0;
-	regex_t re;
+	np_regex_t re;
 	struct mount_entry *me;
-	if (regcomp(&re,regstr, cflags) == 0) {
+	if (np_regcomp(&re,regstr, cflags) == 0) {
 		for (me = dummy_mount_list; me; me= me->me_next) {
 			if(np_regex_match_mount_entry(me,&re))
 				matches++;
@@ -222,3 +278,214 @@ np_test_mount_entry_regex (struct mount_entry *dummy_mount_list, char *regstr, i
 		ok ( false, "regex '%s' not compilable", regstr);
 }
 
+/* np_set_best_match as it was before the mount list got indexed: every
+ * path against every mount */
+static struct mount_entry *
+linear_best_match (const char *name, struct mount_entry *mount_list, int exact)
+{
+	struct mount_entry *me, *best_match = NULL;
+	size_t name_len = strlen (name), best_match_len = 0, len;
+
+	for (me = mount_list; me; me = me->me_next)
+		if (strcmp (me->me_devname, name) == 0)
+			best_match = me;
+	if (best_match)
+		return best_match;
+	for (me = mount_list; me; me = me->me_next) {
+		len = strlen (me->me_mountdir);
+		if ((exact == FALSE && (best_match_len <= len && len <= name_len &&
+		     (len == 1 || strncmp (me->me_mountdir, name, len) == 0)))
+		    || (exact == TRUE && strcmp (me->me_mountdir, name) == 0)) {
+			best_match = me;
+			best_match_len = len;
+		}
+	}
+	return best_match;
+}
+
+static double
+elapsed_ms (struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday (&end, NULL);
+	return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* an autofs-like host: a few hundred exports with mounts below them, and a
+ * -p for something inside nearly every mount */
+void
+np_test_best_match_bench (size_t mounts)
+{
+	struct mount_entry *mount_list = NULL, **mtail = &mount_list, *me;
+	struct parameter_list *paths = NULL, *p;
+	struct name_hash seen = { NULL, 0, 0 };
+	struct timeval start;
+	char buf[MAX_INPUT_BUFFER];
+	double t_index, t_linear, t_seen;
+	size_t i, wrong = 0, missing = 0;
+	int exact;
+
+	for (i = 0; i < mounts; i++) {
+		me = (struct mount_entry *) calloc (1, sizeof *me);
+		snprintf (buf, sizeof (buf), "server%lu:/export/vol%lu", (unsigned long) (i % 97), (unsigned long) i);
+		me->me_devname = strdup (buf);
+		if (i == 0)
+			snprintf (buf, sizeof (buf), "/");
+		else if (i % 10 == 1)
+			snprintf (buf, sizeof (buf), "/net/host%lu", (unsigned long) (i / 10));
+		else
+			snprintf (buf, sizeof (buf), "/net/host%lu/vol%lu", (unsigned long) (i / 10), (unsigned long) i);
+		me->me_mountdir = strdup (buf);
+		*mtail = me;
+		mtail = &me->me_next;
+	}
+
+	for (i = 0; i < mounts; i++) {
+		if (i % 3 == 0)
+			snprintf (buf, sizeof (buf), "/net/host%lu/vol%lu/data/file", (unsigned long) (i / 10), (unsigned long) i);
+		else if (i % 3 == 1)
+			snprintf (buf, sizeof (buf), "/net/host%lu/other", (unsigned long) (i / 10));
+		else
+			snprintf (buf, sizeof (buf), "server%lu:/export/vol%lu", (unsigned long) (i % 97), (unsigned long) i);
+		np_add_parameter (&paths, strdup (buf));
+	}
+
+	for (exact = FALSE; exact <= TRUE; exact++) {
+		for (p = paths; p; p = p->name_next)
+			p->best_match = NULL;
+		gettimeofday (&start, NULL);
+		np_set_best_match (paths, mount_list, exact);
+		t_index = elapsed_ms (&start);
+
+		gettimeofday (&start, NULL);
+		for (p = paths; p; p = p->name_next) {
+			me = linear_best_match (p->name, mount_list, exact);
+			if (p->best_match != me)
+				wrong++;
+			if (me == NULL)
+				missing++;
+		}
+		t_linear = elapsed_ms (&start);
+
+		ok (wrong == 0, "%s best match of %lu paths against %lu mounts agrees with the linear search",
+		    exact ? "exact" : "prefix", (unsigned long) mounts, (unsigned long) mounts);
+		diag ("%s match: index %.1f ms, linear search %.1f ms (%lu paths without a match)",
+		      exact ? "exact" : "prefix", t_index, t_linear, (unsigned long) missing);
+		wrong = missing = 0;
+	}
+
+	gettimeofday (&start, NULL);
+	for (me = mount_list; me; me = me->me_next)
+		if (! np_seen_hashed_name (&seen, me->me_mountdir))
+			np_add_hashed_name (&seen, me->me_mountdir);
+	for (me = mount_list; me; me = me->me_next)
+		if (! np_seen_hashed_name (&seen, me->me_mountdir))
+			wrong++;
+	t_seen = elapsed_ms (&start);
+	ok (wrong == 0 && seen.count == mounts, "all %lu mount directories seen once", (unsigned long) mounts);
+	ok (np_seen_hashed_name (&seen, "/net/nosuchhost") == FALSE, "unknown directory not seen");
+	diag ("seen names: %.1f ms for %lu mounts", t_seen, (unsigned long) mounts);
+}
+
+/* the six get_status() calls check_disk made for every file system before
+ * the thresholds were held against a column at a time */
+static int
+scalar_disk_status (struct parameter_list *p)
+{
+	int state = STATE_OK, i;
+	int states[DISK_COLUMNS];
+
+	states[0] = get_status (p->dfree_units, p->freespace_units);
+	states[1] = get_status (p->dfree_pct, p->freespace_percent);
+	states[2] = get_status (p->dused_units, p->usedspace_units);
+	states[3] = get_status (p->dused_pct, p->usedspace_percent);
+	states[4] = get_status (p->dused_inodes_percent, p->usedinodes_percent);
+	states[5] = get_status (p->dfree_inodes_percent, p->freeinodes_percent);
+	for (i = 0; i < DISK_COLUMNS; i++)
+		if (states[i] == STATE_CRITICAL || (states[i] == STATE_WARNING && state == STATE_OK))
+			state = states[i];
+	return state;
+}
+
+/* -w/-c on the free space for all file systems, the used inodes of every
+ * seventh checked with @ ranges of its own, and a group-like row without
+ * any thresholds */
+void
+np_test_disk_table_bench (size_t mounts)
+{
+	struct disk_table table = DISK_TABLE_INIT;
+	struct parameter_list *paths = NULL, *p;
+	thresholds *none = NULL, *free_units = NULL, *free_pct = NULL, *inodes = NULL;
+	struct timeval start;
+	double t_stage, t_table, t_scalar;
+	unsigned long seed = 1;
+	size_t i, k, top, rows[10], wrong = 0;
+	int worst = STATE_OK, state, table_worst;
+	char buf[32];
+
+	set_thresholds (&none, NULL, NULL);
+	set_thresholds (&free_units, "1000:", "500:");
+	set_thresholds (&free_pct, "20:", "10:");
+	set_thresholds (&inodes, "@80:90", "@90:");
+
+	for (i = 0; i < mounts; i++) {
+		snprintf (buf, sizeof (buf), "/mnt/%lu", (unsigned long) i);
+		p = np_add_parameter (&paths, strdup (buf));
+		p->freespace_units = i == 0 ? none : free_units;
+		p->freespace_percent = i == 0 ? none : free_pct;
+		p->usedspace_units = p->usedspace_percent = p->freeinodes_percent = none;
+		p->usedinodes_percent = i % 7 == 0 ? inodes : none;
+		seed = seed * 1103515245 + 12345;
+		p->dtotal_units = 10000;
+		p->dfree_units = (seed >> 8) % 10001;
+		p->dused_units = p->dtotal_units - p->dfree_units;
+		p->dfree_pct = p->dfree_units / 100;
+		p->dused_pct = 100 - p->dfree_pct;
+		p->dused_inodes_percent = (seed >> 20) % 101;
+		p->dfree_inodes_percent = 100 - p->dused_inodes_percent;
+	}
+
+	gettimeofday (&start, NULL);
+	for (p = paths; p; p = p->name_next)
+		np_disk_table_add (&table, p);
+	t_stage = elapsed_ms (&start);
+	ok (table.count == mounts, "%lu file systems staged into the table", (unsigned long) table.count);
+
+	gettimeofday (&start, NULL);
+	table_worst = np_disk_table_evaluate (&table);
+	t_table = elapsed_ms (&start);
+
+	gettimeofday (&start, NULL);
+	for (i = 0, p = paths; p; p = p->name_next, i++) {
+		state = scalar_disk_status (p);
+		if (state != table.result[i])
+			wrong++;
+		if (state == STATE_CRITICAL || (state == STATE_WARNING && worst == STATE_OK))
+			worst = state;
+	}
+	t_scalar = elapsed_ms (&start);
+
+	ok (wrong == 0, "state of every file system agrees with get_status (%lu differ)", (unsigned long) wrong);
+	ok (table_worst == worst, "worst state of the table is %s", state_text (worst));
+
+	/* the ten worst, against every other row */
+	top = np_disk_table_worst (&table, 10, rows);
+	for (i = 1, wrong = 0; i < top; i++)
+		if (table.result[rows[i]] > table.result[rows[i - 1]] ||
+		    (table.result[rows[i]] == table.result[rows[i - 1]] &&
+		     table.column[DISK_FREE_PERCENT].value[rows[i]] < table.column[DISK_FREE_PERCENT].value[rows[i - 1]]))
+			wrong++;
+	for (i = 0; i < table.count && top; i++) {
+		for (k = 0; k < top && rows[k] != i; k++)
+			;
+		if (k == top && (table.result[i] > table.result[rows[top - 1]] ||
+		                 (table.result[i] == table.result[rows[top - 1]] &&
+		                  table.column[DISK_FREE_PERCENT].value[i] < table.column[DISK_FREE_PERCENT].value[rows[top - 1]])))
+			wrong++;
+	}
+	ok (top == (mounts < 10 ? mounts : 10) && wrong == 0, "the %lu worst file systems, worst first", (unsigned long) top);
+	diag ("thresholds of %lu file systems: staged in %.2f ms, by column %.2f ms, get_status per path %.2f ms",
+	      (unsigned long) mounts, t_stage, t_table, t_scalar);
+	np_disk_table_free (&table);
+}
@@ -0,0 +1,110 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_frame.h"
+#include <stdint.h>
+#include "tap.h"
+
+static uint64_t
+get_uint (const char **p, int bytes)
+{
+	uint64_t v = 0;
+
+	while (bytes--)
+		v = (v << 8) | (unsigned char) *(*p)++;
+	return v;
+}
+
+static double
+get_double (const char **p)
+{
+	uint64_t v = get_uint (p, 8);
+	double d;
+
+	memcpy (&d, &v, sizeof (d));
+	return d;
+}
+
+int
+main (void)
+{
+	char *output = "OK - 3 users |users=3;5;10;0\nfirst line\nsecond line|a=1\nb=2\n";
+	const char *p;
+	char *frame, *label;
+	range *warn;
+	size_t len;
+
+	plan_tests (16);
+
+	np_frame_point ("ignored", 1, "", NULL, NULL, FALSE, 0, FALSE, 0);
+	np_frame_collect (TRUE);
+	ok (np_frame_collecting (), "Collecting");
+	warn = parse_range_string ("@10:20");
+	np_frame_point ("users", 3, "", warn, NULL, TRUE, 0, FALSE, 0);
+	np_frame_point ("time", 0.25, "s", NULL, NULL, FALSE, 0, TRUE, 10);
+	frame = np_frame_result (STATE_WARNING, 1700000000.5, 0.125, output, strlen (output), &len);
+
+	ok (frame != NULL && memcmp (frame, NP_FRAME_MAGIC, 4) == 0, "Magic");
+	p = frame + 4;
+	ok (get_uint (&p, 4) == len - NP_FRAME_HEADER, "Length of the rest");
+	ok (get_uint (&p, 1) == STATE_WARNING && get_uint (&p, 1) == 0, "State");
+	ok (get_uint (&p, 2) == 2, "Two points");
+	ok ((int64_t) get_uint (&p, 8) == 1700000000500000LL, "Start in microseconds");
+	ok (get_uint (&p, 4) == 125000, "Duration in microseconds");
+	len = get_uint (&p, 4);
+	ok (len == strlen ("OK - 3 users \nfirst line\nsecond line") &&
+	    strncmp (p, "OK - 3 users \nfirst line\nsecond line", len) == 0,
+	    "Output without the perfdata");
+	p += len;
+
+	len = get_uint (&p, 1);
+	ok (len == 5 && strncmp (p, "users", 5) == 0, "Label");
+	p += len;
+	ok (get_uint (&p, 1) == 0, "No uom");
+	ok (get_uint (&p, 1) == (NP_FRAME_WARN | NP_FRAME_MIN) && get_double (&p) == 3,
+	    "Flags and value");
+	ok (get_double (&p) == 10 && get_double (&p) == 20 && get_uint (&p, 1) == NP_FRAME_INSIDE &&
+	    get_double (&p) == 0, "Range and min");
+
+	len = get_uint (&p, 1);
+	label = strndup (p, len);
+	p += len;
+	p += get_uint (&p, 1);
+	ok (strcmp (label, "time") == 0 && get_uint (&p, 1) == NP_FRAME_MAX &&
+	    get_double (&p) == 0.25 && get_double (&p) == 10, "The second point");
+	ok (p == frame + NP_FRAME_HEADER + (frame[4] << 24 | frame[5] << 16 | frame[6] << 8 | (unsigned char) frame[7]),
+	    "Nothing left");
+	free (frame);
+
+	frame = np_frame_result (STATE_OK, 0, 0, "OK\n", 3, &len);
+	p = frame + 10;
+	ok (get_uint (&p, 2) == 0 && len == NP_FRAME_HEADER + 4 + 8 + 4 + 4 + 2,
+	    "The points start over after a record");
+	free (frame);
+
+	np_frame_collect (FALSE);
+	np_frame_point ("users", 3, "", NULL, NULL, FALSE, 0, FALSE, 0);
+	frame = np_frame_result (STATE_OK, 0, 0, NULL, 0, &len);
+	p = frame + 10;
+	ok (get_uint (&p, 2) == 0, "Nothing collected when stopped");
+	free (frame);
+
+	return exit_status ();
+}
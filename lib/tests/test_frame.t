@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_frame") {
+	plan skip_all => "./test_frame not compiled - please enable libtap library to test";
+}
+exec "./test_frame";
@@ -21,6 +21,8 @@
 #include "parse_ini.h"
 
 #include "tap.h"
+#include <sys/stat.h>
+#include <utime.h>
 
 void my_free(char *string) {
 	if (string != NULL) {
@@ -49,12 +51,34 @@ list2str(np_arg_list *optlst)
 	return optstr;
 }
 
+/* Writes an ini file dated in the past, so that its index is kept */
+void
+write_ini(const char *file, const char *contents, time_t mtime)
+{
+	struct utimbuf times;
+	FILE *fp;
+
+	fp = fopen(file, "w");
+	fputs(contents, fp);
+	fclose(fp);
+	times.actime = times.modtime = mtime;
+	utime(file, &times);
+}
+
 int
 main (int argc, char **argv)
 {
 	char *optstr=NULL;
+	char state_dir[] = "/tmp/test_ini1.XXXXXX";
+	char *ini_file, *index_dir, *stanza;
+	struct stat st;
+
+	plan_tests(16);
 
-	plan_tests(12);
+	/* keep the stanza indexes out of the real state directory */
+	if (mkdtemp(state_dir) == NULL)
+		return 1;
+	setenv("MP_STATE_PATH", state_dir, 1);
 
 	optstr=list2str(np_get_defaults("section@./config-tiny.ini", "check_disk"));
 	ok( !strcmp(optstr, "--one=two --Foo=Bar --this=Your Mother! --blank"), "config-tiny.ini's section as expected");
@@ -104,6 +128,29 @@ main (int argc, char **argv)
 	ok( !strcmp(optstr, "--escape --send=Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda --expect=Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda Foo bar BAZ yadda yadda yadda --jail"), "Long options");
 	my_free(optstr);
 
+	asprintf(&index_dir, "%s/%lu/ini", state_dir, (unsigned long)geteuid());
+	ok( stat(index_dir, &st) == 0 && S_ISDIR(st.st_mode), "Stanza indexes saved in the state directory");
+
+	optstr=list2str(np_get_defaults("section_twice@./plugin.ini", "check_disk"));
+	ok( !strcmp(optstr, "--foo=bar --bar=foo"), "plugin.ini's section_twice read again through its index");
+	my_free(optstr);
+
+	asprintf(&ini_file, "%s/changed.ini", state_dir);
+	asprintf(&stanza, "check_changed@%s", ini_file);
+	write_ini(ini_file, "[check_changed]\nwarning=10\n", time(NULL) - 60);
+	optstr=list2str(np_get_defaults(stanza, "check_disk"));
+	ok( !strcmp(optstr, "--warning=10"), "Stanza read from a new file");
+	my_free(optstr);
+
+	write_ini(ini_file, "[other]\nfoo=bar\n[check_changed]\nwarning=20\ncritical=30\n", time(NULL) - 30);
+	optstr=list2str(np_get_defaults(stanza, "check_disk"));
+	ok( !strcmp(optstr, "--warning=20 --critical=30"), "Stanza index built again when the file changes");
+	my_free(optstr);
+
+	asprintf(&optstr, "rm -rf %s", state_dir);
+	system(optstr);
+	free(optstr);
+
 	return exit_status();
 }
 
@@ -0,0 +1,90 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_json.h"
+#include "tap.h"
+
+int
+main(void)
+{
+	char *doc = "{ \"status\": \"UP\", \"checks\": { \"db\": { \"latency\": 12.5, \"ok\": true },"
+	            " \"disk\": { \"free\": -3e2, \"ok\": null } },"
+	            " \"items\": [ 1, { \"name\": \"a\\\"b\\u00e9\" }, [ false ] ] }";
+	char *paths[] = { "status", "$.checks.db.latency", "checks.db.ok", "checks.disk.free",
+	                  "checks.disk.ok", "$.items[1].name", "items[2][0]", "checks", "missing" };
+	char *first[] = { "status" };
+	char *root[] = { "$" };
+	np_json *j;
+	size_t i;
+	int found;
+
+	plan_tests(25);
+
+	j = np_json_new(paths, 9);
+	ok(j != NULL, "Parser built");
+	found = np_json_feed(j, doc, strlen(doc));
+	ok(found == 8, "All but the missing path found in one chunk");
+	ok(j->type[0] == NP_JSON_STRING && strcmp(j->value[0], "UP") == 0, "A string");
+	ok(j->type[1] == NP_JSON_NUMBER && strcmp(j->value[1], "12.5") == 0, "A number in nested objects");
+	ok(j->type[2] == NP_JSON_TRUE && strcmp(j->value[2], "true") == 0, "true");
+	ok(j->type[3] == NP_JSON_NUMBER && strcmp(j->value[3], "-3e2") == 0, "A number with an exponent");
+	ok(j->type[4] == NP_JSON_NULL, "null");
+	ok(j->type[5] == NP_JSON_STRING && strcmp(j->value[5], "a\"b\xc3\xa9") == 0, "Escapes in an array element");
+	ok(j->type[6] == NP_JSON_FALSE, "An element of a nested array");
+	ok(j->type[7] == NP_JSON_OBJECT && j->value[7] == NULL, "An object");
+	ok(j->type[8] == NP_JSON_NONE, "Not there");
+	ok(np_json_done(j) && np_json_end(j) == 8, "The document ended");
+
+	np_json_reset(j);
+	ok(j->found_count == 0 && j->type[0] == NP_JSON_NONE && j->value[0] == NULL, "Reset");
+	for (i = 0; i < strlen(doc); i++)
+		found = np_json_feed(j, doc + i, 1);
+	ok(found == 8 && strcmp(j->value[5], "a\"b\xc3\xa9") == 0 && strcmp(j->value[3], "-3e2") == 0,
+	   "The same a byte at a time");
+	np_json_free(j);
+
+	j = np_json_new(first, 1);
+	ok(np_json_feed(j, "{\"status\":\"UP\",", 15) == 1 && np_json_done(j), "Done before the end of the document");
+	np_json_reset(j);
+	ok(np_json_feed(j, "{\"other\":{\"status\":1},\"status\":2}", 33) == 1 && strcmp(j->value[0], "2") == 0,
+	   "A key only matches at its path");
+	np_json_reset(j);
+	ok(np_json_feed(j, "{\"status\" \"UP\"}", 15) == -1 && j->error == 11, "Missing colon");
+	ok(np_json_feed(j, "{}", 2) == -1, "An error stays");
+	np_json_reset(j);
+	ok(np_json_feed(j, "[1, 2,]", 7) == -1, "Trailing comma");
+	np_json_reset(j);
+	ok(np_json_feed(j, "{\"a\": tru }", 11) == -1, "Bad literal");
+	np_json_reset(j);
+	ok(np_json_feed(j, "{\"a\": 1.}", 9) == -1, "Bad number");
+	np_json_reset(j);
+	ok(np_json_feed(j, "{\"a\": [1}", 9) == -1, "Mismatched brackets");
+	np_json_reset(j);
+	ok(np_json_feed(j, "{\"a\": 1", 7) == 0 && np_json_end(j) == -1, "Cut short");
+	np_json_free(j);
+
+	j = np_json_new(root, 1);
+	ok(np_json_feed(j, " 42", 3) == 0 && np_json_end(j) == 1 && strcmp(j->value[0], "42") == 0,
+	   "A number alone ends with the document");
+	np_json_reset(j);
+	ok(np_json_feed(j, "[]  ", 4) == 1 && j->type[0] == NP_JSON_ARRAY && np_json_end(j) == 1, "The root");
+	np_json_free(j);
+
+	return exit_status();
+}
@@ -0,0 +1,80 @@
+/*****************************************************************************
+* 
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+* 
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+* 
+* 
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_match.h"
+#include "tap.h"
+
+int
+main(void)
+{
+	char *text = "the cat sat on the mat";
+	char *strings[] = { "he", "she", "hers", "his", "her" };
+	char *animals[] = { "cat", "mat", "cat", "dog" };
+	char *empty[] = { "", "zz" };
+	char body[] = "ushers\0she";
+	np_matcher *m;
+	int i, found;
+
+	plan_tests(21);
+
+	ok(np_memmem(text, strlen(text), "cat", 3) == text + 4, "np_memmem finds a string");
+	ok(np_memmem(text, strlen(text), "mat", 3) == text + 19, "np_memmem finds a string at the end");
+	ok(np_memmem(text, strlen(text), "the", 3) == text, "np_memmem finds the first occurrence");
+	ok(np_memmem(text, strlen(text), "mate", 4) == NULL, "np_memmem does not read past the end");
+	ok(np_memmem(text, strlen(text), "cut", 3) == NULL, "np_memmem with same first and last byte");
+	ok(np_memmem(text, strlen(text), "", 0) == text, "np_memmem of an empty string");
+	ok(np_memmem(body, sizeof(body) - 1, "she", 3) == body + 1, "np_memmem on data with a nul byte");
+	ok(np_memmem(body + 3, sizeof(body) - 4, "she", 3) == body + 7, "np_memmem past a nul byte");
+
+	m = np_matcher_new(strings, 5);
+	ok(m != NULL, "Matcher built");
+	found = np_matcher_feed(m, "ushers", 6);
+	ok(found == 4, "Overlapping strings found in one pass");
+	ok(m->found[0] && m->found[1] && m->found[2] && !m->found[3] && m->found[4], "The right ones");
+	np_matcher_reset(m);
+	ok(m->found_count == 0 && !m->found[0], "Reset");
+	np_matcher_feed(m, "u", 1);
+	np_matcher_feed(m, "sh", 2);
+	found = np_matcher_feed(m, "e", 1);
+	ok(found == 2 && m->found[0] && m->found[1], "Strings split over several chunks");
+	np_matcher_free(m);
+
+	m = np_matcher_new(animals, 4);
+	found = np_matcher_feed(m, text, strlen(text));
+	ok(found == 3, "Duplicate strings count once each");
+	ok(m->found[0] && m->found[1] && m->found[2] && !m->found[3], "Both copies found");
+	np_matcher_free(m);
+
+	m = np_matcher_new(animals, 1);
+	ok(m->start_byte == 'c', "One first byte to skip ahead to");
+	ok(np_matcher_feed(m, "xxxxc", 5) == 0, "Not found yet");
+	ok(np_matcher_feed(m, "atxx", 4) == 1, "Found when completed by the next chunk");
+	np_matcher_free(m);
+
+	m = np_matcher_new(empty, 2);
+	ok(m->found_count == 1 && m->found[0], "An empty string is always found");
+	ok(np_matcher_feed(m, "azzb", 4) == 2, "Along with the other one");
+	np_matcher_free(m);
+
+	m = np_matcher_new(NULL, 0);
+	ok(m != NULL && np_matcher_feed(m, text, strlen(text)) == 0, "No strings at all");
+	np_matcher_free(m);
+
+	return exit_status();
+}
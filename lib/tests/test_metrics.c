@@ -0,0 +1,116 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_metrics.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tap.h"
+
+/* the next datagram, or "" if none is waiting */
+static char *
+receive (int fd)
+{
+	static char buf[16384];
+	ssize_t n = recv (fd, buf, sizeof (buf) - 1, MSG_DONTWAIT);
+
+	buf[n > 0 ? n : 0] = '\0';
+	return buf;
+}
+
+int
+main (void)
+{
+	struct sockaddr_un sink;
+	char path[] = "/tmp/test_metrics.XXXXXX", *sock, *env, *d;
+	const char *want;
+	int fd, i, lines;
+
+	plan_tests (11);
+
+	if (mkdtemp (path) == NULL || asprintf (&sock, "%s/sink", path) < 0)
+		return exit_status ();
+	memset (&sink, 0, sizeof (sink));
+	sink.sun_family = AF_UNIX;
+	strcpy (sink.sun_path, sock);
+	fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+	ok (fd >= 0 && bind (fd, (struct sockaddr *) &sink, sizeof (sink)) == 0, "Sink bound");
+
+	unsetenv (NP_METRICS_SINK_ENV);
+	np_metrics_record ("time", 1.5, "s");
+	np_metrics_flush ();
+	ok (strcmp (receive (fd), "") == 0, "Nothing sent without a sink");
+
+	asprintf (&env, "statsd:%s", sock);
+	setenv (NP_METRICS_SINK_ENV, env, 1);
+	np_metrics_name ("check_test");
+	np_metrics_record ("time", 1.5, "s");
+	np_metrics_record ("/var/log", 42, "MB");
+	np_metrics_record ("offset", -0.25, "s");
+	ok (strcmp (receive (fd), "") == 0, "Nothing sent before the flush");
+	np_metrics_flush ();
+	d = receive (fd);
+	ok (strcmp (d, "check_test.time:1.5|g\ncheck_test._var_log:42|g\n"
+	               "check_test.offset:0|g\ncheck_test.offset:-0.25|g\n") == 0,
+	    "statsd gauges in one datagram");
+	np_metrics_flush ();
+	ok (strcmp (receive (fd), "") == 0, "The batch was dropped");
+
+	asprintf (&env, "influx:%s", sock);
+	setenv (NP_METRICS_SINK_ENV, env, 1);
+	np_metrics_record ("a b,c=d", 1e12, "%");
+	np_metrics_record ("count", 3, "");
+	np_metrics_flush ();
+	d = receive (fd);
+	want = "check_test,label=a\\ b\\,c\\=d,uom=% value=1000000000000 ";
+	ok (strncmp (d, want, strlen (want)) == 0,
+	    "Line protocol with escaped tags");
+	ok (strstr (d, "000000000\ncheck_test,label=count value=3 ") != NULL,
+	    "No uom tag for an empty uom");
+
+	for (i = 0; i < 1000; i++)
+		np_metrics_record ("some_rather_long_label_for_a_point", i, "B");
+	np_metrics_flush ();
+	for (i = 0, lines = 0; *(d = receive (fd)) != '\0'; i++) {
+		if (strlen (d) > 8192 || d[strlen (d) - 1] != '\n')
+			break;
+		for (; *d; d++)
+			lines += *d == '\n';
+	}
+	ok (i > 1 && lines == 1000, "A large batch in several datagrams of whole lines");
+
+	setenv (NP_METRICS_SINK_ENV, "statsd://127.0.0.1", 1);
+	np_metrics_record ("time", 1, "s");
+	np_metrics_flush ();
+	ok (TRUE, "No port, no sink");
+	setenv (NP_METRICS_SINK_ENV, "statsd://localhost:8125", 1);
+	np_metrics_record ("time", 1, "s");
+	np_metrics_flush ();
+	ok (TRUE, "Names are not looked up");
+
+	unlink (sock);
+	setenv (NP_METRICS_SINK_ENV, env, 1);
+	np_metrics_record ("time", 1, "s");
+	np_metrics_flush ();
+	ok (TRUE, "A sink that is gone is ignored");
+
+	close (fd);
+	rmdir (path);
+	return exit_status ();
+}
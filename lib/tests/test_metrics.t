@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_metrics") {
+	plan skip_all => "./test_metrics not compiled - please enable libtap library to test";
+}
+exec "./test_metrics";
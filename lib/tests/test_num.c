@@ -0,0 +1,130 @@
+/*****************************************************************************
+* 
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+* 
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+* 
+* 
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_num.h"
+#include "tap.h"
+#include <locale.h>
+
+/* random decimal numbers compared with strtod() */
+#define RANDOM_NUMBERS 100000
+
+static const char *floats[] = {
+	"0", "-0", "1", "0.5", ".5", "5.", "123.456", "-98.6", "1e10", "1.5E-3",
+	"0.1", "0.2", "0.3", "3.14159265358979323846", "2.2250738585072014e-308",
+	"1.7976931348623157e308", "1e400", "1e-400", "4.9e-324", "9007199254740993",
+	"12345678901234567890", "0.000000000000000000000000001", "100000000000000000000000",
+	"1e", "1e+", "7e-2x", "  42 ", "+3.5", "inf", "-nan", "0x1p4", "00000000000000000000001.5",
+};
+
+static int
+same_double (double a, double b)
+{
+	return memcmp (&a, &b, sizeof (double)) == 0 || (a != a && b != b);
+}
+
+int
+main (void)
+{
+	char buf[64], *end, *end_c;
+	long long fields[8];
+	size_t i, j;
+	int right, len;
+	double d;
+
+	plan_tests (25);
+
+	ok (np_strtoll ("1234", &end) == 1234 && *end == '\0', "Integer");
+	ok (np_strtoll (" \t-42 rest", &end) == -42 && strcmp (end, " rest") == 0,
+	    "Blanks before a negative integer, end past it");
+	ok (np_strtoll ("abc", &end) == 0 && strcmp (end, "abc") == 0, "No integer, end at the start");
+	ok (np_strtoll ("-", &end) == 0 && strcmp (end, "-") == 0, "A sign alone is no integer");
+	errno = 0;
+	ok (np_strtoll ("9223372036854775807", NULL) == LLONG_MAX && errno == 0, "Largest integer");
+	ok (np_strtoll ("-9223372036854775808", NULL) == LLONG_MIN && errno == 0, "Smallest integer");
+	ok (np_strtoll ("9223372036854775808", &end) == LLONG_MAX && errno == ERANGE && *end == '\0',
+	    "Too large saturates with ERANGE and reads all the digits");
+	errno = 0;
+	ok (np_strtoull ("18446744073709551615", NULL) == ULLONG_MAX && errno == 0, "Largest unsigned");
+	ok (np_strtoull ("18446744073709551616", NULL) == ULLONG_MAX && errno == ERANGE, "Too large unsigned");
+	ok (np_strtoull ("-1", &end) == 0 && strcmp (end, "-1") == 0, "No minus sign for unsigned");
+	ok (np_strtoull ("0x10", &end) == 0 && strcmp (end, "x10") == 0, "Decimal only");
+
+	ok (np_strtod ("", &end) == 0 && *end == '\0', "No float in an empty string");
+	ok (np_strtod (".", &end) == 0 && strcmp (end, ".") == 0, "A point alone is no float");
+	ok (np_strtod ("-.e5", &end) == 0 && strcmp (end, "-.e5") == 0, "Nor a sign, a point and an exponent");
+
+	right = 0;
+	for (i = 0; i < sizeof (floats) / sizeof (floats[0]); i++) {
+		d = np_strtod (floats[i], &end);
+		if (same_double (d, strtod (floats[i], &end_c)) && end == end_c)
+			right++;
+		else
+			diag ("%s: %.17g, strtod() %.17g", floats[i], d, strtod (floats[i], NULL));
+	}
+	ok (right == (int) (sizeof (floats) / sizeof (floats[0])), "Floats as strtod() reads them");
+
+	/* mostly digits that fit, some with more than fit */
+	srand (1);
+	right = 0;
+	for (i = 0; i < RANDOM_NUMBERS; i++) {
+		len = 0;
+		if (rand () % 4 == 0)
+			buf[len++] = '-';
+		for (j = rand () % (i % 10 ? 12 : 25); j > 0; j--)
+			buf[len++] = '0' + rand () % 10;
+		if (rand () % 2) {
+			buf[len++] = '.';
+			for (j = rand () % 12; j > 0; j--)
+				buf[len++] = '0' + rand () % 10;
+		}
+		if (rand () % 4 == 0)
+			len += sprintf (buf + len, "e%d", rand () % 80 - 40);
+		buf[len] = '\0';
+		d = np_strtod (buf, &end);
+		if (same_double (d, strtod (buf, &end_c)) && end == end_c)
+			right++;
+		else if (i - right < 5)
+			diag ("%s: %.17g, strtod() %.17g", buf, d, strtod (buf, NULL));
+	}
+	ok (right == RANDOM_NUMBERS, "%d random numbers as strtod() reads them", RANDOM_NUMBERS);
+
+	ok (np_strtoll_fields ("S 1 2 3", fields, 8, &end) == 0 && strcmp (end, "S 1 2 3") == 0,
+	    "No fields before something else");
+	ok (np_strtoll_fields ("1 -2 3 x", fields, 8, &end) == 3 && fields[1] == -2 && strcmp (end, " x") == 0,
+	    "Fields up to something else");
+	ok (np_strtoll_fields ("1 2 3 4", fields, 2, &end) == 2 && fields[1] == 2 && strcmp (end, " 3 4") == 0,
+	    "No more fields than asked for");
+	ok (np_strtoll_fields ("1 2\n", fields, 8, &end) == 2 && strcmp (end, "\n") == 0,
+	    "Fields up to the end of the line");
+
+	/* a locale with a decimal comma changes neither */
+	if (setlocale (LC_NUMERIC, "de_DE.UTF-8") == NULL && setlocale (LC_NUMERIC, "fr_FR.UTF-8") == NULL)
+		skip (5, "No locale with a decimal comma");
+	else {
+		ok (np_strtod ("1.5", &end) == 1.5 && *end == '\0', "1.5 with a decimal comma");
+		ok (np_strtod ("1,5", &end) == 1 && strcmp (end, ",5") == 0, "1,5 is 1 and something else");
+		ok (np_strtod ("0.30000000000000000000001", NULL) == strtod ("0,30000000000000000000001", NULL),
+		    "Too many digits, through strtod()");
+		ok (np_strtod ("1.5e400", NULL) == HUGE_VAL, "Too large, through strtod()");
+		ok (np_strtoll ("1.000", &end) == 1 && strcmp (end, ".000") == 0, "No thousands separator");
+		setlocale (LC_NUMERIC, "C");
+	}
+
+	return exit_status ();
+}
@@ -0,0 +1,107 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_openmetrics.h"
+#include "tap.h"
+
+int
+main(void)
+{
+	char *doc = "# HELP http_requests_total Requests.\n"
+	            "# TYPE http_requests_total counter\n"
+	            "http_requests_total{method=\"get\",code=\"200\"} 1027 1395066363000\n"
+	            "http_requests_total{method=\"post\",code=\"500\"} 3\n"
+	            "process_open_fds 12\r\n"
+	            "up 1\n"
+	            "\n"
+	            "queue_depth{name=\"a \\\"b\\\"\",shard=\"1\"} +Inf\n"
+	            "queue_depth{name=\"c\"} 7.5e1\n"
+	            "queue_depth oops\n"
+	            "# EOF\n";
+	char *selectors[] = { "http_requests_total{code!=\"200\"}", "up", "queue_depth{name=\"a \\\"b\\\"\"}",
+	                      "queue_depth{shard=\"\"}", "missing", "http_requests_total" };
+	char *bad[] = { "up", "up{code=200}" };
+	char *last[] = { "up" };
+	thresholds *t = NULL;
+	np_openmetrics *om;
+	size_t i;
+	int found, n;
+
+	plan_tests(22);
+
+	om = np_openmetrics_new(selectors, 6, &n);
+	ok(om != NULL && n == -1, "Parser built");
+	ok(om->selectors[0].nlabels == 1 && om->selectors[0].negate[0] &&
+	   strcmp(om->selectors[0].label[0], "code") == 0 && strcmp(om->selectors[0].value[0], "200") == 0,
+	   "A negated label matcher");
+	ok(strcmp(om->selectors[2].value[0], "a \"b\"") == 0, "Escapes in a selector");
+
+	set_thresholds(&t, "10", "100");
+	om->selectors[5].thlds = t;
+	found = np_openmetrics_feed(om, doc, strlen(doc));
+	ok(found == 5, "All but the missing metric found in one chunk");
+	ok(om->selectors[0].matched == 1 && om->selectors[0].samples[0].value == 3 &&
+	   strcmp(om->selectors[0].samples[0].series, "http_requests_total{method=\"post\",code=\"500\"}") == 0,
+	   "Only the series with another code");
+	ok(om->selectors[1].matched == 1 && om->selectors[1].samples[0].value == 1 &&
+	   strcmp(om->selectors[1].samples[0].series, "up") == 0, "A sample without labels");
+	ok(om->selectors[2].matched == 1 && om->selectors[2].samples[0].value > 1e308, "An escaped label value and +Inf");
+	ok(om->selectors[3].matched == 1 && om->selectors[3].samples[0].value == 75, "A label that is not there is empty");
+	ok(om->selectors[4].matched == 0, "Not there");
+	ok(om->selectors[5].matched == 2 && om->selectors[5].status == STATE_CRITICAL &&
+	   om->selectors[5].worst.value == 1027, "The worst sample against the thresholds");
+	ok(om->lines == 7 && om->skipped == 1 && om->errors == 1, "Lines, skipped by name, and the bad one");
+	ok(om->eof, "# EOF");
+	ok(np_openmetrics_end(om) == 5, "The exposition ended");
+
+	np_openmetrics_reset(om);
+	ok(om->found_count == 0 && om->selectors[1].matched == 0 && om->selectors[1].samples[0].series == NULL &&
+	   !om->eof, "Reset");
+	for (i = 0; i < strlen(doc); i++)
+		found = np_openmetrics_feed(om, doc + i, 1);
+	ok(found == 5 && om->selectors[5].status == STATE_CRITICAL && om->selectors[3].samples[0].value == 75 &&
+	   om->lines == 7 && om->skipped == 1 && om->errors == 1 && om->eof, "The same a byte at a time");
+	np_openmetrics_free(om);
+
+	om = np_openmetrics_new(bad, 2, &n);
+	ok(om == NULL && n == 1, "An unquoted label value");
+	bad[1] = "up{code=\"200\"";
+	ok(np_openmetrics_new(bad, 2, &n) == NULL && n == 1, "An unclosed brace");
+	bad[1] = "{code=\"200\"}";
+	ok(np_openmetrics_new(bad, 2, &n) == NULL && n == 1, "No name");
+
+	om = np_openmetrics_new(last, 1, &n);
+	ok(np_openmetrics_feed(om, "other 1\nup 0", 12) == 0 && np_openmetrics_end(om) == 1 &&
+	   om->selectors[0].samples[0].value == 0, "A last line without a newline");
+	np_openmetrics_reset(om);
+	ok(np_openmetrics_feed(om, "up{a=\"1\"} 1\nup{a=\"2\"} 2\n", 24) == 1 && om->selectors[0].matched == 2 &&
+	   om->selectors[0].samples[1].value == 2, "Every series of a metric");
+	np_openmetrics_reset(om);
+	for (i = 0; i < NP_OM_MAX_SAMPLES + 8; i++)
+		np_openmetrics_feed(om, "up 5\n", 5);
+	ok(om->selectors[0].matched == NP_OM_MAX_SAMPLES + 8 && om->selectors[0].samples[NP_OM_MAX_SAMPLES - 1].value == 5,
+	   "Samples beyond the ones kept are counted");
+	np_openmetrics_reset(om);
+	ok(np_openmetrics_feed(om, "up{a=\"1\" 1\nup 2\n", 16) == 1 && om->errors == 1 &&
+	   om->selectors[0].samples[0].value == 2, "A broken line does not spoil the next");
+	np_openmetrics_free(om);
+
+	return exit_status();
+}
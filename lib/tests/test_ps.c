@@ -0,0 +1,187 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_ps.h"
+#include "utils_base.h"
+#include "tap.h"
+#include <stdint.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+static int
+find_self (const np_proc_table *table)
+{
+	size_t i;
+
+	for (i = 0; i < table->count; i++)
+		if (table->procs[i].parsed && table->procs[i].pid == getpid ())
+			return TRUE;
+	return FALSE;
+}
+
+/* a record as pst3 -b writes it */
+static size_t
+put_record (char *p, int32_t pid, uint32_t pcpu, const char *prog, const char *args)
+{
+	uint32_t v[9];
+	size_t prog_length = strlen (prog), args_length = strlen (args);
+
+	v[0] = NP_PS_RECORD_HEADER + prog_length + args_length;
+	v[1] = 100;
+	v[2] = pid;
+	v[3] = 1;
+	v[4] = 2048;
+	v[5] = 1024;
+	v[6] = pcpu;
+	memcpy (&v[7], "S\0\0\0", 4);
+	v[8] = prog_length;
+	memcpy (p, v, sizeof (v));
+	memcpy (p + 36, &args_length, 4);
+	memcpy (p + NP_PS_RECORD_HEADER, prog, prog_length);
+	memcpy (p + NP_PS_RECORD_HEADER + prog_length, args, args_length);
+	return NP_PS_RECORD_HEADER + prog_length + args_length;
+}
+
+int
+main (int argc, char **argv)
+{
+	np_proc_table table, again;
+	char dir[] = "/tmp/test_ps.XXXXXX";
+	char *saved = NULL, *pidfile = NULL;
+	struct utimbuf times;
+	FILE *fp;
+	size_t i;
+	int result;
+
+	plan_tests (27);
+
+	ok (mkdtemp (dir) != NULL, "Made a directory for the snapshot");
+	setenv (NP_PS_CACHE_DIR_ENV, dir, 1);
+	ok (strncmp (np_ps_cache_file (), dir, strlen (dir)) == 0, "Snapshot is kept in " NP_PS_CACHE_DIR_ENV);
+
+	result = np_ps_run (&table, 0);
+	ok (result == 0, "PS_COMMAND ran");
+	ok (table.count > 0 && table.count == table.out.lines - 1, "One process per line after the header");
+	ok (find_self (&table), "Found ourselves");
+	ok (access (np_ps_cache_file (), F_OK) != 0, "No snapshot is left without a ttl");
+
+	np_ps_free (&table);
+	np_ps_run (&table, 30);
+	ok (table.cached == FALSE && access (np_ps_cache_file (), F_OK) == 0, "First run with a ttl leaves a snapshot");
+
+	np_ps_run (&again, 30);
+	ok (again.cached == TRUE, "Second run takes the snapshot");
+	ok (again.count == table.count && again.result == table.result, "with the same processes");
+	for (i = 0; i < table.count; i++)
+		if (strcmp (again.procs[i].line, table.procs[i].line) != 0)
+			break;
+	ok (i == table.count, "and the same lines");
+	np_ps_free (&again);
+
+	chmod (np_ps_cache_file (), 0622);
+	np_ps_run (&again, 30);
+	ok (again.cached == FALSE, "A snapshot others can write to is not taken");
+	np_ps_free (&again);
+
+	/* age the snapshot */
+	if ((fp = fopen (np_ps_cache_file (), "r+")) != NULL) {
+		fprintf (fp, "np_ps %d %ld %d", NP_PS_CACHE_VERSION, (long) time (NULL) - 60, 0);
+		fclose (fp);
+	}
+	np_ps_run (&again, 30);
+	ok (again.cached == FALSE, "A snapshot older than the ttl is not taken");
+	np_ps_free (&again);
+
+	asprintf (&saved, "%s/saved", dir);
+	if ((fp = fopen (saved, "w")) != NULL) {
+		for (i = 0; i < table.out.lines; i++)
+			fprintf (fp, "%s\n", table.out.line[i]);
+		fclose (fp);
+	}
+	np_ps_read_file (&again, saved);
+	ok (again.count == table.count, "Saved output reads back");
+	ok (find_self (&again), "Found ourselves in it");
+	np_ps_free (&again);
+	np_ps_free (&table);
+
+	memset (&again, 0, sizeof (again));
+	again.out.buf = malloc (4096);
+	strcpy (again.out.buf, NP_PS_RECORD_MAGIC);
+	i = strlen (NP_PS_RECORD_MAGIC);
+	i += put_record (again.out.buf + i, 42, 1250, "sshd", "/usr/sbin/sshd -D");
+	i += put_record (again.out.buf + i, 43, 0, "sh", "");
+	/* cut short */
+	i += put_record (again.out.buf + i, 44, 0, "cron", "/usr/sbin/cron") - 3;
+	again.out.buflen = i;
+	ok (np_ps_records_parse (&again) == 2 && again.count == 2, "Two whole records");
+	ok (again.procs[0].pid == 42 && again.procs[0].ppid == 1 && again.procs[0].uid == 100 &&
+	    again.procs[0].vsz == 2048 && again.procs[0].rss == 1024 && again.procs[0].pcpu == 12.5f &&
+	    strcmp (again.procs[0].stat, "S") == 0, "with the fields");
+	ok (strcmp (again.procs[0].prog, "sshd") == 0 && strcmp (again.procs[0].args, "/usr/sbin/sshd -D") == 0,
+	    "the command and the args");
+	ok (strcmp (again.procs[1].args, "") == 0 && again.procs[1].etime[0] == '\0', "and no args");
+	np_ps_free (&again);
+
+	np_ps_run_records (&table, 0);
+	ok (find_self (&table), "Found ourselves in the records, or the lines without them");
+	np_ps_free (&table);
+
+	asprintf (&pidfile, "%s/pid", dir);
+	ok (np_ps_pidfile (&table, pidfile) == NP_PIDFILE_UNREADABLE && table.count == 0, "No pid file");
+	np_ps_free (&table);
+	if ((fp = fopen (pidfile, "w")) != NULL) {
+		fprintf (fp, "%d\n", (int) getpid ());
+		fclose (fp);
+	}
+	result = np_ps_pidfile (&table, pidfile);
+	ok (result == NP_PIDFILE_OK && table.count == 1 && find_self (&table), "The process of a pid file");
+	ok (table.count == 1 && strstr (table.procs[0].args, "test_ps") != NULL, "with its args");
+	np_ps_free (&table);
+#ifdef __linux__
+	/* written long before we started */
+	times.actime = times.modtime = time (NULL) - 86400 * 365;
+	utime (pidfile, &times);
+	ok (np_ps_pidfile (&table, pidfile) == NP_PIDFILE_REUSED && table.count == 0,
+	    "A process younger than the pid file is not the one that wrote it");
+	np_ps_free (&table);
+#else
+	skip (1, "the start time of a process is only known from /proc");
+#endif
+	if ((fp = fopen (pidfile, "w")) != NULL) {
+		fprintf (fp, "%d\n", INT_MAX - 1);
+		fclose (fp);
+	}
+	ok (np_ps_pidfile (&table, pidfile) == NP_PIDFILE_GONE && table.count == 0, "A pid nothing runs under");
+	np_ps_free (&table);
+	unlink (pidfile);
+
+	np_ps_top (&table, 3, 0);
+	ok (table.count > 0 && table.count <= 3, "At most the busiest 3");
+	for (i = 1; i < table.count && table.procs[i - 1].pcpu >= table.procs[i].pcpu; i++)
+		;
+	ok (table.count > 0 && i == table.count, "busiest first");
+	ok (table.seen >= table.count && table.zombies <= table.seen, "All processes counted, not just the busiest");
+	np_ps_free (&table);
+
+	unlink (saved);
+	unlink (np_ps_cache_file ());
+	rmdir (dir);
+
+	return exit_status ();
+}
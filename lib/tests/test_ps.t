@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_ps") {
+	plan skip_all => "./test_ps not compiled - please enable libtap library to test";
+}
+exec "./test_ps";
@@ -0,0 +1,109 @@
+/*****************************************************************************
+* 
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+* 
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+* 
+* 
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_regex.h"
+#include <dirent.h>
+#include "tap.h"
+
+#define ERE REG_EXTENDED
+
+static int
+matches(const char *pattern, int cflags, const char *string)
+{
+	np_regex_t re;
+	int rc;
+
+	if (np_regcomp(&re, pattern, cflags) != 0)
+		return -1;
+	rc = np_regexec(&re, string, 0, NULL, 0);
+	np_regfree(&re);
+	return rc == 0;
+}
+
+static int
+cache_files(const char *dir)
+{
+	DIR *d;
+	struct dirent *e;
+	int n = 0;
+
+	if ((d = opendir(dir)) == NULL)
+		return 0;
+	while ((e = readdir(d)) != NULL)
+		if (e->d_name[0] != '.')
+			n++;
+	closedir(d);
+	return n;
+}
+
+int
+main(void)
+{
+	np_regex_t re;
+	regmatch_t pmatch[3];
+	char errbuf[256];
+	char state[] = "/tmp/np_test_regex.XXXXXX";
+	char *dir;
+	int err;
+
+	plan_tests(19);
+
+	ok(matches("^HTTP/1\\.[01] 200", ERE, "HTTP/1.1 200 OK") == 1, "Extended expression matches");
+	ok(matches("^HTTP/1\\.[01] 200", ERE, "HTTP/1.1 404 Not Found") == 0, "and does not");
+	ok(matches("ok|fine", ERE, "all fine") == 1, "Alternation");
+	ok(matches("[[:digit:]]{3}", ERE, "code 123") == 1, "Character classes and intervals");
+	ok(matches("rOoT", ERE | REG_ICASE, "root") == 1, "REG_ICASE");
+	ok(matches("a.b", ERE, "a\nb") == 1, "Without REG_NEWLINE . matches a newline");
+	ok(matches("a.b", ERE | REG_NEWLINE, "a\nb") == 0, "With REG_NEWLINE it does not");
+	ok(matches("^b", ERE, "a\nb") == 0, "Without REG_NEWLINE ^ matches at the start only");
+	ok(matches("^b", ERE | REG_NEWLINE, "a\nb") == 1, "With REG_NEWLINE after a newline too");
+	ok(matches("a$", ERE, "a\n") == 0, "Without REG_NEWLINE $ is the end of the string");
+	ok(matches("\\(ab\\)*c", 0, "ababc") == 1, "Basic expressions");
+
+	ok(np_regcomp(&re, "([a-z]+)=([0-9]+)", ERE) == 0, "Compiled with groups");
+	ok(np_regexec(&re, "x: size=42;", 3, pmatch, 0) == 0 &&
+	   pmatch[0].rm_so == 3 && pmatch[0].rm_eo == 10 &&
+	   pmatch[1].rm_so == 3 && pmatch[1].rm_eo == 7 &&
+	   pmatch[2].rm_so == 8 && pmatch[2].rm_eo == 10, "Offsets of the match and groups");
+	ok(np_regexec(&re, "size=", 3, pmatch, 0) == REG_NOMATCH, "REG_NOMATCH");
+	np_regfree(&re);
+
+	err = np_regcomp(&re, "a(b", ERE);
+	ok(err != 0, "Invalid expression");
+	np_regerror(err, &re, errbuf, sizeof(errbuf));
+	ok(errbuf[0] != '\0', "with an error message: %s", errbuf);
+
+	/* compiled patterns go to the state directory */
+	ok(mkdtemp(state) != NULL, "State directory");
+	setenv("MP_STATE_PATH", state, 1);
+	asprintf(&dir, "%s/%lu/regex", state, (unsigned long)geteuid());
+	np_regcomp(&re, "cached (pattern)+", ERE);
+	np_regfree(&re);
+#ifdef HAVE_PCRE2
+	ok(cache_files(dir) == 1, "Compiled pattern saved");
+	ok(matches("cached (pattern)+", ERE, "a cached patternpattern") == 1 && cache_files(dir) == 1,
+	   "and used again");
+#else
+	ok(cache_files(dir) == 0, "Nothing saved without PCRE2");
+	ok(matches("cached (pattern)+", ERE, "a cached patternpattern") == 1, "Matches anyway");
+#endif
+
+	return exit_status();
+}
@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_regex") {
+	plan skip_all => "./test_regex not compiled - please enable libtap library to test";
+}
+exec "./test_regex";
@@ -0,0 +1,98 @@
+/*****************************************************************************
+* 
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+* 
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+* 
+* 
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_cmd.h"
+#include "utils_base.h"
+#include "tap.h"
+#include <sys/time.h>
+
+/* Size of the memory the benchmark touches before starting children, so
+ * fork() has page tables to copy. NP_SPAWN_BENCH_MB overrides it. */
+#define BENCH_MB 128
+#define BENCH_RUNS 200
+
+static double
+bench (char *const *argv, int flags, int runs)
+{
+	struct timeval start, end;
+	output out;
+	int i;
+
+	gettimeofday (&start, NULL);
+	for (i = 0; i < runs; i++)
+		cmd_run_array (argv, &out, NULL, flags);
+	gettimeofday (&end, NULL);
+
+	return ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec)) / runs;
+}
+
+int
+main (int argc, char **argv)
+{
+	char *echo[] = { "/bin/echo", "spawned", NULL };
+	char *missing[] = { "/bin/non-existant-command", NULL };
+	char *truecmd[] = { "/bin/sh", "-c", ":", NULL };
+	output chld_out, chld_err;
+	size_t mb = BENCH_MB, i;
+	char *ballast, *env;
+	double t_spawn, t_fork;
+	int result;
+
+	plan_tests(8);
+
+	result = cmd_run_array (echo, &chld_out, &chld_err, 0);
+	ok (result == 0, "Default launch path: exit code 0");
+	ok (chld_out.lines == 1 && strcmp (chld_out.line[0], "spawned") == 0,
+			"Default launch path: stdout is captured");
+	ok (chld_err.lines == 0, "Default launch path: no stderr");
+
+	result = cmd_run_array (echo, &chld_out, &chld_err, CMD_FORK);
+	ok (result == 0 && chld_out.lines == 1 && strcmp (chld_out.line[0], "spawned") == 0,
+			"CMD_FORK: same output and exit code");
+
+	result = cmd_run_array (missing, &chld_out, &chld_err, 0);
+	ok (result == 3 && chld_out.lines == 0,
+			"Default launch path: missing command returns UNKNOWN");
+
+	result = cmd_run ("/bin/sh -c 'exit 7'", NULL, NULL, 0);
+	ok (result == 7, "Default launch path: exit code 7 from /bin/sh");
+
+	/* the micro-benchmark: how long each path takes to start a trivial
+	 * child from a parent with a large resident set */
+	if ((env = getenv ("NP_SPAWN_BENCH_MB")) != NULL)
+		mb = strtoul (env, NULL, 10);
+	ballast = malloc (mb << 20);
+	ok (ballast != NULL, "Allocated benchmark ballast");
+	for (i = 0; ballast && i < (mb << 20); i += 4096)
+		ballast[i] = 1;
+
+	t_fork = bench (truecmd, CMD_FORK, BENCH_RUNS);
+	t_spawn = bench (truecmd, 0, BENCH_RUNS);
+	diag ("with %lu MB resident: fork() %.0f us, default path %.0f us per command",
+	      (unsigned long) mb, t_fork, t_spawn);
+#ifdef HAVE_POSIX_SPAWN
+	diag ("default path is posix_spawn()");
+#else
+	diag ("default path is fork(), posix_spawn() is not available");
+#endif
+	ok (t_fork > 0 && t_spawn > 0, "Benchmark ran both launch paths");
+
+	free (ballast);
+	return exit_status ();
+}
@@ -0,0 +1,192 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_targets.h"
+#include "utils_arena.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "tap.h"
+
+#define HOSTS 10000
+
+static char list[] = "/tmp/test_targets.XXXXXX";
+static char state_dir[] = "/tmp/test_targets_state.XXXXXX";
+
+/* how many of the lines of the list the shard takes */
+static unsigned long
+read_shard (const char *source, unsigned long *lines)
+{
+	np_targets *t;
+	unsigned long taken = 0;
+
+	if ((t = np_targets_open (source)) == NULL)
+		return 0;
+	while (np_targets_next (t) != NULL)
+		taken++;
+	*lines = t->lines;
+	np_targets_close (t);
+	return taken;
+}
+
+/* a child process that hands text to the first one connecting to path */
+static void
+serve (const char *path, const char *text)
+{
+	struct sockaddr_un su;
+	int sd, c;
+
+	memset (&su, 0, sizeof (su));
+	su.sun_family = AF_UNIX;
+	strcpy (su.sun_path, path);
+	if ((sd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return;
+	if (bind (sd, (struct sockaddr *) &su, sizeof (su)) == 0 && listen (sd, 1) == 0 && fork () == 0) {
+		if ((c = accept (sd, NULL, NULL)) >= 0) {
+			(void) !write (c, text, strlen (text));
+			close (c);
+		}
+		_exit (0);
+	}
+	close (sd);
+}
+
+/* a run over the targets, how many of them it reports */
+static int
+changes_run (time_t refresh, const char **names, const int *states, int n, int *full, time_t age)
+{
+	np_changes *c;
+	int i, reported = 0;
+
+	c = np_changes_load (refresh);
+	for (i = 0; i < n; i++)
+		if (np_changes_check (c, names[i], states[i]))
+			reported++;
+	*full = c->full;
+	/* as if the last full report was that long ago */
+	c->full_at -= age;
+	np_changes_save (c);
+	return reported;
+}
+
+int
+main (int argc, char **argv)
+{
+	const char *names[] = { "alpha:80", "beta:80", "gamma:80", "delta:80" };
+	int states[] = { STATE_OK, STATE_OK, STATE_CRITICAL, STATE_OK };
+	int full;
+	unsigned long counts[5] = { 0 }, lines, taken, moved = 0, total;
+	unsigned int i, s4, s5;
+	char host[32], source[80], *p;
+	np_targets *t;
+	FILE *fp;
+	int fd, even;
+
+	plan_tests (22);
+
+	ok (np_targets_shard ("1/1") == OK && np_targets_shard ("3/4") == OK, "Shards");
+	ok (np_targets_shard ("0/4") == ERROR && np_targets_shard ("5/4") == ERROR &&
+	    np_targets_shard ("1/0") == ERROR && np_targets_shard ("1") == ERROR &&
+	    np_targets_shard ("1/2x") == ERROR && np_targets_shard ("/2") == ERROR &&
+	    np_targets_shard ("-1/2") == ERROR, "Not shards");
+
+	/* every host in exactly one shard, about as many in each */
+	for (i = 0; i < HOSTS; i++) {
+		snprintf (host, sizeof (host), "host%u.example.com", i);
+		s4 = np_targets_shard_of (host, 4);
+		s5 = np_targets_shard_of (host, 5);
+		counts[s5]++;
+		if (s4 != s5 && s5 != 4)
+			moved++;
+	}
+	for (i = 0, even = TRUE, total = 0; i < 5; i++) {
+		total += counts[i];
+		if (counts[i] < HOSTS / 5 * 9 / 10 || counts[i] > HOSTS / 5 * 11 / 10)
+			even = FALSE;
+	}
+	ok (total == HOSTS && even, "Spread over the shards");
+	ok (moved == 0, "A fifth shard takes only from the others");
+	ok (np_targets_shard_of ("host1.example.com", 5) == np_targets_shard_of ("host1.example.com", 5),
+	    "The same shard every time");
+	ok (np_targets_shard_of ("anything", 1) == 0, "One shard");
+
+	fd = mkstemp (list);
+	fp = fdopen (fd, "w");
+	fprintf (fp, "# a comment\n\n   \n  spaced  \t\n");
+	for (i = 0; i < NP_TARGETS_LINE_MAX + 10; i++)
+		fputc ('x', fp);
+	fputc ('\n', fp);
+	for (i = 0; i < 1000; i++)
+		fprintf (fp, "host%u.example.com\n", i);
+	fprintf (fp, "last");
+	fclose (fp);
+
+	np_targets_shard ("1/1");
+	t = np_targets_open (list);
+	ok (t != NULL, "Opened");
+	p = np_targets_next (t);
+	ok (p != NULL && strcmp (p, "spaced") == 0, "Blanks stripped, comments skipped");
+	ok (p != NULL && (p = np_targets_next (t)) != NULL && strcmp (p, "host0.example.com") == 0 &&
+	    t->too_long == 1, "A line too long skipped");
+	while ((p = np_targets_next (t)) != NULL && strcmp (p, "last") != 0)
+		;
+	ok (p != NULL && np_targets_next (t) == NULL && t->lines == 1002, "A last line without a newline");
+	np_targets_close (t);
+
+	for (i = 1, total = 0; i <= 4; i++) {
+		snprintf (source, sizeof (source), "%u/4", i);
+		np_targets_shard (source);
+		taken = read_shard (list, &lines);
+		total += taken;
+		counts[i - 1] = taken;
+	}
+	ok (total == 1002 && lines == 1002, "The shards of a list add up to it");
+	ok (counts[0] > 150 && counts[1] > 150 && counts[2] > 150 && counts[3] > 150, "Each shard takes some");
+	np_targets_shard ("1/1");
+
+	ok (np_targets_open ("/nonexistent/test_targets") == NULL && errno == ENOENT, "No list");
+	ok (np_targets_open ("unix:/nonexistent/test_targets") == NULL, "No socket");
+	ok (np_targets_open ("tcp:nohost") == NULL && errno == EINVAL, "No port");
+
+	snprintf (source, sizeof (source), "unix:%s.sock", list);
+	serve (source + 5, "alpha\n# not this\nbeta\n");
+	taken = read_shard (source, &lines);
+	wait (NULL);
+	unlink (source + 5);
+	ok (taken == 2 && lines == 2, "From a local socket");
+
+	unlink (list);
+
+	/* the states of the targets across runs */
+	mkdtemp (state_dir);
+	setenv ("MP_STATE_PATH", state_dir, 1);
+	np_init ("check_test_targets", argc, argv);
+	ok (changes_run (3600, names, states, 3, &full, 0) == 3 && full, "All of them the first time");
+	ok (changes_run (3600, names, states, 3, &full, 0) == 0 && !full, "None when nothing changed");
+	states[1] = STATE_WARNING;
+	ok (changes_run (3600, names, states, 4, &full, 0) == 2, "One that changed and one that is new");
+	ok (changes_run (3600, names + 1, states + 1, 2, &full, 100) == 0, "None that went away");
+	ok (changes_run (50, names, states, 4, &full, 0) == 4 && full, "All of them once the refresh is due");
+	ok (changes_run (0, names, states, 4, &full, 1000000) == 0 && !full, "No full report without a refresh");
+	np_cleanup ();
+	system (np_arena_printf ("rm -rf %s", state_dir));
+
+	return exit_status ();
+}
@@ -25,8 +25,10 @@ main(void)
 {
 	char **server_expect;
 	int server_expect_count = 3;
+	np_expect_state state = NP_EXPECT_STATE_INIT;
+	const char *response = "XX CXX bb XXXC";
 
-	plan_tests(9);
+	plan_tests(15);
 
 	server_expect = malloc(sizeof(char*) * server_expect_count);
 
@@ -52,7 +54,28 @@ main(void)
 	   "Test not matching all strings");
 	ok(np_expect_match("XX XX", server_expect, server_expect_count, NP_MATCH_ALL) == NP_MATCH_RETRY,
 	   "Test not matching any string (testing all)");
-	 
+
+	/* a response read a piece at a time */
+	ok(np_expect_match_more(&state, "b", 1, server_expect, server_expect_count, NP_MATCH_EXACT) == NP_MATCH_RETRY,
+	   "Test beginning of an expect string in the first piece");
+	ok(np_expect_match_more(&state, "bb XX", 5, server_expect, server_expect_count, NP_MATCH_EXACT) == NP_MATCH_SUCCESS,
+	   "Test rest of it in the next piece");
+	np_expect_free(&state);
+	ok(np_expect_match_more(&state, "A", 1, server_expect, server_expect_count, NP_MATCH_EXACT) == NP_MATCH_RETRY &&
+	   np_expect_match_more(&state, "AX", 2, server_expect, server_expect_count, NP_MATCH_EXACT) == NP_MATCH_FAILURE,
+	   "Test beginning that stops matching in the next piece");
+	np_expect_free(&state);
+	ok(np_expect_match_more(&state, response, 4, server_expect, server_expect_count, 0) == NP_MATCH_RETRY &&
+	   np_expect_match_more(&state, response, 5, server_expect, server_expect_count, 0) == NP_MATCH_RETRY,
+	   "Test substring not complete yet");
+	ok(np_expect_match_more(&state, response, 9, server_expect, server_expect_count, 0) == NP_MATCH_SUCCESS,
+	   "Test substring across the pieces");
+	np_expect_free(&state);
+	ok(np_expect_match_more(&state, response, 13, server_expect, server_expect_count, NP_MATCH_ALL) == NP_MATCH_RETRY &&
+	   np_expect_match_more(&state, "XX CXX bb XXXCC AA", 18, server_expect, server_expect_count, NP_MATCH_ALL) == NP_MATCH_SUCCESS,
+	   "Test matching all strings over the pieces");
+	np_expect_free(&state);
+
 
 	return exit_status();
 }
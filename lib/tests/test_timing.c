@@ -0,0 +1,90 @@
+/*****************************************************************************
+* 
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+* 
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+* 
+* 
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_timing.h"
+#include "tap.h"
+
+static void
+count_span(const char *name, double seconds, void *arg)
+{
+	(*(int *) arg)++;
+}
+
+int
+main(void)
+{
+	char *argv[] = { "check_test", "-H", "--timing-perfdata", "host", NULL };
+	int argc = 4;
+	char *perfdata;
+	int names = 0;
+
+	plan_tests(15);
+
+	np_span_begin("off");
+	np_span_end();
+	ok(np_span_elapsed("off") == 0, "No spans before timing is turned on");
+	perfdata = np_timing_perfdata();
+	ok(strcmp(perfdata, "") == 0, "No perfdata before timing is turned on");
+
+	np_timing_opts(&argc, argv);
+	ok(argc == 3, "--timing-perfdata is taken out of the arguments");
+	ok(strcmp(argv[1], "-H") == 0 && strcmp(argv[2], "host") == 0 && argv[3] == NULL,
+	   "The other arguments keep their order");
+	ok(np_timing_enabled() == NP_TIMING_PERFDATA, "Timing perfdata turned on");
+
+	np_span_begin("connect");
+	usleep(20000);
+	np_span_end();
+	np_span_begin("response");
+	np_span_begin("firstbyte");
+	usleep(10000);
+	np_span_end();
+	np_span_end();
+	np_span_begin("connect");
+	np_span_end();
+	np_span_begin("parse");
+
+	ok(np_span_elapsed("connect") >= 0.02, "Spans of one name add up");
+	ok(np_span_elapsed("firstbyte") >= 0.01, "Nested span");
+	ok(np_span_elapsed("response") >= np_span_elapsed("firstbyte"), "Outer span holds the nested one");
+	ok(np_span_elapsed("parse") == 0, "Open span not counted");
+	ok(np_span_elapsed("dns") == 0, "No such span");
+
+	perfdata = np_timing_perfdata();
+	ok(strncmp(perfdata, "timing_connect=", 15) == 0 && strstr(perfdata, " timing_response=") &&
+	   strstr(perfdata, " timing_firstbyte=") && strstr(perfdata, " timing_parse=0.000000s;;;0.000000;") &&
+	   strstr(perfdata + 1, "timing_connect=") == NULL,
+	   "Perfdata has every name once, in the order they began: %s", perfdata);
+
+	perfdata = np_resource_usage();
+	ok(strncmp(perfdata, "rusage_user=", 12) == 0 && strstr(perfdata, " rusage_maxrss=") &&
+	   strstr(perfdata, " rusage_ivcsw=") && strstr(perfdata, " rusage_children_sys="),
+	   "Resource usage as perfdata: %s", perfdata);
+	ok(strstr(np_timing_perfdata(), "rusage_") == NULL, "No resource usage unless asked for");
+
+	np_span_each(count_span, &names);
+	ok(names == 4, "Every span name once");
+	np_timing_reset();
+	names = 0;
+	np_span_each(count_span, &names);
+	ok(names == 0 && np_span_elapsed("connect") == 0, "No spans after a reset");
+
+	return exit_status();
+}
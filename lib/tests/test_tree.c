@@ -0,0 +1,149 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_arena.h"
+#include "utils_tree.h"
+#include <sys/stat.h>
+#include <utime.h>
+#include "tap.h"
+
+static char root[] = "/tmp/test_tree.XXXXXX";
+static uintmax_t expect_bytes;
+
+static void
+make(const char *name, int dir, size_t size)
+{
+	char path[256];
+	struct stat st;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	if (dir) {
+		mkdir(path, 0700);
+	} else if ((fp = fopen(path, "w")) != NULL) {
+		while (size--)
+			fputc('x', fp);
+		fclose(fp);
+	}
+	if (stat(path, &st) == 0)
+		expect_bytes += (uintmax_t)st.st_blocks * 512;
+}
+
+/* as if the directory had changed that long ago */
+static void
+age(const char *name, time_t ago)
+{
+	char path[256];
+	struct utimbuf t;
+
+	snprintf(path, sizeof(path), "%s%s%s", root, *name ? "/" : "", name);
+	t.actime = t.modtime = time(NULL) - ago;
+	utime(path, &t);
+}
+
+static void
+walk(np_tree_dir **cached, np_tree_dir **tree, np_tree_total *total, int threads, time_t max_age)
+{
+	char *paths[] = { root };
+
+	np_tree_walk(paths, 1, cached, tree, threads, max_age);
+	memset(total, 0, sizeof(np_tree_total));
+	np_tree_sum(*tree, total);
+}
+
+int
+main(void)
+{
+	char *missing[] = { "/nonexistent/test_tree" };
+	np_tree_dir *tree, *again, *last, **loaded;
+	np_tree_total total;
+	struct stat st;
+	char *text;
+
+	plan_tests(17);
+
+	ok(mkdtemp(root) != NULL, "A tree to walk");
+	if (stat(root, &st) == 0)
+		expect_bytes = (uintmax_t)st.st_blocks * 512;
+	make("a", FALSE, 5000);
+	make("sub", TRUE, 0);
+	make("sub/b", FALSE, 100);
+	make("sub/deep", TRUE, 0);
+	make("sub/deep/c", FALSE, 10000);
+	make("empty", TRUE, 0);
+	age("sub/deep", 100);
+	age("sub", 100);
+	age("empty", 100);
+	age("", 100);
+
+	walk(NULL, &tree, &total, 1, 3600);
+	ok(total.files == 3 && total.dirs == 4 && total.errors == 0, "Files and directories");
+	ok(total.bytes == expect_bytes, "The blocks of all of them");
+	ok(total.dirs_cached == 0, "Nothing cached");
+	ok(tree->nsub == 2 && strcmp(tree->sub[0]->name, "empty") == 0 && strcmp(tree->sub[1]->name, "sub") == 0,
+	   "Subdirectories sorted by name");
+	np_tree_free(tree);
+
+	walk(NULL, &tree, &total, 4, 3600);
+	ok(total.files == 3 && total.dirs == 4 && total.bytes == expect_bytes, "The same with four threads");
+
+	text = np_tree_to_string(&tree, 1);
+	ok(np_tree_from_string(text, &loaded) == 1 && strcmp(loaded[0]->name, root) == 0 &&
+	   loaded[0]->sub[1]->sub[0]->files == 1, "Through the state and back");
+	ok(np_tree_find(loaded, 1, root) == loaded[0] && np_tree_find(loaded, 1, "/elsewhere") == NULL, "Found by path");
+
+	walk(loaded, &again, &total, 2, 3600);
+	ok(total.dirs_cached == 4 && total.files == 3 && total.bytes == expect_bytes, "Every directory from the cache");
+	np_tree_free(loaded[0]);
+	free(loaded);
+
+	make("sub/new", FALSE, 10);
+	age("sub", -1000);
+	walk(&again, &last, &total, 2, 3600);
+	ok(total.dirs_cached == 3 && !last->sub[1]->cached && total.files == 4 && total.bytes == expect_bytes,
+	   "A changed directory is read again");
+	np_tree_free(tree);
+
+	walk(&last, &tree, &total, 2, 3600);
+	ok(total.dirs_cached == 3 && !tree->sub[1]->cached && total.files == 4,
+	   "And again when it had not changed before it was read");
+	np_tree_free(tree);
+	np_tree_free(last);
+
+	walk(&again, &last, &total, 2, 0);
+	ok(total.dirs_cached == 0 && total.files == 4, "Nothing cached with no cache age");
+	np_tree_free(last);
+	np_tree_free(again);
+
+	np_tree_walk(missing, 1, NULL, &tree, 2, 3600);
+	memset(&total, 0, sizeof(total));
+	np_tree_sum(tree, &total);
+	ok(tree->error == ENOENT && total.errors == 1, "A tree that is not there");
+	np_tree_free(tree);
+
+	ok(np_tree_from_string("tree 1\n0 5 6 7 8\n", &loaded) == -1 && loaded == NULL, "No name");
+	ok(np_tree_from_string("tree 1\n1 5 6 7 8 /x\n", &loaded) == -1, "A subdirectory missing");
+	ok(np_tree_from_string("tree 0\n", &loaded) == 0, "No trees");
+	free(loaded);
+	ok(np_tree_from_string("other\n", &loaded) == -1, "Not a tree");
+
+	system(np_arena_printf("rm -rf %s", root));
+	return exit_status();
+}
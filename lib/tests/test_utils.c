@@ -26,21 +26,68 @@
 #include <sys/stat.h>
 
 #include "utils_base.c"
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+
+static int
+test_entry_return (int argc, char **argv)
+{
+	return STATE_CRITICAL;
+}
+
+static int
+test_entry_die (int argc, char **argv)
+{
+	np_init ("check_test_entry", argc, argv);
+	die (STATE_WARNING, "%s", "");
+	return STATE_OK;
+}
+
+static int
+test_entry_message (int argc, char **argv)
+{
+	np_init ("check_test_thread", argc, argv);
+	die (STATE_CRITICAL, "%s - %s\n", np_plugin ()->plugin_name, "message");
+	return STATE_OK;
+}
+
+#ifdef HAVE_LIBPTHREAD
+struct test_thread {
+	np_exec_context context;
+	int result;
+	int clean;
+};
+
+static void *
+test_thread (void *arg)
+{
+	struct test_thread *t = arg;
+
+	t->clean = np_plugin () == NULL;
+	t->result = np_exec_capture (&t->context, test_entry_message, 0, NULL);
+	return NULL;
+}
+#endif
 
 int
 main (int argc, char **argv)
 {
 	char state_path[1024];
+	char store_dir[] = "/tmp/test_utils.XXXXXX";
+	char store_key[32], store_value[32];
+	double binary_values[3] = { 1.5, 0, -4294967296.0 };
+	struct stat st;
 	range	*range;
 	double	temp;
 	thresholds *thresholds = NULL;
-	int	i, rc;
+	int	i, rc, temp_ms;
 	char	*temp_string;
 	state_key *temp_state_key = NULL;
 	state_data *temp_state_data;
 	time_t	current_time;
 
-	plan_tests(185);
+	plan_tests(223);
 
 	ok( this_monitoring_plugin==NULL, "monitoring_plugin not initialised");
 
@@ -199,6 +246,23 @@ main (int argc, char **argv)
 	ok( get_status(19, thresholds) == STATE_WARNING, "19 - warning");
 	ok( get_status(21, thresholds) == STATE_CRITICAL, "21 - critical");
 
+	{
+		double values[] = { -31, -29, -11, -10, -2, -1, 19, 21, NAN, INFINITY, -INFINITY };
+		int states[11], expected[11], i, same = TRUE;
+		for (i = 0; i < 11; i++)
+			expected[i] = get_status(values[i], thresholds);
+		ok( get_status_batch(values, states, 11, thresholds) == STATE_CRITICAL, "Batch gives the worst status");
+		for (i = 0; i < 11; i++)
+			same = same && states[i] == expected[i];
+		ok( same, "Batch gives the same statuses as get_status");
+		ok( states[8] == STATE_CRITICAL, "NaN is outside the ranges");
+
+		rc = _set_thresholds(&thresholds, "@~:", NULL);
+		ok( get_status_batch(values, states, 11, thresholds) == STATE_WARNING && states[8] == STATE_WARNING, "Everything, NaN too, is inside @~:");
+		rc = _set_thresholds(&thresholds, NULL, NULL);
+		ok( get_status_batch(values, states, 11, thresholds) == STATE_OK && states[8] == STATE_OK, "No thresholds, no alerts");
+	}
+
 	char *test;
 	test = np_escaped_string("bob\\n");
 	ok( strcmp(test, "bob\n") == 0, "bob\\n ok");
@@ -220,6 +284,10 @@ main (int argc, char **argv)
 	ok( strcmp(test, "and\\or") == 0, "and\\\\or okay");
 	free(test);
 
+	test = np_escaped_string("trailing\\");
+	ok( strcmp(test, "trailing\\") == 0, "A backslash at the end stays");
+	free(test);
+
 	test = np_escaped_string("bo\\gus");
 	ok( strcmp(test, "bogus") == 0, "bo\\gus okay");
 	free(test);
@@ -446,6 +514,91 @@ main (int argc, char **argv)
 	/* Check time is set to current_time */
 	ok(system("cmp var/generated var/statefile > /dev/null")!=0, "Generated file should be different this time");
 	ok(this_monitoring_plugin->state->state_data->time-current_time<=1, "Has time generated from current time");
+
+	/* String data longer than the first read buffer */
+	temp_string = (char *) malloc(5000);
+	memset(temp_string, 'x', 4999);
+	temp_string[4999] = '\0';
+	np_state_write_string(0, temp_string);
+	temp_state_data = np_state_read();
+	ok(temp_state_data!=NULL, "Can read long state data");
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, temp_string), "Long state data read in full");
+
+	/* Binary data, zeros and all */
+	np_state_write_binary(1234567890, binary_values, sizeof(binary_values));
+	temp_state_data = np_state_read();
+	ok(temp_state_data && temp_state_data->time==1234567890, "Got time of binary data");
+	ok(temp_state_data && temp_state_data->length==sizeof(binary_values) &&
+	   !memcmp(temp_state_data->data, binary_values, sizeof(binary_values)), "Binary data read back as written");
+	temp_state_key->data_version=53;
+	ok(np_state_read()==NULL, "Older data version gives NULL for binary data");
+	temp_state_key->data_version=54;
+	np_state_write_string(0, "Text again");
+	temp_state_data = np_state_read();
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, "Text again"), "Text state replaces binary state");
+
+	/* The same through the state store */
+	if (mkdtemp(store_dir) == NULL) {
+		diag("Cannot create a temporary directory: %s", strerror(errno));
+		return 1;
+	}
+	setenv("MP_STATE_PATH", store_dir, 1);
+	setenv("MP_STATE_STORE", "1", 1);
+	np_enable_state("storekey", 54);
+	temp_state_key = this_monitoring_plugin->state;
+	ok(np_state_read()==NULL, "Got no state data from a new store");
+
+	np_state_write_string(1234567890, "String to read");
+	temp_state_data = np_state_read();
+	ok(temp_state_data && temp_state_data->time==1234567890, "Got time from the store");
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, "String to read"), "Data from the store as expected");
+	ok(stat(temp_state_key->_filename, &st)!=0, "No state file for short data");
+
+	temp_state_key->data_version=53;
+	ok(np_state_read()==NULL, "Older data version gives NULL from the store");
+	temp_state_key->data_version=54;
+
+	np_state_write_string(0, temp_string);
+	temp_state_data = np_state_read();
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, temp_string), "Long data read through the store");
+	ok(stat(temp_state_key->_filename, &st)==0, "Long data written in the state file");
+
+	np_state_write_string(0, "Short again");
+	temp_state_data = np_state_read();
+	ok(temp_state_data && !strcmp((char *)temp_state_data->data, "Short again"), "Short data back in the store");
+	ok(stat(temp_state_key->_filename, &st)!=0, "Stale state file removed");
+
+	np_state_write_binary(1234567890, binary_values, sizeof(binary_values));
+	temp_state_data = np_state_read();
+	ok(temp_state_data && temp_state_data->length==sizeof(binary_values) &&
+	   !memcmp(temp_state_data->data, binary_values, sizeof(binary_values)), "Binary data through the store");
+	ok(stat(temp_state_key->_filename, &st)!=0, "No state file for short binary data");
+	np_state_write_binary(0, temp_string, 5000);
+	temp_state_data = np_state_read();
+	ok(temp_state_data && temp_state_data->length==5000 &&
+	   !memcmp(temp_state_data->data, temp_string, 5000), "Long binary data read through the store");
+	ok(stat(temp_state_key->_filename, &st)==0, "Long binary data written in the state file");
+
+	/* More keys than the store first has room for */
+	for (i=0; i<3000; i++) {
+		sprintf(store_key, "key_%d", i);
+		sprintf(store_value, "value %d", i);
+		np_enable_state(store_key, 1);
+		np_state_write_string(0, store_value);
+	}
+	for (i=0, rc=TRUE; i<3000 && rc; i++) {
+		sprintf(store_key, "key_%d", i);
+		sprintf(store_value, "value %d", i);
+		np_enable_state(store_key, 1);
+		temp_state_data = np_state_read();
+		rc = temp_state_data && !strcmp((char *)temp_state_data->data, store_value);
+	}
+	ok(rc, "Read back 3000 keys from the store");
+
+	unsetenv("MP_STATE_STORE");
+	sprintf(state_path, "rm -rf %s", store_dir);
+	system(state_path);
+	free(temp_string);
 	
 
 	/* Don't know how to automatically test this. Need to be able to redefine die and catch the error */
@@ -506,6 +659,40 @@ main (int argc, char **argv)
 	ok(ERROR==mp_translate_state("10"), "Translate state string: bad numeric string 3");
 	ok(ERROR==mp_translate_state(""), "Translate state string: empty string");
 
+	np_exec_context context;
+	ok(np_exec_run(&context, test_entry_return, argc, argv)==STATE_CRITICAL, "np_exec_run returns the entry's result");
+	ok(np_exec_run(&context, test_entry_die, argc, argv)==STATE_WARNING, "die() inside np_exec_run returns to the caller");
+	ok(this_monitoring_plugin==NULL, "monitoring_plugin released after in-process run");
+	ok(!np_exec_active(), "No execution context active afterwards");
+	ok(np_exec_capture(&context, test_entry_message, argc, argv)==STATE_CRITICAL, "np_exec_capture returns the state of die()");
+	ok(context.message && !strcmp(context.message, "check_test_thread - message\n"), "np_exec_capture keeps the message of die()");
+	free(context.message);
+
+#ifdef HAVE_LIBPTHREAD
+	{
+		struct test_thread t;
+		pthread_t thread;
+
+		np_init("check_test_main", argc, argv);
+		pthread_create(&thread, NULL, test_thread, &t);
+		pthread_join(thread, NULL);
+		ok(t.clean && t.result==STATE_CRITICAL && t.context.message &&
+		   !strcmp(t.context.message, "check_test_thread - message\n"), "A check runs on a thread of its own");
+		ok(np_plugin() && !strcmp(np_plugin()->plugin_name, "check_test_main"), "and leaves the context of this thread alone");
+		free(t.context.message);
+		np_cleanup();
+	}
+#else
+	skip(2, "no threads");
+#endif
+
+	/* deadlines */
+	ok(np_deadline(0) == 0, "np_deadline: none without a timeout");
+	ok(np_deadline_ms(0) == -1, "np_deadline_ms: no deadline waits forever");
+	ok(np_deadline_ms(np_clock() - 1) == 0, "np_deadline_ms: passed deadline");
+	temp_ms = np_deadline_ms(np_deadline(2));
+	ok(temp_ms > 1000 && temp_ms <= 2001, "np_deadline_ms: time left until the deadline");
+
 	return exit_status();
 }
 
@@ -0,0 +1,193 @@
+/*****************************************************************************
+*
+* Monitoring Plugins arena allocator
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds the memory a plugin needs until it exits, mostly the
+* strings its output is built from. The arena hands out pieces of large
+* chunks by moving a pointer, and a string that grows at the end of the
+* current chunk grows in place, so building the output of a check takes a
+* few malloc() calls instead of one malloc() and one full copy for every
+* piece added. All of it is freed at once by np_cleanup().
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_arena.h"
+#include <stdarg.h>
+
+/* chunks are at least this large, larger requests get a chunk of their own */
+#define ARENA_CHUNK 16384
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+} arena_chunk;
+
+/* the data starts right after the aligned header */
+#define CHUNK_DATA(c) ((char *)(c) + ARENA_ROUND (sizeof (arena_chunk)))
+
+/* the arena of the check running on this thread */
+static NP_THREAD_LOCAL arena_chunk *arena = NULL;
+
+void *
+np_arena_alloc (size_t len)
+{
+	arena_chunk *c;
+	size_t size;
+	void *p;
+
+	len = ARENA_ROUND (len ? len : 1);
+	if (arena == NULL || arena->size - arena->used < len) {
+		size = len > ARENA_CHUNK ? len : ARENA_CHUNK;
+		if ((c = malloc (ARENA_ROUND (sizeof (arena_chunk)) + size)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		c->size = size;
+		c->used = 0;
+		/* keep filling the current chunk if the new one is only for this */
+		if (arena != NULL && size == len) {
+			c->next = arena->next;
+			arena->next = c;
+			c->used = len;
+			return CHUNK_DATA (c);
+		}
+		c->next = arena;
+		arena = c;
+	}
+	p = CHUNK_DATA (arena) + arena->used;
+	arena->used += len;
+	return p;
+}
+
+char *
+np_arena_strdup (const char *s)
+{
+	size_t len = strlen (s) + 1;
+
+	return memcpy (np_arena_alloc (len), s, len);
+}
+
+char *
+np_arena_printf (const char *fmt, ...)
+{
+	va_list ap;
+	char *p;
+	int n;
+
+	va_start (ap, fmt);
+	n = vsnprintf (NULL, 0, fmt, ap);
+	va_end (ap);
+	if (n < 0)
+		die (STATE_UNKNOWN, _("Cannot format string\n"));
+	p = np_arena_alloc ((size_t) n + 1);
+	va_start (ap, fmt);
+	vsnprintf (p, (size_t) n + 1, fmt, ap);
+	va_end (ap);
+	return p;
+}
+
+void
+np_arena_free (void)
+{
+	arena_chunk *c;
+
+	while ((c = arena) != NULL) {
+		arena = c->next;
+		free (c);
+	}
+}
+
+/* make room for len more bytes and the terminating '\0' */
+static void
+str_reserve (np_str *s, size_t len)
+{
+	size_t need = s->len + len + 1, size;
+	char *buf;
+
+	if (need <= s->size)
+		return;
+
+	/* the last thing in the current chunk simply grows into the rest of it */
+	if (s->buf != NULL && arena != NULL &&
+	    s->buf + s->size == CHUNK_DATA (arena) + arena->used &&
+	    s->buf + need <= CHUNK_DATA (arena) + arena->size) {
+		arena->used = s->buf - CHUNK_DATA (arena) + ARENA_ROUND (need);
+		s->size = ARENA_ROUND (need);
+		return;
+	}
+
+	size = s->size ? s->size * 2 : 64;
+	while (size < need)
+		size *= 2;
+	buf = np_arena_alloc (size);
+	if (s->len)
+		memcpy (buf, s->buf, s->len);
+	s->buf = buf;
+	s->size = size;
+}
+
+void
+np_str_append (np_str *s, const char *text, size_t len)
+{
+	str_reserve (s, len);
+	memcpy (s->buf + s->len, text, len);
+	s->len += len;
+	s->buf[s->len] = '\0';
+}
+
+void
+np_str_puts (np_str *s, const char *text)
+{
+	np_str_append (s, text, strlen (text));
+}
+
+void
+np_str_printf (np_str *s, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	/* mostly it fits into what is left */
+	str_reserve (s, 0);
+	va_start (ap, fmt);
+	n = vsnprintf (s->buf + s->len, s->size - s->len, fmt, ap);
+	va_end (ap);
+	if (n < 0)
+		die (STATE_UNKNOWN, _("Cannot format string\n"));
+	if ((size_t) n >= s->size - s->len) {
+		str_reserve (s, (size_t) n);
+		va_start (ap, fmt);
+		vsnprintf (s->buf + s->len, s->size - s->len, fmt, ap);
+		va_end (ap);
+	}
+	s->len += (size_t) n;
+}
+
+const char *
+np_str_string (np_str *s)
+{
+	return s->buf ? s->buf : "";
+}
@@ -0,0 +1,32 @@
+#ifndef _UTILS_ARENA_
+#define _UTILS_ARENA_
+/* Header file for utils_arena: memory for one run of a plugin */
+
+#include <stddef.h>
+
+/* Allocations from the arena are never freed one by one, np_cleanup()
+ * (or np_arena_free()) gives all of them back at once. Running out of
+ * memory dies with STATE_UNKNOWN. */
+void *np_arena_alloc (size_t);
+char *np_arena_strdup (const char *);
+char *np_arena_printf (const char *, ...)
+	__attribute__((format (printf, 1, 2)));
+void np_arena_free (void);
+
+/* A string built up piece by piece in the arena, in place of chains of
+ * xasprintf(&s, "%s...", s, ...). Start from np_str s = NP_STR_INIT;
+ * np_str_string(&s) is "" until something was added. */
+typedef struct np_str {
+	char *buf;
+	size_t len;
+	size_t size;
+} np_str;
+#define NP_STR_INIT { NULL, 0, 0 }
+
+void np_str_append (np_str *, const char *, size_t);
+void np_str_puts (np_str *, const char *);
+void np_str_printf (np_str *, const char *, ...)
+	__attribute__((format (printf, 2, 3)));
+const char *np_str_string (np_str *);
+
+#endif /* _UTILS_ARENA_ */
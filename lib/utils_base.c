@@ -27,20 +27,126 @@
 #include "common.h"
 #include <stdarg.h>
 #include "utils_base.h"
+#include "utils_arena.h"
+#include "utils_metrics.h"
 #include <ctype.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/types.h>
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #define np_free(ptr) { if(ptr) { free(ptr); ptr = NULL; } }
 
-monitoring_plugin *this_monitoring_plugin=NULL;
+/* The check running on this thread: every thread can run one of its own
+ * with np_exec_run() */
+NP_THREAD_LOCAL monitoring_plugin *this_monitoring_plugin=NULL;
 
-unsigned int timeout_state = STATE_CRITICAL;
-unsigned int timeout_interval = DEFAULT_SOCKET_TIMEOUT;
+static NP_THREAD_LOCAL np_exec_context *this_exec_context=NULL;
+
+NP_THREAD_LOCAL unsigned int timeout_state = STATE_CRITICAL;
+NP_THREAD_LOCAL unsigned int timeout_interval = DEFAULT_SOCKET_TIMEOUT;
+
+np_exec_stats np_exec_counters;
 
 int _np_state_read_file(FILE *);
+static state_data *_np_state_read(void);
+static int _np_state_read_binary(void);
+static void _np_state_write_counted(time_t, const void *, size_t, int);
+static void _np_state_write(time_t, const void *, size_t, int);
+
+/*
+ * State written with np_state_write_binary() goes in the state file as
+ * this header and the data right after it, so that it is read with one
+ * pread() and written with one write().
+ */
+#define NP_STATE_BINARY_MAGIC "NPSTATEB"
+
+typedef struct {
+	char     magic[8];
+	int32_t  format_version;
+	int32_t  data_version;
+	int64_t  time;
+	uint64_t length;
+	} np_state_binary_header;
+
+#ifdef HAVE_MMAP
+/*
+ * With MP_STATE_STORE set, the state of all plugins of an user is kept in
+ * a single file, <state>/<euid>/state.store, mapped in memory: a header, a
+ * hash table of the keys, then fixed-size records. A record is updated in
+ * place, its sequence number being odd while it is written, so that readers
+ * retry instead of reading half of it; writers hold a lock on the file. Data
+ * too long for a record is written in the usual state file, and the record
+ * says so.
+ */
+#define NP_STATE_STORE_MAGIC "NPSTORE1"
+#define NP_STATE_STORE_BUCKETS 262144
+#define NP_STATE_STORE_FIRST_RECORDS 1024
+#define NP_STATE_STORE_KEY_MAX 88
+#define NP_STATE_STORE_DATA_MAX 384
+#define NP_STATE_STORE_NONE 0xffffffffU
+#define NP_STATE_STORE_IN_FILE 1	/* the data is in the state file */
+
+typedef struct {
+	char     magic[8];
+	uint32_t record_size;
+	uint32_t nbuckets;
+	uint32_t nrecords;
+	uint32_t capacity;
+	char     unused[40];
+	} np_state_store_header;
+
+typedef struct {
+	uint32_t seq;
+	uint32_t next;
+	uint32_t hash;
+	uint32_t flags;
+	uint32_t key_len;
+	uint32_t data_len;
+	int32_t  data_version;
+	uint32_t unused;
+	int64_t  time;
+	char     key[NP_STATE_STORE_KEY_MAX];
+	char     data[NP_STATE_STORE_DATA_MAX];
+	} np_state_store_record;
+
+static struct {
+	int    fd;
+	char   *path;
+	char   *map;
+	size_t map_len;
+	} np_state_store = { -1, NULL, NULL, 0 };
+
+#ifdef __GNUC__
+# define np_state_store_barrier() __sync_synchronize()
+#else
+# define np_state_store_barrier()
+#endif
+
+/* The lock on the file only keeps other processes out, threads of this one
+ * share the mapping and take turns on it. die() lets go of it. */
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t np_state_store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static NP_THREAD_LOCAL int np_state_store_locked = FALSE;
+# define np_state_store_lock() \
+	do { pthread_mutex_lock(&np_state_store_mutex); np_state_store_locked = TRUE; } while(0)
+# define np_state_store_unlock() \
+	do { np_state_store_locked = FALSE; pthread_mutex_unlock(&np_state_store_mutex); } while(0)
+#else
+# define np_state_store_lock()
+# define np_state_store_unlock()
+#endif
+
+static int _np_state_store_open(void);
+static int _np_state_store_read(state_data *);
+static void _np_state_store_write(time_t, const void *, size_t, int);
+#endif /* HAVE_MMAP */
 
 void np_init( char *plugin_name, int argc, char **argv ) {
 	if (this_monitoring_plugin==NULL) {
@@ -54,6 +160,7 @@ void np_init( char *plugin_name, int argc, char **argv ) {
 			die(STATE_UNKNOWN, _("Cannot execute strdup: %s"), strerror(errno));
 		this_monitoring_plugin->argc = argc;
 		this_monitoring_plugin->argv = argv;
+		np_metrics_name(plugin_name);
 	}
 }
 
@@ -67,6 +174,8 @@ void np_set_args( int argc, char **argv ) {
 
 
 void np_cleanup() {
+	/* the points of this run go out before anything else is released */
+	np_metrics_flush();
 	if (this_monitoring_plugin!=NULL) {
 		if(this_monitoring_plugin->state!=NULL) {
 			if(this_monitoring_plugin->state->state_data) {
@@ -80,6 +189,86 @@ void np_cleanup() {
 		np_free(this_monitoring_plugin);
 	}
 	this_monitoring_plugin=NULL;
+	np_arena_free();
+}
+
+/* Locale setup. setlocale() maps the locale archive and the first
+ * gettext() looks for a catalog under every variant of the locale name,
+ * all of it wasted on a run whose messages stay in English. So unless
+ * NP_LOCALE asks for it, the locale is only set when the environment names
+ * one other than C, POSIX or English, and the catalog is only bound by the
+ * first _() that needs a translation. */
+enum {
+	NP_LOCALE_UNSET,	/* np_locale_init not called */
+	NP_LOCALE_NONE,		/* C or English, nothing to translate */
+	NP_LOCALE_PENDING,	/* locale set, catalog not bound yet */
+	NP_LOCALE_BOUND
+};
+static int np_locale_state = NP_LOCALE_UNSET;
+
+static int
+np_locale_untranslated (const char *name)
+{
+	if (name == NULL || *name == '\0')
+		return TRUE;
+	if (!strcmp (name, "POSIX") || !strcmp (name, "C") || !strncmp (name, "C.", 2))
+		return TRUE;
+	return !strncmp (name, "en", 2) && strchr ("_.@", name[2]) != NULL;
+}
+
+/* TRUE if every locale variable in the environment is unset, C, POSIX or
+ * English, where setlocale would change nothing the plugins print */
+static int
+np_locale_default (void)
+{
+	extern char **environ;
+	char **env;
+
+	for (env = environ; env != NULL && *env != NULL; env++) {
+		if (strncmp (*env, "LANG=", 5) && strncmp (*env, "LC_", 3))
+			continue;
+		if (!np_locale_untranslated (strchr (*env, '=') + 1))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+void
+np_locale_init (void)
+{
+	const char *forced = getenv ("NP_LOCALE");
+
+	if (forced != NULL) {
+		setlocale (LC_ALL, forced);
+		bindtextdomain (PACKAGE, LOCALEDIR);
+		textdomain (PACKAGE);
+		np_locale_state = NP_LOCALE_BOUND;
+	} else if (np_locale_default ()) {
+		np_locale_state = NP_LOCALE_NONE;
+	} else {
+		setlocale (LC_ALL, "");
+		np_locale_state = NP_LOCALE_PENDING;
+	}
+}
+
+char *
+np_gettext (const char *msgid)
+{
+	if (np_locale_state == NP_LOCALE_NONE)
+		return (char *) msgid;
+	if (np_locale_state == NP_LOCALE_PENDING) {
+		bindtextdomain (PACKAGE, LOCALEDIR);
+		textdomain (PACKAGE);
+		np_locale_state = NP_LOCALE_BOUND;
+	}
+	return gettext (msgid);
+}
+
+/* The context of the check running on this thread, NULL before np_init() */
+monitoring_plugin *
+np_plugin (void)
+{
+	return this_monitoring_plugin;
 }
 
 /* Hidden function to get a pointer to this_monitoring_plugin for testing */
@@ -93,24 +282,144 @@ die (int result, const char *fmt, ...)
 	if(fmt!=NULL) {
 		va_list ap;
 		va_start (ap, fmt);
-		vprintf (fmt, ap);
+		if (this_exec_context != NULL && this_exec_context->capture) {
+			free (this_exec_context->message);
+			if (vasprintf (&this_exec_context->message, fmt, ap) < 0)
+				this_exec_context->message = NULL;
+		} else {
+			vprintf (fmt, ap);
+		}
 		va_end (ap);
 	}
 
+#if defined(HAVE_MMAP) && defined(HAVE_LIBPTHREAD)
+	if (np_state_store_locked)
+		np_state_store_unlock();
+#endif
 	if(this_monitoring_plugin!=NULL) {
 		np_cleanup();
 	}
+	np_exit (result);
+}
+
+/*
+ * Terminate the current check. Outside of np_exec_run() this is exit(),
+ * inside it the check's result is handed back to the caller. Also safe to
+ * call from the timeout signal handlers.
+ */
+void
+np_exit (int result)
+{
+	if (this_exec_context != NULL) {
+		this_exec_context->result = result;
+		siglongjmp (this_exec_context->env, 1);
+	}
 	exit (result);
 }
 
+/*
+ * Run a plugin entry point in-process. Returns the value returned by entry
+ * or the state passed to die()/np_exit(), and releases the per-invocation
+ * monitoring_plugin state either way so the next check starts clean. Each
+ * thread has contexts of its own, so checks can run on several at once.
+ */
+static int
+np_exec_start (np_exec_context *context, int capture, int (*entry)(int, char **),
+               int argc, char **argv)
+{
+	volatile int result;
+
+	context->previous = this_exec_context;
+	context->capture = capture;
+	context->message = NULL;
+	this_exec_context = context;
+
+	if (sigsetjmp (context->env, 1) == 0)
+		result = entry (argc, argv);
+	else
+		result = context->result;
+
+	this_exec_context = context->previous;
+	fflush (stdout);
+	np_cleanup ();
+
+	return result;
+}
+
+int
+np_exec_run (np_exec_context *context, int (*entry)(int, char **),
+             int argc, char **argv)
+{
+	return np_exec_start (context, FALSE, entry, argc, argv);
+}
+
+/* The same, but the message of die() is kept in context->message, to be
+ * free()d by the caller, instead of being printed */
+int
+np_exec_capture (np_exec_context *context, int (*entry)(int, char **),
+                 int argc, char **argv)
+{
+	return np_exec_start (context, TRUE, entry, argc, argv);
+}
+
+int
+np_exec_active (void)
+{
+	return this_exec_context != NULL;
+}
+
+/* seconds on a clock that does not jump with the time of day */
+double
+np_clock (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+		return (double)ts.tv_sec + (double)ts.tv_nsec / 1.0e9;
+#endif
+	return (double)time (NULL);
+}
+
+/* the deadline this many seconds from now, or none for seconds <= 0 */
+double
+np_deadline (double seconds)
+{
+	return (seconds > 0) ? np_clock () + seconds : 0;
+}
+
+/* the milliseconds left until the deadline, rounded up, as a poll()
+ * timeout: -1 without a deadline, 0 once it has passed */
+int
+np_deadline_ms (double deadline)
+{
+	double left;
+
+	if (deadline == 0)
+		return -1;
+	if ((left = deadline - np_clock ()) <= 0)
+		return 0;
+	return (left * 1000 > INT_MAX) ? INT_MAX : (int)(left * 1000) + 1;
+}
+
+/* Fill in the compiled form of the range that check_range uses */
+static void _compile_range (range *this) {
+	this->lo = this->start_infinity ? -INFINITY : this->start;
+	this->hi = this->end_infinity ? INFINITY : this->end;
+	this->all = this->start_infinity && this->end_infinity;
+	this->outside = this->alert_on == OUTSIDE;
+}
+
 void set_range_start (range *this, double value) {
 	this->start = value;
 	this->start_infinity = FALSE;
+	_compile_range(this);
 }
 
 void set_range_end (range *this, double value) {
 	this->end = value;
 	this->end_infinity = FALSE;
+	_compile_range(this);
 }
 
 range
@@ -154,6 +463,7 @@ range
 	if (temp_range->start_infinity == TRUE ||
 		temp_range->end_infinity == TRUE ||
 		temp_range->start <= temp_range->end) {
+		_compile_range(temp_range);
 		return temp_range;
 	}
 	free(temp_range);
@@ -226,35 +536,8 @@ void print_thresholds(const char *threshold_name, thresholds *my_threshold) {
 int
 check_range(double value, range *my_range)
 {
-	int no = FALSE;
-	int yes = TRUE;
-
-	if (my_range->alert_on == INSIDE) {
-		no = TRUE;
-		yes = FALSE;
-	}
-
-	if (my_range->end_infinity == FALSE && my_range->start_infinity == FALSE) {
-		if ((my_range->start <= value) && (value <= my_range->end)) {
-			return no;
-		} else {
-			return yes;
-		}
-	} else if (my_range->start_infinity == FALSE && my_range->end_infinity == TRUE) {
-		if (my_range->start <= value) {
-			return no;
-		} else {
-			return yes;
-		}
-	} else if (my_range->start_infinity == TRUE && my_range->end_infinity == FALSE) {
-		if (value <= my_range->end) {
-			return no;
-		} else {
-			return yes;
-		}
-	} else {
-		return no;
-	}
+	/* A NaN is outside every range but ~: */
+	return (((my_range->lo <= value) & (value <= my_range->hi)) | my_range->all) ^ my_range->outside;
 }
 
 /* Returns status */
@@ -274,12 +557,37 @@ get_status(double value, thresholds *my_thresholds)
 	return STATE_OK;
 }
 
+/* get_status for count values at once, into states. Returns the worst of
+ * them. The loop has no branches so that the compiler can vectorise it. */
+int
+get_status_batch(const double *values, int *states, size_t count, thresholds *my_thresholds)
+{
+	/* a missing range alerts on nothing, not even NaN */
+	range never = { 0, FALSE, 0, FALSE, INSIDE, 1, 0, FALSE, FALSE };
+	const range *c = my_thresholds->critical ? my_thresholds->critical : &never;
+	const range *w = my_thresholds->warning ? my_thresholds->warning : &never;
+	const double clo = c->lo, chi = c->hi, wlo = w->lo, whi = w->hi;
+	const int call = c->all, cout = c->outside, wall = w->all, wout = w->outside;
+	int worst = STATE_OK;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		int crit = (((clo <= values[i]) & (values[i] <= chi)) | call) ^ cout;
+		int warn = (((wlo <= values[i]) & (values[i] <= whi)) | wall) ^ wout;
+		/* STATE_CRITICAL is 2, STATE_WARNING 1 and STATE_OK 0 */
+		states[i] = (crit << 1) | (warn & ~crit);
+		worst |= states[i];
+	}
+	return worst & STATE_CRITICAL ? STATE_CRITICAL : worst;
+}
+
 char *np_escaped_string (const char *string) {
 	char *data;
 	int i, j=0;
 	data = strdup(string);
 	for (i=0; data[i]; i++) {
-		if (data[i] == '\\') {
+		/* a backslash at the end stays, it escapes nothing */
+		if (data[i] == '\\' && data[i+1] != '\0') {
 			switch(data[++i]) {
 				case 'n':
 					data[j++] = '\n';
@@ -400,27 +708,34 @@ int mp_translate_state (char *state_text) {
  * hopefully a unique key per service/plugin invocation. Use the extra-opts
  * parse of argv, so that uniqueness in parameters are reflected there.
  */
-char *_np_state_generate_key() {
+/*
+ * Hex SHA-1 of the arguments, the default state key of a command line
+ */
+void np_argv_digest(int argc, char **argv, char *keyname) {
 	struct sha1_ctx ctx;
 	int i;
-	char **argv = this_monitoring_plugin->argv;
 	unsigned char result[20];
-	char keyname[41];
-	char *p=NULL;
 
 	sha1_init_ctx(&ctx);
-	
-	for(i=0; i<this_monitoring_plugin->argc; i++) {
+
+	for(i=0; i<argc; i++) {
 		sha1_process_bytes(argv[i], strlen(argv[i]), &ctx);
 	}
 
 	sha1_finish_ctx(&ctx, &result);
-	
+
 	for (i=0; i<20; ++i) {
 		sprintf(&keyname[2*i], "%02x", result[i]);
 	}
 	keyname[40]='\0';
-	
+}
+
+char *_np_state_generate_key() {
+	char keyname[41];
+	char *p=NULL;
+
+	np_argv_digest(this_monitoring_plugin->argc, this_monitoring_plugin->argv, keyname);
+
 	p = strdup(keyname);
 	if(p==NULL) {
 		die(STATE_UNKNOWN, _("Cannot execute strdup: %s"), strerror(errno));
@@ -519,6 +834,17 @@ void np_enable_state(char *keyname, int expected_data_version) {
  * if exceptional error.
  */
 state_data *np_state_read() {
+	double start=np_clock();
+	state_data *this_state_data=_np_state_read();
+
+	np_exec_counters.state_reads++;
+	np_exec_counters.state_read_seconds+=np_clock()-start;
+	if(this_state_data!=NULL)
+		np_exec_counters.state_bytes_read+=this_state_data->length;
+	return this_state_data;
+}
+
+static state_data *_np_state_read(void) {
 	state_data *this_state_data=NULL;
 	FILE *statefile;
 	int rc = FALSE;
@@ -526,6 +852,40 @@ state_data *np_state_read() {
 	if(this_monitoring_plugin==NULL)
 		die(STATE_UNKNOWN, _("This requires np_init to be called"));
 
+#ifdef HAVE_MMAP
+	np_state_store_lock();
+	if(!_np_state_store_open()) {
+		np_state_store_unlock();
+	} else {
+		this_state_data = (state_data *) calloc(1, sizeof(state_data));
+		if(this_state_data==NULL)
+			die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+			    strerror(errno));
+		this_monitoring_plugin->state->state_data = this_state_data;
+
+		/* Keys not in the store yet, or with long data, are in files */
+		rc = _np_state_store_read(this_state_data);
+		np_state_store_unlock();
+		if(rc!=ERROR) {
+			if(rc==FALSE)
+				_cleanup_state_data();
+			return this_monitoring_plugin->state->state_data;
+		}
+		_cleanup_state_data();
+		this_state_data = NULL;
+		rc = FALSE;
+	}
+#endif
+
+	/* Binary state, or none at all, needs no parsing */
+	rc = _np_state_read_binary();
+	if(rc!=ERROR) {
+		if(rc==FALSE)
+			_cleanup_state_data();
+		return this_monitoring_plugin->state->state_data;
+	}
+	rc = FALSE;
+
 	/* Open file. If this fails, no previous state found */
 	statefile = fopen( this_monitoring_plugin->state->_filename, "r" );
 	if(statefile!=NULL) {
@@ -550,12 +910,68 @@ state_data *np_state_read() {
 	return this_monitoring_plugin->state->state_data;
 }
 
+/*
+ * Reads a state file written by np_state_write_binary(), with the same
+ * checks as _np_state_read_file(). Returns FALSE if there is no state file
+ * or it is not valid, ERROR if it is a text state file.
+ */
+static int _np_state_read_binary(void) {
+	np_state_binary_header header;
+	state_data *this_state_data;
+	struct stat st;
+	char *buf;
+	ssize_t got;
+	int fd;
+
+	fd = open(this_monitoring_plugin->state->_filename, O_RDONLY);
+	if(fd<0)
+		return FALSE;
+	if(fstat(fd, &st)!=0 || (size_t)st.st_size < sizeof(header)) {
+		close(fd);
+		return ERROR;
+	}
+
+	buf = malloc(st.st_size + 1);
+	if(buf==NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+		    strerror(errno));
+	got = pread(fd, buf, st.st_size, 0);
+	close(fd);
+	if(got < (ssize_t)sizeof(header) ||
+	    memcmp(buf, NP_STATE_BINARY_MAGIC, sizeof(header.magic))!=0) {
+		free(buf);
+		return ERROR;
+	}
+
+	memcpy(&header, buf, sizeof(header));
+	if(header.format_version!=NP_STATE_FORMAT_VERSION ||
+	    header.data_version!=this_monitoring_plugin->state->data_version ||
+	    header.time > time(NULL) ||
+	    header.length!=(uint64_t)(got - sizeof(header))) {
+		free(buf);
+		return FALSE;
+	}
+
+	this_state_data = (state_data *) calloc(1, sizeof(state_data));
+	if(this_state_data==NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+		    strerror(errno));
+	/* keep the data where it was read, terminated in case it is text */
+	memmove(buf, buf + sizeof(header), header.length);
+	buf[header.length] = '\0';
+	this_state_data->time = header.time;
+	this_state_data->data = buf;
+	this_state_data->length = header.length;
+	this_monitoring_plugin->state->state_data = this_state_data;
+	return TRUE;
+}
+
 /*
  * Read the state file
  */
 int _np_state_read_file(FILE *f) {
 	int status=FALSE;
-	size_t pos;
+	size_t pos, size=1024;
 	char *line;
 	int i;
 	int failure=0;
@@ -564,15 +980,26 @@ int _np_state_read_file(FILE *f) {
 
 	time(&current_time);
 
-	/* Note: This introduces a limit of 1024 bytes in the string data */
-	line = (char *) calloc(1, 1024);
+	line = (char *) calloc(1, size);
 	if(line==NULL)
 		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
 		    strerror(errno));
 
-	while(!failure && (fgets(line,1024,f))!=NULL){
+	while(!failure && (fgets(line,size,f))!=NULL){
 		pos=strlen(line);
-		if(line[pos-1]=='\n') {
+		/* Grow the buffer for lines that do not fit, the string data
+		 * has no length limit */
+		while(pos==size-1 && line[pos-1]!='\n') {
+			size*=2;
+			line = (char *) realloc(line, size);
+			if(line==NULL)
+				die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+				    strerror(errno));
+			if(fgets(line+pos,size-pos,f)==NULL)
+				break;
+			pos+=strlen(line+pos);
+		}
+		if(pos>0 && line[pos-1]=='\n') {
 			line[pos-1]='\0';
 		}
 
@@ -627,7 +1054,31 @@ int _np_state_read_file(FILE *f) {
  * Will die with UNKNOWN if errors
  */
 void np_state_write_string(time_t data_time, char *data_string) {
+	_np_state_write_counted(data_time, data_string, strlen(data_string), FALSE);
+}
+
+/*
+ * Same as np_state_write_string(), for length bytes of data in any format.
+ * np_state_read() gives them back with their length.
+ */
+void np_state_write_binary(time_t data_time, const void *data, size_t length) {
+	_np_state_write_counted(data_time, data, length, TRUE);
+}
+
+static void _np_state_write_counted(time_t data_time, const void *data, size_t length, int binary) {
+	double start=np_clock();
+
+	_np_state_write(data_time, data, length, binary);
+	np_exec_counters.state_writes++;
+	np_exec_counters.state_bytes_written+=length;
+	np_exec_counters.state_write_seconds+=np_clock()-start;
+}
+
+static void _np_state_write(time_t data_time, const void *data, size_t length, int binary) {
+	np_state_binary_header header;
 	FILE *fp;
+	char *buf;
+	ssize_t wrote;
 	char *temp_file=NULL;
 	int fd=0, result=0;
 	time_t current_time;
@@ -638,6 +1089,16 @@ void np_state_write_string(time_t data_time, char *data_string) {
 		time(&current_time);
 	else
 		current_time=data_time;
+
+#ifdef HAVE_MMAP
+	np_state_store_lock();
+	if(_np_state_store_open() && length<=NP_STATE_STORE_DATA_MAX) {
+		_np_state_store_write(current_time, data, length, FALSE);
+		np_state_store_unlock();
+		return;
+	}
+	np_state_store_unlock();
+#endif
 	
 	/* If file doesn't currently exist, create directories */
 	if(access(this_monitoring_plugin->state->_filename,F_OK)!=0) {
@@ -670,6 +1131,31 @@ void np_state_write_string(time_t data_time, char *data_string) {
 		die(STATE_UNKNOWN, _("Cannot create temporary filename"));
 	}
 
+	if(binary) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, NP_STATE_BINARY_MAGIC, sizeof(header.magic));
+		header.format_version = NP_STATE_FORMAT_VERSION;
+		header.data_version = this_monitoring_plugin->state->data_version;
+		header.time = current_time;
+		header.length = length;
+		buf = malloc(sizeof(header) + length);
+		if(buf==NULL)
+			die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+			    strerror(errno));
+		memcpy(buf, &header, sizeof(header));
+		memcpy(buf + sizeof(header), data, length);
+		wrote = write(fd, buf, sizeof(header) + length);
+		free(buf);
+		fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP);
+		fsync(fd);
+		if(close(fd)!=0 || wrote!=(ssize_t)(sizeof(header) + length)) {
+			unlink(temp_file);
+			np_free(temp_file);
+			die(STATE_UNKNOWN, _("Error writing temp file"));
+		}
+		goto swap;
+	}
+
 	fp=(FILE *)fdopen(fd,"w");
 	if(fp==NULL) {
 		close(fd);
@@ -682,7 +1168,7 @@ void np_state_write_string(time_t data_time, char *data_string) {
 	fprintf(fp,"%d\n",NP_STATE_FORMAT_VERSION);
 	fprintf(fp,"%d\n",this_monitoring_plugin->state->data_version);
 	fprintf(fp,"%lu\n",current_time);
-	fprintf(fp,"%s\n",data_string);
+	fprintf(fp,"%s\n",(const char *)data);
 	
 	fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP);
 	
@@ -698,6 +1184,7 @@ void np_state_write_string(time_t data_time, char *data_string) {
 		die(STATE_UNKNOWN, _("Error writing temp file"));
 	}
 
+swap:
 	if(rename(temp_file, this_monitoring_plugin->state->_filename)!=0) {
 		unlink(temp_file);
 		np_free(temp_file);
@@ -705,5 +1192,310 @@ void np_state_write_string(time_t data_time, char *data_string) {
 	}
 
 	np_free(temp_file);
+
+#ifdef HAVE_MMAP
+	np_state_store_lock();
+	if(_np_state_store_open())
+		_np_state_store_write(current_time, NULL, 0, TRUE);
+	np_state_store_unlock();
+#endif
+}
+
+#ifdef HAVE_MMAP
+/*
+ * Opens the state store if MP_STATE_STORE is set, and not in setuid
+ * plugins, like MP_STATE_PATH. Returns FALSE if the store is not used
+ * or the key of the current state does not fit in a record.
+ */
+static int _np_state_store_open(void) {
+	char *env, *path=NULL, *p;
+	struct stat st;
+	struct flock lock;
+	np_state_store_header header;
+
+	env = getenv("MP_STATE_STORE");
+	if(mp_suid()==TRUE || env==NULL || env[0]=='\0')
+		return FALSE;
+	if(strlen(this_monitoring_plugin->state->plugin_name) + 1 +
+	    strlen(this_monitoring_plugin->state->name) > NP_STATE_STORE_KEY_MAX)
+		return FALSE;
+
+	if(asprintf(&path, "%s/%lu/state.store",
+	    _np_state_calculate_location_prefix(), (unsigned long)geteuid()) < 0)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+		    strerror(errno));
+	if(np_state_store.fd>=0 && !strcmp(path, np_state_store.path)) {
+		np_free(path);
+		return TRUE;
+	}
+
+	if(np_state_store.fd>=0) {
+		if(np_state_store.map!=NULL)
+			munmap(np_state_store.map, np_state_store.map_len);
+		close(np_state_store.fd);
+		np_free(np_state_store.path);
+		np_state_store.map=NULL;
+		np_state_store.map_len=0;
+	}
+
+	for(p=path+1; *p; p++) {
+		if(*p=='/') {
+			*p='\0';
+			if((access(path,F_OK)!=0) && (mkdir(path, S_IRWXU)!=0))
+				die(STATE_UNKNOWN, _("Cannot create directory: %s"), path);
+			*p='/';
+		}
+	}
+
+	np_state_store.fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if(np_state_store.fd<0)
+		die(STATE_UNKNOWN, _("Cannot open state store %s: %s"), path,
+		    strerror(errno));
+	fcntl(np_state_store.fd, F_SETFD, FD_CLOEXEC);
+	np_state_store.path = path;
+
+	/* The first to get the lock lays out an empty store */
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	if(fcntl(np_state_store.fd, F_SETLKW, &lock)!=0 ||
+	    fstat(np_state_store.fd, &st)!=0)
+		die(STATE_UNKNOWN, _("Cannot lock state store %s: %s"), path,
+		    strerror(errno));
+	if(st.st_size==0) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, NP_STATE_STORE_MAGIC, 8);
+		header.record_size = sizeof(np_state_store_record);
+		header.nbuckets = NP_STATE_STORE_BUCKETS;
+		header.capacity = NP_STATE_STORE_FIRST_RECORDS;
+		if(ftruncate(np_state_store.fd, sizeof(header) +
+		    NP_STATE_STORE_BUCKETS * sizeof(uint32_t) +
+		    NP_STATE_STORE_FIRST_RECORDS * sizeof(np_state_store_record))!=0)
+			die(STATE_UNKNOWN, _("Cannot write state store %s: %s"),
+			    path, strerror(errno));
+		np_state_store.map_len = sizeof(header) +
+		    NP_STATE_STORE_BUCKETS * sizeof(uint32_t);
+		np_state_store.map = mmap(NULL, np_state_store.map_len,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, np_state_store.fd, 0);
+		if(np_state_store.map==MAP_FAILED)
+			die(STATE_UNKNOWN, _("Cannot map state store %s: %s"),
+			    path, strerror(errno));
+		memset(np_state_store.map + sizeof(header), 0xff,
+		    NP_STATE_STORE_BUCKETS * sizeof(uint32_t));
+		memcpy(np_state_store.map, &header, sizeof(header));
+		munmap(np_state_store.map, np_state_store.map_len);
+		np_state_store.map = NULL;
+		np_state_store.map_len = 0;
+	}
+	lock.l_type = F_UNLCK;
+	fcntl(np_state_store.fd, F_SETLK, &lock);
+
+	return TRUE;
+}
+
+/*
+ * Maps the whole store, again if other processes made it grow. Dies if
+ * the file is not a state store.
+ */
+static np_state_store_header *_np_state_store_map(void) {
+	np_state_store_header *header;
+	struct stat st;
+	size_t len;
+
+	header = (np_state_store_header *) np_state_store.map;
+	if(header!=NULL && sizeof(*header) + header->nbuckets * sizeof(uint32_t) +
+	    (size_t)header->capacity * sizeof(np_state_store_record) <= np_state_store.map_len)
+		return header;
+
+	if(fstat(np_state_store.fd, &st)!=0)
+		die(STATE_UNKNOWN, _("Cannot read state store %s: %s"),
+		    np_state_store.path, strerror(errno));
+	len = st.st_size;
+	if(np_state_store.map!=NULL)
+		munmap(np_state_store.map, np_state_store.map_len);
+	np_state_store.map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, np_state_store.fd, 0);
+	if(np_state_store.map==MAP_FAILED) {
+		np_state_store.map = NULL;
+		np_state_store.map_len = 0;
+		die(STATE_UNKNOWN, _("Cannot map state store %s: %s"),
+		    np_state_store.path, strerror(errno));
+	}
+	np_state_store.map_len = len;
+
+	header = (np_state_store_header *) np_state_store.map;
+	if(len < sizeof(*header) || memcmp(header->magic, NP_STATE_STORE_MAGIC, 8)!=0 ||
+	    header->record_size!=sizeof(np_state_store_record) ||
+	    len < sizeof(*header) + header->nbuckets * sizeof(uint32_t) +
+	    (size_t)header->capacity * sizeof(np_state_store_record))
+		die(STATE_UNKNOWN, _("Invalid state store %s"), np_state_store.path);
+	return header;
+}
+
+/* Returns the key of the current state in the store, "plugin/key" */
+static size_t _np_state_store_key(char *key, uint32_t *hash) {
+	size_t len, i;
+
+	len = sprintf(key, "%s/%s", this_monitoring_plugin->state->plugin_name,
+	    this_monitoring_plugin->state->name);
+	*hash = 2166136261U;
+	for(i=0; i<len; i++)
+		*hash = (*hash ^ (unsigned char)key[i]) * 16777619U;
+	return len;
+}
+
+/*
+ * Returns the index of the record of the key, or NP_STATE_STORE_NONE. The
+ * store is mapped again when the record was added after it grew.
+ */
+static uint32_t _np_state_store_find(np_state_store_header **header,
+    const char *key, size_t len, uint32_t hash) {
+	uint32_t *buckets = (uint32_t *)(*header + 1);
+	np_state_store_record *records =
+	    (np_state_store_record *)(buckets + (*header)->nbuckets);
+	size_t mapped = (np_state_store.map_len - ((char *)records - np_state_store.map)) /
+	    sizeof(np_state_store_record);
+	uint32_t i;
+
+	for(i=buckets[hash % (*header)->nbuckets]; i!=NP_STATE_STORE_NONE;
+	    i=records[i].next) {
+		if(i>=mapped) {
+			*header = _np_state_store_map();
+			if(i>=(*header)->capacity)
+				die(STATE_UNKNOWN, _("Invalid state store %s"),
+				    np_state_store.path);
+			return _np_state_store_find(header, key, len, hash);
+		}
+		if(records[i].hash==hash && records[i].key_len==len &&
+		    !memcmp(records[i].key, key, len))
+			return i;
+	}
+	return NP_STATE_STORE_NONE;
+}
+
+/*
+ * Reads the current state from the store, with the same checks as
+ * _np_state_read_file(). Returns ERROR if it is not there or in a file.
+ */
+static int _np_state_store_read(state_data *data) {
+	np_state_store_header *header;
+	np_state_store_record *records, record;
+	char key[NP_STATE_STORE_KEY_MAX + 1];
+	uint32_t hash, i, seq;
+	size_t len;
+	int tries;
+
+	len = _np_state_store_key(key, &hash);
+	header = _np_state_store_map();
+	i = _np_state_store_find(&header, key, len, hash);
+	if(i==NP_STATE_STORE_NONE)
+		return ERROR;
+
+	/* A writer may be halfway through the record, read it again then */
+	records = (np_state_store_record *)((uint32_t *)(header + 1) + header->nbuckets);
+	for(tries=0; ; tries++) {
+		seq = records[i].seq;
+		np_state_store_barrier();
+		memcpy(&record, &records[i], sizeof(record));
+		np_state_store_barrier();
+		if(seq%2==0 && seq==records[i].seq)
+			break;
+		if(tries==1000)
+			return FALSE;
+		sleep(0);
+	}
+
+	if(record.flags & NP_STATE_STORE_IN_FILE)
+		return ERROR;
+	if(record.data_version!=this_monitoring_plugin->state->data_version ||
+	    record.time > time(NULL) || record.data_len > NP_STATE_STORE_DATA_MAX)
+		return FALSE;
+
+	data->time = record.time;
+	data->data = malloc(record.data_len + 1);
+	if(data->data==NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+		    strerror(errno));
+	memcpy(data->data, record.data, record.data_len);
+	((char *)data->data)[record.data_len] = '\0';
+	data->length = record.data_len;
+	return TRUE;
+}
+
+/*
+ * Writes the current state in the store, adding its record if needed. With
+ * in_file, only records that the data is in the state file.
+ */
+static void _np_state_store_write(time_t data_time, const void *data, size_t data_len, int in_file) {
+	np_state_store_header *header;
+	np_state_store_record *records, *record;
+	uint32_t *buckets;
+	char key[NP_STATE_STORE_KEY_MAX + 1];
+	uint32_t hash, i, was_in_file=FALSE;
+	size_t len;
+	struct flock lock;
+
+	len = _np_state_store_key(key, &hash);
+
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	if(fcntl(np_state_store.fd, F_SETLKW, &lock)!=0)
+		die(STATE_UNKNOWN, _("Cannot lock state store %s: %s"),
+		    np_state_store.path, strerror(errno));
+
+	header = _np_state_store_map();
+	i = _np_state_store_find(&header, key, len, hash);
+	if(i==NP_STATE_STORE_NONE) {
+		if(header->nrecords==header->capacity) {
+			if(ftruncate(np_state_store.fd, sizeof(*header) +
+			    header->nbuckets * sizeof(uint32_t) +
+			    (size_t)header->capacity * 2 * sizeof(np_state_store_record))!=0)
+				die(STATE_UNKNOWN, _("Cannot write state store %s: %s"),
+				    np_state_store.path, strerror(errno));
+			header->capacity *= 2;
+			header = _np_state_store_map();
+		}
+		buckets = (uint32_t *)(header + 1);
+		records = (np_state_store_record *)(buckets + header->nbuckets);
+		i = header->nrecords;
+		record = &records[i];
+		memset(record, 0, sizeof(*record));
+		record->hash = hash;
+		record->key_len = len;
+		memcpy(record->key, key, len);
+		record->next = buckets[hash % header->nbuckets];
+		record->seq = 1;
+	} else {
+		buckets = (uint32_t *)(header + 1);
+		records = (np_state_store_record *)(buckets + header->nbuckets);
+		record = &records[i];
+		was_in_file = record->flags & NP_STATE_STORE_IN_FILE;
+		record->seq |= 1;
+	}
+	np_state_store_barrier();
+
+	record->flags = in_file ? NP_STATE_STORE_IN_FILE : 0;
+	record->data_version = this_monitoring_plugin->state->data_version;
+	record->time = data_time;
+	record->data_len = data_len;
+	if(!in_file)
+		memcpy(record->data, data, data_len);
+
+	np_state_store_barrier();
+	record->seq++;
+	if(i==header->nrecords) {
+		np_state_store_barrier();
+		buckets[hash % header->nbuckets] = i;
+		header->nrecords++;
+	}
+
+	lock.l_type = F_UNLCK;
+	fcntl(np_state_store.fd, F_SETLK, &lock);
+
+	/* The data is short again, the old state file is stale */
+	if(was_in_file && !in_file)
+		unlink(this_monitoring_plugin->state->_filename);
 }
+#endif /* HAVE_MMAP */
 
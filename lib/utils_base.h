@@ -3,6 +3,7 @@
 /* Header file for Monitoring Plugins utils_base.c */
 
 #include "sha1.h"
+#include <setjmp.h>
 
 /* This file holds header information for thresholds - use this in preference to 
    individual plugin logic */
@@ -14,6 +15,16 @@
    and utils_*.h for specific to plugin routines. If routines are
    placed in utils_*.h, then these can be tested with libtap */
 
+/* Storage every thread has a copy of. The lib keeps what belongs to the
+ * check being run in it, so that checks can run on threads of their own. */
+#if defined(__GNUC__) || defined(__clang__)
+# define NP_THREAD_LOCAL __thread
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+# define NP_THREAD_LOCAL _Thread_local
+#else
+# define NP_THREAD_LOCAL
+#endif
+
 #define OUTSIDE 0
 #define INSIDE  1
 
@@ -23,6 +34,12 @@ typedef struct range_struct {
 	double	end;
 	int	end_infinity;
 	int	alert_on;		/* OUTSIDE (default) or INSIDE */
+	/* The same, compiled for check_range by parse_range_string:
+	 * alert = ((lo <= value && value <= hi) || all) ^ outside */
+	double	lo;			/* start, or -infinity */
+	double	hi;			/* end, or +infinity */
+	int	all;			/* both ends are infinite */
+	int	outside;		/* alert_on == OUTSIDE */
 	} range;
 
 typedef struct thresholds_struct {
@@ -60,10 +77,11 @@ void set_thresholds(thresholds **, char *, char *);
 void print_thresholds(const char *, thresholds *);
 int check_range(double, range *);
 int get_status(double, thresholds *);
+int get_status_batch(const double *, int *, size_t, thresholds *);
 
 /* Handle timeouts */
-extern unsigned int timeout_state;
-extern unsigned int timeout_interval;
+extern NP_THREAD_LOCAL unsigned int timeout_state;
+extern NP_THREAD_LOCAL unsigned int timeout_interval;
 
 /* All possible characters in a threshold range */
 #define NP_THRESHOLDS_CHARS "-0123456789.:@~"
@@ -72,6 +90,46 @@ char *np_escaped_string (const char *);
 
 void die (int, const char *, ...) __attribute__((noreturn,format(printf, 2, 3)));
 
+/* Execution context for plugins run in-process (see plugins/np_executor.c).
+ * While a context is active, die() and np_exit() jump back to np_exec_run()
+ * with the plugin's result instead of terminating the process. Contexts,
+ * like the monitoring_plugin state, belong to the thread they run on. */
+typedef struct np_exec_context_struct {
+	sigjmp_buf	env;
+	int	result;
+	int	capture;	/* np_exec_capture(): die() keeps its message ... */
+	char	*message;	/* ... here, for the caller to free() */
+	struct np_exec_context_struct *previous;
+	} np_exec_context;
+
+void np_exit (int) __attribute__((noreturn));
+int np_exec_run (np_exec_context *, int (*)(int, char **), int, char **);
+int np_exec_capture (np_exec_context *, int (*)(int, char **), int, char **);
+int np_exec_active (void);
+
+/* What the checks run by this process did to the state files and to the
+ * connections they keep between runs, for np-executor --metrics */
+typedef struct np_exec_stats_struct {
+	unsigned long	state_reads;
+	unsigned long	state_writes;
+	unsigned long long	state_bytes_read;
+	unsigned long long	state_bytes_written;
+	double	state_read_seconds;
+	double	state_write_seconds;
+	unsigned long	pool_opened;	/* connections kept for a later run */
+	unsigned long	pool_reused;	/* one of them used by a later run */
+	unsigned long	pool_closed;
+	} np_exec_stats;
+
+extern np_exec_stats np_exec_counters;
+
+/* Deadlines for single operations, on the monotonic clock. Running past one
+ * only fails the operation that had it, where alarm() ends the process.
+ * A deadline of 0 never passes. */
+double np_clock (void);
+double np_deadline (double seconds);
+int np_deadline_ms (double deadline);
+
 /* Return codes for _set_thresholds */
 #define NP_RANGE_UNPARSEABLE 1
 #define NP_WARN_WITHIN_CRIT 2
@@ -105,12 +163,25 @@ char *np_extract_value(const char*, const char*, char);
 int mp_translate_state (char *);
 
 void np_enable_state(char *, int);
+/* The hex SHA-1 of a command line in the 41 bytes at key, the key the state
+ * of np_enable_state() has by default */
+void np_argv_digest(int argc, char **argv, char *key);
 state_data *np_state_read();
 void np_state_write_string(time_t, char *);
+/* The data is not text: read back as it was, length set in the state_data */
+void np_state_write_binary(time_t, const void *, size_t);
+/* The directory state files go in, caches of other data can use it too */
+char *_np_state_calculate_location_prefix();
 
 void np_init(char *, int argc, char **argv);
+/* the state of the check running on this thread, NULL before np_init() */
+monitoring_plugin *np_plugin(void);
 void np_set_args(int argc, char **argv);
 void np_cleanup();
+
+/* Set the locale for the messages, see _() in common.h; NP_LOCALE set
+ * forces the locale it names and the catalog to be set up at once */
+void np_locale_init(void);
 const char *state_text (int);
 
 #endif /* _UTILS_BASE_ */
@@ -44,15 +44,37 @@
 #include "utils_cmd.h"
 #include "utils_base.h"
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 
 #ifdef HAVE_SYS_WAIT_H
 # include <sys/wait.h>
 #endif
 
+#ifdef HAVE_POSIX_SPAWN
+# include <spawn.h>
+#endif
+
+/* a pidfd becomes readable when the child exits, whoever else still holds
+ * its pipes open; pidfd_open() is 434 wherever the system call numbers
+ * have been unified */
+#ifdef __linux__
+# include <sys/syscall.h>
+# if !defined __NR_pidfd_open && !defined __alpha__
+#  define __NR_pidfd_open 434
+# endif
+# ifdef __NR_pidfd_open
+#  define CMD_PIDFD 1
+# endif
+#endif
+
 /* used in _cmd_open to pass the environment to commands */
 extern char **environ;
 
 /** macros **/
+/* initial size of the output buffer, which doubles as needed */
+#define CMD_FETCH_CHUNK 4096
+
 #ifndef WEXITSTATUS
 # define WEXITSTATUS(stat_val) ((unsigned)(stat_val) >> 8)
 #endif
@@ -67,106 +89,315 @@ extern char **environ;
 #endif
 
 /** prototypes **/
-static int _cmd_open (char *const *, int *, int *)
+static int _cmd_open (char *const *, int *, int *, int)
 	__attribute__ ((__nonnull__ (1, 2, 3)));
 
-static int _cmd_fetch_output (int, output *, int)
-	__attribute__ ((__nonnull__ (2)));
-
 static int _cmd_close (int);
 
+static void cmd_child_resize (cmd_children *, size_t);
+
 /* prototype imported from utils.h */
 extern void die (int, const char *, ...)
 	__attribute__ ((__noreturn__, __format__ (__printf__, 2, 3)));
 
 
+/* This variable must be global, since there's no way the caller
+ * can forcibly slay a dead or ungainly running program otherwise.
+ * Multithreading apps and plugins can initialize it (via CMD_INIT)
+ * in an async safe manner PRIOR to calling cmd_run() or cmd_run_array()
+ * for the first time.
+ *
+ * The check for initialized values is atomic and can
+ * occur in any number of threads simultaneously. */
+static cmd_children _cmd_children;
+
+/* room for this many children before the table has to grow */
+#define CMD_CHILDREN_INITIAL 16
+
 /* this function is NOT async-safe. It is exported so multithreaded
  * plugins (or other apps) can call it prior to running any commands
  * through this api and thus achieve async-safeness throughout the api */
 void
 cmd_init (void)
 {
-#ifndef maxfd
-	if (!maxfd && (maxfd = sysconf (_SC_OPEN_MAX)) < 0) {
-		/* possibly log or emit a warning here, since there's no
-		 * guarantee that our guess at maxfd will be adequate */
-		maxfd = DEFAULT_MAXFD;
+	if (!_cmd_children.size)
+		cmd_children_init (&_cmd_children);
+}
+
+/* Allocate the table up front, so that adding the first children to it
+ * does not have to */
+void
+cmd_children_init (cmd_children *c)
+{
+	if (!c->size)
+		cmd_child_resize (c, CMD_CHILDREN_INITIAL);
+}
+
+
+static size_t
+cmd_child_hash (const cmd_children *c, int fd)
+{
+	return ((unsigned int) fd * 2654435761U) & (c->size - 1);
+}
+
+/* Move the children to a table of size slots. The new table is filled
+ * before it replaces the old one, so that a signal handler walking it at
+ * any moment sees one or the other whole. */
+static void
+cmd_child_resize (cmd_children *c, size_t size)
+{
+	cmd_children grown;
+	struct cmd_child *old = c->slot;
+	size_t i;
+
+	grown.size = size;
+	grown.count = 0;
+	if ((grown.slot = calloc (size, sizeof (struct cmd_child))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc()"));
+	for (i = 0; i < c->size; i++)
+		if (old[i].pid > 0)
+			cmd_child_add (&grown, old[i].fd, old[i].err_fd, old[i].pid);
+
+	c->slot = grown.slot;
+	c->size = grown.size;
+	free (old);
+}
+
+/* Note pid as the child whose output is read from fd (and err_fd) */
+void
+cmd_child_add (cmd_children *c, int fd, int err_fd, pid_t pid)
+{
+	size_t i;
+
+	/* at most half full, so that probes stay short */
+	if ((c->count + 1) * 2 > c->size)
+		cmd_child_resize (c, c->size ? c->size * 2 : CMD_CHILDREN_INITIAL);
+
+	for (i = cmd_child_hash (c, fd); c->slot[i].pid > 0 && c->slot[i].fd != fd;
+	     i = (i + 1) & (c->size - 1))
+		;
+	if (c->slot[i].pid <= 0)
+		c->count++;
+	c->slot[i].fd = fd;
+	c->slot[i].err_fd = err_fd;
+	c->slot[i].pid = pid;
+}
+
+struct cmd_child *
+cmd_child_find (const cmd_children *c, int fd)
+{
+	size_t i;
+
+	if (!c->size || fd < 0)
+		return NULL;
+	for (i = cmd_child_hash (c, fd); c->slot[i].pid > 0; i = (i + 1) & (c->size - 1))
+		if (c->slot[i].fd == fd)
+			return &c->slot[i];
+	return NULL;
+}
+
+/* Forget the child read from fd, returns its pid or 0 if there was none */
+pid_t
+cmd_child_remove (cmd_children *c, int fd)
+{
+	struct cmd_child *child, moved;
+	size_t i, hole;
+	pid_t pid;
+
+	if ((child = cmd_child_find (c, fd)) == NULL)
+		return 0;
+	pid = child->pid;
+	child->pid = 0;
+	c->count--;
+
+	/* put back the rest of the run, which may have probed past the hole */
+	hole = (size_t) (child - c->slot);
+	for (i = (hole + 1) & (c->size - 1); c->slot[i].pid > 0; i = (i + 1) & (c->size - 1)) {
+		moved = c->slot[i];
+		c->slot[i].pid = 0;
+		c->count--;
+		cmd_child_add (c, moved.fd, moved.err_fd, moved.pid);
 	}
+	return pid;
+}
+
+/* Send sig to every child; async-safe, for the timeout handlers */
+void
+cmd_child_kill_all (const cmd_children *c, int sig)
+{
+	size_t i;
+
+	for (i = 0; i < c->size; i++)
+		if (c->slot[i].pid > 0)
+			kill (c->slot[i].pid, sig);
+}
+
+/* In a child about to execve(), close what it inherited beyond stdin,
+ * stdout and stderr. close_range() and closefrom() do that in one call,
+ * whatever the limit on open files; without them, the descriptors of the
+ * other children are closed. This is shared with spopen() in
+ * plugins/popen.c. */
+void
+cmd_close_inherited (const cmd_children *c)
+{
+	size_t i;
+
+#if defined(HAVE_CLOSE_RANGE)
+	if (close_range (3, ~0U, 0) == 0)
+		return;
+#elif defined(HAVE_CLOSEFROM)
+	closefrom (3);
+	return;
 #endif
+	for (i = 0; i < c->size; i++) {
+		if (c->slot[i].pid <= 0)
+			continue;
+		close (c->slot[i].fd);
+		if (c->slot[i].err_fd >= 0)
+			close (c->slot[i].err_fd);
+	}
+}
 
-	/* if maxfd is unnaturally high, we force it to a lower value
-	 * ( e.g. on SunOS, when ulimit is set to unlimited: 2147483647 this would cause
-	 * a segfault when following calloc is called ...  ) */
 
-	if ( maxfd > MAXFD_LIMIT ) {
-		maxfd = MAXFD_LIMIT;
+#ifdef HAVE_POSIX_SPAWN
+/* posix_spawn() version of the child setup in cmd_spawn(). Returns -1
+ * without having started anything if it cannot be used for argv. */
+static pid_t
+_cmd_posix_spawn (char *const *argv, char *const *envp, const int *pfd,
+                  const int *pfderr, const cmd_children *children)
+{
+	posix_spawn_file_actions_t fa;
+	pid_t pid;
+	size_t i;
+	int ret;
+#ifdef RLIMIT_CORE
+	struct rlimit limit, saved;
+#endif
+
+	/* the fork() path exits with STATE_UNKNOWN when execve() fails, which
+	 * posix_spawn() can't do, so leave missing programs to it */
+	if (access (argv[0], X_OK) != 0)
+		return -1;
+
+	if (posix_spawn_file_actions_init (&fa) != 0)
+		return -1;
+	posix_spawn_file_actions_addclose (&fa, pfd[0]);
+	if (pfd[1] != STDOUT_FILENO) {
+		posix_spawn_file_actions_adddup2 (&fa, pfd[1], STDOUT_FILENO);
+		posix_spawn_file_actions_addclose (&fa, pfd[1]);
+	}
+	posix_spawn_file_actions_addclose (&fa, pfderr[0]);
+	if (pfderr[1] != STDERR_FILENO) {
+		posix_spawn_file_actions_adddup2 (&fa, pfderr[1], STDERR_FILENO);
+		posix_spawn_file_actions_addclose (&fa, pfderr[1]);
 	}
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+	posix_spawn_file_actions_addclosefrom_np (&fa, 3);
+#else
+	for (i = 0; i < children->size; i++) {
+		if (children->slot[i].pid <= 0)
+			continue;
+		posix_spawn_file_actions_addclose (&fa, children->slot[i].fd);
+		if (children->slot[i].err_fd >= 0)
+			posix_spawn_file_actions_addclose (&fa, children->slot[i].err_fd);
+	}
+#endif
 
-	if (!_cmd_pids)
-		_cmd_pids = calloc (maxfd, sizeof (pid_t));
-}
+#ifdef RLIMIT_CORE
+	/* the program we start shouldn't leave core files; the limit is
+	 * inherited at spawn time, so lower ours just around the call */
+	getrlimit (RLIMIT_CORE, &saved);
+	limit = saved;
+	limit.rlim_cur = 0;
+	setrlimit (RLIMIT_CORE, &limit);
+#endif
 
+	ret = posix_spawn (&pid, argv[0], &fa, NULL, argv, envp);
 
-/* Start running a command, array style */
-static int
-_cmd_open (char *const *argv, int *pfd, int *pfderr)
+#ifdef RLIMIT_CORE
+	setrlimit (RLIMIT_CORE, &saved);
+#endif
+	posix_spawn_file_actions_destroy (&fa);
+
+	return ret == 0 ? pid : -1;
+}
+#endif
+
+/* Start argv[0] with its stdout and stderr on the write ends of pfd and
+ * pfderr, closing the descriptors of the other children in it. Where
+ * posix_spawn() is available it is used, since fork() has to copy the page
+ * tables of the whole parent first; CMD_FORK in flags forces fork().
+ * This is shared with np_runcmd() in plugins/runcmd.c. */
+pid_t
+cmd_spawn (char *const *argv, char *const *envp, const int *pfd,
+           const int *pfderr, const cmd_children *children, int flags)
 {
 	pid_t pid;
 #ifdef RLIMIT_CORE
 	struct rlimit limit;
 #endif
 
-	int i = 0;
+#ifdef HAVE_POSIX_SPAWN
+	if (!(flags & CMD_FORK) && (pid = _cmd_posix_spawn (argv, envp, pfd, pfderr, children)) > 0)
+		return pid;
+#endif
+
+	if ((pid = fork ()) != 0)
+		return pid;
+
+	/* child runs exceve() and _exit. */
+#ifdef 	RLIMIT_CORE
+	/* the program we execve shouldn't leave core files */
+	getrlimit (RLIMIT_CORE, &limit);
+	limit.rlim_cur = 0;
+	setrlimit (RLIMIT_CORE, &limit);
+#endif
+	close (pfd[0]);
+	if (pfd[1] != STDOUT_FILENO) {
+		dup2 (pfd[1], STDOUT_FILENO);
+		close (pfd[1]);
+	}
+	close (pfderr[0]);
+	if (pfderr[1] != STDERR_FILENO) {
+		dup2 (pfderr[1], STDERR_FILENO);
+		close (pfderr[1]);
+	}
+
+	/* This is executed in a separate address space (pure child),
+	 * so we don't have to worry about async safety */
+	cmd_close_inherited (children);
+
+	execve (argv[0], argv, envp);
+	_exit (STATE_UNKNOWN);
+}
+
+
+/* Start running a command, array style */
+static int
+_cmd_open (char *const *argv, int *pfd, int *pfderr, int flags)
+{
+	pid_t pid;
 
 	/* if no command was passed, return with no error */
 	if (argv == NULL)
 		return -1;
 
-	if (!_cmd_pids)
+	if (!_cmd_children.size)
 		CMD_INIT;
 
 	setenv("LC_ALL", "C", 1);
 
-	if (pipe (pfd) < 0 || pipe (pfderr) < 0 || (pid = fork ()) < 0)
+	if (pipe (pfd) < 0 || pipe (pfderr) < 0 ||
+	    (pid = cmd_spawn (argv, environ, pfd, pfderr, &_cmd_children, flags)) < 0)
 		return -1;									/* errno set by the failing function */
 
-	/* child runs exceve() and _exit. */
-	if (pid == 0) {
-#ifdef 	RLIMIT_CORE
-		/* the program we execve shouldn't leave core files */
-		getrlimit (RLIMIT_CORE, &limit);
-		limit.rlim_cur = 0;
-		setrlimit (RLIMIT_CORE, &limit);
-#endif
-		close (pfd[0]);
-		if (pfd[1] != STDOUT_FILENO) {
-			dup2 (pfd[1], STDOUT_FILENO);
-			close (pfd[1]);
-		}
-		close (pfderr[0]);
-		if (pfderr[1] != STDERR_FILENO) {
-			dup2 (pfderr[1], STDERR_FILENO);
-			close (pfderr[1]);
-		}
-
-		/* close all descriptors in _cmd_pids[]
-		 * This is executed in a separate address space (pure child),
-		 * so we don't have to worry about async safety */
-		for (i = 0; i < maxfd; i++)
-			if (_cmd_pids[i] > 0)
-				close (i);
-
-		execve (argv[0], argv, environ);
-		_exit (STATE_UNKNOWN);
-	}
-
 	/* parent picks up execution here */
 	/* close childs descriptors in our address space */
 	close (pfd[1]);
 	close (pfderr[1]);
 
 	/* tag our file's entry in the pid-list and return it */
-	_cmd_pids[pfd[0]] = pid;
+	cmd_child_add (&_cmd_children, pfd[0], pfderr[0], pid);
 
 	return pfd[0];
 }
@@ -178,10 +409,9 @@ _cmd_close (int fd)
 	pid_t pid;
 
 	/* make sure the provided fd was opened */
-	if (fd < 0 || fd > maxfd || !_cmd_pids || (pid = _cmd_pids[fd]) == 0)
+	if ((pid = cmd_child_remove (&_cmd_children, fd)) == 0)
 		return -1;
 
-	_cmd_pids[fd] = 0;
 	if (close (fd) == -1)
 		return -1;
 
@@ -195,77 +425,166 @@ _cmd_close (int fd)
 }
 
 
-static int
-_cmd_fetch_output (int fd, output * op, int flags)
+/* Reading the output of a command straight into op->buf, doubling the
+ * buffer when it fills up, and noting where each line starts while the new
+ * data is still in the cache. The line index starts out empty and grows the
+ * same way. A fetch goes one read() at a time, so that stdout and stderr can
+ * be read as either has something. */
+struct fetch {
+	output *op;
+	int flags;
+	size_t size, scanned, lineno, ary_size;
+	size_t *starts;
+	int in_line;
+};
+
+static void
+fetch_init (struct fetch *f, output * op, int flags)
 {
-	size_t len = 0, i = 0, lineno = 0;
-	size_t rsf = 6, ary_size = 0;	/* rsf = right shift factor, dec'ed uncond once */
-	char *buf = NULL;
-	int ret;
-	char tmpbuf[4096];
-
+	memset (f, 0, sizeof (*f));
+	f->op = op;
+	f->flags = flags;
 	op->buf = NULL;
 	op->buflen = 0;
-	while ((ret = read (fd, tmpbuf, sizeof (tmpbuf))) > 0) {
-		len = (size_t) ret;
-		op->buf = realloc (op->buf, op->buflen + len + 1);
-		memcpy (op->buf + op->buflen, tmpbuf, len);
-		op->buflen += len;
-		i++;
+	op->line = NULL;
+	op->lens = NULL;
+}
+
+/* one read() from fd, returns what that read() returned */
+static ssize_t
+fetch_read (struct fetch *f, int fd)
+{
+	output *op = f->op;
+	ssize_t ret;
+	char *nl;
+
+	/* always keep a spare byte to terminate the last line */
+	if (op->buflen + 1 >= f->size) {
+		f->size = f->size ? f->size * 2 : CMD_FETCH_CHUNK;
+		if ((op->buf = realloc (op->buf, f->size)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot realloc()"));
 	}
+	if ((ret = read (fd, op->buf + op->buflen, f->size - op->buflen - 1)) <= 0)
+		return ret;
+	op->buflen += (size_t) ret;
 
-	if (ret < 0) {
-		printf ("read() returned %d: %s\n", ret, strerror (errno));
+	if (f->flags & CMD_NO_ARRAYS)
 		return ret;
+
+	/* index the lines in what just arrived */
+	while (f->scanned < op->buflen) {
+		if (!f->in_line) {
+			if (f->lineno >= f->ary_size) {
+				f->ary_size = f->ary_size ? f->ary_size * 2 : 64;
+				if ((f->starts = realloc (f->starts, f->ary_size * sizeof (size_t))) == NULL)
+					die (STATE_UNKNOWN, _("Cannot realloc()"));
+			}
+			f->starts[f->lineno++] = f->scanned;
+			f->in_line = 1;
+		}
+		if ((nl = memchr (op->buf + f->scanned, '\n', op->buflen - f->scanned)) == NULL) {
+			f->scanned = op->buflen;
+			break;
+		}
+		f->scanned = (size_t) (nl - op->buf) + 1;
+		f->in_line = 0;
 	}
+	return ret;
+}
+
+/* build the line arrays once everything has been read, returns the number
+ * of lines, or of bytes with CMD_NO_ARRAYS */
+static int
+fetch_finish (struct fetch *f)
+{
+	output *op = f->op;
+	size_t *starts = f->starts;
+	size_t lineno = f->lineno, i, end;
+	char *buf;
+
+	if (op->buf == NULL && (op->buf = malloc (1)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot realloc()"));
+
+	/* keep the unbroken buffer usable as a string */
+	op->buf[op->buflen] = '\0';
 
 	/* some plugins may want to keep output unbroken, and some commands
 	 * will yield no output, so return here for those */
-	if (flags & CMD_NO_ARRAYS || !op->buf || !op->buflen)
+	if (f->flags & CMD_NO_ARRAYS || !op->buflen) {
+		free (starts);
 		return op->buflen;
+	}
 
 	/* and some may want both */
-	if (flags & CMD_NO_ASSOC) {
-		buf = malloc (op->buflen);
-		memcpy (buf, op->buf, op->buflen);
+	if (f->flags & CMD_NO_ASSOC) {
+		buf = malloc (op->buflen + 1);
+		memcpy (buf, op->buf, op->buflen + 1);
 	}
 	else
 		buf = op->buf;
 
-	op->line = NULL;
-	op->lens = NULL;
-	i = 0;
-	while (i < op->buflen) {
-		/* make sure we have enough memory */
-		if (lineno >= ary_size) {
-			/* ary_size must never be zero */
-			do {
-				ary_size = op->buflen >> --rsf;
-			} while (!ary_size);
-
-			op->line = realloc (op->line, ary_size * sizeof (char *));
-			op->lens = realloc (op->lens, ary_size * sizeof (size_t));
-		}
+	/* turn the offsets into pointers; the lengths reuse the offset array,
+	 * each slot being read before it is overwritten */
+	op->line = malloc (lineno * sizeof (char *));
+	for (i = 0; i < lineno; i++) {
+		end = (i + 1 < lineno) ? starts[i + 1] - 1 : op->buflen;
+		if (i + 1 == lineno && end > starts[i] && buf[end - 1] == '\n')
+			end--;
+		op->line[i] = &buf[starts[i]];
+		buf[end] = '\0';
+		starts[i] = end - starts[i];
+	}
+	op->lens = starts;
 
-		/* set the pointer to the string */
-		op->line[lineno] = &buf[i];
+	return lineno;
+}
 
-		/* hop to next newline or end of buffer */
-		while (buf[i] != '\n' && i < op->buflen)
-			i++;
-		buf[i] = '\0';
+/* Read everything from fd into op. This is shared with np_runcmd() in
+ * plugins/runcmd.c. */
+int
+cmd_fetch_output (int fd, output * op, int flags)
+{
+	struct fetch f;
+	ssize_t ret;
 
-		/* calculate the string length using pointer difference */
-		op->lens[lineno] = (size_t) & buf[i] - (size_t) op->line[lineno];
+	fetch_init (&f, op, flags);
+	while ((ret = fetch_read (&f, fd)) > 0)
+		;
 
-		lineno++;
-		i++;
+	if (ret < 0) {
+		printf ("read() returned %d: %s\n", (int) ret, strerror (errno));
+		free (f.starts);
+		return ret;
 	}
 
-	return lineno;
+	return fetch_finish (&f);
 }
 
 
+/* Walk the lines of a buffer fetched with CMD_NO_ARRAYS without building
+ * the line arrays. Start with *pos = 0; each call returns the next line
+ * (not NUL-terminated) and stores its length in *len, or NULL at the end. */
+char *
+cmd_next_line (const output * op, size_t * pos, size_t * len)
+{
+	char *line, *nl;
+
+	if (op->buf == NULL || *pos >= op->buflen)
+		return NULL;
+
+	line = op->buf + *pos;
+	if ((nl = memchr (line, '\n', op->buflen - *pos)) != NULL) {
+		*len = (size_t) (nl - line);
+		*pos += *len + 1;
+	}
+	else {
+		*len = op->buflen - *pos;
+		*pos = op->buflen;
+	}
+
+	return line;
+}
+
 int
 cmd_run (const char *cmdstring, output * out, output * err, int flags)
 {
@@ -344,7 +663,22 @@ cmd_run (const char *cmdstring, output * out, output * err, int flags)
 int
 cmd_run_array (char *const *argv, output * out, output * err, int flags)
 {
-	int fd, pfd_out[2], pfd_err[2];
+	return cmd_run_array_deadline (argv, out, err, flags, 0);
+}
+
+/* Like cmd_run_array(), but gives up at the deadline (see np_deadline()):
+ * the command is killed, and CMD_TIMEOUT returned with what it wrote until
+ * then in out and err. stdout and stderr are read as either has something,
+ * so a command filling up the one pipe nobody reads can not stall. */
+int
+cmd_run_array_deadline (char *const *argv, output * out, output * err, int flags,
+                        double deadline)
+{
+	int fd, pfd_out[2], pfd_err[2], i, n, result, timed_out = 0;
+	output scratch[2];
+	struct fetch f[2];
+	struct pollfd pfds[2];
+	ssize_t ret;
 
 	/* initialize the structs */
 	if (out)
@@ -352,15 +686,337 @@ cmd_run_array (char *const *argv, output * out, output * err, int flags)
 	if (err)
 		memset (err, 0, sizeof (output));
 
-	if ((fd = _cmd_open (argv, pfd_out, pfd_err)) == -1)
+	if ((fd = _cmd_open (argv, pfd_out, pfd_err, flags)) == -1)
 		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), argv[0]);
 
-	if (out)
-		out->lines = _cmd_fetch_output (pfd_out[0], out, flags);
+	/* what nobody asked for is still read, and dropped */
+	fetch_init (&f[0], out ? out : &scratch[0], out ? flags : CMD_NO_ARRAYS);
+	fetch_init (&f[1], err ? err : &scratch[1], err ? flags : CMD_NO_ARRAYS);
+	pfds[0].fd = pfd_out[0];
+	pfds[1].fd = pfd_err[0];
+	pfds[0].events = pfds[1].events = POLLIN;
+
+	while (pfds[0].fd >= 0 || pfds[1].fd >= 0) {
+		pfds[0].revents = pfds[1].revents = 0;
+		if ((n = poll (pfds, 2, np_deadline_ms (deadline))) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (n == 0) {
+			/* out of time */
+			kill (cmd_child_find (&_cmd_children, fd)->pid, SIGKILL);
+			timed_out = 1;
+			break;
+		}
+		for (i = 0; i < 2; i++) {
+			if (pfds[i].fd < 0 || !pfds[i].revents)
+				continue;
+			if ((ret = fetch_read (&f[i], pfds[i].fd)) < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				pfds[i].fd = -1;
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		n = fetch_finish (&f[i]);
+		if (f[i].op == &scratch[i])
+			free (scratch[i].buf);
+		else
+			f[i].op->lines = n;
+	}
+
+	close (pfd_err[0]);
+	result = _cmd_close (fd);
+	return timed_out ? CMD_TIMEOUT : result;
+}
+
+/* Read the stdout of the child pid from out_fd a line at a time, handing
+ * every line, without its newline, to on_line as soon as it is complete,
+ * and stderr from err_fd into err (if not NULL). The buffer only ever holds
+ * the line being read. When on_line returns non-zero the child is killed
+ * and nothing more read; returns 1 then, 0 otherwise. This is shared with
+ * np_runcmd_lines() in plugins/runcmd.c. */
+int
+cmd_fetch_lines (int out_fd, int err_fd, pid_t pid, int (*on_line) (char *, void *),
+                 void *data, output * err, int flags)
+{
+	size_t size = CMD_FETCH_CHUNK, len = 0, start, i;
+	int n, stopped = 0;
+	output scratch;
+	struct fetch f;
+	struct pollfd pfds[2];
+	char *buf;
+	ssize_t ret;
+
+	if ((buf = malloc (size)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc()"));
+
+	/* stderr is read along, so that a chatty command can't stall */
+	fetch_init (&f, err ? err : &scratch, err ? flags : CMD_NO_ARRAYS);
+	pfds[0].fd = out_fd;
+	pfds[1].fd = err_fd;
+	pfds[0].events = pfds[1].events = POLLIN;
+
+	while (pfds[0].fd >= 0 && !stopped) {
+		pfds[0].revents = pfds[1].revents = 0;
+		if (poll (pfds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfds[1].fd >= 0 && pfds[1].revents) {
+			if ((ret = fetch_read (&f, pfds[1].fd)) <= 0 && !(ret < 0 && errno == EINTR))
+				pfds[1].fd = -1;
+		}
+		if (!pfds[0].revents)
+			continue;
+
+		/* keep a spare byte to terminate the last line */
+		if (len + 1 >= size) {
+			size *= 2;
+			if ((buf = realloc (buf, size)) == NULL)
+				die (STATE_UNKNOWN, _("Cannot realloc()"));
+		}
+		ret = read (pfds[0].fd, buf + len, size - len - 1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			pfds[0].fd = -1;
+			break;
+		}
+
+		/* pass on the lines completed by this read */
+		for (start = 0, i = len, len += ret; i < len && !stopped; i++) {
+			if (buf[i] == '\n') {
+				buf[i] = '\0';
+				stopped = on_line (buf + start, data);
+				start = i + 1;
+			}
+		}
+		memmove (buf, buf + start, len - start);
+		len -= start;
+	}
+	if (stopped)
+		kill (pid, SIGKILL);
+	else if (len > 0) {
+		buf[len] = '\0';
+		on_line (buf, data);
+	}
+	free (buf);
+
+	/* the rest of stderr, unless killed: what is left of the command may
+	 * still hold it open then */
+	while (!stopped && pfds[1].fd >= 0)
+		if ((ret = fetch_read (&f, pfds[1].fd)) <= 0 && !(ret < 0 && errno == EINTR))
+			pfds[1].fd = -1;
+	n = fetch_finish (&f);
+	if (f.op == &scratch)
+		free (scratch.buf);
+	else
+		f.op->lines = n;
+
+	return stopped;
+}
+
+/* Like cmd_run_array(), but hands every line of stdout, without its
+ * newline, to on_line as soon as it has been read instead of collecting
+ * the output, so that callers can act on it while the command runs. Once
+ * on_line returns non-zero, the command is killed and CMD_STOPPED
+ * returned. */
+int
+cmd_run_array_lines (char *const *argv, int (*on_line) (char *, void *),
+                     void *data, output * err, int flags)
+{
+	int fd, pfd_out[2], pfd_err[2], stopped, result;
+
 	if (err)
-		err->lines = _cmd_fetch_output (pfd_err[0], err, flags);
+		memset (err, 0, sizeof (output));
+
+	if ((fd = _cmd_open (argv, pfd_out, pfd_err, flags)) == -1)
+		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), argv[0]);
 
-	return _cmd_close (fd);
+	stopped = cmd_fetch_lines (pfd_out[0], pfd_err[0],
+	                           cmd_child_find (&_cmd_children, fd)->pid,
+	                           on_line, data, err, flags);
+	close (pfd_err[0]);
+	result = _cmd_close (fd);
+	return stopped ? CMD_STOPPED : result;
+}
+
+/* what cmd_run_many() keeps of a command while it runs */
+struct cmd_running {
+	struct fetch f[2];
+	int fd[2];      /* stdout and stderr, -1 once read to the end */
+	int out_fd;     /* stdout, which the table of children knows it by */
+	int err_fd;
+	int pidfd;      /* -1 without */
+	pid_t pid;
+	int status;
+	int running, exited, timed_out;
+};
+
+static int
+cmd_pidfd_open (pid_t pid)
+{
+#ifdef CMD_PIDFD
+	return syscall (__NR_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Once the command exited, what it left in the pipes is all there is from
+ * it, while anything it started in the background may hold them open for
+ * much longer */
+static void
+cmd_drain (struct cmd_running *r)
+{
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (r->fd[i] < 0)
+			continue;
+		fcntl (r->fd[i], F_SETFL, fcntl (r->fd[i], F_GETFL) | O_NONBLOCK);
+		while ((ret = fetch_read (&r->f[i], r->fd[i])) > 0 || (ret < 0 && errno == EINTR))
+			;
+		r->fd[i] = -1;
+	}
+}
+
+static void
+cmd_finish (cmd_job *job, struct cmd_running *r)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+		r->f[i].op->lines = fetch_finish (&r->f[i]);
+
+	cmd_child_remove (&_cmd_children, r->out_fd);
+	close (r->out_fd);
+	close (r->err_fd);
+	if (r->pidfd >= 0)
+		close (r->pidfd);
+	if (!r->exited)
+		while (waitpid (r->pid, &r->status, 0) < 0 && errno == EINTR)
+			;
+
+	if (r->timed_out)
+		job->result = CMD_TIMEOUT;
+	else
+		job->result = WIFEXITED (r->status) ? WEXITSTATUS (r->status) : -1;
+	r->running = 0;
+}
+
+/* Runs the n commands of jobs side by side, at most max_running of them
+ * (0 for no limit) at a time, and returns how many were killed at their
+ * deadline. The stdout and stderr of all of them are read in one poll()
+ * loop as they come, and with pidfds a command is done when it exits, not
+ * only once its pipes are closed. The children are in the same table as
+ * those of cmd_run(), so that timeout_alarm_handler() kills them too. */
+int
+cmd_run_many (cmd_job *jobs, size_t n, size_t max_running, int flags)
+{
+	struct cmd_running *run, *r;
+	struct pollfd *pfds;
+	size_t *owner, next = 0, running = 0, done = 0, i, k, np;
+	int fd, pfd_out[2], pfd_err[2], timeout, ms, timed_out = 0;
+	ssize_t ret;
+
+	if (n == 0)
+		return 0;
+	if (max_running == 0 || max_running > n)
+		max_running = n;
+	run = calloc (n, sizeof (struct cmd_running));
+	pfds = malloc (3 * max_running * sizeof (struct pollfd));
+	owner = malloc (3 * max_running * sizeof (size_t));
+	if (run == NULL || pfds == NULL || owner == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc()"));
+
+	while (done < n) {
+		for (; next < n && running < max_running; next++, running++) {
+			r = &run[next];
+			if ((fd = _cmd_open (jobs[next].argv, pfd_out, pfd_err, flags)) == -1)
+				die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), jobs[next].argv[0]);
+			r->fd[0] = r->out_fd = pfd_out[0];
+			r->fd[1] = r->err_fd = pfd_err[0];
+			r->pid = cmd_child_find (&_cmd_children, fd)->pid;
+			r->pidfd = cmd_pidfd_open (r->pid);
+			r->status = -1;
+			r->running = 1;
+			fetch_init (&r->f[0], &jobs[next].out, flags);
+			fetch_init (&r->f[1], &jobs[next].err, flags);
+		}
+
+		/* what to wait for, and until the first deadline */
+		timeout = -1;
+		for (i = np = 0; i < next; i++) {
+			r = &run[i];
+			if (!r->running)
+				continue;
+			for (k = 0; k < 2; k++) {
+				if (r->fd[k] < 0)
+					continue;
+				pfds[np].fd = r->fd[k];
+				pfds[np].events = POLLIN;
+				owner[np++] = i;
+			}
+			if (r->pidfd >= 0) {
+				pfds[np].fd = r->pidfd;
+				pfds[np].events = POLLIN;
+				owner[np++] = i;
+			}
+			ms = np_deadline_ms (jobs[i].deadline);
+			if (ms >= 0 && (timeout < 0 || ms < timeout))
+				timeout = ms;
+		}
+
+		if (poll (pfds, np, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+		}
+		for (k = 0; k < np; k++) {
+			if (!pfds[k].revents)
+				continue;
+			r = &run[owner[k]];
+			if (pfds[k].fd == r->pidfd) {
+				if (waitpid (r->pid, &r->status, WNOHANG) == r->pid)
+					r->exited = 1;
+				continue;
+			}
+			i = (pfds[k].fd == r->fd[0]) ? 0 : 1;
+			if ((ret = fetch_read (&r->f[i], pfds[k].fd)) <= 0 && !(ret < 0 && errno == EINTR))
+				r->fd[i] = -1;
+		}
+
+		for (i = 0; i < next; i++) {
+			r = &run[i];
+			if (!r->running)
+				continue;
+			if (!r->exited && np_deadline_ms (jobs[i].deadline) == 0) {
+				/* what it wrote until now is kept */
+				kill (r->pid, SIGKILL);
+				r->timed_out = 1;
+				timed_out++;
+			}
+			else if (r->exited)
+				cmd_drain (r);
+			else if (r->fd[0] >= 0 || r->fd[1] >= 0 || r->pidfd >= 0)
+				continue;
+			cmd_finish (&jobs[i], r);
+			running--;
+			done++;
+		}
+	}
+
+	free (run);
+	free (pfds);
+	free (owner);
+	return timed_out;
 }
 
 int
@@ -375,7 +1031,7 @@ cmd_file_read ( char *filename, output *out, int flags)
 	}
 	
 	if(out)
-		out->lines = _cmd_fetch_output (fd, out, flags);
+		out->lines = cmd_fetch_output (fd, out, flags);
 	
 	if (close(fd) == -1)
 		die( STATE_UNKNOWN, _("Error closing %s: %s"), filename, strerror(errno) );
@@ -386,15 +1042,12 @@ cmd_file_read ( char *filename, output *out, int flags)
 void
 timeout_alarm_handler (int signo)
 {
-	size_t i;
 	if (signo == SIGALRM) {
 		printf (_("%s - Plugin timed out after %d seconds\n"),
 						state_text(timeout_state), timeout_interval);
 
-		if(_cmd_pids) for(i = 0; i < maxfd; i++) {
-			if(_cmd_pids[i] != 0) kill(_cmd_pids[i], SIGKILL);
-		}
+		cmd_child_kill_all (&_cmd_children, SIGKILL);
 
-		exit (timeout_state);
+		np_exit (timeout_state);
 	}
 }
@@ -19,10 +19,51 @@ struct output
 
 typedef struct output output;
 
+/* The children started by cmd_run() and friends, by the descriptor their
+ * output is read from. The table grows with the number of children running
+ * at the same time rather than with the limit on open files. */
+struct cmd_child
+{
+	int fd;        /* the read end of the child's stdout */
+	int err_fd;    /* that of its stderr, or -1 */
+	pid_t pid;     /* 0 for a free slot */
+};
+
+typedef struct cmd_children
+{
+	struct cmd_child *slot;
+	size_t size;   /* a power of two, or 0 before the first child */
+	size_t count;
+} cmd_children;
+
+/* One of the commands cmd_run_many() runs side by side */
+typedef struct cmd_job
+{
+	char *const *argv;
+	double deadline; /* see np_deadline(), 0 for none */
+	output out;      /* what it wrote, as cmd_run_array() has it */
+	output err;
+	int result;      /* its exit status, -1, or CMD_TIMEOUT */
+} cmd_job;
+
 /** prototypes **/
 int cmd_run (const char *, output *, output *, int);
 int cmd_run_array (char *const *, output *, output *, int);
+int cmd_run_array_deadline (char *const *, output *, output *, int, double);
+int cmd_run_array_lines (char *const *, int (*) (char *, void *), void *, output *, int);
+int cmd_run_many (cmd_job *, size_t, size_t, int);
 int cmd_file_read (char *, output *, int);
+int cmd_fetch_output (int, output *, int);
+int cmd_fetch_lines (int, int, pid_t, int (*) (char *, void *), void *, output *, int);
+char *cmd_next_line (const output *, size_t *, size_t *);
+pid_t cmd_spawn (char *const *, char *const *, const int *, const int *, const cmd_children *, int);
+
+void cmd_children_init (cmd_children *);
+void cmd_child_add (cmd_children *, int, int, pid_t);
+struct cmd_child *cmd_child_find (const cmd_children *, int);
+pid_t cmd_child_remove (cmd_children *, int);
+void cmd_child_kill_all (const cmd_children *, int);
+void cmd_close_inherited (const cmd_children *);
 
 /* only multi-threaded plugins need to bother with this */
 void cmd_init (void);
@@ -31,16 +72,12 @@ void cmd_init (void);
 /* possible flags for cmd_run()'s fourth argument */
 #define CMD_NO_ARRAYS 0x01   /* don't populate arrays at all */
 #define CMD_NO_ASSOC 0x02    /* output.line won't point to buf */
+#define CMD_FORK 0x04        /* start the command with fork(), not posix_spawn() */
 
-/* This variable must be global, since there's no way the caller
- * can forcibly slay a dead or ungainly running program otherwise.
- * Multithreading apps and plugins can initialize it (via CMD_INIT)
- * in an async safe manner PRIOR to calling cmd_run() or cmd_run_array()
- * for the first time.
- *
- * The check for initialized values is atomic and can
- * occur in any number of threads simultaneously. */
-static pid_t *_cmd_pids = NULL;
+/* what cmd_run_array_deadline() returns for a command it had to kill */
+#define CMD_TIMEOUT -2
+/* and cmd_run_array_lines() for one killed because on_line had enough */
+#define CMD_STOPPED -3
 
 RETSIGTYPE timeout_alarm_handler (int);
 
@@ -28,6 +28,25 @@
 
 #include "common.h"
 #include "utils_disk.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef MOUNTED_GETMNTENT1
+# include <mntent.h>
+# if !defined MOUNTED && defined _PATH_MOUNTED
+#  define MOUNTED _PATH_MOUNTED
+# endif
+#endif
+
+#ifdef __linux__
+# include <sys/syscall.h>
+/* listmount() and statmount() are 458 and 457 wherever the system call
+ * numbers have been unified, that is everywhere but on alpha and mips */
+# if !defined __NR_listmount && !defined __alpha__ && !defined __mips__ && !defined __ia64__
+#  define __NR_statmount 457
+#  define __NR_listmount 458
+# endif
+#endif
 
 void
 np_add_name (struct name_list **list, const char *name)
@@ -48,6 +67,7 @@ np_add_parameter(struct parameter_list **list, const char *name)
   new_path = (struct parameter_list *) malloc (sizeof *new_path);
   new_path->name = (char *) name;
   new_path->best_match = NULL;
+  new_path->usage_job = NULL;
   new_path->name_next = NULL;
   new_path->freespace_bytes = NULL;
   new_path->freespace_units = NULL;
@@ -117,44 +137,159 @@ np_find_parameter(struct parameter_list *list, const char *name)
   return NULL;
 }
 
+/* Index of a mount list for np_set_best_match: open addressing hash tables
+ * of mount directories and device names, so that the longest mount
+ * directory a path starts with is found by looking up the prefixes of the
+ * path, instead of comparing the path with every mount. Where several
+ * mounts have the same directory or device the last one in the list counts,
+ * as one mounted over another hides it. */
+struct mount_index_slot
+{
+  const char *key;
+  size_t len;
+  unsigned int hash;
+  struct mount_entry *me;
+};
+
+struct mount_index
+{
+  struct mount_index_slot *dirs;
+  struct mount_index_slot *devs;
+  size_t mask;
+  struct mount_entry *short_dir;	/* last mount with a one character directory */
+  struct mount_entry *empty_dir;	/* last mount with an empty directory */
+};
+
+#define NP_HASH_INIT 2166136261U
+#define NP_HASH_STEP(h, c) (((h) ^ (unsigned char) (c)) * 16777619U)
+
+static unsigned int
+np_hash (const char *s, size_t len)
+{
+  unsigned int h = NP_HASH_INIT;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    h = NP_HASH_STEP (h, s[i]);
+  return h;
+}
+
+static struct mount_index_slot *
+mount_index_slot (struct mount_index_slot *table, size_t mask, const char *key,
+                  size_t len, unsigned int hash)
+{
+  size_t i;
+
+  for (i = hash & mask; table[i].key; i = (i + 1) & mask)
+    if (table[i].hash == hash && table[i].len == len && memcmp (table[i].key, key, len) == 0)
+      break;
+  return &table[i];
+}
+
+static void
+mount_index_add (struct mount_index_slot *table, size_t mask, const char *key, struct mount_entry *me)
+{
+  size_t len = strlen (key);
+  unsigned int hash = np_hash (key, len);
+  struct mount_index_slot *slot = mount_index_slot (table, mask, key, len, hash);
+
+  slot->key = key;
+  slot->len = len;
+  slot->hash = hash;
+  slot->me = me;
+}
+
+static void
+mount_index_build (struct mount_index *idx, struct mount_entry *mount_list)
+{
+  struct mount_entry *me;
+  size_t count = 0, size = 16;
+
+  for (me = mount_list; me; me = me->me_next)
+    count++;
+  while (size < count * 2)
+    size *= 2;
+
+  idx->mask = size - 1;
+  idx->dirs = calloc (size, sizeof (struct mount_index_slot));
+  idx->devs = calloc (size, sizeof (struct mount_index_slot));
+  if (idx->dirs == NULL || idx->devs == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  idx->short_dir = NULL;
+  idx->empty_dir = NULL;
+
+  for (me = mount_list; me; me = me->me_next) {
+    mount_index_add (idx->devs, idx->mask, me->me_devname, me);
+    mount_index_add (idx->dirs, idx->mask, me->me_mountdir, me);
+    if (me->me_mountdir[0] == '\0')
+      idx->empty_dir = me;
+    else if (me->me_mountdir[1] == '\0')
+      idx->short_dir = me;
+  }
+}
+
+static struct mount_entry *
+mount_index_find (struct mount_index_slot *table, size_t mask, const char *key, size_t len, unsigned int hash)
+{
+  return mount_index_slot (table, mask, key, len, hash)->me;
+}
+
 void
 np_set_best_match(struct parameter_list *desired, struct mount_entry *mount_list, int exact)
 {
   struct parameter_list *d;
+  struct mount_index idx;
+  unsigned int *prefix_hash = NULL;
+  size_t prefix_size = 0, len;
+  int built = FALSE;
+
   for (d = desired; d; d= d->name_next) {
     if (! d->best_match) {
-      struct mount_entry *me;
       size_t name_len = strlen(d->name);
-      size_t best_match_len = 0;
       struct mount_entry *best_match = NULL;
 
-      /* set best match if path name exactly matches a mounted device name */
-      for (me = mount_list; me; me = me->me_next) {
-        if (strcmp(me->me_devname, d->name)==0)
-          best_match = me;
+      if (! built) {
+        mount_index_build (&idx, mount_list);
+        built = TRUE;
       }
 
+      /* set best match if path name exactly matches a mounted device name */
+      best_match = mount_index_find (idx.devs, idx.mask, d->name, name_len, np_hash (d->name, name_len));
+
       /* set best match by directory name if no match was found by devname */
       if (! best_match) {
-        for (me = mount_list; me; me = me->me_next) {
-          size_t len = strlen (me->me_mountdir);
-          if ((exact == FALSE && (best_match_len <= len && len <= name_len &&
-             (len == 1 || strncmp (me->me_mountdir, d->name, len) == 0)))
-             || (exact == TRUE && strcmp(me->me_mountdir, d->name)==0))
-          {
-            best_match = me;
-            best_match_len = len;
+        if (exact == TRUE) {
+          best_match = mount_index_find (idx.dirs, idx.mask, d->name, name_len, np_hash (d->name, name_len));
+        } else {
+          /* hashes of all prefixes of the name in one pass, then the
+           * longest prefix that is a mount directory wins; any one
+           * character directory (that is "/") is taken to match */
+          if (prefix_size < name_len + 1) {
+            prefix_size = name_len + 1;
+            if ((prefix_hash = realloc (prefix_hash, prefix_size * sizeof (unsigned int))) == NULL)
+              die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
           }
+          prefix_hash[0] = NP_HASH_INIT;
+          for (len = 0; len < name_len; len++)
+            prefix_hash[len + 1] = NP_HASH_STEP (prefix_hash[len], d->name[len]);
+          for (len = name_len; len >= 2 && ! best_match; len--)
+            best_match = mount_index_find (idx.dirs, idx.mask, d->name, len, prefix_hash[len]);
+          if (! best_match && name_len >= 1)
+            best_match = idx.short_dir;
+          if (! best_match)
+            best_match = idx.empty_dir;
         }
       }
 
-      if (best_match) {
-        d->best_match = best_match;
-      } else {
-        d->best_match = NULL;	/* Not sure why this is needed as it should be null on initialisation */
-      }
+      d->best_match = best_match;
     }
   }
+
+  if (built) {
+    free (idx.dirs);
+    free (idx.devs);
+  }
+  free (prefix_hash);
 }
 
 /* Returns TRUE if name is in list */
@@ -186,14 +321,720 @@ np_seen_name(struct name_list *list, const char *name)
   return FALSE;
 }
 
+/* The same as np_add_name/np_seen_name, for sets that grow with the
+ * number of mounts */
+void
+np_add_hashed_name (struct name_hash *hash, const char *name)
+{
+  struct name_list **buckets, *n, *next;
+  size_t i, size;
+  unsigned int h;
+
+  if (hash->count >= hash->size) {
+    size = hash->size ? hash->size * 2 : 64;
+    if ((buckets = calloc (size, sizeof (struct name_list *))) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    for (i = 0; i < hash->size; i++) {
+      for (n = hash->buckets[i]; n; n = next) {
+        next = n->next;
+        h = np_hash (n->name, strlen (n->name)) & (size - 1);
+        n->next = buckets[h];
+        buckets[h] = n;
+      }
+    }
+    free (hash->buckets);
+    hash->buckets = buckets;
+    hash->size = size;
+  }
+
+  np_add_name (&hash->buckets[np_hash (name, strlen (name)) & (hash->size - 1)], name);
+  hash->count++;
+}
+
 int
-np_regex_match_mount_entry (struct mount_entry* me, regex_t* re)
+np_seen_hashed_name (const struct name_hash *hash, const char *name)
 {
-  if (regexec(re, me->me_devname, (size_t) 0, NULL, 0) == 0 ||
-      regexec(re, me->me_mountdir, (size_t) 0, NULL, 0) == 0 ) {
+  if (hash->size == 0)
+    return FALSE;
+  return np_seen_name (hash->buckets[np_hash (name, strlen (name)) & (hash->size - 1)], name);
+}
+
+int
+np_regex_match_mount_entry (struct mount_entry* me, np_regex_t* re)
+{
+  if (np_regexec(re, me->me_devname, (size_t) 0, NULL, 0) == 0 ||
+      np_regexec(re, me->me_mountdir, (size_t) 0, NULL, 0) == 0 ) {
     return TRUE;
   } else {
     return FALSE;
   }
 }
 
+#ifdef __NR_listmount
+/* What we use of struct mnt_id_req and struct statmount of <linux/mount.h>
+ * (Linux 6.8, the source since 6.13), which older headers do not have. The
+ * strings of a statmount follow its 512 bytes, at the offsets in it. */
+struct np_mnt_id_req
+{
+  uint32_t size;
+  uint32_t spare;
+  uint64_t mnt_id;
+  uint64_t param;
+};
+
+struct np_statmount
+{
+  uint32_t size;
+  uint32_t mnt_opts;
+  uint64_t mask;
+  uint32_t sb_dev_major;
+  uint32_t sb_dev_minor;
+  uint64_t sb_magic;
+  uint32_t sb_flags;
+  uint32_t fs_type;
+  uint64_t mnt_id;
+  uint64_t mnt_parent_id;
+  uint32_t mnt_id_old;
+  uint32_t mnt_parent_id_old;
+  uint64_t mnt_attr;
+  uint64_t mnt_propagation;
+  uint64_t mnt_peer_group;
+  uint64_t mnt_master;
+  uint64_t propagate_from;
+  uint32_t mnt_root;
+  uint32_t mnt_point;
+  uint64_t mnt_ns_id;
+  uint32_t fs_subtype;
+  uint32_t sb_source;
+  uint8_t spare[384];
+};
+
+#define NP_MNT_ID_REQ_SIZE_VER0 24
+#define NP_LSMT_ROOT 0xffffffffffffffffULL
+#define NP_STATMOUNT_MNT_POINT 0x10
+#define NP_STATMOUNT_FS_TYPE 0x20
+#define NP_STATMOUNT_SB_SOURCE 0x200
+
+/* The IDs of all mounts below our root, in the order of the mount table.
+ * Returns the number of them, or -1 if the kernel has no listmount(). */
+static ssize_t
+listmount_ids (uint64_t **ids)
+{
+  struct np_mnt_id_req req;
+  size_t count = 0, size = 0;
+  long n;
+
+  *ids = NULL;
+  memset (&req, 0, sizeof (req));
+  req.size = NP_MNT_ID_REQ_SIZE_VER0;
+  req.mnt_id = NP_LSMT_ROOT;
+  for (;;) {
+    if (count == size) {
+      size = size ? size * 2 : 1024;
+      if ((*ids = realloc (*ids, size * sizeof (uint64_t))) == NULL)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    }
+    /* each call continues after the last ID it was given */
+    n = syscall (__NR_listmount, &req, *ids + count, size - count, 0);
+    if (n < 0) {
+      free (*ids);
+      *ids = NULL;
+      return -1;
+    }
+    count += n;
+    if (count < size)
+      return count;
+    req.param = (*ids)[count - 1];
+  }
+}
+
+/* statmount() of a mount into *buf, grown as its strings need. Returns 0,
+ * or the errno. */
+static int
+statmount_get (uint64_t id, struct np_statmount **buf, size_t *size)
+{
+  struct np_mnt_id_req req;
+
+  memset (&req, 0, sizeof (req));
+  req.size = NP_MNT_ID_REQ_SIZE_VER0;
+  req.mnt_id = id;
+  req.param = NP_STATMOUNT_MNT_POINT | NP_STATMOUNT_FS_TYPE | NP_STATMOUNT_SB_SOURCE;
+  if (*buf == NULL) {
+    *size = sizeof (struct np_statmount) + 1024;
+    if ((*buf = malloc (*size)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  }
+  while (syscall (__NR_statmount, &req, *buf, *size, 0) != 0) {
+    if (errno != EOVERFLOW)
+      return errno;
+    *size *= 2;
+    if ((*buf = realloc (*buf, *size)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  }
+  return 0;
+}
+#endif
+
+/* A fingerprint of the mount table np_read_mount_list() reads, which
+ * changes whenever the table does, or 0 if it cannot be taken. With
+ * listmount() that is the list of mount IDs. A regular
+ * /etc/mtab is known by its inode and mtime; the kernel's table (which is
+ * what /etc/mtab links to nowadays) keeps neither stable across processes,
+ * so its text is hashed instead, which still costs less than parsing it. */
+unsigned int
+np_mount_table_fingerprint (void)
+{
+#ifdef __NR_listmount
+  uint64_t *ids;
+  ssize_t count;
+#endif
+#ifdef MOUNTED
+  struct stat st;
+  char buf[8192];
+  unsigned int h = NP_HASH_INIT;
+  ssize_t n, i;
+  int fd;
+#endif
+
+#ifdef __NR_listmount
+  /* mount IDs are never used again, so the list of them changes with the
+   * table, and comes without formatting any of it */
+  if ((count = listmount_ids (&ids)) >= 0) {
+    unsigned int ih = np_hash ((const char *) ids, count * sizeof (uint64_t));
+    free (ids);
+    return ih ? ih : 1;
+  }
+#endif
+
+#ifdef MOUNTED
+  if ((fd = open (MOUNTED, O_RDONLY)) < 0)
+    return 0;
+  if (fstat (fd, &st) != 0) {
+    close (fd);
+    return 0;
+  }
+  if (S_ISREG (st.st_mode) && st.st_size > 0) {
+    n = snprintf (buf, sizeof (buf), "%ju %ju %ld %ld %jd",
+                  (uintmax_t) st.st_dev, (uintmax_t) st.st_ino,
+                  (long) st.st_mtime, (long) st.st_ctime, (intmax_t) st.st_size);
+    h = np_hash (buf, n);
+  } else {
+    while ((n = read (fd, buf, sizeof (buf))) > 0)
+      for (i = 0; i < n; i++)
+        h = NP_HASH_STEP (h, buf[i]);
+    if (n < 0) {
+      close (fd);
+      return 0;
+    }
+  }
+  close (fd);
+  return h ? h : 1;
+#else
+  return 0;
+#endif
+}
+
+/* The same dummy and remote file systems as read_file_system_list() */
+static int
+mount_type_dummy (const char *type)
+{
+  static const char *const dummy[] = {
+    "autofs", "proc", "subfs", "debugfs", "devpts", "fusectl", "mqueue",
+    "rpc_pipefs", "sysfs", "devfs", "kernfs", "ignore", "none", NULL
+  };
+  int i;
+
+  for (i = 0; dummy[i]; i++)
+    if (strcmp (type, dummy[i]) == 0)
+      return TRUE;
+  return FALSE;
+}
+
+static int
+mount_remote (const char *devname, const char *type)
+{
+  return strchr (devname, ':') != NULL
+    || (devname[0] == '/' && devname[1] == '/'
+        && (strcmp (type, "smbfs") == 0 || strcmp (type, "cifs") == 0));
+}
+
+/* Whether the filters keep a mount. Going through the mount table from its
+ * end, a mount whose directory has been seen is hidden by one mounted over
+ * it, and goes too, as it would not be checked either. */
+static int
+mount_wanted (struct name_hash *seen, const char *dir, const char *type,
+              struct name_list *fs_include, struct name_list *fs_exclude)
+{
+  if (np_seen_hashed_name (seen, dir))
+    return FALSE;
+  np_add_hashed_name (seen, strdup (dir));
+  if (fs_exclude && np_find_name (fs_exclude, type))
+    return FALSE;
+  if (fs_include && !np_find_name (fs_include, type))
+    return FALSE;
+  return TRUE;
+}
+
+static void
+name_hash_free (struct name_hash *hash)
+{
+  struct name_list *n, *next;
+  size_t i;
+
+  for (i = 0; i < hash->size; i++) {
+    for (n = hash->buckets[i]; n; n = next) {
+      next = n->next;
+      free (n->name);
+      free (n);
+    }
+  }
+  free (hash->buckets);
+}
+
+#ifdef __NR_listmount
+/* The mount list through listmount() and statmount(), which only format
+ * the three strings we want of each mount instead of all of the mount
+ * table. Returns FALSE if the kernel cannot tell them all. */
+static int
+listmount_file_system_list (struct mount_entry **list, int filter,
+                            struct name_list *fs_include, struct name_list *fs_exclude)
+{
+  struct np_statmount *sm = NULL;
+  struct name_hash seen = { NULL, 0, 0 };
+  struct mount_entry *me;
+  uint64_t *ids;
+  ssize_t count, i;
+  size_t size = 0;
+  const char *dir, *type;
+  int ok = TRUE, err;
+
+  *list = NULL;
+  if ((count = listmount_ids (&ids)) < 0)
+    return FALSE;
+
+  /* backwards, as the filters need to know what is mounted over what */
+  for (i = count - 1; i >= 0; i--) {
+    if ((err = statmount_get (ids[i], &sm, &size)) != 0) {
+      /* unmounted since listmount() */
+      if (err == ENOENT)
+        continue;
+      ok = FALSE;
+      break;
+    }
+    if ((sm->mask & (NP_STATMOUNT_MNT_POINT | NP_STATMOUNT_FS_TYPE | NP_STATMOUNT_SB_SOURCE)) !=
+        (NP_STATMOUNT_MNT_POINT | NP_STATMOUNT_FS_TYPE | NP_STATMOUNT_SB_SOURCE)) {
+      ok = FALSE;
+      break;
+    }
+    dir = (const char *) (sm + 1) + sm->mnt_point;
+    type = (const char *) (sm + 1) + sm->fs_type;
+    if (filter && ! mount_wanted (&seen, dir, type, fs_include, fs_exclude))
+      continue;
+
+    if ((me = calloc (1, sizeof (struct mount_entry))) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    me->me_devname = strdup ((const char *) (sm + 1) + sm->sb_source);
+    me->me_mountdir = strdup (dir);
+    me->me_type = strdup (type);
+    me->me_type_malloced = 1;
+    me->me_dummy = mount_type_dummy (me->me_type);
+    me->me_remote = mount_remote (me->me_devname, me->me_type);
+    me->me_dev = (dev_t) -1;
+    me->me_next = *list;
+    *list = me;
+  }
+
+  free (sm);
+  free (ids);
+  name_hash_free (&seen);
+  if (! ok) {
+    while ((me = *list) != NULL) {
+      *list = me->me_next;
+      free_mount_entry (me);
+    }
+  }
+  return ok;
+}
+#endif
+
+/* The mount list, as read_file_system_list() reads it, but from Linux 6.13
+ * on without having the kernel format all of the mount table. With filter
+ * set, mounts whose type fs_exclude has, or fs_include has not, are left
+ * out, along with those mounted over, as if every mount was to be checked. */
+struct mount_entry *
+np_read_mount_list (int filter, struct name_list *fs_include, struct name_list *fs_exclude)
+{
+  struct mount_entry *list, *me, **entries = NULL;
+  struct name_hash seen = { NULL, 0, 0 };
+  size_t count = 0, i;
+
+#ifdef __NR_listmount
+  if (listmount_file_system_list (&list, filter, fs_include, fs_exclude))
+    return list;
+#endif
+
+  list = read_file_system_list (0);
+  if (! filter || list == NULL)
+    return list;
+
+  for (me = list; me; me = me->me_next)
+    count++;
+  if ((entries = malloc (count * sizeof (struct mount_entry *))) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  for (me = list, i = 0; me; me = me->me_next)
+    entries[i++] = me;
+  list = NULL;
+  while (i-- > 0) {
+    me = entries[i];
+    if (mount_wanted (&seen, me->me_mountdir, me->me_type, fs_include, fs_exclude)) {
+      me->me_next = list;
+      list = me;
+    } else {
+      free_mount_entry (me);
+    }
+  }
+  free (entries);
+  name_hash_free (&seen);
+  return list;
+}
+
+/* Append s to the buffer, with the mount table's octal escapes if quote is
+ * set so that every field stays one word */
+static void
+mount_list_put (char **buf, size_t *len, size_t *size, const char *s, int quote)
+{
+  for (; ; s++) {
+    if (*len + 5 > *size) {
+      *size = *size ? *size * 2 : 1024;
+      if ((*buf = realloc (*buf, *size)) == NULL)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    }
+    if (*s == '\0')
+      break;
+    if (quote && ((unsigned char) *s <= ' ' || *s == '\\'))
+      *len += sprintf (*buf + *len, "\\%03o", (unsigned char) *s);
+    else
+      (*buf)[(*len)++] = *s;
+  }
+  (*buf)[*len] = '\0';
+}
+
+/* The next word of the text, unescaped */
+static char *
+mount_list_get (const char **text)
+{
+  const char *p;
+  char *word, *w;
+
+  for (p = *text; *p != '\0' && *p != ' '; p++)
+    ;
+  if ((word = malloc (p - *text + 1)) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  for (p = *text, w = word; *p != '\0' && *p != ' '; p++) {
+    if (p[0] == '\\' && p[1] >= '0' && p[1] <= '3' && p[2] >= '0' && p[2] <= '7' && p[3] >= '0' && p[3] <= '7') {
+      *w++ = (p[1] - '0') * 64 + (p[2] - '0') * 8 + (p[3] - '0');
+      p += 3;
+    } else {
+      *w++ = *p;
+    }
+  }
+  *w = '\0';
+  *text = *p == ' ' ? p + 1 : p;
+  return word;
+}
+
+/* The mount list as one line of text, for np_state_write_string() */
+char *
+np_mount_list_to_string (struct mount_entry *list)
+{
+  struct mount_entry *me;
+  char *buf = NULL;
+  char num[64];
+  size_t len = 0, size = 0, count = 0;
+
+  for (me = list; me; me = me->me_next)
+    count++;
+  snprintf (num, sizeof (num), "%lu", (unsigned long) count);
+  mount_list_put (&buf, &len, &size, num, FALSE);
+  for (me = list; me; me = me->me_next) {
+    mount_list_put (&buf, &len, &size, " ", FALSE);
+    mount_list_put (&buf, &len, &size, me->me_devname, TRUE);
+    mount_list_put (&buf, &len, &size, " ", FALSE);
+    mount_list_put (&buf, &len, &size, me->me_mountdir, TRUE);
+    mount_list_put (&buf, &len, &size, " ", FALSE);
+    mount_list_put (&buf, &len, &size, me->me_type, TRUE);
+    snprintf (num, sizeof (num), " %ju %d", (uintmax_t) me->me_dev, me->me_dummy | me->me_remote << 1);
+    mount_list_put (&buf, &len, &size, num, FALSE);
+  }
+  return buf;
+}
+
+/* Read back a mount list from np_mount_list_to_string(). *text is moved past
+ * it. Returns FALSE if the text is not such a list. */
+int
+np_mount_list_from_string (const char **text, struct mount_entry **list)
+{
+  struct mount_entry *me, **tail = list;
+  unsigned long count;
+  unsigned int flags;
+  char *word, *end;
+
+  *list = NULL;
+  word = mount_list_get (text);
+  count = strtoul (word, &end, 10);
+  if (*word == '\0' || *end != '\0') {
+    free (word);
+    return FALSE;
+  }
+  free (word);
+
+  for (; count > 0; count--) {
+    if (**text == '\0')
+      goto fail;
+    if ((me = calloc (1, sizeof (struct mount_entry))) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    *tail = me;
+    tail = &me->me_next;
+    me->me_devname = mount_list_get (text);
+    me->me_mountdir = mount_list_get (text);
+    me->me_type = mount_list_get (text);
+    me->me_type_malloced = 1;
+
+    word = mount_list_get (text);
+    me->me_dev = (dev_t) strtoumax (word, &end, 10);
+    if (*word == '\0' || *end != '\0') {
+      free (word);
+      goto fail;
+    }
+    free (word);
+    word = mount_list_get (text);
+    flags = strtoul (word, &end, 10);
+    if (*word == '\0' || *end != '\0' || flags > 3) {
+      free (word);
+      goto fail;
+    }
+    free (word);
+    me->me_dummy = flags & 1;
+    me->me_remote = (flags & 2) != 0;
+  }
+  return TRUE;
+
+ fail:
+  while ((me = *list) != NULL) {
+    *list = me->me_next;
+    free_mount_entry (me);
+  }
+  return FALSE;
+}
+
+static thresholds *
+disk_table_thresholds (const struct parameter_list *path, int column)
+{
+  switch (column) {
+  case DISK_FREE_UNITS:
+    return path->freespace_units;
+  case DISK_FREE_PERCENT:
+    return path->freespace_percent;
+  case DISK_USED_UNITS:
+    return path->usedspace_units;
+  case DISK_USED_PERCENT:
+    return path->usedspace_percent;
+  case DISK_USED_INODES_PERCENT:
+    return path->usedinodes_percent;
+  default:
+    return path->freeinodes_percent;
+  }
+}
+
+/* bits of disk_column.flags */
+#define CRIT_ALL 1
+#define CRIT_OUTSIDE 2
+#define WARN_ALL 4
+#define WARN_OUTSIDE 8
+
+static void *
+disk_table_realloc (void *p, size_t size)
+{
+  if ((p = realloc (p, size)) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  return p;
+}
+
+/* Every path has thresholds of its own, so their compiled ranges are copied
+ * into the columns next to the values. */
+void
+np_disk_table_add (struct disk_table *table, struct parameter_list *path)
+{
+  /* a missing range alerts on nothing, not even NaN */
+  static const range never = { 0, FALSE, 0, FALSE, INSIDE, 1, 0, FALSE, FALSE };
+  struct disk_column *col;
+  const range *crit, *warn;
+  thresholds *th;
+  size_t i = table->count, n;
+  int c;
+
+  if (table->count == table->size) {
+    table->size = n = table->size ? table->size * 2 : 64;
+    table->path = disk_table_realloc (table->path, n * sizeof (*table->path));
+    table->result = disk_table_realloc (table->result, n * sizeof (int));
+    for (c = 0; c < DISK_COLUMNS; c++) {
+      col = &table->column[c];
+      col->value = disk_table_realloc (col->value, n * sizeof (double));
+      col->clo = disk_table_realloc (col->clo, n * sizeof (double));
+      col->chi = disk_table_realloc (col->chi, n * sizeof (double));
+      col->wlo = disk_table_realloc (col->wlo, n * sizeof (double));
+      col->whi = disk_table_realloc (col->whi, n * sizeof (double));
+      col->flags = disk_table_realloc (col->flags, n * sizeof (int));
+      col->state = disk_table_realloc (col->state, n * sizeof (int));
+    }
+  }
+
+  table->path[i] = path;
+  table->column[DISK_FREE_UNITS].value[i] = path->dfree_units;
+  table->column[DISK_FREE_PERCENT].value[i] = path->dfree_pct;
+  table->column[DISK_USED_UNITS].value[i] = path->dused_units;
+  table->column[DISK_USED_PERCENT].value[i] = path->dused_pct;
+  table->column[DISK_USED_INODES_PERCENT].value[i] = path->dused_inodes_percent;
+  table->column[DISK_FREE_INODES_PERCENT].value[i] = path->dfree_inodes_percent;
+  for (c = 0; c < DISK_COLUMNS; c++) {
+    col = &table->column[c];
+    th = disk_table_thresholds (path, c);
+    crit = th && th->critical ? th->critical : &never;
+    warn = th && th->warning ? th->warning : &never;
+    col->clo[i] = crit->lo;
+    col->chi[i] = crit->hi;
+    col->wlo[i] = warn->lo;
+    col->whi[i] = warn->hi;
+    col->flags[i] = (crit->all ? CRIT_ALL : 0) | (crit->outside ? CRIT_OUTSIDE : 0) |
+                    (warn->all ? WARN_ALL : 0) | (warn->outside ? WARN_OUTSIDE : 0);
+  }
+  table->count++;
+}
+
+/* The loop over a column reads nothing but its arrays and has no branches,
+ * like get_status_batch(), so the compiler can vectorise it. */
+int
+np_disk_table_evaluate (struct disk_table *table)
+{
+  size_t i, n = table->count;
+  int c, worst = STATE_OK;
+
+  for (i = 0; i < n; i++)
+    table->result[i] = STATE_OK;
+
+  for (c = 0; c < DISK_COLUMNS; c++) {
+    const struct disk_column *col = &table->column[c];
+    const double *value = col->value;
+    const int *flags = col->flags;
+    int *state = col->state;
+
+    for (i = 0; i < n; i++) {
+      int crit = (((col->clo[i] <= value[i]) & (value[i] <= col->chi[i])) | (flags[i] & CRIT_ALL)) ^
+                 ((flags[i] & CRIT_OUTSIDE) >> 1);
+      int warn = (((col->wlo[i] <= value[i]) & (value[i] <= col->whi[i])) | ((flags[i] & WARN_ALL) >> 2)) ^
+                 ((flags[i] & WARN_OUTSIDE) >> 3);
+      /* STATE_CRITICAL is 2, STATE_WARNING 1 and STATE_OK 0 */
+      state[i] = (crit << 1) | (warn & ~crit);
+      table->result[i] |= state[i];
+    }
+  }
+
+  /* WARNING | CRITICAL is CRITICAL */
+  for (i = 0; i < n; i++) {
+    worst |= table->result[i];
+    table->result[i] = table->result[i] & STATE_CRITICAL ? STATE_CRITICAL : table->result[i];
+  }
+  return worst & STATE_CRITICAL ? STATE_CRITICAL : worst;
+}
+
+/* Whether row a is worse than row b: the worse state, then the less free
+ * space, then the one checked first */
+static int
+disk_table_worse (const struct disk_table *table, size_t a, size_t b)
+{
+  const double *free_pct = table->column[DISK_FREE_PERCENT].value;
+
+  if (table->result[a] != table->result[b])
+    return table->result[a] > table->result[b];
+  if (free_pct[a] != free_pct[b])
+    return free_pct[a] < free_pct[b];
+  return a < b;
+}
+
+/* heap[0] is the least bad of the rows kept */
+static void
+disk_table_sift_down (const struct disk_table *table, size_t *heap, size_t n, size_t i)
+{
+  size_t child, tmp;
+
+  while ((child = 2 * i + 1) < n) {
+    if (child + 1 < n && disk_table_worse (table, heap[child], heap[child + 1]))
+      child++;
+    if (! disk_table_worse (table, heap[i], heap[child]))
+      break;
+    tmp = heap[i];
+    heap[i] = heap[child];
+    heap[child] = tmp;
+    i = child;
+  }
+}
+
+/* A heap of n rows, so a few of thousands of file systems are picked
+ * without sorting all of them */
+size_t
+np_disk_table_worst (const struct disk_table *table, size_t n, size_t *rows)
+{
+  size_t i, k, kept = 0, tmp;
+
+  if (n > table->count)
+    n = table->count;
+  if (n == 0)
+    return 0;
+
+  for (i = 0; i < table->count; i++) {
+    if (kept < n) {
+      /* sift up */
+      for (k = kept++, rows[k] = i; k > 0 && disk_table_worse (table, rows[(k - 1) / 2], rows[k]); k = (k - 1) / 2) {
+        tmp = rows[k];
+        rows[k] = rows[(k - 1) / 2];
+        rows[(k - 1) / 2] = tmp;
+      }
+    } else if (disk_table_worse (table, i, rows[0])) {
+      rows[0] = i;
+      disk_table_sift_down (table, rows, n, 0);
+    }
+  }
+
+  /* taking the least bad off the end leaves the worst first */
+  for (k = n - 1; k > 0; k--) {
+    tmp = rows[0];
+    rows[0] = rows[k];
+    rows[k] = tmp;
+    disk_table_sift_down (table, rows, k, 0);
+  }
+  return n;
+}
+
+void
+np_disk_table_free (struct disk_table *table)
+{
+  struct disk_column *col;
+  int c;
+
+  for (c = 0; c < DISK_COLUMNS; c++) {
+    col = &table->column[c];
+    free (col->value);
+    free (col->clo);
+    free (col->chi);
+    free (col->wlo);
+    free (col->whi);
+    free (col->flags);
+    free (col->state);
+    memset (col, 0, sizeof (*col));
+  }
+  free (table->path);
+  free (table->result);
+  table->count = table->size = 0;
+  table->path = NULL;
+  table->result = NULL;
+}
@@ -2,7 +2,7 @@
 
 #include "mountlist.h"
 #include "utils_base.h"
-#include "regex.h"
+#include "utils_regex.h"
 
 struct name_list
 {
@@ -10,6 +10,16 @@ struct name_list
   struct name_list *next;
 };
 
+/* a set of names, hashed into name_list buckets */
+struct name_hash
+{
+  struct name_list **buckets;
+  size_t size;
+  size_t count;
+};
+
+struct fs_usage_job;
+
 struct parameter_list
 {
   char *name;
@@ -23,6 +33,7 @@ struct parameter_list
   thresholds *freeinodes_percent;
   char *group;
   struct mount_entry *best_match;
+  struct fs_usage_job *usage_job;
   struct parameter_list *name_next;
   uintmax_t total, available, available_to_root, used,
     inodes_free, inodes_free_to_root, inodes_used, inodes_total;
@@ -34,10 +45,60 @@ struct parameter_list
 void np_add_name (struct name_list **list, const char *name);
 int np_find_name (struct name_list *list, const char *name);
 int np_seen_name (struct name_list *list, const char *name);
+void np_add_hashed_name (struct name_hash *hash, const char *name);
+int np_seen_hashed_name (const struct name_hash *hash, const char *name);
 struct parameter_list *np_add_parameter(struct parameter_list **list, const char *name);
 struct parameter_list *np_find_parameter(struct parameter_list *list, const char *name);
 struct parameter_list *np_del_parameter(struct parameter_list *item, struct parameter_list *prev);
   
 int search_parameter_list (struct parameter_list *list, const char *name);
 void np_set_best_match(struct parameter_list *desired, struct mount_entry *mount_list, int exact);
-int np_regex_match_mount_entry (struct mount_entry* me, regex_t* re);
+int np_regex_match_mount_entry (struct mount_entry* me, np_regex_t* re);
+unsigned int np_mount_table_fingerprint (void);
+struct mount_entry *np_read_mount_list (int filter, struct name_list *fs_include, struct name_list *fs_exclude);
+char *np_mount_list_to_string (struct mount_entry *list);
+int np_mount_list_from_string (const char **text, struct mount_entry **list);
+
+/* The numbers of the file systems to check, a column for every kind of
+ * threshold, in the order of the checks */
+enum {
+  DISK_FREE_UNITS,
+  DISK_FREE_PERCENT,
+  DISK_USED_UNITS,
+  DISK_USED_PERCENT,
+  DISK_USED_INODES_PERCENT,
+  DISK_FREE_INODES_PERCENT,
+  DISK_COLUMNS
+};
+
+/* A column holds the values and the compiled critical and warning ranges
+ * of every row, see range in utils_base.h */
+struct disk_column
+{
+  double *value;
+  double *clo, *chi, *wlo, *whi;
+  int *flags;			/* all and outside of both ranges, as bits */
+  int *state;			/* filled in by np_disk_table_evaluate */
+};
+
+struct disk_table
+{
+  size_t count;
+  size_t size;
+  struct parameter_list **path;
+  struct disk_column column[DISK_COLUMNS];
+  int *result;			/* the worst state of every row */
+};
+
+#define DISK_TABLE_INIT { 0, 0, NULL, { { NULL, NULL, NULL, NULL, NULL, NULL, NULL } }, NULL }
+
+/* Append the numbers get_stats() worked out for path, and its thresholds. */
+void np_disk_table_add (struct disk_table *table, struct parameter_list *path);
+/* get_status() for every row and column, a column at a time, and the worst
+ * state of all of them */
+int np_disk_table_evaluate (struct disk_table *table);
+/* The rows of the n worst file systems after np_disk_table_evaluate(),
+ * worst first: by state, then by free space in percent. Returns how many
+ * there are in rows, at most n. */
+size_t np_disk_table_worst (const struct disk_table *table, size_t n, size_t *rows);
+void np_disk_table_free (struct disk_table *table);
@@ -0,0 +1,216 @@
+/*****************************************************************************
+*
+* Monitoring Plugins framed results
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file builds the framed binary record of a check result, see
+* utils_frame.h for the layout. The executor and the batch modes hand
+* these out next to the text, so that whoever takes in thousands of
+* results reads lengths and numbers instead of scanning the output for
+* '|', '=' and ';'. The perfdata functions add their points to the record
+* of the run while it is collected, so the values are the ones the text
+* was printed from.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_frame.h"
+#include <stdint.h>
+
+typedef struct frame_buffer {
+	char *buf;
+	size_t len;
+	size_t size;
+	int failed;		/* out of memory, the record is lost */
+} frame_buffer;
+
+static NP_THREAD_LOCAL int collecting = FALSE;
+static NP_THREAD_LOCAL frame_buffer points = { NULL, 0, 0, FALSE };
+static NP_THREAD_LOCAL unsigned int point_count = 0;
+
+static void
+frame_append (frame_buffer *f, const void *data, size_t len)
+{
+	size_t size;
+	char *p;
+
+	if (f->failed || len == 0)
+		return;
+	if (f->len + len > f->size) {
+		size = f->size ? f->size * 2 : 256;
+		while (size < f->len + len)
+			size *= 2;
+		if ((p = realloc (f->buf, size)) == NULL) {
+			f->failed = TRUE;
+			return;
+		}
+		f->buf = p;
+		f->size = size;
+	}
+	memcpy (f->buf + f->len, data, len);
+	f->len += len;
+}
+
+static void
+frame_uint (frame_buffer *f, uint64_t v, int bytes)
+{
+	unsigned char b[8];
+	int i;
+
+	for (i = bytes - 1; i >= 0; i--) {
+		b[i] = v & 0xff;
+		v >>= 8;
+	}
+	frame_append (f, b, bytes);
+}
+
+static void
+frame_double (frame_buffer *f, double d)
+{
+	uint64_t v;
+
+	memcpy (&v, &d, sizeof (v));
+	frame_uint (f, v, 8);
+}
+
+/* a length byte and at most 255 bytes of s */
+static void
+frame_short_string (frame_buffer *f, const char *s)
+{
+	size_t len = s ? strlen (s) : 0;
+
+	if (len > 255)
+		len = 255;
+	frame_uint (f, len, 1);
+	frame_append (f, s, len);
+}
+
+static void
+frame_range (frame_buffer *f, const range *r)
+{
+	frame_double (f, r->start);
+	frame_double (f, r->end);
+	frame_uint (f, (r->start_infinity ? NP_FRAME_START_INFINITY : 0) |
+	               (r->end_infinity ? NP_FRAME_END_INFINITY : 0) |
+	               (r->alert_on == INSIDE ? NP_FRAME_INSIDE : 0), 1);
+}
+
+void
+np_frame_collect (int on)
+{
+	collecting = on;
+	points.len = 0;
+	points.failed = FALSE;
+	point_count = 0;
+}
+
+int
+np_frame_collecting (void)
+{
+	return collecting;
+}
+
+void
+np_frame_point (const char *label, double value, const char *uom,
+                const range *warn, const range *crit,
+                int minp, double minv, int maxp, double maxv)
+{
+	if (!collecting || label == NULL || point_count == 0xffff)
+		return;
+
+	frame_short_string (&points, label);
+	frame_short_string (&points, uom);
+	frame_uint (&points, (warn ? NP_FRAME_WARN : 0) | (crit ? NP_FRAME_CRIT : 0) |
+	                     (minp ? NP_FRAME_MIN : 0) | (maxp ? NP_FRAME_MAX : 0), 1);
+	frame_double (&points, value);
+	if (warn)
+		frame_range (&points, warn);
+	if (crit)
+		frame_range (&points, crit);
+	if (minp)
+		frame_double (&points, minv);
+	if (maxp)
+		frame_double (&points, maxv);
+	point_count++;
+}
+
+/* The output without the perfdata: the first line up to its '|', and of
+ * the long output what comes before the next '|', after which all of it
+ * is perfdata */
+static void
+frame_output (frame_buffer *f, const char *output, size_t len)
+{
+	const char *eol, *bar, *end = output + len;
+	size_t start = f->len;
+
+	frame_uint (f, 0, 4);
+	eol = memchr (output, '\n', len);
+	if (eol == NULL)
+		eol = end;
+	bar = memchr (output, '|', eol - output);
+	frame_append (f, output, (bar ? bar : eol) - output);
+	if (eol < end) {
+		bar = memchr (eol, '|', end - eol);
+		frame_append (f, eol, (bar ? bar : end) - eol);
+	}
+	/* no trailing newline */
+	while (!f->failed && f->len > start + 4 && f->buf[f->len - 1] == '\n')
+		f->len--;
+	if (!f->failed) {
+		len = f->len - start - 4;
+		f->len = start;
+		frame_uint (f, len, 4);
+		f->len += len;
+	}
+}
+
+char *
+np_frame_result (int state, double start, double duration,
+                 const char *output, size_t output_len, size_t *len)
+{
+	frame_buffer f = { NULL, 0, 0, FALSE };
+
+	frame_append (&f, NP_FRAME_MAGIC, 4);
+	frame_uint (&f, 0, 4);
+	frame_uint (&f, state, 1);
+	frame_uint (&f, 0, 1);
+	frame_uint (&f, point_count, 2);
+	frame_uint (&f, (uint64_t) (int64_t) (start * 1e6), 8);
+	frame_uint (&f, duration <= 0 ? 0 : duration >= 4294.967295 ? 0xffffffff :
+	                (uint64_t) (duration * 1e6), 4);
+	frame_output (&f, output ? output : "", output ? output_len : 0);
+	if (points.failed)
+		f.failed = TRUE;
+	frame_append (&f, points.buf, points.len);
+	np_frame_collect (collecting);
+
+	if (f.failed) {
+		free (f.buf);
+		return NULL;
+	}
+	*len = f.len;
+	/* the length of what follows the header */
+	f.len = 4;
+	frame_uint (&f, *len - NP_FRAME_HEADER, 4);
+	return f.buf;
+}
@@ -0,0 +1,56 @@
+#ifndef _UTILS_FRAME_
+#define _UTILS_FRAME_
+/* Header file for utils_frame: check results as framed binary records */
+
+#include <stddef.h>
+#include "utils_base.h"
+
+/*
+ * A record holds what a scheduler otherwise parses out of the text of a
+ * check: the state, when it ran, the output without the perfdata, and
+ * the perfdata as typed values. Integers are big endian, doubles are IEEE
+ * 754 big endian.
+ *
+ *   "NPF1"                  magic
+ *   u32 length              of the rest of the record
+ *   u8 state, u8 0, u16 points
+ *   i64 start               microseconds since the epoch
+ *   u32 duration            microseconds
+ *   u32 length, output      the lines of the output with the perfdata cut
+ *                           off, no trailing newline
+ *   then for every point:
+ *     u8 length, label, u8 length, uom
+ *     u8 flags              NP_FRAME_* below
+ *     f64 value
+ *     warn range, crit range if flagged: f64 start, f64 end, u8 range flags
+ *     f64 min, f64 max      if flagged
+ */
+#define NP_FRAME_MAGIC "NPF1"
+#define NP_FRAME_HEADER 8	/* magic and length */
+
+#define NP_FRAME_WARN 0x01
+#define NP_FRAME_CRIT 0x02
+#define NP_FRAME_MIN  0x04
+#define NP_FRAME_MAX  0x08
+
+/* the range flags */
+#define NP_FRAME_START_INFINITY 0x01
+#define NP_FRAME_END_INFINITY   0x02
+#define NP_FRAME_INSIDE         0x04
+
+/* While collecting, the perfdata functions add every point they build to
+ * the record of the run. np_frame_collect(TRUE) starts over, FALSE stops
+ * and drops what was collected. */
+void np_frame_collect (int on);
+int np_frame_collecting (void);
+void np_frame_point (const char *label, double value, const char *uom,
+                     const range *warn, const range *crit,
+                     int minp, double minv, int maxp, double maxv);
+
+/* The record of a run with the points collected since, which start over.
+ * start is seconds since the epoch, duration seconds. Returns a malloc()ed
+ * record of *len bytes, NULL if out of memory. */
+char *np_frame_result (int state, double start, double duration,
+                       const char *output, size_t output_len, size_t *len);
+
+#endif /* _UTILS_FRAME_ */
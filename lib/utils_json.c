@@ -0,0 +1,461 @@
+/*****************************************************************************
+*
+* Monitoring Plugins JSON utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds a JSON parser for the assertions on health endpoints of
+* check_curl. It is fed the body a chunk at a time as it arrives and keeps
+* nothing of it but the path to the value being read and the values asked
+* for, so a body does not have to be buffered, and the transfer can stop
+* once every path asked for was seen. The parser takes one byte at a time
+* and keeps its state between chunks, so a chunk may end anywhere.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_json.h"
+
+enum {
+	ST_VALUE,		/* a value, after ':', ',' in an array or at the start */
+	ST_VALUE_OR_END,	/* a value or ']', after '[' */
+	ST_KEY,			/* a key, after ',' in an object */
+	ST_KEY_OR_END,		/* a key or '}', after '{' */
+	ST_COLON,
+	ST_NEXT,		/* ',' or the end of the container, after a value */
+	ST_STRING,
+	ST_ESCAPE,
+	ST_UNICODE,
+	ST_NUMBER,
+	ST_LITERAL,		/* true, false or null */
+	ST_DONE			/* only whitespace may follow */
+};
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+static int
+path_append(np_json *j, size_t at, const char *s, size_t n)
+{
+	char *p;
+
+	if (at + n + 1 > j->pathsize) {
+		j->pathsize = (at + n + 1) * 2;
+		if ((p = realloc(j->path, j->pathsize)) == NULL)
+			return FALSE;
+		j->path = p;
+	}
+	memcpy(j->path + at, s, n);
+	j->path[at + n] = '\0';
+	return TRUE;
+}
+
+/* the path of a value starting in the innermost container */
+static int
+value_path(np_json *j)
+{
+	size_t at = j->pathlen[j->depth];
+	char index[32];
+
+	if (j->depth == 0)
+		return path_append(j, 0, "", 0);
+	if (j->container[j->depth] == '[') {
+		snprintf(index, sizeof(index), "[%ld]", j->index[j->depth]);
+		return path_append(j, at, index, strlen(index));
+	}
+	if (at > 0) {
+		if (!path_append(j, at, ".", 1))
+			return FALSE;
+		at++;
+	}
+	return path_append(j, at, j->key, j->keylen);
+}
+
+static int
+path_wanted(const np_json *j)
+{
+	int i;
+
+	for (i = 0; i < j->count; i++)
+		if (j->type[i] == NP_JSON_NONE && strcmp(j->paths[i], j->path) == 0)
+			return TRUE;
+	return FALSE;
+}
+
+/* the value at the current path was read */
+static int
+record(np_json *j, int type)
+{
+	int i;
+
+	if (!j->capture)
+		return TRUE;
+	j->token[j->tokenlen] = '\0';
+	for (i = 0; i < j->count; i++) {
+		if (j->type[i] != NP_JSON_NONE || strcmp(j->paths[i], j->path) != 0)
+			continue;
+		if (type != NP_JSON_OBJECT && type != NP_JSON_ARRAY &&
+		    (j->value[i] = strdup(j->token)) == NULL)
+			return FALSE;
+		j->type[i] = type;
+		j->found_count++;
+	}
+	j->capture = FALSE;
+	return TRUE;
+}
+
+static void
+after_value(np_json *j)
+{
+	j->state = j->depth == 0 ? ST_DONE : ST_NEXT;
+}
+
+static int
+begin_value(np_json *j, unsigned char c)
+{
+	if (!value_path(j))
+		return FALSE;
+	j->capture = path_wanted(j);
+	j->tokenlen = 0;
+
+	if (c == '{' || c == '[') {
+		if (!record(j, c == '{' ? NP_JSON_OBJECT : NP_JSON_ARRAY) || j->depth == NP_JSON_MAX_DEPTH)
+			return FALSE;
+		j->depth++;
+		j->container[j->depth] = c;
+		j->index[j->depth] = 0;
+		j->pathlen[j->depth] = strlen(j->path);
+		j->state = c == '{' ? ST_KEY_OR_END : ST_VALUE_OR_END;
+	} else if (c == '"') {
+		j->in_key = FALSE;
+		j->state = ST_STRING;
+	} else if (c == '-' || (c >= '0' && c <= '9')) {
+		j->token[j->tokenlen++] = c;
+		j->state = ST_NUMBER;
+	} else if (c >= 'a' && c <= 'z') {
+		j->token[j->tokenlen++] = c;
+		j->state = ST_LITERAL;
+	} else {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int
+end_container(np_json *j, unsigned char c)
+{
+	if (j->depth == 0 || j->container[j->depth] != (c == '}' ? '{' : '['))
+		return FALSE;
+	j->depth--;
+	after_value(j);
+	return TRUE;
+}
+
+static void
+string_add(np_json *j, unsigned char c)
+{
+	if (j->in_key) {
+		if (j->keylen < NP_JSON_MAX_KEY - 1)
+			j->key[j->keylen++] = c;
+	} else if (j->capture && j->tokenlen < NP_JSON_MAX_VALUE - 1) {
+		j->token[j->tokenlen++] = c;
+	}
+}
+
+/* a \uXXXX as UTF-8; the halves of a surrogate pair are not joined */
+static void
+string_add_unicode(np_json *j, unsigned int u)
+{
+	if (u < 0x80) {
+		string_add(j, u);
+	} else if (u < 0x800) {
+		string_add(j, 0xc0 | (u >> 6));
+		string_add(j, 0x80 | (u & 0x3f));
+	} else {
+		string_add(j, 0xe0 | (u >> 12));
+		string_add(j, 0x80 | ((u >> 6) & 0x3f));
+		string_add(j, 0x80 | (u & 0x3f));
+	}
+}
+
+static int
+end_scalar(np_json *j)
+{
+	char *end;
+	int type;
+
+	j->token[j->tokenlen] = '\0';
+	if (j->state == ST_NUMBER) {
+		/* strtod() is more lenient than JSON, but the bytes were checked */
+		strtod(j->token, &end);
+		if (*end != '\0' || j->token[j->tokenlen - 1] == '.')
+			return FALSE;
+		type = NP_JSON_NUMBER;
+	} else if (strcmp(j->token, "true") == 0) {
+		type = NP_JSON_TRUE;
+	} else if (strcmp(j->token, "false") == 0) {
+		type = NP_JSON_FALSE;
+	} else if (strcmp(j->token, "null") == 0) {
+		type = NP_JSON_NULL;
+	} else {
+		return FALSE;
+	}
+	if (!record(j, type))
+		return FALSE;
+	after_value(j);
+	return TRUE;
+}
+
+np_json *
+np_json_new(char * const *paths, int count)
+{
+	np_json *j;
+	const char *p;
+	int i;
+
+	if ((j = calloc(1, sizeof(*j))) == NULL)
+		return NULL;
+	j->count = count;
+	j->paths = calloc(count > 0 ? count : 1, sizeof(char *));
+	j->value = calloc(count > 0 ? count : 1, sizeof(char *));
+	j->type = calloc(count > 0 ? count : 1, sizeof(int));
+	if (j->paths == NULL || j->value == NULL || j->type == NULL) {
+		np_json_free(j);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		p = paths[i];
+		if (*p == '$')
+			p++;
+		if (*p == '.')
+			p++;
+		if ((j->paths[i] = strdup(p)) == NULL) {
+			np_json_free(j);
+			return NULL;
+		}
+	}
+	np_json_reset(j);
+	return j;
+}
+
+void
+np_json_reset(np_json *j)
+{
+	int i;
+
+	for (i = 0; i < j->count; i++) {
+		free(j->value[i]);
+		j->value[i] = NULL;
+		j->type[i] = NP_JSON_NONE;
+	}
+	j->found_count = 0;
+	j->error = 0;
+	j->offset = 0;
+	j->state = ST_VALUE;
+	j->depth = 0;
+	j->pathlen[0] = 0;
+	j->keylen = 0;
+	j->tokenlen = 0;
+	j->capture = FALSE;
+}
+
+int
+np_json_feed(np_json *j, const char *buf, size_t len)
+{
+	unsigned char c;
+	size_t i = 0;
+	int v;
+
+	if (j->error)
+		return -1;
+
+	while (i < len) {
+		c = (unsigned char)buf[i];
+		switch (j->state) {
+		case ST_VALUE:
+		case ST_VALUE_OR_END:
+			if (IS_SPACE(c))
+				break;
+			if (c == ']' && j->state == ST_VALUE_OR_END) {
+				if (!end_container(j, c))
+					goto error;
+			} else if (!begin_value(j, c)) {
+				goto error;
+			}
+			break;
+		case ST_KEY:
+		case ST_KEY_OR_END:
+			if (IS_SPACE(c))
+				break;
+			if (c == '}' && j->state == ST_KEY_OR_END) {
+				if (!end_container(j, c))
+					goto error;
+			} else if (c == '"') {
+				j->in_key = TRUE;
+				j->keylen = 0;
+				j->state = ST_STRING;
+			} else {
+				goto error;
+			}
+			break;
+		case ST_COLON:
+			if (IS_SPACE(c))
+				break;
+			if (c != ':')
+				goto error;
+			j->state = ST_VALUE;
+			break;
+		case ST_NEXT:
+			if (IS_SPACE(c))
+				break;
+			if (c == ',') {
+				if (j->container[j->depth] == '{') {
+					j->state = ST_KEY;
+				} else {
+					j->index[j->depth]++;
+					j->state = ST_VALUE;
+				}
+			} else if (c == '}' || c == ']') {
+				if (!end_container(j, c))
+					goto error;
+			} else {
+				goto error;
+			}
+			break;
+		case ST_STRING:
+			if (c == '"') {
+				if (j->in_key) {
+					j->key[j->keylen] = '\0';
+					j->state = ST_COLON;
+				} else {
+					if (!record(j, NP_JSON_STRING))
+						goto error;
+					after_value(j);
+				}
+			} else if (c == '\\') {
+				j->state = ST_ESCAPE;
+			} else if (c < 0x20) {
+				goto error;
+			} else {
+				string_add(j, c);
+			}
+			break;
+		case ST_ESCAPE:
+			j->state = ST_STRING;
+			switch (c) {
+			case '"': case '\\': case '/':
+				string_add(j, c);
+				break;
+			case 'b': string_add(j, '\b'); break;
+			case 'f': string_add(j, '\f'); break;
+			case 'n': string_add(j, '\n'); break;
+			case 'r': string_add(j, '\r'); break;
+			case 't': string_add(j, '\t'); break;
+			case 'u':
+				j->ucode = 0;
+				j->uleft = 4;
+				j->state = ST_UNICODE;
+				break;
+			default:
+				goto error;
+			}
+			break;
+		case ST_UNICODE:
+			if (c >= '0' && c <= '9')
+				v = c - '0';
+			else if (c >= 'a' && c <= 'f')
+				v = c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				v = c - 'A' + 10;
+			else
+				goto error;
+			j->ucode = j->ucode * 16 + v;
+			if (--j->uleft == 0) {
+				string_add_unicode(j, j->ucode);
+				j->state = ST_STRING;
+			}
+			break;
+		case ST_NUMBER:
+		case ST_LITERAL:
+			if (j->state == ST_NUMBER ? (c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' ||
+			                            c == '+' || c == '-'
+			                          : c >= 'a' && c <= 'z') {
+				if (j->tokenlen == NP_JSON_MAX_VALUE - 1)
+					goto error;
+				j->token[j->tokenlen++] = c;
+				break;
+			}
+			/* the byte after it is looked at again in the next state */
+			if (!end_scalar(j))
+				goto error;
+			continue;
+		case ST_DONE:
+			if (!IS_SPACE(c))
+				goto error;
+			break;
+		}
+		i++;
+		j->offset++;
+	}
+	return j->found_count;
+
+error:
+	j->error = j->offset + 1;
+	return -1;
+}
+
+int
+np_json_end(np_json *j)
+{
+	if (j->error)
+		return -1;
+	/* a number or literal standing alone ends with the document */
+	if (j->depth == 0 && (j->state == ST_NUMBER || j->state == ST_LITERAL) && !end_scalar(j))
+		j->error = j->offset + 1;
+	else if (j->state != ST_DONE)
+		j->error = j->offset + 1;
+	return j->error ? -1 : j->found_count;
+}
+
+int
+np_json_done(const np_json *j)
+{
+	return j->error || j->state == ST_DONE || j->found_count == j->count;
+}
+
+void
+np_json_free(np_json *j)
+{
+	int i;
+
+	if (j == NULL)
+		return;
+	for (i = 0; i < j->count; i++) {
+		if (j->paths)
+			free(j->paths[i]);
+		if (j->value)
+			free(j->value[i]);
+	}
+	free(j->paths);
+	free(j->value);
+	free(j->type);
+	free(j->path);
+	free(j);
+}
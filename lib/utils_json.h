@@ -0,0 +1,73 @@
+#ifndef _UTILS_JSON_
+#define _UTILS_JSON_
+
+/*
+ * Header file for Monitoring Plugins utils_json.c
+ *
+ * Picking values out of a JSON document as it arrives, without keeping
+ * the document: the paths asked for are resolved while np_json_feed() is
+ * given the body chunk by chunk, and a caller may stop reading once all of
+ * them were seen.
+ */
+
+#include <stddef.h>
+
+/* how deep containers may nest, and how much of a key or a value is kept */
+#define NP_JSON_MAX_DEPTH 64
+#define NP_JSON_MAX_KEY 256
+#define NP_JSON_MAX_VALUE 4096
+
+enum np_json_type {
+	NP_JSON_NONE,		/* not seen (yet) */
+	NP_JSON_STRING,
+	NP_JSON_NUMBER,
+	NP_JSON_TRUE,
+	NP_JSON_FALSE,
+	NP_JSON_NULL,
+	NP_JSON_OBJECT,
+	NP_JSON_ARRAY
+};
+
+typedef struct np_json {
+	int count;		/* number of paths */
+	int found_count;	/* how many of them were seen */
+	char **paths;		/* as given, less a leading "$" or "$." */
+	char **value;		/* the text of a scalar, unescaped, or NULL */
+	int *type;		/* enum np_json_type of each path */
+	size_t error;		/* offset of a syntax error plus one, or 0 */
+	size_t offset;		/* bytes fed so far */
+
+	/* the parser, which stops anywhere in a chunk and goes on in the next */
+	int state;
+	int depth;		/* open containers */
+	char container[NP_JSON_MAX_DEPTH + 1];
+	long index[NP_JSON_MAX_DEPTH + 1];
+	size_t pathlen[NP_JSON_MAX_DEPTH + 1];	/* path of each open container */
+	char *path;		/* path of the value being read */
+	size_t pathsize;
+	char key[NP_JSON_MAX_KEY];
+	size_t keylen;
+	char token[NP_JSON_MAX_VALUE];
+	size_t tokenlen;
+	int in_key;		/* the string being read is a key */
+	int capture;		/* the value being read is asked for */
+	unsigned int ucode;	/* \uXXXX being read */
+	int uleft;
+} np_json;
+
+/* Paths look like "status", "checks.db.latency" or "$.items[2].name".
+ * Returns NULL if out of memory. */
+np_json *np_json_new(char * const *paths, int count);
+void np_json_reset(np_json *json);
+/* Parses the next len bytes of the document and returns how many of the
+ * paths have been seen so far, or -1 once the document is not JSON */
+int np_json_feed(np_json *json, const char *buf, size_t len);
+/* The document ended: finishes a number or literal standing alone, and
+ * returns what np_json_feed() would, -1 if the document was cut short */
+int np_json_end(np_json *json);
+/* whether more of the document can tell nothing new: every path was seen,
+ * the document ended or is broken */
+int np_json_done(const np_json *json);
+void np_json_free(np_json *json);
+
+#endif /* _UTILS_JSON_ */
@@ -0,0 +1,213 @@
+/*****************************************************************************
+*
+* Monitoring Plugins string matching utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds the literal string search used for the content checks
+* of check_http and check_curl and for the expected replies of check_tcp.
+* A single string is found with memchr() on its first byte, which the C
+* library does a word or vector at a time, and a comparison of its last
+* byte before the whole of it. Several strings are looked for in one pass
+* with an Aho-Corasick automaton, which keeps its state between chunks of
+* a body that is still arriving.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_match.h"
+
+const char *
+np_memmem(const char *haystack, size_t len, const char *needle, size_t needle_len)
+{
+	const char *p, *end;
+
+	if (needle_len == 0)
+		return haystack;
+	if (needle_len > len)
+		return NULL;
+
+	/* last place a match can start, plus one */
+	end = haystack + len - needle_len + 1;
+	for (p = haystack; p < end; p++) {
+		p = memchr(p, needle[0], end - p);
+		if (p == NULL)
+			return NULL;
+		if (p[needle_len - 1] == needle[needle_len - 1] &&
+		    memcmp(p, needle, needle_len) == 0)
+			return p;
+	}
+	return NULL;
+}
+
+np_matcher *
+np_matcher_new(char * const *strings, int count)
+{
+	np_matcher *m;
+	int *fail, *queue;
+	int i, c, s, head, tail, size = 1;
+	const unsigned char *p;
+
+	for (i = 0; i < count; i++)
+		size += strlen(strings[i]);
+
+	m = calloc(1, sizeof(*m));
+	if (m == NULL)
+		return NULL;
+	m->count = count;
+	m->found = calloc(count > 0 ? count : 1, 1);
+	m->next = malloc(sizeof(int) * 256 * size);
+	m->output = malloc(sizeof(int) * size);
+	m->dict = malloc(sizeof(int) * size);
+	m->same = malloc(sizeof(int) * (count > 0 ? count : 1));
+	fail = calloc(size, sizeof(int));
+	queue = malloc(sizeof(int) * size);
+	if (m->found == NULL || m->next == NULL || m->output == NULL ||
+	    m->dict == NULL || m->same == NULL || fail == NULL || queue == NULL) {
+		free(fail);
+		free(queue);
+		np_matcher_free(m);
+		return NULL;
+	}
+
+	/* the trie of the strings */
+	memset(m->next, -1, sizeof(int) * 256 * size);
+	m->output[0] = -1;
+	m->states = 1;
+	m->start_byte = -1;
+	for (i = 0; i < count; i++) {
+		m->same[i] = -1;
+		s = 0;
+		for (p = (const unsigned char *)strings[i]; *p; p++) {
+			if (m->next[s * 256 + *p] < 0) {
+				m->output[m->states] = -1;
+				m->next[s * 256 + *p] = m->states++;
+			}
+			s = m->next[s * 256 + *p];
+		}
+		if (m->output[s] >= 0) {
+			m->same[i] = m->same[m->output[s]];
+			m->same[m->output[s]] = i;
+		} else {
+			m->output[s] = i;
+		}
+		if (i == 0)
+			m->start_byte = (unsigned char)strings[i][0];
+		else if (m->start_byte != (unsigned char)strings[i][0])
+			m->start_byte = -1;
+	}
+	/* an empty string matches anywhere, and so does not start with a byte */
+	if (m->start_byte == 0)
+		m->start_byte = -1;
+
+	/* failure links breadth first, turning the trie into a complete
+	 * transition table on the way */
+	head = tail = 0;
+	m->dict[0] = -1;
+	for (c = 0; c < 256; c++) {
+		s = m->next[c];
+		if (s < 0) {
+			m->next[c] = 0;
+		} else {
+			fail[s] = 0;
+			queue[tail++] = s;
+		}
+	}
+	while (head < tail) {
+		int r = queue[head++];
+
+		m->dict[r] = m->output[fail[r]] >= 0 ? fail[r] : m->dict[fail[r]];
+		for (c = 0; c < 256; c++) {
+			s = m->next[r * 256 + c];
+			if (s < 0) {
+				m->next[r * 256 + c] = m->next[fail[r] * 256 + c];
+			} else {
+				fail[s] = m->next[fail[r] * 256 + c];
+				queue[tail++] = s;
+			}
+		}
+	}
+	free(fail);
+	free(queue);
+
+	np_matcher_reset(m);
+	return m;
+}
+
+static void
+np_matcher_mark(np_matcher *m, int s)
+{
+	int i;
+
+	for (; s >= 0; s = m->dict[s]) {
+		for (i = m->output[s]; i >= 0; i = m->same[i]) {
+			if (!m->found[i]) {
+				m->found[i] = 1;
+				m->found_count++;
+			}
+		}
+	}
+}
+
+void
+np_matcher_reset(np_matcher *m)
+{
+	memset(m->found, 0, m->count > 0 ? m->count : 1);
+	m->found_count = 0;
+	m->state = 0;
+	/* empty strings end in the start state */
+	np_matcher_mark(m, 0);
+}
+
+int
+np_matcher_feed(np_matcher *m, const char *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	const unsigned char *end = p + len;
+	int s = m->state;
+
+	while (p < end && m->found_count < m->count) {
+		/* nothing is under way, skip ahead to where a string can start */
+		if (s == 0 && m->start_byte >= 0) {
+			p = memchr(p, m->start_byte, end - p);
+			if (p == NULL)
+				break;
+		}
+		s = m->next[s * 256 + *p++];
+		if (m->output[s] >= 0 || m->dict[s] >= 0)
+			np_matcher_mark(m, s);
+	}
+	m->state = s;
+	return m->found_count;
+}
+
+void
+np_matcher_free(np_matcher *m)
+{
+	if (m == NULL)
+		return;
+	free(m->found);
+	free(m->next);
+	free(m->output);
+	free(m->dict);
+	free(m->same);
+	free(m);
+}
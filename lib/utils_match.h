@@ -0,0 +1,39 @@
+#ifndef _UTILS_MATCH_
+#define _UTILS_MATCH_
+
+/*
+ * Header file for Monitoring Plugins utils_match.c
+ *
+ * Looking for literal strings in page bodies and server replies: one
+ * string with np_memmem(), or several at once in a single pass with an
+ * np_matcher, which may also be fed a body chunk by chunk.
+ */
+
+#include <stddef.h>
+
+typedef struct np_matcher {
+	int count;		/* number of strings */
+	int found_count;	/* how many different ones were seen */
+	char *found;		/* found[i] is set once string i was seen */
+	/* Aho-Corasick automaton, as a complete transition table */
+	int states;
+	int *next;		/* next[state * 256 + byte] */
+	int *output;		/* string ending in state, or -1 */
+	int *dict;		/* next state with an output on the suffix chain, or -1 */
+	int *same;		/* next string equal to string i, or -1 */
+	int start_byte;		/* the one byte any string starts with, or -1 */
+	int state;		/* where the last np_matcher_feed() stopped */
+} np_matcher;
+
+/* Returns the first occurrence of needle in the len bytes at haystack, or
+ * NULL */
+const char *np_memmem(const char *haystack, size_t len, const char *needle, size_t needle_len);
+
+np_matcher *np_matcher_new(char * const *strings, int count);
+void np_matcher_reset(np_matcher *matcher);
+/* Looks for the strings in the next len bytes of the body, and returns
+ * how many of them have been seen so far */
+int np_matcher_feed(np_matcher *matcher, const char *buf, size_t len);
+void np_matcher_free(np_matcher *matcher);
+
+#endif /* _UTILS_MATCH_ */
@@ -0,0 +1,307 @@
+/*****************************************************************************
+*
+* Monitoring Plugins metrics export
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file sends the perfdata of a check straight to a metrics sink, a
+* statsd or an InfluxDB listening for datagrams, next to the plugin output
+* the scheduler passes on as before. The points are formatted as the
+* perfdata functions produce them and go out in as few datagrams as they
+* fit into when the run ends. The socket does not block and errors are
+* ignored: a sink that is gone or slow loses points, it never holds up the
+* exit or changes the result of the check.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_metrics.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* datagrams are cut at line ends to stay below these, the first one fits
+ * into an ethernet frame */
+#define METRICS_UDP_MAX 1432
+#define METRICS_UNIX_MAX 8192
+
+#ifdef MSG_DONTWAIT
+# define METRICS_SEND_FLAGS MSG_DONTWAIT
+#else
+# define METRICS_SEND_FLAGS 0
+#endif
+
+enum {
+	METRICS_UNKNOWN,	/* the environment was not looked at this run */
+	METRICS_OFF,
+	METRICS_STATSD,
+	METRICS_INFLUX
+};
+
+static NP_THREAD_LOCAL int metrics_format = METRICS_UNKNOWN;
+static NP_THREAD_LOCAL char metrics_plugin[64] = "plugin";
+
+/* the socket stays open for the next run of an in-process check on the
+ * same thread as long as the sink does not change */
+static NP_THREAD_LOCAL char *metrics_sink = NULL;
+static NP_THREAD_LOCAL int metrics_sink_format;
+static NP_THREAD_LOCAL int metrics_fd = -1;
+static NP_THREAD_LOCAL struct sockaddr_storage metrics_addr;
+static NP_THREAD_LOCAL socklen_t metrics_addrlen;
+static NP_THREAD_LOCAL size_t metrics_max;
+
+static NP_THREAD_LOCAL char *batch = NULL;
+static NP_THREAD_LOCAL size_t batch_len = 0, batch_size = 0;
+static NP_THREAD_LOCAL int batch_short = FALSE;	/* out of memory in the current line */
+
+static void
+batch_append (const char *s, size_t len)
+{
+	size_t size;
+	char *p;
+
+	if (batch_len + len > batch_size) {
+		size = batch_size ? batch_size * 2 : 1024;
+		while (size < batch_len + len)
+			size *= 2;
+		if ((p = realloc (batch, size)) == NULL) {
+			batch_short = TRUE;
+			return;
+		}
+		batch = p;
+		batch_size = size;
+	}
+	memcpy (batch + batch_len, s, len);
+	batch_len += len;
+}
+
+static void
+batch_printf (const char *fmt, ...)
+{
+	char buf[128];
+	va_list ap;
+	int n;
+
+	va_start (ap, fmt);
+	n = vsnprintf (buf, sizeof (buf), fmt, ap);
+	va_end (ap);
+	if (n > 0 && (size_t) n < sizeof (buf))
+		batch_append (buf, (size_t) n);
+}
+
+/* statsd names are dot separated, anything else becomes '_' */
+static void
+batch_statsd_name (const char *s)
+{
+	char c;
+
+	for (; *s; s++) {
+		c = isalnum ((unsigned char) *s) || strchr ("_.-", *s) ? *s : '_';
+		batch_append (&c, 1);
+	}
+}
+
+/* a backslash before the characters the line protocol splits on */
+static void
+batch_influx_escaped (const char *s, const char *special)
+{
+	for (; *s; s++) {
+		if (*s == '\n')
+			continue;
+		if (strchr (special, *s))
+			batch_append ("\\", 1);
+		batch_append (s, 1);
+	}
+}
+
+static int
+metrics_connect (const char *spec, int format)
+{
+	const char *rest = strchr (spec, ':') + 1;
+	struct addrinfo hints, *res;
+	struct sockaddr_un *sa_un;
+	char host[256], *port;
+	size_t len;
+	int fd;
+
+	if (rest[0] == '/' && rest[1] == '/') {
+		/* host:port, or [host]:port for IPv6 */
+		rest += 2;
+		if ((len = strlen (rest)) >= sizeof (host))
+			return FALSE;
+		memcpy (host, rest, len + 1);
+		if (host[0] == '[') {
+			if ((port = strchr (host, ']')) == NULL || port[1] != ':')
+				return FALSE;
+			*port = '\0';
+			port += 2;
+			memmove (host, host + 1, strlen (host));
+		} else {
+			if ((port = strrchr (host, ':')) == NULL)
+				return FALSE;
+			*port++ = '\0';
+		}
+		memset (&hints, 0, sizeof (hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+		if (getaddrinfo (host, port, &hints, &res) != 0)
+			return FALSE;
+		memcpy (&metrics_addr, res->ai_addr, res->ai_addrlen);
+		metrics_addrlen = res->ai_addrlen;
+		freeaddrinfo (res);
+		metrics_max = METRICS_UDP_MAX;
+	} else if (rest[0] == '/') {
+		sa_un = (struct sockaddr_un *) &metrics_addr;
+		if (strlen (rest) >= sizeof (sa_un->sun_path))
+			return FALSE;
+		memset (sa_un, 0, sizeof (*sa_un));
+		sa_un->sun_family = AF_UNIX;
+		strcpy (sa_un->sun_path, rest);
+		metrics_addrlen = sizeof (*sa_un);
+		metrics_max = METRICS_UNIX_MAX;
+	} else
+		return FALSE;
+
+	if ((fd = socket (metrics_addr.ss_family, SOCK_DGRAM, 0)) < 0)
+		return FALSE;
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+	fcntl (fd, F_SETFD, FD_CLOEXEC);
+	metrics_fd = fd;
+	metrics_sink_format = format;
+	return TRUE;
+}
+
+/* the format to record the points of this run in */
+static int
+metrics_open (void)
+{
+	static int flush_at_exit = FALSE;
+	const char *env = getenv (NP_METRICS_SINK_ENV);
+	int format;
+
+	if (mp_suid () == TRUE || env == NULL || env[0] == '\0')
+		return METRICS_OFF;
+	if (metrics_sink != NULL && strcmp (env, metrics_sink) == 0)
+		return metrics_fd >= 0 ? metrics_sink_format : METRICS_OFF;
+
+	if (strncmp (env, "statsd:", 7) == 0)
+		format = METRICS_STATSD;
+	else if (strncmp (env, "influx:", 7) == 0)
+		format = METRICS_INFLUX;
+	else if (strncmp (env, "unix:/", 6) == 0)
+		format = METRICS_INFLUX;
+	else
+		format = METRICS_OFF;
+
+	if (metrics_fd >= 0)
+		close (metrics_fd);
+	metrics_fd = -1;
+	free (metrics_sink);
+	/* a sink that is not understood is not looked at again either */
+	metrics_sink = strdup (env);
+	if (metrics_sink == NULL || format == METRICS_OFF ||
+	    !metrics_connect (env, format))
+		return METRICS_OFF;
+
+	if (!flush_at_exit) {
+		atexit (np_metrics_flush);
+		flush_at_exit = TRUE;
+	}
+	return format;
+}
+
+void
+np_metrics_name (const char *plugin_name)
+{
+	if (plugin_name != NULL && plugin_name[0] != '\0')
+		snprintf (metrics_plugin, sizeof (metrics_plugin), "%s", plugin_name);
+}
+
+void
+np_metrics_record (const char *label, double value, const char *uom)
+{
+	size_t start = batch_len;
+
+	if (metrics_format == METRICS_UNKNOWN)
+		metrics_format = metrics_open ();
+	if (metrics_format == METRICS_OFF || label == NULL || label[0] == '\0' ||
+	    !isfinite (value))
+		return;
+
+	if (metrics_format == METRICS_STATSD) {
+		/* a gauge with a sign changes the last value, so a negative
+		 * one is set from 0 */
+		if (value < 0) {
+			batch_statsd_name (metrics_plugin);
+			batch_append (".", 1);
+			batch_statsd_name (label);
+			batch_append (":0|g\n", 5);
+		}
+		batch_statsd_name (metrics_plugin);
+		batch_append (".", 1);
+		batch_statsd_name (label);
+		batch_printf (":%.15g|g\n", value);
+	} else {
+		batch_influx_escaped (metrics_plugin, ", ");
+		batch_append (",label=", 7);
+		batch_influx_escaped (label, ",= ");
+		if (uom != NULL && uom[0] != '\0') {
+			batch_append (",uom=", 5);
+			batch_influx_escaped (uom, ",= ");
+		}
+		batch_printf (" value=%.15g %ld000000000\n", value, (long) time (NULL));
+	}
+
+	/* no half lines */
+	if (batch_short) {
+		batch_len = start;
+		batch_short = FALSE;
+	}
+}
+
+void
+np_metrics_flush (void)
+{
+	size_t start, end, next;
+
+	for (start = 0; start < batch_len && metrics_fd >= 0; start = end) {
+		/* as many whole lines as fit, or one that does not */
+		end = start;
+		while (end < batch_len) {
+			next = (char *) memchr (batch + end, '\n', batch_len - end) - batch + 1;
+			if (end > start && next - start > metrics_max)
+				break;
+			end = next;
+		}
+		if (sendto (metrics_fd, batch + start, end - start, METRICS_SEND_FLAGS,
+		            (struct sockaddr *) &metrics_addr, metrics_addrlen) < 0)
+			break;
+	}
+	batch_len = 0;
+	/* the next run looks at the environment again */
+	metrics_format = METRICS_UNKNOWN;
+}
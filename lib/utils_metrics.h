@@ -0,0 +1,27 @@
+#ifndef _UTILS_METRICS_
+#define _UTILS_METRICS_
+/* Header file for utils_metrics: perfdata sent straight to a metrics sink */
+
+/* Where the points go, unset or empty for nowhere:
+ *   statsd://127.0.0.1:8125    statsd gauges over UDP
+ *   influx://[::1]:8089        InfluxDB line protocol over UDP
+ *   statsd:/run/statsd.sock    either of them to a Unix datagram socket
+ *   unix:/run/telegraf.sock    the same as influx:/run/telegraf.sock
+ * Hosts must be numeric addresses, as a name lookup could hold up the exit.
+ * Ignored in setuid plugins. */
+#define NP_METRICS_SINK_ENV "MP_PERF_SINK"
+
+/* The plugin the points are named after, np_init() and np_extra_opts()
+ * pass it on */
+void np_metrics_name (const char *plugin_name);
+
+/* Adds a point to the batch of this run, if a sink is set. perfdata(),
+ * fperfdata(), sperfdata() and sperfdata_int() call it for every point. */
+void np_metrics_record (const char *label, double value, const char *uom);
+
+/* Sends the batch without waiting for the sink and drops it. Errors are
+ * ignored, the points are lost rather than the check held up. np_cleanup()
+ * calls it, and so does exit() for plugins that return from main. */
+void np_metrics_flush (void);
+
+#endif /* _UTILS_METRICS_ */
@@ -0,0 +1,241 @@
+/*****************************************************************************
+*
+* Monitoring Plugins number parsing utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds the parsers for the numbers the plugins read by the
+* million out of /proc, ps, snmpget and log files. Unlike sscanf() and
+* strtod() they do not look at the locale and do no more than the plain
+* decimal numbers those need, so each is a single pass over the digits.
+* A float is exact when its digits fit a double and its power of ten is
+* small, as with nearly all of them; the others go to strtod().
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_num.h"
+#include <locale.h>
+#include <stdint.h>
+
+#define IS_DIGIT(c) ((unsigned) ((c) - '0') < 10)
+/* what isspace() takes in the C locale */
+#define IS_BLANK(c) ((c) == ' ' || ((unsigned) ((c) - '\t') < 5))
+
+/* the significant digits a uint64_t always holds */
+#define MAX_DIGITS 19
+/* the largest integer below which every integer is a double */
+#define MAX_EXACT (UINT64_C(1) << 53)
+/* the powers of ten which are doubles */
+#define MAX_EXACT_POW10 22
+
+static const double powers_of_ten[MAX_EXACT_POW10 + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* The digits of an unsigned number at p, past any sign */
+static unsigned long long
+read_digits (const char **p, unsigned long long max, int *overflow)
+{
+	unsigned long long value = 0;
+	unsigned d;
+
+	for (; IS_DIGIT (**p); (*p)++) {
+		d = **p - '0';
+		if (value > (max - d) / 10)
+			*overflow = 1;
+		else
+			value = value * 10 + d;
+	}
+	return value;
+}
+
+unsigned long long
+np_strtoull (const char *s, char **end)
+{
+	const char *p = s;
+	unsigned long long value;
+	int overflow = 0;
+
+	while (IS_BLANK (*p))
+		p++;
+	if (*p == '+')
+		p++;
+	if (!IS_DIGIT (*p)) {
+		if (end)
+			*end = (char *) s;
+		return 0;
+	}
+	value = read_digits (&p, ULLONG_MAX, &overflow);
+	if (end)
+		*end = (char *) p;
+	if (overflow) {
+		errno = ERANGE;
+		return ULLONG_MAX;
+	}
+	return value;
+}
+
+long long
+np_strtoll (const char *s, char **end)
+{
+	const char *p = s;
+	unsigned long long value, max = LLONG_MAX;
+	int negative = 0, overflow = 0;
+
+	while (IS_BLANK (*p))
+		p++;
+	if (*p == '-' || *p == '+')
+		negative = *p++ == '-';
+	if (!IS_DIGIT (*p)) {
+		if (end)
+			*end = (char *) s;
+		return 0;
+	}
+	if (negative)
+		max = (unsigned long long) LLONG_MAX + 1;
+	value = read_digits (&p, max, &overflow);
+	if (end)
+		*end = (char *) p;
+	if (overflow) {
+		errno = ERANGE;
+		return negative ? LLONG_MIN : LLONG_MAX;
+	}
+	/* -LLONG_MIN does not fit, so negate it in unsigned */
+	return negative ? (long long) (0 - value) : (long long) value;
+}
+
+/* strtod() of the number from start to stop, which has a '.' for the
+ * decimal point however the locale writes it */
+static double
+strtod_c (const char *start, const char *stop)
+{
+	const char *point = localeconv ()->decimal_point;
+	char small[64], *buf = small, *q;
+	size_t len = stop - start, plen = strlen (point);
+	double value;
+
+	if (strcmp (point, ".") == 0)
+		return strtod (start, NULL);
+	if (len * plen + 1 > sizeof (small) && (buf = malloc (len * plen + 1)) == NULL)
+		return strtod (start, NULL);
+	for (q = buf; start < stop; start++)
+		if (*start == '.') {
+			memcpy (q, point, plen);
+			q += plen;
+		}
+		else
+			*q++ = *start;
+	*q = '\0';
+	value = strtod (buf, NULL);
+	if (buf != small)
+		free (buf);
+	return value;
+}
+
+double
+np_strtod (const char *s, char **end)
+{
+	const char *p = s, *start, *e;
+	uint64_t mantissa = 0;
+	int negative = 0, digits = 0, significant = 0, exact = 1, overflow = 0;
+	long exponent = 0;
+	unsigned long long power;
+	double value;
+
+	while (IS_BLANK (*p))
+		p++;
+	start = p;
+	if (*p == '-' || *p == '+')
+		negative = *p++ == '-';
+
+	/* infinity, nan and hexadecimal floats are left to strtod() */
+	if (*p == 'i' || *p == 'I' || *p == 'n' || *p == 'N' ||
+	    (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')))
+		return strtod (s, end);
+
+	for (; IS_DIGIT (*p); p++, digits++) {
+		if (significant < MAX_DIGITS) {
+			mantissa = mantissa * 10 + (*p - '0');
+			significant += mantissa > 0;
+		}
+		else {
+			exponent++;
+			exact &= *p == '0';
+		}
+	}
+	if (*p == '.')
+		for (p++; IS_DIGIT (*p); p++, digits++) {
+			if (significant < MAX_DIGITS) {
+				mantissa = mantissa * 10 + (*p - '0');
+				significant += mantissa > 0;
+				exponent--;
+			}
+			else
+				exact &= *p == '0';
+		}
+	if (digits == 0) {
+		if (end)
+			*end = (char *) s;
+		return 0;
+	}
+
+	/* an exponent only counts with digits */
+	if (*p == 'e' || *p == 'E') {
+		e = p + 1;
+		if (*e == '-' || *e == '+')
+			e++;
+		if (IS_DIGIT (*e)) {
+			power = read_digits (&e, 100000, &overflow);
+			if (overflow)
+				power = 100000;
+			exponent += p[1] == '-' ? -(long) power : (long) power;
+			p = e;
+		}
+	}
+	if (end)
+		*end = (char *) p;
+
+	/* both exact, so a single rounding gives the nearest double */
+	if (exact && mantissa <= MAX_EXACT && exponent >= -MAX_EXACT_POW10 && exponent <= MAX_EXACT_POW10) {
+		value = exponent < 0 ? mantissa / powers_of_ten[-exponent] : mantissa * powers_of_ten[exponent];
+		return negative ? -value : value;
+	}
+	return strtod_c (start, p);
+}
+
+int
+np_strtoll_fields (const char *s, long long *values, int n, char **end)
+{
+	char *next;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		values[i] = np_strtoll (s, &next);
+		if (next == s)
+			break;
+		s = next;
+	}
+	if (end)
+		*end = (char *) s;
+	return i;
+}
@@ -0,0 +1,19 @@
+#ifndef _UTILS_NUM_
+#define _UTILS_NUM_
+/* Header file for utils_num: numbers out of the text of other programs */
+
+/* Like strtoll(), strtoull() and strtod() in the C locale, only quicker:
+ * blanks before the number are skipped, integers are decimal and '.' is
+ * the decimal point whatever LC_NUMERIC says. *end, unless end is NULL,
+ * points just past the number, or at s if there was none, which gives 0.
+ * Integers out of range saturate and set errno to ERANGE. np_strtoull()
+ * takes no minus sign. */
+long long np_strtoll (const char *s, char **end);
+unsigned long long np_strtoull (const char *s, char **end);
+double np_strtod (const char *s, char **end);
+
+/* Up to n blank separated integers of s, as np_strtoll() reads them, into
+ * values. Returns how many there were before anything else. */
+int np_strtoll_fields (const char *s, long long *values, int n, char **end);
+
+#endif /* _UTILS_NUM_ */
@@ -0,0 +1,470 @@
+/*****************************************************************************
+*
+* Monitoring Plugins OpenMetrics utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds a parser for the Prometheus and OpenMetrics text formats,
+* for check_curl to judge the samples of a /metrics endpoint as the body
+* arrives. A chunk may end anywhere in a line. Only the metric name at the
+* start of a line is kept until it is known whether a selector wants the
+* line; most lines are then skipped to their newline without being copied,
+* and a wanted one is parsed and judged as soon as it is complete. Nothing
+* grows with the size of the exposition but the counters.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_num.h"
+#include "utils_openmetrics.h"
+#include <ctype.h>
+
+enum {
+	ST_NAME,		/* the metric name at the start of a line */
+	ST_COMMENT,		/* a line starting with '#', which may be "# EOF" */
+	ST_KEEP,		/* a wanted line, read to its end */
+	ST_SKIP			/* a line no selector wants, up to its newline */
+};
+
+/* labels a sample line may have */
+#define MAX_SAMPLE_LABELS 64
+
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t')
+#define IS_NAME(c) (isalnum((unsigned char)(c)) || (c) == '_' || (c) == ':')
+
+static char *
+skip_blanks(char *p)
+{
+	while (IS_BLANK(*p))
+		p++;
+	return p;
+}
+
+/* 1 if the selector was parsed, 0 if it is not one, -1 if out of memory */
+static int
+selector_parse(np_om_selector *s, const char *text)
+{
+	char *p, *q, *out;
+	int negate;
+
+	if ((s->text = strdup(text)) == NULL || (s->name = strdup(text)) == NULL)
+		return -1;
+
+	for (p = s->name; IS_NAME(*p); p++)
+		;
+	if (p == s->name)
+		return 0;
+	if (*p == '\0')
+		return 1;
+	if (*p != '{')
+		return 0;
+	*p++ = '\0';
+
+	for (;;) {
+		p = skip_blanks(p);
+		if (*p == '}')
+			break;
+		if (s->nlabels == NP_OM_MAX_LABELS)
+			return 0;
+		for (q = p; isalnum((unsigned char)*q) || *q == '_'; q++)
+			;
+		if (q == p)
+			return 0;
+		s->label[s->nlabels] = p;
+
+		p = skip_blanks(q);
+		if (p[0] == '!' && p[1] == '=') {
+			negate = TRUE;
+			p += 2;
+		} else if (p[0] == '=') {
+			negate = FALSE;
+			p++;
+		} else {
+			return 0;
+		}
+		*q = '\0';
+
+		p = skip_blanks(p);
+		if (*p++ != '"')
+			return 0;
+		s->value[s->nlabels] = out = p;
+		while (*p != '"') {
+			if (*p == '\0')
+				return 0;
+			if (*p == '\\' && p[1] != '\0') {
+				p++;
+				*out++ = *p == 'n' ? '\n' : *p;
+				p++;
+			} else {
+				*out++ = *p++;
+			}
+		}
+		p++;
+		*out = '\0';
+		s->negate[s->nlabels++] = negate;
+
+		p = skip_blanks(p);
+		if (*p == ',')
+			p++;
+		else if (*p != '}')
+			return 0;
+	}
+	return *skip_blanks(p + 1) == '\0';
+}
+
+static int
+name_wanted(const np_openmetrics *om)
+{
+	int i;
+
+	for (i = 0; i < om->count; i++)
+		if (strlen(om->selectors[i].name) == om->linelen &&
+		    memcmp(om->selectors[i].name, om->line, om->linelen) == 0)
+			return TRUE;
+	return FALSE;
+}
+
+static int
+sample_keep(np_om_sample *sample, const char *series, size_t len, double value)
+{
+	char *p;
+
+	if ((p = malloc(len + 1)) == NULL)
+		return FALSE;
+	memcpy(p, series, len);
+	p[len] = '\0';
+	free(sample->series);
+	sample->series = p;
+	sample->value = value;
+	return TRUE;
+}
+
+/* a sample of the selector: judged, and kept if among the first or the
+ * first one as bad as it gets */
+static int
+record(np_openmetrics *om, np_om_selector *s, size_t series_len, double value)
+{
+	int status = s->thlds ? get_status(value, s->thlds) : STATE_OK;
+
+	if (s->matched == 0)
+		om->found_count++;
+	if (s->matched < NP_OM_MAX_SAMPLES &&
+	    !sample_keep(&s->samples[s->matched], om->line, series_len, value))
+		return FALSE;
+	if (s->matched == 0 || status > s->status) {
+		if (!sample_keep(&s->worst, om->line, series_len, value))
+			return FALSE;
+		s->status = status;
+	}
+	s->matched++;
+	return TRUE;
+}
+
+/* a complete wanted line, name{label="value",...} value [timestamp] */
+static int
+sample_line(np_openmetrics *om)
+{
+	char labels[NP_OM_MAX_LINE];
+	char *key[MAX_SAMPLE_LABELS], *val[MAX_SAMPLE_LABELS];
+	char *p, *q, *out = labels, *end;
+	const char *have;
+	size_t name_len, series_len;
+	int nlabels = 0, i, k, l;
+	double value;
+	np_om_selector *s;
+
+	if (om->linelen > 0 && om->line[om->linelen - 1] == '\r')
+		om->linelen--;
+	om->line[om->linelen] = '\0';
+
+	for (p = om->line; IS_NAME(*p); p++)
+		;
+	name_len = p - om->line;
+	if (*p == '{') {
+		for (p++;;) {
+			p = skip_blanks(p);
+			if (*p == '}') {
+				p++;
+				break;
+			}
+			if (nlabels == MAX_SAMPLE_LABELS)
+				return FALSE;
+			for (q = p; isalnum((unsigned char)*q) || *q == '_'; q++)
+				;
+			if (q == p)
+				return FALSE;
+			key[nlabels] = out;
+			memcpy(out, p, q - p);
+			out += q - p;
+			*out++ = '\0';
+
+			p = skip_blanks(q);
+			if (*p++ != '=')
+				return FALSE;
+			p = skip_blanks(p);
+			if (*p++ != '"')
+				return FALSE;
+			val[nlabels++] = out;
+			while (*p != '"') {
+				if (*p == '\0')
+					return FALSE;
+				if (*p == '\\' && p[1] != '\0') {
+					p++;
+					*out++ = *p == 'n' ? '\n' : *p;
+					p++;
+				} else {
+					*out++ = *p++;
+				}
+			}
+			p++;
+			*out++ = '\0';
+
+			p = skip_blanks(p);
+			if (*p == ',')
+				p++;
+			else if (*p != '}')
+				return FALSE;
+		}
+	}
+	series_len = p - om->line;
+
+	if (!IS_BLANK(*p))
+		return FALSE;
+	p = skip_blanks(p);
+	value = np_strtod(p, &end);
+	if (end == p || (*end != '\0' && !IS_BLANK(*end)))
+		return FALSE;
+
+	for (i = 0; i < om->count; i++) {
+		s = &om->selectors[i];
+		if (strlen(s->name) != name_len || memcmp(s->name, om->line, name_len) != 0)
+			continue;
+		for (k = 0; k < s->nlabels; k++) {
+			have = "";
+			for (l = 0; l < nlabels; l++) {
+				if (strcmp(key[l], s->label[k]) == 0) {
+					have = val[l];
+					break;
+				}
+			}
+			if ((strcmp(have, s->value[k]) == 0) == s->negate[k])
+				break;
+		}
+		if (k == s->nlabels && !record(om, s, series_len, value))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* the newline of a line whose metric name was not followed by anything */
+static void
+name_line(np_openmetrics *om)
+{
+	if (om->linelen > 0 && om->line[om->linelen - 1] == '\r')
+		om->linelen--;
+	if (om->linelen == 0)
+		return;
+	om->lines++;
+	if (name_wanted(om))
+		om->errors++;
+	else
+		om->skipped++;
+}
+
+static void
+comment_line(np_openmetrics *om)
+{
+	if (om->linelen > 0 && om->line[om->linelen - 1] == '\r')
+		om->linelen--;
+	if (om->linelen == 5 && memcmp(om->line, "# EOF", 5) == 0)
+		om->eof = TRUE;
+}
+
+np_openmetrics *
+np_openmetrics_new(char * const *selectors, int count, int *bad)
+{
+	np_openmetrics *om;
+	int i, parsed;
+
+	*bad = -1;
+	if ((om = calloc(1, sizeof(*om))) == NULL)
+		return NULL;
+	om->count = count;
+	if ((om->selectors = calloc(count > 0 ? count : 1, sizeof(np_om_selector))) == NULL) {
+		np_openmetrics_free(om);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		if ((parsed = selector_parse(&om->selectors[i], selectors[i])) != 1) {
+			if (parsed == 0)
+				*bad = i;
+			np_openmetrics_free(om);
+			return NULL;
+		}
+	}
+	np_openmetrics_reset(om);
+	return om;
+}
+
+void
+np_openmetrics_reset(np_openmetrics *om)
+{
+	np_om_selector *s;
+	int i, k;
+
+	for (i = 0; i < om->count; i++) {
+		s = &om->selectors[i];
+		for (k = 0; k < NP_OM_MAX_SAMPLES; k++) {
+			free(s->samples[k].series);
+			s->samples[k].series = NULL;
+		}
+		free(s->worst.series);
+		s->worst.series = NULL;
+		s->matched = 0;
+		s->status = STATE_OK;
+	}
+	om->found_count = 0;
+	om->lines = 0;
+	om->skipped = 0;
+	om->errors = 0;
+	om->eof = FALSE;
+	om->state = ST_NAME;
+	om->linelen = 0;
+}
+
+int
+np_openmetrics_feed(np_openmetrics *om, const char *buf, size_t len)
+{
+	const char *p = buf, *end = buf + len, *nl;
+	size_t n;
+	char c;
+
+	while (p < end) {
+		switch (om->state) {
+		case ST_SKIP:
+			if ((nl = memchr(p, '\n', end - p)) == NULL)
+				return om->found_count;
+			p = nl + 1;
+			om->linelen = 0;
+			om->state = ST_NAME;
+			break;
+
+		case ST_NAME:
+			c = *p++;
+			if (c == '\n') {
+				name_line(om);
+				om->linelen = 0;
+			} else if (c == '#' && om->linelen == 0) {
+				om->line[om->linelen++] = c;
+				om->state = ST_COMMENT;
+			} else if (c == '{' || IS_BLANK(c)) {
+				/* the name is complete, and decides */
+				om->lines++;
+				if (name_wanted(om)) {
+					om->line[om->linelen++] = c;
+					om->state = ST_KEEP;
+				} else {
+					om->skipped++;
+					om->state = ST_SKIP;
+				}
+			} else if (om->linelen == NP_OM_MAX_LINE - 1) {
+				om->lines++;
+				om->errors++;
+				om->state = ST_SKIP;
+			} else {
+				om->line[om->linelen++] = c;
+			}
+			break;
+
+		case ST_COMMENT:
+			c = *p++;
+			if (c == '\n') {
+				comment_line(om);
+				om->linelen = 0;
+				om->state = ST_NAME;
+			} else if (om->linelen > 5) {
+				om->state = ST_SKIP;
+			} else {
+				om->line[om->linelen++] = c;
+			}
+			break;
+
+		case ST_KEEP:
+			nl = memchr(p, '\n', end - p);
+			n = (nl ? nl : end) - p;
+			if (om->linelen + n >= NP_OM_MAX_LINE) {
+				om->errors++;
+				om->state = ST_SKIP;
+				break;
+			}
+			memcpy(om->line + om->linelen, p, n);
+			om->linelen += n;
+			p += n;
+			if (nl) {
+				p++;
+				if (!sample_line(om))
+					om->errors++;
+				om->linelen = 0;
+				om->state = ST_NAME;
+			}
+			break;
+		}
+	}
+	return om->found_count;
+}
+
+int
+np_openmetrics_end(np_openmetrics *om)
+{
+	switch (om->state) {
+	case ST_NAME:
+		name_line(om);
+		break;
+	case ST_COMMENT:
+		comment_line(om);
+		break;
+	case ST_KEEP:
+		if (!sample_line(om))
+			om->errors++;
+		break;
+	}
+	om->linelen = 0;
+	om->state = ST_NAME;
+	return om->found_count;
+}
+
+void
+np_openmetrics_free(np_openmetrics *om)
+{
+	int i;
+
+	if (om == NULL)
+		return;
+	if (om->selectors) {
+		np_openmetrics_reset(om);
+		for (i = 0; i < om->count; i++) {
+			free(om->selectors[i].text);
+			free(om->selectors[i].name);
+		}
+	}
+	free(om->selectors);
+	free(om);
+}
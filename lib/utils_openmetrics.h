@@ -0,0 +1,71 @@
+#ifndef _UTILS_OPENMETRICS_
+#define _UTILS_OPENMETRICS_
+
+/*
+ * Header file for Monitoring Plugins utils_openmetrics.c
+ *
+ * Picking samples out of a Prometheus or OpenMetrics text exposition as it
+ * arrives, without keeping it: a line is dropped as soon as its metric name
+ * shows that no selector wants it, and the samples of the others are judged
+ * against the thresholds of their selector right away, so memory stays the
+ * same however many series there are.
+ */
+
+#include <stddef.h>
+#include "utils_base.h"
+
+/* how long a wanted sample line may be, how many label matchers a
+ * selector may have, and how many samples of a selector are kept */
+#define NP_OM_MAX_LINE 4096
+#define NP_OM_MAX_LABELS 16
+#define NP_OM_MAX_SAMPLES 32
+
+typedef struct np_om_sample {
+	char *series;		/* name{labels} as in the exposition */
+	double value;
+} np_om_sample;
+
+/* name{label="value",label!="value"}, a label that is not there has the
+ * value "" as in PromQL */
+typedef struct np_om_selector {
+	char *text;		/* as given */
+	char *name;
+	int nlabels;
+	char *label[NP_OM_MAX_LABELS];
+	char *value[NP_OM_MAX_LABELS];
+	int negate[NP_OM_MAX_LABELS];
+	thresholds *thlds;	/* set by the caller before feeding, or NULL */
+
+	long matched;		/* samples that matched */
+	np_om_sample samples[NP_OM_MAX_SAMPLES];	/* the first of them */
+	int status;		/* the worst get_status() of all of them */
+	np_om_sample worst;	/* the first sample with that status */
+} np_om_selector;
+
+typedef struct np_openmetrics {
+	int count;		/* number of selectors */
+	int found_count;	/* how many of them matched a sample */
+	np_om_selector *selectors;
+	size_t lines;		/* sample lines seen */
+	size_t skipped;		/* of them dropped by the metric name alone */
+	size_t errors;		/* wanted lines that were too long or not a sample */
+	int eof;		/* the "# EOF" of OpenMetrics was seen */
+
+	/* the line being read, which a chunk may end anywhere in */
+	int state;
+	char line[NP_OM_MAX_LINE];
+	size_t linelen;
+} np_openmetrics;
+
+/* Returns NULL if out of memory, or if a selector cannot be parsed, which
+ * *bad is then the index of, and -1 otherwise. */
+np_openmetrics *np_openmetrics_new(char * const *selectors, int count, int *bad);
+void np_openmetrics_reset(np_openmetrics *om);
+/* Parses the next len bytes of the exposition and returns how many of the
+ * selectors have matched a sample so far */
+int np_openmetrics_feed(np_openmetrics *om, const char *buf, size_t len);
+/* The exposition ended: a last line without a newline is taken as well */
+int np_openmetrics_end(np_openmetrics *om);
+void np_openmetrics_free(np_openmetrics *om);
+
+#endif /* _UTILS_OPENMETRICS_ */
@@ -0,0 +1,747 @@
+/*****************************************************************************
+*
+* Monitoring Plugins process table utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds the one parser for the output of PS_COMMAND, which
+* configure knows how to read with PS_FORMAT and PS_VARLIST, and a snapshot
+* of that output which is kept for a few seconds in a file on a tmpfs. Then
+* check_procs, check_nagios and check_load running on the same host within
+* one scheduling tick can share a single run of ps.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+/** includes **/
+#include "common.h"
+#include "utils.h"
+#include "utils_base.h"
+#include "utils_ps.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#ifdef __linux__
+# include <dirent.h>
+#endif
+
+#ifndef O_NOFOLLOW
+# define O_NOFOLLOW 0
+#endif
+
+/* "np_ps VERSION TIME RESULT", padded with blanks, before the ps output */
+#define PS_CACHE_HEADER 64
+
+/* Parse one line of ps output into proc. Returns FALSE, with proc->parsed
+ * cleared, if it does not fit PS_FORMAT. */
+int
+np_ps_parse (const char *input_line, np_proc *proc)
+{
+	int procuid = 0;
+	int procpid = 0;
+	int procppid = 0;
+	int procvsz = 0;
+	int procrss = 0;
+	float procpcpu = 0;
+	char *procstat;
+	char *procetime;
+	char *procprog;
+	int pos = -1;
+	int cols;
+	size_t len = strlen (input_line);
+
+	memset (proc, 0, sizeof (np_proc));
+	proc->line = (char *) input_line;
+
+	/* any of the strings sscanf() fills in may be as long as the line */
+	if ((proc->buf = malloc (4 * (len + 1))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	procstat = proc->buf;
+	procetime = proc->buf + (len + 1);
+	procprog = proc->buf + 2 * (len + 1);
+	proc->args = proc->buf + 3 * (len + 1);
+	procstat[0] = procetime[0] = procprog[0] = proc->args[0] = '\0';
+	proc->etime = procetime;
+	proc->prog = procprog;
+
+	cols = sscanf (input_line, PS_FORMAT, PS_VARLIST);
+
+	/* Zombie processes do not give a procprog command */
+	if (cols < PS_COLS - 1 && strstr (procstat, "Z"))
+		cols = PS_COLS - 1;
+	if (cols < PS_COLS - 1)
+		return FALSE;
+
+	if (pos >= 0 && (size_t) pos <= len) {
+		strcpy (proc->args, input_line + pos);
+		for (len = strlen (proc->args); len > 0 && isspace ((unsigned char) proc->args[len - 1]); len--)
+			proc->args[len - 1] = '\0';
+	}
+	strncpy (proc->stat, procstat, sizeof (proc->stat) - 1);
+	proc->uid = procuid;
+	proc->pid = (pid_t) procpid;
+	proc->ppid = (pid_t) procppid;
+	proc->vsz = procvsz;
+	proc->rss = procrss;
+	proc->pcpu = procpcpu;
+	proc->parsed = TRUE;
+	return TRUE;
+}
+
+static void
+ps_table_parse (np_proc_table *table)
+{
+	size_t i;
+
+	table->count = table->out.lines > 1 ? table->out.lines - 1 : 0;
+	if (table->count == 0)
+		return;
+	if ((table->procs = calloc (table->count, sizeof (np_proc))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < table->count; i++)
+		np_ps_parse (table->out.line[i + 1], &table->procs[i]);
+}
+
+/* The file the snapshot is shared in, one per user */
+char *
+np_ps_cache_file (void)
+{
+	static char *path = NULL;
+	const char *dir;
+	struct stat st;
+
+	if (path != NULL)
+		return path;
+	if ((dir = getenv (NP_PS_CACHE_DIR_ENV)) == NULL || *dir == '\0') {
+		if (stat ("/dev/shm", &st) == 0 && S_ISDIR (st.st_mode))
+			dir = "/dev/shm";
+		else
+			dir = "/tmp";
+	}
+	if (asprintf (&path, "%s/np_ps_%lu", dir, (unsigned long) geteuid ()) < 0)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	return path;
+}
+
+/* the snapshot of the records, kept apart from the one of the lines */
+static char *
+ps_records_cache_file (void)
+{
+	static char *path = NULL;
+
+	if (path == NULL && asprintf (&path, "%s.rec", np_ps_cache_file ()) < 0)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	return path;
+}
+
+static int
+ps_cache_read (np_proc_table *table, int ttl, const char *path, int flags)
+{
+	char header[PS_CACHE_HEADER + 1];
+	struct stat st;
+	int fd, version, result;
+	long stamp;
+	time_t now;
+
+	if ((fd = open (path, O_RDONLY | O_NOFOLLOW)) < 0)
+		return FALSE;
+
+	/* only take a snapshot of our own that nobody else could have written */
+	if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) || st.st_uid != geteuid () ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+	    read (fd, header, PS_CACHE_HEADER) != PS_CACHE_HEADER) {
+		close (fd);
+		return FALSE;
+	}
+	header[PS_CACHE_HEADER] = '\0';
+	time (&now);
+	if (sscanf (header, "np_ps %d %ld %d", &version, &stamp, &result) != 3 ||
+	    version != NP_PS_CACHE_VERSION || stamp > (long) now || (long) now - stamp > ttl) {
+		close (fd);
+		return FALSE;
+	}
+
+	memset (&table->out, 0, sizeof (output));
+	memset (&table->err, 0, sizeof (output));
+	if (flags & CMD_NO_ARRAYS)
+		cmd_fetch_output (fd, &table->out, flags);
+	else
+		table->out.lines = cmd_fetch_output (fd, &table->out, flags);
+	close (fd);
+	table->result = result;
+	table->cached = TRUE;
+	return TRUE;
+}
+
+/* Replace the snapshot, through a rename() so that readers never see half */
+static void
+ps_cache_write (const np_proc_table *table, time_t stamp, const char *path)
+{
+	char header[PS_CACHE_HEADER];
+	char *tmp = NULL;
+	size_t len;
+	int fd, ok;
+
+	/* a run that complained is not worth sharing */
+	if (table->err.buflen > 0 || table->out.buflen == 0)
+		return;
+
+	if (asprintf (&tmp, "%s.XXXXXX", path) < 0)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	if ((fd = mkstemp (tmp)) < 0) {
+		free (tmp);
+		return;
+	}
+	snprintf (header, sizeof (header), "np_ps %d %ld %d", NP_PS_CACHE_VERSION, (long) stamp, table->result);
+	len = strlen (header);
+	memset (header + len, ' ', PS_CACHE_HEADER - 1 - len);
+	header[PS_CACHE_HEADER - 1] = '\n';
+
+	ok = write (fd, header, PS_CACHE_HEADER) == PS_CACHE_HEADER &&
+	     write (fd, table->out.buf, table->out.buflen) == (ssize_t) table->out.buflen;
+	if (close (fd) != 0 || !ok || rename (tmp, path) != 0)
+		unlink (tmp);
+	free (tmp);
+}
+
+/* Take a snapshot of the process table with PS_COMMAND. With a ttl of more
+ * than 0 seconds, one that another plugin took no longer than that ago is
+ * used instead, and a fresh one is left for the others. Returns the exit
+ * status of PS_COMMAND. */
+int
+np_ps_run (np_proc_table *table, int ttl)
+{
+	time_t stamp;
+
+	memset (table, 0, sizeof (np_proc_table));
+	if (ttl <= 0 || !ps_cache_read (table, ttl, np_ps_cache_file (), CMD_NO_ASSOC)) {
+		time (&stamp);
+		table->result = cmd_run (PS_COMMAND, &table->out, &table->err, CMD_NO_ASSOC);
+		if (ttl > 0)
+			ps_cache_write (table, stamp, np_ps_cache_file ());
+	}
+	ps_table_parse (table);
+	return table->result;
+}
+
+/* The same with PS_RECORD_COMMAND where there is one, for the plugins that
+ * only want the fields and not the lines */
+int
+np_ps_run_records (np_proc_table *table, int ttl)
+{
+#ifdef PS_RECORD_COMMAND
+	time_t stamp;
+
+	memset (table, 0, sizeof (np_proc_table));
+	if (ttl <= 0 || !ps_cache_read (table, ttl, ps_records_cache_file (), CMD_NO_ARRAYS)) {
+		time (&stamp);
+		table->result = cmd_run (PS_RECORD_COMMAND, &table->out, &table->err, CMD_NO_ARRAYS);
+		if (ttl > 0)
+			ps_cache_write (table, stamp, ps_records_cache_file ());
+	}
+	np_ps_records_parse (table);
+	return table->result;
+#else
+	return np_ps_run (table, ttl);
+#endif
+}
+
+static uint32_t
+record_field (const char *p)
+{
+	uint32_t v;
+
+	memcpy (&v, p, sizeof (v));
+	return v;
+}
+
+/* Turn the records in table->out.buf into table->procs. A record that is
+ * cut short ends the table. Returns the number of processes. */
+size_t
+np_ps_records_parse (np_proc_table *table)
+{
+	const char *p, *end = table->out.buf + table->out.buflen;
+	size_t count = 0, size = 0, magic = strlen (NP_PS_RECORD_MAGIC);
+	uint32_t length, prog_length, args_length;
+	np_proc *proc;
+
+	table->procs = NULL;
+	table->count = 0;
+	if (table->out.buf == NULL || table->out.buflen < magic ||
+	    memcmp (table->out.buf, NP_PS_RECORD_MAGIC, magic) != 0)
+		return 0;
+
+	for (p = table->out.buf + magic; end - p >= NP_PS_RECORD_HEADER; p += length) {
+		length = record_field (p);
+		prog_length = record_field (p + 32);
+		args_length = record_field (p + 36);
+		if (length < NP_PS_RECORD_HEADER || length > (size_t) (end - p) ||
+		    (size_t) prog_length + args_length != length - NP_PS_RECORD_HEADER)
+			break;
+
+		if (count == size) {
+			size = size ? size * 2 : 256;
+			if ((proc = realloc (table->procs, size * sizeof (np_proc))) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			table->procs = proc;
+		}
+		proc = &table->procs[count++];
+		memset (proc, 0, sizeof (np_proc));
+
+		/* etime, prog and args, each terminated */
+		if ((proc->buf = malloc (prog_length + args_length + 3)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		proc->etime = proc->buf;
+		proc->etime[0] = '\0';
+		proc->prog = proc->buf + 1;
+		memcpy (proc->prog, p + NP_PS_RECORD_HEADER, prog_length);
+		proc->prog[prog_length] = '\0';
+		proc->args = proc->prog + prog_length + 1;
+		memcpy (proc->args, p + NP_PS_RECORD_HEADER + prog_length, args_length);
+		proc->args[args_length] = '\0';
+		proc->line = proc->args;
+
+		proc->uid = (int32_t) record_field (p + 4);
+		proc->pid = (pid_t) (int32_t) record_field (p + 8);
+		proc->ppid = (pid_t) (int32_t) record_field (p + 12);
+		proc->vsz = record_field (p + 16);
+		proc->rss = record_field (p + 20);
+		proc->pcpu = record_field (p + 24) / 100.0;
+		memcpy (proc->stat, p + 28, 4);
+		proc->parsed = TRUE;
+	}
+	table->count = count;
+	return count;
+}
+
+/* The same for ps output saved to a file */
+int
+np_ps_read_file (np_proc_table *table, char *filename)
+{
+	memset (table, 0, sizeof (np_proc_table));
+	table->result = cmd_file_read (filename, &table->out, CMD_NO_ASSOC);
+	ps_table_parse (table);
+	return table->result;
+}
+
+/* the pid in a pid file, and when it was written */
+static pid_t
+pidfile_read (const char *path, time_t *written)
+{
+	char buf[32], *end;
+	struct stat st;
+	ssize_t n;
+	long pid;
+	int fd;
+
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return 0;
+	n = fstat (fd, &st) == 0 ? read (fd, buf, sizeof (buf) - 1) : -1;
+	close (fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
+	pid = strtol (buf, &end, 10);
+	if (pid <= 0 || pid > INT_MAX || end == buf || (*end != '\0' && !isspace ((unsigned char) *end)))
+		return 0;
+	*written = st.st_mtime;
+	return (pid_t) pid;
+}
+
+#ifdef __linux__
+/* /proc/PID/FILE, or /proc/FILE for pid 0, NUL terminated, in a buffer
+ * that is the caller's */
+static ssize_t
+proc_file (pid_t pid, const char *file, char **buf)
+{
+	char path[64];
+	ssize_t n, len = 0;
+	size_t size = 1024;
+	int fd;
+
+	if (pid > 0)
+		snprintf (path, sizeof (path), "/proc/%d/%s", (int) pid, file);
+	else
+		snprintf (path, sizeof (path), "/proc/%s", file);
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return -1;
+	if ((*buf = malloc (size)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	while ((n = read (fd, *buf + len, size - 1 - len)) > 0) {
+		len += n;
+		if ((size_t) len + 1 >= size) {
+			size *= 2;
+			if ((*buf = realloc (*buf, size)) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		}
+	}
+	close (fd);
+	(*buf)[len] = '\0';
+	return len;
+}
+
+/* seconds since the epoch the system was booted at */
+static time_t
+boot_time (void)
+{
+	char *buf = NULL, *p;
+	time_t btime = 0;
+
+	if (proc_file (0, "stat", &buf) > 0 && (p = strstr (buf, "\nbtime ")) != NULL)
+		btime = (time_t) strtol (p + 7, NULL, 10);
+	free (buf);
+	return btime;
+}
+
+/* Fill in proc the way ps would have for pid, from its stat, status and
+ * cmdline. Returns FALSE if the process is gone. */
+static int
+proc_pid (pid_t pid, np_proc *proc, time_t *started)
+{
+	char *stat = NULL, *status = NULL, *cmdline = NULL, *comm, *p;
+	char state;
+	int ppid, euid = -1;
+	unsigned long utime, stime, vsize;
+	unsigned long long starttime;
+	long long f[NP_STAT_FIELDS];
+	long rss, hz = sysconf (_SC_CLK_TCK);
+	time_t now = time (NULL), seconds;
+	ssize_t len, i;
+
+	if (proc_file (pid, "stat", &stat) <= 0 ||
+	    (comm = strchr (stat, '(')) == NULL || (p = strrchr (comm, ')')) == NULL) {
+		free (stat);
+		return FALSE;
+	}
+	*p = '\0';
+	comm++;
+	if (p[1] != ' ' || p[2] == '\0' ||
+	    np_strtoll_fields (p + 3, f, NP_STAT_FIELDS, NULL) != NP_STAT_FIELDS) {
+		free (stat);
+		return FALSE;
+	}
+	state = p[2];
+	ppid = (int) f[NP_STAT_PPID];
+	utime = (unsigned long) f[NP_STAT_UTIME];
+	stime = (unsigned long) f[NP_STAT_STIME];
+	starttime = (unsigned long long) f[NP_STAT_STARTTIME];
+	vsize = (unsigned long) f[NP_STAT_VSIZE];
+	rss = (long) f[NP_STAT_RSS];
+	/* the real uid, then the effective one */
+	if (proc_file (pid, "status", &status) > 0 && (p = strstr (status, "\nUid:")) != NULL &&
+	    np_strtoll_fields (p + 5, f, 2, NULL) == 2)
+		euid = (int) f[1];
+	free (status);
+
+	*started = boot_time () + (time_t) (starttime / hz);
+	seconds = now > *started ? now - *started : 0;
+
+	/* etime, prog and args, each terminated, like the records */
+	if ((len = proc_file (pid, "cmdline", &cmdline)) < 0)
+		len = 0;
+	if ((proc->buf = malloc (32 + strlen (comm) + 1 + len + strlen (comm) + 16)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	proc->etime = proc->buf;
+	if (seconds >= 86400)
+		sprintf (proc->etime, "%ld-%02ld:%02ld:%02ld", (long) seconds / 86400,
+		         (long) seconds / 3600 % 24, (long) seconds / 60 % 60, (long) seconds % 60);
+	else if (seconds >= 3600)
+		sprintf (proc->etime, "%02ld:%02ld:%02ld", (long) seconds / 3600,
+		         (long) seconds / 60 % 60, (long) seconds % 60);
+	else
+		sprintf (proc->etime, "%02ld:%02ld", (long) seconds / 60, (long) seconds % 60);
+	proc->prog = proc->etime + 32;
+	strcpy (proc->prog, comm);
+	proc->args = proc->prog + strlen (comm) + 1;
+	if (len > 0) {
+		/* arguments are NUL separated; like ps, show them with blanks */
+		for (i = 0; i < len; i++)
+			proc->args[i] = (unsigned char) cmdline[i] < ' ' ? ' ' : cmdline[i];
+		while (len > 0 && proc->args[len - 1] == ' ')
+			len--;
+		proc->args[len] = '\0';
+	} else {
+		/* kernel threads and zombies have no command line */
+		sprintf (proc->args, "[%s]%s", comm, state == 'Z' ? " <defunct>" : "");
+	}
+	free (cmdline);
+	proc->line = proc->args;
+
+	proc->stat[0] = state;
+	proc->uid = euid;
+	proc->pid = pid;
+	proc->ppid = (pid_t) ppid;
+	proc->vsz = (int) (vsize / 1024);
+	proc->rss = (int) (rss * (sysconf (_SC_PAGESIZE) / 1024));
+	proc->pcpu = seconds ? ((utime + stime) * 1000.0 / hz / seconds) / 10.0 : 0;
+	proc->parsed = TRUE;
+	free (stat);
+	return TRUE;
+}
+#endif /* __linux__ */
+
+/* Put the process of the pid in pidfile into table, as the only one. That
+ * costs a few reads of /proc instead of a scan of all processes. A process
+ * that started after the pid file was written only got the pid of the one
+ * that wrote it after that one was gone, and does not count. */
+int
+np_ps_pidfile (np_proc_table *table, const char *pidfile)
+{
+	time_t written = 0, started = 0;
+	pid_t pid;
+#ifndef __linux__
+	size_t i;
+#endif
+
+	memset (table, 0, sizeof (np_proc_table));
+	if ((pid = pidfile_read (pidfile, &written)) == 0)
+		return NP_PIDFILE_UNREADABLE;
+
+	if ((table->procs = calloc (1, sizeof (np_proc))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+#ifdef __linux__
+	if (!proc_pid (pid, &table->procs[0], &started))
+		return NP_PIDFILE_GONE;
+	table->count = 1;
+	/* the start time is rounded to whole seconds twice */
+	if (started > written + 1) {
+		np_ps_free (table);
+		return NP_PIDFILE_REUSED;
+	}
+#else
+	/* without /proc, ps has to list them all after all, and has no start
+	 * time to tell a reused pid with */
+	free (table->procs);
+	np_ps_run (table, 0);
+	for (i = 0; i < table->count; i++)
+		if (table->procs[i].parsed && table->procs[i].pid == pid)
+			break;
+	if (i == table->count) {
+		np_ps_free (table);
+		return NP_PIDFILE_GONE;
+	}
+	if (i > 0) {
+		free (table->procs[0].buf);
+		table->procs[0] = table->procs[i];
+		table->procs[i].buf = NULL;
+	}
+	for (i = 1; i < table->count; i++)
+		free (table->procs[i].buf);
+	table->count = 1;
+	(void) started;
+#endif
+	return NP_PIDFILE_OK;
+}
+
+const char *
+np_ps_pidfile_text (int result)
+{
+	switch (result) {
+	case NP_PIDFILE_OK:
+		return _("process found");
+	case NP_PIDFILE_UNREADABLE:
+		return _("no pid in the pid file");
+	case NP_PIDFILE_GONE:
+		return _("the process is gone");
+	case NP_PIDFILE_REUSED:
+		return _("the pid is another process now");
+	}
+	return "";
+}
+
+/* np_ps_top(): the busiest n processes seen so far, in a heap with the
+ * least busy of them on top */
+typedef struct ps_top {
+	float pcpu;
+	pid_t pid;
+	size_t idx;	/* in the process table, for ps */
+} ps_top;
+
+/* whether a is less busy than b; the lower pid wins a tie */
+static int
+top_less (const ps_top *a, const ps_top *b)
+{
+	return a->pcpu < b->pcpu || (a->pcpu == b->pcpu && a->pid > b->pid);
+}
+
+static void
+top_push (ps_top *heap, size_t *count, size_t n, const ps_top *e)
+{
+	size_t i, child;
+	ps_top t;
+
+	if (*count < n) {
+		/* sift up */
+		for (i = (*count)++; i > 0 && top_less (e, &heap[(i - 1) / 2]); i = (i - 1) / 2)
+			heap[i] = heap[(i - 1) / 2];
+		heap[i] = *e;
+		return;
+	}
+	if (n == 0 || !top_less (&heap[0], e))
+		return;
+	/* replace the least busy and sift down */
+	t = *e;
+	for (i = 0; (child = 2 * i + 1) < n; i = child) {
+		if (child + 1 < n && top_less (&heap[child + 1], &heap[child]))
+			child++;
+		if (!top_less (&heap[child], &t))
+			break;
+		heap[i] = heap[child];
+	}
+	heap[i] = t;
+}
+
+static int
+top_compare (const void *a, const void *b)
+{
+	return top_less (a, b) - top_less (b, a);
+}
+
+/* The n processes with the most %CPU, busiest first. With /proc only the
+ * stat of each process is read, and everything else of the n picked; the
+ * table has no lines then. Otherwise PS_COMMAND runs as in np_ps_run(),
+ * and the n come first in the table. Either way no more than n processes
+ * are ever kept in order. Either way seen and zombies count all of them.
+ * Returns the exit status of PS_COMMAND, or 0. */
+int
+np_ps_top (np_proc_table *table, size_t n, int ttl)
+{
+	ps_top *heap, e;
+	size_t count = 0, i;
+	np_proc *procs;
+#ifdef __linux__
+	char path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	unsigned long long starttime;
+	long long f[NP_STAT_STARTTIME + 1];
+	long hz = sysconf (_SC_CLK_TCK);
+	time_t btime, now, seconds, started;
+	struct dirent *d;
+	DIR *dir;
+	ssize_t len;
+	int fd;
+#endif
+
+	if ((heap = calloc (n ? n : 1, sizeof (ps_top))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+#ifdef __linux__
+	if ((btime = boot_time ()) > 0 && (dir = opendir ("/proc")) != NULL) {
+		memset (table, 0, sizeof (np_proc_table));
+		now = time (NULL);
+		while ((d = readdir (dir)) != NULL) {
+			if (d->d_name[0] < '1' || d->d_name[0] > '9')
+				continue;
+			snprintf (path, sizeof (path), "/proc/%s/stat", d->d_name);
+			if ((fd = open (path, O_RDONLY)) < 0)
+				continue;
+			len = read (fd, buf, sizeof (buf) - 1);
+			close (fd);
+			if (len <= 0)
+				continue;
+			buf[len] = '\0';
+			if ((p = strrchr (buf, ')')) == NULL || p[1] != ' ' || p[2] == '\0' ||
+			    np_strtoll_fields (p + 3, f, NP_STAT_STARTTIME + 1, NULL) != NP_STAT_STARTTIME + 1)
+				continue;
+			table->seen++;
+			if (p[2] == 'Z')
+				table->zombies++;
+			utime = (unsigned long) f[NP_STAT_UTIME];
+			stime = (unsigned long) f[NP_STAT_STIME];
+			starttime = (unsigned long long) f[NP_STAT_STARTTIME];
+			started = btime + (time_t) (starttime / hz);
+			seconds = now > started ? now - started : 0;
+			e.pcpu = seconds ? ((utime + stime) * 1000.0 / hz / seconds) / 10.0 : 0;
+			e.pid = (pid_t) np_strtoll (d->d_name, NULL);
+			e.idx = 0;
+			top_push (heap, &count, n, &e);
+		}
+		closedir (dir);
+
+		qsort (heap, count, sizeof (ps_top), top_compare);
+		if ((table->procs = calloc (count ? count : 1, sizeof (np_proc))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		/* one may be gone by now */
+		for (i = 0; i < count; i++)
+			if (proc_pid (heap[i].pid, &table->procs[table->count], &started))
+				table->count++;
+		free (heap);
+		return 0;
+	}
+#endif
+
+	np_ps_run (table, ttl);
+	for (i = 0; i < table->count; i++) {
+		if (!table->procs[i].parsed)
+			continue;
+		table->seen++;
+		if (table->procs[i].stat[0] == 'Z')
+			table->zombies++;
+	}
+#ifdef PS_USES_PROCPCPU
+	for (i = 0; i < table->count; i++) {
+		if (!table->procs[i].parsed)
+			continue;
+		e.pcpu = table->procs[i].pcpu;
+		e.pid = table->procs[i].pid;
+		e.idx = i;
+		top_push (heap, &count, n, &e);
+	}
+	qsort (heap, count, sizeof (ps_top), top_compare);
+
+	/* the n to the front, the rest after them in any order */
+	if ((procs = malloc ((table->count ? table->count : 1) * sizeof (np_proc))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < count; i++) {
+		procs[i] = table->procs[heap[i].idx];
+		table->procs[heap[i].idx].buf = NULL;
+		table->procs[heap[i].idx].line = NULL;
+	}
+	for (i = 0; i < table->count; i++)
+		if (table->procs[i].line != NULL)
+			procs[count++] = table->procs[i];
+	free (table->procs);
+	table->procs = procs;
+#else
+	(void) procs;
+#endif
+	free (heap);
+	return table->result;
+}
+
+void
+np_ps_free (np_proc_table *table)
+{
+	size_t i;
+
+	for (i = 0; i < table->count; i++)
+		free (table->procs[i].buf);
+	free (table->procs);
+	if (table->out.lines > 0)
+		free (table->out.line[0]);
+	free (table->out.line);
+	free (table->out.lens);
+	free (table->out.buf);
+	free (table->err.line);
+	free (table->err.lens);
+	free (table->err.buf);
+	memset (table, 0, sizeof (np_proc_table));
+}
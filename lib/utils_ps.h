@@ -0,0 +1,95 @@
+#ifndef _UTILS_PS_
+#define _UTILS_PS_
+
+/*
+ * Header file for Monitoring Plugins utils_ps.c
+ *
+ * One parser for the output of PS_COMMAND, and a snapshot of it that
+ * plugins running on the same host within a few seconds can share.
+ */
+
+#include "utils_cmd.h"
+
+/** types **/
+typedef struct np_proc
+{
+	int parsed;    /* FALSE if the line did not match PS_FORMAT */
+	char *line;    /* the line of ps output, the args for a record */
+	char stat[8];
+	int uid;
+	pid_t pid;
+	pid_t ppid;
+	int vsz;
+	int rss;
+	float pcpu;
+	char *etime;   /* "" unless PS_USES_PROCETIME */
+	char *prog;
+	char *args;
+	char *buf;     /* holds etime, prog and args */
+} np_proc;
+
+typedef struct np_proc_table
+{
+	np_proc *procs;  /* one per line of output after the header */
+	size_t count;
+	output out;      /* the output of PS_COMMAND, line 0 is the header; no
+	                  * lines for records */
+	output err;
+	int result;      /* the exit status of PS_COMMAND */
+	int cached;      /* TRUE if the snapshot came from the cache */
+	size_t seen;     /* the processes np_ps_top() went through, */
+	size_t zombies;  /* and the zombies of them */
+} np_proc_table;
+
+/* what np_ps_pidfile() found */
+enum np_pidfile_result {
+	NP_PIDFILE_OK,          /* the table has the process */
+	NP_PIDFILE_UNREADABLE,  /* no pid file, or no pid in it */
+	NP_PIDFILE_GONE,        /* the process is not running */
+	NP_PIDFILE_REUSED       /* another process started since, under its pid */
+};
+
+/* the fields of /proc/PID/stat after the state, as np_strtoll_fields()
+ * reads them from just past it */
+enum np_proc_stat_field {
+	NP_STAT_PPID, NP_STAT_PGRP, NP_STAT_SESSION, NP_STAT_TTY, NP_STAT_TPGID,
+	NP_STAT_FLAGS, NP_STAT_MINFLT, NP_STAT_CMINFLT, NP_STAT_MAJFLT, NP_STAT_CMAJFLT,
+	NP_STAT_UTIME, NP_STAT_STIME, NP_STAT_CUTIME, NP_STAT_CSTIME, NP_STAT_PRIORITY,
+	NP_STAT_NICE, NP_STAT_NLWP, NP_STAT_ITREALVALUE, NP_STAT_STARTTIME, NP_STAT_VSIZE,
+	NP_STAT_RSS, NP_STAT_FIELDS
+};
+
+/** prototypes **/
+int np_ps_parse (const char *, np_proc *);
+int np_ps_run (np_proc_table *, int);
+int np_ps_read_file (np_proc_table *, char *);
+int np_ps_run_records (np_proc_table *, int);
+size_t np_ps_records_parse (np_proc_table *);
+void np_ps_free (np_proc_table *);
+char *np_ps_cache_file (void);
+/* The process of a pid file alone, without looking at any other: from
+ * /proc/PID where there is one, from the output of PS_COMMAND elsewhere */
+int np_ps_pidfile (np_proc_table *, const char *);
+const char *np_ps_pidfile_text (int);
+/* The n processes using the most CPU, busiest first, with the count of all
+ * of them and of the zombies */
+int np_ps_top (np_proc_table *, size_t, int);
+
+/* MP_PS_CACHE_DIR overrides where the snapshot is kept, or else a tmpfs
+ * as /dev/shm is used if there is one */
+#define NP_PS_CACHE_DIR_ENV "MP_PS_CACHE_DIR"
+#define NP_PS_CACHE_VERSION 1
+
+/*
+ * Where configure found PS_RECORD_COMMAND (pst3 -b on Solaris), the
+ * process table comes as binary records that need no sscanf() and have no
+ * limit on the length of the args: NP_PS_RECORD_MAGIC, then per process in
+ * the byte order of the host
+ *   u32 length of the record, i32 uid, pid, ppid, u32 vsz, rss (kB),
+ *   u32 %CPU in hundredths, char state[4], u32 length of the command,
+ *   u32 length of the args, then the command and the args
+ */
+#define NP_PS_RECORD_MAGIC "NPPS1\n"
+#define NP_PS_RECORD_HEADER 40
+
+#endif /* _UTILS_PS_ */
@@ -0,0 +1,287 @@
+/*****************************************************************************
+*
+* Monitoring Plugins regular expression utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds the wrapper the plugins compile and match their regular
+* expressions through. With PCRE2 (configure --with-pcre2) extended
+* expressions are compiled by pcre2_compile() and matched by its JIT. The
+* compiled pattern is kept in the state directory, under regex/ and a
+* hash of the pattern and its options, and read back by the next run so
+* that frequently run checks skip compiling it. Basic expressions, and
+* patterns PCRE2 refuses, go to the gnulib engine as before.
+*
+* PCRE2 is told to follow POSIX where it can: without REG_NEWLINE '.'
+* matches a newline and only the ends of the string match ^ and $. Its
+* syntax is otherwise a superset of what the plugins' users write, but
+* unlike POSIX a backslash inside brackets escapes the next character.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_regex.h"
+
+#ifdef HAVE_PCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#include <sys/stat.h>
+
+#define NP_REGEX_CACHE_MAGIC "# NP regex cache 1\n"
+/* far more than any pattern a plugin is given compiles to */
+#define NP_REGEX_CACHE_MAX (1024 * 1024)
+
+static uint32_t
+np_pcre2_options(int cflags)
+{
+	uint32_t options = 0;
+
+	if (cflags & REG_ICASE)
+		options |= PCRE2_CASELESS;
+	if (cflags & REG_NEWLINE)
+		options |= PCRE2_MULTILINE;
+	else
+		options |= PCRE2_DOTALL | PCRE2_DOLLAR_ENDONLY;
+	if (cflags & REG_NOSUB)
+		options |= PCRE2_NO_AUTO_CAPTURE;
+	return options;
+}
+
+/* The cache file of a pattern, named after a hash of the PCRE2 version,
+ * the options and the pattern */
+static char *
+np_regex_cache_file(const char *pattern, uint32_t options)
+{
+	struct sha1_ctx ctx;
+	unsigned char digest[20];
+	char version[64] = "";
+	char key[41];
+	char *file;
+	int i;
+
+	pcre2_config(PCRE2_CONFIG_VERSION, version);
+	sha1_init_ctx(&ctx);
+	sha1_process_bytes(version, strlen(version), &ctx);
+	sha1_process_bytes(&options, sizeof(options), &ctx);
+	sha1_process_bytes(pattern, strlen(pattern), &ctx);
+	sha1_finish_ctx(&ctx, digest);
+	for (i = 0; i < 20; i++)
+		sprintf(&key[2 * i], "%02x", digest[i]);
+	key[40] = '\0';
+
+	if (asprintf(&file, "%s/%lu/regex/%s", _np_state_calculate_location_prefix(),
+	    (unsigned long)geteuid(), key) < 0)
+		return NULL;
+	return file;
+}
+
+/* Returns the compiled pattern from its cache file, or NULL if it isn't
+ * there or was written for another pattern or by another PCRE2 */
+static pcre2_code *
+np_regex_cache_load(const char *file, const char *pattern, uint32_t options)
+{
+	FILE *fp;
+	struct stat st;
+	unsigned char *buf = NULL;
+	size_t magic_len = strlen(NP_REGEX_CACHE_MAGIC);
+	size_t pattern_len = strlen(pattern);
+	size_t header_len = magic_len + sizeof(options) + pattern_len + 1;
+	pcre2_code *code = NULL;
+
+	if ((fp = fopen(file, "rb")) == NULL)
+		return NULL;
+	if (fstat(fileno(fp), &st) != 0 || st.st_uid != geteuid() ||
+	    st.st_size <= (off_t)header_len || st.st_size > NP_REGEX_CACHE_MAX ||
+	    (buf = malloc(st.st_size)) == NULL ||
+	    fread(buf, 1, st.st_size, fp) != (size_t)st.st_size) {
+		free(buf);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+
+	if (memcmp(buf, NP_REGEX_CACHE_MAGIC, magic_len) == 0 &&
+	    memcmp(buf + magic_len, &options, sizeof(options)) == 0 &&
+	    memcmp(buf + magic_len + sizeof(options), pattern, pattern_len + 1) == 0 &&
+	    pcre2_serialize_decode(&code, 1, buf + header_len, NULL) != 1)
+		code = NULL;
+	free(buf);
+	return code;
+}
+
+/* Writes the cache file like np_state_write_string() writes state files,
+ * but quietly gives up on errors: the next run just compiles again */
+static void
+np_regex_cache_save(const char *file, const char *pattern, uint32_t options, pcre2_code *code)
+{
+	uint8_t *bytes;
+	PCRE2_SIZE size;
+	char *directories, *temp_file, *p;
+	FILE *fp;
+	int fd, result;
+
+	if (pcre2_serialize_encode((const pcre2_code **)&code, 1, &bytes, &size, NULL) != 1)
+		return;
+
+	if ((directories = strdup(file)) != NULL) {
+		for (p = directories + 1; *p; p++) {
+			if (*p == '/') {
+				*p = '\0';
+				if (access(directories, F_OK) != 0)
+					mkdir(directories, S_IRWXU);
+				*p = '/';
+			}
+		}
+		free(directories);
+	}
+
+	if (asprintf(&temp_file, "%s.XXXXXX", file) < 0) {
+		pcre2_serialize_free(bytes);
+		return;
+	}
+	if ((fd = mkstemp(temp_file)) == -1) {
+		free(temp_file);
+		pcre2_serialize_free(bytes);
+		return;
+	}
+	if ((fp = fdopen(fd, "wb")) == NULL) {
+		close(fd);
+		unlink(temp_file);
+		free(temp_file);
+		pcre2_serialize_free(bytes);
+		return;
+	}
+	fputs(NP_REGEX_CACHE_MAGIC, fp);
+	fwrite(&options, sizeof(options), 1, fp);
+	fwrite(pattern, strlen(pattern) + 1, 1, fp);
+	fwrite(bytes, size, 1, fp);
+	result = ferror(fp);
+	if (fclose(fp) != 0 || result != 0 || rename(temp_file, file) != 0)
+		unlink(temp_file);
+	free(temp_file);
+	pcre2_serialize_free(bytes);
+}
+#endif /* HAVE_PCRE2 */
+
+int
+np_regcomp(np_regex_t *re, const char *pattern, int cflags)
+{
+	memset(re, 0, sizeof(*re));
+	re->backend = NP_REGEX_POSIX;
+	re->cflags = cflags;
+
+#ifdef HAVE_PCRE2
+	if (cflags & REG_EXTENDED) {
+		uint32_t options = np_pcre2_options(cflags);
+		char *file = np_regex_cache_file(pattern, options);
+		pcre2_code *code = NULL;
+		int error;
+		PCRE2_SIZE offset;
+
+		if (file)
+			code = np_regex_cache_load(file, pattern, options);
+		if (code == NULL) {
+			code = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED,
+			    options, &error, &offset, NULL);
+			if (code && file)
+				np_regex_cache_save(file, pattern, options, code);
+		}
+		free(file);
+
+		if (code) {
+			/* machine code can't be serialised, so the JIT runs each
+			 * time. Without JIT support pcre2_match() interprets. */
+			pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+			re->match_data = pcre2_match_data_create_from_pattern(code, NULL);
+			if (re->match_data == NULL) {
+				pcre2_code_free(code);
+				return REG_ESPACE;
+			}
+			re->code = code;
+			re->backend = NP_REGEX_PCRE2;
+			return 0;
+		}
+		/* leave what PCRE2 doesn't take to regcomp(), and its errors */
+	}
+#endif
+
+	return regcomp(&re->posix, pattern, cflags);
+}
+
+int
+np_regexec(const np_regex_t *re, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags)
+{
+#ifdef HAVE_PCRE2
+	if (re->backend == NP_REGEX_PCRE2) {
+		uint32_t options = 0;
+		PCRE2_SIZE *ovector;
+		size_t i;
+		int rc;
+
+		if (eflags & REG_NOTBOL)
+			options |= PCRE2_NOTBOL;
+		if (eflags & REG_NOTEOL)
+			options |= PCRE2_NOTEOL;
+		rc = pcre2_match(re->code, (PCRE2_SPTR)string, PCRE2_ZERO_TERMINATED,
+		    0, options, re->match_data, NULL);
+		if (rc == PCRE2_ERROR_NOMATCH)
+			return REG_NOMATCH;
+		if (rc < 0)
+			return REG_ESPACE;
+
+		if (pmatch && !(re->cflags & REG_NOSUB)) {
+			ovector = pcre2_get_ovector_pointer(re->match_data);
+			for (i = 0; i < nmatch; i++) {
+				if (i < (size_t)rc && ovector[2 * i] != PCRE2_UNSET) {
+					pmatch[i].rm_so = ovector[2 * i];
+					pmatch[i].rm_eo = ovector[2 * i + 1];
+				} else {
+					pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+				}
+			}
+		}
+		return 0;
+	}
+#endif
+
+	return regexec(&re->posix, string, nmatch, pmatch, eflags);
+}
+
+size_t
+np_regerror(int errcode, const np_regex_t *re, char *errbuf, size_t errbuf_size)
+{
+	return regerror(errcode, &re->posix, errbuf, errbuf_size);
+}
+
+void
+np_regfree(np_regex_t *re)
+{
+#ifdef HAVE_PCRE2
+	if (re->backend == NP_REGEX_PCRE2) {
+		pcre2_match_data_free(re->match_data);
+		pcre2_code_free(re->code);
+		re->match_data = re->code = NULL;
+		return;
+	}
+#endif
+	regfree(&re->posix);
+}
@@ -0,0 +1,33 @@
+#ifndef _UTILS_REGEX_
+#define _UTILS_REGEX_
+
+/*
+ * Header file for Monitoring Plugins utils_regex.c
+ *
+ * regcomp() and friends for the plugins. When configure was given
+ * --with-pcre2, extended expressions are compiled and matched by PCRE2
+ * and its JIT, otherwise and for basic expressions the gnulib engine is
+ * used.
+ */
+
+#include "regex.h"
+
+typedef struct np_regex {
+	regex_t posix;
+	int backend;		/* NP_REGEX_POSIX or NP_REGEX_PCRE2 */
+	int cflags;
+	void *code;		/* pcre2_code */
+	void *match_data;	/* pcre2_match_data */
+} np_regex_t;
+
+#define NP_REGEX_POSIX 0
+#define NP_REGEX_PCRE2 1
+
+/* Takes the cflags and returns the error codes of regcomp() */
+int np_regcomp(np_regex_t *re, const char *pattern, int cflags);
+/* Takes the eflags and returns 0 or REG_NOMATCH like regexec() */
+int np_regexec(const np_regex_t *re, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags);
+size_t np_regerror(int errcode, const np_regex_t *re, char *errbuf, size_t errbuf_size);
+void np_regfree(np_regex_t *re);
+
+#endif /* _UTILS_REGEX_ */
@@ -0,0 +1,329 @@
+/*****************************************************************************
+*
+* Monitoring Plugins target list utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds the reader the multi-target modes of check_tcp,
+* check_icmp, check_snmp, check_syn and check_curl take their lists with.
+* Lines are read into a buffer of fixed size and handed out one at a time,
+* and a plugin run on one of several pollers keeps only the lines of its
+* shard.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_targets.h"
+#include <ctype.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+static unsigned int shard_index = 0;
+static unsigned int shard_count = 0;	/* 0 for all of them */
+
+int
+np_targets_shard (const char *spec)
+{
+	unsigned long i, n;
+	char *end;
+
+	if (!isdigit ((unsigned char) *spec))
+		return ERROR;
+	i = strtoul (spec, &end, 10);
+	if (*end != '/' || !isdigit ((unsigned char) end[1]))
+		return ERROR;
+	n = strtoul (end + 1, &end, 10);
+	if (*end != '\0' || i < 1 || i > n || n > UINT_MAX)
+		return ERROR;
+	shard_index = i - 1;
+	shard_count = n;
+	return OK;
+}
+
+/* the last step of splitmix64, which spreads every bit of x over all of
+ * the result */
+static uint64_t
+mix (uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* FNV-1a */
+static uint64_t
+hash_line (const char *line)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *line; line++)
+		h = (h ^ (unsigned char) *line) * 1099511628211ULL;
+	return h;
+}
+
+unsigned int
+np_targets_shard_of (const char *line, unsigned int n)
+{
+	uint64_t h = hash_line (line), weight, best = 0;
+	unsigned int i, shard = 0;
+
+	for (i = 0; i < n; i++) {
+		weight = mix (h ^ ((uint64_t) (i + 1) * 0x9e3779b97f4a7c15ULL));
+		if (i == 0 || weight > best) {
+			best = weight;
+			shard = i;
+		}
+	}
+	return shard;
+}
+
+static int
+connect_unix (const char *path)
+{
+	struct sockaddr_un su;
+	int sd;
+
+	if (strlen (path) >= sizeof (su.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset (&su, 0, sizeof (su));
+	su.sun_family = AF_UNIX;
+	strcpy (su.sun_path, path);
+	if ((sd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect (sd, (struct sockaddr *) &su, sizeof (su)) < 0) {
+		close (sd);
+		return -1;
+	}
+	return sd;
+}
+
+/* "host:port" or "[v6addr]:port" */
+static int
+connect_tcp (const char *spec)
+{
+	struct addrinfo hints, *res, *r;
+	char host[256], *port;
+	size_t len;
+	int sd = -1, saved = EHOSTUNREACH;
+
+	if ((port = strrchr (spec, ':')) == NULL || port == spec ||
+	    (len = port - spec) >= sizeof (host)) {
+		errno = EINVAL;
+		return -1;
+	}
+	port++;
+	if (spec[0] == '[' && spec[len - 1] == ']') {
+		spec++;
+		len -= 2;
+	}
+	memcpy (host, spec, len);
+	host[len] = '\0';
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo (host, port, &hints, &res) != 0) {
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+	for (r = res; r != NULL; r = r->ai_next) {
+		if ((sd = socket (r->ai_family, r->ai_socktype, r->ai_protocol)) < 0) {
+			saved = errno;
+			continue;
+		}
+		if (connect (sd, r->ai_addr, r->ai_addrlen) == 0)
+			break;
+		saved = errno;
+		close (sd);
+		sd = -1;
+	}
+	freeaddrinfo (res);
+	if (sd < 0)
+		errno = saved;
+	return sd;
+}
+
+np_targets *
+np_targets_open (const char *source)
+{
+	np_targets *t;
+	FILE *fp;
+	int sd = -1, saved;
+
+	if (strcmp (source, "-") == 0)
+		fp = stdin;
+	else if (strncmp (source, "unix:", 5) == 0 || strncmp (source, "tcp:", 4) == 0) {
+		sd = source[0] == 'u' ? connect_unix (source + 5) : connect_tcp (source + 4);
+		if (sd < 0)
+			return NULL;
+		if ((fp = fdopen (sd, "r")) == NULL) {
+			saved = errno;
+			close (sd);
+			errno = saved;
+			return NULL;
+		}
+	}
+	else if ((fp = fopen (source, "r")) == NULL)
+		return NULL;
+
+	if ((t = calloc (1, sizeof (np_targets))) == NULL) {
+		saved = errno;
+		if (fp != stdin)
+			fclose (fp);
+		errno = saved;
+		return NULL;
+	}
+	t->fp = fp;
+	return t;
+}
+
+char *
+np_targets_next (np_targets *t)
+{
+	char *p;
+	size_t len;
+	int c;
+
+	while (fgets (t->line, sizeof (t->line), t->fp) != NULL) {
+		len = strlen (t->line);
+		if (len == sizeof (t->line) - 1 && t->line[len - 1] != '\n') {
+			/* the rest of it, in whatever pieces */
+			while ((c = getc (t->fp)) != EOF && c != '\n')
+				;
+			t->too_long++;
+			continue;
+		}
+		while (len > 0 && isspace ((unsigned char) t->line[len - 1]))
+			t->line[--len] = '\0';
+		p = t->line + strspn (t->line, " \t");
+		if (*p == '\0' || *p == '#')
+			continue;
+		t->lines++;
+		if (shard_count > 1 && np_targets_shard_of (p, shard_count) != shard_index)
+			continue;
+		t->taken++;
+		return p;
+	}
+	return NULL;
+}
+
+void
+np_targets_close (np_targets *t)
+{
+	if (t->fp != stdin)
+		fclose (t->fp);
+	free (t);
+}
+
+/* A state is one of STATE_OK to STATE_DEPENDENT and takes three bits; the
+ * hash of the name keeps the others. */
+#define CHANGES_STATE_BITS 7
+
+static int
+changes_order (const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a & ~(uint64_t) CHANGES_STATE_BITS;
+	uint64_t y = *(const uint64_t *) b & ~(uint64_t) CHANGES_STATE_BITS;
+
+	return x < y ? -1 : x > y;
+}
+
+np_changes *
+np_changes_load (time_t refresh)
+{
+	monitoring_plugin *plugin = np_plugin ();
+	state_key *own;
+	state_data *data;
+	np_changes *c;
+	time_t now;
+
+	if (plugin == NULL)
+		die (STATE_UNKNOWN, _("This requires np_init to be called"));
+	if ((c = calloc (1, sizeof (np_changes))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	/* apart from the plugin's own state, one for every command line */
+	strcpy (c->key, "changes_");
+	np_argv_digest (plugin->argc, plugin->argv, c->key + strlen (c->key));
+	own = plugin->state;
+	np_enable_state (c->key, 1);
+	data = np_state_read ();
+	plugin->state = own;
+
+	if (data != NULL && data->data != NULL && data->length > 0 &&
+	    data->length % sizeof (uint64_t) == 0) {
+		c->nlast = data->length / sizeof (uint64_t);
+		if ((c->last = malloc (data->length)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		memcpy (c->last, data->data, data->length);
+		c->full_at = data->time;
+	}
+
+	time (&now);
+	c->full = c->last == NULL || (refresh > 0 && (now < c->full_at || now - c->full_at >= refresh));
+	if (c->full)
+		c->full_at = now;
+	return c;
+}
+
+int
+np_changes_check (np_changes *c, const char *name, int state)
+{
+	uint64_t entry, *found;
+
+	if (state < STATE_OK || state > STATE_DEPENDENT)
+		state = STATE_UNKNOWN;
+	entry = (hash_line (name) & ~(uint64_t) CHANGES_STATE_BITS) | (uint64_t) state;
+	if (c->nnow == c->size) {
+		c->size = c->size ? c->size * 2 : 1024;
+		if ((c->now = realloc (c->now, c->size * sizeof (uint64_t))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	c->now[c->nnow++] = entry;
+
+	found = c->last ? bsearch (&entry, c->last, c->nlast, sizeof (uint64_t), changes_order) : NULL;
+	if (found != NULL && *found == entry)
+		return c->full;
+	c->changed++;
+	return TRUE;
+}
+
+void
+np_changes_save (np_changes *c)
+{
+	monitoring_plugin *plugin = np_plugin ();
+	state_key *own;
+
+	if (c->now != NULL)
+		qsort (c->now, c->nnow, sizeof (uint64_t), changes_order);
+	own = plugin->state;
+	np_enable_state (c->key, 1);
+	np_state_write_binary (c->full_at, c->now, c->nnow * sizeof (uint64_t));
+	plugin->state = own;
+
+	free (c->last);
+	free (c->now);
+	free (c);
+}
@@ -0,0 +1,69 @@
+#ifndef _UTILS_TARGETS_
+#define _UTILS_TARGETS_
+/* Header file for utils_targets: the target lists of the multi-target modes */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define NP_TARGETS_LINE_MAX 8192	/* with the newline */
+
+/* A list is read a line at a time from a file, "-" for stdin,
+ * "unix:PATH" for a local socket or "tcp:HOST:PORT" for a TCP one, so it
+ * takes the same little memory however long it is. Blanks around a line
+ * are stripped, and empty lines and lines starting with '#' skipped, as
+ * are lines too long for the buffer. */
+typedef struct np_targets {
+	FILE *fp;
+	unsigned long lines;	/* targets read so far */
+	unsigned long taken;	/* of them in this shard */
+	unsigned long too_long;
+	char line[NP_TARGETS_LINE_MAX];
+} np_targets;
+
+/* Takes "I/N": only the targets of shard I of N, counting from 1, are
+ * returned from now on. A target is in the shard with the highest hash of
+ * its line and the shard number (rendezvous hashing), so N pollers split a
+ * list between them without talking to each other, and going from N to
+ * N+1 pollers moves only the targets the new one gets. Returns OK, or
+ * ERROR if spec is not that. */
+int np_targets_shard (const char *spec);
+/* the shard of that line among n, counting from 0 */
+unsigned int np_targets_shard_of (const char *line, unsigned int n);
+
+/* NULL with errno set if the source cannot be opened */
+np_targets *np_targets_open (const char *source);
+/* The next target of this shard, valid until the next call, or NULL at the
+ * end of the list */
+char *np_targets_next (np_targets *);
+void np_targets_close (np_targets *);
+
+/* Only what changed. A run over many thousands of targets that prints them
+ * all hands the scheduler the same results every time; instead the state
+ * of every target is kept for the next run, under a key made from the
+ * command line, and a target is reported when its state is not the one of
+ * the last run or it is new, and all of them are every refresh seconds. */
+#define DEFAULT_CHANGES_REFRESH 3600
+
+typedef struct np_changes {
+	uint64_t *last;		/* hashes of the names, the states in the low bits, sorted */
+	size_t nlast;
+	uint64_t *now;
+	size_t nnow;
+	size_t size;
+	time_t full_at;		/* when all targets were last reported */
+	int full;		/* this run reports all of them */
+	unsigned long changed;	/* targets reported as they changed */
+	char key[64];		/* of the state */
+} np_changes;
+
+/* The states of the last run. A full report is due when there were none,
+ * or refresh seconds passed since the last one, never for 0. Needs
+ * np_init(). */
+np_changes *np_changes_load (time_t refresh);
+/* Records the state of a target, and returns TRUE if it is to be reported */
+int np_changes_check (np_changes *, const char *name, int state);
+/* keeps the states recorded for the next run and frees them */
+void np_changes_save (np_changes *);
+
+#endif /* _UTILS_TARGETS_ */
@@ -27,7 +27,9 @@
 *****************************************************************************/
 
 #include "common.h"
+#include "utils_base.h"
 #include "utils_tcp.h"
+#include "utils_match.h"
 
 #define VERBOSE(message)                        \
 	do {                                    \
@@ -35,35 +37,69 @@
 			puts(message);          \
 	} while (0)
 
+/* what is known of each expect string */
+#define EXPECT_OPEN     0
+#define EXPECT_FOUND    1
+#define EXPECT_FAILED   2	/* NP_MATCH_EXACT: the beginning differs */
+
 enum np_match_result
-np_expect_match(char *status, char **server_expect, int expect_count, int flags)
+np_expect_match_more(np_expect_state *state, const char *status, size_t len,
+                     char **server_expect, int expect_count, int flags)
 {
 	int i, match = 0, partial = 0;
+	size_t elen, start, end;
+
+	if (state->found == NULL &&
+	    (state->found = calloc(expect_count ? expect_count : 1, 1)) == NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
 
 	for (i = 0; i < expect_count; i++) {
+		if (state->found[i] == EXPECT_FOUND) {
+			match++;
+			continue;
+		}
+		if (state->found[i] == EXPECT_FAILED)
+			continue;
+		elen = strlen(server_expect[i]);
+
 		if (flags & NP_MATCH_VERBOSE)
-			printf("looking for [%s] %s [%s]\n", server_expect[i],
+			printf("looking for [%s] %s [%.*s]\n", server_expect[i],
 			    (flags & NP_MATCH_EXACT) ?
 			    "in beginning of" : "anywhere in",
-			    status);
+			    (int)(len - state->scanned), status + state->scanned);
 
 		if (flags & NP_MATCH_EXACT) {
-			if (strncmp(status, server_expect[i], strlen(server_expect[i])) == 0) {
+			/* only the bytes of the expect string not compared yet */
+			end = len < elen ? len : elen;
+			if (state->scanned < end &&
+			    memcmp(status + state->scanned, server_expect[i] + state->scanned,
+			           end - state->scanned) != 0) {
+				state->found[i] = EXPECT_FAILED;
+				VERBOSE("couldn't find it");
+				continue;
+			}
+			if (len >= elen) {
 				VERBOSE("found it");
+				state->found[i] = EXPECT_FOUND;
 				match++;
-				continue;
-			} else if (strncmp(status, server_expect[i], strlen(status)) == 0) {
+			} else {
 				VERBOSE("found a substring");
 				partial++;
-				continue;
 			}
-		} else if (strstr(status, server_expect[i]) != NULL) {
-				VERBOSE("found it");
-				match++;
-				continue;
+			continue;
+		}
+
+		/* a match may have begun in the elen - 1 bytes before */
+		start = state->scanned >= elen ? state->scanned - elen + 1 : 0;
+		if (np_memmem(status + start, len - start, server_expect[i], elen) != NULL) {
+			VERBOSE("found it");
+			state->found[i] = EXPECT_FOUND;
+			match++;
+			continue;
 		}
 		VERBOSE("couldn't find it");
 	}
+	state->scanned = len;
 
 	if ((flags & NP_MATCH_ALL && match == expect_count) ||
 	    (!(flags & NP_MATCH_ALL) && match >= 1))
@@ -73,3 +109,23 @@ np_expect_match(char *status, char **server_expect, int expect_count, int flags)
 	else
 		return NP_MATCH_FAILURE;
 }
+
+void
+np_expect_free(np_expect_state *state)
+{
+	free(state->found);
+	state->found = NULL;
+	state->scanned = 0;
+}
+
+enum np_match_result
+np_expect_match(char *status, char **server_expect, int expect_count, int flags)
+{
+	np_expect_state state = NP_EXPECT_STATE_INIT;
+	enum np_match_result result;
+
+	result = np_expect_match_more(&state, status, strlen(status),
+	                              server_expect, expect_count, flags);
+	np_expect_free(&state);
+	return result;
+}
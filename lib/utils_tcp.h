@@ -20,3 +20,23 @@ enum np_match_result np_expect_match(char *status,
                                      char **server_expect,
                                      int server_expect_count,
                                      int flags);
+
+/*
+ * The same for a response that grows while it is read: each call is given
+ * everything received so far, len bytes of it, but only looks at what came
+ * since the call before, so matching as data trickles in stays linear. A
+ * state starts out as NP_EXPECT_STATE_INIT, is used for one response with
+ * the same expect strings and flags, and is released by np_expect_free().
+ */
+typedef struct np_expect_state {
+	size_t scanned;		/* bytes of the response already looked at */
+	unsigned char *found;	/* for each expect string, see utils_tcp.c */
+} np_expect_state;
+#define NP_EXPECT_STATE_INIT { 0, NULL }
+
+enum np_match_result np_expect_match_more(np_expect_state *state,
+                                          const char *status, size_t len,
+                                          char **server_expect,
+                                          int server_expect_count,
+                                          int flags);
+void np_expect_free(np_expect_state *state);
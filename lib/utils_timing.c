@@ -0,0 +1,259 @@
+/*****************************************************************************
+*
+* Monitoring Plugins timing utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds the spans which tell where the time of a check went:
+* the name resolution, the connect, the TLS handshake, the request and so
+* on. A span takes two readings of the monotonic clock and nothing else
+* happens unless --timing-perfdata or --trace-timing was given, so the
+* spans can stay in the code paths every check takes. With
+* --resource-usage, what the run cost in CPU time, memory and context
+* switches follows, so that the plugins of a large poller can be ranked by
+* what they cost.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_base.h"
+#include "utils_timing.h"
+#include <sys/resource.h>
+
+typedef struct np_span {
+	const char *name;
+	int depth;
+	int open;
+	double start;
+	double elapsed;
+} np_span;
+
+static int timing_flags = 0;
+static double timing_start;
+/* the spans of the check running on this thread */
+static NP_THREAD_LOCAL np_span *spans = NULL;
+static NP_THREAD_LOCAL size_t span_count = 0, span_size = 0;
+static NP_THREAD_LOCAL int span_depth = 0;
+
+static void
+timing_atexit (void)
+{
+	char *usage;
+
+	/* after what the plugin printed */
+	fflush (stdout);
+	if (timing_flags & NP_TIMING_TRACE)
+		np_timing_trace (stderr);
+	if (timing_flags & NP_TIMING_RUSAGE) {
+		usage = np_resource_usage ();
+		fprintf (stderr, "resources: %s\n", usage);
+		free (usage);
+	}
+}
+
+char **
+np_timing_opts (int *argc, char **argv)
+{
+	const char *env = getenv (NP_RESOURCE_USAGE_ENV);
+	int i, j;
+
+	if (env != NULL && *env != '\0')
+		np_timing_enable (NP_TIMING_RUSAGE);
+	for (i = j = 0; i < *argc; i++) {
+		if (i > 0 && strcmp (argv[i], "--timing-perfdata") == 0)
+			np_timing_enable (NP_TIMING_PERFDATA);
+		else if (i > 0 && strcmp (argv[i], "--trace-timing") == 0)
+			np_timing_enable (NP_TIMING_TRACE);
+		else if (i > 0 && strcmp (argv[i], "--resource-usage") == 0)
+			np_timing_enable (NP_TIMING_RUSAGE);
+		else
+			argv[j++] = argv[i];
+	}
+	for (i = j; i < *argc; i++)
+		argv[i] = NULL;
+	*argc = j;
+	return argv;
+}
+
+void
+np_timing_enable (int flags)
+{
+	if (!timing_flags)
+		timing_start = np_clock ();
+	/* one handler for whatever goes to stderr */
+	if (flags & (NP_TIMING_TRACE | NP_TIMING_RUSAGE) &&
+	    !(timing_flags & (NP_TIMING_TRACE | NP_TIMING_RUSAGE)))
+		atexit (timing_atexit);
+	timing_flags |= flags;
+}
+
+int
+np_timing_enabled (void)
+{
+	return timing_flags;
+}
+
+void
+np_span_begin (const char *name)
+{
+	np_span *s;
+
+	if (!(timing_flags & (NP_TIMING_PERFDATA | NP_TIMING_TRACE | NP_TIMING_SPANS)))
+		return;
+	if (span_count >= span_size) {
+		span_size = span_size ? span_size * 2 : 16;
+		if ((spans = realloc (spans, span_size * sizeof (np_span))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	s = &spans[span_count++];
+	s->name = name;
+	s->depth = span_depth++;
+	s->open = 1;
+	s->elapsed = 0;
+	s->start = np_clock ();
+}
+
+void
+np_span_end (void)
+{
+	double now;
+	size_t i;
+
+	if (!(timing_flags & (NP_TIMING_PERFDATA | NP_TIMING_TRACE | NP_TIMING_SPANS)))
+		return;
+	now = np_clock ();
+	for (i = span_count; i-- > 0; )
+		if (spans[i].open) {
+			spans[i].open = 0;
+			spans[i].elapsed = now - spans[i].start;
+			span_depth--;
+			return;
+		}
+}
+
+double
+np_span_elapsed (const char *name)
+{
+	double total = 0;
+	size_t i;
+
+	for (i = 0; i < span_count; i++)
+		if (!spans[i].open && strcmp (spans[i].name, name) == 0)
+			total += spans[i].elapsed;
+	return total;
+}
+
+void
+np_span_each (void (*fn) (const char *name, double seconds, void *arg), void *arg)
+{
+	size_t i, j;
+
+	for (i = 0; i < span_count; i++) {
+		for (j = 0; j < i; j++)
+			if (strcmp (spans[j].name, spans[i].name) == 0)
+				break;
+		if (j == i)
+			fn (spans[i].name, np_span_elapsed (spans[i].name), arg);
+	}
+}
+
+void
+np_timing_reset (void)
+{
+	span_count = 0;
+	span_depth = 0;
+	timing_start = np_clock ();
+}
+
+char *
+np_timing_perfdata (void)
+{
+	char *perfdata, *next, *usage;
+	size_t i, j;
+
+	if ((perfdata = strdup ("")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	if (!(timing_flags & NP_TIMING_PERFDATA))
+		return perfdata;
+
+	for (i = 0; i < span_count; i++) {
+		/* one value for every name, where it first appears */
+		for (j = 0; j < i; j++)
+			if (strcmp (spans[j].name, spans[i].name) == 0)
+				break;
+		if (j < i)
+			continue;
+		if (asprintf (&next, "%s%stiming_%s=%fs;;;0.000000;", perfdata, *perfdata ? " " : "",
+		              spans[i].name, np_span_elapsed (spans[i].name)) < 0)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		free (perfdata);
+		perfdata = next;
+	}
+
+	if (timing_flags & NP_TIMING_RUSAGE) {
+		usage = np_resource_usage ();
+		if (asprintf (&next, "%s%s%s", perfdata, *perfdata ? " " : "", usage) < 0)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		free (perfdata);
+		free (usage);
+		perfdata = next;
+	}
+	return perfdata;
+}
+
+char *
+np_resource_usage (void)
+{
+	struct rusage self, children;
+	char *usage;
+	long maxrss;
+
+	getrusage (RUSAGE_SELF, &self);
+	getrusage (RUSAGE_CHILDREN, &children);
+	maxrss = self.ru_maxrss;
+#ifdef __APPLE__
+	/* bytes there, kilobytes everywhere else */
+	maxrss /= 1024;
+#endif
+	if (asprintf (&usage, "rusage_user=%fs;;;0.000000; rusage_sys=%fs;;;0.000000; "
+	              "rusage_maxrss=%ldKB;;;0; rusage_vcsw=%ld;;;0; rusage_ivcsw=%ld;;;0; "
+	              "rusage_children_user=%fs;;;0.000000; rusage_children_sys=%fs;;;0.000000;",
+	              self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1.0e6,
+	              self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1.0e6,
+	              maxrss, (long) self.ru_nvcsw, (long) self.ru_nivcsw,
+	              children.ru_utime.tv_sec + children.ru_utime.tv_usec / 1.0e6,
+	              children.ru_stime.tv_sec + children.ru_stime.tv_usec / 1.0e6) < 0)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	return usage;
+}
+
+void
+np_timing_trace (FILE *f)
+{
+	double now = np_clock ();
+	size_t i;
+
+	fprintf (f, "timing: %.6fs total\n", now - timing_start);
+	for (i = 0; i < span_count; i++)
+		fprintf (f, "timing: %*s%s %.6fs%s\n", 2 * spans[i].depth + 2, "", spans[i].name,
+		         spans[i].open ? now - spans[i].start : spans[i].elapsed,
+		         spans[i].open ? _(" (not ended)") : "");
+}
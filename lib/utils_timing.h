@@ -0,0 +1,52 @@
+#ifndef _UTILS_TIMING_
+#define _UTILS_TIMING_
+/* Header file for utils_timing: where the time of a check goes */
+
+#include <stdio.h>
+
+/* what np_timing_enable() turns on */
+#define NP_TIMING_PERFDATA 0x1	/* np_timing_perfdata() reports the spans */
+#define NP_TIMING_TRACE    0x2	/* the spans go to stderr on exit */
+#define NP_TIMING_RUSAGE   0x4	/* and what the run cost, see np_resource_usage() */
+#define NP_TIMING_SPANS    0x8	/* the spans are only kept, for np_span_each() */
+
+/* turns on NP_TIMING_RUSAGE when set and not empty */
+#define NP_RESOURCE_USAGE_ENV "MP_RESOURCE_USAGE"
+
+/* Strip --timing-perfdata, --trace-timing and --resource-usage from argv
+ * and turn on what they ask for, the environment may ask for the last one
+ * too. np_extra_opts() does this for the plugins, so the options are known
+ * to all of them. Returns argv. */
+char **np_timing_opts (int *argc, char **argv);
+void np_timing_enable (int flags);
+int np_timing_enabled (void);
+
+/* A span is a named phase of a check, like "dns", "connect" or "tls".
+ * Spans nest: np_span_end() ends the one begun last. The name is kept as
+ * it is, so pass a string constant. Both do nothing unless timing was
+ * turned on. */
+void np_span_begin (const char *name);
+void np_span_end (void);
+
+/* seconds of all the ended spans of that name */
+double np_span_elapsed (const char *name);
+/* calls fn with the seconds of np_span_elapsed() for every span name, in
+ * the order they first began */
+void np_span_each (void (*fn) (const char *name, double seconds, void *arg), void *arg);
+/* forgets the spans, for a process that runs one check after another */
+void np_timing_reset (void);
+
+/* "timing_<name>=<seconds>s;;;0.000000;" for every span name, in the order
+ * they first began, then np_resource_usage() with NP_TIMING_RUSAGE, or ""
+ * without NP_TIMING_PERFDATA */
+char *np_timing_perfdata (void);
+
+/* What the run cost so far as perfdata: user and system CPU time, the
+ * largest resident set, voluntary and involuntary context switches, and the
+ * CPU time of the child processes waited for. */
+char *np_resource_usage (void);
+
+/* every span, indented by how deep it nests */
+void np_timing_trace (FILE *);
+
+#endif /* _UTILS_TIMING_ */
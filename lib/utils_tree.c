@@ -0,0 +1,527 @@
+/*****************************************************************************
+*
+* Monitoring Plugins directory tree utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description :
+*
+* This file holds the walker check_disk sums the size of directory trees
+* with. The directories waiting to be read are on a stack that a pool of
+* threads takes them from, so that the latency of one does not hold up the
+* others. Entries are read with readdir() on a descriptor of the directory,
+* their type comes from d_type where the file system gives it, and only
+* the block count of a file is asked for, with statx() where there is one.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_arena.h"
+#include "utils_tree.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+
+/* how deep the text of np_tree_to_string() may nest */
+#define TREE_MAX_DEPTH 4096
+
+/* a directory to read, and what the last run found in it */
+struct tree_job {
+	np_tree_dir *dir;
+	const np_tree_dir *old;
+	char *path;
+	dev_t dev;		/* of its tree */
+	int root;
+};
+
+typedef struct tree_walker {
+	struct tree_job *jobs;	/* a stack, so that it stays small */
+	size_t count, size;
+	int active;		/* jobs being done */
+	long long now;
+	time_t max_age;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+} tree_walker;
+
+static void
+tree_lock(tree_walker *w)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&w->lock);
+#endif
+}
+
+static void
+tree_unlock(tree_walker *w)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock(&w->lock);
+#endif
+}
+
+static np_tree_dir *
+tree_node(const char *name)
+{
+	np_tree_dir *d;
+
+	if ((d = calloc(1, sizeof(np_tree_dir))) == NULL)
+		return NULL;
+	if ((d->name = strdup(name)) == NULL) {
+		free(d);
+		return NULL;
+	}
+	d->mtime = -1;
+	return d;
+}
+
+static int
+tree_compare(const void *a, const void *b)
+{
+	return strcmp((*(np_tree_dir * const *)a)->name, (*(np_tree_dir * const *)b)->name);
+}
+
+static const np_tree_dir *
+tree_sub(const np_tree_dir *old, const char *name)
+{
+	np_tree_dir key, *k = &key, **found;
+
+	if (old == NULL || old->nsub == 0)
+		return NULL;
+	key.name = (char *)name;
+	found = bsearch(&k, old->sub, old->nsub, sizeof(np_tree_dir *), tree_compare);
+	return found ? *found : NULL;
+}
+
+/* add a subdirectory, doubling the array as it grows */
+static np_tree_dir *
+tree_add_sub(np_tree_dir *d, size_t *size, const char *name)
+{
+	np_tree_dir **sub, *s;
+
+	if (d->nsub == *size) {
+		*size = *size ? *size * 2 : 8;
+		if ((sub = realloc(d->sub, *size * sizeof(np_tree_dir *))) == NULL)
+			return NULL;
+		d->sub = sub;
+	}
+	if ((s = tree_node(name)) == NULL)
+		return NULL;
+	d->sub[d->nsub++] = s;
+	return s;
+}
+
+/* the bytes allocated to an entry, and whether it is a directory when
+ * readdir() did not tell, asking for no more than that */
+static int
+tree_entry(int dfd, const char *name, int need_type, int *is_dir, uintmax_t *bytes)
+{
+#ifdef HAVE_STATX
+	struct statx stx;
+
+	if (statx(dfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC,
+	          need_type ? STATX_TYPE | STATX_BLOCKS : STATX_BLOCKS, &stx) != 0)
+		return FALSE;
+	*is_dir = need_type && S_ISDIR(stx.stx_mode);
+	*bytes = (stx.stx_mask & STATX_BLOCKS) ? (uintmax_t)stx.stx_blocks * 512 : 0;
+#else
+	struct stat st;
+
+	if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+		return FALSE;
+	*is_dir = need_type && S_ISDIR(st.st_mode);
+	*bytes = (uintmax_t)st.st_blocks * 512;
+#endif
+	return TRUE;
+}
+
+/* hand the subdirectories of a directory that was read to the threads */
+static void
+tree_push(tree_walker *w, const struct tree_job *job, const np_tree_dir *old)
+{
+	np_tree_dir *d = job->dir;
+	struct tree_job *jobs;
+	size_t i, len = strlen(job->path);
+	char *path;
+
+	tree_lock(w);
+	for (i = 0; i < d->nsub; i++) {
+		if (w->count == w->size) {
+			w->size = w->size ? w->size * 2 : 64;
+			if ((jobs = realloc(w->jobs, w->size * sizeof(struct tree_job))) == NULL)
+				break;
+			w->jobs = jobs;
+		}
+		if ((path = malloc(len + strlen(d->sub[i]->name) + 2)) == NULL)
+			break;
+		sprintf(path, "%s%s%s", job->path, len && job->path[len - 1] == '/' ? "" : "/", d->sub[i]->name);
+		w->jobs[w->count].dir = d->sub[i];
+		w->jobs[w->count].old = tree_sub(old, d->sub[i]->name);
+		w->jobs[w->count].path = path;
+		w->jobs[w->count].dev = job->dev;
+		w->jobs[w->count].root = FALSE;
+		w->count++;
+	}
+	/* out of memory: the rest is not known */
+	for (; i < d->nsub; i++)
+		d->sub[i]->error = ENOMEM;
+#ifdef HAVE_LIBPTHREAD
+	pthread_cond_broadcast(&w->cond);
+#endif
+	tree_unlock(w);
+}
+
+static void
+tree_read(tree_walker *w, struct tree_job *job)
+{
+	np_tree_dir *d = job->dir;
+	const np_tree_dir *old = job->old;
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	size_t size = 0, i;
+	uintmax_t bytes;
+	int fd, is_dir, need_type;
+
+	fd = open(job->path, O_RDONLY | O_NOCTTY | O_DIRECTORY | (job->root ? 0 : O_NOFOLLOW));
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		d->error = errno;
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	if (job->root)
+		job->dev = st.st_dev;
+	else if (st.st_dev != job->dev) {
+		/* a mount point, which is another file system's */
+		close(fd);
+		return;
+	}
+	d->mtime = st.st_mtime;
+
+	/* unchanged since the last run, the subdirectories are still looked at */
+	if (old && old->error == 0 && old->mtime == d->mtime && old->mtime < old->read_at &&
+	    w->max_age > 0 && w->now - old->read_at <= w->max_age) {
+		close(fd);
+		d->read_at = old->read_at;
+		d->bytes = old->bytes;
+		d->files = old->files;
+		d->cached = TRUE;
+		for (i = 0; i < old->nsub; i++) {
+			if (tree_add_sub(d, &size, old->sub[i]->name) == NULL) {
+				d->error = ENOMEM;
+				break;
+			}
+		}
+		tree_push(w, job, old);
+		return;
+	}
+
+	d->read_at = w->now;
+	d->bytes = (uintmax_t)st.st_blocks * 512;
+	if ((dir = fdopendir(fd)) == NULL) {
+		d->error = errno;
+		close(fd);
+		return;
+	}
+	for (;;) {
+		errno = 0;
+		if ((de = readdir(dir)) == NULL) {
+			if (errno)
+				d->error = errno;
+			break;
+		}
+		if (de->d_name[0] == '.' && (de->d_name[1] == '\0' || (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+			continue;
+#ifdef _DIRENT_HAVE_D_TYPE
+		if (de->d_type == DT_DIR) {
+			if (tree_add_sub(d, &size, de->d_name) == NULL)
+				d->error = ENOMEM;
+			continue;
+		}
+		need_type = de->d_type == DT_UNKNOWN;
+#else
+		need_type = TRUE;
+#endif
+		/* gone since it was listed */
+		if (! tree_entry(dirfd(dir), de->d_name, need_type, &is_dir, &bytes))
+			continue;
+		if (is_dir) {
+			if (tree_add_sub(d, &size, de->d_name) == NULL)
+				d->error = ENOMEM;
+			continue;
+		}
+		d->bytes += bytes;
+		d->files++;
+	}
+	closedir(dir);
+
+	if (d->nsub > 1)
+		qsort(d->sub, d->nsub, sizeof(np_tree_dir *), tree_compare);
+	tree_push(w, job, old);
+}
+
+static void *
+tree_worker(void *arg)
+{
+	tree_walker *w = arg;
+	struct tree_job job;
+
+	tree_lock(w);
+	for (;;) {
+#ifdef HAVE_LIBPTHREAD
+		while (w->count == 0 && w->active > 0)
+			pthread_cond_wait(&w->cond, &w->lock);
+#endif
+		if (w->count == 0)
+			break;
+		job = w->jobs[--w->count];
+		w->active++;
+		tree_unlock(w);
+
+		tree_read(w, &job);
+		free(job.path);
+
+		tree_lock(w);
+		w->active--;
+#ifdef HAVE_LIBPTHREAD
+		if (w->count == 0 && w->active == 0)
+			pthread_cond_broadcast(&w->cond);
+#endif
+	}
+	tree_unlock(w);
+	return NULL;
+}
+
+void
+np_tree_walk(char * const *paths, int count, np_tree_dir * const *cached,
+             np_tree_dir **trees, int threads, time_t max_age)
+{
+	tree_walker w;
+	int i;
+#ifdef HAVE_LIBPTHREAD
+	pthread_t *tids = NULL;
+	int started = 0;
+#endif
+
+	memset(&w, 0, sizeof(w));
+	w.now = time(NULL);
+	w.max_age = max_age;
+	if ((w.jobs = malloc((count > 0 ? count : 1) * sizeof(struct tree_job))) == NULL) {
+		for (i = 0; i < count; i++)
+			trees[i] = NULL;
+		return;
+	}
+	w.size = count > 0 ? count : 1;
+	for (i = count - 1; i >= 0; i--) {
+		if ((trees[i] = tree_node(paths[i])) == NULL)
+			continue;
+		if ((w.jobs[w.count].path = strdup(paths[i])) == NULL) {
+			trees[i]->error = ENOMEM;
+			continue;
+		}
+		w.jobs[w.count].dir = trees[i];
+		w.jobs[w.count].old = cached ? cached[i] : NULL;
+		w.jobs[w.count].dev = 0;
+		w.jobs[w.count].root = TRUE;
+		w.count++;
+	}
+
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_cond_init(&w.cond, NULL);
+	if (threads > 1 && (tids = malloc((threads - 1) * sizeof(pthread_t))) != NULL)
+		for (started = 0; started < threads - 1; started++)
+			if (pthread_create(&tids[started], NULL, tree_worker, &w) != 0)
+				break;
+	tree_worker(&w);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+	pthread_cond_destroy(&w.cond);
+	pthread_mutex_destroy(&w.lock);
+#else
+	tree_worker(&w);
+#endif
+	free(w.jobs);
+}
+
+void
+np_tree_sum(const np_tree_dir *tree, np_tree_total *total)
+{
+	size_t i;
+
+	if (tree == NULL) {
+		total->errors++;
+		return;
+	}
+	total->bytes += tree->bytes;
+	total->files += tree->files;
+	total->dirs++;
+	if (tree->cached)
+		total->dirs_cached++;
+	if (tree->error)
+		total->errors++;
+	for (i = 0; i < tree->nsub; i++)
+		np_tree_sum(tree->sub[i], total);
+}
+
+/* a line of the directory and how many of its subdirectories follow,
+ * each with theirs; one that cannot be on a line is left out, and the
+ * directory written so that it is read again */
+static void
+tree_write(np_str *s, const np_tree_dir *d)
+{
+	size_t i, nsub = 0;
+	int usable = d->error == 0;
+
+	for (i = 0; i < d->nsub; i++) {
+		if (strchr(d->sub[i]->name, '\n'))
+			usable = FALSE;
+		else
+			nsub++;
+	}
+	np_str_printf(s, "%lu %lld %lld %ju %ju %s\n", (unsigned long)nsub, usable ? d->mtime : -1LL,
+	              d->read_at, d->bytes, d->files, d->name);
+	for (i = 0; i < d->nsub; i++)
+		if (strchr(d->sub[i]->name, '\n') == NULL)
+			tree_write(s, d->sub[i]);
+}
+
+char *
+np_tree_to_string(np_tree_dir * const *trees, int count)
+{
+	np_str s = NP_STR_INIT;
+	int i, n = 0;
+
+	for (i = 0; i < count; i++)
+		if (trees[i] && strchr(trees[i]->name, '\n') == NULL)
+			n++;
+	np_str_printf(&s, "tree %d\n", n);
+	for (i = 0; i < count; i++)
+		if (trees[i] && strchr(trees[i]->name, '\n') == NULL)
+			tree_write(&s, trees[i]);
+	return (char *)np_str_string(&s);
+}
+
+/* the shortest line there is, to tell a count that cannot be right */
+#define TREE_MIN_LINE 12
+
+static np_tree_dir *
+tree_parse(const char **text, const char *limit, int depth)
+{
+	const char *p = *text, *eol;
+	char *end;
+	unsigned long nsub, i;
+	np_tree_dir *d;
+
+	if (depth > TREE_MAX_DEPTH || (eol = strchr(p, '\n')) == NULL)
+		return NULL;
+	if ((d = calloc(1, sizeof(np_tree_dir))) == NULL)
+		return NULL;
+	nsub = strtoul(p, &end, 10);
+	if (*end != ' ')
+		goto fail;
+	d->mtime = strtoll(end + 1, &end, 10);
+	if (*end != ' ')
+		goto fail;
+	d->read_at = strtoll(end + 1, &end, 10);
+	if (*end != ' ')
+		goto fail;
+	d->bytes = strtoumax(end + 1, &end, 10);
+	if (*end != ' ')
+		goto fail;
+	d->files = strtoumax(end + 1, &end, 10);
+	if (*end != ' ' || end + 1 >= eol || nsub > (unsigned long)(limit - eol) / TREE_MIN_LINE)
+		goto fail;
+	if ((d->name = strndup(end + 1, eol - end - 1)) == NULL)
+		goto fail;
+	*text = eol + 1;
+
+	if (nsub && (d->sub = calloc(nsub, sizeof(np_tree_dir *))) == NULL)
+		goto fail;
+	for (i = 0; i < nsub; i++) {
+		if ((d->sub[i] = tree_parse(text, limit, depth + 1)) == NULL)
+			goto fail;
+		d->nsub++;
+	}
+	return d;
+
+fail:
+	np_tree_free(d);
+	return NULL;
+}
+
+int
+np_tree_from_string(const char *text, np_tree_dir ***trees)
+{
+	const char *limit = text + strlen(text);
+	char *end;
+	long count, i;
+
+	*trees = NULL;
+	if (strncmp(text, "tree ", 5) != 0)
+		return -1;
+	count = strtol(text + 5, &end, 10);
+	if (count < 0 || *end != '\n' || count > (limit - end) / TREE_MIN_LINE)
+		return -1;
+	text = end + 1;
+	if ((*trees = calloc(count > 0 ? count : 1, sizeof(np_tree_dir *))) == NULL)
+		return -1;
+	for (i = 0; i < count; i++) {
+		if (((*trees)[i] = tree_parse(&text, limit, 0)) == NULL) {
+			while (i-- > 0)
+				np_tree_free((*trees)[i]);
+			free(*trees);
+			*trees = NULL;
+			return -1;
+		}
+	}
+	return (int)count;
+}
+
+np_tree_dir *
+np_tree_find(np_tree_dir * const *trees, int count, const char *path)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (trees[i] && strcmp(trees[i]->name, path) == 0)
+			return trees[i];
+	return NULL;
+}
+
+void
+np_tree_free(np_tree_dir *tree)
+{
+	size_t i;
+
+	if (tree == NULL)
+		return;
+	for (i = 0; i < tree->nsub; i++)
+		np_tree_free(tree->sub[i]);
+	free(tree->sub);
+	free(tree->name);
+	free(tree);
+}
@@ -0,0 +1,62 @@
+#ifndef _UTILS_TREE_
+#define _UTILS_TREE_
+
+/*
+ * Header file for Monitoring Plugins utils_tree.c
+ *
+ * The size of directory trees, walked by a pool of threads. What a
+ * directory holds besides its subdirectories is kept between runs keyed
+ * by its mtime, which changes whenever an entry is added, removed or
+ * renamed: a directory whose mtime is the same as in the last run is not
+ * read again and its files are not looked at, only its subdirectories.
+ * A file that grows in place does not change the mtime of its directory,
+ * so a directory is taken from the cache for at most max_age seconds, and
+ * never if it changed in the second it was read, as mtimes are compared
+ * in seconds.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct np_tree_dir {
+	char *name;		/* the path of a tree, the entry name below it */
+	long long mtime;
+	long long read_at;	/* when its entries were last read */
+	uintmax_t bytes;	/* allocated to it and the files in it */
+	uintmax_t files;	/* its entries that are not directories */
+	size_t nsub;
+	struct np_tree_dir **sub;	/* its subdirectories, sorted by name */
+	int error;		/* errno of reading it, or 0 */
+	int cached;		/* its entries came from the cache */
+} np_tree_dir;
+
+/* what np_tree_sum() adds of a tree found by np_tree_walk() to a total */
+typedef struct np_tree_total {
+	uintmax_t bytes;
+	uintmax_t files;
+	uintmax_t dirs;
+	uintmax_t dirs_cached;	/* of them not read again */
+	uintmax_t errors;	/* directories that could not be read */
+} np_tree_total;
+
+/* Walks the trees at paths[] with up to threads threads, staying on the
+ * file system each starts on. cached[] is what the last run found for
+ * each or NULL, and a directory in it is used as it was if its mtime did
+ * not change and it was read at most max_age seconds ago, never if that
+ * is 0. The new trees are in trees[], which the next run can be given as
+ * cached[]. */
+void np_tree_walk(char * const *paths, int count, np_tree_dir * const *cached,
+                  np_tree_dir **trees, int threads, time_t max_age);
+void np_tree_sum(const np_tree_dir *tree, np_tree_total *total);
+
+/* The trees as text for a state file, in the arena, and back.
+ * np_tree_from_string() returns how many trees it read into *trees, or -1
+ * if the text is not what np_tree_to_string() wrote. */
+char *np_tree_to_string(np_tree_dir * const *trees, int count);
+int np_tree_from_string(const char *text, np_tree_dir ***trees);
+/* the tree of that path among them, or NULL */
+np_tree_dir *np_tree_find(np_tree_dir * const *trees, int count, const char *path);
+void np_tree_free(np_tree_dir *tree);
+
+#endif /* _UTILS_TREE_ */
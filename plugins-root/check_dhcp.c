@@ -64,6 +64,8 @@ const char *email = "devel@monitoring-plugins.org";
 #if defined( __linux__ )
 
 #include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
 #include <features.h>
 
 #elif defined (__bsd__)
@@ -150,7 +152,21 @@ typedef struct dhcp_packet_struct{
         }dhcp_packet;
 
 
+typedef struct dhcp_interface_struct{
+	char name[IFNAMSIZ];
+	int sock;                         /* socket bound to this interface */
+	int rsock;                        /* socket the offers are read from */
+	unsigned char hardware_address[MAX_DHCP_CHADDR_LENGTH];
+	struct in_addr ip;                /* our address (required for relay) */
+	u_int32_t xid;                    /* transaction id of our DHCPDISCOVER */
+	int valid_responses;              /* number of valid DHCPOFFERs received */
+	int requested_responses;          /* number of requested servers that answered */
+	int received_requested_address;
+	        }dhcp_interface;
+
+
 typedef struct dhcp_offer_struct{
+	dhcp_interface *iface;           /* interface the offer came in on */
 	struct in_addr server_address;   /* address of DHCP server that sent this offer */
 	struct in_addr offered_address;  /* the IP address that was offered to us */
 	u_int32_t lease_time;            /* lease time in seconds */
@@ -162,7 +178,6 @@ typedef struct dhcp_offer_struct{
 
 typedef struct requested_server_struct{
 	struct in_addr server_address;
-	int answered;
 	struct requested_server_struct *next;
         }requested_server;
 
@@ -198,15 +213,16 @@ typedef struct requested_server_struct{
 #define ETHERNET_HARDWARE_ADDRESS            1     /* used in htype field of dhcp packet */
 #define ETHERNET_HARDWARE_ADDRESS_LENGTH     6     /* length of Ethernet hardware addresses */
 
+#define MAX_DHCP_INTERFACES 4096  /* interfaces probed at once */
+#define MAX_LISTED_INTERFACES 10  /* interfaces named in the output */
+
 u_int8_t unicast = 0;        /* unicast mode: mimic a DHCP relay */
-struct in_addr my_ip;        /* our address (required for relay) */
+int packet_mode = FALSE;     /* read the offers from a filtered packet socket */
 struct in_addr dhcp_ip;      /* server to query (if in unicast mode) */
-unsigned char client_hardware_address[MAX_DHCP_CHADDR_LENGTH]="";
 unsigned char *user_specified_mac=NULL;
 
-char network_interface_name[IFNAMSIZ]="eth0";
-
-u_int32_t packet_xid=0;
+dhcp_interface *interfaces=NULL;
+int num_interfaces=0;
 
 u_int32_t dhcp_lease_time=0;
 u_int32_t dhcp_renewal_time=0;
@@ -217,12 +233,10 @@ int dhcpoffer_timeout=2;
 dhcp_offer *dhcp_offer_list=NULL;
 requested_server *requested_server_list=NULL;
 
-int valid_responses=0;     /* number of valid DHCPOFFERs we received */
+int valid_responses=0;     /* number of valid DHCPOFFERs we received on all interfaces */
 int requested_servers=0;
-int requested_responses=0;
 
 int request_specific_address=FALSE;
-int received_requested_address=FALSE;
 int verbose=0;
 struct in_addr requested_address;
 
@@ -236,32 +250,36 @@ void print_help(void);
 void resolve_host(const char *in,struct in_addr *out);
 unsigned char *mac_aton(const char *);
 void print_hardware_address(const unsigned char *);
-int get_hardware_address(int,char *);
-int get_ip_address(int,char *);
+int get_hardware_address(int,char *,unsigned char *);
+int get_ip_address(int,char *,struct in_addr *);
 
-int send_dhcp_discover(int);
-int get_dhcp_offer(int);
+int add_interface(const char *);
+int send_dhcp_discover(dhcp_interface *);
+int get_dhcp_offer(void);
+int all_requested_servers_answered(void);
 
+int get_interface_results(dhcp_interface *,u_int32_t *);
 int get_results(void);
 
-int add_dhcp_offer(struct in_addr,dhcp_packet *);
+int add_dhcp_offer(dhcp_interface *,struct in_addr,dhcp_packet *);
 int free_dhcp_offer_list(void);
 int free_requested_server_list(void);
 
-int create_dhcp_socket(void);
+int create_dhcp_socket(dhcp_interface *);
+int create_packet_socket(dhcp_interface *);
 int close_dhcp_socket(int);
 int send_dhcp_packet(void *,int,int,struct sockaddr_in *);
 int receive_dhcp_packet(void *,int,int,int,struct sockaddr_in *);
+int receive_packet_socket(void *,int,int,struct sockaddr_in *);
 
 
 
 int main(int argc, char **argv){
-	int dhcp_socket;
+	dhcp_interface *iface;
 	int result = STATE_UNKNOWN;
+	int i, j;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts(&argc, argv, progname);
@@ -270,26 +288,52 @@ int main(int argc, char **argv){
 		usage4 (_("Could not parse arguments"));
 		}
 
-	/* create socket for DHCP communications */
-	dhcp_socket=create_dhcp_socket();
+	if(num_interfaces==0)
+		add_interface("eth0");
 
-	/* get hardware address of client machine */
-	if(user_specified_mac!=NULL)
-		memcpy(client_hardware_address,user_specified_mac,6);
-	else
-		get_hardware_address(dhcp_socket,network_interface_name);
+	/*
+	 * transaction ID is supposed to be random, and tells apart the
+	 * offers for each interface
+	 */
+	srand(time(NULL)^getpid());
 
-	if(unicast) /* get IP address of client machine */
-		get_ip_address(dhcp_socket,network_interface_name);
+	for(i=0;i<num_interfaces;i++){
+		iface=&interfaces[i];
 
-	/* send DHCPDISCOVER packet */
-	send_dhcp_discover(dhcp_socket);
+		/* create socket for DHCP communications */
+		iface->sock=create_dhcp_socket(iface);
 
-	/* wait for a DHCPOFFER packet */
-	get_dhcp_offer(dhcp_socket);
+		/* get hardware address of client machine */
+		if(user_specified_mac!=NULL)
+			memcpy(iface->hardware_address,user_specified_mac,6);
+		else
+			get_hardware_address(iface->sock,iface->name,iface->hardware_address);
 
-	/* close socket we created */
-	close_dhcp_socket(dhcp_socket);
+		if(unicast) /* get IP address of client machine */
+			get_ip_address(iface->sock,iface->name,&iface->ip);
+
+		do{
+			iface->xid=random();
+			for(j=0;j<i && interfaces[j].xid!=iface->xid;j++);
+			}while(j<i);
+
+		/* the kernel passes on only the offers with our transaction id */
+		iface->rsock = packet_mode ? create_packet_socket(iface) : iface->sock;
+		}
+
+	/* send DHCPDISCOVER packets on all interfaces before waiting for any answer */
+	for(i=0;i<num_interfaces;i++)
+		send_dhcp_discover(&interfaces[i]);
+
+	/* wait for DHCPOFFER packets */
+	get_dhcp_offer();
+
+	/* close sockets we created */
+	for(i=0;i<num_interfaces;i++){
+		if(interfaces[i].rsock!=interfaces[i].sock)
+			close_dhcp_socket(interfaces[i].rsock);
+		close_dhcp_socket(interfaces[i].sock);
+		}
 
 	/* determine state/plugin output to return */
 	result=get_results();
@@ -297,6 +341,7 @@ int main(int argc, char **argv){
 	/* free allocated memory */
 	free_dhcp_offer_list();
 	free_requested_server_list();
+	free(interfaces);
 
 	return result;
         }
@@ -304,7 +349,7 @@ int main(int argc, char **argv){
 
 
 /* determines hardware address on client machine */
-int get_hardware_address(int sock,char *interface_name){
+int get_hardware_address(int sock,char *interface_name,unsigned char *hardware_address){
 
 #if defined(__linux__)
 	struct ifreq ifr;
@@ -318,7 +363,7 @@ int get_hardware_address(int sock,char *interface_name){
 		exit(STATE_UNKNOWN);
 	        }
 
-	memcpy(&client_hardware_address[0],&ifr.ifr_hwaddr.sa_data,6);
+	memcpy(hardware_address,&ifr.ifr_hwaddr.sa_data,6);
 
 #elif defined(__bsd__)
 						/* King 2004	see ACKNOWLEDGEMENTS */
@@ -359,7 +404,7 @@ int get_hardware_address(int sock,char *interface_name){
         ifm = (struct if_msghdr *)buf;
         sdl = (struct sockaddr_dl *)(ifm + 1);
         ptr = (unsigned char *)LLADDR(sdl);
-        memcpy(&client_hardware_address[0], ptr, 6) ;
+        memcpy(hardware_address, ptr, 6) ;
 						/* King 2004 */
 
 #elif defined(__sun__) || defined(__solaris__)
@@ -386,7 +431,7 @@ int get_hardware_address(int sock,char *interface_name){
 		printf(_("Error: can't find unit number in interface_name (%s) - expecting TypeNumber eg lnc0.\n"), interface_name);
 		exit(STATE_UNKNOWN);
 		}
-	stat = mac_addr_dlpi(dev, unit, client_hardware_address);
+	stat = mac_addr_dlpi(dev, unit, hardware_address);
 	if(stat != 0){
 		printf(_("Error: can't read MAC address from DLPI streams interface for device %s unit %d.\n"), dev, unit);
 		exit(STATE_UNKNOWN);
@@ -398,7 +443,7 @@ int get_hardware_address(int sock,char *interface_name){
 	char dev[20] = "/dev/dlpi" ;
 	int unit = 0;
 
-	stat = mac_addr_dlpi(dev, unit, client_hardware_address);
+	stat = mac_addr_dlpi(dev, unit, hardware_address);
 	if(stat != 0){
 		printf(_("Error: can't read MAC address from DLPI streams interface for device %s unit %d.\n"), dev, unit);
 		exit(STATE_UNKNOWN);
@@ -411,13 +456,13 @@ int get_hardware_address(int sock,char *interface_name){
 #endif
 
 	if(verbose)
-		print_hardware_address(client_hardware_address);
+		print_hardware_address(hardware_address);
 
 	return OK;
         }
 
 /* determines IP address of the client interface */
-int get_ip_address(int sock,char *interface_name){
+int get_ip_address(int sock,char *interface_name,struct in_addr *ip){
 #if defined(SIOCGIFADDR)
 	struct ifreq ifr;
 
@@ -430,7 +475,7 @@ int get_ip_address(int sock,char *interface_name){
 		exit(STATE_UNKNOWN);
 		}
 
-	my_ip=((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr;
+	*ip=((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr;
 
 #else
 	printf(_("Error: Cannot get interface IP address on this platform.\n"));
@@ -438,13 +483,33 @@ int get_ip_address(int sock,char *interface_name){
 #endif
 
 	if(verbose)
-		printf(_("Pretending to be relay client %s\n"),inet_ntoa(my_ip));
+		printf(_("Pretending to be relay client %s\n"),inet_ntoa(*ip));
+
+	return OK;
+	}
+
+/* adds an interface to probe, the list is fixed once arguments are parsed */
+int add_interface(const char *name){
+	dhcp_interface *new_interfaces;
+
+	if(num_interfaces>=MAX_DHCP_INTERFACES)
+		usage4(_("Too many interfaces"));
+
+	new_interfaces=realloc(interfaces,(num_interfaces+1)*sizeof(dhcp_interface));
+	if(new_interfaces==NULL)
+		return ERROR;
+	interfaces=new_interfaces;
+
+	bzero(&interfaces[num_interfaces],sizeof(dhcp_interface));
+	strncpy(interfaces[num_interfaces].name,name,sizeof(interfaces[num_interfaces].name)-1);
+	interfaces[num_interfaces].sock=-1;
+	num_interfaces++;
 
 	return OK;
 	}
 
 /* sends a DHCPDISCOVER broadcast message in an attempt to find DHCP servers */
-int send_dhcp_discover(int sock){
+int send_dhcp_discover(dhcp_interface *iface){
 	dhcp_packet discover_packet;
 	struct sockaddr_in sockaddr_broadcast;
     unsigned short opts;
@@ -463,12 +528,8 @@ int send_dhcp_discover(int sock){
 	/* length of our hardware address */
 	discover_packet.hlen=ETHERNET_HARDWARE_ADDRESS_LENGTH;
 
-	/*
-	 * transaction ID is supposed to be random.
-	 */
-	srand(time(NULL)^getpid());
-	packet_xid=random();
-	discover_packet.xid=htonl(packet_xid);
+	/* transaction ID, see main() */
+	discover_packet.xid=htonl(iface->xid);
 
 	/**** WHAT THE HECK IS UP WITH THIS?!?  IF I DON'T MAKE THIS CALL, ONLY ONE SERVER RESPONSE IS PROCESSED!!!! ****/
 	/* downright bizzarre... */
@@ -484,7 +545,7 @@ int send_dhcp_discover(int sock){
 	discover_packet.flags = unicast ? 0 : htons(DHCP_BROADCAST_FLAG);
 
 	/* our hardware address */
-	memcpy(discover_packet.chaddr,client_hardware_address,ETHERNET_HARDWARE_ADDRESS_LENGTH);
+	memcpy(discover_packet.chaddr,iface->hardware_address,ETHERNET_HARDWARE_ADDRESS_LENGTH);
 
 	/* first four bytes of options field is magic cookie (as per RFC 2132) */
 	discover_packet.options[0]='\x63';
@@ -509,7 +570,7 @@ int send_dhcp_discover(int sock){
 
 	/* unicast fields */
 	if(unicast)
-		discover_packet.giaddr.s_addr = my_ip.s_addr;
+		discover_packet.giaddr.s_addr = iface->ip.s_addr;
 
 	/* see RFC 1542, 4.1.1 */
 	discover_packet.hops = unicast ? 1 : 0;
@@ -522,7 +583,7 @@ int send_dhcp_discover(int sock){
 
 
 	if(verbose){
-		printf(_("DHCPDISCOVER to %s port %d\n"),inet_ntoa(sockaddr_broadcast.sin_addr),ntohs(sockaddr_broadcast.sin_port));
+		printf(_("DHCPDISCOVER to %s port %d on %s\n"),inet_ntoa(sockaddr_broadcast.sin_addr),ntohs(sockaddr_broadcast.sin_port),iface->name);
 		printf("DHCPDISCOVER XID: %u (0x%X)\n",ntohl(discover_packet.xid),ntohl(discover_packet.xid));
 		printf("DHCDISCOVER ciaddr:  %s\n",inet_ntoa(discover_packet.ciaddr));
 		printf("DHCDISCOVER yiaddr:  %s\n",inet_ntoa(discover_packet.yiaddr));
@@ -531,7 +592,7 @@ int send_dhcp_discover(int sock){
 		}
 
 	/* send the DHCPDISCOVER packet out */
-	send_dhcp_packet(&discover_packet,sizeof(discover_packet),sock,&sockaddr_broadcast);
+	send_dhcp_packet(&discover_packet,sizeof(discover_packet),iface->sock,&sockaddr_broadcast);
 
 	if(verbose)
 		printf("\n\n");
@@ -542,101 +603,150 @@ int send_dhcp_discover(int sock){
 
 
 
-/* waits for a DHCPOFFER message from one or more DHCP servers */
-int get_dhcp_offer(int sock){
+/*
+ * waits for DHCPOFFER messages from one or more DHCP servers on all
+ * interfaces at once, until the timeout or until every requested server
+ * has answered on every interface
+ */
+int get_dhcp_offer(void){
 	dhcp_packet offer_packet;
+	dhcp_interface *iface;
+	struct pollfd *pfds;
 	struct sockaddr_in source;
 	struct sockaddr_in via;
+	struct timeval start_time;
 	int result=OK;
 	int responses=0;
+	int remaining;
+	int nfound;
+	int i;
 	int x;
-	time_t start_time;
-	time_t current_time;
 
-	time(&start_time);
+	pfds=calloc(num_interfaces,sizeof(struct pollfd));
+	if(pfds==NULL)
+		die(STATE_UNKNOWN,_("Could not allocate memory\n"));
+	for(i=0;i<num_interfaces;i++){
+		pfds[i].fd=interfaces[i].rsock;
+		pfds[i].events=POLLIN;
+		}
+
+	gettimeofday(&start_time,NULL);
 
 	/* receive as many responses as we can */
 	for(responses=0,valid_responses=0;;){
 
-		time(&current_time);
-		if((current_time-start_time)>=dhcpoffer_timeout)
+		/* no need to wait out the timeout once everyone we asked for has answered */
+		if(all_requested_servers_answered()){
+			if(verbose)
+				printf(_("All requested servers responded on all interfaces\n"));
 			break;
+			}
 
-		if(verbose)
-			printf("\n\n");
+		remaining=dhcpoffer_timeout*1000-deltime(start_time)/1000;
+		if(remaining<=0)
+			break;
 
-		bzero(&source,sizeof(source));
-		bzero(&via,sizeof(via));
-		bzero(&offer_packet,sizeof(offer_packet));
+		nfound=poll(pfds,num_interfaces,remaining);
+		if(nfound<0 && errno!=EINTR)
+			die(STATE_UNKNOWN,_("poll() failed: %s\n"),strerror(errno));
+		if(nfound<=0){
+			if(verbose)
+				printf(_("No (more) data received (nfound: %d)\n"), nfound);
+			continue;
+			}
 
-		result=OK;
-		result=receive_dhcp_packet(&offer_packet,sizeof(offer_packet),sock,dhcpoffer_timeout,&source);
+		for(i=0;i<num_interfaces;i++){
 
-		if(result!=OK){
-			if(verbose)
-				printf(_("Result=ERROR\n"));
+			if(!(pfds[i].revents&POLLIN))
+				continue;
+			iface=&interfaces[i];
 
-			continue;
-		        }
-		else{
 			if(verbose)
-				printf(_("Result=OK\n"));
+				printf("\n\n");
 
-			responses++;
-		        }
+			bzero(&source,sizeof(source));
+			bzero(&via,sizeof(via));
+			bzero(&offer_packet,sizeof(offer_packet));
 
-		/* The "source" is either a server or a relay. */
-		/* Save a copy of "source" into "via" even if it's via itself */
-		memcpy(&via,&source,sizeof(source)) ;
+			result=OK;
+			if(packet_mode)
+				result=receive_packet_socket(&offer_packet,sizeof(offer_packet),iface->rsock,&source);
+			else
+				result=receive_dhcp_packet(&offer_packet,sizeof(offer_packet),iface->sock,0,&source);
 
-		if(verbose){
-			printf(_("DHCPOFFER from IP address %s"),inet_ntoa(source.sin_addr));
-			printf(_(" via %s\n"),inet_ntoa(via.sin_addr));
-			printf("DHCPOFFER XID: %u (0x%X)\n",ntohl(offer_packet.xid),ntohl(offer_packet.xid));
-			}
+			if(result!=OK){
+				if(verbose)
+					printf(_("Result=ERROR\n"));
 
-		/* check packet xid to see if its the same as the one we used in the discover packet */
-		if(ntohl(offer_packet.xid)!=packet_xid){
-			if(verbose)
-				printf(_("DHCPOFFER XID (%u) did not match DHCPDISCOVER XID (%u) - ignoring packet\n"),ntohl(offer_packet.xid),packet_xid);
+				continue;
+			        }
+			else{
+				if(verbose)
+					printf(_("Result=OK\n"));
 
-			continue;
-		        }
+				responses++;
+			        }
 
-		/* check hardware address */
-		result=OK;
-		if(verbose)
-			printf("DHCPOFFER chaddr: ");
+			/* The "source" is either a server or a relay. */
+			/* Save a copy of "source" into "via" even if it's via itself */
+			memcpy(&via,&source,sizeof(source)) ;
+
+			if(verbose){
+				printf(_("DHCPOFFER from IP address %s"),inet_ntoa(source.sin_addr));
+				printf(_(" via %s on %s\n"),inet_ntoa(via.sin_addr),iface->name);
+				printf("DHCPOFFER XID: %u (0x%X)\n",ntohl(offer_packet.xid),ntohl(offer_packet.xid));
+				}
 
-		for(x=0;x<ETHERNET_HARDWARE_ADDRESS_LENGTH;x++){
+			/*
+			 * check packet xid to see if its the same as the one we used in the
+			 * discover packet on this interface. Where sockets are not bound to
+			 * a device each of them sees the broadcasts for all interfaces.
+			 */
+			if(ntohl(offer_packet.xid)!=iface->xid){
+				if(verbose)
+					printf(_("DHCPOFFER XID (%u) did not match DHCPDISCOVER XID (%u) - ignoring packet\n"),ntohl(offer_packet.xid),iface->xid);
+
+				continue;
+			        }
+
+			/* check hardware address */
+			result=OK;
 			if(verbose)
-				printf("%02X",(unsigned char)offer_packet.chaddr[x]);
+				printf("DHCPOFFER chaddr: ");
 
-			if(offer_packet.chaddr[x]!=client_hardware_address[x])
-				result=ERROR;
-			}
-		if(verbose)
-			printf("\n");
+			for(x=0;x<ETHERNET_HARDWARE_ADDRESS_LENGTH;x++){
+				if(verbose)
+					printf("%02X",(unsigned char)offer_packet.chaddr[x]);
 
-		if(result==ERROR){
+				if(offer_packet.chaddr[x]!=iface->hardware_address[x])
+					result=ERROR;
+				}
 			if(verbose)
-				printf(_("DHCPOFFER hardware address did not match our own - ignoring packet\n"));
+				printf("\n");
 
-			continue;
-		        }
+			if(result==ERROR){
+				if(verbose)
+					printf(_("DHCPOFFER hardware address did not match our own - ignoring packet\n"));
 
-		if(verbose){
-			printf("DHCPOFFER ciaddr: %s\n",inet_ntoa(offer_packet.ciaddr));
-			printf("DHCPOFFER yiaddr: %s\n",inet_ntoa(offer_packet.yiaddr));
-			printf("DHCPOFFER siaddr: %s\n",inet_ntoa(offer_packet.siaddr));
-			printf("DHCPOFFER giaddr: %s\n",inet_ntoa(offer_packet.giaddr));
-			}
+				continue;
+			        }
 
-		add_dhcp_offer(source.sin_addr,&offer_packet);
+			if(verbose){
+				printf("DHCPOFFER ciaddr: %s\n",inet_ntoa(offer_packet.ciaddr));
+				printf("DHCPOFFER yiaddr: %s\n",inet_ntoa(offer_packet.yiaddr));
+				printf("DHCPOFFER siaddr: %s\n",inet_ntoa(offer_packet.siaddr));
+				printf("DHCPOFFER giaddr: %s\n",inet_ntoa(offer_packet.giaddr));
+				}
+
+			add_dhcp_offer(iface,source.sin_addr,&offer_packet);
 
-		valid_responses++;
+			iface->valid_responses++;
+			valid_responses++;
+			}
 	        }
 
+	free(pfds);
+
 	if(verbose){
 		printf(_("Total responses seen on the wire: %d\n"),responses);
 		printf(_("Valid responses for this machine: %d\n"),valid_responses);
@@ -646,6 +756,24 @@ int get_dhcp_offer(int sock){
         }
 
 
+/* TRUE once each interface has offers from all requested servers, and of the requested address */
+int all_requested_servers_answered(void){
+	int i;
+
+	if(requested_servers==0)
+		return FALSE;
+
+	for(i=0;i<num_interfaces;i++){
+		if(interfaces[i].requested_responses<requested_servers)
+			return FALSE;
+		if(request_specific_address==TRUE && interfaces[i].received_requested_address==FALSE)
+			return FALSE;
+		}
+
+	return TRUE;
+	}
+
+
 
 /* sends a DHCP packet */
 int send_dhcp_packet(void *buffer, int buffer_size, int sock, struct sockaddr_in *dest){
@@ -721,7 +849,7 @@ int receive_dhcp_packet(void *buffer, int buffer_size, int sock, int timeout, st
 
 
 /* creates a socket for DHCP communication */
-int create_dhcp_socket(void){
+int create_dhcp_socket(dhcp_interface *iface){
         struct sockaddr_in myname;
 	struct ifreq interface;
         int sock;
@@ -732,7 +860,7 @@ int create_dhcp_socket(void){
         myname.sin_family=AF_INET;
         /* listen to DHCP server port if we're in unicast mode */
         myname.sin_port = htons(unicast ? DHCP_SERVER_PORT : DHCP_CLIENT_PORT);
-        myname.sin_addr.s_addr = unicast ? my_ip.s_addr : INADDR_ANY;
+        myname.sin_addr.s_addr = unicast ? iface->ip.s_addr : INADDR_ANY;
         bzero(&myname.sin_zero,sizeof(myname.sin_zero));
 
         /* create a socket for DHCP communications */
@@ -760,15 +888,15 @@ int create_dhcp_socket(void){
 
 	/* bind socket to interface */
 #if defined(__linux__)
-	strncpy(interface.ifr_ifrn.ifrn_name,network_interface_name,IFNAMSIZ-1);
+	strncpy(interface.ifr_ifrn.ifrn_name,iface->name,IFNAMSIZ-1);
 	interface.ifr_ifrn.ifrn_name[IFNAMSIZ-1]='\0';
 	if(setsockopt(sock,SOL_SOCKET,SO_BINDTODEVICE,(char *)&interface,sizeof(interface))<0){
-		printf(_("Error: Could not bind socket to interface %s.  Check your privileges...\n"),network_interface_name);
+		printf(_("Error: Could not bind socket to interface %s.  Check your privileges...\n"),iface->name);
 		exit(STATE_UNKNOWN);
 	        }
 
 #else
-	strncpy(interface.ifr_name,network_interface_name,IFNAMSIZ-1);
+	strncpy(interface.ifr_name,iface->name,IFNAMSIZ-1);
 	interface.ifr_name[IFNAMSIZ-1]='\0';
 #endif
 
@@ -782,6 +910,115 @@ int create_dhcp_socket(void){
         }
 
 
+#if defined(__linux__)
+/*
+ * Offsets in what a SOCK_DGRAM packet socket reads, the IPv4 header on: the
+ * UDP header follows the IP header, and the transaction id follows op,
+ * htype, hlen and hops in the DHCP message.
+ */
+#define IP_PROTOCOL_OFFSET   9
+#define IP_FRAGMENT_OFFSET   6
+#define UDP_DEST_PORT_OFFSET 2
+#define UDP_HEADER_LENGTH    8
+#define DHCP_XID_OFFSET      (UDP_HEADER_LENGTH + 4)
+
+/*
+ * creates a packet socket on the interface that only sees the answers to
+ * our DHCPDISCOVER: other probes on the same host get the frames too, so
+ * none of them has to win port 68 to see its offers
+ */
+int create_packet_socket(dhcp_interface *iface){
+	struct sock_filter code[] = {
+		/* UDP, not a fragment */
+		BPF_STMT(BPF_LD+BPF_B+BPF_ABS, IP_PROTOCOL_OFFSET),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, IPPROTO_UDP, 0, 8),
+		BPF_STMT(BPF_LD+BPF_H+BPF_ABS, IP_FRAGMENT_OFFSET),
+		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, 0x1fff, 6, 0),
+		/* to the port we listen on */
+		BPF_STMT(BPF_LDX+BPF_B+BPF_MSH, 0),
+		BPF_STMT(BPF_LD+BPF_H+BPF_IND, UDP_DEST_PORT_OFFSET),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, unicast ? DHCP_SERVER_PORT : DHCP_CLIENT_PORT, 0, 3),
+		/* with our transaction id */
+		BPF_STMT(BPF_LD+BPF_W+BPF_IND, DHCP_XID_OFFSET),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, iface->xid, 0, 1),
+		BPF_STMT(BPF_RET+BPF_K, 0xffff),
+		BPF_STMT(BPF_RET+BPF_K, 0),
+		};
+	struct sock_fprog filter;
+	struct sockaddr_ll address;
+	int sock;
+
+	/* nothing is received before the filter is attached and it is bound */
+	sock=socket(AF_PACKET,SOCK_DGRAM,0);
+	if(sock<0){
+		printf(_("Error: Could not create packet socket: %s\n"),strerror(errno));
+		exit(STATE_UNKNOWN);
+		}
+
+	filter.len=sizeof(code)/sizeof(code[0]);
+	filter.filter=code;
+	if(setsockopt(sock,SOL_SOCKET,SO_ATTACH_FILTER,&filter,sizeof(filter))<0){
+		printf(_("Error: Could not attach the filter to the packet socket: %s\n"),strerror(errno));
+		exit(STATE_UNKNOWN);
+		}
+
+	bzero(&address,sizeof(address));
+	address.sll_family=AF_PACKET;
+	address.sll_protocol=htons(ETH_P_IP);
+	address.sll_ifindex=if_nametoindex(iface->name);
+	if(address.sll_ifindex==0 || bind(sock,(struct sockaddr *)&address,sizeof(address))<0){
+		printf(_("Error: Could not bind packet socket to interface %s: %s\n"),iface->name,strerror(errno));
+		exit(STATE_UNKNOWN);
+		}
+
+	if(verbose)
+		printf(_("Packet socket: %d, filtered on XID 0x%X\n"),sock,iface->xid);
+
+	return sock;
+	}
+
+
+/* receives a DHCP packet from a packet socket, without its IP and UDP headers */
+int receive_packet_socket(void *buffer, int buffer_size, int sock, struct sockaddr_in *address){
+	unsigned char frame[sizeof(dhcp_packet)+128];
+	ssize_t recv_result;
+	size_t header_length;
+
+	recv_result=recv(sock,frame,sizeof(frame),0);
+	if(verbose)
+		printf("recv_result: %d\n",(int)recv_result);
+	if(recv_result<0){
+		if(verbose)
+			printf(_("recv() failed, errno: (%d) -> %s\n"),errno,strerror(errno));
+		return ERROR;
+		}
+
+	/* the filter checked the rest */
+	header_length=(frame[0]&0x0f)*4+UDP_HEADER_LENGTH;
+	if(recv_result<(ssize_t)header_length)
+		return ERROR;
+
+	bzero(address,sizeof(*address));
+	address->sin_family=AF_INET;
+	memcpy(&address->sin_addr,frame+12,sizeof(address->sin_addr));
+	recv_result-=header_length;
+	memcpy(buffer,frame+header_length,recv_result<buffer_size ? recv_result : buffer_size);
+
+	if(verbose)
+		printf(_("receive_packet_socket() source: %s\n"),inet_ntoa(address->sin_addr));
+	return OK;
+	}
+#else
+int create_packet_socket(dhcp_interface *iface){
+	return iface->sock;
+	}
+
+int receive_packet_socket(void *buffer, int buffer_size, int sock, struct sockaddr_in *address){
+	return ERROR;
+	}
+#endif
+
+
 /* closes DHCP socket */
 int close_dhcp_socket(int sock){
 
@@ -800,7 +1037,6 @@ int add_requested_server(struct in_addr server_address){
 		return ERROR;
 
 	new_server->server_address=server_address;
-	new_server->answered=FALSE;
 
 	new_server->next=requested_server_list;
 	requested_server_list=new_server;
@@ -817,8 +1053,10 @@ int add_requested_server(struct in_addr server_address){
 
 
 /* adds a DHCP OFFER to list in memory */
-int add_dhcp_offer(struct in_addr source,dhcp_packet *offer_packet){
+int add_dhcp_offer(dhcp_interface *iface,struct in_addr source,dhcp_packet *offer_packet){
 	dhcp_offer *new_offer;
+	dhcp_offer *temp_offer;
+	requested_server *temp_server;
 	int x;
 	unsigned option_type;
 	unsigned option_length;
@@ -899,6 +1137,7 @@ int add_dhcp_offer(struct in_addr source,dhcp_packet *offer_packet){
 	 * DHCPOFFER from.  If 'serv_ident' isn't available for some reason, we
 	 * use 'source'.
 	 */
+	new_offer->iface=iface;
 	new_offer->server_address=serv_ident.s_addr?serv_ident:source;
 	new_offer->offered_address=offer_packet->yiaddr;
 	new_offer->lease_time=dhcp_lease_time;
@@ -911,6 +1150,29 @@ int add_dhcp_offer(struct in_addr source,dhcp_packet *offer_packet){
 		printf(_(" of IP address %s\n"),inet_ntoa(new_offer->offered_address));
 		}
 
+	/* see if we got the address we requested */
+	if(!memcmp(&requested_address,&new_offer->offered_address,sizeof(requested_address)))
+		iface->received_requested_address=TRUE;
+
+	/* see if this is a server we wanted a response from, and the first offer it made on this interface */
+	for(temp_server=requested_server_list;temp_server!=NULL;temp_server=temp_server->next){
+		if(memcmp(&new_offer->server_address,&temp_server->server_address,sizeof(temp_server->server_address)))
+			continue;
+		for(temp_offer=dhcp_offer_list;temp_offer!=NULL;temp_offer=temp_offer->next){
+			if(temp_offer->iface==iface && !memcmp(&temp_offer->server_address,&new_offer->server_address,sizeof(new_offer->server_address)))
+				break;
+			}
+		if(verbose){
+			printf(_("DHCP Server Match: Offerer=%s"),inet_ntoa(new_offer->server_address));
+			printf(_(" Requested=%s"),inet_ntoa(temp_server->server_address));
+			if(temp_offer!=NULL)
+				printf(_(" (duplicate)"));
+			printf(_("\n"));
+			}
+		if(temp_offer==NULL)
+			iface->requested_responses++;
+		}
+
 	/* add new offer to head of list */
 	new_offer->next=dhcp_offer_list;
 	dhcp_offer_list=new_offer;
@@ -947,75 +1209,51 @@ int free_requested_server_list(void){
         }
 
 
-/* gets state and plugin output to return */
-int get_results(void){
+/* gets the state of one interface, and the max lease time we were offered on it */
+int get_interface_results(dhcp_interface *iface,u_int32_t *max_lease_time){
 	dhcp_offer *temp_offer;
-	requested_server *temp_server;
 	int result;
-	u_int32_t max_lease_time=0;
-
-	received_requested_address=FALSE;
-
-	/* checks responses from requested servers */
-	requested_responses=0;
-	if(requested_servers>0){
-
-		for(temp_server=requested_server_list;temp_server!=NULL;temp_server=temp_server->next){
-
-			for(temp_offer=dhcp_offer_list;temp_offer!=NULL;temp_offer=temp_offer->next){
-
-				/* get max lease time we were offered */
-				if(temp_offer->lease_time>max_lease_time || temp_offer->lease_time==DHCP_INFINITE_TIME)
-					max_lease_time=temp_offer->lease_time;
-
-				/* see if we got the address we requested */
-				if(!memcmp(&requested_address,&temp_offer->offered_address,sizeof(requested_address)))
-					received_requested_address=TRUE;
-
-				/* see if the servers we wanted a response from talked to us or not */
-				if(!memcmp(&temp_offer->server_address,&temp_server->server_address,sizeof(temp_server->server_address))){
-					if(verbose){
-						printf(_("DHCP Server Match: Offerer=%s"),inet_ntoa(temp_offer->server_address));
-						printf(_(" Requested=%s"),inet_ntoa(temp_server->server_address));
-						if(temp_server->answered)
-							printf(_(" (duplicate)"));
-						printf(_("\n"));
-						}
-					if(temp_server->answered == FALSE){
-						requested_responses++;
-						temp_server->answered=TRUE;
-						}
-				        }
-		                }
-		        }
-
-	        }
 
-	/* else check and see if we got our requested address from any server */
-	else{
-
-		for(temp_offer=dhcp_offer_list;temp_offer!=NULL;temp_offer=temp_offer->next){
-
-			/* get max lease time we were offered */
-			if(temp_offer->lease_time>max_lease_time || temp_offer->lease_time==DHCP_INFINITE_TIME)
-				max_lease_time=temp_offer->lease_time;
+	for(temp_offer=dhcp_offer_list;temp_offer!=NULL;temp_offer=temp_offer->next){
+		if(temp_offer->iface!=iface)
+			continue;
 
-			/* see if we got the address we requested */
-			if(!memcmp(&requested_address,&temp_offer->offered_address,sizeof(requested_address)))
-				received_requested_address=TRUE;
-	                }
-	        }
+		/* get max lease time we were offered */
+		if(temp_offer->lease_time>*max_lease_time || temp_offer->lease_time==DHCP_INFINITE_TIME)
+			*max_lease_time=temp_offer->lease_time;
+		}
 
 	result=STATE_OK;
-	if(valid_responses==0)
+	if(iface->valid_responses==0)
 		result=STATE_CRITICAL;
-	else if(requested_servers>0 && requested_responses==0)
+	else if(requested_servers>0 && iface->requested_responses==0)
 		result=STATE_CRITICAL;
-	else if(requested_responses<requested_servers)
+	else if(iface->requested_responses<requested_servers)
 		result=STATE_WARNING;
-	else if(request_specific_address==TRUE && received_requested_address==FALSE)
+	else if(request_specific_address==TRUE && iface->received_requested_address==FALSE)
 		result=STATE_WARNING;
 
+	return result;
+	}
+
+
+/* gets state and plugin output to return */
+int get_results(void){
+	dhcp_interface *iface;
+	int result=STATE_OK;
+	int iface_result;
+	int answering=0;
+	int listed=0;
+	int i;
+	u_int32_t max_lease_time=0;
+
+	for(i=0;i<num_interfaces;i++){
+		iface_result=get_interface_results(&interfaces[i],&max_lease_time);
+		result=max_state(result,iface_result);
+		if(interfaces[i].valid_responses>0)
+			answering++;
+		}
+
 	if(result==0)               /* garrett honeycutt 2005 */
 		printf("OK: ");
 	else if(result==1)
@@ -1027,17 +1265,53 @@ int get_results(void){
 
 	/* we didn't receive any DHCPOFFERs */
 	if(dhcp_offer_list==NULL){
-		printf(_("No DHCPOFFERs were received.\n"));
+		if(num_interfaces>1)
+			printf(_("No DHCPOFFERs were received on %d interfaces.\n"),num_interfaces);
+		else
+			printf(_("No DHCPOFFERs were received.\n"));
 		return result;
 	        }
 
 	printf(_("Received %d DHCPOFFER(s)"),valid_responses);
 
-	if(requested_servers>0)
-		printf(_(", %s%d of %d requested servers responded"),((requested_responses<requested_servers) && requested_responses>0)?"only ":"",requested_responses,requested_servers);
+	if(num_interfaces==1){
+		iface=&interfaces[0];
+
+		if(requested_servers>0)
+			printf(_(", %s%d of %d requested servers responded"),((iface->requested_responses<requested_servers) && iface->requested_responses>0)?"only ":"",iface->requested_responses,requested_servers);
+
+		if(request_specific_address==TRUE)
+			printf(_(", requested address (%s) was %soffered"),inet_ntoa(requested_address),(iface->received_requested_address==TRUE)?"":_("not "));
+		}
+	else{
+		if(answering<num_interfaces)
+			printf(_(" on %d of %d interfaces"),answering,num_interfaces);
+		else
+			printf(_(" on %d interfaces"),num_interfaces);
+
+		/* name the interfaces that are not fine, up to a point */
+		for(i=0;i<num_interfaces;i++){
+			iface=&interfaces[i];
+			if(get_interface_results(iface,&max_lease_time)==STATE_OK)
+				continue;
+			if(++listed>MAX_LISTED_INTERFACES)
+				continue;
+
+			if(iface->valid_responses==0)
+				printf(_(", %s: no DHCPOFFERs"),iface->name);
+			else if(iface->requested_responses<requested_servers)
+				printf(_(", %s: %s%d of %d requested servers responded"),iface->name,(iface->requested_responses>0)?"only ":"",iface->requested_responses,requested_servers);
+			else
+				printf(_(", %s: requested address (%s) was not offered"),iface->name,inet_ntoa(requested_address));
+			}
+		if(listed>MAX_LISTED_INTERFACES)
+			printf(_(" and %d more interfaces"),listed-MAX_LISTED_INTERFACES);
 
-	if(request_specific_address==TRUE)
-		printf(_(", requested address (%s) was %soffered"),inet_ntoa(requested_address),(received_requested_address==TRUE)?"":_("not "));
+		if(listed==0 && requested_servers>0)
+			printf(_(", %d of %d requested servers responded on each"),requested_servers,requested_servers);
+		if(listed==0 && request_specific_address==TRUE)
+			printf(_(", requested address (%s) was offered on each"),inet_ntoa(requested_address));
+		}
 
 	printf(_(", max lease time = "));
 	if(max_lease_time==DHCP_INFINITE_TIME)
@@ -1067,6 +1341,7 @@ int process_arguments(int argc, char **argv){
 int call_getopt(int argc, char **argv){
 	extern int optind;
 	int option_index = 0;
+	char *name;
 	static struct option long_options[] =
 	{
 		{"serverip",       required_argument,0,'s'},
@@ -1075,6 +1350,7 @@ int call_getopt(int argc, char **argv){
 		{"interface",      required_argument,0,'i'},
 		{"mac",            required_argument,0,'m'},
 		{"unicast",        no_argument,      0,'u'},
+		{"packet",         no_argument,      0,'p'},
 		{"verbose",        no_argument,      0,'v'},
 		{"version",        no_argument,      0,'V'},
 		{"help",           no_argument,      0,'h'},
@@ -1084,7 +1360,7 @@ int call_getopt(int argc, char **argv){
 	while(1){
 		int c=0;
 
-		c=getopt_long(argc,argv,"+hVvt:s:r:t:i:m:u",long_options,&option_index);
+		c=getopt_long(argc,argv,"+hVvt:s:r:t:i:m:up",long_options,&option_index);
 
 		if(c==-1||c==EOF||c==1)
 			break;
@@ -1123,10 +1399,12 @@ int call_getopt(int argc, char **argv){
 
 			break;
 
-		case 'i': /* interface name */
+		case 'i': /* interface name, may be given several times or as a list */
 
-			strncpy(network_interface_name,optarg,sizeof(network_interface_name)-1);
-			network_interface_name[sizeof(network_interface_name)-1]='\x0';
+			for(name=strtok(optarg,",");name!=NULL;name=strtok(NULL,",")){
+				if(add_interface(name)!=OK)
+					usage4(_("Could not allocate memory for the interfaces"));
+				}
 
 			break;
 
@@ -1134,6 +1412,14 @@ int call_getopt(int argc, char **argv){
 			unicast=1;
 			break;
 
+		case 'p': /* offers through a packet socket */
+#if defined(__linux__)
+			packet_mode=TRUE;
+#else
+			usage4(_("Packet sockets are only supported on Linux"));
+#endif
+			break;
+
 		case 'V': /* version */
 			print_revision(progname, NP_VERSION);
 			exit(STATE_UNKNOWN);
@@ -1372,16 +1658,24 @@ void print_help(void){
 
 	printf (" %s\n", "-s, --serverip=IPADDRESS");
   printf ("    %s\n", _("IP address of DHCP server that we must hear from"));
+  printf ("    %s\n", _("Once all of them have answered on every interface the check stops waiting"));
   printf (" %s\n", "-r, --requestedip=IPADDRESS");
   printf ("    %s\n", _("IP address that should be offered by at least one DHCP server"));
   printf (" %s\n", "-t, --timeout=INTEGER");
   printf ("    %s\n", _("Seconds to wait for DHCPOFFER before timeout occurs"));
   printf (" %s\n", "-i, --interface=STRING");
   printf ("    %s\n", _("Interface to to use for listening (i.e. eth0)"));
+  printf ("    %s\n", _("May be given several times or as a comma separated list to probe all the"));
+  printf ("    %s\n", _("interfaces at once, with the offers for each told apart by transaction id"));
   printf (" %s\n", "-m, --mac=STRING");
   printf ("    %s\n", _("MAC address to use in the DHCP request"));
   printf (" %s\n", "-u, --unicast");
   printf ("    %s\n", _("Unicast testing: mimic a DHCP relay, requires -s"));
+#if defined(__linux__)
+  printf (" %s\n", "-p, --packet");
+  printf ("    %s\n", _("Read the offers from a packet socket with a filter on the transaction id,"));
+  printf ("    %s\n", _("so that checks running at the same time on this host each see their own"));
+#endif
 
   printf (UT_SUPPORT);
 	return;
@@ -1392,8 +1686,8 @@ void
 print_usage(void){
 
   printf ("%s\n", _("Usage:"));
-  printf (" %s [-v] [-u] [-s serverip] [-r requestedip] [-t timeout]\n",progname);
-  printf ("                  [-i interface] [-m mac]\n");
+  printf (" %s [-v] [-u] [-p] [-s serverip] [-r requestedip] [-t timeout]\n",progname);
+  printf ("                  [-i interface[,interface...]] [-m mac]\n");
 
 	return;
 	}
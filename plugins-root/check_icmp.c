@@ -45,6 +45,8 @@ const char *email = "devel@monitoring-plugins.org";
 /** Monitoring Plugins basic includes */
 #include "common.h"
 #include "netutils.h"
+#include "icmputils.h"
+#include "utils_targets.h"
 #include "utils.h"
 
 #if HAVE_SYS_SOCKIO_H
@@ -52,7 +54,12 @@ const char *email = "devel@monitoring-plugins.org";
 #endif
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -73,6 +80,20 @@ const char *email = "devel@monitoring-plugins.org";
 #include <arpa/inet.h>
 #include <signal.h>
 #include <float.h>
+/* -T takes the replies in with threads behind socket filters */
+#if defined(HAVE_LIBPTHREAD) && defined(__linux__)
+# define RECV_THREADS 1
+# include <pthread.h>
+# include <sched.h>
+# include <linux/filter.h>
+#endif
+/* -N asks the kernel neighbour table which hosts failed ARP or ND */
+#ifdef __linux__
+# define NEIGH_CHECK 1
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+# include <linux/neighbour.h>
+#endif
 
 
 /** sometimes undefined system macros (quite a few, actually) **/
@@ -111,24 +132,46 @@ const char *email = "devel@monitoring-plugins.org";
 
 typedef unsigned short range_t;  /* type for get_range() -- unimplemented */
 
+/* an address of the family of the run, a fraction of a sockaddr_storage */
+typedef union icmp_addr {
+	struct in_addr in;
+	struct in6_addr in6;
+} icmp_addr;
+
+/* the fields touched for every reply come first, the addresses and
+ * names only matter when sending and reporting */
 typedef struct rta_host {
-	unsigned short id;           /* id in **table, and icmp pkts */
-	char *name;                  /* arg used for adding this host */
-	char *msg;                   /* icmp error message, if any */
-	struct sockaddr_storage saddr_in;     /* the address of this host */
-	struct sockaddr_storage error_addr;   /* stores address of error replies */
-	unsigned long long time_waited; /* total time waited, in usecs */
-	unsigned int icmp_sent, icmp_recv, icmp_lost; /* counters */
-	unsigned char icmp_type, icmp_code; /* type and code from errors */
+	unsigned short id;           /* seq of the next packet, table index * packets */
 	unsigned short flags;        /* control/status flags */
-	double rta;                  /* measured RTA */
+	unsigned int icmp_sent, icmp_recv, icmp_lost; /* counters */
+	unsigned long long time_waited; /* total time waited, in usecs */
 	double rtmax;                /* max rtt */
 	double rtmin;                /* min rtt */
+	double rta;                  /* measured RTA */
+	double last_rtt;             /* rtt of the reply before, for the jitter */
+	double jitter;               /* sum of the rtt differences of the replies */
 	unsigned char pl;            /* measured packet loss */
-	struct rta_host *next;       /* linked list */
+	unsigned char icmp_type, icmp_code; /* type and code from errors */
+	char *name;                  /* arg used for adding this host, NULL until printed for one of a range */
+	char *msg;                   /* icmp error message, if any */
+	icmp_addr addr;              /* the address of this host, unused for one of a range */
+	icmp_addr error_addr;        /* stores address of error replies */
+	struct rta_host *sched_next; /* timer wheel slot or ready queue (-r) */
+	unsigned long long next_send; /* wheel tick of the next packet (-r) */
+	unsigned int sched_left;     /* packets still to be sent (-r) */
 } rta_host;
 
 #define FLAG_LOST_CAUSE 0x01  /* decidedly dead target. */
+#define FLAG_IN_RANGE 0x02    /* one of a CIDR range, see host_addr() */
+
+/* -H and -f take CIDR ranges, whose hosts take their places in the table
+ * all at once but nothing else: the address of one is worked out from its
+ * index when a packet goes out, and its name only made when it is printed */
+typedef struct target_range {
+	unsigned int first;          /* table index of the first host */
+	unsigned int count;
+	icmp_addr base;              /* the address of the first host */
+} target_range;
 
 /* threshold structure. all values are maximum allowed, exclusive */
 typedef struct threshold {
@@ -136,11 +179,53 @@ typedef struct threshold {
 	unsigned int rta;  /* roundtrip time average, microseconds */
 } threshold;
 
-/* the data structure */
-typedef struct icmp_ping_data {
-	struct timeval stime;	/* timestamp (saved in protocol struct as well) */
-	unsigned short ping_id;
-} icmp_ping_data;
+/* -P and -Q: the rtt percentiles of a target come from a histogram of its
+ * replies with four linear buckets an octave from 4us to 32s, one byte a
+ * bucket as a target gets at most 20 packets. That is RTT_BUCKETS bytes a
+ * target whatever the number of replies, and only allocated when asked for. */
+#define RTT_BUCKET_MIN_BIT 2
+#define RTT_BUCKET_MAX_BIT 24
+#define RTT_BUCKETS (1 + (RTT_BUCKET_MAX_BIT - RTT_BUCKET_MIN_BIT + 1) * 4)
+#define MAX_PERCENTILES 8
+
+typedef struct percentile {
+	double pct;          /* 0 < pct <= 100 */
+	unsigned int warn;   /* thresholds in microseconds, 0 if none */
+	unsigned int crit;
+} percentile;
+
+/* -D and -R: the prober publishes the results of every round in a table
+ * mapped from a file, which the client mode reads instead of pinging. The
+ * entries are sorted by the name of the target. Each one has a sequence
+ * number that is odd while the prober writes it; readers take a copy and
+ * try again when the number changed under them. */
+#define RESULTS_MAGIC 0x4e504931	/* NPI1 */
+#define RESULTS_HEADER 64	/* the entries start here */
+#define RESULTS_NAME_MAX 64
+
+typedef struct results_header {
+	unsigned int magic;
+	unsigned int entry_size;     /* sizeof(results_entry), as a version */
+	unsigned int count;
+	unsigned int interval;       /* seconds between rounds */
+	unsigned int timeout;        /* seconds a round may take */
+	unsigned int family;         /* of the addresses */
+} results_header;
+
+typedef struct results_entry {
+	volatile unsigned int seq;
+	unsigned short flags;
+	unsigned char icmp_type, icmp_code;
+	unsigned int icmp_sent, icmp_recv;
+	long long updated;           /* time() of the round, 0 before the first */
+	unsigned long long time_waited;
+	double rtmin, rtmax, jitter;
+	struct sockaddr_storage error_addr;
+	char name[RESULTS_NAME_MAX];
+	unsigned char hist[RTT_BUCKETS];
+} results_entry;
+
+#define results_entries(h) ((results_entry *)((char *)(h) + RESULTS_HEADER))
 
 typedef union ip_hdr {
 	struct ip ip;
@@ -179,12 +264,39 @@ typedef union icmp_packet {
 #define HAVE_TCP 4
 #define HAVE_ARP 8
 
-#define MIN_PING_DATA_SIZE sizeof(struct icmp_ping_data)
+#define MIN_PING_DATA_SIZE sizeof(np_icmp_echo_data)
 #define MAX_IP_PKT_SIZE 65536	/* (theoretical) max IP packet size */
 #define IP_HDR_SIZE 20
 #define MAX_PING_DATA (MAX_IP_PKT_SIZE - IP_HDR_SIZE - ICMP_MINLEN)
 #define DEFAULT_PING_DATA_SIZE (MIN_PING_DATA_SIZE + 44)
 
+/* paced sending (-r) */
+#define WHEEL_SLOTS 1024
+#define WHEEL_TICK 1000	/* usecs per timer wheel slot */
+
+/* -T: every thread has a raw socket of its own, which a filter limits to
+ * the echo replies with its id, pid + the number of the thread. Thread n
+ * owns the targets from n * thread_span on, and the main thread, which
+ * still does all the sending, sees only the errors. */
+#define MAX_RECV_THREADS 64
+#define THREAD_POLL 10000	/* usecs between looks at the counts of the threads */
+
+/* -N: a host on a directly connected network whose neighbour entry went
+ * FAILED, as ARP or ND found nobody there, is a lost cause, and none of
+ * its packets are waited for any longer. Entries that failed before the
+ * run, and longer ago than the -N time, are not trusted: the kernel asks
+ * for the host again once we send to it. */
+#define NEIGH_POLL 100000	/* usecs between looks at the neighbour table */
+
+typedef struct recv_thread {
+#ifdef RECV_THREADS
+	pthread_t tid;
+#endif
+	int sock;
+	unsigned short id;           /* the echo id of its targets */
+	volatile unsigned int recv;  /* replies taken in, only it writes this */
+} recv_thread;
+
 /* various target states */
 #define TSTATE_INACTIVE 0x01	/* don't ping this host anymore */
 #define TSTATE_WAITING 0x02		/* unanswered packets on the wire */
@@ -198,17 +310,47 @@ static u_int get_timevar(const char *);
 static u_int get_timevaldiff(struct timeval *, struct timeval *);
 static in_addr_t get_ip_address(const char *);
 static int wait_for_reply(int, u_int);
+static void handle_reply(unsigned char *, int, struct sockaddr_storage *, struct timeval *, void *);
 static int recvfrom_wto(int, void *, unsigned int, struct sockaddr *, u_int *, struct timeval*);
+static void init_icmp_packets(void);
+static int send_icmp_batch(int, struct rta_host **, int);
 static int send_icmp_ping(int, struct rta_host *);
 static int get_threshold(char *str, threshold *th);
+static void get_percentiles(char *);
+static void get_percentile_threshold(char *);
+static int rtt_bucket(u_int);
+static double rtt_percentile(struct rta_host *, double);
+static int check_rtt_spread(struct rta_host *);
+static void start_checks(void);
 static void run_checks(void);
+static void run_paced_checks(void);
+static void run_prober(void);
+static void read_results(char **, int);
+static void load_targets_file(int);
 static void set_source_ip(char *);
 static int add_target(char *);
 static int add_target_ip(char *, struct sockaddr_storage *);
+static int add_target_range(char *, char *);
+static int addr_hash_lookup(icmp_addr *);
+static void addr_hash_insert(unsigned int);
+static int target_lookup(icmp_addr *);
+static void range_addr(icmp_addr *, unsigned long, icmp_addr *);
+static void host_sockaddr(struct rta_host *, struct sockaddr_storage *);
+static const char *host_name(struct rta_host *);
 static int handle_random_icmp(unsigned char *, struct sockaddr_storage *);
+static unsigned short echo_id(struct rta_host *);
+static int our_id(unsigned short);
+static void threads_open(void);
+static void threads_start(void);
+static void threads_finish(void);
+static void threads_sync(void);
+static void neigh_open(void);
+static void neigh_sync(void);
 static void parse_address(struct sockaddr_storage *, char *, int);
-static unsigned short icmp_checksum(unsigned short *, int);
+static void addr_from_sockaddr(icmp_addr *, struct sockaddr_storage *);
+static void addr_to_sockaddr(icmp_addr *, struct sockaddr_storage *);
 static void finish(int);
+static void publish_results(void);
 static void crash(const char *, ...);
 
 /** external **/
@@ -217,7 +359,12 @@ extern char *optarg;
 extern char **environ;
 
 /** global variables **/
-static struct rta_host **table, *cursor, *list;
+static struct rta_host *table;	/* every target, indexed by icmp seq / packets */
+static unsigned int table_size;
+static unsigned int *addr_hash;	/* table index + 1 by address, 0 if unused */
+static target_range *ranges;	/* by first table index */
+static unsigned int nranges, ranges_size;
+static unsigned int addr_hash_size;	/* a power of two */
 static threshold crit = {80, 500000}, warn = {40, 200000};
 static int mode, protocols, sockets, debug = 0, timeout = 10;
 static unsigned short icmp_data_size = DEFAULT_PING_DATA_SIZE;
@@ -235,7 +382,34 @@ static struct timeval prog_start;
 static unsigned long long max_completion_time = 0;
 static unsigned char ttl = 0;	/* outgoing ttl */
 static unsigned int warn_down = 1, crit_down = 1; /* host down threshold values */
+static percentile percentiles[MAX_PERCENTILES];
+static int n_percentiles = 0;
+static unsigned char *rtt_hist;	/* RTT_BUCKETS for every target, with -P or -Q */
+static int report_jitter = 0;
+static unsigned int jitter_warn = 0, jitter_crit = 0;	/* microseconds */
 static int min_hosts_alive = -1;
+static unsigned int send_rate = 0;	/* packets per second, 0 for the classic send loop */
+static struct rta_host *wheel[WHEEL_SLOTS], *ready_head, *ready_tail;
+static unsigned long long wheel_pos;
+static unsigned int wheel_count;
+static char *results_file;	/* -D or -R */
+static int results_client = 0;	/* -R: read the results, don't ping */
+static results_header *results;	/* the table mapped from results_file */
+static size_t results_size;
+static unsigned int *results_slot;	/* the entry of every target */
+static time_t round_started;
+static unsigned int round_interval = 60;
+static char *targets_file;	/* -f */
+static struct stat targets_stat;
+static unsigned short static_targets;	/* the ones not from -f */
+static int resolve_soft = 0;	/* skip the names that don't resolve */
+static recv_thread *threads;	/* -T */
+static unsigned int nthreads = 0, thread_span;
+static volatile int threads_running = 0;
+static int neigh_sock = -1;	/* -N */
+static u_int neigh_age;	/* usecs before the run a failed entry counts */
+static unsigned long long neigh_last;	/* usecs after prog_start of the last look */
+static long changes_refresh = -1;	/* -U */
 float pkt_backoff_factor = 1.5;
 float target_backoff_factor = 1.5;
 
@@ -321,7 +495,7 @@ handle_random_icmp(unsigned char *packet, struct sockaddr_storage *addr)
 	struct rta_host *host = NULL;
 
 	memcpy(&p, packet, sizeof(p));
-	if(p.icmp_type == ICMP_ECHO && ntohs(p.icmp_id) == pid) {
+	if(p.icmp_type == ICMP_ECHO && our_id(ntohs(p.icmp_id))) {
 		/* echo request from us to us (pinging localhost) */
 		return 0;
 	}
@@ -347,21 +521,34 @@ handle_random_icmp(unsigned char *packet, struct sockaddr_storage *addr)
 	/* might be for us. At least it holds the original package (according
 	 * to RFC 792). If it isn't, just ignore it */
 	memcpy(&sent_icmp, packet + 28, sizeof(sent_icmp));
-	if(sent_icmp.icmp_type != ICMP_ECHO || ntohs(sent_icmp.icmp_id) != pid ||
+	if(sent_icmp.icmp_type != ICMP_ECHO || !our_id(ntohs(sent_icmp.icmp_id)) ||
 	   ntohs(sent_icmp.icmp_seq) >= targets*packets)
 	{
 		if(debug) printf("Packet is no response to a packet we sent\n");
 		return 0;
 	}
 
-	/* it is indeed a response for us */
-	host = table[ntohs(sent_icmp.icmp_seq)/packets];
+	/* it is indeed a response for us. The seq tells us the host, but the
+	 * error could have come for a packet of another run with the same pid,
+	 * so believe the quoted destination address if the two disagree */
+	host = &table[ntohs(sent_icmp.icmp_seq)/packets];
+	if (address_family == AF_INET) {
+		icmp_addr dst;
+		struct ip sent_ip;
+		int idx;
+
+		memcpy(&sent_ip, packet + 8, sizeof(sent_ip));
+		memset(&dst, 0, sizeof(dst));
+		dst.in = sent_ip.ip_dst;
+		if((idx = target_lookup(&dst)) >= 0)
+			host = &table[idx];
+	}
 	if(debug) {
 		char address[INET6_ADDRSTRLEN];
 		parse_address(addr, address, sizeof(address));
 		printf("Received \"%s\" from %s for ICMP ECHO sent to %s.\n",
 			get_icmp_error_msg(p.icmp_type, p.icmp_code),
-			address, host->name);
+			address, host_name(host));
 	}
 
 	icmp_lost++;
@@ -381,7 +568,7 @@ handle_random_icmp(unsigned char *packet, struct sockaddr_storage *addr)
 	}
 	host->icmp_type = p.icmp_type;
 	host->icmp_code = p.icmp_code;
-	host->error_addr = *addr;
+	addr_from_sockaddr(&host->error_addr, addr);
 
 	return 0;
 }
@@ -398,6 +585,27 @@ void parse_address(struct sockaddr_storage *addr, char *address, int size)
 	}
 }
 
+static void
+addr_from_sockaddr(icmp_addr *addr, struct sockaddr_storage *in)
+{
+	memset(addr, 0, sizeof(*addr));
+	if(address_family == AF_INET6)
+		addr->in6 = ((struct sockaddr_in6 *)in)->sin6_addr;
+	else
+		addr->in = ((struct sockaddr_in *)in)->sin_addr;
+}
+
+static void
+addr_to_sockaddr(icmp_addr *addr, struct sockaddr_storage *out)
+{
+	memset(out, 0, sizeof(*out));
+	out->ss_family = address_family;
+	if(address_family == AF_INET6)
+		((struct sockaddr_in6 *)out)->sin6_addr = addr->in6;
+	else
+		((struct sockaddr_in *)out)->sin_addr = addr->in;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -406,22 +614,17 @@ main(int argc, char **argv)
 	long int arg;
 	int icmp_sockerrno, udp_sockerrno, tcp_sockerrno;
 	int result;
-	struct rta_host *host;
-#ifdef SO_TIMESTAMP
-	int on = 1;
-#endif
-	char * opts_str = "vhVw:c:n:p:t:H:s:i:b:I:l:m:64";
+	char * opts_str = "vhVw:c:n:p:t:H:s:i:b:I:l:m:r:P:Q:J:D:R:f:S:e:T:N:U:64";
+	char **names;
+	int nnames = 0;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* we only need to be setsuid when we get the sockets, so do
 	 * that before pointer magic (esp. on network data) */
 	icmp_sockerrno = udp_sockerrno = tcp_sockerrno = sockets = 0;
 
         address_family = -1;
-	int icmp_proto = IPPROTO_ICMP;
 
 	/* get calling name the old-fashioned way for portability instead
 	 * of relying on the glibc-ism __progname */
@@ -431,7 +634,6 @@ main(int argc, char **argv)
 
 	/* now set defaults. Use progname to set them initially (allows for
 	 * superfast check_host program when target host is up */
-	cursor = list = NULL;
 	table = NULL;
 
 	mode = MODE_RTA;
@@ -461,11 +663,24 @@ main(int argc, char **argv)
 		packets = 5;
 	}
 
-	/* Parse protocol arguments first */
+	/* Parse protocol arguments first, and collect the hosts to resolve
+	 * them all at once */
+	if((names = calloc(argc, sizeof(char *))) == NULL)
+		crash("Cannot allocate memory");
 	for(i = 1; i < argc; i++) {
 		while((arg = getopt(argc, argv, opts_str)) != EOF) {
 			unsigned short size;
 			switch(arg) {
+			case 'H':
+				names[nnames++] = optarg;
+				break;
+			case 'D':
+			case 'R':
+				if(results_file)
+					crash("Only one of -D and -R can be given");
+				results_file = optarg;
+				results_client = (arg == 'R');
+				break;
 			case '4':
 				if (address_family != -1)
 					crash("Multiple protocol versions not supported");
@@ -483,6 +698,13 @@ main(int argc, char **argv)
 			}
 		}
 	}
+	for(i = optind; i < argc; i++)
+		names[nnames++] = argv[i];
+	/* the client mode only looks the names up in the results */
+	if(!results_client)
+		np_resolve_prefetch((const char **)names, nnames,
+		                    address_family == -1 ? AF_UNSPEC : address_family,
+		                    DEFAULT_RESOLVE_THREADS);
 
 	/* Reset argument scanning */
 	optind = 1;
@@ -497,13 +719,13 @@ main(int argc, char **argv)
 				break;
 			case 'b':
 				size = (unsigned short)strtol(optarg,NULL,0);
-				if (size >= (sizeof(struct icmp) + sizeof(struct icmp_ping_data)) &&
+				if (size >= (sizeof(struct icmp) + sizeof(np_icmp_echo_data)) &&
 				    size < MAX_PING_DATA) {
 					icmp_data_size = size;
 					icmp_pkt_size = size + ICMP_MINLEN;
 				} else
 					usage_va("ICMP data length must be between: %d and %d",
-					         sizeof(struct icmp) + sizeof(struct icmp_ping_data),
+					         sizeof(struct icmp) + sizeof(np_icmp_echo_data),
 					         MAX_PING_DATA - 1);
 				break;
 			case 'i':
@@ -512,6 +734,25 @@ main(int argc, char **argv)
 			case 'I':
 				target_interval = get_timevar(optarg);
 				break;
+			case 'r':
+				send_rate = strtoul(optarg, NULL, 0);
+				break;
+			case 'T':
+				nthreads = strtoul(optarg, NULL, 0);
+#ifndef RECV_THREADS
+				if(nthreads)
+					usage_va(_("-T needs threads and Linux socket filters"));
+#endif
+				if(nthreads > MAX_RECV_THREADS)
+					usage_va(_("-T takes at most %d threads"), MAX_RECV_THREADS);
+				break;
+			case 'N':
+#ifndef NEIGH_CHECK
+				usage_va(_("-N needs the Linux neighbour table"));
+#endif
+				neigh_age = get_timevar(optarg);
+				neigh_sock = 0;
+				break;
 			case 'w':
 				get_threshold(optarg, &warn);
 				break;
@@ -527,7 +768,23 @@ main(int argc, char **argv)
 				if(!timeout) timeout = 10;
 				break;
 			case 'H':
-				add_target(optarg);
+				if(!results_client) add_target(optarg);
+				break;
+			case 'f':
+				targets_file = optarg;
+				break;
+			case 'S':
+				if(np_targets_shard(optarg) == ERROR)
+					usage_va(_("-S must be I/N, I from 1 to N"));
+				break;
+			case 'U':
+				changes_refresh = strtol(optarg, &ptr, 10);
+				if(*ptr || changes_refresh < 0)
+					usage_va(_("-U must be a number of seconds"));
+				break;
+			case 'e':
+				round_interval = strtoul(optarg, NULL, 0);
+				if(!round_interval) round_interval = 60;
 				break;
 			case 'l':
 				ttl = (unsigned char)strtoul(optarg, NULL, 0);
@@ -544,6 +801,22 @@ main(int argc, char **argv)
 			case 's': /* specify source IP address */
 				set_source_ip(optarg);
 				break;
+			case 'P': /* percentiles to report */
+				get_percentiles(optarg);
+				report_jitter = 1;
+				break;
+			case 'Q': /* percentile threshold */
+				get_percentile_threshold(optarg);
+				break;
+			case 'J': /* jitter threshold */
+				/* get_timevar() looks for the unit at the end */
+				if((ptr = strchr(optarg, ',')) != NULL) {
+					*ptr = '\0';
+					jitter_crit = get_timevar(ptr + 1);
+				}
+				jitter_warn = get_timevar(optarg);
+				report_jitter = 1;
+				break;
 			case 'V': /* version */
 				print_revision (progname, NP_VERSION);
 				exit (STATE_UNKNOWN);
@@ -565,6 +838,8 @@ main(int argc, char **argv)
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts(&argc, argv, progname);
+	/* the states of -U are kept under the command line */
+	if(changes_refresh >= 0) np_init(progname, argc, argv);
 
 	/* support "--help" and "--version" */
 	if(argc == 2) {
@@ -575,10 +850,43 @@ main(int argc, char **argv)
 	}
 
 	argv = &argv[optind];
-	while(*argv) {
+	while(*argv && !results_client) {
 		add_target(*argv);
 		argv++;
 	}
+
+	/* stupid users should be able to give whatever thresholds they want
+	 * (nothing will break if they do), but some anal plugin maintainer
+	 * will probably add some printf() thing here later, so it might be
+	 * best to at least show them where to do it. ;) */
+	if(warn.pl > crit.pl) warn.pl = crit.pl;
+	if(warn.rta > crit.rta) warn.rta = crit.rta;
+	if(warn_down > crit_down) crit_down = warn_down;
+
+	if(packets > 20) {
+		errno = 0;
+		crash("packets is > 20 (%d)", packets);
+	}
+
+	if(min_hosts_alive < -1) {
+		errno = 0;
+		crash("minimum alive hosts is negative (%i)", min_hosts_alive);
+	}
+
+	if(results_client) {
+		/* no socket needed, and the table is read as the caller */
+		if (setuid(getuid()) == -1) {
+			printf("ERROR: Failed to drop privileges\n");
+			return 1;
+		}
+		read_results(names, nnames);
+		return(0);
+	}
+	free(names);
+
+	static_targets = targets;
+	if(targets_file)
+		load_targets_file(TRUE);
 	if(!targets) {
 		errno = 0;
 		crash("No hosts to check");
@@ -587,21 +895,19 @@ main(int argc, char **argv)
 
 	// add_target might change address_family
 	switch ( address_family ){
-		case AF_INET:	icmp_proto = IPPROTO_ICMP;
-				break;
-		case AF_INET6:	icmp_proto = IPPROTO_ICMPV6;
-				break;
+		case AF_INET:
+		case AF_INET6:	break;
 		default:	crash("Address family not supported");
 	}
-	if((icmp_sock = socket(address_family, SOCK_RAW, icmp_proto)) != -1)
+	if((icmp_sock = np_icmp_socket(address_family, FALSE, NULL)) != -1)
 		sockets |= HAVE_ICMP;
 	else icmp_sockerrno = errno;
 
-
-#ifdef SO_TIMESTAMP
-	if(setsockopt(icmp_sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)))
-	  if(debug) printf("Warning: no SO_TIMESTAMP support\n");
-#endif // SO_TIMESTAMP
+	np_icmp_timestamps(icmp_sock, debug);
+	if(nthreads && icmp_sock != -1)
+		threads_open();
+	if(neigh_sock == 0)
+		neigh_open();
 
 	/* now drop privileges (no effect if not setsuid or geteuid() == 0) */
 	if (setuid(getuid()) == -1) {
@@ -636,18 +942,28 @@ main(int argc, char **argv)
 		}
 	}
 
-	/* stupid users should be able to give whatever thresholds they want
-	 * (nothing will break if they do), but some anal plugin maintainer
-	 * will probably add some printf() thing here later, so it might be
-	 * best to at least show them where to do it. ;) */
-	if(warn.pl > crit.pl) warn.pl = crit.pl;
-	if(warn.rta > crit.rta) warn.rta = crit.rta;
-	if(warn_down > crit_down) crit_down = warn_down;
-
 	signal(SIGINT, finish);
 	signal(SIGHUP, finish);
 	signal(SIGTERM, finish);
 	signal(SIGALRM, finish);
+
+	if(results_file)
+		run_prober();
+
+	start_checks();
+
+	errno = 0;
+	finish(0);
+
+	return(0);
+}
+
+/* one run over all targets, which ends in finish() */
+static void
+start_checks(void)
+{
+	int i;
+
 	if(debug) printf("Setting alarm timeout to %u seconds\n", timeout);
 	alarm(timeout);
 
@@ -656,6 +972,15 @@ main(int argc, char **argv)
 	max_completion_time =
 		((targets * packets * pkt_interval) + (targets * target_interval)) +
 		(targets * packets * crit.rta) + crit.rta;
+	if(send_rate) {
+		/* paced: the rate or the per-target interval limits, whichever is slower */
+		unsigned long long by_rate, by_interval;
+
+		by_rate = (unsigned long long)targets * packets * 1000000 / send_rate;
+		by_interval = (unsigned long long)(packets ? packets - 1 : 0) * pkt_interval +
+			(unsigned long long)targets * 1000000 / send_rate;
+		max_completion_time = (by_rate > by_interval ? by_rate : by_interval) + crit.rta;
+	}
 
 	if(debug) {
 		printf("packets: %u, targets: %u\n"
@@ -686,32 +1011,26 @@ main(int argc, char **argv)
 			   icmp_pkt_size, timeout);
 	}
 
-	if(packets > 20) {
-		errno = 0;
-		crash("packets is > 20 (%d)", packets);
-	}
-
-	if(min_hosts_alive < -1) {
-		errno = 0;
-		crash("minimum alive hosts is negative (%i)", min_hosts_alive);
-	}
+	for(i = 0; i < targets; i++)
+		table[i].id = i*packets;
 
-	host = list;
-	table = (struct rta_host**)malloc(sizeof(struct rta_host **) * targets);
-	i = 0;
-	while(host) {
-		host->id = i*packets;
-		table[i] = host;
-		host = host->next;
-		i++;
-	}
+	/* the prober publishes the histograms for any percentile asked for */
+	if((n_percentiles || results_file) && !(rtt_hist = calloc(targets, RTT_BUCKETS)))
+		crash("failed to allocate %lu bytes for the rtt histograms",
+			  (unsigned long)targets * RTT_BUCKETS);
 
-	run_checks();
+	init_icmp_packets();
+	if(nthreads)
+		threads_start();
 
-	errno = 0;
-	finish(0);
+	/* the hosts known to be gone are not sent to at all */
+	neigh_last = 0;
+	neigh_sync();
 
-	return(0);
+	if(send_rate)
+		run_paced_checks();
+	else
+		run_checks();
 }
 
 static void
@@ -727,14 +1046,14 @@ run_checks()
 		for(t = 0; t < targets; t++) {
 			/* don't send useless packets */
 			if(!targets_alive) finish(0);
-			if(table[t]->flags & FLAG_LOST_CAUSE) {
+			if(table[t].flags & FLAG_LOST_CAUSE) {
 				if(debug) printf("%s is a lost cause. not sending any more\n",
-								 table[t]->name);
+								 host_name(&table[t]));
 				continue;
 			}
 
 			/* we're still in the game, so send next packet */
-			(void)send_icmp_ping(icmp_sock, table[t]);
+			(void)send_icmp_ping(icmp_sock, &table[t]);
 			result = wait_for_reply(icmp_sock, target_interval);
 		}
 		result = wait_for_reply(icmp_sock, pkt_interval * targets);
@@ -762,6 +1081,468 @@ run_checks()
 }
 
 
+/* the timer wheel for -r: hosts wait in the slot of the tick their next
+ * packet is due in, and move to the ready queue once that tick has come */
+static void
+ready_push(struct rta_host *host)
+{
+	host->sched_next = NULL;
+	if(ready_tail) ready_tail->sched_next = host;
+	else ready_head = host;
+	ready_tail = host;
+}
+
+static struct rta_host *
+ready_pop(void)
+{
+	struct rta_host *host = ready_head;
+
+	if(host) {
+		ready_head = host->sched_next;
+		if(!ready_head) ready_tail = NULL;
+	}
+	return host;
+}
+
+static void
+wheel_insert(struct rta_host *host, unsigned long long when)
+{
+	unsigned long long tick = when / WHEEL_TICK;
+
+	if(tick < wheel_pos) tick = wheel_pos;
+	host->next_send = tick;
+	host->sched_next = wheel[tick % WHEEL_SLOTS];
+	wheel[tick % WHEEL_SLOTS] = host;
+	wheel_count++;
+}
+
+static void
+wheel_advance(unsigned long long when)
+{
+	unsigned long long tick = when / WHEEL_TICK;
+	struct rta_host **pp, *host;
+
+	for(; wheel_count && wheel_pos <= tick; wheel_pos++) {
+		pp = &wheel[wheel_pos % WHEEL_SLOTS];
+		while((host = *pp) != NULL) {
+			if(host->next_send > wheel_pos) {	/* due in a later revolution */
+				pp = &host->sched_next;
+				continue;
+			}
+			*pp = host->sched_next;
+			wheel_count--;
+			ready_push(host);
+		}
+	}
+	if(!wheel_count && wheel_pos <= tick) wheel_pos = tick + 1;
+}
+
+/* send at send_rate packets per second over all targets, with at least
+ * pkt_interval between two packets to the same target, and take in the
+ * replies while waiting for the next send slot */
+static void
+run_paced_checks()
+{
+	struct rta_host *host, *batch[NP_ICMP_SEND_BATCH];
+	unsigned long long now, start, due, sent = 0;
+	u_int t, wait;
+	int n;
+
+	for(t = 0; t < targets; t++) {
+		table[t].sched_left = packets;
+		if(packets) ready_push(&table[t]);
+	}
+
+	start = get_timevaldiff(&prog_start, NULL);
+	while(ready_head || wheel_count) {
+		if(!targets_alive || (mode == MODE_HOSTCHECK && targets_down)) finish(0);
+		now = get_timevaldiff(&prog_start, NULL);
+		if(now >= max_completion_time) {
+			if(debug) printf("Time passed. Finishing up\n");
+			finish(0);
+		}
+		wheel_advance(now);
+		neigh_sync();
+
+		/* what is due goes out in batches of up to NP_ICMP_SEND_BATCH */
+		n = 0;
+		while(ready_head && sent * 1000000 <= (now - start) * send_rate) {
+			host = ready_pop();
+			if(host->flags & FLAG_LOST_CAUSE) {
+				if(debug) printf("%s is a lost cause. not sending any more\n",
+								 host_name(host));
+				continue;
+			}
+			batch[n++] = host;
+			sent++;
+			if(--host->sched_left)
+				wheel_insert(host, now + pkt_interval);
+			if(n == NP_ICMP_SEND_BATCH) {
+				(void)send_icmp_batch(icmp_sock, batch, n);
+				n = 0;
+			}
+		}
+		if(n) (void)send_icmp_batch(icmp_sock, batch, n);
+
+		/* sleep until the next send slot or the next wheel tick */
+		if(ready_head) {
+			due = start + (sent * 1000000) / send_rate;
+			wait = due > now ? due - now : 1;
+		}
+		else wait = WHEEL_TICK - (now % WHEEL_TICK);
+		np_icmp_drain(icmp_sock, wait, handle_reply, NULL);
+	}
+
+	/* catch the packets that might come in within the timeframe, but
+	 * haven't yet */
+	for(threads_sync(); icmp_pkts_en_route && targets_alive; threads_sync()) {
+		now = get_timevaldiff(&prog_start, NULL);
+		if(now >= max_completion_time) break;
+		wait = max_completion_time - now;
+		if(nthreads && wait > THREAD_POLL) wait = THREAD_POLL;
+		if(neigh_sock > 0 && wait > NEIGH_POLL) wait = NEIGH_POLL;
+		np_icmp_drain(icmp_sock, wait, handle_reply, NULL);
+		neigh_sync();
+	}
+}
+
+
+/* -f: the targets listed in a file or read from a socket, one a line,
+ * with '#' starting a comment, of the shard of -S. The prober reads a file
+ * again whenever it changes, and then starts over from the targets given
+ * on the command line. */
+static void
+load_targets_file(int initial)
+{
+	np_targets *list;
+	uid_t euid = geteuid();
+	char *p, **names = NULL, **lookup;
+	unsigned int i, n = 0, nlookup = 0, size = 0;
+
+	/* opened with the rights of the caller, not those of a setuid binary */
+	if(seteuid(getuid()) == -1)
+		crash("Failed to drop privileges");
+	list = np_targets_open(targets_file);
+	if(seteuid(euid) == -1)
+		crash("Failed to regain privileges");
+	if(!list) {
+		/* a prober keeps going with the targets it has */
+		if(!initial) return;
+		crash("Cannot open %s", targets_file);
+	}
+	fstat(fileno(list->fp), &targets_stat);
+
+	while((p = np_targets_next(list))) {
+		p[strcspn(p, " \t#")] = '\0';
+		if(results_file && strlen(p) >= RESULTS_NAME_MAX) {
+			if(debug) printf("%s: name too long, not probed\n", p);
+			continue;
+		}
+		if(n == size) {
+			size = size ? size * 2 : 64;
+			if(!(names = realloc(names, size * sizeof(char *))))
+				crash("Cannot allocate memory");
+		}
+		if(!(names[n++] = strdup(p)))
+			crash("Cannot allocate memory");
+	}
+	np_targets_close(list);
+
+	for(i = static_targets; i < targets; i++)
+		free(table[i].name);
+	targets = static_targets;
+	while(nranges && ranges[nranges - 1].first >= targets)
+		nranges--;
+	if(addr_hash_size) {
+		memset(addr_hash, 0, addr_hash_size * sizeof(*addr_hash));
+		for(i = 0; i < targets; i++)
+			if(!(table[i].flags & FLAG_IN_RANGE)) addr_hash_insert(i);
+	}
+
+	/* ranges are no names to look up */
+	if(n && !(lookup = malloc(n * sizeof(char *))))
+		crash("Cannot allocate memory");
+	for(i = 0; i < n; i++)
+		if(!strchr(names[i], '/')) lookup[nlookup++] = names[i];
+	if(nlookup)
+		np_resolve_prefetch((const char **)lookup, nlookup,
+		                    address_family == -1 ? AF_UNSPEC : address_family,
+		                    DEFAULT_RESOLVE_THREADS);
+	if(n) free(lookup);
+	resolve_soft = 1;
+	for(i = 0; i < n; i++) {
+		add_target(names[i]);
+		free(names[i]);
+	}
+	resolve_soft = 0;
+	free(names);
+	if(debug) printf("%u targets after reading %s\n", targets, targets_file);
+}
+
+static int
+results_order(const void *a, const void *b)
+{
+	int r = strcmp(host_name(&table[*(const unsigned int *)a]), host_name(&table[*(const unsigned int *)b]));
+
+	if(r) return r;
+	return *(const unsigned int *)a < *(const unsigned int *)b ? -1 : 1;
+}
+
+/* the first of the n entries of name, -1 if there are none */
+static int
+results_find(results_header *h, const char *name, int *n)
+{
+	results_entry *e = results_entries(h);
+	int lo = 0, hi = h->count, mid;
+
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(strcmp(e[mid].name, name) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	for(*n = 0; lo + *n < (int)h->count && !strcmp(e[lo + *n].name, name); (*n)++)
+		;
+	return *n ? lo : -1;
+}
+
+/* a new table for the current targets, taking over the results of the
+ * ones that were there before, which replaces the old file at once */
+static void
+results_create(void)
+{
+	results_header *h;
+	results_entry *e, *old;
+	unsigned int *order, i;
+	size_t size;
+	char *tmp;
+	int fd, first, n, k;
+
+	order = malloc(targets * sizeof(unsigned int));
+	results_slot = realloc(results_slot, targets * sizeof(unsigned int));
+	if(!order || !results_slot || asprintf(&tmp, "%s.tmp", results_file) < 0)
+		crash("Cannot allocate memory");
+	for(i = 0; i < targets; i++)
+		order[i] = i;
+	qsort(order, targets, sizeof(unsigned int), results_order);
+
+	size = RESULTS_HEADER + targets * sizeof(results_entry);
+	if((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+		crash("Cannot create %s", tmp);
+	if(ftruncate(fd, size) < 0 ||
+	   (h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		crash("Cannot map %s", tmp);
+	close(fd);
+
+	h->magic = RESULTS_MAGIC;
+	h->entry_size = sizeof(results_entry);
+	h->count = targets;
+	h->interval = round_interval;
+	h->timeout = timeout;
+	h->family = address_family;
+	e = results_entries(h);
+	for(i = 0, k = 0; i < targets; i++) {
+		/* k counts the entries with the same name */
+		k = (i && !strcmp(table[order[i]].name, table[order[i - 1]].name)) ? k + 1 : 0;
+		results_slot[order[i]] = i;
+		if(results && (first = results_find(results, table[order[i]].name, &n)) >= 0 && k < n) {
+			old = &results_entries(results)[first + k];
+			memcpy(&e[i], old, sizeof(results_entry));
+			e[i].seq = 0;
+		}
+		else {
+			strncpy(e[i].name, table[order[i]].name, RESULTS_NAME_MAX - 1);
+			e[i].rtmin = DBL_MAX;
+		}
+	}
+
+	if(rename(tmp, results_file) < 0)
+		crash("Cannot rename %s to %s", tmp, results_file);
+	if(results) munmap(results, results_size);
+	results = h;
+	results_size = size;
+	free(order);
+	free(tmp);
+}
+
+/* called at the end of a round instead of printing the result */
+static void
+publish_results(void)
+{
+	struct rta_host *host;
+	results_entry *e;
+	unsigned int t;
+
+	for(t = 0; t < targets; t++) {
+		host = &table[t];
+		e = &results_entries(results)[results_slot[t]];
+		e->seq++;
+		__sync_synchronize();
+		e->flags = host->flags;
+		e->icmp_type = host->icmp_type;
+		e->icmp_code = host->icmp_code;
+		e->icmp_sent = host->icmp_sent;
+		e->icmp_recv = host->icmp_recv;
+		e->updated = round_started;
+		e->time_waited = host->time_waited;
+		e->rtmin = host->rtmin;
+		e->rtmax = host->rtmax;
+		e->jitter = host->jitter;
+		addr_to_sockaddr(&host->error_addr, &e->error_addr);
+		if(rtt_hist)
+			memcpy(e->hist, &rtt_hist[t * RTT_BUCKETS], RTT_BUCKETS);
+		__sync_synchronize();
+		e->seq++;
+	}
+}
+
+/* -D: a round over all targets every round_interval seconds, each in a
+ * child that publishes its results and exits, for as long as we live. The
+ * raw socket is opened once, the client mode (-R) needs none. */
+static void
+run_prober(void)
+{
+	struct stat st;
+	time_t next, now;
+	pid_t child;
+	unsigned int i;
+
+	if(mode == MODE_HOSTCHECK) {
+		errno = 0;
+		crash("-D does not work in host check mode");
+	}
+	for(i = 0; i < targets; i++) {
+		if(table[i].name && strlen(table[i].name) >= RESULTS_NAME_MAX) {
+			errno = 0;
+			crash("%s: name too long for -D", table[i].name);
+		}
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGALRM, SIG_DFL);
+	results_create();
+
+	for(next = time(NULL);; next += round_interval) {
+		if(targets_file && stat(targets_file, &st) == 0 &&
+		   (st.st_mtime != targets_stat.st_mtime || st.st_size != targets_stat.st_size ||
+		    st.st_ino != targets_stat.st_ino)) {
+			load_targets_file(FALSE);
+			results_create();
+		}
+
+		round_started = time(NULL);
+		if((child = fork()) < 0)
+			crash("fork() failed");
+		if(!child) {
+			/* replies to the rounds before are not ours */
+			pid = getpid() & 0xffff;
+			signal(SIGINT, finish);
+			signal(SIGHUP, finish);
+			signal(SIGTERM, finish);
+			signal(SIGALRM, finish);
+			start_checks();
+			errno = 0;
+			finish(0);
+		}
+		while(waitpid(child, NULL, 0) < 0 && errno == EINTR)
+			;
+
+		/* a round that took too long is followed by the next at once */
+		now = time(NULL);
+		if(next + round_interval > now)
+			sleep(next + round_interval - now);
+		else next = now - round_interval;
+	}
+}
+
+/* -R: the latest results of the named targets, judged as if we had just
+ * pinged them */
+static void
+read_results(char **names, int count)
+{
+	results_header *h;
+	results_entry copy, *e;
+	struct rta_host *host;
+	struct stat st;
+	unsigned int seq;
+	int fd, i, k, first, n, tries;
+	time_t now = time(NULL);
+
+	if(!count) {
+		errno = 0;
+		crash("No hosts to check");
+	}
+	if((fd = open(results_file, O_RDONLY)) < 0)
+		crash("Cannot open %s", results_file);
+	if(fstat(fd, &st) < 0 || st.st_size < RESULTS_HEADER ||
+	   (h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		crash("Cannot map %s", results_file);
+	close(fd);
+	if(h->magic != RESULTS_MAGIC || h->entry_size != sizeof(results_entry) ||
+	   (size_t)st.st_size < RESULTS_HEADER + (size_t)h->count * sizeof(results_entry)) {
+		errno = 0;
+		crash("%s is not a results table of this %s", results_file, progname);
+	}
+	results = h;
+	address_family = h->family;
+
+	for(i = 0; i < count; i++) {
+		if((first = results_find(h, names[i], &n)) < 0) {
+			errno = 0;
+			crash("%s is not probed by the prober writing %s", names[i], results_file);
+		}
+		for(k = 0; k < n; k++) {
+			e = &results_entries(h)[first + k];
+			for(tries = 0;; tries++) {
+				if(tries == 1000) {
+					errno = 0;
+					crash("The results of %s keep changing", names[i]);
+				}
+				seq = e->seq;
+				__sync_synchronize();
+				memcpy(&copy, (void *)e, sizeof(copy));
+				__sync_synchronize();
+				if(!(seq & 1) && seq == e->seq) break;
+			}
+			errno = 0;
+			if(!copy.updated)
+				crash("No results for %s yet", names[i]);
+			if(now - copy.updated > 2 * (long long)h->interval + h->timeout)
+				crash("The results for %s are %lld seconds old", names[i],
+				      (long long)(now - copy.updated));
+
+			if(targets == table_size) {
+				table_size = table_size ? table_size * 2 : 16;
+				if(!(table = realloc(table, table_size * sizeof(struct rta_host))) ||
+				   !(rtt_hist = realloc(rtt_hist, table_size * RTT_BUCKETS)))
+					crash("Cannot allocate memory");
+			}
+			host = &table[targets];
+			memset(host, 0, sizeof(struct rta_host));
+			host->name = names[i];
+			host->flags = copy.flags;
+			host->icmp_type = copy.icmp_type;
+			host->icmp_code = copy.icmp_code;
+			host->icmp_sent = copy.icmp_sent;
+			host->icmp_recv = copy.icmp_recv;
+			host->time_waited = copy.time_waited;
+			host->rtmin = copy.rtmin;
+			host->rtmax = copy.rtmax;
+			host->jitter = copy.jitter;
+			addr_from_sockaddr(&host->error_addr, &copy.error_addr);
+			memcpy(&rtt_hist[targets * RTT_BUCKETS], copy.hist, RTT_BUCKETS);
+			if(host->flags & FLAG_LOST_CAUSE) targets_down++;
+			targets++;
+		}
+	}
+
+	icmp_sock = udp_sock = tcp_sock = -1;
+	errno = 0;
+	finish(0);
+}
+
+
 /* response structure:
  * IPv4:
  * ip header   : 20 bytes
@@ -775,27 +1556,15 @@ run_checks()
 static int
 wait_for_reply(int sock, u_int t)
 {
-	int n, hlen;
+	int n;
 	static unsigned char buf[4096];
 	struct sockaddr_storage resp_addr;
-	union ip_hdr *ip;
-	union icmp_packet packet;
-	struct rta_host *host;
-	struct icmp_ping_data data;
 	struct timeval wait_start, now;
-	u_int tdiff, i, per_pkt_wait;
-
-	if (!(packet.buf = malloc(icmp_pkt_size))) {
-		crash("send_icmp_ping(): failed to malloc %d bytes for send buffer",
-			icmp_pkt_size);
-		return -1;	/* might be reached if we're in debug mode */
-	}
-
-	memset(packet.buf, 0, icmp_pkt_size);
+	u_int i, per_pkt_wait;
 
 	/* if we can't listen or don't have anything to listen to, just return */
+	threads_sync();
 	if(!t || !icmp_pkts_en_route) {
-		free(packet.buf);
 		return 0;
 	}
 
@@ -805,6 +1574,9 @@ wait_for_reply(int sock, u_int t)
 	per_pkt_wait = t / icmp_pkts_en_route;
 	while(icmp_pkts_en_route && get_timevaldiff(&wait_start, NULL) < i) {
 		t = per_pkt_wait;
+		if(nthreads && t > THREAD_POLL) t = THREAD_POLL;
+		if(neigh_sock > 0 && t > NEIGH_POLL) t = NEIGH_POLL;
+		neigh_sync();
 
 		/* wrap up if all targets are declared dead */
 		if(!targets_alive ||
@@ -822,127 +1594,145 @@ wait_for_reply(int sock, u_int t)
 				printf("recvfrom_wto() timed out during a %u usecs wait\n",
 					   per_pkt_wait);
 			}
+			threads_sync();
 			continue;	/* timeout for this one, so keep trying */
 		}
 		if(n < 0) {
 			if(debug) printf("recvfrom_wto() returned errors\n");
-			free(packet.buf);
 			return n;
 		}
 
-		// FIXME: with ipv6 we don't have an ip header here
-		if (address_family != AF_INET6) {
-			ip = (union ip_hdr *)buf;
+		handle_reply(buf, n, &resp_addr, &now, NULL);
+	}
 
-			if(debug > 1) {
-				char address[INET6_ADDRSTRLEN];
-				parse_address(&resp_addr, address, sizeof(address));
-				printf("received %u bytes from %s\n",
-					address_family == AF_INET6 ? ntohs(ip->ip6.ip6_plen)
-								   : ntohs(ip->ip.ip_len),
-					address);
-			}
-		}
+	return 0;
+}
+
+/* match one received packet against the targets and account for it */
+static void
+handle_reply(unsigned char *buf, int n, struct sockaddr_storage *from, struct timeval *now, void *arg)
+{
+	int echo;
+	union ip_hdr *ip = NULL;
+	union icmp_packet packet;
+	recv_thread *thread = arg;	/* NULL in the main thread */
+	struct rta_host *host;
+	np_icmp_reply reply;
+	struct sockaddr_storage resp_addr;
+	u_int tdiff;
+
+	memcpy(&resp_addr, from, sizeof(resp_addr));
+
+	// FIXME: with ipv6 we don't have an ip header here
+	if (address_family != AF_INET6) {
+		ip = (union ip_hdr *)buf;
 
-/* obsolete. alpha on tru64 provides the necessary defines, but isn't broken */
-/* #if defined( __alpha__ ) && __STDC__ && !defined( __GLIBC__ ) */
-		/* alpha headers are decidedly broken. Using an ansi compiler,
-		 * they provide ip_vhl instead of ip_hl and ip_v, so we mask
-		 * off the bottom 4 bits */
-/* 		hlen = (ip->ip_vhl & 0x0f) << 2; */
-/* #else */
-		hlen = (address_family == AF_INET6) ? 0 : ip->ip.ip_hl << 2;
-/* #endif */
-
-		if(n < (hlen + ICMP_MINLEN)) {
+		if(debug > 1) {
 			char address[INET6_ADDRSTRLEN];
 			parse_address(&resp_addr, address, sizeof(address));
-			crash("received packet too short for ICMP (%d bytes, expected %d) from %s\n",
-				  n, hlen + icmp_pkt_size, address);
+			printf("received %u bytes from %s\n",
+				ntohs(ip->ip.ip_len), address);
 		}
-		/* else if(debug) { */
-		/* 	printf("ip header size: %u, packet size: %u (expected %u, %u)\n", */
-		/* 		   hlen, ntohs(ip->ip_len) - hlen, */
-		/* 		   sizeof(struct ip), icmp_pkt_size); */
-		/* } */
+	}
 
-		/* check the response */
+	echo = np_icmp_parse_reply(buf, n, address_family, address_family != AF_INET6, &reply);
+	if(echo < 0) {
+		char address[INET6_ADDRSTRLEN];
+		parse_address(&resp_addr, address, sizeof(address));
+		crash("received packet too short for ICMP (%d bytes, expected %d) from %s\n",
+			  n, reply.hlen + icmp_pkt_size, address);
+	}
 
-		memcpy(packet.buf, buf + hlen, icmp_pkt_size);
-/*			address_family == AF_INET6 ? sizeof(struct icmp6_hdr)
-						   : sizeof(struct icmp));*/
+	/* check the response */
+	packet.buf = reply.icmp;
+	if(!echo || reply.id != (thread ? thread->id : pid) || reply.seq >= targets * packets) {
+		if(debug > 2) printf("not a proper ICMP_ECHOREPLY\n");
+		/* the main thread takes care of the errors */
+		if(!thread) handle_random_icmp(reply.icmp, &resp_addr);
+		return;
+	}
 
-		if(   (address_family == PF_INET &&
-			(ntohs(packet.icp->icmp_id) != pid || packet.icp->icmp_type != ICMP_ECHOREPLY
-			 || ntohs(packet.icp->icmp_seq) >= targets * packets))
-		   || (address_family == PF_INET6 &&
-			(ntohs(packet.icp6->icmp6_id) != pid || packet.icp6->icmp6_type != ICMP6_ECHO_REPLY
-			|| ntohs(packet.icp6->icmp6_seq) >= targets * packets))) {
-			if(debug > 2) printf("not a proper ICMP_ECHOREPLY\n");
-			handle_random_icmp(buf + hlen, &resp_addr);
-			continue;
-		}
+	/* this is indeed a valid response */
+	if (debug > 2)
+		printf("ICMP echo-reply of len %lu, id %u, seq %u, cksum 0x%X\n",
+			(unsigned long)sizeof(reply.data), reply.id, reply.seq,
+			address_family == PF_INET ? packet.icp->icmp_cksum : packet.icp6->icmp6_cksum);
+	host = &table[reply.seq/packets];
+
+	tdiff = get_timevaldiff(&reply.data.stime, now);
+
+	host->time_waited += tdiff;
+	host->icmp_recv++;
+	if(thread) thread->recv++;
+	else icmp_recv++;
+	if (tdiff > host->rtmax)
+		host->rtmax = tdiff;
+	if (tdiff < host->rtmin)
+		host->rtmin = tdiff;
+	if (host->icmp_recv > 1)
+		host->jitter += tdiff > host->last_rtt ? tdiff - host->last_rtt : host->last_rtt - tdiff;
+	host->last_rtt = tdiff;
+	if (rtt_hist)
+		rtt_hist[(host - table) * RTT_BUCKETS + rtt_bucket(tdiff)]++;
 
-		/* this is indeed a valid response */
-		if (address_family == PF_INET) {
-			memcpy(&data, packet.icp->icmp_data, sizeof(data));
-			if (debug > 2)
-				printf("ICMP echo-reply of len %lu, id %u, seq %u, cksum 0x%X\n",
-					(unsigned long)sizeof(data), ntohs(packet.icp->icmp_id),
-					ntohs(packet.icp->icmp_seq), packet.icp->icmp_cksum);
-			host = table[ntohs(packet.icp->icmp_seq)/packets];
-		} else {
-			memcpy(&data, &packet.icp6->icmp6_dataun.icmp6_un_data8[4], sizeof(data));
-			if (debug > 2)
-				printf("ICMP echo-reply of len %lu, id %u, seq %u, cksum 0x%X\n",
-					(unsigned long)sizeof(data), ntohs(packet.icp6->icmp6_id),
-					ntohs(packet.icp6->icmp6_seq), packet.icp6->icmp6_cksum);
-			host = table[ntohs(packet.icp6->icmp6_seq)/packets];
-		}
+	if(debug) {
+		char address[INET6_ADDRSTRLEN];
+		parse_address(&resp_addr, address, sizeof(address));
+		printf("%0.3f ms rtt from %s, outgoing ttl: %u, incoming ttl: %u, max: %0.3f, min: %0.3f\n",
+			(float)tdiff / 1000, address,
+			ttl, ip ? ip->ip.ip_ttl : 0, (float)host->rtmax / 1000, (float)host->rtmin / 1000);
+	}
 
-		tdiff = get_timevaldiff(&data.stime, &now);
+	/* if we're in hostcheck mode, exit with limited printouts */
+	if(mode == MODE_HOSTCHECK) {
+		if(thread) icmp_recv = host->icmp_recv;
+		printf("OK - %s responds to ICMP. Packet %u, rta %0.3fms|"
+			"pkt=%u;;0;%u rta=%0.3f;%0.3f;%0.3f;;\n",
+			host_name(host), icmp_recv, (float)tdiff / 1000,
+			icmp_recv, packets, (float)tdiff / 1000,
+			(float)warn.rta / 1000, (float)crit.rta / 1000);
+		exit(STATE_OK);
+	}
+}
 
-		host->time_waited += tdiff;
-		host->icmp_recv++;
-		icmp_recv++;
-		if (tdiff > host->rtmax)
-			host->rtmax = tdiff;
-		if (tdiff < host->rtmin)
-			host->rtmin = tdiff;
+/* the ping functions */
 
-		if(debug) {
-			char address[INET6_ADDRSTRLEN];
-			parse_address(&resp_addr, address, sizeof(address));
-			printf("%0.3f ms rtt from %s, outgoing ttl: %u, incoming ttl: %u, max: %0.3f, min: %0.3f\n",
-				(float)tdiff / 1000, address,
-				ttl, ip->ip.ip_ttl, (float)host->rtmax / 1000, (float)host->rtmin / 1000);
-		}
+/* one echo request per slot of a batch, built once and then only updated
+ * for each send, see np_icmp_echo_update() */
+static unsigned char *icmp_packets[NP_ICMP_SEND_BATCH];
 
-		/* if we're in hostcheck mode, exit with limited printouts */
-		if(mode == MODE_HOSTCHECK) {
-			printf("OK - %s responds to ICMP. Packet %u, rta %0.3fms|"
-				"pkt=%u;;0;%u rta=%0.3f;%0.3f;%0.3f;;\n",
-				host->name, icmp_recv, (float)tdiff / 1000,
-				icmp_recv, packets, (float)tdiff / 1000,
-				(float)warn.rta / 1000, (float)crit.rta / 1000);
-			exit(STATE_OK);
-		}
+static void
+init_icmp_packets(void)
+{
+	np_icmp_echo_data data;
+	size_t stride = (icmp_pkt_size + 7) & ~7;
+	unsigned char *buf;
+	int i;
+
+	if(!(buf = calloc(NP_ICMP_SEND_BATCH, stride))) {
+		crash("init_icmp_packets(): failed to malloc %lu bytes for send buffers",
+			  (unsigned long)(NP_ICMP_SEND_BATCH * stride));
+		return;	/* might be reached if we're in debug mode */
 	}
 
-	free(packet.buf);
-	return 0;
+	memset(&data, 0, sizeof(data));
+	data.ping_id = 10;
+	for(i = 0; i < NP_ICMP_SEND_BATCH; i++) {
+		icmp_packets[i] = buf + i * stride;
+		np_icmp_echo_request(icmp_packets[i], icmp_pkt_size, address_family, pid, 0, &data);
+	}
 }
 
-/* the ping functions */
+/* send the next echo request to each of count hosts, with a single system
+ * call where the system has sendmmsg(). Returns the number sent. */
 static int
-send_icmp_ping(int sock, struct rta_host *host)
+send_icmp_batch(int sock, struct rta_host **hosts, int count)
 {
-	long int len;
-	struct icmp_ping_data data;
-	struct msghdr hdr;
-	struct iovec iov;
-	struct timeval tv;
-	void *buf = NULL;
+	struct sockaddr_storage addrs[NP_ICMP_SEND_BATCH], *to[NP_ICMP_SEND_BATCH];
+	int errors[NP_ICMP_SEND_BATCH];
+	np_icmp_echo_data data;
+	unsigned short seq;
+	int i, sent = 0;
 
 	if(sock == -1) {
 		errno = 0;
@@ -950,91 +1740,50 @@ send_icmp_ping(int sock, struct rta_host *host)
 		return -1;
 	}
 
-	if(!buf) {
-		if (!(buf = malloc(icmp_pkt_size))) {
-			crash("send_icmp_ping(): failed to malloc %d bytes for send buffer",
-				  icmp_pkt_size);
-			return -1;	/* might be reached if we're in debug mode */
-		}
-	}
-	memset(buf, 0, icmp_pkt_size);
-
-	if((gettimeofday(&tv, &tz)) == -1) {
-		free(buf);
-		return -1;
-	}
-
+	memset(&data, 0, sizeof(data));
 	data.ping_id = 10; /* host->icmp.icmp_sent; */
-	memcpy(&data.stime, &tv, sizeof(tv));
-
-	if (address_family == AF_INET) {
-		struct icmp *icp = (struct icmp*)buf;
-
-		memcpy(&icp->icmp_data, &data, sizeof(data));
+	for(i = 0; i < count; i++) {
+		if((gettimeofday(&data.stime, &tz)) == -1)
+			return -1;
 
-		icp->icmp_type = ICMP_ECHO;
-		icp->icmp_code = 0;
-		icp->icmp_cksum = 0;
-		icp->icmp_id = htons(pid);
-		icp->icmp_seq = htons(host->id++);
-		icp->icmp_cksum = icmp_checksum((unsigned short*)buf, icmp_pkt_size);
+		seq = hosts[i]->id++;
+		np_icmp_echo_update(icmp_packets[i], icmp_pkt_size, address_family,
+		                    echo_id(hosts[i]), seq, &data);
+		host_sockaddr(hosts[i], &addrs[i]);
+		to[i] = &addrs[i];
 
+		/* the ICMPv6 checksum is calculated automatically */
 		if (debug > 2)
 			printf("Sending ICMP echo-request of len %lu, id %u, seq %u, cksum 0x%X to host %s\n",
-				(unsigned long)sizeof(data), ntohs(icp->icmp_id), ntohs(icp->icmp_seq), icp->icmp_cksum, host->name);
+				(unsigned long)sizeof(data), echo_id(hosts[i]), seq,
+				address_family == AF_INET ? ((struct icmp *)icmp_packets[i])->icmp_cksum : 0,
+				host_name(hosts[i]));
 	}
-	else {
-		struct icmp6_hdr *icp6 = (struct icmp6_hdr*)buf;
-		memcpy(&icp6->icmp6_dataun.icmp6_un_data8[4], &data, sizeof(data));
-		icp6->icmp6_type = ICMP6_ECHO_REQUEST;
-		icp6->icmp6_code = 0;
-		icp6->icmp6_cksum = 0;
-		icp6->icmp6_id = htons(pid);
-		icp6->icmp6_seq = htons(host->id++);
-		// let checksum be calculated automatically
-
-		if (debug > 2) {
-			printf("Sending ICMP echo-request of len %lu, id %u, seq %u, cksum 0x%X to host %s\n",
-				(unsigned long)sizeof(data), ntohs(icp6->icmp6_id),
-				ntohs(icp6->icmp6_seq), icp6->icmp6_cksum, host->name);
-		}
-	}
-
-	memset(&iov, 0, sizeof(iov));
-	iov.iov_base = buf;
-	iov.iov_len = icmp_pkt_size;
 
-	memset(&hdr, 0, sizeof(hdr));
-	hdr.msg_name = (struct sockaddr *)&host->saddr_in;
-	hdr.msg_namelen = sizeof(struct sockaddr_storage);
-	hdr.msg_iov = &iov;
-	hdr.msg_iovlen = 1;
-
-	errno = 0;
-
-/* MSG_CONFIRM is a linux thing and only available on linux kernels >= 2.3.15, see send(2) */
-#ifdef MSG_CONFIRM
-	len = sendmsg(sock, &hdr, MSG_CONFIRM);
-#else
-	len = sendmsg(sock, &hdr, 0);
-#endif
+	np_icmp_send_batch(sock, icmp_packets, icmp_pkt_size, to, count, errors);
 
-	free(buf);
-
-	if(len < 0 || (unsigned int)len != icmp_pkt_size) {
-		if(debug) {
-			char address[INET6_ADDRSTRLEN];
-			parse_address((struct sockaddr_storage *)&host->saddr_in, address, sizeof(address));
-			printf("Failed to send ping to %s: %s\n", address, strerror(errno));
+	for(i = 0; i < count; i++) {
+		if(errors[i]) {
+			if(debug) {
+				char address[INET6_ADDRSTRLEN];
+				parse_address(&addrs[i], address, sizeof(address));
+				printf("Failed to send ping to %s: %s\n", address, strerror(errors[i]));
+			}
+			continue;
 		}
-		errno = 0;
-		return -1;
+		icmp_sent++;
+		hosts[i]->icmp_sent++;
+		sent++;
 	}
+	errno = 0;
 
-	icmp_sent++;
-	host->icmp_sent++;
+	return sent;
+}
 
-	return 0;
+static int
+send_icmp_ping(int sock, struct rta_host *host)
+{
+	return send_icmp_batch(sock, &host, 1) == 1 ? 0 : -1;
 }
 
 static int
@@ -1048,9 +1797,6 @@ recvfrom_wto(int sock, void *buf, unsigned int len, struct sockaddr *saddr,
 	char ans_data[4096];
 	struct msghdr hdr;
 	struct iovec iov;
-#ifdef SO_TIMESTAMP
-	struct cmsghdr* chdr;
-#endif
 
 	if(!*timo) {
 		if(debug) printf("*timo is not\n");
@@ -1087,26 +1833,260 @@ recvfrom_wto(int sock, void *buf, unsigned int len, struct sockaddr *saddr,
 	hdr.msg_controllen = sizeof(ans_data);
 
 	ret = recvmsg(sock, &hdr, 0);
-#ifdef SO_TIMESTAMP
-	for(chdr = CMSG_FIRSTHDR(&hdr); chdr; chdr = CMSG_NXTHDR(&hdr, chdr)) {
-		if(chdr->cmsg_level == SOL_SOCKET
-		   && chdr->cmsg_type == SO_TIMESTAMP
-		   && chdr->cmsg_len >= CMSG_LEN(sizeof(struct timeval))) {
-			memcpy(tv, CMSG_DATA(chdr), sizeof(*tv));
-			break ;
-		}
+	np_icmp_packet_time(&hdr, tv);
+	return (ret);
+}
+
+/* the echo id of the requests to a target */
+static unsigned short
+echo_id(struct rta_host *host)
+{
+	if(!nthreads) return pid;
+	return (pid + (host - table) / thread_span) & 0xffff;
+}
+
+/* whether an echo id is one of those we send */
+static int
+our_id(unsigned short id)
+{
+	return (unsigned short)(id - pid) < (nthreads ? nthreads : 1);
+}
+
+#ifdef RECV_THREADS
+/* let only the echo replies with id through, or with echo FALSE only what
+ * is no echo reply at all */
+static void
+attach_filter(int sock, int echo, unsigned short id)
+{
+	int reply = address_family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY;
+	struct sock_filter code[] = {
+		/* the ICMP header is behind the IP header on raw IPv4 sockets */
+		BPF_STMT(BPF_LDX+BPF_B+BPF_MSH, 0),
+		BPF_STMT(BPF_LD+BPF_B+BPF_IND, 0),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, reply, 0, 4),
+		BPF_STMT(BPF_LD+BPF_H+BPF_IND, 4),
+		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, id, 0, 1),
+		BPF_STMT(BPF_RET+BPF_K, echo ? 0xffff : 0),
+		BPF_STMT(BPF_RET+BPF_K, 0),
+		BPF_STMT(BPF_RET+BPF_K, echo ? 0 : 0xffff),
+	};
+	struct sock_fprog filter;
+
+	if(address_family == AF_INET6)
+		code[0].code = BPF_LDX+BPF_W+BPF_IMM;
+	filter.len = sizeof(code) / sizeof(code[0]);
+	filter.filter = code;
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == -1)
+		crash("failed to attach the socket filter for -T");
+}
+
+static void *
+recv_thread_loop(void *arg)
+{
+	recv_thread *thread = arg;
+#ifdef CPU_SET
+	cpu_set_t cpus;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/* a CPU of its own, as far as there are enough */
+	if(ncpus > 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET((thread - threads) % ncpus, &cpus);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) && debug)
+			printf("Failed to pin receive thread %ld\n", (long)(thread - threads));
 	}
+#endif
 
-	if (!chdr)
-#endif // SO_TIMESTAMP
-		gettimeofday(tv, &tz);
-	return (ret);
+	while(threads_running)
+		np_icmp_drain(thread->sock, THREAD_POLL, handle_reply, thread);
+
+	return NULL;
+}
+#endif /* RECV_THREADS */
+
+/* the sockets of the threads are raw ones too, so they are opened with
+ * the privileges, once for all rounds of a prober */
+static void
+threads_open(void)
+{
+	unsigned int i;
+
+	if(!(threads = calloc(nthreads, sizeof(*threads))))
+		crash("failed to allocate %u receive threads", nthreads);
+	for(i = 0; i < nthreads; i++) {
+		if((threads[i].sock = np_icmp_socket(address_family, FALSE, NULL)) == -1)
+			crash("Failed to obtain ICMP socket for receive thread %u", i);
+		np_icmp_timestamps(threads[i].sock, debug);
+	}
+}
+
+/* share the targets out, with the ids of this round */
+static void
+threads_start(void)
+{
+#ifdef RECV_THREADS
+	sigset_t all, old;
+	unsigned int i;
+
+	thread_span = (targets + nthreads - 1) / nthreads;
+	attach_filter(icmp_sock, FALSE, 0);
+	for(i = 0; i < nthreads; i++) {
+		threads[i].id = (pid + i) & 0xffff;
+		threads[i].recv = 0;
+		attach_filter(threads[i].sock, TRUE, threads[i].id);
+	}
+
+	/* the signals, and with them finish(), are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	threads_running = 1;
+	for(i = 0; i < nthreads; i++)
+		if(pthread_create(&threads[i].tid, NULL, recv_thread_loop, &threads[i]))
+			crash("failed to start receive thread %u", i);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(debug)
+		printf("%u receive threads, %u targets each\n", nthreads, thread_span);
+#endif
+}
+
+/* stop the threads, and with that the replies, for the report */
+static void
+threads_finish(void)
+{
+#ifdef RECV_THREADS
+	unsigned int i;
+
+	if(!threads_running) return;
+	threads_running = 0;
+	for(i = 0; i < nthreads; i++)
+		pthread_join(threads[i].tid, NULL);
+	threads_sync();
+#endif
+}
+
+/* the replies the threads took in count as received by the main thread */
+static void
+threads_sync(void)
+{
+	unsigned int i, recv = 0;
+
+	if(!nthreads || !threads) return;
+	for(i = 0; i < nthreads; i++)
+		recv += threads[i].recv;
+	icmp_recv = recv;
+}
+
+static void
+neigh_open(void)
+{
+#ifdef NEIGH_CHECK
+	struct sockaddr_nl local;
+
+	memset(&local, 0, sizeof(local));
+	local.nl_family = AF_NETLINK;
+	if((neigh_sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0 ||
+	   bind(neigh_sock, (struct sockaddr *)&local, sizeof(local)) < 0)
+		crash("Failed to open a netlink socket for -N");
+#endif
+}
+
+#ifdef NEIGH_CHECK
+/* the host has nobody at its address, so its packets are lost already */
+static void
+neigh_failed(struct rta_host *host)
+{
+	u_int en_route = host->icmp_sent - host->icmp_recv - host->icmp_lost;
+	struct sockaddr_storage addr;
+
+	if(debug) printf("%s has a failed neighbour entry, not waiting for it\n", host_name(host));
+	host->icmp_lost += en_route;
+	icmp_lost += en_route;
+	targets_down++;
+	host->flags |= FLAG_LOST_CAUSE;
+	host->icmp_type = address_family == AF_INET6 ? ICMP6_DST_UNREACH : ICMP_UNREACH;
+	host->icmp_code = address_family == AF_INET6 ? ICMP6_DST_UNREACH_ADDR : ICMP_UNREACH_HOST;
+	host_sockaddr(host, &addr);
+	addr_from_sockaddr(&host->error_addr, &addr);
+}
+#endif
+
+/* one dump of the neighbour table of our address family, at most every
+ * NEIGH_POLL, and every target in it with a fresh FAILED entry is lost */
+static void
+neigh_sync(void)
+{
+#ifdef NEIGH_CHECK
+	static char buf[16384];
+	static unsigned int seq;
+	static long ticks;
+	struct {
+		struct nlmsghdr nh;
+		struct ndmsg nd;
+	} req;
+	struct nlmsghdr *nh;
+	struct ndmsg *nd;
+	struct rtattr *rta;
+	struct nda_cacheinfo *ci;
+	icmp_addr dst;
+	unsigned long long now, age;
+	int len, attrlen, idx, done = 0;
+	unsigned char *addr;
+
+	if(neigh_sock <= 0) return;
+	now = get_timevaldiff(&prog_start, NULL);
+	if(neigh_last && now - neigh_last < NEIGH_POLL) return;
+	neigh_last = now ? now : 1;
+	if(!ticks) ticks = sysconf(_SC_CLK_TCK);
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = sizeof(req);
+	req.nh.nlmsg_type = RTM_GETNEIGH;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq = ++seq;
+	req.nd.ndm_family = address_family;
+	if(send(neigh_sock, &req, sizeof(req), 0) < 0) return;
+
+	while(!done && (len = recv(neigh_sock, buf, sizeof(buf), 0)) > 0) {
+		for(nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (unsigned int)len); nh = NLMSG_NEXT(nh, len)) {
+			if(nh->nlmsg_seq != seq) continue;
+			if(nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR) {
+				done = 1;
+				break;
+			}
+			nd = NLMSG_DATA(nh);
+			if(nh->nlmsg_type != RTM_NEWNEIGH || nd->ndm_family != address_family ||
+			   !(nd->ndm_state & NUD_FAILED))
+				continue;
+
+			addr = NULL;
+			ci = NULL;
+			attrlen = nh->nlmsg_len - NLMSG_LENGTH(sizeof(*nd));
+			for(rta = (struct rtattr *)((char *)nd + NLMSG_ALIGN(sizeof(*nd)));
+			    RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen)) {
+				if(rta->rta_type == NDA_DST)
+					addr = RTA_DATA(rta);
+				else if(rta->rta_type == NDA_CACHEINFO && RTA_PAYLOAD(rta) >= sizeof(*ci))
+					ci = RTA_DATA(rta);
+			}
+			if(!addr || !ci) continue;
+
+			/* in clock ticks since the entry changed */
+			age = (unsigned long long)ci->ndm_updated * 1000000 / ticks;
+			if(age > now + neigh_age) continue;
+
+			memset(&dst, 0, sizeof(dst));
+			memcpy(&dst, addr, address_family == AF_INET6 ? sizeof(struct in6_addr) : sizeof(struct in_addr));
+			if((idx = target_lookup(&dst)) >= 0 && !(table[idx].flags & FLAG_LOST_CAUSE))
+				neigh_failed(&table[idx]);
+		}
+	}
+#endif
 }
 
 static void
 finish(int sig)
 {
-	u_int i = 0;
+	u_int i = 0, t;
 	unsigned char pl;
 	double rta;
 	struct rta_host *host;
@@ -1114,14 +2094,33 @@ finish(int sig)
 	{"OK", "WARNING", "CRITICAL", "UNKNOWN", "DEPENDENT"};
 	int hosts_ok = 0;
 	int hosts_warn = 0;
+	int spread;
+	int p;
+	np_changes *changes = NULL;
+	unsigned char *shown = NULL;
+	u_int nshown = targets;
 
 	alarm(0);
 	if(debug > 1) printf("finish(%d) called\n", sig);
+	threads_finish();
+
+	/* a round of the prober ends here */
+	if(results && !results_client) {
+		publish_results();
+		_exit(0);
+	}
 
 	if(icmp_sock != -1) close(icmp_sock);
 	if(udp_sock != -1) close(udp_sock);
 	if(tcp_sock != -1) close(tcp_sock);
 
+	if(changes_refresh >= 0) {
+		changes = np_changes_load(changes_refresh);
+		shown = calloc(targets ? targets : 1, 1);
+		if(!shown) crash("calloc() failed for the changed targets");
+		nshown = 0;
+	}
+
 	if(debug) {
 		printf("icmp_sent: %u  icmp_recv: %u  icmp_lost: %u\n",
 			   icmp_sent, icmp_recv, icmp_lost);
@@ -1129,9 +2128,8 @@ finish(int sig)
 	}
 
 	/* iterate thrice to calculate values, give output, and print perfparse */
-	host = list;
-
-	while(host) {
+	for(t = 0; t < targets; t++) {
+		host = &table[t];
 		if(!host->icmp_recv) {
 			/* rta 0 is ofcourse not entirely correct, but will still show up
 			 * conspicuosly as missing entries in perfparse and cacti */
@@ -1147,18 +2145,26 @@ finish(int sig)
 		}
 		host->pl = pl;
 		host->rta = rta;
-		if(pl >= crit.pl || rta >= crit.rta) {
+		spread = check_rtt_spread(host);
+		if(pl >= crit.pl || rta >= crit.rta || spread == STATE_CRITICAL) {
 			status = STATE_CRITICAL;
 		}
-		else if(!status && (pl >= warn.pl || rta >= warn.rta)) {
+		else if(!status && (pl >= warn.pl || rta >= warn.rta || spread == STATE_WARNING)) {
 			status = STATE_WARNING;
 			hosts_warn++;
 		}
 		else {
 			hosts_ok++;
 		}
-
-		host = host->next;
+		if(changes) {
+			/* the state of the host on its own, whatever came before it */
+			int hstate = STATE_OK;
+			if(pl >= crit.pl || rta >= crit.rta || spread == STATE_CRITICAL)
+				hstate = STATE_CRITICAL;
+			else if(pl >= warn.pl || rta >= warn.rta || spread == STATE_WARNING)
+				hstate = STATE_WARNING;
+			if((shown[t] = np_changes_check(changes, host_name(host), hstate))) nshown++;
+		}
 	}
 	/* this is inevitable */
 	if(!targets_alive) status = STATE_CRITICAL;
@@ -1167,12 +2173,18 @@ finish(int sig)
 		else if((hosts_ok + hosts_warn) >= min_hosts_alive) status = STATE_WARNING;
 	}
 	printf("%s - ", status_string[status]);
+	if(changes) {
+		printf("%u targets, %lu changed%s", targets, changes->changed,
+			   changes->full ? ", all listed" : "");
+		if(nshown) printf(" :: ");
+	}
 
-	host = list;
-	while(host) {
+	for(t = 0; t < targets; t++) {
+		host = &table[t];
+		if(shown && !shown[t]) continue;
 		if(debug) puts("");
 		if(i) {
-			if(i < targets) printf(" :: ");
+			if(i < nshown) printf(" :: ");
 			else printf("\n");
 		}
 		i++;
@@ -1180,39 +2192,56 @@ finish(int sig)
 			status = STATE_CRITICAL;
 			if(host->flags & FLAG_LOST_CAUSE) {
 				char address[INET6_ADDRSTRLEN];
-				parse_address(&host->error_addr, address, sizeof(address));
+				inet_ntop(address_family, &host->error_addr, address, sizeof(address));
 				printf("%s: %s @ %s. rta nan, lost %d%%",
-					   host->name,
+					   host_name(host),
 					   get_icmp_error_msg(host->icmp_type, host->icmp_code),
 					   address,
 					   100);
 			}
 			else { /* not marked as lost cause, so we have no flags for it */
-				printf("%s: rta nan, lost 100%%", host->name);
+				printf("%s: rta nan, lost 100%%", host_name(host));
 			}
 		}
 		else {	/* !icmp_recv */
 			printf("%s: rta %0.3fms, lost %u%%",
-				   host->name, host->rta / 1000, host->pl);
+				   host_name(host), host->rta / 1000, host->pl);
+			for(p = 0; p < n_percentiles; p++)
+				printf(", p%g %0.3fms", percentiles[p].pct, rtt_percentile(host, percentiles[p].pct) / 1000);
+			if(report_jitter)
+				printf(", jitter %0.3fms",
+					   host->icmp_recv > 1 ? host->jitter / (host->icmp_recv - 1) / 1000 : 0.0);
 		}
-
-		host = host->next;
 	}
 
 	/* iterate once more for pretty perfparse output */
 	printf("|");
-	i = 0;
-	host = list;
-	while(host) {
+	for(t = 0; t < targets; t++) {
+		host = &table[t];
+		if(shown && !shown[t]) continue;
 		if(debug) puts("");
 		printf("%srta=%0.3fms;%0.3f;%0.3f;0; %spl=%u%%;%u;%u;; %srtmax=%0.3fms;;;; %srtmin=%0.3fms;;;; ",
-			   (targets > 1) ? host->name : "",
+			   (targets > 1) ? host_name(host) : "",
 			   host->rta / 1000, (float)warn.rta / 1000, (float)crit.rta / 1000,
-			   (targets > 1) ? host->name : "", host->pl, warn.pl, crit.pl,
-			   (targets > 1) ? host->name : "", (float)host->rtmax / 1000,
-			   (targets > 1) ? host->name : "", (host->rtmin < DBL_MAX) ? (float)host->rtmin / 1000 : (float)0);
-
-		host = host->next;
+			   (targets > 1) ? host_name(host) : "", host->pl, warn.pl, crit.pl,
+			   (targets > 1) ? host_name(host) : "", (float)host->rtmax / 1000,
+			   (targets > 1) ? host_name(host) : "", (host->rtmin < DBL_MAX) ? (float)host->rtmin / 1000 : (float)0);
+		for(p = 0; p < n_percentiles; p++) {
+			printf("%sp%g=%0.3fms;", (targets > 1) ? host_name(host) : "", percentiles[p].pct,
+				   host->icmp_recv ? rtt_percentile(host, percentiles[p].pct) / 1000 : 0.0);
+			if(percentiles[p].warn) printf("%0.3f", (float)percentiles[p].warn / 1000);
+			printf(";");
+			if(percentiles[p].crit) printf("%0.3f", (float)percentiles[p].crit / 1000);
+			printf(";0; ");
+		}
+		if(report_jitter) {
+			printf("%sjitter=%0.3fms;", (targets > 1) ? host_name(host) : "",
+				   host->icmp_recv > 1 ? host->jitter / (host->icmp_recv - 1) / 1000 : 0.0);
+			if(jitter_warn) printf("%0.3f", (float)jitter_warn / 1000);
+			printf(";");
+			if(jitter_crit) printf("%0.3f", (float)jitter_crit / 1000);
+			printf(";0; ");
+		}
 	}
 
 	if(min_hosts_alive > -1) {
@@ -1222,8 +2251,28 @@ finish(int sig)
 
 	/* finish with an empty line */
 	puts("");
+	if(changes) np_changes_save(changes);
 	if(debug) printf("targets: %u, targets_alive: %u, hosts_ok: %u, hosts_warn: %u, min_hosts_alive: %i\n",
 					 targets, targets_alive, hosts_ok, hosts_warn, min_hosts_alive);
+	if(debug) {
+		struct rusage ru;
+		double cpu;
+
+		getrusage(RUSAGE_SELF, &ru);
+		cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+			(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+		printf("memory: %lu bytes of host table, %lu bytes of address hash, %lu bytes of rtt histograms, %lu bytes per target\n",
+			   (unsigned long)(table_size * sizeof(struct rta_host)),
+			   (unsigned long)(addr_hash_size * sizeof(*addr_hash)),
+			   rtt_hist ? (unsigned long)targets * RTT_BUCKETS : 0UL,
+			   targets ? (unsigned long)((table_size * sizeof(struct rta_host) +
+				   addr_hash_size * sizeof(*addr_hash) +
+				   (rtt_hist ? (unsigned long)targets * RTT_BUCKETS : 0UL)) / targets) : 0UL);
+		printf("cpu: %0.3fs user, %0.3fs system, %0.3fus per target\n",
+			   ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0,
+			   ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0,
+			   targets ? cpu * 1000000 / targets : 0.0);
+	}
 
 	exit(status);
 }
@@ -1252,12 +2301,182 @@ get_timevaldiff(struct timeval *early, struct timeval *later)
 	return ret;
 }
 
+/* the address hash finds targets by address: for duplicate -H arguments
+ * and for error replies, which quote the address we sent to. The hosts of
+ * ranges are not in it, target_lookup() finds them by arithmetic. */
+static size_t
+addr_len(void)
+{
+	return address_family == AF_INET6 ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+}
+
+static unsigned int
+addr_hash_slot(icmp_addr *addr)
+{
+	const unsigned char *key = (const unsigned char *)addr;
+	size_t len = addr_len(), i;
+	unsigned int h = 2166136261U;	/* FNV-1a */
+
+	for(i = 0; i < len; i++) {
+		h ^= key[i];
+		h *= 16777619U;
+	}
+	return h & (addr_hash_size - 1);
+}
+
+static int
+addr_hash_lookup(icmp_addr *addr)
+{
+	unsigned int slot;
+
+	if(!addr_hash_size) return -1;
+
+	for(slot = addr_hash_slot(addr); addr_hash[slot]; slot = (slot + 1) & (addr_hash_size - 1)) {
+		if(!memcmp(addr, &table[addr_hash[slot] - 1].addr, addr_len()))
+			return addr_hash[slot] - 1;
+	}
+	return -1;
+}
+
+static void
+addr_hash_insert(unsigned int idx)
+{
+	unsigned int slot, i;
+
+	/* keep the load below one half, rehashing everything when growing */
+	if((idx + 1) * 2 > addr_hash_size) {
+		free(addr_hash);
+		addr_hash_size = addr_hash_size ? addr_hash_size * 2 : 64;
+		if(!(addr_hash = calloc(addr_hash_size, sizeof(*addr_hash))))
+			crash("addr_hash_insert(): failed to malloc %u slots", addr_hash_size);
+		for(i = 0; i < idx; i++)
+			if(!(table[i].flags & FLAG_IN_RANGE)) addr_hash_insert(i);
+	}
+	for(slot = addr_hash_slot(&table[idx].addr); addr_hash[slot];
+		slot = (slot + 1) & (addr_hash_size - 1))
+		;
+	addr_hash[slot] = idx + 1;
+}
+
+/* how far addr is past base, both of one range: its prefix is at least
+ * /16 for IPv4 and /112 for IPv6, so the rest of the two agrees */
+static unsigned long
+range_offset(icmp_addr *base, icmp_addr *addr)
+{
+	uint32_t b, a;
+
+	if(address_family == AF_INET6) {
+		if(memcmp(base->in6.s6_addr, addr->in6.s6_addr, 12))
+			return ULONG_MAX;
+		memcpy(&b, base->in6.s6_addr + 12, sizeof(b));
+		memcpy(&a, addr->in6.s6_addr + 12, sizeof(a));
+	}
+	else {
+		b = base->in.s_addr;
+		a = addr->in.s_addr;
+	}
+	return ntohl(a) >= ntohl(b) ? ntohl(a) - ntohl(b) : ULONG_MAX;
+}
+
+/* the table index of the target with that address, -1 if there is none */
+static int
+target_lookup(icmp_addr *addr)
+{
+	unsigned long off;
+	unsigned int i;
+
+	for(i = 0; i < nranges; i++) {
+		off = range_offset(&ranges[i].base, addr);
+		if(off < ranges[i].count)
+			return ranges[i].first + off;
+	}
+	return addr_hash_lookup(addr);
+}
+
+/* the address off past base, the reverse of range_offset() */
+static void
+range_addr(icmp_addr *base, unsigned long off, icmp_addr *addr)
+{
+	uint32_t low;
+
+	*addr = *base;
+	if(address_family == AF_INET6) {
+		memcpy(&low, addr->in6.s6_addr + 12, sizeof(low));
+		low = htonl(ntohl(low) + off);
+		memcpy(addr->in6.s6_addr + 12, &low, sizeof(low));
+	}
+	else
+		addr->in.s_addr = htonl(ntohl(addr->in.s_addr) + off);
+}
+
+static void
+host_addr(struct rta_host *host, icmp_addr *addr)
+{
+	unsigned int idx = host - table, lo = 0, hi = nranges, mid;
+
+	if(!(host->flags & FLAG_IN_RANGE)) {
+		*addr = host->addr;
+		return;
+	}
+	/* the last range starting at or before it */
+	while(hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if(ranges[mid].first <= idx) lo = mid;
+		else hi = mid;
+	}
+	range_addr(&ranges[lo].base, idx - ranges[lo].first, addr);
+}
+
+static void
+host_sockaddr(struct rta_host *host, struct sockaddr_storage *out)
+{
+	icmp_addr addr;
+
+	host_addr(host, &addr);
+	addr_to_sockaddr(&addr, out);
+}
+
+/* the name of a host of a range is its address, made the first time it
+ * is asked for, which is when the host gets printed */
+static const char *
+host_name(struct rta_host *host)
+{
+	char address[INET6_ADDRSTRLEN];
+	icmp_addr addr;
+
+	if(!host->name) {
+		host_addr(host, &addr);
+		inet_ntop(address_family, &addr, address, sizeof(address));
+		if(!(host->name = strdup(address)))
+			crash("Cannot allocate memory");
+	}
+	return host->name;
+}
+
+/* make room in the table for count more targets at once */
+static void
+table_reserve(char *arg, unsigned int count)
+{
+	if(targets + count > USHRT_MAX)
+		crash("add_target(%s): too many targets", arg);
+	if(targets + count <= table_size)
+		return;
+	table_size = table_size ? table_size * 2 : 16;
+	if(table_size < targets + count) table_size = targets + count;
+	if(table_size > USHRT_MAX) table_size = USHRT_MAX;
+	table = (struct rta_host*)realloc(table, table_size * sizeof(struct rta_host));
+	if(!table)
+		crash("add_target(%s): realloc(%lu) failed",
+			arg, (unsigned long)(table_size * sizeof(struct rta_host)));
+}
+
 static int
 add_target_ip(char *arg, struct sockaddr_storage *in)
 {
 	struct rta_host *host;
-	struct sockaddr_in *sin, *host_sin;
-	struct sockaddr_in6 *sin6, *host_sin6;
+	struct sockaddr_in *sin;
+	struct sockaddr_in6 *sin6;
+	icmp_addr addr;
 
 	if (address_family == AF_INET)
 		sin = (struct sockaddr_in *)in;
@@ -1275,51 +2494,120 @@ add_target_ip(char *arg, struct sockaddr_storage *in)
 	}
 
 	/* no point in adding two identical IP's, so don't. ;) */
-	host = list;
-	while(host) {
-		host_sin = (struct sockaddr_in *)&host->saddr_in;
-		host_sin6 = (struct sockaddr_in6 *)&host->saddr_in;
-
-		if(   (address_family == AF_INET && host_sin->sin_addr.s_addr == sin->sin_addr.s_addr)
-		   || (address_family == AF_INET6 && host_sin6->sin6_addr.s6_addr == sin6->sin6_addr.s6_addr)) {
-			if(debug) printf("Identical IP already exists. Not adding %s\n", arg);
-			return -1;
-		}
-		host = host->next;
+	addr_from_sockaddr(&addr, in);
+	if(target_lookup(&addr) >= 0) {
+		if(debug) printf("Identical IP already exists. Not adding %s\n", arg);
+		return -1;
 	}
 
 	/* add the fresh ip */
-	host = (struct rta_host*)malloc(sizeof(struct rta_host));
-	if(!host) {
-		char straddr[INET6_ADDRSTRLEN];
-		parse_address((struct sockaddr_storage*)&in, straddr, sizeof(straddr));
-		crash("add_target_ip(%s, %s): malloc(%d) failed",
-			arg, straddr, sizeof(struct rta_host));
-	}
+	table_reserve(arg, 1);
+	host = &table[targets];
 	memset(host, 0, sizeof(struct rta_host));
 
 	/* set the values. use calling name for output */
 	host->name = strdup(arg);
+	host->addr = addr;
+	host->rtmin = DBL_MAX;
 
-	/* fill out the sockaddr_storage struct */
-	if(address_family == AF_INET) {
-		host_sin = (struct sockaddr_in *)&host->saddr_in;
-		host_sin->sin_family = AF_INET;
-		host_sin->sin_addr.s_addr = sin->sin_addr.s_addr;
-	}
-	else {
-		host_sin6 = (struct sockaddr_in6 *)&host->saddr_in;
-		host_sin6->sin6_family = AF_INET6;
-		memcpy(host_sin6->sin6_addr.s6_addr, sin6->sin6_addr.s6_addr, sizeof host_sin6->sin6_addr.s6_addr);
+	addr_hash_insert(targets);
+	targets++;
+
+	return 0;
+}
+
+/* a range given wrongly stops us, but for one in a -f file */
+static int
+range_fail(char *arg, const char *why)
+{
+	if(resolve_soft) {
+		if(debug) printf("%s: %s, not probed\n", arg, why);
+		return -1;
 	}
+	errno = 0;
+	crash("%s: %s", arg, why);
+	return -1;
+}
 
-	host->rtmin = DBL_MAX;
+/* ADDRESS/PREFIX: every address of the network, but for the network and
+ * broadcast addresses of an IPv4 one larger than a /31. The hosts only get
+ * their counters here, see host_addr() and host_name(). */
+static int
+add_target_range(char *arg, char *slash)
+{
+	struct sockaddr_storage ip;
+	struct rta_host *host;
+	icmp_addr base, addr;
+	unsigned long count, i, bits;
+	uint32_t low;
+	char *end;
+	long prefix;
+	int family, result;
+
+	family = address_family == -1 ? AF_INET : address_family;
+	*slash = '\0';
+	memset(&ip, 0, sizeof(ip));
+	ip.ss_family = family;
+	result = inet_pton(family, arg, family == AF_INET6
+	                   ? (void *)&((struct sockaddr_in6 *)&ip)->sin6_addr
+	                   : (void *)&((struct sockaddr_in *)&ip)->sin_addr);
+#ifdef USE_IPV6
+	if(result != 1 && address_family == -1) {
+		family = AF_INET6;
+		result = inet_pton(family, arg, &((struct sockaddr_in6 *)&ip)->sin6_addr);
+	}
+#endif
+	*slash = '/';
+	prefix = strtol(slash + 1, &end, 10);
+	bits = family == AF_INET6 ? 128 : 32;
+	if(result != 1 || *end || end == slash + 1 || prefix < 0 || prefix > (long)bits)
+		return range_fail(arg, "not an address range");
+	if(bits - prefix >= 17 || (family == AF_INET6 && bits - prefix == 16))
+		return range_fail(arg, "range too large");
+	address_family = family;
+
+	/* from the first address of the network, whatever the one given */
+	addr_from_sockaddr(&base, &ip);
+	if(address_family == AF_INET6)
+		memcpy(&low, base.in6.s6_addr + 12, sizeof(low));
+	else
+		low = base.in.s_addr;
+	count = 1UL << (bits - prefix);
+	low = htonl(ntohl(low) & ~(uint32_t)(count - 1));
+	if(address_family == AF_INET && count > 2) {
+		low = htonl(ntohl(low) + 1);
+		count -= 2;
+	}
+	if(address_family == AF_INET6)
+		memcpy(base.in6.s6_addr + 12, &low, sizeof(low));
+	else
+		base.in.s_addr = low;
 
-	if(!list) list = cursor = host;
-	else cursor->next = host;
+	/* the targets before it keep their places, so it may not have them */
+	for(i = 0; i < count; i++) {
+		range_addr(&base, i, &addr);
+		if(target_lookup(&addr) >= 0)
+			return range_fail(arg, "range overlaps another target");
+	}
 
-	cursor = host;
-	targets++;
+	table_reserve(arg, count);
+	if(nranges == ranges_size) {
+		ranges_size = ranges_size ? ranges_size * 2 : 8;
+		if(!(ranges = realloc(ranges, ranges_size * sizeof(target_range))))
+			crash("Cannot allocate memory");
+	}
+	ranges[nranges].first = targets;
+	ranges[nranges].count = count;
+	ranges[nranges].base = base;
+	nranges++;
+
+	for(i = 0; i < count; i++) {
+		host = &table[targets++];
+		memset(host, 0, sizeof(struct rta_host));
+		host->flags = FLAG_IN_RANGE;
+		host->rtmin = DBL_MAX;
+	}
+	if(debug) printf("%s: %lu targets\n", arg, count);
 
 	return 0;
 }
@@ -1333,6 +2621,10 @@ add_target(char *arg)
 	struct addrinfo hints, *res, *p;
 	struct sockaddr_in *sin;
 	struct sockaddr_in6 *sin6;
+	char *slash;
+
+	if((slash = strchr(arg, '/')))
+		return add_target_range(arg, slash);
 
 	switch (address_family) {
 	case -1:
@@ -1377,7 +2669,11 @@ add_target(char *arg)
 			hints.ai_family = address_family == AF_INET ? PF_INET : PF_INET6;
 		}
 		hints.ai_socktype = SOCK_RAW;
-		if((error = getaddrinfo(arg, NULL, &hints, &res)) != 0) {
+		if((error = np_getaddrinfo(arg, NULL, &hints, &res)) != 0) {
+			if(resolve_soft) {
+				if(debug) printf("Failed to resolve %s: %s\n", arg, gai_strerror(error));
+				return -1;
+			}
 			errno = 0;
 			crash("Failed to resolve %s: %s", arg, gai_strerror(error));
 			return -1;
@@ -1513,25 +2809,120 @@ get_threshold(char *str, threshold *th)
 	return 0;
 }
 
-unsigned short
-icmp_checksum(unsigned short *p, int n)
+/* -P 50,95,99 */
+static void
+get_percentiles(char *str)
+{
+	char *p = str;
+	double pct;
+
+	while(*p) {
+		pct = strtod(p, &p);
+		if(pct <= 0 || pct > 100 || (*p && *p != ','))
+			usage2(_("Percentiles must be numbers above 0 and up to 100"), str);
+		if(n_percentiles == MAX_PERCENTILES)
+			usage4(_("Too many percentiles"));
+		percentiles[n_percentiles++].pct = pct;
+		if(*p == ',') p++;
+	}
+}
+
+/* -Q 95=200,400 for WARNING if p95 >= 200ms and CRITICAL if p95 >= 400ms */
+static void
+get_percentile_threshold(char *str)
 {
-	unsigned short cksum;
-	long sum = 0;
+	char *p;
+	double pct;
+	int i;
 
-	while(n > 2) {
-		sum += *p++;
-		n -= sizeof(unsigned short);
+	pct = strtod(str, &p);
+	if(pct <= 0 || pct > 100 || *p != '=')
+		usage2(_("Percentile thresholds look like 95=200,400"), str);
+	for(i = 0; i < n_percentiles; i++)
+		if(percentiles[i].pct == pct) break;
+	if(i == n_percentiles) {
+		if(n_percentiles == MAX_PERCENTILES)
+			usage4(_("Too many percentiles"));
+		percentiles[n_percentiles++].pct = pct;
+	}
+	str = p + 1;
+	if((p = strchr(str, ',')) != NULL) {
+		*p = '\0';
+		percentiles[i].crit = get_timevar(p + 1);
 	}
+	percentiles[i].warn = get_timevar(str);
+}
+
+/* bucket 0 holds everything below 4us, then four buckets for each power
+ * of two: 4-5us, 5-6us, 6-7us, 7-8us, 8-10us and so on */
+static int
+rtt_bucket(u_int usec)
+{
+	int bit = RTT_BUCKET_MIN_BIT;
 
-	/* mop up the occasional odd byte */
-	if(n == 1) sum += (unsigned char)*p;
+	if(usec < (1U << RTT_BUCKET_MIN_BIT)) return 0;
+	while(bit < RTT_BUCKET_MAX_BIT && (usec >> (bit + 1)))
+		bit++;
+	if(usec >> (bit + 1)) return RTT_BUCKETS - 1;
+	return 1 + (bit - RTT_BUCKET_MIN_BIT) * 4 + ((usec >> (bit - 2)) & 3);
+}
 
-	sum = (sum >> 16) + (sum & 0xffff);	/* add hi 16 to low 16 */
-	sum += (sum >> 16);			/* add carry */
-	cksum = ~sum;				/* ones-complement, trunc to 16 bits */
+/* The rtt at or below which pct percent of the replies came back, with the
+ * rank spread evenly over its bucket and kept between rtmin and rtmax */
+static double
+rtt_percentile(struct rta_host *host, double pct)
+{
+	unsigned char *hist;
+	unsigned int rank, seen = 0;
+	double lo, width, value;
+	int b, bit;
+
+	if(!rtt_hist || !host->icmp_recv) return 0;
+	hist = &rtt_hist[(host - table) * RTT_BUCKETS];
+	rank = (unsigned int)(pct / 100 * host->icmp_recv + 0.999999);
+	if(rank < 1) rank = 1;
+	for(b = 0; b < RTT_BUCKETS - 1; b++) {
+		if(seen + hist[b] >= rank) break;
+		seen += hist[b];
+	}
+	if(b == 0) {
+		lo = 0;
+		width = 1 << RTT_BUCKET_MIN_BIT;
+	}
+	else {
+		bit = RTT_BUCKET_MIN_BIT + (b - 1) / 4;
+		width = 1U << (bit - 2);
+		lo = (1U << bit) + ((b - 1) % 4) * width;
+	}
+	value = hist[b] ? lo + width * (rank - seen - 0.5) / hist[b] : lo;
+	if(value < host->rtmin) value = host->rtmin;
+	if(value > host->rtmax) value = host->rtmax;
+	return value;
+}
 
-	return cksum;
+/* the state of the percentiles and the jitter of a target */
+static int
+check_rtt_spread(struct rta_host *host)
+{
+	int result = STATE_OK, i;
+	double value;
+
+	if(!host->icmp_recv) return STATE_OK;
+	for(i = 0; i < n_percentiles; i++) {
+		value = rtt_percentile(host, percentiles[i].pct);
+		if(percentiles[i].crit && value >= percentiles[i].crit)
+			return STATE_CRITICAL;
+		if(percentiles[i].warn && value >= percentiles[i].warn)
+			result = STATE_WARNING;
+	}
+	if(host->icmp_recv > 1) {
+		value = host->jitter / (host->icmp_recv - 1);
+		if(jitter_crit && value >= jitter_crit)
+			return STATE_CRITICAL;
+		if(jitter_warn && value >= jitter_warn)
+			result = STATE_WARNING;
+	}
+	return result;
 }
 
 void
@@ -1551,7 +2942,8 @@ print_help(void)
   printf (UT_EXTRA_OPTS);
 
   printf (" %s\n", "-H");
-  printf ("    %s\n", _("specify a target"));
+  printf ("    %s\n", _("specify a target, or a range such as 10.0.0.0/24 of up to 65535 addresses"));
+  printf ("    %s\n", _("(without the network and broadcast addresses), which -f takes as well"));
   printf (" %s\n", "[-4|-6]");
   printf ("    %s\n", _("Use IPv4 (default) or IPv6 to communicate with the targets"));
   printf (" %s\n", "-w");
@@ -1571,6 +2963,15 @@ print_help(void)
   printf (" %s\n", "-I");
   printf ("    %s", _("max target interval (currently "));
   printf ("%0.3fms)\n", (float)target_interval / 1000);
+  printf (" %s\n", "-r");
+  printf ("    %s\n", _("pace packets at this many per second across all targets, with -i"));
+  printf ("    %s\n", _("as the interval between packets to the same target (-I is ignored)"));
+  printf (" %s\n", "-T");
+  printf ("    %s\n", _("take the replies in with this many threads, each with a raw socket and"));
+  printf ("    %s\n", _("a CPU of its own and a share of the targets, for large sweeps (Linux)"));
+  printf (" %s\n", "-N");
+  printf ("    %s\n", _("give up on the hosts on a local network that the kernel could not find"));
+  printf ("    %s\n", _("with ARP or ND, during the run or this long before it, e.g. 5s (Linux)"));
   printf (" %s\n", "-m");
   printf ("    %s",_("number of alive hosts required for success"));
   printf ("\n");
@@ -1583,6 +2984,31 @@ print_help(void)
   printf (" %s\n", "-b");
   printf ("    %s\n", _("Number of icmp data bytes to send"));
   printf ("    %s %u + %d)\n", _("Packet size will be data bytes + icmp header (currently"),icmp_data_size, ICMP_MINLEN);
+  printf (" %s\n", "-P");
+  printf ("    %s\n", _("rtt percentiles to report for each target, e.g. 50,95,99, and the jitter"));
+  printf (" %s\n", "-Q");
+  printf ("    %s\n", _("percentile threshold: 95=200,400 warns if the 95th percentile of the rtt"));
+  printf ("    %s\n", _("is 200ms or more and is critical at 400ms"));
+  printf (" %s\n", "-J");
+  printf ("    %s\n", _("jitter threshold WARN[,CRIT]: the mean rtt difference of successive replies"));
+  printf (" %s\n", "-f");
+  printf ("    %s\n", _("file with more targets, one a line; with -D it is read again when it changes."));
+  printf ("    %s\n", _("- for stdin, unix:PATH or tcp:HOST:PORT read them from a socket"));
+  printf (" %s\n", "-S");
+  printf ("    %s\n", _("I/N: take only the targets of -f in shard I of N, so that N probers given"));
+  printf ("    %s\n", _("the same list ping each target once"));
+  printf (" %s\n", "-U");
+  printf ("    %s\n", _("list only the targets whose state changed since the last run, and all of"));
+  printf ("    %s\n", _("them when this many seconds passed since they last were, never for 0"));
+  printf (" %s\n", "-D");
+  printf ("    %s\n", _("keep running as a prober: ping the targets every -e seconds and publish"));
+  printf ("    %s\n", _("the results in a table in this file for -R, which is mapped in memory"));
+  printf (" %s\n", "-e");
+  printf ("    %s", _("seconds between the rounds of the prober (currently "));
+  printf ("%u)\n", round_interval);
+  printf (" %s\n", "-R");
+  printf ("    %s\n", _("judge the latest results of the targets from the table of a prober"));
+  printf ("    %s\n", _("instead of pinging them, which needs no privileges"));
   printf (" %s\n", "-v");
   printf ("    %s\n", _("verbose"));
 
@@ -1594,12 +3020,18 @@ print_help(void)
   printf (" %s\n", _("packet loss.  The default values should work well for most users."));
   printf (" %s\n", _("You can specify different RTA factors using the standardized abbreviations"));
   printf (" %s\n", _("us (microseconds), ms (milliseconds, default) or just plain s for seconds."));
+  printf (" %s\n", _("The percentiles are estimated from a histogram of a fixed size for each"));
+  printf (" %s\n", _("target, within an eighth of the rtt and between the rtmin and the rtmax."));
 /* -d not yet implemented */
 /*  printf ("%s\n", _("Threshold format for -d is warn,crit.  12,14 means WARNING if >= 12 hops"));
   printf ("%s\n", _("are spent and CRITICAL if >= 14 hops are spent."));
   printf ("%s\n\n", _("NOTE: Some systems decrease TTL when forming ICMP_ECHOREPLY, others do not."));*/
   printf ("\n");
   printf (" %s\n", _("The -v switch can be specified several times for increased verbosity."));
+  printf ("\n");
+  printf (" %s\n", _("A prober started with -D as root runs until it is killed. With -R the"));
+  printf (" %s\n", _("targets are looked up by the names the prober was given, and results older"));
+  printf (" %s\n", _("than two rounds and the timeout are UNKNOWN."));
 /*  printf ("%s\n", _("Long options are currently unsupported."));
   printf ("%s\n", _("Options marked with * require an argument"));
 */
@@ -1614,4 +3046,7 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
   printf(" %s [options] [-H] host1 host2 hostN\n", progname);
+  printf(" %s -f <targets file> -U <seconds> [options]\n", progname);
+  printf(" %s -D <file> [-f <targets file>] [-S <i/n>] [-e <seconds>] [options] [-H] host1 hostN\n", progname);
+  printf(" %s -R <file> [-w <warn>] [-c <crit>] [-P <percentiles>] [-H] host1 hostN\n", progname);
 }
@@ -0,0 +1,815 @@
+/*****************************************************************************
+*
+* Monitoring check_syn plugin
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains the check_syn plugin
+*
+* Checks whether TCP ports accept connections by sending a SYN to each and
+* waiting for the SYN-ACK or RST, without completing the handshake: the
+* kernel resets the connections we never made itself. The SYNs go out from
+* one raw socket at a paced rate, so that a million host and port pairs
+* cost neither end a socket each.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "check_syn";
+const char *copyright = "2026";
+const char *email = "devel@monitoring-plugins.org";
+
+#include "common.h"
+#include "netutils.h"
+#include "icmputils.h"
+#include "utils_targets.h"
+#include "utils.h"
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in_systm.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_RATE 10000	/* SYNs a second */
+#define DEFAULT_WAIT 1000	/* msecs for the answers after the last SYN of a round */
+#define MAX_ATTEMPTS 4
+#define MAX_SOURCES 256
+#define MAX_LISTED 10	/* targets not open named in the output, without -v */
+
+#define TCP_HDR_LEN 24	/* with the MSS option */
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_ACK 0x10
+
+/* what became of a target */
+enum {
+	SYN_SILENT,	/* no answer (yet) */
+	SYN_OPEN,	/* SYN-ACK */
+	SYN_CLOSED,	/* RST */
+	SYN_UNREACH	/* the SYN could not be sent */
+};
+
+/* Kept small for a million of them. A target is found by its index in
+ * the table, which its SYN carries in the sequence number, see syn_seq() */
+typedef struct syn_target {
+	unsigned char addr[16];	/* network order, an IPv4 address in the first 4 */
+	unsigned short port;	/* network order */
+	unsigned char v6;
+	unsigned char state;
+	unsigned char attempts;	/* SYNs sent */
+	unsigned char source;	/* in sources[], for the IPv4 checksum */
+	unsigned int sent;	/* usecs after the start the last SYN went out */
+	unsigned int rtt;	/* usecs, UINT_MAX if the answer was to an earlier SYN */
+	const char *name;	/* as given, NULL for an address from a file */
+} syn_target;
+
+int process_arguments (int, char **);
+int validate_arguments (void);
+void print_help (void);
+void print_usage (void);
+
+static syn_target *targets;
+static size_t target_count, target_size;
+static struct in_addr sources[MAX_SOURCES];
+static unsigned int source_count;
+static struct in_addr source_addr;	/* -s */
+static int sock4 = -1, sock6 = -1, sock_errno;
+static unsigned short our_port;	/* network order */
+static uint32_t secret;
+static unsigned int rate = DEFAULT_RATE;
+static unsigned int wait_ms = DEFAULT_WAIT;
+static unsigned int attempts = 1;
+static int default_port = 0;
+static double warn_rta = 200, crit_rta = 500;	/* msecs */
+static double warn_pl = 0, crit_pl = 10;	/* percent of the targets not open */
+static struct timeval start;
+static size_t answered;
+int verbose = 0;
+
+static unsigned int
+elapsed (void)
+{
+	struct timeval now;
+
+	gettimeofday (&now, NULL);
+	return (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_usec - start.tv_usec);
+}
+
+/* the sequence number of a SYN, which comes back in the acknowledgement of
+ * the answer plus one: the index and the attempt, behind a secret so that
+ * other runs at the same time do not take each other's answers */
+static uint32_t
+syn_seq (size_t index, unsigned int attempt)
+{
+	return (uint32_t)(index * MAX_ATTEMPTS + attempt) ^ secret;
+}
+
+static const char *
+target_name (const syn_target *t)
+{
+	static char buf[INET6_ADDRSTRLEN + 16];
+	char addr[INET6_ADDRSTRLEN];
+
+	if (t->name)
+		snprintf (buf, sizeof (buf), "%s:%u", t->name, ntohs (t->port));
+	else {
+		inet_ntop (t->v6 ? AF_INET6 : AF_INET, t->addr, addr, sizeof (addr));
+		snprintf (buf, sizeof (buf), t->v6 ? "[%s]:%u" : "%s:%u", addr, ntohs (t->port));
+	}
+	return buf;
+}
+
+static void
+to_sockaddr (const syn_target *t, struct sockaddr_storage *ss)
+{
+	memset (ss, 0, sizeof (*ss));
+	if (t->v6) {
+		ss->ss_family = AF_INET6;
+		memcpy (&((struct sockaddr_in6 *)ss)->sin6_addr, t->addr, 16);
+	}
+	else {
+		ss->ss_family = AF_INET;
+		memcpy (&((struct sockaddr_in *)ss)->sin_addr, t->addr, 4);
+	}
+}
+
+/* The address a SYN to an IPv4 target goes out from, for the checksum,
+ * which the kernel fills in for IPv6 but not for IPv4: the one the routing
+ * table picks, found by connecting a UDP socket there, which sends nothing */
+static unsigned char
+target_source (int udp, const syn_target *t)
+{
+	struct sockaddr_storage to;
+	struct sockaddr_in from;
+	socklen_t len = sizeof (from);
+	unsigned int i;
+
+	if (source_addr.s_addr == INADDR_ANY) {
+		/* undone first, or the source of the last one sticks */
+		memset (&to, 0, sizeof (to));
+		to.ss_family = AF_UNSPEC;
+		connect (udp, (struct sockaddr *)&to, sizeof (to));
+		to_sockaddr (t, &to);
+		((struct sockaddr_in *)&to)->sin_port = t->port;
+		if (connect (udp, (struct sockaddr *)&to, sizeof (struct sockaddr_in)) != 0 ||
+		    getsockname (udp, (struct sockaddr *)&from, &len) != 0)
+			die (STATE_UNKNOWN, _("No route to %s: %s\n"), target_name (t), strerror (errno));
+	}
+	else
+		from.sin_addr = source_addr;
+
+	for (i = 0; i < source_count; i++)
+		if (sources[i].s_addr == from.sin_addr.s_addr)
+			return i;
+	if (source_count == MAX_SOURCES)
+		die (STATE_UNKNOWN, _("The targets are reached from more than %d addresses\n"), MAX_SOURCES);
+	sources[source_count] = from.sin_addr;
+	return source_count++;
+}
+
+/* "host", "host:port", "host port" or "[v6]:port" */
+static void
+add_target (const char *spec, int keep_name)
+{
+	char *host = strdup (spec), *port_str = NULL, *p;
+	struct addrinfo hints, *res;
+	syn_target *t;
+	int port = default_port;
+
+	if (host == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	if (*host == '[' && (p = strchr (host, ']')) != NULL) {
+		*p++ = '\0';
+		memmove (host, host + 1, p - host - 1);
+		if (*p == ':' || *p == ' ' || *p == '\t')
+			port_str = p + 1;
+	}
+	else if ((p = strpbrk (host, " \t")) != NULL) {
+		*p++ = '\0';
+		port_str = p + strspn (p, " \t");
+	}
+	else if ((p = strchr (host, ':')) != NULL && strchr (p + 1, ':') == NULL) {
+		*p++ = '\0';
+		port_str = p;
+	}
+	if (port_str != NULL && *port_str != '\0') {
+		if (!is_intpos (port_str) || atoi (port_str) > 65535)
+			usage2 (_("Invalid port"), spec);
+		port = atoi (port_str);
+	}
+	if (port <= 0)
+		usage2 (_("No port given for target"), spec);
+
+	if (target_count == target_size) {
+		target_size = target_size ? target_size * 2 : 1024;
+		if ((targets = realloc (targets, target_size * sizeof (syn_target))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	t = &targets[target_count];
+	memset (t, 0, sizeof (*t));
+	t->port = htons (port);
+
+	/* addresses as they are, names through the resolver cache */
+	if ((address_family != AF_INET6 && inet_pton (AF_INET, host, t->addr) == 1) ||
+	    (address_family != AF_INET && (t->v6 = inet_pton (AF_INET6, host, t->addr) == 1))) {
+		free (host);
+		host = NULL;
+	}
+	else {
+		memset (&hints, 0, sizeof (hints));
+		hints.ai_family = address_family;
+		hints.ai_socktype = SOCK_STREAM;
+		if (np_getaddrinfo (host, NULL, &hints, &res) != 0)
+			die (STATE_UNKNOWN, _("Cannot resolve %s\n"), host);
+		t->v6 = res->ai_family == AF_INET6;
+		if (t->v6)
+			memcpy (t->addr, &((struct sockaddr_in6 *)res->ai_addr)->sin6_addr, 16);
+		else
+			memcpy (t->addr, &((struct sockaddr_in *)res->ai_addr)->sin_addr, 4);
+		freeaddrinfo (res);
+	}
+	t->name = keep_name ? host : NULL;
+	if (!keep_name)
+		free (host);
+	target_count++;
+}
+
+/* -f: a target a line, '#' starts a comment, those of the shard of --shard */
+static void
+read_targets (const char *filename)
+{
+	np_targets *list;
+	char *p, *q;
+
+	if ((list = np_targets_open (filename)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open target list %s: %s\n"), filename, strerror (errno));
+
+	while ((p = np_targets_next (list)) != NULL) {
+		if ((q = strchr (p, '#')) != NULL)
+			*q = '\0';
+		strip (p);
+		add_target (p, FALSE);
+	}
+	np_targets_close (list);
+}
+
+/* a SYN with an MSS option, so that it looks like any other */
+static void
+build_syn (unsigned char *pkt, const syn_target *t, uint32_t seq)
+{
+	unsigned char pseudo[12 + TCP_HDR_LEN];
+	unsigned short sum;
+
+	memset (pkt, 0, TCP_HDR_LEN);
+	memcpy (pkt, &our_port, 2);
+	memcpy (pkt + 2, &t->port, 2);
+	seq = htonl (seq);
+	memcpy (pkt + 4, &seq, 4);
+	pkt[12] = (TCP_HDR_LEN / 4) << 4;
+	pkt[13] = TCP_SYN;
+	pkt[14] = pkt[15] = 0xff;	/* window */
+	pkt[20] = 2;	/* MSS */
+	pkt[21] = 4;
+	pkt[22] = 1460 >> 8;
+	pkt[23] = 1460 & 0xff;
+
+	if (t->v6)
+		return;
+	memcpy (pseudo, &sources[t->source], 4);
+	memcpy (pseudo + 4, t->addr, 4);
+	pseudo[8] = 0;
+	pseudo[9] = IPPROTO_TCP;
+	pseudo[10] = 0;
+	pseudo[11] = TCP_HDR_LEN;
+	memcpy (pseudo + 12, pkt, TCP_HDR_LEN);
+	sum = np_icmp_checksum ((unsigned short *)pseudo, sizeof (pseudo));
+	memcpy (pkt + 16, &sum, 2);
+}
+
+/* a SYN-ACK or RST to us from a target, IPv4 ones behind their IP header */
+static void
+syn_reply (unsigned char *buf, int len, struct sockaddr_storage *from, struct timeval *now, void *arg)
+{
+	int v6 = *(int *)arg, hlen = 0;
+	unsigned char *tcp, flags;
+	uint32_t ack;
+	size_t index;
+	unsigned int attempt, at;
+	syn_target *t;
+
+	if (!v6) {
+		if (len < (int)sizeof (struct ip) || buf[9] != IPPROTO_TCP)
+			return;
+		hlen = (buf[0] & 0x0f) << 2;
+	}
+	if (len < hlen + 20)
+		return;
+	tcp = buf + hlen;
+	flags = tcp[13];
+	if (memcmp (tcp + 2, &our_port, 2) != 0 || !(flags & TCP_ACK) ||
+	    ((flags & (TCP_SYN | TCP_RST)) != TCP_SYN && (flags & (TCP_SYN | TCP_RST)) != TCP_RST))
+		return;
+
+	memcpy (&ack, tcp + 8, 4);
+	index = (ntohl (ack) - 1) ^ secret;
+	attempt = index % MAX_ATTEMPTS;
+	index /= MAX_ATTEMPTS;
+	if (index >= target_count)
+		return;
+	t = &targets[index];
+	if (t->v6 != v6 || attempt >= t->attempts || memcmp (tcp, &t->port, 2) != 0 ||
+	    (v6 ? memcmp (&((struct sockaddr_in6 *)from)->sin6_addr, t->addr, 16)
+	        : memcmp (&((struct sockaddr_in *)from)->sin_addr, t->addr, 4)) != 0)
+		return;
+	if (t->state != SYN_SILENT)
+		return;
+
+	t->state = flags & TCP_SYN ? SYN_OPEN : SYN_CLOSED;
+	at = (now->tv_sec - start.tv_sec) * 1000000 + (now->tv_usec - start.tv_usec);
+	/* the time of an earlier SYN is not kept */
+	t->rtt = attempt + 1 == t->attempts ? (at > t->sent ? at - t->sent : 0) : UINT_MAX;
+	answered++;
+	if (verbose >= 2)
+		printf ("%s %s %.3f ms\n", target_name (t), t->state == SYN_OPEN ? "open" : "closed",
+		        t->rtt == UINT_MAX ? -1.0 : t->rtt / 1000.0);
+}
+
+/* take in the answers for up to usecs */
+static void
+take_in (unsigned int usecs)
+{
+	static int v4 = FALSE, v6 = TRUE;
+
+	if (sock4 >= 0 && sock6 >= 0) {
+		np_icmp_drain (sock4, usecs / 2, syn_reply, &v4);
+		np_icmp_drain (sock6, usecs / 2, syn_reply, &v6);
+	}
+	else if (sock4 >= 0)
+		np_icmp_drain (sock4, usecs, syn_reply, &v4);
+	else
+		np_icmp_drain (sock6, usecs, syn_reply, &v6);
+}
+
+/* one SYN to every target without an answer, rate a second, as
+ * check_icmp -r paces its echo requests */
+static void
+syn_round (unsigned int attempt)
+{
+	unsigned char pkts[2][NP_ICMP_SEND_BATCH][TCP_HDR_LEN], *bufs[2][NP_ICMP_SEND_BATCH];
+	struct sockaddr_storage addrs[2][NP_ICMP_SEND_BATCH], *to[2][NP_ICMP_SEND_BATCH];
+	size_t batch[2][NP_ICMP_SEND_BATCH], i = 0;
+	unsigned long long round_start = elapsed (), sent = 0, now, allowed;
+	int errors[NP_ICMP_SEND_BATCH], n[2], f, k;
+	unsigned int sent_at;
+
+	for (f = 0; f < 2; f++)
+		for (k = 0; k < NP_ICMP_SEND_BATCH; k++) {
+			bufs[f][k] = pkts[f][k];
+			to[f][k] = &addrs[f][k];
+		}
+
+	while (i < target_count) {
+		now = elapsed ();
+		allowed = (now - round_start) * rate / 1000000 + 1;
+		if (sent >= allowed) {
+			take_in ((unsigned int)(round_start + (sent * 1000000) / rate - now) + 1);
+			continue;
+		}
+
+		/* the IPv4 and the IPv6 targets of a batch go out on their own sockets */
+		n[0] = n[1] = 0;
+		sent_at = elapsed ();
+		for (; i < target_count && sent < allowed && n[0] < NP_ICMP_SEND_BATCH && n[1] < NP_ICMP_SEND_BATCH; i++) {
+			syn_target *t = &targets[i];
+
+			if (t->state != SYN_SILENT)
+				continue;
+			f = t->v6;
+			build_syn (pkts[f][n[f]], t, syn_seq (i, attempt));
+			to_sockaddr (t, &addrs[f][n[f]]);
+			t->attempts = attempt + 1;
+			t->sent = sent_at;
+			batch[f][n[f]++] = i;
+			sent++;
+		}
+		for (f = 0; f < 2; f++) {
+			if (n[f] == 0)
+				continue;
+			np_icmp_send_batch (f ? sock6 : sock4, bufs[f], TCP_HDR_LEN, to[f], n[f], errors);
+			for (k = 0; k < n[f]; k++)
+				if (errors[k]) {
+					targets[batch[f][k]].state = SYN_UNREACH;
+					answered++;
+					if (verbose >= 2)
+						printf (_("Failed to send SYN to %s: %s\n"), target_name (&targets[batch[f][k]]),
+						        strerror (errors[k]));
+				}
+		}
+		take_in (0);
+	}
+
+	/* the answers to the last of them */
+	allowed = elapsed () + wait_ms * 1000ULL;
+	while (answered < target_count && (now = elapsed ()) < allowed)
+		take_in ((unsigned int)(allowed - now));
+}
+
+int
+main (int argc, char **argv)
+{
+	struct sockaddr_in6 bound;
+	socklen_t len = sizeof (bound);
+	struct timeval tv;
+	size_t i, open = 0, closed = 0, silent = 0, unreach = 0, timed = 0, listed = 0;
+	double rta = 0, rtmax = 0, pl, rtt;
+	np_str output = NP_STR_INIT, listing = NP_STR_INIT;
+	int result = STATE_OK, reserve, udp = -1, offset = 16;
+	unsigned int a;
+
+	np_locale_init ();
+
+	/* the raw sockets are all that needs privileges */
+	sock4 = socket (AF_INET, SOCK_RAW, IPPROTO_TCP);
+	if (sock4 < 0)
+		sock_errno = errno;
+	sock6 = socket (AF_INET6, SOCK_RAW, IPPROTO_TCP);
+	if (setuid (getuid ()) == -1) {
+		printf ("ERROR: Failed to drop privileges\n");
+		return STATE_UNKNOWN;
+	}
+
+	/* Parse extra opts if any */
+	argv = np_extra_opts (&argc, argv, progname);
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	gettimeofday (&tv, NULL);
+	secret = (uint32_t)(tv.tv_sec ^ tv.tv_usec ^ (getpid () << 16));
+
+	if (sock4 < 0 && sock6 < 0)
+		die (STATE_UNKNOWN, _("Cannot open a raw socket: %s\n"), strerror (sock_errno));
+	for (i = 0; i < target_count; i++) {
+		if (targets[i].v6 ? sock6 < 0 : sock4 < 0)
+			die (STATE_UNKNOWN, _("Cannot open a raw socket for %s: %s\n"), target_name (&targets[i]),
+			     strerror (targets[i].v6 ? errno : sock_errno));
+		if (!targets[i].v6) {
+			if (udp < 0 && (udp = socket (AF_INET, SOCK_DGRAM, 0)) < 0)
+				die (STATE_UNKNOWN, _("Cannot open a socket: %s\n"), strerror (errno));
+			targets[i].source = target_source (udp, &targets[i]);
+		}
+	}
+	if (udp >= 0)
+		close (udp);
+
+	/* A bound TCP socket that neither listens nor connects keeps other
+	 * programs off our port, and leaves the kernel to reset the connections
+	 * the SYN-ACKs are for. */
+	memset (&bound, 0, sizeof (bound));
+	bound.sin6_family = AF_INET6;
+	if ((reserve = socket (AF_INET6, SOCK_STREAM, 0)) >= 0) {
+		setsockopt (reserve, IPPROTO_IPV6, IPV6_V6ONLY, &(int){ 0 }, sizeof (int));
+		if (bind (reserve, (struct sockaddr *)&bound, sizeof (bound)) != 0) {
+			close (reserve);
+			reserve = -1;
+		}
+	}
+	if (reserve < 0) {
+		struct sockaddr_in *in = (struct sockaddr_in *)&bound;
+
+		memset (&bound, 0, sizeof (bound));
+		in->sin_family = AF_INET;
+		if ((reserve = socket (AF_INET, SOCK_STREAM, 0)) < 0 ||
+		    bind (reserve, (struct sockaddr *)in, sizeof (*in)) != 0)
+			die (STATE_UNKNOWN, _("Cannot bind a port: %s\n"), strerror (errno));
+	}
+	if (getsockname (reserve, (struct sockaddr *)&bound, &len) != 0)
+		die (STATE_UNKNOWN, _("Cannot bind a port: %s\n"), strerror (errno));
+	our_port = bound.sin6_family == AF_INET6 ? bound.sin6_port : ((struct sockaddr_in *)&bound)->sin_port;
+
+	if (sock6 >= 0)
+		setsockopt (sock6, IPPROTO_IPV6, IPV6_CHECKSUM, &offset, sizeof (offset));
+	if (sock4 >= 0) {
+		np_icmp_timestamps (sock4, verbose);
+		setsockopt (sock4, SOL_SOCKET, SO_RCVBUFFORCE, &(int){ 4 << 20 }, sizeof (int));
+	}
+	if (sock6 >= 0) {
+		np_icmp_timestamps (sock6, verbose);
+		setsockopt (sock6, SOL_SOCKET, SO_RCVBUFFORCE, &(int){ 4 << 20 }, sizeof (int));
+	}
+
+	if (signal (SIGALRM, socket_timeout_alarm_handler) == SIG_ERR)
+		usage4 (_("Cannot catch SIGALRM"));
+	alarm (socket_timeout);
+
+	gettimeofday (&start, NULL);
+	for (a = 0; a < attempts && answered < target_count; a++)
+		syn_round (a);
+	alarm (0);
+
+	for (i = 0; i < target_count; i++) {
+		syn_target *t = &targets[i];
+		const char *what = NULL;
+
+		switch (t->state) {
+		case SYN_OPEN:
+			open++;
+			if (t->rtt != UINT_MAX) {
+				rtt = t->rtt / 1000.0;
+				rta += rtt;
+				timed++;
+				if (rtt > rtmax)
+					rtmax = rtt;
+			}
+			break;
+		case SYN_CLOSED:
+			closed++;
+			what = _("refused");
+			break;
+		case SYN_UNREACH:
+			unreach++;
+			what = _("unreachable");
+			break;
+		default:
+			silent++;
+			what = _("no answer");
+		}
+		if (verbose)
+			printf ("%s %s\n", target_name (t), what ? what : "open");
+		if (what && (verbose || listed < MAX_LISTED))
+			np_str_printf (&listing, "%s%s %s", listed ? ", " : ": ", target_name (t), what);
+		if (what)
+			listed++;
+	}
+	if (listed > MAX_LISTED && !verbose)
+		np_str_printf (&listing, _(", %lu more"), (unsigned long)(listed - MAX_LISTED));
+
+	if (timed)
+		rta /= timed;
+	pl = (double)(target_count - open) * 100 / target_count;
+	if (pl > crit_pl || (timed && rta > crit_rta))
+		result = STATE_CRITICAL;
+	else if (pl > warn_pl || (timed && rta > warn_rta))
+		result = STATE_WARNING;
+
+	np_str_printf (&output, _("%lu of %lu open"), (unsigned long)open, (unsigned long)target_count);
+	if (closed)
+		np_str_printf (&output, _(", %lu refused"), (unsigned long)closed);
+	if (silent)
+		np_str_printf (&output, _(", %lu without answer"), (unsigned long)silent);
+	if (unreach)
+		np_str_printf (&output, _(", %lu unreachable"), (unsigned long)unreach);
+	if (timed)
+		np_str_printf (&output, _(", rta %.3fms, max %.3fms"), rta, rtmax);
+
+	printf ("SYN %s - %s%s|%s %s %s %s %s %s\n", state_text (result), np_str_string (&output), np_str_string (&listing),
+	        perfdata ("open", open, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, target_count),
+	        perfdata ("refused", closed, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0),
+	        perfdata ("silent", silent, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0),
+	        fperfdata ("pl", pl, "%", TRUE, warn_pl, TRUE, crit_pl, TRUE, 0, TRUE, 100),
+	        fperfdata ("rta", rta, "ms", TRUE, warn_rta, TRUE, crit_rta, TRUE, 0, FALSE, 0),
+	        fperfdata ("rtmax", rtmax, "ms", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+	close (reserve);
+	return result;
+}
+
+/* "RTA,PL%": msecs and percent */
+static void
+get_threshold (char *arg, double *rta, double *pl)
+{
+	char *comma = strchr (arg, ',');
+
+	if (comma == NULL || !is_nonnegative (arg = strndup (arg, comma - arg)) ||
+	    strchr (comma + 1, '%') == NULL)
+		usage2 (_("Threshold must be RTA,PL% with the RTA in milliseconds"), arg);
+	*rta = strtod (arg, NULL);
+	*pl = strtod (comma + 1, NULL);
+	if (*pl < 0 || *pl > 100)
+		usage2 (_("Packet loss must be between 0% and 100%"), comma + 1);
+}
+
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+	char *targets_file = NULL, **names = NULL;
+	int name_count = 0, option = 0, sharded = FALSE;
+	enum {
+		SHARD_OPTION = CHAR_MAX + 1
+	};
+	static struct option longopts[] = {
+		{"hostname", required_argument, 0, 'H'},
+		{"port", required_argument, 0, 'p'},
+		{"file", required_argument, 0, 'f'},
+		{"shard", required_argument, 0, SHARD_OPTION},
+		{"warning", required_argument, 0, 'w'},
+		{"critical", required_argument, 0, 'c'},
+		{"rate", required_argument, 0, 'r'},
+		{"wait", required_argument, 0, 'W'},
+		{"attempts", required_argument, 0, 'n'},
+		{"source", required_argument, 0, 's'},
+		{"timeout", required_argument, 0, 't'},
+		{"use-ipv4", no_argument, 0, '4'},
+		{"use-ipv6", no_argument, 0, '6'},
+		{"verbose", no_argument, 0, 'v'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		usage4 (_("Could not parse arguments"));
+	if ((names = calloc (argc, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	while ((c = getopt_long (argc, argv, "hVv46H:p:f:w:c:r:W:n:s:t:", longopts, &option)) != -1) {
+		switch (c) {
+		case '?':
+			usage5 ();
+		case 'h':
+			print_help ();
+			exit (STATE_UNKNOWN);
+		case 'V':
+			print_revision (progname, NP_VERSION);
+			exit (STATE_UNKNOWN);
+		case 'v':
+			verbose++;
+			break;
+		case '4':
+			address_family = AF_INET;
+			break;
+		case '6':
+			address_family = AF_INET6;
+			break;
+		case 'H':
+			names[name_count++] = optarg;
+			break;
+		case 'p':
+			if (!is_intpos (optarg) || atoi (optarg) > 65535)
+				usage2 (_("Port must be a positive integer"), optarg);
+			default_port = atoi (optarg);
+			break;
+		case 'f':
+			targets_file = optarg;
+			break;
+		case SHARD_OPTION:
+			if (np_targets_shard (optarg) == ERROR)
+				usage2 (_("Shard must be I/N, I from 1 to N"), optarg);
+			sharded = TRUE;
+			break;
+		case 'w':
+			get_threshold (optarg, &warn_rta, &warn_pl);
+			break;
+		case 'c':
+			get_threshold (optarg, &crit_rta, &crit_pl);
+			break;
+		case 'r':
+			if (!is_intpos (optarg))
+				usage2 (_("Rate must be a positive integer"), optarg);
+			rate = atoi (optarg);
+			break;
+		case 'W':
+			if (!is_intnonneg (optarg))
+				usage2 (_("Wait must be a non-negative number of milliseconds"), optarg);
+			wait_ms = atoi (optarg);
+			break;
+		case 'n':
+			if (!is_intpos (optarg) || atoi (optarg) > MAX_ATTEMPTS)
+				usage2 (_("Attempts must be between 1 and 4"), optarg);
+			attempts = atoi (optarg);
+			break;
+		case 's':
+			if (inet_pton (AF_INET, optarg, &source_addr) != 1)
+				usage2 (_("Source must be an IPv4 address"), optarg);
+			break;
+		case 't':
+			if (!is_intpos (optarg))
+				usage2 (_("Timeout interval must be a positive integer"), optarg);
+			socket_timeout = atoi (optarg);
+			break;
+		}
+	}
+
+	/* the ports are known once all options are */
+	for (c = 0; c < name_count; c++)
+		add_target (names[c], TRUE);
+	free (names);
+	if (sharded && targets_file == NULL)
+		usage4 (_("--shard needs --file"));
+	if (targets_file)
+		read_targets (targets_file);
+
+	return validate_arguments ();
+}
+
+int
+validate_arguments (void)
+{
+	unsigned long long need;
+
+	if (target_count == 0)
+		usage4 (_("No targets given, use -H or -f"));
+	if (target_count > UINT32_MAX / MAX_ATTEMPTS)
+		usage4 (_("Too many targets"));
+	if (warn_rta > crit_rta || warn_pl > crit_pl)
+		usage4 (_("Warning threshold must not be above critical"));
+
+	/* rather than cutting a run short */
+	need = (unsigned long long)target_count * attempts / rate + ((unsigned long long)attempts * wait_ms + 999) / 1000;
+	if (need >= socket_timeout)
+		usage_va (_("%lu targets at %u SYNs a second take about %llu seconds, more than the timeout of %u"),
+		          (unsigned long)target_count, rate, need, socket_timeout);
+	return OK;
+}
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("This plugin checks whether TCP ports accept connections, by sending them a"));
+	printf ("%s\n", _("SYN and waiting for the SYN-ACK or RST without completing the handshake."));
+	printf ("%s\n", _("The SYNs go out at a paced rate from a raw socket, so it needs to run as"));
+	printf ("%s\n", _("root, and thousands of ports cost neither side a socket each."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+	printf (UT_EXTRA_OPTS);
+
+	printf (" %s\n", "-H, --hostname=HOST[:PORT]");
+	printf ("    %s\n", _("A target, may be given several times"));
+	printf (" %s\n", "-p, --port=INTEGER");
+	printf ("    %s\n", _("The port of the targets that do not name one"));
+	printf (" %s\n", "-f, --file=FILE");
+	printf ("    %s\n", _("Read the targets from FILE, one a line as HOST PORT, HOST:PORT or"));
+	printf ("    %s\n", _("[ADDRESS]:PORT, '#' starts a comment, - for standard input, unix:PATH"));
+	printf ("    %s\n", _("or tcp:HOST:PORT for a socket"));
+	printf (" %s\n", "--shard=I/N");
+	printf ("    %s\n", _("Take only the targets of FILE in shard I of N, so that N pollers given"));
+	printf ("    %s\n", _("the same list probe each target once"));
+	printf (UT_IPv46);
+	printf (" %s\n", "-w, --warning=RTA,PL%");
+	printf ("    %s\n", _("Warn when the mean round trip time of the open ports is over RTA"));
+	printf ("    %s\n", _("milliseconds, or more than PL% of the targets are not open (default: 200,0%)"));
+	printf (" %s\n", "-c, --critical=RTA,PL%");
+	printf ("    %s\n", _("The same for critical (default: 500,10%)"));
+	printf (" %s\n", "-r, --rate=INTEGER");
+	printf ("    %s %d)\n", _("SYNs a second over all targets (default:"), DEFAULT_RATE);
+	printf (" %s\n", "-W, --wait=INTEGER");
+	printf ("    %s %d)\n", _("Milliseconds to wait for the answers after the last SYN (default:"), DEFAULT_WAIT);
+	printf (" %s\n", "-n, --attempts=INTEGER");
+	printf ("    %s\n", _("SYNs to a target at most, again to those without an answer after the"));
+	printf ("    %s\n", _("wait (default: 1, at most 4)"));
+	printf (" %s\n", "-s, --source=ADDRESS");
+	printf ("    %s\n", _("The IPv4 address the SYNs come from, instead of the one the route to"));
+	printf ("    %s\n", _("every target picks"));
+	printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf ("    %s\n", _("It must leave time for all the SYNs at the rate and the waits after them"));
+	printf (UT_VERBOSE);
+	printf ("    %s\n", _("-v lists every target, -vv also the answers as they come in"));
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("A target that refuses the connection with a RST is up but not open; one that"));
+	printf (" %s\n", _("does not answer at all may also be behind a firewall dropping the SYNs."));
+	printf (" %s\n", _("Only the first ten targets that are not open are named without -v."));
+
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "check_syn -f webservers.txt -p 443 -r 20000 -n 2 -w 100,0% -c 300,1%");
+	printf ("    %s\n", _("Checks port 443 of every host in the file, unless it names another port"));
+
+	printf (UT_SUPPORT);
+}
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf (" %s {-H host[:port] ... | -f file} [-p port] [-4|-6] [-w rta,pl%%] [-c rta,pl%%]\n", progname);
+	printf ("  [-r rate] [-W wait] [-n attempts] [-s source] [-t timeout] [--shard=i/n] [-v]\n");
+}
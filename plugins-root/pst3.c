@@ -49,6 +49,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <procfs.h>
+#include <inttypes.h>
 #include <sys/types32.h>
 
 /*
@@ -58,6 +59,30 @@
 #define PROC_DIR  "/proc"
 #define ARGS            30
 
+/*
+ *  With -b every process is a binary record instead of a line, as
+ *  np_ps_records_parse() in lib/utils_ps.c reads them: "NPPS1\n", then
+ *  per process in the byte order of the host
+ *    u32 length of the record, i32 uid, pid, ppid, u32 vsz, rss (kB),
+ *    u32 %CPU in hundredths, char state[4], u32 length of the command,
+ *    u32 length of the args, then the command and the args
+ *  Only 32 bit fields, so a 64 bit pst3 writes what a 32 bit plugin reads.
+ */
+#define RECORD_MAGIC    "NPPS1\n"
+
+struct record {
+  uint32_t length;
+  int32_t uid;
+  int32_t pid;
+  int32_t ppid;
+  uint32_t vsz;
+  uint32_t rss;
+  uint32_t pcpu;
+  char state[4];
+  uint32_t prog_length;
+  uint32_t args_length;
+};
+
 /*
  *  Globals
  */
@@ -68,6 +93,7 @@ static char *        szProg;
  *  Prototypes
  */
 void usage();
+static int append(char **, size_t *, size_t *, const char *, size_t);
 
 /*----------------------------------------------------------------------------*/
 
@@ -78,6 +104,9 @@ int main (int argc, char **argv)
   char ps_name[ARGS];
   char as_name[ARGS];
   psinfo_t psinfo;
+  int binary = 0;
+  char *line = NULL;
+  size_t line_len, line_size = 0;
 
   /* Set our program name global */
   if ((szProg = strrchr(argv[0], '/')) != NULL)
@@ -85,8 +114,10 @@ int main (int argc, char **argv)
   else
     szProg = argv[0];
 
-  /* if given any parameters, print out help */
-  if(argc > 1) {
+  if(argc == 2 && strcmp(argv[1], "-b") == 0)
+    binary = 1;
+  /* if given any other parameters, print out help */
+  else if(argc > 1) {
     (void)usage();
     exit(1);
   }
@@ -104,17 +135,21 @@ int main (int argc, char **argv)
   }
 
   /* Display column headings */
-  printf("%c %5s %5s %5s %6s %6s %4s %s %s\n",
-    'S',
-    "UID",
-    "PID",
-    "PPID",
-    "VSZ",
-    "RSS",
-    "%CPU",
-    "COMMAND",
-    "ARGS"
-  );
+  if(binary) {
+    fwrite(RECORD_MAGIC, 1, strlen(RECORD_MAGIC), stdout);
+  } else {
+    printf("%c %5s %5s %5s %6s %6s %4s %s %s\n",
+      'S',
+      "UID",
+      "PID",
+      "PPID",
+      "VSZ",
+      "RSS",
+      "%CPU",
+      "COMMAND",
+      "ARGS"
+    );
+  }
 
   /* Zip through all of the process entries */
   while((proc = readdir(procdir))) {
@@ -174,19 +209,21 @@ try_again:
         ptr = procname;
 
     /*
-     * print out what we currently know
+     * print out what we currently know, a record is written once the
+     * args are known
      */
-    printf("%c %5d %5d %5d %6lu %6lu %4.1f %s ",
-      psinfo.pr_lwp.pr_sname,
-      psinfo.pr_euid,
-      psinfo.pr_pid,
-      psinfo.pr_ppid,
-      psinfo.pr_size,
-      psinfo.pr_rssize,
-      ((float)(psinfo.pr_pctcpu) / 0x8000 * 100.0),
-      ptr
-    );
-    free(procname);
+    if(!binary) {
+      printf("%c %5d %5d %5d %6lu %6lu %4.1f %s ",
+        psinfo.pr_lwp.pr_sname,
+        psinfo.pr_euid,
+        psinfo.pr_pid,
+        psinfo.pr_ppid,
+        psinfo.pr_size,
+        psinfo.pr_rssize,
+        ((float)(psinfo.pr_pctcpu) / 0x8000 * 100.0),
+        ptr
+      );
+    }
 
     /*
      * and now for the command line stuff
@@ -213,6 +250,15 @@ try_again:
      * now read in the args - if what we read in fills buffer
      * resize buffer and reread that bit again
      */
+    if(binary) {
+      struct record blank;
+
+      memset(&blank, 0, sizeof(blank));
+      line_len = 0;
+      append(&line, &line_len, &line_size, (char *)&blank, sizeof(blank));
+      append(&line, &line_len, &line_size, ptr, strlen(ptr));
+    }
+
     argslen=ARGS;
     args=malloc(argslen+1);
     for(i=0;i<args_count;i++) {
@@ -227,12 +273,35 @@ try_again:
         i--;
         continue;
       }
-      printf(" %s", args);
+      if(binary) {
+        if(line_len > sizeof(struct record) + strlen(ptr))
+          append(&line, &line_len, &line_size, " ", 1);
+        append(&line, &line_len, &line_size, args, strlen(args));
+      } else {
+        printf(" %s", args);
+      }
     }
     free(args_vecs);
     free(args);
     close(as_fd);
-    printf("\n");
+    if(binary) {
+      struct record *r = (struct record *)line;
+      memset(r, 0, sizeof(*r));
+      r->length = line_len;
+      r->uid = psinfo.pr_euid;
+      r->pid = psinfo.pr_pid;
+      r->ppid = psinfo.pr_ppid;
+      r->vsz = psinfo.pr_size;
+      r->rss = psinfo.pr_rssize;
+      r->pcpu = (uint32_t)psinfo.pr_pctcpu * 10000 / 0x8000;
+      r->state[0] = psinfo.pr_lwp.pr_sname;
+      r->prog_length = strlen(ptr);
+      r->args_length = line_len - sizeof(*r) - r->prog_length;
+      fwrite(line, 1, line_len, stdout);
+    } else {
+      printf("\n");
+    }
+    free(procname);
   }
 
   (void) closedir(procdir);
@@ -242,9 +311,27 @@ try_again:
 
 /*----------------------------------------------------------------------------*/
 
+static int append(char **buf, size_t *len, size_t *size, const char *data, size_t n) {
+  char *p;
+
+  if(*len + n > *size) {
+    *size = (*len + n) * 2;
+    if((p = realloc(*buf, *size)) == NULL) {
+      fprintf(stderr, "%s: out of memory\n", szProg);
+      exit(1);
+    }
+    *buf = p;
+  }
+  memcpy(*buf + *len, data, n);
+  *len += n;
+  return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
 void usage() {
   printf("%s: Help output\n\n", szProg);
-  printf("If this program is given any arguments, this help is displayed.\n");
+  printf("If this program is given any arguments but -b, this help is displayed.\n");
   printf("This command is used to print out the full command line for all\n");
   printf("running processes because /usr/bin/ps is limited to 80 chars and\n");
   printf("/usr/ucb/ps can merge columns together.\n\n");
@@ -258,5 +345,6 @@ void usage() {
   printf("\t%%CPU     - CPU usage\n");
   printf("\tCOMMAND  - Command being run\n");
   printf("\tARGS     - Full command line with arguements\n");
+  printf("\nWith -b the same fields are written as binary records for check_procs.\n");
   return;
 }
@@ -12,7 +12,7 @@ my $allow_sudo = getTestParameter( "NP_ALLOW_SUDO",
                                    "no" );
 
 if ($allow_sudo eq "yes" or $> == 0) {
-    plan tests => 6;
+    plan tests => 8;
 } else {
     plan skip_all => "Need sudo to test check_dhcp";
 }
@@ -20,6 +20,7 @@ my $sudo = $> == 0 ? '' : 'sudo';
 
 my $successOutput = '/OK: Received \d+ DHCPOFFER\(s\), \d+ of 1 requested servers responded, max lease time = \d+ sec\./';
 my $failureOutput = '/CRITICAL: No DHCPOFFERs were received/';
+my $failureOutputMulti = '/CRITICAL: No DHCPOFFERs were received on 2 interfaces/';
 my $invalidOutput = '/Invalid hostname/';
 
 my $host_responsive    = getTestParameter( "NP_HOST_DHCP_RESPONSIVE",
@@ -39,6 +40,7 @@ my $interface = '';
 if(`ifconfig -a 2>/dev/null` =~ m/^(e\w*\d+)/mx and $1 ne 'eth0') {
     $interface = ' -i '.$1;
 }
+my $ifname = $interface ? substr($interface, 4) : 'eth0';
 
 my $res;
 SKIP: {
@@ -59,6 +61,15 @@ SKIP: {
     like( $res->output, $failureOutput, "Output OK" );
 };
 
+SKIP: {
+    skip('need nonresponsive test host', 2) unless $host_nonresponsive;
+    $res = NPTest->testCmd(
+        "$sudo ./check_dhcp -i $ifname,$ifname -u -s $host_nonresponsive"
+    );
+    is( $res->return_code, 2, "Exit code - host nonresponsive on several interfaces" );
+    like( $res->output, $failureOutputMulti, "Output OK" );
+};
+
 SKIP: {
     skip('need invalid test host', 2) unless $hostname_invalid;
     $res = NPTest->testCmd(
@@ -12,7 +12,7 @@ my $allow_sudo = getTestParameter( "NP_ALLOW_SUDO",
 	"no" );
 
 if ($allow_sudo eq "yes" or $> == 0) {
-	plan tests => 16;
+	plan tests => 26;
 } else {
 	plan skip_all => "Need sudo to test check_icmp";
 }
@@ -83,3 +83,33 @@ $res = NPTest->testCmd(
 is( $res->return_code, 2, "One of two host nonresponsive - two required" );
 like( $res->output, $failureOutput, "Output OK" );
 
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H $host_responsive -r 100 -n 3 -i 10ms -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 0, "Paced sending" );
+like( $res->output, $successOutput, "Output OK" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H $host_responsive -H $host_nonresponsive -r 100 -n 1 -w 10000ms,100% -c 10000ms,100% -m 2"
+	);
+is( $res->return_code, 2, "Paced sending, one of two host nonresponsive - two required" );
+like( $res->output, $failureOutput, "Output OK" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H $host_nonresponsive -N 5s -n 1 -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 2, "Nonresponsive host with the neighbour table consulted" );
+like( $res->output, '/100%/', "Error contains '100%' string (for 100% packet loss)" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H 127.0.0.0/29 -n 1 -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 0, "Range of loopback addresses" );
+like( $res->output, '/127\.0\.0\.6: rta/', "Names made from the addresses of the range" );
+
+$res = NPTest->testCmd(
+	"$sudo ./check_icmp -H 127.0.0.3 -H 127.0.0.0/29 -n 1"
+	);
+is( $res->return_code, 3, "Range overlapping another target" );
+like( $res->output, '/overlaps/', "Output names the overlap" );
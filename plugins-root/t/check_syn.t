@@ -0,0 +1,60 @@
+#! /usr/bin/perl -w -I ..
+#
+# Half-open port checks via check_syn
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use IO::Socket::INET;
+
+my $allow_sudo = getTestParameter( "NP_ALLOW_SUDO",
+	"If sudo is setup for this user to run any command as root ('yes' to allow)",
+	"no" );
+
+if (! -x "./check_syn") {
+	plan skip_all => "check_syn is only built on linux";
+} elsif ($allow_sudo eq "yes" or $> == 0) {
+	plan tests => 12;
+} else {
+	plan skip_all => "Need sudo to test check_syn";
+}
+my $sudo = $> == 0 ? '' : 'sudo';
+
+my $host_nonresponsive = getTestParameter( "NP_HOST_NONRESPONSIVE",
+				"The hostname of system not responsive to network requests",
+				"10.0.0.1" );
+
+# a port that accepts, and one that refused once it is closed again
+my $listener = IO::Socket::INET->new( LocalAddr => '127.0.0.1', LocalPort => 0, Listen => 5, ReuseAddr => 1 )
+	or die "Cannot listen: $!";
+my $open = $listener->sockport;
+my $closer = IO::Socket::INET->new( LocalAddr => '127.0.0.1', LocalPort => 0, Listen => 1 );
+my $closed = $closer->sockport;
+$closer->close;
+
+my $res;
+
+$res = NPTest->testCmd( "$sudo ./check_syn -H 127.0.0.1:$open" );
+is( $res->return_code, 0, "Open port" );
+like( $res->output, '/^SYN OK - 1 of 1 open, rta [\d\.]+ms, max [\d\.]+ms\|open=1;;;0;1 /', "Output OK" );
+
+$res = NPTest->testCmd( "$sudo ./check_syn -H 127.0.0.1 -p $closed" );
+is( $res->return_code, 2, "Closed port" );
+like( $res->output, "/0 of 1 open, 1 refused: 127.0.0.1:$closed refused/", "Refused and named" );
+
+$res = NPTest->testCmd( "$sudo ./check_syn -H 127.0.0.1:$open -H 127.0.0.1:$closed -w 200,50% -c 500,60%" );
+is( $res->return_code, 0, "One of two refused, below the threshold" );
+like( $res->output, '/pl=50.000000%;50.000000;60.000000;/', "Packet loss perfdata" );
+
+$res = NPTest->testCmd( "$sudo ./check_syn -H $host_nonresponsive:80 -W 200 -n 2" );
+is( $res->return_code, 2, "No answer" );
+like( $res->output, '/1 without answer/', "Output OK" );
+
+$res = NPTest->testCmd( "$sudo ./check_syn -H 127.0.0.1" );
+is( $res->return_code, 3, "No port" );
+like( $res->output, '/No port given for target/', "Output with appropriate error message" );
+
+$res = NPTest->testCmd( "$sudo ./check_syn -H 127.0.0.1:$open -H 127.0.0.1:$closed -r 1 -t 1" );
+is( $res->return_code, 3, "More than fits in the timeout" );
+like( $res->output, '/take about \d+ seconds, more than the timeout of 1/', "Output OK" );
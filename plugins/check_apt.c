@@ -37,12 +37,15 @@ const char *email = "devel@monitoring-plugins.org";
 #include "runcmd.h"
 #include "utils.h"
 #include "regex.h"
+#include <sys/stat.h>
 
 /* some constants */
 typedef enum { UPGRADE, DIST_UPGRADE, NO_UPGRADE } upgrade_type;
 
 /* Character for hidden input file option (for testing). */
 #define INPUT_FILE_OPT CHAR_MAX+1
+#define CACHE_OPT CHAR_MAX+2
+#define SUMMARY_FILE_OPT CHAR_MAX+3
 /* the default opts can be overridden via the cmdline */
 #define UPGRADE_DEFAULT_OPTS "-o 'Debug::NoLocking=true' -s -qq"
 #define UPDATE_DEFAULT_OPTS "-q"
@@ -53,6 +56,9 @@ typedef enum { UPGRADE, DIST_UPGRADE, NO_UPGRADE } upgrade_type;
 #endif /* PATH_TO_APTGET */
 /* String found at the beginning of the apt output lines we're interested in */
 #define PKGINST_PREFIX "Inst "
+/* what apt-get upgrade -s depends on, the output is cached until they change */
+#define DPKG_STATUS "/var/lib/dpkg/status"
+#define APT_LISTS "/var/lib/apt/lists"
 /* the RE that catches security updates */
 #define SECURITY_RE "^[^\\(]*\\(.* (Debian-Security:|Ubuntu:[^/]*/[^-]*-security)"
 
@@ -67,6 +73,11 @@ char* construct_cmdline(upgrade_type u, const char *opts);
 int run_update(void);
 /* run an apt-get upgrade */
 int run_upgrade(int *pkgcount, int *secpkgcount, char ***pkglist, char ***secpkglist);
+/* stamp of the package database and lists, FALSE if they are missing */
+int apt_stamp(char *stamp, size_t len, time_t *newest);
+/* the apt-get upgrade output cached for the current stamp */
+int read_cache(const char *stamp, output *out);
+void write_cache(const char *stamp, output *out);
 /* add another clause to a regexp */
 char* add_to_regexp(char *expr, const char *next);
 /* extract package name from Inst line */
@@ -86,6 +97,8 @@ static char *do_include = NULL;  /* regexp to only include certain packages */
 static char *do_exclude = NULL;  /* regexp to only exclude certain packages */
 static char *do_critical = NULL;  /* regexp specifying critical packages */
 static char *input_filename = NULL; /* input filename for testing */
+static char *summary_filename = NULL; /* apt-get upgrade output saved elsewhere */
+static int use_cache = 0;    /* reuse the last apt-get upgrade output */
 /* number of packages available for upgrade to return WARNING status */
 static int packages_warning = 1;
 
@@ -97,6 +110,8 @@ int main (int argc, char **argv) {
 	int result=STATE_UNKNOWN, packages_available=0, sec_count=0, i=0;
 	char **packages_list=NULL, **secpackages_list=NULL;
 
+	np_init((char *) progname, argc, argv);
+
 	/* Parse extra opts if any */
 	argv=np_extra_opts(&argc, argv, progname);
 
@@ -172,6 +187,8 @@ int process_arguments (int argc, char **argv) {
 		{"critical", required_argument, 0, 'c'},
 		{"only-critical", no_argument, 0, 'o'},
 		{"input-file", required_argument, 0, INPUT_FILE_OPT},
+		{"cache", no_argument, 0, CACHE_OPT},
+		{"summary-file", required_argument, 0, SUMMARY_FILE_OPT},
 		{"packages-warning", required_argument, 0, 'w'},
 		{0, 0, 0, 0}
 	};
@@ -236,6 +253,12 @@ int process_arguments (int argc, char **argv) {
 		case INPUT_FILE_OPT:
 			input_filename = optarg;
 			break;
+		case CACHE_OPT:
+			use_cache = 1;
+			break;
+		case SUMMARY_FILE_OPT:
+			summary_filename = optarg;
+			break;
 		case 'w':
 			packages_warning = atoi(optarg);
 			break;
@@ -249,12 +272,83 @@ int process_arguments (int argc, char **argv) {
 }
 
 
+/* The stamp changes with the installed packages (dpkg status) and the
+ * available ones (apt lists, where apt-get update renames new files) */
+int apt_stamp(char *stamp, size_t len, time_t *newest){
+	struct stat status_st, lists_st;
+
+	if(stat(DPKG_STATUS, &status_st) != 0 || stat(APT_LISTS, &lists_st) != 0)
+		return FALSE;
+
+	snprintf(stamp, len, "%lu:%lu:%lu", (unsigned long)status_st.st_mtime,
+	    (unsigned long)status_st.st_size, (unsigned long)lists_st.st_mtime);
+	*newest = max(status_st.st_mtime, lists_st.st_mtime);
+	return TRUE;
+}
+
+/* The state holds the stamp, then the "Inst" lines, separated by tabs */
+int read_cache(const char *stamp, output *out){
+	state_data *previous;
+	char *data, *line;
+	size_t i;
+
+	if((previous = np_state_read()) == NULL)
+		return FALSE;
+
+	data = strdup((char *) previous->data);
+	if(data == NULL) die(STATE_UNKNOWN, "strdup failed");
+	line = strsep(&data, "\t");
+	if(strcmp(line, stamp) != 0){
+		if(verbose) printf(_("Cached output is out of date\n"));
+		free(line);
+		return FALSE;
+	}
+
+	memset(out, 0, sizeof(output));
+	out->buf = line;
+	for(i = 0; data && data[i]; i++)
+		if(data[i] == '\t') out->lines++;
+	if(data) out->lines++;
+	out->line = malloc(sizeof(char *) * (out->lines + 1));
+	if(out->line == NULL) die(STATE_UNKNOWN, "malloc failed!\n");
+	for(i = 0; i < out->lines; i++)
+		out->line[i] = strsep(&data, "\t");
+
+	if(verbose) printf(_("Using cached output, %lu lines\n"), (unsigned long)out->lines);
+	return TRUE;
+}
+
+void write_cache(const char *stamp, output *out){
+	char *data = NULL;
+	size_t i, len = strlen(stamp) + 1;
+
+	for(i = 0; i < out->lines; i++)
+		if(strncmp(PKGINST_PREFIX, out->line[i], strlen(PKGINST_PREFIX)) == 0)
+			len += strlen(out->line[i]) + 1;
+	data = malloc(len);
+	if(data == NULL) die(STATE_UNKNOWN, "malloc failed!\n");
+
+	strcpy(data, stamp);
+	for(i = 0; i < out->lines; i++) {
+		if(strncmp(PKGINST_PREFIX, out->line[i], strlen(PKGINST_PREFIX)) == 0 &&
+		   strchr(out->line[i], '\t') == NULL) {
+			strcat(data, "\t");
+			strcat(data, out->line[i]);
+		}
+	}
+	np_state_write_string(0, data);
+	free(data);
+}
+
 /* run an apt-get upgrade */
 int run_upgrade(int *pkgcount, int *secpkgcount, char ***pkglist, char ***secpkglist){
 	int i=0, result=STATE_UNKNOWN, regres=0, pc=0, spc=0;
 	struct output chld_out, chld_err;
 	regex_t ireg, ereg, sreg;
-	char *cmdline=NULL, rerrbuf[64];
+	char *cmdline=NULL, rerrbuf[64], stamp[64];
+	int have_stamp=FALSE, cached=FALSE;
+	time_t newest=0;
+	struct stat st;
 
 	/* initialize ereg as it is possible it is printed while uninitialized */
 	memset(&ereg, '\0', sizeof(ereg.buffer));
@@ -288,13 +382,46 @@ int run_upgrade(int *pkgcount, int *secpkgcount, char ***pkglist, char ***secpkg
 	}
 
 	cmdline=construct_cmdline(upgrade, upgrade_opts);
-	if (input_filename != NULL) {
+	memset(&chld_err, 0, sizeof(chld_err));
+	/* taken before apt-get runs, so that changes while it runs are seen
+	 * the next time */
+	have_stamp = apt_stamp(stamp, sizeof(stamp), &newest);
+	if (use_cache && have_stamp) {
+		char *key = NULL;
+		struct sha1_ctx ctx;
+		unsigned char digest[20];
+
+		/* one cache for each apt-get command line */
+		sha1_init_ctx(&ctx);
+		sha1_process_bytes(cmdline, strlen(cmdline), &ctx);
+		sha1_finish_ctx(&ctx, digest);
+		for(i = 0; i < 8; i++)
+			xasprintf(&key, "%s%02x", i ? key : "apt_", digest[i]);
+		np_enable_state(key, 1);
+		free(key);
+		cached = read_cache(stamp, &chld_out);
+	}
+
+	if (cached) {
+		result = 0;
+	} else if (summary_filename != NULL) {
+		/* written by an APT hook, it must be newer than what it describes */
+		if (stat(summary_filename, &st) != 0)
+			die(STATE_UNKNOWN, _("Error opening %s: %s\n"), summary_filename, strerror(errno));
+		if (have_stamp && st.st_mtime < newest)
+			die(STATE_UNKNOWN, _("%s is older than the installed packages or the package lists\n"), summary_filename);
+		result = cmd_file_read(summary_filename, &chld_out, 0);
+	} else if (input_filename != NULL) {
 		/* read input from a file for testing */
 		result = cmd_file_read(input_filename, &chld_out, 0);
 	} else {
 		/* run the upgrade */
 		result = np_runcmd(cmdline, &chld_out, &chld_err, 0);
 	}
+
+	/* only clean runs are kept */
+	if (use_cache && have_stamp && !cached && result == 0 && chld_err.buflen == 0)
+		write_cache(stamp, &chld_out);
    
 	/* apt-get upgrade only changes exit status if there is an
 	 * internal error when run in dry-run mode.  therefore we will
@@ -349,7 +476,7 @@ int run_upgrade(int *pkgcount, int *secpkgcount, char ***pkglist, char ***secpkg
 	*secpkgcount=spc;
 
 	/* If we get anything on stderr, at least set warning */
-	if (input_filename == NULL && chld_err.buflen) {
+	if (chld_err.buflen) {
 		stderr_warning=1;
 		result = max_state(result, STATE_WARNING);
 		if(verbose){
@@ -537,6 +664,15 @@ print_help (void)
   printf ("    %s\n", _("Only warn about upgrades matching the critical list.  The total number"));
   printf ("    %s\n", _("of upgrades will be printed, but any non-critical upgrades will not cause"));
   printf ("    %s\n", _("the plugin to return WARNING status."));
+  printf (" %s\n", "--cache");
+  printf ("    %s\n", _("Reuse the apt-get output of the last run until the installed packages"));
+  printf ("    ");
+  printf (_("(%s) or the package lists (%s) change."), DPKG_STATUS, APT_LISTS);
+  printf ("\n");
+  printf (" %s\n", "--summary-file=FILE");
+  printf ("    %s\n", _("Read the output of 'apt-get -s upgrade' from FILE instead of running it,"));
+  printf ("    %s\n", _("e.g. as written by an APT Post-Invoke hook. UNKNOWN if FILE is older than"));
+  printf ("    %s\n", _("the installed packages or the package lists."));
   printf (" %s\n", "-w, --packages-warning");
   printf ("    %s\n", _("Minumum number of packages available for upgrade to return WARNING status."));
   printf ("    %s\n\n", _("Default is 1 package."));
@@ -34,14 +34,30 @@ const char *email = "devel@monitoring-plugins.org";
 #include "utils.h"
 #include "netutils.h"
 #include "utils_cmd.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #ifndef NP_MAXARGS
 #define NP_MAXARGS 1024
 #endif
 
+#define MULTIPLEX_OPTION CHAR_MAX+1
+#define STREAM_OPTION CHAR_MAX+2
+#define AGENT_OPTION CHAR_MAX+3
+#define PARALLEL_OPTION CHAR_MAX+4
+
+/* how long an idle master connection or agent is kept, unless --multiplex
+ * or --agent says */
+#define DEFAULT_CONTROL_PERSIST 300
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 void comm_append (const char *);
+void ssh_multiplex (void);
+int run_stream (void);
+int run_parallel (void);
 void print_help (void);
 void print_usage (void);
 
@@ -57,8 +73,23 @@ char *outputfile = NULL;
 char *host_shortname = NULL;
 char **service;
 int passive = FALSE;
+int stream = FALSE;
+int control_persist = 0;
+int agent_idle = 0;
+int parallel = -1;	/* sessions at the same time, 0 for all, -1 for one shell */
+char **command_list = NULL;
+unsigned int command_count = 0;
 int verbose = FALSE;
 
+/* where stream_result() is in the output of a passive run */
+struct stream_state {
+	FILE *fp;
+	int skip;
+	char *status_text;
+};
+
+int agent_run (output *, output *, struct stream_state *);
+
 int
 main (int argc, char **argv)
 {
@@ -74,9 +105,7 @@ main (int argc, char **argv)
 	remotecmd = "";
 	comm_append(SSH_COMMAND);
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -91,6 +120,9 @@ main (int argc, char **argv)
 	}
 	alarm (timeout_interval);
 
+	if (control_persist > 0)
+		ssh_multiplex ();
+
 	/* run the command */
 	if (verbose) {
 		printf ("Command: %s\n", commargv[0]);
@@ -98,7 +130,13 @@ main (int argc, char **argv)
 			printf ("Argument %i: %s\n", i, commargv[i]);
 	}
 
-	result = cmd_run_array (commargv, &chld_out, &chld_err, 0);
+	if (stream)
+		return run_stream ();
+	if (parallel >= 0)
+		return run_parallel ();
+
+	if (agent_idle == 0 || (result = agent_run (&chld_out, &chld_err, NULL)) < 0)
+		result = cmd_run_array (commargv, &chld_out, &chld_err, 0);
 
 	if (verbose) {
 		for(i = 0; i < chld_out.lines; i++)
@@ -162,6 +200,568 @@ main (int argc, char **argv)
 	return result;
 }
 
+/* Writes a result to the external command file as soon as its status
+ * line has come in */
+static int
+stream_result (char *line, void *data)
+{
+	struct stream_state *st = data;
+	int cresult;
+
+	if (verbose)
+		printf ("stdout: %s\n", line);
+
+	/* skip n (or all) lines on stdout */
+	if (st->skip != 0) {
+		if (st->skip > 0)
+			st->skip--;
+		return 0;
+	}
+
+	if (st->status_text == NULL) {
+		st->status_text = strdup (line);
+		return 0;
+	}
+	if (sscanf (line, "STATUS CODE: %d", &cresult) != 1)
+		die (STATE_UNKNOWN, _("%s: Error parsing output\n"), progname);
+
+	if (service[commands]) {
+		fprintf (st->fp, "[%d] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;%s\n",
+		         (int) time (NULL), host_shortname, service[commands++],
+		         cresult, st->status_text);
+		fflush (st->fp);
+	}
+	free (st->status_text);
+	st->status_text = NULL;
+	return 0;
+}
+
+/* Passive mode, but each result is written as its command completes
+ * instead of after the whole batch */
+int
+run_stream (void)
+{
+	struct stream_state st;
+	output chld_err;
+	int result, i;
+
+	if (!(st.fp = fopen (outputfile, "a"))) {
+		printf (_("SSH WARNING: could not open %s\n"), outputfile);
+		exit (STATE_UNKNOWN);
+	}
+	st.skip = skip_stdout;
+	st.status_text = NULL;
+	commands = 0;
+
+	if (agent_idle == 0 || (result = agent_run (NULL, &chld_err, &st)) < 0)
+		result = cmd_run_array_lines (commargv, stream_result, &st, &chld_err, 0);
+	fclose (st.fp);
+
+	if (verbose)
+		for(i = 0; i < chld_err.lines; i++)
+			printf("stderr: %s\n", chld_err.line[i]);
+
+	if (skip_stderr == -1) /* --skip-stderr specified without argument */
+		skip_stderr = chld_err.lines;
+
+	/* UNKNOWN or worse if (non-skipped) output found on stderr */
+	if(chld_err.lines > skip_stderr) {
+		printf (_("Remote command execution failed: %s\n"),
+		        chld_err.line[skip_stderr]);
+		return max_state_alt(result, STATE_UNKNOWN);
+	}
+
+	if (st.status_text != NULL)
+		die (STATE_UNKNOWN, _("%s: Error parsing output\n"), progname);
+
+	/* Multiple commands and passive checking should always return OK */
+	return result;
+}
+
+/* Passive mode, with each command in an ssh session of its own and the
+ * sessions running side by side rather than the commands one after the
+ * other in one remote shell */
+int
+run_parallel (void)
+{
+	cmd_job *jobs;
+	char **argv;
+	size_t skip, j;
+	unsigned int i;
+	int result = STATE_OK, cresult;
+	time_t local_time;
+	FILE *fp;
+
+	if ((jobs = calloc (command_count, sizeof (cmd_job))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < command_count; i++) {
+		if ((argv = malloc ((commargc + 1) * sizeof (char *))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		memcpy (argv, commargv, (commargc + 1) * sizeof (char *));
+		xasprintf (&argv[commargc - 1], "%s;echo STATUS CODE: $?", command_list[i]);
+		jobs[i].argv = argv;
+	}
+	cmd_run_many (jobs, command_count, parallel, 0);
+
+	if (!(fp = fopen (outputfile, "a"))) {
+		printf (_("SSH WARNING: could not open %s\n"), outputfile);
+		exit (STATE_UNKNOWN);
+	}
+	local_time = time (NULL);
+	for (i = 0; i < command_count; i++) {
+		if (verbose) {
+			for (j = 0; j < jobs[i].out.lines; j++)
+				printf ("stdout %u: %s\n", i + 1, jobs[i].out.line[j]);
+			for (j = 0; j < jobs[i].err.lines; j++)
+				printf ("stderr %u: %s\n", i + 1, jobs[i].err.line[j]);
+		}
+
+		/* what is skipped is skipped in every session */
+		skip = skip_stderr == -1 ? jobs[i].err.lines : (size_t) skip_stderr;
+		if (jobs[i].err.lines > skip) {
+			printf (_("Remote command execution failed: %s\n"), jobs[i].err.line[skip]);
+			result = max_state_alt (result, STATE_UNKNOWN);
+			continue;
+		}
+		skip = skip_stdout == -1 ? jobs[i].out.lines : (size_t) skip_stdout;
+		if (jobs[i].out.lines <= skip)
+			continue;
+		if (jobs[i].out.lines < skip + 2 ||
+		    sscanf (jobs[i].out.line[skip + 1], "STATUS CODE: %d", &cresult) != 1)
+			die (STATE_UNKNOWN, _("%s: Error parsing output\n"), progname);
+		if (service[i])
+			fprintf (fp, "[%d] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;%s\n",
+			         (int) local_time, host_shortname, service[i],
+			         cresult, jobs[i].out.line[skip]);
+	}
+	fclose (fp);
+
+	/* Multiple commands and passive checking should always return OK */
+	return result;
+}
+
+
+static int
+ssh_socket_alive (const char *path)
+{
+	struct sockaddr_un sun;
+	int fd, alive;
+
+	if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return FALSE;
+	memset (&sun, 0, sizeof (sun));
+	sun.sun_family = AF_UNIX;
+	strcpy (sun.sun_path, path);
+	alive = connect (fd, (struct sockaddr *)&sun, sizeof (sun)) == 0;
+	close (fd);
+	return alive;
+}
+
+/* The socket of a master connection or agent, named by the ssh options
+ * and host, in the state directory. NULL if the path is too long for a
+ * socket */
+static char *
+ssh_socket_path (const char *suffix)
+{
+	struct sha1_ctx ctx;
+	struct sockaddr_un sun;
+	unsigned char digest[20];
+	char key[41], *path, *p;
+	int i;
+
+	/* everything but the remote command */
+	sha1_init_ctx (&ctx);
+	for (i = 0; i < commargc - 1; i++)
+		sha1_process_bytes (commargv[i], strlen (commargv[i]) + 1, &ctx);
+	sha1_finish_ctx (&ctx, digest);
+	for (i = 0; i < 20; i++)
+		sprintf (&key[2 * i], "%02x", digest[i]);
+
+	xasprintf (&path, "%s/%lu/ssh/%s%s", _np_state_calculate_location_prefix (),
+	           (unsigned long) geteuid (), key, suffix);
+	if (strlen (path) >= sizeof (sun.sun_path)) {
+		if (verbose)
+			printf (_("Socket path is too long: %s\n"), path);
+		free (path);
+		return NULL;
+	}
+	for (p = path + 1; *p; p++) {
+		if (*p == '/') {
+			*p = '\0';
+			if (access (path, F_OK) != 0 && mkdir (path, S_IRWXU) != 0)
+				die (STATE_UNKNOWN, _("Cannot create directory: %s\n"), path);
+			*p = '/';
+		}
+	}
+	return path;
+}
+
+/* Only one check at a time starts the master or agent of a host */
+static int
+ssh_lock (const char *path)
+{
+	struct flock lock;
+	char *lock_path;
+	int lock_fd;
+
+	xasprintf (&lock_path, "%s.lock", path);
+	if ((lock_fd = open (lock_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0)
+		die (STATE_UNKNOWN, _("Cannot open %s: %s\n"), lock_path, strerror (errno));
+	memset (&lock, 0, sizeof (lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	while (fcntl (lock_fd, F_SETLKW, &lock) < 0)
+		if (errno != EINTR)
+			die (STATE_UNKNOWN, _("Cannot lock %s: %s\n"), lock_path, strerror (errno));
+	free (lock_path);
+	return lock_fd;
+}
+
+/*
+ * Makes the ssh command go through a master connection, which is kept
+ * for control_persist seconds after its last use. Masters are keyed by
+ * the ssh options and host, and live in the state directory. Checks
+ * keep running without one if it cannot be started.
+ */
+void
+ssh_multiplex (void)
+{
+	char *path, **argv;
+	int i, n, lock_fd, status;
+	pid_t pid;
+
+	if ((path = ssh_socket_path ("")) == NULL)
+		return;
+	lock_fd = ssh_lock (path);
+
+	if (!ssh_socket_alive (path)) {
+		unlink (path);
+
+		/* ssh -M -N, which goes to the background once it is connected.
+		 * Options of our own after those of the user, the first one wins */
+		argv = calloc (commargc + 12, sizeof (char *));
+		n = 0;
+		argv[n++] = commargv[0];
+		argv[n++] = "-M";
+		argv[n++] = "-N";
+		argv[n++] = "-S";
+		argv[n++] = path;
+		argv[n++] = "-o";
+		xasprintf (&argv[n++], "ControlPersist=%d", control_persist);
+		for (i = 1; i < commargc - 2; i++)
+			argv[n++] = commargv[i];
+		argv[n++] = "-o";
+		argv[n++] = "BatchMode=yes";
+		argv[n++] = "-o";
+		xasprintf (&argv[n++], "ConnectTimeout=%u", timeout_interval);
+		argv[n++] = commargv[commargc - 2];
+		argv[n] = NULL;
+
+		if (verbose)
+			printf (_("Starting master connection: %s\n"), path);
+		if ((pid = fork ()) == 0) {
+			/* the master must not hold our pipes open */
+			setsid ();
+			if ((i = open ("/dev/null", O_RDWR)) >= 0) {
+				dup2 (i, STDIN_FILENO);
+				dup2 (i, STDOUT_FILENO);
+				dup2 (i, STDERR_FILENO);
+			}
+			execv (argv[0], argv);
+			_exit (STATE_UNKNOWN);
+		}
+		status = -1;
+		while (pid > 0 && waitpid (pid, &status, 0) < 0 && errno == EINTR)
+			;
+		if (status != 0 || !ssh_socket_alive (path)) {
+			if (verbose)
+				printf (_("Could not start the master connection, not multiplexing\n"));
+			close (lock_fd);
+			return;
+		}
+	}
+	close (lock_fd);
+
+	/* ssh -S path -o ControlMaster=no ... */
+	if ((commargv = realloc (commargv, (commargc + 5) * sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Can not (re)allocate 'commargv' buffer\n"));
+	memmove (commargv + 5, commargv + 1, commargc * sizeof (char *));
+	commargv[1] = "-S";
+	commargv[2] = path;
+	commargv[3] = "-o";
+	commargv[4] = "ControlMaster=no";
+	commargc += 4;
+}
+
+
+/*
+ * The remote agent (--agent) is a /bin/sh reading "<id> <command>" lines,
+ * which runs each command in a subshell, so that "exit" only ends the
+ * command and the shell execs the last program in place, and answers with a
+ * "<id> <status>" line, the stdout lines prefixed by '|', the stderr lines
+ * prefixed by '!' and a "." line. The script is one compound command, so
+ * the shell has read all of it when it says "ready", and no request can
+ * end up in its input buffer instead of that of "read". A local broker
+ * process per host owns the ssh channel to it and serves the checks over a
+ * socket in the state directory, one request line per command.
+ */
+static const char agent_script[] =
+	"{\n"
+	"np_t=`mktemp -d \"${TMPDIR:-/tmp}/np_agent.XXXXXX\"` || exit 1\n"
+	"trap 'rm -rf \"$np_t\"' 0\n"
+	"printf 'ready\\n'\n"
+	"while read -r np_id np_cmd; do\n"
+	"  (eval \"$np_cmd\") </dev/null >\"$np_t/o\" 2>\"$np_t/e\"\n"
+	"  printf '%s %s\\n' \"$np_id\" \"$?\"\n"
+	"  while IFS= read -r np_l || [ -n \"$np_l\" ]; do printf '|%s\\n' \"$np_l\"; done <\"$np_t/o\"\n"
+	"  while IFS= read -r np_l || [ -n \"$np_l\" ]; do printf '!%s\\n' \"$np_l\"; done <\"$np_t/e\"\n"
+	"  printf '.\\n'\n"
+	"done\n"
+	"}\n";
+
+static int
+agent_connect (const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	memset (&sun, 0, sizeof (sun));
+	sun.sun_family = AF_UNIX;
+	strcpy (sun.sun_path, path);
+	if (connect (fd, (struct sockaddr *)&sun, sizeof (sun)) != 0) {
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* The broker: starts the agent over ssh, then passes the requests of the
+ * checks to it and its answers back, until it has been idle for
+ * agent_idle seconds or the agent is gone */
+static void
+agent_broker (int listen_fd, const char *path)
+{
+	int to_agent[2], from_agent[2], c, i, n;
+	char **argv, *line = NULL;
+	size_t size = 0;
+	unsigned int id = 0, reply_id;
+	struct pollfd pfds[2];
+	FILE *from = NULL, *client = NULL, *to_client = NULL;
+	pid_t pid;
+
+	/* ssh [options] -o BatchMode=yes host 'exec /bin/sh' */
+	argv = calloc (commargc + 4, sizeof (char *));
+	for (n = 0; n < commargc - 2; n++)
+		argv[n] = commargv[n];
+	argv[n++] = "-o";
+	argv[n++] = "BatchMode=yes";
+	argv[n++] = commargv[commargc - 2];
+	argv[n++] = "exec /bin/sh";
+	argv[n] = NULL;
+
+	if (pipe (to_agent) < 0 || pipe (from_agent) < 0)
+		_exit (STATE_UNKNOWN);
+	if ((pid = fork ()) == 0) {
+		dup2 (to_agent[0], STDIN_FILENO);
+		dup2 (from_agent[1], STDOUT_FILENO);
+		close (to_agent[0]);
+		close (to_agent[1]);
+		close (from_agent[0]);
+		close (from_agent[1]);
+		close (listen_fd);
+		execv (argv[0], argv);
+		_exit (STATE_UNKNOWN);
+	}
+	close (to_agent[0]);
+	close (from_agent[1]);
+	if (pid < 0 || write (to_agent[1], agent_script, strlen (agent_script)) < 0)
+		goto done;
+	from = fdopen (from_agent[0], "r");
+	if (getline (&line, &size, from) <= 0 || strcmp (line, "ready\n") != 0)
+		goto done;
+
+	pfds[0].fd = listen_fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = from_agent[0];
+	pfds[1].events = POLLIN;
+	for (;;) {
+		if ((i = poll (pfds, 2, agent_idle * 1000)) < 0 && errno == EINTR)
+			continue;
+		/* idle, or the agent went away or says things unasked */
+		if (i <= 0 || pfds[1].revents)
+			break;
+		if ((c = accept (listen_fd, NULL, NULL)) < 0)
+			continue;
+		client = fdopen (c, "r");
+		to_client = fdopen (dup (c), "w");
+		while (getline (&line, &size, client) > 0) {
+			line[strcspn (line, "\n")] = '\0';
+			if (dprintf (to_agent[1], "%u %s\n", ++id, line) < 0)
+				goto done;
+			if (getline (&line, &size, from) <= 0 ||
+			    sscanf (line, "%u %d", &reply_id, &i) != 2 || reply_id != id)
+				goto done;
+			fprintf (to_client, "%d\n", i);
+			do {
+				if (getline (&line, &size, from) <= 0)
+					goto done;
+				fputs (line, to_client);
+			} while (strcmp (line, ".\n") != 0);
+			fflush (to_client);
+		}
+		fclose (client);
+		fclose (to_client);
+		client = to_client = NULL;
+	}
+
+done:
+	/* no new checks for this one, then end the agent */
+	unlink (path);
+	if (client != NULL) {
+		fclose (client);
+		fclose (to_client);
+	}
+	close (listen_fd);
+	close (to_agent[1]);
+	if (from != NULL)
+		fclose (from);
+	if (pid > 0)
+		waitpid (pid, NULL, 0);
+	_exit (STATE_OK);
+}
+
+static void
+agent_start (const char *path)
+{
+	struct sockaddr_un sun;
+	int listen_fd, fd;
+	pid_t pid;
+
+	memset (&sun, 0, sizeof (sun));
+	sun.sun_family = AF_UNIX;
+	strcpy (sun.sun_path, path);
+	unlink (path);
+	if ((listen_fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    bind (listen_fd, (struct sockaddr *)&sun, sizeof (sun)) != 0 ||
+	    listen (listen_fd, 64) != 0) {
+		if (listen_fd >= 0)
+			close (listen_fd);
+		return;
+	}
+
+	if (verbose)
+		printf (_("Starting agent: %s\n"), path);
+	if ((pid = fork ()) == 0) {
+		/* the broker outlives us, and must not hold our pipes open */
+		setsid ();
+		alarm (0);
+		signal (SIGALRM, SIG_DFL);
+		signal (SIGPIPE, SIG_IGN);
+		if ((fd = open ("/dev/null", O_RDWR)) >= 0) {
+			dup2 (fd, STDIN_FILENO);
+			dup2 (fd, STDOUT_FILENO);
+			dup2 (fd, STDERR_FILENO);
+		}
+		agent_broker (listen_fd, path);
+	}
+	close (listen_fd);
+}
+
+/* One line of the output, collected or handed to the passive stream */
+static void
+agent_output (output *op, struct stream_state *st, const char *line)
+{
+	if (st != NULL) {
+		stream_result ((char *) line, st);
+		return;
+	}
+	op->line = realloc (op->line, (op->lines + 1) * sizeof (char *));
+	op->lens = realloc (op->lens, (op->lines + 1) * sizeof (size_t));
+	if (op->line == NULL || op->lens == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	op->line[op->lines] = strdup (line);
+	op->lens[op->lines++] = strlen (line);
+}
+
+/*
+ * Runs the commands through the agent of the host, starting it if there
+ * is none, and fills out and err the way the remote shell would have, or
+ * hands stdout to the passive stream. Returns -1 if the agent could not
+ * be used, and nothing was run then.
+ */
+int
+agent_run (output *out, output *err, struct stream_state *st)
+{
+	char *path, *line = NULL, status[32];
+	size_t size = 0;
+	unsigned int i;
+	int fd, lock_fd, rc = 0;
+	ssize_t len;
+	FILE *fp;
+
+	for (i = 0; i < command_count; i++)
+		if (strchr (command_list[i], '\n') != NULL)
+			return -1;
+	if ((path = ssh_socket_path (".agent")) == NULL)
+		return -1;
+
+	if ((fd = agent_connect (path)) < 0) {
+		lock_fd = ssh_lock (path);
+		if ((fd = agent_connect (path)) < 0) {
+			agent_start (path);
+			fd = agent_connect (path);
+		}
+		close (lock_fd);
+	}
+	if (fd < 0) {
+		if (verbose)
+			printf (_("Could not reach the agent, not using it\n"));
+		return -1;
+	}
+
+	for (i = 0; i < command_count; i++) {
+		if (verbose)
+			printf (_("Agent request: %s\n"), command_list[i]);
+		dprintf (fd, "%s\n", command_list[i]);
+	}
+	shutdown (fd, SHUT_WR);
+
+	if (out)
+		memset (out, 0, sizeof (output));
+	memset (err, 0, sizeof (output));
+	fp = fdopen (fd, "r");
+	for (i = 0; i < command_count; i++) {
+		if (getline (&line, &size, fp) <= 0) {
+			/* an agent that did not come up, the check runs without it */
+			if (i == 0) {
+				fclose (fp);
+				if (verbose)
+					printf (_("The agent did not answer, not using it\n"));
+				return -1;
+			}
+			die (STATE_UNKNOWN, _("%s: Lost the connection to the agent\n"), progname);
+		}
+		rc = atoi (line);
+		while ((len = getline (&line, &size, fp)) > 0 && strcmp (line, ".\n") != 0) {
+			line[strcspn (line, "\n")] = '\0';
+			agent_output (line[0] == '!' ? err : out, line[0] == '!' ? NULL : st, line + 1);
+		}
+		if (len <= 0)
+			die (STATE_UNKNOWN, _("%s: Lost the connection to the agent\n"), progname);
+		/* what the "echo STATUS CODE: $?" of the remote shell prints */
+		if (command_count > 1 || passive) {
+			snprintf (status, sizeof (status), "STATUS CODE: %d", rc);
+			agent_output (out, st, status);
+		}
+	}
+	fclose (fp);
+
+	/* the exit status of the remote shell */
+	return (command_count > 1 || passive) ? STATE_OK : rc;
+}
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -196,6 +796,10 @@ process_arguments (int argc, char **argv)
 		{"ssh-option", required_argument, 0, 'o'},
 		{"quiet", no_argument, 0, 'q'},
 		{"configfile", optional_argument, 0, 'F'},
+		{"multiplex", optional_argument, 0, MULTIPLEX_OPTION},
+		{"stream", no_argument, 0, STREAM_OPTION},
+		{"agent", optional_argument, 0, AGENT_OPTION},
+		{"parallel", optional_argument, 0, PARALLEL_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -287,6 +891,8 @@ process_arguments (int argc, char **argv)
 			comm_append("-f");
 			break;
 		case 'C':									/* Command for remote machine */
+			command_list = realloc (command_list, (commands + 1) * sizeof (char *));
+			command_list[commands] = optarg;
 			commands++;
 			if (commands > 1)
 				xasprintf (&remotecmd, "%s;echo STATUS CODE: $?;", remotecmd);
@@ -319,6 +925,33 @@ process_arguments (int argc, char **argv)
 			comm_append("-F");
 			comm_append(optarg);
 			break;
+		case MULTIPLEX_OPTION:						/* reuse a master connection */
+			if (optarg == NULL)
+				control_persist = DEFAULT_CONTROL_PERSIST;
+			else if (!is_intpos (optarg))
+				usage_va(_("multiplex argument must be a positive integer"));
+			else
+				control_persist = atoi (optarg);
+			break;
+		case STREAM_OPTION:						/* write passive results as they come */
+			stream = TRUE;
+			break;
+		case AGENT_OPTION:						/* run the commands through a remote agent */
+			if (optarg == NULL)
+				agent_idle = DEFAULT_CONTROL_PERSIST;
+			else if (!is_intpos (optarg))
+				usage_va(_("agent argument must be a positive integer"));
+			else
+				agent_idle = atoi (optarg);
+			break;
+		case PARALLEL_OPTION:						/* one session per command, side by side */
+			if (optarg == NULL)
+				parallel = 0;
+			else if (!is_intpos (optarg))
+				usage_va(_("parallel argument must be a positive integer"));
+			else
+				parallel = atoi (optarg);
+			break;
 		default:									/* help */
 			usage5();
 		}
@@ -341,6 +974,15 @@ process_arguments (int argc, char **argv)
 				xasprintf (&remotecmd, "%s", argv[c]);
 	}
 
+	/* the agent runs the remote command given as arguments as one */
+	if (commands == 0 && strlen (remotecmd) > 0) {
+		command_list = realloc (command_list, sizeof (char *));
+		command_list[0] = remotecmd;
+		command_count = 1;
+	}
+	else
+		command_count = commands;
+
 	if (commands > 1 || passive)
 		xasprintf (&remotecmd, "%s;echo STATUS CODE: $?;", remotecmd);
 
@@ -378,6 +1020,12 @@ validate_arguments (void)
 	if (passive && commands != services)
 		die (STATE_UNKNOWN, _("%s: In passive mode, you must provide a service name for each command.\n"), progname);
 
+	if (stream && !passive)
+		die (STATE_UNKNOWN, _("%s: --stream is for passive mode, it requires -O.\n"), progname);
+
+	if (parallel >= 0 && (!passive || stream || agent_idle > 0))
+		die (STATE_UNKNOWN, _("%s: --parallel is for passive mode, it requires -O and cannot be used with --stream or --agent.\n"), progname);
+
 	if (passive && host_shortname == NULL)
 		die (STATE_UNKNOWN, _("%s: In passive mode, you must provide the host short name from the monitoring configs.\n"), progname);
 
@@ -435,6 +1083,22 @@ print_help (void)
   printf ("    %s\n", _("Tell ssh to use this configfile [optional]"));
   printf (" %s\n","-q, --quiet");
   printf ("    %s\n", _("Tell ssh to suppress warning and diagnostic messages [optional]"));
+  printf (" %s\n","--multiplex[=SECONDS]");
+  printf ("    %s\n", _("Run the commands through a master connection to the host, kept in the"));
+  printf ("    %s\n", _("state directory, which later checks reuse. It is closed after SECONDS"));
+  printf ("    %s\n", _("without use (default: 300) [optional]"));
+  printf (" %s\n","--agent[=SECONDS]");
+  printf ("    %s\n", _("Run the commands in a shell left running on the remote host, which later"));
+  printf ("    %s\n", _("checks reuse over the same ssh channel, instead of a new ssh session and"));
+  printf ("    %s\n", _("shell each time. It ends after SECONDS without use (default: 300) [optional]"));
+  printf (" %s\n","--stream");
+  printf ("    %s\n", _("In passive mode, write each result to the output file as soon as its"));
+  printf ("    %s\n", _("command has completed, instead of after all of them [optional]"));
+  printf (" %s\n","--parallel[=N]");
+  printf ("    %s\n", _("In passive mode, run each command in an ssh session of its own, at most N"));
+  printf ("    %s\n", _("(default: all) at the same time, instead of one after the other in one"));
+  printf ("    %s\n", _("remote shell. -S and -E apply to each session. Best with --multiplex"));
+  printf ("    %s\n", _("[optional]"));
 	printf (UT_WARN_CRIT);
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 	printf (UT_VERBOSE);
@@ -469,6 +1133,8 @@ print_usage (void)
 	printf (" %s -H <host> -C <command> [-fqv] [-1|-2] [-4|-6]\n"
 	        "       [-S [lines]] [-E [lines]] [-t timeout] [-i identity]\n"
 	        "       [-l user] [-n name] [-s servicelist] [-O outputfile]\n"
-	        "       [-p port] [-o ssh-option] [-F configfile]\n",
+	        "       [-p port] [-o ssh-option] [-F configfile]\n"
+	        "       [--multiplex[=seconds]] [--agent[=seconds]] [--stream]\n"
+	        "       [--parallel[=sessions]]\n",
 	        progname);
 }
@@ -29,21 +29,30 @@ const char *email = "devel@monitoring-plugins.org";
 #include "common.h"
 #include "utils.h"
 #include "utils_base.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define CHECK_SERVICES	1
 #define CHECK_HOSTS	2
 
+#define CLUSTER_OPTION	CHAR_MAX+1
+#define QUERY_OPTION	CHAR_MAX+2
+
 void print_help (void);
 void print_usage (void);
 
-int total_services_ok=0;
-int total_services_warning=0;
-int total_services_unknown=0;
-int total_services_critical=0;
+/* the members of a cluster by state, 0-3 for services, 0-2 for hosts */
+typedef struct cluster {
+	char *name;
+	char *label;
+	thresholds *thresholds;
+	int states[4];
+} cluster;
 
-int total_hosts_up=0;
-int total_hosts_down=0;
-int total_hosts_unreachable=0;
+cluster *clusters=NULL;
+int clusters_count=0;
 
 char *warn_threshold;
 char *crit_threshold;
@@ -52,10 +61,15 @@ int check_type=CHECK_SERVICES;
 
 char *data_vals=NULL;
 char *label=NULL;
+char *feed=NULL;
+char *query=NULL;
 
 int verbose=0;
 
 int process_arguments(int,char **);
+void add_cluster(char *);
+void read_feed(void);
+int evaluate_cluster(cluster *, int);
 
 
 
@@ -63,11 +77,9 @@ int main(int argc, char **argv){
 	char *ptr;
 	int data_val;
 	int return_code=STATE_OK;
-	thresholds *thresholds = NULL;
+	int i, state, states[STATE_UNKNOWN+1] = { 0 };
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts(&argc, argv, progname);
@@ -75,78 +87,200 @@ int main(int argc, char **argv){
 	if(process_arguments(argc,argv)==ERROR)
 		usage(_("Could not parse arguments"));
 
-	/* Initialize the thresholds */
-	set_thresholds(&thresholds, warn_threshold, crit_threshold);
-	if(verbose)
-		print_thresholds("check_cluster", thresholds);
+	/* without --cluster, all members make up a single cluster */
+	if(clusters_count==0)
+		add_cluster(NULL);
 
-	/* check the data values */
-	for(ptr=strtok(data_vals,",");ptr!=NULL;ptr=strtok(NULL,",")){
+	if(feed!=NULL){
+		read_feed();
+	}
+	else{
+		/* check the data values */
+		for(ptr=strtok(data_vals,",");ptr!=NULL;ptr=strtok(NULL,",")){
+			data_val=atoi(ptr);
+			if(data_val>=0 && data_val<=3)
+				clusters[0].states[data_val]++;
+		}
+	}
 
-		data_val=atoi(ptr);
+	if(clusters_count==1)
+		return evaluate_cluster(&clusters[0], TRUE);
+
+	for(i=0;i<clusters_count;i++){
+		state=evaluate_cluster(&clusters[i], FALSE);
+		return_code=max_state(return_code, state);
+		states[state]++;
+	}
+	printf("CLUSTER %s: %d clusters: %d ok, %d warning, %d unknown, %d critical\n",
+		state_text(return_code), clusters_count, states[STATE_OK],
+		states[STATE_WARNING], states[STATE_UNKNOWN], states[STATE_CRITICAL]);
+	for(i=0;i<clusters_count;i++)
+		evaluate_cluster(&clusters[i], TRUE);
+
+	return return_code;
+}
 
-		if(check_type==CHECK_SERVICES){
-			switch(data_val){
-			case 0:
-				total_services_ok++;
-				break;
-			case 1:
-				total_services_warning++;
-				break;
-			case 2:
-				total_services_critical++;
-				break;
-			case 3:
-				total_services_unknown++;
-				break;
-			default:
-				break;
-		        }
-	        }
-		else{
-			switch(data_val){
-			case 0:
-				total_hosts_up++;
-				break;
-			case 1:
-				total_hosts_down++;
-				break;
-			case 2:
-				total_hosts_unreachable++;
-				break;
-			default:
-				break;
-		        }
-	        }
-        }
 
 
-	/* return the status of the cluster */
+/* Returns the status of the cluster, printing it if asked to */
+int evaluate_cluster(cluster *c, int print){
+	int return_code;
+
 	if(check_type==CHECK_SERVICES){
-		return_code=get_status(total_services_warning+total_services_unknown+total_services_critical, thresholds);
-		printf("CLUSTER %s: %s: %d ok, %d warning, %d unknown, %d critical\n",
-			state_text(return_code), (label==NULL)?"Service cluster":label,
-			total_services_ok,total_services_warning,
-			total_services_unknown,total_services_critical);
+		return_code=get_status(c->states[1]+c->states[3]+c->states[2], c->thresholds);
+		if(print)
+			printf("CLUSTER %s: %s: %d ok, %d warning, %d unknown, %d critical\n",
+				state_text(return_code), (c->label==NULL)?"Service cluster":c->label,
+				c->states[0],c->states[1],c->states[3],c->states[2]);
 	}
 	else{
-		return_code=get_status(total_hosts_down+total_hosts_unreachable, thresholds);
-		printf("CLUSTER %s: %s: %d up, %d down, %d unreachable\n",
-			state_text(return_code), (label==NULL)?"Host cluster":label,
-			total_hosts_up,total_hosts_down,total_hosts_unreachable);
+		return_code=get_status(c->states[1]+c->states[2], c->thresholds);
+		if(print)
+			printf("CLUSTER %s: %s: %d up, %d down, %d unreachable\n",
+				state_text(return_code), (c->label==NULL)?"Host cluster":c->label,
+				c->states[0],c->states[1],c->states[2]);
 	}
-
 	return return_code;
 }
 
 
 
+/* A cluster takes the thresholds and label given before it */
+void add_cluster(char *name){
+	cluster *c;
+
+	clusters=realloc(clusters, (clusters_count+1)*sizeof(cluster));
+	if(clusters==NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
+	c=&clusters[clusters_count++];
+	memset(c, 0, sizeof(cluster));
+	c->name=name;
+	c->label=(label!=NULL)?label:name;
+	set_thresholds(&c->thresholds, warn_threshold, crit_threshold);
+	if(verbose)
+		print_thresholds(name?name:"check_cluster", c->thresholds);
+	label=NULL;
+}
+
+static int cmp_cluster(const void *a, const void *b){
+	return strcmp((*(cluster * const *)a)->name, (*(cluster * const *)b)->name);
+}
+
+/* A member line is "[CLUSTER] STATE", fields separated by spaces, tabs or
+ * semicolons (Livestatus); lines of clusters not asked for are skipped */
+static void count_member(char *line, cluster **sorted){
+	char *name, *state, *end;
+	cluster key, *keyp=&key, **c;
+
+	name=line+strspn(line, " \t;");
+	if(*name=='\0' || *name=='#')
+		return;
+	for(end=name+strlen(name); end>name && strchr(" \t;\r", end[-1]); end--)
+		;
+	*end='\0';
+	for(state=end; state>name && !strchr(" \t;", state[-1]); state--)
+		;
+	if(state[0]<'0' || state[0]>'3' || state[1]!='\0'){
+		if(verbose)
+			printf(_("Ignoring line: %s\n"), name);
+		return;
+	}
+
+	if(sorted==NULL){
+		clusters[0].states[state[0]-'0']++;
+		return;
+	}
+	name[strcspn(name, " \t;")]='\0';
+	key.name=name;
+	c=bsearch(&keyp, sorted, clusters_count, sizeof(cluster *), cmp_cluster);
+	if(c!=NULL)
+		(*c)->states[state[0]-'0']++;
+}
+
+/* Reads the member states from a file, standard input ("-") or a socket,
+ * to which the query is sent first, a line at a time */
+void read_feed(void){
+	char buf[MAX_INPUT_BUFFER], *line=NULL, *p, *nl;
+	size_t line_len=0, n;
+	ssize_t len;
+	cluster **sorted=NULL;
+	struct sockaddr_un sun;
+	struct stat st;
+	int fd, i;
+
+	if(strcmp(feed, "-")==0){
+		fd=STDIN_FILENO;
+	}
+	else if(stat(feed, &st)==0 && S_ISSOCK(st.st_mode)){
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family=AF_UNIX;
+		if(strlen(feed)>=sizeof(sun.sun_path))
+			die(STATE_UNKNOWN, _("Socket path is too long: %s\n"), feed);
+		strcpy(sun.sun_path, feed);
+		if((fd=socket(AF_UNIX, SOCK_STREAM, 0))<0 ||
+		   connect(fd, (struct sockaddr *)&sun, sizeof(sun))!=0)
+			die(STATE_UNKNOWN, _("Cannot connect to %s: %s\n"), feed, strerror(errno));
+		if(query!=NULL){
+			if(write(fd, query, strlen(query))!=(ssize_t)strlen(query))
+				die(STATE_UNKNOWN, _("Cannot send the query to %s: %s\n"), feed, strerror(errno));
+		}
+		/* Livestatus answers once the query is complete */
+		shutdown(fd, SHUT_WR);
+	}
+	else if((fd=open(feed, O_RDONLY))<0){
+		die(STATE_UNKNOWN, _("Cannot open %s: %s\n"), feed, strerror(errno));
+	}
+
+	/* clusters looked up by name, through sorted pointers so that the
+	 * output keeps the order of the command line */
+	if(clusters[0].name!=NULL){
+		sorted=malloc(clusters_count*sizeof(cluster *));
+		if(sorted==NULL)
+			die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
+		for(i=0;i<clusters_count;i++)
+			sorted[i]=&clusters[i];
+		qsort(sorted, clusters_count, sizeof(cluster *), cmp_cluster);
+	}
+
+	while((len=read(fd, buf, sizeof(buf)))>0 || (len<0 && errno==EINTR)){
+		for(p=buf; len>0; p=nl+1){
+			nl=memchr(p, '\n', len);
+			n=(nl?nl:p+len)-p;
+			line=realloc(line, line_len+n+1);
+			if(line==NULL)
+				die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
+			memcpy(line+line_len, p, n);
+			line_len+=n;
+			line[line_len]='\0';
+			len-=n+(nl?1:0);
+			if(nl==NULL)
+				break;
+			count_member(line, sorted);
+			line_len=0;
+		}
+	}
+	if(len<0)
+		die(STATE_UNKNOWN, _("Cannot read %s: %s\n"), feed, strerror(errno));
+	if(line_len>0)
+		count_member(line, sorted);
+	free(line);
+	if(fd!=STDIN_FILENO)
+		close(fd);
+
+	free(sorted);
+}
+
+
+
 int process_arguments(int argc, char **argv){
 	int c;
 	char *ptr;
 	int option=0;
 	static struct option longopts[]={
 		{"data",     required_argument,0,'d'},
+		{"file",     required_argument,0,'f'},
+		{"cluster",  required_argument,0,CLUSTER_OPTION},
+		{"query",    required_argument,0,QUERY_OPTION},
 		{"warning",  required_argument,0,'w'},
 		{"critical", required_argument,0,'c'},
 		{"label",    required_argument,0,'l'},
@@ -164,7 +298,7 @@ int process_arguments(int argc, char **argv){
 
 	while(1){
 
-		c=getopt_long(argc,argv,"hHsvVw:c:d:l:",longopts,&option);
+		c=getopt_long(argc,argv,"hHsvVw:c:d:l:f:",longopts,&option);
 
 		if(c==-1 || c==EOF || c==1)
 			break;
@@ -200,6 +334,32 @@ int process_arguments(int argc, char **argv){
 			}
 			break;
 
+		case 'f': /* status feed */
+			feed=optarg;
+			break;
+
+		case CLUSTER_OPTION:
+			add_cluster(optarg);
+			break;
+
+		case QUERY_OPTION:
+			/* \n in the query stands for a new line */
+			query=malloc(strlen(optarg)+2);
+			if(query==NULL)
+				die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
+			for(ptr=query; *optarg; optarg++){
+				if(optarg[0]=='\\' && optarg[1]=='n'){
+					*ptr++='\n';
+					optarg++;
+				}
+				else
+					*ptr++=*optarg;
+			}
+			if(ptr>query && ptr[-1]!='\n')
+				*ptr++='\n';
+			*ptr='\0';
+			break;
+
 		case 'l': /* text label */
 			label=(char *)strdup(optarg);
 			break;
@@ -224,8 +384,10 @@ int process_arguments(int argc, char **argv){
 	        }
 	}
 
-	if(data_vals==NULL)
+	if((data_vals==NULL) == (feed==NULL))
 		return ERROR;
+	if(clusters_count>0 && feed==NULL)
+		usage4(_("--cluster requires --file"));
 
 	return OK;
 }
@@ -260,6 +422,16 @@ print_help(void)
 	printf (" %s\n", "-d, --data=LIST");
 	printf ("    %s\n", _("The status codes of the hosts or services in the cluster, separated by"));
 	printf ("    %s\n", _("commas"));
+	printf (" %s\n", "-f, --file=PATH");
+	printf ("    %s\n", _("Read the status codes from PATH instead, \"-\" for standard input, one"));
+	printf ("    %s\n", _("\"[CLUSTER] CODE\" line per member, the fields separated by spaces, tabs or"));
+	printf ("    %s\n", _("semicolons. PATH can be a socket like the one of Livestatus"));
+	printf (" %s\n", "--query=STRING");
+	printf ("    %s\n", _("Query to send to the socket first, \\n stands for a new line"));
+	printf (" %s\n", "--cluster=NAME");
+	printf ("    %s\n", _("With --file, check the members of cluster NAME, with the thresholds and"));
+	printf ("    %s\n", _("label given before this option. Can be repeated, all clusters are then"));
+	printf ("    %s\n", _("checked in one pass over the feed"));
 
 	printf(UT_VERBOSE);
 
@@ -272,6 +444,9 @@ print_help(void)
 	printf (" %s\n", "check_cluster -s -d 2,0,2,0 -c @3:");
 	printf ("    %s\n", _("Will alert critical if there are 3 or more service data points in a non-OK") );
 	printf ("    %s\n", _("state.") );
+	printf (" %s\n", "check_cluster -s -f /var/lib/cluster.status -w 2 -c 5 --cluster web -c 10 --cluster db");
+	printf ("    %s\n", _("Will check the web and db clusters of the file, db alerting at 10 non-OK") );
+	printf ("    %s\n", _("members.") );
 
 	printf(UT_SUPPORT);
 }
@@ -284,6 +459,8 @@ print_usage(void)
 	printf("%s\n", _("Usage:"));
 	printf(" %s (-s | -h) -d val1[,val2,...,valn] [-l label]\n", progname);
 	printf("[-w threshold] [-c threshold] [-v] [--help]\n");
+	printf(" %s (-s | -h) -f path [--query string] [-w threshold] [-c threshold]\n", progname);
+	printf("[[-l label] --cluster name]... [-v]\n");
 
 }
 
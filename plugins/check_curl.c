@@ -50,10 +50,22 @@ const char *email = "devel@monitoring-plugins.org";
 #include "curl/easy.h"
 
 #include "picohttpparser.h"
+#include "httputils.h"
+#include "utils_match.h"
+#include "utils_json.h"
+#include "utils_openmetrics.h"
+#include "utils_frame.h"
+#include "utils_targets.h"
 
 #include "uriparser/Uri.h"
 
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #define MAKE_LIBCURL_VERSION(major, minor, patch) ((major)*0x10000 + (minor)*0x100 + (patch))
 
@@ -61,6 +73,11 @@ const char *email = "devel@monitoring-plugins.org";
 #define DEFAULT_SERVER_URL "/"
 #define HTTP_EXPECT "HTTP/"
 #define DEFAULT_MAX_REDIRS 15
+#define DEFAULT_BATCH_CONNECTIONS 16
+#define MAX_PAGE_ASSETS 100
+#define MAX_ASSET_CONNECTIONS 6
+#define MAX_THROUGHPUT_CHUNKS 64
+#define MAX_THROUGHPUT_SIZE (1ULL << 30)
 #define INET_ADDR_MAX_SIZE INET6_ADDRSTRLEN
 enum {
   MAX_IPV4_HOSTLENGTH = 255,
@@ -87,13 +104,19 @@ typedef struct {
   size_t bufsize;
 } curlhelp_write_curlbuf;
 
-/* for buffering the data sent in PUT */
+/* for buffering the data sent in PUT, or mapping the file of --post-file
+ * and --put-file */
 typedef struct {
   char *buf;
   size_t buflen;
   off_t pos;
+  int mapped;
+  off_t released;       /* pages before this were sent and let go */
 } curlhelp_read_curlbuf;
 
+/* how much of a mapped body is sent before its pages are let go */
+#define READ_RELEASE_SIZE (1024 * 1024)
+
 /* for parsing the HTTP status line */
 typedef struct {
   int http_major;   /* major version of the protocol, always 1 (HTTP/0.9
@@ -106,6 +129,32 @@ typedef struct {
   char *first_line; /* a copy of the first line */
 } curlhelp_statusline;
 
+/* for matching the body while it arrives (--stream-body), a window holds
+ * the tail of the previous chunk followed by the current one */
+typedef struct {
+  char *window;
+  size_t windowsize;
+  size_t carry;     /* bytes of the previous chunk at the start of window */
+  size_t total;     /* bytes of body seen so far */
+  int regex_found;
+  int aborted;      /* transfer stopped early, the verdict was already known */
+} curlhelp_stream_state;
+
+/* one URL of a --batch run */
+typedef struct {
+  char *url;
+  CURL *handle;
+  curlhelp_write_curlbuf body_buf;
+  curlhelp_write_curlbuf header_buf;
+  char errbuf[CURL_ERROR_SIZE+1];
+  CURLcode res;
+  int done;
+  int result;
+  double total_time;
+  int page_len;
+  char msg[DEFAULT_BUFFER_SIZE];
+} curlhelp_batch_entry;
+
 /* to know the underlying SSL library used by libcurl */
 typedef enum curlhelp_ssl_library {
   CURLHELP_SSL_LIBRARY_UNKNOWN,
@@ -119,8 +168,8 @@ enum {
   REGS = 2,
   MAX_RE_SIZE = 256
 };
-#include "regex.h"
-regex_t preg;
+#include "utils_regex.h"
+np_regex_t preg;
 regmatch_t pmatch[REGS];
 char regexp[MAX_RE_SIZE];
 int cflags = REG_NOSUB | REG_EXTENDED | REG_NEWLINE;
@@ -151,12 +200,17 @@ int redir_depth = 0;
 int max_depth = DEFAULT_MAX_REDIRS;
 char *http_method = NULL;
 char *http_post_data = NULL;
+char *http_body_file = NULL;
 char *http_content_type = NULL;
 CURL *curl;
 struct curl_slist *header_list = NULL;
 curlhelp_write_curlbuf body_buf;
+curlhelp_stream_state body_stream;
+int stream_body = FALSE;
+int compressed = FALSE;
 curlhelp_write_curlbuf header_buf;
 curlhelp_statusline status_line;
+http_response response_headers;
 curlhelp_read_curlbuf put_buf;
 char http_header[DEFAULT_BUFFER_SIZE];
 long code;
@@ -172,7 +226,32 @@ char url[DEFAULT_BUFFER_SIZE];
 char msg[DEFAULT_BUFFER_SIZE];
 char perfstring[DEFAULT_BUFFER_SIZE];
 char header_expect[MAX_INPUT_BUFFER] = "";
-char string_expect[MAX_INPUT_BUFFER] = "";
+char **string_expect = NULL;
+int string_expect_count = 0;
+np_matcher *string_matcher = NULL;
+/* --json: PATH alone must be there, PATH=VALUE must equal it,
+ * PATH,WARN,CRIT must be a number within the thresholds */
+typedef struct json_assertion {
+  char *path;
+  char *expect;
+  char *warn;
+  char *crit;
+  thresholds *thlds;
+} json_assertion;
+json_assertion *json_assert = NULL;
+int json_assert_count = 0;
+np_json *json_parser = NULL;
+/* --metric: SELECTOR must match a sample of the exposition,
+ * SELECTOR,WARN,CRIT every sample it matches must be within the thresholds */
+typedef struct metric_assertion {
+  char *selector;
+  char *warn;
+  char *crit;
+  thresholds *thlds;
+} metric_assertion;
+metric_assertion *metric_assert = NULL;
+int metric_assert_count = 0;
+np_openmetrics *metrics_parser = NULL;
 char server_expect[MAX_INPUT_BUFFER] = HTTP_EXPECT;
 int server_expect_yn = 0;
 char user_auth[MAX_INPUT_BUFFER] = "";
@@ -196,6 +275,10 @@ char *client_cert = NULL;
 char *client_privkey = NULL;
 char *ca_cert = NULL;
 int is_openssl_callback = FALSE;
+int cert_cache_ttl = 0;
+int check_ocsp = FALSE;
+int ocsp_result = STATE_UNKNOWN;
+char *ocsp_message = NULL;
 #if defined(HAVE_SSL) && defined(USE_OPENSSL)
 X509 *cert = NULL;
 #endif /* defined(HAVE_SSL) && defined(USE_OPENSSL) */
@@ -204,25 +287,70 @@ int maximum_age = -1;
 int address_family = AF_UNSPEC;
 curlhelp_ssl_library ssl_library = CURLHELP_SSL_LIBRARY_UNKNOWN;
 int curl_http_version = CURL_HTTP_VERSION_NONE;
+char *batch_file = NULL;
+long batch_connections = DEFAULT_BATCH_CONNECTIONS;
+char *batch_frames = NULL;
+int batch_sharded = FALSE;
+int dual_stack = FALSE;
+/* --backends: every server behind the name, or those of the list */
+int backends = FALSE;
+char *backends_list = NULL;
+int http3 = FALSE;
+int ssl_session_cache = FALSE;
+/* --assets: what is judged of the page and the assets it links to */
+enum {
+  ASSETS_BYTES,
+  ASSETS_REQUESTS,
+  ASSETS_CRITICAL_PATH,
+  ASSETS_SLOWEST,
+  ASSETS_FIELDS
+};
+int page_assets = FALSE;
+char *assets_warning = NULL;
+char *assets_critical = NULL;
+thresholds *assets_thlds[ASSETS_FIELDS];
+CURLM *assets_multi = NULL;
+/* --throughput: chunks of this many bytes, all asked for at once */
+unsigned long long throughput_size = 0;
+int throughput_chunks = 1;
+char *throughput_warning = NULL;
+char *throughput_critical = NULL;
+thresholds *throughput_thlds;
 
 int process_arguments (int, char**);
 void handle_curl_option_return_code (CURLcode res, const char* option);
 int check_http (void);
-void redir (curlhelp_write_curlbuf*);
+int check_http_batch (void);
+int check_http_dual_stack (void);
+int check_http_backends (void);
+int check_http_throughput (void);
+void redir (const http_response *);
+CURLcode assets_perform_page (CURL *);
+int check_assets (int page_len, char (*msg)[DEFAULT_BUFFER_SIZE]);
 char *perfd_time (double microsec);
 char *perfd_time_connect (double microsec);
 char *perfd_time_ssl (double microsec);
 char *perfd_time_firstbyte (double microsec);
 char *perfd_time_headers (double microsec);
 char *perfd_time_transfer (double microsec);
+char *perfd_time_quic (double microsec);
 char *perfd_size (int page_len);
+char *perfd_size_wire (double wire_len);
 void print_help (void);
 void print_usage (void);
 void print_curl_version (void);
 int curlhelp_initwritebuffer (curlhelp_write_curlbuf*);
 int curlhelp_buffer_write_callback (void*, size_t , size_t , void*);
+int curlhelp_count_write_callback (void*, size_t , size_t , void*);
+int curlhelp_range_write_callback (void*, size_t , size_t , void*);
 void curlhelp_freewritebuffer (curlhelp_write_curlbuf*);
+void curlhelp_initstreamstate (curlhelp_stream_state*);
+int curlhelp_stream_write_callback (void*, size_t , size_t , void*);
+void curlhelp_freestreamstate (curlhelp_stream_state*);
+void curlhelp_accept_encoding (CURL*);
+double curlhelp_wire_size (CURL*);
 int curlhelp_initreadbuffer (curlhelp_read_curlbuf *, const char *, size_t);
+int curlhelp_mapreadbuffer (curlhelp_read_curlbuf *, const char *);
 int curlhelp_buffer_read_callback (void *, size_t , size_t , void *);
 void curlhelp_freereadbuffer (curlhelp_read_curlbuf *);
 curlhelp_ssl_library curlhelp_get_ssl_library (CURL*);
@@ -231,14 +359,25 @@ int net_noopenssl_check_certificate (cert_ptr_union*, int, int);
 
 int curlhelp_parse_statusline (const char*, curlhelp_statusline *);
 void curlhelp_free_statusline (curlhelp_statusline *);
-char *get_header_value (const struct phr_header* headers, const size_t nof_headers, const char* header);
-int check_document_dates (const curlhelp_write_curlbuf *, char (*msg)[DEFAULT_BUFFER_SIZE]);
-int get_content_length (const curlhelp_write_curlbuf* header_buf, const curlhelp_write_curlbuf* body_buf);
+int check_document_dates (const http_response *, char (*msg)[DEFAULT_BUFFER_SIZE]);
+void missing_strings (char *, size_t);
+void parse_json_assertion (json_assertion *, char *);
+int check_json (char (*msg)[DEFAULT_BUFFER_SIZE]);
+void parse_metric_assertion (metric_assertion *, char *);
+int check_metrics (char (*msg)[DEFAULT_BUFFER_SIZE]);
+int get_content_length (const http_response *, const curlhelp_write_curlbuf* header_buf, const curlhelp_write_curlbuf* body_buf);
 
 #if defined(HAVE_SSL) && defined(USE_OPENSSL)
 int np_net_ssl_check_certificate(X509 *certificate, int days_till_exp_warn, int days_till_exp_crit);
+void np_net_ssl_cert_cache(int ttl);
+void np_net_ssl_ocsp_stapling(void);
+int np_net_ssl_handshake_ocsp(SSL *ssl, char **message);
+int np_net_ssl_offload(const char *name);
 #endif /* defined(HAVE_SSL) && defined(USE_OPENSSL) */
 
+void session_cache_load (CURL *);
+void session_cache_save (CURL *);
+
 void remove_newlines (char *);
 void test_file (char *);
 
@@ -247,9 +386,7 @@ main (int argc, char **argv)
 {
   int result = STATE_UNKNOWN;
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  np_locale_init ();
 
   /* Parse extra opts if any */
   argv = np_extra_opts (&argc, argv, progname);
@@ -262,6 +399,24 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  if (cert_cache_ttl > 0 || ssl_session_cache || check_ocsp)
+    np_init ((char *) progname, argc, argv);
+#if defined(HAVE_SSL) && defined(USE_OPENSSL)
+  if (cert_cache_ttl > 0)
+    np_net_ssl_cert_cache (cert_cache_ttl);
+  if (check_ocsp)
+    np_net_ssl_ocsp_stapling ();
+#endif /* defined(HAVE_SSL) && defined(USE_OPENSSL) */
+
+  if (batch_file)
+    return check_http_batch ();
+  if (dual_stack)
+    return check_http_dual_stack ();
+  if (backends)
+    return check_http_backends ();
+  if (throughput_size)
+    return check_http_throughput ();
+
   if (display_html == TRUE)
     printf ("<A HREF=\"%s://%s:%d%s\" target=\"_blank\">",
       use_ssl ? "https" : "http",
@@ -286,9 +441,23 @@ int verify_callback(int preverify_ok, X509_STORE_CTX *x509_ctx)
   return 1;
 }
 
+/* The stapled OCSP response is only there while the handshake runs, so it
+ * is judged right when OpenSSL has it, and the handshake goes on */
+int ocsp_status_callback(SSL *ssl, void *arg)
+{
+  free (ocsp_message);
+  ocsp_result = np_net_ssl_handshake_ocsp (ssl, &ocsp_message);
+  return 1;
+}
+
 CURLcode sslctxfun(CURL *curl, SSL_CTX *sslctx, void *parm)
 {
-  SSL_CTX_set_verify(sslctx, SSL_VERIFY_PEER, verify_callback);
+  if (check_cert)
+    SSL_CTX_set_verify(sslctx, SSL_VERIFY_PEER, verify_callback);
+  if (check_ocsp) {
+    SSL_CTX_set_tlsext_status_type(sslctx, TLSEXT_STATUSTYPE_ocsp);
+    SSL_CTX_set_tlsext_status_cb(sslctx, ocsp_status_callback);
+  }
 
   return CURLE_OK;
 }
@@ -347,11 +516,22 @@ check_http (void)
   /* print everything on stdout like check_http would do */
   handle_curl_option_return_code (curl_easy_setopt(curl, CURLOPT_STDERR, stdout), "CURLOPT_STDERR");
 
-  /* initialize buffer for body of the answer */
+  /* initialize buffer for body of the answer, an empty one is kept when
+   * streaming so the checks below can treat both cases alike */
   if (curlhelp_initwritebuffer(&body_buf) < 0)
     die (STATE_UNKNOWN, "HTTP CRITICAL - out of memory allocating buffer for body\n");
-  handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, (curl_write_callback)curlhelp_buffer_write_callback), "CURLOPT_WRITEFUNCTION");
-  handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *)&body_buf), "CURLOPT_WRITEDATA");
+  if (stream_body) {
+    curlhelp_initstreamstate (&body_stream);
+    handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, (curl_write_callback)curlhelp_stream_write_callback), "CURLOPT_WRITEFUNCTION");
+    handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *)&body_stream), "CURLOPT_WRITEDATA");
+  } else {
+    handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, (curl_write_callback)curlhelp_buffer_write_callback), "CURLOPT_WRITEFUNCTION");
+    handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_WRITEDATA, (void *)&body_buf), "CURLOPT_WRITEDATA");
+  }
+
+  /* libcurl decodes the body before the write callbacks see it */
+  if (compressed)
+    curlhelp_accept_encoding (curl);
 
   /* initialize buffer for header of the answer */
   if (curlhelp_initwritebuffer( &header_buf ) < 0)
@@ -436,9 +616,12 @@ check_http (void)
     header_list = curl_slist_append (header_list, http_header);
   }
 
-  /* always close connection, be nice to servers */
-  snprintf (http_header, DEFAULT_BUFFER_SIZE, "Connection: close");
-  header_list = curl_slist_append (header_list, http_header);
+  /* always close connection, be nice to servers, unless the assets of the
+   * page are to come over it */
+  if (!page_assets) {
+    snprintf (http_header, DEFAULT_BUFFER_SIZE, "Connection: close");
+    header_list = curl_slist_append (header_list, http_header);
+  }
 
   /* attach additional headers supplied by the user */
   /* optionally send any other header tag */
@@ -486,6 +669,8 @@ check_http (void)
 
   /* try hard to get a stack of certificates to verify against */
   if (check_cert) {
+    /* the URL is not checked, the handshake is all we need */
+    handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_CONNECT_ONLY, 1L), "CURLOPT_CONNECT_ONLY");
 #if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 19, 1)
     /* inform curl to report back certificates */
     switch (ssl_library) {
@@ -536,8 +721,28 @@ check_http (void)
 #endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 19, 1) */
   }
 
+  /* the stapled OCSP response can only be had from OpenSSL itself */
+  if (check_ocsp) {
+#ifdef USE_OPENSSL
+    if (ssl_library != CURLHELP_SSL_LIBRARY_OPENSSL && ssl_library != CURLHELP_SSL_LIBRARY_LIBRESSL)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - Cannot check OCSP responses (libcurl linked with SSL library '%s')\n", curlhelp_get_ssl_library_string (ssl_library));
+    handle_curl_option_return_code (curl_easy_setopt(curl, CURLOPT_SSL_CTX_FUNCTION, sslctxfun), "CURLOPT_SSL_CTX_FUNCTION");
+#else /* USE_OPENSSL */
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - Cannot check OCSP responses (not linked against OpenSSL)\n");
+#endif /* USE_OPENSSL */
+  }
+
 #endif /* LIBCURL_FEATURE_SSL */
 
+  /* offer the sessions of the last run, early data only where a replay is harmless */
+  if (ssl_session_cache) {
+    session_cache_load (curl);
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 11, 0)
+    if (!strcmp (http_method, "GET") || !strcmp (http_method, "HEAD"))
+      handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_SSL_OPTIONS, (long)CURLSSLOPT_EARLYDATA), "CURLOPT_SSL_OPTIONS");
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 11, 0) */
+  }
+
   /* set default or user-given user agent identification */
   handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_USERAGENT, user_agent), "CURLOPT_USERAGENT");
 
@@ -614,9 +819,21 @@ check_http (void)
     }
     /* NULL indicates "HTTP Continue" in libcurl, provide an empty string
      * in case of no POST/PUT data */
-    if (!http_post_data)
+    if (!http_post_data && !http_body_file)
       http_post_data = "";
-    if (!strcmp(http_method, "POST")) {
+    if (http_body_file) {
+      /* the file is mapped and given to libcurl as it asks for more */
+      if (curlhelp_mapreadbuffer (&put_buf, http_body_file) < 0)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot read %s: %s\n"), http_body_file, strerror (errno));
+      handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_READFUNCTION, (curl_read_callback)curlhelp_buffer_read_callback), "CURLOPT_READFUNCTION");
+      handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_READDATA, (void *)&put_buf), "CURLOPT_READDATA");
+      if (!strcmp(http_method, "POST"))
+        handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)put_buf.buflen), "CURLOPT_POSTFIELDSIZE_LARGE");
+      else
+        handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)put_buf.buflen), "CURLOPT_INFILESIZE_LARGE");
+      if (verbose >= 1)
+        printf ("* sending the %lu bytes of %s\n", (unsigned long)put_buf.buflen, http_body_file);
+    } else if (!strcmp(http_method, "POST")) {
       /* POST method, set payload with CURLOPT_POSTFIELDS */
       handle_curl_option_return_code (curl_easy_setopt (curl, CURLOPT_POSTFIELDS, http_post_data), "CURLOPT_POSTFIELDS");
     } else if (!strcmp(http_method, "PUT")) {
@@ -628,7 +845,17 @@ check_http (void)
   }
 
   /* do the request */
-  res = curl_easy_perform(curl);
+  if (page_assets)
+    res = assets_perform_page (curl);
+  else
+    res = curl_easy_perform(curl);
+
+  /* the stream callback stopping the transfer is not an error */
+  if (res == CURLE_WRITE_ERROR && stream_body && body_stream.aborted) {
+    res = CURLE_OK;
+    if (verbose >= 1)
+      printf ("* transfer stopped after %lu bytes of body, result already known\n", (unsigned long)body_stream.total);
+  }
 
   if (verbose>=2 && http_post_data)
     printf ("**** REQUEST CONTENT ****\n%s\n", http_post_data);
@@ -644,6 +871,18 @@ check_http (void)
     die (STATE_CRITICAL, "HTTP CRITICAL - %s\n", msg);
   }
 
+  if (ssl_session_cache)
+    session_cache_save (curl);
+
+  /* a resumed session brings no OCSP response, and the callback never ran */
+  if (check_ocsp) {
+    if (verbose >= 1 && ocsp_message)
+      printf ("* %s\n", ocsp_message);
+    if (ocsp_result != STATE_OK)
+      die (ocsp_result, "HTTP %s - %s\n", state_text (ocsp_result),
+           ocsp_message ? ocsp_message : _("No OCSP response seen in the handshake."));
+  }
+
   /* certificate checks */
 #ifdef LIBCURL_FEATURE_SSL
   if (use_ssl == TRUE) {
@@ -716,7 +955,13 @@ GOT_FIRST_CERT:
    * performance data to the answer always
    */
   handle_curl_option_return_code (curl_easy_getinfo (curl, CURLINFO_TOTAL_TIME, &total_time), "CURLINFO_TOTAL_TIME");
-  page_len = get_content_length(&header_buf, &body_buf);
+  /* parse the headers once, for all the lookups below */
+  http_response_init (&response_headers);
+  http_response_parse (&response_headers, header_buf.buf, header_buf.buflen);
+  if (stream_body)
+    page_len = header_buf.buflen + body_stream.total;
+  else
+    page_len = get_content_length(&response_headers, &header_buf, &body_buf);
   if(show_extended_perfdata) {
     handle_curl_option_return_code (curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &time_connect), "CURLINFO_CONNECT_TIME");
     handle_curl_option_return_code (curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &time_appconnect), "CURLINFO_APPCONNECT_TIME");
@@ -737,6 +982,37 @@ GOT_FIRST_CERT:
       perfd_size(page_len)
     );
   }
+  if (compressed) {
+    size_t perflen = strlen (perfstring);
+    double wire_len = header_buf.buflen + curlhelp_wire_size (curl);
+    if (verbose >= 1)
+      printf ("* %d bytes decoded from %.0f bytes transferred\n", page_len, wire_len);
+    snprintf(perfstring + perflen, DEFAULT_BUFFER_SIZE - perflen, " %s", perfd_size_wire (wire_len));
+  }
+  if (http3) {
+    /* the QUIC handshake carries the TLS one, time_connect and time_ssl
+     * end together and only tell it from the start of the check */
+    double time_namelookup = 0;
+    size_t perflen = strlen (perfstring);
+    handle_curl_option_return_code (curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &time_namelookup), "CURLINFO_NAMELOOKUP_TIME");
+    handle_curl_option_return_code (curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &time_appconnect), "CURLINFO_APPCONNECT_TIME");
+    handle_curl_option_return_code (curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME, &time_headers), "CURLINFO_PRETRANSFER_TIME");
+    handle_curl_option_return_code (curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &time_firstbyte), "CURLINFO_STARTTRANSFER_TIME");
+    snprintf(perfstring + perflen, DEFAULT_BUFFER_SIZE - perflen, " %s%s%s",
+      perfd_time_quic(time_appconnect - time_namelookup),
+      show_extended_perfdata ? "" : " ",
+      show_extended_perfdata ? "" : perfd_time_firstbyte(time_firstbyte - time_headers));
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 11, 0)
+    if (ssl_session_cache) {
+      /* the request went out with the handshake when this is not 0 */
+      curl_off_t early_data = 0;
+      handle_curl_option_return_code (curl_easy_getinfo(curl, CURLINFO_EARLYDATA_SENT_T, &early_data), "CURLINFO_EARLYDATA_SENT_T");
+      perflen = strlen (perfstring);
+      snprintf(perfstring + perflen, DEFAULT_BUFFER_SIZE - perflen, " %s",
+        perfdata ("early_data", (long)early_data, "B", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    }
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 11, 0) */
+  }
 
   /* return a CRITICAL status if we couldn't read any data */
   if (strlen(header_buf.buf) == 0 && strlen(body_buf.buf) == 0)
@@ -757,7 +1033,7 @@ GOT_FIRST_CERT:
   /* print status line, header, body if verbose */
   if (verbose >= 2) {
     printf ("**** HEADER ****\n%s\n**** CONTENT ****\n%s\n", header_buf.buf,
-                (no_body ? "  [[ skipped ]]" : body_buf.buf));
+                (no_body ? "  [[ skipped ]]" : stream_body ? "  [[ streamed ]]" : body_buf.buf));
   }
 
   /* make sure the status line matches the response we are looking for */
@@ -795,7 +1071,7 @@ GOT_FIRST_CERT:
            * back here, we are in the same status as with
            * the libcurl method
            */
-          redir (&header_buf);
+          redir (&response_headers);
         }
       } else {
         /* this is a specific code in the command line to
@@ -829,7 +1105,7 @@ GOT_FIRST_CERT:
   }
 
   if (maximum_age >= 0) {
-    result = max_state_alt(check_document_dates(&header_buf, &msg), result);
+    result = max_state_alt(check_document_dates(&response_headers, &msg), result);
   }
 
   /* Page and Header content checks go here */
@@ -845,19 +1121,25 @@ GOT_FIRST_CERT:
     }
   }
 
-  if (strlen (string_expect)) {
-    if (!strstr (body_buf.buf, string_expect)) {
-      strncpy(&output_string_search[0],string_expect,sizeof(output_string_search));
-      if(output_string_search[sizeof(output_string_search)-1]!='\0') {
-        bcopy("...",&output_string_search[sizeof(output_string_search)-4],4);
-      }
-      snprintf (msg, DEFAULT_BUFFER_SIZE, _("%sstring '%s' not found on '%s://%s:%d%s', "), msg, output_string_search, use_ssl ? "https" : "http", host_name ? host_name : server_address, server_port, server_url);
+  if (string_expect_count) {
+    /* with --stream-body the strings were looked for while the body arrived */
+    if (!stream_body) {
+      np_matcher_reset (string_matcher);
+      np_matcher_feed (string_matcher, body_buf.buf, body_buf.buflen);
+    }
+    if (string_matcher->found_count < string_expect_count) {
+      char missing[DEFAULT_BUFFER_SIZE];
+      missing_strings (missing, sizeof (missing));
+      snprintf (msg, DEFAULT_BUFFER_SIZE, _("%sstring '%s' not found on '%s://%s:%d%s', "), msg, missing, use_ssl ? "https" : "http", host_name ? host_name : server_address, server_port, server_url);
       result = STATE_CRITICAL;
     }
   }
 
   if (strlen (regexp)) {
-    errcode = regexec (&preg, body_buf.buf, REGS, pmatch, 0);
+    if (stream_body)
+      errcode = body_stream.regex_found ? 0 : REG_NOMATCH;
+    else
+      errcode = np_regexec (&preg, body_buf.buf, REGS, pmatch, 0);
     if ((errcode == 0 && invert_regex == 0) || (errcode == REG_NOMATCH && invert_regex == 1)) {
       /* OK - No-op to avoid changing the logic around it */
       result = max_state_alt(STATE_OK, result);
@@ -870,12 +1152,26 @@ GOT_FIRST_CERT:
       result = STATE_CRITICAL;
     }
     else {
-      regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+      np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
       snprintf (msg, DEFAULT_BUFFER_SIZE, _("%sExecute Error: %s, "), msg, errbuf);
       result = STATE_UNKNOWN;
     }
   }
 
+  if (json_parser) {
+    /* a number ending the document is only complete with the document */
+    if (!body_stream.aborted)
+      np_json_end (json_parser);
+    result = max_state_alt (check_json (&msg), result);
+  }
+
+  if (metrics_parser) {
+    /* so is a last sample line without a newline */
+    if (!body_stream.aborted)
+      np_openmetrics_end (metrics_parser);
+    result = max_state_alt (check_metrics (&msg), result);
+  }
+
   /* make sure the page is of an appropriate size */
   if ((max_page_len > 0) && (page_len > max_page_len)) {
     snprintf (msg, DEFAULT_BUFFER_SIZE, _("%spage size %d too large, "), msg, page_len);
@@ -888,6 +1184,10 @@ GOT_FIRST_CERT:
   /* -w, -c: check warning and critical level */
   result = max_state_alt(get_status(total_time, thlds), result);
 
+  /* --assets: fetch what the page links to, as a browser would */
+  if (page_assets)
+    result = max_state_alt(check_assets(page_len, &msg), result);
+
   /* Cut-off trailing characters */
   if(msg[strlen(msg)-2] == ',')
     msg[strlen(msg)-2] = '\0';
@@ -909,50 +1209,1361 @@ GOT_FIRST_CERT:
   curl_global_cleanup ();
   curlhelp_freewritebuffer (&body_buf);
   curlhelp_freewritebuffer (&header_buf);
-  if (!strcmp (http_method, "PUT")) {
+  if (stream_body)
+    curlhelp_freestreamstate (&body_stream);
+  if (!strcmp (http_method, "PUT") || http_body_file) {
     curlhelp_freereadbuffer (&put_buf);
   }
 
-  return result;
-}
+  return result;
+}
+
+/* --batch: one URL per line, blank lines and lines starting with '#' are
+ * skipped, and so are those of other shards with --shard */
+static curlhelp_batch_entry *
+batch_read_urls (const char *filename, size_t *count)
+{
+  np_targets *list;
+  char *p;
+  curlhelp_batch_entry *entries = NULL;
+  size_t size = 0;
+
+  *count = 0;
+  if ((list = np_targets_open (filename)) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot open URL list %s: %s\n"), filename, strerror (errno));
+
+  while ((p = np_targets_next (list)) != NULL) {
+    if (*count == size) {
+      size = size ? size * 2 : 16;
+      entries = realloc (entries, size * sizeof (curlhelp_batch_entry));
+      if (entries == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+    }
+    memset (&entries[*count], 0, sizeof (curlhelp_batch_entry));
+    entries[*count].url = strdup (p);
+    entries[*count].result = STATE_UNKNOWN;
+    (*count)++;
+  }
+
+  if (list->lines == 0)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - No URLs found in %s\n"), filename);
+  np_targets_close (list);
+
+  return entries;
+}
+
+/* the per-URL part of check_http (): options that make sense for a full URL
+ * are applied to every handle, everything else is rejected in process_arguments */
+static void
+batch_setup_handle (curlhelp_batch_entry *e, CURLSH *share, struct curl_slist *headers)
+{
+  CURL *h;
+
+  if ((h = e->handle = curl_easy_init ()) == NULL)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_easy_init failed\n");
+
+  if (verbose >= 1)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_VERBOSE, 1L), "CURLOPT_VERBOSE");
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_STDERR, stdout), "CURLOPT_STDERR");
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_PRIVATE, (void *)e), "CURLOPT_PRIVATE");
+
+  if (curlhelp_initwritebuffer (&e->body_buf) < 0 || curlhelp_initwritebuffer (&e->header_buf) < 0)
+    die (STATE_UNKNOWN, "HTTP CRITICAL - out of memory allocating buffers for answer\n");
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_WRITEFUNCTION, (curl_write_callback)curlhelp_buffer_write_callback), "CURLOPT_WRITEFUNCTION");
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_WRITEDATA, (void *)&e->body_buf), "CURLOPT_WRITEDATA");
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_HEADERFUNCTION, (curl_write_callback)curlhelp_buffer_write_callback), "CURLOPT_HEADERFUNCTION");
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_WRITEHEADER, (void *)&e->header_buf), "CURLOPT_WRITEHEADER");
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_ERRORBUFFER, e->errbuf), "CURLOPT_ERRORBUFFER");
+
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_CONNECTTIMEOUT, socket_timeout), "CURLOPT_CONNECTTIMEOUT");
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_TIMEOUT, socket_timeout), "CURLOPT_TIMEOUT");
+
+  if (verbose >= 1)
+    printf ("* curl CURLOPT_URL: %s\n", e->url);
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_URL, e->url), "CURLOPT_URL");
+
+  /* DNS and TLS sessions come from the share, connections from the multi handle's cache */
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_SHARE, share), "CURLOPT_SHARE");
+
+  /* prefer HTTP/2 over TLS unless a version was given, and rather wait for a
+   * connection that can be multiplexed than open a new one to the same origin */
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 47, 0)
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_HTTP_VERSION,
+    curl_http_version != CURL_HTTP_VERSION_NONE ? (long)curl_http_version : (long)CURL_HTTP_VERSION_2TLS), "CURLOPT_HTTP_VERSION");
+#else
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_HTTP_VERSION, (long)curl_http_version), "CURLOPT_HTTP_VERSION");
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 47, 0) */
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0)
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_PIPEWAIT, 1L), "CURLOPT_PIPEWAIT");
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0) */
+
+  if (!strcmp (http_method, "POST"))
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_POSTFIELDS, http_post_data ? http_post_data : ""), "CURLOPT_POSTFIELDS");
+  else if (strcmp (http_method, "GET") && strcmp (http_method, "HEAD"))
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_CUSTOMREQUEST, http_method), "CURLOPT_CUSTOMREQUEST");
+  if (no_body)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_NOBODY, 1L), "CURLOPT_NOBODY");
+  if (compressed)
+    curlhelp_accept_encoding (h);
+
+  if (headers)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_HTTPHEADER, headers), "CURLOPT_HTTPHEADER");
+
+#ifdef LIBCURL_FEATURE_SSL
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_SSLVERSION, (long)ssl_version), "CURLOPT_SSLVERSION");
+  if (client_cert)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_SSLCERT, client_cert), "CURLOPT_SSLCERT");
+  if (client_privkey)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_SSLKEY, client_privkey), "CURLOPT_SSLKEY");
+  if (ca_cert) {
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_CAINFO, ca_cert), "CURLOPT_CAINFO");
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_SSL_VERIFYPEER, 1L), "CURLOPT_SSL_VERIFYPEER");
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_SSL_VERIFYHOST, 2L), "CURLOPT_SSL_VERIFYHOST");
+  } else {
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_SSL_VERIFYPEER, 0L), "CURLOPT_SSL_VERIFYPEER");
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_SSL_VERIFYHOST, 0L), "CURLOPT_SSL_VERIFYHOST");
+  }
+#endif /* LIBCURL_FEATURE_SSL */
+
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_USERAGENT, user_agent), "CURLOPT_USERAGENT");
+  if (strcmp (proxy_auth, ""))
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_PROXYUSERPWD, proxy_auth), "CURLOPT_PROXYUSERPWD");
+  if (strcmp (user_auth, ""))
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_USERPWD, user_auth), "CURLOPT_USERPWD");
+
+  /* every flavour of -f follow is handled by libcurl in batch mode */
+  if (onredirect == STATE_DEPENDENT) {
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_FOLLOWLOCATION, 1L), "CURLOPT_FOLLOWLOCATION");
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_MAXREDIRS, (long)max_depth), "CURLOPT_MAXREDIRS");
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 85, 0)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_REDIR_PROTOCOLS_STR, "http,https"), "CURLOPT_REDIR_PROTOCOLS_STR");
+#elif LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 19, 4)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_REDIR_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS), "CURLOPT_REDIRECT_PROTOCOLS");
+#endif
+  }
+
+  if (address_family == AF_INET)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4), "CURLOPT_IPRESOLVE(CURL_IPRESOLVE_V4)");
+#if defined (USE_IPV6) && defined (LIBCURL_FEATURE_IPV6)
+  else if (address_family == AF_INET6)
+    handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6), "CURLOPT_IPRESOLVE(CURL_IPRESOLVE_V6)");
+#endif
+}
+
+/* the verdict part of check_http (), storing the state and message in the entry */
+static void
+batch_judge (curlhelp_batch_entry *e)
+{
+  curlhelp_statusline sl;
+  http_response headers;
+  long http_code = 0;
+  int result = STATE_OK;
+  size_t len;
+  char details[DEFAULT_BUFFER_SIZE] = "";
+
+  curl_easy_getinfo (e->handle, CURLINFO_TOTAL_TIME, &e->total_time);
+  http_response_init (&headers);
+  http_response_parse (&headers, e->header_buf.buf, e->header_buf.buflen);
+  e->page_len = get_content_length (&headers, &e->header_buf, &e->body_buf);
+
+  if (verbose >= 2)
+    printf ("**** %s HEADER ****\n%s\n**** CONTENT ****\n%s\n", e->url, e->header_buf.buf,
+      (no_body ? "  [[ skipped ]]" : e->body_buf.buf));
+
+  if (e->res == CURLE_TOO_MANY_REDIRECTS) {
+    snprintf (e->msg, DEFAULT_BUFFER_SIZE, _("maximum redirection depth %d exceeded in libcurl"), max_depth);
+    e->result = STATE_WARNING;
+    return;
+  }
+  if (e->res != CURLE_OK) {
+    snprintf (e->msg, DEFAULT_BUFFER_SIZE, _("cURL returned %d - %s"),
+      e->res, e->errbuf[0] ? e->errbuf : curl_easy_strerror (e->res));
+    e->result = STATE_CRITICAL;
+    return;
+  }
+
+  if (curlhelp_parse_statusline (e->header_buf.buf, &sl) < 0) {
+    snprintf (e->msg, DEFAULT_BUFFER_SIZE, _("Unparsable status line in %.3g seconds response time"), e->total_time);
+    e->result = STATE_CRITICAL;
+    return;
+  }
+  curl_easy_getinfo (e->handle, CURLINFO_RESPONSE_CODE, &http_code);
+
+  if (!expected_statuscode (sl.first_line, server_expect)) {
+    snprintf (e->msg, DEFAULT_BUFFER_SIZE, _("Invalid HTTP response received from host: %s"), sl.first_line);
+    e->result = STATE_CRITICAL;
+    curlhelp_free_statusline (&sl);
+    return;
+  }
+
+  if (!server_expect_yn) {
+    if (http_code >= 600 || http_code < 100) {
+      snprintf (e->msg, DEFAULT_BUFFER_SIZE, _("Invalid Status (%d, %.40s)"), sl.http_code, sl.msg);
+      e->result = STATE_CRITICAL;
+      curlhelp_free_statusline (&sl);
+      return;
+    } else if (http_code >= 500)
+      result = STATE_CRITICAL;
+    else if (http_code >= 400)
+      result = STATE_WARNING;
+    else if (http_code >= 300)
+      result = max_state_alt (onredirect, result);
+  }
+
+  if (maximum_age >= 0)
+    result = max_state_alt (check_document_dates (&headers, &details), result);
+
+  if (strlen (header_expect) && !strstr (e->header_buf.buf, header_expect)) {
+    snprintf (details + strlen (details), DEFAULT_BUFFER_SIZE - strlen (details), _("header '%.30s' not found, "), header_expect);
+    result = STATE_CRITICAL;
+  }
+
+  if (string_expect_count) {
+    np_matcher_reset (string_matcher);
+    if (np_matcher_feed (string_matcher, e->body_buf.buf, e->body_buf.buflen) < string_expect_count) {
+      char missing[DEFAULT_BUFFER_SIZE];
+      missing_strings (missing, sizeof (missing));
+      snprintf (details + strlen (details), DEFAULT_BUFFER_SIZE - strlen (details), _("string '%s' not found, "), missing);
+      result = STATE_CRITICAL;
+    }
+  }
+
+  if (strlen (regexp)) {
+    errcode = np_regexec (&preg, e->body_buf.buf, REGS, pmatch, 0);
+    if ((errcode == REG_NOMATCH && invert_regex == 0) || (errcode == 0 && invert_regex == 1)) {
+      snprintf (details + strlen (details), DEFAULT_BUFFER_SIZE - strlen (details), "%s",
+        invert_regex == 0 ? _("pattern not found, ") : _("pattern found, "));
+      result = STATE_CRITICAL;
+    } else if (errcode != 0 && errcode != REG_NOMATCH) {
+      np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+      snprintf (details + strlen (details), DEFAULT_BUFFER_SIZE - strlen (details), _("Execute Error: %s, "), errbuf);
+      result = STATE_UNKNOWN;
+    }
+  }
+
+  if ((max_page_len > 0) && (e->page_len > max_page_len)) {
+    snprintf (details + strlen (details), DEFAULT_BUFFER_SIZE - strlen (details), _("page size %d too large, "), e->page_len);
+    result = max_state_alt (STATE_WARNING, result);
+  } else if ((min_page_len > 0) && (e->page_len < min_page_len)) {
+    snprintf (details + strlen (details), DEFAULT_BUFFER_SIZE - strlen (details), _("page size %d too small, "), e->page_len);
+    result = max_state_alt (STATE_WARNING, result);
+  }
+
+  result = max_state_alt (get_status (e->total_time, thlds), result);
+
+  /* cut off the trailing ", " */
+  len = strlen (details);
+  if (len >= 2 && details[len-2] == ',')
+    details[len-2] = '\0';
+
+  snprintf (e->msg, DEFAULT_BUFFER_SIZE, "HTTP/%d.%d %d %s%s%s - %d bytes in %.3f second response time",
+    sl.http_major, sl.http_minor, sl.http_code, sl.msg,
+    strlen (details) > 0 ? " - " : "", details,
+    e->page_len, e->total_time);
+  e->result = result;
+  curlhelp_free_statusline (&sl);
+}
+
+/* the records of --batch-frames: one per URL with its time and size,
+ * then the one of the batch, whose state is the max_state() of them */
+static void
+batch_write_frames (curlhelp_batch_entry *entries, size_t count, int result,
+  double start, double elapsed, const char *summary)
+{
+  FILE *fp;
+  char *frame;
+  size_t i, len;
+  int ok;
+
+  if ((fp = fopen (batch_frames, "w")) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot write %s: %s\n"), batch_frames, strerror (errno));
+
+  ok = TRUE;
+  for (i = 0; i <= count && ok; i++) {
+    np_frame_collect (TRUE);
+    if (i < count) {
+      np_frame_point ("time", entries[i].total_time, "s", thlds->warning, thlds->critical,
+        TRUE, 0, TRUE, socket_timeout);
+      np_frame_point ("size", entries[i].page_len, "B", NULL, NULL, TRUE, 0, FALSE, 0);
+      frame = np_frame_result (entries[i].result, start, entries[i].total_time,
+        entries[i].msg, strlen (entries[i].msg), &len);
+    } else
+      frame = np_frame_result (result, start, elapsed, summary, strlen (summary), &len);
+    if (frame == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    ok = fwrite (frame, 1, len, fp) == len;
+    free (frame);
+  }
+  np_frame_collect (FALSE);
+
+  if (fclose (fp) != 0 || !ok)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot write %s: %s\n"), batch_frames, strerror (errno));
+}
+
+/* run the transfers of the multi handle to their end, noting in the entry
+ * of each (CURLOPT_PRIVATE) how it ended */
+static void
+batch_run (CURLM *multi)
+{
+  CURLMsg *info;
+  char *priv;
+  int running = 0, pending;
+
+  do {
+    if (curl_multi_perform (multi, &running) != CURLM_OK)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_perform failed\n");
+
+    while ((info = curl_multi_info_read (multi, &pending)) != NULL) {
+      if (info->msg != CURLMSG_DONE)
+        continue;
+      curl_easy_getinfo (info->easy_handle, CURLINFO_PRIVATE, &priv);
+      ((curlhelp_batch_entry *)priv)->res = info->data.result;
+      ((curlhelp_batch_entry *)priv)->done = TRUE;
+    }
+
+    if (running && curl_multi_wait (multi, NULL, 0, 1000, NULL) != CURLM_OK)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_wait failed\n");
+  } while (running);
+}
+
+int
+check_http_batch (void)
+{
+  curlhelp_batch_entry *entries;
+  size_t count, i;
+  CURLM *multi;
+  CURLSH *share;
+  struct curl_slist *headers = NULL;
+  char *label, *summary;
+  int result = STATE_OK;
+  int states[STATE_DEPENDENT + 1] = { 0 };
+  struct timeval tv;
+  double start, started;
+
+  gettimeofday (&tv, NULL);
+  start = tv.tv_sec + tv.tv_usec / 1e6;
+  started = np_clock ();
+  entries = batch_read_urls (batch_file, &count);
+
+  if (curl_global_init (CURL_GLOBAL_DEFAULT) != CURLE_OK)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_global_init failed\n");
+  if ((multi = curl_multi_init ()) == NULL)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_init failed\n");
+  if ((share = curl_share_init ()) == NULL)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_share_init failed\n");
+
+  /* handles added to one multi handle already share its connection cache,
+   * DNS lookups and TLS sessions (for resumption) are shared explicitly */
+  curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 23, 0)
+  curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 23, 0) */
+
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0)
+  curl_multi_setopt (multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0) */
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 30, 0)
+  curl_multi_setopt (multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, batch_connections);
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 30, 0) */
+
+  for (i = 0; i < (size_t)http_opt_headers_count; i++)
+    headers = curl_slist_append (headers, http_opt_headers[i]);
+  if (!strcmp (http_method, "POST") && http_content_type) {
+    snprintf (http_header, DEFAULT_BUFFER_SIZE, "Content-Type: %s", http_content_type);
+    headers = curl_slist_append (headers, http_header);
+  }
+
+  if (verbose >= 1)
+    printf ("* batch of %lu URLs over at most %ld connections\n", (unsigned long)count, batch_connections);
+
+  for (i = 0; i < count; i++) {
+    batch_setup_handle (&entries[i], share, headers);
+    if (curl_multi_add_handle (multi, entries[i].handle) != CURLM_OK)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_add_handle failed\n");
+  }
+
+  batch_run (multi);
+
+  for (i = 0; i < count; i++) {
+    if (entries[i].done)
+      batch_judge (&entries[i]);
+    else
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("transfer did not complete"));
+    result = max_state (result, entries[i].result);
+    if (entries[i].result >= STATE_OK && entries[i].result <= STATE_DEPENDENT)
+      states[entries[i].result]++;
+  }
+
+  xasprintf (&summary, _("HTTP %s - %lu URLs: %d ok, %d warning, %d critical, %d unknown"),
+    state_text (result), (unsigned long)count, states[STATE_OK],
+    states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+  if (batch_frames)
+    batch_write_frames (entries, count, result, start, np_clock () - started, summary);
+  printf ("%s", summary);
+
+  printf ("|");
+  for (i = 0; i < count; i++) {
+    xasprintf (&label, "%s size", entries[i].url);
+    printf ("%s%s %s", i ? " " : "",
+      fperfdata (entries[i].url, entries[i].total_time, "s",
+        thlds->warning?TRUE:FALSE, thlds->warning?thlds->warning->end:0,
+        thlds->critical?TRUE:FALSE, thlds->critical?thlds->critical->end:0,
+        TRUE, 0, TRUE, socket_timeout),
+      perfdata (label, entries[i].page_len, "B", (min_page_len>0?TRUE:FALSE), min_page_len,
+        (min_page_len>0?TRUE:FALSE), 0, TRUE, 0, FALSE, 0));
+    free (label);
+  }
+  putchar ('\n');
+
+  for (i = 0; i < count; i++)
+    printf ("%s %s: %s\n", state_text (entries[i].result), entries[i].url, entries[i].msg);
+
+  for (i = 0; i < count; i++) {
+    curl_multi_remove_handle (multi, entries[i].handle);
+    curl_easy_cleanup (entries[i].handle);
+    curlhelp_freewritebuffer (&entries[i].body_buf);
+    curlhelp_freewritebuffer (&entries[i].header_buf);
+    free (entries[i].url);
+  }
+  free (entries);
+  curl_slist_free_all (headers);
+  curl_multi_cleanup (multi);
+  curl_share_cleanup (share);
+  curl_global_cleanup ();
+
+  return result;
+}
+
+/* --dual-stack: the first address of each family the name resolves to,
+ * an empty string where there is none */
+static void
+dual_stack_resolve (const char *name, char (*addr)[INET6_ADDRSTRLEN])
+{
+  struct addrinfo hints, *res, *ai;
+  int err;
+
+  addr[0][0] = addr[1][0] = '\0';
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if ((err = getaddrinfo (name, NULL, &hints, &res)) != 0)
+    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to resolve %s: %s\n"), name, gai_strerror (err));
+
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    if (ai->ai_family == AF_INET && addr[0][0] == '\0')
+      inet_ntop (AF_INET, &((struct sockaddr_in *)ai->ai_addr)->sin_addr, addr[0], INET6_ADDRSTRLEN);
+    else if (ai->ai_family == AF_INET6 && addr[1][0] == '\0')
+      inet_ntop (AF_INET6, &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr, addr[1], INET6_ADDRSTRLEN);
+  }
+  freeaddrinfo (res);
+}
+
+/* the same request over IPv4 and IPv6 at once: the name is resolved here
+ * and each handle is pinned to its address with CURLOPT_RESOLVE, so libcurl
+ * does not look it up again, then both are judged like a --batch URL */
+int
+check_http_dual_stack (void)
+{
+  static const char *family[2] = { "IPv4", "IPv6" };
+  static const long ipresolve[2] = { CURL_IPRESOLVE_V4, CURL_IPRESOLVE_V6 };
+  curlhelp_batch_entry entries[2];
+  struct curl_slist *resolve[2] = { NULL, NULL };
+  struct curl_slist *headers = NULL;
+  char addr[2][INET6_ADDRSTRLEN];
+  char pin[DEFAULT_BUFFER_SIZE];
+  char url[DEFAULT_BUFFER_SIZE];
+  const char *name;
+  CURLM *multi;
+  int result = STATE_OK;
+  int i;
+  double elapsed;
+
+  name = host_name ? host_name : server_address;
+  elapsed = np_clock ();
+  dual_stack_resolve (server_address, addr);
+
+  if (curl_global_init (CURL_GLOBAL_DEFAULT) != CURLE_OK)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_global_init failed\n");
+  if ((multi = curl_multi_init ()) == NULL)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_init failed\n");
+
+  /* the URL names the virtual host, so that Host: and SNI are right */
+  snprintf (url, DEFAULT_BUFFER_SIZE, strchr (name, ':') ? "%s://[%s]:%d%s" : "%s://%s:%d%s",
+    use_ssl ? "https" : "http", name, server_port, server_url);
+
+  for (i = 0; i < http_opt_headers_count; i++)
+    headers = curl_slist_append (headers, http_opt_headers[i]);
+  if (host_name != NULL && virtual_port != server_port) {
+    snprintf (http_header, DEFAULT_BUFFER_SIZE, "Host: %s:%d", host_name, virtual_port);
+    headers = curl_slist_append (headers, http_header);
+  }
+  if (!strcmp (http_method, "POST") && http_content_type) {
+    snprintf (http_header, DEFAULT_BUFFER_SIZE, "Content-Type: %s", http_content_type);
+    headers = curl_slist_append (headers, http_header);
+  }
+
+  for (i = 0; i < 2; i++) {
+    memset (&entries[i], 0, sizeof (curlhelp_batch_entry));
+    entries[i].url = url;
+    if (addr[i][0] == '\0') {
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("%s has no %s address"), server_address, family[i]);
+      entries[i].result = STATE_CRITICAL;
+      continue;
+    }
+    entries[i].result = STATE_UNKNOWN;
+
+    batch_setup_handle (&entries[i], NULL, headers);
+    snprintf (pin, DEFAULT_BUFFER_SIZE, "%s:%d:%s", name, server_port, addr[i]);
+    if (verbose >= 1)
+      printf ("* curl CURLOPT_RESOLVE: %s\n", pin);
+    resolve[i] = curl_slist_append (NULL, pin);
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_RESOLVE, resolve[i]), "CURLOPT_RESOLVE");
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_IPRESOLVE, ipresolve[i]), "CURLOPT_IPRESOLVE");
+    if (curl_multi_add_handle (multi, entries[i].handle) != CURLM_OK)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_add_handle failed\n");
+  }
+
+  batch_run (multi);
+  elapsed = np_clock () - elapsed;
+
+  for (i = 0; i < 2; i++) {
+    if (entries[i].done)
+      batch_judge (&entries[i]);
+    else if (entries[i].handle)
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("transfer did not complete"));
+    result = max_state (result, entries[i].result);
+  }
+
+  printf ("HTTP %s - %s: IPv4 %s in %.3f seconds, IPv6 %s in %.3f seconds",
+    state_text (result), name,
+    state_text (entries[0].result), entries[0].total_time,
+    state_text (entries[1].result), entries[1].total_time);
+
+  printf ("|%s", fperfdata ("time", elapsed, "s", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout));
+  for (i = 0; i < 2; i++) {
+    if (!entries[i].done)
+      continue;
+    snprintf (pin, DEFAULT_BUFFER_SIZE, "time_%s", i ? "ipv6" : "ipv4");
+    printf (" %s", fperfdata (pin, entries[i].total_time, "s",
+      thlds->warning?TRUE:FALSE, thlds->warning?thlds->warning->end:0,
+      thlds->critical?TRUE:FALSE, thlds->critical?thlds->critical->end:0,
+      TRUE, 0, TRUE, socket_timeout));
+    snprintf (pin, DEFAULT_BUFFER_SIZE, "size_%s", i ? "ipv6" : "ipv4");
+    printf (" %s", perfdata (pin, entries[i].page_len, "B", (min_page_len>0?TRUE:FALSE), min_page_len,
+      (min_page_len>0?TRUE:FALSE), 0, TRUE, 0, FALSE, 0));
+  }
+  /* how much slower (or, negative, faster) IPv6 is */
+  if (entries[0].done && entries[1].done)
+    printf (" %s", fperfdata ("time_delta", entries[1].total_time - entries[0].total_time, "s",
+      FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0));
+  putchar ('\n');
+
+  for (i = 0; i < 2; i++)
+    printf ("%s %s %s: %s\n", state_text (entries[i].result), family[i],
+      addr[i][0] ? addr[i] : "-", entries[i].msg);
+
+  for (i = 0; i < 2; i++) {
+    if (entries[i].handle == NULL)
+      continue;
+    curl_multi_remove_handle (multi, entries[i].handle);
+    curl_easy_cleanup (entries[i].handle);
+    curlhelp_freewritebuffer (&entries[i].body_buf);
+    curlhelp_freewritebuffer (&entries[i].header_buf);
+    curl_slist_free_all (resolve[i]);
+  }
+  curl_slist_free_all (headers);
+  curl_multi_cleanup (multi);
+  curl_global_cleanup ();
+
+  return result;
+}
+
+/* --backends: add addr to the list unless it is there already */
+static void
+backends_add (char ***list, size_t *count, size_t *size, const char *addr)
+{
+  size_t i;
+
+  for (i = 0; i < *count; i++)
+    if (!strcmp ((*list)[i], addr))
+      return;
+  if (*count == *size) {
+    *size = *size ? *size * 2 : 8;
+    if ((*list = realloc (*list, *size * sizeof (char *))) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  }
+  if (((*list)[(*count)++] = strdup (addr)) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+}
+
+/* the servers of the --backends list, or else every address the host
+ * resolves to, of the family of -4 or -6 if one was given */
+static char **
+backends_collect (size_t *count)
+{
+  struct addrinfo hints, *res, *ai;
+  char addr[INET6_ADDRSTRLEN];
+  char **list = NULL, *copy, *tok;
+  size_t size = 0;
+  int err;
+
+  *count = 0;
+  if (backends_list) {
+    if ((copy = strdup (backends_list)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    for (tok = strtok (copy, ","); tok != NULL; tok = strtok (NULL, ","))
+      backends_add (&list, count, &size, tok);
+    free (copy);
+    return list;
+  }
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = address_family;
+  hints.ai_socktype = SOCK_STREAM;
+  if ((err = getaddrinfo (server_address, NULL, &hints, &res)) != 0)
+    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to resolve %s: %s\n"), server_address, gai_strerror (err));
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    if (ai->ai_family == AF_INET)
+      inet_ntop (AF_INET, &((struct sockaddr_in *)ai->ai_addr)->sin_addr, addr, sizeof (addr));
+    else if (ai->ai_family == AF_INET6)
+      inet_ntop (AF_INET6, &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr, addr, sizeof (addr));
+    else
+      continue;
+    backends_add (&list, count, &size, addr);
+  }
+  freeaddrinfo (res);
+  return list;
+}
+
+/* the request to every server behind one name at once. The URL names the
+ * virtual host, so all of them get its Host header and SNI, and each handle
+ * is sent to its server with CURLOPT_CONNECT_TO rather than CURLOPT_RESOLVE,
+ * whose DNS cache the handles of one multi handle would share. Each one is
+ * judged like a --batch URL */
+int
+check_http_backends (void)
+{
+  curlhelp_batch_entry *entries;
+  struct curl_slist **connect_to;
+  struct curl_slist *headers = NULL;
+  char **addr;
+  char pin[DEFAULT_BUFFER_SIZE];
+  char url[DEFAULT_BUFFER_SIZE];
+  const char *name;
+  CURLM *multi;
+  size_t count, i;
+  int result = STATE_OK;
+  int states[STATE_DEPENDENT + 1] = { 0 };
+  double elapsed;
+
+  name = host_name ? host_name : server_address;
+  elapsed = np_clock ();
+  addr = backends_collect (&count);
+  if (count == 0)
+    die (STATE_CRITICAL, _("HTTP CRITICAL - %s has no addresses\n"), server_address);
+  if ((entries = calloc (count, sizeof (curlhelp_batch_entry))) == NULL ||
+      (connect_to = calloc (count, sizeof (struct curl_slist *))) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+  if (curl_global_init (CURL_GLOBAL_DEFAULT) != CURLE_OK)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_global_init failed\n");
+  if ((multi = curl_multi_init ()) == NULL)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_init failed\n");
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 30, 0)
+  curl_multi_setopt (multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, batch_connections);
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 30, 0) */
+
+  snprintf (url, DEFAULT_BUFFER_SIZE, strchr (name, ':') ? "%s://[%s]:%d%s" : "%s://%s:%d%s",
+    use_ssl ? "https" : "http", name, server_port, server_url);
+
+  for (i = 0; i < (size_t)http_opt_headers_count; i++)
+    headers = curl_slist_append (headers, http_opt_headers[i]);
+  if (host_name != NULL && virtual_port != server_port) {
+    snprintf (http_header, DEFAULT_BUFFER_SIZE, "Host: %s:%d", host_name, virtual_port);
+    headers = curl_slist_append (headers, http_header);
+  }
+  if (!strcmp (http_method, "POST") && http_content_type) {
+    snprintf (http_header, DEFAULT_BUFFER_SIZE, "Content-Type: %s", http_content_type);
+    headers = curl_slist_append (headers, http_header);
+  }
+
+  if (verbose >= 1)
+    printf ("* %lu backends over at most %ld connections\n", (unsigned long)count, batch_connections);
+
+  for (i = 0; i < count; i++) {
+    entries[i].url = url;
+    entries[i].result = STATE_UNKNOWN;
+    batch_setup_handle (&entries[i], NULL, headers);
+    snprintf (pin, DEFAULT_BUFFER_SIZE, strchr (addr[i], ':') ? "%s:%d:[%s]:%d" : "%s:%d:%s:%d",
+      name, server_port, addr[i], server_port);
+    if (verbose >= 1)
+      printf ("* curl CURLOPT_CONNECT_TO: %s\n", pin);
+    connect_to[i] = curl_slist_append (NULL, pin);
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 49, 0)
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_CONNECT_TO, connect_to[i]), "CURLOPT_CONNECT_TO");
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 49, 0) */
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0)
+    /* a connection of its own, not one of another backend to wait for */
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_PIPEWAIT, 0L), "CURLOPT_PIPEWAIT");
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0) */
+    if (curl_multi_add_handle (multi, entries[i].handle) != CURLM_OK)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_add_handle failed\n");
+  }
+
+  batch_run (multi);
+  elapsed = np_clock () - elapsed;
+
+  for (i = 0; i < count; i++) {
+    if (entries[i].done)
+      batch_judge (&entries[i]);
+    else
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("transfer did not complete"));
+    result = max_state (result, entries[i].result);
+    if (entries[i].result >= STATE_OK && entries[i].result <= STATE_DEPENDENT)
+      states[entries[i].result]++;
+  }
+
+  printf (_("HTTP %s - %s: %lu backends: %d ok, %d warning, %d critical, %d unknown"),
+    state_text (result), name, (unsigned long)count, states[STATE_OK],
+    states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+  printf ("|%s", fperfdata ("time", elapsed, "s", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout));
+  for (i = 0; i < count; i++) {
+    if (!entries[i].done)
+      continue;
+    snprintf (pin, DEFAULT_BUFFER_SIZE, "time_%s", addr[i]);
+    printf (" %s", fperfdata (pin, entries[i].total_time, "s",
+      thlds->warning?TRUE:FALSE, thlds->warning?thlds->warning->end:0,
+      thlds->critical?TRUE:FALSE, thlds->critical?thlds->critical->end:0,
+      TRUE, 0, TRUE, socket_timeout));
+    snprintf (pin, DEFAULT_BUFFER_SIZE, "size_%s", addr[i]);
+    printf (" %s", perfdata (pin, entries[i].page_len, "B", (min_page_len>0?TRUE:FALSE), min_page_len,
+      (min_page_len>0?TRUE:FALSE), 0, TRUE, 0, FALSE, 0));
+  }
+  putchar ('\n');
+
+  for (i = 0; i < count; i++)
+    printf ("%s %s: %s\n", state_text (entries[i].result), addr[i], entries[i].msg);
+
+  for (i = 0; i < count; i++) {
+    curl_multi_remove_handle (multi, entries[i].handle);
+    curl_easy_cleanup (entries[i].handle);
+    curlhelp_freewritebuffer (&entries[i].body_buf);
+    curlhelp_freewritebuffer (&entries[i].header_buf);
+    curl_slist_free_all (connect_to[i]);
+    free (addr[i]);
+  }
+  free (entries);
+  free (connect_to);
+  free (addr);
+  curl_slist_free_all (headers);
+  curl_multi_cleanup (multi);
+  curl_global_cleanup ();
+
+  return result;
+}
+
+/* --throughput: the chunks follow each other from the start of the file
+ * and are asked for at once with Range requests, each over a connection of
+ * its own. The bodies are counted and dropped, the throughput is the bytes
+ * of all chunks over the time from the first request to the last byte */
+int
+check_http_throughput (void)
+{
+  curlhelp_batch_entry *entries;
+  struct curl_slist *resolve = NULL;
+  struct curl_slist *headers = NULL;
+  char range[DEFAULT_BUFFER_SIZE];
+  char label[DEFAULT_BUFFER_SIZE];
+  const char *name;
+  long http_code;
+  double *speed, *first_byte;
+  double elapsed, throughput, bytes = 0;
+  CURLM *multi;
+  int result = STATE_OK;
+  int i, slowest = -1;
+
+  name = host_name ? host_name : server_address;
+
+  if (curl_global_init (CURL_GLOBAL_DEFAULT) != CURLE_OK)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_global_init failed\n");
+  if ((multi = curl_multi_init ()) == NULL)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_init failed\n");
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0)
+  /* parallel chunks are parallel connections, not streams of one */
+  curl_multi_setopt (multi, CURLMOPT_PIPELINING, CURLPIPE_NOTHING);
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0) */
+
+  entries = calloc (throughput_chunks, sizeof (curlhelp_batch_entry));
+  speed = calloc (throughput_chunks, sizeof (double));
+  first_byte = calloc (throughput_chunks, sizeof (double));
+  if (entries == NULL || speed == NULL || first_byte == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+
+  /* the URL names the virtual host, so that Host: and SNI are right */
+  snprintf (url, DEFAULT_BUFFER_SIZE, strchr (name, ':') ? "%s://[%s]:%d%s" : "%s://%s:%d%s",
+    use_ssl ? "https" : "http", name, server_port, server_url);
+  if (host_name != NULL && strcmp (host_name, server_address)) {
+    snprintf (range, DEFAULT_BUFFER_SIZE, "%s:%d:%s", host_name, server_port, server_address);
+    if (verbose >= 1)
+      printf ("* curl CURLOPT_RESOLVE: %s\n", range);
+    resolve = curl_slist_append (NULL, range);
+  }
+
+  for (i = 0; i < http_opt_headers_count; i++)
+    headers = curl_slist_append (headers, http_opt_headers[i]);
+  if (host_name != NULL && virtual_port != server_port) {
+    snprintf (http_header, DEFAULT_BUFFER_SIZE, "Host: %s:%d", host_name, virtual_port);
+    headers = curl_slist_append (headers, http_header);
+  }
+
+  if (verbose >= 1)
+    printf ("* %d chunks of %llu bytes\n", throughput_chunks, throughput_size);
+
+  elapsed = np_clock ();
+  for (i = 0; i < throughput_chunks; i++) {
+    entries[i].url = url;
+    entries[i].result = STATE_UNKNOWN;
+    batch_setup_handle (&entries[i], NULL, headers);
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_WRITEFUNCTION, (curl_write_callback)curlhelp_range_write_callback), "CURLOPT_WRITEFUNCTION");
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_WRITEDATA, (void *)&entries[i].page_len), "CURLOPT_WRITEDATA");
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0)
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_PIPEWAIT, 0L), "CURLOPT_PIPEWAIT");
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0) */
+    snprintf (range, DEFAULT_BUFFER_SIZE, "%llu-%llu",
+      throughput_size * i, throughput_size * (i + 1) - 1);
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_RANGE, range), "CURLOPT_RANGE");
+    if (resolve)
+      handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_RESOLVE, resolve), "CURLOPT_RESOLVE");
+    if (curl_multi_add_handle (multi, entries[i].handle) != CURLM_OK)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_add_handle failed\n");
+  }
+  batch_run (multi);
+  elapsed = np_clock () - elapsed;
+
+  for (i = 0; i < throughput_chunks; i++) {
+    http_code = 0;
+    curl_easy_getinfo (entries[i].handle, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo (entries[i].handle, CURLINFO_TOTAL_TIME, &entries[i].total_time);
+    curl_easy_getinfo (entries[i].handle, CURLINFO_STARTTRANSFER_TIME, &first_byte[i]);
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 55, 0)
+    {
+      curl_off_t bytes_per_second = 0;
+      curl_easy_getinfo (entries[i].handle, CURLINFO_SPEED_DOWNLOAD_T, &bytes_per_second);
+      speed[i] = bytes_per_second / 1e6;
+    }
+#else
+    curl_easy_getinfo (entries[i].handle, CURLINFO_SPEED_DOWNLOAD, &speed[i]);
+    speed[i] /= 1e6;
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 55, 0) */
+
+    /* a server that ignores Range sends all of the file, which was stopped */
+    if (http_code == 200) {
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("the server ignored the Range request (HTTP 200)"));
+      entries[i].result = STATE_UNKNOWN;
+    } else if (!entries[i].done) {
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("transfer did not complete"));
+      entries[i].result = STATE_CRITICAL;
+    } else if (entries[i].res != CURLE_OK) {
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("cURL returned %d - %s"),
+        entries[i].res, entries[i].errbuf[0] ? entries[i].errbuf : curl_easy_strerror (entries[i].res));
+      entries[i].result = STATE_CRITICAL;
+    } else if (http_code != 206) {
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("HTTP %ld instead of 206 Partial Content"), http_code);
+      entries[i].result = STATE_CRITICAL;
+    } else {
+      snprintf (entries[i].msg, DEFAULT_BUFFER_SIZE, _("%d bytes in %.3f seconds (%.2f MB/s), first byte after %.3f seconds"),
+        entries[i].page_len, entries[i].total_time, speed[i], first_byte[i]);
+      entries[i].result = STATE_OK;
+      if (slowest < 0 || speed[i] < speed[slowest])
+        slowest = i;
+    }
+    bytes += entries[i].page_len;
+    result = max_state (result, entries[i].result);
+  }
+
+  throughput = elapsed > 0 ? bytes / elapsed / 1e6 : 0;
+  if (result == STATE_OK)
+    result = get_status (throughput, throughput_thlds);
+  result = max_state_alt (get_status (elapsed, thlds), result);
+
+  printf ("HTTP %s - %d chunks of %llu bytes: %.2f MB/s, %.0f bytes in %.3f seconds",
+    state_text (result), throughput_chunks, throughput_size, throughput, bytes, elapsed);
+  if (slowest >= 0 && throughput_chunks > 1)
+    printf (_(", slowest chunk %d at %.2f MB/s"), slowest + 1, speed[slowest]);
+
+  printf ("|%s", fperfdata ("throughput", throughput, "",
+    throughput_thlds->warning?TRUE:FALSE, throughput_thlds->warning?throughput_thlds->warning->start:0,
+    throughput_thlds->critical?TRUE:FALSE, throughput_thlds->critical?throughput_thlds->critical->start:0,
+    TRUE, 0, FALSE, 0));
+  printf (" %s", fperfdata ("time", elapsed, "s",
+    thlds->warning?TRUE:FALSE, thlds->warning?thlds->warning->end:0,
+    thlds->critical?TRUE:FALSE, thlds->critical?thlds->critical->end:0,
+    TRUE, 0, TRUE, socket_timeout));
+  printf (" %s", perfdata ("size", (long)bytes, "B", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+  for (i = 0; i < throughput_chunks; i++) {
+    if (entries[i].result != STATE_OK)
+      continue;
+    snprintf (label, DEFAULT_BUFFER_SIZE, "throughput_chunk%d", i + 1);
+    printf (" %s", fperfdata (label, speed[i], "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    snprintf (label, DEFAULT_BUFFER_SIZE, "time_chunk%d", i + 1);
+    printf (" %s", fperfdata (label, entries[i].total_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout));
+  }
+  putchar ('\n');
+
+  for (i = 0; i < throughput_chunks; i++)
+    printf ("%s chunk %d bytes %llu-%llu: %s\n", state_text (entries[i].result), i + 1,
+      throughput_size * i, throughput_size * (i + 1) - 1, entries[i].msg);
+
+  for (i = 0; i < throughput_chunks; i++) {
+    curl_multi_remove_handle (multi, entries[i].handle);
+    curl_easy_cleanup (entries[i].handle);
+    curlhelp_freewritebuffer (&entries[i].body_buf);
+    curlhelp_freewritebuffer (&entries[i].header_buf);
+  }
+  free (entries);
+  free (speed);
+  free (first_byte);
+  curl_slist_free_all (headers);
+  curl_slist_free_all (resolve);
+  curl_multi_cleanup (multi);
+  curl_global_cleanup ();
+
+  return result;
+}
+
+int
+uri_strcmp (const UriTextRangeA range, const char* s)
+{
+  if (!range.first) return -1;
+  if (range.afterLast - range.first < strlen (s)) return -1;
+  return strncmp (s, range.first, min( range.afterLast - range.first, strlen (s)));
+}
+
+char*
+uri_string (const UriTextRangeA range, char* buf, size_t buflen)
+{
+  if (!range.first) return "(null)";
+  strncpy (buf, range.first, max (buflen, range.afterLast - range.first));
+  buf[max (buflen, range.afterLast - range.first)] = '\0';
+  buf[range.afterLast - range.first] = '\0';
+  return buf;
+}
+
+/* whether two ranges hold the same text, ignoring case */
+static int
+uri_range_equal (const UriTextRangeA a, const UriTextRangeA b)
+{
+  size_t n = a.first ? (size_t)(a.afterLast - a.first) : 0;
+
+  if (n != (b.first ? (size_t)(b.afterLast - b.first) : 0))
+    return FALSE;
+  return n == 0 || strncasecmp (a.first, b.first, n) == 0;
+}
+
+static int
+uri_port (const UriUriA *uri)
+{
+  if (uri->portText.first && uri->portText.afterLast > uri->portText.first)
+    return (int)strtol (uri->portText.first, NULL, 10);
+  if (uri->scheme.first && uri->scheme.afterLast - uri->scheme.first == 5 &&
+      strncasecmp (uri->scheme.first, "https", 5) == 0)
+    return HTTPS_PORT;
+  return HTTP_PORT;
+}
+
+/* the page of --assets goes through the multi handle its assets go through
+ * later, whose cache keeps the connection of the page open for them */
+CURLcode
+assets_perform_page (CURL *h)
+{
+  curlhelp_batch_entry page;
+
+  if (assets_multi == NULL) {
+    if ((assets_multi = curl_multi_init ()) == NULL)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_init failed\n");
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0)
+    curl_multi_setopt (assets_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 43, 0) */
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 30, 0)
+    /* no more connections to the origin than a browser opens */
+    curl_multi_setopt (assets_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)MAX_ASSET_CONNECTIONS);
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 30, 0) */
+  }
+
+  memset (&page, 0, sizeof (page));
+  handle_curl_option_return_code (curl_easy_setopt (h, CURLOPT_PRIVATE, (void *)&page), "CURLOPT_PRIVATE");
+  if (curl_multi_add_handle (assets_multi, h) != CURLM_OK)
+    die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_add_handle failed\n");
+  batch_run (assets_multi);
+  curl_multi_remove_handle (assets_multi, h);
+
+  return page.done ? page.res : CURLE_FAILED_INIT;
+}
+
+/* the end of the tag whose attributes start at p, the '>' outside quotes */
+static const char *
+html_tag_end (const char *p, const char *end)
+{
+  char quote = '\0';
+
+  for (; p < end; p++) {
+    if (quote) {
+      if (*p == quote)
+        quote = '\0';
+    } else if (*p == '"' || *p == '\'') {
+      quote = *p;
+    } else if (*p == '>')
+      return p;
+  }
+  return end;
+}
+
+/* the value of attribute name in the tag from p to end and its length, or
+ * NULL if the tag has no such attribute */
+static const char *
+html_attribute (const char *p, const char *end, const char *name, size_t *len)
+{
+  const char *attr, *value;
+  char quote;
+  size_t n;
+
+  while (p < end) {
+    while (p < end && (isspace ((unsigned char)*p) || *p == '/'))
+      p++;
+    attr = p;
+    while (p < end && !isspace ((unsigned char)*p) && *p != '=' && *p != '/')
+      p++;
+    n = p - attr;
+    while (p < end && isspace ((unsigned char)*p))
+      p++;
+
+    value = p;
+    *len = 0;
+    if (p < end && *p == '=') {
+      for (p++; p < end && isspace ((unsigned char)*p); p++)
+        ;
+      if (p < end && (*p == '"' || *p == '\'')) {
+        quote = *p++;
+        for (value = p; p < end && *p != quote; p++)
+          ;
+        *len = p - value;
+        if (p < end)
+          p++;
+      } else {
+        for (value = p; p < end && !isspace ((unsigned char)*p); p++)
+          ;
+        *len = p - value;
+      }
+    }
+
+    if (n == strlen (name) && strncasecmp (attr, name, n) == 0)
+      return value;
+  }
+  return NULL;
+}
+
+/* whether the rel attribute of a link tag names a stylesheet */
+static int
+html_stylesheet (const char *p, const char *end)
+{
+  const char *rel, *rel_end, *word;
+  size_t len;
+
+  if ((rel = html_attribute (p, end, "rel", &len)) == NULL)
+    return FALSE;
+  for (rel_end = rel + len; rel < rel_end; ) {
+    while (rel < rel_end && isspace ((unsigned char)*rel))
+      rel++;
+    for (word = rel; rel < rel_end && !isspace ((unsigned char)*rel); rel++)
+      ;
+    if (rel - word == 10 && strncasecmp (word, "stylesheet", 10) == 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* the text of a script or style element runs to its end tag, whatever
+ * markup it seems to hold */
+static const char *
+html_skip_text (const char *p, const char *end, const char *tag)
+{
+  size_t n = strlen (tag);
+
+  for (; end - p >= (ptrdiff_t)(n + 2); p++)
+    if (p[0] == '<' && p[1] == '/' && strncasecmp (p + 2, tag, n) == 0)
+      return p;
+  return end;
+}
+
+/* the URL of an asset as written in the page, resolved against the URL of
+ * the page and without its fragment, or NULL if it is of another origin */
+static char *
+assets_resolve (const char *ref, size_t len, const UriUriA *base)
+{
+  UriParserStateA state;
+  UriUriA rel, abs;
+  char *text, *url = NULL, *p, *q;
+  int chars;
+
+  if ((text = malloc (len + 1)) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+  /* the only entity expected in a URL */
+  for (p = (char *)ref, q = text; p < ref + len; ) {
+    if (ref + len - p >= 5 && strncmp (p, "&amp;", 5) == 0) {
+      *q++ = '&';
+      p += 5;
+    } else
+      *q++ = *p++;
+  }
+  *q = '\0';
+
+  state.uri = &rel;
+  if (uriParseUriA (&state, text) != URI_SUCCESS) {
+    free (text);
+    return NULL;
+  }
+  if (uriAddBaseUriA (&abs, &rel, base) == URI_SUCCESS) {
+    if (uri_range_equal (abs.scheme, base->scheme) &&
+        uri_range_equal (abs.hostText, base->hostText) &&
+        uri_port (&abs) == uri_port (base) &&
+        uriToStringCharsRequiredA (&abs, &chars) == URI_SUCCESS) {
+      if ((url = malloc (chars + 1)) == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+      if (uriToStringA (url, &abs, chars + 1, &chars) != URI_SUCCESS) {
+        free (url);
+        url = NULL;
+      } else if ((p = strchr (url, '#')) != NULL)
+        *p = '\0';
+    }
+    uriFreeUriMembersA (&abs);
+  }
+  uriFreeUriMembersA (&rel);
+  free (text);
+
+  return url;
+}
+
+/* the scripts, stylesheets and images of the same origin as the page that
+ * it links to, each once and at most MAX_PAGE_ASSETS of them */
+static char **
+assets_find (const char *html, size_t html_len, const UriUriA *base, size_t *count)
+{
+  const char *p = html, *end = html + html_len, *tag_end, *value;
+  char **urls = NULL;
+  char *url;
+  size_t size = 0, name_len, len, i;
+
+  *count = 0;
+  while ((p = memchr (p, '<', end - p)) != NULL) {
+    p++;
+    /* nothing in a comment is fetched */
+    if (end - p >= 3 && strncmp (p, "!--", 3) == 0) {
+      for (p += 3; end - p >= 3 && strncmp (p, "-->", 3) != 0; p++)
+        ;
+      continue;
+    }
+
+    for (name_len = 0; p + name_len < end && isalnum ((unsigned char)p[name_len]); name_len++)
+      ;
+    tag_end = html_tag_end (p + name_len, end);
+
+    value = NULL;
+    if (name_len == 6 && strncasecmp (p, "script", 6) == 0)
+      value = html_attribute (p + name_len, tag_end, "src", &len);
+    else if (name_len == 3 && strncasecmp (p, "img", 3) == 0)
+      value = html_attribute (p + name_len, tag_end, "src", &len);
+    else if (name_len == 4 && strncasecmp (p, "link", 4) == 0 && html_stylesheet (p + name_len, tag_end))
+      value = html_attribute (p + name_len, tag_end, "href", &len);
+
+    if (value && len > 0 && (url = assets_resolve (value, len, base)) != NULL) {
+      for (i = 0; i < *count && strcmp (urls[i], url) != 0; i++)
+        ;
+      if (i < *count) {
+        free (url);
+      } else if (*count == MAX_PAGE_ASSETS) {
+        if (verbose >= 1)
+          printf ("* more than %d assets, %s and the ones after it are not fetched\n", MAX_PAGE_ASSETS, url);
+        free (url);
+        break;
+      } else {
+        if (*count == size) {
+          size = size ? size * 2 : 16;
+          if ((urls = realloc (urls, size * sizeof (char *))) == NULL)
+            die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+        }
+        urls[(*count)++] = url;
+      }
+    }
+
+    if (name_len == 6 && strncasecmp (p, "script", 6) == 0)
+      p = html_skip_text (tag_end, end, "script");
+    else if (name_len == 5 && strncasecmp (p, "style", 5) == 0)
+      p = html_skip_text (tag_end, end, "style");
+    else
+      p = tag_end;
+  }
+
+  return urls;
+}
+
+static char *
+assets_perfdata (const char *label, double value, const char *uom, int field)
+{
+  thresholds *t = assets_thlds[field];
+
+  if (!strcmp (uom, "s"))
+    return fperfdata (label, value, uom,
+      t->warning ? TRUE : FALSE, t->warning ? t->warning->end : 0,
+      t->critical ? TRUE : FALSE, t->critical ? t->critical->end : 0,
+      TRUE, 0, TRUE, socket_timeout);
+  return perfdata (label, (long)value, uom,
+    t->warning ? TRUE : FALSE, t->warning ? (long)t->warning->end : 0,
+    t->critical ? TRUE : FALSE, t->critical ? (long)t->critical->end : 0,
+    TRUE, 0, FALSE, 0);
+}
+
+/* --assets: fetch the assets the page links to all at once over the
+ * connections the multi handle keeps, as a browser would, and judge the
+ * bytes and requests of the page and them, the critical path (the page,
+ * then the last of the assets to arrive) and the slowest asset */
+int
+check_assets (int page_len, char (*msg)[DEFAULT_BUFFER_SIZE])
+{
+  curlhelp_batch_entry *entries;
+  struct curl_slist *headers = NULL;
+  struct curl_slist *resolve = NULL;
+  UriParserStateA state;
+  UriUriA base;
+  char *effective_url = NULL;
+  char **urls;
+  double value[ASSETS_FIELDS];
+  double started;
+  long http_code;
+  size_t count, i, slowest = 0, failed = 0, len;
+  int force_host_header = FALSE;
+  int result = STATE_OK;
+
+  /* after redirects libcurl followed, links are relative to where they ended */
+  handle_curl_option_return_code (curl_easy_getinfo (curl, CURLINFO_EFFECTIVE_URL, &effective_url), "CURLINFO_EFFECTIVE_URL");
+  state.uri = &base;
+  if (effective_url == NULL || uriParseUriA (&state, effective_url) != URI_SUCCESS)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot parse the URL of the page: %s\n"), effective_url ? effective_url : url);
+  urls = assets_find (body_buf.buf, body_buf.buflen, &base, &count);
+  uriFreeUriMembersA (&base);
+
+  /* from the same virtual host and address as the page */
+  for (i = 0; i < (size_t)http_opt_headers_count; i++) {
+    if (strncmp (http_opt_headers[i], "Host:", 5) == 0)
+      force_host_header = TRUE;
+    headers = curl_slist_append (headers, http_opt_headers[i]);
+  }
+  if (host_name != NULL && !force_host_header) {
+    if ((virtual_port != HTTP_PORT && !use_ssl) || (virtual_port != HTTPS_PORT && use_ssl))
+      snprintf (http_header, DEFAULT_BUFFER_SIZE, "Host: %s:%d", host_name, virtual_port);
+    else
+      snprintf (http_header, DEFAULT_BUFFER_SIZE, "Host: %s", host_name);
+    headers = curl_slist_append (headers, http_header);
+  }
+  if (use_ssl && host_name != NULL) {
+    snprintf (http_header, DEFAULT_BUFFER_SIZE, "%s:%d:%s", host_name, server_port, server_address);
+    resolve = curl_slist_append (NULL, http_header);
+  }
+
+  if ((entries = calloc (count ? count : 1, sizeof (curlhelp_batch_entry))) == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Memory allocation error\n"));
+
+  if (verbose >= 1)
+    printf ("* %lu assets of %s\n", (unsigned long)count, effective_url);
+
+  started = np_clock ();
+  for (i = 0; i < count; i++) {
+    entries[i].url = urls[i];
+    batch_setup_handle (&entries[i], NULL, headers);
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_WRITEFUNCTION, (curl_write_callback)curlhelp_count_write_callback), "CURLOPT_WRITEFUNCTION");
+    handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_WRITEDATA, (void *)&entries[i].page_len), "CURLOPT_WRITEDATA");
+    if (resolve)
+      handle_curl_option_return_code (curl_easy_setopt (entries[i].handle, CURLOPT_RESOLVE, resolve), "CURLOPT_RESOLVE");
+    if (curl_multi_add_handle (assets_multi, entries[i].handle) != CURLM_OK)
+      die (STATE_UNKNOWN, "HTTP UNKNOWN - curl_multi_add_handle failed\n");
+  }
+  batch_run (assets_multi);
+
+  value[ASSETS_BYTES] = page_len;
+  value[ASSETS_REQUESTS] = count + 1;
+  value[ASSETS_CRITICAL_PATH] = total_time + np_clock () - started;
+  value[ASSETS_SLOWEST] = 0;
+  for (i = 0; i < count; i++) {
+    http_code = 0;
+    curl_easy_getinfo (entries[i].handle, CURLINFO_TOTAL_TIME, &entries[i].total_time);
+    curl_easy_getinfo (entries[i].handle, CURLINFO_RESPONSE_CODE, &http_code);
+    value[ASSETS_BYTES] += entries[i].header_buf.buflen + entries[i].page_len;
+    if (!entries[i].done || entries[i].res != CURLE_OK || http_code >= 400)
+      failed++;
+    if (entries[i].total_time > value[ASSETS_SLOWEST]) {
+      value[ASSETS_SLOWEST] = entries[i].total_time;
+      slowest = i;
+    }
+    if (verbose >= 1) {
+      if (!entries[i].done || entries[i].res != CURLE_OK)
+        printf ("* asset %s: cURL returned %d - %s\n", entries[i].url, entries[i].res,
+          entries[i].errbuf[0] ? entries[i].errbuf : curl_easy_strerror (entries[i].res));
+      else
+        printf ("* asset %s: HTTP %ld, %d bytes in %.3f seconds\n", entries[i].url, http_code,
+          (int)entries[i].header_buf.buflen + entries[i].page_len, entries[i].total_time);
+    }
+  }
+
+  len = strlen (*msg);
+  if (failed) {
+    snprintf (*msg + len, DEFAULT_BUFFER_SIZE - len, _("%lu of %lu assets failed, "),
+      (unsigned long)failed, (unsigned long)count);
+    result = STATE_WARNING;
+    len = strlen (*msg);
+  }
+  for (i = 0; i < ASSETS_FIELDS; i++)
+    result = max_state_alt (get_status (value[i], assets_thlds[i]), result);
+  snprintf (*msg + len, DEFAULT_BUFFER_SIZE - len, _("%.0f requests, %.0f bytes, critical path %.3f seconds, "),
+    value[ASSETS_REQUESTS], value[ASSETS_BYTES], value[ASSETS_CRITICAL_PATH]);
+  if (count) {
+    len = strlen (*msg);
+    snprintf (*msg + len, DEFAULT_BUFFER_SIZE - len, _("slowest asset %s in %.3f seconds, "),
+      entries[slowest].url, value[ASSETS_SLOWEST]);
+  }
 
-int
-uri_strcmp (const UriTextRangeA range, const char* s)
-{
-  if (!range.first) return -1;
-  if (range.afterLast - range.first < strlen (s)) return -1;
-  return strncmp (s, range.first, min( range.afterLast - range.first, strlen (s)));
-}
+  len = strlen (perfstring);
+  snprintf (perfstring + len, DEFAULT_BUFFER_SIZE - len, " %s %s %s %s",
+    assets_perfdata ("requests", value[ASSETS_REQUESTS], "", ASSETS_REQUESTS),
+    assets_perfdata ("size_total", value[ASSETS_BYTES], "B", ASSETS_BYTES),
+    assets_perfdata ("time_critical_path", value[ASSETS_CRITICAL_PATH], "s", ASSETS_CRITICAL_PATH),
+    assets_perfdata ("time_slowest_asset", value[ASSETS_SLOWEST], "s", ASSETS_SLOWEST));
+
+  for (i = 0; i < count; i++) {
+    curl_multi_remove_handle (assets_multi, entries[i].handle);
+    curl_easy_cleanup (entries[i].handle);
+    curlhelp_freewritebuffer (&entries[i].body_buf);
+    curlhelp_freewritebuffer (&entries[i].header_buf);
+    free (urls[i]);
+  }
+  free (urls);
+  free (entries);
+  curl_slist_free_all (headers);
+  curl_slist_free_all (resolve);
 
-char*
-uri_string (const UriTextRangeA range, char* buf, size_t buflen)
-{
-  if (!range.first) return "(null)";
-  strncpy (buf, range.first, max (buflen, range.afterLast - range.first));
-  buf[max (buflen, range.afterLast - range.first)] = '\0';
-  buf[range.afterLast - range.first] = '\0';
-  return buf;
+  return result;
 }
 
 void
-redir (curlhelp_write_curlbuf* header_buf)
+redir (const http_response *headers)
 {
   char *location = NULL;
-  curlhelp_statusline status_line;
-  struct phr_header headers[255];
-  size_t nof_headers = 255;
-  size_t msglen;
   char buf[DEFAULT_BUFFER_SIZE];
   char ipstr[INET_ADDR_MAX_SIZE];
   int new_port;
   char *new_host;
   char *new_url;
 
-  int res = phr_parse_response (header_buf->buf, header_buf->buflen,
-    &status_line.http_minor, &status_line.http_code, &status_line.msg, &msglen,
-    headers, &nof_headers, 0);
-
-  location = get_header_value (headers, nof_headers, "location");
+  location = http_header_value (headers, "location");
 
   if (verbose >= 2)
     printf(_("* Seen redirect location %s\n"), location);
@@ -1086,6 +2697,134 @@ redir (curlhelp_write_curlbuf* header_buf)
   check_http ();
 }
 
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 12, 0)
+/* The TLS and QUIC sessions libcurl exports are kept in a state file of
+ * their own, keyed by server, port, virtual host and transport, as records
+ * of the curl session key (with its '\0'), the salted hash and the session
+ * data, each behind its length. */
+typedef struct {
+  unsigned char *buf;
+  size_t len;
+  size_t size;
+} session_buffer;
+
+static void
+session_state_enable (void)
+{
+  struct sha1_ctx ctx;
+  unsigned char result[20];
+  char key[5 + 2 * sizeof (result) + 1];
+  char *id = NULL;
+  int i;
+
+  xasprintf (&id, "%s:%d:%s:%s", server_address, server_port, host_name ? host_name : "",
+             http3 ? "quic" : "tcp");
+  sha1_init_ctx (&ctx);
+  sha1_process_bytes (id, strlen (id), &ctx);
+  sha1_finish_ctx (&ctx, &result);
+  free (id);
+
+  strcpy (key, "curl_");
+  for (i = 0; i < 20; i++)
+    sprintf (&key[5 + 2 * i], "%02x", result[i]);
+  np_enable_state (key, 1);
+}
+
+static void
+session_buffer_add (session_buffer *b, const void *data, size_t len)
+{
+  uint32_t field_len = (uint32_t) len;
+
+  if (b->len + sizeof (field_len) + len > b->size) {
+    b->size = (b->len + sizeof (field_len) + len) * 2;
+    if ((b->buf = realloc (b->buf, b->size)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  }
+  memcpy (b->buf + b->len, &field_len, sizeof (field_len));
+  b->len += sizeof (field_len);
+  if (len)
+    memcpy (b->buf + b->len, data, len);
+  b->len += len;
+}
+
+static CURLcode
+session_export_callback (CURL *h, void *userptr, const char *session_key,
+                         const unsigned char *shmac, size_t shmac_len,
+                         const unsigned char *sdata, size_t sdata_len,
+                         curl_off_t valid_until, int ietf_tls_id, const char *alpn,
+                         size_t earlydata_max)
+{
+  session_buffer *b = userptr;
+
+  if (verbose >= 2)
+    printf ("* keeping %lu bytes of TLS session, %s, early data up to %lu bytes\n",
+            (unsigned long) sdata_len, alpn ? alpn : "no ALPN", (unsigned long) earlydata_max);
+  session_buffer_add (b, session_key ? session_key : "", session_key ? strlen (session_key) + 1 : 0);
+  session_buffer_add (b, shmac, shmac_len);
+  session_buffer_add (b, sdata, sdata_len);
+  return CURLE_OK;
+}
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 12, 0) */
+
+/* hand the sessions of the last run back to libcurl */
+void
+session_cache_load (CURL *h)
+{
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 12, 0)
+  state_data *data;
+  const unsigned char *p, *end, *field[3];
+  uint32_t len[3];
+  CURLcode res;
+  int i;
+
+  session_state_enable ();
+  data = np_state_read ();
+  if (data == NULL || data->data == NULL)
+    return;
+
+  p = data->data;
+  end = p + data->length;
+  while (p < end) {
+    for (i = 0; i < 3; i++) {
+      if ((size_t)(end - p) < sizeof (len[i]))
+        return;
+      memcpy (&len[i], p, sizeof (len[i]));
+      p += sizeof (len[i]);
+      if ((size_t)(end - p) < len[i])
+        return;
+      field[i] = p;
+      p += len[i];
+    }
+    /* a damaged file is simply not used */
+    if (len[0] && field[0][len[0] - 1] != '\0')
+      return;
+    res = curl_easy_ssls_import (h, len[0] ? (const char *) field[0] : NULL,
+                                 field[1], len[1], field[2], len[2]);
+    if (verbose >= 2)
+      printf ("* offering %lu bytes of TLS session: %s\n", (unsigned long) len[2], curl_easy_strerror (res));
+  }
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 12, 0) */
+}
+
+/* keep the sessions of this run for the next one */
+void
+session_cache_save (CURL *h)
+{
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 12, 0)
+  session_buffer b = { NULL, 0, 0 };
+
+  CURLcode res;
+
+  /* a TLS backend without session export tells so here */
+  res = curl_easy_ssls_export (h, session_export_callback, &b);
+  if (res == CURLE_OK && b.len > 0)
+    np_state_write_binary (0, b.buf, b.len);
+  else if (verbose >= 2)
+    printf ("* no TLS session kept: %s\n", res == CURLE_OK ? "none exported" : curl_easy_strerror (res));
+  free (b.buf);
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(8, 12, 0) */
+}
+
 /* check whether a file exists */
 void
 test_file (char *path)
@@ -1095,6 +2834,63 @@ test_file (char *path)
   usage2 (_("file does not exist or is not readable"), path);
 }
 
+/* --assets-warning, --assets-critical: BYTES,REQUESTS,TIME,SLOWEST, any of
+ * them may be empty or left out */
+static void
+assets_split (char *list, char **fields)
+{
+  char *arg = list;
+  int i;
+
+  for (i = 0; list && i < ASSETS_FIELDS; i++) {
+    fields[i] = list;
+    if ((list = strchr (list, ',')) != NULL)
+      *list++ = '\0';
+    if (*fields[i] == '\0')
+      fields[i] = NULL;
+  }
+  if (list)
+    usage2 (_("Asset thresholds are BYTES,REQUESTS,TIME,SLOWEST"), arg);
+}
+
+/* --throughput=SIZE[,CHUNKS], SIZE in bytes or with a K, M or G suffix */
+static void
+throughput_parse (const char *arg)
+{
+  char *end;
+  long long chunks;
+
+  throughput_size = np_strtoull (arg, &end);
+  if (end == arg)
+    usage2 (_("Throughput chunk size must be a positive integer"), arg);
+  switch (*end) {
+  case 'k': case 'K':
+    throughput_size <<= 10;
+    end++;
+    break;
+  case 'm': case 'M':
+    throughput_size <<= 20;
+    end++;
+    break;
+  case 'g': case 'G':
+    throughput_size <<= 30;
+    end++;
+    break;
+  }
+  if (throughput_size == 0 || throughput_size > MAX_THROUGHPUT_SIZE)
+    usage2 (_("Throughput chunk size must be between 1 byte and 1G"), arg);
+
+  throughput_chunks = 1;
+  if (*end == ',') {
+    chunks = np_strtoll (end + 1, &end);
+    if (chunks < 1 || chunks > MAX_THROUGHPUT_CHUNKS)
+      usage2 (_("Number of throughput chunks must be between 1 and 64"), arg);
+    throughput_chunks = (int)chunks;
+  }
+  if (*end != '\0')
+    usage2 (_("Throughput is SIZE[,CHUNKS]"), arg);
+}
+
 int
 process_arguments (int argc, char **argv)
 {
@@ -1106,7 +2902,30 @@ process_arguments (int argc, char **argv)
     INVERT_REGEX = CHAR_MAX + 1,
     SNI_OPTION,
     CA_CERT_OPTION,
-    HTTP_VERSION_OPTION
+    HTTP_VERSION_OPTION,
+    BATCH_OPTION,
+    BATCH_CONNECTIONS_OPTION,
+    BATCH_FRAMES_OPTION,
+    SHARD_OPTION,
+    DUAL_STACK_OPTION,
+    BACKENDS_OPTION,
+    STREAM_BODY_OPTION,
+    COMPRESSED_OPTION,
+    POST_FILE_OPTION,
+    PUT_FILE_OPTION,
+    CERT_CACHE_OPTION,
+    HTTP3_OPTION,
+    SSL_SESSION_CACHE_OPTION,
+    JSON_OPTION,
+    METRIC_OPTION,
+    OCSP_OPTION,
+    ASSETS_OPTION,
+    ASSETS_WARNING_OPTION,
+    ASSETS_CRITICAL_OPTION,
+    THROUGHPUT_OPTION,
+    THROUGHPUT_WARNING_OPTION,
+    THROUGHPUT_CRITICAL_OPTION,
+    TLS_OFFLOAD_OPTION
   };
 
   int option = 0;
@@ -1118,6 +2937,8 @@ process_arguments (int argc, char **argv)
     {"ssl", optional_argument, 0, 'S'},
     {"sni", no_argument, 0, SNI_OPTION},
     {"post", required_argument, 0, 'P'},
+    {"post-file", required_argument, 0, POST_FILE_OPTION},
+    {"put-file", required_argument, 0, PUT_FILE_OPTION},
     {"method", required_argument, 0, 'j'},
     {"IP-address", required_argument, 0, 'I'},
     {"url", required_argument, 0, 'u'},
@@ -1147,6 +2968,27 @@ process_arguments (int argc, char **argv)
     {"use-ipv6", no_argument, 0, '6'},
     {"extended-perfdata", no_argument, 0, 'E'},
     {"http-version", required_argument, 0, HTTP_VERSION_OPTION},
+    {"batch", required_argument, 0, BATCH_OPTION},
+    {"batch-connections", required_argument, 0, BATCH_CONNECTIONS_OPTION},
+    {"batch-frames", required_argument, 0, BATCH_FRAMES_OPTION},
+    {"shard", required_argument, 0, SHARD_OPTION},
+    {"dual-stack", no_argument, 0, DUAL_STACK_OPTION},
+    {"backends", optional_argument, 0, BACKENDS_OPTION},
+    {"assets", no_argument, 0, ASSETS_OPTION},
+    {"assets-warning", required_argument, 0, ASSETS_WARNING_OPTION},
+    {"assets-critical", required_argument, 0, ASSETS_CRITICAL_OPTION},
+    {"throughput", required_argument, 0, THROUGHPUT_OPTION},
+    {"throughput-warning", required_argument, 0, THROUGHPUT_WARNING_OPTION},
+    {"throughput-critical", required_argument, 0, THROUGHPUT_CRITICAL_OPTION},
+    {"stream-body", no_argument, 0, STREAM_BODY_OPTION},
+    {"compressed", no_argument, 0, COMPRESSED_OPTION},
+    {"json", required_argument, 0, JSON_OPTION},
+    {"metric", required_argument, 0, METRIC_OPTION},
+    {"ocsp", no_argument, 0, OCSP_OPTION},
+    {"cert-cache", required_argument, 0, CERT_CACHE_OPTION},
+    {"tls-offload", required_argument, 0, TLS_OFFLOAD_OPTION},
+    {"http3", no_argument, 0, HTTP3_OPTION},
+    {"ssl-session-cache", no_argument, 0, SSL_SESSION_CACHE_OPTION},
     {0, 0, 0, 0}
   };
 
@@ -1248,6 +3090,12 @@ process_arguments (int argc, char **argv)
       if (! http_method)
         http_method = strdup("POST");
       break;
+    case POST_FILE_OPTION: /* the request body is the file, never read in */
+    case PUT_FILE_OPTION:
+      http_body_file = optarg;
+      if (! http_method)
+        http_method = strdup (c == PUT_FILE_OPTION ? "PUT" : "POST");
+      break;
     case 'j': /* Set HTTP method */
       if (http_method)
         free(http_method);
@@ -1425,9 +3273,11 @@ process_arguments (int argc, char **argv)
       strncpy (header_expect, optarg, MAX_INPUT_BUFFER - 1);
       header_expect[MAX_INPUT_BUFFER - 1] = 0;
       break;
-    case 's': /* string or substring */
-      strncpy (string_expect, optarg, MAX_INPUT_BUFFER - 1);
-      string_expect[MAX_INPUT_BUFFER - 1] = 0;
+    case 's': /* string or substring, all of them have to be found */
+      string_expect = realloc (string_expect, sizeof (char *) * (++string_expect_count));
+      if (string_expect == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for string_expect\n"));
+      string_expect[string_expect_count - 1] = optarg;
       break;
     case 'e': /* string or substring */
       strncpy (server_expect, optarg, MAX_INPUT_BUFFER - 1);
@@ -1445,9 +3295,9 @@ process_arguments (int argc, char **argv)
     case 'r': /* regex */
       strncpy (regexp, optarg, MAX_RE_SIZE - 1);
       regexp[MAX_RE_SIZE - 1] = 0;
-      errcode = regcomp (&preg, regexp, cflags);
+      errcode = np_regcomp (&preg, regexp, cflags);
       if (errcode != 0) {
-        (void) regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+        (void) np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
         printf (_("Could Not Compile Regular Expression: %s"), errbuf);
         return ERROR;
       }
@@ -1525,11 +3375,116 @@ process_arguments (int argc, char **argv)
 #else
         curl_http_version = CURL_HTTP_VERSION_NONE;
 #endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 33, 0) */
+      } else if (strcmp (optarg, "3") == 0) {
+        http3 = TRUE;
       } else {
         fprintf (stderr, "unkown http-version parameter: %s\n", optarg);
         exit (STATE_WARNING);
       }
       break;
+    case BATCH_OPTION:
+      batch_file = optarg;
+      break;
+    case SHARD_OPTION:
+      if (np_targets_shard (optarg) == ERROR)
+        usage2 (_("Shard must be I/N, I from 1 to N"), optarg);
+      batch_sharded = TRUE;
+      break;
+    case BATCH_CONNECTIONS_OPTION:
+      if (!is_intpos (optarg))
+        usage2 (_("Number of batch connections must be a positive integer"), optarg);
+      batch_connections = strtol (optarg, NULL, 10);
+      break;
+    case BATCH_FRAMES_OPTION:
+      batch_frames = optarg;
+      break;
+    case DUAL_STACK_OPTION:
+#if defined (USE_IPV6) && defined (LIBCURL_FEATURE_IPV6)
+      dual_stack = TRUE;
+#else
+      usage4 (_("IPv6 support not available"));
+#endif
+      break;
+    case BACKENDS_OPTION:
+      backends = TRUE;
+      backends_list = optarg;
+      break;
+    case ASSETS_OPTION:
+      page_assets = TRUE;
+      break;
+    case ASSETS_WARNING_OPTION:
+      assets_warning = strdup (optarg);
+      break;
+    case ASSETS_CRITICAL_OPTION:
+      assets_critical = strdup (optarg);
+      break;
+    case THROUGHPUT_OPTION:
+      throughput_parse (optarg);
+      break;
+    case THROUGHPUT_WARNING_OPTION:
+      throughput_warning = optarg;
+      break;
+    case THROUGHPUT_CRITICAL_OPTION:
+      throughput_critical = optarg;
+      break;
+    case STREAM_BODY_OPTION:
+      stream_body = TRUE;
+      break;
+    case COMPRESSED_OPTION:
+      compressed = TRUE;
+      break;
+    case JSON_OPTION:
+      json_assert = realloc (json_assert, sizeof (json_assertion) * (++json_assert_count));
+      if (json_assert == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for json_assert\n"));
+      memset (&json_assert[json_assert_count - 1], 0, sizeof (json_assertion));
+      parse_json_assertion (&json_assert[json_assert_count - 1], optarg);
+      /* the document is parsed as it arrives, never buffered */
+      stream_body = TRUE;
+      break;
+    case METRIC_OPTION:
+      metric_assert = realloc (metric_assert, sizeof (metric_assertion) * (++metric_assert_count));
+      if (metric_assert == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for metric_assert\n"));
+      memset (&metric_assert[metric_assert_count - 1], 0, sizeof (metric_assertion));
+      parse_metric_assertion (&metric_assert[metric_assert_count - 1], optarg);
+      stream_body = TRUE;
+      break;
+    case HTTP3_OPTION:
+      http3 = TRUE;
+      break;
+    case SSL_SESSION_CACHE_OPTION:
+      ssl_session_cache = TRUE;
+      break;
+    case CERT_CACHE_OPTION:
+#if defined(HAVE_SSL) && defined(USE_OPENSSL)
+      if (!is_intpos (optarg))
+        usage2 (_("Certificate cache time must be a positive integer"), optarg);
+      cert_cache_ttl = atoi (optarg);
+#else
+      usage4 (_("Invalid option - certificates are not checked with OpenSSL"));
+#endif
+      break;
+    case TLS_OFFLOAD_OPTION:
+      /* libcurl cannot let a handshake wait as an async job, so the device
+       * only takes the work off the CPU, the handshake waits for it */
+#if defined(HAVE_SSL) && defined(USE_OPENSSL)
+      if (np_net_ssl_offload (optarg) != OK)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Cannot load the crypto provider or engine %s\n"), optarg);
+#else
+      usage4 (_("Invalid option - the crypto is only offloaded with OpenSSL"));
+#endif
+      break;
+    case OCSP_OPTION:
+#if defined(HAVE_SSL) && defined(USE_OPENSSL)
+      check_ocsp = TRUE;
+      use_ssl = TRUE;
+      if (specify_port == FALSE)
+        server_port = HTTPS_PORT;
+#else
+      usage4 (_("Invalid option - certificates are not checked with OpenSSL"));
+#endif
+      break;
     case '?':
       /* print short usage statement if args not parsable */
       usage5 ();
@@ -1545,7 +3500,7 @@ process_arguments (int argc, char **argv)
   if (host_name == NULL && c < argc)
     host_name = strdup (argv[c++]);
 
-  if (server_address == NULL) {
+  if (server_address == NULL && batch_file == NULL) {
     if (host_name == NULL)
       usage4 (_("You must specify a server address or host name"));
     else
@@ -1562,9 +3517,126 @@ process_arguments (int argc, char **argv)
   if (http_method == NULL)
     http_method = strdup ("GET");
 
+  if (http_body_file) {
+    if (http_post_data)
+      usage4 (_("-P cannot be used with --post-file or --put-file"));
+    if (strcmp (http_method, "POST") && strcmp (http_method, "PUT"))
+      usage4 (_("--post-file and --put-file need a POST or PUT request"));
+    if (batch_file || dual_stack || backends)
+      usage4 (_("--post-file and --put-file cannot be used with --batch, --dual-stack or --backends"));
+  }
+
   if (client_cert && !client_privkey)
     usage4 (_("If you use a client certificate you must also specify a private key file"));
 
+  if (batch_frames && !batch_file)
+    usage4 (_("--batch-frames needs --batch"));
+  if (batch_sharded && !batch_file)
+    usage4 (_("--shard needs --batch"));
+  if (batch_file) {
+#if LIBCURL_VERSION_NUM < MAKE_LIBCURL_VERSION(7, 28, 0)
+    usage4 (_("--batch needs libcurl 7.28.0 or newer"));
+#endif
+    if (check_cert)
+      usage4 (_("Certificate checks (-C) are not supported with --batch"));
+    if (!strcmp (http_method, "PUT") || !strcmp (http_method, "CONNECT"))
+      usage4 (_("PUT and CONNECT requests are not supported with --batch"));
+    if (json_assert_count || metric_assert_count)
+      usage4 (_("--json and --metric cannot be used with --batch"));
+    if (check_ocsp)
+      usage4 (_("--ocsp cannot be used with --batch"));
+    if (stream_body)
+      usage4 (_("--stream-body cannot be used with --batch"));
+    if (ssl_session_cache)
+      usage4 (_("--ssl-session-cache cannot be used with --batch"));
+  }
+  /* both requests are set up and judged like --batch URLs */
+  if (dual_stack) {
+#if LIBCURL_VERSION_NUM < MAKE_LIBCURL_VERSION(7, 28, 0)
+    usage4 (_("--dual-stack needs libcurl 7.28.0 or newer"));
+#endif
+    if (batch_file)
+      usage4 (_("--dual-stack cannot be used with --batch"));
+    if (address_family != AF_UNSPEC)
+      usage4 (_("-4 and -6 cannot be used with --dual-stack"));
+    if (check_cert)
+      usage4 (_("Certificate checks (-C) are not supported with --dual-stack"));
+    if (!strcmp (http_method, "PUT") || !strcmp (http_method, "CONNECT") || strstr (server_url, "http") == server_url)
+      usage4 (_("PUT, CONNECT and proxy requests are not supported with --dual-stack"));
+    if (json_assert_count || metric_assert_count || check_ocsp || stream_body || ssl_session_cache)
+      usage4 (_("--json, --metric, --ocsp, --stream-body and --ssl-session-cache cannot be used with --dual-stack"));
+  }
+  /* each backend is set up and judged like a --batch URL */
+  if (backends) {
+#if LIBCURL_VERSION_NUM < MAKE_LIBCURL_VERSION(7, 49, 0)
+    usage4 (_("--backends needs libcurl 7.49.0 or newer"));
+#endif
+    if (batch_file || dual_stack)
+      usage4 (_("--backends cannot be used with --batch or --dual-stack"));
+    if (check_cert)
+      usage4 (_("Certificate checks (-C) are not supported with --backends"));
+    if (!strcmp (http_method, "PUT") || !strcmp (http_method, "CONNECT") || strstr (server_url, "http") == server_url)
+      usage4 (_("PUT, CONNECT and proxy requests are not supported with --backends"));
+    if (json_assert_count || metric_assert_count || check_ocsp || stream_body || ssl_session_cache)
+      usage4 (_("--json, --metric, --ocsp, --stream-body and --ssl-session-cache cannot be used with --backends"));
+  }
+  /* the page is fetched and judged as usual, then what it links to */
+  if (page_assets) {
+    char *warn[ASSETS_FIELDS] = { NULL };
+    char *crit[ASSETS_FIELDS] = { NULL };
+#if LIBCURL_VERSION_NUM < MAKE_LIBCURL_VERSION(7, 28, 0)
+    usage4 (_("--assets needs libcurl 7.28.0 or newer"));
+#endif
+    if (batch_file || dual_stack || backends)
+      usage4 (_("--assets cannot be used with --batch, --dual-stack or --backends"));
+    if (strcmp (http_method, "GET") || no_body || strstr (server_url, "http") == server_url)
+      usage4 (_("--assets needs the body of a GET request that does not go through a proxy"));
+    if (check_cert || stream_body)
+      usage4 (_("-C, --json and --stream-body cannot be used with --assets"));
+    assets_split (assets_warning, warn);
+    assets_split (assets_critical, crit);
+    for (c = 0; c < ASSETS_FIELDS; c++)
+      set_thresholds (&assets_thlds[c], warn[c], crit[c]);
+  } else if (assets_warning || assets_critical)
+    usage4 (_("--assets-warning and --assets-critical need --assets"));
+  /* the chunks are set up like --batch URLs */
+  if (throughput_size) {
+#if LIBCURL_VERSION_NUM < MAKE_LIBCURL_VERSION(7, 28, 0)
+    usage4 (_("--throughput needs libcurl 7.28.0 or newer"));
+#endif
+    if (batch_file || dual_stack || backends || page_assets)
+      usage4 (_("--throughput cannot be used with --batch, --dual-stack, --backends or --assets"));
+    if (strcmp (http_method, "GET") || no_body || strstr (server_url, "http") == server_url)
+      usage4 (_("--throughput needs a GET request that does not go through a proxy"));
+    if (check_cert || stream_body || compressed || check_ocsp || ssl_session_cache)
+      usage4 (_("-C, --json, --stream-body, --compressed, --ocsp and --ssl-session-cache cannot be used with --throughput"));
+    set_thresholds (&throughput_thlds, throughput_warning, throughput_critical);
+  } else if (throughput_warning || throughput_critical)
+    usage4 (_("--throughput-warning and --throughput-critical need --throughput"));
+
+  /* HTTP/3 only, a check falling back to TCP would not tell that QUIC is broken */
+  if (http3) {
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 66, 0)
+    if (!(curl_version_info (CURLVERSION_NOW)->features & CURL_VERSION_HTTP3))
+      usage4 (_("HTTP/3 is not supported by this libcurl"));
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 88, 0)
+    curl_http_version = CURL_HTTP_VERSION_3ONLY;
+#else
+    curl_http_version = CURL_HTTP_VERSION_3;
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 88, 0) */
+    use_ssl = TRUE;
+    if (specify_port == FALSE)
+      server_port = HTTPS_PORT;
+#else
+    usage4 (_("--http3 needs libcurl 7.66.0 or newer"));
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 66, 0) */
+  }
+
+#if LIBCURL_VERSION_NUM < MAKE_LIBCURL_VERSION(8, 12, 0)
+  if (ssl_session_cache)
+    usage4 (_("--ssl-session-cache needs libcurl 8.12.0 or newer"));
+#endif /* LIBCURL_VERSION_NUM < MAKE_LIBCURL_VERSION(8, 12, 0) */
+
   if (virtual_port == 0)
     virtual_port = server_port;
   else {
@@ -1573,6 +3645,44 @@ process_arguments (int argc, char **argv)
         server_port = virtual_port;
   }
 
+  /* all the -s strings are looked for in one pass over the body */
+  if (string_expect_count) {
+    string_matcher = np_matcher_new (string_expect, string_expect_count);
+    if (string_matcher == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for string_matcher\n"));
+  }
+
+  /* and all the --json paths in one pass over the document */
+  if (json_assert_count) {
+    char **paths = malloc (sizeof (char *) * json_assert_count);
+    if (paths == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for json_parser\n"));
+    for (c = 0; c < json_assert_count; c++)
+      paths[c] = json_assert[c].path;
+    json_parser = np_json_new (paths, json_assert_count);
+    if (json_parser == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for json_parser\n"));
+    free (paths);
+  }
+
+  /* and all the --metric selectors in one pass over the exposition */
+  if (metric_assert_count) {
+    char **selectors = malloc (sizeof (char *) * metric_assert_count);
+    int bad;
+    if (selectors == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for metrics_parser\n"));
+    for (c = 0; c < metric_assert_count; c++)
+      selectors[c] = metric_assert[c].selector;
+    metrics_parser = np_openmetrics_new (selectors, metric_assert_count, &bad);
+    if (metrics_parser == NULL && bad >= 0)
+      usage2 (_("Invalid --metric selector"), metric_assert[bad].selector);
+    if (metrics_parser == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for metrics_parser\n"));
+    for (c = 0; c < metric_assert_count; c++)
+      metrics_parser->selectors[c].thlds = metric_assert[c].thlds;
+    free (selectors);
+  }
+
   return TRUE;
 }
 
@@ -1609,6 +3719,11 @@ char *perfd_time_transfer (double elapsed_time_transfer)
   return fperfdata ("time_transfer", elapsed_time_transfer, "s", FALSE, 0, FALSE, 0, FALSE, 0, TRUE, socket_timeout);
 }
 
+char *perfd_time_quic (double elapsed_time_quic)
+{
+  return fperfdata ("time_quic", elapsed_time_quic, "s", FALSE, 0, FALSE, 0, FALSE, 0, TRUE, socket_timeout);
+}
+
 char *perfd_size (int page_len)
 {
   return perfdata ("size", page_len, "B",
@@ -1617,6 +3732,12 @@ char *perfd_size (int page_len)
             TRUE, 0, FALSE, 0);
 }
 
+char *perfd_size_wire (double wire_len)
+{
+  return perfdata ("size_wire", (long int)wire_len, "B",
+            FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+}
+
 void
 print_help (void)
 {
@@ -1669,9 +3790,26 @@ print_help (void)
 #else
   printf ("    %s\n", _("Note: SNI is not supported in libcurl before 7.18.1"));
 #endif
+  printf (" %s\n", "--ssl-session-cache");
+  printf ("    %s\n", _("Keep the TLS sessions in the state directory and resume them in the next"));
+  printf ("    %s\n", _("runs. GET and HEAD requests are sent as early data (0-RTT) where the"));
+  printf ("    %s\n", _("server allows it, early_data in the performance data tells how much was"));
+  printf ("    %s\n", _("sent. Needs libcurl 8.12.0 or newer"));
   printf (" %s\n", "-C, --certificate=INTEGER[,INTEGER]");
   printf ("    %s\n", _("Minimum number of days a certificate has to be valid. Port defaults to 443"));
   printf ("    %s\n", _("(when this option is used the URL is not checked.)"));
+  printf (" %s\n", "--cert-cache=SECONDS");
+  printf ("    %s\n", _("With -C, keep the expiry of the certificate in the state directory for"));
+  printf ("    %s\n", _("SECONDS, keyed by its fingerprint, and only fingerprint it until then"));
+  printf (" %s\n", "--ocsp");
+  printf ("    %s\n", _("Ask for the OCSP response stapled to the handshake and go critical if the"));
+  printf ("    %s\n", _("certificate is revoked or the response does not verify, warning if there"));
+  printf ("    %s\n", _("is none. The verdict is kept in the state directory until the response's"));
+  printf ("    %s\n", _("nextUpdate. Needs libcurl with OpenSSL"));
+  printf (" %s\n", "--tls-offload=NAME");
+  printf ("    %s\n", _("Hand the crypto of the handshakes to an offload device such as QAT, through"));
+  printf ("    %s\n", _("the OpenSSL provider (engine before OpenSSL 3) NAME. Needs libcurl with"));
+  printf ("    %s\n", _("OpenSSL"));
   printf (" %s\n", "-J, --client-cert=FILE");
   printf ("   %s\n", _("Name of file that contains the client certificate (PEM format)"));
   printf ("   %s\n", _("to be used in establishing the SSL session"));
@@ -1690,11 +3828,17 @@ print_help (void)
   printf (" %s\n", "-d, --header-string=STRING");
   printf ("    %s\n", _("String to expect in the response headers"));
   printf (" %s\n", "-s, --string=STRING");
-  printf ("    %s\n", _("String to expect in the content"));
+  printf ("    %s\n", _("String to expect in the content, may be given more than once to expect all"));
+  printf ("    %s\n", _("of them, which are then looked for in a single pass over the body"));
   printf (" %s\n", "-u, --url=PATH");
   printf ("    %s\n", _("URL to GET or POST (default: /)"));
   printf (" %s\n", "-P, --post=STRING");
   printf ("    %s\n", _("URL encoded http POST data"));
+  printf (" %s\n", "--post-file=FILE");
+  printf (" %s\n", "--put-file=FILE");
+  printf ("    %s\n", _("Send the contents of FILE as the body of a POST or PUT request (the method"));
+  printf ("    %s\n", _("unless -j gives another one). The file is mapped, not read into memory,"));
+  printf ("    %s\n", _("and what was sent of it is let go again, so large bodies cost no memory"));
   printf (" %s\n", "-j, --method=STRING  (for example: HEAD, OPTIONS, TRACE, PUT, DELETE, CONNECT)");
   printf ("    %s\n", _("Set HTTP method."));
   printf (" %s\n", "-N, --no-body");
@@ -1732,10 +3876,87 @@ print_help (void)
   printf ("    %s\n", _("curl uses CURL_FOLLOWLOCATION built into libcurl."));
   printf (" %s\n", "-m, --pagesize=INTEGER<:INTEGER>");
   printf ("    %s\n", _("Minimum page size required (bytes) : Maximum page size required (bytes)"));
+  printf (" %s\n", "--stream-body");
+  printf ("    %s\n", _("Match -s and -r against the body while it is received instead of buffering"));
+  printf ("    %s\n", _("it, and stop the transfer as soon as the result is known. Only the last"));
+  printf ("    %s\n", _("8 KB are kept, so a longer regular expression match may be missed"));
+  printf (" %s\n", "--compressed");
+  printf ("    %s\n", _("Ask for the body in any encoding libcurl can decode (gzip, deflate, br,"));
+  printf ("    %s\n", _("zstd), decoded while it arrives. The checks and 'size' see the decoded body,"));
+  printf ("    %s\n", _("'size_wire' is what was transferred"));
+  printf (" %s\n", "--json=PATH[=VALUE|,WARN,CRIT]");
+  printf ("    %s\n", _("The body is a JSON document with a value at PATH, like checks.db.status or"));
+  printf ("    %s\n", _("$.items[0].name, which equals VALUE or is a number within the WARN and CRIT"));
+  printf ("    %s\n", _("threshold ranges, either of which may be empty. Can be given more than once."));
+  printf ("    %s\n", _("The document is parsed while it is received as with --stream-body, and the"));
+  printf ("    %s\n", _("transfer stops once every path was seen"));
+  printf (" %s\n", "--metric=SELECTOR[,WARN,CRIT]");
+  printf ("    %s\n", _("The body is a Prometheus or OpenMetrics text exposition with a sample that"));
+  printf ("    %s\n", _("matches SELECTOR, like up or http_requests_total{code=\"500\",job!=\"test\"}."));
+  printf ("    %s\n", _("Every matching sample must be within the WARN and CRIT threshold ranges,"));
+  printf ("    %s\n", _("either of which may be empty, the worst one is reported and the first"));
+  printf ("    %s%d%s\n", _("ones, at most "), NP_OM_MAX_SAMPLES, _(", go into the performance data. Can be given more"));
+  printf ("    %s\n", _("than once. The exposition is parsed while it is received as with"));
+  printf ("    %s\n", _("--stream-body, lines of other metrics are skipped by their name alone"));
   printf ("\n");
   printf (" %s\n", "--http-version=VERSION");
   printf ("    %s\n", _("Connect via specific HTTP protocol."));
-  printf ("    %s\n", _("1.0 = HTTP/1.0, 1.1 = HTTP/1.1, 2.0 = HTTP/2 (HTTP/2 will fail without -S)"));
+  printf ("    %s\n", _("1.0 = HTTP/1.0, 1.1 = HTTP/1.1, 2.0 = HTTP/2 (HTTP/2 will fail without -S),"));
+  printf ("    %s\n", _("3 = HTTP/3, the same as --http3"));
+  printf (" %s\n", "--http3");
+  printf ("    %s\n", _("Connect via HTTP/3 over QUIC only, implies -S. The QUIC handshake is"));
+  printf ("    %s\n", _("reported as time_quic, the wait for the response as time_firstbyte"));
+  printf (" %s\n", "--batch=FILE");
+  printf ("    %s\n", _("Check every URL listed in FILE (one per line, - for stdin, unix:PATH or"));
+  printf ("    %s\n", _("tcp:HOST:PORT for a socket) at once. Requests share connections, DNS and"));
+  printf ("    %s\n", _("TLS session caches and use HTTP/2 multiplexing where the server supports"));
+  printf ("    %s\n", _("it. -H, -I, -p, -u and -S are ignored, redirects are followed by libcurl"));
+  printf ("    %s\n", _("and -C, PUT and CONNECT cannot be used"));
+  printf (" %s\n", "--shard=I/N");
+  printf ("    %s\n", _("Check only the URLs of shard I of N, so that N pollers given the same list"));
+  printf ("    %s\n", _("check each URL once"));
+  printf (" %s\n", "--batch-connections=INTEGER");
+  printf ("    %s\n", _("Maximum number of connections opened in batch mode"));
+  printf ("    %s%d)\n", _("(default: "), DEFAULT_BATCH_CONNECTIONS);
+  printf (" %s\n", "--batch-frames=FILE");
+  printf ("    %s\n", _("Also write the result of every URL and then of the whole batch to FILE as"));
+  printf ("    %s\n", _("binary records (see lib/utils_frame.h), so that they are read without"));
+  printf ("    %s\n", _("parsing the text"));
+  printf (" %s\n", "--dual-stack");
+  printf ("    %s\n", _("Resolve the host once and send the request over IPv4 and IPv6 at the same"));
+  printf ("    %s\n", _("time. Each family is judged on its own and the worse state is returned, a"));
+  printf ("    %s\n", _("family without an address is critical. -C, PUT, CONNECT, --json and"));
+  printf ("    %s\n", _("--stream-body cannot be used, redirects are followed by libcurl"));
+  printf (" %s\n", "--backends[=LIST]");
+  printf ("    %s\n", _("Send the request to every address the host resolves to (of the family of"));
+  printf ("    %s\n", _("-4 or -6 if given), or to each server of the comma separated LIST, all at"));
+  printf ("    %s\n", _("once over up to --batch-connections connections. They all get the same"));
+  printf ("    %s\n", _("Host header and SNI, each is judged on its own and the worst state is"));
+  printf ("    %s\n", _("returned. The same options as with --dual-stack cannot be used"));
+  printf (" %s\n", "--assets");
+  printf ("    %s\n", _("Then fetch the scripts, stylesheets and images of the same origin (scheme,"));
+  printf ("    %s%d%s\n", _("host and port) that the page links to, at most "), MAX_PAGE_ASSETS, _(", all at once"));
+  printf ("    %s%d%s\n", _("over the connection of the page and up to "), MAX_ASSET_CONNECTIONS, _(" in all, multiplexed"));
+  printf ("    %s\n", _("with HTTP/2 where the server supports it. Reports the bytes and the number"));
+  printf ("    %s\n", _("of requests of the page and its assets, the critical path (the page, then"));
+  printf ("    %s\n", _("the assets until the last one arrived) and the slowest asset. An asset that"));
+  printf ("    %s\n", _("fails or gets a 4xx or 5xx answer is a warning. Needs a GET request, -C,"));
+  printf ("    %s\n", _("--json and --stream-body cannot be used"));
+  printf (" %s\n", "--assets-warning=BYTES,REQUESTS,TIME,SLOWEST");
+  printf (" %s\n", "--assets-critical=BYTES,REQUESTS,TIME,SLOWEST");
+  printf ("    %s\n", _("Threshold ranges for the bytes, the requests, the critical path and the"));
+  printf ("    %s\n", _("slowest asset in seconds of --assets, each of which may be empty"));
+  printf (" %s\n", "--throughput=SIZE[,CHUNKS]");
+  printf ("    %s\n", _("Measure the throughput instead: ask for CHUNKS (default 1, at most 64) byte"));
+  printf ("    %s\n", _("ranges of SIZE bytes (K, M and G are binary suffixes) from the start of the"));
+  printf ("    %s\n", _("file at once, each over a connection of its own. The bodies are counted and"));
+  printf ("    %s\n", _("dropped. Reports the MB/s (1000000 bytes) of all chunks from the first"));
+  printf ("    %s\n", _("request to the last byte and of each chunk. A server that does not answer"));
+  printf ("    %s\n", _("with 206 Partial Content is unknown, a chunk past the end of the file"));
+  printf ("    %s\n", _("is critical. -w and -c apply to the time of all chunks"));
+  printf (" %s\n", "--throughput-warning=RANGE");
+  printf (" %s\n", "--throughput-critical=RANGE");
+  printf ("    %s\n", _("Threshold ranges for the throughput in MB/s, like 10: for less than 10 MB/s"));
   printf ("\n");
 
   printf (UT_WARN_CRIT);
@@ -1817,10 +4038,22 @@ print_usage (void)
   printf ("       [-w <warn time>] [-c <critical time>] [-t <timeout>] [-L] [-E] [-a auth]\n");
   printf ("       [-b proxy_auth] [-f <ok|warning|critcal|follow|sticky|stickyport|curl>]\n");
   printf ("       [-e <expect>] [-d string] [-s string] [-l] [-r <regex> | -R <case-insensitive regex>]\n");
-  printf ("       [-P string] [-m <min_pg_size>:<max_pg_size>] [-4|-6] [-N] [-M <age>]\n");
+  printf ("       [-P string | --post-file=<file> | --put-file=<file>]\n");
+  printf ("       [-m <min_pg_size>:<max_pg_size>] [-4|-6] [-N] [-M <age>]\n");
   printf ("       [-A string] [-k string] [-S <version>] [--sni] [-C <warn_age>[,<crit_age>]]\n");
   printf ("       [-T <content-type>] [-j method]\n");
-  printf ("       [--http-version=<version>]\n");
+  printf ("       [--http-version=<version>] [--http3] [--ssl-session-cache] [--stream-body]\n");
+  printf ("       [--compressed]\n");
+  printf ("       [--json=<path>[=<value>|,<warn>,<crit>]] [--ocsp] [--dual-stack]\n");
+  printf ("       [--backends[=<address>,...]]\n");
+  printf ("       [--tls-offload=<name>]\n");
+  printf ("       [--metric=<selector>[,<warn>,<crit>]]\n");
+  printf ("       [--assets [--assets-warning=<bytes>,<requests>,<time>,<slowest>]\n");
+  printf ("       [--assets-critical=<bytes>,<requests>,<time>,<slowest>]]\n");
+  printf ("       [--throughput=<size>[,<chunks>] [--throughput-warning=<MB/s range>]\n");
+  printf ("       [--throughput-critical=<MB/s range>]]\n");
+  printf (" %s --batch=<file> [--batch-connections=<n>] [--batch-frames=<file>] [--shard=<i/n>] [-w <warn time>] [-c <critical time>]\n", progname);
+  printf ("       [-t <timeout>] [-e <expect>] [-d string] [-s string] [-r <regex>] [-f <ok|warning|critical|follow>]\n");
   printf ("\n");
   printf ("%s\n", _("WARNING: check_curl is experimental. Please use"));
   printf ("%s\n\n", _("check_http if you need a stable version."));
@@ -1848,7 +4081,7 @@ curlhelp_buffer_write_callback (void *buffer, size_t size, size_t nmemb, void *s
   curlhelp_write_curlbuf *buf = (curlhelp_write_curlbuf *)stream;
 
   while (buf->bufsize < buf->buflen + size * nmemb + 1) {
-    buf->bufsize *= buf->bufsize * 2;
+    buf->bufsize *= 2;
     buf->buf = (char *)realloc (buf->buf, buf->bufsize);
     if (buf->buf == NULL) return -1;
   }
@@ -1860,6 +4093,27 @@ curlhelp_buffer_write_callback (void *buffer, size_t size, size_t nmemb, void *s
   return (int)(size * nmemb);
 }
 
+/* for the assets of --assets, of which only the size matters */
+int
+curlhelp_count_write_callback (void *buffer, size_t size, size_t nmemb, void *stream)
+{
+  *(int *)stream += (int)(size * nmemb);
+  return (int)(size * nmemb);
+}
+
+/* for the chunks of --throughput, counted and dropped, and stopped should
+ * the server send more than was asked for */
+int
+curlhelp_range_write_callback (void *buffer, size_t size, size_t nmemb, void *stream)
+{
+  int *received = (int *)stream;
+
+  *received += (int)(size * nmemb);
+  if ((unsigned long long)*received > throughput_size)
+    return 0;
+  return (int)(size * nmemb);
+}
+
 int
 curlhelp_buffer_read_callback (void *buffer, size_t size, size_t nmemb, void *stream)
 {
@@ -1870,6 +4124,15 @@ curlhelp_buffer_read_callback (void *buffer, size_t size, size_t nmemb, void *st
   memcpy (buffer, buf->buf + buf->pos, n);
   buf->pos += n;
 
+#if defined (HAVE_MMAP) && defined (HAVE_MADVISE)
+  /* the pages of a mapped file that were sent need not stay resident */
+  if (buf->mapped && buf->pos - buf->released >= READ_RELEASE_SIZE) {
+    off_t end = buf->pos - buf->pos % READ_RELEASE_SIZE;
+    madvise (buf->buf + buf->released, end - buf->released, MADV_DONTNEED);
+    buf->released = end;
+  }
+#endif
+
   return (int)n;
 }
 
@@ -1880,6 +4143,115 @@ curlhelp_freewritebuffer (curlhelp_write_curlbuf *buf)
   buf->buf = NULL;
 }
 
+void
+curlhelp_initstreamstate (curlhelp_stream_state *state)
+{
+  memset (state, 0, sizeof (curlhelp_stream_state));
+  if (string_matcher)
+    np_matcher_reset (string_matcher);
+  if (json_parser)
+    np_json_reset (json_parser);
+  if (metrics_parser)
+    np_openmetrics_reset (metrics_parser);
+}
+
+/* the verdict is known once every configured matcher succeeded, the JSON
+ * document told all it can, the OpenMetrics exposition reached its # EOF
+ * (and enough of the body was seen for -m) or the page became too large */
+static int
+curlhelp_stream_decided (const curlhelp_stream_state *state)
+{
+  if (max_page_len > 0 && state->total > (size_t)max_page_len)
+    return TRUE;
+  if (!string_expect_count && !strlen (regexp) && !json_parser && !metrics_parser)
+    return FALSE;
+  if (string_expect_count && string_matcher->found_count < string_expect_count)
+    return FALSE;
+  if (json_parser && !np_json_done (json_parser))
+    return FALSE;
+  if (metrics_parser && !metrics_parser->eof)
+    return FALSE;
+  if (strlen (regexp) && !state->regex_found)
+    return FALSE;
+  return min_page_len <= 0 || state->total >= (size_t)min_page_len;
+}
+
+int
+curlhelp_stream_write_callback (void *buffer, size_t size, size_t nmemb, void *stream)
+{
+  curlhelp_stream_state *state = (curlhelp_stream_state *)stream;
+  size_t n = size * nmemb;
+  size_t len, keep;
+
+  state->total += n;
+
+  if (state->windowsize < state->carry + n + 1) {
+    state->windowsize = state->carry + n + 1;
+    state->window = (char *)realloc (state->window, state->windowsize);
+    if (state->window == NULL) return 0;
+  }
+  memcpy (state->window + state->carry, buffer, n);
+  len = state->carry + n;
+  state->window[len] = '\0';
+
+  /* the matcher carries over strings split across two chunks by itself */
+  if (string_expect_count)
+    np_matcher_feed (string_matcher, buffer, n);
+  if (json_parser)
+    np_json_feed (json_parser, buffer, n);
+  if (metrics_parser)
+    np_openmetrics_feed (metrics_parser, buffer, n);
+  if (strlen (regexp) && !state->regex_found && np_regexec (&preg, state->window, REGS, pmatch, 0) == 0)
+    state->regex_found = TRUE;
+
+  /* keep some of the tail for a -r match split across two chunks */
+  keep = min (len, MAX_INPUT_BUFFER - 1);
+  memmove (state->window, state->window + len - keep, keep);
+  state->carry = keep;
+
+  if (curlhelp_stream_decided (state)) {
+    state->aborted = TRUE;
+    return 0;
+  }
+
+  return (int)n;
+}
+
+void
+curlhelp_freestreamstate (curlhelp_stream_state *state)
+{
+  free (state->window);
+  state->window = NULL;
+}
+
+/* "" offers every encoding libcurl was built to decode */
+void
+curlhelp_accept_encoding (CURL *handle)
+{
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 21, 6)
+  handle_curl_option_return_code (curl_easy_setopt (handle, CURLOPT_ACCEPT_ENCODING, ""), "CURLOPT_ACCEPT_ENCODING");
+#else
+  handle_curl_option_return_code (curl_easy_setopt (handle, CURLOPT_ENCODING, ""), "CURLOPT_ENCODING");
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 21, 6) */
+}
+
+/* the body as transferred, before any decoding */
+double
+curlhelp_wire_size (CURL *handle)
+{
+#if LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 55, 0)
+  curl_off_t size = 0;
+
+  handle_curl_option_return_code (curl_easy_getinfo (handle, CURLINFO_SIZE_DOWNLOAD_T, &size), "CURLINFO_SIZE_DOWNLOAD_T");
+  return (double)size;
+#else
+  double size = 0;
+
+  handle_curl_option_return_code (curl_easy_getinfo (handle, CURLINFO_SIZE_DOWNLOAD, &size), "CURLINFO_SIZE_DOWNLOAD");
+  return size;
+#endif /* LIBCURL_VERSION_NUM >= MAKE_LIBCURL_VERSION(7, 55, 0) */
+}
+
 int
 curlhelp_initreadbuffer (curlhelp_read_curlbuf *buf, const char *data, size_t datalen)
 {
@@ -1891,9 +4263,66 @@ curlhelp_initreadbuffer (curlhelp_read_curlbuf *buf, const char *data, size_t da
   return 0;
 }
 
+/* the file of --post-file and --put-file, mapped so that no more of it
+ * than libcurl is sending is in memory, read where there is no mmap() */
+int
+curlhelp_mapreadbuffer (curlhelp_read_curlbuf *buf, const char *path)
+{
+  struct stat st;
+  int fd;
+
+  memset (buf, 0, sizeof (curlhelp_read_curlbuf));
+  if ((fd = open (path, O_RDONLY)) < 0)
+    return -1;
+  if (fstat (fd, &st) < 0) {
+    close (fd);
+    return -1;
+  }
+  if (!S_ISREG (st.st_mode)) {
+    close (fd);
+    errno = EINVAL;
+    return -1;
+  }
+  buf->buflen = (size_t)st.st_size;
+  if (buf->buflen > 0) {
+#ifdef HAVE_MMAP
+    buf->buf = mmap (NULL, buf->buflen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf->buf == MAP_FAILED) {
+      buf->buf = NULL;
+      close (fd);
+      return -1;
+    }
+    buf->mapped = TRUE;
+# ifdef HAVE_MADVISE
+    madvise (buf->buf, buf->buflen, MADV_SEQUENTIAL);
+# endif
+#else
+    size_t got = 0;
+    ssize_t n;
+    if ((buf->buf = malloc (buf->buflen)) == NULL) {
+      close (fd);
+      return -1;
+    }
+    while (got < buf->buflen && (n = read (fd, buf->buf + got, buf->buflen - got)) > 0)
+      got += n;
+    buf->buflen = got;
+#endif
+  }
+  close (fd);
+  return 0;
+}
+
 void
 curlhelp_freereadbuffer (curlhelp_read_curlbuf *buf)
 {
+#ifdef HAVE_MMAP
+  if (buf->mapped) {
+    munmap (buf->buf, buf->buflen);
+    buf->buf = NULL;
+    buf->mapped = FALSE;
+    return;
+  }
+#endif
   free (buf->buf);
   buf->buf = NULL;
 }
@@ -2032,35 +4461,192 @@ remove_newlines (char *s)
       *p = ' ';
 }
 
-char *
-get_header_value (const struct phr_header* headers, const size_t nof_headers, const char* header)
+/* the -s strings which were not found, for a message quoting them:
+ * one', 'two */
+void
+missing_strings (char *buf, size_t size)
 {
   int i;
-  for( i = 0; i < nof_headers; i++ ) {
-    if( strncasecmp( header, headers[i].name, max( headers[i].name_len, 4 ) ) == 0 ) {
-      return strndup( headers[i].value, headers[i].value_len );
+
+  buf[0] = '\0';
+  for (i = 0; i < string_expect_count; i++) {
+    if (string_matcher->found[i])
+      continue;
+    strncpy(&output_string_search[0],string_expect[i],sizeof(output_string_search));
+    if(output_string_search[sizeof(output_string_search)-1]!='\0') {
+      bcopy("...",&output_string_search[sizeof(output_string_search)-4],4);
     }
+    snprintf (buf + strlen (buf), size - strlen (buf), "%s%s", buf[0] ? "', '" : "", output_string_search);
   }
-  return NULL;
+}
+
+/* PATH, PATH=VALUE or PATH,WARN[,CRIT] */
+void
+parse_json_assertion (json_assertion *a, char *arg)
+{
+  char *p;
+
+  a->path = arg;
+  if ((p = strchr (arg, '=')) != NULL) {
+    *p = '\0';
+    a->expect = p + 1;
+  } else if ((p = strchr (arg, ',')) != NULL) {
+    *p++ = '\0';
+    a->warn = p;
+    if ((p = strchr (p, ',')) != NULL) {
+      *p++ = '\0';
+      a->crit = p;
+    }
+    if (a->warn[0] == '\0')
+      a->warn = NULL;
+    if (a->crit != NULL && a->crit[0] == '\0')
+      a->crit = NULL;
+    set_thresholds (&a->thlds, a->warn, a->crit);
+  }
+  if (a->path[0] == '\0')
+    usage2 (_("Invalid --json, no path"), arg);
+}
+
+/* the --json assertions on the document parsed while it was received,
+ * numbers with thresholds also go into the performance data */
+int
+check_json (char (*msg)[DEFAULT_BUFFER_SIZE])
+{
+  int result = STATE_OK, status, i;
+  size_t perflen;
+  double value;
+
+  if (json_parser->error) {
+    snprintf (*msg, DEFAULT_BUFFER_SIZE, _("%sinvalid JSON at byte %lu, "), *msg, (unsigned long)json_parser->error - 1);
+    return STATE_CRITICAL;
+  }
+
+  for (i = 0; i < json_assert_count; i++) {
+    json_assertion *a = &json_assert[i];
+    const char *text = json_parser->value[i];
+
+    if (json_parser->type[i] == NP_JSON_NONE) {
+      snprintf (*msg, DEFAULT_BUFFER_SIZE, _("%sjson '%s' not found, "), *msg, a->path);
+      result = STATE_CRITICAL;
+    } else if (a->expect) {
+      if (text == NULL || strcmp (text, a->expect)) {
+        snprintf (*msg, DEFAULT_BUFFER_SIZE, _("%sjson '%s' is '%s', expected '%s', "), *msg, a->path,
+                  text ? text : json_parser->type[i] == NP_JSON_OBJECT ? "{...}" : "[...]", a->expect);
+        result = STATE_CRITICAL;
+      }
+    } else if (a->thlds) {
+      if (json_parser->type[i] != NP_JSON_NUMBER) {
+        snprintf (*msg, DEFAULT_BUFFER_SIZE, _("%sjson '%s' is not a number, "), *msg, a->path);
+        result = STATE_CRITICAL;
+        continue;
+      }
+      value = strtod (text, NULL);
+      status = get_status (value, a->thlds);
+      if (status != STATE_OK) {
+        snprintf (*msg, DEFAULT_BUFFER_SIZE, _("%sjson '%s' is %s, "), *msg, a->path, text);
+        result = max_state_alt (status, result);
+      }
+      perflen = strlen (perfstring);
+      snprintf (perfstring + perflen, DEFAULT_BUFFER_SIZE - perflen, " %s",
+                sperfdata (a->path, value, "", a->warn, a->crit, FALSE, 0, FALSE, 0));
+    }
+  }
+
+  return result;
+}
+
+/* SELECTOR or SELECTOR,WARN[,CRIT], a comma between the braces of the
+ * selector being part of it */
+void
+parse_metric_assertion (metric_assertion *a, char *arg)
+{
+  char *p;
+  int quoted = FALSE, braces = 0;
+
+  a->selector = arg;
+  for (p = arg; *p; p++) {
+    if (quoted) {
+      if (*p == '\\' && p[1] != '\0')
+        p++;
+      else if (*p == '"')
+        quoted = FALSE;
+    } else if (*p == '"')
+      quoted = TRUE;
+    else if (*p == '{')
+      braces++;
+    else if (*p == '}')
+      braces--;
+    else if (*p == ',' && braces == 0)
+      break;
+  }
+  if (*p == ',') {
+    *p++ = '\0';
+    a->warn = p;
+    if ((p = strchr (p, ',')) != NULL) {
+      *p++ = '\0';
+      a->crit = p;
+    }
+    if (a->warn[0] == '\0')
+      a->warn = NULL;
+    if (a->crit != NULL && a->crit[0] == '\0')
+      a->crit = NULL;
+    set_thresholds (&a->thlds, a->warn, a->crit);
+  }
+  if (a->selector[0] == '\0')
+    usage2 (_("Invalid --metric, no selector"), arg);
+}
+
+/* the --metric selectors on the exposition parsed while it was received:
+ * each must have matched a sample, the worst sample of each is reported
+ * when it is outside the thresholds, and the samples kept go into the
+ * performance data */
+int
+check_metrics (char (*msg)[DEFAULT_BUFFER_SIZE])
+{
+  int result = STATE_OK, i;
+  long k;
+  size_t perflen;
+
+  if (verbose >= 1)
+    printf ("* %lu sample lines, %lu skipped by name, %lu not understood%s\n",
+            (unsigned long)metrics_parser->lines, (unsigned long)metrics_parser->skipped,
+            (unsigned long)metrics_parser->errors, metrics_parser->eof ? ", # EOF seen" : "");
+
+  for (i = 0; i < metric_assert_count; i++) {
+    metric_assertion *a = &metric_assert[i];
+    np_om_selector *s = &metrics_parser->selectors[i];
+
+    if (s->matched == 0) {
+      snprintf (*msg, DEFAULT_BUFFER_SIZE, _("%smetric '%s' not found, "), *msg, a->selector);
+      result = STATE_CRITICAL;
+      continue;
+    }
+    if (s->status != STATE_OK) {
+      snprintf (*msg, DEFAULT_BUFFER_SIZE, _("%smetric '%s' is %g, "), *msg, s->worst.series, s->worst.value);
+      result = max_state_alt (s->status, result);
+    }
+    for (k = 0; k < s->matched && k < NP_OM_MAX_SAMPLES; k++) {
+      perflen = strlen (perfstring);
+      snprintf (perfstring + perflen, DEFAULT_BUFFER_SIZE - perflen, " %s",
+                sperfdata (s->samples[k].series, s->samples[k].value, "", a->warn, a->crit, FALSE, 0, FALSE, 0));
+    }
+    if (verbose >= 1 && s->matched > NP_OM_MAX_SAMPLES)
+      printf ("* %ld samples matched '%s', the first %d are in the performance data\n",
+              s->matched, a->selector, NP_OM_MAX_SAMPLES);
+  }
+
+  return result;
 }
 
 int
-check_document_dates (const curlhelp_write_curlbuf *header_buf, char (*msg)[DEFAULT_BUFFER_SIZE])
+check_document_dates (const http_response *headers, char (*msg)[DEFAULT_BUFFER_SIZE])
 {
   char *server_date = NULL;
   char *document_date = NULL;
   int date_result = STATE_OK;
-  curlhelp_statusline status_line;
-  struct phr_header headers[255];
-  size_t nof_headers = 255;
-  size_t msglen;
 
-  int res = phr_parse_response (header_buf->buf, header_buf->buflen,
-    &status_line.http_minor, &status_line.http_code, &status_line.msg, &msglen,
-    headers, &nof_headers, 0);
-
-  server_date = get_header_value (headers, nof_headers, "date");
-  document_date = get_header_value (headers, nof_headers, "last-modified");
+  server_date = http_header_value (headers, "date");
+  document_date = http_header_value (headers, "last-modified");
 
   if (!server_date || !*server_date) {
     snprintf (*msg, DEFAULT_BUFFER_SIZE, _("%sServer date unknown, "), *msg);
@@ -2102,33 +4688,21 @@ check_document_dates (const curlhelp_write_curlbuf *header_buf, char (*msg)[DEFA
 
 
 int
-get_content_length (const curlhelp_write_curlbuf* header_buf, const curlhelp_write_curlbuf* body_buf)
+get_content_length (const http_response *headers, const curlhelp_write_curlbuf* header_buf, const curlhelp_write_curlbuf* body_buf)
 {
-  const char *s;
   int content_length = 0;
-  char *copy;
-  struct phr_header headers[255];
-  size_t nof_headers = 255;
-  size_t msglen;
-  char *content_length_s = NULL;
-  curlhelp_statusline status_line;
-
-  int res = phr_parse_response (header_buf->buf, header_buf->buflen,
-    &status_line.http_minor, &status_line.http_code, &status_line.msg, &msglen,
-    headers, &nof_headers, 0);
-
-  content_length_s = get_header_value (headers, nof_headers, "content-length");
+  const char *content_length_s;
+  size_t len;
+
+  content_length_s = http_header_find (headers, "content-length", &len);
   if (!content_length_s) {
     return header_buf->buflen + body_buf->buflen;
   }
-  content_length_s += strspn (content_length_s, " \t");
   content_length = atoi (content_length_s);
   if (content_length != body_buf->buflen) {
     /* TODO: should we warn if the actual and the reported body length don't match? */
   }
 
-  if (content_length_s) free (content_length_s);
-
   return header_buf->buflen + body_buf->buflen;
 }
 
@@ -70,6 +70,31 @@ typedef struct {
 	char *value;
 } driver_option_t;
 
+#define MAX_QUERY_ARGS 64 /* arguments on a line of the --queries file */
+
+/* A query of the --queries file: its settings, which process_arguments()
+ * leaves in the globals below, and its results */
+typedef struct np_dbi_query_struct {
+	char *query;
+	char *label;
+	np_dbi_metric_t metric;
+	np_dbi_type_t type;
+	char *warning_range;
+	char *critical_range;
+	thresholds *thresholds;
+	char *expect;
+	regex_t expect_re;
+	char *expect_re_str;
+	int expect_re_cflags;
+
+	const char *val_str;
+	double val;
+	double time;
+	int status;
+	char *message;
+	struct np_dbi_query_struct *next;
+} np_dbi_query_t;
+
 char *host = NULL;
 int verbose = 0;
 
@@ -91,6 +116,13 @@ driver_option_t *np_dbi_options = NULL;
 int np_dbi_options_num = 0;
 char *np_dbi_database = NULL;
 char *np_dbi_query = NULL;
+char *np_dbi_label = NULL;
+
+char *queries_file = NULL;
+int queries_lineno = 0;
+np_dbi_query_t *queries = NULL;
+/* the query whose error messages are being collected */
+np_dbi_query_t *current_query = NULL;
 
 int process_arguments (int, char **);
 int validate_arguments (void);
@@ -99,9 +131,18 @@ void print_help (void);
 
 double timediff (struct timeval, struct timeval);
 
+void np_dbi_print (const char *, ...);
 void np_dbi_print_error (dbi_conn, char *, ...);
 
 int do_query (dbi_conn, const char **, double *, double *);
+int evaluate_query (const char *, double, double);
+void print_query (const char *, double, double, int);
+
+void query_reset (void);
+np_dbi_query_t *query_save (void);
+void query_load (const np_dbi_query_t *);
+void read_queries (const char *);
+int run_queries (dbi_conn, int, double, unsigned int);
 
 int
 main (int argc, char **argv)
@@ -122,9 +163,7 @@ main (int argc, char **argv)
 
 	int i;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv = np_extra_opts (&argc, argv, progname);
@@ -132,6 +171,9 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (queries_file)
+		read_queries (queries_file);
+
 	/* Set signal handling and alarm */
 	if (signal (SIGALRM, timeout_alarm_handler) == SIG_ERR) {
 		usage4 (_("Cannot catch SIGALRM"));
@@ -248,6 +290,9 @@ main (int argc, char **argv)
 		}
 	}
 
+	if (queries)
+		return run_queries (conn, status, conn_time, server_version);
+
 	if (np_dbi_query) {
 		/* execute query */
 		status = do_query (conn, &query_val_str, &query_val, &query_time);
@@ -255,34 +300,7 @@ main (int argc, char **argv)
 			/* do_query prints an error message in this case */
 			return status;
 
-		if (metric == METRIC_QUERY_RESULT) {
-			if (expect) {
-				if ((! query_val_str) || strcmp (query_val_str, expect))
-					status = STATE_CRITICAL;
-				else
-					status = STATE_OK;
-			}
-			else if (expect_re_str) {
-				int err;
-
-				err = regexec (&expect_re, query_val_str, 0, NULL, /* flags = */ 0);
-				if (! err)
-					status = STATE_OK;
-				else if (err == REG_NOMATCH)
-					status = STATE_CRITICAL;
-				else {
-					char errmsg[1024];
-					regerror (err, &expect_re, errmsg, sizeof (errmsg));
-					printf ("ERROR - failed to execute regular expression: %s\n",
-							errmsg);
-					status = STATE_CRITICAL;
-				}
-			}
-			else
-				status = get_status (query_val, dbi_thresholds);
-		}
-		else if (metric == METRIC_QUERY_TIME)
-			status = get_status (query_time, dbi_thresholds);
+		status = evaluate_query (query_val_str, query_val, query_time);
 	}
 
 	if (verbose)
@@ -299,22 +317,8 @@ main (int argc, char **argv)
 
 	printf ("%s - connection time: %fs", state_text (status), conn_time);
 	if (np_dbi_query) {
-		if (type == TYPE_STRING) {
-			assert (expect || expect_re_str);
-			printf (", '%s' returned '%s' in %fs", np_dbi_query,
-					query_val_str ? query_val_str : "<nothing>", query_time);
-			if (status != STATE_OK) {
-				if (expect)
-					printf (" (expected '%s')", expect);
-				else if (expect_re_str)
-					printf (" (expected regex /%s/%s)", expect_re_str,
-							((expect_re_cflags & REG_ICASE) ? "i" : ""));
-			}
-		}
-		else if (isnan (query_val))
-			printf (", '%s' query execution time: %fs", np_dbi_query, query_time);
-		else
-			printf (", '%s' returned %f in %fs", np_dbi_query, query_val, query_time);
+		printf (", ");
+		print_query (query_val_str, query_val, query_time, status);
 	}
 
 	printf (" | conntime=%fs;%s;%s;0; server_version=%u;%s;%s;0;", conn_time,
@@ -342,6 +346,10 @@ process_arguments (int argc, char **argv)
 {
 	int c;
 
+	enum {
+		QUERIES_OPTION = CHAR_MAX + 1
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		STD_LONG_OPTS,
@@ -354,16 +362,23 @@ process_arguments (int argc, char **argv)
 		{"option", required_argument, 0, 'o'},
 		{"query", required_argument, 0, 'q'},
 		{"database", required_argument, 0, 'D'},
+		{"label", required_argument, 0, 'l'},
+		{"queries", required_argument, 0, QUERIES_OPTION},
 		{0, 0, 0, 0}
 	};
 
 	while (1) {
-		c = getopt_long (argc, argv, "Vvht:c:w:e:r:R:m:H:d:o:q:D:",
+		c = getopt_long (argc, argv, "Vvht:c:w:e:r:R:m:H:d:o:q:D:l:",
 				longopts, &option);
 
 		if (c == EOF)
 			break;
 
+		/* a line of the --queries file only describes its query */
+		if (queries_lineno && (c > CHAR_MAX || ! strchr ("qwcerRml", c)))
+			die (STATE_UNKNOWN, _("UNKNOWN - %s line %d: only -q, -w, -c, -e, -r, -R, -m and -l may be used\n"),
+					queries_file, queries_lineno);
+
 		switch (c) {
 		case '?':     /* usage */
 			usage5 ();
@@ -475,6 +490,14 @@ process_arguments (int argc, char **argv)
 		case 'D':
 			np_dbi_database = optarg;
 			break;
+		case 'l':
+			if (strpbrk (optarg, "'="))
+				usage2 (_("Invalid label"), optarg);
+			np_dbi_label = optarg;
+			break;
+		case QUERIES_OPTION:
+			queries_file = optarg;
+			break;
 		}
 	}
 
@@ -486,6 +509,23 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments ()
 {
+	if (queries_lineno) {
+		if ((metric != METRIC_QUERY_RESULT) && (metric != METRIC_QUERY_TIME))
+			usage ("Queries of --queries need metric QUERY_RESULT or QUERY_TIME");
+	}
+	else if (queries_file) {
+		if (np_dbi_query || expect || expect_re_str || np_dbi_label)
+			usage ("Do not mix --queries and -q/-e/-r/-R/-l");
+		if ((metric == METRIC_QUERY_RESULT) || (metric == METRIC_QUERY_TIME)) {
+			if (warning_range || critical_range)
+				usage ("With --queries, -w/-c need metric CONN_TIME or SERVER_VERSION");
+			/* no thresholds, the connection alone is always OK */
+			metric = METRIC_CONN_TIME;
+		}
+	}
+	else if (np_dbi_label)
+		usage ("Option -l is only used in a --queries file");
+
 	if (! np_dbi_driver)
 		usage ("Must specify a DBI driver");
 
@@ -543,6 +583,8 @@ print_help (void)
 	printf ("    %s\n", _("DBI driver options"));
 	printf (" %s\n", "-q, --query=STRING");
 	printf ("    %s\n", _("query to execute"));
+	printf (" %s\n", "--queries=FILE");
+	printf ("    %s\n", _("Execute the queries listed in FILE over one connection, see below"));
 	printf ("\n");
 
 	printf (UT_WARN_CRIT_RANGE);
@@ -577,6 +619,13 @@ print_help (void)
 	printf (" %s\n", _("warning and critical ranges. The result from the query has to be numeric"));
 	printf (" %s\n\n", _("(strings representing numbers are fine)."));
 
+	printf (" %s\n", _("Each line of the --queries file holds the -q, -w, -c, -e, -r, -R and -m"));
+	printf (" %s\n", _("options of one query, quoted as on a command line, and optionally"));
+	printf (" %s\n", _("-l LABEL to name its performance data (default: queryN for the Nth"));
+	printf (" %s\n", _("query). Blank lines and lines starting with '#' are skipped. The queries"));
+	printf (" %s\n", _("run one after the other and the worst of their states is returned. The"));
+	printf (" %s\n\n", _("-w and -c options of the command line then need metric CONN_TIME or SERVER_VERSION."));
+
 	printf (" %s\n", _("The number and type of required DBI driver options depends on the actual"));
 	printf (" %s\n", _("driver. See its documentation at http://libdbi-drivers.sourceforge.net/"));
 	printf (" %s\n\n", _("for details."));
@@ -616,7 +665,7 @@ print_usage (void)
 	printf ("%s\n", _("Usage:"));
 	printf ("%s -d <DBI driver> [-o <DBI driver option> [...]] [-q <query>]\n", progname);
 	printf (" [-H <host>] [-c <critical range>] [-w <warning range>] [-m <metric>]\n");
-	printf (" [-e <string>] [-r|-R <regex>]\n");
+	printf (" [-e <string>] [-r|-R <regex>] [--queries=<file>]\n");
 }
 
 #define CHECK_IGNORE_ERROR(s) \
@@ -631,7 +680,7 @@ get_field_str (dbi_conn conn, dbi_result res, unsigned short field_type)
 	const char *str;
 
 	if (field_type != DBI_TYPE_STRING) {
-		printf ("CRITICAL - result value is not a string\n");
+		np_dbi_print ("CRITICAL - result value is not a string\n");
 		return NULL;
 	}
 
@@ -672,7 +721,7 @@ get_field (dbi_conn conn, dbi_result res, unsigned short *field_type)
 		val = strtod (val_str, &endptr);
 		if (endptr == val_str) {
 			CHECK_IGNORE_ERROR (NAN);
-			printf ("CRITICAL - result value is not a numeric: %s\n", val_str);
+			np_dbi_print ("CRITICAL - result value is not a numeric: %s\n", val_str);
 			*field_type = DBI_TYPE_ERROR;
 			return NAN;
 		}
@@ -683,7 +732,7 @@ get_field (dbi_conn conn, dbi_result res, unsigned short *field_type)
 	}
 	else {
 		CHECK_IGNORE_ERROR (NAN);
-		printf ("CRITICAL - cannot parse value of type %s (%i)\n",
+		np_dbi_print ("CRITICAL - cannot parse value of type %s (%i)\n",
 				(*field_type == DBI_TYPE_BINARY)
 					? "BINARY"
 					: (*field_type == DBI_TYPE_DATETIME)
@@ -710,7 +759,7 @@ get_query_result (dbi_conn conn, dbi_result res, const char **res_val_str, doubl
 
 	if (dbi_result_get_numrows (res) < 1) {
 		CHECK_IGNORE_ERROR (STATE_OK);
-		printf ("WARNING - no rows returned\n");
+		np_dbi_print ("WARNING - no rows returned\n");
 		return STATE_WARNING;
 	}
 
@@ -722,7 +771,7 @@ get_query_result (dbi_conn conn, dbi_result res, const char **res_val_str, doubl
 
 	if (dbi_result_get_numfields (res) < 1) {
 		CHECK_IGNORE_ERROR (STATE_OK);
-		printf ("WARNING - no fields returned\n");
+		np_dbi_print ("WARNING - no fields returned\n");
 		return STATE_WARNING;
 	}
 
@@ -787,6 +836,273 @@ do_query (dbi_conn conn, const char **res_val_str, double *res_val, double *res_
 	return status;
 }
 
+/* The state of a query result for the current metric and thresholds */
+int
+evaluate_query (const char *query_val_str, double query_val, double query_time)
+{
+	int status = STATE_OK;
+
+	if (metric == METRIC_QUERY_RESULT) {
+		if (expect) {
+			if ((! query_val_str) || strcmp (query_val_str, expect))
+				status = STATE_CRITICAL;
+			else
+				status = STATE_OK;
+		}
+		else if (expect_re_str) {
+			int err;
+
+			err = regexec (&expect_re, query_val_str, 0, NULL, /* flags = */ 0);
+			if (! err)
+				status = STATE_OK;
+			else if (err == REG_NOMATCH)
+				status = STATE_CRITICAL;
+			else {
+				char errmsg[1024];
+				regerror (err, &expect_re, errmsg, sizeof (errmsg));
+				np_dbi_print ("ERROR - failed to execute regular expression: %s\n",
+						errmsg);
+				status = STATE_CRITICAL;
+			}
+		}
+		else
+			status = get_status (query_val, dbi_thresholds);
+	}
+	else if (metric == METRIC_QUERY_TIME)
+		status = get_status (query_time, dbi_thresholds);
+
+	return status;
+}
+
+void
+print_query (const char *query_val_str, double query_val, double query_time, int status)
+{
+	if (type == TYPE_STRING) {
+		assert (expect || expect_re_str);
+		printf ("'%s' returned '%s' in %fs", np_dbi_query,
+				query_val_str ? query_val_str : "<nothing>", query_time);
+		if (status != STATE_OK) {
+			if (expect)
+				printf (" (expected '%s')", expect);
+			else if (expect_re_str)
+				printf (" (expected regex /%s/%s)", expect_re_str,
+						((expect_re_cflags & REG_ICASE) ? "i" : ""));
+		}
+	}
+	else if (isnan (query_val))
+		printf ("'%s' query execution time: %fs", np_dbi_query, query_time);
+	else
+		printf ("'%s' returned %f in %fs", np_dbi_query, query_val, query_time);
+}
+
+/* Settings of one query, see np_dbi_query_t */
+void
+query_reset (void)
+{
+	np_dbi_query = NULL;
+	np_dbi_label = NULL;
+	metric = METRIC_QUERY_RESULT;
+	type = TYPE_NUMERIC;
+	warning_range = NULL;
+	critical_range = NULL;
+	dbi_thresholds = NULL;
+	expect = NULL;
+	expect_re_str = NULL;
+	expect_re_cflags = 0;
+}
+
+np_dbi_query_t *
+query_save (void)
+{
+	np_dbi_query_t *q;
+
+	q = calloc (1, sizeof (*q));
+	if (! q) {
+		printf ("UNKNOWN - failed to allocate memory\n");
+		exit (STATE_UNKNOWN);
+	}
+
+	q->query = np_dbi_query;
+	q->label = np_dbi_label;
+	q->metric = metric;
+	q->type = type;
+	q->warning_range = warning_range;
+	q->critical_range = critical_range;
+	q->thresholds = dbi_thresholds;
+	q->expect = expect;
+	q->expect_re = expect_re;
+	q->expect_re_str = expect_re_str;
+	q->expect_re_cflags = expect_re_cflags;
+	q->val = NAN;
+	q->status = STATE_UNKNOWN;
+	return q;
+}
+
+void
+query_load (const np_dbi_query_t *q)
+{
+	np_dbi_query = q->query;
+	np_dbi_label = q->label;
+	metric = q->metric;
+	type = q->type;
+	warning_range = q->warning_range;
+	critical_range = q->critical_range;
+	dbi_thresholds = q->thresholds;
+	expect = q->expect;
+	expect_re = q->expect_re;
+	expect_re_str = q->expect_re_str;
+	expect_re_cflags = q->expect_re_cflags;
+}
+
+/* --queries: the options of one query per line. Arguments are split at
+ * blanks unless quoted with ' or ". Blank lines and lines starting with '#'
+ * are skipped. */
+void
+read_queries (const char *filename)
+{
+	FILE *fp;
+	char line[MAX_INPUT_BUFFER];
+	char *qargv[MAX_QUERY_ARGS + 1];
+	char *p, *q, *opts, quote;
+	np_dbi_query_t *settings, **tail = &queries;
+	int qargc, count = 0;
+
+	if (strcmp (filename, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen (filename, "r")) == NULL)
+		die (STATE_UNKNOWN, _("UNKNOWN - Cannot open queries file %s: %s\n"), filename, strerror (errno));
+
+	/* the settings of the command line are restored below */
+	settings = query_save ();
+	while (fgets (line, sizeof (line), fp) != NULL) {
+		queries_lineno++;
+		strip (line);
+		p = line + strspn (line, " \t");
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		/* the options point into the line, so it has to stay */
+		opts = strdup (p);
+		qargv[0] = (char *) progname;
+		for (qargc = 1; ; qargc++) {
+			p = opts + strspn (opts, " \t");
+			if (*p == '\0')
+				break;
+			if (qargc == MAX_QUERY_ARGS)
+				die (STATE_UNKNOWN, _("UNKNOWN - %s line %d: too many arguments\n"), filename, queries_lineno);
+			/* unquote in place, the argument never gets longer */
+			qargv[qargc] = q = p;
+			for (quote = '\0'; *p != '\0'; p++) {
+				if (quote) {
+					if (*p == quote)
+						quote = '\0';
+					else
+						*q++ = *p;
+				} else if (*p == '\'' || *p == '"') {
+					quote = *p;
+				} else if (*p == ' ' || *p == '\t') {
+					p++;
+					break;
+				} else {
+					*q++ = *p;
+				}
+			}
+			if (quote)
+				die (STATE_UNKNOWN, _("UNKNOWN - %s line %d: unterminated quote\n"), filename, queries_lineno);
+			*q = '\0';
+			opts = p;
+		}
+		qargv[qargc] = NULL;
+
+		query_reset ();
+		optind = 0;
+		if (process_arguments (qargc, qargv) == ERROR)
+			die (STATE_UNKNOWN, _("UNKNOWN - %s line %d: could not parse arguments\n"), filename, queries_lineno);
+		if (! np_dbi_label)
+			xasprintf (&np_dbi_label, "query%d", count + 1);
+		*tail = query_save ();
+		tail = &(*tail)->next;
+		count++;
+	}
+	queries_lineno = 0;
+
+	if (fp != stdin)
+		fclose (fp);
+	if (queries == NULL)
+		die (STATE_UNKNOWN, _("UNKNOWN - No queries found in %s\n"), filename);
+
+	query_load (settings);
+	free (settings);
+}
+
+/* Execute all queries of --queries on the connection and print a summary
+ * with the performance data of all of them, and a line per query */
+int
+run_queries (dbi_conn conn, int status, double conn_time, unsigned int server_version)
+{
+	np_dbi_query_t *q;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int count = 0;
+	char *conn_warning = warning_range, *conn_critical = critical_range;
+	np_dbi_metric_t conn_metric = metric;
+
+	if (status == STATE_UNKNOWN)
+		status = STATE_OK;
+
+	for (q = queries; q != NULL; q = q->next) {
+		query_load (q);
+		current_query = q;
+		q->status = do_query (conn, &q->val_str, &q->val, &q->time);
+		if (q->status == STATE_OK)
+			q->status = evaluate_query (q->val_str, q->val, q->time);
+		current_query = NULL;
+
+		status = max_state (status, q->status);
+		if (q->status >= STATE_OK && q->status <= STATE_DEPENDENT)
+			states[q->status]++;
+		count++;
+	}
+
+	if (verbose)
+		printf("Closing connection\n");
+	dbi_conn_close (conn);
+
+	printf ("%s - connection time: %fs, ", state_text (status), conn_time);
+	printf (_("%d queries: %d ok, %d warning, %d critical, %d unknown"), count,
+			states[STATE_OK], states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+	printf (" | conntime=%fs;%s;%s;0; server_version=%u;%s;%s;0;", conn_time,
+			((conn_metric == METRIC_CONN_TIME) && conn_warning) ? conn_warning : "",
+			((conn_metric == METRIC_CONN_TIME) && conn_critical) ? conn_critical : "",
+			server_version,
+			((conn_metric == METRIC_SERVER_VERSION) && conn_warning) ? conn_warning : "",
+			((conn_metric == METRIC_SERVER_VERSION) && conn_critical) ? conn_critical : "");
+	for (q = queries; q != NULL; q = q->next) {
+		const char *quote = strchr (q->label, ' ') ? "'" : "";
+
+		if (! isnan (q->val))
+			printf (" %s%s%s=%f;%s;%s;;", quote, q->label, quote, q->val,
+					((q->metric == METRIC_QUERY_RESULT) && q->warning_range) ? q->warning_range : "",
+					((q->metric == METRIC_QUERY_RESULT) && q->critical_range) ? q->critical_range : "");
+		printf (" %s%s_time%s=%fs;%s;%s;0;", quote, q->label, quote, q->time,
+				((q->metric == METRIC_QUERY_TIME) && q->warning_range) ? q->warning_range : "",
+				((q->metric == METRIC_QUERY_TIME) && q->critical_range) ? q->critical_range : "");
+	}
+	printf ("\n");
+
+	for (q = queries; q != NULL; q = q->next) {
+		printf ("%s %s: ", state_text (q->status), q->label);
+		if (q->message) {
+			printf ("%s\n", q->message);
+			continue;
+		}
+		query_load (q);
+		print_query (q->val_str, q->val, q->time, q->status);
+		printf ("\n");
+	}
+	return status;
+}
+
 double
 timediff (struct timeval start, struct timeval end)
 {
@@ -801,17 +1117,45 @@ timediff (struct timeval start, struct timeval end)
 	return diff;
 }
 
+/* Like printf, but with --queries the message goes into the line of the
+ * query it is about */
+void
+np_dbi_print (const char *fmt, ...)
+{
+	char *msg = NULL;
+	va_list ap;
+
+	va_start (ap, fmt);
+	if (! current_query) {
+		vprintf (fmt, ap);
+		va_end (ap);
+		return;
+	}
+	if (vasprintf (&msg, fmt, ap) < 0)
+		die (STATE_UNKNOWN, _("UNKNOWN - failed to allocate memory\n"));
+	va_end (ap);
+
+	strip (msg);
+	if (current_query->message)
+		xasprintf (&current_query->message, "%s; %s", current_query->message, msg);
+	else
+		current_query->message = msg;
+}
+
 void
 np_dbi_print_error (dbi_conn conn, char *fmt, ...)
 {
 	const char *errmsg = NULL;
+	char *msg = NULL;
 	va_list ap;
 
 	va_start (ap, fmt);
 
 	dbi_conn_error (conn, &errmsg);
-	vprintf (fmt, ap);
-	printf (": %s\n", errmsg);
+	if (vasprintf (&msg, fmt, ap) < 0)
+		die (STATE_UNKNOWN, _("UNKNOWN - failed to allocate memory\n"));
+	np_dbi_print ("%s: %s\n", msg, errmsg);
+	free (msg);
 
 	va_end (ap);
 }
@@ -41,6 +41,23 @@ const char *email = "devel@monitoring-plugins.org";
 #include "utils.h"
 #include "runcmd.h"
 
+#ifdef HAVE_RES_NSEND
+# include <fcntl.h>
+# include <arpa/nameser.h>
+# include <resolv.h>
+# ifdef USE_OPENSSL
+#  include <openssl/opensslv.h>
+#  if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#   define HAVE_DNSSEC 1
+#   include <ctype.h>
+#   include <openssl/bn.h>
+#   include <openssl/ec.h>
+#   include <openssl/evp.h>
+#   include <openssl/rsa.h>
+#  endif
+# endif
+#endif
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
@@ -49,6 +66,7 @@ void print_usage (void);
 #define UNDEFINED 0
 #define DEFAULT_PORT 53
 #define DEFAULT_TRIES 2
+#define DEFAULT_CONCURRENCY 64
 
 char *query_address = NULL;
 char *record_type = "A";
@@ -61,24 +79,1720 @@ int server_port = DEFAULT_PORT;
 int number_tries = DEFAULT_TRIES;
 double warning_interval = UNDEFINED;
 double critical_interval = UNDEFINED;
+char *records_file = NULL;
+int concurrency = DEFAULT_CONCURRENCY;
+int dnssec = FALSE;
+int signature_days_warn = -1;
+int signature_days_crit = -1;
 struct timeval tv;
 
+
+
+#ifdef HAVE_RES_NSEND
+/* Bulk mode: the records from --records are all queried from this process,
+ * over UDP with one socket per address family and over TCP for truncated
+ * replies, with at most `concurrency` queries in flight in a single poll()
+ * loop. The answer section of each reply is judged like dig's. */
+
+enum dig_record_phase {
+  RECORD_PENDING,
+  RECORD_UDP,
+  RECORD_TCP_CONNECTING,
+  RECORD_TCP_READING,
+  RECORD_DONE
+};
+
+typedef struct dig_record_struct {
+  char *name;
+  char *type_name;
+  int type;
+  char *expected;
+  char *server;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  enum dig_record_phase phase;
+  int fd;                   /* TCP only */
+  u_char query[NS_PACKETSZ];
+  int qlen;
+  int qdlen;                /* up to the end of the question */
+  int id;
+  int tries;
+  u_char *reply;            /* TCP reply with its length prefix */
+  size_t reply_len;
+  size_t reply_size;
+  struct timeval start;
+  double deadline;          /* absolute, for the current try */
+  double elapsed;
+  int result;
+  char *message;
+  u_char *answer;           /* the reply, kept for --dnssec */
+  size_t answer_len;
+} dig_record;
+
+static const struct {
+  const char *name;
+  int type;
+} record_types[] = {
+  { "A", ns_t_a },
+  { "NS", ns_t_ns },
+  { "CNAME", ns_t_cname },
+  { "SOA", ns_t_soa },
+  { "PTR", ns_t_ptr },
+  { "MX", ns_t_mx },
+  { "TXT", ns_t_txt },
+  { "AAAA", ns_t_aaaa },
+  { "SRV", ns_t_srv },
+  { "NAPTR", ns_t_naptr },
+  { "DS", 43 },
+  { "DNSKEY", 48 },
+  { "CAA", 257 },
+  { "ANY", ns_t_any },
+  { NULL, 0 }
+};
+
+static const char *rcode_names[] = {
+  "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
+};
+
+/* the record waiting for each query ID over UDP */
+static dig_record *records_by_id[65536];
+static int next_id;
+static int udp_fd[2] = { -1, -1 };
+static double try_timeout;
+
+static double
+now_seconds (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1.0e6;
+}
+
+/* "A", "aaaa" or "TYPE65" */
+static int
+record_type_value (const char *name)
+{
+  int i;
+
+  for (i = 0; record_types[i].name; i++)
+    if (strcasecmp (name, record_types[i].name) == 0)
+      return record_types[i].type;
+  if (strncasecmp (name, "TYPE", 4) == 0 && is_intpos ((char *)name + 4) && atoi (name + 4) < 65536)
+    return atoi (name + 4);
+  return -1;
+}
+
+static void
+add_record (dig_record **records, size_t *count, size_t *size,
+            char *name, char *type_name, char *expected, char *server)
+{
+  dig_record *r;
+
+  if (*count >= *size) {
+    *size = *size ? *size * 2 : 64;
+    *records = realloc (*records, *size * sizeof (dig_record));
+    if (*records == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  }
+  r = &(*records)[*count];
+  memset (r, 0, sizeof (dig_record));
+  r->name = name;
+  r->type_name = type_name;
+  if ((r->type = record_type_value (type_name)) < 0)
+    die (STATE_UNKNOWN, _("Unknown record type %s for %s\n"), type_name, name);
+  r->expected = expected;
+  r->server = server;
+  r->fd = -1;
+  (*count)++;
+}
+
+/* Read "[@server] name [type [expected]]" lines, one per record. The
+ * server, type and expected answer default to -H, -T and -a. */
+static dig_record *
+read_records (const char *filename, size_t *count)
+{
+  FILE *fp;
+  char line[MAX_INPUT_BUFFER];
+  char *field[3], *server, *p;
+  dig_record *records = NULL;
+  size_t size = 0;
+  int n;
+
+  *count = 0;
+  if (strcmp (filename, "-") == 0)
+    fp = stdin;
+  else if ((fp = fopen (filename, "r")) == NULL)
+    die (STATE_UNKNOWN, _("Cannot open record list %s: %s\n"), filename, strerror (errno));
+
+  while (fgets (line, sizeof (line), fp) != NULL) {
+    strip (line);
+    p = line + strspn (line, " \t");
+    if (*p == '\0' || *p == '#')
+      continue;
+
+    server = dns_server;
+    n = 0;
+    for (p = strtok (p, " \t"); p != NULL; p = strtok (NULL, " \t")) {
+      if (*p == '@' && p[1] != '\0')
+        server = strdup (p + 1);
+      else if (n < 3)
+        field[n++] = strdup (p);
+      else
+        die (STATE_UNKNOWN, _("Too many fields in record list: %s\n"), p);
+    }
+    if (n == 0)
+      die (STATE_UNKNOWN, _("No name given in record list\n"));
+
+    add_record (&records, count, &size, field[0], n > 1 ? field[1] : record_type,
+                n > 2 ? field[2] : expected_address, server);
+  }
+
+  if (fp != stdin)
+    fclose (fp);
+
+  if (*count == 0)
+    die (STATE_UNKNOWN, _("No records found in %s\n"), filename);
+
+  return records;
+}
+
+/* Look up the servers, once for each run of records with the same one */
+static void
+resolve_servers (dig_record *records, size_t count)
+{
+  struct addrinfo hints, *ai;
+  const char **names;
+  char port_str[8];
+  size_t i;
+
+  if ((names = calloc (count, sizeof (char *))) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  for (i = 0; i < count; i++)
+    names[i] = records[i].server;
+  np_resolve_prefetch (names, count, address_family, concurrency);
+  free (names);
+
+  snprintf (port_str, sizeof (port_str), "%d", server_port);
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = address_family;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  for (i = 0; i < count; i++) {
+    if (i > 0 && strcmp (records[i].server, records[i - 1].server) == 0) {
+      records[i].addr = records[i - 1].addr;
+      records[i].addrlen = records[i - 1].addrlen;
+      continue;
+    }
+    if (np_getaddrinfo (records[i].server, port_str, &hints, &ai) != 0)
+      continue;
+    memcpy (&records[i].addr, ai->ai_addr, ai->ai_addrlen);
+    records[i].addrlen = ai->ai_addrlen;
+    freeaddrinfo (ai);
+  }
+}
+
+static void
+record_finish (dig_record *r, int result, char *message)
+{
+  if (r->phase == RECORD_UDP)
+    records_by_id[r->id] = NULL;
+  if (r->fd >= 0)
+    close (r->fd);
+  r->fd = -1;
+  r->phase = RECORD_DONE;
+  r->elapsed = (double)deltime (r->start) / 1.0e6;
+  r->result = result;
+  r->message = message;
+}
+
+static void
+record_send_udp (dig_record *r)
+{
+  int family = r->addr.ss_family == AF_INET6 ? 1 : 0;
+  char *message = NULL;
+
+  if (udp_fd[family] < 0) {
+    udp_fd[family] = socket (r->addr.ss_family, SOCK_DGRAM, 0);
+    if (udp_fd[family] < 0)
+      die (STATE_UNKNOWN, _("Cannot create socket: %s\n"), strerror (errno));
+    fcntl (udp_fd[family], F_SETFL, fcntl (udp_fd[family], F_GETFL) | O_NONBLOCK);
+  }
+
+  r->tries++;
+  r->deadline = now_seconds () + try_timeout;
+  if (sendto (udp_fd[family], r->query, r->qlen, 0, (struct sockaddr *)&r->addr, r->addrlen) < 0
+      && errno != EAGAIN && errno != EWOULDBLOCK) {
+    xasprintf (&message, _("Cannot send query to %s: %s"), r->server, strerror (errno));
+    record_finish (r, STATE_CRITICAL, message);
+  }
+}
+
+static void
+record_start (dig_record *r)
+{
+  char *message = NULL;
+  int i;
+
+  gettimeofday (&r->start, NULL);
+  if (r->addrlen == 0) {
+    xasprintf (&message, _("Cannot resolve DNS server %s"), r->server);
+    record_finish (r, STATE_UNKNOWN, message);
+    return;
+  }
+  r->qlen = res_mkquery (ns_o_query, r->name, ns_c_in, r->type, NULL, 0, NULL,
+                         r->query, sizeof (r->query));
+  if (r->qlen < 0) {
+    xasprintf (&message, _("Cannot build a query for %s"), r->name);
+    record_finish (r, STATE_UNKNOWN, message);
+    return;
+  }
+  r->qdlen = r->qlen;
+  if (dnssec && r->qlen + 11 <= (int)sizeof (r->query)) {
+    /* an OPT record with the DO bit, for the RRSIGs */
+    static const u_char opt[11] = { 0, 0, 41, 0x10, 0x00, 0, 0, 0x80, 0, 0, 0 };
+    memcpy (r->query + r->qlen, opt, sizeof (opt));
+    r->qlen += sizeof (opt);
+    r->query[11] = 1;
+  }
+
+  /* give each query in flight its own ID */
+  for (i = 0; records_by_id[next_id] != NULL && i < 65536; i++)
+    next_id = (next_id + 1) & 0xffff;
+  r->id = next_id;
+  next_id = (next_id + 1) & 0xffff;
+  r->query[0] = r->id >> 8;
+  r->query[1] = r->id & 0xff;
+  records_by_id[r->id] = r;
+
+  r->phase = RECORD_UDP;
+  record_send_udp (r);
+}
+
+/* Print rr the way dig prints it in the answer section, with spaces
+ * between the fields */
+static int
+record_sprint (ns_msg *handle, ns_rr *rr, char *buf, size_t size)
+{
+  const u_char *rd = ns_rr_rdata (*rr);
+  const u_char *end = rd + ns_rr_rdlen (*rr);
+  char name[NS_MAXDNAME], type[16];
+  size_t len;
+  int i, n;
+
+#define NAME(p) (n = ns_name_uncompress (ns_msg_base (*handle), ns_msg_end (*handle), (p), \
+                                         name, sizeof (name)))
+  for (i = 0; record_types[i].name && record_types[i].type != ns_rr_type (*rr); i++)
+    ;
+  if (record_types[i].name)
+    snprintf (type, sizeof (type), "%s", record_types[i].name);
+  else
+    snprintf (type, sizeof (type), "TYPE%d", ns_rr_type (*rr));
+  len = snprintf (buf, size, "%s. %lu IN %s ", *ns_rr_name (*rr) ? ns_rr_name (*rr) : "",
+                  (unsigned long)ns_rr_ttl (*rr), type);
+  if (len >= size)
+    return -1;
+  buf += len;
+  size -= len;
+
+  switch (ns_rr_type (*rr)) {
+  case ns_t_a:
+  case ns_t_aaaa:
+    if (inet_ntop (ns_rr_type (*rr) == ns_t_a ? AF_INET : AF_INET6, rd, buf, size) == NULL)
+      return -1;
+    return 0;
+  case ns_t_ns:
+  case ns_t_cname:
+  case ns_t_ptr:
+    if (NAME (rd) < 0)
+      return -1;
+    snprintf (buf, size, "%s.", name);
+    return 0;
+  case ns_t_mx:
+    if (end - rd < 3 || NAME (rd + 2) < 0)
+      return -1;
+    snprintf (buf, size, "%u %s.", ns_get16 (rd), name);
+    return 0;
+  case ns_t_srv:
+    if (end - rd < 7 || NAME (rd + 6) < 0)
+      return -1;
+    snprintf (buf, size, "%u %u %u %s.", ns_get16 (rd), ns_get16 (rd + 2), ns_get16 (rd + 4), name);
+    return 0;
+  case ns_t_txt:
+    /* each character string quoted */
+    while (rd < end && size > 4) {
+      n = *rd++;
+      if (n > end - rd)
+        n = end - rd;
+      len = snprintf (buf, size, "%s\"%.*s\"", buf[-1] == ' ' ? "" : " ", n, rd);
+      if (len >= size)
+        break;
+      buf += len;
+      size -= len;
+      rd += n;
+    }
+    return 0;
+  case ns_t_soa:
+    if (NAME (rd) < 0)
+      return -1;
+    len = snprintf (buf, size, "%s. ", name);
+    rd += n;
+    if (len >= size || NAME (rd) < 0 || end - (rd + n) < 20)
+      return -1;
+    rd += n;
+    snprintf (buf + len, size - len, "%s. %lu %lu %lu %lu %lu", name,
+              (unsigned long)ns_get32 (rd), (unsigned long)ns_get32 (rd + 4),
+              (unsigned long)ns_get32 (rd + 8), (unsigned long)ns_get32 (rd + 12),
+              (unsigned long)ns_get32 (rd + 16));
+    return 0;
+  default:
+    /* RFC 3597 generic form */
+    len = snprintf (buf, size, "\\# %d ", (int)(end - rd));
+    for (; rd < end && len + 3 < size; rd++)
+      len += snprintf (buf + len, size - len, "%02X", *rd);
+    return 0;
+  }
+#undef NAME
+}
+
+/* Judge the answer section the way main() judges dig's output */
+static void
+record_evaluate (dig_record *r, const u_char *buf, size_t len)
+{
+  ns_msg handle;
+  ns_rr rr;
+  char line[MAX_INPUT_BUFFER];
+  char *message = NULL;
+  int rcode;
+  u_int i;
+
+  if (dnssec && r->answer == NULL && (r->answer = malloc (len)) != NULL) {
+    memcpy (r->answer, buf, len);
+    r->answer_len = len;
+  }
+  if (ns_initparse (buf, len, &handle) < 0) {
+    record_finish (r, STATE_WARNING, (char *)_("Invalid reply from the server"));
+    return;
+  }
+  rcode = ns_msg_getflag (handle, ns_f_rcode);
+  if (rcode != ns_r_noerror) {
+    if (rcode < (int)(sizeof (rcode_names) / sizeof (rcode_names[0])))
+      xasprintf (&message, _("No ANSWER SECTION found, status %s"), rcode_names[rcode]);
+    else
+      xasprintf (&message, _("No ANSWER SECTION found, status %d"), rcode);
+    record_finish (r, STATE_CRITICAL, message);
+    return;
+  }
+  if (ns_msg_count (handle, ns_s_an) == 0) {
+    record_finish (r, STATE_CRITICAL, (char *)_("No ANSWER SECTION found"));
+    return;
+  }
+
+  for (i = 0; i < ns_msg_count (handle, ns_s_an); i++) {
+    if (ns_parserr (&handle, ns_s_an, i, &rr) < 0
+        || record_sprint (&handle, &rr, line, sizeof (line)) < 0)
+      continue;
+
+    if (verbose)
+      printf ("%s %s: %s\n", r->name, r->type_name, line);
+    if (strcasestr (line, r->expected ? r->expected : r->name) != NULL) {
+      record_finish (r, STATE_OK, strdup (line));
+      return;
+    }
+  }
+  record_finish (r, STATE_WARNING, (char *)_("Server not found in ANSWER SECTION"));
+}
+
+static void
+record_start_tcp (dig_record *r)
+{
+  char *message = NULL;
+
+  records_by_id[r->id] = NULL;
+  r->phase = RECORD_TCP_CONNECTING;
+  r->deadline = now_seconds () + try_timeout;
+  if ((r->fd = socket (r->addr.ss_family, SOCK_STREAM, 0)) < 0)
+    die (STATE_UNKNOWN, _("Cannot create socket: %s\n"), strerror (errno));
+  fcntl (r->fd, F_SETFL, fcntl (r->fd, F_GETFL) | O_NONBLOCK);
+  if (connect (r->fd, (struct sockaddr *)&r->addr, r->addrlen) < 0 && errno != EINPROGRESS) {
+    xasprintf (&message, _("Truncated reply, TCP connection to %s failed: %s"), r->server, strerror (errno));
+    record_finish (r, STATE_CRITICAL, message);
+  }
+}
+
+/* Replies to any of the queries in flight over UDP */
+static void
+udp_read (int fd)
+{
+  static u_char buf[NS_MAXMSG];
+  struct sockaddr_storage from;
+  socklen_t fromlen;
+  dig_record *r;
+  ssize_t n;
+
+  for (;;) {
+    fromlen = sizeof (from);
+    if ((n = recvfrom (fd, buf, sizeof (buf), 0, (struct sockaddr *)&from, &fromlen)) < 0)
+      return;
+    if (n < NS_HFIXEDSZ)
+      continue;
+
+    /* only take the reply from the server asked, to the question asked */
+    r = records_by_id[(buf[0] << 8) | buf[1]];
+    if (r == NULL || fromlen != r->addrlen || memcmp (&from, &r->addr, fromlen) != 0
+        || n < r->qdlen || memcmp (buf + NS_HFIXEDSZ, r->query + NS_HFIXEDSZ, r->qdlen - NS_HFIXEDSZ) != 0)
+      continue;
+
+    if (buf[2] & 0x02)        /* TC */
+      record_start_tcp (r);
+    else
+      record_evaluate (r, buf, n);
+  }
+}
+
+static void
+record_handle_event (dig_record *r, short revents)
+{
+  u_char prefix[2 + NS_PACKETSZ];
+  char *message = NULL;
+  socklen_t len = sizeof (int);
+  size_t want;
+  ssize_t n;
+  int err = 0;
+
+  if (r->phase == RECORD_TCP_CONNECTING) {
+    if (getsockopt (r->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+      err = errno;
+    prefix[0] = r->qlen >> 8;
+    prefix[1] = r->qlen & 0xff;
+    memcpy (prefix + 2, r->query, r->qlen);
+    if (err == 0 && send (r->fd, prefix, r->qlen + 2, 0) != r->qlen + 2)
+      err = errno ? errno : EIO;
+    if (err != 0) {
+      xasprintf (&message, _("Truncated reply, TCP connection to %s failed: %s"), r->server, strerror (err));
+      record_finish (r, STATE_CRITICAL, message);
+      return;
+    }
+    r->phase = RECORD_TCP_READING;
+    return;
+  }
+
+  /* the length first, then the message */
+  want = r->reply_len < 2 ? 2 : 2 + ((r->reply[0] << 8) | r->reply[1]);
+  if (r->reply_size < want) {
+    r->reply_size = want < 2 + NS_PACKETSZ ? 2 + NS_PACKETSZ : want;
+    if ((r->reply = realloc (r->reply, r->reply_size)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  }
+  n = recv (r->fd, r->reply + r->reply_len, want - r->reply_len, 0);
+  if (n <= 0) {
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      return;
+    xasprintf (&message, _("Truncated reply, TCP connection to %s closed"), r->server);
+    record_finish (r, STATE_CRITICAL, message);
+    return;
+  }
+  r->reply_len += n;
+  if (r->reply_len == 2 && want == 2)
+    return;
+  if (r->reply_len == 2 + (size_t)((r->reply[0] << 8) | r->reply[1]))
+    record_evaluate (r, r->reply + 2, r->reply_len - 2);
+}
+
+static void
+record_handle_timeout (dig_record *r)
+{
+  char *message = NULL;
+
+  if (r->phase == RECORD_UDP && r->tries < number_tries) {
+    record_send_udp (r);
+    return;
+  }
+  if (r->phase == RECORD_UDP)
+    xasprintf (&message, _("No response from %s after %d tries"), r->server, r->tries);
+  else
+    xasprintf (&message, _("Truncated reply, no response from %s over TCP"), r->server);
+  record_finish (r, STATE_CRITICAL, message);
+}
+
+/* Query all records, returning once every one of them is done */
+static void
+run_queries (dig_record *records, size_t count)
+{
+  struct pollfd *pfds;
+  size_t *active, *polled;
+  size_t next = 0, nactive = 0, npolled, i, j;
+  int timeout_ms, u;
+  double now, first;
+
+  res_init ();
+  if (concurrency > 65535)
+    concurrency = 65535;
+  next_id = rand () & 0xffff;
+  resolve_servers (records, count);
+
+  active = calloc (concurrency, sizeof (size_t));
+  polled = calloc (concurrency + 2, sizeof (size_t));
+  pfds = calloc (concurrency + 2, sizeof (struct pollfd));
+  if (active == NULL || polled == NULL || pfds == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+  while (next < count || nactive > 0) {
+    /* top up the set of queries in flight */
+    while (nactive < (size_t)concurrency && next < count) {
+      record_start (&records[next]);
+      if (records[next].phase != RECORD_DONE)
+        active[nactive++] = next;
+      next++;
+    }
+    if (nactive == 0)
+      continue;
+
+    npolled = 0;
+    for (u = 0; u < 2; u++)
+      if (udp_fd[u] >= 0) {
+        pfds[npolled].fd = udp_fd[u];
+        pfds[npolled].events = POLLIN;
+        pfds[npolled].revents = 0;
+        polled[npolled++] = (size_t)-1;
+      }
+    now = now_seconds ();
+    first = records[active[0]].deadline;
+    for (i = 0; i < nactive; i++) {
+      dig_record *r = &records[active[i]];
+      if (r->deadline < first)
+        first = r->deadline;
+      if (r->fd < 0)
+        continue;
+      pfds[npolled].fd = r->fd;
+      pfds[npolled].events = (r->phase == RECORD_TCP_CONNECTING) ? POLLOUT : POLLIN;
+      pfds[npolled].revents = 0;
+      polled[npolled++] = active[i];
+    }
+    timeout_ms = (first > now) ? (int)((first - now) * 1000) + 1 : 0;
+
+    if (poll (pfds, npolled, timeout_ms) < 0 && errno != EINTR)
+      die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+
+    for (i = 0; i < npolled; i++) {
+      if (!pfds[i].revents)
+        continue;
+      if (polled[i] == (size_t)-1)
+        udp_read (pfds[i].fd);
+      else if (records[polled[i]].phase != RECORD_DONE)
+        record_handle_event (&records[polled[i]], pfds[i].revents);
+    }
+
+    now = now_seconds ();
+    for (i = 0; i < nactive; i++) {
+      dig_record *r = &records[active[i]];
+      if (r->phase != RECORD_DONE && r->deadline <= now)
+        record_handle_timeout (r);
+    }
+
+    /* drop finished records from the active set */
+    for (i = j = 0; i < nactive; i++)
+      if (records[active[i]].phase != RECORD_DONE)
+        active[j++] = active[i];
+    nactive = j;
+  }
+
+  free (active);
+  free (polled);
+  free (pfds);
+}
+
+#ifdef HAVE_DNSSEC
+/* With --dnssec, the queries ask for the signatures (the DO bit) and every
+ * RRset in an answer must carry an RRSIG that verifies with a DNSKEY of its
+ * zone. The DNSKEY RRsets are validated from the trust anchor down, DS by
+ * DS, and kept in the state directory until their TTL or one of the
+ * signatures on the way runs out, so most runs only verify the RRSIGs of
+ * the records themselves. */
+
+#define DNSSEC_ROOT_ANCHOR ". 20326 8 2 E06D44B80B8F1D39A95C0B0D7C65D08458E880409BBC683457104237C7F8EC8D"
+#define DNSSEC_T_DS 43
+#define DNSSEC_T_RRSIG 46
+#define DNSSEC_T_DNSKEY 48
+#define DNSSEC_NEVER ((time_t)LONG_MAX)
+
+enum dnssec_zone_status {
+  ZONE_WANTED,
+  ZONE_FETCHED,
+  ZONE_VALID,
+  ZONE_FAILED
+};
+
+typedef struct dnssec_zone_struct {
+  char name[NS_MAXDNAME];   /* lower case, "." for the root */
+  enum dnssec_zone_status status;
+  int round;                /* of the queries for its DNSKEY and DS */
+  size_t dnskey_query;
+  size_t ds_query;
+  u_char *dnskey_reply;
+  size_t dnskey_len;
+  u_char *ds_reply;
+  size_t ds_len;
+  char parent[NS_MAXDNAME]; /* the signer of the DS RRset */
+  u_char *keys;             /* DNSKEY RDATA, each after a 16 bit length */
+  size_t keys_len;
+  time_t sig_expires;       /* the first signature up to the anchor to expire */
+  time_t expires;           /* and the first TTL, for the cache */
+  char *message;
+} dnssec_zone;
+
+typedef struct dnssec_sig_struct {
+  int covered;
+  int alg;
+  int labels;
+  uint32_t ttl;
+  uint32_t expiration;
+  uint32_t inception;
+  int tag;
+  char signer[NS_MAXDNAME];
+  u_char head[18 + NS_MAXCDNAME]; /* the RDATA before the signature */
+  size_t head_len;
+  const u_char *sig;
+  size_t sig_len;
+} dnssec_sig;
+
+typedef struct dnssec_rdata_struct {
+  u_char *data;
+  size_t len;
+} dnssec_rdata;
+
+static dnssec_zone **zones;
+static size_t n_zones;
+static char *anchor_spec;
+static char anchor_zone[NS_MAXDNAME];
+static u_char *anchor_ds;   /* DS RDATA, each after a 16 bit length */
+static size_t anchor_ds_len;
+
+/* "Example.COM." and "example.com" are both "example.com", the root is "." */
+static void
+zone_name (char *dst, const char *src)
+{
+  char buf[NS_MAXDNAME];
+  size_t len;
+
+  snprintf (buf, sizeof (buf), "%s", *src ? src : ".");
+  strcpy (dst, buf);
+  len = strlen (dst);
+  if (len > 1 && dst[len - 1] == '.')
+    dst[len - 1] = '\0';
+  for (; *dst; dst++)
+    *dst = tolower ((unsigned char)*dst);
+}
+
+/* whether name is zone or below it */
+static int
+in_zone (const char *name, const char *zone)
+{
+  size_t len = strlen (name), zlen = strlen (zone);
+
+  if (strcmp (zone, ".") == 0 || strcmp (name, zone) == 0)
+    return TRUE;
+  return len > zlen && name[len - zlen - 1] == '.' && strcmp (name + len - zlen, zone) == 0;
+}
+
+static const char *
+type_text (int type)
+{
+  static char buf[16];
+  int i;
+
+  for (i = 0; record_types[i].name; i++)
+    if (record_types[i].type == type)
+      return record_types[i].name;
+  snprintf (buf, sizeof (buf), "TYPE%d", type);
+  return buf;
+}
+
+static void
+rdata_append (u_char **buf, size_t *len, const u_char *rdata, size_t n)
+{
+  if ((*buf = realloc (*buf, *len + 2 + n)) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  ns_put16 (n, *buf + *len);
+  memcpy (*buf + *len + 2, rdata, n);
+  *len += 2 + n;
+}
+
+/* Lower case the labels of a name in wire format, returning its length */
+static size_t
+wire_lower (u_char *name)
+{
+  u_char *p = name;
+  int n;
+
+  while ((n = *p++) != 0)
+    for (; n > 0; n--, p++)
+      *p = tolower (*p);
+  return p - name;
+}
+
+static int
+owner_wire (const char *name, u_char *buf, size_t size)
+{
+  if (ns_name_pton (name, buf, size) < 0)
+    return -1;
+  return wire_lower (buf);
+}
+
+/* RFC 4034 appendix B */
+static int
+dnskey_tag (const u_char *key, size_t len)
+{
+  unsigned long ac = 0;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    ac += (i & 1) ? key[i] : (unsigned long)key[i] << 8;
+  ac += (ac >> 16) & 0xffff;
+  return ac & 0xffff;
+}
+
+/* whether the DS RDATA is the digest of the DNSKEY RDATA of zone */
+static int
+ds_matches (const u_char *ds, size_t ds_len, const char *zone, const u_char *key, size_t key_len)
+{
+  u_char owner[NS_MAXCDNAME], digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  const EVP_MD *md;
+  EVP_MD_CTX *ctx;
+  int n;
+
+  if (ds_len < 5 || key_len < 4 || ns_get16 (ds) != dnskey_tag (key, key_len) || ds[2] != key[3])
+    return FALSE;
+  switch (ds[3]) {
+  case 1: md = EVP_sha1 (); break;
+  case 2: md = EVP_sha256 (); break;
+  case 4: md = EVP_sha384 (); break;
+  default: return FALSE;
+  }
+  if ((n = owner_wire (zone, owner, sizeof (owner))) < 0 || (ctx = EVP_MD_CTX_new ()) == NULL)
+    return FALSE;
+  if (EVP_DigestInit_ex (ctx, md, NULL) != 1 || EVP_DigestUpdate (ctx, owner, n) != 1
+      || EVP_DigestUpdate (ctx, key, key_len) != 1 || EVP_DigestFinal_ex (ctx, digest, &digest_len) != 1)
+    digest_len = 0;
+  EVP_MD_CTX_free (ctx);
+  return digest_len > 0 && digest_len == ds_len - 4 && memcmp (digest, ds + 4, digest_len) == 0;
+}
+
+static int
+sig_parse (ns_msg *handle, ns_rr *rr, dnssec_sig *s)
+{
+  const u_char *rd = ns_rr_rdata (*rr);
+  size_t rdlen = ns_rr_rdlen (*rr);
+  int n;
+
+  if (ns_rr_type (*rr) != DNSSEC_T_RRSIG || rdlen < 19)
+    return -1;
+  s->covered = ns_get16 (rd);
+  s->alg = rd[2];
+  s->labels = rd[3];
+  s->ttl = ns_get32 (rd + 4);
+  s->expiration = ns_get32 (rd + 8);
+  s->inception = ns_get32 (rd + 12);
+  s->tag = ns_get16 (rd + 16);
+  memcpy (s->head, rd, 18);
+  n = ns_name_unpack (ns_msg_base (*handle), ns_msg_end (*handle), rd + 18, s->head + 18, NS_MAXCDNAME);
+  if (n < 0 || (size_t)(18 + n) >= rdlen || ns_name_ntop (s->head + 18, s->signer, sizeof (s->signer)) < 0)
+    return -1;
+  zone_name (s->signer, s->signer);
+  s->head_len = 18 + wire_lower (s->head + 18);
+  s->sig = rd + 18 + n;
+  s->sig_len = rdlen - 18 - n;
+  return 0;
+}
+
+/* The RDATA of rr with its names uncompressed and in lower case, for the
+ * types RFC 4034 6.2 and RFC 4035 say so of */
+static int
+canonical_rdata (ns_msg *handle, ns_rr *rr, u_char *out)
+{
+  const u_char *rd = ns_rr_rdata (*rr), *end = rd + ns_rr_rdlen (*rr);
+  size_t fixed = 0, len;
+  int names = 1, strings = 0, n;
+
+  switch (ns_rr_type (*rr)) {
+  case ns_t_ns:
+  case ns_t_cname:
+  case ns_t_ptr:
+  case 39:                  /* DNAME */
+    break;
+  case ns_t_mx: fixed = 2; break;
+  case ns_t_srv: fixed = 6; break;
+  case ns_t_soa: names = 2; break;
+  case ns_t_naptr: fixed = 4; strings = 3; break;
+  default: names = 0;
+  }
+
+  /* fixed fields, character strings, names, then the rest as it is */
+  if ((size_t)(end - rd) < fixed)
+    return -1;
+  memcpy (out, rd, fixed);
+  len = fixed;
+  rd += fixed;
+  for (; strings > 0; strings--) {
+    if (rd >= end || *rd + 1 > end - rd)
+      return -1;
+    memcpy (out + len, rd, *rd + 1);
+    len += *rd + 1;
+    rd += *rd + 1;
+  }
+  for (; names > 0; names--) {
+    if ((n = ns_name_unpack (ns_msg_base (*handle), ns_msg_end (*handle), rd, out + len, NS_MAXCDNAME)) < 0)
+      return -1;
+    rd += n;
+    len += wire_lower (out + len);
+  }
+  if (rd > end)
+    return -1;
+  memcpy (out + len, rd, end - rd);
+  return len + (end - rd);
+}
+
+static int
+rdata_compare (const void *a, const void *b)
+{
+  const dnssec_rdata *x = a, *y = b;
+  int c = memcmp (x->data, y->data, min (x->len, y->len));
+
+  return c ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+/* What s signs: its RDATA up to the signature, then the RRset of owner in
+ * the answer section in canonical form and order (RFC 4034 6.2, 6.3) */
+static u_char *
+rrset_signed_data (ns_msg *handle, const char *owner, const dnssec_sig *s, size_t *len)
+{
+  u_char name[NS_MAXCDNAME + 2], *data = NULL, *p;
+  dnssec_rdata *rrs = NULL;
+  char rr_owner[NS_MAXDNAME];
+  size_t n_rrs = 0, name_len, i;
+  int labels, total, n;
+  ns_rr rr;
+  u_int j;
+
+  if ((n = owner_wire (owner, name, NS_MAXCDNAME)) < 0)
+    return NULL;
+  name_len = n;
+  for (p = name, total = 0; *p; p += *p + 1)
+    total++;
+  labels = (name[0] == 1 && name[1] == '*') ? total - 1 : total;
+  if (labels < s->labels)
+    return NULL;
+  if (labels > s->labels) {
+    /* an answer from a wildcard is signed as the wildcard */
+    for (p = name; total > s->labels; total--)
+      p += *p + 1;
+    name_len -= p - name;
+    memmove (name + 2, p, name_len);
+    name[0] = 1;
+    name[1] = '*';
+    name_len += 2;
+  }
+
+  for (j = 0; j < ns_msg_count (*handle, ns_s_an); j++) {
+    if (ns_parserr (handle, ns_s_an, j, &rr) < 0 || ns_rr_type (rr) != s->covered
+        || ns_rr_class (rr) != ns_c_in)
+      continue;
+    zone_name (rr_owner, ns_rr_name (rr));
+    if (strcmp (rr_owner, owner) != 0)
+      continue;
+    if ((rrs = realloc (rrs, (n_rrs + 1) * sizeof (dnssec_rdata))) == NULL
+        || (rrs[n_rrs].data = malloc (ns_rr_rdlen (rr) + 2 * NS_MAXCDNAME)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    if ((n = canonical_rdata (handle, &rr, rrs[n_rrs].data)) < 0) {
+      free (rrs[n_rrs].data);
+      continue;
+    }
+    rrs[n_rrs++].len = n;
+  }
+
+  if (n_rrs > 0) {
+    qsort (rrs, n_rrs, sizeof (dnssec_rdata), rdata_compare);
+    *len = s->head_len;
+    for (i = 0; i < n_rrs; i++)
+      *len += name_len + 10 + rrs[i].len;
+    if ((data = malloc (*len)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    memcpy (data, s->head, s->head_len);
+    p = data + s->head_len;
+    for (i = 0; i < n_rrs; i++) {
+      if (i > 0 && rdata_compare (&rrs[i - 1], &rrs[i]) == 0)
+        continue;
+      memcpy (p, name, name_len);
+      p += name_len;
+      ns_put16 (s->covered, p);
+      ns_put16 (ns_c_in, p + 2);
+      ns_put32 (s->ttl, p + 4);
+      ns_put16 (rrs[i].len, p + 8);
+      memcpy (p + 10, rrs[i].data, rrs[i].len);
+      p += 10 + rrs[i].len;
+    }
+    *len = p - data;
+  }
+
+  for (i = 0; i < n_rrs; i++)
+    free (rrs[i].data);
+  free (rrs);
+  return data;
+}
+
+/* Check the signature s over data with the DNSKEY RDATA key */
+static int
+signature_verify (const u_char *key, size_t key_len, const dnssec_sig *s,
+                  const u_char *data, size_t data_len)
+{
+  const u_char *pk = key + 4, *sig = s->sig;
+  size_t pk_len = key_len - 4, sig_len = s->sig_len, half, exp_len;
+  const EVP_MD *md = NULL;
+  EVP_PKEY *pkey = NULL;
+  EVP_MD_CTX *ctx;
+  u_char *der = NULL, point[1 + 96];
+  BIGNUM *e, *n;
+  ECDSA_SIG *es;
+  EC_KEY *ec;
+  RSA *rsa;
+  int ok = FALSE, der_len;
+
+  switch (s->alg) {
+  case 8:                   /* RSA/SHA-256 */
+  case 10:                  /* RSA/SHA-512 */
+    md = s->alg == 8 ? EVP_sha256 () : EVP_sha512 ();
+    if (pk_len < 3)
+      return FALSE;
+    exp_len = *pk++;
+    pk_len--;
+    if (exp_len == 0) {
+      exp_len = ns_get16 (pk);
+      pk += 2;
+      pk_len -= 2;
+    }
+    if (exp_len == 0 || exp_len >= pk_len)
+      return FALSE;
+    e = BN_bin2bn (pk, exp_len, NULL);
+    n = BN_bin2bn (pk + exp_len, pk_len - exp_len, NULL);
+    rsa = RSA_new ();
+    if (e == NULL || n == NULL || rsa == NULL || RSA_set0_key (rsa, n, e, NULL) != 1) {
+      BN_free (e);
+      BN_free (n);
+      RSA_free (rsa);
+      return FALSE;
+    }
+    if ((pkey = EVP_PKEY_new ()) != NULL && EVP_PKEY_assign_RSA (pkey, rsa) != 1) {
+      EVP_PKEY_free (pkey);
+      pkey = NULL;
+    }
+    if (pkey == NULL)
+      RSA_free (rsa);
+    break;
+  case 13:                  /* ECDSA P-256 with SHA-256 */
+  case 14:                  /* ECDSA P-384 with SHA-384 */
+    md = s->alg == 13 ? EVP_sha256 () : EVP_sha384 ();
+    half = s->alg == 13 ? 32 : 48;
+    if (pk_len != 2 * half || sig_len != 2 * half)
+      return FALSE;
+    if ((ec = EC_KEY_new_by_curve_name (s->alg == 13 ? NID_X9_62_prime256v1 : NID_secp384r1)) == NULL)
+      return FALSE;
+    point[0] = POINT_CONVERSION_UNCOMPRESSED;
+    memcpy (point + 1, pk, pk_len);
+    if (EC_KEY_oct2key (ec, point, pk_len + 1, NULL) != 1
+        || (pkey = EVP_PKEY_new ()) == NULL || EVP_PKEY_assign_EC_KEY (pkey, ec) != 1) {
+      EVP_PKEY_free (pkey);
+      EC_KEY_free (ec);
+      return FALSE;
+    }
+    /* r and s side by side, where OpenSSL wants them in DER */
+    es = ECDSA_SIG_new ();
+    e = BN_bin2bn (sig, half, NULL);
+    n = BN_bin2bn (sig + half, half, NULL);
+    if (es == NULL || e == NULL || n == NULL || ECDSA_SIG_set0 (es, e, n) != 1) {
+      BN_free (e);
+      BN_free (n);
+      der_len = -1;
+    }
+    else
+      der_len = i2d_ECDSA_SIG (es, &der);
+    ECDSA_SIG_free (es);
+    if (der_len <= 0) {
+      EVP_PKEY_free (pkey);
+      return FALSE;
+    }
+    sig = der;
+    sig_len = der_len;
+    break;
+  case 15:                  /* Ed25519 */
+    pkey = EVP_PKEY_new_raw_public_key (EVP_PKEY_ED25519, NULL, pk, pk_len);
+    break;
+  default:
+    return FALSE;
+  }
+
+  if (pkey != NULL && (ctx = EVP_MD_CTX_new ()) != NULL) {
+    ok = EVP_DigestVerifyInit (ctx, NULL, md, NULL, pkey) == 1
+      && EVP_DigestVerify (ctx, sig, sig_len, data, data_len) == 1;
+    EVP_MD_CTX_free (ctx);
+  }
+  EVP_PKEY_free (pkey);
+  OPENSSL_free (der);
+  return ok;
+}
+
+/* the signer of the first RRSIG over the RRset of owner and type */
+static int
+rrset_signer (ns_msg *handle, const char *owner, int type, char *signer)
+{
+  char rr_owner[NS_MAXDNAME];
+  dnssec_sig s;
+  ns_rr rr;
+  u_int i;
+
+  for (i = 0; i < ns_msg_count (*handle, ns_s_an); i++) {
+    if (ns_parserr (handle, ns_s_an, i, &rr) < 0 || sig_parse (handle, &rr, &s) < 0 || s.covered != type)
+      continue;
+    zone_name (rr_owner, ns_rr_name (rr));
+    if (strcmp (rr_owner, owner) == 0) {
+      strcpy (signer, s.signer);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* Verify the RRset of owner and type in the answer section with the keys
+ * of signer. Returns when the signature that verified expires, and the
+ * TTL of the RRset, or 0 with *msg telling why none did. */
+static time_t
+rrset_verify (ns_msg *handle, const char *owner, int type, const char *signer,
+              const u_char *keys, size_t keys_len, uint32_t *ttl, char **msg)
+{
+  char rr_owner[NS_MAXDNAME];
+  time_t now = time (NULL), expires = 0;
+  const u_char *p;
+  u_char *data;
+  size_t data_len, n;
+  dnssec_sig s;
+  ns_rr rr;
+  int found;
+  u_int i;
+
+  *msg = NULL;
+  *ttl = UINT32_MAX;
+  for (i = 0; i < ns_msg_count (*handle, ns_s_an); i++) {
+    if (ns_parserr (handle, ns_s_an, i, &rr) < 0)
+      continue;
+    zone_name (rr_owner, ns_rr_name (rr));
+    if (strcmp (rr_owner, owner) != 0)
+      continue;
+    if (ns_rr_type (rr) == type) {
+      *ttl = min (*ttl, ns_rr_ttl (rr));
+      continue;
+    }
+    if (sig_parse (handle, &rr, &s) < 0 || s.covered != type || strcmp (s.signer, signer) != 0)
+      continue;
+
+    if ((int32_t)(now - s.inception) < 0) {
+      xasprintf (msg, _("signature over %s/%s by %s not valid yet"), owner, type_text (type), signer);
+      continue;
+    }
+    if ((int32_t)(s.expiration - now) < 0) {
+      xasprintf (msg, _("signature over %s/%s by %s expired"), owner, type_text (type), signer);
+      continue;
+    }
+    if ((data = rrset_signed_data (handle, owner, &s, &data_len)) == NULL) {
+      xasprintf (msg, _("invalid signature over %s/%s"), owner, type_text (type));
+      continue;
+    }
+    found = FALSE;
+    for (p = keys; !found && p + 2 <= keys + keys_len; p += 2 + n) {
+      n = ns_get16 (p);
+      if (n >= 4 && p[2 + 3] == s.alg && dnskey_tag (p + 2, n) == s.tag)
+        found = signature_verify (p + 2, n, &s, data, data_len);
+    }
+    free (data);
+    if (!found) {
+      xasprintf (msg, _("no key of %s verifies the signature over %s/%s"), signer, owner, type_text (type));
+      continue;
+    }
+    expires = max (expires, now + (int32_t)(s.expiration - now));
+    *ttl = min (*ttl, s.ttl);
+  }
+
+  if (expires > 0)
+    *msg = NULL;
+  else if (*msg == NULL)
+    xasprintf (msg, _("no signature over %s/%s by %s"), owner, type_text (type), signer);
+  return expires;
+}
+
+static dnssec_zone *
+zone_find (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < n_zones; i++)
+    if (strcmp (zones[i]->name, name) == 0)
+      return zones[i];
+  return NULL;
+}
+
+static dnssec_zone *
+zone_want (const char *name)
+{
+  dnssec_zone *z;
+
+  if ((z = zone_find (name)) != NULL)
+    return z;
+  if ((zones = realloc (zones, (n_zones + 1) * sizeof (dnssec_zone *))) == NULL
+      || (z = calloc (1, sizeof (dnssec_zone))) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  snprintf (z->name, sizeof (z->name), "%s", name);
+  z->status = ZONE_WANTED;
+  zones[n_zones++] = z;
+  return z;
+}
+
+static void
+zone_fail (dnssec_zone *z, char *message)
+{
+  z->status = ZONE_FAILED;
+  z->message = message;
+  if (verbose)
+    printf ("DNSSEC %s: %s\n", z->name, message);
+}
+
+/* "ZONE KEYTAG ALGORITHM DIGESTTYPE DIGEST", as a DS record reads */
+static void
+anchor_parse (const char *spec)
+{
+  u_char ds[4 + EVP_MAX_MD_SIZE];
+  char zone[NS_MAXDNAME];
+  const char *p;
+  unsigned int tag, alg, digest_type, byte;
+  size_t len = 4;
+  int n = 0;
+
+  if (sscanf (spec, "%1024s %u %u %u %n", zone, &tag, &alg, &digest_type, &n) < 4 || n == 0
+      || tag > 65535 || alg > 255 || digest_type > 255)
+    usage2 (_("Invalid trust anchor"), spec);
+  for (p = spec + n; *p; p += 2) {
+    if (isspace ((unsigned char)*p)) {
+      p--;
+      continue;
+    }
+    if (len >= sizeof (ds) || sscanf (p, "%2x", &byte) != 1 || !isxdigit ((unsigned char)p[1]))
+      usage2 (_("Invalid trust anchor"), spec);
+    ds[len++] = byte;
+  }
+  if (len == 4)
+    usage2 (_("Invalid trust anchor"), spec);
+  zone_name (zone, zone);
+  if (anchor_ds_len > 0 && strcmp (zone, anchor_zone) != 0)
+    usage2 (_("All trust anchors must be for the same zone"), spec);
+  snprintf (anchor_zone, sizeof (anchor_zone), "%s", zone);
+  ns_put16 (tag, ds);
+  ds[2] = alg;
+  ds[3] = digest_type;
+  rdata_append (&anchor_ds, &anchor_ds_len, ds, len);
+  if (anchor_spec == NULL)
+    anchor_spec = strdup (spec);
+  else
+    xasprintf (&anchor_spec, "%s\n%s", anchor_spec, spec);
+}
+
+/* Query the DNSKEY and DS RRsets of the zones wanted, and of the zones
+ * signing the DS RRsets in turn, until the anchor or the cache is reached */
+static void
+dnssec_fetch (void)
+{
+  dig_record *queries, *q;
+  size_t count, size, i;
+  char *message = NULL;
+  ns_msg handle;
+  dnssec_zone *z;
+  int round;
+
+  for (round = 1;; round++) {
+    queries = NULL;
+    count = size = 0;
+    for (i = 0; i < n_zones; i++) {
+      z = zones[i];
+      if (z->status != ZONE_WANTED)
+        continue;
+      if (strcmp (z->name, ".") == 0 && strcmp (anchor_zone, ".") != 0) {
+        xasprintf (&message, _("no chain of trust to the anchor %s"), anchor_zone);
+        zone_fail (z, message);
+        continue;
+      }
+      z->round = round;
+      z->dnskey_query = count;
+      add_record (&queries, &count, &size, z->name, "DNSKEY", NULL, dns_server);
+      z->ds_query = count;
+      if (strcmp (z->name, anchor_zone) != 0)
+        add_record (&queries, &count, &size, z->name, "DS", NULL, dns_server);
+    }
+    if (count == 0)
+      break;
+
+    alarm (((count + concurrency - 1) / concurrency) * (timeout_interval + try_timeout) + 1);
+    run_queries (queries, count);
+
+    for (i = 0; i < n_zones; i++) {
+      z = zones[i];
+      if (z->status != ZONE_WANTED || z->round != round)
+        continue;
+      q = &queries[z->dnskey_query];
+      if (q->result != STATE_OK) {
+        xasprintf (&message, _("DNSKEY of %s: %s"), z->name, q->message);
+        zone_fail (z, message);
+        continue;
+      }
+      z->dnskey_reply = q->answer;
+      z->dnskey_len = q->answer_len;
+      z->status = ZONE_FETCHED;
+      if (strcmp (z->name, anchor_zone) == 0)
+        continue;
+
+      /* no DS, no chain: an unsigned delegation fails here */
+      q = &queries[z->ds_query];
+      if (q->result != STATE_OK) {
+        xasprintf (&message, _("DS of %s: %s"), z->name, q->message);
+        zone_fail (z, message);
+        continue;
+      }
+      z->ds_reply = q->answer;
+      z->ds_len = q->answer_len;
+      if (ns_initparse (z->ds_reply, z->ds_len, &handle) < 0
+          || rrset_signer (&handle, z->name, DNSSEC_T_DS, z->parent) < 0) {
+        xasprintf (&message, _("DS of %s is not signed"), z->name);
+        zone_fail (z, message);
+        continue;
+      }
+      if (strcmp (z->parent, z->name) == 0 || !in_zone (z->name, z->parent)) {
+        xasprintf (&message, _("DS of %s is signed by %s"), z->name, z->parent);
+        zone_fail (z, message);
+        continue;
+      }
+      zone_want (z->parent);
+    }
+    free (queries);
+  }
+}
+
+/* Trust the DNSKEY RRset of z if one of the keys matches a DS, from the
+ * anchor or signed by the parent zone, and signs it */
+static void
+zone_validate (dnssec_zone *z)
+{
+  u_char *ds = NULL, *trusted = NULL;
+  size_t ds_len = 0, trusted_len = 0, n;
+  time_t now = time (NULL), sig_expires, dnskey_expires, expires;
+  uint32_t ds_ttl = UINT32_MAX, dnskey_ttl;
+  const u_char *rd, *p;
+  dnssec_zone *parent;
+  char owner[NS_MAXDNAME], *message = NULL, *msg;
+  ns_msg handle;
+  ns_rr rr;
+  u_int i;
+
+  if (strcmp (z->name, anchor_zone) == 0) {
+    ds = anchor_ds;
+    ds_len = anchor_ds_len;
+    sig_expires = expires = DNSSEC_NEVER;
+  }
+  else {
+    parent = zone_find (z->parent);
+    ns_initparse (z->ds_reply, z->ds_len, &handle);
+    sig_expires = rrset_verify (&handle, z->name, DNSSEC_T_DS, parent->name, parent->keys,
+                                parent->keys_len, &ds_ttl, &msg);
+    if (sig_expires == 0) {
+      xasprintf (&message, _("DS of %s: %s"), z->name, msg);
+      zone_fail (z, message);
+      return;
+    }
+    for (i = 0; i < ns_msg_count (handle, ns_s_an); i++) {
+      if (ns_parserr (&handle, ns_s_an, i, &rr) < 0 || ns_rr_type (rr) != DNSSEC_T_DS)
+        continue;
+      zone_name (owner, ns_rr_name (rr));
+      if (strcmp (owner, z->name) == 0)
+        rdata_append (&ds, &ds_len, ns_rr_rdata (rr), ns_rr_rdlen (rr));
+    }
+    sig_expires = min (sig_expires, parent->sig_expires);
+    expires = parent->expires;
+  }
+
+  /* the zone keys, and the ones the DS set vouches for */
+  if (ns_initparse (z->dnskey_reply, z->dnskey_len, &handle) < 0) {
+    xasprintf (&message, _("Invalid DNSKEY reply for %s"), z->name);
+    zone_fail (z, message);
+    return;
+  }
+  for (i = 0; i < ns_msg_count (handle, ns_s_an); i++) {
+    if (ns_parserr (&handle, ns_s_an, i, &rr) < 0 || ns_rr_type (rr) != DNSSEC_T_DNSKEY
+        || ns_rr_rdlen (rr) < 5)
+      continue;
+    zone_name (owner, ns_rr_name (rr));
+    rd = ns_rr_rdata (rr);
+    if (strcmp (owner, z->name) != 0 || !(rd[0] & 0x01) || rd[2] != 3)
+      continue;
+    rdata_append (&z->keys, &z->keys_len, rd, ns_rr_rdlen (rr));
+    for (p = ds; p + 2 <= ds + ds_len; p += 2 + n) {
+      n = ns_get16 (p);
+      if (ds_matches (p + 2, n, z->name, rd, ns_rr_rdlen (rr))) {
+        rdata_append (&trusted, &trusted_len, rd, ns_rr_rdlen (rr));
+        break;
+      }
+    }
+  }
+  if (ds != anchor_ds)
+    free (ds);
+
+  if (trusted_len == 0) {
+    xasprintf (&message, _("no DNSKEY of %s matches its DS"), z->name);
+    zone_fail (z, message);
+    return;
+  }
+  dnskey_expires = rrset_verify (&handle, z->name, DNSSEC_T_DNSKEY, z->name, trusted, trusted_len,
+                                 &dnskey_ttl, &msg);
+  free (trusted);
+  if (dnskey_expires == 0) {
+    xasprintf (&message, _("DNSKEY of %s: %s"), z->name, msg);
+    zone_fail (z, message);
+    return;
+  }
+
+  z->sig_expires = min (sig_expires, dnskey_expires);
+  expires = min (expires, now + (time_t)min (ds_ttl, dnskey_ttl));
+  z->expires = min (expires, z->sig_expires);
+  z->status = ZONE_VALID;
+  if (verbose)
+    printf ("DNSSEC %s: keys valid for %ld seconds\n", z->name, (long)(z->expires - now));
+}
+
+/* Validate the zones fetched top down, each once its parent is */
+static void
+dnssec_chain (void)
+{
+  char *message = NULL;
+  dnssec_zone *z, *parent;
+  int progress;
+  size_t i;
+
+  do {
+    progress = FALSE;
+    for (i = 0; i < n_zones; i++) {
+      z = zones[i];
+      if (z->status != ZONE_FETCHED)
+        continue;
+      parent = strcmp (z->name, anchor_zone) == 0 ? NULL : zone_find (z->parent);
+      if (parent != NULL && parent->status == ZONE_FAILED) {
+        xasprintf (&message, _("chain of trust broken at %s"), parent->message);
+        zone_fail (z, message);
+      }
+      else if (parent == NULL || parent->status == ZONE_VALID)
+        zone_validate (z);
+      else
+        continue;
+      progress = TRUE;
+    }
+  } while (progress);
+}
+
+static void
+dnssec_cache_enable (void)
+{
+  struct sha1_ctx ctx;
+  unsigned char result[20];
+  char key[7 + 2 * 20 + 1];
+  int i;
+
+  sha1_init_ctx (&ctx);
+  sha1_process_bytes (anchor_spec, strlen (anchor_spec), &ctx);
+  sha1_finish_ctx (&ctx, &result);
+  strcpy (key, "dnssec_");
+  for (i = 0; i < 20; i++)
+    sprintf (&key[7 + 2 * i], "%02x", result[i]);
+  np_enable_state (key, 1);
+}
+
+/* "ZONE EXPIRES SIG_EXPIRES KEY,KEY,..." lines, the keys in hex */
+static void
+dnssec_cache_load (void)
+{
+  state_data *data;
+  char name[NS_MAXDNAME], *line, *next, *p;
+  u_char key[4096];
+  long expires, sig_expires;
+  time_t now = time (NULL);
+  unsigned int byte;
+  dnssec_zone *z;
+  size_t len;
+  int n;
+
+  if ((data = np_state_read ()) == NULL || data->data == NULL)
+    return;
+  for (line = data->data; line != NULL && *line; line = next) {
+    if ((next = strchr (line, '\n')) != NULL)
+      *next++ = '\0';
+    n = 0;
+    if (sscanf (line, "%1024s %ld %ld %n", name, &expires, &sig_expires, &n) < 3 || n == 0
+        || expires <= now || zone_find (name) != NULL)
+      continue;
+    z = zone_want (name);
+    for (p = line + n, len = 0; *p; p++) {
+      if (*p == ',') {
+        rdata_append (&z->keys, &z->keys_len, key, len);
+        len = 0;
+      }
+      else if (len < sizeof (key) && sscanf (p, "%2x", &byte) == 1 && p[1] != '\0') {
+        key[len++] = byte;
+        p++;
+      }
+    }
+    if (len > 0)
+      rdata_append (&z->keys, &z->keys_len, key, len);
+    z->expires = expires;
+    z->sig_expires = sig_expires;
+    z->status = ZONE_VALID;
+    if (verbose)
+      printf ("DNSSEC %s: keys from the cache, valid for %ld seconds\n", name, (long)(expires - now));
+  }
+}
+
+static void
+dnssec_cache_save (void)
+{
+  char *data = strdup (""), *line = NULL;
+  const u_char *p;
+  size_t i, n, k;
+  dnssec_zone *z;
+
+  for (i = 0; i < n_zones; i++) {
+    z = zones[i];
+    if (z->status != ZONE_VALID || z->expires <= time (NULL))
+      continue;
+    xasprintf (&line, "%s %ld %ld ", z->name, (long)z->expires, (long)z->sig_expires);
+    for (p = z->keys; p + 2 <= z->keys + z->keys_len; p += 2 + n) {
+      n = ns_get16 (p);
+      for (k = 0; k < n; k++)
+        xasprintf (&line, "%s%02x", line, p[2 + k]);
+      if (p + 2 + n < z->keys + z->keys_len)
+        xasprintf (&line, "%s,", line);
+    }
+    xasprintf (&data, "%s%s\n", data, line);
+  }
+  np_state_write_binary (0, data, strlen (data));
+}
+
+/* Verify every RRset in the answer to r with the keys of its zone */
+static void
+dnssec_check_record (dig_record *r)
+{
+  char owner[NS_MAXDNAME], other[NS_MAXDNAME], signer[NS_MAXDNAME];
+  char *message = NULL, *msg = NULL;
+  time_t now = time (NULL), first = DNSSEC_NEVER, expires;
+  uint32_t ttl;
+  dnssec_zone *z;
+  ns_msg handle;
+  ns_rr rr, seen;
+  double days;
+  u_int i, j;
+
+  if (r->result != STATE_OK || ns_initparse (r->answer, r->answer_len, &handle) < 0)
+    return;
+
+  for (i = 0; i < ns_msg_count (handle, ns_s_an); i++) {
+    if (ns_parserr (&handle, ns_s_an, i, &rr) < 0 || ns_rr_type (rr) == DNSSEC_T_RRSIG)
+      continue;
+    zone_name (owner, ns_rr_name (rr));
+    for (j = 0; j < i; j++) {
+      if (ns_parserr (&handle, ns_s_an, j, &seen) < 0 || ns_rr_type (seen) != ns_rr_type (rr))
+        continue;
+      zone_name (other, ns_rr_name (seen));
+      if (strcmp (owner, other) == 0)
+        break;
+    }
+    if (j < i)
+      continue;
+
+    if (rrset_signer (&handle, owner, ns_rr_type (rr), signer) < 0)
+      xasprintf (&msg, _("%s/%s is not signed"), owner, type_text (ns_rr_type (rr)));
+    else if (!in_zone (owner, signer))
+      xasprintf (&msg, _("%s/%s is signed by %s"), owner, type_text (ns_rr_type (rr)), signer);
+    else if ((z = zone_find (signer)) == NULL || z->status != ZONE_VALID)
+      msg = z ? z->message : (char *)_("no keys");
+    else if ((expires = rrset_verify (&handle, owner, ns_rr_type (rr), signer,
+                                      z->keys, z->keys_len, &ttl, &msg)) > 0) {
+      first = min (first, min (expires, z->sig_expires));
+      continue;
+    }
+    xasprintf (&message, _("DNSSEC: %s"), msg);
+    record_finish (r, STATE_CRITICAL, message);
+    return;
+  }
+
+  days = (double)(first - now) / 86400;
+  if (signature_days_crit >= 0 && days < signature_days_crit)
+    r->result = STATE_CRITICAL;
+  else if (signature_days_warn >= 0 && days < signature_days_warn)
+    r->result = STATE_WARNING;
+  xasprintf (&r->message, _("%s, DNSSEC signatures valid for %.1f more days"), r->message, days);
+}
+
+static void
+dnssec_validate (dig_record *records, size_t count)
+{
+  char signer[NS_MAXDNAME];
+  dnssec_sig s;
+  ns_msg handle;
+  ns_rr rr;
+  size_t i, cached;
+  u_int j;
+
+  dnssec_cache_enable ();
+  dnssec_cache_load ();
+  cached = n_zones;
+
+  /* the zones signing the answers */
+  for (i = 0; i < count; i++) {
+    if (records[i].result != STATE_OK
+        || ns_initparse (records[i].answer, records[i].answer_len, &handle) < 0)
+      continue;
+    for (j = 0; j < ns_msg_count (handle, ns_s_an); j++)
+      if (ns_parserr (&handle, ns_s_an, j, &rr) == 0 && sig_parse (&handle, &rr, &s) == 0) {
+        strcpy (signer, s.signer);
+        zone_want (signer);
+      }
+  }
+
+  dnssec_fetch ();
+  dnssec_chain ();
+  for (i = 0; i < count; i++)
+    dnssec_check_record (&records[i]);
+
+  if (n_zones > cached)
+    dnssec_cache_save ();
+}
+#endif /* HAVE_DNSSEC */
+
+static int
+run_records (void)
+{
+  dig_record *records;
+  size_t count, i;
+  int states[STATE_DEPENDENT + 1] = { 0 };
+  int result = STATE_OK;
+  char *label = NULL;
+
+  records = read_records (records_file, &count);
+  try_timeout = (double)timeout_interval / number_tries;
+  /* every window of records gets all tries, and one more for TCP */
+  alarm (((count + concurrency - 1) / concurrency) * (timeout_interval + try_timeout) + 1);
+
+  run_queries (records, count);
+#ifdef HAVE_DNSSEC
+  if (dnssec)
+    dnssec_validate (records, count);
+#endif
+
+  for (i = 0; i < count; i++) {
+    dig_record *r = &records[i];
+    if (critical_interval > UNDEFINED && r->elapsed > critical_interval)
+      r->result = max_state (r->result, STATE_CRITICAL);
+    else if (warning_interval > UNDEFINED && r->elapsed > warning_interval)
+      r->result = max_state (r->result, STATE_WARNING);
+    result = max_state (result, r->result);
+    if (r->result >= STATE_OK && r->result <= STATE_DEPENDENT)
+      states[r->result]++;
+  }
+
+  printf (_("DNS %s - %lu records: %d ok, %d warning, %d critical, %d unknown"),
+          state_text (result), (unsigned long)count, states[STATE_OK],
+          states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+  printf ("|");
+  for (i = 0; i < count; i++) {
+    if (records[i].server == dns_server)
+      xasprintf (&label, "%s/%s", records[i].name, records[i].type_name);
+    else
+      xasprintf (&label, "%s/%s@%s", records[i].name, records[i].type_name, records[i].server);
+    printf ("%s%s", i ? " " : "",
+            fperfdata (label, records[i].elapsed, "s",
+                       (warning_interval>UNDEFINED?TRUE:FALSE), warning_interval,
+                       (critical_interval>UNDEFINED?TRUE:FALSE), critical_interval,
+                       TRUE, 0, FALSE, 0));
+    free (label);
+  }
+  putchar ('\n');
+
+  for (i = 0; i < count; i++)
+    printf ("%s %s %s: %.3f seconds response time (%s)\n", state_text (records[i].result),
+            records[i].name, records[i].type_name, records[i].elapsed,
+            records[i].message ? records[i].message : "");
+
+  return result;
+}
+#endif
+
+#ifdef PATH_TO_DIG
+/* how far answer_line() got in the output of dig */
+struct answer_state {
+  int in_answer;   /* seen ";; ANSWER SECTION:" */
+  char *found;     /* the line with the address, once seen */
+};
+
+/* Look for the address in the ANSWER SECTION of the output of dig as it
+ * comes in, and stop reading once it was found */
+static int
+answer_line (char *line, void *data)
+{
+  struct answer_state *st = data;
+  char *t;
+
+  /* the server is responding, we just got the host name... */
+  if (!st->in_answer && strstr (line, ";; ANSWER SECTION:"))
+    st->in_answer = TRUE;
+  if (!st->in_answer)
+    return 0;
+
+  /* get the host address */
+  if (verbose)
+    printf ("%s\n", line);
+
+  if (strcasestr (line, (expected_address == NULL ? query_address : expected_address)) != NULL) {
+    st->found = strdup (line);
+
+    /* Translate output TAB -> SPACE */
+    t = st->found;
+    while ((t = strchr(t, '\t')) != NULL) *t = ' ';
+    return 1;
+  }
+  return 0;
+}
+#endif
+
 int
 main (int argc, char **argv)
 {
+#ifdef PATH_TO_DIG
   char *command_line;
-  output chld_out, chld_err;
-  char *msg = NULL;
+  output chld_err;
+  struct answer_state answer;
   size_t i;
-  char *t;
+  int timeout_interval_dig;
+#else
+  dig_record *record = NULL;
+  size_t count = 0, size = 0;
+#endif
+  char *msg = NULL;
   long microsec;
   double elapsed_time;
   int result = STATE_UNKNOWN;
-  int timeout_interval_dig;
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  np_locale_init ();
 
   /* Set signal handling and alarm */
   if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR)
@@ -90,6 +1804,14 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage_va(_("Could not parse arguments"));
 
+#ifdef HAVE_RES_NSEND
+  if (dnssec)
+    np_init ((char *) progname, argc, argv);
+  if (records_file != NULL)
+    return run_records ();
+#endif
+
+#ifdef PATH_TO_DIG
   /* dig applies the timeout to each try, so we need to work around this */
   timeout_interval_dig = timeout_interval / number_tries + number_tries;
 
@@ -109,41 +1831,23 @@ main (int argc, char **argv)
     }
   }
 
-  /* run the command */
-  if(np_runcmd(command_line, &chld_out, &chld_err, 0) != 0) {
+  /* run the command, which is done with as soon as the answer is in */
+  memset (&answer, 0, sizeof (answer));
+  switch (np_runcmd_lines(command_line, answer_line, &answer, &chld_err, 0)) {
+  case 0:
+  case CMD_STOPPED:
+    break;
+  default:
     result = STATE_WARNING;
     msg = (char *)_("dig returned an error status");
   }
 
-  for(i = 0; i < chld_out.lines; i++) {
-    /* the server is responding, we just got the host name... */
-    if (strstr (chld_out.line[i], ";; ANSWER SECTION:")) {
-
-      /* loop through the whole 'ANSWER SECTION' */
-      for(; i < chld_out.lines; i++) {
-        /* get the host address */
-        if (verbose)
-          printf ("%s\n", chld_out.line[i]);
-
-        if (strcasestr (chld_out.line[i], (expected_address == NULL ? query_address : expected_address)) != NULL) {
-          msg = chld_out.line[i];
-          result = STATE_OK;
-
-          /* Translate output TAB -> SPACE */
-          t = msg;
-          while ((t = strchr(t, '\t')) != NULL) *t = ' ';
-          break;
-        }
-      }
-
-      if (result == STATE_UNKNOWN) {
-        msg = (char *)_("Server not found in ANSWER SECTION");
-        result = STATE_WARNING;
-      }
-
-      /* we found the answer section, so break out of the loop */
-      break;
-    }
+  if (answer.found != NULL) {
+    msg = answer.found;
+    result = STATE_OK;
+  } else if (answer.in_answer && result == STATE_UNKNOWN) {
+    msg = (char *)_("Server not found in ANSWER SECTION");
+    result = STATE_WARNING;
   }
 
   if (result == STATE_UNKNOWN) {
@@ -162,6 +1866,22 @@ main (int argc, char **argv)
       }
     }
   }
+#else
+  /* without dig, the query goes through the code of --records */
+  if (strlen (dig_args) > 0)
+    usage4 (_("-A needs dig, which was not found when check_dig was built"));
+  add_record (&record, &count, &size, query_address, record_type, expected_address, dns_server);
+  try_timeout = (double)timeout_interval / number_tries;
+  alarm (timeout_interval + try_timeout + 1);
+  gettimeofday (&tv, NULL);
+
+  if (verbose)
+    printf (_("Looking for: '%s'\n"), expected_address != NULL ? expected_address : query_address);
+
+  run_queries (record, count);
+  result = record->result;
+  msg = record->message;
+#endif
 
   microsec = deltime (tv);
   elapsed_time = (double)microsec / 1.0e6;
@@ -193,6 +1913,13 @@ process_arguments (int argc, char **argv)
   int c;
 
   int option = 0;
+  enum {
+    RECORDS_OPTION = CHAR_MAX + 1,
+    CONCURRENCY_OPTION,
+    DNSSEC_OPTION,
+    TRUST_ANCHOR_OPTION,
+    SIGNATURE_EXPIRY_OPTION
+  };
   static struct option longopts[] = {
     {"hostname", required_argument, 0, 'H'},
     {"query_address", required_argument, 0, 'l'},
@@ -208,6 +1935,11 @@ process_arguments (int argc, char **argv)
     {"port", required_argument, 0, 'p'},
     {"use-ipv4", no_argument, 0, '4'},
     {"use-ipv6", no_argument, 0, '6'},
+    {"records", required_argument, 0, RECORDS_OPTION},
+    {"concurrency", required_argument, 0, CONCURRENCY_OPTION},
+    {"dnssec", no_argument, 0, DNSSEC_OPTION},
+    {"trust-anchor", required_argument, 0, TRUST_ANCHOR_OPTION},
+    {"signature-expiry", required_argument, 0, SIGNATURE_EXPIRY_OPTION},
     {0, 0, 0, 0}
   };
 
@@ -280,9 +2012,39 @@ process_arguments (int argc, char **argv)
       break;
     case '4':
       query_transport = "-4";
+      address_family = AF_INET;
       break;
     case '6':
       query_transport = "-6";
+      address_family = AF_INET6;
+      break;
+    case RECORDS_OPTION:
+#ifdef HAVE_RES_NSEND
+      records_file = optarg;
+#else
+      usage4 (_("check_dig was built without res_nsend()"));
+#endif
+      break;
+    case CONCURRENCY_OPTION:
+      if (!is_intpos (optarg))
+        usage_va(_("Concurrency must be a positive integer - %s"), optarg);
+      concurrency = atoi (optarg);
+      break;
+    case DNSSEC_OPTION:
+    case TRUST_ANCHOR_OPTION:
+    case SIGNATURE_EXPIRY_OPTION:
+#ifdef HAVE_DNSSEC
+      dnssec = TRUE;
+      if (c == TRUST_ANCHOR_OPTION)
+        anchor_parse (optarg);
+      else if (c == SIGNATURE_EXPIRY_OPTION) {
+        if (sscanf (optarg, "%d,%d", &signature_days_warn, &signature_days_crit) < 1
+            || signature_days_warn < 0 || signature_days_crit < -1)
+          usage2 (_("Invalid signature expiry thresholds"), optarg);
+      }
+#else
+      usage4 (_("check_dig was built without DNSSEC support, which needs res_nsend() and OpenSSL"));
+#endif
       break;
     default:                  /* usage5 */
       usage5();
@@ -311,7 +2073,13 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
-  if (query_address != NULL)
+  if (dnssec && records_file == NULL)
+    usage4 (_("--dnssec only works with --records"));
+#ifdef HAVE_DNSSEC
+  if (dnssec && anchor_ds_len == 0)
+    anchor_parse (DNSSEC_ROOT_ANCHOR);
+#endif
+  if (query_address != NULL || records_file != NULL)
     return OK;
   else
     return ERROR;
@@ -356,6 +2124,28 @@ print_help (void)
   printf ("    %s\n",_("was in -l"));
   printf (" %s\n","-A, --dig-arguments=STRING");
   printf ("    %s\n",_("Pass STRING as argument(s) to dig"));
+#ifdef HAVE_RES_NSEND
+  printf (" %s\n","--records=FILE");
+  printf ("    %s\n",_("Query all records listed in FILE (\"-\" for stdin) from this process instead"));
+  printf ("    %s\n",_("of running dig, one \"[@server] name [type [expected]]\" per line. Server,"));
+  printf ("    %s\n",_("type and expected answer default to -H, -T and -a"));
+  printf (" %s\n","--concurrency=INTEGER");
+  printf ("    %s\n",_("Maximum number of queries in flight with --records"));
+  printf ("    %s%d\n",_("Default: "), DEFAULT_CONCURRENCY);
+#endif
+#ifdef HAVE_DNSSEC
+  printf (" %s\n","--dnssec");
+  printf ("    %s\n",_("With --records, ask for the signatures and verify every RRset in the answers"));
+  printf ("    %s\n",_("with the DNSKEYs of its zone, validated from the trust anchor down. The"));
+  printf ("    %s\n",_("DNSKEYs are kept in the state directory until their TTL or a signature runs"));
+  printf ("    %s\n",_("out, so that usually only the signatures of the records are fetched"));
+  printf (" %s\n","--trust-anchor=\"ZONE KEYTAG ALGORITHM DIGESTTYPE DIGEST\"");
+  printf ("    %s\n",_("DS record to validate from, may be given more than once for the same zone"));
+  printf ("    %s\n",_("(default: the root KSK-2017). Implies --dnssec"));
+  printf (" %s\n","--signature-expiry=DAYS_WARN[,DAYS_CRIT]");
+  printf ("    %s\n",_("Minimum number of days the signatures of a record and of its chain of trust"));
+  printf ("    %s\n",_("must still be valid for. Implies --dnssec"));
+#endif
   printf (UT_WARN_CRIT);
   printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
   printf (UT_VERBOSE);
@@ -377,4 +2167,7 @@ print_usage (void)
   printf ("%s -l <query_address> [-H <host>] [-p <server port>]\n", progname);
   printf (" [-T <query type>] [-w <warning interval>] [-c <critical interval>]\n");
   printf (" [-t <timeout>] [-a <expected answer address>] [-v]\n");
+  printf ("%s --records=FILE [-H <host>] [-p <server port>] [-T <query type>]\n", progname);
+  printf (" [-w <warning interval>] [-c <critical interval>] [-t <timeout>] [--concurrency=N]\n");
+  printf (" [--dnssec] [--trust-anchor=DS] [--signature-expiry=DAYS_WARN[,DAYS_CRIT]]\n");
 }
@@ -50,7 +50,14 @@ const char *email = "devel@monitoring-plugins.org";
 #if HAVE_LIMITS_H
 # include <limits.h>
 #endif
-#include "regex.h"
+#include "utils_regex.h"
+#include "utils_tree.h"
+#ifdef __linux__
+# include <sys/sysmacros.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
 
 #ifdef __CYGWIN__
 # include <windows.h>
@@ -112,9 +119,26 @@ enum
 {
   SYNC_OPTION = CHAR_MAX + 1,
   NO_SYNC_OPTION,
-  BLOCK_SIZE_OPTION
+  BLOCK_SIZE_OPTION,
+  MOUNT_TIMEOUT_OPTION,
+  MOUNT_TIMEOUT_STATE_OPTION,
+  STAT_THREADS_OPTION,
+  MOUNT_CACHE_OPTION,
+  IMMUTABLE_CACHE_OPTION,
+  IO_OPTION,
+  IO_IOPS_OPTION,
+  IO_THROUGHPUT_OPTION,
+  IO_AWAIT_OPTION,
+  IO_UTIL_OPTION,
+  TREE_OPTION,
+  TREE_SIZE_OPTION,
+  TREE_CACHE_OPTION,
+  TOP_OPTION
 };
 
+/* threads to stat the selected paths with, --stat-threads */
+#define DEFAULT_STAT_THREADS 16
+
 #ifdef _AIX
  #pragma alloca
 #endif
@@ -157,7 +181,796 @@ char *crit_freeinodes_percent = NULL;
 int path_selected = FALSE;
 char *group = NULL;
 struct stat *stat_buf;
-struct name_list *seen = NULL;
+struct name_hash seen = { NULL, 0, 0 };
+long long mount_timeout = -1; /* usec; the -t timeout unless --mount-timeout */
+int mount_timeout_state = STATE_CRITICAL;
+int stat_threads = DEFAULT_STAT_THREADS;
+char *timed_out = NULL; /* paths whose file system did not answer in time */
+size_t top_count = 0; /* --top: only the worst file systems in the output */
+
+/* --immutable-cache keeps the usage of the file systems that cannot be
+ * written to, by their type, and uses it instead of statvfs() for as long
+ * as the mount table keeps its fingerprint */
+int immutable_cache = FALSE;
+
+/* --mount-cache keeps the mount list and the results of the -r/-R/-i/-I
+ * regular expressions in the state file of this command line, for as long
+ * as the mount table keeps its fingerprint */
+int mount_cache = FALSE;
+int io_mode = FALSE;
+static int mount_list_loaded = FALSE;
+static unsigned int mount_table;	/* its fingerprint, 0 if unknown */
+static int mount_cache_dirty = FALSE;	/* the cache needs writing */
+static int mount_cache_stable = TRUE;	/* one mount table all along */
+static const char *regex_memo_in;	/* the results to replay */
+static char *regex_memo;	/* the results of this run, as '0' and '1' */
+static size_t regex_memo_len, regex_memo_size;
+
+/* read the mount list, or take it from the cache. With filter set every
+ * mount is to be checked, and the mounts of the types -X and -N leave out
+ * are not even read. */
+static void
+load_mount_list (int filter)
+{
+  state_data *state;
+  const char *text;
+  char *end;
+
+  mount_list_loaded = TRUE;
+  if (mount_cache && (mount_table = np_mount_table_fingerprint ()) != 0) {
+    state = np_state_read ();
+    if (state && state->data) {
+      text = state->data;
+      if (strtoul (text, &end, 16) == mount_table && *end == ' ') {
+        text = end + 1;
+        if (np_mount_list_from_string (&text, &mount_list)) {
+          if (verbose >= 3)
+            printf ("Using the cached mount list\n");
+          if (*text != '-')
+            regex_memo_in = text;
+          return;
+        }
+      }
+    }
+    mount_cache_dirty = TRUE;
+  }
+  mount_list = np_read_mount_list (filter, fs_include_list, fs_exclude_list);
+}
+
+/* read the mount list again after a stat() may have mounted something. With
+ * the cache that is only needed if the mount table has changed. */
+static void
+refresh_mount_list (void)
+{
+  unsigned int fingerprint;
+
+  if (! mount_list_loaded) {
+    load_mount_list (FALSE);
+    return;
+  }
+  if (mount_cache && mount_table != 0) {
+    if ((fingerprint = np_mount_table_fingerprint ()) == mount_table)
+      return;
+    /* the results recorded so far were for the previous list */
+    mount_table = fingerprint;
+    mount_cache_stable = FALSE;
+    regex_memo_in = NULL;
+  }
+  /* NB: We can't free the old mount_list "just like that": both list pointers and struct
+   * pointers are copied around. One of the reason it wasn't done yet is that other parts
+   * of check_disk need the same kind of cleanup so it'd better be done as a whole */
+  mount_list = np_read_mount_list (FALSE, NULL, NULL);
+}
+
+/* np_regex_match_mount_entry(), replayed from the cache if possible */
+static int
+path_regex_match (struct mount_entry *me, np_regex_t *re)
+{
+  int match;
+
+  if (regex_memo_in && (*regex_memo_in == '0' || *regex_memo_in == '1')) {
+    match = *regex_memo_in++ == '1';
+  } else {
+    if (regex_memo_in)
+      mount_cache_dirty = TRUE;
+    regex_memo_in = NULL;
+    match = np_regex_match_mount_entry (me, re);
+  }
+
+  if (mount_cache) {
+    if (regex_memo_len + 2 > regex_memo_size) {
+      regex_memo_size = regex_memo_size ? regex_memo_size * 2 : 256;
+      if ((regex_memo = realloc (regex_memo, regex_memo_size)) == NULL)
+        die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+    }
+    regex_memo[regex_memo_len++] = match ? '1' : '0';
+    regex_memo[regex_memo_len] = '\0';
+  }
+  return match;
+}
+
+static void
+save_mount_cache (void)
+{
+  char *list, *data;
+
+  /* the cached results would not all be for the same list */
+  if (! mount_cache_stable || mount_table == 0)
+    return;
+  /* fewer results were used than the cache holds */
+  if (regex_memo_in && *regex_memo_in != '\0')
+    mount_cache_dirty = TRUE;
+  if (! mount_cache_dirty)
+    return;
+
+  list = np_mount_list_to_string (mount_list);
+  xasprintf (&data, "%x %s %s", mount_table, list, regex_memo_len ? regex_memo : "-");
+  np_state_write_string (0, data);
+  free (data);
+  free (list);
+}
+
+/* whether the filters skip this mount unless its path is in a group */
+static int
+path_filtered (struct mount_entry *me)
+{
+  /* Skip remote filesystems if we're not interested in them */
+  if (me->me_remote && show_local_fs)
+    return TRUE;
+  /* Skip pseudo fs's if we haven't asked for all fs's */
+  if (me->me_dummy && !show_all_fs)
+    return TRUE;
+  /* Skip excluded fstypes */
+  if (fs_exclude_list && np_find_name (fs_exclude_list, me->me_type))
+    return TRUE;
+  /* Skip excluded fs's */
+  if (dp_exclude_list &&
+      (np_find_name (dp_exclude_list, me->me_devname) ||
+       np_find_name (dp_exclude_list, me->me_mountdir)))
+    return TRUE;
+  /* Skip not included fstypes */
+  if (fs_include_list && !np_find_name (fs_include_list, me->me_type))
+    return TRUE;
+  return FALSE;
+}
+
+/* stat() and get_fs_usage() of a selected path, done ahead of the checks
+ * by a pool of threads so that mounts are looked at concurrently and a
+ * hanging one (NFS, mostly) only costs its own --mount-timeout */
+struct fs_usage_job
+{
+  struct parameter_list *path;
+  struct fs_usage fsp;
+  int stat_errno;
+  int state;
+  int reported;
+  struct timeval started;
+};
+
+#define JOB_PENDING 0
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+#define JOB_TIMEDOUT 3
+
+#ifdef HAVE_LIBPTHREAD
+static struct fs_usage_job *jobs;
+static size_t jobs_count;
+static size_t jobs_next;	/* the first job no thread has taken */
+static size_t jobs_finished;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+
+static long long
+timeval_usec (const struct timeval *tv)
+{
+  return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+static void *
+fs_usage_worker (void *arg)
+{
+  struct fs_usage_job *job;
+  struct fs_usage fsp;
+  struct stat st;
+  int stat_errno;
+
+  for (;;) {
+    pthread_mutex_lock (&jobs_lock);
+    if (jobs_next == jobs_count) {
+      pthread_mutex_unlock (&jobs_lock);
+      return NULL;
+    }
+    job = &jobs[jobs_next++];
+    job->state = JOB_RUNNING;
+    gettimeofday (&job->started, NULL);
+    pthread_mutex_unlock (&jobs_lock);
+
+    memset (&fsp, 0, sizeof (fsp));
+    stat_errno = stat (job->path->name, &st) ? errno : 0;
+    if (stat_errno == 0)
+      get_fs_usage (job->path->best_match->me_mountdir, job->path->best_match->me_devname, &fsp);
+
+    /* a job given up on stays given up on */
+    pthread_mutex_lock (&jobs_lock);
+    if (job->state == JOB_RUNNING) {
+      job->fsp = fsp;
+      job->stat_errno = stat_errno;
+      job->state = JOB_DONE;
+      jobs_finished++;
+      pthread_cond_signal (&jobs_cond);
+    }
+    pthread_mutex_unlock (&jobs_lock);
+  }
+}
+
+static void
+fs_usage_start_worker (void)
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create (&thread, &attr, fs_usage_worker, NULL) != 0)
+    die (STATE_UNKNOWN, _("DISK %s - Cannot start thread: %s\n"), _("UNKNOWN"), strerror (errno));
+  pthread_attr_destroy (&attr);
+}
+
+/* run the jobs of all paths that will be checked and wait for them to
+ * finish or time out */
+static void
+fs_usage_prefetch (void)
+{
+  struct name_hash prefetch_seen = { NULL, 0, 0 };
+  struct parameter_list *path;
+  struct timeval now;
+  struct timespec wait;
+  size_t i, threads;
+  long long next, end;
+
+  if (stat_threads <= 0)
+    return;
+
+  for (path = path_select_list; path; path = path->name_next)
+    jobs_count++;
+  if ((jobs = calloc (jobs_count, sizeof (struct fs_usage_job))) == NULL)
+    die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+
+  jobs_count = 0;
+  for (path = path_select_list; path; path = path->name_next) {
+#ifdef __CYGWIN__
+    if (strncmp(path->name, "/cygdrive/", 10) != 0)
+      continue;
+#endif
+    if (path->group == NULL && path_filtered (path->best_match))
+      continue;
+    /* taken from --immutable-cache, or the usage of a file system that
+     * will not be checked, as a path before it is on the same one */
+    if (path->usage_job)
+      continue;
+    if (path->group == NULL) {
+      if (np_seen_hashed_name (&prefetch_seen, path->best_match->me_mountdir))
+        continue;
+      np_add_hashed_name (&prefetch_seen, path->best_match->me_mountdir);
+    }
+    jobs[jobs_count].path = path;
+    path->usage_job = &jobs[jobs_count++];
+  }
+
+  threads = jobs_count < (size_t) stat_threads ? jobs_count : (size_t) stat_threads;
+  if (verbose >= 3)
+    printf ("Querying %lu paths with %lu threads\n", (unsigned long) jobs_count, (unsigned long) threads);
+
+  pthread_mutex_lock (&jobs_lock);
+  for (i = 0; i < threads; i++)
+    fs_usage_start_worker ();
+
+  while (jobs_finished < jobs_count) {
+    gettimeofday (&now, NULL);
+    next = timeval_usec (&now) + mount_timeout;
+
+    /* give up on the jobs past their deadline, and have another thread
+     * take over the rest of the queue from the one that is stuck */
+    for (i = 0; i < jobs_next; i++) {
+      if (jobs[i].state != JOB_RUNNING)
+        continue;
+      end = timeval_usec (&jobs[i].started) + mount_timeout;
+      if (end <= timeval_usec (&now)) {
+        if (verbose >= 3)
+          printf ("get_fs_usage on %s timed out\n", jobs[i].path->name);
+        jobs[i].state = JOB_TIMEDOUT;
+        jobs_finished++;
+        if (jobs_next < jobs_count)
+          fs_usage_start_worker ();
+      } else if (end < next) {
+        next = end;
+      }
+    }
+    if (jobs_finished == jobs_count)
+      break;
+
+    wait.tv_sec = next / 1000000;
+    wait.tv_nsec = (next % 1000000) * 1000;
+    pthread_cond_timedwait (&jobs_cond, &jobs_lock, &wait);
+  }
+  pthread_mutex_unlock (&jobs_lock);
+}
+#endif /* HAVE_LIBPTHREAD */
+
+/* stat() the path and get the usage of its file system, from the threads
+ * if they have done that already. Without them the result is kept in a job
+ * of the path's own, so that the groups it is in do not ask again. Returns
+ * FALSE if that timed out. */
+static int
+path_usage (struct parameter_list *p, struct fs_usage *fsp)
+{
+  struct fs_usage_job *job = p->usage_job;
+
+  if (job == NULL) {
+    stat_path (p);
+    if ((job = calloc (1, sizeof (struct fs_usage_job))) == NULL)
+      die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+    job->path = p;
+    get_fs_usage (p->best_match->me_mountdir, p->best_match->me_devname, &job->fsp);
+    job->state = JOB_DONE;
+    p->usage_job = job;
+  }
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock (&jobs_lock);
+  if (job->state != JOB_DONE)
+    job->state = JOB_TIMEDOUT;
+  pthread_mutex_unlock (&jobs_lock);
+#endif
+  if (job->state == JOB_TIMEDOUT) {
+    if (! job->reported)
+      xasprintf (&timed_out, "%s%s%s", timed_out ? timed_out : "", timed_out ? ", " : "", p->name);
+    job->reported = TRUE;
+    return FALSE;
+  }
+  if (job->stat_errno) {
+    printf("DISK %s - ", _("CRITICAL"));
+    die (STATE_CRITICAL, _("%s %s: %s\n"), p->name, _("is not accessible"), strerror(job->stat_errno));
+  }
+  *fsp = job->fsp;
+  return TRUE;
+}
+
+/* --io: the rates of the block devices behind the checked mounts, from
+ * their counters in /proc/diskstats against those of the last run */
+enum { IO_IOPS, IO_THROUGHPUT, IO_AWAIT, IO_UTIL, IO_METRICS };
+
+/* reads, writes, sectors read, sectors written, ms reading, ms writing and
+ * ms with I/O in flight */
+#define IO_COUNTERS 7
+
+struct io_device
+{
+  unsigned int major, minor;
+  char name[32];
+  unsigned long long count[IO_COUNTERS];
+  int found;
+};
+
+static thresholds *io_thresholds[IO_METRICS];
+
+/* "WARN[,CRIT]" */
+static void
+set_warn_crit (thresholds **t, char *arg, const char *error)
+{
+  char *crit = strchr (arg, ',');
+
+  if (crit)
+    *crit++ = '\0';
+  if (_set_thresholds (t, *arg ? arg : NULL, crit && *crit ? crit : NULL) != 0)
+    usage2 (error, arg);
+}
+
+/* the states of --io and --immutable-cache have keys of their own, made of
+ * the prefix and the command line; the --mount-cache uses the default one */
+static void
+state_enable_keyed (const char *prefix, int argc, char **argv)
+{
+  char key[8 + 41];
+
+  strcpy (key, prefix);
+  np_argv_digest (argc, argv, key + strlen (prefix));
+  np_enable_state (key, 1);
+}
+
+/* --immutable-cache: file systems of these types cannot change, so neither
+ * can their usage nor which paths exist on them */
+static int
+fs_immutable (const struct mount_entry *me)
+{
+  static const char *const types[] = { "squashfs", "iso9660", "erofs", "cramfs", "romfs", NULL };
+  int i;
+
+  for (i = 0; types[i]; i++)
+    if (strcmp (me->me_type, types[i]) == 0)
+      return TRUE;
+  return FALSE;
+}
+
+struct usage_cache_entry
+{
+  char *name;
+  struct fs_usage fsp;
+};
+
+static unsigned int usage_table;	/* the fingerprint the cache is for */
+static size_t usage_cache_loaded, usage_cache_hits;
+
+static int
+usage_cache_compare (const void *a, const void *b)
+{
+  return strcmp (((const struct usage_cache_entry *) a)->name, ((const struct usage_cache_entry *) b)->name);
+}
+
+/* give the paths on immutable file systems the usage of the last run, as
+ * if they had been looked at already, if the mount table is the same */
+static void
+usage_cache_load (int argc, char **argv)
+{
+  struct usage_cache_entry *entries = NULL, key, *found;
+  struct parameter_list *path;
+  struct fs_usage_job *job;
+  state_data *state;
+  const char *text, *eol;
+  char *end;
+  size_t count = 0, size = 0;
+  int top, n;
+
+  if ((usage_table = mount_table ? mount_table : np_mount_table_fingerprint ()) == 0)
+    return;
+  state_enable_keyed ("ro_", argc, argv);
+  state = np_state_read ();
+  if (state == NULL || state->data == NULL)
+    return;
+  text = state->data;
+  if (strtoul (text, &end, 16) != usage_table || *end != '\n')
+    return;
+
+  /* a line of the usage and the path of every one */
+  for (text = end + 1; *text; text = eol + 1) {
+    if ((eol = strchr (text, '\n')) == NULL)
+      break;
+    if (count == size) {
+      size = size ? size * 2 : 64;
+      if ((entries = realloc (entries, size * sizeof (struct usage_cache_entry))) == NULL)
+        die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+    }
+    if (sscanf (text, "%ju %ju %ju %ju %d %ju %ju %ju %n",
+                &entries[count].fsp.fsu_blocksize, &entries[count].fsp.fsu_blocks,
+                &entries[count].fsp.fsu_bfree, &entries[count].fsp.fsu_bavail, &top,
+                &entries[count].fsp.fsu_files, &entries[count].fsp.fsu_ffree,
+                &entries[count].fsp.fsu_favail, &n) != 8 || text + n >= eol)
+      continue;
+    entries[count].fsp.fsu_bavail_top_bit_set = top != 0;
+    entries[count].name = strndup (text + n, eol - text - n);
+    count++;
+  }
+  usage_cache_loaded = count;
+  if (count == 0)
+    return;
+  qsort (entries, count, sizeof (struct usage_cache_entry), usage_cache_compare);
+
+  for (path = path_select_list; path; path = path->name_next) {
+    if (path->usage_job || path->best_match == NULL || ! fs_immutable (path->best_match))
+      continue;
+    key.name = path->name;
+    if ((found = bsearch (&key, entries, count, sizeof (struct usage_cache_entry), usage_cache_compare)) == NULL)
+      continue;
+    if ((job = calloc (1, sizeof (struct fs_usage_job))) == NULL)
+      die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+    job->path = path;
+    job->fsp = found->fsp;
+    job->state = JOB_DONE;
+    path->usage_job = job;
+    usage_cache_hits++;
+    if (verbose >= 3)
+      printf ("Using the cached usage of %s\n", path->name);
+  }
+}
+
+/* keep the usage of the paths on immutable file systems for the next run,
+ * unless the cache has them all already */
+static void
+usage_cache_save (int argc, char **argv)
+{
+  struct parameter_list *path;
+  struct fs_usage_job *job;
+  np_str data = NP_STR_INIT;
+  size_t count = 0;
+
+  if (usage_table == 0)
+    return;
+  np_str_printf (&data, "%x\n", usage_table);
+  for (path = path_select_list; path; path = path->name_next) {
+    job = path->usage_job;
+    if (job == NULL || job->path != path || job->state != JOB_DONE || job->stat_errno ||
+        path->best_match == NULL || ! fs_immutable (path->best_match) || strchr (path->name, '\n'))
+      continue;
+    np_str_printf (&data, "%ju %ju %ju %ju %d %ju %ju %ju %s\n",
+                   job->fsp.fsu_blocksize, job->fsp.fsu_blocks, job->fsp.fsu_bfree,
+                   job->fsp.fsu_bavail, job->fsp.fsu_bavail_top_bit_set ? 1 : 0,
+                   job->fsp.fsu_files, job->fsp.fsu_ffree, job->fsp.fsu_favail, path->name);
+    count++;
+  }
+  if (count != usage_cache_hits || usage_cache_loaded != usage_cache_hits) {
+    state_enable_keyed ("ro_", argc, argv);
+    np_state_write_binary (0, np_str_string (&data), data.len);
+  }
+}
+
+#ifdef __linux__
+
+static int
+io_read_counters (struct io_device *dev, size_t count)
+{
+  char line[MAX_INPUT_BUFFER], name[32];
+  unsigned long long c[11];
+  unsigned int major_no, minor_no;
+  size_t i;
+  FILE *fp;
+
+  if ((fp = fopen ("/proc/diskstats", "r")) == NULL)
+    return FALSE;
+  while (fgets (line, sizeof (line), fp)) {
+    if (sscanf (line, "%u %u %31s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+                &major_no, &minor_no, name, &c[0], &c[1], &c[2], &c[3], &c[4], &c[5],
+                &c[6], &c[7], &c[8], &c[9], &c[10]) != 14)
+      continue;
+    for (i = 0; i < count; i++) {
+      if (dev[i].major != major_no || dev[i].minor != minor_no)
+        continue;
+      strcpy (dev[i].name, name);
+      dev[i].count[0] = c[0];
+      dev[i].count[1] = c[4];
+      dev[i].count[2] = c[2];
+      dev[i].count[3] = c[6];
+      dev[i].count[4] = c[3];
+      dev[i].count[5] = c[7];
+      dev[i].count[6] = c[9];
+      dev[i].found = TRUE;
+    }
+  }
+  fclose (fp);
+  return TRUE;
+}
+
+/* the device a path is on: the mount list seldom knows it, and the mount
+ * directory of a group is its name by now */
+static int
+io_device_number (struct parameter_list *path, dev_t *devno)
+{
+  struct stat st;
+
+  if (path->best_match->me_dev != (dev_t) -1) {
+    *devno = path->best_match->me_dev;
+    return TRUE;
+  }
+  if (stat (path->name, &st) != 0)
+    return FALSE;
+  *devno = S_ISBLK (st.st_mode) ? st.st_rdev : st.st_dev;
+  return TRUE;
+}
+
+/* the I/O state of the devices, the worst of them */
+static int
+io_check (int argc, char **argv, np_str *output, perf_buffer *perf)
+{
+  static const char *metric_name[IO_METRICS] = { "iops", "throughput", "await", "util" };
+  struct io_device *dev = NULL;
+  struct parameter_list *path;
+  struct timeval tv;
+  state_data *previous;
+  np_str state = NP_STR_INIT;
+  const char *text;
+  char *end, *label;
+  double now, then = 0, dt, value[IO_METRICS];
+  unsigned long long old[IO_COUNTERS], ios;
+  unsigned int major_no, minor_no;
+  dev_t devno;
+  size_t count = 0, size = 0, i;
+  int result = STATE_OK, dev_result, m, k;
+
+  /* one entry for every device behind a mount that was looked at */
+  for (path = path_select_list; path; path = path->name_next) {
+    if (path->usage_job == NULL || path->usage_job->state != JOB_DONE || path->best_match == NULL)
+      continue;
+    if (! io_device_number (path, &devno))
+      continue;
+    major_no = major (devno);
+    minor_no = minor (devno);
+    if (major_no == 0)
+      continue;	/* tmpfs, proc and the like */
+    for (i = 0; i < count; i++)
+      if (dev[i].major == major_no && dev[i].minor == minor_no)
+        break;
+    if (i < count)
+      continue;
+    if (count == size) {
+      size = size ? size * 2 : 16;
+      if ((dev = realloc (dev, size * sizeof (struct io_device))) == NULL)
+        die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+    }
+    memset (&dev[count], 0, sizeof (struct io_device));
+    dev[count].major = major_no;
+    dev[count].minor = minor_no;
+    count++;
+  }
+
+  if (! io_read_counters (dev, count)) {
+    np_str_printf (output, " io: %s;", _("cannot read /proc/diskstats"));
+    free (dev);
+    return STATE_UNKNOWN;
+  }
+
+  state_enable_keyed ("io_", argc, argv);
+  previous = np_state_read ();
+  gettimeofday (&tv, NULL);
+  now = tv.tv_sec + tv.tv_usec / 1.0e6;
+
+  /* the time, then every device and its counters, on one line */
+  np_str_printf (&state, "%.6f", now);
+  for (i = 0; i < count; i++) {
+    if (! dev[i].found)
+      continue;
+    np_str_printf (&state, " %u:%u", dev[i].major, dev[i].minor);
+    for (k = 0; k < IO_COUNTERS; k++)
+      np_str_printf (&state, " %llu", dev[i].count[k]);
+  }
+  np_state_write_string (0, (char *) np_str_string (&state));
+
+  if (previous == NULL || previous->data == NULL ||
+      (then = strtod (previous->data, &end)) <= 0 || (dt = now - then) <= 0) {
+    np_str_printf (output, " io: %s;", _("no previous counters to compare with, assuming OK"));
+    free (dev);
+    return STATE_OK;
+  }
+
+  for (i = 0; i < count; i++) {
+    if (! dev[i].found)
+      continue;
+
+    /* the counters of this device in the last run */
+    for (text = end; ; text += k) {
+      if (sscanf (text, " %u:%u %llu %llu %llu %llu %llu %llu %llu%n", &major_no, &minor_no,
+                  &old[0], &old[1], &old[2], &old[3], &old[4], &old[5], &old[6], &k) != 9) {
+        text = NULL;
+        break;
+      }
+      if (major_no == dev[i].major && minor_no == dev[i].minor)
+        break;
+    }
+    if (text == NULL)
+      continue;
+    /* a reboot or a new device with the same number */
+    for (k = 0; k < IO_COUNTERS; k++)
+      if (dev[i].count[k] < old[k])
+        break;
+    if (k < IO_COUNTERS)
+      continue;
+
+    ios = (dev[i].count[0] - old[0]) + (dev[i].count[1] - old[1]);
+    value[IO_IOPS] = ios / dt;
+    value[IO_THROUGHPUT] = (dev[i].count[2] - old[2] + dev[i].count[3] - old[3]) * 512.0 / mult / dt;
+    value[IO_AWAIT] = ios ? (double) (dev[i].count[4] - old[4] + dev[i].count[5] - old[5]) / ios : 0;
+    value[IO_UTIL] = (dev[i].count[6] - old[6]) / (dt * 10);
+    if (value[IO_UTIL] > 100)
+      value[IO_UTIL] = 100;
+
+    dev_result = STATE_OK;
+    for (m = 0; m < IO_METRICS; m++)
+      if (io_thresholds[m])
+        dev_result = max_state (dev_result, get_status (value[m], io_thresholds[m]));
+    result = max_state (result, dev_result);
+
+    for (m = 0; m < IO_METRICS; m++) {
+      label = np_arena_printf ("io_%s_%s", dev[i].name, metric_name[m]);
+      fperfdata_append (perf, label, value[m],
+                        m == IO_THROUGHPUT ? units : m == IO_AWAIT ? "ms" : m == IO_UTIL ? "%" : "",
+                        io_thresholds[m] && io_thresholds[m]->warning, io_thresholds[m] && io_thresholds[m]->warning ? io_thresholds[m]->warning->end : 0,
+                        io_thresholds[m] && io_thresholds[m]->critical, io_thresholds[m] && io_thresholds[m]->critical ? io_thresholds[m]->critical->end : 0,
+                        TRUE, 0, m == IO_UTIL, 100);
+    }
+
+    if (dev_result == STATE_OK && erronly && !verbose)
+      continue;
+    if (dev_result && verbose >= 1)
+      np_str_printf (output, " %s [", state_text (dev_result));
+    np_str_printf (output, " io %s %.0f iops %.1f %s/s await=%.1fms util=%.0f%%%s;",
+                   dev[i].name, value[IO_IOPS], value[IO_THROUGHPUT], units, value[IO_AWAIT],
+                   value[IO_UTIL], (dev_result && verbose >= 1) ? "]" : "");
+  }
+  free (dev);
+  return result;
+}
+#endif /* __linux__ */
+
+/* --tree: the size of directory trees, walked by the --stat-threads, and
+ * with --tree-cache taking what the directories that did not change hold
+ * from the state of the last run */
+static char **tree_paths;
+static int tree_count;
+static thresholds *tree_thresholds;
+static time_t tree_cache_age;
+
+static int
+tree_check (int argc, char **argv, np_str *output, perf_buffer *perf)
+{
+  np_tree_dir **cached = NULL, **found, **trees;
+  np_tree_total total;
+  state_data *state;
+  double size;
+  char *text;
+  int loaded = 0, result = STATE_OK, tree_result, i;
+
+  if ((trees = calloc (tree_count, sizeof (np_tree_dir *))) == NULL ||
+      (found = calloc (tree_count, sizeof (np_tree_dir *))) == NULL)
+    die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+
+  if (tree_cache_age > 0) {
+    state_enable_keyed ("tree_", argc, argv);
+    state = np_state_read ();
+    if (state && state->data && (loaded = np_tree_from_string (state->data, &cached)) > 0)
+      for (i = 0; i < tree_count; i++)
+        found[i] = np_tree_find (cached, loaded, tree_paths[i]);
+  }
+
+  np_tree_walk (tree_paths, tree_count, found, trees, stat_threads > 0 ? stat_threads : 1, tree_cache_age);
+
+  for (i = 0; i < tree_count; i++) {
+    if (trees[i] == NULL || trees[i]->error) {
+      np_str_printf (output, " %s %s: %s;", tree_paths[i], _("is not accessible"),
+                     strerror (trees[i] ? trees[i]->error : ENOMEM));
+      result = max_state (result, STATE_CRITICAL);
+      continue;
+    }
+    memset (&total, 0, sizeof (total));
+    np_tree_sum (trees[i], &total);
+    size = (double) total.bytes / mult;
+
+    /* the size of a tree with directories that could not be read is too low */
+    tree_result = tree_thresholds ? get_status (size, tree_thresholds) : STATE_OK;
+    if (total.errors)
+      tree_result = max_state (tree_result, STATE_WARNING);
+    result = max_state (result, tree_result);
+
+    if (verbose >= 3)
+      printf ("Tree %s: %ju bytes in %ju files and %ju directories, %ju of them cached, %ju unreadable\n",
+              tree_paths[i], total.bytes, total.files, total.dirs, total.dirs_cached, total.errors);
+    fperfdata_append (perf, np_arena_printf ("%s (tree)", tree_paths[i]), size, units,
+                      tree_thresholds && tree_thresholds->warning, tree_thresholds && tree_thresholds->warning ? tree_thresholds->warning->end : 0,
+                      tree_thresholds && tree_thresholds->critical, tree_thresholds && tree_thresholds->critical ? tree_thresholds->critical->end : 0,
+                      TRUE, 0, FALSE, 0);
+
+    if (tree_result == STATE_OK && erronly && !verbose)
+      continue;
+    if (tree_result && verbose >= 1)
+      np_str_printf (output, " %s [", state_text (tree_result));
+    np_str_printf (output, " %s %.0f %s (%ju files", tree_paths[i], size, units, total.files);
+    if (total.errors)
+      np_str_printf (output, ", %ju %s", total.errors, _("directories unreadable"));
+    np_str_printf (output, ")%s;", (tree_result && verbose >= 1) ? "]" : "");
+  }
+
+  /* a line a directory, so not as a state string */
+  if (tree_cache_age > 0) {
+    text = np_tree_to_string (trees, tree_count);
+    np_state_write_binary (0, text, strlen (text));
+  }
+
+  for (i = 0; i < tree_count; i++)
+    np_tree_free (trees[i]);
+  for (i = 0; i < loaded; i++)
+    np_tree_free (cached[i]);
+  free (cached);
+  free (found);
+  free (trees);
+  return result;
+}
 
 
 int
@@ -165,16 +978,18 @@ main (int argc, char **argv)
 {
   int result = STATE_UNKNOWN;
   int disk_result = STATE_UNKNOWN;
-  char *output;
+  np_str output = NP_STR_INIT;
   char *details;
-  char *perf;
-  char *perf_ilabel;
+  perf_buffer perf = PERF_BUFFER_INIT;
   char *preamble;
-  char *flag_header;
   double inode_space_pct;
   double warning_high_tide;
   double critical_high_tide;
-  int temp_result;
+  struct disk_table table = DISK_TABLE_INIT;
+  size_t row, shown, i, *worst = NULL;
+  size_t states[STATE_UNKNOWN + 1] = { 0 };
+  double total_units = 0, total_free = 0, total_used = 0;
+  int column;
 
   struct mount_entry *me;
   struct fs_usage fsp;
@@ -185,24 +1000,33 @@ main (int argc, char **argv)
 #endif
 
   preamble = strdup (" - free space:");
-  output = strdup ("");
   details = strdup ("");
-  perf = strdup ("");
-  perf_ilabel = strdup ("");
   stat_buf = malloc(sizeof *stat_buf);
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
-
-  mount_list = read_file_system_list (0);
+  np_locale_init ();
 
   /* Parse extra opts if any */
   argv = np_extra_opts (&argc, argv, progname);
 
+  np_init ((char *) progname, argc, argv);
+
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  /* --tree without -p, -r or -R is about the trees alone */
+  if (tree_count && path_selected == FALSE) {
+    result = tree_check (argc, argv, &output, &perf);
+    printf ("DISK %s%s%s|%s%s\n", state_text (result), (erronly && result==STATE_OK) ? "" : " - tree size:",
+            np_str_string (&output), perf.len ? " " : "", perf_string (&perf));
+    return result;
+  }
+
+  if (! mount_list_loaded)
+    load_mount_list (path_selected == FALSE && group == NULL);
+
+  if (mount_timeout < 0)
+    mount_timeout = timeout_interval * 1000000LL;
+
   /* If a list of paths has not been selected, find entire
      mount list and create list of paths
    */
@@ -229,6 +1053,16 @@ main (int argc, char **argv)
     temp_list = temp_list->name_next;
   }
 
+  if (mount_cache)
+    save_mount_cache ();
+
+  if (immutable_cache)
+    usage_cache_load (argc, argv);
+
+#ifdef HAVE_LIBPTHREAD
+  fs_usage_prefetch ();
+#endif
+
   /* Process for every path in list */
   for (path = path_select_list; path; path=path->name_next) {
     if (verbose >= 3 && path->freespace_percent->warning != NULL && path->freespace_percent->critical != NULL)
@@ -238,9 +1072,6 @@ main (int argc, char **argv)
     if (verbose >= 3 && path->group != NULL)
       printf("Group of %s: %s\n",path->name,path->group);
 
-    /* reset disk result */
-    disk_result = STATE_UNKNOWN;
-
     me = path->best_match;
 
 #ifdef __CYGWIN__
@@ -253,36 +1084,19 @@ main (int argc, char **argv)
     /* Filters */
 
     /* Remove filesystems already seen */
-    if (np_seen_name(seen, me->me_mountdir)) {
+    if (np_seen_hashed_name(&seen, me->me_mountdir)) {
       continue;
     } 
-    np_add_name(&seen, me->me_mountdir);
+    np_add_hashed_name(&seen, me->me_mountdir);
 
-    if (path->group == NULL) {
-      /* Skip remote filesystems if we're not interested in them */
-      if (me->me_remote && show_local_fs) {
-        if (stat_remote_fs)
-          stat_path(path);
-        continue;
-      /* Skip pseudo fs's if we haven't asked for all fs's */
-      } else if (me->me_dummy && !show_all_fs) {
-        continue;
-      /* Skip excluded fstypes */
-      } else if (fs_exclude_list && np_find_name (fs_exclude_list, me->me_type)) {
-        continue;
-      /* Skip excluded fs's */
-      } else if (dp_exclude_list &&
-               (np_find_name (dp_exclude_list, me->me_devname) ||
-                np_find_name (dp_exclude_list, me->me_mountdir))) {
-        continue;
-      /* Skip not included fstypes */
-      } else if (fs_include_list && !np_find_name (fs_include_list, me->me_type)) {
-        continue;
-      }
+    if (path->group == NULL && path_filtered (me)) {
+      if (me->me_remote && show_local_fs && stat_remote_fs)
+        stat_path(path);
+      continue;
     }
 
-    stat_path(path);
-    get_fs_usage (me->me_mountdir, me->me_devname, &fsp);
+    if (! path_usage (path, &fsp))
+      continue;
 
     if (fsp.fsu_blocks && strcmp ("none", me->me_mountdir)) {
       get_stats (path, &fsp);
@@ -292,125 +1106,155 @@ main (int argc, char **argv)
           me->me_mountdir, path->dused_pct, path->dfree_pct, path->dused_units, path->dfree_units, path->dtotal_units, path->dused_inodes_percent, path->dfree_inodes_percent, fsp.fsu_blocksize, mult);
       }
 
-      /* Threshold comparisons */
-
-      temp_result = get_status(path->dfree_units, path->freespace_units);
-      if (verbose >=3) printf("Freespace_units result=%d\n", temp_result);
-      disk_result = max_state( disk_result, temp_result );
+      np_disk_table_add (&table, path);
+    }
+  }
 
-      temp_result = get_status(path->dfree_pct, path->freespace_percent);
-      if (verbose >=3) printf("Freespace%% result=%d\n", temp_result);
-      disk_result = max_state( disk_result, temp_result );
+  /* Threshold comparisons, a column of all the file systems at a time */
+  np_disk_table_evaluate (&table);
+
+  /* --top: the rest only count towards the state and the total */
+  shown = table.count;
+  if (top_count && table.count) {
+    shown = top_count < table.count ? top_count : table.count;
+    if ((worst = malloc (shown * sizeof (size_t))) == NULL)
+      die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+    shown = np_disk_table_worst (&table, shown, worst);
+    for (row = 0; row < table.count; row++) {
+      result = max_state (result, table.result[row]);
+      states[table.result[row]]++;
+      total_units += table.path[row]->dtotal_units;
+      total_free += table.path[row]->dfree_units;
+      total_used += table.path[row]->dused_units;
+    }
+  }
 
-      temp_result = get_status(path->dused_units, path->usedspace_units);
-      if (verbose >=3) printf("Usedspace_units result=%d\n", temp_result);
-      disk_result = max_state( disk_result, temp_result );
+  for (i = 0; i < shown; i++) {
+    row = worst ? worst[i] : i;
+    path = table.path[row];
+    me = path->best_match;
+    disk_result = table.result[row];
+
+    if (verbose >= 3) {
+      static const char *column_name[DISK_COLUMNS] = {
+        "Freespace_units", "Freespace%", "Usedspace_units",
+        "Usedspace_percent", "Usedinodes_percent", "Freeinodes_percent"
+      };
+      for (column = 0; column < DISK_COLUMNS; column++)
+        printf ("%s result=%d\n", column_name[column], table.column[column].state[row]);
+    }
 
-      temp_result = get_status(path->dused_pct, path->usedspace_percent);
-      if (verbose >=3) printf("Usedspace_percent result=%d\n", temp_result);
-      disk_result = max_state( disk_result, temp_result );
+    result = max_state(result, disk_result);
 
-      temp_result = get_status(path->dused_inodes_percent, path->usedinodes_percent);
-      if (verbose >=3) printf("Usedinodes_percent result=%d\n", temp_result);
-      disk_result = max_state( disk_result, temp_result );
+    /* What a mess of units. The output shows free space, the perf data shows used space. Yikes!
+       Hack here. Trying to get warn/crit levels from freespace_(units|percent) for perf
+       data. Assumption that start=0. Roll on new syntax...
+    */
 
-      temp_result = get_status(path->dfree_inodes_percent, path->freeinodes_percent);
-      if (verbose >=3) printf("Freeinodes_percent result=%d\n", temp_result);
-      disk_result = max_state( disk_result, temp_result );
+    /* *_high_tide must be reinitialized at each run */
+    warning_high_tide = UINT_MAX;
+    critical_high_tide = UINT_MAX;
 
-      result = max_state(result, disk_result);
+    if (path->freespace_units->warning != NULL) {
+      warning_high_tide = path->dtotal_units - path->freespace_units->warning->end;
+    }
+    if (path->freespace_percent->warning != NULL) {
+      warning_high_tide = abs( min( (double) warning_high_tide, (double) (1.0 - path->freespace_percent->warning->end/100)*path->dtotal_units ));
+    }
+    if (path->freespace_units->critical != NULL) {
+      critical_high_tide = path->dtotal_units - path->freespace_units->critical->end;
+    }
+    if (path->freespace_percent->critical != NULL) {
+      critical_high_tide = abs( min( (double) critical_high_tide, (double) (1.0 - path->freespace_percent->critical->end/100)*path->dtotal_units ));
+    }
 
-      /* What a mess of units. The output shows free space, the perf data shows used space. Yikes!
-         Hack here. Trying to get warn/crit levels from freespace_(units|percent) for perf
-         data. Assumption that start=0. Roll on new syntax...
-      */
+    /* Nb: *_high_tide are unset when == UINT_MAX */
+    perfdata_append (&perf, (!strcmp(me->me_mountdir, "none") || display_mntp) ? me->me_devname : me->me_mountdir,
+                     path->dused_units, units,
+                     (warning_high_tide != UINT_MAX ? TRUE : FALSE), warning_high_tide,
+                     (critical_high_tide != UINT_MAX ? TRUE : FALSE), critical_high_tide,
+                     TRUE, 0,
+                     TRUE, path->dtotal_units);
 
+    if (display_inodes_perfdata) {
       /* *_high_tide must be reinitialized at each run */
       warning_high_tide = UINT_MAX;
       critical_high_tide = UINT_MAX;
 
-      if (path->freespace_units->warning != NULL) {
-        warning_high_tide = path->dtotal_units - path->freespace_units->warning->end;
-      }
-      if (path->freespace_percent->warning != NULL) {
-        warning_high_tide = abs( min( (double) warning_high_tide, (double) (1.0 - path->freespace_percent->warning->end/100)*path->dtotal_units ));
+      if (path->freeinodes_percent->warning != NULL) {
+        warning_high_tide = abs( min( (double) warning_high_tide, (double) (1.0 - path->freeinodes_percent->warning->end/100)*path->inodes_total ));
       }
-      if (path->freespace_units->critical != NULL) {
-        critical_high_tide = path->dtotal_units - path->freespace_units->critical->end;
-      }
-      if (path->freespace_percent->critical != NULL) {
-        critical_high_tide = abs( min( (double) critical_high_tide, (double) (1.0 - path->freespace_percent->critical->end/100)*path->dtotal_units ));
+      if (path->freeinodes_percent->critical != NULL) {
+        critical_high_tide = abs( min( (double) critical_high_tide, (double) (1.0 - path->freeinodes_percent->critical->end/100)*path->inodes_total ));
       }
 
       /* Nb: *_high_tide are unset when == UINT_MAX */
-      xasprintf (&perf, "%s %s", perf,
-                perfdata ((!strcmp(me->me_mountdir, "none") || display_mntp) ? me->me_devname : me->me_mountdir,
-                          path->dused_units, units,
-                          (warning_high_tide != UINT_MAX ? TRUE : FALSE), warning_high_tide,
-                          (critical_high_tide != UINT_MAX ? TRUE : FALSE), critical_high_tide,
-                          TRUE, 0,
-                          TRUE, path->dtotal_units));
-
-      if (display_inodes_perfdata) {
-        /* *_high_tide must be reinitialized at each run */
-        warning_high_tide = UINT_MAX;
-        critical_high_tide = UINT_MAX;
-
-        if (path->freeinodes_percent->warning != NULL) {
-          warning_high_tide = abs( min( (double) warning_high_tide, (double) (1.0 - path->freeinodes_percent->warning->end/100)*path->inodes_total ));
-        }
-        if (path->freeinodes_percent->critical != NULL) {
-          critical_high_tide = abs( min( (double) critical_high_tide, (double) (1.0 - path->freeinodes_percent->critical->end/100)*path->inodes_total ));
-        }
-
-        xasprintf (&perf_ilabel, "%s (inodes)", (!strcmp(me->me_mountdir, "none") || display_mntp) ? me->me_devname : me->me_mountdir);
-        /* Nb: *_high_tide are unset when == UINT_MAX */
-        xasprintf (&perf, "%s %s", perf,
-                   perfdata (perf_ilabel,
-                             path->inodes_used, "",
-                             (warning_high_tide != UINT_MAX ? TRUE : FALSE), warning_high_tide,
-                             (critical_high_tide != UINT_MAX ? TRUE : FALSE), critical_high_tide,
-                             TRUE, 0,
-                             TRUE, path->inodes_total));
-      }
+      perfdata_append (&perf, np_arena_printf ("%s (inodes)", (!strcmp(me->me_mountdir, "none") || display_mntp) ? me->me_devname : me->me_mountdir),
+                       path->inodes_used, "",
+                       (warning_high_tide != UINT_MAX ? TRUE : FALSE), warning_high_tide,
+                       (critical_high_tide != UINT_MAX ? TRUE : FALSE), critical_high_tide,
+                       TRUE, 0,
+                       TRUE, path->inodes_total);
+    }
 
-      if (disk_result==STATE_OK && erronly && !verbose)
-        continue;
+    if (disk_result==STATE_OK && erronly && !verbose)
+      continue;
 
-      if(disk_result && verbose >= 1) {
-	xasprintf(&flag_header, " %s [", state_text (disk_result));
-      } else {
-	xasprintf(&flag_header, "");
-      }
-      xasprintf (&output, "%s%s %s %.0f %s (%.0f%%",
-		output, flag_header,
-                (!strcmp(me->me_mountdir, "none") || display_mntp) ? me->me_devname : me->me_mountdir,
-                path->dfree_units,
-                units,
-                path->dfree_pct);
-      if (path->dused_inodes_percent < 0) {
-	xasprintf(&output, "%s inode=-)%s;", output, (disk_result ? "]" : ""));
-      } else {
-	xasprintf(&output, "%s inode=%.0f%%)%s;", output, path->dfree_inodes_percent, ((disk_result && verbose >= 1) ? "]" : ""));
-      }
-      free(flag_header);
-      /* TODO: Need to do a similar debug line
-      xasprintf (&details, _("%s\n\
+    if(disk_result && verbose >= 1)
+	np_str_printf (&output, " %s [", state_text (disk_result));
+    np_str_printf (&output, " %s %.0f %s (%.0f%%",
+              (!strcmp(me->me_mountdir, "none") || display_mntp) ? me->me_devname : me->me_mountdir,
+              path->dfree_units,
+              units,
+              path->dfree_pct);
+    if (path->dused_inodes_percent < 0) {
+	np_str_printf (&output, " inode=-)%s;", (disk_result ? "]" : ""));
+    } else {
+	np_str_printf (&output, " inode=%.0f%%)%s;", path->dfree_inodes_percent, ((disk_result && verbose >= 1) ? "]" : ""));
+    }
+    /* TODO: Need to do a similar debug line
+    xasprintf (&details, _("%s\n\
 %.0f of %.0f %s (%.0f%% inode=%.0f%%) free on %s (type %s mounted on %s) warn:%lu crit:%lu warn%%:%.0f%% crit%%:%.0f%%"),
-                details, dfree_units, dtotal_units, units, dfree_pct, inode_space_pct,
-                me->me_devname, me->me_type, me->me_mountdir,
-                (unsigned long)w_df, (unsigned long)c_df, w_dfp, c_dfp);
-      */
+              details, dfree_units, dtotal_units, units, dfree_pct, inode_space_pct,
+              me->me_devname, me->me_type, me->me_mountdir,
+              (unsigned long)w_df, (unsigned long)c_df, w_dfp, c_dfp);
+    */
+  }
 
-    }
+  if (worst) {
+    np_str_printf (&output, " %s %lu %s, %.0f %s (%.0f%%) free, %lu %s, %lu %s;", _("total of"),
+                   (unsigned long) table.count, _("file systems"), total_free, units,
+                   total_units > 0 ? total_free * 100 / total_units : 0.0,
+                   (unsigned long) states[STATE_WARNING], _("warning"),
+                   (unsigned long) states[STATE_CRITICAL], _("critical"));
+    fperfdata_append (&perf, "total", total_used, units, FALSE, 0, FALSE, 0, TRUE, 0, TRUE, total_units);
+    free (worst);
+  }
+
+  np_disk_table_free (&table);
 
+  if (immutable_cache)
+    usage_cache_save (argc, argv);
+
+#ifdef __linux__
+  if (io_mode)
+    result = max_state (result, io_check (argc, argv, &output, &perf));
+#endif
+
+  if (tree_count)
+    result = max_state (result, tree_check (argc, argv, &output, &perf));
+
+  if (timed_out) {
+    result = max_state_alt (result, mount_timeout_state);
+    np_str_printf (&output, " %s %s;", timed_out, _("timed out"));
   }
 
   if (verbose >= 2)
-    xasprintf (&output, "%s%s", output, details);
+    np_str_puts (&output, details);
 
 
-  printf ("DISK %s%s%s|%s\n", state_text (result), (erronly && result==STATE_OK) ? "" : preamble, output, perf);
+  printf ("DISK %s%s%s|%s%s\n", state_text (result), (erronly && result==STATE_OK) ? "" : preamble, np_str_string (&output),
+          perf.len ? " " : "", perf_string (&perf));
   return result;
 }
 
@@ -447,7 +1291,7 @@ process_arguments (int argc, char **argv)
   struct parameter_list *se;
   struct parameter_list *temp_list = NULL, *previous = NULL;
   struct mount_entry *me;
-  regex_t re;
+  np_regex_t re;
   int cflags = REG_NOSUB | REG_EXTENDED;
   int default_cflags = cflags;
   char errbuf[MAX_INPUT_BUFFER];
@@ -489,6 +1333,20 @@ process_arguments (int argc, char **argv)
     {"verbose", no_argument, 0, 'v'},
     {"quiet", no_argument, 0, 'q'},
     {"clear", no_argument, 0, 'C'},
+    {"mount-timeout", required_argument, 0, MOUNT_TIMEOUT_OPTION},
+    {"mount-timeout-state", required_argument, 0, MOUNT_TIMEOUT_STATE_OPTION},
+    {"stat-threads", required_argument, 0, STAT_THREADS_OPTION},
+    {"mount-cache", no_argument, 0, MOUNT_CACHE_OPTION},
+    {"immutable-cache", no_argument, 0, IMMUTABLE_CACHE_OPTION},
+    {"io", no_argument, 0, IO_OPTION},
+    {"io-iops", required_argument, 0, IO_IOPS_OPTION},
+    {"io-throughput", required_argument, 0, IO_THROUGHPUT_OPTION},
+    {"io-await", required_argument, 0, IO_AWAIT_OPTION},
+    {"io-util", required_argument, 0, IO_UTIL_OPTION},
+    {"tree", required_argument, 0, TREE_OPTION},
+    {"tree-size", required_argument, 0, TREE_SIZE_OPTION},
+    {"tree-cache", required_argument, 0, TREE_CACHE_OPTION},
+    {"top", required_argument, 0, TOP_OPTION},
     {"version", no_argument, 0, 'V'},
     {"help", no_argument, 0, 'h'},
     {0, 0, 0, 0}
@@ -518,6 +1376,64 @@ process_arguments (int argc, char **argv)
       else {
         usage2 (_("Timeout interval must be a positive integer"), optarg);
       }
+    case MOUNT_TIMEOUT_OPTION:
+      {
+        char *end;
+        double seconds = strtod (optarg, &end);
+        if (end == optarg || *end != '\0' || seconds <= 0)
+          usage2 (_("Mount timeout must be a positive number of seconds"), optarg);
+        mount_timeout = (long long) (seconds * 1000000);
+      }
+      break;
+    case MOUNT_TIMEOUT_STATE_OPTION:
+      if ((mount_timeout_state = mp_translate_state (optarg)) == ERROR)
+        usage2 (_("Mount timeout state must be a valid state name (OK, WARNING, CRITICAL, UNKNOWN) or integer (0-3)"), optarg);
+      break;
+    case MOUNT_CACHE_OPTION:
+      if (mount_list_loaded)
+        die (STATE_UNKNOWN, "DISK %s: %s", _("UNKNOWN"), _("Must set --mount-cache before selecting paths\n"));
+      if (! mount_cache)
+        np_enable_state (NULL, 1);
+      mount_cache = TRUE;
+      break;
+    case IMMUTABLE_CACHE_OPTION:
+      immutable_cache = TRUE;
+      break;
+    case IO_IOPS_OPTION:
+    case IO_THROUGHPUT_OPTION:
+    case IO_AWAIT_OPTION:
+    case IO_UTIL_OPTION:
+      set_warn_crit (&io_thresholds[c - IO_IOPS_OPTION + IO_IOPS], optarg, _("Invalid I/O threshold"));
+      /* fall through */
+    case IO_OPTION:
+#ifndef __linux__
+      usage4 (_("I/O rates need /proc/diskstats"));
+#endif
+      io_mode = TRUE;
+      break;
+    case TREE_OPTION:
+      if ((tree_paths = realloc (tree_paths, (tree_count + 1) * sizeof (char *))) == NULL)
+        die (STATE_UNKNOWN, _("DISK %s - Cannot allocate memory\n"), _("UNKNOWN"));
+      tree_paths[tree_count++] = optarg;
+      break;
+    case TREE_SIZE_OPTION:
+      set_warn_crit (&tree_thresholds, optarg, _("Invalid tree size threshold"));
+      break;
+    case TREE_CACHE_OPTION:
+      if (! is_integer (optarg) || atoi (optarg) < 0)
+        usage2 (_("Tree cache age must be a non-negative number of seconds"), optarg);
+      tree_cache_age = atoi (optarg);
+      break;
+    case TOP_OPTION:
+      if (! is_intpos (optarg))
+        usage2 (_("The number of file systems to show must be a positive integer"), optarg);
+      top_count = atoi (optarg);
+      break;
+    case STAT_THREADS_OPTION:
+      if (! is_integer (optarg) || atoi (optarg) < 0)
+        usage2 (_("Number of threads must be a non-negative integer"), optarg);
+      stat_threads = atoi (optarg);
+      break;
 
     /* See comments for 'c' */
     case 'w':                 /* warning threshold */
@@ -633,10 +1549,7 @@ process_arguments (int argc, char **argv)
 
       /* With autofs, it is required to stat() the path before re-populating the mount_list */
       stat_path(se);
-      /* NB: We can't free the old mount_list "just like that": both list pointers and struct
-       * pointers are copied around. One of the reason it wasn't done yet is that other parts
-       * of check_disk need the same kind of cleanup so it'd better be done as a whole */
-      mount_list = read_file_system_list (0);
+      refresh_mount_list ();
       np_set_best_match(se, mount_list, exact_match);
 
       path_selected = TRUE;
@@ -678,9 +1591,9 @@ process_arguments (int argc, char **argv)
     case 'i':
       if (!path_selected)
         die (STATE_UNKNOWN, "DISK %s: %s\n", _("UNKNOWN"), _("Paths need to be selected before using -i/-I. Use -A to select all paths explicitly"));
-      err = regcomp(&re, optarg, cflags);
+      err = np_regcomp(&re, optarg, cflags);
       if (err != 0) {
-        regerror (err, &re, errbuf, MAX_INPUT_BUFFER);
+        np_regerror (err, &re, errbuf, MAX_INPUT_BUFFER);
         die (STATE_UNKNOWN, "DISK %s: %s - %s\n",_("UNKNOWN"), _("Could not compile regular expression"), errbuf);
       }
 
@@ -689,7 +1602,7 @@ process_arguments (int argc, char **argv)
       previous = NULL;
       while (temp_list) {
         if (temp_list->best_match) {
-          if (np_regex_match_mount_entry(temp_list->best_match, &re)) {
+          if (path_regex_match(temp_list->best_match, &re)) {
 
               if (verbose >=3)
                 printf("ignoring %s matching regex\n", temp_list->name);
@@ -724,14 +1637,16 @@ process_arguments (int argc, char **argv)
         die (STATE_UNKNOWN, "DISK %s: %s", _("UNKNOWN"), _("Must set a threshold value before using -r/-R\n"));
       }
 
-      err = regcomp(&re, optarg, cflags);
+      err = np_regcomp(&re, optarg, cflags);
       if (err != 0) {
-        regerror (err, &re, errbuf, MAX_INPUT_BUFFER);
+        np_regerror (err, &re, errbuf, MAX_INPUT_BUFFER);
         die (STATE_UNKNOWN, "DISK %s: %s - %s\n",_("UNKNOWN"), _("Could not compile regular expression"), errbuf);
       }
 
+      if (! mount_list_loaded)
+        load_mount_list (FALSE);
       for (me = mount_list; me; me = me->me_next) {
-        if (np_regex_match_mount_entry(me, &re)) {
+        if (path_regex_match(me, &re)) {
           fnd = TRUE;
           if (verbose >= 3)
             printf("%s %s matching expression %s\n", me->me_devname, me->me_mountdir, optarg);
@@ -762,6 +1677,8 @@ process_arguments (int argc, char **argv)
        /* add all mount entries to path_select list if no partitions have been explicitly defined using -p */
        if (path_selected == FALSE) {
          struct parameter_list *path;
+         if (! mount_list_loaded)
+           load_mount_list (FALSE);
          for (me = mount_list; me; me = me->me_next) {
            if (! (path = np_find_parameter(path_select_list, me->me_mountdir)))
              path = np_add_parameter(&path_select_list, me->me_mountdir);
@@ -933,6 +1850,9 @@ print_help (void)
   printf ("    %s\n", _("For paths or partitions specified with -p, only check for exact paths"));
   printf (" %s\n", "-e, --errors-only");
   printf ("    %s\n", _("Display only devices/mountpoints with errors"));
+  printf (" %s\n", "--top=NUMBER");
+  printf ("    %s\n", _("Display and give perfdata of only the NUMBER file systems with the worst"));
+  printf ("    %s\n", _("state and least free space, and a total of all of them"));
   printf (" %s\n", "-f, --freespace-ignore-reserved");
   printf ("    %s\n", _("Don't account root-reserved blocks into freespace in perfdata"));
   printf (" %s\n", "-P, --iperfdata");
@@ -961,6 +1881,46 @@ print_help (void)
   printf (" %s\n", "-i, --ignore-ereg-path=PATH, --ignore-ereg-partition=PARTITION");
   printf ("    %s\n", _("Regular expression to ignore selected path or partition (may be repeated)"));
   printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+  printf (" %s\n", "--mount-timeout=SECONDS");
+  printf ("    %s\n", _("Give up on a file system that does not answer within this time"));
+  printf ("    %s\n", _("(default: the plugin timeout). Fractions of a second are allowed"));
+  printf (" %s\n", "--mount-timeout-state=STATE");
+  printf ("    %s\n", _("Return STATE if a file system timed out (default: CRITICAL)"));
+  printf (" %s\n", "--stat-threads=NUMBER");
+  printf ("    %s\n", _("Query up to NUMBER file systems at once, 0 queries them one after"));
+  printf ("    %s\n", _("the other without a timeout"));
+  printf ("    %s %d)\n", _("(default:"), DEFAULT_STAT_THREADS);
+  printf (" %s\n", "--mount-cache");
+  printf ("    %s\n", _("Keep the mount list and the paths the regular expressions select in a"));
+  printf ("    %s\n", _("state file, and use them while the mount table does not change. Must"));
+  printf ("    %s\n", _("come before the options that select paths"));
+  printf (" %s\n", "--immutable-cache");
+  printf ("    %s\n", _("Keep the usage of read-only file system types (squashfs, iso9660, erofs,"));
+  printf ("    %s\n", _("cramfs, romfs) in a state file, and use it instead of asking the file"));
+  printf ("    %s\n", _("system again while the mount table does not change"));
+  printf (" %s\n", "--io");
+  printf ("    %s\n", _("Also report the I/O rates of the block devices behind the checked mounts,"));
+  printf ("    %s\n", _("from /proc/diskstats since the last run: operations per second, units per"));
+  printf ("    %s\n", _("second, the average wait of an operation and how busy the device was"));
+  printf (" %s\n", "--io-iops=WARN[,CRIT]");
+  printf ("    %s\n", _("Thresholds for the operations per second, implies --io"));
+  printf (" %s\n", "--io-throughput=WARN[,CRIT]");
+  printf ("    %s\n", _("Thresholds for the units (see -u) read and written per second"));
+  printf (" %s\n", "--io-await=WARN[,CRIT]");
+  printf ("    %s\n", _("Thresholds for the average milliseconds an operation took"));
+  printf (" %s\n", "--io-util=WARN[,CRIT]");
+  printf ("    %s\n", _("Thresholds for the percentage of time the device was busy"));
+  printf (" %s\n", "--tree=PATH");
+  printf ("    %s\n", _("Also report the size of the directory tree at PATH, the files and"));
+  printf ("    %s\n", _("directories below it on its file system, read by the --stat-threads at"));
+  printf ("    %s\n", _("once. May be repeated. Without -p, -r or -R only the trees are checked"));
+  printf (" %s\n", "--tree-size=WARN[,CRIT]");
+  printf ("    %s\n", _("Thresholds for the units (see -u) taken up by each tree"));
+  printf (" %s\n", "--tree-cache=SECONDS");
+  printf ("    %s\n", _("Keep what each directory holds in a state file, and do not read a"));
+  printf ("    %s\n", _("directory again whose mtime did not change, for up to SECONDS. Files that"));
+  printf ("    %s\n", _("grow in place do not change the mtime of their directory, so their growth"));
+  printf ("    %s\n", _("may be seen that much later (default: 0, read every directory)"));
   printf (" %s\n", "-u, --units=STRING");
   printf ("    %s\n", _("Choose bytes, kB, MB, GB, TB (default: MB)"));
   printf (UT_VERBOSE);
@@ -978,6 +1938,11 @@ print_help (void)
   printf ("    %s\n", _("are grouped which means the freespace thresholds are applied to all disks together"));
   printf (" %s\n", "check_disk -w 100 -c 50 -C -w 1000 -c 500 -p /foo -C -w 5% -c 3% -p /bar");
   printf ("    %s\n", _("Checks /foo for 1000M/500M and /bar for 5/3%. All remaining volumes use 100M/50M"));
+  printf (" %s\n", "check_disk -w 10% -c 5% -p /var --io-await=20,50 --io-util=80,95");
+  printf ("    %s\n", _("Checks the space of /var and the wait and load of the device it is on"));
+  printf (" %s\n", "check_disk --tree=/var/spool --tree=/var/log --tree-size=2000,5000 --tree-cache=3600");
+  printf ("    %s\n", _("Checks that neither tree takes up more than 2000 MB, reading only the"));
+  printf ("    %s\n", _("directories that changed since the last run, and each at least once an hour"));
 
   printf (UT_SUPPORT);
 }
@@ -991,6 +1956,10 @@ print_usage (void)
   printf (" %s -w limit -c limit [-W limit] [-K limit] {-p path | -x device}\n", progname);
   printf ("[-C] [-E] [-e] [-f] [-g group ] [-k] [-l] [-M] [-m] [-R path ] [-r path ]\n");
   printf ("[-t timeout] [-u unit] [-v] [-X type] [-N type]\n");
+  printf ("[--mount-timeout seconds] [--mount-timeout-state state] [--stat-threads number]\n");
+  printf ("[--top number] [--mount-cache] [--immutable-cache] [--io] [--io-iops limits]\n");
+  printf ("[--io-throughput limits] [--io-await limits] [--io-util limits]\n");
+  printf ("[--tree path [--tree-size limits] [--tree-cache seconds]]\n");
 }
 
 void
@@ -1017,15 +1986,15 @@ get_stats (struct parameter_list *p, struct fs_usage *fsp) {
   if (p->group == NULL) {
     get_path_stats(p,fsp);
   } else {
-    /* find all group members */
+    /* add up the group members, path_usage() asked for each usage only once */
     for (p_list = path_select_list; p_list; p_list=p_list->name_next) {
 #ifdef __CYGWIN__
       if (strncmp(p_list->name, "/cygdrive/", 10) != 0)
         continue;
 #endif
       if (p_list->group && ! (strcmp(p_list->group, p->group))) {
-        stat_path(p_list);
-        get_fs_usage (p_list->best_match->me_mountdir, p_list->best_match->me_devname, &tmpfsp);
+        if (! path_usage (p_list, &tmpfsp))
+          continue;
         get_path_stats(p_list, &tmpfsp); 
         if (verbose >= 3)
           printf("Group %s: adding %llu blocks sized %llu, (%s) used_units=%g free_units=%g total_units=%g fsu_blocksize=%llu mult=%llu\n",
@@ -1098,5 +2067,5 @@ get_path_stats (struct parameter_list *p, struct fs_usage *fsp) {
     /* default behaviour : take all the inodes into account */
     p->inodes_total = fsp->fsu_files;
   }
-  np_add_name(&seen, p->best_match->me_mountdir);
+  np_add_hashed_name(&seen, p->best_match->me_mountdir);
 }
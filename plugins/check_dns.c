@@ -39,6 +39,11 @@ const char *email = "devel@monitoring-plugins.org";
 #include "netutils.h"
 #include "runcmd.h"
 
+#ifdef HAVE_RES_NSEND
+# include <arpa/nameser.h>
+# include <resolv.h>
+#endif
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 int error_scan (char *);
@@ -46,6 +51,13 @@ int ip_match_cidr(const char *, const char *);
 unsigned long ip2long(const char *);
 void print_help (void);
 void print_usage (void);
+#ifdef NSLOOKUP_COMMAND
+int nslookup_query (char **, long *);
+#endif
+#ifdef HAVE_RES_NSEND
+int native_query (char **, long *);
+int servers_query_all (void);
+#endif
 
 #define ADDRESS_LENGTH 256
 char query_address[ADDRESS_LENGTH] = "";
@@ -58,6 +70,30 @@ int expected_address_cnt = 0;
 int expect_authority = FALSE;
 int all_match = FALSE;
 thresholds *time_thresholds = NULL;
+int dns_port = 0;
+#if defined(HAVE_RES_NSEND) && !defined(NSLOOKUP_COMMAND)
+int use_native = TRUE;
+#else
+int use_native = FALSE;
+#endif
+
+/* the answers, from either backend */
+char **addresses = NULL;
+int n_addresses = 0;
+int non_authoritative = FALSE;
+long min_ttl = -1;
+
+/* the same for one server of --servers */
+typedef struct {
+  char **addresses;
+  int n_addresses;
+  int non_authoritative;
+  long min_ttl;
+} dns_answers;
+
+char **servers = NULL;
+int *server_ports = NULL;	/* 0 for -p or the default */
+int n_servers = 0;
 
 static int
 qstrcmp(const void *p1, const void *p2)
@@ -68,29 +104,54 @@ qstrcmp(const void *p1, const void *p2)
 	return strcmp(* (char * const *) p1, * (char * const *) p2);
 }
 
+/* Compare the answers to the -a addresses and networks. Returns
+ * STATE_CRITICAL with what was expected in *msg if none of them match, or
+ * with -L if not all of them do. */
+static int
+match_expected (char **addrs, int n, const char *address, char **msg)
+{
+  char *temp_buffer = "";
+  unsigned long expect_match = (1 << expected_address_cnt) - 1;
+  unsigned long addr_match = (1 << n) - 1;
+  int result = STATE_CRITICAL;
+  int i, j;
+
+  for (i=0; i<expected_address_cnt; i++) {
+    /* check if we get a match on 'raw' ip or cidr */
+    for (j=0; j<n; j++) {
+      if ( strcmp(addrs[j], expected_address[i]) == 0
+           || ip_match_cidr(addrs[j], expected_address[i]) ) {
+        result = STATE_OK;
+        addr_match &= ~(1 << j);
+        expect_match &= ~(1 << i);
+      }
+    }
+
+    /* prepare an error string */
+    xasprintf(&temp_buffer, "%s%s; ", temp_buffer, expected_address[i]);
+  }
+  /* check if expected_address must cover all in addresses and none may be missing */
+  if (all_match && (expect_match != 0 || addr_match != 0))
+    result = STATE_CRITICAL;
+  if (result == STATE_CRITICAL) {
+    /* Strip off last semicolon... */
+    temp_buffer[strlen(temp_buffer)-2] = '\0';
+    xasprintf(msg, _("expected '%s' but got '%s'"), temp_buffer, address);
+  }
+  return result;
+}
+
 
 int
 main (int argc, char **argv)
 {
-  char *command_line = NULL;
-  char input_buffer[MAX_INPUT_BUFFER];
   char *address = NULL; /* comma seperated str with addrs/ptrs (sorted) */
-  char **addresses = NULL;
-  int n_addresses = 0;
   char *msg = NULL;
-  char *temp_buffer = NULL;
-  int non_authoritative = FALSE;
   int result = STATE_UNKNOWN;
   double elapsed_time;
-  long microsec;
-  struct timeval tv;
-  int parse_address = FALSE; /* This flag scans for Address: but only after Name: */
-  output chld_out, chld_err;
-  size_t i;
+  long microsec = 0;
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  np_locale_init ();
 
   /* Set signal handling and alarm */
   if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR) {
@@ -104,10 +165,120 @@ main (int argc, char **argv)
     usage_va(_("Could not parse arguments"));
   }
 
+  alarm (timeout_interval);
+
+#ifdef HAVE_RES_NSEND
+  if (n_servers > 0)
+    return servers_query_all ();
+  if (use_native == TRUE)
+    result = native_query (&msg, &microsec);
+#endif
+#ifdef NSLOOKUP_COMMAND
+  if (use_native == FALSE)
+    result = nslookup_query (&msg, &microsec);
+#endif
+
+  if (addresses) {
+    int i,slen;
+    char *adrp;
+    qsort(addresses, n_addresses, sizeof(*addresses), qstrcmp);
+    for(i=0, slen=1; i < n_addresses; i++) {
+      slen += strlen(addresses[i])+1;
+    }
+    adrp = address = malloc(slen);
+    for(i=0; i < n_addresses; i++) {
+      if (i) *adrp++ = ',';
+      strcpy(adrp, addresses[i]);
+      adrp += strlen(addresses[i]);
+    }
+    *adrp = 0;
+  } else if (use_native == TRUE)
+    die (STATE_CRITICAL, _("DNS CRITICAL - DNS %s returned no address for %s\n"),
+         dns_server, query_address);
+#ifdef NSLOOKUP_COMMAND
+  else
+    die (STATE_CRITICAL,
+         _("DNS CRITICAL - '%s' msg parsing exited with no address\n"),
+         NSLOOKUP_COMMAND);
+#endif
+
+  /* compare to expected address */
+  if (result == STATE_OK && expected_address_cnt > 0)
+    result = match_expected (addresses, n_addresses, address, &msg);
+
+  /* check if authoritative */
+  if (result == STATE_OK && expect_authority && non_authoritative) {
+    result = STATE_CRITICAL;
+    xasprintf(&msg, _("server %s is not authoritative for %s"), dns_server, query_address);
+  }
+
+  elapsed_time = (double)microsec / 1.0e6;
+
+  if (result == STATE_OK) {
+    result = get_status(elapsed_time, time_thresholds);
+    if (result == STATE_OK) {
+      printf ("DNS %s: ", _("OK"));
+    } else if (result == STATE_WARNING) {
+      printf ("DNS %s: ", _("WARNING"));
+    } else if (result == STATE_CRITICAL) {
+      printf ("DNS %s: ", _("CRITICAL"));
+    }
+    printf (ngettext("%.3f second response time", "%.3f seconds response time", elapsed_time), elapsed_time);
+    printf (_(". %s returns %s"), query_address, address);
+    if ((time_thresholds->warning != NULL) && (time_thresholds->critical != NULL)) {
+      printf ("|%s", fperfdata ("time", elapsed_time, "s",
+                                  TRUE, time_thresholds->warning->end,
+                                  TRUE, time_thresholds->critical->end,
+                                  TRUE, 0, FALSE, 0));
+    } else if ((time_thresholds->warning == NULL) && (time_thresholds->critical != NULL)) {
+      printf ("|%s", fperfdata ("time", elapsed_time, "s",
+                                  FALSE, 0,
+                                  TRUE, time_thresholds->critical->end,
+                                  TRUE, 0, FALSE, 0));
+    } else if ((time_thresholds->warning != NULL) && (time_thresholds->critical == NULL)) {
+      printf ("|%s", fperfdata ("time", elapsed_time, "s",
+                                  TRUE, time_thresholds->warning->end,
+                                  FALSE, 0,
+                                  TRUE, 0, FALSE, 0));
+    } else
+      printf ("|%s", fperfdata ("time", elapsed_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    /* the answers are only cached for as long as the shortest TTL */
+    if (min_ttl >= 0)
+      printf (" %s", perfdata ("ttl", min_ttl, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    printf ("\n");
+  }
+  else if (result == STATE_WARNING)
+    printf (_("DNS WARNING - %s\n"),
+            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
+  else if (result == STATE_CRITICAL)
+    printf (_("DNS CRITICAL - %s\n"),
+            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
+  else
+    printf (_("DNS UNKNOWN - %s\n"),
+            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
+
+  return result;
+}
+
+#ifdef NSLOOKUP_COMMAND
+/* Run nslookup and scan what it printed */
+int
+nslookup_query (char **msg, long *microsec)
+{
+  char *command_line = NULL;
+  char *temp_buffer = NULL;
+  int result = STATE_UNKNOWN;
+  struct timeval tv;
+  int parse_address = FALSE; /* This flag scans for Address: but only after Name: */
+  output chld_out, chld_err;
+  size_t i;
+
   /* get the command to run */
-  xasprintf (&command_line, "%s %s %s", NSLOOKUP_COMMAND, query_address, dns_server);
+  if (dns_port)
+    xasprintf (&command_line, "%s -port=%d %s %s", NSLOOKUP_COMMAND, dns_port, query_address, dns_server);
+  else
+    xasprintf (&command_line, "%s %s %s", NSLOOKUP_COMMAND, query_address, dns_server);
 
-  alarm (timeout_interval);
   gettimeofday (&tv, NULL);
 
   if (verbose)
@@ -115,7 +286,7 @@ main (int argc, char **argv)
 
   /* run the command */
   if((np_runcmd(command_line, &chld_out, &chld_err, 0)) != 0) {
-    msg = (char *)_("nslookup returned an error status");
+    *msg = (char *)_("nslookup returned an error status");
     result = STATE_WARNING;
   }
 
@@ -133,7 +304,7 @@ main (int argc, char **argv)
       if ((temp_buffer = strstr (chld_out.line[i], "name = ")))
         addresses[n_addresses++] = strdup (temp_buffer + 7);
       else {
-        msg = (char *)_("Warning plugin error");
+        *msg = (char *)_("Warning plugin error");
         result = STATE_WARNING;
       }
     }
@@ -188,8 +359,8 @@ main (int argc, char **argv)
 
     result = error_scan (chld_out.line[i]);
     if (result != STATE_OK) {
-      msg = strchr (chld_out.line[i], ':');
-      if(msg) msg++;
+      *msg = strchr (chld_out.line[i], ':');
+      if(*msg) (*msg)++;
       break;
     }
   }
@@ -201,115 +372,375 @@ main (int argc, char **argv)
 
     if (error_scan (chld_err.line[i]) != STATE_OK) {
       result = max_state (result, error_scan (chld_err.line[i]));
-      msg = strchr(input_buffer, ':');
-      if(msg)
-         msg++;
+      *msg = strchr(chld_err.line[i], ':');
+      if(*msg)
+         (*msg)++;
       else
-         msg = input_buffer;
+         *msg = chld_err.line[i];
     }
   }
 
-  if (addresses) {
-    int i,slen;
-    char *adrp;
-    qsort(addresses, n_addresses, sizeof(*addresses), qstrcmp);
-    for(i=0, slen=1; i < n_addresses; i++) {
-      slen += strlen(addresses[i])+1;
-    }
-    adrp = address = malloc(slen);
-    for(i=0; i < n_addresses; i++) {
-      if (i) *adrp++ = ',';
-      strcpy(adrp, addresses[i]);
-      adrp += strlen(addresses[i]);
+  *microsec = deltime (tv);
+  return result;
+}
+#endif
+
+#ifdef HAVE_RES_NSEND
+/* Keep one answer, the way nslookup prints it */
+static void
+add_address (dns_answers *a, const char *str)
+{
+  if (!(a->n_addresses % 10))
+    a->addresses = realloc (a->addresses, sizeof (*a->addresses) * (a->n_addresses + 10));
+  if (a->addresses == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  a->addresses[a->n_addresses++] = strdup (str);
+}
+
+/* The name to ask for and the record types: A and AAAA for query_address,
+ * or PTR if it is an address, which is looked up in reverse */
+static int
+native_question (char *name, size_t size, int *types)
+{
+  struct in_addr addr4;
+  struct in6_addr addr6;
+  int j;
+
+  if (inet_pton (AF_INET, query_address, &addr4) == 1) {
+    u_char *p = (u_char *) &addr4;
+    snprintf (name, size, "%u.%u.%u.%u.in-addr.arpa", p[3], p[2], p[1], p[0]);
+    types[0] = ns_t_ptr;
+    return 1;
+  } else if (inet_pton (AF_INET6, query_address, &addr6) == 1) {
+    u_char *p = (u_char *) &addr6;
+    name[0] = '\0';
+    for (j = 15; j >= 0; j--)
+      snprintf (name + strlen (name), size - strlen (name), "%x.%x.", p[j] & 0xf, p[j] >> 4);
+    strncat (name, "ip6.arpa", size - strlen (name) - 1);
+    types[0] = ns_t_ptr;
+    return 1;
+  }
+  snprintf (name, size, "%s", query_address);
+  types[0] = ns_t_a;
+  types[1] = ns_t_aaaa;
+  return 2;
+}
+
+/* Add the answers of a reply from server to a. Returns STATE_OK, or the
+ * state its response code stands for with the reason in *msg */
+static int
+native_answers (const u_char *answer, int len, const char *server, dns_answers *a, char **msg)
+{
+  ns_msg handle;
+  ns_rr rr;
+  char buf[NS_MAXDNAME + 1];
+  u_int i;
+
+  if (ns_initparse (answer, len, &handle) < 0) {
+    xasprintf (msg, "%s", _("Invalid reply from the server"));
+    return STATE_WARNING;
+  }
+
+  switch (ns_msg_getflag (handle, ns_f_rcode)) {
+  case ns_r_noerror:
+    break;
+  case ns_r_nxdomain:
+    xasprintf (msg, _("Domain %s was not found by the server"), query_address);
+    return STATE_CRITICAL;
+  case ns_r_refused:
+    xasprintf (msg, _("Query was refused by DNS server at %s"), server);
+    return STATE_CRITICAL;
+  case ns_r_servfail:
+    xasprintf (msg, _("DNS failure for %s"), server);
+    return STATE_CRITICAL;
+  default:
+    xasprintf (msg, "%s", _("Format error"));
+    return STATE_WARNING;
+  }
+
+  if (!ns_msg_getflag (handle, ns_f_aa))
+    a->non_authoritative = TRUE;
+
+  for (i = 0; i < ns_msg_count (handle, ns_s_an); i++) {
+    if (ns_parserr (&handle, ns_s_an, i, &rr) < 0)
+      break;
+    if (ns_rr_type (rr) == ns_t_a && ns_rr_rdlen (rr) == 4)
+      inet_ntop (AF_INET, ns_rr_rdata (rr), buf, sizeof (buf));
+    else if (ns_rr_type (rr) == ns_t_aaaa && ns_rr_rdlen (rr) == 16)
+      inet_ntop (AF_INET6, ns_rr_rdata (rr), buf, sizeof (buf));
+    else if (ns_rr_type (rr) == ns_t_ptr &&
+             ns_name_uncompress (ns_msg_base (handle), ns_msg_end (handle), ns_rr_rdata (rr),
+                                 buf, sizeof (buf) - 1) >= 0)
+      strcat (buf, ".");
+    else
+      continue;
+
+    if (verbose)
+      printf ("  %s %s TTL %lu\n", ns_rr_name (rr), buf, (unsigned long) ns_rr_ttl (rr));
+    add_address (a, buf);
+    if (a->min_ttl < 0 || (long) ns_rr_ttl (rr) < a->min_ttl)
+      a->min_ttl = ns_rr_ttl (rr);
+  }
+  return STATE_OK;
+}
+
+/* Ask the server for the A and AAAA records of query_address, or for its
+ * PTR record if it is an address, through the resolver library. Only the
+ * exchange with the server is timed. */
+int
+native_query (char **msg, long *microsec)
+{
+  struct __res_state res;
+  struct addrinfo hints, *server;
+  struct timeval tv;
+  dns_answers a = { NULL, 0, FALSE, -1 };
+  char name[NS_MAXDNAME];
+  u_char query[NS_PACKETSZ];
+  u_char answer[NS_MAXMSG];
+  int types[2];
+  int n_types;
+  int result = STATE_OK;
+  int len, t;
+
+  memset (&res, 0, sizeof (res));
+  if (res_ninit (&res) != 0)
+    die (STATE_UNKNOWN, _("Could not initialize the resolver\n"));
+  /* one try per server, and give up on it before the plugin times out */
+  res.retry = 1;
+  res.retrans = timeout_interval > 2 ? timeout_interval - 1 : 1;
+
+  if (strlen (dns_server) > 0 || dns_port) {
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (np_getaddrinfo (strlen (dns_server) > 0 ? dns_server : "127.0.0.1", NULL, &hints, &server) != 0)
+      die (STATE_UNKNOWN, _("DNS UNKNOWN - %s has no IPv4 address to query\n"), dns_server);
+    memcpy (&res.nsaddr_list[0], server->ai_addr, sizeof (res.nsaddr_list[0]));
+    res.nsaddr_list[0].sin_port = htons (dns_port ? dns_port : NS_DEFAULTPORT);
+    res.nscount = 1;
+    freeaddrinfo (server);
+  }
+
+  n_types = native_question (name, sizeof (name), types);
+
+  gettimeofday (&tv, NULL);
+
+  for (t = 0; t < n_types; t++) {
+    len = res_nmkquery (&res, ns_o_query, name, ns_c_in, types[t], NULL, 0, NULL,
+                        query, sizeof (query));
+    if (len < 0)
+      die (STATE_UNKNOWN, _("DNS UNKNOWN - Cannot build a query for %s\n"), name);
+    if (verbose)
+      printf ("%s %s\n", types[t] == ns_t_a ? "A" : (types[t] == ns_t_aaaa ? "AAAA" : "PTR"), name);
+
+    len = res_nsend (&res, query, len, answer, sizeof (answer));
+    if (len < 0) {
+      if (errno == ECONNREFUSED)
+        die (STATE_CRITICAL, _("Connection to DNS %s was refused\n"), dns_server);
+      die (STATE_CRITICAL, _("No response from DNS %s\n"), dns_server);
     }
-    *adrp = 0;
-  } else
-    die (STATE_CRITICAL,
-         _("DNS CRITICAL - '%s' msg parsing exited with no address\n"),
-         NSLOOKUP_COMMAND);
+    if ((result = native_answers (answer, len, dns_server, &a, msg)) == STATE_CRITICAL)
+      die (STATE_CRITICAL, "%s\n", *msg);
+    if (result != STATE_OK)
+      break;
+  }
 
-  /* compare to expected address */
-  if (result == STATE_OK && expected_address_cnt > 0) {
-    result = STATE_CRITICAL;
-    temp_buffer = "";
-    unsigned long expect_match = (1 << expected_address_cnt) - 1;
-    unsigned long addr_match = (1 << n_addresses) - 1;
-
-    for (i=0; i<expected_address_cnt; i++) {
-      int j;
-      /* check if we get a match on 'raw' ip or cidr */
-      for (j=0; j<n_addresses; j++) {
-        if ( strcmp(addresses[j], expected_address[i]) == 0
-             || ip_match_cidr(addresses[j], expected_address[i]) ) {
-          result = STATE_OK;
-          addr_match &= ~(1 << j);
-          expect_match &= ~(1 << i);
-        }
-      }
+  *microsec = deltime (tv);
+  res_nclose (&res);
+
+  addresses = a.addresses;
+  n_addresses = a.n_addresses;
+  non_authoritative = a.non_authoritative;
+  min_ttl = a.min_ttl;
+  return result;
+}
+
+/* --servers: every server gets the same queries at once through
+ * np_udp_run(), one round per record type, and what they answer is
+ * compared once it is sorted */
+typedef struct {
+  dns_answers answers;
+  char *address;      /* the sorted answers, comma separated */
+  double elapsed;
+  int result;
+  char *msg;
+} dns_server_state;
+
+static u_char servers_query[NS_PACKETSZ];
+
+static void
+server_received (np_conn *c)
+{
+  dns_server_state *s = c->session;
+  char *msg = NULL;
+  int result;
+
+  /* a late reply to an earlier round, or not DNS at all */
+  if (c->len < NS_HFIXEDSZ || memcmp (c->data, servers_query, 2) != 0) {
+    free (c->data);
+    c->data = NULL;
+    c->len = 0;
+    return;
+  }
+  result = native_answers ((u_char *) c->data, c->len, c->host, &s->answers, &msg);
+  np_conn_finish (c, result, msg);
+}
+
+static void
+server_judge (np_conn *c)
+{
+  np_conn_finish (c, STATE_WARNING, strdup (_("Invalid reply from the server")));
+}
+
+int
+servers_query_all (void)
+{
+  np_conn *conns;
+  np_conn_ops ops;
+  dns_server_state *states;
+  char name[NS_MAXDNAME];
+  char *common = NULL;
+  char *msg = NULL;
+  int types[2];
+  int n_types, t, i, j, len, agree, best = 0, disagree = 0;
+  int result = STATE_OK;
+  size_t k, slen;
+
+  /* np_udp_run() gives up on a server after socket_timeout */
+  socket_timeout = timeout_interval > 1 ? timeout_interval - 1 : 1;
+  n_types = native_question (name, sizeof (name), types);
+
+  if ((states = calloc (n_servers, sizeof (dns_server_state))) == NULL ||
+      (conns = calloc (n_servers, sizeof (np_conn))) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  for (i = 0; i < n_servers; i++) {
+    states[i].answers.min_ttl = -1;
+    states[i].result = STATE_OK;
+  }
 
-      /* prepare an error string */
-      xasprintf(&temp_buffer, "%s%s; ", temp_buffer, expected_address[i]);
+  memset (&ops, 0, sizeof (ops));
+  ops.received = server_received;
+  ops.judge = server_judge;
+  ops.request = (const char *) servers_query;
+  ops.retries = 1;
+  ops.retry_interval = 1.0;
+
+  for (t = 0; t < n_types; t++) {
+    len = res_mkquery (ns_o_query, name, ns_c_in, types[t], NULL, 0, NULL,
+                       servers_query, sizeof (servers_query));
+    if (len < 0)
+      die (STATE_UNKNOWN, _("DNS UNKNOWN - Cannot build a query for %s\n"), name);
+    ops.request_len = len;
+    if (verbose)
+      printf ("%s %s\n", types[t] == ns_t_a ? "A" : (types[t] == ns_t_aaaa ? "AAAA" : "PTR"), name);
+
+    /* a server that failed already is not asked again */
+    memset (conns, 0, n_servers * sizeof (np_conn));
+    for (i = j = 0; i < n_servers; i++) {
+      if (states[i].result != STATE_OK)
+        continue;
+      conns[j].host = servers[i];
+      conns[j].port = server_ports[i] ? server_ports[i] : (dns_port ? dns_port : NS_DEFAULTPORT);
+      conns[j].fd = -1;
+      conns[j].match = -1;
+      conns[j].session = &states[i];
+      j++;
     }
-    /* check if expected_address must cover all in addresses and none may be missing */
-    if (all_match && (expect_match != 0 || addr_match != 0))
-      result = STATE_CRITICAL;
-    if (result == STATE_CRITICAL) {
-      /* Strip off last semicolon... */
-      temp_buffer[strlen(temp_buffer)-2] = '\0';
-      xasprintf(&msg, _("expected '%s' but got '%s'"), temp_buffer, address);
+    np_udp_run (conns, j, &ops);
+
+    while (j-- > 0) {
+      dns_server_state *s = conns[j].session;
+      s->elapsed += conns[j].elapsed;
+      s->result = conns[j].result;
+      s->msg = conns[j].message;
+      free (conns[j].data);
     }
   }
 
-  /* check if authoritative */
-  if (result == STATE_OK && expect_authority && non_authoritative) {
-    result = STATE_CRITICAL;
-    xasprintf(&msg, _("server %s is not authoritative for %s"), dns_server, query_address);
+  /* sorted and joined like the answers of a single server */
+  for (i = 0; i < n_servers; i++) {
+    dns_answers *a = &states[i].answers;
+    qsort (a->addresses, a->n_addresses, sizeof (*a->addresses), qstrcmp);
+    for (j = 0, slen = 1; j < a->n_addresses; j++)
+      slen += strlen (a->addresses[j]) + 1;
+    if ((states[i].address = malloc (slen)) == NULL)
+      die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    states[i].address[0] = '\0';
+    for (j = 0; j < a->n_addresses; j++) {
+      if (j)
+        strcat (states[i].address, ",");
+      strcat (states[i].address, a->addresses[j]);
+    }
+    if (states[i].result == STATE_OK && a->n_addresses == 0) {
+      states[i].result = STATE_CRITICAL;
+      xasprintf (&states[i].msg, _("DNS %s returned no address for %s"), servers[i], query_address);
+    }
   }
 
-  microsec = deltime (tv);
-  elapsed_time = (double)microsec / 1.0e6;
-
-  if (result == STATE_OK) {
-    result = get_status(elapsed_time, time_thresholds);
-    if (result == STATE_OK) {
-      printf ("DNS %s: ", _("OK"));
-    } else if (result == STATE_WARNING) {
-      printf ("DNS %s: ", _("WARNING"));
-    } else if (result == STATE_CRITICAL) {
-      printf ("DNS %s: ", _("CRITICAL"));
+  /* the answer most of the servers agree on */
+  for (i = 0, agree = 0; i < n_servers; i++) {
+    if (states[i].result != STATE_OK)
+      continue;
+    for (j = i, k = 0; j < n_servers; j++)
+      if (states[j].result == STATE_OK && strcmp (states[i].address, states[j].address) == 0)
+        k++;
+    if ((int) k > agree) {
+      agree = k;
+      best = i;
     }
-    printf (ngettext("%.3f second response time", "%.3f seconds response time", elapsed_time), elapsed_time);
-    printf (_(". %s returns %s"), query_address, address);
-    if ((time_thresholds->warning != NULL) && (time_thresholds->critical != NULL)) {
-      printf ("|%s\n", fperfdata ("time", elapsed_time, "s",
-                                  TRUE, time_thresholds->warning->end,
-                                  TRUE, time_thresholds->critical->end,
-                                  TRUE, 0, FALSE, 0));
-    } else if ((time_thresholds->warning == NULL) && (time_thresholds->critical != NULL)) {
-      printf ("|%s\n", fperfdata ("time", elapsed_time, "s",
-                                  FALSE, 0,
-                                  TRUE, time_thresholds->critical->end,
-                                  TRUE, 0, FALSE, 0));
-    } else if ((time_thresholds->warning != NULL) && (time_thresholds->critical == NULL)) {
-      printf ("|%s\n", fperfdata ("time", elapsed_time, "s",
-                                  TRUE, time_thresholds->warning->end,
-                                  FALSE, 0,
-                                  TRUE, 0, FALSE, 0));
-    } else
-      printf ("|%s\n", fperfdata ("time", elapsed_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
   }
-  else if (result == STATE_WARNING)
-    printf (_("DNS WARNING - %s\n"),
-            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
-  else if (result == STATE_CRITICAL)
-    printf (_("DNS CRITICAL - %s\n"),
-            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
+  if (agree > 0)
+    common = states[best].address;
+
+  for (i = 0; i < n_servers; i++) {
+    if (states[i].result == STATE_OK && strcmp (states[i].address, common) != 0) {
+      states[i].result = STATE_CRITICAL;
+      xasprintf (&states[i].msg, _("returns %s, but %d of %d servers return %s"),
+                 states[i].address, agree, n_servers, common);
+      disagree++;
+    }
+    if (states[i].result == STATE_OK && expected_address_cnt > 0)
+      states[i].result = match_expected (states[i].answers.addresses, states[i].answers.n_addresses,
+                                         states[i].address, &states[i].msg);
+    if (states[i].result == STATE_OK && expect_authority && states[i].answers.non_authoritative) {
+      states[i].result = STATE_CRITICAL;
+      xasprintf (&states[i].msg, _("server %s is not authoritative for %s"), servers[i], query_address);
+    }
+    if (states[i].result == STATE_OK) {
+      states[i].result = get_status (states[i].elapsed, time_thresholds);
+      xasprintf (&states[i].msg, _("%.3f seconds response time, returns %s"),
+                 states[i].elapsed, states[i].address);
+    }
+    result = max_state (result, states[i].result);
+  }
+
+  if (agree == n_servers)
+    xasprintf (&msg, _("%d servers agree that %s returns %s"), n_servers, query_address, common);
+  else if (agree > 0)
+    xasprintf (&msg, _("%d of %d servers agree that %s returns %s"), agree, n_servers, query_address, common);
   else
-    printf (_("DNS UNKNOWN - %s\n"),
-            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
+    xasprintf (&msg, _("no server returned an address for %s"), query_address);
+  printf ("DNS %s - %s|", state_text (result), msg);
+
+  /* servers are told apart by their port where it was given */
+  for (i = 0; i < n_servers; i++) {
+    if (server_ports[i])
+      xasprintf (&servers[i], "%s:%d", servers[i], server_ports[i]);
+    printf ("%s%s", i ? " " : "",
+            fperfdata (servers[i], states[i].elapsed, "s",
+                       time_thresholds->warning != NULL, time_thresholds->warning ? time_thresholds->warning->end : 0,
+                       time_thresholds->critical != NULL, time_thresholds->critical ? time_thresholds->critical->end : 0,
+                       TRUE, 0, FALSE, 0));
+  }
+  printf (" %s\n", perfdata ("disagree", disagree, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, n_servers));
+
+  for (i = 0; i < n_servers; i++)
+    printf ("%s %s: %s\n", state_text (states[i].result), servers[i],
+            states[i].msg ? states[i].msg : "");
 
   return result;
 }
+#endif
 
 int
 ip_match_cidr(const char *addr, const char *cidr_ro)
@@ -408,6 +839,10 @@ process_arguments (int argc, char **argv)
   char *critical = NULL;
 
   int opt_index = 0;
+  enum {
+    NATIVE_OPTION = CHAR_MAX + 1,
+    SERVERS_OPTION
+  };
   static struct option long_opts[] = {
     {"help", no_argument, 0, 'h'},
     {"version", no_argument, 0, 'V'},
@@ -415,6 +850,9 @@ process_arguments (int argc, char **argv)
     {"timeout", required_argument, 0, 't'},
     {"hostname", required_argument, 0, 'H'},
     {"server", required_argument, 0, 's'},
+    {"port", required_argument, 0, 'p'},
+    {"native", no_argument, 0, NATIVE_OPTION},
+    {"servers", required_argument, 0, SERVERS_OPTION},
     {"reverse-server", required_argument, 0, 'r'},
     {"expected-address", required_argument, 0, 'a'},
     {"expect-authority", no_argument, 0, 'A'},
@@ -432,7 +870,7 @@ process_arguments (int argc, char **argv)
       strcpy (argv[c], "-t");
 
   while (1) {
-    c = getopt_long (argc, argv, "hVvALt:H:s:r:a:w:c:", long_opts, &opt_index);
+    c = getopt_long (argc, argv, "hVvALt:H:s:p:r:a:w:c:", long_opts, &opt_index);
 
     if (c == -1 || c == EOF)
       break;
@@ -463,6 +901,47 @@ process_arguments (int argc, char **argv)
         die (STATE_UNKNOWN, _("Input buffer overflow\n"));
       strcpy (dns_server, optarg);
       break;
+    case 'p': /* server port */
+      if (!is_intpos (optarg) || atoi (optarg) > 65535)
+        usage2 (_("Port must be a positive integer"), optarg);
+      dns_port = atoi (optarg);
+      break;
+    case NATIVE_OPTION:
+#ifdef HAVE_RES_NSEND
+      use_native = TRUE;
+#else
+      usage4 (_("check_dns was built without res_nsend()"));
+#endif
+      break;
+    case SERVERS_OPTION: /* comma separated list of servers */
+#ifdef HAVE_RES_NSEND
+      {
+      char *server, *port;
+      for (server = strtok (optarg, ","); server != NULL; server = strtok (NULL, ",")) {
+        servers = realloc (servers, (n_servers + 1) * sizeof (char *));
+        server_ports = realloc (server_ports, (n_servers + 1) * sizeof (int));
+        if (servers == NULL || server_ports == NULL)
+          die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+        /* "host:port" or "[address]:port" */
+        port = NULL;
+        if (*server == '[' && (port = strchr (server, ']')) != NULL) {
+          *port++ = '\0';
+          server++;
+          port = (*port == ':') ? port + 1 : NULL;
+        } else if ((port = strchr (server, ':')) != NULL && strchr (port + 1, ':') == NULL)
+          *port++ = '\0';
+        else
+          port = NULL;
+        if (port != NULL && (!is_intpos (port) || atoi (port) > 65535))
+          usage2 (_("Port must be a positive integer"), port);
+        servers[n_servers] = server;
+        server_ports[n_servers++] = port ? atoi (port) : 0;
+      }
+      }
+#else
+      usage4 (_("check_dns was built without res_nsend()"));
+#endif
+      break;
     case 'r': /* reverse server name */
       /* TODO: Is this host_or_die necessary? */
       host_or_die(optarg);
@@ -520,6 +999,8 @@ validate_arguments ()
 {
   if (query_address[0] == 0)
     return ERROR;
+  if (n_servers > 0 && strlen (dns_server) > 0)
+    usage4 (_("-s and --servers cannot be used together"));
 
   return OK;
 }
@@ -533,7 +1014,7 @@ print_help (void)
   printf ("Copyright (c) 1999 Ethan Galstad <nagios@nagios.org>\n");
   printf (COPYRIGHT, copyright, email);
 
-  printf ("%s\n", _("This plugin uses the nslookup program to obtain the IP address for the given host/domain query."));
+  printf ("%s\n", _("This plugin uses the nslookup program or the resolver library to obtain the IP address for the given host/domain query."));
   printf ("%s\n", _("An optional DNS server to use may be specified."));
   printf ("%s\n", _("If no DNS server is specified, the default server(s) specified in /etc/resolv.conf will be used."));
 
@@ -548,6 +1029,8 @@ print_help (void)
   printf ("    %s\n", _("The name or address you want to query"));
   printf (" -s, --server=HOST\n");
   printf ("    %s\n", _("Optional DNS server you want to use for the lookup"));
+  printf (" -p, --port=INTEGER\n");
+  printf ("    %s\n", _("Port of the DNS server (default: 53)"));
   printf (" -a, --expected-address=IP-ADDRESS|CIDR|HOST\n");
   printf ("    %s\n", _("Optional IP-ADDRESS/CIDR you expect the DNS server to return. HOST must end"));
   printf ("    %s\n", _("with a dot (.). This option can be repeated multiple times (Returns OK if any"));
@@ -561,6 +1044,20 @@ print_help (void)
   printf (" -L, --all\n");
   printf ("    %s\n", _("Return critical if the list of expected addresses does not match all addresses"));
   printf ("    %s\n", _("returned. Default off"));
+#ifdef HAVE_RES_NSEND
+  printf (" --native\n");
+  printf ("    %s\n", _("Query the server through the resolver library instead of running nslookup."));
+  printf ("    %s\n", _("Only the DNS exchange is timed, the shortest TTL of the answers is added"));
+  printf ("    %s\n", _("to the performance data and -s must be an IPv4 server"));
+#ifndef NSLOOKUP_COMMAND
+  printf ("    %s\n", _("This is the default as nslookup was not found when check_dns was built"));
+#endif
+  printf (" --servers=SERVER[:PORT],SERVER[:PORT],...\n");
+  printf ("    %s\n", _("Send the same query to all of these servers at once and compare what they"));
+  printf ("    %s\n", _("answer once it is sorted. A server that disagrees with most of them is"));
+  printf ("    %s\n", _("critical, -a, -A, -w and -c apply to each server, the worst state is"));
+  printf ("    %s\n", _("returned"));
+#endif
 
   printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
@@ -572,5 +1069,6 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-  printf ("%s -H host [-s server] [-a expected-address] [-A] [-t timeout] [-w warn] [-c crit] [-L]\n", progname);
+  printf ("%s -H host [-s server] [-p port] [-a expected-address] [-A] [-t timeout] [-w warn] [-c crit] [-L] [--native]\n", progname);
+  printf ("%s -H host --servers=server,server,... [-p port] [-a expected-address] [-A] [-t timeout] [-w warn] [-c crit] [-L]\n", progname);
 }
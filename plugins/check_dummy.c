@@ -28,6 +28,8 @@
 * 
 *****************************************************************************/
 
+#include "np_entry.h"
+
 const char *progname = "check_dummy";
 const char *copyright = "1999-2007";
 const char *email = "devel@monitoring-plugins.org";
@@ -44,9 +46,7 @@ main (int argc, char **argv)
 {
   int result = STATE_UNKNOWN;
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  np_locale_init ();
 
   if (argc < 2)
     usage4 (_("Could not parse arguments"));
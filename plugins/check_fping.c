@@ -36,6 +36,7 @@ const char *email = "devel@monitoring-plugins.org";
 #include "common.h"
 #include "popen.h"
 #include "netutils.h"
+#include "icmputils.h"
 #include "utils.h"
 
 enum {
@@ -46,6 +47,8 @@ enum {
 };
 
 int textscan (char *buf);
+int fping_status (double loss, double rta, int have_rta);
+static int run_targets (void);
 int process_arguments (int, char **);
 int get_threshold (char *arg, char *rv[2]);
 void print_help (void);
@@ -67,6 +70,9 @@ int cpl_p = FALSE;
 int wpl_p = FALSE;
 int crta_p = FALSE;
 int wrta_p = FALSE;
+char *targets_file = NULL;
+static np_icmp_target *targets = NULL;
+static int targets_count = 0;
 
 int
 main (int argc, char **argv)
@@ -82,9 +88,7 @@ main (int argc, char **argv)
   char *option_string = "";
   input_buffer = malloc (MAX_INPUT_BUFFER);
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  np_locale_init ();
 
   /* Parse extra opts if any */
   argv=np_extra_opts (&argc, argv, progname);
@@ -92,6 +96,9 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  if (targets_file != NULL)
+    return run_targets ();
+
   server = strscpy (server, server_name);
 
   /* compose the command */
@@ -126,7 +133,7 @@ main (int argc, char **argv)
     return STATE_UNKNOWN;
   }
 
-  child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
+  child_stderr = fdopen (spopen_stderr (child_process), "r");
   if (child_stderr == NULL) {
     printf (_("Could not open stderr for %s\n"), command_line);
   }
@@ -213,16 +220,7 @@ textscan (char *buf)
     rtastr = 1 + index (rtastr, '/');
     loss = strtod (losstr, NULL);
     rta = strtod (rtastr, NULL);
-    if (cpl_p == TRUE && loss > cpl)
-      status = STATE_CRITICAL;
-    else if (crta_p == TRUE  && rta > crta)
-      status = STATE_CRITICAL;
-    else if (wpl_p == TRUE && loss > wpl)
-      status = STATE_WARNING;
-    else if (wrta_p == TRUE && rta > wrta)
-      status = STATE_WARNING;
-    else
-      status = STATE_OK;
+    status = fping_status (loss, rta, TRUE);
     die (status,
           _("FPING %s - %s (loss=%.0f%%, rta=%f ms)|%s %s\n"),
          state_text (status), server_name, loss, rta,
@@ -241,14 +239,7 @@ textscan (char *buf)
     losstr = 1 + strstr (losstr, "/");
     losstr = 1 + strstr (losstr, "/");
     loss = strtod (losstr, NULL);
-    if (atoi(losstr) == 100)
-      status = STATE_CRITICAL;
-    else if (cpl_p == TRUE && loss > cpl)
-      status = STATE_CRITICAL;
-    else if (wpl_p == TRUE && loss > wpl)
-      status = STATE_WARNING;
-    else
-      status = STATE_OK;
+    status = fping_status (loss, 0, FALSE);
     /* loss=%.0f%%;%d;%d;0;100 */
     die (status, _("FPING %s - %s (loss=%.0f%% )|%s\n"),
          state_text (status), server_name, loss ,
@@ -263,6 +254,184 @@ textscan (char *buf)
 }
 
 
+/* The state for a host given its packet loss and, if any packet came
+ * back, its round trip average */
+int
+fping_status (double loss, double rta, int have_rta)
+{
+  if (!have_rta && loss >= 100)
+    return STATE_CRITICAL;
+  else if (cpl_p == TRUE && loss > cpl)
+    return STATE_CRITICAL;
+  else if (have_rta && crta_p == TRUE && rta > crta)
+    return STATE_CRITICAL;
+  else if (wpl_p == TRUE && loss > wpl)
+    return STATE_WARNING;
+  else if (have_rta && wrta_p == TRUE && rta > wrta)
+    return STATE_WARNING;
+  return STATE_OK;
+}
+
+
+/* One host per line, blank lines and lines starting with # are skipped */
+static void
+read_targets (const char *filename)
+{
+  FILE *fp;
+  char line[MAX_INPUT_BUFFER];
+  char *host;
+  size_t size = 0;
+
+  if (strcmp (filename, "-") == 0)
+    fp = stdin;
+  else if ((fp = fopen (filename, "r")) == NULL)
+    die (STATE_UNKNOWN, _("Cannot open target list %s: %s\n"), filename, strerror (errno));
+
+  while (fgets (line, sizeof (line), fp) != NULL) {
+    strip (line);
+    host = line + strspn (line, " \t");
+    if (*host == '\0' || *host == '#')
+      continue;
+    if (targets_count >= size) {
+      size = size ? size * 2 : 64;
+      if ((targets = realloc (targets, size * sizeof (np_icmp_target))) == NULL)
+        die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+    }
+    memset (&targets[targets_count], 0, sizeof (np_icmp_target));
+    targets[targets_count++].name = strdup (host);
+  }
+
+  if (fp != stdin)
+    fclose (fp);
+
+  if (targets_count == 0)
+    die (STATE_UNKNOWN, _("No targets found in %s\n"), filename);
+}
+
+/* Ping every host listed in targets_file from this process, with the
+ * ICMP prober shared with check_ping */
+static int
+run_targets (void)
+{
+  struct addrinfo hints, *res;
+  struct timeval start;
+  np_icmp_probe probe;
+  perf_buffer perf = PERF_BUFFER_INIT;
+  const char **names;
+  char *label = NULL;
+  unsigned int replies;
+  double loss, rta;
+  int states[STATE_DEPENDENT + 1] = { 0 };
+  int *results;
+  int result = STATE_OK;
+  int sock, i;
+
+  read_targets (targets_file);
+
+  if (address_family != AF_INET6)
+    address_family = AF_INET;
+
+  /* look up all host names at once rather than one by one */
+  if ((names = calloc (targets_count, sizeof (char *))) == NULL ||
+      (results = calloc (targets_count, sizeof (int))) == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  for (i = 0; i < targets_count; i++)
+    names[i] = targets[i].name;
+  np_resolve_prefetch (names, targets_count, address_family, DEFAULT_RESOLVE_THREADS);
+  free (names);
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = address_family;
+  hints.ai_socktype = SOCK_RAW;
+  for (i = 0; i < targets_count; i++) {
+    if (np_getaddrinfo (targets[i].name, NULL, &hints, &res) != 0) {
+      results[i] = STATE_UNKNOWN;
+      continue;
+    }
+    memcpy (&targets[i].addr, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo (res);
+    targets[i].resolved = TRUE;
+  }
+
+  memset (&probe, 0, sizeof (probe));
+  if ((sock = np_icmp_socket (address_family, TRUE, &probe.dgram)) < 0)
+    die (STATE_UNKNOWN, _("FPING UNKNOWN - Cannot open an ICMP socket: %s\n"), strerror (errno));
+  np_icmp_timestamps (sock, verbose);
+  if (verbose)
+    printf (_("Using a %s ICMP socket\n"), probe.dgram ? _("datagram") : _("raw"));
+
+  if (sourceip) {
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = address_family;
+    if (np_getaddrinfo (sourceip, NULL, &hints, &res) != 0 ||
+        bind (sock, res->ai_addr, res->ai_addrlen) != 0)
+      die (STATE_UNKNOWN, _("FPING UNKNOWN - Cannot bind to %s\n"), sourceip);
+    freeaddrinfo (res);
+  }
+#ifdef SO_BINDTODEVICE
+  if (sourceif && setsockopt (sock, SOL_SOCKET, SO_BINDTODEVICE, sourceif, strlen (sourceif) + 1) != 0)
+    die (STATE_UNKNOWN, _("FPING UNKNOWN - Cannot bind to interface %s: %s\n"), sourceif, strerror (errno));
+#endif
+
+  probe.sock = sock;
+  probe.family = address_family;
+  probe.packets = packet_count;
+  probe.size = packet_size;
+  /* the same defaults as fping's -p and -t */
+  probe.interval = packet_interval ? packet_interval * 1000 : 1000000;
+  probe.timeout = target_timeout ? target_timeout * 1000 : 500000;
+  probe.verbose = verbose;
+
+  gettimeofday (&start, NULL);
+  replies = np_icmp_ping (&probe, targets, targets_count);
+  close (sock);
+
+  for (i = 0; i < targets_count; i++) {
+    np_icmp_target *t = &targets[i];
+
+    if (t->resolved) {
+      loss = t->sent ? (t->sent - t->received) * 100.0 / t->sent : 100;
+      rta = t->received ? t->rtt_total / t->received : 0;
+      results[i] = fping_status (loss, rta, t->received > 0);
+
+      xasprintf (&label, "%s_loss", t->name);
+      perfdata_append (&perf, label, (long int) loss, "%", wpl_p, wpl, cpl_p, cpl, TRUE, 0, TRUE, 100);
+      free (label);
+      if (t->received) {
+        xasprintf (&label, "%s_rta", t->name);
+        fperfdata_append (&perf, label, rta / 1.0e3, "s", wrta_p, wrta / 1.0e3, crta_p, crta / 1.0e3, TRUE, 0, FALSE, 0);
+        free (label);
+      }
+    }
+    result = max_state_alt (result, results[i]);
+    states[results[i]]++;
+  }
+
+  if (verbose)
+    printf (_("%u replies in %.3f seconds\n"), replies, (double) deltime (start) / 1.0e6);
+
+  printf (_("FPING %s - %d targets: %d ok, %d warning, %d critical, %d unknown|%s\n"),
+          state_text (result), targets_count, states[STATE_OK], states[STATE_WARNING],
+          states[STATE_CRITICAL], states[STATE_UNKNOWN], perf_string (&perf));
+
+  for (i = 0; i < targets_count; i++) {
+    np_icmp_target *t = &targets[i];
+
+    if (!t->resolved)
+      printf (_("%s %s: not found\n"), state_text (results[i]), t->name);
+    else if (t->received == 0)
+      printf (_("%s %s: is down (loss=100%%)\n"), state_text (results[i]), t->name);
+    else
+      printf (_("%s %s (loss=%.0f%%, rta=%f ms)\n"), state_text (results[i]), t->name,
+              (t->sent - t->received) * 100.0 / t->sent, t->rtt_total / t->received);
+  }
+
+  free (results);
+  free (perf.buf);
+  return result;
+}
+
+
 
 /* process command-line arguments */
 int
@@ -272,6 +441,9 @@ process_arguments (int argc, char **argv)
   char *rv[2];
 
   int option = 0;
+  enum {
+    TARGETS_OPTION = CHAR_MAX + 1
+  };
   static struct option longopts[] = {
     {"hostname", required_argument, 0, 'H'},
     {"sourceip", required_argument, 0, 'S'},
@@ -287,6 +459,7 @@ process_arguments (int argc, char **argv)
     {"help", no_argument, 0, 'h'},
     {"use-ipv4", no_argument, 0, '4'},
     {"use-ipv6", no_argument, 0, '6'},
+    {"targets", required_argument, 0, TARGETS_OPTION},
     {0, 0, 0, 0}
   };
 
@@ -395,10 +568,13 @@ process_arguments (int argc, char **argv)
       else
         usage (_("Interval must be a positive integer"));
       break;
+    case TARGETS_OPTION:     /* hosts to ping from this process */
+      targets_file = optarg;
+      break;
     }
   }
 
-  if (server_name == NULL)
+  if (server_name == NULL && targets_file == NULL)
     usage4 (_("Hostname was not supplied"));
 
   return OK;
@@ -486,6 +662,10 @@ print_help (void)
   printf ("    %s\n", _("name or IP Address of sourceip"));
   printf (" %s\n", "-I, --sourceif=IF");
   printf ("    %s\n", _("source interface name"));
+  printf (" %s\n", "--targets=FILE");
+  printf ("    %s\n", _("Ping all hosts listed in FILE (\"-\" for stdin), one per line, from this"));
+  printf ("    %s\n", _("process instead of running fping, and report on each. Needs root, or on"));
+  printf ("    %s\n", _("Linux a group allowed by the net.ipv4.ping_group_range sysctl"));
   printf (UT_VERBOSE);
   printf ("\n");
   printf (" %s\n", _("THRESHOLD is <rta>,<pl>%% where <rta> is the round trip average travel time (ms)"));
@@ -504,4 +684,5 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
   printf (" %s <host_address> -w limit -c limit [-b size] [-n number] [-T number] [-i number]\n", progname);
+  printf (" %s --targets=<file> -w limit -c limit [-b size] [-n number] [-T number] [-i number]\n", progname);
 }
@@ -10,7 +10,7 @@
 * This file contains the check_game plugin
 * 
 * This plugin tests game server connections with the specified host.
-* using the qstat program
+* using the qstat program, or natively for the Source and Quake 3 protocols
 * 
 * 
 * This program is free software: you can redistribute it and/or modify
@@ -36,11 +36,16 @@ const char *email = "devel@monitoring-plugins.org";
 #include "common.h"
 #include "utils.h"
 #include "runcmd.h"
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
 
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
+int check_native (void);
+static int native_game (void);
 
 #define QSTAT_DATA_DELIMITER  ","
 
@@ -49,9 +54,46 @@ void print_usage (void);
 #define QSTAT_HOST_TIMEOUT  "TIMEOUT"
 #define QSTAT_MAX_RETURN_ARGS 12
 
+/* The built-in query engine (--native) speaks the Source (A2S_INFO) and
+ * Quake 3 (getstatus) protocols, to all servers at the same time */
+#define NATIVE_OPTION CHAR_MAX+1
+
+#define GAME_MAX_PACKET 65536
+#define GAME_RESEND_INTERVAL 1000	/* milliseconds */
+#define GAME_RCVBUF (4 * 1024 * 1024)
+
+enum {
+  GAME_A2S,
+  GAME_Q3S
+};
+
+typedef struct game_server {
+  char *name;
+  char *host;
+  int port;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  int fd;
+  unsigned char challenge[4];
+  int has_challenge;
+  struct timeval sent;
+  struct timeval started;
+  int done;
+  int result;
+  int players;
+  int players_max;
+  char *title;
+  char *map;
+  double ping;
+  char *message;
+} game_server;
+
 char *server_ip;
 char *game_type;
 int port = 0;
+int native = FALSE;
+game_server *servers = NULL;
+size_t servers_count = 0;
 
 int verbose;
 
@@ -65,15 +107,15 @@ int qstat_ping_field = -1;
 int
 main (int argc, char **argv)
 {
+#ifdef PATH_TO_QSTAT
   char *command_line;
   int result = STATE_UNKNOWN;
   char *p, *ret[QSTAT_MAX_RETURN_ARGS];
   size_t i = 0;
   output chld_out;
+#endif
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  np_locale_init ();
 
   /* Parse extra opts if any */
   argv=np_extra_opts (&argc, argv, progname);
@@ -81,6 +123,12 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage_va(_("Could not parse arguments"));
 
+  if (native)
+    return check_native ();
+
+#ifndef PATH_TO_QSTAT
+  die (STATE_UNKNOWN, _("qstat was not found at build time, use --native\n"));
+#else
   result = STATE_OK;
 
   /* create the command line to execute */
@@ -141,18 +189,47 @@ main (int argc, char **argv)
             ret[qstat_game_field],
             ret[qstat_map_field],
             ret[qstat_ping_field],
-            perfdata ("players", atol(ret[qstat_game_players]), "",
+            perfdata ("players", (long) np_strtoll (ret[qstat_game_players], NULL), "",
                       FALSE, 0, FALSE, 0,
-                      TRUE, 0, TRUE, atol(ret[qstat_game_players_max])),
-            fperfdata ("ping", strtod(ret[qstat_ping_field], NULL), "",
+                      TRUE, 0, TRUE, (long) np_strtoll (ret[qstat_game_players_max], NULL)),
+            fperfdata ("ping", np_strtod (ret[qstat_ping_field], NULL), "",
                       FALSE, 0, FALSE, 0,
                       TRUE, 0, FALSE, 0));
   }
 
   return result;
+#endif
 }
 
 
+static void
+add_server (char *name)
+{
+  game_server *srv;
+  char *p;
+
+  servers = realloc (servers, (servers_count + 1) * sizeof (game_server));
+  if (servers == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  srv = &servers[servers_count++];
+  memset (srv, 0, sizeof (game_server));
+  srv->name = name;
+  srv->fd = -1;
+
+  /* host, host:port, [address]:port */
+  srv->host = strdup (name);
+  if (srv->host[0] == '[' && (p = strchr (srv->host, ']')) != NULL) {
+    *p++ = '\0';
+    memmove (srv->host, srv->host + 1, strlen (srv->host));
+    if (*p == ':')
+      srv->port = atoi (p + 1);
+  }
+  else if ((p = strchr (srv->host, ':')) != NULL && strchr (p + 1, ':') == NULL) {
+    *p = '\0';
+    srv->port = atoi (p + 1);
+  }
+}
+
 int
 process_arguments (int argc, char **argv)
 {
@@ -172,6 +249,7 @@ process_arguments (int argc, char **argv)
     {"game-field", required_argument, 0, 'g'},
     {"players-field", required_argument, 0, 129},
     {"max-players-field", required_argument, 0, 130},
+    {"native", no_argument, 0, NATIVE_OPTION},
     {0, 0, 0, 0}
   };
 
@@ -210,6 +288,7 @@ process_arguments (int argc, char **argv)
       if (strlen (optarg) >= MAX_HOST_ADDRESS_LENGTH)
         die (STATE_UNKNOWN, _("Input buffer overflow\n"));
       server_ip = optarg;
+      add_server (optarg);
       break;
     case 'P': /* port */
       port = atoi (optarg);
@@ -246,6 +325,9 @@ process_arguments (int argc, char **argv)
       if (qstat_game_players_max < 0 || qstat_game_players_max > QSTAT_MAX_RETURN_ARGS)
         return ERROR;
       break;
+    case NATIVE_OPTION:
+      native = TRUE;
+      break;
     default: /* args not parsable */
       usage5();
     }
@@ -257,8 +339,14 @@ process_arguments (int argc, char **argv)
     game_type = strdup (argv[c++]);
 
   /* Second option is the server name */
-  if (!server_ip && c<argc)
+  if (!server_ip && c<argc) {
     server_ip = strdup (argv[c++]);
+    add_server (server_ip);
+  }
+
+  /* The built-in engine takes any number of servers */
+  while (native && c<argc)
+    add_server (argv[c++]);
 
   return validate_arguments ();
 }
@@ -282,10 +370,388 @@ validate_arguments (void)
   if (qstat_ping_field < 0)
     qstat_ping_field = 5;
 
+  if (servers_count > 1 && !native)
+    usage4 (_("Several servers require --native"));
+
+  if (native) {
+    if (game_type == NULL || server_ip == NULL)
+      usage4 (_("Game type and server must be given"));
+    if (native_game () < 0)
+      usage2 (_("Game type not supported by --native, use a2s or q3s"), game_type);
+  }
+
   return OK;
 }
 
 
+/* Protocol of the game type, or -1 if the built-in engine cannot query it */
+static int
+native_game (void)
+{
+  if (strcmp (game_type, "a2s") == 0)
+    return GAME_A2S;
+  if (strcmp (game_type, "q3s") == 0)
+    return GAME_Q3S;
+  return -1;
+}
+
+static int
+game_open (game_server *srv, int game, int *fds)
+{
+  struct addrinfo hints, *res;
+  char port_str[6];
+  int result, family, size = GAME_RCVBUF;
+
+  if (srv->port == 0)
+    srv->port = port ? port : (game == GAME_A2S ? 27015 : 27960);
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  snprintf (port_str, sizeof (port_str), "%d", srv->port);
+  if ((result = getaddrinfo (srv->host, port_str, &hints, &res)) != 0) {
+    xasprintf (&srv->message, _("Host not found"));
+    return STATE_CRITICAL;
+  }
+  memcpy (&srv->addr, res->ai_addr, res->ai_addrlen);
+  srv->addrlen = res->ai_addrlen;
+  freeaddrinfo (res);
+
+  /* one socket per address family is shared by all servers, the replies
+   * are told apart by their source address */
+  family = srv->addr.ss_family == AF_INET6 ? 1 : 0;
+  if (fds[family] < 0) {
+    if ((fds[family] = socket (srv->addr.ss_family, SOCK_DGRAM, 0)) < 0) {
+      xasprintf (&srv->message, _("Cannot create socket: %s"), strerror (errno));
+      return STATE_UNKNOWN;
+    }
+    /* many replies can arrive at the same time */
+    setsockopt (fds[family], SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+  }
+  srv->fd = fds[family];
+  return STATE_OK;
+}
+
+static void
+game_send (game_server *srv, int game)
+{
+  static const char a2s_query[] = "\xff\xff\xff\xffTSource Engine Query";
+  static const char q3s_query[] = "\xff\xff\xff\xffgetstatus\n";
+  unsigned char packet[sizeof (a2s_query) + 4];
+  size_t len;
+
+  gettimeofday (&srv->sent, NULL);
+  if (srv->started.tv_sec == 0)
+    srv->started = srv->sent;
+  if (game == GAME_A2S) {
+    /* with the terminating NUL, followed by the challenge if there is one */
+    memcpy (packet, a2s_query, sizeof (a2s_query));
+    len = sizeof (a2s_query);
+    if (srv->has_challenge) {
+      memcpy (packet + len, srv->challenge, 4);
+      len += 4;
+    }
+  }
+  else {
+    len = sizeof (q3s_query) - 1;
+    memcpy (packet, q3s_query, len);
+  }
+  if (verbose)
+    printf (_("Sending query to %s\n"), srv->name);
+  sendto (srv->fd, packet, len, 0, (struct sockaddr *)&srv->addr, srv->addrlen);
+}
+
+/* Copies the NUL terminated string at *pos, FALSE if the packet ends first */
+static int
+game_string (const unsigned char *packet, size_t len, size_t *pos, char **out)
+{
+  const unsigned char *end;
+
+  if (*pos >= len || (end = memchr (packet + *pos, '\0', len - *pos)) == NULL)
+    return FALSE;
+  if (out)
+    *out = strdup ((const char *)packet + *pos);
+  *pos = end - packet + 1;
+  return TRUE;
+}
+
+/* The reply parsers return 1 for the answer, -1 when the query must be
+ * sent again and 0 for packets to ignore */
+static int
+a2s_reply (game_server *srv, unsigned char *packet, size_t len)
+{
+  size_t pos = 5;
+
+  if (packet[4] == 'A' && len >= 9) {
+    /* a challenge to send back with the query */
+    memcpy (srv->challenge, packet + 5, 4);
+    srv->has_challenge = TRUE;
+    return -1;
+  }
+  if (packet[4] == 'I') {
+    /* protocol, name, map, folder, game, appid, players, max players */
+    pos++;
+    if (!game_string (packet, len, &pos, &srv->title) ||
+        !game_string (packet, len, &pos, &srv->map) ||
+        !game_string (packet, len, &pos, NULL) ||
+        !game_string (packet, len, &pos, NULL) || pos + 4 > len)
+      return 0;
+    srv->players = packet[pos + 2];
+    srv->players_max = packet[pos + 3];
+    return 1;
+  }
+  if (packet[4] == 'm') {
+    /* GoldSrc: address, name, map, folder, game, players, max players */
+    if (!game_string (packet, len, &pos, NULL) ||
+        !game_string (packet, len, &pos, &srv->title) ||
+        !game_string (packet, len, &pos, &srv->map) ||
+        !game_string (packet, len, &pos, NULL) ||
+        !game_string (packet, len, &pos, NULL) || pos + 2 > len)
+      return 0;
+    srv->players = packet[pos];
+    srv->players_max = packet[pos + 1];
+    return 1;
+  }
+  return 0;
+}
+
+/* statusResponse, a line of \key\value pairs then a line per player */
+static int
+q3s_reply (game_server *srv, unsigned char *packet, size_t len)
+{
+  char *text, *line, *key, *value, *next;
+
+  if (len < 19 || memcmp (packet + 4, "statusResponse", 14) != 0)
+    return 0;
+  text = malloc (len + 1);
+  if (text == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+  memcpy (text, packet, len);
+  text[len] = '\0';
+
+  line = strchr (text, '\n');
+  if (line == NULL) {
+    free (text);
+    return 0;
+  }
+  line++;
+  next = strchr (line, '\n');
+  if (next != NULL)
+    *next++ = '\0';
+  for (key = strtok (line, "\\"); key != NULL; key = strtok (NULL, "\\")) {
+    if ((value = strtok (NULL, "\\")) == NULL)
+      break;
+    if (strcasecmp (key, "sv_hostname") == 0 || (srv->title == NULL && strcasecmp (key, "hostname") == 0))
+      srv->title = strdup (value);
+    else if (strcasecmp (key, "mapname") == 0)
+      srv->map = strdup (value);
+    else if (strcasecmp (key, "sv_maxclients") == 0)
+      srv->players_max = (int) np_strtoll (value, NULL);
+  }
+  for (line = next; line != NULL && *line != '\0'; line = next) {
+    if ((next = strchr (line, '\n')) != NULL)
+      next++;
+    srv->players++;
+  }
+  free (text);
+  return 1;
+}
+
+/* The server of a reply, by its source address */
+static int
+game_addr_cmp (const void *a, const void *b)
+{
+  const struct sockaddr_storage *x = &(*(game_server * const *)a)->addr;
+  const struct sockaddr_storage *y = &(*(game_server * const *)b)->addr;
+  const struct sockaddr_in *x4 = (const struct sockaddr_in *)x, *y4 = (const struct sockaddr_in *)y;
+  const struct sockaddr_in6 *x6 = (const struct sockaddr_in6 *)x, *y6 = (const struct sockaddr_in6 *)y;
+
+  if (x->ss_family != y->ss_family)
+    return x->ss_family < y->ss_family ? -1 : 1;
+  if (x->ss_family == AF_INET6) {
+    if (x6->sin6_port != y6->sin6_port)
+      return x6->sin6_port < y6->sin6_port ? -1 : 1;
+    return memcmp (&x6->sin6_addr, &y6->sin6_addr, sizeof (x6->sin6_addr));
+  }
+  if (x4->sin_port != y4->sin_port)
+    return x4->sin_port < y4->sin_port ? -1 : 1;
+  return memcmp (&x4->sin_addr, &y4->sin_addr, sizeof (x4->sin_addr));
+}
+
+static game_server *
+game_find (game_server **sorted, size_t count, struct sockaddr_storage *from, socklen_t fromlen)
+{
+  game_server key, *keyp = &key, **found;
+
+  memset (&key, 0, sizeof (key));
+  memcpy (&key.addr, from, fromlen);
+  found = bsearch (&keyp, sorted, count, sizeof (game_server *), game_addr_cmp);
+  if (found == NULL)
+    return NULL;
+  /* the same server may be given twice, take the first one still waiting */
+  while (found > sorted && game_addr_cmp (found - 1, &keyp) == 0)
+    found--;
+  while (found < sorted + count - 1 && (*found)->done && game_addr_cmp (found + 1, &keyp) == 0)
+    found++;
+  return *found;
+}
+
+/*
+ * Sends the query to all servers at once and collects the replies with a
+ * single poll loop, sending it again to the silent ones every second until
+ * the timeout
+ */
+int
+check_native (void)
+{
+  unsigned char packet[GAME_MAX_PACKET];
+  struct sockaddr_storage from;
+  socklen_t fromlen;
+  struct pollfd pfds[2];
+  game_server **sorted, *srv;
+  int fds[2] = { -1, -1 }, game = native_game (), result = STATE_OK;
+  int states[STATE_UNKNOWN + 1] = { 0 }, reply, first = TRUE;
+  size_t i, nsorted = 0, pending;
+  long left, wait;
+  ssize_t len;
+  char *label;
+  nfds_t nfds;
+
+  sorted = calloc (servers_count, sizeof (game_server *));
+  if (sorted == NULL)
+    die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+  for (i = 0; i < servers_count; i++) {
+    srv = &servers[i];
+    if ((srv->result = game_open (srv, game, fds)) != STATE_OK) {
+      srv->done = TRUE;
+      continue;
+    }
+    sorted[nsorted++] = srv;
+  }
+  qsort (sorted, nsorted, sizeof (game_server *), game_addr_cmp);
+  for (i = 0; i < nsorted; i++)
+    game_send (sorted[i], game);
+
+  nfds = 0;
+  for (i = 0; i < 2; i++) {
+    if (fds[i] < 0)
+      continue;
+    fcntl (fds[i], F_SETFL, O_NONBLOCK);
+    pfds[nfds].fd = fds[i];
+    pfds[nfds++].events = POLLIN;
+  }
+
+  for (;;) {
+    pending = 0;
+    wait = -1;
+    for (i = 0; i < nsorted; i++) {
+      srv = sorted[i];
+      if (srv->done)
+        continue;
+      if (deltime (srv->started) / 1000 >= (long) timeout_interval * 1000) {
+        srv->done = TRUE;
+        srv->result = STATE_CRITICAL;
+        xasprintf (&srv->message, _("Game server timeout"));
+        continue;
+      }
+      left = GAME_RESEND_INTERVAL - deltime (srv->sent) / 1000;
+      if (left <= 0) {
+        game_send (srv, game);
+        left = GAME_RESEND_INTERVAL;
+      }
+      if (wait < 0 || left < wait)
+        wait = left;
+      pending++;
+    }
+    if (pending == 0)
+      break;
+
+    if (poll (pfds, nfds, wait) < 0 && errno != EINTR)
+      die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+    for (i = 0; i < nfds; i++) {
+      if (!(pfds[i].revents & POLLIN))
+        continue;
+      for (;;) {
+        fromlen = sizeof (from);
+        len = recvfrom (pfds[i].fd, packet, sizeof (packet), 0, (struct sockaddr *)&from, &fromlen);
+        if (len < 0)
+          break;
+        if (len < 5 || memcmp (packet, "\xff\xff\xff\xff", 4) != 0)
+          continue;
+        if ((srv = game_find (sorted, nsorted, &from, fromlen)) == NULL || srv->done)
+          continue;
+        reply = game == GAME_A2S ? a2s_reply (srv, packet, len) : q3s_reply (srv, packet, len);
+        if (reply > 0) {
+          srv->ping = (double) deltime (srv->sent) / 1000.0;
+          srv->done = TRUE;
+          srv->result = STATE_OK;
+          if (srv->title == NULL)
+            srv->title = strdup ("");
+          if (srv->map == NULL)
+            srv->map = strdup ("");
+        }
+        else if (reply < 0) {
+          game_send (srv, game);
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < servers_count; i++) {
+    result = max_state (result, servers[i].result);
+    states[servers[i].result]++;
+  }
+
+  /* a single server is reported like the qstat mode does */
+  if (servers_count == 1) {
+    srv = &servers[0];
+    if (srv->result != STATE_OK) {
+      printf ("CRITICAL - %s\n", srv->message);
+      return result;
+    }
+    printf ("OK: %d/%d %s (%s), Ping: %.0f ms|%s %s\n",
+            srv->players, srv->players_max, srv->title, srv->map, srv->ping,
+            perfdata ("players", srv->players, "",
+                      FALSE, 0, FALSE, 0,
+                      TRUE, 0, TRUE, srv->players_max),
+            fperfdata ("ping", srv->ping, "",
+                      FALSE, 0, FALSE, 0,
+                      TRUE, 0, FALSE, 0));
+    return result;
+  }
+
+  printf (_("GAME %s - %lu servers: %d ok, %d warning, %d critical, %d unknown"),
+          state_text (result), (unsigned long) servers_count, states[STATE_OK],
+          states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+  printf ("|");
+  for (i = 0; i < servers_count; i++) {
+    srv = &servers[i];
+    if (srv->result != STATE_OK)
+      continue;
+    xasprintf (&label, "%s_players", srv->name);
+    printf ("%s%s", first ? "" : " ",
+            perfdata (label, srv->players, "", FALSE, 0, FALSE, 0,
+                      TRUE, 0, TRUE, srv->players_max));
+    xasprintf (&label, "%s_ping", srv->name);
+    printf (" %s", fperfdata (label, srv->ping, "", FALSE, 0, FALSE, 0,
+                              TRUE, 0, FALSE, 0));
+    first = FALSE;
+  }
+  putchar ('\n');
+  for (i = 0; i < servers_count; i++) {
+    srv = &servers[i];
+    if (srv->result != STATE_OK)
+      printf ("%s %s: %s\n", state_text (srv->result), srv->name, srv->message);
+    else
+      printf ("OK %s: %d/%d %s (%s), Ping: %.0f ms\n", srv->name, srv->players,
+              srv->players_max, srv->title, srv->map, srv->ping);
+  }
+
+  return result;
+}
+
+
 void
 print_help (void)
 {
@@ -311,6 +777,11 @@ print_help (void)
   printf ("    %s\n", _("Field number in raw qstat output that contains map name"));
   printf (" %s\n", "-pf");
   printf ("    %s\n", _("Field number in raw qstat output that contains ping time"));
+  printf (" %s\n", "--native");
+  printf ("    %s\n", _("Query the servers with the built-in engine instead of qstat, for the a2s"));
+  printf ("    %s\n", _("(Source) and q3s (Quake 3) game types. Several servers can be given, as"));
+  printf ("    %s\n", _("-H options or arguments, in the host[:port] form. They are all queried at"));
+  printf ("    %s\n", _("the same time and reported on separately"));
 
   printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
@@ -319,6 +790,12 @@ print_help (void)
   printf (" %s\n", _("This plugin uses the 'qstat' command, the popular game server status query tool."));
   printf (" %s\n", _("If you don't have the package installed, you will need to download it from"));
   printf (" %s\n", _("http://www.activesw.com/people/steve/qstat.html before you can use this plugin."));
+  printf (" %s\n", _("With --native, qstat is not needed."));
+
+  printf ("\n");
+  printf ("%s\n", _("Examples:"));
+  printf (" %s\n", "check_game --native a2s 192.0.2.10 192.0.2.11:27016 192.0.2.12:27017");
+  printf ("    %s\n", _("Queries three Source servers at once"));
 
   printf (UT_SUPPORT);
 }
@@ -330,6 +807,7 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
   printf (" %s [-hvV] [-P port] [-t timeout] [-g game_field] [-m map_field] [-p ping_field] [-G game-time] [-H hostname] <game> <ip_address>\n", progname);
+  printf (" %s --native [-hvV] [-P port] [-t timeout] <a2s|q3s> <host[:port]> [host[:port]...]\n", progname);
 }
 
 /******************************************************************************
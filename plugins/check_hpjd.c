@@ -37,6 +37,7 @@ const char *email = "devel@monitoring-plugins.org";
 #include "popen.h"
 #include "utils.h"
 #include "netutils.h"
+#include "snmputils.h"
 
 #define DEFAULT_COMMUNITY "public"
 #define DEFAULT_PORT "161"
@@ -59,44 +60,74 @@ const char *option_summary = "-H host [-C community]\n";
 #define ONLINE		0
 #define OFFLINE		1
 
+/* The status values, in the order they are requested */
+enum {
+	LINE_STATUS,
+	PAPER_STATUS,
+	INTERVENTION_REQUIRED,
+	PERIPHERAL_ERROR,
+	PAPER_JAM,
+	PAPER_OUT,
+	TONER_LOW,
+	PAGE_PUNT,				/* did data come too slow for engine */
+	MEMORY_OUT,				/* did we run out of memory */
+	DOOR_OPEN,
+	PAPER_OUTPUT,			/* is output tray full */
+	STATUS_DISPLAY,		/* display panel message */
+	HPJD_OIDS
+};
+
+char *hpjd_oids[HPJD_OIDS] = {
+	HPJD_LINE_STATUS ".0",
+	HPJD_PAPER_STATUS ".0",
+	HPJD_INTERVENTION_REQUIRED ".0",
+	HPJD_GD_PERIPHERAL_ERROR ".0",
+	HPJD_GD_PAPER_JAM ".0",
+	HPJD_GD_PAPER_OUT ".0",
+	HPJD_GD_TONER_LOW ".0",
+	HPJD_GD_PAGE_PUNT ".0",
+	HPJD_GD_MEMORY_OUT ".0",
+	HPJD_GD_DOOR_OPEN ".0",
+	HPJD_GD_PAPER_OUTPUT ".0",
+	HPJD_GD_STATUS_DISPLAY ".0"
+};
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
+#ifdef PATH_TO_SNMPGET
+int snmpget_fetch (int *);
+#endif
+#ifdef HAVE_NETSNMP
+int native_fetch (int *);
+#endif
 
 char *community = NULL;
 char *address = NULL;
 char *port = NULL;
 int  check_paper_out = 1;
+#if defined(HAVE_NETSNMP) && !defined(PATH_TO_SNMPGET)
+int use_native = TRUE;
+#else
+int use_native = FALSE;
+#endif
+
+int status[HPJD_OIDS];
+char display_message[MAX_INPUT_BUFFER];
+char *errmsg;
 
 int
 main (int argc, char **argv)
 {
-	char command_line[1024];
 	int result = STATE_UNKNOWN;
-	int line;
-	char input_buffer[MAX_INPUT_BUFFER];
-	char query_string[512];
-	char *errmsg;
-	char *temp_buffer;
-	int line_status = ONLINE;
-	int paper_status = 0;
-	int intervention_required = 0;
-	int peripheral_error = 0;
-	int paper_jam = 0;
-	int paper_out = 0;
-	int toner_low = 0;
-	int page_punt = 0;
-	int memory_out = 0;
-	int door_open = 0;
-	int paper_output = 0;
-	char display_message[MAX_INPUT_BUFFER];
+	int received = 0;
 
 	errmsg = malloc(MAX_INPUT_BUFFER);
+	errmsg[0] = '\0';
+	status[LINE_STATUS] = ONLINE;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -104,128 +135,17 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
-	/* removed ' 2>1' at end of command 10/27/1999 - EG */
-	/* create the query string */
-	sprintf
-		(query_string,
-		 "%s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0",
-		 HPJD_LINE_STATUS,
-		 HPJD_PAPER_STATUS,
-		 HPJD_INTERVENTION_REQUIRED,
-		 HPJD_GD_PERIPHERAL_ERROR,
-		 HPJD_GD_PAPER_JAM,
-		 HPJD_GD_PAPER_OUT,
-		 HPJD_GD_TONER_LOW,
-		 HPJD_GD_PAGE_PUNT,
-		 HPJD_GD_MEMORY_OUT,
-		 HPJD_GD_DOOR_OPEN, HPJD_GD_PAPER_OUTPUT, HPJD_GD_STATUS_DISPLAY);
-
-	/* get the command to run */
-	sprintf (command_line, "%s -OQa -m : -v 1 -c %s %s:%hd %s", PATH_TO_SNMPGET, community,
-									address, port, query_string);
-
-	/* run the command */
-	child_process = spopen (command_line);
-	if (child_process == NULL) {
-		printf (_("Could not open pipe: %s\n"), command_line);
-		return STATE_UNKNOWN;
-	}
-
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
-	if (child_stderr == NULL) {
-		printf (_("Could not open stderr for %s\n"), command_line);
-	}
-
-	result = STATE_OK;
-
-	line = 0;
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process)) {
-
-		/* strip the newline character from the end of the input */
-		if (input_buffer[strlen (input_buffer) - 1] == '\n')
-			input_buffer[strlen (input_buffer) - 1] = 0;
-
-		line++;
-
-		temp_buffer = strtok (input_buffer, "=");
-		temp_buffer = strtok (NULL, "=");
-
-		if (temp_buffer == NULL && line < 13) {
-
-				result = STATE_UNKNOWN;
-				strcpy (errmsg, input_buffer);
-
-		} else {
-
-			switch (line) {
-
-			case 1:										/* 1st line should contain the line status */
-				line_status = atoi (temp_buffer);
-				break;
-			case 2:										/* 2nd line should contain the paper status */
-				paper_status = atoi (temp_buffer);
-				break;
-			case 3:										/* 3rd line should be intervention required */
-				intervention_required = atoi (temp_buffer);
-				break;
-			case 4:										/* 4th line should be peripheral error */
-				peripheral_error = atoi (temp_buffer);
-				break;
-			case 5:										/* 5th line should contain the paper jam status */
-				paper_jam = atoi (temp_buffer);
-				break;
-			case 6:										/* 6th line should contain the paper out status */
-				paper_out = atoi (temp_buffer);
-				break;
-			case 7:										/* 7th line should contain the toner low status */
-				toner_low = atoi (temp_buffer);
-				break;
-			case 8:										/* did data come too slow for engine */
-				page_punt = atoi (temp_buffer);
-				break;
-			case 9:										/* did we run out of memory */
-				memory_out = atoi (temp_buffer);
-				break;
-			case 10:										/* is there a door open */
-				door_open = atoi (temp_buffer);
-				break;
-			case 11:										/* is output tray full */
-				paper_output = atoi (temp_buffer);
-				break;
-			case 12:										/* display panel message */
-				strcpy (display_message, temp_buffer + 1);
-				break;
-			default:										/* fold multiline message */
-				strncat (display_message, input_buffer,
-						sizeof (display_message) - strlen (display_message) - 1);
-			}
-
-		}
-
-		/* break out of the read loop if we encounter an error */
-		if (result != STATE_OK)
-			break;
-	}
-
-	/* WARNING if output found on stderr */
-	if (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_stderr)) {
-		result = max_state (result, STATE_WARNING);
-		/* remove CRLF */
-		if (input_buffer[strlen (input_buffer) - 1] == '\n')
-			input_buffer[strlen (input_buffer) - 1] = 0;
-		sprintf (errmsg, "%s", input_buffer );
-
-	}
-
-	/* close stderr */
-	(void) fclose (child_stderr);
-
-	/* close the pipe */
-	if (spclose (child_process))
-		result = max_state (result, STATE_WARNING);
+#ifdef HAVE_NETSNMP
+	if (use_native == TRUE)
+		result = native_fetch (&received);
+#endif
+#ifdef PATH_TO_SNMPGET
+	if (use_native == FALSE)
+		result = snmpget_fetch (&received);
+#endif
 
 	/* if there wasn't any output, display an error */
-	if (line == 0) {
+	if (received == 0) {
 
 		/* might not be the problem, but most likely is. */
 		result = STATE_UNKNOWN ;
@@ -236,50 +156,50 @@ main (int argc, char **argv)
 	/* if we had no read errors, check the printer status results... */
 	if (result == STATE_OK) {
 
-		if (paper_jam) {
+		if (status[PAPER_JAM]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("Paper Jam"));
 		}
-		else if (paper_out) {
+		else if (status[PAPER_OUT]) {
 			if (check_paper_out)
 				result = STATE_WARNING;
 			strcpy (errmsg, _("Out of Paper"));
 		}
-		else if (line_status == OFFLINE) {
+		else if (status[LINE_STATUS] == OFFLINE) {
 			if (strcmp (errmsg, "POWERSAVE ON") != 0) {
 				result = STATE_WARNING;
 				strcpy (errmsg, _("Printer Offline"));
 			}
 		}
-		else if (peripheral_error) {
+		else if (status[PERIPHERAL_ERROR]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("Peripheral Error"));
 		}
-		else if (intervention_required) {
+		else if (status[INTERVENTION_REQUIRED]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("Intervention Required"));
 		}
-		else if (toner_low) {
+		else if (status[TONER_LOW]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("Toner Low"));
 		}
-		else if (memory_out) {
+		else if (status[MEMORY_OUT]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("Insufficient Memory"));
 		}
-		else if (door_open) {
+		else if (status[DOOR_OPEN]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("A Door is Open"));
 		}
-		else if (paper_output) {
+		else if (status[PAPER_OUTPUT]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("Output Tray is Full"));
 		}
-		else if (page_punt) {
+		else if (status[PAGE_PUNT]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("Data too Slow for Engine"));
 		}
-		else if (paper_status) {
+		else if (status[PAPER_STATUS]) {
 			result = STATE_WARNING;
 			strcpy (errmsg, _("Unknown Paper Error"));
 		}
@@ -304,6 +224,151 @@ main (int argc, char **argv)
 }
 
 
+#ifdef PATH_TO_SNMPGET
+/* Run snmpget for all status OIDs and read what it printed; *received
+ * counts the lines */
+int
+snmpget_fetch (int *received)
+{
+	char *command_line = NULL;
+	char *query_string = NULL;
+	char input_buffer[MAX_INPUT_BUFFER];
+	char *temp_buffer;
+	int result;
+	int line;
+	int i;
+
+	/* removed ' 2>1' at end of command 10/27/1999 - EG */
+	/* create the query string */
+	for (i = 0; i < HPJD_OIDS; i++)
+		xasprintf (&query_string, "%s%s%s", query_string ? query_string : "",
+		           i ? " " : "", hpjd_oids[i]);
+
+	/* get the command to run */
+	xasprintf (&command_line, "%s -OQa -m : -v 1 -c %s %s:%s %s", PATH_TO_SNMPGET, community,
+	           address, port, query_string);
+
+	/* run the command */
+	child_process = spopen (command_line);
+	if (child_process == NULL) {
+		printf (_("Could not open pipe: %s\n"), command_line);
+		exit (STATE_UNKNOWN);
+	}
+
+	child_stderr = fdopen (spopen_stderr (child_process), "r");
+	if (child_stderr == NULL) {
+		printf (_("Could not open stderr for %s\n"), command_line);
+	}
+
+	result = STATE_OK;
+
+	line = 0;
+	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process)) {
+
+		/* strip the newline character from the end of the input */
+		if (input_buffer[strlen (input_buffer) - 1] == '\n')
+			input_buffer[strlen (input_buffer) - 1] = 0;
+
+		line++;
+
+		temp_buffer = strtok (input_buffer, "=");
+		temp_buffer = strtok (NULL, "=");
+
+		if (temp_buffer == NULL && line <= HPJD_OIDS) {
+
+				result = STATE_UNKNOWN;
+				strcpy (errmsg, input_buffer);
+
+		} else if (line - 1 < STATUS_DISPLAY) {
+			status[line - 1] = atoi (temp_buffer);
+		} else if (line - 1 == STATUS_DISPLAY) {
+			strcpy (display_message, temp_buffer + 1);
+		} else {
+			/* fold multiline message */
+			strncat (display_message, input_buffer,
+					sizeof (display_message) - strlen (display_message) - 1);
+		}
+
+		/* break out of the read loop if we encounter an error */
+		if (result != STATE_OK)
+			break;
+	}
+
+	/* WARNING if output found on stderr */
+	if (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_stderr)) {
+		result = max_state (result, STATE_WARNING);
+		/* remove CRLF */
+		if (input_buffer[strlen (input_buffer) - 1] == '\n')
+			input_buffer[strlen (input_buffer) - 1] = 0;
+		sprintf (errmsg, "%s", input_buffer );
+
+	}
+
+	/* close stderr */
+	(void) fclose (child_stderr);
+
+	/* close the pipe */
+	if (spclose (child_process))
+		result = max_state (result, STATE_WARNING);
+
+	*received = line;
+	return result;
+}
+#endif
+
+
+#ifdef HAVE_NETSNMP
+/* Fetch all status OIDs with one SNMPv1 GET through libnetsnmp, with the
+ * same defaults snmpget uses; *received counts the variables returned.
+ * snmpget's first line of error output becomes errmsg. */
+int
+native_fetch (int *received)
+{
+	netsnmp_session session;
+	netsnmp_pdu *response = NULL;
+	netsnmp_variable_list *vars;
+	char *peer = NULL;
+	char *errors = NULL;
+	int result = STATE_OK;
+	int i;
+
+	np_snmp_init (":");
+
+	snmp_sess_init (&session);
+	xasprintf (&peer, "%s:%s", address, port);
+	session.peername = peer;
+	session.version = SNMP_VERSION_1;
+	session.community = (u_char *) community;
+	session.community_len = strlen (community);
+
+	if (np_snmp_get (&session, SNMP_MSG_GET, hpjd_oids, HPJD_OIDS, &response, &errors) != 0) {
+		/* snmpget prints nothing on stdout then, only its diagnostics */
+		result = STATE_WARNING;
+		strncpy (errmsg, errors ? errors : "", MAX_INPUT_BUFFER - 1);
+		errmsg[MAX_INPUT_BUFFER - 1] = '\0';
+		errmsg[strcspn (errmsg, "\n")] = '\0';
+		*received = 0;
+	} else {
+		for (i = 0, vars = response->variables; vars; vars = vars->next_variable, i++) {
+			if (i < STATUS_DISPLAY && vars->type == ASN_INTEGER)
+				status[i] = *vars->val.integer;
+			else if (i == STATUS_DISPLAY && vars->type == ASN_OCTET_STR)
+				/* quoted, as snmpget -OQa prints it */
+				snprintf (display_message, sizeof (display_message), "\"%.*s\"",
+				          (int) vars->val_len, (char *) vars->val.string);
+		}
+		*received = i;
+	}
+
+	if (response)
+		snmp_free_pdu (response);
+	free (errors);
+	free (peer);
+	return result;
+}
+#endif
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -311,12 +376,16 @@ process_arguments (int argc, char **argv)
 	int c;
 
 	int option = 0;
+	enum {
+		NATIVE_OPTION = CHAR_MAX + 1
+	};
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
 		{"community", required_argument, 0, 'C'},
 /*  		{"critical",       required_argument,0,'c'}, */
 /*  		{"warning",        required_argument,0,'w'}, */
   		{"port", required_argument,0,'p'}, 
+		{"native", no_argument, 0, NATIVE_OPTION},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
@@ -348,10 +417,18 @@ process_arguments (int argc, char **argv)
 			if (!is_intpos(optarg))
 				usage2 (_("Port must be a positive short integer"), optarg);
 			else
-				port = atoi(optarg);
+				port = optarg;
+			break;
 		case 'D':									/* disable paper out check*/
 			check_paper_out = 0;
 			break;
+		case NATIVE_OPTION:
+#ifdef HAVE_NETSNMP
+			use_native = TRUE;
+#else
+			usage4 (_("check_hpjd was built without the Net-SNMP library"));
+#endif
+			break;
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
 			exit (STATE_UNKNOWN);
@@ -384,7 +461,7 @@ process_arguments (int argc, char **argv)
 		if (argv[c] != NULL )
 			port = argv[c];
 		else
-			port = atoi (DEFAULT_PORT);
+			port = strdup (DEFAULT_PORT);
 	}
 
 	return validate_arguments ();
@@ -426,6 +503,11 @@ print_help (void)
 	printf ("\n");
 	printf (" %s\n", "-D");
 	printf ("    %s", _("Disable paper check "));
+#ifdef HAVE_NETSNMP
+	printf ("\n");
+	printf (" %s\n", "--native");
+	printf ("    %s\n", _("Send the request through libnetsnmp instead of running snmpget"));
+#endif
 
 	printf (UT_SUPPORT);
 }
@@ -436,5 +518,5 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host [-C community] [-p port] [-D]\n", progname);
+	printf ("%s -H host [-C community] [-p port] [-D] [--native]\n", progname);
 }
@@ -41,6 +41,8 @@ const char *email = "devel@monitoring-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 #include "base64.h"
+#include "httputils.h"
+#include "utils_match.h"
 #include <ctype.h>
 
 #define STICKY_NONE 0
@@ -74,8 +76,8 @@ enum {
   REGS = 2,
   MAX_RE_SIZE = 256
 };
-#include "regex.h"
-regex_t preg;
+#include "utils_regex.h"
+np_regex_t preg;
 regmatch_t pmatch[REGS];
 char regexp[MAX_RE_SIZE];
 char errbuf[MAX_INPUT_BUFFER];
@@ -103,7 +105,9 @@ int server_url_length;
 int server_expect_yn = 0;
 char server_expect[MAX_INPUT_BUFFER] = HTTP_EXPECT;
 char header_expect[MAX_INPUT_BUFFER] = "";
-char string_expect[MAX_INPUT_BUFFER] = "";
+char **string_expect = NULL;
+int string_expect_count = 0;
+np_matcher *string_matcher = NULL;
 char output_header_search[30] = "";
 char output_string_search[30] = "";
 char *warning_thresholds = NULL;
@@ -120,12 +124,61 @@ int use_ssl = FALSE;
 int use_sni = FALSE;
 int verbose = FALSE;
 int show_extended_perfdata = FALSE;
+int ssl_session_cache = FALSE;
+int cert_cache_ttl = 0;
+int check_ocsp = FALSE;
 int show_body = FALSE;
 int sd;
 int min_page_len = 0;
 int max_page_len = 0;
 int redir_depth = 0;
 int max_depth = 15;
+/* the connection of a redirect response, kept open so that the redirect
+ * can be followed over it when it stays on the same server */
+int keep_sd = 0;
+char *keep_address = NULL;
+char *keep_host_name = NULL;
+int keep_port = 0;
+int keep_ssl = FALSE;
+double elapsed_time_redirect = 0.0;
+/* with --keepalive, every -u is a path of its own, checked one after the
+ * other over one connection. The options following a -u are its own, those
+ * before the first -u apply to all of them */
+typedef struct http_path {
+  char *url;
+  char server_expect[MAX_INPUT_BUFFER];
+  int server_expect_yn;
+  char header_expect[MAX_INPUT_BUFFER];
+  char **string_expect;
+  int string_expect_count;
+  np_matcher *string_matcher;
+  char regexp[MAX_RE_SIZE];
+  np_regex_t preg;
+  int invert_regex;
+  char *warning_thresholds;
+  char *critical_thresholds;
+  thresholds *thlds;
+  int min_page_len;
+  int max_page_len;
+  /* what check_http() found */
+  int result;
+  char *msg;
+  double elapsed_time;
+  double elapsed_time_firstbyte;
+  int page_len;
+} http_path;
+int keepalive = FALSE;
+int pipeline = FALSE;
+http_path *paths = NULL;
+int path_count = 0;
+http_path path_defaults;
+http_path *current_path = NULL;
+/* requests sent ahead on the kept connection with --pipeline, and what
+ * was read past the end of the last response */
+int pipelined = 0;
+char *pipeline_rest = NULL;
+size_t pipeline_rest_len = 0;
+int connects = 0;
 char *http_method;
 char *http_method_proxy;
 char *http_post_data;
@@ -136,6 +189,7 @@ char *client_privkey = NULL;
 
 int process_arguments (int, char **);
 int check_http (void);
+int check_http_paths (void);
 void redir (char *pos, char *status_line);
 int server_type_check(const char *type);
 int server_port_check(int ssl_flag);
@@ -145,6 +199,12 @@ char *perfd_time_ssl (double microsec);
 char *perfd_time_firstbyte (double microsec);
 char *perfd_time_headers (double microsec);
 char *perfd_time_transfer (double microsec);
+char *perfd_time_redirect (double microsec);
+char *perfd_time_redirect (double elapsed_time_redirect)
+{
+  return fperfdata ("time_redirect", elapsed_time_redirect, "s", FALSE, 0, FALSE, 0, FALSE, 0, TRUE, socket_timeout);
+}
+
 char *perfd_size (int page_len);
 void print_help (void);
 void print_usage (void);
@@ -154,9 +214,7 @@ main (int argc, char **argv)
 {
   int result = STATE_UNKNOWN;
 
-  setlocale (LC_ALL, "");
-  bindtextdomain (PACKAGE, LOCALEDIR);
-  textdomain (PACKAGE);
+  np_locale_init ();
 
   /* Set default URL. Must be malloced for subsequent realloc if --onredirect=follow */
   server_url = strdup(HTTP_URL);
@@ -170,16 +228,32 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  if (ssl_session_cache == TRUE || cert_cache_ttl > 0 || check_ocsp == TRUE)
+    np_init ((char *) progname, argc, argv);
+#ifdef HAVE_SSL
+  if (cert_cache_ttl > 0)
+    np_net_ssl_cert_cache (cert_cache_ttl);
+  if (check_ocsp == TRUE)
+    np_net_ssl_ocsp_stapling ();
+#endif
+
   if (display_html == TRUE)
     printf ("<A HREF=\"%s://%s:%d%s\" target=\"_blank\">",
       use_ssl ? "https" : "http", host_name ? host_name : server_address,
       server_port, server_url);
 
+  /* a kept connection may have been closed by the server, writing to it
+   * must not kill us */
+  if (onredirect == STATE_DEPENDENT || path_count > 1)
+    (void) signal (SIGPIPE, SIG_IGN);
+
   /* initialize alarm signal handling, set socket timeout, start timer */
   (void) signal (SIGALRM, socket_timeout_alarm_handler);
   (void) alarm (socket_timeout);
   gettimeofday (&tv, NULL);
 
+  if (path_count > 1)
+    return check_http_paths ();
   result = check_http ();
   return result;
 }
@@ -193,6 +267,73 @@ test_file (char *path)
   usage2 (_("file does not exist or is not readable"), path);
 }
 
+/* Keep the options of a path given with --keepalive */
+static void
+path_save (http_path *path)
+{
+  path->url = server_url;
+  memcpy (path->server_expect, server_expect, sizeof (server_expect));
+  path->server_expect_yn = server_expect_yn;
+  memcpy (path->header_expect, header_expect, sizeof (header_expect));
+  path->string_expect = string_expect;
+  path->string_expect_count = string_expect_count;
+  path->string_matcher = string_matcher;
+  memcpy (path->regexp, regexp, sizeof (regexp));
+  path->preg = preg;
+  path->invert_regex = invert_regex;
+  path->warning_thresholds = warning_thresholds;
+  path->critical_thresholds = critical_thresholds;
+  path->thlds = thlds;
+  path->min_page_len = min_page_len;
+  path->max_page_len = max_page_len;
+}
+
+/* and make them the ones check_http() goes by */
+static void
+path_load (const http_path *path)
+{
+  server_url = path->url;
+  server_url_length = strlen (server_url);
+  memcpy (server_expect, path->server_expect, sizeof (server_expect));
+  server_expect_yn = path->server_expect_yn;
+  memcpy (header_expect, path->header_expect, sizeof (header_expect));
+  /* a copy, since more -s may be added to it */
+  string_expect_count = path->string_expect_count;
+  string_expect = NULL;
+  if (string_expect_count) {
+    string_expect = malloc (sizeof (char *) * string_expect_count);
+    if (string_expect == NULL)
+      die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for string_expect\n"));
+    memcpy (string_expect, path->string_expect, sizeof (char *) * string_expect_count);
+  }
+  string_matcher = path->string_matcher;
+  memcpy (regexp, path->regexp, sizeof (regexp));
+  preg = path->preg;
+  invert_regex = path->invert_regex;
+  warning_thresholds = path->warning_thresholds;
+  critical_thresholds = path->critical_thresholds;
+  thlds = path->thlds;
+  min_page_len = path->min_page_len;
+  max_page_len = path->max_page_len;
+}
+
+/* A -u with --keepalive: the options so far belong to the path before, and
+ * the next one starts out from the defaults */
+static void
+path_next (void)
+{
+  if (path_count == 0)
+    path_save (&path_defaults);
+  else {
+    path_save (&paths[path_count - 1]);
+    path_load (&path_defaults);
+  }
+  paths = realloc (paths, sizeof (http_path) * (path_count + 1));
+  if (paths == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for the paths\n"));
+  memset (&paths[path_count++], 0, sizeof (http_path));
+}
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -203,7 +344,12 @@ process_arguments (int argc, char **argv)
 
   enum {
     INVERT_REGEX = CHAR_MAX + 1,
-    SNI_OPTION
+    SNI_OPTION,
+    SSL_SESSION_CACHE_OPTION,
+    CERT_CACHE_OPTION,
+    OCSP_OPTION,
+    KEEPALIVE_OPTION,
+    PIPELINE_OPTION
   };
 
   int option = 0;
@@ -213,6 +359,9 @@ process_arguments (int argc, char **argv)
     {"nohtml", no_argument, 0, 'n'},
     {"ssl", optional_argument, 0, 'S'},
     {"sni", no_argument, 0, SNI_OPTION},
+    {"ssl-session-cache", no_argument, 0, SSL_SESSION_CACHE_OPTION},
+    {"cert-cache", required_argument, 0, CERT_CACHE_OPTION},
+    {"ocsp", no_argument, 0, OCSP_OPTION},
     {"post", required_argument, 0, 'P'},
     {"method", required_argument, 0, 'j'},
     {"IP-address", required_argument, 0, 'I'},
@@ -242,6 +391,8 @@ process_arguments (int argc, char **argv)
     {"use-ipv6", no_argument, 0, '6'},
     {"extended-perfdata", no_argument, 0, 'E'},
     {"show-body", no_argument, 0, 'B'},
+    {"keepalive", no_argument, 0, KEEPALIVE_OPTION},
+    {"pipeline", no_argument, 0, PIPELINE_OPTION},
     {0, 0, 0, 0}
   };
 
@@ -259,6 +410,9 @@ process_arguments (int argc, char **argv)
       strcpy (argv[c], "-c");
     if (strcmp ("-nohtml", argv[c]) == 0)
       strcpy (argv[c], "-n");
+    /* the options of each -u are told apart while they are read */
+    if (strcmp ("--keepalive", argv[c]) == 0 || strcmp ("--pipeline", argv[c]) == 0)
+      keepalive = TRUE;
   }
 
   while (1) {
@@ -373,6 +527,32 @@ process_arguments (int argc, char **argv)
     case SNI_OPTION:
       use_sni = TRUE;
       break;
+    case SSL_SESSION_CACHE_OPTION:
+#ifdef HAVE_SSL
+      ssl_session_cache = TRUE;
+#else
+      usage4 (_("Invalid option - SSL is not available"));
+#endif
+      break;
+    case CERT_CACHE_OPTION:
+#ifdef HAVE_SSL
+      if (!is_intpos (optarg))
+        usage2 (_("Certificate cache time must be a positive integer"), optarg);
+      cert_cache_ttl = atoi (optarg);
+#else
+      usage4 (_("Invalid option - SSL is not available"));
+#endif
+      break;
+    case OCSP_OPTION:
+#ifdef HAVE_SSL
+      check_ocsp = TRUE;
+      use_ssl = TRUE;
+      if (specify_port == FALSE)
+        server_port = HTTPS_PORT;
+#else
+      usage4 (_("Invalid option - SSL is not available"));
+#endif
+      break;
     case 'f': /* onredirect */
       if (!strcmp (optarg, "stickyport"))
         onredirect = STATE_DEPENDENT, followsticky = STICKY_HOST|STICKY_PORT;
@@ -420,6 +600,8 @@ process_arguments (int argc, char **argv)
       server_address = strdup (optarg);
       break;
     case 'u': /* URL path */
+      if (keepalive)
+        path_next ();
       server_url = strdup (optarg);
       server_url_length = strlen (server_url);
       break;
@@ -460,9 +642,11 @@ process_arguments (int argc, char **argv)
       strncpy (header_expect, optarg, MAX_INPUT_BUFFER - 1);
       header_expect[MAX_INPUT_BUFFER - 1] = 0;
       break;
-    case 's': /* string or substring */
-      strncpy (string_expect, optarg, MAX_INPUT_BUFFER - 1);
-      string_expect[MAX_INPUT_BUFFER - 1] = 0;
+    case 's': /* string or substring, all of them have to be found */
+      string_expect = realloc (string_expect, sizeof (char *) * (++string_expect_count));
+      if (string_expect == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for string_expect\n"));
+      string_expect[string_expect_count - 1] = optarg;
       break;
     case 'e': /* string or substring */
       strncpy (server_expect, optarg, MAX_INPUT_BUFFER - 1);
@@ -480,9 +664,9 @@ process_arguments (int argc, char **argv)
     case 'r': /* regex */
       strncpy (regexp, optarg, MAX_RE_SIZE - 1);
       regexp[MAX_RE_SIZE - 1] = 0;
-      errcode = regcomp (&preg, regexp, cflags);
+      errcode = np_regcomp (&preg, regexp, cflags);
       if (errcode != 0) {
-        (void) regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+        (void) np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
         printf (_("Could Not Compile Regular Expression: %s"), errbuf);
         return ERROR;
       }
@@ -552,9 +736,19 @@ process_arguments (int argc, char **argv)
     case 'B': /* print body content after status line */
       show_body = TRUE;
       break;
+    case KEEPALIVE_OPTION:
+      keepalive = TRUE;
+      break;
+    case PIPELINE_OPTION:
+      keepalive = TRUE;
+      pipeline = TRUE;
+      break;
     }
   }
 
+  if (path_count > 0)
+    path_save (&paths[path_count - 1]);
+
   c = optind;
 
   if (server_address == NULL && c < argc)
@@ -570,11 +764,6 @@ process_arguments (int argc, char **argv)
       server_address = strdup (host_name);
   }
 
-  set_thresholds(&thlds, warning_thresholds, critical_thresholds);
-
-  if (critical_thresholds && thlds->critical->end>(double)socket_timeout)
-    socket_timeout = (int)thlds->critical->end + 1;
-
   if (http_method == NULL)
     http_method = strdup ("GET");
 
@@ -587,29 +776,104 @@ process_arguments (int argc, char **argv)
   if (virtual_port == 0)
     virtual_port = server_port;
 
+  if (path_count > 1) {
+    if (onredirect == STATE_DEPENDENT)
+      usage4 (_("-f follow, sticky and stickyport cannot be used with --keepalive"));
+    if (strcmp (http_method, "CONNECT") == 0)
+      usage4 (_("CONNECT cannot be used with --keepalive"));
+#ifdef HAVE_SSL
+    if (check_cert == TRUE)
+      usage4 (_("Certificate checks (-C) cannot be used with --keepalive"));
+#endif
+    if (pipeline && no_body)
+      usage4 (_("-N cannot be used with --pipeline"));
+  }
+
+  /* with several paths, each of them gets its own, the last one's are set
+   * up last */
+  for (c = 0; c < (path_count > 1 ? path_count : 1); c++) {
+    if (path_count > 1)
+      path_load (&paths[c]);
+
+    set_thresholds(&thlds, warning_thresholds, critical_thresholds);
+
+    if (critical_thresholds && thlds->critical->end>(double)socket_timeout)
+      socket_timeout = (int)thlds->critical->end + 1;
+
+    /* all the -s strings are looked for in one pass over the page */
+    if (string_expect_count) {
+      string_matcher = np_matcher_new (string_expect, string_expect_count);
+      if (string_matcher == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for string_matcher\n"));
+    }
+
+    if (path_count > 1)
+      path_save (&paths[c]);
+  }
+
   return TRUE;
 }
 
 
 
-/* Returns 1 if we're done processing the document body; 0 to keep going */
+/* Returns 1 if we're done processing the document body; 0 to keep going.
+ * *scanned is where the search resumes on the next call, so the headers
+ * are only looked at once however many reads they come in */
 static int
-document_headers_done (char *full_page)
+document_headers_done (char *full_page, size_t length, size_t *scanned)
 {
   const char *body;
 
-  for (body = full_page; *body; body++) {
+  for (body = full_page + *scanned; *body; body++) {
     if (!strncmp (body, "\n\n", 2) || !strncmp (body, "\n\r\n", 3))
       break;
   }
 
-  if (!*body)
+  if (!*body) {
+    /* the end of headers may be split over this read and the next one */
+    *scanned = length > 2 ? length - 2 : 0;
     return 0;  /* haven't read end of headers yet */
+  }
 
   full_page[body - full_page] = 0;
   return 1;
 }
 
+/* How the end of the body is found: by default it is read until the
+ * server closes the connection */
+enum {
+  BODY_UNTIL_CLOSE,
+  BODY_LENGTH,
+  BODY_CHUNKED
+};
+
+/* Returns how the body of a response to method ends, with BODY_LENGTH
+ * its length goes to *length */
+static int
+body_framing (const http_response *response, const char *method, size_t *length)
+{
+  const char *value;
+  size_t len;
+
+  /* no body follows these, whatever the headers say */
+  if (!strcmp (method, "HEAD") || response->http_code == 204 || response->http_code == 304) {
+    *length = 0;
+    return BODY_LENGTH;
+  }
+
+  /* chunked has to be the last coding, and overrides Content-Length */
+  value = http_header_find (response, "transfer-encoding", &len);
+  if (value && len >= 7 && !strncasecmp (value + len - 7, "chunked", 7))
+    return BODY_CHUNKED;
+
+  value = http_header_find (response, "content-length", &len);
+  if (value && isdigit (*value)) {
+    *length = strtoul (value, NULL, 10);
+    return BODY_LENGTH;
+  }
+  return BODY_UNTIL_CLOSE;
+}
+
 static time_t
 parse_time_string (const char *string)
 {
@@ -722,64 +986,16 @@ expected_statuscode (const char *reply, const char *statuscodes)
 }
 
 static int
-check_document_dates (const char *headers, char **msg)
+check_document_dates (const http_response *headers, char **msg)
 {
-  const char *s;
-  char *server_date = 0;
-  char *document_date = 0;
+  char *server_date;
+  char *document_date;
   int date_result = STATE_OK;
 
-  s = headers;
-  while (*s) {
-    const char *field = s;
-    const char *value = 0;
-
-    /* Find the end of the header field */
-    while (*s && !isspace(*s) && *s != ':')
-      s++;
-
-    /* Remember the header value, if any. */
-    if (*s == ':')
-      value = ++s;
-
-    /* Skip to the end of the header, including continuation lines. */
-    while (*s && !(*s == '\n' && (s[1] != ' ' && s[1] != '\t')))
-      s++;
-
-    /* Avoid stepping over end-of-string marker */
-    if (*s)
-      s++;
-
-    /* Process this header. */
-    if (value && value > field+2) {
-      char *ff = (char *) malloc (value-field);
-      char *ss = ff;
-      while (field < value-1)
-        *ss++ = tolower(*field++);
-      *ss++ = 0;
-
-      if (!strcmp (ff, "date") || !strcmp (ff, "last-modified")) {
-        const char *e;
-        while (*value && isspace (*value))
-          value++;
-        for (e = value; *e && *e != '\r' && *e != '\n'; e++)
-          ;
-        ss = (char *) malloc (e - value + 1);
-        strncpy (ss, value, e - value);
-        ss[e - value] = 0;
-        if (!strcmp (ff, "date")) {
-          if (server_date) free (server_date);
-          server_date = ss;
-        } else {
-          if (document_date) free (document_date);
-          document_date = ss;
-        }
-      }
-      free (ff);
-    }
-  }
+  server_date = http_header_value (headers, "date");
+  document_date = http_header_value (headers, "last-modified");
 
-  /* Done parsing the body.  Now check the dates we (hopefully) parsed.  */
+  /* Now check the dates we (hopefully) found.  */
   if (!server_date || !*server_date) {
     xasprintf (msg, _("%sServer date unknown, "), *msg);
     date_result = max_state_alt(STATE_UNKNOWN, date_result);
@@ -816,55 +1032,15 @@ check_document_dates (const char *headers, char **msg)
 }
 
 int
-get_content_length (const char *headers)
+get_content_length (const http_response *headers)
 {
-  const char *s;
+  const char *value;
+  size_t len;
   int content_length = 0;
 
-  s = headers;
-  while (*s) {
-    const char *field = s;
-    const char *value = 0;
-
-    /* Find the end of the header field */
-    while (*s && !isspace(*s) && *s != ':')
-      s++;
-
-    /* Remember the header value, if any. */
-    if (*s == ':')
-      value = ++s;
-
-    /* Skip to the end of the header, including continuation lines. */
-    while (*s && !(*s == '\n' && (s[1] != ' ' && s[1] != '\t')))
-      s++;
-
-    /* Avoid stepping over end-of-string marker */
-    if (*s)
-      s++;
-
-    /* Process this header. */
-    if (value && value > field+2) {
-      char *ff = (char *) malloc (value-field);
-      char *ss = ff;
-      while (field < value-1)
-        *ss++ = tolower(*field++);
-      *ss++ = 0;
-
-      if (!strcmp (ff, "content-length")) {
-        const char *e;
-        while (*value && isspace (*value))
-          value++;
-        for (e = value; *e && *e != '\r' && *e != '\n'; e++)
-          ;
-        ss = (char *) malloc (e - value + 1);
-        strncpy (ss, value, e - value);
-        ss[e - value] = 0;
-        content_length = atoi(ss);
-        free (ss);
-      }
-      free (ff);
-    }
-  }
+  value = http_header_find (headers, "content-length", &len);
+  if (value)
+    content_length = atoi (value);
   return (content_length);
 }
 
@@ -884,6 +1060,195 @@ prepend_slash (char *path)
   return newpath;
 }
 
+/* Returns TRUE if the connection kept by a redirect goes to the server
+ * of this request, otherwise closes it */
+static int
+reuse_connection (void)
+{
+  int reuse;
+
+  if (!keep_sd)
+    return FALSE;
+  reuse = keep_port == server_port && keep_ssl == use_ssl &&
+    !strcmp (keep_address, server_address) &&
+    /* the TLS session was set up for the name sent with SNI */
+    (!use_ssl || (host_name && keep_host_name && !strcmp (keep_host_name, host_name)));
+  if (reuse)
+    sd = keep_sd;
+  else {
+    close (keep_sd);
+#ifdef HAVE_SSL
+    if (keep_ssl)
+      np_net_ssl_cleanup();
+#endif
+  }
+  keep_sd = 0;
+  free (keep_address);
+  free (keep_host_name);
+  keep_address = keep_host_name = NULL;
+  return reuse;
+}
+
+/* TRUE while check_http() is on one of the paths of --keepalive that
+ * another one follows */
+static int
+more_paths (void)
+{
+  return current_path != NULL && current_path < paths + path_count - 1;
+}
+
+/* Keeps the connection for following a redirect over it, or for the next
+ * path, if the server lets it stay open and all of the response has been
+ * read */
+static int
+keep_connection (const http_response *response, int body_complete)
+{
+  const char *value;
+  size_t len;
+
+  if (!body_complete || response->http_minor < 1)
+    return FALSE;
+  if (!more_paths () && (onredirect != STATE_DEPENDENT ||
+      response->http_code < 300 || response->http_code >= 400))
+    return FALSE;
+  value = http_header_find (response, "connection", &len);
+  if (value && len == 5 && !strncasecmp (value, "close", 5))
+    return FALSE;
+
+  keep_sd = sd;
+  keep_address = strdup (server_address);
+  keep_host_name = host_name ? strdup (host_name) : NULL;
+  keep_port = server_port;
+  keep_ssl = use_ssl;
+  return TRUE;
+}
+
+/* The request for server_url, request_method is set to the method it uses */
+static char *
+http_request (const char **request_method)
+{
+  char *buf;
+  char *auth;
+  char *force_host_header = NULL;
+  int i;
+
+  if ( server_address != NULL && strcmp(http_method, "CONNECT") == 0
+       && host_name != NULL && use_ssl == TRUE) {
+    *request_method = http_method_proxy;
+    asprintf (&buf, "%s %s %s\r\n%s\r\n", http_method_proxy, server_url, host_name ? "HTTP/1.1" : "HTTP/1.0", user_agent);
+  } else
+    asprintf (&buf, "%s %s %s\r\n%s\r\n", http_method, server_url, host_name ? "HTTP/1.1" : "HTTP/1.0", user_agent);
+
+  /* tell HTTP/1.1 servers not to keep the connection alive, unless a
+   * redirect may be followed over it or another path comes after this one.
+   * The end of the body is found from the headers then */
+  if ((onredirect != STATE_DEPENDENT && !more_paths ()) || strcmp (http_method, "CONNECT") == 0)
+    xasprintf (&buf, "%sConnection: close\r\n", buf);
+
+  /* check if Host header is explicitly set in options */
+  if (http_opt_headers_count) {
+    for (i = 0; i < http_opt_headers_count ; i++) {
+      if (strncmp(http_opt_headers[i], "Host:", 5) == 0) {
+        force_host_header = http_opt_headers[i];
+      }
+    }
+  }
+
+  /* optionally send the host header info */
+  if (host_name) {
+    if (force_host_header) {
+      xasprintf (&buf, "%s%s\r\n", buf, force_host_header);
+    }
+    else {
+      /*
+       * Specify the port only if we're using a non-default port (see RFC 2616,
+       * 14.23).  Some server applications/configurations cause trouble if the
+       * (default) port is explicitly specified in the "Host:" header line.
+       */
+      if ((use_ssl == FALSE && virtual_port == HTTP_PORT) ||
+          (use_ssl == TRUE && virtual_port == HTTPS_PORT) ||
+          (server_address != NULL && strcmp(http_method, "CONNECT") == 0
+         && host_name != NULL && use_ssl == TRUE))
+        xasprintf (&buf, "%sHost: %s\r\n", buf, host_name);
+      else
+        xasprintf (&buf, "%sHost: %s:%d\r\n", buf, host_name, virtual_port);
+    }
+  }
+
+  /* optionally send any other header tag */
+  if (http_opt_headers_count) {
+    for (i = 0; i < http_opt_headers_count ; i++) {
+      if (force_host_header != http_opt_headers[i]) {
+        xasprintf (&buf, "%s%s\r\n", buf, http_opt_headers[i]);
+      }
+    }
+    /* This cannot be free'd here because a redirection will then try to access this and segfault */
+    /* Covered in a testcase in tests/check_http.t */
+    /* free(http_opt_headers); */
+  }
+
+  /* optionally send the authentication info */
+  if (strlen(user_auth)) {
+    base64_encode_alloc (user_auth, strlen (user_auth), &auth);
+    xasprintf (&buf, "%sAuthorization: Basic %s\r\n", buf, auth);
+  }
+
+  /* optionally send the proxy authentication info */
+  if (strlen(proxy_auth)) {
+    base64_encode_alloc (proxy_auth, strlen (proxy_auth), &auth);
+    xasprintf (&buf, "%sProxy-Authorization: Basic %s\r\n", buf, auth);
+  }
+
+  /* either send http POST data (any data, not only POST)*/
+  if (http_post_data) {
+    if (http_content_type) {
+      xasprintf (&buf, "%sContent-Type: %s\r\n", buf, http_content_type);
+    } else {
+      xasprintf (&buf, "%sContent-Type: application/x-www-form-urlencoded\r\n", buf);
+    }
+
+    xasprintf (&buf, "%sContent-Length: %i\r\n\r\n", buf, (int)strlen (http_post_data));
+    xasprintf (&buf, "%s%s%s", buf, http_post_data, CRLF);
+  }
+  else {
+    /* or just a newline so the server knows we're done with the request */
+    xasprintf (&buf, "%s%s", buf, CRLF);
+  }
+
+  return buf;
+}
+
+/* Reads what came after the last response with --pipeline first, then
+ * from the connection */
+static int
+http_recv (char *buf, size_t len)
+{
+  if (pipeline_rest_len == 0)
+    return my_recv (buf, len);
+  if (len > pipeline_rest_len)
+    len = pipeline_rest_len;
+  memcpy (buf, pipeline_rest, len);
+  memmove (pipeline_rest, pipeline_rest + len, pipeline_rest_len - len);
+  pipeline_rest_len -= len;
+  return len;
+}
+
+/* Keeps what was read past the end of a response, the start of the next
+ * one when the requests were pipelined */
+static void
+pipeline_keep (const char *rest, size_t len)
+{
+  if (pipelined == 0 || len == 0)
+    return;
+  pipeline_rest = realloc (pipeline_rest, pipeline_rest_len + len);
+  if (pipeline_rest == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for the pipeline\n"));
+  /* ahead of what is left of an earlier read */
+  memmove (pipeline_rest + len, pipeline_rest, pipeline_rest_len);
+  memcpy (pipeline_rest, rest, len);
+  pipeline_rest_len += len;
+}
+
 int
 check_http (void)
 {
@@ -897,7 +1262,16 @@ check_http (void)
   int i = 0;
   size_t pagesize = 0;
   char *full_page;
-  char *full_page_new;
+  size_t full_page_size;
+  size_t headers_scanned = 0;
+  http_response response;
+  int framing = BODY_UNTIL_CLOSE;
+  size_t body_length = 0;
+  size_t decoded = 0;
+  struct phr_chunked_decoder decoder;
+  int body_complete = FALSE;
+  int connection_reused;
+  const char *request_method = http_method;
   char *buf;
   char *pos;
   long microsec = 0L;
@@ -912,15 +1286,27 @@ check_http (void)
   double elapsed_time_headers = 0.0;
   long microsec_transfer = 0L;
   double elapsed_time_transfer = 0.0;
+  char *timing;
   int page_len = 0;
   int result = STATE_OK;
   char *force_host_header = NULL;
 
-  /* try to connect to the host at the given port number */
-  gettimeofday (&tv_temp, NULL);
-  if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
-    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
-  microsec_connect = deltime (tv_temp);
+  /* the time spent on the redirects before this request */
+  if (redir_depth > 0)
+    elapsed_time_redirect = (double)deltime (tv) / 1.0e6;
+
+  /* try to connect to the host at the given port number, unless the
+   * redirect to here came over a connection to it */
+  connection_reused = reuse_connection ();
+  if (connection_reused) {
+    if (verbose) printf (_("Reusing the connection to %s:%d\n"), server_address, server_port);
+  } else {
+    gettimeofday (&tv_temp, NULL);
+    if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+      die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
+    microsec_connect = deltime (tv_temp);
+    connects++;
+  }
 
     /* if we are called with the -I option, the -j method is CONNECT and */
     /* we received -S for SSL, then we tunnel the request through a proxy*/
@@ -961,7 +1347,9 @@ check_http (void)
   }
 #ifdef HAVE_SSL
   elapsed_time_connect = (double)microsec_connect / 1.0e6;
-  if (use_ssl == TRUE) {
+  if (use_ssl == TRUE && !connection_reused) {
+    if (ssl_session_cache == TRUE)
+      np_net_ssl_session_cache (server_address, server_port, (use_sni ? host_name : NULL));
     gettimeofday (&tv_temp, NULL);
     result = np_net_ssl_init_with_hostname_version_and_cert(sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey);
     if (verbose) printf ("SSL initialized\n");
@@ -969,6 +1357,14 @@ check_http (void)
       die (STATE_CRITICAL, NULL);
     microsec_ssl = deltime (tv_temp);
     elapsed_time_ssl = (double)microsec_ssl / 1.0e6;
+    if (check_ocsp == TRUE) {
+      char *ocsp_message = NULL;
+      result = np_net_ssl_check_ocsp (&ocsp_message);
+      if (verbose) printf ("%s\n", ocsp_message);
+      if (result != STATE_OK)
+        die (result, "HTTP %s - %s\n", state_text (result), ocsp_message);
+      free (ocsp_message);
+    }
     if (check_cert == TRUE) {
       result = np_net_ssl_check_cert(days_till_exp_warn, days_till_exp_crit);
       if (sd) close(sd);
@@ -978,96 +1374,39 @@ check_http (void)
   }
 #endif /* HAVE_SSL */
 
-  if ( server_address != NULL && strcmp(http_method, "CONNECT") == 0
-       && host_name != NULL && use_ssl == TRUE)
-    asprintf (&buf, "%s %s %s\r\n%s\r\n", http_method_proxy, server_url, host_name ? "HTTP/1.1" : "HTTP/1.0", user_agent);
-  else
-    asprintf (&buf, "%s %s %s\r\n%s\r\n", http_method, server_url, host_name ? "HTTP/1.1" : "HTTP/1.0", user_agent);
-
-  /* tell HTTP/1.1 servers not to keep the connection alive */
-  xasprintf (&buf, "%sConnection: close\r\n", buf);
-
-  /* check if Host header is explicitly set in options */
-  if (http_opt_headers_count) {
-    for (i = 0; i < http_opt_headers_count ; i++) {
-      if (strncmp(http_opt_headers[i], "Host:", 5) == 0) {
-        force_host_header = http_opt_headers[i];
-      }
-    }
-  }
-
-  /* optionally send the host header info */
-  if (host_name) {
-    if (force_host_header) {
-      xasprintf (&buf, "%s%s\r\n", buf, force_host_header);
-    }
-    else {
-      /*
-       * Specify the port only if we're using a non-default port (see RFC 2616,
-       * 14.23).  Some server applications/configurations cause trouble if the
-       * (default) port is explicitly specified in the "Host:" header line.
-       */
-      if ((use_ssl == FALSE && virtual_port == HTTP_PORT) ||
-          (use_ssl == TRUE && virtual_port == HTTPS_PORT) ||
-          (server_address != NULL && strcmp(http_method, "CONNECT") == 0
-         && host_name != NULL && use_ssl == TRUE))
-        xasprintf (&buf, "%sHost: %s\r\n", buf, host_name);
-      else
-        xasprintf (&buf, "%sHost: %s:%d\r\n", buf, host_name, virtual_port);
-    }
-  }
-
-  /* optionally send any other header tag */
-  if (http_opt_headers_count) {
-    for (i = 0; i < http_opt_headers_count ; i++) {
-      if (force_host_header != http_opt_headers[i]) {
-        xasprintf (&buf, "%s%s\r\n", buf, http_opt_headers[i]);
-      }
-    }
-    /* This cannot be free'd here because a redirection will then try to access this and segfault */
-    /* Covered in a testcase in tests/check_http.t */
-    /* free(http_opt_headers); */
-  }
-
-  /* optionally send the authentication info */
-  if (strlen(user_auth)) {
-    base64_encode_alloc (user_auth, strlen (user_auth), &auth);
-    xasprintf (&buf, "%sAuthorization: Basic %s\r\n", buf, auth);
-  }
-
-  /* optionally send the proxy authentication info */
-  if (strlen(proxy_auth)) {
-    base64_encode_alloc (proxy_auth, strlen (proxy_auth), &auth);
-    xasprintf (&buf, "%sProxy-Authorization: Basic %s\r\n", buf, auth);
-  }
-
-  /* either send http POST data (any data, not only POST)*/
-  if (http_post_data) {
-    if (http_content_type) {
-      xasprintf (&buf, "%sContent-Type: %s\r\n", buf, http_content_type);
-    } else {
-      xasprintf (&buf, "%sContent-Type: application/x-www-form-urlencoded\r\n", buf);
-    }
-
-    xasprintf (&buf, "%sContent-Length: %i\r\n\r\n", buf, (int)strlen (http_post_data));
-    xasprintf (&buf, "%s%s%s", buf, http_post_data, CRLF);
-  }
+  /* with --pipeline, the request may have gone out with those of the
+   * other paths already */
+  if (connection_reused && pipelined > 0)
+    pipelined--;
   else {
-    /* or just a newline so the server knows we're done with the request */
-    xasprintf (&buf, "%s%s", buf, CRLF);
+    pipelined = 0;
+    buf = http_request (&request_method);
+    if (verbose) printf ("%s\n", buf);
+    gettimeofday (&tv_temp, NULL);
+    np_span_begin ("request");
+    my_send (buf, strlen (buf));
+    np_span_end ();
+    microsec_headers = deltime (tv_temp);
+    elapsed_time_headers = (double)microsec_headers / 1.0e6;
   }
 
-  if (verbose) printf ("%s\n", buf);
-  gettimeofday (&tv_temp, NULL);
-  my_send (buf, strlen (buf));
-  microsec_headers = deltime (tv_temp);
-  elapsed_time_headers = (double)microsec_headers / 1.0e6;
-
   /* fetch the page */
-  full_page = strdup("");
+  full_page_size = MAX_INPUT_BUFFER;
+  full_page = malloc (full_page_size);
+  if (full_page == NULL)
+    die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for full_page\n"));
+  full_page[0] = '\0';
+  http_response_init (&response);
+  memset (&decoder, 0, sizeof (decoder));
+  /* the next response starts right after the trailer */
+  decoder.consume_trailer = pipelined > 0;
   gettimeofday (&tv_temp, NULL);
-  while ((i = my_recv (buffer, MAX_INPUT_BUFFER-1)) > 0) {
+  np_span_begin ("response");
+  np_span_begin ("firstbyte");
+  while ((i = http_recv (buffer, MAX_INPUT_BUFFER-1)) > 0) {
     if ((i >= 1) && (elapsed_time_firstbyte <= 0.000001)) {
+      np_span_end ();
+      np_span_begin ("transfer");
       microsec_firstbyte = deltime (tv_temp);
       elapsed_time_firstbyte = (double)microsec_firstbyte / 1.0e6;
     }
@@ -1075,20 +1414,95 @@ check_http (void)
       /* replace nul character with a blank */
       *pos = ' ';
     }
-    buffer[i] = '\0';
-    xasprintf (&full_page_new, "%s%s", full_page, buffer);
-    free (full_page);
-    full_page = full_page_new;
+    /* grow geometrically, so that assembling the page stays linear */
+    if (pagesize + i >= full_page_size) {
+      while (pagesize + i >= full_page_size)
+        full_page_size *= 2;
+      full_page = realloc (full_page, full_page_size);
+      if (full_page == NULL)
+        die (STATE_UNKNOWN, _("HTTP UNKNOWN - Could not allocate memory for full_page\n"));
+    }
+    memcpy (full_page + pagesize, buffer, i);
     pagesize += i;
+    full_page[pagesize] = '\0';
 
-                if (no_body && document_headers_done (full_page)) {
-                  i = 0;
-                  break;
-                }
+    if (response.length == HTTP_RESPONSE_PARTIAL) {
+      http_response_parse (&response, full_page, pagesize);
+      if (response.length > 0) {
+        framing = body_framing (&response, request_method, &body_length);
+        decoded = response.length;
+      }
+    }
+
+    /* with -N, stop as soon as the headers are complete */
+    if (no_body) {
+      if (response.length > 0) {
+        full_page[response.length] = '\0';
+        i = 0;
+        break;
+      }
+      /* not a response picohttpparser understands, look for the blank line */
+      if (response.length == HTTP_RESPONSE_INVALID &&
+          document_headers_done (full_page, pagesize, &headers_scanned)) {
+        i = 0;
+        break;
+      }
+      continue;
+    }
+
+    /* otherwise stop once the body the headers announced is complete, the
+     * server may keep the connection open after it */
+    if (framing == BODY_CHUNKED) {
+      size_t size = pagesize - decoded;
+      ssize_t rc = phr_decode_chunked (&decoder, full_page + decoded, &size);
+      if (rc == -1)
+        die (STATE_CRITICAL, _("HTTP CRITICAL - Invalid chunked transfer encoding\n"));
+      /* the chunks are decoded in place, so the page only holds the data */
+      pagesize = decoded + size;
+      decoded = pagesize;
+      if (rc > 0)
+        pipeline_keep (full_page + pagesize, rc);
+      full_page[pagesize] = '\0';
+      if (rc >= 0) {
+        body_complete = TRUE;
+        i = 0;
+        break;
+      }
+    } else if (framing == BODY_LENGTH && pagesize >= response.length + body_length) {
+      pipeline_keep (full_page + response.length + body_length,
+                     pagesize - (response.length + body_length));
+      pagesize = response.length + body_length;
+      full_page[pagesize] = '\0';
+      body_complete = TRUE;
+      i = 0;
+      break;
+    }
+
+    /* past the maximum of -m the page is too large anyway */
+    if (max_page_len > 0 && pagesize > (size_t) max_page_len) {
+      i = 0;
+      break;
+    }
   }
+  np_span_end ();
+  np_span_end ();
   microsec_transfer = deltime (tv_temp);
   elapsed_time_transfer = (double)microsec_transfer / 1.0e6;
 
+  /* the server may have closed the kept connection meanwhile */
+  if (connection_reused && pagesize == (size_t) 0) {
+    if (verbose) printf (_("Kept connection closed by the server, connecting again\n"));
+    /* and the requests pipelined over it are lost */
+    pipelined = 0;
+    pipeline_rest_len = 0;
+    if (sd) close(sd);
+#ifdef HAVE_SSL
+    np_net_ssl_cleanup();
+#endif
+    free (full_page);
+    return check_http ();
+  }
+
   if (i < 0 && errno != ECONNRESET) {
 #ifdef HAVE_SSL
     /*
@@ -1115,16 +1529,24 @@ check_http (void)
   if (pagesize == (size_t) 0)
     die (STATE_CRITICAL, _("HTTP CRITICAL - No data received from host\n"));
 
-  /* close the connection */
-  if (sd) close(sd);
+  /* close the connection, or keep it for a redirect or the next path */
+  if (!keep_connection (&response, body_complete)) {
+    pipelined = 0;
+    pipeline_rest_len = 0;
+    if (sd) close(sd);
 #ifdef HAVE_SSL
-  np_net_ssl_cleanup();
+    np_net_ssl_cleanup();
 #endif
+  }
 
   /* Save check time */
   microsec = deltime (tv);
   elapsed_time = (double)microsec / 1.0e6;
 
+  /* parse the headers once, full_page may have moved since the last time */
+  np_span_begin ("parse");
+  http_response_parse (&response, full_page, pagesize);
+
   /* leave full_page untouched so we can free it later */
   page = full_page;
 
@@ -1188,11 +1610,15 @@ check_http (void)
     /* HTTP-Version   = "HTTP" "/" 1*DIGIT "." 1*DIGIT */
     /* Status-Code = 3 DIGITS */
 
-    status_code = strchr (status_line, ' ') + sizeof (char);
-    if (strspn (status_code, "1234567890") != 3)
-      die (STATE_CRITICAL, _("HTTP CRITICAL: Invalid Status Line (%s)\n"), status_line);
+    if (response.length > 0)
+      http_status = response.http_code;
+    else {
+      status_code = strchr (status_line, ' ') + sizeof (char);
+      if (strspn (status_code, "1234567890") != 3)
+        die (STATE_CRITICAL, _("HTTP CRITICAL: Invalid Status Line (%s)\n"), status_line);
 
-    http_status = atoi (status_code);
+      http_status = atoi (status_code);
+    }
 
     /* check the return code */
 
@@ -1229,7 +1655,7 @@ check_http (void)
   alarm (0);
 
   if (maximum_age >= 0) {
-    result = max_state_alt(check_document_dates(header, &msg), result);
+    result = max_state_alt(check_document_dates(&response, &msg), result);
   }
 
   /* Page and Header content checks go here */
@@ -1245,19 +1671,31 @@ check_http (void)
   }
 
 
-  if (strlen (string_expect)) {
-    if (!strstr (page, string_expect)) {
-      strncpy(&output_string_search[0],string_expect,sizeof(output_string_search));
-      if(output_string_search[sizeof(output_string_search)-1]!='\0') {
-        bcopy("...",&output_string_search[sizeof(output_string_search)-4],4);
+  if (string_expect_count) {
+    np_matcher_reset (string_matcher);
+    if (np_matcher_feed (string_matcher, page, strlen (page)) < string_expect_count) {
+      char *missing = NULL;
+      int j;
+      for (j = 0; j < string_expect_count; j++) {
+        if (string_matcher->found[j])
+          continue;
+        strncpy(&output_string_search[0],string_expect[j],sizeof(output_string_search));
+        if(output_string_search[sizeof(output_string_search)-1]!='\0') {
+          bcopy("...",&output_string_search[sizeof(output_string_search)-4],4);
+        }
+        /* quoted one by one by the message below: 'one', 'two' */
+        if (missing)
+          xasprintf (&missing, "%s', '%s", missing, output_string_search);
+        else
+          missing = strdup (output_string_search);
       }
-      xasprintf (&msg, _("%sstring '%s' not found on '%s://%s:%d%s', "), msg, output_string_search, use_ssl ? "https" : "http", host_name ? host_name : server_address, server_port, server_url);
+      xasprintf (&msg, _("%sstring '%s' not found on '%s://%s:%d%s', "), msg, missing, use_ssl ? "https" : "http", host_name ? host_name : server_address, server_port, server_url);
       result = STATE_CRITICAL;
     }
   }
 
   if (strlen (regexp)) {
-    errcode = regexec (&preg, page, REGS, pmatch, 0);
+    errcode = np_regexec (&preg, page, REGS, pmatch, 0);
     if ((errcode == 0 && invert_regex == 0) || (errcode == REG_NOMATCH && invert_regex == 1)) {
       /* OK - No-op to avoid changing the logic around it */
       result = max_state_alt(STATE_OK, result);
@@ -1271,7 +1709,7 @@ check_http (void)
     }
     else {
       /* FIXME: Shouldn't that be UNKNOWN? */
-      regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+      np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
       xasprintf (&msg, _("%sExecute Error: %s, "), msg, errbuf);
       result = STATE_CRITICAL;
     }
@@ -1301,6 +1739,18 @@ check_http (void)
   else
     msg[strlen(msg)-3] = '\0';
 
+  /* with --keepalive, check_http_paths() reports on all of the paths */
+  if (current_path != NULL) {
+    np_span_end ();
+    current_path->result = max_state_alt(get_status(elapsed_time, thlds), result);
+    current_path->msg = msg;
+    current_path->elapsed_time = elapsed_time;
+    current_path->elapsed_time_firstbyte = elapsed_time_firstbyte;
+    current_path->page_len = page_len;
+    free (full_page);
+    return current_path->result;
+  }
+
   /* check elapsed time */
   if (show_extended_perfdata)
     xasprintf (&msg,
@@ -1322,6 +1772,21 @@ check_http (void)
            perfd_time (elapsed_time),
            perfd_size (page_len));
 
+#ifdef HAVE_SSL
+  if (ssl_session_cache == TRUE && use_ssl == TRUE && !show_extended_perfdata)
+    xasprintf (&msg, "%s %s", msg, perfd_time_ssl (elapsed_time_ssl));
+#endif
+
+  /* time is all of it, the final request took the rest */
+  if (redir_depth > 0)
+    xasprintf (&msg, "%s %s", msg, perfd_time_redirect (elapsed_time_redirect));
+
+  /* where the time went, with --timing-perfdata */
+  np_span_end ();
+  timing = np_timing_perfdata ();
+  if (*timing)
+    xasprintf (&msg, "%s %s", msg, timing);
+
   if (show_body)
     xasprintf (&msg, _("%s\n%s"), msg, page);
 
@@ -1334,6 +1799,131 @@ check_http (void)
 
 
 
+/* --keepalive: the paths one after the other over the connection opened
+ * here, or all of their requests at once with --pipeline, each response
+ * judged by check_http() on its own */
+int
+check_http_paths (void)
+{
+  int states[STATE_DEPENDENT + 1] = { 0 };
+  int result = STATE_OK;
+  int i;
+  double elapsed_time, elapsed_time_connect, elapsed_time_ssl = 0.0;
+  struct timeval start;
+  const char *request_method;
+  char *request, *requests = NULL, *label = NULL;
+
+  gettimeofday (&start, NULL);
+  gettimeofday (&tv_temp, NULL);
+  if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+    die (STATE_CRITICAL, _("HTTP CRITICAL - Unable to open TCP socket\n"));
+  elapsed_time_connect = (double)deltime (tv_temp) / 1.0e6;
+  connects++;
+#ifdef HAVE_SSL
+  if (use_ssl == TRUE) {
+    if (ssl_session_cache == TRUE)
+      np_net_ssl_session_cache (server_address, server_port, (use_sni ? host_name : NULL));
+    gettimeofday (&tv_temp, NULL);
+    if (np_net_ssl_init_with_hostname_version_and_cert(sd, (use_sni ? host_name : NULL), ssl_version, client_cert, client_privkey) != STATE_OK)
+      die (STATE_CRITICAL, NULL);
+    if (verbose) printf ("SSL initialized\n");
+    elapsed_time_ssl = (double)deltime (tv_temp) / 1.0e6;
+    if (check_ocsp == TRUE) {
+      char *ocsp_message = NULL;
+      result = np_net_ssl_check_ocsp (&ocsp_message);
+      if (verbose) printf ("%s\n", ocsp_message);
+      if (result != STATE_OK)
+        die (result, "HTTP %s - %s\n", state_text (result), ocsp_message);
+      free (ocsp_message);
+    }
+  }
+#endif
+
+  /* check_http() takes it over as the connection a redirect kept */
+  keep_sd = sd;
+  keep_address = strdup (server_address);
+  keep_host_name = host_name ? strdup (host_name) : NULL;
+  keep_port = server_port;
+  keep_ssl = use_ssl;
+
+  if (pipeline) {
+    for (i = 0; i < path_count; i++) {
+      path_load (&paths[i]);
+      current_path = &paths[i];
+      request = http_request (&request_method);
+      if (verbose) printf ("%s\n", request);
+      xasprintf (&requests, "%s%s", requests ? requests : "", request);
+      free (request);
+    }
+    my_send (requests, strlen (requests));
+    free (requests);
+    pipelined = path_count;
+  }
+
+  for (i = 0; i < path_count; i++) {
+    path_load (&paths[i]);
+    current_path = &paths[i];
+    if (verbose) printf (_("Checking %s\n"), server_url);
+    /* check_http() stops the alarm when it is done */
+    alarm (socket_timeout);
+    gettimeofday (&tv, NULL);
+    check_http ();
+    result = max_state_alt (paths[i].result, result);
+    if (paths[i].result >= STATE_OK && paths[i].result <= STATE_DEPENDENT)
+      states[paths[i].result]++;
+  }
+  alarm (0);
+  current_path = NULL;
+  if (keep_sd) {
+    close (keep_sd);
+#ifdef HAVE_SSL
+    if (keep_ssl)
+      np_net_ssl_cleanup();
+#endif
+  }
+  elapsed_time = (double)deltime (start) / 1.0e6;
+
+  printf (_("HTTP %s: %d paths: %d ok, %d warning, %d critical, %d unknown over %d connection(s) in %.3f seconds"),
+          state_text (result), path_count, states[STATE_OK], states[STATE_WARNING],
+          states[STATE_CRITICAL], states[STATE_UNKNOWN], connects, elapsed_time);
+  if (display_html == TRUE)
+    printf ("</A>");
+
+  /* the cost of the connection once, then the time and size of each path */
+  printf ("|%s %s", fperfdata ("time", elapsed_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0),
+          perfd_time_connect (elapsed_time_connect));
+  if (use_ssl == TRUE)
+    printf (" %s", perfd_time_ssl (elapsed_time_ssl));
+  for (i = 0; i < path_count; i++) {
+    path_load (&paths[i]);
+    xasprintf (&label, "time_%s", server_url);
+    printf (" %s", fperfdata (label, paths[i].elapsed_time, "s",
+                              thlds->warning?TRUE:FALSE, thlds->warning?thlds->warning->end:0,
+                              thlds->critical?TRUE:FALSE, thlds->critical?thlds->critical->end:0,
+                              TRUE, 0, TRUE, socket_timeout));
+    xasprintf (&label, "size_%s", server_url);
+    printf (" %s", perfdata (label, paths[i].page_len, "B",
+                             (min_page_len>0?TRUE:FALSE), min_page_len,
+                             (min_page_len>0?TRUE:FALSE), 0,
+                             TRUE, 0, FALSE, 0));
+    if (show_extended_perfdata) {
+      xasprintf (&label, "time_firstbyte_%s", server_url);
+      printf (" %s", fperfdata (label, paths[i].elapsed_time_firstbyte, "s",
+                                FALSE, 0, FALSE, 0, FALSE, 0, TRUE, socket_timeout));
+    }
+  }
+  putchar ('\n');
+
+  for (i = 0; i < path_count; i++)
+    printf (_("%s %s: %s - %d bytes in %.3f second response time\n"),
+            state_text (paths[i].result), paths[i].url, paths[i].msg,
+            paths[i].page_len, paths[i].elapsed_time);
+
+  return result;
+}
+
+
+
 /* per RFC 2396 */
 #define URI_HTTP "%5[HTPShtps]"
 #define URI_HOST "%255[-.abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789]"
@@ -1524,6 +2114,11 @@ char *perfd_time_connect (double elapsed_time_connect)
 
 char *perfd_time_ssl (double elapsed_time_ssl)
 {
+#ifdef HAVE_SSL
+  /* resumed handshakes are graphed apart from full ones */
+  if (ssl_session_cache == TRUE && np_net_ssl_session_reused ())
+    return fperfdata ("time_ssl_resumed", elapsed_time_ssl, "s", FALSE, 0, FALSE, 0, FALSE, 0, TRUE, socket_timeout);
+#endif
   return fperfdata ("time_ssl", elapsed_time_ssl, "s", FALSE, 0, FALSE, 0, FALSE, 0, TRUE, socket_timeout);
 }
 
@@ -1573,6 +2168,7 @@ print_help (void)
 
   printf (UT_HELP_VRSN);
   printf (UT_EXTRA_OPTS);
+  printf (UT_TIMING);
 
   printf (" %s\n", "-H, --hostname=ADDRESS");
   printf ("    %s\n", _("Host name argument for servers using host headers (virtual host)"));
@@ -1592,9 +2188,21 @@ print_help (void)
   printf ("    %s\n", _("1.2 = TLSv1.2). With a '+' suffix, newer versions are also accepted."));
   printf (" %s\n", "--sni");
   printf ("    %s\n", _("Enable SSL/TLS hostname extension support (SNI)"));
+  printf (" %s\n", "--ssl-session-cache");
+  printf ("    %s\n", _("Keep the TLS session in the state directory and resume it in the next"));
+  printf ("    %s\n", _("runs. Adds time_ssl to the performance data, named time_ssl_resumed"));
+  printf ("    %s\n", _("when the session was resumed"));
   printf (" %s\n", "-C, --certificate=INTEGER[,INTEGER]");
   printf ("    %s\n", _("Minimum number of days a certificate has to be valid. Port defaults to 443"));
   printf ("    %s\n", _("(when this option is used the URL is not checked.)"));
+  printf (" %s\n", "--cert-cache=SECONDS");
+  printf ("    %s\n", _("With -C, keep the expiry of the certificate in the state directory for"));
+  printf ("    %s\n", _("SECONDS, keyed by its fingerprint, and only fingerprint it until then"));
+  printf (" %s\n", "--ocsp");
+  printf ("    %s\n", _("Ask for the OCSP response stapled to the handshake and go critical if the"));
+  printf ("    %s\n", _("certificate is revoked or the response does not verify, warning if there"));
+  printf ("    %s\n", _("is none. The verdict is kept in the state directory until the response's"));
+  printf ("    %s\n", _("nextUpdate"));
   printf (" %s\n", "-J, --client-cert=FILE");
   printf ("   %s\n", _("Name of file that contains the client certificate (PEM format)"));
   printf ("   %s\n", _("to be used in establishing the SSL session"));
@@ -1611,9 +2219,16 @@ print_help (void)
   printf (" %s\n", "-d, --header-string=STRING");
   printf ("    %s\n", _("String to expect in the response headers"));
   printf (" %s\n", "-s, --string=STRING");
-  printf ("    %s\n", _("String to expect in the content"));
+  printf ("    %s\n", _("String to expect in the content, may be given more than once to expect all"));
+  printf ("    %s\n", _("of them, which are then looked for in a single pass over the page"));
   printf (" %s\n", "-u, --url=PATH");
   printf ("    %s\n", _("URL to GET or POST (default: /)"));
+  printf (" %s\n", "--keepalive");
+  printf ("    %s\n", _("Check every -u over one HTTP/1.1 connection. -e, -d, -s, -r, -R,"));
+  printf ("    %s\n", _("--invert-regex, -m, -w and -c after a -u apply to that path only, before"));
+  printf ("    %s\n", _("the first -u to all of them. The connect and TLS times are given once"));
+  printf (" %s\n", "--pipeline");
+  printf ("    %s\n", _("Like --keepalive, but send the requests of all paths at once"));
   printf (" %s\n", "-P, --post=STRING");
   printf ("    %s\n", _("URL encoded http POST data"));
   printf (" %s\n", "-j, --method=STRING  (for example: HEAD, OPTIONS, TRACE, PUT, DELETE, CONNECT, CONNECT:POST)");
@@ -1653,8 +2268,11 @@ print_help (void)
   printf (" %s\n", "-f, --onredirect=<ok|warning|critical|follow|sticky|stickyport>");
   printf ("    %s\n", _("How to handle redirected pages. sticky is like follow but stick to the"));
   printf ("    %s\n", _("specified IP address. stickyport also ensures port stays the same."));
+  printf ("    %s\n", _("Redirects to the same server are followed over the same connection,"));
+  printf ("    %s\n", _("the time they took is given as time_redirect in the performance data."));
   printf (" %s\n", "-m, --pagesize=INTEGER<:INTEGER>");
   printf ("    %s\n", _("Minimum page size required (bytes) : Maximum page size required (bytes)"));
+  printf ("    %s\n", _("Reading stops once the maximum is exceeded"));
 
   printf (UT_WARN_CRIT);
 
@@ -1727,5 +2345,7 @@ print_usage (void)
   printf ("       [-e <expect>] [-d string] [-s string] [-l] [-r <regex> | -R <case-insensitive regex>]\n");
   printf ("       [-P string] [-m <min_pg_size>:<max_pg_size>] [-4|-6] [-N] [-M <age>]\n");
   printf ("       [-A string] [-k string] [-S <version>] [--sni] [-C <warn_age>[,<crit_age>]]\n");
-  printf ("       [-T <content-type>] [-j method]\n");
+  printf ("       [-T <content-type>] [-j method] [--ocsp]\n");
+  printf (" %s -H <vhost> | -I <IP-address> --keepalive|--pipeline\n", progname);
+  printf ("       -u <uri> [<options of the uri>] -u <uri> [<options of the uri>]...\n");
 }
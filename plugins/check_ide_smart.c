@@ -46,9 +46,16 @@ void print_usage (void);
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <glob.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 #ifdef __linux__
 #include <linux/hdreg.h>
 #include <linux/types.h>
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+#include <linux/nvme_ioctl.h>
+#endif
 
 #define OPEN_MODE O_RDONLY
 #endif /* __linux__ */
@@ -82,6 +89,10 @@ void print_usage (void);
 #define OPERATIONAL 0
 #define UNKNOWN -1
 
+/* drives polled at the same time when checking several */
+#define DEFAULT_THREADS 8
+#define THREADS_OPTION CHAR_MAX+1
+
 typedef struct threshold_s
 {
 	__u8 id;
@@ -125,6 +136,41 @@ typedef struct values_s
 }
 __attribute__ ((packed)) values_t;
 
+/* NVMe SMART / Health Information log page */
+typedef struct nvme_smart_log_s
+{
+	__u8 critical_warning;
+	__u8 temperature[2];
+	__u8 avail_spare;
+	__u8 spare_thresh;
+	__u8 percent_used;
+	__u8 reserved1[26];
+	__u8 data_units_read[16];
+	__u8 data_units_written[16];
+	__u8 host_reads[16];
+	__u8 host_writes[16];
+	__u8 ctrl_busy_time[16];
+	__u8 power_cycles[16];
+	__u8 power_on_hours[16];
+	__u8 unsafe_shutdowns[16];
+	__u8 media_errors[16];
+	__u8 num_err_log_entries[16];
+	__u8 reserved2[320];
+}
+__attribute__ ((packed)) nvme_smart_log_t;
+
+typedef struct smart_drive_s
+{
+	char *device;
+	int nvme;
+	int result;
+	char *message;
+	values_t values;
+	thresholds_t thresholds;
+	nvme_smart_log_t nvme_log;
+}
+smart_drive_t;
+
 struct
 {
 	__u8 value;
@@ -166,23 +212,30 @@ enum SmartCommand
 
 char *get_offline_text (int);
 int smart_read_values (int, values_t *);
-int nagios (values_t *, thresholds_t *);
+int nagios (values_t *, thresholds_t *, char **);
 void print_value (value_t *, threshold_t *);
 void print_values (values_t *, thresholds_t *);
 int smart_cmd_simple (int, enum SmartCommand, __u8, char);
 int smart_read_thresholds (int, thresholds_t *);
+int nvme_read_smart_log (int, nvme_smart_log_t *);
+int nvme_status (nvme_smart_log_t *, char **);
+void print_nvme_log (nvme_smart_log_t *);
+void add_devices (const char *);
+void check_drive (smart_drive_t *);
+void check_drives (void);
 int verbose = FALSE;
 
+smart_drive_t *drives = NULL;
+size_t drives_count = 0;
+int threads = DEFAULT_THREADS;
+
 int
 main (int argc, char *argv[]) 
 {
-	char *device = NULL;
 	int o, longindex;
-	int retval = 0;
-
-	thresholds_t thresholds;
-	values_t values;
-	int fd;
+	int result = STATE_OK;
+	int states[STATE_UNKNOWN + 1] = { 0 };
+	size_t i;
 
 	static struct option longopts[] = { 
 		{"device", required_argument, 0, 'd'}, 
@@ -191,6 +244,7 @@ main (int argc, char *argv[])
 		{"auto-on", no_argument, 0, '1'}, 
 		{"auto-off", no_argument, 0, '0'}, 
 		{"nagios", no_argument, 0, 'n'}, /* DEPRECATED, but we still accept it */
+		{"threads", required_argument, 0, THREADS_OPTION},
 		{"help", no_argument, 0, 'h'}, 
 		{"version", no_argument, 0, 'V'},
 		{0, 0, 0, 0}
@@ -199,9 +253,7 @@ main (int argc, char *argv[])
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	while (1) {
 		
@@ -212,7 +264,7 @@ main (int argc, char *argv[])
 
 		switch (o) {
 		case 'd':
-			device = optarg;
+			add_devices (optarg);
 			break;
 		case 'q':
 			fprintf (stderr, "%s\n", _("DEPRECATION WARNING: the -q switch (quiet output) is no longer \"quiet\"."));
@@ -228,6 +280,11 @@ main (int argc, char *argv[])
 			fprintf (stderr, "%s\n", _("DEPRECATION WARNING: the -n switch (Nagios-compatible output) is now the"));
 			fprintf (stderr, "%s\n", _("default and will be removed from future releases."));
 			break;
+		case THREADS_OPTION:
+			if (!is_intpos (optarg))
+				usage2 (_("Threads must be a positive integer"), optarg);
+			threads = atoi (optarg);
+			break;
 		case 'v': /* verbose */
 			verbose = TRUE;
 			break;
@@ -242,34 +299,168 @@ main (int argc, char *argv[])
 		}
 	}
 
-	if (optind < argc) {
-		device = argv[optind];
+	for (; optind < argc; optind++) {
+		add_devices (argv[optind]);
 	}
 
-	if (!device) {
+	if (drives_count == 0) {
 		print_help ();
 		return STATE_UNKNOWN;
 	}
 
-	fd = open (device, OPEN_MODE);
+	check_drives ();
 
-	if (fd < 0) {
-		printf (_("CRITICAL - Couldn't open device %s: %s\n"), device, strerror (errno));
-		return STATE_CRITICAL;
+	if (drives_count == 1) {
+		printf ("%s\n", drives[0].message);
+		if (verbose && drives[0].result != STATE_CRITICAL) {
+			if (drives[0].nvme)
+				print_nvme_log (&drives[0].nvme_log);
+			else
+				print_values (&drives[0].values, &drives[0].thresholds);
+		}
+		return drives[0].result;
 	}
 
-	if (smart_cmd_simple (fd, SMART_CMD_ENABLE, 0, FALSE)) {
-		printf (_("CRITICAL - SMART_CMD_ENABLE\n"));
-		return STATE_CRITICAL;
+	for (i = 0; i < drives_count; i++) {
+		result = max_state (result, drives[i].result);
+		states[drives[i].result]++;
+	}
+	printf (_("SMART %s - %lu drives: %d ok, %d warning, %d critical, %d unknown\n"),
+	        state_text (result), (unsigned long)drives_count, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+	for (i = 0; i < drives_count; i++) {
+		printf ("%s: %s\n", drives[i].device, drives[i].message);
+		if (verbose && drives[i].result != STATE_CRITICAL) {
+			if (drives[i].nvme)
+				print_nvme_log (&drives[i].nvme_log);
+			else
+				print_values (&drives[i].values, &drives[i].thresholds);
+		}
+	}
+	return result;
+}
+
+
+
+/* A device may be a glob(3) pattern, e.g. /dev/sd?, patterns matching
+ * nothing are kept as they are and fail to open */
+void
+add_devices (const char *pattern)
+{
+	glob_t g;
+	size_t i;
+	char *name;
+
+	if (glob (pattern, GLOB_NOCHECK, NULL, &g) != 0)
+		die (STATE_UNKNOWN, _("Invalid device pattern %s\n"), pattern);
+
+	drives = realloc (drives, (drives_count + g.gl_pathc) * sizeof (smart_drive_t));
+	if (drives == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < g.gl_pathc; i++) {
+		memset (&drives[drives_count], 0, sizeof (smart_drive_t));
+		drives[drives_count].device = strdup (g.gl_pathv[i]);
+		if (drives[drives_count].device == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		name = strrchr (g.gl_pathv[i], '/');
+		drives[drives_count].nvme = strncmp (name ? name + 1 : g.gl_pathv[i], "nvme", 4) == 0;
+		drives[drives_count].result = STATE_UNKNOWN;
+		drives_count++;
+	}
+	globfree (&g);
+}
+
+
+
+/* Reads the SMART data of the drive and sets its result and message */
+void
+check_drive (smart_drive_t *drive)
+{
+	int fd, e;
+
+	fd = open (drive->device, OPEN_MODE);
+
+	if (fd < 0) {
+		xasprintf (&drive->message, _("CRITICAL - Couldn't open device %s: %s"), drive->device, strerror (errno));
+		drive->result = STATE_CRITICAL;
+		return;
 	}
 
-	smart_read_values (fd, &values);
-	smart_read_thresholds (fd, &thresholds);
-	retval = nagios (&values, &thresholds);
-	if (verbose) print_values (&values, &thresholds);
+	drive->result = STATE_CRITICAL;
+	if (drive->nvme) {
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+		if ((e = nvme_read_smart_log (fd, &drive->nvme_log)))
+			xasprintf (&drive->message, _("CRITICAL - NVME_GET_LOG_PAGE: %s"), strerror (e));
+		else
+			drive->result = nvme_status (&drive->nvme_log, &drive->message);
+#else
+		xasprintf (&drive->message, _("UNKNOWN - NVMe drives are not supported on this system"));
+		drive->result = STATE_UNKNOWN;
+#endif
+	}
+	else if (smart_cmd_simple (fd, SMART_CMD_ENABLE, 0, FALSE))
+		xasprintf (&drive->message, _("CRITICAL - SMART_CMD_ENABLE"));
+	else if ((e = smart_read_values (fd, &drive->values)))
+		xasprintf (&drive->message, _("CRITICAL - SMART_READ_VALUES: %s"), strerror (e));
+	else if ((e = smart_read_thresholds (fd, &drive->thresholds)))
+		xasprintf (&drive->message, _("CRITICAL - SMART_READ_THRESHOLDS: %s"), strerror (e));
+	else
+		drive->result = nagios (&drive->values, &drive->thresholds, &drive->message);
 
 	close (fd);
-	return retval;
+}
+
+
+
+#ifdef HAVE_LIBPTHREAD
+static size_t drives_next;	/* the first drive no thread has taken */
+static pthread_mutex_t drives_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *
+check_drive_worker (void *arg)
+{
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock (&drives_lock);
+		i = drives_next++;
+		pthread_mutex_unlock (&drives_lock);
+		if (i >= drives_count)
+			return NULL;
+		check_drive (&drives[i]);
+	}
+}
+#endif
+
+/* The ioctls of a drive block until it answers, so drives are polled by
+ * up to threads threads at the same time */
+void
+check_drives (void)
+{
+	size_t i;
+#ifdef HAVE_LIBPTHREAD
+	pthread_t *tids;
+	int started;
+
+	if (threads > 1 && drives_count > 1) {
+		if ((size_t) threads > drives_count)
+			threads = drives_count;
+		if ((tids = calloc (threads, sizeof (pthread_t))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		drives_next = 0;
+		for (started = 0; started < threads - 1; started++)
+			if (pthread_create (&tids[started], NULL, check_drive_worker, NULL) != 0)
+				break;
+		/* whatever the threads did not take is done here */
+		check_drive_worker (NULL);
+		while (started > 0)
+			pthread_join (tids[--started], NULL);
+		free (tids);
+		return;
+	}
+#endif
+	for (i = 0; i < drives_count; i++)
+		check_drive (&drives[i]);
 }
 
 
@@ -300,7 +491,6 @@ smart_read_values (int fd, values_t * values)
 	args[3] = 1;
 	if (ioctl (fd, HDIO_DRIVE_CMD, &args)) {
 		e = errno;
-		printf (_("CRITICAL - SMART_READ_VALUES: %s\n"), strerror (errno));
 		return e;
 	}
 	memcpy (values, args + 4, 512);
@@ -327,7 +517,6 @@ smart_read_values (int fd, values_t * values)
 
 	if (errno != 0) {
 		int e = errno;
-		printf (_("CRITICAL - SMART_READ_VALUES: %s\n"), strerror (errno));
 		return e;
 	}
 
@@ -339,7 +528,7 @@ smart_read_values (int fd, values_t * values)
 
 
 int
-nagios (values_t * p, thresholds_t * t) 
+nagios (values_t * p, thresholds_t * t, char **message) 
 {
 	value_t * value = p->values;
 	threshold_t * threshold = t->thresholds;
@@ -373,7 +562,7 @@ nagios (values_t * p, thresholds_t * t)
 	}
 	switch (status) {
 	case PREFAILURE:
-		printf (_("CRITICAL - %d Harddrive PreFailure%cDetected! %d/%d tests failed.\n"),
+		xasprintf (message, _("CRITICAL - %d Harddrive PreFailure%cDetected! %d/%d tests failed."),
 		        prefailure,
 		        prefailure > 1 ? 's' : ' ',
 		        failed,
@@ -381,7 +570,7 @@ nagios (values_t * p, thresholds_t * t)
 		status=STATE_CRITICAL;
 		break;
 	case ADVISORY:
-		printf (_("WARNING - %d Harddrive Advisor%s Detected. %d/%d tests failed.\n"),
+		xasprintf (message, _("WARNING - %d Harddrive Advisor%s Detected. %d/%d tests failed."),
 		        advisory,
 		        advisory > 1 ? "ies" : "y",
 		        failed,
@@ -389,11 +578,11 @@ nagios (values_t * p, thresholds_t * t)
 		status=STATE_WARNING;
 		break;
 	case OPERATIONAL:
-		printf (_("OK - Operational (%d/%d tests passed)\n"), passed, total);
+		xasprintf (message, _("OK - Operational (%d/%d tests passed)"), passed, total);
 		status=STATE_OK;
 		break;
 	default:
-		printf (_("ERROR - Status '%d' unknown. %d/%d tests passed\n"), status,
+		xasprintf (message, _("ERROR - Status '%d' unknown. %d/%d tests passed"), status,
 						passed, total);
 		status = STATE_UNKNOWN;
 		break;
@@ -514,7 +703,6 @@ smart_read_thresholds (int fd, thresholds_t * thresholds)
   args[3] = 1;
 	if (ioctl (fd, HDIO_DRIVE_CMD, &args)) {
 		e = errno;
-		printf (_("CRITICAL - SMART_READ_THRESHOLDS: %s\n"), strerror (errno));
 		return e;
 	}
 	memcpy (thresholds, args + 4, 512);
@@ -541,7 +729,6 @@ smart_read_thresholds (int fd, thresholds_t * thresholds)
 
 	if (errno != 0) {
 		int e = errno;
-		printf (_("CRITICAL - SMART_READ_THRESHOLDS: %s\n"), strerror (errno));
 		return e;
 	}
 
@@ -551,6 +738,70 @@ smart_read_thresholds (int fd, thresholds_t * thresholds)
 }
 
 
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+int
+nvme_read_smart_log (int fd, nvme_smart_log_t * log) 
+{
+	struct nvme_admin_cmd cmd;
+	int ret;
+
+	memset (&cmd, 0, sizeof (cmd));
+	memset (log, 0, sizeof (*log));
+	cmd.opcode = 0x02;		/* Get Log Page */
+	cmd.nsid = 0xffffffff;		/* the whole controller */
+	cmd.addr = (unsigned long) log;
+	cmd.data_len = sizeof (*log);
+	cmd.cdw10 = 0x02 | ((sizeof (*log) / 4 - 1) << 16);	/* SMART / Health */
+	ret = ioctl (fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+	if (ret < 0)
+		return errno;
+	/* a positive status is an NVMe error */
+	if (ret > 0)
+		return EIO;
+	return 0;
+}
+#endif /* HAVE_LINUX_NVME_IOCTL_H */
+
+
+
+/* A critical warning bit set or the spare below its threshold is
+ * critical, a worn out drive (100% used) is a warning */
+int
+nvme_status (nvme_smart_log_t * log, char **message) 
+{
+	if (log->critical_warning) {
+		xasprintf (message, _("CRITICAL - NVMe critical warning 0x%02x, spare %d%% (threshold %d%%), %d%% used."),
+		           log->critical_warning, log->avail_spare, log->spare_thresh, log->percent_used);
+		return STATE_CRITICAL;
+	}
+	if (log->avail_spare < log->spare_thresh) {
+		xasprintf (message, _("CRITICAL - NVMe spare %d%% below threshold %d%%, %d%% used."),
+		           log->avail_spare, log->spare_thresh, log->percent_used);
+		return STATE_CRITICAL;
+	}
+	if (log->percent_used >= 100) {
+		xasprintf (message, _("WARNING - NVMe %d%% used, spare %d%% (threshold %d%%)."),
+		           log->percent_used, log->avail_spare, log->spare_thresh);
+		return STATE_WARNING;
+	}
+	xasprintf (message, _("OK - Operational (NVMe spare %d%%, %d%% used)"),
+	           log->avail_spare, log->percent_used);
+	return STATE_OK;
+}
+
+
+
+void
+print_nvme_log (nvme_smart_log_t * log) 
+{
+	printf (_("CriticalWarning=0x%02x, Temperature=%dC, AvailableSpare=%d%%, SpareThreshold=%d%%, PercentageUsed=%d%%\n"),
+	        log->critical_warning,
+	        (log->temperature[0] | log->temperature[1] << 8) - 273,
+	        log->avail_spare, log->spare_thresh, log->percent_used);
+}
+
+
+
 void
 print_help (void)
 {
@@ -573,6 +824,12 @@ print_help (void)
   printf ("    %s\n", _("Select device DEVICE"));
   printf ("    %s\n", _("Note: if the device is specified without this option, any further option will"));
   printf ("          %s\n", _("be ignored."));
+  printf ("    %s\n", _("Can be given several times, and be a pattern like /dev/sd?. With more than"));
+  printf ("    %s\n", _("one device, the worst state of the drives is returned, followed by one"));
+  printf ("    %s\n", _("line for each. Devices named nvme* are read from their SMART log page."));
+  printf (" %s\n", "--threads=NUMBER");
+  printf ("    %s\n", _("Drives polled at the same time when checking several"));
+  printf ("    %s %d)\n", _("(default:"), DEFAULT_THREADS);
 
   printf (UT_VERBOSE);
 
@@ -604,5 +861,5 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-  printf ("%s [-d <device>] [-v]", progname);
+  printf ("%s [-d <device>]... [--threads=<number>] [-v]", progname);
 }
@@ -47,8 +47,55 @@ enum {
 	DEFAULT_PORT = 389
 };
 
+#if defined(HAVE_LDAP_CREATE_PAGE_CONTROL) && defined(HAVE_LDAP_PARSE_PAGERESPONSE_CONTROL)
+# define HAVE_LDAP_PAGED_RESULTS 1
+#endif
+#ifndef LDAP_NO_ATTRS
+# define LDAP_NO_ATTRS "1.1"
+#endif
+
+enum {
+	PAGE_SIZE_OPTION = CHAR_MAX + 1,
+	TARGETS_OPTION,
+	LAG_WARNING_OPTION,
+	LAG_CRITICAL_OPTION,
+	DIVERGENCE_WARNING_OPTION,
+	DIVERGENCE_CRITICAL_OPTION
+};
+
+/* --targets checks every replica over a connection of its own, with all
+ * of them in flight at the same time */
+enum {
+	TARGET_BIND,
+	TARGET_SEARCH,
+	TARGET_CSN,
+	TARGET_DONE
+};
+
+typedef struct ldap_target {
+	char *host;
+	int port;
+	LDAP *ld;
+	int fd;
+	int phase;
+	int msgid;
+	int sent;		/* the pending request has left, only replies are waited for */
+	struct timeval start;
+	double elapsed;
+	double elapsed_bind;
+	double elapsed_firstentry;
+	int num_entries;
+	char *csn;		/* the newest contextCSN of the base */
+	double csn_time;
+	int complete;		/* all went through, the values can be compared */
+	int result;
+	char *message;
+} ldap_target;
+
 int process_arguments (int, char **);
 int validate_arguments (void);
+int search_entries (LDAP *, int, int *, double *);
+int run_targets (void);
 void print_help (void);
 void print_usage (void);
 
@@ -73,6 +120,15 @@ char* warn_entries = NULL;
 char* crit_entries = NULL;
 int starttls = FALSE;
 int ssl_on_connect = FALSE;
+int page_size = 0;
+int show_extended_perfdata = FALSE;
+char *targets_file = NULL;
+char *warn_lag = NULL;
+char *crit_lag = NULL;
+thresholds *lag_thresholds = NULL;
+char *warn_divergence = NULL;
+char *crit_divergence = NULL;
+thresholds *divergence_thresholds = NULL;
 int verbose = 0;
 
 /* for ldap tls */
@@ -84,13 +140,18 @@ main (int argc, char *argv[])
 {
 
 	LDAP *ld;
-	LDAPMessage *result;
 
 	/* should be 	int result = STATE_UNKNOWN; */
 
 	int status = STATE_UNKNOWN;
 	long microsec;
 	double elapsed_time;
+	struct timeval tv_step;
+	double elapsed_time_bind;
+	double elapsed_time_search;
+	double elapsed_time_firstentry;
+	char *extended_perfdata = "";
+	int rc;
 
 	/* for ldap tls */
 
@@ -99,13 +160,10 @@ main (int argc, char *argv[])
 
 	/* for entry counting */
 
-	LDAPMessage *next_entry;
 	int status_entries = STATE_OK;
 	int num_entries = 0;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	if (strstr(argv[0],"check_ldaps")) {
 		xasprintf (&progname, "check_ldaps");
@@ -123,6 +181,9 @@ main (int argc, char *argv[])
 	/* initialize alarm signal handling */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 
+	if (targets_file != NULL)
+		return run_targets ();
+
 	/* set socket timeout */
 	alarm (socket_timeout);
 
@@ -197,6 +258,7 @@ main (int argc, char *argv[])
 	}
 
 	/* bind to the ldap server */
+	gettimeofday (&tv_step, NULL);
 	if (ldap_bind_s (ld, ld_binddn, ld_passwd, LDAP_AUTH_SIMPLE) !=
 			LDAP_SUCCESS) {
 		if (verbose)
@@ -204,17 +266,19 @@ main (int argc, char *argv[])
 		printf (_("Could not bind to the LDAP server\n"));
 		return STATE_CRITICAL;
 	}
+	elapsed_time_bind = (double)deltime (tv_step) / 1.0e6;
 
 	/* do a search of all objectclasses in the base dn */
-	if (ldap_search_s (ld, ld_base, (crit_entries!=NULL || warn_entries!=NULL) ? LDAP_SCOPE_SUBTREE : LDAP_SCOPE_BASE, ld_attr, NULL, 0, &result)
-			!= LDAP_SUCCESS) {
+	gettimeofday (&tv_step, NULL);
+	rc = search_entries (ld, (crit_entries!=NULL || warn_entries!=NULL) ? LDAP_SCOPE_SUBTREE : LDAP_SCOPE_BASE,
+			&num_entries, &elapsed_time_firstentry);
+	if (rc != LDAP_SUCCESS) {
 		if (verbose)
-			ldap_perror(ld, "ldap_search");
+			printf ("ldap_search: %s\n", ldap_err2string (rc));
 		printf (_("Could not search/find objectclasses in %s\n"), ld_base);
 		return STATE_CRITICAL;
-	} else if (crit_entries!=NULL || warn_entries!=NULL) {
-		num_entries = ldap_count_entries(ld, result);
 	}
+	elapsed_time_search = (double)deltime (tv_step) / 1.0e6;
 
 	/* unbind from the ldap server */
 	ldap_unbind (ld);
@@ -247,9 +311,19 @@ main (int argc, char *argv[])
 		}
 	}
 
+	if (show_extended_perfdata) {
+		xasprintf (&extended_perfdata, " %s %s",
+			fperfdata ("time_bind", elapsed_time_bind, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0),
+			fperfdata ("time_search", elapsed_time_search, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+		/* there is no first entry to time if none was found */
+		if (elapsed_time_firstentry >= 0)
+			xasprintf (&extended_perfdata, "%s %s", extended_perfdata,
+				fperfdata ("time_firstentry", elapsed_time_firstentry, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+	}
+
 	/* print out the result */
 	if (crit_entries!=NULL || warn_entries!=NULL) {
-		printf (_("LDAP %s - found %d entries in %.3f seconds|%s %s\n"),
+		printf (_("LDAP %s - found %d entries in %.3f seconds|%s %s%s\n"),
 			state_text (status),
 			num_entries,
 			elapsed_time,
@@ -260,20 +334,544 @@ main (int argc, char *argv[])
 			sperfdata ("entries", (double)num_entries, "",
 				warn_entries,
 				crit_entries,
-				TRUE, 0.0, FALSE, 0.0));
+				TRUE, 0.0, FALSE, 0.0),
+			extended_perfdata);
 	} else {
-		printf (_("LDAP %s - %.3f seconds response time|%s\n"),
+		printf (_("LDAP %s - %.3f seconds response time|%s%s\n"),
 			state_text (status),
 			elapsed_time,
 			fperfdata ("time", elapsed_time, "s",
 				(int)warn_time, warn_time,
 				(int)crit_time, crit_time,
-				TRUE, 0, FALSE, 0));
+				TRUE, 0, FALSE, 0),
+			extended_perfdata);
 	}
 
 	return status;
 }
 
+/* Searches without asking for any attributes, so that only the DNs of
+ * the entries come over the wire, and counts the entries as they arrive
+ * instead of keeping them all. With --page-size the server is asked for
+ * a page of entries at a time. The time until the first entry goes to
+ * *elapsed_time_firstentry, -1 if none was found. Returns the LDAP
+ * result code. */
+int
+search_entries (LDAP *ld, int scope, int *num_entries, double *elapsed_time_firstentry)
+{
+	char *attrs[] = { LDAP_NO_ATTRS, NULL };
+	LDAPControl *controls[2] = { NULL, NULL };
+	LDAPControl **response_controls;
+	LDAPMessage *msg;
+	struct berval cookie = { 0, NULL };
+	struct timeval tv_search;
+	int msgid, type, rc, err;
+#ifdef HAVE_LDAP_PAGED_RESULTS
+	LDAPControl *page_response;
+	struct berval next_cookie;
+	ber_int_t estimate;
+#endif
+
+	*num_entries = 0;
+	*elapsed_time_firstentry = -1;
+	gettimeofday (&tv_search, NULL);
+
+	do {
+#ifdef HAVE_LDAP_PAGED_RESULTS
+		if (page_size > 0) {
+			rc = ldap_create_page_control (ld, page_size, &cookie, 0, &controls[0]);
+			if (rc != LDAP_SUCCESS)
+				return rc;
+		}
+#endif
+		rc = ldap_search_ext (ld, ld_base, scope, ld_attr, attrs, 0,
+				controls[0] ? controls : NULL, NULL, NULL, LDAP_NO_LIMIT, &msgid);
+		if (controls[0]) {
+			ldap_control_free (controls[0]);
+			controls[0] = NULL;
+		}
+		if (rc != LDAP_SUCCESS)
+			return rc;
+
+		/* count the entries of this page as they come */
+		while ((type = ldap_result (ld, msgid, LDAP_MSG_ONE, NULL, &msg)) == LDAP_RES_SEARCH_ENTRY ||
+				type == LDAP_RES_SEARCH_REFERENCE) {
+			if (type == LDAP_RES_SEARCH_ENTRY) {
+				if (*num_entries == 0)
+					*elapsed_time_firstentry = (double)deltime (tv_search) / 1.0e6;
+				(*num_entries)++;
+			}
+			ldap_msgfree (msg);
+		}
+		if (type != LDAP_RES_SEARCH_RESULT) {
+			if (type > 0)
+				ldap_msgfree (msg);
+			err = LDAP_OTHER;
+			ldap_get_option (ld, LDAP_OPT_ERROR_NUMBER, &err);
+			return err;
+		}
+
+		/* the search is done unless the server returned a cookie for
+		 * the next page */
+		response_controls = NULL;
+		rc = ldap_parse_result (ld, msg, &err, NULL, NULL, NULL, &response_controls, 1);
+		if (rc == LDAP_SUCCESS)
+			rc = err;
+		if (cookie.bv_val != NULL)
+			ber_memfree (cookie.bv_val);
+		cookie.bv_val = NULL;
+		cookie.bv_len = 0;
+#ifdef HAVE_LDAP_PAGED_RESULTS
+		if (rc == LDAP_SUCCESS && page_size > 0 && response_controls != NULL &&
+				(page_response = ldap_control_find (LDAP_CONTROL_PAGEDRESULTS, response_controls, NULL)) != NULL &&
+				ldap_parse_pageresponse_control (ld, page_response, &estimate, &next_cookie) == LDAP_SUCCESS)
+			cookie = next_cookie;
+#endif
+		if (response_controls != NULL)
+			ldap_controls_free (response_controls);
+		if (rc != LDAP_SUCCESS) {
+			if (cookie.bv_val != NULL)
+				ber_memfree (cookie.bv_val);
+			return rc;
+		}
+	} while (cookie.bv_len > 0);
+
+	if (cookie.bv_val != NULL)
+		ber_memfree (cookie.bv_val);
+	return LDAP_SUCCESS;
+}
+
+/* Reads "host [port]" lines, the port defaults to the one of -p */
+static ldap_target *
+read_targets (const char *filename, size_t *count)
+{
+	FILE *fp;
+	char line[MAX_INPUT_BUFFER];
+	char *host, *port_str;
+	ldap_target *targets = NULL;
+	size_t size = 0;
+
+	*count = 0;
+	if (strcmp (filename, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen (filename, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open target list %s: %s\n"), filename, strerror (errno));
+
+	while (fgets (line, sizeof (line), fp) != NULL) {
+		strip (line);
+		host = line + strspn (line, " \t");
+		if (*host == '\0' || *host == '#')
+			continue;
+
+		if ((port_str = strpbrk (host, " \t")) != NULL) {
+			*port_str++ = '\0';
+			port_str += strspn (port_str, " \t");
+		}
+
+		if (*count >= size) {
+			size = size ? size * 2 : 64;
+			if ((targets = realloc (targets, size * sizeof (ldap_target))) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		}
+		memset (&targets[*count], 0, sizeof (ldap_target));
+		targets[*count].host = strdup (host);
+		targets[*count].port = ld_port;
+		if (port_str != NULL && *port_str != '\0') {
+			if (!is_intpos (port_str))
+				die (STATE_UNKNOWN, _("Invalid port in target list: %s\n"), port_str);
+			targets[*count].port = atoi (port_str);
+		}
+		(*count)++;
+	}
+
+	if (fp != stdin)
+		fclose (fp);
+
+	if (*count == 0)
+		die (STATE_UNKNOWN, _("No targets found in %s\n"), filename);
+
+	return targets;
+}
+
+static void
+target_finish (ldap_target *t, int result, char *message)
+{
+	t->elapsed = (double)deltime (t->start) / 1.0e6;
+	if (t->ld != NULL)
+		ldap_unbind (t->ld);
+	t->ld = NULL;
+	t->fd = -1;
+	t->phase = TARGET_DONE;
+	t->result = result;
+	t->message = message;
+}
+
+static void
+target_fail (ldap_target *t, const char *what, int rc)
+{
+	char *message;
+
+	xasprintf (&message, "%s: %s", what, ldap_err2string (rc));
+	target_finish (t, STATE_CRITICAL, message);
+}
+
+static int
+target_result_code (ldap_target *t, LDAPMessage *msg)
+{
+	int rc, err;
+
+	rc = ldap_parse_result (t->ld, msg, &err, NULL, NULL, NULL, NULL, 0);
+	return rc == LDAP_SUCCESS ? err : rc;
+}
+
+/* Returns the time of a CSN, "YYYYmmddHHMMSS.ffffffZ#count#sid#mod" */
+static double
+csn_seconds (const char *csn)
+{
+	struct tm tm;
+	double fraction = 0;
+
+	memset (&tm, 0, sizeof (tm));
+	if (sscanf (csn, "%4d%2d%2d%2d%2d%2d%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			&tm.tm_hour, &tm.tm_min, &tm.tm_sec, &fraction) < 6)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon--;
+	return (double)timegm (&tm) + fraction;
+}
+
+/* Starts the connection and sends the bind, the rest follows as the
+ * replies come in */
+static void
+target_start (ldap_target *t)
+{
+	struct berval cred;
+	int rc;
+#ifdef LDAP_OPT_NETWORK_TIMEOUT
+	struct timeval network_timeout;
+#endif
+#if defined(HAVE_LDAP_SET_OPTION) && defined(LDAP_OPT_X_TLS)
+	int tls;
+#endif
+	int use_tls = (t->port == LDAPS_PORT || ssl_on_connect);
+
+	gettimeofday (&t->start, NULL);
+	t->fd = -1;
+	t->elapsed_firstentry = -1;
+	t->csn_time = -1;
+
+	if ((t->ld = ldap_init (t->host, t->port)) == NULL) {
+		target_finish (t, STATE_CRITICAL, _("Could not connect to the server"));
+		return;
+	}
+#ifdef HAVE_LDAP_SET_OPTION
+	if (ldap_set_option (t->ld, LDAP_OPT_PROTOCOL_VERSION, &ld_protocol) != LDAP_OPT_SUCCESS) {
+		target_finish (t, STATE_CRITICAL, _("Could not set protocol version"));
+		return;
+	}
+#endif
+#ifdef LDAP_OPT_NETWORK_TIMEOUT
+	network_timeout.tv_sec = socket_timeout;
+	network_timeout.tv_usec = 0;
+	ldap_set_option (t->ld, LDAP_OPT_NETWORK_TIMEOUT, &network_timeout);
+#endif
+	if (use_tls) {
+#if defined(HAVE_LDAP_SET_OPTION) && defined(LDAP_OPT_X_TLS)
+		tls = LDAP_OPT_X_TLS_HARD;
+		if (ldap_set_option (t->ld, LDAP_OPT_X_TLS, &tls) != LDAP_SUCCESS) {
+			target_finish (t, STATE_CRITICAL, _("Could not init TLS"));
+			return;
+		}
+#else
+		target_finish (t, STATE_CRITICAL, _("TLS not supported by the libraries"));
+		return;
+#endif
+	}
+#ifdef LDAP_OPT_CONNECT_ASYNC
+	/* the TLS handshake of ldaps can't wait, so those connect right away */
+	else
+		ldap_set_option (t->ld, LDAP_OPT_CONNECT_ASYNC, LDAP_OPT_ON);
+#endif
+
+	cred.bv_val = ld_passwd ? ld_passwd : "";
+	cred.bv_len = strlen (cred.bv_val);
+	rc = ldap_sasl_bind (t->ld, ld_binddn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, &t->msgid);
+	if (rc != LDAP_SUCCESS) {
+		target_fail (t, _("Could not bind to the LDAP server"), rc);
+		return;
+	}
+	if (ldap_get_option (t->ld, LDAP_OPT_DESC, &t->fd) != LDAP_OPT_SUCCESS || t->fd < 0) {
+		target_finish (t, STATE_CRITICAL, _("Could not connect to the server"));
+		return;
+	}
+	t->phase = TARGET_BIND;
+	t->sent = FALSE;
+}
+
+static void
+target_reply (ldap_target *t, int type, LDAPMessage *msg)
+{
+	char *no_attrs[] = { LDAP_NO_ATTRS, NULL };
+	char *csn_attrs[] = { "contextCSN", NULL };
+	struct berval **values;
+	char *message;
+	int rc, i;
+
+	switch (t->phase) {
+	case TARGET_BIND:
+		if (type != LDAP_RES_BIND)
+			return;
+		if ((rc = target_result_code (t, msg)) != LDAP_SUCCESS) {
+			target_fail (t, _("Could not bind to the LDAP server"), rc);
+			return;
+		}
+		t->elapsed_bind = (double)deltime (t->start) / 1.0e6;
+		rc = ldap_search_ext (t->ld, ld_base, entries_thresholds || divergence_thresholds ? LDAP_SCOPE_SUBTREE : LDAP_SCOPE_BASE,
+				ld_attr, no_attrs, 0, NULL, NULL, NULL, LDAP_NO_LIMIT, &t->msgid);
+		if (rc != LDAP_SUCCESS) {
+			target_fail (t, _("Could not search/find objectclasses"), rc);
+			return;
+		}
+		t->phase = TARGET_SEARCH;
+		break;
+
+	case TARGET_SEARCH:
+		if (type == LDAP_RES_SEARCH_ENTRY) {
+			if (t->num_entries++ == 0)
+				t->elapsed_firstentry = (double)deltime (t->start) / 1.0e6;
+			return;
+		}
+		if (type != LDAP_RES_SEARCH_RESULT)
+			return;
+		if ((rc = target_result_code (t, msg)) != LDAP_SUCCESS) {
+			target_fail (t, _("Could not search/find objectclasses"), rc);
+			return;
+		}
+		if (lag_thresholds == NULL) {
+			target_finish (t, STATE_OK, NULL);
+			return;
+		}
+		/* replication state is kept in the base, the suffix of a replica */
+		rc = ldap_search_ext (t->ld, ld_base, LDAP_SCOPE_BASE, ld_defattr, csn_attrs, 0,
+				NULL, NULL, NULL, LDAP_NO_LIMIT, &t->msgid);
+		if (rc != LDAP_SUCCESS) {
+			target_fail (t, _("Could not read contextCSN"), rc);
+			return;
+		}
+		t->phase = TARGET_CSN;
+		break;
+
+	case TARGET_CSN:
+		if (type == LDAP_RES_SEARCH_ENTRY) {
+			/* one value per server ID, the newest tells how recent the
+			 * replica is */
+			if ((values = ldap_get_values_len (t->ld, msg, "contextCSN")) == NULL)
+				return;
+			for (i = 0; values[i] != NULL; i++) {
+				if (t->csn == NULL || strncmp (values[i]->bv_val, t->csn, values[i]->bv_len) > 0) {
+					free (t->csn);
+					t->csn = strndup (values[i]->bv_val, values[i]->bv_len);
+				}
+			}
+			ldap_value_free_len (values);
+			return;
+		}
+		if (type != LDAP_RES_SEARCH_RESULT)
+			return;
+		if ((rc = target_result_code (t, msg)) != LDAP_SUCCESS) {
+			target_fail (t, _("Could not read contextCSN"), rc);
+			return;
+		}
+		if (t->csn == NULL || (t->csn_time = csn_seconds (t->csn)) < 0) {
+			xasprintf (&message, _("No contextCSN in %s"), ld_base);
+			target_finish (t, STATE_UNKNOWN, message);
+			return;
+		}
+		target_finish (t, STATE_OK, NULL);
+		break;
+	}
+}
+
+/* Takes in the replies that have arrived */
+static void
+target_handle_event (ldap_target *t)
+{
+	struct timeval zero = { 0, 0 };
+	LDAPMessage *msg;
+	int type, err;
+
+	/* ldap_result() also sends what waited for the connection */
+	t->sent = TRUE;
+	while (t->phase != TARGET_DONE &&
+			(type = ldap_result (t->ld, t->msgid, LDAP_MSG_ONE, &zero, &msg)) != 0) {
+		if (type == -1) {
+			err = LDAP_SERVER_DOWN;
+			ldap_get_option (t->ld, LDAP_OPT_ERROR_NUMBER, &err);
+			target_fail (t, t->phase == TARGET_BIND ? _("Could not bind to the LDAP server") :
+					_("Could not search/find objectclasses"), err);
+			return;
+		}
+		target_reply (t, type, msg);
+		ldap_msgfree (msg);
+	}
+}
+
+int
+run_targets (void)
+{
+	ldap_target *targets;
+	struct pollfd *pfds;
+	size_t *active;
+	size_t count, nactive, i, j;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int result = STATE_OK;
+	int status;
+	int timeout_ms;
+	long remaining, first;
+	int max_entries = 0;
+	double newest_csn = -1;
+	char *label = NULL;
+	char *details;
+
+	if (starttls)
+		usage4 (_("STARTTLS is not supported together with --targets"));
+
+	targets = read_targets (targets_file, &count);
+	if ((active = calloc (count, sizeof (size_t))) == NULL ||
+			(pfds = calloc (count, sizeof (struct pollfd))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	/* connections that block only do so for up to the timeout each */
+	alarm (socket_timeout + 1);
+
+	nactive = 0;
+	for (i = 0; i < count; i++) {
+		target_start (&targets[i]);
+		if (targets[i].phase != TARGET_DONE)
+			active[nactive++] = i;
+	}
+
+	while (nactive > 0) {
+		first = socket_timeout * 1000000L;
+		for (i = 0; i < nactive; i++) {
+			ldap_target *t = &targets[active[i]];
+			pfds[i].fd = t->fd;
+			pfds[i].events = t->sent ? POLLIN : (POLLIN | POLLOUT);
+			pfds[i].revents = 0;
+			remaining = socket_timeout * 1000000L - deltime (t->start);
+			if (remaining < first)
+				first = remaining;
+		}
+		timeout_ms = first > 0 ? (int)(first / 1000) + 1 : 0;
+
+		if (poll (pfds, nactive, timeout_ms) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+
+		for (i = 0; i < nactive; i++) {
+			ldap_target *t = &targets[active[i]];
+			if (pfds[i].revents)
+				target_handle_event (t);
+			else if (deltime (t->start) >= socket_timeout * 1000000L)
+				target_finish (t, STATE_CRITICAL, _("Socket timeout"));
+		}
+
+		/* drop finished targets from the active set */
+		for (i = j = 0; i < nactive; i++)
+			if (targets[active[i]].phase != TARGET_DONE)
+				active[j++] = active[i];
+		nactive = j;
+	}
+	alarm (0);
+
+	/* the replicas are compared to the one furthest ahead */
+	for (i = 0; i < count; i++) {
+		if (targets[i].result != STATE_OK)
+			continue;
+		if (targets[i].num_entries > max_entries)
+			max_entries = targets[i].num_entries;
+		if (targets[i].csn_time > newest_csn)
+			newest_csn = targets[i].csn_time;
+	}
+
+	for (i = 0; i < count; i++) {
+		ldap_target *t = &targets[i];
+		if (t->result != STATE_OK)
+			continue;
+		t->complete = TRUE;
+
+		if (crit_time!=UNDEFINED && t->elapsed>crit_time)
+			status = STATE_CRITICAL;
+		else if (warn_time!=UNDEFINED && t->elapsed>warn_time)
+			status = STATE_WARNING;
+		else
+			status = STATE_OK;
+		xasprintf (&details, _("%.3f seconds response time"), t->elapsed);
+
+		if (entries_thresholds != NULL || divergence_thresholds != NULL)
+			xasprintf (&details, _("%s, %d entries"), details, t->num_entries);
+		if (entries_thresholds != NULL)
+			status = max_state (status, get_status (t->num_entries, entries_thresholds));
+		if (divergence_thresholds != NULL)
+			status = max_state (status, get_status (max_entries - t->num_entries, divergence_thresholds));
+		if (lag_thresholds != NULL) {
+			xasprintf (&details, _("%s, %.0f seconds behind"), details, newest_csn - t->csn_time);
+			status = max_state (status, get_status (newest_csn - t->csn_time, lag_thresholds));
+		}
+		t->result = status;
+		t->message = details;
+	}
+
+	for (i = 0; i < count; i++) {
+		result = max_state (result, targets[i].result);
+		if (targets[i].result >= STATE_OK && targets[i].result <= STATE_DEPENDENT)
+			states[targets[i].result]++;
+	}
+
+	printf (_("%s %s - %lu targets: %d ok, %d warning, %d critical, %d unknown"),
+		SERVICE, state_text (result), (unsigned long)count, states[STATE_OK],
+		states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+	/* one set of labels per replica, with host:port in front */
+	printf ("|");
+	for (i = 0; i < count; i++) {
+		ldap_target *t = &targets[i];
+		xasprintf (&label, "%s:%d_time", t->host, t->port);
+		printf ("%s%s", i ? " " : "",
+			fperfdata (label, t->elapsed, "s",
+				(int)warn_time, warn_time,
+				(int)crit_time, crit_time,
+				TRUE, 0, TRUE, socket_timeout));
+		if (t->complete) {
+			if (show_extended_perfdata) {
+				xasprintf (&label, "%s:%d_time_bind", t->host, t->port);
+				printf (" %s", fperfdata (label, t->elapsed_bind, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+				if (t->elapsed_firstentry >= 0) {
+					xasprintf (&label, "%s:%d_time_firstentry", t->host, t->port);
+					printf (" %s", fperfdata (label, t->elapsed_firstentry, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+				}
+			}
+			if (entries_thresholds != NULL || divergence_thresholds != NULL) {
+				xasprintf (&label, "%s:%d_entries", t->host, t->port);
+				printf (" %s", sperfdata (label, (double)t->num_entries, "",
+					warn_entries, crit_entries, TRUE, 0.0, FALSE, 0.0));
+			}
+			if (lag_thresholds != NULL) {
+				xasprintf (&label, "%s:%d_lag", t->host, t->port);
+				printf (" %s", sperfdata (label, newest_csn - t->csn_time, "s",
+					warn_lag, crit_lag, TRUE, 0.0, FALSE, 0.0));
+			}
+		}
+	}
+	putchar ('\n');
+
+	for (i = 0; i < count; i++)
+		printf ("%s %s:%d: %s\n", state_text (targets[i].result),
+			targets[i].host, targets[i].port,
+			targets[i].message ? targets[i].message : "");
+
+	return result;
+}
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -304,6 +902,13 @@ process_arguments (int argc, char **argv)
 		{"crit", required_argument, 0, 'c'},
 		{"warn-entries", required_argument, 0, 'W'},
 		{"crit-entries", required_argument, 0, 'C'},
+		{"page-size", required_argument, 0, PAGE_SIZE_OPTION},
+		{"extended-perfdata", no_argument, 0, 'E'},
+		{"targets", required_argument, 0, TARGETS_OPTION},
+		{"lag-warning", required_argument, 0, LAG_WARNING_OPTION},
+		{"lag-critical", required_argument, 0, LAG_CRITICAL_OPTION},
+		{"divergence-warning", required_argument, 0, DIVERGENCE_WARNING_OPTION},
+		{"divergence-critical", required_argument, 0, DIVERGENCE_CRITICAL_OPTION},
 		{"verbose", no_argument, 0, 'v'},
 		{0, 0, 0, 0}
 	};
@@ -317,7 +922,7 @@ process_arguments (int argc, char **argv)
 	}
 
 	while (1) {
-		c = getopt_long (argc, argv, "hvV234TS6t:c:w:H:b:p:a:D:P:C:W:", longopts, &option);
+		c = getopt_long (argc, argv, "hvV234TS6Et:c:w:H:b:p:a:D:P:C:W:", longopts, &option);
 
 		if (c == -1 || c == EOF)
 			break;
@@ -365,6 +970,33 @@ process_arguments (int argc, char **argv)
 		case 'C':
 			crit_entries = optarg;
 			break;
+		case PAGE_SIZE_OPTION:
+#ifdef HAVE_LDAP_PAGED_RESULTS
+			if (!is_intpos (optarg))
+				usage2 (_("Page size must be a positive integer"), optarg);
+			page_size = atoi (optarg);
+#else
+			usage (_("Paged searches are not supported by the LDAP library\n"));
+#endif
+			break;
+		case 'E':
+			show_extended_perfdata = TRUE;
+			break;
+		case TARGETS_OPTION:
+			targets_file = optarg;
+			break;
+		case LAG_WARNING_OPTION:
+			warn_lag = optarg;
+			break;
+		case LAG_CRITICAL_OPTION:
+			crit_lag = optarg;
+			break;
+		case DIVERGENCE_WARNING_OPTION:
+			warn_divergence = optarg;
+			break;
+		case DIVERGENCE_CRITICAL_OPTION:
+			crit_divergence = optarg;
+			break;
 #ifdef HAVE_LDAP_SET_OPTION
 		case '2':
 			ld_protocol = 2;
@@ -406,7 +1038,7 @@ process_arguments (int argc, char **argv)
 	}
 
 	c = optind;
-	if (ld_host == NULL && is_host(argv[c]))
+	if (ld_host == NULL && targets_file == NULL && is_host(argv[c]))
 		ld_host = strdup (argv[c++]);
 
 	if (ld_base == NULL && argv[c])
@@ -422,7 +1054,7 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments ()
 {
-	if (ld_host==NULL || strlen(ld_host)==0)
+	if (targets_file == NULL && (ld_host==NULL || strlen(ld_host)==0))
 		usage4 (_("Please specify the host name\n"));
 
 	if (ld_base==NULL)
@@ -432,6 +1064,21 @@ validate_arguments ()
 		set_thresholds(&entries_thresholds,
 			warn_entries, crit_entries);
 	}
+
+	if (warn_lag!=NULL || crit_lag!=NULL || warn_divergence!=NULL || crit_divergence!=NULL) {
+		if (targets_file == NULL)
+			usage4 (_("The lag and divergence thresholds need --targets\n"));
+		set_thresholds(&lag_thresholds, warn_lag, crit_lag);
+		set_thresholds(&divergence_thresholds, warn_divergence, crit_divergence);
+	}
+	if (targets_file != NULL && page_size > 0)
+		usage4 (_("--page-size is not supported together with --targets\n"));
+
+#ifdef HAVE_LDAP_SET_OPTION
+	/* the paged results control is an LDAPv3 extension */
+	if (page_size > 0)
+		ld_protocol = 3;
+#endif
 	return OK;
 }
 
@@ -485,6 +1132,21 @@ print_help (void)
   printf ("    %s\n", _("Number of found entries to result in warning status"));
   printf (" %s\n", "-C [--crit-entries]");
   printf ("    %s\n", _("Number of found entries to result in critical status"));
+  printf (" %s\n", "--page-size=INTEGER");
+  printf ("    %s\n", _("Fetch the entries in pages of this many with the paged results control,"));
+  printf ("    %s\n", _("for servers that limit the size of searches. Implies protocol version 3"));
+  printf (" %s\n", "-E [--extended-perfdata]");
+  printf ("    %s\n", _("Print the bind, search and first entry times as performance data"));
+  printf (" %s\n", "--targets=FILE");
+  printf ("    %s\n", _("Check every server listed in FILE (\"-\" for stdin), one \"host [port]\" per"));
+  printf ("    %s\n", _("line, instead of -H. All of them are searched at the same time, and one"));
+  printf ("    %s\n", _("line per server follows a summary"));
+  printf (" %s\n", "--lag-warning=THRESHOLD, --lag-critical=THRESHOLD");
+  printf ("    %s\n", _("With --targets, read the contextCSN of the base from every server and"));
+  printf ("    %s\n", _("check how many seconds each one is behind the newest"));
+  printf (" %s\n", "--divergence-warning=THRESHOLD, --divergence-critical=THRESHOLD");
+  printf ("    %s\n", _("With --targets, count the entries on every server and check how many"));
+  printf ("    %s\n", _("each one has fewer than the server with the most"));
 
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
@@ -498,6 +1160,7 @@ print_help (void)
 	printf (" %s\n", _("This detection is deprecated, please use 'check_ldap' with the '--starttls' or '--ssl' flags"));
 	printf (" %s\n", _("to define the behaviour explicitly instead."));
 	printf (" %s\n", _("The parameters --warn-entries and --crit-entries are optional."));
+	printf (" %s\n", _("Entries are counted as they arrive, no attributes of them are fetched."));
 
 	printf (UT_SUPPORT);
 }
@@ -514,4 +1177,6 @@ print_usage (void)
 			""
 #endif
 			);
+  printf (" %s --targets=<file> -b <base_dn> [--lag-warning=<seconds>] [--lag-critical=<seconds>]\n", progname);
+  printf ("       [--divergence-warning=<entries>] [--divergence-critical=<entries>] [options]\n");
 }
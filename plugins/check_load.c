@@ -35,7 +35,7 @@ const char *email = "devel@monitoring-plugins.org";
 #include "common.h"
 #include "runcmd.h"
 #include "utils.h"
-#include "popen.h"
+#include "utils_ps.h"
 
 #ifdef HAVE_SYS_LOADAVG_H
 #include <sys/loadavg.h>
@@ -48,14 +48,45 @@ const char *email = "devel@monitoring-plugins.org";
 #define LOADAVG_15MIN	2
 #endif /* !defined LOADAVG_1MIN */
 
+#ifdef __linux__
+# define HAVE_PSI 1
+# ifndef PROC_PRESSURE
+#  define PROC_PRESSURE "/proc/pressure"
+# endif
+# ifndef CGROUP_ROOT
+#  define CGROUP_ROOT "/sys/fs/cgroup"
+# endif
+# ifndef PROC_STAT
+#  define PROC_STAT "/proc/stat"
+# endif
+# ifndef PROC_LOADAVG
+#  define PROC_LOADAVG "/proc/loadavg"
+# endif
+# ifndef PROC_MEMINFO
+#  define PROC_MEMINFO "/proc/meminfo"
+# endif
+# include <glob.h>
+# if HAVE_UTMPX_H
+#  include <utmpx.h>
+# endif
+#endif
+
 
 static int process_arguments (int argc, char **argv);
 static int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
-static int print_top_consuming_processes();
+static int print_top_consuming_processes(np_proc_table *);
+#ifdef HAVE_PSI
+static int check_pressure (void);
+static char *psi_perfdata (int);
+static int check_cgroups (char **, perf_buffer *);
+static int check_cpu (char **, perf_buffer *);
+static int check_vitals (char **, perf_buffer *, np_proc_table *);
+#endif
 
 static int n_procs_to_show = 0;
+static int ps_cache_ttl = 0;
 
 /* strictly for pretty-print usage in loops */
 static const int nums[3] = { 1, 5, 15 };
@@ -69,6 +100,51 @@ double cload[3] = { 0.0, 0.0, 0.0 };
 
 char *status_line;
 int take_into_account_cpus = 0;
+static int verbose = 0;
+
+#ifdef HAVE_PSI
+/* pressure stall thresholds for cpu, io and memory, below 0 if not given */
+static const char *psi_names[3] = { "cpu", "io", "memory" };
+static double wpsi[3] = { -1.0, -1.0, -1.0 };
+static double cpsi[3] = { -1.0, -1.0, -1.0 };
+static int psi_window = 10;
+static int use_psi = FALSE;
+static double psi[3];
+
+/* --cgroup: -w and -c are THROTTLED,PRESSURE for each cgroup matched, the
+ * share of CPU periods throttled since the last run and the share of time
+ * some of its tasks were stalled on the CPU */
+static char **cgroup_patterns = NULL;
+static int cgroup_pattern_count = 0;
+static double wcg[3] = { -1.0, -1.0, -1.0 };
+static double ccg[3] = { -1.0, -1.0, -1.0 };
+
+/* --cpu: -w and -c are BUSY,IOWAIT,STEAL,SOFTIRQ, the share of the jiffies
+ * of the interval since the last run, overall and for every core */
+#define CPU_METRICS 4
+#define HOT_CORES 3
+static const char *cpu_names[CPU_METRICS] = { "busy", "iowait", "steal", "softirq" };
+static double wcpu[CPU_METRICS] = { -1.0, -1.0, -1.0, -1.0 };
+static double ccpu[CPU_METRICS] = { -1.0, -1.0, -1.0, -1.0 };
+static int use_cpu = FALSE;
+
+/* --vitals: the load, memory, swap, users and zombies from one read of
+ * each source. Memory and swap have thresholds on what is free as with
+ * check_swap, BYTES or PERCENT% or both, 0 if not given; users and
+ * zombies ranges as with check_users and check_procs */
+typedef struct free_threshold {
+	double bytes;
+	int percent;
+} free_threshold;
+static int use_vitals = FALSE;
+static free_threshold wmem, cmem, wswap, cswap;
+static char *users_warn = NULL, *users_crit = NULL;
+static char *zombies_warn = NULL, *zombies_crit = NULL;
+static thresholds *users_thlds = NULL, *zombies_thlds = NULL;
+#endif
+
+/* -w and -c as given, they are percentages with --cgroup and --cpu */
+static char *percent_warn = NULL, *percent_crit = NULL;
 
 static void
 get_threshold(char *arg, double *th)
@@ -106,76 +182,73 @@ main (int argc, char **argv)
 	long numcpus;
 
 	double la[3] = { 0.0, 0.0, 0.0 };	/* NetBSD complains about unitialized arrays */
-#ifndef HAVE_GETLOADAVG
-	char input_buffer[MAX_INPUT_BUFFER];
-# ifdef HAVE_PROC_LOADAVG
-	FILE *fp;
-	char *str, *next;
-# endif
-#endif
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 	setlocale(LC_NUMERIC, "POSIX");
 
 	/* Parse extra opts if any */
 	argv = np_extra_opts (&argc, argv, progname);
 
+	np_init ((char *) progname, argc, argv);
+
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
-#ifdef HAVE_GETLOADAVG
-	result = getloadavg (la, 3);
-	if (result != 3)
-		return STATE_UNKNOWN;
-#else
-# ifdef HAVE_PROC_LOADAVG
-	fp = fopen (PROC_LOADAVG, "r");
-	if (fp == NULL) {
-		printf (_("Error opening %s\n"), PROC_LOADAVG);
-		return STATE_UNKNOWN;
-	}
+#ifdef HAVE_PSI
+	/* the load of the host says little about a cgroup, so only these count */
+	if (cgroup_pattern_count > 0) {
+		perf_buffer perf = PERF_BUFFER_INIT;
 
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-		str = (char *)input_buffer;
-		for(i = 0; i < 3; i++) {
-			la[i] = strtod(str, &next);
-			str = next;
-		}
+		status_line = "";
+		result = check_cgroups (&status_line, &perf);
+		if (use_psi)
+			result = max_state (result, check_pressure ());
+		printf ("%s - %s|%s", state_text (result), status_line, perf_string (&perf));
+		for (i = 0; use_psi && i < 3; i++)
+			printf (" %s", psi_perfdata (i));
+		putchar ('\n');
+		return result;
 	}
 
-	fclose (fp);
-# else
-	child_process = spopen (PATH_TO_UPTIME);
-	if (child_process == NULL) {
-		printf (_("Error opening %s\n"), PATH_TO_UPTIME);
-		return STATE_UNKNOWN;
+	if (use_vitals) {
+		perf_buffer perf = PERF_BUFFER_INIT;
+		np_proc_table table;
+
+		status_line = "";
+		result = check_vitals (&status_line, &perf, &table);
+		if (use_psi)
+			result = max_state (result, check_pressure ());
+		printf ("%s - %s|%s", state_text (result), status_line, perf_string (&perf));
+		for (i = 0; use_psi && i < 3; i++)
+			printf (" %s", psi_perfdata (i));
+		putchar ('\n');
+		if (n_procs_to_show > 0)
+			print_top_consuming_processes (&table);
+		else
+			np_ps_free (&table);
+		return result;
 	}
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
-	if (child_stderr == NULL) {
-		printf (_("Could not open stderr for %s\n"), PATH_TO_UPTIME);
-	}
-	fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process);
-    if(strstr(input_buffer, "load average:")) {
-	    sscanf (input_buffer, "%*[^l]load average: %lf, %lf, %lf", &la1, &la5, &la15);
-    }
-    else if(strstr(input_buffer, "load averages:")) {
-	    sscanf (input_buffer, "%*[^l]load averages: %lf, %lf, %lf", &la1, &la5, &la15);
-    }
-    else {
-		printf (_("could not parse load from uptime %s: %s\n"), PATH_TO_UPTIME, result);
-		return STATE_UNKNOWN;
-    }
 
-	result = spclose (child_process);
-	if (result) {
-		printf (_("Error code %d returned in %s\n"), result, PATH_TO_UPTIME);
-		return STATE_UNKNOWN;
+	if (use_cpu) {
+		perf_buffer perf = PERF_BUFFER_INIT;
+
+		status_line = "";
+		result = check_cpu (&status_line, &perf);
+		if (use_psi)
+			result = max_state (result, check_pressure ());
+		printf ("%s - %s|%s", state_text (result), status_line, perf_string (&perf));
+		for (i = 0; use_psi && i < 3; i++)
+			printf (" %s", psi_perfdata (i));
+		putchar ('\n');
+		return result;
 	}
-# endif
 #endif
 
+	/* gnulib supplies getloadavg() where the system does not */
+	result = getloadavg (la, 3);
+	if (result != 3)
+		die (STATE_UNKNOWN, _("Error in getloadavg()\n"));
+
 	if (take_into_account_cpus == 1) {
 		if ((numcpus = GET_NUMBER_OF_CPUS()) > 0) {
 			la[0] = la[0] / numcpus;
@@ -183,18 +256,8 @@ main (int argc, char **argv)
 			la[2] = la[2] / numcpus;
 		}
 	}
-	if ((la[0] < 0.0) || (la[1] < 0.0) || (la[2] < 0.0)) {
-#ifdef HAVE_GETLOADAVG
-		printf (_("Error in getloadavg()\n"));
-#else
-# ifdef HAVE_PROC_LOADAVG
-		printf (_("Error processing %s\n"), PROC_LOADAVG);
-# else
-		printf (_("Error processing %s\n"), PATH_TO_UPTIME);
-# endif
-#endif
-		return STATE_UNKNOWN;
-	}
+	if ((la[0] < 0.0) || (la[1] < 0.0) || (la[2] < 0.0))
+		die (STATE_UNKNOWN, _("Error in getloadavg()\n"));
 
 	/* we got this far, so assume OK until we've measured */
 	result = STATE_OK;
@@ -209,24 +272,692 @@ main (int argc, char **argv)
 		else if(la[i] > wload[i]) result = STATE_WARNING;
 	}
 
+#ifdef HAVE_PSI
+	if (use_psi)
+		result = max_state (result, check_pressure ());
+#endif
+
 	printf("%s - %s|", state_text(result), status_line);
 	for(i = 0; i < 3; i++)
 		printf("load%d=%.3f;%.3f;%.3f;0; ", nums[i], la[i], wload[i], cload[i]);
+#ifdef HAVE_PSI
+	for(i = 0; use_psi && i < 3; i++)
+		printf("%s ", psi_perfdata (i));
+#endif
 
 	putchar('\n');
 	if (n_procs_to_show > 0) {
-		print_top_consuming_processes();
+		print_top_consuming_processes(NULL);
 	}
 	return result;
 }
 
 
+#ifdef HAVE_PSI
+/* Read the share of time some tasks were stalled on each resource over the
+ * last psi_window seconds, from the "some" line of /proc/pressure/NAME */
+static int
+check_pressure (void)
+{
+	char path[64], line[MAX_INPUT_BUFFER], key[16];
+	int result = STATE_OK;
+	int i;
+	char *p;
+	FILE *fp;
+
+	snprintf (key, sizeof (key), "avg%d=", psi_window);
+	for (i = 0; i < 3; i++) {
+		snprintf (path, sizeof (path), "%s/%s", PROC_PRESSURE, psi_names[i]);
+		if ((fp = fopen (path, "r")) == NULL)
+			die (STATE_UNKNOWN, _("Cannot open %s: %s (is the kernel built with CONFIG_PSI?)\n"),
+			     path, strerror (errno));
+		psi[i] = -1.0;
+		while (fgets (line, sizeof (line), fp)) {
+			if (strncmp (line, "some ", 5) == 0 && (p = strstr (line, key)) != NULL) {
+				psi[i] = strtod (p + strlen (key), NULL);
+				break;
+			}
+		}
+		fclose (fp);
+		if (psi[i] < 0)
+			die (STATE_UNKNOWN, _("Could not parse %s\n"), path);
+
+		xasprintf (&status_line, "%s, %s pressure: %.2f%%", status_line, psi_names[i], psi[i]);
+		if (cpsi[i] >= 0 && psi[i] > cpsi[i])
+			result = STATE_CRITICAL;
+		else if (wpsi[i] >= 0 && psi[i] > wpsi[i])
+			result = max_state (result, STATE_WARNING);
+	}
+	return result;
+}
+
+static char *
+psi_perfdata (int i)
+{
+	char *label;
+
+	xasprintf (&label, "%s_pressure", psi_names[i]);
+	return fperfdata (label, psi[i], "%",
+	                  wpsi[i] >= 0, wpsi[i], cpsi[i] >= 0, cpsi[i],
+	                  TRUE, 0, TRUE, 100);
+}
+
+/* Like get_threshold(), but for n percentages, and a field left empty
+ * leaves that one without a threshold: "--pressure-warning=,20" only
+ * checks io */
+static void
+get_percent_threshold (char *arg, double *th, int n)
+{
+	char *str = arg, *p;
+	int i;
+
+	for (i = 0; i < n && str; i++) {
+		if (*str != ',' && *str != '\0') {
+			th[i] = strtod (str, &p);
+			if (p == str || (*p != ',' && *p != '\0') || th[i] < 0 || th[i] > 100)
+				usage2 (_("Thresholds must be percentages"), arg);
+			str = p;
+		}
+		str = *str == ',' ? str + 1 : NULL;
+	}
+}
+
+static int
+percent_state (double value, double warn, double crit)
+{
+	if (value < 0)
+		return STATE_OK;
+	if (crit >= 0 && value > crit)
+		return STATE_CRITICAL;
+	if (warn >= 0 && value > warn)
+		return STATE_WARNING;
+	return STATE_OK;
+}
+
+/* What a cgroup had been throttled up to a run, kept in the state sorted by
+ * the hash of its path, after the time of the run in microseconds */
+typedef struct cgroup_usage {
+	uint64_t id;
+	uint64_t periods;
+	uint64_t throttled;
+	uint64_t throttled_usec;
+} cgroup_usage;
+
+static int
+cgroup_usage_compare (const void *a, const void *b)
+{
+	const cgroup_usage *x = a, *y = b;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+/* FNV-1a */
+static uint64_t
+cgroup_id (const char *path)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *path; path++)
+		h = (h ^ (unsigned char) *path) * 1099511628211ULL;
+	return h;
+}
+
+/* nr_periods, nr_throttled and throttled_usec are only there with the cpu
+ * controller enabled, FALSE if the cgroup has no cpu.stat at all */
+static int
+read_cgroup_stat (const char *dir, cgroup_usage *u)
+{
+	char path[PATH_MAX], line[MAX_INPUT_BUFFER];
+	FILE *fp;
+
+	snprintf (path, sizeof (path), "%s/cpu.stat", dir);
+	if ((fp = fopen (path, "r")) == NULL)
+		return FALSE;
+	while (fgets (line, sizeof (line), fp)) {
+		if (strncmp (line, "nr_periods ", 11) == 0)
+			u->periods = strtoull (line + 11, NULL, 10);
+		else if (strncmp (line, "nr_throttled ", 13) == 0)
+			u->throttled = strtoull (line + 13, NULL, 10);
+		else if (strncmp (line, "throttled_usec ", 15) == 0)
+			u->throttled_usec = strtoull (line + 15, NULL, 10);
+	}
+	fclose (fp);
+	return TRUE;
+}
+
+/* the "some" share of cpu.pressure over psi_window, below 0 without PSI */
+static double
+read_cgroup_pressure (const char *dir)
+{
+	char path[PATH_MAX], line[MAX_INPUT_BUFFER], key[16];
+	double value = -1.0;
+	char *p;
+	FILE *fp;
+
+	snprintf (path, sizeof (path), "%s/cpu.pressure", dir);
+	if ((fp = fopen (path, "r")) == NULL)
+		return value;
+	snprintf (key, sizeof (key), "avg%d=", psi_window);
+	while (fgets (line, sizeof (line), fp))
+		if (strncmp (line, "some ", 5) == 0 && (p = strstr (line, key)) != NULL) {
+			value = strtod (p + strlen (key), NULL);
+			break;
+		}
+	fclose (fp);
+	return value;
+}
+
+/* Every cgroup the patterns match, relative to CGROUP_ROOT unless they are
+ * absolute. The status names the cgroups which are not OK, or with -v all
+ * of them; the perfdata has all of them. */
+static int
+check_cgroups (char **status, perf_buffer *perf)
+{
+	glob_t matches;
+	cgroup_usage *now, *then = NULL, *old, key;
+	state_data *previous;
+	struct timeval tv;
+	uint64_t now_time, then_time = 0;
+	size_t count = 0, then_count = 0, i;
+	int result = STATE_OK, state, states[STATE_UNKNOWN + 1] = { 0 }, flags = 0, j;
+	double throttled, throttled_ms, pressure, dt = 0;
+	const char *name;
+	char *pattern, *label;
+
+	memset (&matches, 0, sizeof (matches));
+	for (j = 0; j < cgroup_pattern_count; j++) {
+		if (cgroup_patterns[j][0] == '/')
+			pattern = cgroup_patterns[j];
+		else
+			xasprintf (&pattern, "%s/%s", CGROUP_ROOT, cgroup_patterns[j]);
+		glob (pattern, flags, NULL, &matches);
+		flags = GLOB_APPEND;
+	}
+	if (matches.gl_pathc == 0)
+		die (STATE_UNKNOWN, _("No cgroup matches %s\n"), cgroup_patterns[0]);
+
+	if ((now = calloc (matches.gl_pathc, sizeof (cgroup_usage))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	np_enable_state (NULL, 1);
+	previous = np_state_read ();
+	gettimeofday (&tv, NULL);
+	now_time = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+	if (previous != NULL && previous->data != NULL && previous->length >= (int) sizeof (uint64_t) &&
+	    (previous->length - sizeof (uint64_t)) % sizeof (cgroup_usage) == 0) {
+		memcpy (&then_time, previous->data, sizeof (uint64_t));
+		then_count = (previous->length - sizeof (uint64_t)) / sizeof (cgroup_usage);
+		if (then_count > 0 && (then = malloc (then_count * sizeof (cgroup_usage))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		if (then_count > 0)
+			memcpy (then, (char *) previous->data + sizeof (uint64_t), then_count * sizeof (cgroup_usage));
+		if (now_time > then_time)
+			dt = (now_time - then_time) / 1.0e6;
+	}
+
+	for (i = 0; i < matches.gl_pathc; i++) {
+		name = matches.gl_pathv[i];
+		if (strncmp (name, CGROUP_ROOT "/", strlen (CGROUP_ROOT) + 1) == 0)
+			name += strlen (CGROUP_ROOT) + 1;
+
+		if (!read_cgroup_stat (matches.gl_pathv[i], &now[count]))
+			continue;
+		now[count].id = cgroup_id (matches.gl_pathv[i]);
+		pressure = read_cgroup_pressure (matches.gl_pathv[i]);
+
+		/* the share of the periods since the last run it was throttled in */
+		throttled = throttled_ms = -1.0;
+		key.id = now[count].id;
+		old = then && dt > 0 ? bsearch (&key, then, then_count, sizeof (cgroup_usage), cgroup_usage_compare) : NULL;
+		if (old != NULL && now[count].periods >= old->periods && now[count].throttled >= old->throttled &&
+		    now[count].throttled_usec >= old->throttled_usec) {
+			throttled = now[count].periods > old->periods ?
+				100.0 * (now[count].throttled - old->throttled) / (now[count].periods - old->periods) : 0;
+			throttled_ms = (now[count].throttled_usec - old->throttled_usec) / 1000.0 / dt;
+		}
+		count++;
+
+		state = max_state (percent_state (throttled, wcg[0], ccg[0]), percent_state (pressure, wcg[1], ccg[1]));
+		result = max_state (result, state);
+		states[state]++;
+
+		if (state != STATE_OK || verbose) {
+			xasprintf (status, "%s%s %s (", *status, **status ? "," : "", name);
+			if (throttled >= 0)
+				xasprintf (status, _("%sthrottled %.1f%%"), *status, throttled);
+			else
+				xasprintf (status, _("%sno previous run"), *status);
+			if (pressure >= 0)
+				xasprintf (status, _("%s, pressure %.2f%%"), *status, pressure);
+			xasprintf (status, "%s)", *status);
+		}
+		if (throttled >= 0) {
+			xasprintf (&label, "%s_throttled", name);
+			fperfdata_append (perf, label, throttled, "%", wcg[0] >= 0, wcg[0], ccg[0] >= 0, ccg[0],
+			                  TRUE, 0, TRUE, 100);
+			free (label);
+			/* throttled_usec over the interval: ms throttled a second */
+			xasprintf (&label, "%s_throttled_time", name);
+			fperfdata_append (perf, label, throttled_ms, "ms", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+			free (label);
+		}
+		if (pressure >= 0) {
+			xasprintf (&label, "%s_pressure", name);
+			fperfdata_append (perf, label, pressure, "%", wcg[1] >= 0, wcg[1], ccg[1] >= 0, ccg[1],
+			                  TRUE, 0, TRUE, 100);
+			free (label);
+		}
+	}
+	globfree (&matches);
+
+	if (count == 0)
+		die (STATE_UNKNOWN, _("No cgroup with a cpu.stat matches %s\n"), cgroup_patterns[0]);
+
+	qsort (now, count, sizeof (cgroup_usage), cgroup_usage_compare);
+	{
+		char *data;
+		size_t length = sizeof (uint64_t) + count * sizeof (cgroup_usage);
+
+		if ((data = malloc (length)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		memcpy (data, &now_time, sizeof (uint64_t));
+		memcpy (data + sizeof (uint64_t), now, count * sizeof (cgroup_usage));
+		np_state_write_binary (0, data, length);
+		free (data);
+	}
+	free (now);
+	free (then);
+
+	xasprintf (status, _("%lu cgroups: %d critical, %d warning%s%s"), (unsigned long) count,
+	           states[STATE_CRITICAL], states[STATE_WARNING], **status ? ":" : "", *status);
+	return result;
+}
+/* The jiffies of a cpu line of /proc/stat, kept in the state sorted by id,
+ * the line of all of them being -1 */
+enum { CPU_USER, CPU_NICE, CPU_SYSTEM, CPU_IDLE, CPU_IOWAIT, CPU_IRQ, CPU_SOFTIRQ, CPU_STEAL, CPU_FIELDS };
+
+typedef struct cpu_jiffies {
+	int64_t id;
+	uint64_t field[CPU_FIELDS];
+} cpu_jiffies;
+
+/* what check_cpu() makes of a cpu line */
+typedef struct cpu_usage {
+	int64_t id;
+	double pct[CPU_METRICS];
+	int state;
+} cpu_usage;
+
+static int
+cpu_jiffies_compare (const void *a, const void *b)
+{
+	const cpu_jiffies *x = a, *y = b;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+/* busiest first */
+static int
+cpu_usage_compare (const void *a, const void *b)
+{
+	const cpu_usage *x = a, *y = b;
+
+	return (x->pct[0] < y->pct[0]) - (x->pct[0] > y->pct[0]);
+}
+
+/* Every cpu line of /proc/stat; guest time is part of user time already */
+static cpu_jiffies *
+read_cpu_stat (size_t *count)
+{
+	char line[MAX_INPUT_BUFFER], *p, *end;
+	cpu_jiffies *cpus = NULL;
+	size_t size = 0;
+	int i;
+	FILE *fp;
+
+	*count = 0;
+	if ((fp = fopen (PROC_STAT, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open %s: %s\n"), PROC_STAT, strerror (errno));
+	while (fgets (line, sizeof (line), fp)) {
+		if (strncmp (line, "cpu", 3) != 0)
+			continue;
+		if (*count == size) {
+			size = size ? size * 2 : 64;
+			if ((cpus = realloc (cpus, size * sizeof (cpu_jiffies))) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		}
+		memset (&cpus[*count], 0, sizeof (cpu_jiffies));
+		p = line + 3;
+		if (*p == ' ')
+			cpus[*count].id = -1;
+		else {
+			cpus[*count].id = strtoll (p, &end, 10);
+			if (end == p)
+				continue;
+			p = end;
+		}
+		/* older kernels have fewer fields, those stay 0 */
+		for (i = 0; i < CPU_FIELDS; i++) {
+			cpus[*count].field[i] = strtoull (p, &end, 10);
+			if (end == p)
+				break;
+			p = end;
+		}
+		(*count)++;
+	}
+	fclose (fp);
+	if (*count == 0)
+		die (STATE_UNKNOWN, _("Could not parse %s\n"), PROC_STAT);
+	qsort (cpus, *count, sizeof (cpu_jiffies), cpu_jiffies_compare);
+	return cpus;
+}
+
+/* The shares of the jiffies from then to now, or since boot without then.
+ * Some counters, iowait in particular, can go backwards; they count as 0. */
+static uint64_t
+cpu_interval (const cpu_jiffies *now, const cpu_jiffies *then, cpu_usage *u)
+{
+	uint64_t d[CPU_FIELDS], total = 0;
+	int i;
+
+	for (i = 0; i < CPU_FIELDS; i++) {
+		d[i] = now->field[i];
+		if (then != NULL)
+			d[i] = now->field[i] > then->field[i] ? now->field[i] - then->field[i] : 0;
+		total += d[i];
+	}
+	u->id = now->id;
+	if (total == 0) {
+		memset (u->pct, 0, sizeof (u->pct));
+		return 0;
+	}
+	u->pct[0] = 100.0 * (total - d[CPU_IDLE] - d[CPU_IOWAIT]) / total;
+	u->pct[1] = 100.0 * d[CPU_IOWAIT] / total;
+	u->pct[2] = 100.0 * d[CPU_STEAL] / total;
+	u->pct[3] = 100.0 * d[CPU_SOFTIRQ] / total;
+	return total;
+}
+
+/* Utilisation, iowait, steal and softirq from one read of /proc/stat
+ * against the jiffies the last run left in the state, of all CPUs and of
+ * each. The thresholds hold for both. The status names the busiest cores,
+ * or with -v all of them, and those which are not OK. */
+static int
+check_cpu (char **status, perf_buffer *perf)
+{
+	cpu_jiffies *now, *then = NULL, *old;
+	cpu_usage *usage, all;
+	state_data *previous;
+	size_t count, then_count = 0, cores = 0, i;
+	uint64_t total;
+	int result = STATE_OK, j;
+	long hz;
+	char *label, *hot = "", *bad = "";
+
+	now = read_cpu_stat (&count);
+
+	np_enable_state (NULL, 1);
+	previous = np_state_read ();
+	if (previous != NULL && previous->data != NULL && previous->length > 0 &&
+	    previous->length % sizeof (cpu_jiffies) == 0) {
+		then_count = previous->length / sizeof (cpu_jiffies);
+		if ((then = malloc (previous->length)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		memcpy (then, previous->data, previous->length);
+	}
+	np_state_write_binary (0, now, count * sizeof (cpu_jiffies));
+
+	if ((usage = calloc (count, sizeof (cpu_usage))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	all.id = -2;
+	total = 0;
+	for (i = 0; i < count; i++) {
+		old = then ? bsearch (&now[i], then, then_count, sizeof (cpu_jiffies), cpu_jiffies_compare) : NULL;
+		/* the aggregate line sorts first */
+		if (now[i].id < 0) {
+			total = cpu_interval (&now[i], old, &all);
+			continue;
+		}
+		cpu_interval (&now[i], old, &usage[cores]);
+		for (j = 0; j < CPU_METRICS; j++)
+			usage[cores].state = max_state (usage[cores].state,
+			                                percent_state (usage[cores].pct[j], wcpu[j], ccpu[j]));
+		cores++;
+	}
+	if (all.id != -1)
+		die (STATE_UNKNOWN, _("Could not parse %s\n"), PROC_STAT);
+
+	xasprintf (status, _("CPU %s %.1f%%"), cpu_names[0], all.pct[0]);
+	for (j = 1; j < CPU_METRICS; j++)
+		xasprintf (status, "%s, %s %.1f%%", *status, cpu_names[j], all.pct[j]);
+	if ((hz = sysconf (_SC_CLK_TCK)) > 0 && cores > 0)
+		xasprintf (status, then ? _("%s over %.0fs") : _("%s since boot"), *status,
+		           (double) total / cores / hz);
+
+	for (j = 0; j < CPU_METRICS; j++) {
+		result = max_state (result, percent_state (all.pct[j], wcpu[j], ccpu[j]));
+		xasprintf (&label, "cpu_%s", cpu_names[j]);
+		fperfdata_append (perf, label, all.pct[j], "%", wcpu[j] >= 0, wcpu[j], ccpu[j] >= 0, ccpu[j],
+		                  TRUE, 0, TRUE, 100);
+		free (label);
+	}
+	for (i = 0; i < cores; i++) {
+		result = max_state (result, usage[i].state);
+		if (usage[i].state != STATE_OK)
+			xasprintf (&bad, "%s%scpu%lld %s", bad, *bad ? ", " : "", (long long) usage[i].id,
+			           state_text (usage[i].state));
+		for (j = 0; j < CPU_METRICS; j++) {
+			xasprintf (&label, "cpu%lld_%s", (long long) usage[i].id, cpu_names[j]);
+			fperfdata_append (perf, label, usage[i].pct[j], "%", wcpu[j] >= 0, wcpu[j], ccpu[j] >= 0, ccpu[j],
+			                  TRUE, 0, TRUE, 100);
+			free (label);
+		}
+	}
+
+	qsort (usage, cores, sizeof (cpu_usage), cpu_usage_compare);
+	for (i = 0; i < cores && (verbose || i < HOT_CORES); i++)
+		xasprintf (&hot, "%s%scpu%lld %.1f%%", hot, *hot ? ", " : "", (long long) usage[i].id, usage[i].pct[0]);
+	if (*hot)
+		xasprintf (status, _("%s; busiest: %s"), *status, hot);
+	if (*bad)
+		xasprintf (status, _("%s; out of thresholds: %s"), *status, bad);
+
+	free (usage);
+	free (then);
+	free (now);
+	return result;
+}
+
+/* the syntax of the -w and -c of check_swap */
+static void
+get_free_threshold (char *arg, free_threshold *th)
+{
+	float bytes;
+
+	if (is_intnonneg (arg))
+		th->bytes = atof (arg);
+	else if (strchr (arg, ',') && strchr (arg, '%') && sscanf (arg, "%f,%d%%", &bytes, &th->percent) == 2)
+		th->bytes = floorf (bytes);
+	else if (!strchr (arg, '%') || sscanf (arg, "%d%%", &th->percent) != 1)
+		usage2 (_("Memory and swap thresholds must be an integer (bytes) or a percentage"), arg);
+}
+
+static int
+free_state (double free_bytes, double total_bytes, const free_threshold *warn, const free_threshold *crit)
+{
+	double percent = total_bytes > 0 ? 100 * free_bytes / total_bytes : 0;
+
+	if ((crit->percent && percent <= crit->percent) || (crit->bytes > 0 && free_bytes <= crit->bytes))
+		return STATE_CRITICAL;
+	if ((warn->percent && percent <= warn->percent) || (warn->bytes > 0 && free_bytes <= warn->bytes))
+		return STATE_WARNING;
+	return STATE_OK;
+}
+
+/* the larger of the two thresholds in MB, as the perfdata of check_swap */
+static long
+free_threshold_mb (const free_threshold *th, double total_mb)
+{
+	return (long) max (th->bytes / (1024 * 1024), th->percent / 100.0 * total_mb);
+}
+
+/* "memory 60% available (4800 MB of 8000 MB)" and the perfdata */
+static int
+vitals_free (char **status, perf_buffer *perf, const char *name, const char *what,
+             double free_kb, double total_kb, const free_threshold *warn, const free_threshold *crit)
+{
+	long free_mb = free_kb / 1024, total_mb = total_kb / 1024;
+	int state = free_state (free_kb * 1024, total_kb * 1024, warn, crit);
+
+	xasprintf (status, _("%s, %s %.0f%% %s (%ld MB of %ld MB)%s%s"), *status, name,
+	           total_kb > 0 ? 100 * free_kb / total_kb : 0.0, what, free_mb, total_mb,
+	           state != STATE_OK ? " " : "", state != STATE_OK ? state_text (state) : "");
+	perfdata_append (perf, name, free_mb, "MB",
+	                 warn->bytes > 0 || warn->percent, free_threshold_mb (warn, total_mb),
+	                 crit->bytes > 0 || crit->percent, free_threshold_mb (crit, total_mb),
+	                 TRUE, 0, TRUE, total_mb);
+	return state;
+}
+
+/* a count judged like the users of check_users or the procs of check_procs */
+static int
+vitals_count (char **status, perf_buffer *perf, const char *name, const char *text,
+              long count, thresholds *th)
+{
+	int state = get_status ((double) count, th);
+
+	xasprintf (status, "%s, %ld %s%s%s", *status, count, text,
+	           state != STATE_OK ? " " : "", state != STATE_OK ? state_text (state) : "");
+	perfdata_append (perf, name, count, "",
+	                 th->warning != NULL, th->warning ? (long) th->warning->end : 0,
+	                 th->critical != NULL, th->critical ? (long) th->critical->end : 0,
+	                 TRUE, 0, FALSE, 0);
+	return state;
+}
+
+/* --vitals: what check_load, check_swap, check_users and check_procs -s Z
+ * would say, from PROC_LOADAVG, PROC_MEMINFO, utmpx and one pass over the
+ * processes, which also gives the busiest -n of them in table */
+static int
+check_vitals (char **status, perf_buffer *perf, np_proc_table *table)
+{
+	static const char *fields[] = {
+		"MemTotal:", "MemFree:", "MemAvailable:", "Buffers:", "Cached:", "SwapTotal:", "SwapFree:"
+	};
+	enum { MEM_TOTAL, MEM_FREE, MEM_AVAILABLE, BUFFERS, CACHED, SWAP_TOTAL, SWAP_FREE, FIELDS };
+	double kb[FIELDS] = { 0 }, la[3];
+	int have[FIELDS] = { 0 };
+	char line[MAX_INPUT_BUFFER], *label;
+	long numcpus, running = 0, tasks = 0, users = -1;
+	int result = STATE_OK, state, i;
+	size_t len;
+	FILE *fp;
+#if HAVE_UTMPX_H
+	struct utmpx *ut;
+#endif
+
+	if ((fp = fopen (PROC_LOADAVG, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open %s: %s\n"), PROC_LOADAVG, strerror (errno));
+	if (fscanf (fp, "%lf %lf %lf %ld/%ld", &la[0], &la[1], &la[2], &running, &tasks) < 3)
+		die (STATE_UNKNOWN, _("Could not parse %s\n"), PROC_LOADAVG);
+	fclose (fp);
+
+	if ((fp = fopen (PROC_MEMINFO, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open %s: %s\n"), PROC_MEMINFO, strerror (errno));
+	while (fgets (line, sizeof (line), fp)) {
+		for (i = 0; i < FIELDS; i++) {
+			len = strlen (fields[i]);
+			if (!strncmp (line, fields[i], len)) {
+				kb[i] = np_strtod (line + len, NULL);
+				have[i] = TRUE;
+				break;
+			}
+		}
+	}
+	fclose (fp);
+	if (!have[MEM_TOTAL])
+		die (STATE_UNKNOWN, _("Could not parse %s\n"), PROC_MEMINFO);
+	/* kernels before 3.14 do not estimate it */
+	if (!have[MEM_AVAILABLE])
+		kb[MEM_AVAILABLE] = kb[MEM_FREE] + kb[BUFFERS] + kb[CACHED];
+
+#if HAVE_UTMPX_H
+	users = 0;
+	setutxent ();
+	while ((ut = getutxent ()) != NULL)
+		if (ut->ut_type == USER_PROCESS)
+			users++;
+	endutxent ();
+#endif
+
+	if (np_ps_top (table, (size_t) n_procs_to_show, ps_cache_ttl) != 0)
+		die (STATE_UNKNOWN, _("'%s' exited with non-zero status.\n"), PS_COMMAND);
+
+	/* the load as check_load judges it */
+	if (take_into_account_cpus == 1 && (numcpus = GET_NUMBER_OF_CPUS ()) > 0)
+		for (i = 0; i < 3; i++)
+			la[i] /= numcpus;
+	state = STATE_OK;
+	for (i = 0; i < 3; i++) {
+		if (cload[i] >= 0 && la[i] > cload[i])
+			state = STATE_CRITICAL;
+		else if (wload[i] >= 0 && la[i] > wload[i])
+			state = max_state (state, STATE_WARNING);
+		xasprintf (&label, "load%d", nums[i]);
+		fperfdata_append (perf, label, la[i], "", wload[i] >= 0, wload[i], cload[i] >= 0, cload[i],
+		                  TRUE, 0, FALSE, 0);
+		free (label);
+	}
+	xasprintf (status, _("load average: %.2f, %.2f, %.2f%s%s"), la[0], la[1], la[2],
+	           state != STATE_OK ? " " : "", state != STATE_OK ? state_text (state) : "");
+	result = max_state (result, state);
+
+	result = max_state (result, vitals_free (status, perf, "memory", _("available"),
+	                    kb[MEM_AVAILABLE], kb[MEM_TOTAL], &wmem, &cmem));
+	if (kb[SWAP_TOTAL] > 0)
+		result = max_state (result, vitals_free (status, perf, "swap", _("free"),
+		                    kb[SWAP_FREE], kb[SWAP_TOTAL], &wswap, &cswap));
+	else
+		xasprintf (status, _("%s, no swap"), *status);
+
+	if (users >= 0)
+		result = max_state (result, vitals_count (status, perf, "users", _("users"), users, users_thlds));
+	result = max_state (result, vitals_count (status, perf, "zombies", _("zombies"),
+	                    (long) table->zombies, zombies_thlds));
+	xasprintf (status, _("%s of %lu processes"), *status, (unsigned long) table->seen);
+	perfdata_append (perf, "procs", (long) table->seen, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+	if (tasks > 0)
+		perfdata_append (perf, "running", running, "", FALSE, 0, FALSE, 0, TRUE, 0, TRUE, tasks);
+
+	return result;
+}
+#endif /* HAVE_PSI */
+
+
 /* process command-line arguments */
 static int
 process_arguments (int argc, char **argv)
 {
 	int c = 0;
 
+	enum {
+		PS_CACHE_OPTION = CHAR_MAX + 1,
+		PRESSURE_WARNING_OPTION,
+		PRESSURE_CRITICAL_OPTION,
+		PRESSURE_WINDOW_OPTION,
+		CGROUP_OPTION,
+		CPU_OPTION,
+		VITALS_OPTION,
+		MEMORY_WARNING_OPTION,
+		MEMORY_CRITICAL_OPTION,
+		SWAP_WARNING_OPTION,
+		SWAP_CRITICAL_OPTION,
+		USERS_WARNING_OPTION,
+		USERS_CRITICAL_OPTION,
+		ZOMBIES_WARNING_OPTION,
+		ZOMBIES_CRITICAL_OPTION
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"warning", required_argument, 0, 'w'},
@@ -235,6 +966,22 @@ process_arguments (int argc, char **argv)
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{"procs-to-show", required_argument, 0, 'n'},
+		{"ps-cache", required_argument, 0, PS_CACHE_OPTION},
+		{"pressure-warning", required_argument, 0, PRESSURE_WARNING_OPTION},
+		{"pressure-critical", required_argument, 0, PRESSURE_CRITICAL_OPTION},
+		{"pressure-window", required_argument, 0, PRESSURE_WINDOW_OPTION},
+		{"cgroup", required_argument, 0, CGROUP_OPTION},
+		{"cpu", no_argument, 0, CPU_OPTION},
+		{"vitals", no_argument, 0, VITALS_OPTION},
+		{"memory-warning", required_argument, 0, MEMORY_WARNING_OPTION},
+		{"memory-critical", required_argument, 0, MEMORY_CRITICAL_OPTION},
+		{"swap-warning", required_argument, 0, SWAP_WARNING_OPTION},
+		{"swap-critical", required_argument, 0, SWAP_CRITICAL_OPTION},
+		{"users-warning", required_argument, 0, USERS_WARNING_OPTION},
+		{"users-critical", required_argument, 0, USERS_CRITICAL_OPTION},
+		{"zombies-warning", required_argument, 0, ZOMBIES_WARNING_OPTION},
+		{"zombies-critical", required_argument, 0, ZOMBIES_CRITICAL_OPTION},
+		{"verbose", no_argument, 0, 'v'},
 		{0, 0, 0, 0}
 	};
 
@@ -242,17 +989,20 @@ process_arguments (int argc, char **argv)
 		return ERROR;
 
 	while (1) {
-		c = getopt_long (argc, argv, "Vhrc:w:n:", longopts, &option);
+		c = getopt_long (argc, argv, "Vvhrc:w:n:", longopts, &option);
 
 		if (c == -1 || c == EOF)
 			break;
 
 		switch (c) {
 		case 'w': /* warning time threshold */
-			get_threshold(optarg, wload);
+			percent_warn = optarg;
 			break;
 		case 'c': /* critical time threshold */
-			get_threshold(optarg, cload);
+			percent_crit = optarg;
+			break;
+		case 'v':
+			verbose++;
 			break;
 		case 'r': /* Divide load average by number of CPUs */
 			take_into_account_cpus = 1;
@@ -266,11 +1016,125 @@ process_arguments (int argc, char **argv)
 		case 'n':
 			n_procs_to_show = atoi(optarg);
 			break;
+		case PS_CACHE_OPTION:
+			if (!is_intnonneg (optarg))
+				usage2 (_("Process table cache time must be an integer (seconds)"), optarg);
+			ps_cache_ttl = atoi (optarg);
+			break;
+		case PRESSURE_WARNING_OPTION:
+		case PRESSURE_CRITICAL_OPTION:
+		case PRESSURE_WINDOW_OPTION:
+#ifdef HAVE_PSI
+			use_psi = TRUE;
+			if (c == PRESSURE_WINDOW_OPTION) {
+				psi_window = atoi (optarg);
+				if (psi_window != 10 && psi_window != 60 && psi_window != 300)
+					usage2 (_("Pressure window must be 10, 60 or 300 (seconds)"), optarg);
+			} else
+				get_percent_threshold (optarg, c == PRESSURE_WARNING_OPTION ? wpsi : cpsi, 3);
+			break;
+#else
+			usage4 (_("Pressure stall information is only available on Linux"));
+#endif
+		case CGROUP_OPTION:
+#ifdef HAVE_PSI
+			if ((cgroup_patterns = realloc (cgroup_patterns, (cgroup_pattern_count + 1) * sizeof (char *))) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			cgroup_patterns[cgroup_pattern_count++] = optarg;
+			break;
+#else
+			usage4 (_("Cgroups can only be checked on Linux"));
+#endif
+		case CPU_OPTION:
+#ifdef HAVE_PSI
+			use_cpu = TRUE;
+			break;
+#else
+			usage4 (_("CPU utilisation can only be checked on Linux"));
+#endif
+		case VITALS_OPTION:
+		case MEMORY_WARNING_OPTION:
+		case MEMORY_CRITICAL_OPTION:
+		case SWAP_WARNING_OPTION:
+		case SWAP_CRITICAL_OPTION:
+		case USERS_WARNING_OPTION:
+		case USERS_CRITICAL_OPTION:
+		case ZOMBIES_WARNING_OPTION:
+		case ZOMBIES_CRITICAL_OPTION:
+#ifdef HAVE_PSI
+			use_vitals = TRUE;
+			if (c == MEMORY_WARNING_OPTION || c == MEMORY_CRITICAL_OPTION)
+				get_free_threshold (optarg, c == MEMORY_WARNING_OPTION ? &wmem : &cmem);
+			else if (c == SWAP_WARNING_OPTION || c == SWAP_CRITICAL_OPTION)
+				get_free_threshold (optarg, c == SWAP_WARNING_OPTION ? &wswap : &cswap);
+			else if (c == USERS_WARNING_OPTION)
+				users_warn = optarg;
+			else if (c == USERS_CRITICAL_OPTION)
+				users_crit = optarg;
+			else if (c == ZOMBIES_WARNING_OPTION)
+				zombies_warn = optarg;
+			else if (c == ZOMBIES_CRITICAL_OPTION)
+				zombies_crit = optarg;
+			break;
+#else
+			usage4 (_("The vitals can only be checked on Linux"));
+#endif
 		case '?':									/* help */
 			usage5 ();
 		}
 	}
 
+#ifdef HAVE_PSI
+	/* -w and -c stay those of the load, but need not be given */
+	if (use_vitals) {
+		if (use_cpu || cgroup_pattern_count > 0)
+			usage4 (_("--vitals cannot be combined with --cpu or --cgroup"));
+		for (c = 0; c < 3; c++)
+			wload[c] = cload[c] = -1.0;
+		if (percent_warn)
+			get_threshold (percent_warn, wload);
+		if (percent_crit)
+			get_threshold (percent_crit, cload);
+		for (c = 0; c < 3; c++)
+			if (wload[c] >= 0 && cload[c] >= 0 && wload[c] > cload[c])
+				die (STATE_UNKNOWN, _("Parameter inconsistency: %d-minute \"warning load\" is greater than \"critical load\"\n"), nums[c]);
+		set_thresholds (&users_thlds, users_warn, users_crit);
+		set_thresholds (&zombies_thlds, zombies_warn, zombies_crit);
+		return OK;
+	}
+
+	/* -w and -c are the thresholds of each cgroup then */
+	if (cgroup_pattern_count > 0) {
+		if (use_cpu)
+			usage4 (_("--cgroup and --cpu cannot be combined"));
+		if (percent_warn)
+			get_percent_threshold (percent_warn, wcg, 3);
+		if (percent_crit)
+			get_percent_threshold (percent_crit, ccg, 3);
+		for (c = 0; c < 2; c++)
+			if (wcg[c] >= 0 && ccg[c] >= 0 && wcg[c] > ccg[c])
+				die (STATE_UNKNOWN, _("Parameter inconsistency: cgroup \"warning\" is greater than \"critical\"\n"));
+		return OK;
+	}
+
+	/* and of each CPU metric with --cpu */
+	if (use_cpu) {
+		if (percent_warn)
+			get_percent_threshold (percent_warn, wcpu, CPU_METRICS);
+		if (percent_crit)
+			get_percent_threshold (percent_crit, ccpu, CPU_METRICS);
+		for (c = 0; c < CPU_METRICS; c++)
+			if (wcpu[c] >= 0 && ccpu[c] >= 0 && wcpu[c] > ccpu[c])
+				die (STATE_UNKNOWN, _("Parameter inconsistency: %s \"warning\" is greater than \"critical\"\n"), cpu_names[c]);
+		return OK;
+	}
+#endif
+
+	if (percent_warn)
+		get_threshold(percent_warn, wload);
+	if (percent_crit)
+		get_threshold(percent_crit, cload);
+
 	c = optind;
 	if (c == argc)
 		return validate_arguments ();
@@ -304,6 +1168,10 @@ validate_arguments (void)
 			die (STATE_UNKNOWN, _("Warning threshold for %d-minute load average is not specified\n"), nums[i]);
 		if(wload[i] > cload[i])
 			die (STATE_UNKNOWN, _("Parameter inconsistency: %d-minute \"warning load\" is greater than \"critical load\"\n"), nums[i]);
+#ifdef HAVE_PSI
+		if(wpsi[i] >= 0 && cpsi[i] >= 0 && wpsi[i] > cpsi[i])
+			die (STATE_UNKNOWN, _("Parameter inconsistency: %s \"warning pressure\" is greater than \"critical pressure\"\n"), psi_names[i]);
+#endif
 	}
 
 	return OK;
@@ -338,6 +1206,46 @@ print_help (void)
   printf (" %s\n", "-n, --procs-to-show=NUMBER_OF_PROCS");
   printf ("    %s\n", _("Number of processes to show when printing the top consuming processes."));
   printf ("    %s\n", _("NUMBER_OF_PROCS=0 disables this feature. Default value is 0"));
+#ifdef HAVE_PSI
+  printf (" %s\n", "--pressure-warning=WCPU,WIO,WMEMORY");
+  printf ("    %s\n", _("Exit with WARNING status if the share of time some tasks were stalled"));
+  printf ("    %s\n", _("on cpu, io or memory exceeds the percentage given (see /proc/pressure)."));
+  printf ("    %s\n", _("An empty field leaves that resource without a threshold."));
+  printf (" %s\n", "--pressure-critical=CCPU,CIO,CMEMORY");
+  printf ("    %s\n", _("Exit with CRITICAL status if the stall share exceeds the percentage given"));
+  printf (" %s\n", "--pressure-window=10|60|300");
+  printf ("    %s\n", _("Average the stall share over that many seconds (default: 10)"));
+  printf (" %s\n", "--cgroup=PATTERN");
+  printf ("    %s\n", _("Check each cgroup (v2) PATTERN matches instead of the load average, may be"));
+  printf ("    %s %s %s\n", _("given more than once. PATTERN is a glob under"), CGROUP_ROOT, _("unless it"));
+  printf ("    %s\n", _("is absolute. -w and -c are THROTTLED,PRESSURE for every cgroup then: the"));
+  printf ("    %s\n", _("percentage of CPU periods it was throttled in since the last run (from"));
+  printf ("    %s\n", _("cpu.stat) and of the time some of its tasks were stalled on the CPU (from"));
+  printf ("    %s\n", _("cpu.pressure, over --pressure-window). An empty field means no threshold."));
+  printf (" %s\n", "--cpu");
+  printf ("    %s %s %s\n", _("Check the CPU utilisation since the last run instead of the load average,"), _("from"), PROC_STAT);
+  printf ("    %s\n", _("-w and -c are BUSY,IOWAIT,STEAL,SOFTIRQ then, the percentage of the time"));
+  printf ("    %s\n", _("not idle, waiting for io, stolen by the hypervisor and in softirqs, both of"));
+  printf ("    %s\n", _("all CPUs and of each core. An empty field means no threshold."));
+  printf (" %s\n", "-v, --verbose");
+  printf ("    %s\n", _("With --cgroup, list every cgroup, not just those out of their thresholds;"));
+  printf ("    %s\n", _("with --cpu, every core by utilisation, not just the busiest three"));
+  printf (" %s\n", "--vitals");
+  printf ("    %s %s, %s\n", _("Check the load, memory, swap, logged in users and zombies at once, from"), PROC_LOADAVG, PROC_MEMINFO);
+  printf ("    %s\n", _("utmpx and one pass over the processes. -w and -c are the load thresholds"));
+  printf ("    %s\n", _("as usual but optional, each part is judged on its own and the worst state"));
+  printf ("    %s\n", _("is returned. Any of the following implies --vitals"));
+  printf (" %s\n", "--memory-warning=INTEGER|PERCENT%, --memory-critical=INTEGER|PERCENT%");
+  printf ("    %s\n", _("The bytes or percentage of the memory available at most, as -w and -c of"));
+  printf ("    %s\n", _("check_swap"));
+  printf (" %s\n", "--swap-warning=INTEGER|PERCENT%, --swap-critical=INTEGER|PERCENT%");
+  printf ("    %s\n", _("The same for the swap free, which is not checked if there is none"));
+  printf (" %s\n", "--users-warning=RANGE, --users-critical=RANGE");
+  printf ("    %s\n", _("The range of logged in users, as with check_users"));
+  printf (" %s\n", "--zombies-warning=RANGE, --zombies-critical=RANGE");
+  printf ("    %s\n", _("The range of zombie processes, as with check_procs -s Z"));
+#endif
+	printf (UT_PS_CACHE);
 
 	printf (UT_SUPPORT);
 }
@@ -347,47 +1255,46 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
   printf ("%s [-r] -w WLOAD1,WLOAD5,WLOAD15 -c CLOAD1,CLOAD5,CLOAD15 [-n NUMBER_OF_PROCS]\n", progname);
+  printf ("[--ps-cache=SECONDS] [--pressure-warning=WCPU,WIO,WMEMORY]\n");
+  printf ("[--pressure-critical=CCPU,CIO,CMEMORY] [--pressure-window=10|60|300]\n");
+  printf ("%s --cgroup=PATTERN [-w WTHROTTLED,WPRESSURE] [-c CTHROTTLED,CPRESSURE] [-v]\n", progname);
+  printf ("%s --cpu [-w WBUSY,WIOWAIT,WSTEAL,WSOFTIRQ] [-c CBUSY,CIOWAIT,CSTEAL,CSOFTIRQ] [-v]\n", progname);
+  printf ("%s --vitals [-r] [-w WLOAD1,WLOAD5,WLOAD15] [-c CLOAD1,CLOAD5,CLOAD15] [-n NUMBER_OF_PROCS]\n", progname);
+  printf ("[--memory-warning=LIMIT] [--memory-critical=LIMIT] [--swap-warning=LIMIT]\n");
+  printf ("[--swap-critical=LIMIT] [--users-warning=RANGE] [--users-critical=RANGE]\n");
+  printf ("[--zombies-warning=RANGE] [--zombies-critical=RANGE]\n");
 }
 
-#ifdef PS_USES_PROCPCPU
-int cmpstringp(const void *p1, const void *p2) {
-	int procuid = 0;
-	int procpid = 0;
-	int procppid = 0;
-	int procvsz = 0;
-	int procrss = 0;
-	float procpcpu = 0;
-	char procstat[8];
-#ifdef PS_USES_PROCETIME
-	char procetime[MAX_INPUT_BUFFER];
-#endif /* PS_USES_PROCETIME */
-	char procprog[MAX_INPUT_BUFFER];
-	int pos;
-	sscanf (* (char * const *) p1, PS_FORMAT, PS_VARLIST);
-	float procpcpu1 = procpcpu;
-	sscanf (* (char * const *) p2, PS_FORMAT, PS_VARLIST);
-	return procpcpu1 < procpcpu;
-}
-#endif /* PS_USES_PROCPCPU */
-
-static int print_top_consuming_processes() {
-	int i = 0;
-	struct output chld_out, chld_err;
-	if(np_runcmd(PS_COMMAND, &chld_out, &chld_err, 0) != 0){
+/* from the snapshot taken already, or else a new one */
+static int print_top_consuming_processes(np_proc_table *snapshot) {
+	size_t i = 0;
+	np_proc_table table;
+	np_proc *proc;
+	if (snapshot != NULL)
+		table = *snapshot;
+	else if(np_ps_top(&table, (size_t) n_procs_to_show, ps_cache_ttl) != 0){
 		fprintf(stderr, _("'%s' exited with non-zero status.\n"), PS_COMMAND);
 		return STATE_UNKNOWN;
 	}
-	if (chld_out.lines < 2) {
+	if (table.count < 1) {
 		fprintf(stderr, _("some error occurred getting procs list.\n"));
 		return STATE_UNKNOWN;
 	}
-#ifdef PS_USES_PROCPCPU
-	qsort(chld_out.line + 1, chld_out.lines - 1, sizeof(char*), cmpstringp);
-#endif /* PS_USES_PROCPCPU */
-	int lines_to_show = chld_out.lines < (n_procs_to_show + 1)
-			? chld_out.lines : n_procs_to_show + 1;
-	for (i = 0; i < lines_to_show; i += 1) {
-		printf("%s\n", chld_out.line[i]);
+	/* from /proc there is no ps output, so lay it out the same way */
+	if (table.out.lines == 0)
+		printf("%-4s %5s %5s %5s %7s %6s %4s %-15s %s\n",
+		       "STAT", "UID", "PID", "PPID", "VSZ", "RSS", "%CPU", "COMMAND", "COMMAND");
+	else
+		printf("%s\n", table.out.line[0]);
+	for (i = 0; i < table.count && i < (size_t) n_procs_to_show; i += 1) {
+		proc = &table.procs[i];
+		if (table.out.lines == 0)
+			printf("%-4s %5d %5d %5d %7d %6d %4.1f %-15s %s\n", proc->stat, proc->uid,
+			       (int) proc->pid, (int) proc->ppid, proc->vsz, proc->rss, proc->pcpu,
+			       proc->prog, proc->args);
+		else
+			printf("%s\n", proc->line);
 	}
+	np_ps_free(&table);
 	return OK;
 }
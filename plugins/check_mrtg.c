@@ -35,11 +35,29 @@ const char *email = "devel@monitoring-plugins.org";
 
 #include "common.h"
 #include "utils.h"
+#include "mrtgutils.h"
+
+/* --log checks several logs in one run, each with the options given
+ * before it */
+#define LOG_OPTION CHAR_MAX+1
+
+typedef struct value_log {
+	char *file;
+	char *name;
+	int expire_minutes;
+	int use_average;
+	int variable_number;
+	unsigned long value_warning_threshold;
+	unsigned long value_critical_threshold;
+	char *label;
+	char *units;
+} value_log;
 
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
+int check_logs (void);
 
 char *log_file = NULL;
 int expire_minutes = 0;
@@ -49,24 +67,18 @@ unsigned long value_warning_threshold = 0L;
 unsigned long value_critical_threshold = 0L;
 char *label;
 char *units;
+value_log *logs = NULL;
+size_t logs_count = 0;
 
 int
 main (int argc, char **argv)
 {
 	int result = STATE_OK;
-	FILE *fp;
-	int line;
-	char input_buffer[MAX_INPUT_BUFFER];
-	char *temp_buffer;
+	mrtg_entry entry;
 	time_t current_time;
-	time_t timestamp = 0L;
-	unsigned long average_value_rate = 0L;
-	unsigned long maximum_value_rate = 0L;
 	unsigned long rate = 0L;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -74,56 +86,16 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments\n"));
 
-	/* open the MRTG log file for reading */
-	fp = fopen (log_file, "r");
-	if (fp == NULL) {
+	if (logs_count > 0)
+		return check_logs ();
+
+	/* read the newest entry of the MRTG log file */
+	switch (mrtg_read_latest (log_file, &entry)) {
+	case MRTG_LOG_OPEN_ERROR:
 		printf (_("Unable to open MRTG log file\n"));
 		return STATE_UNKNOWN;
-	}
-
-	line = 0;
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-
-		line++;
-
-		/* skip the first line of the log file */
-		if (line == 1)
-			continue;
-
-		/* break out of read loop if we've passed the number of entries we want to read */
-		if (line > 2)
-			break;
-
-		/* grab the timestamp */
-		temp_buffer = strtok (input_buffer, " ");
-		timestamp = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the average value 1 rate */
-		temp_buffer = strtok (NULL, " ");
-		if (variable_number == 1)
-			average_value_rate = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the average value 2 rate */
-		temp_buffer = strtok (NULL, " ");
-		if (variable_number == 2)
-			average_value_rate = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the maximum value 1 rate */
-		temp_buffer = strtok (NULL, " ");
-		if (variable_number == 1)
-			maximum_value_rate = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the maximum value 2 rate */
-		temp_buffer = strtok (NULL, " ");
-		if (variable_number == 2)
-			maximum_value_rate = strtoul (temp_buffer, NULL, 10);
-	}
-
-	/* close the log file */
-	fclose (fp);
-
-	/* if we couldn't read enough data, return an unknown error */
-	if (line <= 2) {
+	case MRTG_LOG_PARSE_ERROR:
+		/* if we couldn't read enough data, return an unknown error */
 		printf (_("Unable to process MRTG log file\n"));
 		return STATE_UNKNOWN;
 	}
@@ -131,17 +103,17 @@ main (int argc, char **argv)
 	/* make sure the MRTG data isn't too old */
 	time (&current_time);
 	if (expire_minutes > 0
-			&& (current_time - timestamp) > (expire_minutes * 60)) {
+			&& (current_time - entry.timestamp) > (expire_minutes * 60)) {
 		printf (_("MRTG data has expired (%d minutes old)\n"),
-		        (int) ((current_time - timestamp) / 60));
+		        (int) ((current_time - entry.timestamp) / 60));
 		return STATE_WARNING;
 	}
 
 	/* else check the incoming/outgoing rates */
 	if (use_average == TRUE)
-		rate = average_value_rate;
+		rate = entry.average[variable_number - 1];
 	else
-		rate = maximum_value_rate;
+		rate = entry.maximum[variable_number - 1];
 
 	if (rate > value_critical_threshold)
 		result = STATE_CRITICAL;
@@ -161,6 +133,84 @@ main (int argc, char **argv)
 
 
 
+/* Checks every --log against its own thresholds, with a summary line
+ * followed by a line per log */
+int
+check_logs (void)
+{
+	int result = STATE_OK, states[STATE_UNKNOWN + 1] = { 0 }, *log_states;
+	char **messages, *perf = NULL, *perf_label;
+	unsigned long rate;
+	time_t current_time;
+	mrtg_entry entry;
+	size_t i;
+
+	log_states = calloc (logs_count, sizeof (int));
+	messages = calloc (logs_count, sizeof (char *));
+	if (log_states == NULL || messages == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	time (&current_time);
+	for (i = 0; i < logs_count; i++) {
+		value_log *log = &logs[i];
+
+		switch (mrtg_read_latest (log->file, &entry)) {
+		case MRTG_LOG_OPEN_ERROR:
+			log_states[i] = STATE_UNKNOWN;
+			xasprintf (&messages[i], _("Unable to open MRTG log file %s: %s"), log->file, strerror (errno));
+			continue;
+		case MRTG_LOG_PARSE_ERROR:
+			log_states[i] = STATE_UNKNOWN;
+			xasprintf (&messages[i], _("Unable to process MRTG log file %s"), log->file);
+			continue;
+		}
+
+		if (log->expire_minutes > 0
+				&& (current_time - entry.timestamp) > (log->expire_minutes * 60)) {
+			log_states[i] = STATE_WARNING;
+			xasprintf (&messages[i], _("MRTG data has expired (%d minutes old)"),
+			           (int) ((current_time - entry.timestamp) / 60));
+			continue;
+		}
+
+		if (log->use_average)
+			rate = entry.average[log->variable_number - 1];
+		else
+			rate = entry.maximum[log->variable_number - 1];
+
+		if (rate > log->value_critical_threshold)
+			log_states[i] = STATE_CRITICAL;
+		else if (rate > log->value_warning_threshold)
+			log_states[i] = STATE_WARNING;
+
+		xasprintf (&messages[i], "%s. %s = %lu %s",
+		           log->use_average ? _("Avg") : _("Max"),
+		           log->label, rate, log->units);
+		xasprintf (&perf_label, "%s_%s", log->name, log->label);
+		xasprintf (&perf, "%s%s%s", perf ? perf : "", perf ? " " : "",
+		           perfdata (perf_label, (long) rate, log->units,
+		                     (int) log->value_warning_threshold, (long) log->value_warning_threshold,
+		                     (int) log->value_critical_threshold, (long) log->value_critical_threshold,
+		                     0, 0, 0, 0));
+	}
+
+	for (i = 0; i < logs_count; i++) {
+		result = max_state (result, log_states[i]);
+		states[log_states[i]]++;
+	}
+
+	printf (_("MRTG %s - %lu logs: %d ok, %d warning, %d critical, %d unknown|%s\n"),
+	        state_text (result), (unsigned long) logs_count, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN],
+	        perf ? perf : "");
+	for (i = 0; i < logs_count; i++)
+		printf ("%s %s: %s\n", state_text (log_states[i]), logs[i].name, messages[i]);
+
+	return result;
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -178,6 +228,7 @@ process_arguments (int argc, char **argv)
 		{"label", required_argument, 0, 'l'},
 		{"units", required_argument, 0, 'u'},
 		{"variable", required_argument, 0, 'v'},
+		{"log", required_argument, 0, LOG_OPTION},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
@@ -232,6 +283,23 @@ process_arguments (int argc, char **argv)
 		case 'u':									/* timeout */
 			units = optarg;
 			break;
+		case LOG_OPTION:					/* one of several logs */
+			if (variable_number == -1)
+				usage4 (_("You must supply the variable number"));
+			logs = realloc (logs, (logs_count + 1) * sizeof (value_log));
+			if (logs == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			logs[logs_count].file = optarg;
+			logs[logs_count].name = mrtg_log_name (optarg);
+			logs[logs_count].expire_minutes = expire_minutes;
+			logs[logs_count].use_average = use_average;
+			logs[logs_count].variable_number = variable_number;
+			logs[logs_count].value_warning_threshold = value_warning_threshold;
+			logs[logs_count].value_critical_threshold = value_critical_threshold;
+			logs[logs_count].label = label ? label : "value";
+			logs[logs_count].units = units ? units : "";
+			logs_count++;
+			break;
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
 			exit (STATE_UNKNOWN);
@@ -296,6 +364,9 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
+	if (logs_count > 0 && log_file != NULL)
+		usage4 (_("--log cannot be used with -F"));
+
 	if (variable_number == -1)
 		usage4 (_("You must supply the variable number"));
 
@@ -345,6 +416,10 @@ print_help (void)
   printf (" %s\n", "-u, --units=STRING");
   printf ("   %s\n", _("Option units label for data (Example: Packets/Sec, Errors/Sec,"));
   printf ("   %s\n", _("\"Bytes Per Second\", \"%% Utilization\")"));
+  printf (" %s\n", "--log=FILE");
+  printf ("   %s\n", _("Check this log with the -e, -a, -v, -w, -c, -l and -u options given"));
+  printf ("   %s\n", _("before it, instead of -F. Can be given several times to check many logs"));
+  printf ("   %s\n", _("in one run"));
 
   printf ("\n");
 	printf (" %s\n", _("If the value exceeds the <vwl> threshold, a WARNING status is returned. If"));
@@ -382,4 +457,6 @@ print_usage (void)
   printf ("%s\n", _("Usage:"));
 	printf ("%s -F log_file -a <AVG | MAX> -v variable -w warning -c critical\n",progname);
   printf ("[-l label] [-u units] [-e expire_minutes] [-t timeout] [-v]\n");
+	printf ("%s [-a <AVG | MAX>] [-e expire_minutes] -v variable -w warning -c critical\n",progname);
+  printf ("[-l label] [-u units] --log log_file [[-w warning] [-c critical] --log log_file...]\n");
 }
@@ -31,15 +31,32 @@
 
 #include "common.h"
 #include "utils.h"
+#include "mrtgutils.h"
 
 const char *progname = "check_mrtgtraf";
 const char *copyright = "1999-2007";
 const char *email = "devel@monitoring-plugins.org";
 
+/* --log checks several logs in one run, each with the options given
+ * before it */
+#define LOG_OPTION CHAR_MAX+1
+
+typedef struct traffic_log {
+	char *file;
+	char *name;
+	int expire_minutes;
+	int use_average;
+	unsigned long incoming_warning_threshold;
+	unsigned long incoming_critical_threshold;
+	unsigned long outgoing_warning_threshold;
+	unsigned long outgoing_critical_threshold;
+} traffic_log;
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help(void);
 void print_usage(void);
+int check_logs (void);
 
 char *log_file = NULL;
 int expire_minutes = -1;
@@ -48,23 +65,39 @@ unsigned long incoming_warning_threshold = 0L;
 unsigned long incoming_critical_threshold = 0L;
 unsigned long outgoing_warning_threshold = 0L;
 unsigned long outgoing_critical_threshold = 0L;
+traffic_log *logs = NULL;
+size_t logs_count = 0;
+
+
+/* Scales a rate in Bytes/sec to B, KB or MB */
+static double
+adjust_rate (unsigned long rate, char *speed_rating)
+{
+	/* report traffic in Bytes/sec */
+	if (rate < 1024) {
+		strcpy (speed_rating, "B");
+		return (double) rate;
+	}
+
+	/* report traffic in KBytes/sec */
+	else if (rate < (1024 * 1024)) {
+		strcpy (speed_rating, "KB");
+		return (double) (rate / 1024.0);
+	}
+
+	/* report traffic in MBytes/sec */
+	strcpy (speed_rating, "MB");
+	return (double) (rate / 1024.0 / 1024.0);
+}
 
 
 int
 main (int argc, char **argv)
 {
 	int result = STATE_OK;
-	FILE *fp;
-	int line;
-	char input_buffer[MAX_INPUT_BUFFER];
-	char *temp_buffer;
+	mrtg_entry entry;
 	time_t current_time;
 	char *error_message;
-	time_t timestamp = 0L;
-	unsigned long average_incoming_rate = 0L;
-	unsigned long average_outgoing_rate = 0L;
-	unsigned long maximum_incoming_rate = 0L;
-	unsigned long maximum_outgoing_rate = 0L;
 	unsigned long incoming_rate = 0L;
 	unsigned long outgoing_rate = 0L;
 	double adjusted_incoming_rate = 0.0;
@@ -72,9 +105,7 @@ main (int argc, char **argv)
 	char incoming_speed_rating[8];
 	char outgoing_speed_rating[8];
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -82,105 +113,37 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
-	/* open the MRTG log file for reading */
-	fp = fopen (log_file, "r");
-	if (fp == NULL)
-		usage4 (_("Unable to open MRTG log file"));
-
-	line = 0;
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-
-		line++;
-
-		/* skip the first line of the log file */
-		if (line == 1)
-			continue;
-
-		/* break out of read loop */
-		/* if we've passed the number of entries we want to read */
-		if (line > 2)
-			break;
-
-		/* grab the timestamp */
-		temp_buffer = strtok (input_buffer, " ");
-		timestamp = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the average incoming transfer rate */
-		temp_buffer = strtok (NULL, " ");
-		average_incoming_rate = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the average outgoing transfer rate */
-		temp_buffer = strtok (NULL, " ");
-		average_outgoing_rate = strtoul (temp_buffer, NULL, 10);
-
-		/* grab the maximum incoming transfer rate */
-		temp_buffer = strtok (NULL, " ");
-		maximum_incoming_rate = strtoul (temp_buffer, NULL, 10);
+	if (logs_count > 0)
+		return check_logs ();
 
-		/* grab the maximum outgoing transfer rate */
-		temp_buffer = strtok (NULL, " ");
-		maximum_outgoing_rate = strtoul (temp_buffer, NULL, 10);
-	}
-
-	/* close the log file */
-	fclose (fp);
-
-	/* if we couldn't read enough data, return an unknown error */
-	if (line <= 2)
+	/* read the newest entry of the MRTG log file */
+	switch (mrtg_read_latest (log_file, &entry)) {
+	case MRTG_LOG_OPEN_ERROR:
+		usage4 (_("Unable to open MRTG log file"));
+	case MRTG_LOG_PARSE_ERROR:
+		/* if we couldn't read enough data, return an unknown error */
 		usage4 (_("Unable to process MRTG log file"));
+	}
 
 	/* make sure the MRTG data isn't too old */
 	time (&current_time);
 	if ((expire_minutes > 0) &&
-	    (current_time - timestamp) > (expire_minutes * 60))
+	    (current_time - entry.timestamp) > (expire_minutes * 60))
 		die (STATE_WARNING,	_("MRTG data has expired (%d minutes old)\n"),
-		     (int) ((current_time - timestamp) / 60));
+		     (int) ((current_time - entry.timestamp) / 60));
 
 	/* else check the incoming/outgoing rates */
 	if (use_average == TRUE) {
-		incoming_rate = average_incoming_rate;
-		outgoing_rate = average_outgoing_rate;
+		incoming_rate = entry.average[0];
+		outgoing_rate = entry.average[1];
 	}
 	else {
-		incoming_rate = maximum_incoming_rate;
-		outgoing_rate = maximum_outgoing_rate;
-	}
-
-	/* report incoming traffic in Bytes/sec */
-	if (incoming_rate < 1024) {
-		strcpy (incoming_speed_rating, "B");
-		adjusted_incoming_rate = (double) incoming_rate;
-	}
-
-	/* report incoming traffic in KBytes/sec */
-	else if (incoming_rate < (1024 * 1024)) {
-		strcpy (incoming_speed_rating, "KB");
-		adjusted_incoming_rate = (double) (incoming_rate / 1024.0);
+		incoming_rate = entry.maximum[0];
+		outgoing_rate = entry.maximum[1];
 	}
 
-	/* report incoming traffic in MBytes/sec */
-	else {
-		strcpy (incoming_speed_rating, "MB");
-		adjusted_incoming_rate = (double) (incoming_rate / 1024.0 / 1024.0);
-	}
-
-	/* report outgoing traffic in Bytes/sec */
-	if (outgoing_rate < 1024) {
-		strcpy (outgoing_speed_rating, "B");
-		adjusted_outgoing_rate = (double) outgoing_rate;
-	}
-
-	/* report outgoing traffic in KBytes/sec */
-	else if (outgoing_rate < (1024 * 1024)) {
-		strcpy (outgoing_speed_rating, "KB");
-		adjusted_outgoing_rate = (double) (outgoing_rate / 1024.0);
-	}
-
-	/* report outgoing traffic in MBytes/sec */
-	else {
-		strcpy (outgoing_speed_rating, "MB");
-		adjusted_outgoing_rate = (double) (outgoing_rate / 1024.0 / 1024.0);
-	}
+	adjusted_incoming_rate = adjust_rate (incoming_rate, incoming_speed_rating);
+	adjusted_outgoing_rate = adjust_rate (outgoing_rate, outgoing_speed_rating);
 
 	if (incoming_rate > incoming_critical_threshold
 			|| outgoing_rate > outgoing_critical_threshold) {
@@ -211,6 +174,96 @@ main (int argc, char **argv)
 
 
 
+/* Checks every --log against its own thresholds, with a summary line
+ * followed by a line per log */
+int
+check_logs (void)
+{
+	int result = STATE_OK, states[STATE_UNKNOWN + 1] = { 0 }, *log_states;
+	char **messages, *perf = NULL, *label;
+	char incoming_speed_rating[8], outgoing_speed_rating[8];
+	double adjusted_incoming_rate, adjusted_outgoing_rate;
+	unsigned long incoming_rate, outgoing_rate;
+	time_t current_time;
+	mrtg_entry entry;
+	size_t i;
+
+	log_states = calloc (logs_count, sizeof (int));
+	messages = calloc (logs_count, sizeof (char *));
+	if (log_states == NULL || messages == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	time (&current_time);
+	for (i = 0; i < logs_count; i++) {
+		traffic_log *log = &logs[i];
+
+		switch (mrtg_read_latest (log->file, &entry)) {
+		case MRTG_LOG_OPEN_ERROR:
+			log_states[i] = STATE_UNKNOWN;
+			xasprintf (&messages[i], _("Unable to open MRTG log file %s: %s"), log->file, strerror (errno));
+			continue;
+		case MRTG_LOG_PARSE_ERROR:
+			log_states[i] = STATE_UNKNOWN;
+			xasprintf (&messages[i], _("Unable to process MRTG log file %s"), log->file);
+			continue;
+		}
+
+		if ((log->expire_minutes > 0) &&
+		    (current_time - entry.timestamp) > (log->expire_minutes * 60)) {
+			log_states[i] = STATE_WARNING;
+			xasprintf (&messages[i], _("MRTG data has expired (%d minutes old)"),
+			           (int) ((current_time - entry.timestamp) / 60));
+			continue;
+		}
+
+		incoming_rate = log->use_average ? entry.average[0] : entry.maximum[0];
+		outgoing_rate = log->use_average ? entry.average[1] : entry.maximum[1];
+		adjusted_incoming_rate = adjust_rate (incoming_rate, incoming_speed_rating);
+		adjusted_outgoing_rate = adjust_rate (outgoing_rate, outgoing_speed_rating);
+
+		if (incoming_rate > log->incoming_critical_threshold
+				|| outgoing_rate > log->outgoing_critical_threshold)
+			log_states[i] = STATE_CRITICAL;
+		else if (incoming_rate > log->incoming_warning_threshold
+				|| outgoing_rate > log->outgoing_warning_threshold)
+			log_states[i] = STATE_WARNING;
+
+		xasprintf (&messages[i], _("%s. In = %0.1f %s/s, %s. Out = %0.1f %s/s"),
+		          log->use_average ? _("Avg") : _("Max"), adjusted_incoming_rate,
+		          incoming_speed_rating, log->use_average ? _("Avg") : _("Max"),
+		          adjusted_outgoing_rate, outgoing_speed_rating);
+
+		xasprintf (&label, "%s_in", log->name);
+		xasprintf (&perf, "%s%s%s", perf ? perf : "", perf ? " " : "",
+		           fperfdata (label, adjusted_incoming_rate, incoming_speed_rating,
+		                      (int)log->incoming_warning_threshold, log->incoming_warning_threshold,
+		                      (int)log->incoming_critical_threshold, log->incoming_critical_threshold,
+		                      TRUE, 0, FALSE, 0));
+		xasprintf (&label, "%s_out", log->name);
+		xasprintf (&perf, "%s %s", perf,
+		           fperfdata (label, adjusted_outgoing_rate, outgoing_speed_rating,
+		                      (int)log->outgoing_warning_threshold, log->outgoing_warning_threshold,
+		                      (int)log->outgoing_critical_threshold, log->outgoing_critical_threshold,
+		                      TRUE, 0, FALSE, 0));
+	}
+
+	for (i = 0; i < logs_count; i++) {
+		result = max_state (result, log_states[i]);
+		states[log_states[i]]++;
+	}
+
+	printf (_("Traffic %s - %lu logs: %d ok, %d warning, %d critical, %d unknown|%s\n"),
+	        state_text (result), (unsigned long) logs_count, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN],
+	        perf ? perf : "");
+	for (i = 0; i < logs_count; i++)
+		printf ("%s %s: %s\n", state_text (log_states[i]), logs[i].name, messages[i]);
+
+	return result;
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -224,6 +277,7 @@ process_arguments (int argc, char **argv)
 		{"aggregation", required_argument, 0, 'a'},
 		{"critical", required_argument, 0, 'c'},
 		{"warning", required_argument, 0, 'w'},
+		{"log", required_argument, 0, LOG_OPTION},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
@@ -268,6 +322,20 @@ process_arguments (int argc, char **argv)
 			sscanf (optarg, "%lu,%lu", &incoming_warning_threshold,
 							&outgoing_warning_threshold);
 			break;
+		case LOG_OPTION:					/* one of several logs */
+			logs = realloc (logs, (logs_count + 1) * sizeof (traffic_log));
+			if (logs == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			logs[logs_count].file = optarg;
+			logs[logs_count].name = mrtg_log_name (optarg);
+			logs[logs_count].expire_minutes = expire_minutes;
+			logs[logs_count].use_average = use_average;
+			logs[logs_count].incoming_warning_threshold = incoming_warning_threshold;
+			logs[logs_count].incoming_critical_threshold = incoming_critical_threshold;
+			logs[logs_count].outgoing_warning_threshold = outgoing_warning_threshold;
+			logs[logs_count].outgoing_critical_threshold = outgoing_critical_threshold;
+			logs_count++;
+			break;
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
 			exit (STATE_UNKNOWN);
@@ -320,6 +388,10 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
+	if (logs_count > 0 && log_file != NULL)
+		usage4 (_("--log cannot be used with -F"));
+	if (logs_count == 0 && log_file == NULL)
+		usage4 (_("No MRTG log file given"));
 	return OK;
 }
 
@@ -356,6 +428,9 @@ print_help (void)
   printf ("    %s\n", _("Warning threshold pair <incoming>,<outgoing>"));
   printf (" %s\n", "-c, --critical");
   printf ("    %s\n", _("Critical threshold pair <incoming>,<outgoing>"));
+  printf (" %s\n", "--log=STRING");
+  printf ("    %s\n", _("Check this log with the -e, -a, -w and -c options given before it,"));
+  printf ("    %s\n", _("instead of -F. Can be given several times to check many logs in one run"));
 
   printf ("\n");
 	printf ("%s\n", _("Notes:"));
@@ -378,4 +453,6 @@ print_usage (void)
 	printf (_("Usage"));
   printf (" %s -F <log_file> -a <AVG | MAX> -w <warning_pair>\n",progname);
   printf ("-c <critical_pair> [-e expire_minutes]\n");
+  printf (" %s [-a <AVG | MAX>] [-e expire_minutes] -w <warning_pair> -c <critical_pair>\n", progname);
+  printf ("--log <log_file> [[-w <warning_pair>] [-c <critical_pair>] --log <log_file>...]\n");
 }
@@ -44,6 +44,9 @@ const char *email = "devel@monitoring-plugins.org";
 #include <mysql.h>
 #include <mysqld_error.h>
 #include <errmsg.h>
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
 
 char *db_user = NULL;
 char *db_host = NULL;
@@ -76,7 +79,7 @@ static const char *metric_unit[LENGTH_METRIC_UNIT] = {
 	"Threads_running"
 };
 
-#define LENGTH_METRIC_COUNTER 9
+#define LENGTH_METRIC_COUNTER 10
 static const char *metric_counter[LENGTH_METRIC_COUNTER] = {
 	"Connections",
 	"Qcache_hits",
@@ -85,12 +88,58 @@ static const char *metric_counter[LENGTH_METRIC_COUNTER] = {
 	"Qcache_not_cached",
 	"Queries",
 	"Questions",
+	"Slow_queries",
 	"Table_locks_waited",
 	"Uptime"
 };
 
+/* Tried in order, the first one the server knows is used */
+#define LENGTH_STATUS_TABLES 2
+static const char *status_tables[LENGTH_STATUS_TABLES] = {
+	"performance_schema.global_status",
+	"information_schema.GLOBAL_STATUS"
+};
+
+typedef struct status_var {
+	char *name;
+	int counter;
+	int found;
+	long value;
+	int have_previous;
+	long previous;
+} status_var;
+
+static status_var *status_vars = NULL;
+static int n_status_vars = 0;
+static int calculate_rate = FALSE;
+static state_data *previous_state = NULL;
+
 thresholds *my_threshold = NULL;
 
+/* one server of --instances, checked by a thread of its own */
+typedef struct instance {
+	char *name;		/* as given */
+	char *host;
+	char *socket;
+	unsigned int port;
+	int result;
+	double elapsed;		/* to connect */
+	long uptime;
+	long threads;		/* Threads_connected, -1 if not known */
+	double lag;		/* Seconds_Behind_Master, -1 if not known */
+	char *message;
+} instance;
+
+static instance *instances = NULL;
+static size_t n_instances = 0;
+
+void add_status_var (const char *, int);
+void read_previous_status (void);
+MYSQL_RES *query_status (MYSQL *);
+void write_status (time_t);
+void add_instance (char *);
+void *check_instance (void *);
+int check_instances (void);
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
@@ -103,6 +152,9 @@ main (int argc, char **argv)
 	MYSQL mysql;
 	MYSQL_RES *res;
 	MYSQL_ROW row;
+	time_t current_time;
+	double duration = 0;
+	int i;
 
 	/* should be status */
 
@@ -113,16 +165,24 @@ main (int argc, char **argv)
 
         perf = strdup ("");
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
+
+	np_init ((char *) progname, argc, argv);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
+	np_set_args (argc, argv);
+
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (calculate_rate)
+		read_previous_status ();
+
+	if (n_instances > 0)
+		return check_instances ();
+
 	/* initialize mysql  */
 	mysql_init (&mysql);
 	
@@ -175,34 +235,46 @@ main (int argc, char **argv)
 	}
 
 	/* try to fetch some perf data */
-	if (mysql_query (&mysql, "show global status") == 0) {
-		if ( (res = mysql_store_result (&mysql)) == NULL) {
-			error = strdup(mysql_error(&mysql));
-			mysql_close (&mysql);
-			die (STATE_CRITICAL, _("status store_result error: %s\n"), error);
-		}
-
+	time (&current_time);
+	if ((res = query_status (&mysql)) != NULL) {
 		while ( (row = mysql_fetch_row (res)) != NULL) {
-			int i;
-
-			for(i = 0; i < LENGTH_METRIC_UNIT; i++) {
-				if (strcmp(row[0], metric_unit[i]) == 0) {
-					xasprintf(&perf, "%s%s ", perf, perfdata(metric_unit[i],
-						atol(row[1]), "", FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0));
-					continue;
-				}
-			}
-			for(i = 0; i < LENGTH_METRIC_COUNTER; i++) {
-				if (strcmp(row[0], metric_counter[i]) == 0) {
-					xasprintf(&perf, "%s%s ", perf, perfdata(metric_counter[i],
-						atol(row[1]), "c", FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0));
-					continue;
+			for(i = 0; i < n_status_vars; i++) {
+				if (strcasecmp(row[0], status_vars[i].name) == 0) {
+					status_vars[i].found = TRUE;
+					status_vars[i].value = row[1] ? atol(row[1]) : 0;
+					break;
 				}
 			}
 		}
+		mysql_free_result (res);
+
+		if (previous_state != NULL)
+			duration = current_time - previous_state->time;
+
+		for(i = 0; i < n_status_vars; i++) {
+			status_var *var = &status_vars[i];
+			char *label = NULL;
+
+			if (!var->found)
+				continue;
+			xasprintf(&perf, "%s%s ", perf, perfdata(var->name,
+				var->value, var->counter ? "c" : "", FALSE, 0, FALSE, 0, FALSE, 0, FALSE, 0));
+
+			/* A counter going backwards means the server was restarted */
+			if (!calculate_rate || !var->counter || !var->have_previous ||
+			    duration <= 0 || var->value < var->previous)
+				continue;
+			xasprintf(&label, "%s_rate", var->name);
+			xasprintf(&perf, "%s%s ", perf, fperfdata(label,
+				(var->value - var->previous) / duration, "", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+			free (label);
+		}
 		/* remove trailing space */
                 if (strlen(perf) > 0)
                     perf[strlen(perf) - 1] = '\0';
+
+		if (calculate_rate)
+			write_status (current_time);
 	}
 
 	if(check_slave) {
@@ -213,21 +285,20 @@ main (int argc, char **argv)
 			die (STATE_CRITICAL, _("slave query error: %s\n"), error);
 		}
 
-		/* store the result */
-		if ( (res = mysql_store_result (&mysql)) == NULL) {
+		/* stream the result, the first row is all there is to it */
+		if ( (res = mysql_use_result (&mysql)) == NULL) {
 			error = strdup(mysql_error(&mysql));
 			mysql_close (&mysql);
-			die (STATE_CRITICAL, _("slave store_result error: %s\n"), error);
-		}
-
-		/* Check there is some data */
-		if (mysql_num_rows(res) == 0) {
-			mysql_close(&mysql);
-			die (STATE_WARNING, "%s\n", _("No slaves defined"));
+			die (STATE_CRITICAL, _("slave use_result error: %s\n"), error);
 		}
 
-		/* fetch the first row */
+		/* fetch the first row, there is none without slaves */
 		if ( (row = mysql_fetch_row (res)) == NULL) {
+			if (mysql_errno (&mysql) == 0) {
+				mysql_free_result (res);
+				mysql_close(&mysql);
+				die (STATE_WARNING, "%s\n", _("No slaves defined"));
+			}
 			error = strdup(mysql_error(&mysql));
 			mysql_free_result (res);
 			mysql_close (&mysql);
@@ -331,6 +402,342 @@ main (int argc, char **argv)
 }
 
 
+void
+add_status_var (const char *name, int counter)
+{
+	status_var *var;
+
+	status_vars = realloc (status_vars, (n_status_vars + 1) * sizeof (*status_vars));
+	if (status_vars == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+	var = &status_vars[n_status_vars++];
+	memset (var, 0, sizeof (*var));
+	var->name = strdup (name);
+	var->counter = counter;
+}
+
+
+/* The state file holds "Name=value" for each counter of the last run */
+void
+read_previous_status (void)
+{
+	char *state_string, *item, *value;
+	int i;
+
+	if ((previous_state = np_state_read ()) == NULL)
+		return;
+
+	state_string = strdup ((char *) previous_state->data);
+	while ((item = strsep (&state_string, " ")) != NULL) {
+		if ((value = strchr (item, '=')) == NULL)
+			continue;
+		*value++ = '\0';
+		if (verbose > 2)
+			printf ("State for %s=%s\n", item, value);
+		for (i = 0; i < n_status_vars; i++) {
+			if (strcasecmp (item, status_vars[i].name) == 0) {
+				status_vars[i].previous = atol (value);
+				status_vars[i].have_previous = TRUE;
+				break;
+			}
+		}
+	}
+}
+
+
+/* Ask for the wanted variables only. Servers without the status tables
+ * get the full "show global status" list. */
+MYSQL_RES *
+query_status (MYSQL *mysql)
+{
+	MYSQL_RES *res;
+	char *names = NULL;
+	char *query = NULL;
+	char *error = NULL;
+	int i, ret = 1;
+
+	for (i = 0; i < n_status_vars; i++)
+		xasprintf (&names, "%s%s'%s'", i ? names : "", i ? "," : "", status_vars[i].name);
+
+	for (i = 0; i < LENGTH_STATUS_TABLES && ret != 0; i++) {
+		xasprintf (&query, "SELECT VARIABLE_NAME, VARIABLE_VALUE FROM %s WHERE VARIABLE_NAME IN (%s)",
+		           status_tables[i], names);
+		if (verbose >= 3)
+			printf ("%s\n", query);
+		ret = mysql_query (mysql, query);
+		if (ret != 0 && verbose >= 2)
+			printf ("%s: %s\n", status_tables[i], mysql_error (mysql));
+		free (query);
+	}
+	free (names);
+
+	if (ret != 0 && mysql_query (mysql, "show global status") != 0)
+		return NULL;
+
+	/* the caller reads every row, so there is no need to keep them all */
+	if ( (res = mysql_use_result (mysql)) == NULL) {
+		error = strdup(mysql_error(mysql));
+		mysql_close (mysql);
+		die (STATE_CRITICAL, _("status use_result error: %s\n"), error);
+	}
+	return res;
+}
+
+
+void
+write_status (time_t current_time)
+{
+	char *state_string = NULL;
+	int i;
+
+	for (i = 0; i < n_status_vars; i++) {
+		if (status_vars[i].counter && status_vars[i].found)
+			xasprintf (&state_string, "%s%s%s=%ld", state_string ? state_string : "",
+			           state_string ? " " : "", status_vars[i].name, status_vars[i].value);
+	}
+	if (state_string == NULL)
+		return;
+	if (verbose > 2)
+		printf ("State string=%s\n", state_string);
+	np_state_write_string (current_time, state_string);
+	free (state_string);
+}
+
+
+/* A socket path, a port on the -H host, HOST or HOST:PORT */
+void
+add_instance (char *name)
+{
+	instance *in;
+	char *colon;
+
+	instances = realloc (instances, (n_instances + 1) * sizeof (*instances));
+	if (instances == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+	in = &instances[n_instances++];
+	memset (in, 0, sizeof (*in));
+	in->name = name;
+	in->port = MYSQL_PORT;
+	in->threads = -1;
+	in->lag = -1;
+
+	if (*name == '/') {
+		in->host = "localhost";
+		in->socket = name;
+	}
+	else if (is_intnonneg (name))
+		in->port = atoi (name);
+	else {
+		if ((colon = strrchr (name, ':')) != NULL) {
+			if (!is_intnonneg (colon + 1))
+				usage2 (_("Invalid instance"), name);
+			in->port = atoi (colon + 1);
+			/* [2001:db8::1]:3306 */
+			if (*name == '[' && colon > name + 1 && colon[-1] == ']')
+				in->host = strndup (name + 1, colon - name - 2);
+			else
+				in->host = strndup (name, colon - name);
+		}
+		else
+			in->host = name;
+		if (in->host == NULL || !is_host (in->host))
+			usage2 (_("Invalid instance"), name);
+	}
+}
+
+
+/* Connect to one instance, look at its status and, with -S, at its
+ * replication. Runs in a thread of its own: the result goes into the
+ * instance, nothing is printed and nothing dies. */
+void *
+check_instance (void *arg)
+{
+	instance *in = arg;
+	MYSQL mysql;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+	MYSQL_FIELD *fields;
+	unsigned int timeout = DEFAULT_SOCKET_TIMEOUT;
+	int io = -1, sql = -1, behind = -1, i, num_fields, status;
+	double start;
+	char *slave = NULL;
+
+	mysql_thread_init ();
+	mysql_init (&mysql);
+	if (opt_file != NULL)
+		mysql_options (&mysql, MYSQL_READ_DEFAULT_FILE, opt_file);
+	mysql_options (&mysql, MYSQL_READ_DEFAULT_GROUP, opt_group ? opt_group : "client");
+	mysql_options (&mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	mysql_options (&mysql, MYSQL_OPT_READ_TIMEOUT, &timeout);
+	mysql_options (&mysql, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+	if (ssl)
+		mysql_ssl_set (&mysql, key, cert, ca_cert, ca_dir, ciphers);
+
+	start = np_clock ();
+	if (!mysql_real_connect (&mysql, in->host, db_user, db_pass, db, in->port, in->socket, 0)) {
+		in->elapsed = np_clock () - start;
+		if (ignore_auth && mysql_errno (&mysql) == ER_ACCESS_DENIED_ERROR) {
+			in->result = STATE_OK;
+			xasprintf (&in->message, "Version: %s (protocol %d)",
+			           mysql_get_server_info (&mysql), mysql_get_proto_info (&mysql));
+		}
+		else {
+			switch (mysql_errno (&mysql)) {
+			case CR_UNKNOWN_HOST:
+			case CR_VERSION_ERROR:
+			case CR_OUT_OF_MEMORY:
+			case CR_IPSOCK_ERROR:
+			case CR_SOCKET_CREATE_ERROR:
+				in->result = STATE_WARNING;
+				break;
+			default:
+				in->result = STATE_CRITICAL;
+			}
+			in->message = strdup (mysql_error (&mysql));
+		}
+		mysql_close (&mysql);
+		mysql_thread_end ();
+		return NULL;
+	}
+	in->elapsed = np_clock () - start;
+	in->result = STATE_OK;
+
+	if (mysql_query (&mysql, "SHOW GLOBAL STATUS WHERE Variable_name IN ('Uptime', 'Threads_connected')") == 0 &&
+	    (res = mysql_use_result (&mysql)) != NULL) {
+		while ((row = mysql_fetch_row (res)) != NULL) {
+			if (strcasecmp (row[0], "Uptime") == 0)
+				in->uptime = row[1] ? atol (row[1]) : 0;
+			else if (strcasecmp (row[0], "Threads_connected") == 0)
+				in->threads = row[1] ? atol (row[1]) : 0;
+		}
+		mysql_free_result (res);
+	}
+	xasprintf (&in->message, "Uptime: %ld  Threads: %ld", in->uptime, in->threads);
+
+	if (check_slave) {
+		if (mysql_query (&mysql, "show slave status") != 0 ||
+		    (res = mysql_use_result (&mysql)) == NULL) {
+			in->result = STATE_CRITICAL;
+			xasprintf (&in->message, _("slave query error: %s"), mysql_error (&mysql));
+		}
+		else if ((row = mysql_fetch_row (res)) == NULL) {
+			in->result = STATE_WARNING;
+			xasprintf (&in->message, "%s  %s", in->message, _("No slaves defined"));
+			mysql_free_result (res);
+		}
+		else {
+			num_fields = mysql_num_fields (res);
+			fields = mysql_fetch_fields (res);
+			for (i = 0; i < num_fields; i++) {
+				if (strcmp (fields[i].name, "Slave_IO_Running") == 0)
+					io = i;
+				else if (strcmp (fields[i].name, "Slave_SQL_Running") == 0)
+					sql = i;
+				else if (strcmp (fields[i].name, "Seconds_Behind_Master") == 0)
+					behind = i;
+			}
+			if (io < 0 || sql < 0) {
+				in->result = STATE_CRITICAL;
+				xasprintf (&in->message, "%s  %s", in->message, "Slave status unavailable");
+			}
+			else {
+				xasprintf (&slave, "Slave IO: %s Slave SQL: %s Seconds Behind Master: %s",
+				           row[io], row[sql], behind >= 0 && row[behind] ? row[behind] : "Unknown");
+				xasprintf (&in->message, "%s  %s", in->message, slave);
+				free (slave);
+				if (strcmp (row[io], "Yes") != 0 || strcmp (row[sql], "Yes") != 0)
+					in->result = STATE_CRITICAL;
+				else if (behind >= 0 && row[behind] && strcmp (row[behind], "NULL") != 0) {
+					in->lag = atof (row[behind]);
+					status = get_status (in->lag, my_threshold);
+					in->result = max_state (in->result, status);
+				}
+			}
+			mysql_free_result (res);
+		}
+	}
+
+	mysql_close (&mysql);
+	mysql_thread_end ();
+	return NULL;
+}
+
+
+/* All of --instances at the same time, a thread for each. Where threads are
+ * not to be had they are checked one after the other. */
+int
+check_instances (void)
+{
+	int states[STATE_UNKNOWN + 1] = { 0 };
+	int result = STATE_OK;
+	char *label = NULL;
+	size_t i;
+#ifdef HAVE_LIBPTHREAD
+	pthread_t *tids;
+	int *started;
+#endif
+
+	for (i = 0; i < n_instances; i++)
+		if (instances[i].socket == NULL && instances[i].host == NULL)
+			instances[i].host = *db_host ? db_host : "127.0.0.1";
+
+	mysql_library_init (0, NULL, NULL);
+#ifdef HAVE_LIBPTHREAD
+	tids = calloc (n_instances, sizeof (pthread_t));
+	started = calloc (n_instances, sizeof (int));
+	if (tids == NULL || started == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < n_instances; i++)
+		started[i] = pthread_create (&tids[i], NULL, check_instance, &instances[i]) == 0;
+	for (i = 0; i < n_instances; i++) {
+		if (started[i])
+			pthread_join (tids[i], NULL);
+		else
+			check_instance (&instances[i]);
+	}
+	free (tids);
+	free (started);
+#else
+	for (i = 0; i < n_instances; i++)
+		check_instance (&instances[i]);
+#endif
+	mysql_library_end ();
+
+	for (i = 0; i < n_instances; i++) {
+		result = max_state (result, instances[i].result);
+		states[instances[i].result]++;
+	}
+
+	printf (_("MySQL %s - %lu instances: %d ok, %d warning, %d critical, %d unknown"),
+	        state_text (result), (unsigned long) n_instances, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+	printf ("|");
+	for (i = 0; i < n_instances; i++) {
+		xasprintf (&label, "%s_time", instances[i].name);
+		printf ("%s%s", i ? " " : "", fperfdata (label, instances[i].elapsed, "s",
+		        FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+		if (instances[i].threads >= 0) {
+			xasprintf (&label, "%s_threads_connected", instances[i].name);
+			printf (" %s", perfdata (label, instances[i].threads, "",
+			        FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+		}
+		if (instances[i].lag >= 0) {
+			xasprintf (&label, "%s_seconds_behind_master", instances[i].name);
+			printf (" %s", fperfdata (label, instances[i].lag, "s",
+			        TRUE, warning_time, TRUE, critical_time, TRUE, 0, FALSE, 0));
+		}
+	}
+	putchar ('\n');
+
+	for (i = 0; i < n_instances; i++)
+		printf ("%s %s: %s\n", state_text (instances[i].result), instances[i].name,
+		        instances[i].message ? instances[i].message : "");
+
+	return result;
+}
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -338,6 +745,14 @@ process_arguments (int argc, char **argv)
 	int c;
 	char *warning = NULL;
 	char *critical = NULL;
+	char *name, *suffix;
+	int i, counter;
+
+	enum {
+		VARIABLES_OPTION = CHAR_MAX + 1,
+		RATE_OPTION,
+		INSTANCES_OPTION
+	};
 
 	int option = 0;
 	static struct option longopts[] = {
@@ -362,6 +777,9 @@ process_arguments (int argc, char **argv)
 		{"cert", required_argument,0,'a'},
 		{"ca-dir", required_argument, 0, 'D'},
 		{"ciphers", required_argument, 0, 'L'},
+		{"variables", required_argument, 0, VARIABLES_OPTION},
+		{"rate", no_argument, 0, RATE_OPTION},
+		{"instances", required_argument, 0, INSTANCES_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -454,6 +872,32 @@ process_arguments (int argc, char **argv)
 		case 'v':
 			verbose++;
 			break;
+		case VARIABLES_OPTION:
+			for (name = strtok (optarg, ","); name != NULL; name = strtok (NULL, ",")) {
+				counter = FALSE;
+				if ((suffix = strrchr (name, ':')) != NULL) {
+					if (strcmp (suffix, ":c") != 0)
+						usage2 (_("Invalid status variable"), name);
+					*suffix = '\0';
+					counter = TRUE;
+				}
+				if (*name == '\0' || strspn (name, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_") != strlen (name))
+					usage2 (_("Invalid status variable"), name);
+				for (i = 0; i < LENGTH_METRIC_COUNTER && !counter; i++)
+					if (strcasecmp (name, metric_counter[i]) == 0)
+						counter = TRUE;
+				add_status_var (name, counter);
+			}
+			break;
+		case RATE_OPTION:
+			if (!calculate_rate)
+				np_enable_state (NULL, 1);
+			calculate_rate = TRUE;
+			break;
+		case INSTANCES_OPTION:
+			for (name = strtok (optarg, ","); name != NULL; name = strtok (NULL, ","))
+				add_instance (name);
+			break;
 		case '?':									/* help */
 			usage5 ();
 		}
@@ -491,6 +935,8 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
+	int i;
+
 	if (db_user == NULL)
 		db_user = strdup("");
 
@@ -500,6 +946,16 @@ validate_arguments (void)
 	if (db == NULL)
 		db = strdup("");
 
+	if (n_instances > 0 && calculate_rate)
+		usage4 (_("--rate cannot be used with --instances"));
+
+	if (n_status_vars == 0) {
+		for (i = 0; i < LENGTH_METRIC_UNIT; i++)
+			add_status_var (metric_unit[i], FALSE);
+		for (i = 0; i < LENGTH_METRIC_COUNTER; i++)
+			add_status_var (metric_counter[i], TRUE);
+	}
+
 	return OK;
 }
 
@@ -562,6 +1018,14 @@ print_help (void)
   printf ("    %s\n", _("Path to CA directory"));
   printf (" %s\n", "-L, --ciphers=STRING");
   printf ("    %s\n", _("List of valid SSL ciphers"));
+  printf (" %s\n", "--variables=LIST");
+  printf ("    %s\n", _("Comma separated list of status variables to report instead of the default"));
+  printf ("    %s\n", _("set. Append :c to a name to treat it as a counter"));
+  printf (" %s\n", "--rate");
+  printf ("    %s\n", _("Also report the per second rate of each counter since the last run"));
+  printf (" %s\n", "--instances=LIST");
+  printf ("    %s\n", _("Comma separated list of servers to check at the same time, each a socket"));
+  printf ("    %s\n", _("path, a port on the -H host or HOST:PORT"));
 
 
   printf ("\n");
@@ -573,6 +1037,18 @@ print_help (void)
 	printf ("%s\n", _("Notes:"));
 	printf (" %s\n", _("You must specify -p with an empty string to force an empty password,"));
 	printf (" %s\n", _("overriding any my.cnf settings."));
+	printf (" %s\n", _("Status variables are read from performance_schema.global_status, or"));
+	printf (" %s\n", _("information_schema.GLOBAL_STATUS on older servers, asking for the wanted"));
+	printf (" %s\n", _("names only. Servers without either table get 'show global status'."));
+	printf (" %s\n", _("With --rate the counter values are saved in a state file so that the next"));
+	printf (" %s\n", _("run can report NAME_rate in counts per second. The first run, and the"));
+	printf (" %s\n", _("first run after a server restart, have no rates."));
+	printf (" %s\n", _("With --instances every server is checked by a thread of its own with the"));
+	printf (" %s\n", _("same credentials and options, so that a slow one does not hold up the"));
+	printf (" ");
+	printf (_("others. Each has %d seconds to connect and to answer, and -S, -w and -c"),
+	        DEFAULT_SOCKET_TIMEOUT);
+	printf ("\n %s\n", _("apply to each of them."));
 
 	printf (UT_SUPPORT);
 }
@@ -585,4 +1061,5 @@ print_usage (void)
   printf (" %s [-d database] [-H host] [-P port] [-s socket]\n",progname);
   printf ("       [-u user] [-p password] [-S] [-l] [-a cert] [-k key]\n");
   printf ("       [-C ca-cert] [-D ca-dir] [-L ciphers] [-f optfile] [-g group]\n");
+  printf ("       [--variables=LIST] [--rate] [--instances=LIST]\n");
 }
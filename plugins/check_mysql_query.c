@@ -29,6 +29,8 @@
 * 
 *****************************************************************************/
 
+#include "np_entry.h"
+
 const char *progname = "check_mysql_query";
 const char *copyright = "1999-2007";
 const char *email = "devel@monitoring-plugins.org";
@@ -41,6 +43,20 @@ const char *email = "devel@monitoring-plugins.org";
 #include <mysql.h>
 #include <errmsg.h>
 
+/* connections kept open between checks by an np-executor worker */
+#define MAX_PERSISTENT 8
+/* seconds a kept connection may sit unused before it is opened anew */
+#define DEFAULT_MAX_IDLE 300
+
+typedef struct persistent_conn {
+	char *key;
+	MYSQL *mysql;
+	MYSQL_STMT *stmt;
+	int busy;
+	unsigned long used;
+	time_t idle_since;
+} persistent_conn;
+
 char *db_user = NULL;
 char *db_host = NULL;
 char *db_socket = NULL;
@@ -54,27 +70,48 @@ int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
+static void connect_error (MYSQL *);
+static char *plain_query (void);
+static char *persistent_query (double *);
+static persistent_conn *persistent_get (void);
+static void persistent_drop (persistent_conn *);
 
 char *sql_query = NULL;
 int verbose = 0;
 thresholds *my_thresholds = NULL;
+static int persistent_mode = FALSE;
+static int fresh_connection = FALSE;
+static int max_idle = DEFAULT_MAX_IDLE;
+
+static persistent_conn persistent[MAX_PERSISTENT];
+static unsigned long persistent_uses = 0;
 
 
 int
 main (int argc, char **argv)
 {
-
-	MYSQL mysql;
-	MYSQL_RES *res;
-	MYSQL_ROW row;
-	
+	char *result;
 	double value;
-	char *error = NULL;
+	double elapsed_time = 0;
 	int status;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
+
+	/* np-executor may run this check again in the same process */
+	db_user = NULL;
+	db_host = NULL;
+	db_socket = NULL;
+	db_pass = NULL;
+	db = NULL;
+	opt_file = NULL;
+	opt_group = NULL;
+	db_port = MYSQL_PORT;
+	sql_query = NULL;
+	verbose = 0;
+	my_thresholds = NULL;
+	persistent_mode = FALSE;
+	fresh_connection = FALSE;
+	max_idle = DEFAULT_MAX_IDLE;
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -82,6 +119,73 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (persistent_mode)
+		result = persistent_query (&elapsed_time);
+	else
+		result = plain_query ();
+
+	if (! is_numeric(result)) {
+		die (STATE_CRITICAL, "QUERY %s: %s - '%s'\n", _("CRITICAL"), _("Is not a numeric"), result);
+	}
+
+	value = strtod(result, NULL);
+
+	if (verbose >= 3)
+		printf("mysql result: %f\n", value);
+
+	status = get_status(value, my_thresholds);
+
+	if (status == STATE_OK) {
+		printf("QUERY %s: ", _("OK"));
+	} else if (status == STATE_WARNING) {
+		printf("QUERY %s: ", _("WARNING"));
+	} else if (status == STATE_CRITICAL) {
+		printf("QUERY %s: ", _("CRITICAL"));
+	}
+	printf(_("'%s' returned %f | %s"), sql_query, value,
+		fperfdata("result", value, "",
+		my_thresholds->warning?TRUE:FALSE, my_thresholds->warning?my_thresholds->warning->end:0,
+		my_thresholds->critical?TRUE:FALSE, my_thresholds->critical?my_thresholds->critical->end:0,
+		FALSE, 0, 
+		FALSE, 0)
+	);
+	if (persistent_mode)
+		printf(" %s", fperfdata("time", elapsed_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+	printf("\n");
+
+	return status;
+}
+
+
+static void
+connect_error (MYSQL *mysql)
+{
+	if (mysql_errno (mysql) == CR_UNKNOWN_HOST)
+		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+	else if (mysql_errno (mysql) == CR_VERSION_ERROR)
+		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+	else if (mysql_errno (mysql) == CR_OUT_OF_MEMORY)
+		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+	else if (mysql_errno (mysql) == CR_IPSOCK_ERROR)
+		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+	else if (mysql_errno (mysql) == CR_SOCKET_CREATE_ERROR)
+		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (mysql));
+	else
+		die (STATE_CRITICAL, "QUERY %s: %s\n", _("CRITICAL"), mysql_error (mysql));
+}
+
+
+/* Connect, run the query and disconnect. Returns the first column of the
+ * first row. */
+static char *
+plain_query (void)
+{
+	MYSQL mysql;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+	char *error = NULL;
+	char *result;
+
 	/* initialize mysql  */
 	mysql_init (&mysql);
 
@@ -94,20 +198,8 @@ main (int argc, char **argv)
 		mysql_options(&mysql,MYSQL_READ_DEFAULT_GROUP,"client");
 
 	/* establish a connection to the server and error checking */
-	if (!mysql_real_connect(&mysql,db_host,db_user,db_pass,db,db_port,db_socket,0)) {
-		if (mysql_errno (&mysql) == CR_UNKNOWN_HOST)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else if (mysql_errno (&mysql) == CR_VERSION_ERROR)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else if (mysql_errno (&mysql) == CR_OUT_OF_MEMORY)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else if (mysql_errno (&mysql) == CR_IPSOCK_ERROR)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else if (mysql_errno (&mysql) == CR_SOCKET_CREATE_ERROR)
-			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), mysql_error (&mysql));
-		else
-			die (STATE_CRITICAL, "QUERY %s: %s\n", _("CRITICAL"), mysql_error (&mysql));
-	}
+	if (!mysql_real_connect(&mysql,db_host,db_user,db_pass,db,db_port,db_socket,0))
+		connect_error (&mysql);
 
 	if (mysql_query (&mysql, sql_query) != 0) {
 		error = strdup(mysql_error(&mysql));
@@ -115,61 +207,203 @@ main (int argc, char **argv)
 		die (STATE_CRITICAL, "QUERY %s: %s - %s\n", _("CRITICAL"), _("Error with query"), error);
 	}
 
-	/* store the result */
-	if ( (res = mysql_store_result (&mysql)) == NULL) {
+	/* stream the result: only the first row is ever read */
+	if ( (res = mysql_use_result (&mysql)) == NULL) {
 		error = strdup(mysql_error(&mysql));
 		mysql_close (&mysql);
-		die (STATE_CRITICAL, "QUERY %s: Error with store_result - %s\n", _("CRITICAL"), error);
+		die (STATE_CRITICAL, "QUERY %s: Error with use_result - %s\n", _("CRITICAL"), error);
 	}
 
-	/* Check there is some data */
-	if (mysql_num_rows(res) == 0) {
-		mysql_close(&mysql);
-		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), _("No rows returned"));
-	}
-
-	/* fetch the first row */
+	/* fetch the first row, there is none if it ends the result cleanly */
 	if ( (row = mysql_fetch_row (res)) == NULL) {
+		if (mysql_errno (&mysql) == 0) {
+			mysql_free_result (res);
+			mysql_close (&mysql);
+			die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), _("No rows returned"));
+		}
 		error = strdup(mysql_error(&mysql));
 		mysql_free_result (res);
 		mysql_close (&mysql);
 		die (STATE_CRITICAL, "QUERY %s: Fetch row error - %s\n", _("CRITICAL"), error);
 	}
 
-	/* free the result */
-	mysql_free_result (res);
+	result = strdup (row[0] ? row[0] : "");
 
-	/* close the connection */
+	/* close the connection before freeing the result, which would
+	 * otherwise read the rows left over the wire to get to its end */
 	mysql_close (&mysql);
+	mysql_free_result (res);
 
-	if (! is_numeric(row[0])) {
-		die (STATE_CRITICAL, "QUERY %s: %s - '%s'\n", _("CRITICAL"), _("Is not a numeric"), row[0]);
-	}
+	return result;
+}
 
-	value = strtod(row[0], NULL);
 
-	if (verbose >= 3)
-		printf("mysql result: %f\n", value);
+/* Run the query as a prepared statement, over a connection kept from an
+ * earlier run of the same check if there is one. Only the execution of the
+ * statement is timed. */
+static char *
+persistent_query (double *elapsed_time)
+{
+	persistent_conn *pc;
+	MYSQL_BIND *bind;
+	struct timeval start_timeval;
+	char value[MAX_INPUT_BUFFER];
+	unsigned long length = 0;
+	unsigned int fields, err;
+	unsigned long cursor_type = CURSOR_TYPE_READ_ONLY, prefetch_rows = 1;
+	int retry, ret;
+
+	pc = persistent_get ();
+	for (retry = 0; ; retry++) {
+		/* a check cut short leaves the connection in an unknown state, see
+		 * persistent_get() */
+		pc->busy = TRUE;
+		if (pc->mysql == NULL) {
+			if (verbose >= 2)
+				printf ("Opening persistent connection\n");
+			pc->mysql = mysql_init (NULL);
+			np_exec_counters.pool_opened++;
+			if (opt_file != NULL)
+				mysql_options(pc->mysql,MYSQL_READ_DEFAULT_FILE,opt_file);
+			if (opt_group != NULL)
+				mysql_options(pc->mysql,MYSQL_READ_DEFAULT_GROUP,opt_group);
+			else
+				mysql_options(pc->mysql,MYSQL_READ_DEFAULT_GROUP,"client");
+			if (!mysql_real_connect(pc->mysql,db_host,db_user,db_pass,db,db_port,db_socket,0))
+				connect_error (pc->mysql);
+		}
+		else {
+			np_exec_counters.pool_reused++;
+			if (verbose >= 2)
+				printf ("Reusing connection %lu\n", mysql_thread_id (pc->mysql));
+		}
 
-	status = get_status(value, my_thresholds);
+		gettimeofday (&start_timeval, NULL);
+		ret = 0;
+		if (pc->stmt == NULL) {
+			if ((pc->stmt = mysql_stmt_init (pc->mysql)) == NULL)
+				die (STATE_CRITICAL, "QUERY %s: %s - %s\n", _("CRITICAL"), _("Error with query"), mysql_error (pc->mysql));
+			/* a cursor on the server hands out one row at a time, so the
+			 * rest of a large result never leaves it */
+			mysql_stmt_attr_set (pc->stmt, STMT_ATTR_CURSOR_TYPE, &cursor_type);
+			mysql_stmt_attr_set (pc->stmt, STMT_ATTR_PREFETCH_ROWS, &prefetch_rows);
+			ret = mysql_stmt_prepare (pc->stmt, sql_query, strlen (sql_query));
+		}
+		if (ret == 0)
+			ret = mysql_stmt_execute (pc->stmt);
+		if (ret == 0)
+			break;
 
-	if (status == STATE_OK) {
-		printf("QUERY %s: ", _("OK"));
-	} else if (status == STATE_WARNING) {
-		printf("QUERY %s: ", _("WARNING"));
-	} else if (status == STATE_CRITICAL) {
-		printf("QUERY %s: ", _("CRITICAL"));
+		/* the server may have closed a connection kept since an earlier run */
+		err = mysql_stmt_errno (pc->stmt);
+		if (retry || (err != CR_SERVER_GONE_ERROR && err != CR_SERVER_LOST))
+			die (STATE_CRITICAL, "QUERY %s: %s - %s\n", _("CRITICAL"), _("Error with query"), mysql_stmt_error (pc->stmt));
+		persistent_drop (pc);
 	}
-	printf(_("'%s' returned %f | %s"), sql_query, value,
-		fperfdata("result", value, "",
-		my_thresholds->warning?TRUE:FALSE, my_thresholds->warning?my_thresholds->warning->end:0,
-		my_thresholds->critical?TRUE:FALSE, my_thresholds->critical?my_thresholds->critical->end:0,
-		FALSE, 0, 
-		FALSE, 0)
-	);
-	printf("\n");
 
-	return status;
+	/* only the first column is wanted, the others are fetched as truncated */
+	if ((fields = mysql_stmt_field_count (pc->stmt)) == 0) {
+		pc->busy = FALSE;
+		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), _("No rows returned"));
+	}
+	bind = calloc (fields, sizeof (*bind));
+	if (bind == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s"), strerror (errno));
+	bind[0].buffer_type = MYSQL_TYPE_STRING;
+	bind[0].buffer = value;
+	bind[0].buffer_length = sizeof (value);
+	bind[0].length = &length;
+	for (ret = 1; ret < (int) fields; ret++)
+		bind[ret].buffer_type = MYSQL_TYPE_STRING;
+
+	if (mysql_stmt_bind_result (pc->stmt, bind) != 0)
+		die (STATE_CRITICAL, "QUERY %s: Error with bind_result - %s\n", _("CRITICAL"), mysql_stmt_error (pc->stmt));
+
+	/* freeing the result closes the cursor without the other rows */
+	ret = mysql_stmt_fetch (pc->stmt);
+	if (ret == MYSQL_NO_DATA) {
+		mysql_stmt_free_result (pc->stmt);
+		pc->busy = FALSE;
+		die (STATE_WARNING, "QUERY %s: %s\n", _("WARNING"), _("No rows returned"));
+	}
+	if (ret != 0 && ret != MYSQL_DATA_TRUNCATED)
+		die (STATE_CRITICAL, "QUERY %s: Fetch row error - %s\n", _("CRITICAL"), mysql_stmt_error (pc->stmt));
+	mysql_stmt_free_result (pc->stmt);
+	*elapsed_time = delta_time (start_timeval);
+	pc->busy = FALSE;
+
+	if (bind[0].is_null_value)
+		length = 0;
+	value[min (length, sizeof (value) - 1)] = '\0';
+	free (bind);
+
+	if (verbose >= 2)
+		printf ("Query time: %f\n", *elapsed_time);
+
+	/* nothing to keep the connection for outside of np-executor */
+	if (!np_exec_active ())
+		persistent_drop (pc);
+	pc->idle_since = time (NULL);
+
+	return strdup (value);
+}
+
+
+static persistent_conn *
+persistent_get (void)
+{
+	persistent_conn *pc = NULL;
+	char *key = NULL;
+	int i;
+
+	xasprintf (&key, "%s\n%s\n%s\n%s\n%u\n%s\n%s\n%s\n%s", db_host, db_user,
+	           db_pass ? db_pass : "", db, db_port, db_socket ? db_socket : "",
+	           opt_file ? opt_file : "", opt_group ? opt_group : "", sql_query);
+	for (i = 0; i < MAX_PERSISTENT && pc == NULL; i++)
+		if (persistent[i].key != NULL && strcmp (persistent[i].key, key) == 0)
+			pc = &persistent[i];
+
+	if (pc == NULL) {
+		/* the least recently used slot, an empty one if there is any */
+		pc = &persistent[0];
+		for (i = 1; i < MAX_PERSISTENT; i++)
+			if (persistent[i].used < pc->used)
+				pc = &persistent[i];
+		persistent_drop (pc);
+		free (pc->key);
+		pc->key = key;
+	}
+	else
+		free (key);
+
+	/* the last check using it was cut short in the middle of a request */
+	if (pc->busy)
+		persistent_drop (pc);
+	/* unused for too long, or closed by the server meanwhile */
+	if (pc->mysql != NULL &&
+	    (time (NULL) - pc->idle_since > max_idle || mysql_ping (pc->mysql) != 0)) {
+		if (verbose >= 2)
+			printf ("Dropping idle connection %lu\n", mysql_thread_id (pc->mysql));
+		persistent_drop (pc);
+	}
+
+	pc->used = ++persistent_uses;
+	return pc;
+}
+
+
+static void
+persistent_drop (persistent_conn *pc)
+{
+	if (pc->stmt != NULL)
+		mysql_stmt_close (pc->stmt);
+	if (pc->mysql != NULL) {
+		mysql_close (pc->mysql);
+		np_exec_counters.pool_closed++;
+	}
+	pc->stmt = NULL;
+	pc->mysql = NULL;
+	pc->busy = FALSE;
 }
 
 
@@ -181,6 +415,12 @@ process_arguments (int argc, char **argv)
 	char *warning = NULL;
 	char *critical = NULL;
 
+	enum {
+		PERSISTENT_OPTION = CHAR_MAX + 1,
+		FRESH_CONNECTION_OPTION,
+		MAX_IDLE_OPTION
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
@@ -197,6 +437,9 @@ process_arguments (int argc, char **argv)
 		{"query", required_argument, 0, 'q'},
 		{"warning", required_argument, 0, 'w'},
 		{"critical", required_argument, 0, 'c'},
+		{"persistent", no_argument, 0, PERSISTENT_OPTION},
+		{"fresh-connection", no_argument, 0, FRESH_CONNECTION_OPTION},
+		{"max-idle", required_argument, 0, MAX_IDLE_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -263,6 +506,17 @@ process_arguments (int argc, char **argv)
 		case 'c':
 			critical = optarg;
 			break;
+		case PERSISTENT_OPTION:
+			persistent_mode = TRUE;
+			break;
+		case FRESH_CONNECTION_OPTION:
+			fresh_connection = TRUE;
+			break;
+		case MAX_IDLE_OPTION:
+			if (!is_intnonneg (optarg))
+				usage2 (_("Max idle must be a non-negative integer"), optarg);
+			max_idle = atoi (optarg);
+			break;
 		case '?':									/* help */
 			usage5 ();
 		}
@@ -272,6 +526,12 @@ process_arguments (int argc, char **argv)
 
 	set_thresholds(&my_thresholds, warning, critical);
 
+	if (fresh_connection && persistent_mode)
+		usage4 (_("--fresh-connection and --persistent cannot be used together"));
+	/* np-executor keeps the connection unless it is what is to be measured */
+	if (np_exec_active () && !fresh_connection)
+		persistent_mode = TRUE;
+
 	return validate_arguments ();
 }
 
@@ -331,6 +591,15 @@ print_help (void)
 	printf ("    %s\n", _("Password to login with"));
 	printf ("    ==> %s <==\n", _("IMPORTANT: THIS FORM OF AUTHENTICATION IS NOT SECURE!!!"));
 	printf ("    %s\n", _("Your clear-text password could be visible as a process table entry"));
+	printf (" --persistent\n");
+	printf ("    %s\n", _("Run the query as a prepared statement and, when run by np-executor, keep"));
+	printf ("    %s\n", _("the connection open for the next run of the same check. Adds the time"));
+	printf ("    %s\n", _("the query took to the performance data. The default when run by np-executor"));
+	printf (" --fresh-connection\n");
+	printf ("    %s\n", _("Connect anew for every run, also when run by np-executor"));
+	printf (" --max-idle=SECONDS\n");
+	printf ("    %s (%s: %d)\n", _("Open a kept connection anew once unused for so long"),
+	        _("default"), DEFAULT_MAX_IDLE);
 
 	printf ("\n");
 	printf (" %s\n", _("A query is required. The result from the query should be numeric."));
@@ -351,4 +620,5 @@ print_usage (void)
   printf ("%s\n", _("Usage:"));
   printf (" %s -q SQL_query [-w warn] [-c crit] [-H host] [-P port] [-s socket]\n",progname);
   printf ("       [-d database] [-u user] [-p password] [-f optfile] [-g group]\n");
+  printf ("       [--persistent | --fresh-connection] [--max-idle=seconds]\n");
 }
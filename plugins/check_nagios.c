@@ -32,6 +32,8 @@
 * 
 *****************************************************************************/
 
+#include "np_entry.h"
+
 const char *progname = "check_nagios";
 const char *copyright = "1999-2007";
 const char *email = "devel@monitoring-plugins.org";
@@ -39,14 +41,24 @@ const char *email = "devel@monitoring-plugins.org";
 #include "common.h"
 #include "runcmd.h"
 #include "utils.h"
+#include "utils_ps.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 int process_arguments (int, char **);
+unsigned long status_log_time (const char *);
 void print_help (void);
 void print_usage (void);
 
 char *status_log = NULL;
 char *process_string = NULL;
 int expire_minutes = 0;
+int scan_backwards = FALSE;
+int ps_cache_ttl = 0;
+char *pidfile = NULL;
 
 int verbose = 0;
 
@@ -54,35 +66,15 @@ int
 main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
-	char input_buffer[MAX_INPUT_BUFFER];
 	unsigned long latest_entry_time = 0L;
-	unsigned long temp_entry_time = 0L;
 	int proc_entries = 0;
 	time_t current_time;
-	char *temp_ptr;
-	FILE *fp;
-	int procuid = 0;
-	int procpid = 0;
-	int procppid = 0;
-	int procvsz = 0;
-	int procrss = 0;
-	float procpcpu = 0;
-	char procstat[8];
-#ifdef PS_USES_PROCETIME
-	char procetime[MAX_INPUT_BUFFER];
-#endif /* PS_USES_PROCETIME */
-	char procprog[MAX_INPUT_BUFFER];
-	char *procargs;
-	int pos, cols;
-	int expected_cols = PS_COLS - 1;
-	const char *zombie = "Z";
-	char *temp_string;
-	output chld_out, chld_err;
+	np_proc_table table;
+	np_proc *proc;
 	size_t i;
+	int found = NP_PIDFILE_OK;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -98,72 +90,50 @@ main (int argc, char **argv)
 	/* handle timeouts gracefully... */
 	alarm (timeout_interval);
 
-	/* open the status log */
-	fp = fopen (status_log, "r");
-	if (fp == NULL) {
-		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Cannot open status log for reading!"));
-	}
-
 	/* get the date/time of the last item updated in the log */
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-		if ((temp_ptr = strstr (input_buffer, "created=")) != NULL) {
-			temp_entry_time = strtoul (temp_ptr + 8, NULL, 10);
-			latest_entry_time = temp_entry_time;
-			break;
-		} else if ((temp_ptr = strtok (input_buffer, "]")) != NULL) {
-			temp_entry_time = strtoul (temp_ptr + 1, NULL, 10);
-			if (temp_entry_time > latest_entry_time)
-				latest_entry_time = temp_entry_time;
-		}
-	}
-	fclose (fp);
-
-	if (verbose >= 2)
-		printf("command: %s\n", PS_COMMAND);
+	latest_entry_time = status_log_time (status_log);
 
-	/* run the command to check for the Nagios process.. */
-	if((result = np_runcmd(PS_COMMAND, &chld_out, &chld_err, 0)) != 0)
-		result = STATE_WARNING;
+	if (pidfile != NULL) {
+		/* only the one process, instead of all of them */
+		found = np_ps_pidfile (&table, pidfile);
+		if (verbose >= 2)
+			printf ("pid file %s: %s\n", pidfile, np_ps_pidfile_text (found));
+		result = STATE_OK;
+	} else {
+		if (verbose >= 2)
+			printf("command: %s\n", PS_COMMAND);
+
+		/* run the command to check for the Nagios process.. */
+		if((result = np_ps_run(&table, ps_cache_ttl)) != 0)
+			result = STATE_WARNING;
+		if (verbose >= 2 && table.cached)
+			printf("using the process table of %s\n", np_ps_cache_file ());
+	}
 
 	/* count the number of matching Nagios processes... */
-	for(i = 0; i < chld_out.lines; i++) {
-		cols = sscanf (chld_out.line[i], PS_FORMAT, PS_VARLIST);
-		/* Zombie processes do not give a procprog command */
-		if ( cols == (expected_cols - 1) && strstr(procstat, zombie) ) {
-			cols = expected_cols;
-			/* Set some value for procargs for the strip command further below
-			 * Seen to be a problem on some Solaris 7 and 8 systems */
-			chld_out.line[i][pos] = '\n';
-			chld_out.line[i][pos+1] = 0x0;
-		}
-		if ( cols >= expected_cols ) {
-			xasprintf (&procargs, "%s", chld_out.line[i] + pos);
-			strip (procargs);
-
-			/* Some ps return full pathname for command. This removes path */
-			temp_string = strtok ((char *)procprog, "/");
-			while (temp_string) {
-				strcpy(procprog, temp_string);
-				temp_string = strtok (NULL, "/");
-			}
-
-			/* May get empty procargs */
-			if (!strstr(procargs, argv[0]) && strstr(procargs, process_string) && strcmp(procargs,"")) {
-				proc_entries++;
-				if (verbose >= 2) {
-					printf (_("Found process: %s %s\n"), procprog, procargs);
-				}
+	for(i = 0; i < table.count; i++) {
+		proc = &table.procs[i];
+		/* May get empty procargs */
+		if (proc->parsed && !strstr(proc->args, argv[0]) && strstr(proc->args, process_string) && strcmp(proc->args,"")) {
+			proc_entries++;
+			if (verbose >= 2) {
+				/* Some ps return full pathname for command. This removes path */
+				printf (_("Found process: %s %s\n"), base_name (proc->prog), proc->args);
 			}
 		}
 	}
 
 	/* If we get anything on stderr, at least set warning */
-	if(chld_err.buflen)
+	if(table.err.buflen)
 		result = max_state (result, STATE_WARNING);
 
 	/* reset the alarm handler */
 	alarm (0);
 
+	if (proc_entries == 0 && found != NP_PIDFILE_OK) {
+		die (STATE_CRITICAL, "NAGIOS %s: %s (%s: %s)\n", _("CRITICAL"), _("Could not locate a running Nagios process!"),
+		     pidfile, np_ps_pidfile_text (found));
+	}
 	if (proc_entries == 0) {
 		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Could not locate a running Nagios process!"));
 	}
@@ -194,12 +164,135 @@ main (int argc, char **argv)
 
 
 
+/* strtoul() that does not read past end, the log may be mapped */
+static unsigned long
+line_number (const char *p, const char *end)
+{
+	char buf[32];
+	size_t len = end > p ? end - p : 0;
+
+	if (len > sizeof (buf) - 1)
+		len = sizeof (buf) - 1;
+	memcpy (buf, p, len);
+	buf[len] = '\0';
+	return strtoul (buf, NULL, 10);
+}
+
+/* Take the time of one line of the log into latest. This is a "created="
+ * value in the header of status.dat, which settles it and makes this return
+ * TRUE, or the "[1234567890]" stamp of an entry in a legacy status log. */
+static int
+parse_line (const char *line, const char *end, unsigned long *latest)
+{
+	const char *p;
+	unsigned long entry_time;
+
+	for (p = line; (p = memchr (p, 'c', end - p)) != NULL && end - p >= 8; p++) {
+		if (memcmp (p, "created=", 8) == 0) {
+			*latest = line_number (p + 8, end);
+			return TRUE;
+		}
+	}
+	if (end - line >= 2 && (entry_time = line_number (line + 1, end)) > *latest)
+		*latest = entry_time;
+	return FALSE;
+}
+
+#ifdef HAVE_MMAP
+static unsigned long
+mapped_log_time (const char *map, size_t size)
+{
+	const char *line, *bol, *eol, *end = map + size;
+	unsigned long latest = 0, entry_time;
+
+	/* Up to the first legacy entry. A status.dat has "created=" within
+	 * its first lines, then nothing else is read */
+	for (line = map; line < end && *line != '['; line = eol + 1) {
+		if ((eol = memchr (line, '\n', end - line)) == NULL)
+			eol = end;
+		if (parse_line (line, eol, &latest))
+			return latest;
+	}
+	if (line >= end)
+		return latest;
+
+	if (scan_backwards) {
+		/* entries are appended in time order, the last one is the newest */
+		for (eol = end; eol > line; eol = bol - 1) {
+			for (bol = eol; bol > line && bol[-1] != '\n'; bol--)
+				;
+			entry_time = 0;
+			parse_line (bol, eol, &entry_time);
+			if (entry_time != 0)
+				return max (latest, entry_time);
+			if (bol == line)
+				break;
+		}
+		return latest;
+	}
+
+#ifdef HAVE_MADVISE
+	madvise ((void *) map, size, MADV_SEQUENTIAL);
+#endif
+	for (; line < end; line = eol + 1) {
+		if ((eol = memchr (line, '\n', end - line)) == NULL)
+			eol = end;
+		if (parse_line (line, eol, &latest))
+			break;
+	}
+	return latest;
+}
+#endif /* HAVE_MMAP */
+
+unsigned long
+status_log_time (const char *path)
+{
+	char input_buffer[MAX_INPUT_BUFFER];
+	unsigned long latest = 0L;
+	FILE *fp;
+	int fd;
+#ifdef HAVE_MMAP
+	struct stat st;
+	void *map;
+#endif
+
+	if ((fd = open (path, O_RDONLY)) < 0)
+		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Cannot open status log for reading!"));
+
+#ifdef HAVE_MMAP
+	if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0 &&
+	    (map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+		close (fd);
+		latest = mapped_log_time (map, st.st_size);
+		munmap (map, st.st_size);
+		return latest;
+	}
+#endif
+
+	/* pipes and the like are read through */
+	if ((fp = fdopen (fd, "r")) == NULL)
+		die (STATE_CRITICAL, "NAGIOS %s: %s\n", _("CRITICAL"), _("Cannot open status log for reading!"));
+	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
+		if (parse_line (input_buffer, input_buffer + strlen (input_buffer), &latest))
+			break;
+	}
+	fclose (fp);
+	return latest;
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
 	int c;
 
+	enum {
+		PS_CACHE_OPTION = CHAR_MAX + 1,
+		PIDFILE_OPTION
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"filename", required_argument, 0, 'F'},
@@ -209,6 +302,9 @@ process_arguments (int argc, char **argv)
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{"verbose", no_argument, 0, 'v'},
+		{"backwards", no_argument, 0, 'B'},
+		{"ps-cache", required_argument, 0, PS_CACHE_OPTION},
+		{"pidfile", required_argument, 0, PIDFILE_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -227,7 +323,7 @@ process_arguments (int argc, char **argv)
 	}
 
 	while (1) {
-		c = getopt_long (argc, argv, "+hVvF:C:e:t:", longopts, &option);
+		c = getopt_long (argc, argv, "+hVvBF:C:e:t:", longopts, &option);
 
 		if (c == -1 || c == EOF || c == 1)
 			break;
@@ -262,6 +358,19 @@ process_arguments (int argc, char **argv)
 		case 'v':
 			verbose++;
 			break;
+		case 'B':
+			scan_backwards = TRUE;
+			break;
+		case PS_CACHE_OPTION:
+			if (is_intnonneg (optarg))
+				ps_cache_ttl = atoi (optarg);
+			else
+				die (STATE_UNKNOWN,
+				     _("Process table cache time must be an integer (seconds)\n"));
+			break;
+		case PIDFILE_OPTION:
+			pidfile = optarg;
+			break;
 		default:									/* print short usage_va statement if args not parsable */
 			usage5();
 		}
@@ -304,6 +413,13 @@ print_help (void)
   printf ("    %s\n", _("Minutes aging after which logfile is considered stale"));
   printf (" %s\n", "-C, --command=STRING");
   printf ("    %s\n", _("Substring to search for in process arguments"));
+  printf (" %s\n", "-B, --backwards");
+  printf ("    %s\n", _("Take the time of the last entry of a legacy log instead of the newest"));
+  printf ("    %s\n", _("of all entries. Only for logs that are appended in time order"));
+  printf (UT_PS_CACHE);
+  printf (" %s\n", "--pidfile=FILE");
+  printf ("    %s\n", _("Only look at the process whose pid is in FILE (the lock_file of nagios.cfg)"));
+  printf ("    %s\n", _("instead of the whole process table. It must still match the command"));
   printf (" %s\n", "-t, --timeout=INTEGER");
   printf ("    %s\n", _("Timeout for the plugin in seconds"));
   printf (UT_VERBOSE);
@@ -321,5 +437,6 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -F <status log file> -t <timeout_seconds> -e <expire_minutes> -C <process_string>\n", progname);
+	printf ("%s -F <status log file> -t <timeout_seconds> -e <expire_minutes> -C <process_string> [-B]\n", progname);
+  printf (" [--pidfile=<lock file>]\n");
 }
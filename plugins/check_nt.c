@@ -40,6 +40,8 @@ const char *email = "devel@monitoring-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 
+#include <fcntl.h>
+
 enum checkvars {
 	CHECK_NONE,
 	CHECK_CLIENTVERSION,
@@ -70,21 +72,190 @@ unsigned long critical_value=0L;
 int check_warning_value=FALSE;
 int check_critical_value=FALSE;
 enum checkvars vars_to_check = CHECK_NONE;
-int show_all=FALSE;
+int show_all=FALSE;char recv_buffer[MAX_INPUT_BUFFER];
+
+/* one -v, with the -l, -w and -c that go with it */
+typedef struct nt_variable {
+	enum checkvars check;
+	char *value_list;
+	unsigned long warning_value;
+	unsigned long critical_value;
+	int check_warning_value;
+	int check_critical_value;
+} nt_variable;
+
+nt_variable *variables=NULL;
+int n_variables=0;
+
+/* multi-host mode */
+#define DEFAULT_CONCURRENCY 64
+char *targets_file=NULL;
+int concurrency=DEFAULT_CONCURRENCY;
+
+enum nt_phase {
+	NT_WAITING,
+	NT_CONNECTING,
+	NT_READING,
+	NT_DONE
+};
+
+/* One request to one host.  NSClient answers a single request per
+ * connection, so each gets a connection of its own, and all of them are
+ * in flight at the same time. */
+typedef struct nt_request {
+	const char *host;
+	int port;
+	const char *send;
+	enum nt_phase phase;
+	int fd;
+	struct addrinfo *addrs;
+	struct addrinfo *next_addr;
+	double deadline;
+	int result;
+	char *reply;
+	char *error;           /* why there is no reply */
+} nt_request;
+
+typedef struct nt_host {
+	char *name;
+	int port;
+	nt_request *requests;  /* one for each request of the dry run */
+	int result;
+	char *message;
+} nt_host;
+
+/* the requests the dry run of the checks found they are going to send */
+int dry_run=FALSE;
+char **sends=NULL;
+size_t n_sends=0;
 
-char recv_buffer[MAX_INPUT_BUFFER];
+/* the replies fetch_data() hands out after the dry run */
+const nt_request *replies=NULL;
+size_t next_reply=0;
 
-void fetch_data (const char* address, int port, const char* sendb);
+void fetch_data (const char* sendb);
 int process_arguments(int, char **);
+void select_variable(const nt_variable *);
+static int check_variable(char **, char **);
+static int check_host(nt_host *);
+static void run_requests(nt_request *, size_t);
+static nt_host *read_targets(const char *, size_t *);
+static const char *print_perf(const char *, const char *, char *);
 void preparelist(char *string);
 int strtoularray(unsigned long *array, char *string, const char *delim);
 void print_help(void);
 void print_usage(void);
 
 int main(int argc, char **argv){
+	nt_host *hosts=NULL;
+	nt_request *requests;
+	size_t n_hosts=0, n, i, j;
+	const char **names;
+	const char *sep="|";
+	char *perf=NULL;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int result=STATE_OK;
+
+	np_locale_init ();
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
+
+	if(process_arguments(argc,argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	if (targets_file != NULL)
+		hosts = read_targets (targets_file, &n_hosts);
+	else {
+		if ((hosts = calloc (1, sizeof (nt_host))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		hosts[0].name = server_address;
+		hosts[0].port = server_port;
+		n_hosts = 1;
+	}
+
+	/* a dry run of the checks tells which requests they are going to send,
+	 * then all of those go out at once and the checks run on the replies */
+	dry_run=TRUE;
+	for (i=0;i<(size_t)n_variables;i++) {
+		select_variable (&variables[i]);
+		check_variable (&hosts[0].message, &perf);
+	}
+	dry_run=FALSE;
+
+	n = n_hosts * n_sends;
+	if ((requests = calloc (n ? n : 1, sizeof (nt_request))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i=0;i<n_hosts;i++) {
+		hosts[i].requests = &requests[i * n_sends];
+		for (j=0;j<n_sends;j++) {
+			hosts[i].requests[j].host = hosts[i].name;
+			hosts[i].requests[j].port = hosts[i].port;
+			hosts[i].requests[j].send = sends[j];
+			hosts[i].requests[j].fd = -1;
+		}
+	}
+
+	/* look up all host names at once rather than one by one */
+	if (n_hosts > 1) {
+		if ((names = calloc (n_hosts, sizeof (char *))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		for (i=0;i<n_hosts;i++)
+			names[i] = hosts[i].name;
+		np_resolve_prefetch (names, n_hosts, address_family, concurrency);
+		free (names);
+	}
 
-/* should be 	int result = STATE_UNKNOWN; */
+	/* initialize alarm signal handling */
+	signal(SIGALRM,socket_timeout_alarm_handler);
+
+	/* set socket timeout, there may be several rounds of connections */
+	alarm(((n + concurrency - 1) / concurrency) * socket_timeout + 1);
+
+	run_requests (requests, n);
+
+	/* reset timeout */
+	alarm(0);
+
+	if (targets_file == NULL) {
+		result = check_host (&hosts[0]);
+		printf("%s\n",hosts[0].message);
+		return result;
+	}
+
+	for (i=0;i<n_hosts;i++) {
+		hosts[i].result = check_host (&hosts[i]);
+		result = max_state_alt (result, hosts[i].result);
+		if (hosts[i].result >= STATE_OK && hosts[i].result <= STATE_DEPENDENT)
+			states[hosts[i].result]++;
+	}
 
+	printf (_("NSClient %s - %lu hosts: %d ok, %d warning, %d critical, %d unknown"),
+	        state_text (result), (unsigned long)n_hosts, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+	/* the perfdata of all hosts goes on the first line */
+	for (i=0;i<n_hosts;i++)
+		if ((perf = strchr (hosts[i].message, '|')) != NULL) {
+			*perf++ = '\0';
+			sep = print_perf (sep, hosts[i].name, perf);
+		}
+	putchar ('\n');
+
+	for (i=0;i<n_hosts;i++) {
+		strip (hosts[i].message);
+		printf ("%s %s: %s\n", state_text (hosts[i].result), hosts[i].name, hosts[i].message);
+	}
+
+	return result;
+}
+
+
+
+/* check the variable select_variable() picked, on the replies fetch_data()
+ * hands out */
+static int
+check_variable (char **message, char **perf) {
 	int return_code = STATE_UNKNOWN;
 	char *send_buffer=NULL;
 	char *output_message=NULL;
@@ -116,28 +287,12 @@ int main(int argc, char **argv){
 	int isPercent = FALSE;
 	int allRight = FALSE;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
-	/* Parse extra opts if any */
-	argv=np_extra_opts (&argc, argv, progname);
-
-	if(process_arguments(argc,argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
-
-	/* initialize alarm signal handling */
-	signal(SIGALRM,socket_timeout_alarm_handler);
-
-	/* set socket timeout */
-	alarm(socket_timeout);
-
 	switch (vars_to_check) {
 
 	case CHECK_CLIENTVERSION:
 
 		xasprintf(&send_buffer, "%s&1", req_password);
-		fetch_data (server_address, server_port, send_buffer);
+		fetch_data (send_buffer);
 		if (value_list != NULL && strcmp(recv_buffer, value_list) != 0) {
 			xasprintf (&output_message, _("Wrong client version - running: %s, required: %s"), recv_buffer, value_list);
 			return_code = STATE_WARNING;
@@ -169,7 +324,7 @@ int main(int argc, char **argv){
 
 				/* Send request and retrieve data */
 				xasprintf(&send_buffer,"%s&2&%lu",req_password,lvalue_list[0+offset]);
-				fetch_data (server_address, server_port, send_buffer);
+				fetch_data (send_buffer);
 
 				utilization=strtoul(recv_buffer,NULL,10);
 
@@ -208,7 +363,7 @@ int main(int argc, char **argv){
 			output_message = strdup (_("wrong -l argument"));
 		} else {
 			xasprintf(&send_buffer, "%s&3", req_password);
-			fetch_data (server_address, server_port, send_buffer);
+			fetch_data (send_buffer);
 			uptime=strtoul(recv_buffer,NULL,10);
 			updays = uptime / 86400;
 			uphours = (uptime % 86400) / 3600;
@@ -241,7 +396,7 @@ int main(int argc, char **argv){
 			output_message = strdup (_("wrong -l argument"));
 		else {
 			xasprintf(&send_buffer,"%s&4&%s", req_password, value_list);
-			fetch_data (server_address, server_port, send_buffer);
+			fetch_data (send_buffer);
 			fds=strtok(recv_buffer,"&");
 			tds=strtok(NULL,"&");
 			if(fds!=NULL)
@@ -286,10 +441,13 @@ int main(int argc, char **argv){
 			preparelist(value_list);		/* replace , between services with & to send the request */
 			xasprintf(&send_buffer,"%s&%u&%s&%s", req_password,(vars_to_check==CHECK_SERVICESTATE)?5:6,
 							 (show_all==TRUE) ? "ShowAll" : "ShowFail",value_list);
-			fetch_data (server_address, server_port, send_buffer);
+			fetch_data (send_buffer);
 			numstr = strtok(recv_buffer,"&");
-			if (numstr == NULL)
-				die(STATE_UNKNOWN, _("could not fetch information from server\n"));
+			if (numstr == NULL) {
+				output_message = strdup (_("could not fetch information from server"));
+				return_code=STATE_UNKNOWN;
+				break;
+			}
 			return_code=atoi(numstr);
 			temp_string=strtok(NULL,"&");
 			output_message = strdup (temp_string);
@@ -299,14 +457,20 @@ int main(int argc, char **argv){
 	case CHECK_MEMUSE:
 
 		xasprintf(&send_buffer,"%s&7", req_password);
-		fetch_data (server_address, server_port, send_buffer);
+		fetch_data (send_buffer);
 		numstr = strtok(recv_buffer,"&");
-		if (numstr == NULL)
-			die(STATE_UNKNOWN, _("could not fetch information from server\n"));
+		if (numstr == NULL) {
+			output_message = strdup (_("could not fetch information from server"));
+			return_code=STATE_UNKNOWN;
+			break;
+		}
 		mem_commitLimit=atof(numstr);
 		numstr = strtok(NULL,"&");
-		if (numstr == NULL)
-			die(STATE_UNKNOWN, _("could not fetch information from server\n"));
+		if (numstr == NULL) {
+			output_message = strdup (_("could not fetch information from server"));
+			return_code=STATE_UNKNOWN;
+			break;
+		}
 		mem_commitByte=atof(numstr);
 		percent_used_space = (mem_commitByte / mem_commitLimit) * 100;
 		warning_used_space = ((float)warning_value / 100) * mem_commitLimit;
@@ -363,7 +527,7 @@ int main(int argc, char **argv){
 			description = strtok (NULL, "&");
 			counter_unit = strtok (NULL, "&");
 			xasprintf (&send_buffer, "%s&8&%s", req_password, value_list);
-			fetch_data (server_address, server_port, send_buffer);
+			fetch_data (send_buffer);
 			counter_value = atof (recv_buffer);
 
 			if (description == NULL)
@@ -442,7 +606,7 @@ int main(int argc, char **argv){
 		else {
 			preparelist(value_list);		/* replace , between services with & to send the request */
 			xasprintf(&send_buffer,"%s&9&%s", req_password,value_list);
-			fetch_data (server_address, server_port, send_buffer);
+			fetch_data (send_buffer);
 			age_in_minutes = atoi(strtok(recv_buffer,"&"));
 			description = strtok(NULL,"&");
 			output_message = strdup (description);
@@ -471,7 +635,7 @@ int main(int argc, char **argv){
 			output_message = strdup (_("No counter specified"));
 		else {
 			xasprintf(&send_buffer,"%s&10&%s", req_password,value_list);
-			fetch_data (server_address, server_port, send_buffer);
+			fetch_data (send_buffer);
 			if (!strncmp(recv_buffer,"ERROR",5)) {
 				printf("NSClient - %s\n",recv_buffer);
 				exit(STATE_UNKNOWN);
@@ -488,23 +652,386 @@ int main(int argc, char **argv){
 
 	}
 
-	/* reset timeout */
-	alarm(0);
-
-	if (perfdata==NULL)
-		printf("%s\n",output_message);
-	else
-		printf("%s | %s\n",output_message,perfdata);
+	*message=output_message;
+	*perf=perfdata;
 	return return_code;
 }
 
 
 
+/* append s, without the blanks around it, to the list in *list */
+static void
+append_item (char **list, const char *sep, char *s)
+{
+	s += strspn (s, " ");
+	strip (s);
+	if (*s == '\0')
+		return;
+	xasprintf (list, "%s%s%s", *list ? *list : "", *list ? sep : "", s);
+}
+
+/* run all checks on the replies of one host, and put the output into
+ * h->message */
+static int
+check_host (nt_host *h) {
+	char *message, *perfdata, *bar;
+	char *text=NULL, *perf=NULL;
+	int result=STATE_OK, state, v;
+	size_t i;
+
+	/* what fetch_data() used to die of */
+	for (i=0;i<n_sends;i++) {
+		if (h->requests[i].result != STATE_OK) {
+			if (targets_file == NULL)
+				xasprintf (&h->message, "%s\n%s", h->requests[i].error, _("could not fetch information from server"));
+			else
+				xasprintf (&h->message, _("could not fetch information from server (%s)"), h->requests[i].error);
+			return h->requests[i].result;
+		}
+		if (!strncmp (h->requests[i].reply, "ERROR", 5)) {
+			xasprintf (&h->message, "NSClient - %s", h->requests[i].reply);
+			return STATE_UNKNOWN;
+		}
+	}
+
+	replies = h->requests;
+	next_reply = 0;
+
+	if (n_variables == 1) {
+		select_variable (&variables[0]);
+		result = check_variable (&message, &perfdata);
+		if (perfdata==NULL)
+			xasprintf (&h->message, "%s", message);
+		else
+			xasprintf (&h->message, "%s | %s", message, perfdata);
+		return result;
+	}
+
+	/* all variables on one line, and all their perfdata after it */
+	for (v=0;v<n_variables;v++) {
+		select_variable (&variables[v]);
+		state = check_variable (&message, &perfdata);
+		result = max_state_alt (result, state);
+		if (message == NULL)
+			continue;
+		if ((bar = strchr (message, '|')) != NULL) {
+			*bar++ = '\0';
+			append_item (&perf, " ", bar);
+		}
+		if (perfdata != NULL)
+			append_item (&perf, " ", perfdata);
+		append_item (&text, "; ", message);
+	}
+
+	xasprintf (&h->message, "%s%s%s", text ? text : "", perf ? " | " : "", perf ? perf : "");
+	return result;
+}
+
+
+
+static double
+now_seconds (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1.0e6;
+}
+
+static void
+request_finish (nt_request *r, int result, char *error)
+{
+	if (r->fd >= 0) {
+		close (r->fd);
+		r->fd = -1;
+	}
+	if (r->addrs != NULL) {
+		freeaddrinfo (r->addrs);
+		r->addrs = r->next_addr = NULL;
+	}
+	r->result = result;
+	r->error = error;
+	r->phase = NT_DONE;
+}
+
+static void
+request_connected (nt_request *r)
+{
+	freeaddrinfo (r->addrs);
+	r->addrs = r->next_addr = NULL;
+
+	if (send (r->fd, r->send, strlen (r->send), 0) != (ssize_t) strlen (r->send)) {
+		request_finish (r, STATE_WARNING, strdup (_("Send failed")));
+		return;
+	}
+	r->phase = NT_READING;
+}
+
+/* try the remaining addresses of the host until one connects or blocks */
+static void
+request_connect_next (nt_request *r)
+{
+	struct addrinfo *ai;
+	char *error = NULL;
+	int saved;
+
+	while ((ai = r->next_addr) != NULL) {
+		r->next_addr = ai->ai_next;
+
+		if ((r->fd = socket (ai->ai_family, SOCK_STREAM, ai->ai_protocol)) < 0) {
+			request_finish (r, STATE_UNKNOWN, strdup (_("Socket creation failed")));
+			return;
+		}
+		fcntl (r->fd, F_SETFL, fcntl (r->fd, F_GETFL) | O_NONBLOCK);
+
+		if (connect (r->fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			request_connected (r);
+			return;
+		}
+		if (errno == EINPROGRESS) {
+			r->phase = NT_CONNECTING;
+			return;
+		}
+		saved = errno;
+		close (r->fd);
+		r->fd = -1;
+		errno = saved;
+	}
+
+	saved = errno;
+	xasprintf (&error, _("connect to address %s and port %d: %s"), r->host, r->port, strerror (saved));
+	request_finish (r, (saved == ECONNREFUSED) ? econn_refuse_state : STATE_CRITICAL, error);
+}
+
+static void
+request_start (nt_request *r)
+{
+	struct addrinfo hints;
+	char port_str[6];
+	char *error = NULL;
+
+	r->deadline = now_seconds () + socket_timeout;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf (port_str, sizeof (port_str), "%d", r->port);
+
+	if (np_getaddrinfo (r->host, port_str, &hints, &r->addrs) != 0) {
+		r->addrs = NULL;
+		xasprintf (&error, _("Invalid hostname, address or socket: %s"), r->host);
+		request_finish (r, STATE_UNKNOWN, error);
+		return;
+	}
+	r->next_addr = r->addrs;
+	request_connect_next (r);
+}
+
+static void
+request_handle_event (nt_request *r)
+{
+	char buf[MAX_INPUT_BUFFER];
+	socklen_t optlen;
+	int error = 0;
+	ssize_t i;
+
+	if (r->phase == NT_CONNECTING) {
+		optlen = sizeof (error);
+		if (getsockopt (r->fd, SOL_SOCKET, SO_ERROR, &error, &optlen) < 0)
+			error = errno;
+		if (error == 0) {
+			request_connected (r);
+			return;
+		}
+		close (r->fd);
+		r->fd = -1;
+		errno = error;
+		request_connect_next (r);
+		return;
+	}
+
+	/* NT_READING: the reply is what one read gets, as in send_request() */
+	i = recv (r->fd, buf, sizeof (buf) - 1, 0);
+	if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (i < 0) {
+		request_finish (r, STATE_WARNING, strdup (_("Receive failed")));
+		return;
+	}
+	buf[i] = '\0';
+	r->reply = strdup (buf);
+	request_finish (r, STATE_OK, NULL);
+}
+
+static void
+request_handle_timeout (nt_request *r)
+{
+	char *error = NULL;
+
+	xasprintf (&error, _("Socket timeout after %d seconds"), socket_timeout);
+	request_finish (r, socket_timeout_state, error);
+}
+
+/* run all requests, with up to `concurrency` connections at a time */
+static void
+run_requests (nt_request *reqs, size_t count)
+{
+	struct pollfd *pfds;
+	size_t *active;
+	size_t next = 0, nactive = 0, i, j;
+	double now, first;
+	int timeout_ms;
+
+	active = calloc (concurrency, sizeof (size_t));
+	pfds = calloc (concurrency, sizeof (struct pollfd));
+	if (active == NULL || pfds == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	while (next < count || nactive > 0) {
+		/* top up the set of connections in flight */
+		while (nactive < (size_t)concurrency && next < count) {
+			request_start (&reqs[next]);
+			if (reqs[next].phase != NT_DONE)
+				active[nactive++] = next;
+			next++;
+		}
+		if (nactive == 0)
+			continue;
+
+		now = now_seconds ();
+		first = reqs[active[0]].deadline;
+		for (i = 0; i < nactive; i++) {
+			nt_request *r = &reqs[active[i]];
+			pfds[i].fd = r->fd;
+			pfds[i].events = (r->phase == NT_CONNECTING) ? POLLOUT : POLLIN;
+			pfds[i].revents = 0;
+			if (r->deadline < first)
+				first = r->deadline;
+		}
+		timeout_ms = (first > now) ? (int)((first - now) * 1000) + 1 : 0;
+
+		if (poll (pfds, nactive, timeout_ms) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+
+		now = now_seconds ();
+		for (i = 0; i < nactive; i++) {
+			nt_request *r = &reqs[active[i]];
+			if (pfds[i].revents)
+				request_handle_event (r);
+			else if (r->deadline <= now)
+				request_handle_timeout (r);
+		}
+
+		/* drop finished requests from the active set */
+		for (i = j = 0; i < nactive; i++)
+			if (reqs[active[i]].phase != NT_DONE)
+				active[j++] = active[i];
+		nactive = j;
+	}
+
+	free (active);
+	free (pfds);
+}
+
+
+
+/* Read "host" or "host port" lines, one per host.  The port defaults to
+ * the one given with -p. */
+static nt_host *
+read_targets (const char *filename, size_t *count)
+{
+	FILE *fp;
+	char line[MAX_INPUT_BUFFER];
+	char *host, *port_str;
+	nt_host *hosts = NULL;
+	size_t size = 0;
+
+	*count = 0;
+	if (strcmp (filename, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen (filename, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open target list %s: %s\n"), filename, strerror (errno));
+
+	while (fgets (line, sizeof (line), fp) != NULL) {
+		strip (line);
+		host = line + strspn (line, " \t");
+		if (*host == '\0' || *host == '#')
+			continue;
+
+		if ((port_str = strpbrk (host, " \t")) != NULL) {
+			*port_str++ = '\0';
+			port_str += strspn (port_str, " \t");
+		}
+
+		if (*count >= size) {
+			size = size ? size * 2 : 64;
+			if ((hosts = realloc (hosts, size * sizeof (nt_host))) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		}
+		memset (&hosts[*count], 0, sizeof (nt_host));
+		hosts[*count].name = strdup (host);
+		hosts[*count].port = server_port;
+		if (port_str != NULL && *port_str != '\0') {
+			if (!is_intpos (port_str))
+				die (STATE_UNKNOWN, _("Invalid port in target list: %s\n"), port_str);
+			hosts[*count].port = atoi (port_str);
+		}
+		(*count)++;
+	}
+
+	if (fp != stdin)
+		fclose (fp);
+
+	if (*count == 0)
+		die (STATE_UNKNOWN, _("No targets found in %s\n"), filename);
+
+	return hosts;
+}
+
+/* print the perfdata of a host with its name in front of every label,
+ * returns the separator for what comes next */
+static const char *
+print_perf (const char *sep, const char *host, char *perf)
+{
+	char *item, *end;
+
+	while (*(item = perf + strspn (perf, " ")) != '\0') {
+		end = item;
+		if (*item == '\'' && (end = strchr (item + 1, '\'')) == NULL)
+			end = item + strlen (item);
+		end += strcspn (end, " ");
+		if (*item == '\'')
+			printf ("%s'%s:%.*s", sep, host, (int)(end - item - 1), item + 1);
+		else
+			printf ("%s%s:%.*s", sep, host, (int)(end - item), item);
+		sep = " ";
+		perf = end;
+	}
+	return sep;
+}
+
+void select_variable(const nt_variable *v) {
+	vars_to_check=v->check;
+	/* the checks cut the list up */
+	value_list=(v->value_list==NULL) ? NULL : strdup (v->value_list);
+	warning_value=v->warning_value;
+	critical_value=v->critical_value;
+	check_warning_value=v->check_warning_value;
+	check_critical_value=v->check_critical_value;
+}
+
+
+
 /* process command-line arguments */
 int process_arguments(int argc, char **argv){
 	int c;
 
 	int option = 0;
+	enum {
+		TARGETS_OPTION = CHAR_MAX + 1,
+		CONCURRENCY_OPTION
+	};
 	static struct option longopts[] =
 	{
 		{"port",     required_argument,0,'p'},
@@ -517,6 +1044,8 @@ int process_arguments(int argc, char **argv){
 		{"secret",   required_argument,0,'s'},
 		{"display",  required_argument,0,'d'},
 		{"unknown-timeout", no_argument, 0, 'u'},
+		{"targets",  required_argument,0,TARGETS_OPTION},
+		{"concurrency", required_argument,0,CONCURRENCY_OPTION},
 		{"version",  no_argument,      0,'V'},
 		{"help",     no_argument,      0,'h'},
 		{0,0,0,0}
@@ -594,18 +1123,43 @@ int process_arguments(int argc, char **argv){
 					vars_to_check=CHECK_INSTANCES;
 				else
 					return ERROR;
+				if ((variables = realloc (variables, (n_variables + 1) * sizeof (nt_variable))) == NULL)
+					die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+				memset (&variables[n_variables], 0, sizeof (nt_variable));
+				variables[n_variables++].check=vars_to_check;
 				break;
-			case 'l': /* value list */
-				value_list = optarg;
+			case 'l': /* value list, of the last variable or of all */
+				if (n_variables>0)
+					variables[n_variables-1].value_list = optarg;
+				else
+					value_list = optarg;
 				break;
-			case 'w': /* warning threshold */
+			case 'w': /* warning threshold, of the last variable or of all */
+				if (n_variables>0) {
+					variables[n_variables-1].warning_value=strtoul(optarg,NULL,10);
+					variables[n_variables-1].check_warning_value=TRUE;
+					break;
+				}
 				warning_value=strtoul(optarg,NULL,10);
 				check_warning_value=TRUE;
 				break;
-			case 'c': /* critical threshold */
+			case 'c': /* critical threshold, of the last variable or of all */
+				if (n_variables>0) {
+					variables[n_variables-1].critical_value=strtoul(optarg,NULL,10);
+					variables[n_variables-1].check_critical_value=TRUE;
+					break;
+				}
 				critical_value=strtoul(optarg,NULL,10);
 				check_critical_value=TRUE;
 				break;
+			case TARGETS_OPTION:
+				targets_file = optarg;
+				break;
+			case CONCURRENCY_OPTION:
+				if (!is_intpos (optarg))
+					usage2 (_("Concurrency must be a positive integer"), optarg);
+				concurrency = atoi (optarg);
+				break;
 			case 'd': /* Display select for services */
 				if (!strcmp(optarg,"SHOWALL"))
 					show_all = TRUE;
@@ -620,12 +1174,27 @@ int process_arguments(int argc, char **argv){
 			}
 
 	}
-	if (server_address == NULL)
+	if (server_address == NULL && targets_file == NULL)
 		usage4 (_("You must provide a server address or host name"));
 
-	if (vars_to_check==CHECK_NONE)
+	if (n_variables==0)
 		return ERROR;
 
+	/* -l, -w and -c given before the first -v are those of the variables
+	 * that have none of their own */
+	for (c=0;c<n_variables;c++) {
+		if (variables[c].value_list==NULL)
+			variables[c].value_list=value_list;
+		if (variables[c].check_warning_value==FALSE) {
+			variables[c].warning_value=warning_value;
+			variables[c].check_warning_value=check_warning_value;
+		}
+		if (variables[c].check_critical_value==FALSE) {
+			variables[c].critical_value=critical_value;
+			variables[c].check_critical_value=check_critical_value;
+		}
+	}
+
 	if (req_password == NULL)
 		req_password = strdup (_("None"));
 
@@ -634,16 +1203,19 @@ int process_arguments(int argc, char **argv){
 
 
 
-void fetch_data (const char *address, int port, const char *sendb) {
-	int result;
-
-	result=process_tcp_request(address, port, sendb, recv_buffer,sizeof(recv_buffer));
-
-	if(result!=STATE_OK)
-		die (result, _("could not fetch information from server\n"));
+/* In the dry run the request is only noted down, and "0&0" is the reply so
+ * that every check goes all the way.  After it, the replies that came in are
+ * handed out in the same order. */
+void fetch_data (const char *sendb) {
+	if (dry_run) {
+		if ((sends = realloc (sends, (n_sends + 1) * sizeof (char *))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		sends[n_sends++] = strdup (sendb);
+		strcpy (recv_buffer, "0&0");
+		return;
+	}
 
-	if (!strncmp(recv_buffer,"ERROR",5))
-		die (STATE_UNKNOWN, "NSClient - %s\n",recv_buffer);
+	snprintf (recv_buffer, sizeof (recv_buffer), "%s", replies[next_reply++].reply);
 }
 
 int strtoularray(unsigned long *array, char *string, const char *delim) {
@@ -719,8 +1291,16 @@ void print_help(void)
 	printf ("   %s\n", _("Print this help screen"));
 	printf (" %s\n", "-V, --version");
 	printf ("   %s\n", _("Print version information"));
+	printf (" %s\n", "--targets=FILE");
+	printf ("   %s\n", _("Check every host listed in FILE (\"-\" for stdin), one \"host [port]\" per line"));
+	printf ("   %s\n", _("instead of -H, and print one line per host after a summary"));
+	printf (" %s\n", "--concurrency=INTEGER");
+	printf ("   %s", _("Requests in flight at the same time (default: "));
+	printf ("%d)\n", DEFAULT_CONCURRENCY);
 	printf (" %s\n", "-v, --variable=STRING");
-	printf ("   %s\n\n", _("Variable to check"));
+	printf ("   %s\n", _("Variable to check. May be given more than once, the -l, -w and -c after a"));
+	printf ("   %s\n", _("-v are those of that variable, those before the first -v apply to all"));
+	printf ("   %s\n\n", _("variables without their own"));
 	printf ("%s\n", _("Valid variables are:"));
 	printf (" %s", "CLIENTVERSION =");
 	printf (" %s\n", _("Get the NSClient version"));
@@ -782,6 +1362,10 @@ void print_help(void)
 	printf (" %s\n", _("- The NSClient service should be running on the server to get any information"));
 	printf ("   %s\n", "(http://nsclient.ready2run.nl).");
 	printf (" %s\n", _("- Critical thresholds should be lower than warning thresholds"));
+	printf (" %s\n", _("- All requests are sent at once, each on a connection of its own since"));
+	printf ("   %s\n", _("NSClient answers one request per connection. With more than one -v the"));
+	printf ("   %s\n", _("results are joined by '; ', their perfdata follows and the worst state"));
+	printf ("   %s\n", _("is returned."));
 	printf (" %s\n", _("- Default port 1248 is sometimes in use by other services. The error"));
 	printf ("   %s\n", _("output when this happens contains \"Cannot map xxxxx to protocol number\"."));
 	printf ("   %s\n", _("One fix for this is to change the port to something else on check_nt "));
@@ -796,6 +1380,7 @@ void print_usage(void)
 {
 	printf ("%s\n", _("Usage:"));
 	printf ("%s -H host -v variable [-p port] [-w warning] [-c critical]\n",progname);
-	printf ("[-l params] [-d SHOWALL] [-u] [-t timeout]\n");
+	printf ("[-l params] [-v variable [-l params] [-w warning] [-c critical]]...\n");
+	printf ("[-d SHOWALL] [-u] [-t timeout] [--targets=FILE [--concurrency=N]]\n");
 }
 
@@ -41,6 +41,7 @@ const char *email = "devel@monitoring-plugins.org";
 
 #include "common.h"
 #include "netutils.h"
+#include "ntputils.h"
 #include "utils.h"
 
 static char *server_address=NULL;
@@ -61,6 +62,7 @@ static char *twarn="0:";
 static char *tcrit="0:";
 static int syncsource_found=0;
 static int li_alarm=0;
+static int pipeline=1;
 
 int process_arguments (int, char **);
 thresholds *offset_thresholds = NULL;
@@ -70,122 +72,193 @@ thresholds *truechimer_thresholds = NULL;
 void print_help (void);
 void print_usage (void);
 
-/* max size of control message data */
-#define MAX_CM_SIZE 468
+/* The variables to ask the peers for: the offset, and the stratum and
+ * jitter only if there are thresholds for them. Older servers don't know
+ * what jitter is, so if we get an error for it we ask for dispersion, and
+ * if that fails too, for everything. */
+static const char *getvars[3];
 
-/* this structure holds everything in an ntp control message as per rfc1305 */
-typedef struct {
-	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
-	uint8_t op;          /* R,E,M bits and Opcode */
-	uint16_t seq;        /* Packet sequence */
-	uint16_t status;     /* Clock status */
-	uint16_t assoc;      /* Association */
-	uint16_t offset;     /* Similar to TCP sequence # */
-	uint16_t count;      /* # bytes of data */
-	char data[MAX_CM_SIZE]; /* ASCII data of the request */
-	                        /* NB: not necessarily NULL terminated! */
-} ntp_control_message;
-
-/* this is an association/status-word pair found in control packet reponses */
+static void setup_getvars(void){
+	char *vars;
+
+	xasprintf(&vars, "offset%s%s", do_stratum ? ",stratum" : "", do_jitter ? ",jitter" : "");
+	getvars[0] = vars;
+	xasprintf(&vars, "offset%s%s", do_stratum ? ",stratum" : "", do_jitter ? ",dispersion" : "");
+	getvars[1] = vars;
+	getvars[2] = "";
+}
+
+/* the next getvars[] entry to try after the server refused level */
+static int next_getvar_level(int level){
+	if(level == 0 && do_jitter){
+		if(verbose) printf("The command failed. This is usually caused by servers refusing the 'jitter'\nvariable. Restarting with 'dispersion'...\n");
+		return 1;
+	}
+	if(verbose) printf("Server didn't like %s either; will retrieve everything\n", do_jitter ? "dispersion" : "the variable list");
+	return 2;
+}
+
+/* Ask for the variables of one peer and wait for all of the reply. The
+ * level reached stays for the peers after this one. */
+static char *readvar(int conn, uint16_t assoc, int *level){
+	ntp_control_message req;
+	char *data;
+
+	for(;;){
+		xasprintf(&data, "");
+		do{
+			np_ntp_setup_control_request(&req, OP_READVAR, 2);
+			req.assoc = assoc;
+			/* Putting the wanted variable names in the request
+			 * cause the server to provide _only_ the requested values.
+			 * thus reducing net traffic, guaranteeing us only a single
+			 * datagram in reply, and making intepretation much simpler
+			 */
+			strncpy(req.data, getvars[*level], MAX_CM_SIZE-1);
+			req.count = htons(strlen(getvars[*level]));
+			DBG(printf("sending READVAR request...\n"));
+			write(conn, &req, SIZEOF_NTPCM(req));
+			DBG(np_ntp_print_control_message(&req));
+
+			do {
+				req.count = htons(MAX_CM_SIZE);
+				DBG(printf("receiving READVAR response...\n"));
+				read(conn, &req, SIZEOF_NTPCM(req));
+				DBG(np_ntp_print_control_message(&req));
+			} while (!(req.op&OP_READVAR && ntohs(req.seq) == 2));
+
+			if(!(req.op&REM_ERROR))
+				xasprintf(&data, "%s%s", data, req.data);
+		} while(req.op&REM_MORE);
+
+		if(!(req.op&REM_ERROR) || *level == 2)
+			return data;
+		free(data);
+		*level = next_getvar_level(*level);
+	}
+}
+
+/* this holds a READVAR request kept in flight by readvar_pipelined() */
 typedef struct {
-	uint16_t assoc;
-	uint16_t status;
-} ntp_assoc_status_pair;
-
-/* bits 1,2 are the leap indicator */
-#define LI_MASK 0xc0
-#define LI(x) ((x&LI_MASK)>>6)
-#define LI_SET(x,y) do{ x |= ((y<<6)&LI_MASK); }while(0)
-/* and these are the values of the leap indicator */
-#define LI_NOWARNING 0x00
-#define LI_EXTRASEC 0x01
-#define LI_MISSINGSEC 0x02
-#define LI_ALARM 0x03
-/* bits 3,4,5 are the ntp version */
-#define VN_MASK 0x38
-#define VN(x)	((x&VN_MASK)>>3)
-#define VN_SET(x,y)	do{ x |= ((y<<3)&VN_MASK); }while(0)
-#define VN_RESERVED 0x02
-/* bits 6,7,8 are the ntp mode */
-#define MODE_MASK 0x07
-#define MODE(x) (x&MODE_MASK)
-#define MODE_SET(x,y)	do{ x |= (y&MODE_MASK); }while(0)
-/* here are some values */
-#define MODE_CLIENT 0x03
-#define MODE_CONTROLMSG 0x06
-/* In control message, bits 8-10 are R,E,M bits */
-#define REM_MASK 0xe0
-#define REM_RESP 0x80
-#define REM_ERROR 0x40
-#define REM_MORE 0x20
-/* In control message, bits 11 - 15 are opcode */
-#define OP_MASK 0x1f
-#define OP_SET(x,y)   do{ x |= (y&OP_MASK); }while(0)
-#define OP_READSTAT 0x01
-#define OP_READVAR  0x02
-/* In peer status bytes, bits 6,7,8 determine clock selection status */
-#define PEER_SEL(x) ((ntohs(x)>>8)&0x07)
-#define PEER_TRUECHIMER 0x02
-#define PEER_INCLUDED 0x04
-#define PEER_SYNCSOURCE 0x06
-
-/* NTP control message header is 12 bytes, plus any data in the data
- * field, plus null padding to the nearest 32-bit boundary per rfc.
- */
-#define SIZEOF_NTPCM(m) (12+ntohs(m.count)+((ntohs(m.count)%4)?4-(ntohs(m.count)%4):0))
-
-/* finally, a little helper or two for debugging: */
-#define DBG(x) do{if(verbose>1){ x; }}while(0);
-#define PRINTSOCKADDR(x) \
-	do{ \
-		printf("%u.%u.%u.%u", (x>>24)&0xff, (x>>16)&0xff, (x>>8)&0xff, x&0xff);\
-	}while(0);
-
-void print_ntp_control_message(const ntp_control_message *p){
-	int i=0, numpeers=0;
-	const ntp_assoc_status_pair *peer=NULL;
-
-	printf("control packet contents:\n");
-	printf("\tflags: 0x%.2x , 0x%.2x\n", p->flags, p->op);
-	printf("\t  li=%d (0x%.2x)\n", LI(p->flags), p->flags&LI_MASK);
-	printf("\t  vn=%d (0x%.2x)\n", VN(p->flags), p->flags&VN_MASK);
-	printf("\t  mode=%d (0x%.2x)\n", MODE(p->flags), p->flags&MODE_MASK);
-	printf("\t  response=%d (0x%.2x)\n", (p->op&REM_RESP)>0, p->op&REM_RESP);
-	printf("\t  more=%d (0x%.2x)\n", (p->op&REM_MORE)>0, p->op&REM_MORE);
-	printf("\t  error=%d (0x%.2x)\n", (p->op&REM_ERROR)>0, p->op&REM_ERROR);
-	printf("\t  op=%d (0x%.2x)\n", p->op&OP_MASK, p->op&OP_MASK);
-	printf("\tsequence: %d (0x%.2x)\n", ntohs(p->seq), ntohs(p->seq));
-	printf("\tstatus: %d (0x%.2x)\n", ntohs(p->status), ntohs(p->status));
-	printf("\tassoc: %d (0x%.2x)\n", ntohs(p->assoc), ntohs(p->assoc));
-	printf("\toffset: %d (0x%.2x)\n", ntohs(p->offset), ntohs(p->offset));
-	printf("\tcount: %d (0x%.2x)\n", ntohs(p->count), ntohs(p->count));
-	numpeers=ntohs(p->count)/(sizeof(ntp_assoc_status_pair));
-	if(p->op&REM_RESP && p->op&OP_READSTAT){
-		peer=(ntp_assoc_status_pair*)p->data;
-		for(i=0;i<numpeers;i++){
-			printf("\tpeer id %.2x status %.2x",
-			       ntohs(peer[i].assoc), ntohs(peer[i].status));
-			if(PEER_SEL(peer[i].status) >= PEER_SYNCSOURCE){
-				printf(" <-- current sync source");
-			} else if(PEER_SEL(peer[i].status) >= PEER_INCLUDED){
-				printf(" <-- current sync candidate");
-			} else if(PEER_SEL(peer[i].status) >= PEER_TRUECHIMER){
-				printf(" <-- outlyer, but truechimer");
+	int peer;            /* index into the peer list, -1 if the slot is free */
+	int level;           /* the getvars[] entry asked for */
+	uint16_t seq;        /* the sequence number the reply will carry */
+	char *buf;           /* the reply, put together by fragment offset */
+	size_t have;         /* bytes received so far */
+	size_t total;        /* size of the reply, known from its last fragment */
+	size_t size;         /* allocated for buf */
+	int last;            /* whether the last fragment came in */
+} ntp_readvar_slot;
+
+static void send_readvar(int conn, const ntp_assoc_status_pair *peers, ntp_readvar_slot *slot, uint16_t seq){
+	ntp_control_message req;
+
+	np_ntp_setup_control_request(&req, OP_READVAR, seq);
+	req.assoc = peers[slot->peer].assoc;
+	strncpy(req.data, getvars[slot->level], MAX_CM_SIZE-1);
+	req.count = htons(strlen(getvars[slot->level]));
+	DBG(printf("sending READVAR request %u for peer %.2x...\n", seq, ntohs(req.assoc)));
+	write(conn, &req, SIZEOF_NTPCM(req));
+	free(slot->buf);
+	slot->buf = NULL;
+	slot->seq = seq;
+	slot->have = slot->total = slot->size = 0;
+	slot->last = 0;
+}
+
+/* The same as calling readvar() for each selected peer, but with up to
+ * --pipeline requests out at a time, told apart by their sequence numbers.
+ * Replies that span several datagrams are put together by the offset of
+ * each fragment, and requests still out after a second are sent again. */
+static void readvar_pipelined(int conn, const ntp_assoc_status_pair *peers, int npeers, int min_peer_sel, char **peer_data, int *peer_level){
+	ntp_readvar_slot *slots;
+	ntp_control_message req;
+	struct pollfd pfd;
+	uint16_t seq = 2;
+	int next = 0, inflight = 0, level = 0, i, n;
+	size_t off, cnt;
+	char *tmp;
+
+	if((slots=calloc(pipeline, sizeof(ntp_readvar_slot))) == NULL)
+		die(STATE_UNKNOWN, "can not allocate request slots\n");
+	for(i = 0; i < pipeline; i++)
+		slots[i].peer = -1;
+	pfd.fd = conn;
+	pfd.events = POLLIN;
+
+	for(;;){
+		/* fill the free slots with the next peers worth asking */
+		for(i = 0; i < pipeline; i++){
+			while(slots[i].peer < 0 && next < npeers){
+				if(PEER_SEL(peers[next].status) >= min_peer_sel){
+					if(verbose) printf("Getting %s for peer %.2x\n", getvars[level], ntohs(peers[next].assoc));
+					slots[i].peer = next;
+					slots[i].level = level;
+					send_readvar(conn, peers, &slots[i], seq++);
+					inflight++;
+				}
+				next++;
 			}
-			printf("\n");
 		}
-	}
-}
+		if(inflight == 0)
+			break;
 
-void
-setup_control_request(ntp_control_message *p, uint8_t opcode, uint16_t seq){
-	memset(p, 0, sizeof(ntp_control_message));
-	LI_SET(p->flags, LI_NOWARNING);
-	VN_SET(p->flags, VN_RESERVED);
-	MODE_SET(p->flags, MODE_CONTROLMSG);
-	OP_SET(p->op, opcode);
-	p->seq = htons(seq);
-	/* Remaining fields are zero for requests */
+		if((n = poll(&pfd, 1, 1000)) < 0)
+			die(STATE_UNKNOWN, "poll failed: %s\n", strerror(errno));
+		if(n == 0){
+			DBG(printf("%d READVAR requests timed out, sending them again\n", inflight));
+			for(i = 0; i < pipeline; i++)
+				if(slots[i].peer >= 0)
+					send_readvar(conn, peers, &slots[i], seq++);
+			continue;
+		}
+
+		req.count = htons(MAX_CM_SIZE);
+		if(read(conn, &req, sizeof(req)) < 12)
+			continue;
+		DBG(np_ntp_print_control_message(&req));
+		for(i = 0; i < pipeline; i++)
+			if(slots[i].peer >= 0 && slots[i].seq == ntohs(req.seq))
+				break;
+		cnt = ntohs(req.count);
+		off = ntohs(req.offset);
+		if(i == pipeline || !(req.op&OP_READVAR) || cnt > MAX_CM_SIZE)
+			continue;
+
+		if(req.op&REM_ERROR){
+			if(slots[i].level < 2){
+				if(slots[i].level >= level)
+					level = next_getvar_level(slots[i].level);
+				slots[i].level = level;
+				send_readvar(conn, peers, &slots[i], seq++);
+				continue;
+			}
+			cnt = off = 0;
+			req.op &= ~REM_MORE;
+		}
+
+		if(off + cnt + 1 > slots[i].size){
+			if((tmp = realloc(slots[i].buf, off + cnt + 1)) == NULL)
+				die(STATE_UNKNOWN, "can not (re)allocate reply buffer\n");
+			slots[i].buf = tmp;
+			slots[i].size = off + cnt + 1;
+		}
+		memcpy(slots[i].buf + off, req.data, cnt);
+		slots[i].have += cnt;
+		if(!(req.op&REM_MORE)){
+			slots[i].total = off + cnt;
+			slots[i].last = 1;
+		}
+		if(slots[i].last && slots[i].have >= slots[i].total){
+			slots[i].buf[slots[i].total] = '\0';
+			peer_data[slots[i].peer] = slots[i].buf;
+			peer_level[slots[i].peer] = slots[i].level;
+			slots[i].buf = NULL;
+			slots[i].peer = -1;
+			inflight--;
+		}
+	}
+	free(slots);
 }
 
 /* This function does all the actual work; roughly here's what it does
@@ -203,13 +276,12 @@ int ntp_request(const char *host, double *offset, int *offset_result, double *ji
 	int conn=-1, i, npeers=0, num_candidates=0;
 	double tmp_offset = 0;
 	int min_peer_sel=PEER_INCLUDED;
-	int peers_size=0, peer_offset=0;
 	int status;
 	ntp_assoc_status_pair *peers=NULL;
-	ntp_control_message req;
-	const char *getvar = "stratum,offset,jitter";
+	const char *getvar;
 	char *data, *value, *nptr;
-	void *tmp;
+	char **peer_data;
+	int *peer_level, level=0;
 
 	status = STATE_OK;
 	*offset_result = STATE_UNKNOWN;
@@ -236,36 +308,7 @@ int ntp_request(const char *host, double *offset, int *offset_result, double *ji
 
 	/* keep sending requests until the server stops setting the
 	 * REM_MORE bit, though usually this is only 1 packet. */
-	do{
-		setup_control_request(&req, OP_READSTAT, 1);
-		DBG(printf("sending READSTAT request"));
-		write(conn, &req, SIZEOF_NTPCM(req));
-		DBG(print_ntp_control_message(&req));
-
-		do {
-			/* Attempt to read the largest size packet possible */
-			req.count=htons(MAX_CM_SIZE);
-			DBG(printf("receiving READSTAT response"))
-			if(read(conn, &req, SIZEOF_NTPCM(req)) == -1)
-				die(STATE_CRITICAL, "NTP CRITICAL: No response from NTP server\n");
-			DBG(print_ntp_control_message(&req));
-			/* discard obviously invalid packets */
-			if (ntohs(req.count) > MAX_CM_SIZE)
-				die(STATE_CRITICAL, "NTP CRITICAL: Invalid packet received from NTP server\n");
-		} while (!(req.op&OP_READSTAT && ntohs(req.seq) == 1));
-
-		if (LI(req.flags) == LI_ALARM) li_alarm = 1;
-		/* Each peer identifier is 4 bytes in the data section, which
-	 	 * we represent as a ntp_assoc_status_pair datatype.
-	 	 */
-		peers_size+=ntohs(req.count);
-		if((tmp=realloc(peers, peers_size)) == NULL)
-			free(peers), die(STATE_UNKNOWN, "can not (re)allocate 'peers' buffer\n");
-		peers=tmp;
-		memcpy((void*)((ptrdiff_t)peers+peer_offset), (void*)req.data, ntohs(req.count));
-		npeers=peers_size/sizeof(ntp_assoc_status_pair);
-		peer_offset+=ntohs(req.count);
-	} while(req.op&REM_MORE);
+	npeers=np_ntp_readstat(conn, &peers, &li_alarm, verbose);
 
 	/* first, let's find out if we have a sync source, or if there are
 	 * at least some candidates. In the latter case we'll issue
@@ -294,52 +337,28 @@ int ntp_request(const char *host, double *offset, int *offset_result, double *ji
 	}
 
 
-	for (i = 0; i < npeers; i++){
-		/* Only query this server if it is the current sync source */
-		/* If there's no sync.peer, query all candidates and use the best one */
-		if (PEER_SEL(peers[i].status) >= min_peer_sel){
-			if(verbose) printf("Getting offset, jitter and stratum for peer %.2x\n", ntohs(peers[i].assoc));
-			xasprintf(&data, "");
-			do{
-				setup_control_request(&req, OP_READVAR, 2);
-				req.assoc = peers[i].assoc;
-				/* Putting the wanted variable names in the request
-				 * cause the server to provide _only_ the requested values.
-				 * thus reducing net traffic, guaranteeing us only a single
-				 * datagram in reply, and making intepretation much simpler
-				 */
-				/* Older servers doesn't know what jitter is, so if we get an
-				 * error on the first pass we redo it with "dispersion" */
-				strncpy(req.data, getvar, MAX_CM_SIZE-1);
-				req.count = htons(strlen(getvar));
-				DBG(printf("sending READVAR request...\n"));
-				write(conn, &req, SIZEOF_NTPCM(req));
-				DBG(print_ntp_control_message(&req));
-
-				do {
-					req.count = htons(MAX_CM_SIZE);
-					DBG(printf("receiving READVAR response...\n"));
-					read(conn, &req, SIZEOF_NTPCM(req));
-					DBG(print_ntp_control_message(&req));
-				} while (!(req.op&OP_READVAR && ntohs(req.seq) == 2));
-
-				if(!(req.op&REM_ERROR))
-					xasprintf(&data, "%s%s", data, req.data);
-			} while(req.op&REM_MORE);
-
-			if(req.op&REM_ERROR) {
-				if(strstr(getvar, "jitter")) {
-					if(verbose) printf("The command failed. This is usually caused by servers refusing the 'jitter'\nvariable. Restarting with 'dispersion'...\n");
-					getvar = "stratum,offset,dispersion";
-					i--;
-					continue;
-				} else if(strlen(getvar)) {
-					if(verbose) printf("Server didn't like dispersion either; will retrieve everything\n");
-					getvar = "";
-					i--;
-					continue;
-				}
+	/* Only query the current sync source, or if there's no sync.peer,
+	 * query all candidates and use the best one */
+	setup_getvars();
+	if((peer_data=calloc(npeers, sizeof(char *))) == NULL ||
+	   (peer_level=calloc(npeers, sizeof(int))) == NULL)
+		die(STATE_UNKNOWN, "can not allocate peer arrays\n");
+	if(pipeline > 1){
+		readvar_pipelined(conn, peers, npeers, min_peer_sel, peer_data, peer_level);
+	} else {
+		for (i = 0; i < npeers; i++){
+			if (PEER_SEL(peers[i].status) >= min_peer_sel){
+				if(verbose) printf("Getting %s for peer %.2x\n", getvars[level], ntohs(peers[i].assoc));
+				peer_data[i] = readvar(conn, peers[i].assoc, &level);
+				peer_level[i] = level;
 			}
+		}
+	}
+
+	for (i = 0; i < npeers; i++){
+		if (peer_data[i] != NULL){
+			data = peer_data[i];
+			getvar = getvars[peer_level[i]];
 
 			if(verbose > 1)
 				printf("Server responded: >>>%s<<<\n", data);
@@ -403,10 +422,14 @@ int ntp_request(const char *host, double *offset, int *offset_result, double *ji
 					if(verbose) printf("%i\n", *stratum);
 				}
 			}
-		} /* if (PEER_SEL(peers[i].status) >= min_peer_sel) */
+		} /* if (peer_data[i] != NULL) */
 	} /* for (i = 0; i < npeers; i++) */
 
 	close(conn);
+	for (i = 0; i < npeers; i++)
+		free(peer_data[i]);
+	free(peer_data);
+	free(peer_level);
 	if(peers!=NULL) free(peers);
 
 	return status;
@@ -415,6 +438,11 @@ int ntp_request(const char *host, double *offset, int *offset_result, double *ji
 int process_arguments(int argc, char **argv){
 	int c;
 	int option=0;
+
+	enum {
+		PIPELINE_OPTION = CHAR_MAX + 1
+	};
+
 	static struct option longopts[] = {
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -433,6 +461,7 @@ int process_arguments(int argc, char **argv){
 		{"timeout", required_argument, 0, 't'},
 		{"hostname", required_argument, 0, 'H'},
 		{"port", required_argument, 0, 'p'},
+		{"pipeline", required_argument, 0, PIPELINE_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -503,6 +532,11 @@ int process_arguments(int argc, char **argv){
 		case 't':
 			socket_timeout=atoi(optarg);
 			break;
+		case PIPELINE_OPTION:
+			if(!is_intpos(optarg))
+				usage2(_("Pipeline must be a positive integer"), optarg);
+			pipeline=atoi(optarg);
+			break;
 		case '4':
 			address_family = AF_INET;
 			break;
@@ -564,9 +598,7 @@ int main(int argc, char *argv[]){
 	double offset=0, jitter=0;
 	char *result_line, *perfdata_line;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -714,6 +746,9 @@ void print_help(void){
 	printf ("    %s\n", _("Warning threshold for number of usable time sources (\"truechimers\")"));
 	printf (" %s\n", "-n, --tcrit=THRESHOLD");
 	printf ("    %s\n", _("Critical threshold for number of usable time sources (\"truechimers\")"));
+	printf (" %s\n", "--pipeline=INTEGER");
+	printf ("    %s\n", _("Keep up to INTEGER requests for peer variables out at a time instead of"));
+	printf ("    %s\n", _("asking for one peer after the other (default: 1)"));
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 	printf (UT_VERBOSE);
 
@@ -726,6 +761,8 @@ void print_help(void){
 	printf(" %s\n", _("checking the offset with the sync peer, the jitter and stratum. This"));
 	printf(" %s\n", _("plugin will not check the clock offset between the local host and NTP"));
 	printf(" %s\n", _("server; please use check_ntp_time for that purpose."));
+	printf(" %s\n", _("Only the variables there are thresholds for are asked for, so leaving"));
+	printf(" %s\n", _("out -W/-C and -j/-k makes the replies smaller."));
 	printf("\n");
 	printf(UT_THRESHOLDS_NOTES);
 
@@ -752,5 +789,5 @@ print_usage(void)
 {
 	printf ("%s\n", _("Usage:"));
 	printf(" %s -H <host> [-4|-6] [-w <warn>] [-c <crit>] [-W <warn>] [-C <crit>]\n", progname);
-	printf("       [-j <warn>] [-k <crit>] [-v verbose]\n");
+	printf("       [-j <warn>] [-k <crit>] [-v verbose] [--pipeline=<requests>]\n");
 }
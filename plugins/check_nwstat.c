@@ -110,7 +110,32 @@ int check_netware_version=FALSE;
 enum checkvar vars_to_check = NONE;
 int sap_number=-1;
 
+
+/* one -v, with the thresholds that go with it */
+typedef struct nw_variable {
+	char *name;
+	unsigned long warning_value;
+	unsigned long critical_value;
+	int check_warning_value;
+	int check_critical_value;
+} nw_variable;
+
+nw_variable *variables=NULL;
+int n_variables=0;
+
+/* the one connection to the NLM all variables are asked for on */
+int sd;
+np_net_reader reader;
+int dry_run=FALSE;
+char *ahead=NULL;      /* commands sent before their replies are needed */
+char *ahead_pos=NULL;  /* the first of those whose reply was not read yet */
+
 int process_arguments(int, char **);
+int parse_variable(const char *);
+void select_variable(const nw_variable *);
+static int nw_request(const char *, char *, size_t);
+static int check_server(char **);
+static int check_variable(char **);
 void print_help(void);
 void print_usage(void);
 
@@ -119,12 +144,192 @@ void print_usage(void);
 int
 main(int argc, char **argv) {
 	int result = STATE_UNKNOWN;
-	int sd;
+	char *output_message=NULL;
+
+	np_locale_init ();
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts(&argc, argv, progname);
+
+	if (process_arguments(argc,argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	/* initialize alarm signal handling */
+	signal(SIGALRM,socket_timeout_alarm_handler);
+
+	/* set socket timeout */
+	alarm(socket_timeout);
+
+	/* open connection */
+	my_tcp_connect (server_address, server_port, &sd);
+	np_net_reader_init (&reader, sd, NULL);
+
+	/* a dry run learns which commands the checks are going to send, so
+	 * they can all go out at once and the NLM is waited for only once */
+	dry_run=TRUE;
+	check_server (&output_message);
+	dry_run=FALSE;
+	if (ahead!=NULL && send (sd, ahead, strlen (ahead), 0) != (ssize_t) strlen (ahead)) {
+		printf ("%s\n", _("Send failed"));
+		return STATE_WARNING;
+	}
+	ahead_pos=ahead;
+
+	output_message=NULL;
+	result=check_server (&output_message);
+
+	close (sd);
+
+	/* reset timeout */
+	alarm(0);
+
+	if (output_message!=NULL)
+		printf("%s\n",output_message);
+
+	return result;
+}
+
+
+
+/* wait for and read one line of reply */
+static int
+nw_reply (char *buf, size_t size)
+{
+	struct timeval tv;
+	fd_set readfds;
+	int n;
+
+	/* wait up to the number of seconds for socket timeout minus one
+	   for data from the host, unless some is here already */
+	if (reader.start==reader.end) {
+		tv.tv_sec = socket_timeout - 1;
+		tv.tv_usec = 0;
+		FD_ZERO (&readfds);
+		FD_SET (sd, &readfds);
+		select (sd + 1, &readfds, NULL, NULL, &tv);
+		if (!FD_ISSET (sd, &readfds)) {
+			strcpy (buf, "");
+			printf ("%s\n", _("No data was received from host!"));
+			return STATE_WARNING;
+		}
+	}
+
+	n = np_net_recvline (&reader, buf, size);
+	if (n <= 0) {
+		strcpy (buf, "");
+		printf ("%s\n", (n == 0) ? _("No data was received from host!") : _("Receive failed"));
+		return STATE_WARNING;
+	}
+	return STATE_OK;
+}
+
+
+
+/* Send a command to the NLM and read its reply.  In the dry run nothing is
+ * sent: the command goes on the list of those to send ahead and the reply
+ * is always "1". */
+static int
+nw_request (const char *cmd, char *buf, size_t size)
+{
+	size_t len;
+	int result;
+
+	if (dry_run) {
+		xasprintf (&ahead, "%s%s", ahead ? ahead : "", cmd);
+		strcpy (buf, "1\n");
+		return STATE_OK;
+	}
+
+	/* replies to commands sent ahead that turn out not to be needed (VKS
+	 * of a volume that does not exist) are skipped */
+	while (ahead_pos!=NULL && *ahead_pos) {
+		len = strcspn (ahead_pos, "\n") + 1;
+		result = nw_reply (buf, size);
+		if (result!=STATE_OK || (strlen (cmd)==len && !strncmp (cmd, ahead_pos, len))) {
+			ahead_pos += len;
+			return result;
+		}
+		ahead_pos += len;
+	}
+
+	if (send (sd, cmd, strlen (cmd), 0) != (ssize_t) strlen (cmd)) {
+		printf ("%s\n", _("Send failed"));
+		return STATE_WARNING;
+	}
+	return nw_reply (buf, size);
+}
+
+
+
+/* Check all variables, put the plugin output into *output and return the
+ * overall state.  *output is left NULL if the NLM could not be asked. */
+static int
+check_server (char **output) {
+	int result = STATE_UNKNOWN;
+	int state = STATE_OK;
+	int i;
+	char *send_buffer=NULL;
+	char recv_buffer[MAX_INPUT_BUFFER];
+	char *netware_version=NULL;
+	char *message=NULL;
+	char *text=NULL;
+	char *perf=NULL;
+	char *bar;
+
+	/* get OS version string */
+	if (check_netware_version==TRUE) {
+		send_buffer = strdup ("S19\r\n");
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
+		if (result!=STATE_OK)
+			return result;
+		if (!strcmp(recv_buffer,"-1\n"))
+			netware_version = strdup("");
+		else {
+			recv_buffer[strlen(recv_buffer)-1]=0;
+			xasprintf (&netware_version,_("NetWare %s: "),recv_buffer);
+		}
+	} else
+		netware_version = strdup("");
+
+	if (n_variables<=1) {
+		if (n_variables==1)
+			select_variable (&variables[0]);
+		result=check_variable (&message);
+		if (message!=NULL)
+			xasprintf (output,"%s%s",netware_version,message);
+		return result;
+	}
+
+	/* all variables on one line, and all their perfdata after it */
+	for (i=0; i<n_variables; i++) {
+		select_variable (&variables[i]);
+		result=check_variable (&message);
+		if (message==NULL)
+			return result;
+		state=max_state_alt (state, result);
+
+		if ((bar=strchr (message,'|'))!=NULL) {
+			*bar++='\0';
+			xasprintf (&perf,"%s%s%s",perf ? perf : "",perf ? " " : "",bar);
+		}
+		xasprintf (&text,"%s%s%s",text ? text : "",text ? "; " : "",message);
+	}
+
+	xasprintf (output,"%s%s%s%s",netware_version,text,perf ? "|" : "",perf ? perf : "");
+	return state;
+}
+
+
+
+/* check the variable select_variable() picked, the output goes into
+ * *message unless the NLM could not be asked */
+static int
+check_variable (char **message) {
+	int result = STATE_UNKNOWN;
 	char *send_buffer=NULL;
 	char recv_buffer[MAX_INPUT_BUFFER];
 	char *output_message=NULL;
 	char *temp_buffer=NULL;
-	char *netware_version=NULL;
 
 	int time_sync_status=0;
 	int nrm_health_status=0;
@@ -162,40 +367,8 @@ main(int argc, char **argv) {
 	unsigned long sap_entries=0;
 	char uptime[MAX_INPUT_BUFFER];
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
-	/* Parse extra opts if any */
-	argv=np_extra_opts(&argc, argv, progname);
-
-	if (process_arguments(argc,argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
-
-	/* initialize alarm signal handling */
-	signal(SIGALRM,socket_timeout_alarm_handler);
-
-	/* set socket timeout */
-	alarm(socket_timeout);
-
-	/* open connection */
-	my_tcp_connect (server_address, server_port, &sd);
-
-	/* get OS version string */
-	if (check_netware_version==TRUE) {
-		send_buffer = strdup ("S19\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
-		if (result!=STATE_OK)
-			return result;
-		if (!strcmp(recv_buffer,"-1\n"))
-			netware_version = strdup("");
-		else {
-			recv_buffer[strlen(recv_buffer)-1]=0;
-			xasprintf (&netware_version,_("NetWare %s: "),recv_buffer);
-		}
-	} else
-		netware_version = strdup("");
 
+	*message=NULL;
 
 	/* check CPU load */
 	if (vars_to_check==LOAD1 || vars_to_check==LOAD5 || vars_to_check==LOAD15) {
@@ -212,20 +385,14 @@ main(int argc, char **argv) {
 			break;
 		}
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"UTIL%s\r\n",temp_buffer);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		utilization=strtoul(recv_buffer,NULL,10);
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("UPTIME\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		recv_buffer[strlen(recv_buffer)-1]=0;
@@ -250,11 +417,8 @@ main(int argc, char **argv) {
 		/* check number of user connections */
 	} else if (vars_to_check==CONNS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("CONNECT\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		current_connections=strtoul(recv_buffer,NULL,10);
@@ -275,11 +439,8 @@ main(int argc, char **argv) {
 		/* check % long term cache hits */
 	} else if (vars_to_check==LTCH) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S1\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		cache_hits=atoi(recv_buffer);
@@ -297,11 +458,8 @@ main(int argc, char **argv) {
 		/* check cache buffers */
 	} else if (vars_to_check==CBUFF) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S2\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		cache_buffers=strtoul(recv_buffer,NULL,10);
@@ -322,11 +480,8 @@ main(int argc, char **argv) {
 		/* check dirty cache buffers */
 	} else if (vars_to_check==CDBUFF) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S3\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		cache_buffers=strtoul(recv_buffer,NULL,10);
@@ -347,11 +502,8 @@ main(int argc, char **argv) {
 		/* check LRU sitting time in minutes */
 	} else if (vars_to_check==LRUM) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S5\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		lru_time=strtoul(recv_buffer,NULL,10);
@@ -370,11 +522,8 @@ main(int argc, char **argv) {
 		/* check KB free space on volume */
 	} else if (vars_to_check==VKF) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKF%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -402,7 +551,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==VMF) {
 
 		xasprintf (&send_buffer,"VMF%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -429,7 +578,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==VMU) {
 
 		xasprintf (&send_buffer,"VMU%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -457,11 +606,8 @@ main(int argc, char **argv) {
 		/* check % free space on volume */
 	} else if (vars_to_check==VPF) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKF%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -474,11 +620,8 @@ main(int argc, char **argv) {
 
 			free_disk_space=strtoul(recv_buffer,NULL,10);
 
-			close(sd);
-			my_tcp_connect (server_address, server_port, &sd);
-
 			xasprintf (&send_buffer,"VKS%s\r\n",volume_name);
-			result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+			result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 			if (result!=STATE_OK)
 				return result;
 			total_disk_space=strtoul(recv_buffer,NULL,10);
@@ -506,11 +649,8 @@ main(int argc, char **argv) {
 		/* check to see if DS Database is open or closed */
 	} else if (vars_to_check==DSDB) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S11\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		if (atoi(recv_buffer)==1)
@@ -518,11 +658,8 @@ main(int argc, char **argv) {
 		else
 			result=STATE_WARNING;
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S13\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		temp_buffer=strtok(recv_buffer,"\r\n");
 
 		xasprintf (&output_message,_("Directory Services Database is %s (DS version %s)"),(result==STATE_OK)?"open":"closed",temp_buffer);
@@ -530,11 +667,8 @@ main(int argc, char **argv) {
 		/* check to see if logins are enabled */
 	} else if (vars_to_check==LOGINS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S12\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		if (atoi(recv_buffer)==1)
@@ -549,7 +683,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NRMH) {
 
 		xasprintf (&send_buffer,"NRMH\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -573,21 +707,15 @@ main(int argc, char **argv) {
 		/* check packet receive buffers */
 	} else if (vars_to_check==UPRB || vars_to_check==PUPRB) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S15\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
 		used_packet_receive_buffers=atoi(recv_buffer);
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S16\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -612,14 +740,11 @@ main(int argc, char **argv) {
 		/* check SAP table entries */
 	} else if (vars_to_check==SAPENTRIES) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		if (sap_number==-1)
 			xasprintf (&send_buffer,"S9\r\n");
 		else
 			xasprintf (&send_buffer,"S9.%d\r\n",sap_number);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -638,11 +763,8 @@ main(int argc, char **argv) {
 		/* check KB purgeable space on volume */
 	} else if (vars_to_check==VKP) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -668,7 +790,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==VMP) {
 
 		xasprintf (&send_buffer,"VMP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -694,11 +816,8 @@ main(int argc, char **argv) {
 		/* check % purgeable space on volume */
 	} else if (vars_to_check==VPP) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -711,11 +830,8 @@ main(int argc, char **argv) {
 
 			purgeable_disk_space=strtoul(recv_buffer,NULL,10);
 
-			close(sd);
-			my_tcp_connect (server_address, server_port, &sd);
-
 			xasprintf (&send_buffer,"VKS%s\r\n",volume_name);
-			result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+			result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 			if (result!=STATE_OK)
 				return result;
 			total_disk_space=strtoul(recv_buffer,NULL,10);
@@ -741,11 +857,8 @@ main(int argc, char **argv) {
 		/* check KB not yet purgeable space on volume */
 	} else if (vars_to_check==VKNP) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKNP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -764,11 +877,8 @@ main(int argc, char **argv) {
 		/* check % not yet purgeable space on volume */
 	} else if (vars_to_check==VPNP) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"VKNP%s\r\n",volume_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -781,11 +891,8 @@ main(int argc, char **argv) {
 
 			non_purgeable_disk_space=strtoul(recv_buffer,NULL,10);
 
-			close(sd);
-			my_tcp_connect (server_address, server_port, &sd);
-
 			xasprintf (&send_buffer,"VKS%s\r\n",volume_name);
-			result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+			result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 			if (result!=STATE_OK)
 				return result;
 			total_disk_space=strtoul(recv_buffer,NULL,10);
@@ -803,11 +910,8 @@ main(int argc, char **argv) {
 		/* check # of open files */
 	} else if (vars_to_check==OFILES) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S18\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -828,11 +932,8 @@ main(int argc, char **argv) {
 		/* check # of abended threads (Netware > 5.x only) */
 	} else if (vars_to_check==ABENDS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S17\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -852,21 +953,15 @@ main(int argc, char **argv) {
 		/* check # of current service processes (Netware 5.x only) */
 	} else if (vars_to_check==CSPROCS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S20\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
 		max_service_processes=atoi(recv_buffer);
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S21\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -889,11 +984,8 @@ main(int argc, char **argv) {
 		/* check # Timesync Status */
 	} else if (vars_to_check==TSYNC) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S22\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -914,11 +1006,8 @@ main(int argc, char **argv) {
 		/* check LRU sitting time in secondss */
 	} else if (vars_to_check==LRUS) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S4\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		lru_time=strtoul(recv_buffer,NULL,10);
@@ -933,11 +1022,8 @@ main(int argc, char **argv) {
 		/* check % dirty cacheobuffers as a percentage of the total*/
 	} else if (vars_to_check==DCB) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S6\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		dirty_cache_buffers=atoi(recv_buffer);
@@ -955,11 +1041,8 @@ main(int argc, char **argv) {
 		/* check % total cache buffers as a percentage of the original*/
 	} else if (vars_to_check==TCB) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		send_buffer = strdup ("S7\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 		total_cache_buffers=atoi(recv_buffer);
@@ -976,11 +1059,8 @@ main(int argc, char **argv) {
 
 	} else if (vars_to_check==DSVER) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S13\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -990,11 +1070,8 @@ main(int argc, char **argv) {
 
 	} else if (vars_to_check==UPTIME) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"UPTIME\r\n");
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 	 		return result;
 
@@ -1006,11 +1083,8 @@ main(int argc, char **argv) {
 
 	} else if (vars_to_check==NLM) {
 
-		close(sd);
-		my_tcp_connect (server_address, server_port, &sd);
-
 		xasprintf (&send_buffer,"S24:%s\r\n",nlm_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1025,7 +1099,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NRMP) {
 
 		xasprintf (&send_buffer,"NRMP:%s\r\n",nrmp_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1051,7 +1125,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NRMM) {
 
 		xasprintf (&send_buffer,"NRMM:%s\r\n",nrmm_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1077,7 +1151,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NRMS) {
 
 		xasprintf (&send_buffer,"NRMS:%s\r\n",nrms_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1103,7 +1177,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS1) {
 
 		xasprintf (&send_buffer,"NSS1:%s\r\n",nss1_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1129,7 +1203,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS2) {
 
 		xasprintf (&send_buffer,"NSS2:%s\r\n",nss2_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1155,7 +1229,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS3) {
 
 		xasprintf (&send_buffer,"NSS3:%s\r\n",nss3_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1181,7 +1255,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS4) {
 
 		xasprintf (&send_buffer,"NSS4:%s\r\n",nss4_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1207,7 +1281,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS5) {
 
 		xasprintf (&send_buffer,"NSS5:%s\r\n",nss5_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1233,7 +1307,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS6) {
 
 		xasprintf (&send_buffer,"NSS6:%s\r\n",nss6_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1259,7 +1333,7 @@ main(int argc, char **argv) {
 	} else if (vars_to_check==NSS7) {
 
 		xasprintf (&send_buffer,"NSS7:%s\r\n",nss7_name);
-		result=send_tcp_request(sd,send_buffer,recv_buffer,sizeof(recv_buffer));
+		result=nw_request(send_buffer,recv_buffer,sizeof(recv_buffer));
 		if (result!=STATE_OK)
 			return result;
 
@@ -1291,13 +1365,7 @@ main(int argc, char **argv) {
 
 	}
 
-	close (sd);
-
-	/* reset timeout */
-	alarm(0);
-
-	printf("%s%s\n",netware_version,output_message);
-
+	*message=output_message;
 	return result;
 }
 
@@ -1371,223 +1439,271 @@ int process_arguments(int argc, char **argv) {
 					die(STATE_UNKNOWN,_("Server port an integer\n"));
 				break;
 			case 'v':
-				if (strlen(optarg)<3)
+				if (parse_variable(optarg)==ERROR)
 					return ERROR;
-				if (!strcmp(optarg,"LOAD1"))
-					vars_to_check=LOAD1;
-				else if (!strcmp(optarg,"LOAD5"))
-					vars_to_check=LOAD5;
-				else if (!strcmp(optarg,"LOAD15"))
-					vars_to_check=LOAD15;
-				else if (!strcmp(optarg,"CONNS"))
-					vars_to_check=CONNS;
-				else if (!strcmp(optarg,"LTCH"))
-					vars_to_check=LTCH;
-				else if (!strcmp(optarg,"DCB"))
-					vars_to_check=DCB;
-				else if (!strcmp(optarg,"TCB"))
-					vars_to_check=TCB;
-				else if (!strcmp(optarg,"CBUFF"))
-					vars_to_check=CBUFF;
-				else if (!strcmp(optarg,"CDBUFF"))
-					vars_to_check=CDBUFF;
-				else if (!strcmp(optarg,"LRUM"))
-					vars_to_check=LRUM;
-				else if (!strcmp(optarg,"LRUS"))
-					vars_to_check=LRUS;
-				else if (strncmp(optarg,"VPF",3)==0) {
-					vars_to_check=VPF;
-					volume_name = strdup (optarg+3);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup ("SYS");
-				}
-				else if (strncmp(optarg,"VKF",3)==0) {
-					vars_to_check=VKF;
-					volume_name = strdup (optarg+3);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup ("SYS");
-				}
-				else if (strncmp(optarg,"VMF",3)==0) {
-					vars_to_check=VMF;
-					volume_name = strdup (optarg+3);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup ("SYS");
-				}
-				else if (!strcmp(optarg,"DSDB"))
-					vars_to_check=DSDB;
-				else if (!strcmp(optarg,"LOGINS"))
-					vars_to_check=LOGINS;
-				else if (!strcmp(optarg,"NRMH"))
-					vars_to_check=NRMH;
-				else if (!strcmp(optarg,"UPRB"))
-					vars_to_check=UPRB;
-				else if (!strcmp(optarg,"PUPRB"))
-					vars_to_check=PUPRB;
-				else if (!strncmp(optarg,"SAPENTRIES",10)) {
-					vars_to_check=SAPENTRIES;
-					if (strlen(optarg)>10)
-						sap_number=atoi(optarg+10);
-					else
-						sap_number=-1;
-				}
-				else if (!strcmp(optarg,"OFILES"))
-					vars_to_check=OFILES;
-				else if (strncmp(optarg,"VKP",3)==0) {
-					vars_to_check=VKP;
-					volume_name = strdup (optarg+3);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup ("SYS");
-				}
-				else if (strncmp(optarg,"VMP",3)==0) {
-					vars_to_check=VMP;
-					volume_name = strdup (optarg+3);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup ("SYS");
-				}
-				else if (strncmp(optarg,"VMU",3)==0) {
-					vars_to_check=VMU;
-					volume_name = strdup (optarg+3);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup ("SYS");
-				}
-				else if (strncmp(optarg,"VPP",3)==0) {
-					vars_to_check=VPP;
-					volume_name = strdup (optarg+3);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup ("SYS");
-				}
-				else if (strncmp(optarg,"VKNP",4)==0) {
-					vars_to_check=VKNP;
-					volume_name = strdup (optarg+4);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup ("SYS");
-				}
-				else if (strncmp(optarg,"VPNP",4)==0) {
-					vars_to_check=VPNP;
-					volume_name = strdup (optarg+4);
-					if (!strcmp(volume_name,""))
-						volume_name = strdup("SYS");
-				}
-				else if (!strcmp(optarg,"ABENDS"))
-					vars_to_check=ABENDS;
-				else if (!strcmp(optarg,"CSPROCS"))
-					vars_to_check=CSPROCS;
-				else if (!strcmp(optarg,"TSYNC"))
-					vars_to_check=TSYNC;
-				else if (!strcmp(optarg,"DSVER"))
-					vars_to_check=DSVER;
-				else if (!strcmp(optarg,"UPTIME")) {
-					vars_to_check=UPTIME;
-				}
-				else if (strncmp(optarg,"NLM:",4)==0) {
-					vars_to_check=NLM;
-					nlm_name=strdup (optarg+4);
+				if ((variables = realloc (variables, (n_variables + 1) * sizeof (nw_variable))) == NULL)
+					die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+				memset (&variables[n_variables], 0, sizeof (nw_variable));
+				variables[n_variables++].name=optarg;
+				break;
+			case 'w': /* warning threshold, of the last variable or of all */
+				if (n_variables>0) {
+					variables[n_variables-1].warning_value=strtoul(optarg,NULL,10);
+					variables[n_variables-1].check_warning_value=TRUE;
+					break;
 				}
-				else if (strncmp(optarg,"NRMP",4)==0) {
-					vars_to_check=NRMP;
-					nrmp_name = strdup (optarg+4);
-					if (!strcmp(nrmp_name,""))
-						nrmp_name = strdup ("AVAILABLE_MEMORY");
+				warning_value=strtoul(optarg,NULL,10);
+				check_warning_value=TRUE;
+				break;
+			case 'c': /* critical threshold, of the last variable or of all */
+				if (n_variables>0) {
+					variables[n_variables-1].critical_value=strtoul(optarg,NULL,10);
+					variables[n_variables-1].check_critical_value=TRUE;
+					break;
 				}
-				else if (strncmp(optarg,"NRMM",4)==0) {
-					vars_to_check=NRMM;
-					nrmm_name = strdup (optarg+4);
-					if (!strcmp(nrmm_name,""))
-						nrmm_name = strdup ("AVAILABLE_CACHE_MEMORY");
+				critical_value=strtoul(optarg,NULL,10);
+				check_critical_value=TRUE;
+				break;
+			case 't': /* timeout */
+				socket_timeout=atoi(optarg);
+				if (socket_timeout<=0)
+					return ERROR;
+			}
 
-				}
+	}
 
-				else if (strncmp(optarg,"NRMS",4)==0) {
-					vars_to_check=NRMS;
-					nrms_name = strdup (optarg+4);
-					if (!strcmp(nrms_name,""))
-						nrms_name = strdup ("USED_SWAP_SPACE");
+	/* thresholds given before the first -v are those of the variables
+	 * that have none of their own */
+	for (c=0;c<n_variables;c++) {
+		if (variables[c].check_warning_value==FALSE) {
+			variables[c].warning_value=warning_value;
+			variables[c].check_warning_value=check_warning_value;
+		}
+		if (variables[c].check_critical_value==FALSE) {
+			variables[c].critical_value=critical_value;
+			variables[c].check_critical_value=check_critical_value;
+		}
+	}
 
-				}
+	return OK;
+}
 
-				else if (strncmp(optarg,"NSS1",4)==0) {
-					vars_to_check=NSS1;
-					nss1_name = strdup (optarg+4);
-					if (!strcmp(nss1_name,""))
-						nss1_name = strdup ("CURRENTBUFFERCACHESIZE");
 
-				}
 
-				else if (strncmp(optarg,"NSS2",4)==0) {
-					vars_to_check=NSS2;
-					nss2_name = strdup (optarg+4);
-					if (!strcmp(nss2_name,""))
-						nss2_name = strdup ("CACHEHITS");
+/* set vars_to_check and the names that go with it from a -v argument */
+int parse_variable(const char *arg) {
+	if (strlen(arg)<3)
+		return ERROR;
+	if (!strcmp(arg,"LOAD1"))
+		vars_to_check=LOAD1;
+	else if (!strcmp(arg,"LOAD5"))
+		vars_to_check=LOAD5;
+	else if (!strcmp(arg,"LOAD15"))
+		vars_to_check=LOAD15;
+	else if (!strcmp(arg,"CONNS"))
+		vars_to_check=CONNS;
+	else if (!strcmp(arg,"LTCH"))
+		vars_to_check=LTCH;
+	else if (!strcmp(arg,"DCB"))
+		vars_to_check=DCB;
+	else if (!strcmp(arg,"TCB"))
+		vars_to_check=TCB;
+	else if (!strcmp(arg,"CBUFF"))
+		vars_to_check=CBUFF;
+	else if (!strcmp(arg,"CDBUFF"))
+		vars_to_check=CDBUFF;
+	else if (!strcmp(arg,"LRUM"))
+		vars_to_check=LRUM;
+	else if (!strcmp(arg,"LRUS"))
+		vars_to_check=LRUS;
+	else if (strncmp(arg,"VPF",3)==0) {
+		vars_to_check=VPF;
+		volume_name = strdup (arg+3);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup ("SYS");
+	}
+	else if (strncmp(arg,"VKF",3)==0) {
+		vars_to_check=VKF;
+		volume_name = strdup (arg+3);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup ("SYS");
+	}
+	else if (strncmp(arg,"VMF",3)==0) {
+		vars_to_check=VMF;
+		volume_name = strdup (arg+3);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup ("SYS");
+	}
+	else if (!strcmp(arg,"DSDB"))
+		vars_to_check=DSDB;
+	else if (!strcmp(arg,"LOGINS"))
+		vars_to_check=LOGINS;
+	else if (!strcmp(arg,"NRMH"))
+		vars_to_check=NRMH;
+	else if (!strcmp(arg,"UPRB"))
+		vars_to_check=UPRB;
+	else if (!strcmp(arg,"PUPRB"))
+		vars_to_check=PUPRB;
+	else if (!strncmp(arg,"SAPENTRIES",10)) {
+		vars_to_check=SAPENTRIES;
+		if (strlen(arg)>10)
+			sap_number=atoi(arg+10);
+		else
+			sap_number=-1;
+	}
+	else if (!strcmp(arg,"OFILES"))
+		vars_to_check=OFILES;
+	else if (strncmp(arg,"VKP",3)==0) {
+		vars_to_check=VKP;
+		volume_name = strdup (arg+3);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup ("SYS");
+	}
+	else if (strncmp(arg,"VMP",3)==0) {
+		vars_to_check=VMP;
+		volume_name = strdup (arg+3);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup ("SYS");
+	}
+	else if (strncmp(arg,"VMU",3)==0) {
+		vars_to_check=VMU;
+		volume_name = strdup (arg+3);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup ("SYS");
+	}
+	else if (strncmp(arg,"VPP",3)==0) {
+		vars_to_check=VPP;
+		volume_name = strdup (arg+3);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup ("SYS");
+	}
+	else if (strncmp(arg,"VKNP",4)==0) {
+		vars_to_check=VKNP;
+		volume_name = strdup (arg+4);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup ("SYS");
+	}
+	else if (strncmp(arg,"VPNP",4)==0) {
+		vars_to_check=VPNP;
+		volume_name = strdup (arg+4);
+		if (!strcmp(volume_name,""))
+			volume_name = strdup("SYS");
+	}
+	else if (!strcmp(arg,"ABENDS"))
+		vars_to_check=ABENDS;
+	else if (!strcmp(arg,"CSPROCS"))
+		vars_to_check=CSPROCS;
+	else if (!strcmp(arg,"TSYNC"))
+		vars_to_check=TSYNC;
+	else if (!strcmp(arg,"DSVER"))
+		vars_to_check=DSVER;
+	else if (!strcmp(arg,"UPTIME")) {
+		vars_to_check=UPTIME;
+	}
+	else if (strncmp(arg,"NLM:",4)==0) {
+		vars_to_check=NLM;
+		nlm_name=strdup (arg+4);
+	}
+	else if (strncmp(arg,"NRMP",4)==0) {
+		vars_to_check=NRMP;
+		nrmp_name = strdup (arg+4);
+		if (!strcmp(nrmp_name,""))
+			nrmp_name = strdup ("AVAILABLE_MEMORY");
+	}
+	else if (strncmp(arg,"NRMM",4)==0) {
+		vars_to_check=NRMM;
+		nrmm_name = strdup (arg+4);
+		if (!strcmp(nrmm_name,""))
+			nrmm_name = strdup ("AVAILABLE_CACHE_MEMORY");
 
-				}
+	}
 
-				else if (strncmp(optarg,"NSS3",4)==0) {
-					vars_to_check=NSS3;
-					nss3_name = strdup (optarg+4);
-					if (!strcmp(nss3_name,""))
-						nss3_name = strdup ("CACHEGITPERCENT");
+	else if (strncmp(arg,"NRMS",4)==0) {
+		vars_to_check=NRMS;
+		nrms_name = strdup (arg+4);
+		if (!strcmp(nrms_name,""))
+			nrms_name = strdup ("USED_SWAP_SPACE");
 
-				}
+	}
 
-				else if (strncmp(optarg,"NSS4",4)==0) {
-					vars_to_check=NSS4;
-					nss4_name = strdup (optarg+4);
-					if (!strcmp(nss4_name,""))
-						nss4_name = strdup ("CURRENTOPENCOUNT");
+	else if (strncmp(arg,"NSS1",4)==0) {
+		vars_to_check=NSS1;
+		nss1_name = strdup (arg+4);
+		if (!strcmp(nss1_name,""))
+			nss1_name = strdup ("CURRENTBUFFERCACHESIZE");
 
-				}
+	}
 
-				else if (strncmp(optarg,"NSS5",4)==0) {
-					vars_to_check=NSS5;
-					nss5_name = strdup (optarg+4);
-					if (!strcmp(nss5_name,""))
-						nss5_name = strdup ("CACHEMISSES");
+	else if (strncmp(arg,"NSS2",4)==0) {
+		vars_to_check=NSS2;
+		nss2_name = strdup (arg+4);
+		if (!strcmp(nss2_name,""))
+			nss2_name = strdup ("CACHEHITS");
 
-				}
+	}
 
+	else if (strncmp(arg,"NSS3",4)==0) {
+		vars_to_check=NSS3;
+		nss3_name = strdup (arg+4);
+		if (!strcmp(nss3_name,""))
+			nss3_name = strdup ("CACHEGITPERCENT");
 
-				else if (strncmp(optarg,"NSS6",4)==0) {
-					vars_to_check=NSS6;
-					nss6_name = strdup (optarg+4);
-					if (!strcmp(nss6_name,""))
-						nss6_name = strdup ("PENDINGWORKSCOUNT");
+	}
 
-				}
+	else if (strncmp(arg,"NSS4",4)==0) {
+		vars_to_check=NSS4;
+		nss4_name = strdup (arg+4);
+		if (!strcmp(nss4_name,""))
+			nss4_name = strdup ("CURRENTOPENCOUNT");
 
+	}
 
-				else if (strncmp(optarg,"NSS7",4)==0) {
-					vars_to_check=NSS7;
-					nss7_name = strdup (optarg+4);
-					if (!strcmp(nss7_name,""))
-						nss7_name = strdup ("CACHESIZE");
+	else if (strncmp(arg,"NSS5",4)==0) {
+		vars_to_check=NSS5;
+		nss5_name = strdup (arg+4);
+		if (!strcmp(nss5_name,""))
+			nss5_name = strdup ("CACHEMISSES");
 
-				}
+	}
 
 
-				else
-					return ERROR;
-				break;
-			case 'w': /* warning threshold */
-				warning_value=strtoul(optarg,NULL,10);
-				check_warning_value=TRUE;
-				break;
-			case 'c': /* critical threshold */
-				critical_value=strtoul(optarg,NULL,10);
-				check_critical_value=TRUE;
-				break;
-			case 't': /* timeout */
-				socket_timeout=atoi(optarg);
-				if (socket_timeout<=0)
-					return ERROR;
-			}
+	else if (strncmp(arg,"NSS6",4)==0) {
+		vars_to_check=NSS6;
+		nss6_name = strdup (arg+4);
+		if (!strcmp(nss6_name,""))
+			nss6_name = strdup ("PENDINGWORKSCOUNT");
+
+	}
+
+
+	else if (strncmp(arg,"NSS7",4)==0) {
+		vars_to_check=NSS7;
+		nss7_name = strdup (arg+4);
+		if (!strcmp(nss7_name,""))
+			nss7_name = strdup ("CACHESIZE");
 
 	}
 
+
+	else
+		return ERROR;
+
 	return OK;
 }
 
 
 
+/* make v the variable check_variable() checks */
+void select_variable(const nw_variable *v) {
+	parse_variable(v->name);
+	warning_value=v->warning_value;
+	critical_value=v->critical_value;
+	check_warning_value=v->check_warning_value;
+	check_critical_value=v->check_critical_value;
+}
+
+
+
 void print_help(void)
 {
 	char *myport;
@@ -1656,11 +1772,14 @@ void print_help(void)
   printf ("    %s\n", _("    NSS7<stat> = Statistics from _Admin:Manage_NSS\\AuthorizationCache.xml"));
   printf ("    %s\n", _("    NLM:<nlm> = check if NLM is loaded and report version"));
   printf ("    %s\n", _("                (e.g. NLM:TSANDS.NLM)"));
+  printf ("   %s\n", _("May be given more than once to check several variables in one session"));
   printf ("\n");
 	printf (" %s\n", "-w, --warning=INTEGER");
   printf ("    %s\n", _("Threshold which will result in a warning status"));
   printf (" %s\n", "-c, --critical=INTEGER");
   printf ("    %s\n", _("Threshold which will result in a critical status"));
+  printf ("    %s\n", _("Thresholds after a -v are those of that variable, thresholds before the"));
+  printf ("    %s\n", _("first -v are those of all variables without their own"));
   printf (" %s\n", "-o, --osversion");
   printf ("    %s\n", _("Include server version string in results"));
 
@@ -1674,6 +1793,9 @@ void print_help(void)
   printf (" %s\n", _("- Values for critical thresholds should be lower than warning thresholds"));
   printf (" %s\n", _("  when the following variables are checked: VPF, VKF, LTCH, CBUFF, DCB, "));
   printf (" %s\n", _("  TCB, LRUS and LRUM."));
+  printf (" %s\n", _("- All commands are sent to the NLM at once over one connection. With more"));
+  printf (" %s\n", _("  than one variable their results are joined by '; ', the perfdata of all"));
+  printf (" %s\n", _("  of them follows and the worst state is returned."));
 
 	printf (UT_SUPPORT);
 }
@@ -1683,5 +1805,5 @@ void print_help(void)
 void print_usage(void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host [-p port] [-v variable] [-w warning] [-c critical] [-t timeout]\n",progname);
+	printf ("%s -H host [-p port] [-v variable [-w warning] [-c critical]]... [-t timeout]\n",progname);
 }
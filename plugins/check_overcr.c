@@ -58,42 +58,44 @@ double warning_value = 0L;
 double critical_value = 0L;
 int check_warning_value = FALSE;
 int check_critical_value = FALSE;
-enum checkvar vars_to_check = NONE;
 int cmd_timeout = 1;
 
-int netstat_port = 0;
-char *disk_name = NULL;
-char *process_name = NULL;
-	char send_buffer[MAX_INPUT_BUFFER];
+/* The variables to check. All of them are asked for in one session, and
+ * -w/-c apply to the variable given last, or to all variables without
+ * thresholds of their own when given before the first -v. */
+struct overcr_var {
+	enum checkvar type;
+	char *name;		/* disk, process or port */
+	double warning;
+	double critical;
+	int check_warning;
+	int check_critical;
+	char **lines;		/* the part of the answer for this variable */
+	int line_count;
+};
+struct overcr_var *vars = NULL;
+int var_count = 0;
 
 int process_arguments (int, char **);
 void print_usage (void);
 void print_help (void);
+static int check_var (struct overcr_var *, int, char **, char **);
 
 int
 main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
+	int fetch_result, state, i, n;
 	char recv_buffer[MAX_INPUT_BUFFER];
-	char temp_buffer[MAX_INPUT_BUFFER];
-	char *temp_ptr = NULL;
-	int found_disk = FALSE;
-	unsigned long percent_used_disk_space = 100;
-	double load;
-	double load_1min;
-	double load_5min;
-	double load_15min;
-	int port_connections = 0;
-	int processes = 0;
-	double uptime_raw_hours;
-	int uptime_raw_minutes = 0;
-	int uptime_days = 0;
-	int uptime_hours = 0;
-	int uptime_minutes = 0;
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	char *send_buffer = NULL;
+	char *message, *perf;
+	char *output = NULL, *perfdata = NULL;
+	char *lines[MAX_INPUT_BUFFER / 2];
+	int line_count = 0, next = 0;
+	int want_load = FALSE, want_uptime = FALSE, want_disk = FALSE;
+	char *p;
+
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -101,189 +103,266 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (var_count == 0)
+		die (STATE_UNKNOWN, _("Nothing to check!\n"));
+
+	/* Ask for everything in one request, and have the collector close the
+	 * connection after the last answer. Every answer is one line, except the
+	 * three of LOAD, and the one line per file system of DISKSPACE, which is
+	 * why that one comes last. */
+	for (i = 0; i < var_count; i++) {
+		if (vars[i].type == LOAD1 || vars[i].type == LOAD5 || vars[i].type == LOAD15)
+			want_load = TRUE;
+		else if (vars[i].type == UPTIME)
+			want_uptime = TRUE;
+		else if (vars[i].type == DPU)
+			want_disk = TRUE;
+	}
+	xasprintf (&send_buffer, "%s%s", want_load ? "LOAD\r\n" : "", want_uptime ? "UPTIME\r\n" : "");
+	for (i = 0; i < var_count; i++) {
+		if (vars[i].type == PROCS)
+			xasprintf (&send_buffer, "%sPROCESS %s\r\n", send_buffer, vars[i].name);
+		else if (vars[i].type == NETSTAT)
+			xasprintf (&send_buffer, "%sNETSTAT %s\r\n", send_buffer, vars[i].name);
+	}
+	xasprintf (&send_buffer, "%s%sQUIT\r\n", send_buffer, want_disk ? "DISKSPACE\r\n" : "");
+
 	/* initialize alarm signal handling */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 
 	/* set socket timeout */
 	alarm (socket_timeout);
 
-	result = process_tcp_request2 (server_address,
-	                               server_port,
-	                               send_buffer,
-	                               recv_buffer,
-	                               sizeof (recv_buffer));
+	fetch_result = process_tcp_request2 (server_address,
+	                                     server_port,
+	                                     send_buffer,
+	                                     recv_buffer,
+	                                     sizeof (recv_buffer));
+
+	for (p = strtok (recv_buffer, "\r\n"); p != NULL && line_count < (int)(sizeof (lines) / sizeof (char *));
+	     p = strtok (NULL, "\r\n"))
+		lines[line_count++] = p;
+
+	/* hand every variable its part of the answer, in the order asked for */
+	if (want_load) {
+		n = min (3, line_count - next);
+		for (i = 0; i < var_count; i++)
+			if (vars[i].type == LOAD1 || vars[i].type == LOAD5 || vars[i].type == LOAD15) {
+				vars[i].lines = &lines[next];
+				vars[i].line_count = n;
+			}
+		next += n;
+	}
+	for (i = 0; i < var_count; i++)
+		if (vars[i].type == UPTIME) {
+			vars[i].lines = &lines[next];
+			vars[i].line_count = min (1, line_count - next);
+		}
+	if (want_uptime)
+		next = min (next + 1, line_count);
+	for (i = 0; i < var_count; i++)
+		if (vars[i].type == PROCS || vars[i].type == NETSTAT) {
+			vars[i].lines = &lines[next];
+			vars[i].line_count = min (1, line_count - next);
+			next = min (next + 1, line_count);
+		}
+	for (i = 0; i < var_count; i++)
+		if (vars[i].type == DPU) {
+			vars[i].lines = &lines[next];
+			vars[i].line_count = line_count - next;
+		}
+
+	if (var_count == 1) {
+		state = check_var (&vars[0], fetch_result, &message, &perf);
+		die (state, "%s%s%s\n", message, *perf ? "|" : "", perf);
+	}
+
+	for (i = 0; i < var_count; i++) {
+		state = check_var (&vars[i], fetch_result, &message, &perf);
+		if (i == 0)
+			result = state;
+		else
+			result = max_state (result, state);
+		xasprintf (&output, "%s%s%s", output ? output : "", i ? ", " : "", message);
+		if (*perf != '\0')
+			xasprintf (&perfdata, "%s%s%s", perfdata ? perfdata : "", perfdata ? " " : "", perf);
+	}
+	die (result, "OVERCR %s - %s%s%s\n", state_text (result), output,
+	     perfdata ? "|" : "", perfdata ? perfdata : "");
+}
+
+
+/* Judge one variable on its lines of the answer. The message is the same a
+ * check of that variable alone has always printed. */
+static int
+check_var (struct overcr_var *v, int fetch_result, char **message, char **perf)
+{
+	int result = STATE_OK;
+	char buffer[MAX_INPUT_BUFFER];
+	char *temp_ptr;
+	const char *minutes;
+	double value = 0, load[3];
+	int i, found_disk = FALSE;
+	int uptime_raw_minutes;
 
-	switch (vars_to_check) {
+	*perf = "";
+	switch (v->type) {
 
 	case LOAD1:
 	case LOAD5:
 	case LOAD15:
-	
-		if (result != STATE_OK)
-			die (result, _("Unknown error fetching load data\n"));
-
-		temp_ptr = (char *) strtok (recv_buffer, "\r\n");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server - no load information\n"));
-		else
-			load_1min = strtod (temp_ptr, NULL);
-
-		temp_ptr = (char *) strtok (NULL, "\r\n");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server after load 1\n"));
-		else
-			load_5min = strtod (temp_ptr, NULL);
 
-		temp_ptr = (char *) strtok (NULL, "\r\n");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server after load 5\n"));
-		else
-			load_15min = strtod (temp_ptr, NULL);
+		if (fetch_result != STATE_OK) {
+			xasprintf (message, "%s", _("Unknown error fetching load data"));
+			return fetch_result;
+		}
+		if (v->line_count < 1) {
+			xasprintf (message, "%s", _("Invalid response from server - no load information"));
+			return STATE_CRITICAL;
+		}
+		if (v->line_count < 2) {
+			xasprintf (message, "%s", _("Invalid response from server after load 1"));
+			return STATE_CRITICAL;
+		}
+		if (v->line_count < 3) {
+			xasprintf (message, "%s", _("Invalid response from server after load 5"));
+			return STATE_CRITICAL;
+		}
+		for (i = 0; i < 3; i++)
+			load[i] = strtod (v->lines[i], NULL);
 
-		switch (vars_to_check) {
-		case LOAD1:
-			strcpy (temp_buffer, "1");
-			load = load_1min;
-			break;
-		case LOAD5:
-			strcpy (temp_buffer, "5");
-			load = load_5min;
-			break;
-		default:
-			strcpy (temp_buffer, "15");
-			load = load_15min;
-			break;
+		if (v->type == LOAD1) {
+			minutes = "1";
+			value = load[0];
+		}
+		else if (v->type == LOAD5) {
+			minutes = "5";
+			value = load[1];
+		}
+		else {
+			minutes = "15";
+			value = load[2];
 		}
 
-		if (check_critical_value == TRUE && (load >= critical_value))
+		if (v->check_critical == TRUE && (value >= v->critical))
 			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (load >= warning_value))
+		else if (v->check_warning == TRUE && (value >= v->warning))
 			result = STATE_WARNING;
 
-		die (result,
-		          _("Load %s - %s-min load average = %0.2f"),
-							 state_text(result),
-		          temp_buffer,
-		          load);
-
-			break;
+		xasprintf (message, _("Load %s - %s-min load average = %0.2f"),
+		           state_text (result), minutes, value);
+		xasprintf (&temp_ptr, "load%s", minutes);
+		*perf = fperfdata (temp_ptr, value, "", v->check_warning, v->warning,
+		                   v->check_critical, v->critical, TRUE, 0, FALSE, 0);
+		return result;
 
 	case DPU:
 
-		if (result != STATE_OK)
-			die (result, _("Unknown error fetching disk data\n"));
-
-		for (temp_ptr = (char *) strtok (recv_buffer, " ");
-		     temp_ptr != NULL;
-		     temp_ptr = (char *) strtok (NULL, " ")) {
+		if (fetch_result != STATE_OK) {
+			xasprintf (message, "%s", _("Unknown error fetching disk data"));
+			return fetch_result;
+		}
 
-			if (!strcmp (temp_ptr, disk_name)) {
-				found_disk = TRUE;
-				temp_ptr = (char *) strtok (NULL, "%");
-				if (temp_ptr == NULL)
-					die (STATE_CRITICAL, _("Invalid response from server\n"));
-				else
-					percent_used_disk_space = strtoul (temp_ptr, NULL, 10);
-				break;
+		for (i = 0; i < v->line_count && !found_disk; i++) {
+			strncpy (buffer, v->lines[i], sizeof (buffer) - 1);
+			buffer[sizeof (buffer) - 1] = '\0';
+			temp_ptr = strtok (buffer, " ");
+			if (temp_ptr == NULL || strcmp (temp_ptr, v->name))
+				continue;
+			found_disk = TRUE;
+			if ((temp_ptr = strtok (NULL, "%")) == NULL) {
+				xasprintf (message, "%s", _("Invalid response from server"));
+				return STATE_CRITICAL;
 			}
-
-			temp_ptr = (char *) strtok (NULL, "\r\n");
+			value = strtoul (temp_ptr, NULL, 10);
 		}
 
 		/* error if we couldn't find the info for the disk */
-		if (found_disk == FALSE)
-			die (STATE_CRITICAL,
-			           "CRITICAL - Disk '%s' non-existent or not mounted",
-			           disk_name);
+		if (found_disk == FALSE) {
+			xasprintf (message, "CRITICAL - Disk '%s' non-existent or not mounted", v->name);
+			return STATE_CRITICAL;
+		}
 
-		if (check_critical_value == TRUE && (percent_used_disk_space >= critical_value))
+		if (v->check_critical == TRUE && (value >= v->critical))
 			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (percent_used_disk_space >= warning_value))
+		else if (v->check_warning == TRUE && (value >= v->warning))
 			result = STATE_WARNING;
 
-		die (result, "Disk %s - %lu%% used on %s", state_text(result), percent_used_disk_space, disk_name);
-
-		break;
+		xasprintf (message, "Disk %s - %lu%% used on %s", state_text (result),
+		           (unsigned long) value, v->name);
+		*perf = fperfdata (v->name, value, "%", v->check_warning, v->warning,
+		                   v->check_critical, v->critical, TRUE, 0, TRUE, 100);
+		return result;
 
 	case NETSTAT:
 
-		if (result != STATE_OK)
-			die (result, _("Unknown error fetching network status\n"));
-		else
-			port_connections = strtod (recv_buffer, NULL);
+		if (fetch_result != STATE_OK || v->line_count < 1) {
+			xasprintf (message, "%s", _("Unknown error fetching network status"));
+			return fetch_result != STATE_OK ? fetch_result : STATE_UNKNOWN;
+		}
+		value = (int) strtod (v->lines[0], NULL);
 
-		if (check_critical_value == TRUE && (port_connections >= critical_value))
+		if (v->check_critical == TRUE && (value >= v->critical))
 			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (port_connections >= warning_value))
+		else if (v->check_warning == TRUE && (value >= v->warning))
 			result = STATE_WARNING;
 
-		die (result,
-		           _("Net %s - %d connection%s on port %d"),
-		           state_text(result),
-		           port_connections,
-		           (port_connections == 1) ? "" : "s",
-		           netstat_port);
-
-		break;
+		xasprintf (message, _("Net %s - %d connection%s on port %s"), state_text (result),
+		           (int) value, (value == 1) ? "" : "s", v->name);
+		xasprintf (&temp_ptr, "port_%s", v->name);
+		*perf = fperfdata (temp_ptr, value, "", v->check_warning, v->warning,
+		                   v->check_critical, v->critical, TRUE, 0, FALSE, 0);
+		return result;
 
 	case PROCS:
 
-		if (result != STATE_OK)
-			die (result, _("Unknown error fetching process status\n"));
-
-		temp_ptr = (char *) strtok (recv_buffer, "(");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server\n"));
+		if (fetch_result != STATE_OK) {
+			xasprintf (message, "%s", _("Unknown error fetching process status"));
+			return fetch_result;
+		}
 
-		temp_ptr = (char *) strtok (NULL, ")");
-		if (temp_ptr == NULL)
-			die (STATE_CRITICAL, _("Invalid response from server\n"));
-		else
-			processes = strtod (temp_ptr, NULL);
+		if (v->line_count < 1 || (temp_ptr = strchr (v->lines[0], '(')) == NULL ||
+		    strchr (temp_ptr, ')') == NULL) {
+			xasprintf (message, "%s", _("Invalid response from server"));
+			return STATE_CRITICAL;
+		}
+		value = (int) strtod (temp_ptr + 1, NULL);
 
-		if (check_critical_value == TRUE && (processes >= critical_value))
+		if (v->check_critical == TRUE && (value >= v->critical))
 			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (processes >= warning_value))
+		else if (v->check_warning == TRUE && (value >= v->warning))
 			result = STATE_WARNING;
 
-		die (result,
-		           _("Process %s - %d instance%s of %s running"),
-		           state_text(result),
-		           processes,
-		           (processes == 1) ? "" : "s",
-		           process_name);
-		break;
+		xasprintf (message, _("Process %s - %d instance%s of %s running"), state_text (result),
+		           (int) value, (value == 1) ? "" : "s", v->name);
+		*perf = fperfdata (v->name, value, "", v->check_warning, v->warning,
+		                   v->check_critical, v->critical, TRUE, 0, FALSE, 0);
+		return result;
 
 	case UPTIME:
 
-		if (result != STATE_OK)
-			return result;
+		if (fetch_result != STATE_OK || v->line_count < 1) {
+			xasprintf (message, "%s", _("Unknown error fetching uptime"));
+			return fetch_result != STATE_OK ? fetch_result : STATE_UNKNOWN;
+		}
 
-		uptime_raw_hours = strtod (recv_buffer, NULL);
-		uptime_raw_minutes = (unsigned long) (uptime_raw_hours * 60.0);
+		uptime_raw_minutes = (unsigned long) (strtod (v->lines[0], NULL) * 60.0);
 
-		if (check_critical_value == TRUE && (uptime_raw_minutes <= critical_value))
+		if (v->check_critical == TRUE && (uptime_raw_minutes <= v->critical))
 			result = STATE_CRITICAL;
-		else if (check_warning_value == TRUE && (uptime_raw_minutes <= warning_value))
+		else if (v->check_warning == TRUE && (uptime_raw_minutes <= v->warning))
 			result = STATE_WARNING;
 
-		uptime_days = uptime_raw_minutes / 1440;
-		uptime_raw_minutes %= 1440;
-		uptime_hours = uptime_raw_minutes / 60;
-		uptime_raw_minutes %= 60;
-		uptime_minutes = uptime_raw_minutes;
-
-		die (result,
-		           _("Uptime %s - Up %d days %d hours %d minutes"),
-		           state_text(result),
-		           uptime_days,
-		           uptime_hours,
-		           uptime_minutes);
-		break;
+		*perf = fperfdata ("uptime", uptime_raw_minutes, "min", v->check_warning, v->warning,
+		                   v->check_critical, v->critical, TRUE, 0, FALSE, 0);
+		xasprintf (message, _("Uptime %s - Up %d days %d hours %d minutes"), state_text (result),
+		           uptime_raw_minutes / 1440, (uptime_raw_minutes % 1440) / 60,
+		           uptime_raw_minutes % 60);
+		return result;
 
 	default:
-		die (STATE_UNKNOWN, _("Nothing to check!\n"));
-		break;
+		xasprintf (message, "%s", _("Nothing to check!"));
+		return STATE_UNKNOWN;
 	}
 }
 
@@ -293,6 +372,7 @@ int
 process_arguments (int argc, char **argv)
 {
 	int c;
+	struct overcr_var *v;
 
 	int option = 0;
 	static struct option longopts[] = {
@@ -354,43 +434,51 @@ process_arguments (int argc, char **argv)
 				die (STATE_UNKNOWN,
 									 _("Server port an integer\n"));
 			break;
-		case 'v':									/* variable */
-			if (strcmp (optarg, "LOAD") == 0) {
-				strcpy (send_buffer, "LOAD\r\nQUIT\r\n");
-				if (strcmp (optarg, "LOAD1") == 0)
-					vars_to_check = LOAD1;
-				else if (strcmp (optarg, "LOAD5") == 0)
-					vars_to_check = LOAD5;
-				else if (strcmp (optarg, "LOAD15") == 0)
-					vars_to_check = LOAD15;
-			}
-			else if (strcmp (optarg, "UPTIME") == 0) {
-				vars_to_check = UPTIME;
-				strcpy (send_buffer, "UPTIME\r\n");
-			}
+		case 'v':									/* variable, may be repeated */
+			vars = realloc (vars, (var_count + 1) * sizeof (struct overcr_var));
+			if (vars == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			v = &vars[var_count];
+			memset (v, 0, sizeof (*v));
+			if (strcmp (optarg, "LOAD1") == 0)
+				v->type = LOAD1;
+			else if (strcmp (optarg, "LOAD5") == 0)
+				v->type = LOAD5;
+			else if (strcmp (optarg, "LOAD15") == 0)
+				v->type = LOAD15;
+			else if (strcmp (optarg, "UPTIME") == 0)
+				v->type = UPTIME;
 			else if (strstr (optarg, "PROC") == optarg) {
-				vars_to_check = PROCS;
-				process_name = strscpy (process_name, optarg + 4);
-				sprintf (send_buffer, "PROCESS %s\r\n", process_name);
+				v->type = PROCS;
+				v->name = strdup (optarg + 4);
 			}
 			else if (strstr (optarg, "NET") == optarg) {
-				vars_to_check = NETSTAT;
-				netstat_port = atoi (optarg + 3);
-				sprintf (send_buffer, "NETSTAT %d\r\n", netstat_port);
+				v->type = NETSTAT;
+				xasprintf (&v->name, "%d", atoi (optarg + 3));
 			}
 			else if (strstr (optarg, "DPU") == optarg) {
-				vars_to_check = DPU;
-				strcpy (send_buffer, "DISKSPACE\r\n");
-				disk_name = strscpy (disk_name, optarg + 3);
+				v->type = DPU;
+				v->name = strdup (optarg + 3);
 			}
 			else
 				return ERROR;
+			var_count++;
 			break;
 		case 'w':									/* warning threshold */
+			if (var_count > 0) {
+				vars[var_count - 1].warning = strtoul (optarg, NULL, 10);
+				vars[var_count - 1].check_warning = TRUE;
+				break;
+			}
 			warning_value = strtoul (optarg, NULL, 10);
 			check_warning_value = TRUE;
 			break;
 		case 'c':									/* critical threshold */
+			if (var_count > 0) {
+				vars[var_count - 1].critical = strtoul (optarg, NULL, 10);
+				vars[var_count - 1].check_critical = TRUE;
+				break;
+			}
 			critical_value = strtoul (optarg, NULL, 10);
 			check_critical_value = TRUE;
 			break;
@@ -401,6 +489,18 @@ process_arguments (int argc, char **argv)
 		}
 
 	}
+
+	/* thresholds given before the first variable are the defaults */
+	for (c = 0; c < var_count; c++) {
+		if (!vars[c].check_warning) {
+			vars[c].warning = warning_value;
+			vars[c].check_warning = check_warning_value;
+		}
+		if (!vars[c].check_critical) {
+			vars[c].critical = critical_value;
+			vars[c].check_critical = check_critical_value;
+		}
+	}
 	return OK;
 }
 
@@ -441,6 +541,8 @@ print_help (void)
   printf ("    %s\n", _("PROC<process> = number of running processes with name <process>"));
   printf ("    %s\n", _("NET<port>     = number of active connections on TCP port <port>"));
   printf ("    %s\n", _("UPTIME        = system uptime in seconds"));
+  printf ("    %s\n", _("May be repeated to check several variables in one session, each with"));
+  printf ("    %s\n", _("the -w and -c given after it"));
 
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
@@ -465,5 +567,5 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host [-p port] [-v variable] [-w warning] [-c critical] [-t timeout]\n", progname);
+	printf ("%s -H host [-p port] [-v variable [-w warning] [-c critical]]... [-t timeout]\n", progname);
 }
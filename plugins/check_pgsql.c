@@ -28,6 +28,8 @@
 * 
 *****************************************************************************/
 
+#include "np_entry.h"
+
 const char *progname = "check_pgsql";
 const char *copyright = "1999-2011";
 const char *email = "devel@monitoring-plugins.org";
@@ -63,6 +65,43 @@ enum {
 	DEFAULT_CRIT = 8
 };
 
+/* connections kept open between checks by an np-executor worker */
+#define MAX_PERSISTENT 8
+#define PERSISTENT_STATEMENT "check_pgsql"
+/* seconds a kept connection may sit unused before it is opened anew */
+#define DEFAULT_MAX_IDLE 300
+
+/* what --cluster keeps of each database from one run to the next */
+typedef struct cluster_db {
+	char name[NAMEDATALEN];
+	double xacts;
+	double deadlocks;
+	double reset;	/* stats_reset, the counters start over when it changes */
+} cluster_db;
+
+/* The state of --cluster is the clock of the run followed by its
+ * databases, sorted by name */
+typedef struct cluster_state {
+	double clock;	/* np_clock() of the run */
+	uint32_t count;
+	uint32_t unused;
+} cluster_state;
+
+#define CLUSTER_QUERY \
+	"SELECT d.datname, s.numbackends, s.xact_commit + s.xact_rollback, s.deadlocks," \
+	" age(d.datfrozenxid), coalesce(extract(epoch FROM s.stats_reset), 0)" \
+	" FROM pg_database d JOIN pg_stat_database s ON s.datid = d.oid" \
+	" WHERE d.datallowconn"
+
+typedef struct persistent_conn {
+	char *key;
+	PGconn *conn;
+	int prepared;
+	int busy;
+	unsigned long used;
+	time_t idle_since;
+} persistent_conn;
+
 
 
 int process_arguments (int, char **);
@@ -72,6 +111,14 @@ void print_help (void);
 int is_pg_dbname (char *);
 int is_pg_logname (char *);
 int do_query (PGconn *, char *);
+int evaluate_query (PGconn *, PGresult *, char *);
+static PGresult *first_row (PGconn *, const char *, int);
+static void drain_results (PGconn *);
+static int persistent_check (const char *);
+static persistent_conn *persistent_get (const char *, const char *);
+static void persistent_drop (persistent_conn *);
+static int cluster_check (PGconn *, double, int);
+static int cluster_compare (const void *, const void *);
 
 char *pghost = NULL;						/* host name of the backend server */
 char *pgport = NULL;						/* port of the backend server */
@@ -89,6 +136,22 @@ char *query_warning = NULL;
 char *query_critical = NULL;
 thresholds *qthresholds = NULL;
 int verbose = 0;
+static int persistent_mode = FALSE;
+static int fresh_connection = FALSE;
+static int max_idle = DEFAULT_MAX_IDLE;
+static int cluster_mode = FALSE;
+char *connections_warning = NULL;
+char *connections_critical = NULL;
+char *deadlocks_warning = NULL;
+char *deadlocks_critical = NULL;
+char *age_warning = NULL;
+char *age_critical = NULL;
+thresholds *connections_thresholds = NULL;
+thresholds *deadlocks_thresholds = NULL;
+thresholds *age_thresholds = NULL;
+
+static persistent_conn persistent[MAX_PERSISTENT];
+static unsigned long persistent_uses = 0;
 
 /******************************************************************************
 
@@ -162,9 +225,33 @@ main (int argc, char **argv)
 	pgoptions = NULL;  /* special options to start up the backend server */
 	pgtty = NULL;      /* debugging tty for the backend server */
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	/* np-executor may run this check again in the same process */
+	pghost = NULL;
+	pgport = NULL;
+	strcpy (dbName, DEFAULT_DB);
+	pguser = NULL;
+	pgpasswd = NULL;
+	pgparams = NULL;
+	twarn = (double)DEFAULT_WARN;
+	tcrit = (double)DEFAULT_CRIT;
+	pgquery = NULL;
+	query_warning = NULL;
+	query_critical = NULL;
+	qthresholds = NULL;
+	verbose = 0;
+	persistent_mode = FALSE;
+	fresh_connection = FALSE;
+	max_idle = DEFAULT_MAX_IDLE;
+	cluster_mode = FALSE;
+	connections_warning = connections_critical = NULL;
+	deadlocks_warning = deadlocks_critical = NULL;
+	age_warning = age_critical = NULL;
+	connections_thresholds = deadlocks_thresholds = age_thresholds = NULL;
+	timeout_interval = DEFAULT_SOCKET_TIMEOUT;
+
+	np_locale_init ();
+
+	np_init ((char *) progname, argc, argv);
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -201,6 +288,9 @@ main (int argc, char **argv)
 	if (pgpasswd)
 		asprintf (&conninfo, "%s password = '%s'", conninfo, pgpasswd);
 
+	if (persistent_mode)
+		return persistent_check (conninfo);
+
 	/* make a connection to the database */
 	gettimeofday (&start_timeval, NULL);
 	conn = PQconnectdb (conninfo);
@@ -248,10 +338,13 @@ main (int argc, char **argv)
 				PQprotocolVersion (conn), PQbackendPID (conn));
 	}
 
-	printf (_(" %s - database %s (%f sec.)|%s\n"),
-	        state_text(status), dbName, elapsed_time,
-	        fperfdata("time", elapsed_time, "s",
-	                 !!(twarn > 0.0), twarn, !!(tcrit > 0.0), tcrit, TRUE, 0, FALSE,0));
+	if (cluster_mode)
+		status = cluster_check (conn, elapsed_time, status);
+	else
+		printf (_(" %s - database %s (%f sec.)|%s\n"),
+		        state_text(status), dbName, elapsed_time,
+		        fperfdata("time", elapsed_time, "s",
+		                 !!(twarn > 0.0), twarn, !!(tcrit > 0.0), tcrit, TRUE, 0, FALSE,0));
 
 	if (pgquery)
 		query_status = do_query (conn, pgquery);
@@ -270,6 +363,19 @@ process_arguments (int argc, char **argv)
 {
 	int c;
 
+	enum {
+		PERSISTENT_OPTION = CHAR_MAX + 1,
+		FRESH_CONNECTION_OPTION,
+		MAX_IDLE_OPTION,
+		CLUSTER_OPTION,
+		CONNECTIONS_WARNING_OPTION,
+		CONNECTIONS_CRITICAL_OPTION,
+		DEADLOCKS_WARNING_OPTION,
+		DEADLOCKS_CRITICAL_OPTION,
+		AGE_WARNING_OPTION,
+		AGE_CRITICAL_OPTION
+	};
+
 	int option = 0;
 	static struct option longopts[] = {
 		{"help", no_argument, 0, 'h'},
@@ -288,6 +394,16 @@ process_arguments (int argc, char **argv)
 		{"query_critical", required_argument, 0, 'C'},
 		{"query_warning", required_argument, 0, 'W'},
 		{"verbose", no_argument, 0, 'v'},
+		{"persistent", no_argument, 0, PERSISTENT_OPTION},
+		{"fresh-connection", no_argument, 0, FRESH_CONNECTION_OPTION},
+		{"max-idle", required_argument, 0, MAX_IDLE_OPTION},
+		{"cluster", no_argument, 0, CLUSTER_OPTION},
+		{"connections-warning", required_argument, 0, CONNECTIONS_WARNING_OPTION},
+		{"connections-critical", required_argument, 0, CONNECTIONS_CRITICAL_OPTION},
+		{"deadlocks-warning", required_argument, 0, DEADLOCKS_WARNING_OPTION},
+		{"deadlocks-critical", required_argument, 0, DEADLOCKS_CRITICAL_OPTION},
+		{"age-warning", required_argument, 0, AGE_WARNING_OPTION},
+		{"age-critical", required_argument, 0, AGE_CRITICAL_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -371,10 +487,58 @@ process_arguments (int argc, char **argv)
 		case 'v':
 			verbose++;
 			break;
+		case PERSISTENT_OPTION:
+			persistent_mode = TRUE;
+			break;
+		case FRESH_CONNECTION_OPTION:
+			fresh_connection = TRUE;
+			break;
+		case MAX_IDLE_OPTION:
+			if (!is_intnonneg (optarg))
+				usage2 (_("Max idle must be a non-negative integer"), optarg);
+			max_idle = atoi (optarg);
+			break;
+		case CLUSTER_OPTION:
+			cluster_mode = TRUE;
+			break;
+		case CONNECTIONS_WARNING_OPTION:
+			connections_warning = optarg;
+			break;
+		case CONNECTIONS_CRITICAL_OPTION:
+			connections_critical = optarg;
+			break;
+		case DEADLOCKS_WARNING_OPTION:
+			deadlocks_warning = optarg;
+			break;
+		case DEADLOCKS_CRITICAL_OPTION:
+			deadlocks_critical = optarg;
+			break;
+		case AGE_WARNING_OPTION:
+			age_warning = optarg;
+			break;
+		case AGE_CRITICAL_OPTION:
+			age_critical = optarg;
+			break;
 		}
 	}
 
 	set_thresholds (&qthresholds, query_warning, query_critical);
+	set_thresholds (&connections_thresholds, connections_warning, connections_critical);
+	set_thresholds (&deadlocks_thresholds, deadlocks_warning, deadlocks_critical);
+	set_thresholds (&age_thresholds, age_warning, age_critical);
+
+	if (cluster_mode && persistent_mode)
+		usage4 (_("--cluster and --persistent cannot be used together"));
+	if (fresh_connection && persistent_mode)
+		usage4 (_("--fresh-connection and --persistent cannot be used together"));
+	/* np-executor keeps the connection unless it is what is to be measured */
+	if (np_exec_active () && !fresh_connection && !cluster_mode)
+		persistent_mode = TRUE;
+	if (!cluster_mode && (connections_warning || connections_critical || deadlocks_warning ||
+	                      deadlocks_critical || age_warning || age_critical))
+		usage4 (_("The database thresholds need --cluster"));
+	if (cluster_mode)
+		np_enable_state (NULL, 1);
 
 	return validate_arguments ();
 }
@@ -533,6 +697,22 @@ print_help (void)
 	printf ("    %s\n", _("SQL query value to result in warning status (double)"));
 	printf (" %s\n", "-C, --query-critical=RANGE");
 	printf ("    %s\n", _("SQL query value to result in critical status (double)"));
+	printf (" %s\n", "--cluster");
+	printf ("    %s\n", _("Report on every database of the cluster over the one connection"));
+	printf (" %s\n", "--connections-warning=RANGE, --connections-critical=RANGE");
+	printf ("    %s\n", _("Connections to a database to result in warning or critical status"));
+	printf (" %s\n", "--deadlocks-warning=RANGE, --deadlocks-critical=RANGE");
+	printf ("    %s\n", _("Deadlocks per second in a database since the last run"));
+	printf (" %s\n", "--age-warning=RANGE, --age-critical=RANGE");
+	printf ("    %s\n", _("Transactions since the oldest unfrozen transaction id of a database"));
+	printf (" %s\n", "--persistent");
+	printf ("    %s\n", _("Run the query as a prepared statement and, when run by np-executor, keep"));
+	printf ("    %s\n", _("the connection open for the next run of the same check (see below)"));
+	printf (" %s\n", "--fresh-connection");
+	printf ("    %s\n", _("Connect anew and time the connection even when run by np-executor"));
+	printf (" %s\n", "--max-idle=SECONDS");
+	printf ("    %s (%s: %d)\n", _("Open a kept connection anew once unused for so long"),
+	        _("default"), DEFAULT_MAX_IDLE);
 
 	printf (UT_VERBOSE);
 
@@ -564,6 +744,23 @@ print_help (void)
 	printf (" %s\n", _("connect to a remote host, be sure that the remote postmaster accepts TCP/IP"));
 	printf (" %s\n\n", _("connections (start the postmaster with the -i option)."));
 
+	printf (" %s\n", _("Run by np-executor, the check behaves as with --persistent unless given"));
+	printf (" %s\n", _("--fresh-connection or --cluster. A kept connection is checked before it is"));
+	printf (" %s\n\n", _("used again, and one that was closed or left idle too long is opened anew."));
+
+	printf (" %s\n", _("With --persistent the warning and critical thresholds apply to the time the"));
+	printf (" %s\n", _("query takes, or a 'SELECT 1' without -q, instead of the connection time."));
+	printf (" ");
+	printf (_("Each np-executor worker keeps up to %d connections. The query must be a"), MAX_PERSISTENT);
+	printf ("\n %s\n\n", _("single SQL command."));
+
+	printf (" %s\n", _("With --cluster one query reads the connections, the transactions, the"));
+	printf (" %s\n", _("deadlocks and age(datfrozenxid) of every database that accepts connections"));
+	printf (" %s\n", _("from pg_stat_database and pg_database, and the thresholds apply to each of"));
+	printf (" %s\n", _("them. The counters are saved in a state file so that the next run can"));
+	printf (" %s\n", _("report transactions and deadlocks per second. The first run, and the first"));
+	printf (" %s\n\n", _("run after the statistics of a database were reset, have no rates for it."));
+
 	printf (" %s\n", _("Typically, the monitoring user (unless the --logname option is used) should be"));
 	printf (" %s\n", _("able to connect to the database without a password. The plugin can also send"));
 	printf (" %s\n", _("a password, but no effort is made to obscure or encrypt the password."));
@@ -579,14 +776,65 @@ print_usage (void)
 	printf ("%s\n", _("Usage:"));
 	printf ("%s [-H <host>] [-P <port>] [-c <critical time>] [-w <warning time>]\n", progname);
 	printf (" [-t <timeout>] [-d <database>] [-l <logname>] [-p <password>]\n"
-			"[-q <query>] [-C <critical query range>] [-W <warning query range>]\n");
+			"[-q <query>] [-C <critical query range>] [-W <warning query range>]\n"
+			"[--persistent | --fresh-connection] [--max-idle=<seconds>]\n"
+			"[--cluster [--connections-warning=<range>]\n"
+			"[--connections-critical=<range>] [--deadlocks-warning=<range>]\n"
+			"[--deadlocks-critical=<range>] [--age-warning=<range>] [--age-critical=<range>]]\n");
 }
 
 int
 do_query (PGconn *conn, char *query)
 {
 	PGresult *res;
+	int my_status;
+
+	if (verbose)
+		printf ("Executing SQL query \"%s\".\n", query);
+	res = first_row (conn, query, FALSE);
+
+	/* the caller closes the connection, which leaves any other rows unread */
+	my_status = evaluate_query (conn, res, query);
+	PQclear (res);
+	return my_status;
+}
+
+/* Send the query, or the prepared statement, in single row mode and return
+ * the first row, or the result which ends it when there is none. Other rows
+ * are still on the way: drain_results() them, or close the connection. */
+static PGresult *
+first_row (PGconn *conn, const char *query, int prepared)
+{
+	struct timeval start_timeval;
+	PGresult *res;
+	int sent;
+
+	gettimeofday (&start_timeval, NULL);
+	if (prepared)
+		sent = PQsendQueryPrepared (conn, PERSISTENT_STATEMENT, 0, NULL, NULL, NULL, 0);
+	else
+		sent = PQsendQuery (conn, query);
+	if (!sent)
+		return NULL;
+	PQsetSingleRowMode (conn);
+	res = PQgetResult (conn);
+	if (verbose)
+		printf ("Time to first row: %f\n", delta_time (start_timeval));
+	return res;
+}
 
+static void
+drain_results (PGconn *conn)
+{
+	PGresult *res;
+
+	while ((res = PQgetResult (conn)) != NULL)
+		PQclear (res);
+}
+
+int
+evaluate_query (PGconn *conn, PGresult *res, char *query)
+{
 	char *val_str;
 	double value;
 
@@ -594,11 +842,7 @@ do_query (PGconn *conn, char *query)
 
 	int my_status = STATE_UNKNOWN;
 
-	if (verbose)
-		printf ("Executing SQL query \"%s\".\n", query);
-	res = PQexec (conn, query);
-
-	if (PGRES_TUPLES_OK != PQresultStatus (res)) {
+	if (PQresultStatus (res) != PGRES_TUPLES_OK && PQresultStatus (res) != PGRES_SINGLE_TUPLE) {
 		printf (_("QUERY %s - %s: %s.\n"), _("CRITICAL"), _("Error with query"),
 					PQerrorMessage (conn));
 		return STATE_CRITICAL;
@@ -649,3 +893,291 @@ do_query (PGconn *conn, char *query)
 	return my_status;
 }
 
+
+/* Run the check over a connection kept from an earlier run of the same
+ * check if there is one. The query is prepared once per connection and only
+ * its execution is timed. */
+static int
+persistent_check (const char *conninfo)
+{
+	persistent_conn *pc;
+	PGresult *res = NULL;
+	struct timeval start_timeval;
+	char *query = pgquery ? pgquery : "SELECT 1";
+	double elapsed_time;
+	int status, query_status = STATE_OK, retry;
+
+	pc = persistent_get (conninfo, query);
+	for (retry = 0; ; retry++) {
+		if (pc->conn == NULL) {
+			if (verbose)
+				printf ("Opening persistent connection\n");
+			pc->conn = PQconnectdb (conninfo);
+			np_exec_counters.pool_opened++;
+			if (PQstatus (pc->conn) == CONNECTION_BAD) {
+				printf (_("CRITICAL - no connection to '%s' (%s).\n"),
+				        dbName, PQerrorMessage (pc->conn));
+				persistent_drop (pc);
+				return STATE_CRITICAL;
+			}
+		}
+		else {
+			np_exec_counters.pool_reused++;
+			if (verbose)
+				printf ("Reusing connection to server pid %d\n", PQbackendPID (pc->conn));
+		}
+
+		/* a timeout leaves the connection in an unknown state, see persistent_get() */
+		pc->busy = TRUE;
+		gettimeofday (&start_timeval, NULL);
+		if (!pc->prepared) {
+			res = PQprepare (pc->conn, PERSISTENT_STATEMENT, query, 0, NULL);
+			pc->prepared = (PQresultStatus (res) == PGRES_COMMAND_OK);
+			PQclear (res);
+			res = NULL;
+		}
+		/* timed to the first row, the others are only read to be skipped */
+		if (pc->prepared)
+			res = first_row (pc->conn, query, TRUE);
+		elapsed_time = delta_time (start_timeval);
+		drain_results (pc->conn);
+		pc->busy = FALSE;
+
+		/* the server may have closed a connection kept since an earlier run */
+		if (PQstatus (pc->conn) != CONNECTION_BAD || retry)
+			break;
+		PQclear (res);
+		res = NULL;
+		persistent_drop (pc);
+	}
+
+	if (verbose)
+		printf("Time elapsed: %f\n", elapsed_time);
+
+	if (pgquery == NULL && PQresultStatus (res) != PGRES_TUPLES_OK && PQresultStatus (res) != PGRES_SINGLE_TUPLE) {
+		printf (_("CRITICAL - no connection to '%s' (%s).\n"),
+		        dbName, PQerrorMessage (pc->conn));
+		PQclear (res);
+		persistent_drop (pc);
+		return STATE_CRITICAL;
+	}
+	else if (elapsed_time > tcrit) {
+		status = STATE_CRITICAL;
+	}
+	else if (elapsed_time > twarn) {
+		status = STATE_WARNING;
+	}
+	else {
+		status = STATE_OK;
+	}
+
+	printf (_(" %s - database %s (%f sec.)|%s\n"),
+	        state_text(status), dbName, elapsed_time,
+	        fperfdata("time", elapsed_time, "s",
+	                 !!(twarn > 0.0), twarn, !!(tcrit > 0.0), tcrit, TRUE, 0, FALSE,0));
+
+	if (pgquery) {
+		if (verbose)
+			printf ("Executed prepared SQL query \"%s\".\n", query);
+		query_status = evaluate_query (pc->conn, res, query);
+	}
+	PQclear (res);
+
+	/* nothing to keep the connection for outside of np-executor */
+	if (!np_exec_active ())
+		persistent_drop (pc);
+	pc->idle_since = time (NULL);
+
+	return (query_status > status) ? query_status : status;
+}
+
+static persistent_conn *
+persistent_get (const char *conninfo, const char *query)
+{
+	persistent_conn *pc = NULL;
+	char *key = NULL;
+	int i;
+
+	xasprintf (&key, "%s\n%s", conninfo, query);
+	for (i = 0; i < MAX_PERSISTENT && pc == NULL; i++)
+		if (persistent[i].key != NULL && strcmp (persistent[i].key, key) == 0)
+			pc = &persistent[i];
+
+	if (pc == NULL) {
+		/* the least recently used slot, an empty one if there is any */
+		pc = &persistent[0];
+		for (i = 1; i < MAX_PERSISTENT; i++)
+			if (persistent[i].used < pc->used)
+				pc = &persistent[i];
+		persistent_drop (pc);
+		free (pc->key);
+		pc->key = key;
+	}
+	else
+		free (key);
+
+	/* the last check using it was cut short in the middle of a request */
+	if (pc->busy)
+		persistent_drop (pc);
+	/* unused for too long, or closed or about to be by the server */
+	if (pc->conn != NULL &&
+	    (time (NULL) - pc->idle_since > max_idle || !np_net_idle_alive (PQsocket (pc->conn)))) {
+		if (verbose)
+			printf ("Dropping idle connection to server pid %d\n", PQbackendPID (pc->conn));
+		persistent_drop (pc);
+	}
+
+	pc->used = ++persistent_uses;
+	return pc;
+}
+
+static void
+persistent_drop (persistent_conn *pc)
+{
+	if (pc->conn != NULL) {
+		PQfinish (pc->conn);
+		np_exec_counters.pool_closed++;
+	}
+	pc->conn = NULL;
+	pc->prepared = FALSE;
+	pc->busy = FALSE;
+}
+
+static int
+cluster_compare (const void *a, const void *b)
+{
+	return strcmp (((const cluster_db *) a)->name, ((const cluster_db *) b)->name);
+}
+
+/* Every database from one query, each against the thresholds. The rates
+ * come from the counters the last run saved. */
+static int
+cluster_check (PGconn *conn, double elapsed_time, int status)
+{
+	PGresult *res;
+	state_data *previous;
+	cluster_state header, last = { 0, 0, 0 };
+	cluster_db *dbs, *then = NULL, *found;
+	double *connections, *age, now, interval = 0, rate = 0;
+	int *connections_state, *age_state, *deadlocks_state, *have_rate;
+	int worst, total = 0, n, i;
+	char *problems = NULL, *label = NULL, *data;
+	perf_buffer perf = PERF_BUFFER_INIT;
+	size_t length;
+
+	if (verbose)
+		printf ("Executing SQL query \"%s\".\n", CLUSTER_QUERY);
+	res = PQexec (conn, CLUSTER_QUERY);
+	now = np_clock ();
+	if (PQresultStatus (res) != PGRES_TUPLES_OK || PQnfields (res) < 6) {
+		printf (_("CRITICAL - %s: %s.\n"), _("Error with query"), PQerrorMessage (conn));
+		PQclear (res);
+		return STATE_CRITICAL;
+	}
+
+	n = PQntuples (res);
+	dbs = calloc (n ? n : 1, sizeof (*dbs));
+	connections = calloc (n ? n : 1, sizeof (double));
+	age = calloc (n ? n : 1, sizeof (double));
+	connections_state = calloc (n ? n : 1, sizeof (int));
+	age_state = calloc (n ? n : 1, sizeof (int));
+	deadlocks_state = calloc (n ? n : 1, sizeof (int));
+	have_rate = calloc (n ? n : 1, sizeof (int));
+	if (!dbs || !connections || !age || !connections_state || !age_state ||
+	    !deadlocks_state || !have_rate)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < n; i++)
+		snprintf (dbs[i].name, sizeof (dbs[i].name), "%s", PQgetvalue (res, i, 0));
+	/* the order of the rows does not matter, the state is kept by name */
+	qsort (dbs, n, sizeof (*dbs), cluster_compare);
+	for (i = 0; i < n; i++) {
+		found = bsearch (PQgetvalue (res, i, 0), dbs, n, sizeof (*dbs), cluster_compare);
+		found->xacts = strtod (PQgetvalue (res, i, 2), NULL);
+		found->deadlocks = strtod (PQgetvalue (res, i, 3), NULL);
+		found->reset = strtod (PQgetvalue (res, i, 5), NULL);
+		connections[found - dbs] = strtod (PQgetvalue (res, i, 1), NULL);
+		age[found - dbs] = strtod (PQgetvalue (res, i, 4), NULL);
+	}
+	PQclear (res);
+
+	previous = np_state_read ();
+	if (previous != NULL && previous->data != NULL &&
+	    previous->length >= (int) sizeof (last)) {
+		memcpy (&last, previous->data, sizeof (last));
+		if ((size_t) previous->length == sizeof (last) + last.count * sizeof (cluster_db)) {
+			then = (cluster_db *) ((char *) previous->data + sizeof (last));
+			interval = now - last.clock;
+		}
+	}
+
+	worst = get_status_batch (connections, connections_state, n, connections_thresholds);
+	i = get_status_batch (age, age_state, n, age_thresholds);
+	worst = max_state (worst, i);
+	for (i = 0; i < n; i++) {
+		total += connections[i];
+		/* the key is the first member, so a name compares as a cluster_db */
+		found = (then && interval > 0)
+			? bsearch (dbs[i].name, then, last.count, sizeof (*then), cluster_compare)
+			: NULL;
+		have_rate[i] = found && found->reset == dbs[i].reset &&
+			dbs[i].xacts >= found->xacts && dbs[i].deadlocks >= found->deadlocks;
+		if (have_rate[i]) {
+			rate = (dbs[i].deadlocks - found->deadlocks) / interval;
+			deadlocks_state[i] = get_status (rate, deadlocks_thresholds);
+			worst = max_state (worst, deadlocks_state[i]);
+		}
+
+		if (connections_state[i] != STATE_OK)
+			xasprintf (&problems, "%s, %s %.0f connections", problems ? problems : "",
+			           dbs[i].name, connections[i]);
+		if (age_state[i] != STATE_OK)
+			xasprintf (&problems, "%s, %s age %.0f", problems ? problems : "",
+			           dbs[i].name, age[i]);
+		if (deadlocks_state[i] != STATE_OK)
+			xasprintf (&problems, "%s, %s %g deadlocks/s", problems ? problems : "",
+			           dbs[i].name, rate);
+
+		xasprintf (&label, "%s_connections", dbs[i].name);
+		sperfdata_append (&perf, label, connections[i], "", connections_warning,
+		                  connections_critical, TRUE, 0, FALSE, 0);
+		xasprintf (&label, "%s_age", dbs[i].name);
+		sperfdata_append (&perf, label, age[i], "", age_warning, age_critical,
+		                  TRUE, 0, FALSE, 0);
+		if (have_rate[i]) {
+			xasprintf (&label, "%s_xact_rate", dbs[i].name);
+			fperfdata_append (&perf, label, (dbs[i].xacts - found->xacts) / interval, "",
+			                  FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+			xasprintf (&label, "%s_deadlock_rate", dbs[i].name);
+			sperfdata_append (&perf, label, rate, "", deadlocks_warning, deadlocks_critical,
+			                  TRUE, 0, FALSE, 0);
+		}
+	}
+	worst = max_state (worst, status);
+
+	header.clock = now;
+	header.count = n;
+	header.unused = 0;
+	length = sizeof (header) + n * sizeof (*dbs);
+	if ((data = malloc (length)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	memcpy (data, &header, sizeof (header));
+	memcpy (data + sizeof (header), dbs, n * sizeof (*dbs));
+	np_state_write_binary (0, data, length);
+	free (data);
+
+	printf (_(" %s - %d databases, %d connections%s (%f sec.)|%s %s\n"),
+	        state_text (worst), n, total, problems ? problems : "", elapsed_time,
+	        fperfdata ("time", elapsed_time, "s",
+	                   !!(twarn > 0.0), twarn, !!(tcrit > 0.0), tcrit, TRUE, 0, FALSE, 0),
+	        perf_string (&perf));
+
+	free (dbs);
+	free (connections);
+	free (age);
+	free (connections_state);
+	free (age_state);
+	free (deadlocks_state);
+	free (have_rate);
+	free (perf.buf);
+	return worst;
+}
@@ -34,8 +34,13 @@ const char *email = "devel@monitoring-plugins.org";
 
 #include "common.h"
 #include "netutils.h"
+#include "icmputils.h"
 #include "popen.h"
 #include "utils.h"
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
 
 #define WARN_DUPLICATES "DUPLICATES FOUND! "
 #define UNKNOWN_TRIP_TIME -1.0	/* -1 seconds */
@@ -50,6 +55,8 @@ int get_threshold (char *, float *, int *);
 int validate_arguments (void);
 int run_ping (const char *cmd, const char *addr);
 int error_scan (char buf[MAX_INPUT_BUFFER], const char *addr);
+static int native_ping (void);
+static int native_result (int);
 void print_usage (void);
 void print_help (void);
 
@@ -63,6 +70,9 @@ int n_addresses = 0;
 int max_addr = 1;
 int max_packets = -1;
 int verbose = 0;
+int use_native = FALSE;
+static np_icmp_target *native_targets = NULL;
+static int *native_index = NULL;  /* of each address in native_targets */
 
 float rta = UNKNOWN_TRIP_TIME;
 int pl = UNKNOWN_PACKET_LOSS;
@@ -80,10 +90,8 @@ main (int argc, char **argv)
 	int this_result = STATE_UNKNOWN;
 	int i;
 
-	setlocale (LC_ALL, "");
+	np_locale_init ();
 	setlocale (LC_NUMERIC, "C");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
 
 	addresses = malloc (sizeof(char*) * max_addr);
 	addresses[0] = NULL;
@@ -107,33 +115,40 @@ main (int argc, char **argv)
 	alarm (timeout_interval);
 #endif
 
+	if (use_native && !native_ping ())
+		use_native = FALSE;
+
 	for (i = 0 ; i < n_addresses ; i++) {
 
+		if (use_native) {
+			this_result = native_result (i);
+		} else {
 #ifdef PING6_COMMAND
-		if (address_family != AF_INET && is_inet6_addr(addresses[i]))
-			rawcmd = strdup(PING6_COMMAND);
-		else
-			rawcmd = strdup(PING_COMMAND);
+			if (address_family != AF_INET && is_inet6_addr(addresses[i]))
+				rawcmd = strdup(PING6_COMMAND);
+			else
+				rawcmd = strdup(PING_COMMAND);
 #else
-		rawcmd = strdup(PING_COMMAND);
+			rawcmd = strdup(PING_COMMAND);
 #endif
 
-		/* does the host address of number of packets argument come first? */
+			/* does the host address of number of packets argument come first? */
 #ifdef PING_PACKETS_FIRST
 # ifdef PING_HAS_TIMEOUT
-		xasprintf (&cmd, rawcmd, timeout_interval, max_packets, addresses[i]);
+			xasprintf (&cmd, rawcmd, timeout_interval, max_packets, addresses[i]);
 # else
-		xasprintf (&cmd, rawcmd, max_packets, addresses[i]);
+			xasprintf (&cmd, rawcmd, max_packets, addresses[i]);
 # endif
 #else
-		xasprintf (&cmd, rawcmd, addresses[i], max_packets);
+			xasprintf (&cmd, rawcmd, addresses[i], max_packets);
 #endif
 
-		if (verbose >= 2)
-			printf ("CMD: %s\n", cmd);
+			if (verbose >= 2)
+				printf ("CMD: %s\n", cmd);
 
-		/* run the command */
-		this_result = run_ping (cmd, addresses[i]);
+			/* run the command */
+			this_result = run_ping (cmd, addresses[i]);
+		}
 
 		if (pl == UNKNOWN_PACKET_LOSS || rta < 0.0) {
 			printf ("%s\n", cmd);
@@ -178,6 +193,7 @@ main (int argc, char **argv)
 		result = max_state (result, this_result);
 		free (rawcmd);
 		free (cmd);
+		rawcmd = cmd = NULL;
 	}
 
 	return result;
@@ -193,6 +209,9 @@ process_arguments (int argc, char **argv)
 	char *ptr;
 
 	int option = 0;
+	enum {
+		NATIVE_OPTION = CHAR_MAX + 1
+	};
 	static struct option longopts[] = {
 		STD_LONG_OPTS,
 		{"packets", required_argument, 0, 'p'},
@@ -200,6 +219,7 @@ process_arguments (int argc, char **argv)
 		{"link", no_argument, 0, 'L'},
 		{"use-ipv4", no_argument, 0, '4'},
 		{"use-ipv6", no_argument, 0, '6'},
+		{"native", no_argument, 0, NATIVE_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -283,6 +303,9 @@ process_arguments (int argc, char **argv)
 		case 'w':
 			get_threshold (optarg, &wrta, &wpl);
 			break;
+		case NATIVE_OPTION:
+			use_native = TRUE;
+			break;
 		}
 	}
 
@@ -437,7 +460,7 @@ run_ping (const char *cmd, const char *addr)
 	if ((child_process = spopen (cmd)) == NULL)
 		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), cmd);
 
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
+	child_stderr = fdopen (spopen_stderr (child_process), "r");
 	if (child_stderr == NULL)
 		printf (_("Cannot open stderr for %s\n"), cmd);
 
@@ -557,6 +580,173 @@ error_scan (char buf[MAX_INPUT_BUFFER], const char *addr)
 
 
 
+/* the address family PING_COMMAND or PING6_COMMAND would ping addr with */
+static int
+native_family (const char *addr)
+{
+#ifdef USE_IPV6
+	if (address_family == AF_INET6 || (address_family != AF_INET && is_inet6_addr (addr)))
+		return AF_INET6;
+#endif
+	return AF_INET;
+}
+
+/* Ping all addresses at once from ICMP sockets of our own, with the prober
+ * check_fping uses. Returns FALSE if no socket could be opened, then
+ * PING_COMMAND is run instead. */
+static int
+native_ping (void)
+{
+	static const int families[2] = { AF_INET, AF_INET6 };
+	struct addrinfo hints, *res;
+	np_icmp_probe probe[2];
+	double timeout;
+	int start[2], count[2] = { 0, 0 };
+	int f, i;
+
+	if ((native_targets = calloc (n_addresses, sizeof (np_icmp_target))) == NULL ||
+	    (native_index = calloc (n_addresses, sizeof (int))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	/* one prober run per family, each over its part of native_targets */
+	for (i = 0; i < n_addresses; i++)
+		count[native_family (addresses[i]) == AF_INET6]++;
+	start[0] = 0;
+	start[1] = count[0];
+
+	/* replies later than twice the critical RTA would not change much;
+	 * wait for them no longer than the plugin timeout allows */
+	timeout = crta * 2.0 * 1000.0;
+	if (timeout < 1.0e6)
+		timeout = 1.0e6;
+	if (timeout > (timeout_interval - max_packets) * 1.0e6 + 0.5e6)
+		timeout = (timeout_interval - max_packets) * 1.0e6 + 0.5e6;
+	if (timeout < 0.5e6)
+		timeout = 0.5e6;
+
+	memset (probe, 0, sizeof (probe));
+	for (f = 0; f < 2; f++) {
+		probe[f].sock = -1;
+		if (count[f] == 0)
+			continue;
+		if ((probe[f].sock = np_icmp_socket (families[f], TRUE, &probe[f].dgram)) < 0) {
+			if (verbose)
+				printf (_("Cannot open an ICMP socket (%s), running the ping command\n"), strerror (errno));
+			if (f == 1 && probe[0].sock >= 0)
+				close (probe[0].sock);
+			free (native_targets);
+			free (native_index);
+			return FALSE;
+		}
+		np_icmp_timestamps (probe[f].sock, verbose >= 2);
+		if (verbose >= 2)
+			printf (_("Using a %s ICMP socket\n"), probe[f].dgram ? _("datagram") : _("raw"));
+		probe[f].family = families[f];
+		probe[f].packets = max_packets > 0 ? max_packets : 1;
+		probe[f].size = 56;
+		probe[f].interval = 1000000;
+		probe[f].timeout = (unsigned int) timeout;
+		probe[f].verbose = verbose >= 2;
+		count[f] = 0;
+	}
+
+	/* no child to kill, a timeout here is only a timeout */
+	socket_timeout = timeout_interval;
+	signal (SIGALRM, socket_timeout_alarm_handler);
+
+	for (i = 0; i < n_addresses; i++) {
+		np_icmp_target *t;
+
+		f = native_family (addresses[i]) == AF_INET6;
+		native_index[i] = start[f] + count[f]++;
+		t = &native_targets[native_index[i]];
+		t->name = addresses[i];
+
+		memset (&hints, 0, sizeof (hints));
+		hints.ai_family = families[f];
+		hints.ai_socktype = SOCK_RAW;
+		if (np_getaddrinfo (addresses[i], NULL, &hints, &res) != 0)
+			continue;
+		memcpy (&t->addr, res->ai_addr, res->ai_addrlen);
+		freeaddrinfo (res);
+		t->resolved = TRUE;
+	}
+
+	for (f = 0; f < 2; f++) {
+		if (probe[f].sock < 0)
+			continue;
+		np_icmp_ping (&probe[f], native_targets + start[f], count[f]);
+		close (probe[f].sock);
+	}
+	return TRUE;
+}
+
+/* What run_ping() would make of the ping command for address i */
+static int
+native_result (int i)
+{
+	np_icmp_target *t = &native_targets[native_index[i]];
+	const char *addr = addresses[i];
+	int result = STATE_OK;
+
+	if (!t->resolved)
+		die (STATE_CRITICAL, _("CRITICAL - Host not found (%s)\n"), addr);
+	if (t->send_errno == ENETUNREACH)
+		die (STATE_CRITICAL, _("CRITICAL - Network Unreachable (%s)\n"), addr);
+	if (t->send_errno == EHOSTUNREACH)
+		die (STATE_CRITICAL, _("CRITICAL - Host Unreachable (%s)\n"), addr);
+
+	if (t->error && t->error_type == ICMP_TIMXCEED && t->addr.ss_family == AF_INET)
+		die (STATE_CRITICAL, _("CRITICAL - Time to live exceeded (%s)\n"), addr);
+	else if (t->error && t->addr.ss_family == AF_INET) {
+		switch (t->error_code) {
+		case ICMP_UNREACH_NET:
+		case ICMP_UNREACH_NET_UNKNOWN:
+		case ICMP_UNREACH_TOSNET:
+			die (STATE_CRITICAL, _("CRITICAL - Network Unreachable (%s)\n"), addr);
+		case ICMP_UNREACH_HOST:
+		case ICMP_UNREACH_HOST_UNKNOWN:
+		case ICMP_UNREACH_TOSHOST:
+			die (STATE_CRITICAL, _("CRITICAL - Host Unreachable (%s)\n"), addr);
+		case ICMP_UNREACH_PORT:
+			die (STATE_CRITICAL, _("CRITICAL - Bogus ICMP: Port Unreachable (%s)\n"), addr);
+		case ICMP_UNREACH_PROTOCOL:
+			die (STATE_CRITICAL, _("CRITICAL - Bogus ICMP: Protocol Unreachable (%s)\n"), addr);
+		case ICMP_UNREACH_NET_PROHIB:
+			die (STATE_CRITICAL, _("CRITICAL - Network Prohibited (%s)\n"), addr);
+		case ICMP_UNREACH_HOST_PROHIB:
+			die (STATE_CRITICAL, _("CRITICAL - Host Prohibited (%s)\n"), addr);
+		case ICMP_UNREACH_FILTER_PROHIB:
+			die (STATE_CRITICAL, _("CRITICAL - Packet Filtered (%s)\n"), addr);
+		default:
+			die (STATE_CRITICAL, _("CRITICAL - Destination Unreachable (%s)\n"), addr);
+		}
+	}
+	else if (t->error && t->error_type == ICMP6_TIME_EXCEEDED)
+		die (STATE_CRITICAL, _("CRITICAL - Time to live exceeded (%s)\n"), addr);
+	else if (t->error)
+		die (STATE_CRITICAL, _("CRITICAL - Destination Unreachable (%s)\n"), addr);
+
+	/* the same rounding as ping's */
+	pl = t->sent ? (int) ((t->sent - t->received) * 100 / t->sent) : 100;
+	/* there is no rta if all packets are lost, as in run_ping() */
+	rta = t->received ? t->rtt_total / t->received : crta;
+
+	if (t->duplicates) {
+		warn_text = strdup (_(WARN_DUPLICATES));
+		result = STATE_WARNING;
+	}
+	else
+		warn_text = strdup ("");
+
+	if (verbose)
+		printf (_("%s: %u packets transmitted, %u received, %u duplicates, %d%% packet loss, rtt min/avg/max = %.3f/%.3f/%.3f ms\n"),
+		        addr, t->sent, t->received, t->duplicates, pl, t->rtmin, t->received ? t->rtt_total / t->received : 0, t->rtmax);
+	return result;
+}
+
+
+
 void
 print_help (void)
 {
@@ -585,6 +775,10 @@ print_help (void)
   printf (" %s\n", "-p, --packets=INTEGER");
   printf ("    %s ", _("number of ICMP ECHO packets to send"));
   printf (_("(Default: %d)\n"), DEFAULT_MAX_PACKETS);
+  printf (" %s\n", "--native");
+  printf ("    %s\n", _("send the ICMP ECHO packets from this process rather than run ping,"));
+  printf ("    %s\n", _("over a raw socket or, for users in net.ipv4.ping_group_range, a"));
+  printf ("    %s\n", _("datagram ICMP socket. Runs ping if neither can be opened"));
   printf (" %s\n", "-L, --link");
   printf ("    %s\n", _("show HTML in the plugin output (obsoleted by urlize)"));
 
@@ -609,5 +803,5 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
 	printf ("%s -H <host_address> -w <wrta>,<wpl>%% -c <crta>,<cpl>%%\n", progname);
-  printf (" [-p packets] [-t timeout] [-4|-6]\n");
+  printf (" [-p packets] [-t timeout] [-4|-6] [--native]\n");
 }
@@ -39,7 +39,8 @@ const char *email = "devel@monitoring-plugins.org";
 #include "common.h"
 #include "utils.h"
 #include "utils_cmd.h"
-#include "regex.h"
+#include "utils_ps.h"
+#include "utils_regex.h"
 
 #include <pwd.h>
 #include <errno.h>
@@ -48,6 +49,19 @@ const char *email = "devel@monitoring-plugins.org";
 #include <sys/stat.h>
 #endif
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/syscall.h>
+# ifdef HAVE_LIBPTHREAD
+#  include <pthread.h>
+# endif
+# ifdef SYS_getdents64
+#  define USE_PROC_SCAN 1
+# endif
+#endif
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 int convert_to_seconds (char *); 
@@ -70,6 +84,10 @@ int options = 0; /* bitmask of filter criteria to test against */
 #define PCPU 256
 #define ELAPSED 512
 #define EREG_ARGS 1024
+#define PID 2048
+
+#define MAX_RULE_ARGS 64 /* arguments on a line of the --rules file */
+#define RULE_OPTION (CHAR_MAX+32) /* long options of a rule start here */
 
 #define KTHREAD_PARENT "kthreadd" /* the parent process of kernel threads:
 							ppid of procs are compared to pid of this proc*/
@@ -81,13 +99,16 @@ enum metric {
 	METRIC_VSZ,
 	METRIC_RSS,
 	METRIC_CPU,
-	METRIC_ELAPSED
+	METRIC_ELAPSED,
+	METRIC_IO
 };
 enum metric metric = METRIC_PROCS;
 
 int verbose = 0;
 int uid;
 pid_t ppid;
+pid_t filter_pid;
+int tree = 0;
 int vsz;
 int rss;
 float pcpu;
@@ -95,30 +116,1432 @@ char *statopts;
 char *prog;
 char *args;
 char *input_filename = NULL;
-regex_t re_args;
+np_regex_t re_args;
 char *fmt;
 char *fails;
 char tmp[MAX_INPUT_BUFFER];
 int kthread_filter = 0;
 int usepid = 0; /* whether to test for pid or /proc/pid/exe */
+int use_ps = 0; /* whether to parse PS_COMMAND even where /proc can be read */
+int ps_cache_ttl = 0; /* seconds to share the output of PS_COMMAND for */
+int debug = 0;
+int use_rates = 0; /* --rates: compare with the processes of the last run */
+unsigned long opened_exe = 0; /* /proc/pid/exe lookups, for --debug */
+int scan_threads = 0; /* --threads: to read /proc with, 0 for one per CPU */
+char *pidfile = NULL; /* --pidfile: only look at the process in it */
 
 FILE *ps_input = NULL;
 
+/* One set of filters and thresholds. The command line makes one rule;
+ * --rules reads any number of them, all checked in the same scan. */
+typedef struct procs_rule {
+	char *name;
+	int options;
+	int kthread_filter;
+	int uid;
+	pid_t ppid;
+	pid_t pid;
+	int tree;	/* --tree: the filters pick roots, whose trees are judged */
+	int vsz;
+	int rss;
+	float pcpu;
+	char *statopts;
+	char *prog;
+	char *args;
+	np_regex_t re_args;
+	char *fmt;
+	enum metric metric;
+	char *metric_name;
+	char *warning_range;
+	char *critical_range;
+	thresholds *procs_thresholds;
+
+	char *fails;
+	int procs;
+	int warn;
+	int crit;
+	int result;
+	struct tree_root *roots;
+	size_t nroots;
+	size_t roots_size;
+	struct procs_rule *next;
+} procs_rule;
+
+procs_rule *rules = NULL;
+char *rules_filename = NULL;
+char *rule_name = NULL; /* the rule process_arguments() is parsing */
+int passive = 0;
+char *passive_host = NULL;
+
 static int
 stat_exe (const pid_t pid, struct stat *buf) {
 	char *path;
 	int ret;
 	xasprintf(&path, "/proc/%d/exe", pid);
+	opened_exe++;
 	ret = stat(path, buf);
 	free(path);
 	return ret;
 }
 
+#ifdef USE_PROC_SCAN
+/* The Linux backend: walk /proc ourselves instead of parsing `ps`. Only
+ * /proc/PID/stat is read for every process; status and cmdline are read
+ * for a process once a filter gets to the fields they hold. */
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* What /proc/PID/stat holds of a process, and with --threads what status
+ * and cmdline do if a scan thread read them ahead. */
+typedef struct proc_record {
+	char pid[24];	/* "" if the process was gone */
+	char comm[64];
+	char state;
+	int ppid;
+	int pgrp;
+	int session;
+	int tpgid;
+	long nice;
+	long nlwp;
+	unsigned long utime;
+	unsigned long stime;
+	unsigned long vsize;
+	unsigned long long starttime;
+	long rss;
+	int have_status;
+	int euid;
+	unsigned long vmlck;
+	char *args;	/* the raw cmdline, NULL if not read ahead */
+	ssize_t args_len;
+} proc_record;
+
+typedef struct proc_scan {
+	int dirfd;
+	int eager;	/* load everything, for the verbose output */
+	int want_io;	/* --rates reads /proc/PID/io too */
+	const pid_t *pids;	/* --cgroup: only these, not all of /proc */
+	size_t npids;
+	size_t ipid;
+	long hz;
+	long pagesize;
+	unsigned long uptime;
+
+	/* --threads: every process read ahead, in the order of the pids */
+	proc_record *records;
+	size_t nrecords;
+	size_t irecord;
+	int read_status;	/* and their status or cmdline too */
+	int read_args;
+
+	/* the current process */
+	proc_record *record;
+	char pid[24];
+	char comm[64];
+	char state;
+	long nice;
+	long nlwp;
+	int pgrp;
+	int session;
+	int tpgid;
+	int euid;
+	unsigned long long ticks;	/* utime + stime */
+	unsigned long long starttime;
+	unsigned long seconds;
+	float pcpu;
+	int have_status;
+	int have_args;
+	char *args;
+	size_t args_size;
+
+	/* files opened, for --debug */
+	unsigned long opened_stat;
+	unsigned long opened_status;
+	unsigned long opened_cmdline;
+	unsigned long opened_io;
+
+	long pos;
+	long len;
+	char dents[32768];
+} proc_scan;
+
+/* Read /proc/PID/FILE into buf, returning its length or -1 */
+static ssize_t
+proc_read (int dirfd, const char *pid, const char *file, char *buf, size_t size)
+{
+	char path[64];
+	ssize_t n, len = 0;
+	int fd;
+
+	snprintf (path, sizeof (path), "%s/%s", pid, file);
+	if ((fd = openat (dirfd, path, O_RDONLY)) < 0)
+		return -1;
+	while (len < (ssize_t) size - 1 && (n = read (fd, buf + len, size - 1 - len)) > 0)
+		len += n;
+	close (fd);
+	buf[len] = '\0';
+	return len;
+}
+
+/* Parse /proc/PID/stat into rec, returning 0 if the process is gone */
+static int
+proc_read_stat (int dirfd, const char *pid, proc_record *rec)
+{
+	char buf[1024], *comm, *p;
+	long long f[NP_STAT_FIELDS];
+
+	if (proc_read (dirfd, pid, "stat", buf, sizeof (buf)) <= 0)
+		return 0;
+	if ((comm = strchr (buf, '(')) == NULL || (p = strrchr (comm, ')')) == NULL)
+		return 0;
+	*p = '\0';
+	comm++;
+	if (p[1] != ' ' || p[2] == '\0' ||
+	    np_strtoll_fields (p + 3, f, NP_STAT_FIELDS, NULL) != NP_STAT_FIELDS)
+		return 0;
+	rec->state = p[2];
+	rec->ppid = (int) f[NP_STAT_PPID];
+	rec->pgrp = (int) f[NP_STAT_PGRP];
+	rec->session = (int) f[NP_STAT_SESSION];
+	rec->tpgid = (int) f[NP_STAT_TPGID];
+	rec->utime = (unsigned long) f[NP_STAT_UTIME];
+	rec->stime = (unsigned long) f[NP_STAT_STIME];
+	rec->nice = (long) f[NP_STAT_NICE];
+	rec->nlwp = (long) f[NP_STAT_NLWP];
+	rec->starttime = (unsigned long long) f[NP_STAT_STARTTIME];
+	rec->vsize = (unsigned long) f[NP_STAT_VSIZE];
+	rec->rss = (long) f[NP_STAT_RSS];
+	snprintf (rec->pid, sizeof (rec->pid), "%s", pid);
+	snprintf (rec->comm, sizeof (rec->comm), "%s", comm);
+	return 1;
+}
+
+/* Read /proc/PID/status for the euid and VmLck */
+static void
+proc_read_status (int dirfd, const char *pid, int *euid, unsigned long *vmlck)
+{
+	char buf[2048], *p;
+	long long uids[2];
+
+	*vmlck = 0;
+	if (proc_read (dirfd, pid, "status", buf, sizeof (buf)) > 0) {
+		/* the real uid, then the effective one */
+		if ((p = strstr (buf, "\nUid:")) != NULL && np_strtoll_fields (p + 5, uids, 2, NULL) == 2)
+			*euid = (int) uids[1];
+		if ((p = strstr (buf, "\nVmLck:")) != NULL)
+			*vmlck = (unsigned long) np_strtoull (p + 7, NULL);
+	}
+}
+
+/* Read /proc/PID/cmdline into *buf, which grows as needed, returning its
+ * length */
+static ssize_t
+proc_read_cmdline (int dirfd, const char *pid, char **buf, size_t *size)
+{
+	char path[64];
+	ssize_t n, len = 0;
+	int fd;
+
+	snprintf (path, sizeof (path), "%s/cmdline", pid);
+	if ((fd = openat (dirfd, path, O_RDONLY)) < 0)
+		return 0;
+	for (;;) {
+		if (len + 1 >= (ssize_t) *size) {
+			*size = *size ? *size * 2 : MAX_INPUT_BUFFER;
+			if ((*buf = realloc (*buf, *size)) == NULL)
+				die (STATE_UNKNOWN, _("Cannot realloc()"));
+		}
+		if ((n = read (fd, *buf + len, *size - 1 - len)) <= 0)
+			break;
+		len += n;
+	}
+	close (fd);
+	return len;
+}
+
+/* The stat column of ps: the same flags, in the same order, as procps */
+static void
+proc_flags (proc_scan *ps, int vmlck, char *procstat)
+{
+	int len = 0;
+
+	procstat[len++] = ps->state;
+	if (ps->nice < 0)
+		procstat[len++] = '<';
+	else if (ps->nice > 0)
+		procstat[len++] = 'N';
+	if (vmlck)
+		procstat[len++] = 'L';
+	if (ps->session == atoi (ps->pid))
+		procstat[len++] = 's';
+	if (ps->nlwp > 1)
+		procstat[len++] = 'l';
+	if (ps->pgrp == ps->tpgid)
+		procstat[len++] = '+';
+	procstat[len] = '\0';
+}
+
+/* Read /proc/PID/status for the euid and the L flag */
+static void
+proc_scan_status (proc_scan *ps, int *procuid, char *procstat)
+{
+	unsigned long vmlck;
+
+	if (ps->have_status)
+		return;
+	ps->have_status = 1;
+
+	if (ps->record != NULL && ps->record->have_status) {
+		ps->euid = ps->record->euid;
+		vmlck = ps->record->vmlck;
+	} else {
+		ps->opened_status++;
+		proc_read_status (ps->dirfd, ps->pid, &ps->euid, &vmlck);
+	}
+	*procuid = ps->euid;
+	proc_flags (ps, vmlck != 0, procstat);
+}
+
+/* Read /proc/PID/cmdline the way ps prints args */
+static char *
+proc_scan_args (proc_scan *ps)
+{
+	ssize_t len, i;
+
+	if (ps->have_args)
+		return ps->args;
+	ps->have_args = 1;
+
+	if (ps->record != NULL && ps->record->args != NULL) {
+		len = ps->record->args_len;
+		if ((size_t) len + 1 > ps->args_size) {
+			ps->args_size = len + 1;
+			if ((ps->args = realloc (ps->args, ps->args_size)) == NULL)
+				die (STATE_UNKNOWN, _("Cannot realloc()"));
+		}
+		memcpy (ps->args, ps->record->args, len);
+	} else {
+		ps->opened_cmdline++;
+		len = proc_read_cmdline (ps->dirfd, ps->pid, &ps->args, &ps->args_size);
+	}
+
+	/* kernel threads and zombies have no command line */
+	if (len <= 0) {
+		free (ps->args);
+		xasprintf (&ps->args, "[%s]%s", ps->comm, ps->state == 'Z' ? " <defunct>" : "");
+		ps->args_size = strlen (ps->args) + 1;
+		return ps->args;
+	}
+
+	/* arguments are NUL separated; like ps, show control characters as blanks */
+	for (i = 0; i < len; i++)
+		if ((unsigned char) ps->args[i] < ' ')
+			ps->args[i] = ' ';
+	ps->args[len] = '\0';
+	strip (ps->args);
+	return ps->args;
+}
+
+static proc_scan *
+proc_scan_open (int eager)
+{
+	proc_scan *ps;
+	char buf[128];
+	int fd;
+	ssize_t n;
+
+	if ((ps = calloc (1, sizeof (proc_scan))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	if ((ps->dirfd = open ("/proc", O_RDONLY | O_DIRECTORY)) < 0) {
+		free (ps);
+		return NULL;
+	}
+
+	/* without a mounted /proc this is not the process table */
+	if ((fd = openat (ps->dirfd, "uptime", O_RDONLY)) < 0 ||
+	    (n = read (fd, buf, sizeof (buf) - 1)) <= 0) {
+		if (fd >= 0)
+			close (fd);
+		close (ps->dirfd);
+		free (ps);
+		return NULL;
+	}
+	close (fd);
+	buf[n] = '\0';
+	ps->uptime = (unsigned long) strtod (buf, NULL);
+
+	ps->eager = eager;
+	ps->hz = sysconf (_SC_CLK_TCK);
+	ps->pagesize = sysconf (_SC_PAGESIZE);
+	return ps;
+}
+
+static void
+proc_scan_close (proc_scan *ps)
+{
+	size_t i;
+
+	for (i = 0; i < ps->nrecords; i++)
+		free (ps->records[i].args);
+	free (ps->records);
+	close (ps->dirfd);
+	free (ps->args);
+	free (ps);
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* --threads: the processes are split into as many runs of pids as there
+ * are threads, each reads its run into its part of the records, and the
+ * main loop then goes through them in order as if it had read them. */
+#define SCAN_THREADS_MAX 16
+#define SCAN_THREADS_MIN_PROCS 1024	/* fewer are not worth the threads */
+
+typedef struct proc_worker {
+	pthread_t tid;
+	proc_scan *ps;
+	const pid_t *pids;
+	size_t start;
+	size_t end;
+	unsigned long opened_stat;
+	unsigned long opened_status;
+	unsigned long opened_cmdline;
+} proc_worker;
+
+static void *
+proc_worker_run (void *arg)
+{
+	proc_worker *w = arg;
+	proc_record *rec;
+	char pid[24], *buf = NULL;
+	size_t i, size = 0;
+
+	for (i = w->start; i < w->end; i++) {
+		rec = &w->ps->records[i];
+		snprintf (pid, sizeof (pid), "%d", (int) w->pids[i]);
+		w->opened_stat++;
+		if (!proc_read_stat (w->ps->dirfd, pid, rec)) {
+			rec->pid[0] = '\0';
+			continue;
+		}
+		if (w->ps->read_status) {
+			w->opened_status++;
+			proc_read_status (w->ps->dirfd, pid, &rec->euid, &rec->vmlck);
+			rec->have_status = 1;
+		}
+		if (w->ps->read_args) {
+			w->opened_cmdline++;
+			if ((rec->args_len = proc_read_cmdline (w->ps->dirfd, pid, &buf, &size)) >= 0 &&
+			    (rec->args = malloc (rec->args_len + 1)) != NULL)
+				memcpy (rec->args, buf, rec->args_len);
+		}
+	}
+	free (buf);
+	return NULL;
+}
+
+/* Read every process ahead with up to threads threads, 0 for one per CPU.
+ * Returns the number of threads used, 1 if the scan stays as it is. */
+static int
+proc_scan_threads (proc_scan *ps, int threads)
+{
+	struct linux_dirent64 *d;
+	proc_worker *workers;
+	pid_t *all = NULL;
+	const pid_t *pids;
+	size_t count = 0, size = 0, i;
+	int started;
+
+	if (threads == 0) {
+		threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+		if (threads > SCAN_THREADS_MAX)
+			threads = SCAN_THREADS_MAX;
+	}
+	if (threads <= 1)
+		return 1;
+
+	if (ps->pids != NULL) {
+		pids = ps->pids;
+		count = ps->npids;
+	} else {
+		/* the pids of /proc first, which is one getdents64 per 32k */
+		while ((ps->len = syscall (SYS_getdents64, ps->dirfd, ps->dents, sizeof (ps->dents))) > 0) {
+			for (ps->pos = 0; ps->pos < ps->len; ps->pos += d->d_reclen) {
+				d = (struct linux_dirent64 *) (ps->dents + ps->pos);
+				if (d->d_name[0] < '1' || d->d_name[0] > '9')
+					continue;
+				if (count >= size) {
+					size = size ? size * 2 : 4096;
+					if ((all = realloc (all, size * sizeof (pid_t))) == NULL)
+						die (STATE_UNKNOWN, _("Cannot realloc()"));
+				}
+				all[count++] = (pid_t) np_strtoll (d->d_name, NULL);
+			}
+		}
+		pids = all;
+	}
+
+	if (count < SCAN_THREADS_MIN_PROCS) {
+		/* not worth it: go on from this list without threads */
+		if (all != NULL) {
+			ps->pids = all;
+			ps->npids = count;
+		}
+		return 1;
+	}
+	if ((size_t) threads > count / (SCAN_THREADS_MIN_PROCS / 4))
+		threads = count / (SCAN_THREADS_MIN_PROCS / 4);
+
+	if ((ps->records = calloc (count, sizeof (proc_record))) == NULL ||
+	    (workers = calloc (threads, sizeof (proc_worker))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	ps->nrecords = count;
+
+	for (i = 0; i < (size_t) threads; i++) {
+		workers[i].ps = ps;
+		workers[i].pids = pids;
+		workers[i].start = count * i / threads;
+		workers[i].end = count * (i + 1) / threads;
+	}
+	/* whatever a thread could not be started for is done here */
+	for (started = 1; started < threads; started++)
+		if (pthread_create (&workers[started].tid, NULL, proc_worker_run, &workers[started]) != 0)
+			break;
+	for (i = started; i < (size_t) threads; i++)
+		proc_worker_run (&workers[i]);
+	proc_worker_run (&workers[0]);
+	for (i = 1; i < (size_t) started; i++)
+		pthread_join (workers[i].tid, NULL);
+
+	for (i = 0; i < (size_t) threads; i++) {
+		ps->opened_stat += workers[i].opened_stat;
+		ps->opened_status += workers[i].opened_status;
+		ps->opened_cmdline += workers[i].opened_cmdline;
+	}
+	free (workers);
+	free (all);
+	return threads;
+}
+#endif /* HAVE_LIBPTHREAD */
+
+/* Fill in the next process with what /proc/PID/stat holds of the fields ps
+ * would have printed for 'stat uid pid ppid vsz rss pcpu etime comm args'.
+ * The uid, the L flag and args are left to proc_scan_status() and
+ * proc_scan_args(). Returns 0 at the end. */
+static int
+proc_scan_next (proc_scan *ps, char *procstat, int *procuid, pid_t *procpid,
+                pid_t *procppid, int *procvsz, int *procrss, float *procpcpu,
+                int *procseconds, char *procetime, char *procprog, char **procargs)
+{
+	struct linux_dirent64 *d;
+	proc_record *rec, current;
+	unsigned long seconds, pcpu;
+	char pidname[24];
+	const char *name;
+
+	for (;;) {
+		if (ps->records != NULL) {
+			if (ps->irecord >= ps->nrecords)
+				return 0;
+			rec = &ps->records[ps->irecord++];
+			if (rec->pid[0] == '\0')
+				continue;
+			ps->record = rec;
+		} else {
+			if (ps->pids != NULL) {
+				if (ps->ipid >= ps->npids)
+					return 0;
+				snprintf (pidname, sizeof (pidname), "%d", (int) ps->pids[ps->ipid++]);
+				name = pidname;
+			} else {
+				if (ps->pos >= ps->len) {
+					ps->len = syscall (SYS_getdents64, ps->dirfd, ps->dents, sizeof (ps->dents));
+					ps->pos = 0;
+					if (ps->len <= 0)
+						return 0;
+				}
+				d = (struct linux_dirent64 *) (ps->dents + ps->pos);
+				ps->pos += d->d_reclen;
+				name = d->d_name;
+
+				if (name[0] < '1' || name[0] > '9')
+					continue;
+			}
+
+			/* the process may exit at any point while we look at it */
+			ps->opened_stat++;
+			rec = &current;
+			if (!proc_read_stat (ps->dirfd, name, rec))
+				continue;
+			ps->record = NULL;
+		}
+
+		memcpy (ps->pid, rec->pid, sizeof (ps->pid));
+		memcpy (ps->comm, rec->comm, sizeof (ps->comm));
+		ps->state = rec->state;
+		ps->pgrp = rec->pgrp;
+		ps->session = rec->session;
+		ps->tpgid = rec->tpgid;
+		ps->nice = rec->nice;
+		ps->nlwp = rec->nlwp;
+		ps->euid = -1;
+		ps->ticks = (unsigned long long) rec->utime + rec->stime;
+		ps->starttime = rec->starttime;
+		ps->have_status = 0;
+		ps->have_args = 0;
+
+		*procpid = (pid_t) atoi (rec->pid);
+		*procppid = (pid_t) rec->ppid;
+		*procvsz = (int) (rec->vsize / 1024);
+		*procrss = (int) (rec->rss * (ps->pagesize / 1024));
+		*procuid = -1;
+		*procargs = "";
+		proc_flags (ps, 0, procstat);
+
+		/* ps prints at most TASK_COMM_LEN - 1 characters; keep -C rules
+		 * written against its output working */
+		strncpy (procprog, rec->comm, 15);
+		procprog[15] = '\0';
+
+		/* ps: elapsed seconds and the lifetime average of %CPU in tenths */
+		seconds = ps->uptime - (unsigned long) (rec->starttime / ps->hz);
+		if (seconds > ps->uptime)
+			seconds = 0;
+		*procseconds = (int) seconds;
+		pcpu = seconds ? (ps->ticks * 1000ULL / ps->hz) / seconds : 0;
+		*procpcpu = pcpu > 999 ? (float) (pcpu / 10) : pcpu / 10.0;
+		ps->seconds = seconds;
+		ps->pcpu = *procpcpu;
+		if (seconds >= 86400)
+			sprintf (procetime, "%lu-%02lu:%02lu:%02lu", seconds / 86400,
+			         seconds / 3600 % 24, seconds / 60 % 60, seconds % 60);
+		else if (seconds >= 3600)
+			sprintf (procetime, "%02lu:%02lu:%02lu", seconds / 3600, seconds / 60 % 60, seconds % 60);
+		else
+			sprintf (procetime, "%02lu:%02lu", seconds / 60, seconds % 60);
+
+		if (ps->eager) {
+			proc_scan_status (ps, procuid, procstat);
+			*procargs = proc_scan_args (ps);
+		}
+
+		return 1;
+	}
+}
+
+/* --rates: what a process had used up to a run. Kept sorted by pid in the
+ * state, after the time of the run in microseconds. A pid only is the same
+ * process if it also started at the same time. */
+typedef struct proc_usage {
+	int32_t pid;
+	uint32_t have_io;
+	uint64_t starttime;
+	uint64_t ticks;
+	uint64_t io_bytes;	/* read_bytes + write_bytes */
+} proc_usage;
+
+static proc_usage *usage_then = NULL, *usage_now = NULL;
+static size_t usage_then_count = 0, usage_now_count = 0, usage_now_size = 0;
+static uint64_t usage_then_time = 0, usage_now_time = 0;
+
+static int
+proc_usage_compare (const void *a, const void *b)
+{
+	const proc_usage *x = a, *y = b;
+
+	return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+/* the processes of the last run, if there was one */
+static void
+proc_usage_load (void)
+{
+	struct timeval tv;
+	state_data *previous;
+
+	gettimeofday (&tv, NULL);
+	usage_now_time = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+
+	np_enable_state (NULL, 1);
+	previous = np_state_read ();
+	if (previous == NULL || previous->data == NULL || previous->length < (int) sizeof (uint64_t) ||
+	    (previous->length - sizeof (uint64_t)) % sizeof (proc_usage) != 0)
+		return;
+	memcpy (&usage_then_time, previous->data, sizeof (uint64_t));
+	usage_then_count = (previous->length - sizeof (uint64_t)) / sizeof (proc_usage);
+	if (usage_then_count == 0)
+		return;
+	if ((usage_then = malloc (usage_then_count * sizeof (proc_usage))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	memcpy (usage_then, (char *) previous->data + sizeof (uint64_t), usage_then_count * sizeof (proc_usage));
+}
+
+static void
+proc_usage_save (void)
+{
+	char *data;
+	size_t length = sizeof (uint64_t) + usage_now_count * sizeof (proc_usage);
+
+	if (usage_now_count)
+		qsort (usage_now, usage_now_count, sizeof (proc_usage), proc_usage_compare);
+	if ((data = malloc (length)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	memcpy (data, &usage_now_time, sizeof (uint64_t));
+	if (usage_now_count)
+		memcpy (data + sizeof (uint64_t), usage_now, usage_now_count * sizeof (proc_usage));
+	np_state_write_binary (0, data, length);
+	free (data);
+}
+
+/* The CPU percentage and the kB/s of storage I/O of the current process
+ * since the last run. A process the last run did not see gets what it used
+ * over its lifetime, which is what ps reports for %CPU. */
+static void
+proc_scan_rates (proc_scan *ps, double *cpu, double *io)
+{
+	static const char *io_keys[2] = { "\nread_bytes:", "\nwrite_bytes:" };
+	proc_usage *now, *then, key;
+	char buf[1024], *p, *end;
+	unsigned long long bytes;
+	double dt;
+	int i;
+
+	if (usage_now_count == usage_now_size) {
+		usage_now_size = usage_now_size ? usage_now_size * 2 : 256;
+		if ((usage_now = realloc (usage_now, usage_now_size * sizeof (proc_usage))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	now = &usage_now[usage_now_count++];
+	memset (now, 0, sizeof (proc_usage));
+	now->pid = (pid_t) np_strtoll (ps->pid, NULL);
+	now->starttime = ps->starttime;
+	now->ticks = ps->ticks;
+
+	/* only the owner and root may read it */
+	if (ps->want_io) {
+		ps->opened_io++;
+		if (proc_read (ps->dirfd, ps->pid, "io", buf, sizeof (buf)) > 0) {
+			for (i = 0; i < 2; i++) {
+				if ((p = strstr (buf, io_keys[i])) == NULL)
+					continue;
+				p += strlen (io_keys[i]);
+				bytes = np_strtoull (p, &end);
+				if (end > p) {
+					now->io_bytes += bytes;
+					now->have_io++;
+				}
+			}
+			now->have_io = (now->have_io == 2);
+		}
+	}
+
+	*cpu = ps->pcpu;
+	*io = now->have_io && ps->seconds ? now->io_bytes / 1024.0 / ps->seconds : 0;
+
+	key.pid = now->pid;
+	then = usage_then_count ? bsearch (&key, usage_then, usage_then_count, sizeof (proc_usage), proc_usage_compare) : NULL;
+	if (then == NULL || then->starttime != now->starttime || usage_now_time <= usage_then_time)
+		return;
+	dt = (usage_now_time - usage_then_time) / 1.0e6;
+	if (now->ticks >= then->ticks)
+		*cpu = (now->ticks - then->ticks) * 100.0 / ps->hz / dt;
+	if (now->have_io && then->have_io && now->io_bytes >= then->io_bytes)
+		*io = (now->io_bytes - then->io_bytes) / 1024.0 / dt;
+}
+
+/* --cgroup and --unit: the processes of a cgroup and of the cgroups below
+ * it, straight from their cgroup.procs, and what the kernel accounts for
+ * all of them together. A path is taken below the cgroup v2 hierarchy, or
+ * the systemd one of a hybrid setup. */
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+static const char *cgroup_roots[] = {
+	CGROUP_ROOT, CGROUP_ROOT "/unified", CGROUP_ROOT "/systemd", NULL
+};
+
+char *cgroup_path = NULL;	/* as given, then the directory */
+char *unit_name = NULL;
+static pid_t *cgroup_pids = NULL;
+static size_t cgroup_count = 0, cgroup_size = 0;
+
+static int
+cgroup_is_dir (const char *path)
+{
+	struct stat sb;
+
+	return stat (path, &sb) == 0 && S_ISDIR (sb.st_mode);
+}
+
+/* with cgroup v1, /sys/fs/cgroup only holds the hierarchies */
+static int
+cgroup_is_root (const char *root)
+{
+	char *path;
+	int result;
+
+	xasprintf (&path, "%s/cgroup.procs", root);
+	result = access (path, R_OK) == 0;
+	free (path);
+	return result;
+}
+
+static const char *cgroup_unit;	/* what cgroup_find_unit() looks for */
+static char *cgroup_unit_path;
+
+static int
+cgroup_find_unit (const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+	if (flag != FTW_D || strcmp (path + ftw->base, cgroup_unit) != 0)
+		return 0;
+	cgroup_unit_path = strdup (path);
+	return 1;
+}
+
+/* The directory of --cgroup or --unit. A unit without a suffix is a
+ * service; it is looked for in system.slice first, then anywhere. */
+static char *
+cgroup_resolve (void)
+{
+	const char **root;
+	char *path = NULL, *unit;
+
+	if (cgroup_path != NULL) {
+		if (strncmp (cgroup_path, CGROUP_ROOT "/", strlen (CGROUP_ROOT) + 1) == 0)
+			return cgroup_is_dir (cgroup_path) ? cgroup_path : NULL;
+		/* as /proc/PID/cgroup shows it, below the root of a hierarchy */
+		for (root = cgroup_roots; *root != NULL; root++) {
+			xasprintf (&path, "%s/%s", *root, cgroup_path + strspn (cgroup_path, "/"));
+			if (cgroup_is_root (*root) && cgroup_is_dir (path))
+				return path;
+		}
+		return NULL;
+	}
+
+	if (strchr (unit_name, '.') == NULL)
+		xasprintf (&unit, "%s.service", unit_name);
+	else
+		unit = unit_name;
+	for (root = cgroup_roots; *root != NULL; root++) {
+		xasprintf (&path, "%s/system.slice/%s", *root, unit);
+		if (cgroup_is_root (*root) && cgroup_is_dir (path))
+			return path;
+	}
+	cgroup_unit = unit;
+	for (root = cgroup_roots; *root != NULL && cgroup_unit_path == NULL; root++)
+		if (cgroup_is_root (*root))
+			nftw (*root, cgroup_find_unit, 16, FTW_PHYS);
+	return cgroup_unit_path;
+}
+
+static void
+cgroup_collect (int dirfd)
+{
+	DIR *dir;
+	struct dirent *d;
+	FILE *fp;
+	int fd, pid;
+
+	if ((fd = openat (dirfd, "cgroup.procs", O_RDONLY)) >= 0) {
+		if ((fp = fdopen (fd, "r")) == NULL)
+			close (fd);
+		else {
+			while (fscanf (fp, "%d", &pid) == 1) {
+				if (cgroup_count >= cgroup_size) {
+					cgroup_size = cgroup_size ? cgroup_size * 2 : 256;
+					if ((cgroup_pids = realloc (cgroup_pids, cgroup_size * sizeof (pid_t))) == NULL)
+						die (STATE_UNKNOWN, _("Cannot realloc()"));
+				}
+				cgroup_pids[cgroup_count++] = (pid_t) pid;
+			}
+			fclose (fp);
+		}
+	}
+
+	/* the cgroups below, which are all the directories */
+	if ((fd = dup (dirfd)) < 0)
+		return;
+	if ((dir = fdopendir (fd)) == NULL) {
+		close (fd);
+		return;
+	}
+	while ((d = readdir (dir)) != NULL) {
+		if (d->d_name[0] == '.' || (d->d_type != DT_DIR && d->d_type != DT_UNKNOWN))
+			continue;
+		if ((fd = openat (dirfd, d->d_name, O_RDONLY | O_DIRECTORY)) < 0)
+			continue;
+		cgroup_collect (fd);
+		close (fd);
+	}
+	closedir (dir);
+}
+
+static int
+cgroup_pid_compare (const void *a, const void *b)
+{
+	pid_t x = *(const pid_t *) a, y = *(const pid_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Read the pids of the cgroup, sorted and each once: cgroup v1 may list
+ * a pid more than once. */
+static void
+cgroup_open (void)
+{
+	const char *given = unit_name ? unit_name : cgroup_path;
+	size_t i, n = 0;
+	int fd;
+
+	if ((cgroup_path = cgroup_resolve ()) == NULL)
+		die (STATE_UNKNOWN, _("PROCS UNKNOWN - No cgroup %s\n"), given);
+	if ((fd = open (cgroup_path, O_RDONLY | O_DIRECTORY)) < 0)
+		die (STATE_UNKNOWN, _("PROCS UNKNOWN - Cannot open %s: %s\n"), cgroup_path, strerror (errno));
+	cgroup_collect (fd);
+	close (fd);
+
+	qsort (cgroup_pids, cgroup_count, sizeof (pid_t), cgroup_pid_compare);
+	for (i = 0; i < cgroup_count; i++)
+		if (n == 0 || cgroup_pids[n - 1] != cgroup_pids[i])
+			cgroup_pids[n++] = cgroup_pids[i];
+	cgroup_count = n;
+}
+
+static int
+cgroup_has (pid_t pid)
+{
+	return bsearch (&pid, cgroup_pids, cgroup_count, sizeof (pid_t), cgroup_pid_compare) != NULL;
+}
+
+/* a number in a file of the cgroup, -1 if it has none, as "max" is */
+static long long
+cgroup_value (const char *file)
+{
+	char path[PATH_MAX], buf[64], *end;
+	long long value;
+	ssize_t n;
+	int fd;
+
+	snprintf (path, sizeof (path), "%s/%s", cgroup_path, file);
+	if ((fd = open (path, O_RDONLY)) < 0)
+		return -1;
+	n = read (fd, buf, sizeof (buf) - 1);
+	close (fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	value = strtoll (buf, &end, 10);
+	return end == buf ? -1 : value;
+}
+
+/* the perfdata of the cgroup as a whole */
+static void
+print_cgroup_perfdata (void)
+{
+	long long current, max;
+
+	if ((current = cgroup_value ("memory.current")) >= 0 ||
+	    (current = cgroup_value ("memory.usage_in_bytes")) >= 0) {
+		if ((max = cgroup_value ("memory.max")) < 0)
+			max = cgroup_value ("memory.limit_in_bytes");
+		printf (" cgroup_memory=%lldB;;;0;", current);
+		/* unlimited is "max", or a page short of LLONG_MAX with v1 */
+		if (max >= 0 && max < LLONG_MAX / 2)
+			printf ("%lld", max);
+	}
+	if ((current = cgroup_value ("pids.current")) >= 0) {
+		max = cgroup_value ("pids.max");
+		printf (" cgroup_pids=%lld;;;0;", current);
+		if (max >= 0)
+			printf ("%lld", max);
+	}
+}
+#endif /* USE_PROC_SCAN */
+
+
+/* --tree: every process the scan saw, for the trees below the processes
+ * the rules matched, which are only known once the scan is done */
+typedef struct tree_proc {
+	pid_t pid;
+	pid_t ppid;
+	int vsz;
+	int rss;
+	float cpu;
+	double io;
+	int seconds;
+	unsigned int seen;	/* the walk that last came here */
+} tree_proc;
+
+typedef struct tree_root {
+	pid_t pid;
+	char *prog;
+} tree_root;
+
+static tree_proc *tree_procs = NULL;	/* by pid once indexed */
+static size_t tree_count = 0, tree_size = 0;
+static size_t *tree_children = NULL;	/* tree_procs by ppid */
+
+static void
+tree_add (pid_t pid, pid_t ppid, int vsz, int rss, float cpu, double io, int seconds)
+{
+	tree_proc *t;
+
+	if (tree_count >= tree_size) {
+		tree_size = tree_size ? tree_size * 2 : 1024;
+		if ((tree_procs = realloc (tree_procs, tree_size * sizeof (tree_proc))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot realloc()"));
+	}
+	t = &tree_procs[tree_count++];
+	t->pid = pid;
+	t->ppid = ppid;
+	t->vsz = vsz;
+	t->rss = rss;
+	t->cpu = cpu;
+	t->io = io;
+	t->seconds = seconds;
+	t->seen = 0;
+}
+
+static void
+tree_root_add (procs_rule *r, pid_t pid, const char *prog)
+{
+	if (r->nroots >= r->roots_size) {
+		r->roots_size = r->roots_size ? r->roots_size * 2 : 16;
+		if ((r->roots = realloc (r->roots, r->roots_size * sizeof (tree_root))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot realloc()"));
+	}
+	r->roots[r->nroots].pid = pid;
+	r->roots[r->nroots].prog = strdup (prog);
+	r->nroots++;
+}
+
+static int
+tree_pid_compare (const void *a, const void *b)
+{
+	pid_t x = ((const tree_proc *) a)->pid, y = ((const tree_proc *) b)->pid;
+
+	return (x > y) - (x < y);
+}
+
+static int
+tree_ppid_compare (const void *a, const void *b)
+{
+	pid_t x = tree_procs[*(const size_t *) a].ppid, y = tree_procs[*(const size_t *) b].ppid;
+
+	if (x != y)
+		return (x > y) - (x < y);
+	return (*(const size_t *) a > *(const size_t *) b) - (*(const size_t *) a < *(const size_t *) b);
+}
+
+static int
+tree_root_compare (const void *a, const void *b)
+{
+	pid_t x = ((const tree_root *) a)->pid, y = ((const tree_root *) b)->pid;
+
+	return (x > y) - (x < y);
+}
+
+/* sort the processes by pid, and index their children by ppid */
+static void
+tree_index (void)
+{
+	size_t i;
+
+	qsort (tree_procs, tree_count, sizeof (tree_proc), tree_pid_compare);
+	if ((tree_children = malloc ((tree_count ? tree_count : 1) * sizeof (size_t))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	for (i = 0; i < tree_count; i++)
+		tree_children[i] = i;
+	qsort (tree_children, tree_count, sizeof (size_t), tree_ppid_compare);
+}
+
+static tree_proc *
+tree_find (pid_t pid)
+{
+	tree_proc key;
+
+	key.pid = pid;
+	return bsearch (&key, tree_procs, tree_count, sizeof (tree_proc), tree_pid_compare);
+}
+
+/* the first of the children of pid in tree_children */
+static size_t
+tree_first_child (pid_t pid)
+{
+	size_t lo = 0, hi = tree_count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (tree_procs[tree_children[mid]].ppid < pid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* what a rule measures for one process, or with --tree one tree */
+static void
+rule_judge (procs_rule *r, double value, const char *prog)
+{
+	int i;
+
+	if (r->metric == METRIC_PROCS)
+		return;
+	i = get_status (value, r->procs_thresholds);
+	if (i == STATE_WARNING) {
+		r->warn++;
+		xasprintf (&r->fails, "%s%s%s", r->fails, (strcmp(r->fails,"") ? ", " : ""), prog);
+		r->result = max_state (r->result, i);
+	}
+	if (i == STATE_CRITICAL) {
+		r->crit++;
+		xasprintf (&r->fails, "%s%s%s", r->fails, (strcmp(r->fails,"") ? ", " : ""), prog);
+		r->result = max_state (r->result, i);
+	}
+}
+
+/* Add up the tree below every root of a rule and judge it. A root below
+ * another root is in that one's tree already. */
+static void
+tree_judge (procs_rule *r)
+{
+	static unsigned int walk = 0;
+	static size_t *stack = NULL;
+	static size_t stack_size = 0;
+	tree_root *root, key;
+	tree_proc *t, *up;
+	size_t i, depth, c;
+	int procs, vsz, rss, hops;
+	float cpu;
+	double io, value;
+
+	if (r->nroots == 0)
+		return;
+	qsort (r->roots, r->nroots, sizeof (tree_root), tree_root_compare);
+	if (stack == NULL) {
+		stack_size = tree_count ? tree_count : 1;
+		if ((stack = malloc (stack_size * sizeof (size_t))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot malloc"));
+	}
+
+	for (root = r->roots; root < r->roots + r->nroots; root++) {
+		if ((t = tree_find (root->pid)) == NULL)
+			continue;
+		/* the ppids could loop if processes came and went during the scan */
+		for (up = tree_find (t->ppid), hops = 0; up != NULL && up != t && hops < 1024;
+		     up = tree_find (up->ppid), hops++) {
+			key.pid = up->pid;
+			if (bsearch (&key, r->roots, r->nroots, sizeof (tree_root), tree_root_compare) != NULL)
+				break;
+		}
+		if (up != NULL && up != t && hops < 1024)
+			continue;
+
+		procs = vsz = rss = 0;
+		cpu = 0;
+		io = 0;
+		walk++;
+		stack[0] = t - tree_procs;
+		t->seen = walk;
+		for (depth = 1; depth > 0; ) {
+			t = &tree_procs[stack[--depth]];
+			procs++;
+			vsz += t->vsz;
+			rss += t->rss;
+			cpu += t->cpu;
+			io += t->io;
+			for (i = tree_first_child (t->pid); i < tree_count && tree_procs[tree_children[i]].ppid == t->pid; i++) {
+				c = tree_children[i];
+				if (tree_procs[c].seen == walk || depth >= stack_size)
+					continue;
+				tree_procs[c].seen = walk;
+				stack[depth++] = c;
+			}
+		}
+
+		t = tree_find (root->pid);
+		if (verbose >= 2) {
+			if (r->name)
+				printf ("%s: ", r->name);
+			printf ("Tree of pid=%d prog=%s: %d processes, vsz=%d rss=%d cpu=%.2f io=%.1fkB/s\n",
+			        (int) root->pid, root->prog, procs, vsz, rss, cpu, io);
+		}
+
+		r->procs += procs;
+		if (r->metric == METRIC_VSZ)
+			value = vsz;
+		else if (r->metric == METRIC_RSS)
+			value = rss;
+		else if (r->metric == METRIC_CPU)
+			value = cpu;
+		else if (r->metric == METRIC_IO)
+			value = io;
+		else
+			value = t->seconds;
+		rule_judge (r, value, root->prog);
+	}
+}
+
+/* forget the filters and thresholds process_arguments() has parsed */
+static void
+rule_reset (void)
+{
+	options = 0;
+	kthread_filter = 0;
+	uid = 0;
+	ppid = 0;
+	filter_pid = 0;
+	tree = 0;
+	vsz = 0;
+	rss = 0;
+	pcpu = 0;
+	statopts = NULL;
+	prog = NULL;
+	args = NULL;
+	fmt = NULL;
+	fails = NULL;
+	warning_range = NULL;
+	critical_range = NULL;
+	procs_thresholds = NULL;
+	metric = METRIC_PROCS;
+	xasprintf (&metric_name, "PROCS");
+}
+
+/* keep what process_arguments() has parsed as a rule */
+static procs_rule *
+rule_save (const char *name)
+{
+	procs_rule *r;
+
+	if ((r = calloc (1, sizeof (procs_rule))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	r->name = name ? strdup (name) : NULL;
+	r->options = options;
+	r->kthread_filter = kthread_filter;
+	r->uid = uid;
+	r->ppid = ppid;
+	r->pid = filter_pid;
+	r->tree = tree;
+	r->vsz = vsz;
+	r->rss = rss;
+	r->pcpu = pcpu;
+	r->statopts = statopts;
+	r->prog = prog;
+	r->args = args;
+	r->re_args = re_args;
+	r->fmt = fmt;
+	r->metric = metric;
+	r->metric_name = metric_name;
+	r->warning_range = warning_range;
+	r->critical_range = critical_range;
+	r->procs_thresholds = procs_thresholds;
+	r->fails = fails;
+	r->result = STATE_UNKNOWN;
+
+	rule_reset ();
+	return r;
+}
+
+/* --rules: one "NAME: OPTIONS" per line, OPTIONS being the filters and
+ * thresholds of a check_procs command line. Arguments are split at blanks
+ * unless quoted with ' or ". Blank lines and lines starting with '#' are
+ * skipped. */
+static void
+read_rules (const char *filename)
+{
+	FILE *fp;
+	char line[MAX_INPUT_BUFFER];
+	char *rargv[MAX_RULE_ARGS + 1];
+	char *p, *q, *name, *opts, quote;
+	procs_rule **tail = &rules;
+	int rargc, lineno = 0;
+
+	if (strcmp (filename, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen (filename, "r")) == NULL)
+		die (STATE_UNKNOWN, _("PROCS UNKNOWN - Cannot open rules file %s: %s\n"), filename, strerror (errno));
+
+	rule_reset ();
+	while (fgets (line, sizeof (line), fp) != NULL) {
+		lineno++;
+		strip (line);
+		p = line + strspn (line, " \t");
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		/* the options point into the line, so it has to stay */
+		name = strdup (p);
+		if ((opts = strchr (name, ':')) == NULL)
+			die (STATE_UNKNOWN, _("PROCS UNKNOWN - %s line %d: expected 'NAME: OPTIONS'\n"), filename, lineno);
+		*opts++ = '\0';
+		strip (name);
+		if (*name == '\0' || strchr (name, ';'))
+			die (STATE_UNKNOWN, _("PROCS UNKNOWN - %s line %d: invalid rule name\n"), filename, lineno);
+
+		rargv[0] = (char *) progname;
+		for (rargc = 1; ; rargc++) {
+			p = opts + strspn (opts, " \t");
+			if (*p == '\0')
+				break;
+			if (rargc == MAX_RULE_ARGS)
+				die (STATE_UNKNOWN, _("PROCS UNKNOWN - %s line %d: too many arguments\n"), filename, lineno);
+			/* unquote in place, the argument never gets longer */
+			rargv[rargc] = q = p;
+			for (quote = '\0'; *p != '\0'; p++) {
+				if (quote) {
+					if (*p == quote)
+						quote = '\0';
+					else
+						*q++ = *p;
+				} else if (*p == '\'' || *p == '"') {
+					quote = *p;
+				} else if (*p == ' ' || *p == '\t') {
+					p++;
+					break;
+				} else {
+					*q++ = *p;
+				}
+			}
+			if (quote)
+				die (STATE_UNKNOWN, _("PROCS UNKNOWN - %s line %d: unterminated quote\n"), filename, lineno);
+			*q = '\0';
+			opts = p;
+		}
+		rargv[rargc] = NULL;
+
+		rule_name = name;
+		optind = 0;
+		if (process_arguments (rargc, rargv) == ERROR)
+			die (STATE_UNKNOWN, _("PROCS UNKNOWN - %s line %d: could not parse arguments\n"), filename, lineno);
+		*tail = rule_save (name);
+		tail = &(*tail)->next;
+	}
+	rule_name = NULL;
+
+	if (fp != stdin)
+		fclose (fp);
+	if (rules == NULL)
+		die (STATE_UNKNOWN, _("PROCS UNKNOWN - No rules found in %s\n"), filename);
+}
+
+static int
+rule_status (const procs_rule *r)
+{
+	int result = r->result;
+
+	if ( result == STATE_UNKNOWN ) 
+		result = STATE_OK;
+
+	/* Needed if procs found, but none match filter */
+	if ( r->metric == METRIC_PROCS ) {
+		result = max_state (result, get_status ((double)r->procs, r->procs_thresholds) );
+	}
+	return result;
+}
+
+/* the status line of a rule, without the newline */
+static void
+print_rule (const procs_rule *r, int result, int with_perfdata)
+{
+	if ( result == STATE_OK ) {
+		printf ("%s %s: ", r->metric_name, _("OK"));
+	} else if (result == STATE_WARNING) {
+		printf ("%s %s: ", r->metric_name, _("WARNING"));
+		if ( r->metric != METRIC_PROCS ) {
+			printf (_("%d warn out of "), r->warn);
+		}
+	} else if (result == STATE_CRITICAL) {
+		printf ("%s %s: ", r->metric_name, _("CRITICAL"));
+		if (r->metric != METRIC_PROCS) {
+			printf (_("%d crit, %d warn out of "), r->crit, r->warn);
+		}
+	} 
+	printf (ngettext ("%d process", "%d processes", (unsigned long) r->procs), r->procs);
+	
+	if (strcmp(r->fmt,"") != 0) {
+		printf (_(" with %s"), r->fmt);
+	}
+
+	if ( verbose >= 1 && strcmp(r->fails,"") )
+		printf (" [%s]", r->fails);
+
+	if (!with_perfdata)
+		return;
+
+	if (r->metric == METRIC_PROCS)
+		printf (" | procs=%d;%s;%s;0;", r->procs,
+				r->warning_range ? r->warning_range : "",
+				r->critical_range ? r->critical_range : "");
+	else
+		printf (" | procs=%d;;;0; procs_warn=%d;;;0; procs_crit=%d;;;0;", r->procs, r->warn, r->crit);
+}
+
+/* all rules of --rules: a summary with the perfdata of every rule and a
+ * line per rule, or with --passive an external command per rule */
+static int
+print_rules (void)
+{
+	procs_rule *r;
+	char host[256];
+	int result = STATE_OK, state, count = 0;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+
+	if (passive) {
+		if (passive_host == NULL) {
+			if (gethostname (host, sizeof (host)) != 0)
+				die (STATE_UNKNOWN, _("PROCS UNKNOWN - Cannot get host name: %s\n"), strerror (errno));
+			host[sizeof (host) - 1] = '\0';
+			passive_host = host;
+		}
+		for (r = rules; r != NULL; r = r->next) {
+			state = rule_status (r);
+			result = max_state (result, state);
+			printf ("[%lu] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;", (unsigned long) time (NULL),
+			        passive_host, r->name, state);
+			print_rule (r, state, TRUE);
+			printf ("\n");
+		}
+		return result;
+	}
+
+	for (r = rules; r != NULL; r = r->next) {
+		state = rule_status (r);
+		result = max_state (result, state);
+		if (state >= STATE_OK && state <= STATE_DEPENDENT)
+			states[state]++;
+		count++;
+	}
+
+	printf (_("PROCS %s - %d rules: %d ok, %d warning, %d critical, %d unknown"),
+	        state_text (result), count, states[STATE_OK], states[STATE_WARNING],
+	        states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+	printf (" |");
+	for (r = rules; r != NULL; r = r->next)
+		printf (strpbrk (r->name, "'= ") ? " '%s'=%d;%s;%s;0;" : " %s=%d;%s;%s;0;", r->name, r->procs,
+		        r->metric == METRIC_PROCS && r->warning_range ? r->warning_range : "",
+		        r->metric == METRIC_PROCS && r->critical_range ? r->critical_range : "");
+#ifdef USE_PROC_SCAN
+	if (cgroup_path != NULL)
+		print_cgroup_perfdata ();
+#endif
+	printf ("\n");
+
+	for (r = rules; r != NULL; r = r->next) {
+		state = rule_status (r);
+		printf ("%s %s: ", state_text (state), r->name);
+		print_rule (r, state, FALSE);
+		printf ("\n");
+	}
+	return result;
+}
 
 int
 main (int argc, char **argv)
 {
-	char *input_buffer;
 	char *input_line;
 	char *procprog;
 
@@ -139,27 +1562,29 @@ main (int argc, char **argv)
 	char procetime[MAX_INPUT_BUFFER] = { '\0' };
 	char *procargs;
 
-	const char *zombie = "Z";
-
-	int resultsum = 0; /* bitmask of the filter criteria met by a process */
 	int found = 0; /* counter for number of lines returned in `ps` output */
-	int procs = 0; /* counter for number of processes meeting filter criteria */
-	int pos; /* number of spaces before 'args' in `ps` output */
-	int cols; /* number of columns in ps output */
-	int expected_cols = PS_COLS - 1;
-	int warn = 0; /* number of processes in warn state */
-	int crit = 0; /* number of processes in crit state */
 	int i = 0, j = 0;
 	int result = STATE_UNKNOWN;
 	int ret = 0;
-	output chld_out, chld_err;
+	int match;
+	int self; /* whether the process is ourself, -1 until looked at */
+	procs_rule *r;
+	unsigned long opened_stat = 0, opened_status = 0, opened_cmdline = 0, opened_io = 0;
+	np_proc_table table;
+	np_proc *proc;
+	int want_io = 0;
+	int selected = 0; /* whether no processes at all is an answer */
+	int tree_wanted = 0; /* whether a rule has --tree */
+	double value;
+#ifdef USE_PROC_SCAN
+	proc_scan *scan = NULL;
+	int have_rates; /* whether procpcpu and procio are since the last run yet */
+	double rate_cpu = 0, procio = 0;
+#endif
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 	setlocale(LC_NUMERIC, "POSIX");
 
-	input_buffer = malloc (MAX_INPUT_BUFFER);
 	procprog = malloc (MAX_INPUT_BUFFER);
 
 	xasprintf (&metric_name, "PROCS");
@@ -168,9 +1593,31 @@ main (int argc, char **argv)
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
 
+	np_init ((char *) progname, argc, argv);
+
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (rules_filename) {
+		if (options != ALL || warning_range || critical_range || metric != METRIC_PROCS || kthread_filter || tree)
+			usage4 (_("Filters and thresholds go into the rules file with --rules"));
+		read_rules (rules_filename);
+	} else {
+		if (passive)
+			usage4 (_("--passive needs --rules"));
+		rules = rule_save (NULL);
+	}
+
+	/* I/O has no lifetime average in ps, it always needs the state */
+	for (r = rules; r != NULL; r = r->next) {
+		if (r->metric == METRIC_IO)
+			want_io = use_rates = 1;
+		if (r->tree)
+			tree_wanted = 1;
+	}
+	if (tree_wanted && pidfile != NULL)
+		usage4 (_("--tree needs all processes, not only the one of --pidfile"));
+
 	/* find ourself */
 	mypid = getpid();
 	myppid = getppid();
@@ -189,187 +1636,320 @@ main (int argc, char **argv)
 	}
 	(void) alarm ((unsigned) timeout_interval);
 
-	if (verbose >= 2)
-		printf (_("CMD: %s\n"), PS_COMMAND);
-
+#ifdef USE_PROC_SCAN
+	if (cgroup_path || unit_name) {
+		cgroup_open ();
+		if (verbose >= 2)
+			printf (_("cgroup %s: %lu processes\n"), cgroup_path, (unsigned long) cgroup_count);
+	}
+	if (input_filename == NULL && pidfile == NULL && !use_ps)
+		scan = proc_scan_open (verbose >= 2);
+	if (scan != NULL) {
+		if (verbose >= 2)
+			printf (_("CMD: %s\n"), "/proc");
+		if (cgroup_path != NULL) {
+			/* an empty cgroup must not read all of /proc either */
+			scan->pids = cgroup_pids ? cgroup_pids : &mypid;
+			scan->npids = cgroup_count;
+			selected = 1;
+		}
+#ifdef HAVE_LIBPTHREAD
+		/* read ahead what most processes will be asked for anyway: what
+		 * a rule without a cheaper filter in front of it needs */
+		for (r = rules; r != NULL; r = r->next) {
+			if (r->options & (PROG | PPID | VSZ | RSS | PCPU))
+				continue;
+			if (r->options & (USER | STAT))
+				scan->read_status = 1;
+			else if (r->options & (ARGS | EREG_ARGS))
+				scan->read_args = 1;
+		}
+		if (scan->eager)
+			scan->read_status = scan->read_args = 1;
+		i = proc_scan_threads (scan, scan_threads);
+		if (verbose >= 2 && i > 1)
+			printf (_("/proc read with %d threads\n"), i);
+#endif
+		if (use_rates) {
+			scan->want_io = want_io;
+			proc_usage_load ();
+		}
+	} else
+#endif
+	if (use_rates) {
+		usage4 (_("--rates and --metric=IO need /proc, not the output of ps"));
+	} else
+	if (pidfile != NULL) {
+		i = np_ps_pidfile (&table, pidfile);
+		if (verbose >= 2)
+			printf (_("pid file %s: %s\n"), pidfile, np_ps_pidfile_text (i));
+		result = STATE_OK;
+		selected = 1;
+	} else
 	if (input_filename == NULL) {
-		result = cmd_run( PS_COMMAND, &chld_out, &chld_err, 0);
-		if (chld_err.lines > 0) {
-			printf ("%s: %s", _("System call sent warnings to stderr"), chld_err.line[0]);
+#ifdef PS_RECORD_COMMAND
+		if (verbose >= 2)
+			printf (_("CMD: %s\n"), PS_RECORD_COMMAND);
+#else
+		if (verbose >= 2)
+			printf (_("CMD: %s\n"), PS_COMMAND);
+#endif
+		/* records where there are any, nothing here needs the lines */
+		result = np_ps_run_records (&table, ps_cache_ttl);
+#ifdef PS_RECORD_COMMAND
+		if (verbose >= 2 && table.cached)
+			printf (_("CMD: %s.rec\n"), np_ps_cache_file ());
+#else
+		if (verbose >= 2 && table.cached)
+			printf (_("CMD: %s\n"), np_ps_cache_file ());
+#endif
+		if (table.err.buflen > 0) {
+			printf ("%s: %s", _("System call sent warnings to stderr"),
+			        table.err.lines > 0 ? table.err.line[0] : table.err.buf);
 			exit(STATE_WARNING);
 		}
 	} else {
-		result = cmd_file_read( input_filename, &chld_out, 0);
+		result = np_ps_read_file (&table, input_filename);
 	}
 
+	for (r = rules; r != NULL; r = r->next)
+		r->result = result;
+
 	/* flush first line: j starts at 1 */
-	for (j = 1; j < chld_out.lines; j++) {
-		input_line = chld_out.line[j];
+	for (j = 1; ; j++) {
+#ifdef USE_PROC_SCAN
+		if (scan != NULL) {
+			if (!proc_scan_next (scan, procstat, &procuid, &procpid, &procppid,
+			                     &procvsz, &procrss, &procpcpu, &procseconds,
+			                     procetime, procprog, &procargs))
+				break;
+		} else
+#endif
+		{
+			if ((size_t) j > table.count)
+				break;
+			proc = &table.procs[j - 1];
+			input_line = proc->line;
 
-		if (verbose >= 3)
-			printf ("%s", input_line);
+			if (verbose >= 3)
+				printf ("%s\n", input_line);
 
-		strcpy (procprog, "");
-		xasprintf (&procargs, "%s", "");
+			/* This should not happen */
+			if (!proc->parsed) {
+				if (verbose)
+					printf(_("Not parseable: %s\n"), input_line);
+				continue;
+			}
 
-		cols = sscanf (input_line, PS_FORMAT, PS_VARLIST);
+			strcpy (procstat, proc->stat);
+			procuid = proc->uid;
+			procpid = proc->pid;
+			procppid = proc->ppid;
+			procvsz = proc->vsz;
+			procrss = proc->rss;
+			procpcpu = proc->pcpu;
+			snprintf (procetime, MAX_INPUT_BUFFER, "%s", proc->etime);
+			snprintf (procprog, MAX_INPUT_BUFFER, "%s", proc->prog);
+			procargs = proc->args;
 
-		/* Zombie processes do not give a procprog command */
-		if ( cols < expected_cols && strstr(procstat, zombie) ) {
-			cols = expected_cols;
+			/* we need to convert the elapsed time to seconds */
+			procseconds = convert_to_seconds(procetime);
 		}
-		if ( cols >= expected_cols ) {
-			resultsum = 0;
-			xasprintf (&procargs, "%s", input_line + pos);
-			strip (procargs);
 
-			/* Some ps return full pathname for command. This removes path */
-			strcpy(procprog, base_name(procprog));
+		/* Some ps return full pathname for command. This removes path */
+		strcpy(procprog, base_name(procprog));
 
-			/* we need to convert the elapsed time to seconds */
-			procseconds = convert_to_seconds(procetime);
+		if (verbose >= 3)
+			printf ("proc#=%d uid=%d vsz=%d rss=%d pid=%d ppid=%d pcpu=%.2f stat=%s etime=%s prog=%s args=%s\n", 
+				found, procuid, procvsz, procrss,
+				procpid, procppid, procpcpu, procstat, 
+				procetime, procprog, procargs);
 
+		/* Ignore parent*/
+		if (myppid == procpid) {
 			if (verbose >= 3)
-				printf ("proc#=%d uid=%d vsz=%d rss=%d pid=%d ppid=%d pcpu=%.2f stat=%s etime=%s prog=%s args=%s\n", 
-					procs, procuid, procvsz, procrss,
-					procpid, procppid, procpcpu, procstat, 
-					procetime, procprog, procargs);
+				 printf("not considering - is parent\n");
+			continue;
+		}
 
-			/* Ignore self */
-			if ((usepid && mypid == procpid) ||
-				(!usepid && ((ret = stat_exe(procpid, &statbuf) != -1) && statbuf.st_dev == mydev && statbuf.st_ino == myino) ||
-				 (ret == -1 && errno == ENOENT))) {
-				if (verbose >= 3)
-					 printf("not considering - is myself or gone\n");
-				continue;
-			}
-			/* Ignore parent*/
-			else if (myppid == procpid) {
-				if (verbose >= 3)
-					 printf("not considering - is parent\n");
-				continue;
+		/* get pid KTHREAD_PARENT */
+		if (kthread_ppid == 0 && !strcmp(procprog, KTHREAD_PARENT) )
+			kthread_ppid = procpid;
+
+		found++;
+		self = -1;
+#ifdef USE_PROC_SCAN
+		/* the output of ps has all processes */
+		if (cgroup_path != NULL && scan == NULL && !cgroup_has (procpid))
+			continue;
+		have_rates = 0;
+#endif
+
+		/* any process may be in the tree of one a rule matches */
+		if (tree_wanted && procpid != mypid) {
+#ifdef USE_PROC_SCAN
+			if (use_rates) {
+				proc_scan_rates (scan, &rate_cpu, &procio);
+				have_rates = 1;
 			}
+			tree_add (procpid, procppid, procvsz, procrss, use_rates ? rate_cpu : procpcpu,
+			          use_rates ? procio : 0, procseconds);
+#else
+			tree_add (procpid, procppid, procvsz, procrss, procpcpu, 0, procseconds);
+#endif
+		}
 
+		for (r = rules; r != NULL; r = r->next) {
 			/* filter kernel threads (childs of KTHREAD_PARENT)*/
 			/* TODO adapt for other OSes than GNU/Linux
 					sorry for not doing that, but I've no other OSes to test :-( */
-			if (kthread_filter == 1) {
-				/* get pid KTHREAD_PARENT */
-				if (kthread_ppid == 0 && !strcmp(procprog, KTHREAD_PARENT) )
-					kthread_ppid = procpid;
-
-				if (kthread_ppid == procppid) {
-					if (verbose >= 2)
-						printf ("Ignore kernel thread: pid=%d ppid=%d prog=%s args=%s\n", procpid, procppid, procprog, procargs);
-					continue;
-				}
+			if (r->kthread_filter == 1 && kthread_ppid == procppid) {
+				if (verbose >= 2)
+					printf ("Ignore kernel thread: pid=%d ppid=%d prog=%s args=%s\n", procpid, procppid, procprog, procargs);
+				continue;
 			}
 
-			if ((options & STAT) && (strstr (statopts, procstat)))
-				resultsum |= STAT;
-			if ((options & ARGS) && procargs && (strstr (procargs, args) != NULL))
-				resultsum |= ARGS;
-			if ((options & EREG_ARGS) && procargs && (regexec(&re_args, procargs, (size_t) 0, NULL, 0) == 0))
-				resultsum |= EREG_ARGS;
-			if ((options & PROG) && procprog && (strcmp (prog, procprog) == 0))
-				resultsum |= PROG;
-			if ((options & PPID) && (procppid == ppid))
-				resultsum |= PPID;
-			if ((options & USER) && (procuid == uid))
-				resultsum |= USER;
-			if ((options & VSZ)  && (procvsz >= vsz))
-				resultsum |= VSZ;
-			if ((options & RSS)  && (procrss >= rss))
-				resultsum |= RSS;
-			if ((options & PCPU)  && (procpcpu >= pcpu))
-				resultsum |= PCPU;
-
-			found++;
-
-			/* Next line if filters not matched */
-			if (!(options == resultsum || options == ALL))
+			/* All filters have to match, so test the cheapest first and stop at
+			 * the first one that fails: with /proc, uid and state flags cost a
+			 * read of status and args one of cmdline */
+			match = 1;
+			if (r->options & PROG)
+				match = (strcmp (r->prog, procprog) == 0);
+			if (match && (r->options & PPID))
+				match = (procppid == r->ppid);
+			if (match && (r->options & PID))
+				match = (procpid == r->pid);
+			if (match && (r->options & VSZ))
+				match = (procvsz >= r->vsz);
+			if (match && (r->options & RSS))
+				match = (procrss >= r->rss);
+			if (match && (r->options & PCPU))
+				match = (procpcpu >= r->pcpu);
+			/* the state letter has to be among the flags whatever status says */
+			if (match && (r->options & STAT))
+				match = (strchr (r->statopts, procstat[0]) != NULL);
+#ifdef USE_PROC_SCAN
+			if (match && scan != NULL && (r->options & (USER | STAT)))
+				proc_scan_status (scan, &procuid, procstat);
+#endif
+			if (match && (r->options & USER))
+				match = (procuid == r->uid);
+			if (match && (r->options & STAT))
+				match = (strstr (r->statopts, procstat) != NULL);
+#ifdef USE_PROC_SCAN
+			if (match && scan != NULL && (r->options & (ARGS | EREG_ARGS)))
+				procargs = proc_scan_args (scan);
+#endif
+			if (match && (r->options & ARGS))
+				match = (strstr (procargs, r->args) != NULL);
+			if (match && (r->options & EREG_ARGS))
+				match = (np_regexec (&r->re_args, procargs, (size_t) 0, NULL, 0) == 0);
+
+			/* Next rule if filters not matched */
+			if (!match)
 				continue;
 
-			procs++;
+			/* Ignore self; stat_exe() is only paid for processes that matched */
+			if (self == -1)
+				self = ((usepid && mypid == procpid) ||
+				        (!usepid && ((ret = stat_exe(procpid, &statbuf) != -1) && statbuf.st_dev == mydev && statbuf.st_ino == myino) ||
+				         (ret == -1 && errno == ENOENT)));
+			if (self) {
+				if (verbose >= 3)
+					 printf("not considering - is myself or gone\n");
+				break;
+			}
+
+			/* it is the root of a tree, judged after the scan */
+			if (r->tree) {
+				tree_root_add (r, procpid, procprog);
+				continue;
+			}
+
+			r->procs++;
 			if (verbose >= 2) {
+				if (r->name)
+					printf ("%s: ", r->name);
 				printf ("Matched: uid=%d vsz=%d rss=%d pid=%d ppid=%d pcpu=%.2f stat=%s etime=%s prog=%s args=%s\n", 
 					procuid, procvsz, procrss,
 					procpid, procppid, procpcpu, procstat, 
 					procetime, procprog, procargs);
 			}
 
-			if (metric == METRIC_VSZ)
-				i = get_status ((double)procvsz, procs_thresholds);
-			else if (metric == METRIC_RSS)
-				i = get_status ((double)procrss, procs_thresholds);
-			/* TODO? float thresholds for --metric=CPU */
-			else if (metric == METRIC_CPU)
-				i = get_status (procpcpu, procs_thresholds);
-			else if (metric == METRIC_ELAPSED)
-				i = get_status ((double)procseconds, procs_thresholds);
-
-			if (metric != METRIC_PROCS) {
-				if (i == STATE_WARNING) {
-					warn++;
-					xasprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), procprog);
-					result = max_state (result, i);
-				}
-				if (i == STATE_CRITICAL) {
-					crit++;
-					xasprintf (&fails, "%s%s%s", fails, (strcmp(fails,"") ? ", " : ""), procprog);
-					result = max_state (result, i);
-				}
+#ifdef USE_PROC_SCAN
+			/* once for every process a rule needs them for */
+			if (use_rates && !have_rates && (r->metric == METRIC_CPU || r->metric == METRIC_IO)) {
+				proc_scan_rates (scan, &rate_cpu, &procio);
+				have_rates = 1;
+				if (verbose >= 3)
+					printf ("rates: pid=%d cpu=%.2f%% io=%.1fkB/s\n", procpid, rate_cpu, procio);
 			}
-		} 
-		/* This should not happen */
-		else if (verbose) {
-			printf(_("Not parseable: %s"), input_buffer);
+#endif
+
+			value = 0;
+			if (r->metric == METRIC_VSZ)
+				value = procvsz;
+			else if (r->metric == METRIC_RSS)
+				value = procrss;
+			/* TODO? float thresholds for --metric=CPU */
+			else if (r->metric == METRIC_CPU)
+#ifdef USE_PROC_SCAN
+				value = use_rates ? rate_cpu : procpcpu;
+#else
+				value = procpcpu;
+#endif
+			else if (r->metric == METRIC_ELAPSED)
+				value = procseconds;
+#ifdef USE_PROC_SCAN
+			else if (r->metric == METRIC_IO)
+				value = procio;
+#endif
+			rule_judge (r, value, procprog);
 		}
 	}
 
-	if (found == 0) {							/* no process lines parsed so return STATE_UNKNOWN */
-		printf (_("Unable to read output\n"));
-		return STATE_UNKNOWN;
+	/* the trees below what the rules matched, now that all processes are known */
+	if (tree_wanted) {
+		tree_index ();
+		for (r = rules; r != NULL; r = r->next)
+			if (r->tree)
+				tree_judge (r);
 	}
 
-	if ( result == STATE_UNKNOWN ) 
-		result = STATE_OK;
-
-	/* Needed if procs found, but none match filter */
-	if ( metric == METRIC_PROCS ) {
-		result = max_state (result, get_status ((double)procs, procs_thresholds) );
+#ifdef USE_PROC_SCAN
+	if (scan != NULL) {
+		opened_stat = scan->opened_stat;
+		opened_status = scan->opened_status;
+		opened_cmdline = scan->opened_cmdline;
+		opened_io = scan->opened_io;
+		proc_scan_close (scan);
+		if (use_rates)
+			proc_usage_save ();
 	}
+#endif
 
-	if ( result == STATE_OK ) {
-		printf ("%s %s: ", metric_name, _("OK"));
-	} else if (result == STATE_WARNING) {
-		printf ("%s %s: ", metric_name, _("WARNING"));
-		if ( metric != METRIC_PROCS ) {
-			printf (_("%d warn out of "), warn);
-		}
-	} else if (result == STATE_CRITICAL) {
-		printf ("%s %s: ", metric_name, _("CRITICAL"));
-		if (metric != METRIC_PROCS) {
-			printf (_("%d crit, %d warn out of "), crit, warn);
-		}
-	} 
-	printf (ngettext ("%d process", "%d processes", (unsigned long) procs), procs);
-	
-	if (strcmp(fmt,"") != 0) {
-		printf (_(" with %s"), fmt);
+	if (found == 0 && !selected) {			/* no process lines parsed so return STATE_UNKNOWN */
+		printf (_("Unable to read output\n"));
+		return STATE_UNKNOWN;
 	}
 
-	if ( verbose >= 1 && strcmp(fails,"") )
-		printf (" [%s]", fails);
+	if (rules_filename) {
+		result = print_rules ();
+	} else {
+		result = rule_status (rules);
+		print_rule (rules, result, TRUE);
+#ifdef USE_PROC_SCAN
+		if (cgroup_path != NULL)
+			print_cgroup_perfdata ();
+#endif
+		printf ("\n");
+	}
 
-	if (metric == METRIC_PROCS)
-		printf (" | procs=%d;%s;%s;0;", procs,
-				warning_range ? warning_range : "",
-				critical_range ? critical_range : "");
-	else
-		printf (" | procs=%d;;;0; procs_warn=%d;;;0; procs_crit=%d;;;0;", procs, warn, crit);
+	if (debug)
+		printf (_("%lu files opened for %d processes: %lu stat, %lu status, %lu cmdline, %lu io, %lu exe\n"),
+		        opened_stat + opened_status + opened_cmdline + opened_io + opened_exe, found,
+		        opened_stat, opened_status, opened_cmdline, opened_io, opened_exe);
 
-	printf ("\n");
 	return result;
 }
 
@@ -409,6 +1989,18 @@ process_arguments (int argc, char **argv)
 		{"input-file", required_argument, 0, CHAR_MAX+2},
 		{"no-kthreads", required_argument, 0, 'k'},
 		{"traditional-filter", no_argument, 0, 'T'},
+		{"use-ps", no_argument, 0, CHAR_MAX+3},
+		{"debug", no_argument, 0, CHAR_MAX+4},
+		{"rules", required_argument, 0, CHAR_MAX+5},
+		{"passive", optional_argument, 0, CHAR_MAX+6},
+		{"ps-cache", required_argument, 0, CHAR_MAX+7},
+		{"rates", no_argument, 0, CHAR_MAX+8},
+		{"cgroup", required_argument, 0, CHAR_MAX+9},
+		{"unit", required_argument, 0, CHAR_MAX+10},
+		{"threads", required_argument, 0, CHAR_MAX+11},
+		{"pidfile", required_argument, 0, CHAR_MAX+12},
+		{"pid", required_argument, 0, RULE_OPTION},
+		{"tree", no_argument, 0, RULE_OPTION+1},
 		{0, 0, 0, 0}
 	};
 
@@ -423,6 +2015,12 @@ process_arguments (int argc, char **argv)
 		if (c == -1 || c == EOF)
 			break;
 
+		/* a rule only has filters and thresholds, the rest is for the whole run */
+		if (rule_name && (c == 'h' || c == 'V' || c == 't' || c == 'v' || c == 'T' ||
+		                  (c > CHAR_MAX+1 && c < RULE_OPTION)))
+			die (STATE_UNKNOWN, _("PROCS UNKNOWN - Rule %s: only filters and thresholds can be given in a rule\n"),
+			     rule_name);
+
 		switch (c) {
 		case '?':									/* help */
 			usage5 ();
@@ -451,6 +2049,16 @@ process_arguments (int argc, char **argv)
 				break;
 			}
 			usage4 (_("Parent Process ID must be an integer!"));
+		case RULE_OPTION:							/* process id */
+			if (sscanf (optarg, "%d%[^0-9]", &filter_pid, tmp) == 1) {
+				xasprintf (&fmt, "%s%sPID = %d", (fmt ? fmt : "") , (options ? ", " : ""), filter_pid);
+				options |= PID;
+				break;
+			}
+			usage4 (_("Process ID must be an integer!"));
+		case RULE_OPTION+1:							/* whole trees */
+			tree = 1;
+			break;
 		case 's':									/* status */
 			if (statopts)
 				break;
@@ -500,9 +2108,9 @@ process_arguments (int argc, char **argv)
 			options |= ARGS;
 			break;
 		case CHAR_MAX+1:
-			err = regcomp(&re_args, optarg, cflags);
+			err = np_regcomp (&re_args, optarg, cflags);
 			if (err != 0) {
-				regerror (err, &re_args, errbuf, MAX_INPUT_BUFFER);
+				np_regerror (err, &re_args, errbuf, MAX_INPUT_BUFFER);
 				die (STATE_UNKNOWN, "PROCS %s: %s - %s\n", _("UNKNOWN"), _("Could not compile regular expression"), errbuf);
 			}
 			/* Strip off any | within the regex optarg */
@@ -559,8 +2167,12 @@ process_arguments (int argc, char **argv)
 				metric = METRIC_ELAPSED;
 				break;
 			}
+			else if ( strcmp(optarg, "IO") == 0) {
+				metric = METRIC_IO;
+				break;
+			}
 				
-			usage4 (_("Metric must be one of PROCS, VSZ, RSS, CPU, ELAPSED!"));
+			usage4 (_("Metric must be one of PROCS, VSZ, RSS, CPU, ELAPSED, IO!"));
 		case 'k':	/* linux kernel thread filter */
 			kthread_filter = 1;
 			break;
@@ -573,6 +2185,51 @@ process_arguments (int argc, char **argv)
 		case CHAR_MAX+2:
 			input_filename = optarg;
 			break;
+		case CHAR_MAX+3:
+			use_ps = 1;
+			break;
+		case CHAR_MAX+4:
+			debug = 1;
+			break;
+		case CHAR_MAX+5:
+			rules_filename = optarg;
+			break;
+		case CHAR_MAX+6:
+			passive = 1;
+			if (optarg)
+				passive_host = optarg;
+			break;
+		case CHAR_MAX+7:
+			if (!is_intnonneg (optarg))
+				usage2 (_("Process table cache time must be an integer (seconds)"), optarg);
+			ps_cache_ttl = atoi (optarg);
+			/* only the output of ps is shared */
+			if (ps_cache_ttl > 0)
+				use_ps = 1;
+			break;
+		case CHAR_MAX+8:
+			use_rates = 1;
+			break;
+#ifdef USE_PROC_SCAN
+		case CHAR_MAX+9:
+			cgroup_path = optarg;
+			break;
+		case CHAR_MAX+10:
+			unit_name = optarg;
+			break;
+#else
+		case CHAR_MAX+9:
+		case CHAR_MAX+10:
+			usage4 (_("--cgroup and --unit only work on Linux"));
+#endif
+		case CHAR_MAX+11:
+			if (!is_intnonneg (optarg))
+				usage2 (_("The number of threads must be a non-negative integer"), optarg);
+			scan_threads = atoi (optarg);
+			break;
+		case CHAR_MAX+12:
+			pidfile = optarg;
+			break;
 		}
 	}
 
@@ -613,6 +2270,9 @@ validate_arguments ()
 	if (fmt==NULL)
 		fmt = strdup("");
 
+	if (tree)
+		xasprintf (&fmt, "%s%s", fmt, fmt[0] ? _(" and their descendants") : _("descendants"));
+
 	if (fails==NULL)
 		fails = strdup("");
 
@@ -715,6 +2375,10 @@ print_help (void)
 #if defined( __linux__ )
 	printf ("  %s\n", _("ELAPSED - time elapsed in seconds"));
 #endif /* defined(__linux__) */
+#ifdef USE_PROC_SCAN
+	printf ("  %s\n", _("IO      - kB/s read from and written to storage since the last run,"));
+	printf ("  %s\n", _("          this implies --rates"));
+#endif
 	printf (UT_PLUG_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
 	printf (" %s\n", "-v, --verbose");
@@ -722,6 +2386,45 @@ print_help (void)
 
   printf (" %s\n", "-T, --traditional");
   printf ("   %s\n", _("Filter own process the traditional way by PID instead of /proc/pid/exe"));
+#ifdef USE_PROC_SCAN
+  printf (" %s\n", "--use-ps");
+  printf ("   %s\n", _("Parse the output of `ps` instead of reading /proc directly"));
+#endif
+  printf (UT_PS_CACHE);
+#ifdef USE_PROC_SCAN
+  printf ("   %s\n", _("This implies --use-ps"));
+#endif
+#ifdef USE_PROC_SCAN
+  printf (" %s\n", "--rates");
+  printf ("   %s\n", _("Keep what the processes used in the state and check --metric=CPU against"));
+  printf ("   %s\n", _("the CPU usage since the last run instead of over the lifetime of a process."));
+  printf ("   %s\n", _("A process the last run did not see gets its lifetime average"));
+#endif
+#ifdef USE_PROC_SCAN
+  printf (" %s\n", "--cgroup=PATH");
+  printf ("   %s\n", _("Only look at the processes of this cgroup and the cgroups below it, as"));
+  printf ("   %s\n", _("/proc/PID/cgroup shows it or below /sys/fs/cgroup, read from cgroup.procs"));
+  printf ("   %s\n", _("instead of all of /proc. Adds the memory and pids the cgroup accounts for to"));
+  printf ("   %s\n", _("the perfdata"));
+  printf (" %s\n", "--unit=NAME");
+  printf ("   %s\n", _("The same for the cgroup of a systemd unit, a service if NAME has no suffix"));
+#endif
+  printf (" %s\n", "--pidfile=PATH");
+  printf ("   %s\n", _("Only look at the process whose pid is in PATH, not at all of them. It does"));
+  printf ("   %s\n", _("not count if it started after PATH was written, as the pid was reused then"));
+#if defined(USE_PROC_SCAN) && defined(HAVE_LIBPTHREAD)
+  printf (" %s\n", "--threads=N");
+  printf ("   %s\n", _("Read /proc with up to N threads, each taking a share of the processes;"));
+  printf ("   %s\n", _("0 for one per CPU (default), 1 for none. Only for 1024 processes or more"));
+#endif
+  printf (" %s\n", "--debug");
+  printf ("   %s\n", _("Print how many files were opened to check the processes"));
+  printf (" %s\n", "--rules=FILE");
+  printf ("   %s\n", _("Check every rule in FILE in a single pass over the processes. A rule is a"));
+  printf ("   %s\n", _("line 'NAME: OPTIONS' with the filters and thresholds of one check"));
+  printf (" %s\n", "--passive[=HOST]");
+  printf ("   %s\n", _("With --rules, print a PROCESS_SERVICE_CHECK_RESULT command per rule, for"));
+  printf ("   %s\n", _("service NAME on HOST (default: this host's name)"));
 
   printf ("\n");
 	printf ("%s\n", "Filters:");
@@ -745,6 +2448,12 @@ print_help (void)
   printf ("   %s\n", _("Only scan for processes with args that contain the regex STRING."));
   printf (" %s\n", "-C, --command=COMMAND");
   printf ("   %s\n", _("Only scan for exact matches of COMMAND (without path)."));
+  printf (" %s\n", "--pid=PID");
+  printf ("   %s\n", _("Only scan for the process with this process ID."));
+  printf (" %s\n", "--tree");
+  printf ("   %s\n", _("Take the processes the filters match with all processes below them, and"));
+  printf ("   %s\n", _("check the sum of the metric over each such tree (the elapsed time of its"));
+  printf ("   %s\n", _("top). A process below another match is in that one's tree."));
   printf (" %s\n", "-k, --no-kthreads");
   printf ("   %s\n", _("Only scan for non kernel threads (works on Linux only)."));
 
@@ -775,7 +2484,23 @@ be the total number of running processes\n\n"));
   printf (" %s\n", "check_procs -w 50000 -c 100000 --metric=VSZ");
   printf ("  %s\n\n", _("Alert if VSZ of any processes over 50K or 100K"));
   printf (" %s\n", "check_procs -w 10 -c 20 --metric=CPU");
-  printf ("  %s\n", _("Alert if CPU of any processes over 10%% or 20%%"));
+  printf ("  %s\n\n", _("Alert if CPU of any processes over 10%% or 20%%"));
+#ifdef USE_PROC_SCAN
+  printf (" %s\n", "check_procs -w 5000 -c 20000 --metric=IO -C postgres");
+  printf ("  %s\n\n", _("Alert if any postgres process did more than 5000 or 20000 kB/s of I/O"));
+#endif
+  printf (" %s\n", "check_procs -w 1000000 -c 2000000 --metric=RSS -C apache2 --ppid=1 --tree");
+  printf ("  %s\n\n", _("Alert if the apache2 master and its children use more than 1 or 2 GB"));
+  printf (" %s\n", "check_procs -c 1:1 -C sshd --pidfile=/run/sshd.pid");
+  printf ("  %s\n\n", _("Critical unless the process in /run/sshd.pid is a running sshd"));
+#ifdef USE_PROC_SCAN
+  printf (" %s\n", "check_procs -c 1: --unit=nginx");
+  printf ("  %s\n\n", _("Critical if nginx.service has no process left, without reading all of /proc"));
+#endif
+  printf (" %s\n", "check_procs --rules=/etc/nagios/procs.rules");
+  printf ("  %s\n", _("Check all rules in procs.rules, which could have lines like"));
+  printf ("  %s\n", "sshd: -c 1: -C sshd");
+  printf ("  %s\n", "zombies: -w 5 -c 10 -s Z");
 
 	printf (UT_SUPPORT);
 }
@@ -786,5 +2511,7 @@ print_usage (void)
   printf ("%s\n", _("Usage:"));
 	printf ("%s -w <range> -c <range> [-m metric] [-s state] [-p ppid]\n", progname);
   printf (" [-u user] [-r rss] [-z vsz] [-P %%cpu] [-a argument-array]\n");
-  printf (" [-C command] [-k] [-t timeout] [-v]\n");
+  printf (" [-C command] [--pid=pid] [--tree] [-k] [--rates] [--cgroup=path|--unit=name]\n");
+  printf (" [--threads=n] [--pidfile=path] [-t timeout] [-v]\n");
+	printf ("%s --rules=file [--passive[=host]] [--cgroup=path|--unit=name] [-t timeout] [-v]\n", progname);
 }
@@ -35,6 +35,7 @@ const char *email = "devel@monitoring-plugins.org";
 #include "common.h"
 #include "utils.h"
 #include "netutils.h"
+#include <fcntl.h>
 
 #if defined(HAVE_LIBRADCLI)
 #include <radcli/radcli.h>
@@ -49,6 +50,7 @@ const char *email = "devel@monitoring-plugins.org";
 int process_arguments (int, char **);
 void print_help (void);
 void print_usage (void);
+int check_native (void);
 
 #if defined(HAVE_LIBFREERADIUS_CLIENT) || defined(HAVE_LIBRADIUSCLIENT_NG) || defined(HAVE_LIBRADCLI)
 #define my_rc_conf_str(a) rc_conf_str(rch,a)
@@ -80,11 +82,51 @@ void print_usage (void);
 
 int my_rc_read_config(char *);
 
+/* The built-in client (--native) sends the Access-Requests itself, to
+ * every server at the same time, without reading the dictionary */
+#define NATIVE_OPTION CHAR_MAX+1
+#define SECRET_OPTION CHAR_MAX+2
+#define QUORUM_OPTION CHAR_MAX+3
+
+#define RADIUS_MAX_PACKET 4096
+#define RADIUS_HEADER_LEN 20
+#define RADIUS_ACCESS_REQUEST 1
+#define RADIUS_ACCESS_ACCEPT 2
+#define RADIUS_ACCESS_REJECT 3
+#define RADIUS_ACCESS_CHALLENGE 11
+#define RADIUS_USER_NAME 1
+#define RADIUS_USER_PASSWORD 2
+#define RADIUS_NAS_IP_ADDRESS 4
+#define RADIUS_SERVICE_TYPE 6
+#define RADIUS_REPLY_MESSAGE 18
+#define RADIUS_NAS_IDENTIFIER 32
+#define RADIUS_AUTHENTICATE_ONLY 8
+
+typedef struct radius_server {
+	char *host;
+	char *secret;
+	int fd;
+	unsigned char request[RADIUS_MAX_PACKET];
+	size_t request_len;
+	int tries;
+	struct timeval started;	/* the first try */
+	struct timeval sent;	/* the last try */
+	double elapsed;
+	int done;
+	int result;
+	char *message;
+} radius_server;
+
 #if defined(HAVE_LIBFREERADIUS_CLIENT) || defined(HAVE_LIBRADIUSCLIENT_NG) || defined(HAVE_LIBRADCLI)
 rc_handle *rch = NULL;
 #endif
 
 char *server = NULL;
+radius_server *servers = NULL;
+size_t servers_count = 0;
+int native = FALSE;
+char *secret = NULL;
+int quorum = 0;
 char *username = NULL;
 char *password = NULL;
 char *nasid = NULL;
@@ -161,9 +203,7 @@ main (int argc, char **argv)
 	uint32_t client_id, service;
 	char *str;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -171,6 +211,9 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (native)
+		return check_native ();
+
 	str = strdup ("dictionary");
 	if ((config_file && my_rc_read_config (config_file)) ||
 			my_rc_read_dictionary (my_rc_conf_str (str)))
@@ -244,6 +287,9 @@ process_arguments (int argc, char **argv)
 		{"filename", required_argument, 0, 'F'},
 		{"expect", required_argument, 0, 'e'},
 		{"retries", required_argument, 0, 'r'},
+		{"native", no_argument, 0, NATIVE_OPTION},
+		{"secret", required_argument, 0, SECRET_OPTION},
+		{"quorum", required_argument, 0, QUORUM_OPTION},
 		{"timeout", required_argument, 0, 't'},
 		{"verbose", no_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
@@ -275,6 +321,13 @@ process_arguments (int argc, char **argv)
 				usage2 (_("Invalid hostname/address"), optarg);
 			}
 			server = optarg;
+			servers = realloc (servers, (servers_count + 1) * sizeof (radius_server));
+			if (servers == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			memset (&servers[servers_count], 0, sizeof (radius_server));
+			servers[servers_count].host = optarg;
+			servers[servers_count].fd = -1;
+			servers_count++;
 			break;
 		case 'P':									/* port */
 			if (is_intnonneg (optarg))
@@ -318,17 +371,41 @@ process_arguments (int argc, char **argv)
 			else
 				usage2 (_("Timeout interval must be a positive integer"), optarg);
 			break;
+		case NATIVE_OPTION:
+			native = TRUE;
+			break;
+		case SECRET_OPTION:
+			secret = strdup (optarg);
+			/* Delete the secret from process list */
+			while (*optarg != '\0') {
+				*optarg = 'X';
+				optarg++;
+			}
+			break;
+		case QUORUM_OPTION:
+			if (is_intpos (optarg))
+				quorum = atoi (optarg);
+			else
+				usage2 (_("Quorum must be a positive integer"), optarg);
+			break;
 		}
 	}
 
+	if (servers_count > 1 && !native)
+		usage4 (_("Several servers require --native"));
+	if ((secret != NULL || quorum > 0) && !native)
+		usage4 (_("--secret and --quorum require --native"));
+
 	if (server == NULL)
 		usage4 (_("Hostname was not supplied"));
 	if (username == NULL)
 		usage4 (_("User not specified"));
 	if (password == NULL)
 		usage4 (_("Password not specified"));
-	if (config_file == NULL)
+	if (config_file == NULL && secret == NULL)
 		usage4 (_("Configuration file not specified"));
+	if (quorum > (int) servers_count)
+		usage4 (_("Quorum is larger than the number of servers"));
 
 	return OK;
 }
@@ -371,6 +448,16 @@ print_help (void)
   printf ("    %s\n", _("Response string to expect from the server"));
   printf (" %s\n", "-r, --retries=INTEGER");
   printf ("    %s\n", _("Number of times to retry a failed connection"));
+  printf (" %s\n", "--native");
+  printf ("    %s\n", _("Send the requests with the built-in client instead of the radiusclient"));
+  printf ("    %s\n", _("library, which does not read the dictionary. -H can then be given several"));
+  printf ("    %s\n", _("times, all servers are queried at the same time and reported on separately"));
+  printf (" %s\n", "--secret=STRING");
+  printf ("    %s\n", _("Shared secret with the servers, for --native. By default it is looked up"));
+  printf ("    %s\n", _("in the servers file of the configuration file"));
+  printf (" %s\n", "--quorum=INTEGER");
+  printf ("    %s\n", _("With --native, stop waiting and retrying once that many servers accepted"));
+  printf ("    %s\n", _("the request, and return OK (default: wait for all servers)"));
 
 	printf (UT_CONN_TIMEOUT, timeout_interval);
 
@@ -397,6 +484,9 @@ print_usage (void)
 	printf ("%s -H host -F config_file -u username -p password\n\
 			[-P port] [-t timeout] [-r retries] [-e expect]\n\
 			[-n nas-id] [-N nas-ip-addr]\n", progname);
+	printf ("%s --native -H host [-H host...] [-F config_file|--secret secret]\n\
+			-u username -p password [--quorum count] [-P port] [-t timeout]\n\
+			[-r retries] [-e expect] [-n nas-id] [-N nas-ip-addr]\n", progname);
 }
 
 
@@ -410,3 +500,444 @@ int my_rc_read_config(char * a)
 	return rc_read_config(a);
 #endif
 }
+
+
+
+
+/*
+ * MD5 (RFC 1321), for the User-Password attribute and the authenticators
+ * of the built-in client
+ */
+typedef struct {
+	uint32_t state[4];
+	uint64_t length;
+	unsigned char buffer[64];
+} radius_md5_ctx;
+
+#define MD5_ROTATE(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+radius_md5_block (radius_md5_ctx *ctx, const unsigned char *block)
+{
+	static const uint32_t k[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+	static const int r[64] = {
+		7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+		5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+		4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+		6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+	};
+	uint32_t w[16], a, b, c, d, f, t;
+	int i, g;
+
+	for (i = 0; i < 16; i++)
+		w[i] = block[i * 4] | block[i * 4 + 1] << 8 | block[i * 4 + 2] << 16 | (uint32_t) block[i * 4 + 3] << 24;
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+	for (i = 0; i < 64; i++) {
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
+		}
+		t = d;
+		d = c;
+		c = b;
+		b = b + MD5_ROTATE (a + f + k[i] + w[g], r[i]);
+		a = t;
+	}
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+}
+
+static void
+radius_md5_init (radius_md5_ctx *ctx)
+{
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xefcdab89;
+	ctx->state[2] = 0x98badcfe;
+	ctx->state[3] = 0x10325476;
+	ctx->length = 0;
+}
+
+static void
+radius_md5_update (radius_md5_ctx *ctx, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t used = ctx->length % 64;
+
+	ctx->length += len;
+	while (len > 0) {
+		size_t n = 64 - used < len ? 64 - used : len;
+		memcpy (ctx->buffer + used, p, n);
+		used += n;
+		p += n;
+		len -= n;
+		if (used == 64) {
+			radius_md5_block (ctx, ctx->buffer);
+			used = 0;
+		}
+	}
+}
+
+static void
+radius_md5_final (radius_md5_ctx *ctx, unsigned char *digest)
+{
+	unsigned char pad[72];
+	uint64_t bits = ctx->length * 8;
+	size_t n = 64 - (ctx->length + 8) % 64;
+	int i;
+
+	memset (pad, 0, sizeof (pad));
+	pad[0] = 0x80;
+	for (i = 0; i < 8; i++)
+		pad[n + i] = bits >> (8 * i);
+	radius_md5_update (ctx, pad, n + 8);
+	for (i = 0; i < 16; i++)
+		digest[i] = ctx->state[i / 4] >> (8 * (i % 4));
+}
+
+
+
+/* Looks the secret of a server up in the servers file of the radiusclient
+ * configuration, "host[:port] secret" lines */
+static char *
+radius_find_secret (const char *host)
+{
+	char *servers_file, line[BUFFER_LEN], *name, *key, *colon;
+	FILE *fp;
+
+	static int config_read = FALSE;
+
+	if (secret != NULL)
+		return secret;
+	if (!config_read && my_rc_read_config (config_file))
+		die (STATE_UNKNOWN, _("Config file error\n"));
+	config_read = TRUE;
+	if ((servers_file = my_rc_conf_str ("servers")) == NULL ||
+	    (fp = fopen (servers_file, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot read the servers file\n"));
+	while (fgets (line, sizeof (line), fp) != NULL) {
+		if ((name = strtok (line, " \t\r\n")) == NULL || name[0] == '#')
+			continue;
+		if ((key = strtok (NULL, " \t\r\n")) == NULL)
+			continue;
+		if ((colon = strchr (name, ':')) != NULL)
+			*colon = '\0';
+		if (strcasecmp (name, host) == 0) {
+			fclose (fp);
+			return strdup (key);
+		}
+	}
+	fclose (fp);
+	return NULL;
+}
+
+static void
+radius_add_attribute (radius_server *srv, int type, const void *value, size_t len)
+{
+	if (len > 253 || srv->request_len + 2 + len > RADIUS_MAX_PACKET)
+		die (STATE_UNKNOWN, _("Attribute %d is too long\n"), type);
+	srv->request[srv->request_len++] = type;
+	srv->request[srv->request_len++] = 2 + len;
+	memcpy (srv->request + srv->request_len, value, len);
+	srv->request_len += len;
+}
+
+/* Builds the Access-Request once, retries send it again as it is */
+static void
+radius_build_request (radius_server *srv, uint32_t nas_ip)
+{
+	unsigned char hidden[128], digest[16];
+	radius_md5_ctx ctx;
+	uint32_t value;
+	size_t len, i, j;
+	int fd;
+
+	srv->request[0] = RADIUS_ACCESS_REQUEST;
+	srv->request_len = RADIUS_HEADER_LEN;
+	/* the Request Authenticator must be unpredictable */
+	if ((fd = open ("/dev/urandom", O_RDONLY)) < 0 ||
+	    read (fd, srv->request + 1, 17) != 17) {
+		for (i = 1; i < 18; i++)
+			srv->request[i] = random ();
+	}
+	if (fd >= 0)
+		close (fd);
+
+	value = htonl (RADIUS_AUTHENTICATE_ONLY);
+	radius_add_attribute (srv, RADIUS_SERVICE_TYPE, &value, 4);
+	radius_add_attribute (srv, RADIUS_USER_NAME, username, strlen (username));
+
+	/* User-Password, hidden as in RFC 2865 5.2 */
+	len = strlen (password);
+	if (len > sizeof (hidden))
+		die (STATE_UNKNOWN, _("Password is too long\n"));
+	memset (hidden, 0, sizeof (hidden));
+	memcpy (hidden, password, len);
+	len = len ? (len + 15) & ~(size_t) 15 : 16;
+	for (i = 0; i < len; i += 16) {
+		radius_md5_init (&ctx);
+		radius_md5_update (&ctx, srv->secret, strlen (srv->secret));
+		radius_md5_update (&ctx, i ? hidden + i - 16 : srv->request + 4, 16);
+		radius_md5_final (&ctx, digest);
+		for (j = 0; j < 16; j++)
+			hidden[i + j] ^= digest[j];
+	}
+	radius_add_attribute (srv, RADIUS_USER_PASSWORD, hidden, len);
+
+	if (nasid != NULL)
+		radius_add_attribute (srv, RADIUS_NAS_IDENTIFIER, nasid, strlen (nasid));
+	radius_add_attribute (srv, RADIUS_NAS_IP_ADDRESS, &nas_ip, 4);
+
+	srv->request[2] = srv->request_len >> 8;
+	srv->request[3] = srv->request_len & 0xff;
+}
+
+static int
+radius_open (radius_server *srv)
+{
+	struct addrinfo hints, *res, *r;
+	char port_str[6];
+	int result;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf (port_str, sizeof (port_str), "%d", port);
+	if ((result = getaddrinfo (srv->host, port_str, &hints, &res)) != 0) {
+		xasprintf (&srv->message, "%s", gai_strerror (result));
+		return STATE_UNKNOWN;
+	}
+	for (r = res; r != NULL; r = r->ai_next) {
+		if ((srv->fd = socket (r->ai_family, r->ai_socktype, r->ai_protocol)) < 0)
+			continue;
+		if (connect (srv->fd, r->ai_addr, r->ai_addrlen) == 0)
+			break;
+		close (srv->fd);
+		srv->fd = -1;
+	}
+	freeaddrinfo (res);
+	if (srv->fd < 0) {
+		xasprintf (&srv->message, _("Cannot connect: %s"), strerror (errno));
+		return STATE_CRITICAL;
+	}
+	fcntl (srv->fd, F_SETFL, O_NONBLOCK);
+	return STATE_OK;
+}
+
+static void
+radius_send (radius_server *srv)
+{
+	gettimeofday (&srv->sent, NULL);
+	if (srv->tries++ == 0)
+		srv->started = srv->sent;
+	if (verbose)
+		printf (_("Sending Access-Request to %s, try %d\n"), srv->host, srv->tries);
+	send (srv->fd, srv->request, srv->request_len, 0);
+}
+
+/* Checks the Response Authenticator and sets the result from the reply.
+ * Returns FALSE for packets that are not the answer */
+static int
+radius_reply (radius_server *srv, unsigned char *reply, size_t len)
+{
+	unsigned char digest[16];
+	radius_md5_ctx ctx;
+	char *text = NULL;
+	size_t i;
+
+	if (len < RADIUS_HEADER_LEN || reply[1] != srv->request[1] ||
+	    (size_t) (reply[2] << 8 | reply[3]) > len)
+		return FALSE;
+	len = reply[2] << 8 | reply[3];
+
+	srv->elapsed = (double) deltime (srv->started) / 1.0e6;
+	srv->done = TRUE;
+
+	radius_md5_init (&ctx);
+	radius_md5_update (&ctx, reply, 4);
+	radius_md5_update (&ctx, srv->request + 4, 16);
+	radius_md5_update (&ctx, reply + RADIUS_HEADER_LEN, len - RADIUS_HEADER_LEN);
+	radius_md5_update (&ctx, srv->secret, strlen (srv->secret));
+	radius_md5_final (&ctx, digest);
+	if (memcmp (digest, reply + 4, 16) != 0) {
+		srv->result = STATE_WARNING;
+		xasprintf (&srv->message, _("Bad Response"));
+		return TRUE;
+	}
+
+	for (i = RADIUS_HEADER_LEN; i + 2 <= len && reply[i + 1] >= 2 && i + reply[i + 1] <= len; i += reply[i + 1]) {
+		if (reply[i] == RADIUS_REPLY_MESSAGE)
+			xasprintf (&text, "%s%.*s", text ? text : "", reply[i + 1] - 2, reply + i + 2);
+	}
+
+	if (reply[0] == RADIUS_ACCESS_REJECT) {
+		srv->result = STATE_WARNING;
+		xasprintf (&srv->message, _("Auth Failed"));
+	} else if (reply[0] != RADIUS_ACCESS_ACCEPT && reply[0] != RADIUS_ACCESS_CHALLENGE) {
+		srv->result = STATE_UNKNOWN;
+		xasprintf (&srv->message, _("Unexpected result code %d"), reply[0]);
+	} else if (expect && (text == NULL || !strstr (text, expect))) {
+		srv->result = STATE_WARNING;
+		xasprintf (&srv->message, "%s", text ? text : "");
+	} else {
+		srv->result = STATE_OK;
+		xasprintf (&srv->message, _("Auth OK"));
+	}
+	free (text);
+	return TRUE;
+}
+
+/*
+ * Sends the Access-Request to all servers and waits for their answers,
+ * trying each of them again every timeout seconds, up to retries times.
+ * With a quorum, stops once that many servers accepted.
+ */
+int
+check_native (void)
+{
+	struct sockaddr_storage ss;
+	char name[HOST_NAME_MAX], *perf;
+	unsigned char reply[RADIUS_MAX_PACKET];
+	struct pollfd *pfds;
+	radius_server **pending;
+	size_t i, npending;
+	int result = STATE_OK, accepted = 0, wait, states[STATE_UNKNOWN + 1] = { 0 };
+	uint32_t nas_ip;
+	ssize_t len;
+	long left;
+
+	if (nasipaddress == NULL) {
+		if (gethostname (name, sizeof(name)) != 0)
+			die (STATE_UNKNOWN, _("gethostname() failed!\n"));
+		nasipaddress = name;
+	}
+	if (!dns_lookup (nasipaddress, &ss, AF_INET)) /* TODO: Support IPv6. */
+		die (STATE_UNKNOWN, _("Invalid NAS-IP-Address\n"));
+	nas_ip = ((struct sockaddr_in *)&ss)->sin_addr.s_addr;
+
+	pfds = calloc (servers_count, sizeof (struct pollfd));
+	pending = calloc (servers_count, sizeof (radius_server *));
+	if (pfds == NULL || pending == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	for (i = 0; i < servers_count; i++) {
+		radius_server *srv = &servers[i];
+		if ((srv->secret = radius_find_secret (srv->host)) == NULL) {
+			srv->done = TRUE;
+			srv->result = STATE_UNKNOWN;
+			xasprintf (&srv->message, _("No secret for %s in the servers file"), srv->host);
+			continue;
+		}
+		if ((srv->result = radius_open (srv)) != STATE_OK) {
+			srv->done = TRUE;
+			continue;
+		}
+		radius_build_request (srv, nas_ip);
+		radius_send (srv);
+	}
+
+	for (;;) {
+		npending = 0;
+		wait = -1;
+		for (i = 0; i < servers_count; i++) {
+			radius_server *srv = &servers[i];
+			if (srv->done)
+				continue;
+			left = (long) timeout_interval * 1000 - deltime (srv->sent) / 1000;
+			if (left <= 0) {
+				if (srv->tries >= retries) {
+					srv->done = TRUE;
+					srv->result = STATE_CRITICAL;
+					srv->elapsed = (double) deltime (srv->started) / 1.0e6;
+					xasprintf (&srv->message, _("Timeout"));
+					continue;
+				}
+				radius_send (srv);
+				left = (long) timeout_interval * 1000;
+			}
+			if (wait < 0 || left < wait)
+				wait = left;
+			pfds[npending].fd = srv->fd;
+			pfds[npending].events = POLLIN;
+			pfds[npending].revents = 0;
+			pending[npending++] = srv;
+		}
+		if (npending == 0 || (quorum > 0 && accepted >= quorum))
+			break;
+
+		if (poll (pfds, npending, wait) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+		for (i = 0; i < npending; i++) {
+			if (!(pfds[i].revents & (POLLIN | POLLERR)))
+				continue;
+			while ((len = recv (pfds[i].fd, reply, sizeof (reply), 0)) >= 0) {
+				if (radius_reply (pending[i], reply, len)) {
+					if (pending[i]->result == STATE_OK)
+						accepted++;
+					break;
+				}
+			}
+			/* ICMP port unreachable, the server is not there */
+			if (len < 0 && errno == ECONNREFUSED) {
+				pending[i]->done = TRUE;
+				pending[i]->result = STATE_CRITICAL;
+				pending[i]->elapsed = (double) deltime (pending[i]->started) / 1.0e6;
+				xasprintf (&pending[i]->message, "%s", strerror (errno));
+			}
+		}
+	}
+
+	for (i = 0; i < servers_count; i++) {
+		if (!servers[i].done) {
+			servers[i].result = STATE_OK;
+			xasprintf (&servers[i].message, _("Quorum reached before it answered"));
+			continue;
+		}
+		result = max_state (result, servers[i].result);
+		states[servers[i].result]++;
+	}
+	if (quorum > 0 && accepted >= quorum)
+		result = STATE_OK;
+
+	printf (_("RADIUS %s - %lu servers: %d ok, %d warning, %d critical, %d unknown"),
+	        state_text (result), (unsigned long) servers_count, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+	if (quorum > 0)
+		printf (_(", %d accepted, quorum %d"), accepted, quorum);
+	printf ("|");
+	for (i = 0; i < servers_count; i++) {
+		xasprintf (&perf, "%s:%d", servers[i].host, port);
+		printf ("%s%s", i ? " " : "",
+		        fperfdata (perf, servers[i].elapsed, "s", FALSE, 0, FALSE, 0,
+		                   TRUE, 0, TRUE, (double) timeout_interval * retries));
+		free (perf);
+	}
+	putchar ('\n');
+	for (i = 0; i < servers_count; i++)
+		printf ("%s %s:%d: %s\n", state_text (servers[i].result), servers[i].host,
+		        port, servers[i].message);
+
+	return result;
+}
@@ -47,11 +47,14 @@ int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
+static int read_response (np_net_reader *, char *, size_t);
+static int status_state (const char *);
 
 int server_port = PORT;
 char *server_address;
 char *host_name;
-char *server_url = NULL;
+char **server_urls = NULL;
+int url_count = 0;
 char *server_expect;
 int warning_time = 0;
 int check_warning_time = FALSE;
@@ -66,12 +69,14 @@ main (int argc, char **argv)
 {
 	int sd;
 	int result = STATE_UNKNOWN;
-	char buffer[MAX_INPUT_BUFFER];
-	char *status_line = NULL;
+	int i, n, state, server_state = STATE_UNKNOWN;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	char *request = NULL;
+	char **status_lines;
+	np_net_reader reader;
+	double deadline;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -79,161 +84,86 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if ((status_lines = calloc (url_count + 1, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
 	/* initialize alarm signal handling */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 
-	/* set socket timeout */
-	alarm (socket_timeout);
+	/* set socket timeout, with several streams it only ends the reading and
+	 * the streams still waiting for an answer fail, the alarm stays behind
+	 * as a last resort */
+	alarm (url_count > 1 ? socket_timeout + 1 : socket_timeout);
 	time (&start_time);
+	deadline = np_deadline (socket_timeout);
 
 	/* try to connect to the host at the given port number */
 	if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
 		die (STATE_CRITICAL, _("Unable to connect to %s on port %d\n"),
 							 server_address, server_port);
 
-	/* Part I - Server Check */
-
-	/* send the OPTIONS request */
-	sprintf (buffer, "OPTIONS rtsp://%s:%d RTSP/1.0\r\n", host_name, server_port);
-	result = send (sd, buffer, strlen (buffer), 0);
-
-	/* send the header sync */
-	sprintf (buffer, "CSeq: 1\r\n");
-	result = send (sd, buffer, strlen (buffer), 0);
-
-	/* send a newline so the server knows we're done with the request */
-	sprintf (buffer, "\r\n");
-	result = send (sd, buffer, strlen (buffer), 0);
-
-	/* watch for the REAL connection string */
-	result = recv (sd, buffer, MAX_INPUT_BUFFER - 1, 0);
-
-	/* return a CRITICAL status if we couldn't read any data */
-	if (result == -1)
-		die (STATE_CRITICAL, _("No data received from %s\n"), host_name);
-
-	/* make sure we find the response we are looking for */
-	if (!strstr (buffer, server_expect)) {
-		if (server_port == PORT)
-			printf ("%s\n", _("Invalid REAL response received from host"));
-		else
-			printf (_("Invalid REAL response received from host on port %d\n"),
-							server_port);
-	}
-	else {
-		/* else we got the REAL string, so check the return code */
-
-		time (&end_time);
-
-		result = STATE_OK;
-
-		status_line = (char *) strtok (buffer, "\n");
-
-		if (strstr (status_line, "200"))
-			result = STATE_OK;
-
-		/* client errors result in a warning state */
-		else if (strstr (status_line, "400"))
-			result = STATE_WARNING;
-		else if (strstr (status_line, "401"))
-			result = STATE_WARNING;
-		else if (strstr (status_line, "402"))
-			result = STATE_WARNING;
-		else if (strstr (status_line, "403"))
-			result = STATE_WARNING;
-		else if (strstr (status_line, "404"))
-			result = STATE_WARNING;
-
-		/* server errors result in a critical state */
-		else if (strstr (status_line, "500"))
-			result = STATE_CRITICAL;
-		else if (strstr (status_line, "501"))
-			result = STATE_CRITICAL;
-		else if (strstr (status_line, "502"))
-			result = STATE_CRITICAL;
-		else if (strstr (status_line, "503"))
+	/* Pipeline the OPTIONS request for the server check and a DESCRIBE request
+	 * for every stream, all on this one connection, and send them at once.
+	 * The server answers them in order. */
+	xasprintf (&request, "OPTIONS rtsp://%s:%d RTSP/1.0\r\nCSeq: 1\r\n\r\n",
+	           host_name, server_port);
+	for (i = 0; i < url_count; i++)
+		xasprintf (&request, "%sDESCRIBE rtsp://%s:%d%s RTSP/1.0\r\nCSeq: %d\r\n\r\n",
+		           request, host_name, server_port, server_urls[i], i + 2);
+	if (verbose)
+		printf ("%s", request);
+
+	for (i = 0, n = strlen (request); i < n; i += result)
+		if ((result = send (sd, request + i, n - i, 0)) < 0)
+			die (STATE_CRITICAL, _("Error sending request to %s: %s\n"), host_name, strerror (errno));
+	free (request);
+
+	np_net_reader_init (&reader, sd, NULL);
+	if (url_count > 1)
+		np_net_reader_deadline (&reader, deadline);
+
+	/* Part I - Server Check, then Part II - Check the streams exist and are ok */
+	for (i = 0; i <= url_count; i++) {
+		char buffer[MAX_INPUT_BUFFER];
+
+		if (read_response (&reader, buffer, sizeof (buffer)) <= 0) {
+			/* return a CRITICAL status if we couldn't read any data */
+			if (i == 0)
+				die (STATE_CRITICAL, _("No data received from %s\n"), host_name);
+			for (; i <= url_count; i++) {
+				status_lines[i] = _("No data received from host");
+				states[STATE_CRITICAL]++;
+			}
 			result = STATE_CRITICAL;
+			break;
+		}
 
-		else
-			result = STATE_UNKNOWN;
-	}
-
-	/* Part II - Check stream exists and is ok */
-	if ((result == STATE_OK )&& (server_url != NULL) ) {
-
-		/* Part I - Server Check */
-
-		/* send the DESCRIBE request */
-		sprintf (buffer, "DESCRIBE rtsp://%s:%d%s RTSP/1.0\r\n", host_name,
-						 server_port, server_url);
-		result = send (sd, buffer, strlen (buffer), 0);
-
-		/* send the header sync */
-		sprintf (buffer, "CSeq: 2\r\n");
-		result = send (sd, buffer, strlen (buffer), 0);
-
-		/* send a newline so the server knows we're done with the request */
-		sprintf (buffer, "\r\n");
-		result = send (sd, buffer, strlen (buffer), 0);
-
-		/* watch for the REAL connection string */
-		result = recv (sd, buffer, MAX_INPUT_BUFFER - 1, 0);
-		buffer[result] = '\0'; /* null terminate recieved buffer */
-
-		/* return a CRITICAL status if we couldn't read any data */
-		if (result == -1) {
-			printf (_("No data received from host\n"));
-			result = STATE_CRITICAL;
+		/* make sure we find the response we are looking for */
+		if (!strstr (buffer, server_expect)) {
+			if (server_port == PORT)
+				xasprintf (&status_lines[i], "%s", _("Invalid REAL response received from host"));
+			else
+				xasprintf (&status_lines[i], _("Invalid REAL response received from host on port %d"),
+				           server_port);
+			state = STATE_WARNING;
 		}
 		else {
-			/* make sure we find the response we are looking for */
-			if (!strstr (buffer, server_expect)) {
-				if (server_port == PORT)
-					printf ("%s\n", _("Invalid REAL response received from host"));
-				else
-					printf (_("Invalid REAL response received from host on port %d\n"),
-									server_port);
-			}
-			else {
+			/* else we got the REAL string, so check the return code */
+			status_lines[i] = strdup (buffer);
+			state = status_state (buffer);
+		}
 
-				/* else we got the REAL string, so check the return code */
-
-				time (&end_time);
-
-				result = STATE_OK;
-
-				status_line = (char *) strtok (buffer, "\n");
-
-				if (strstr (status_line, "200"))
-					result = STATE_OK;
-
-				/* client errors result in a warning state */
-				else if (strstr (status_line, "400"))
-					result = STATE_WARNING;
-				else if (strstr (status_line, "401"))
-					result = STATE_WARNING;
-				else if (strstr (status_line, "402"))
-					result = STATE_WARNING;
-				else if (strstr (status_line, "403"))
-					result = STATE_WARNING;
-				else if (strstr (status_line, "404"))
-					result = STATE_WARNING;
-
-				/* server errors result in a critical state */
-				else if (strstr (status_line, "500"))
-					result = STATE_CRITICAL;
-				else if (strstr (status_line, "501"))
-					result = STATE_CRITICAL;
-				else if (strstr (status_line, "502"))
-					result = STATE_CRITICAL;
-				else if (strstr (status_line, "503"))
-					result = STATE_CRITICAL;
-
-				else
-					result = STATE_UNKNOWN;
-			}
+		if (i == 0) {
+			result = server_state = state;
+			if (result != STATE_OK)
+				break;
+		}
+		else {
+			result = (i == 1) ? state : max_state (result, state);
+			states[state]++;
 		}
 	}
+	time (&end_time);
 
 	/* Return results */
 	if (result == STATE_OK) {
@@ -243,14 +173,23 @@ main (int argc, char **argv)
 		else if (check_warning_time == TRUE
 						 && (end_time - start_time) > warning_time) result =
 				STATE_WARNING;
+	}
 
-		/* Put some HTML in here to create a dynamic link */
+	if (server_state != STATE_OK)
+		printf ("%s\n", status_lines[0]);
+	else if (url_count > 1) {
+		printf (_("REAL %s - %d streams: %d ok, %d warning, %d critical, %d unknown, %d second response time\n"),
+		        state_text (result), url_count, states[STATE_OK], states[STATE_WARNING],
+		        states[STATE_CRITICAL], states[STATE_UNKNOWN], (int) (end_time - start_time));
+		for (i = 1; i <= url_count; i++)
+			printf ("%s: %s\n", server_urls[i - 1], status_lines[i]);
+	}
+	else if (url_count == 0 || states[STATE_OK] == 1)
 		printf (_("REAL %s - %d second response time\n"),
 						state_text (result),
 						(int) (end_time - start_time));
-	}
 	else
-		printf ("%s\n", status_line);
+		printf ("%s\n", status_lines[1]);
 
 	/* close the connection */
 	close (sd);
@@ -263,6 +202,79 @@ main (int argc, char **argv)
 
 
 
+/* Read one response, keep its status line in buf and skip the headers and
+ * body, so the next call gets the next one of the pipelined responses.
+ * Returns the length of the status line, 0 on EOF or <0 on error. */
+static int
+read_response (np_net_reader *reader, char *buf, size_t bufsize)
+{
+	char line[MAX_INPUT_BUFFER];
+	size_t body = 0, want;
+	int len, n;
+
+	do {
+		if ((len = np_net_recvline (reader, buf, bufsize)) <= 0)
+			return len;
+		strip (buf);
+	} while (buf[0] == '\0');
+	if (verbose)
+		printf ("%s\n", buf);
+
+	while ((n = np_net_recvline (reader, line, sizeof (line))) > 0) {
+		strip (line);
+		if (line[0] == '\0')
+			break;
+		if (strncasecmp (line, "Content-Length:", 15) == 0)
+			body = strtoul (line + 15, NULL, 10);
+	}
+	if (n <= 0)
+		return n == 0 ? strlen (buf) : n;
+
+	/* a line of at most the rest of the body, -2 when it took all of it */
+	while (body > 0) {
+		want = body < sizeof (line) - 1 ? body : sizeof (line) - 1;
+		if ((n = np_net_recvline (reader, line, want + 1)) == -2)
+			n = want;
+		if (n <= 0)
+			break;
+		body -= n;
+	}
+
+	return strlen (buf);
+}
+
+/* client errors result in a warning state, server errors in a critical one */
+static int
+status_state (const char *status_line)
+{
+	if (strstr (status_line, "200"))
+		return STATE_OK;
+
+	else if (strstr (status_line, "400"))
+		return STATE_WARNING;
+	else if (strstr (status_line, "401"))
+		return STATE_WARNING;
+	else if (strstr (status_line, "402"))
+		return STATE_WARNING;
+	else if (strstr (status_line, "403"))
+		return STATE_WARNING;
+	else if (strstr (status_line, "404"))
+		return STATE_WARNING;
+
+	else if (strstr (status_line, "500"))
+		return STATE_CRITICAL;
+	else if (strstr (status_line, "501"))
+		return STATE_CRITICAL;
+	else if (strstr (status_line, "502"))
+		return STATE_CRITICAL;
+	else if (strstr (status_line, "503"))
+		return STATE_CRITICAL;
+
+	return STATE_UNKNOWN;
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -317,8 +329,11 @@ process_arguments (int argc, char **argv)
 		case 'e':									/* string to expect in response header */
 			server_expect = optarg;
 			break;
-		case 'u':									/* server URL */
-			server_url = optarg;
+		case 'u':									/* server URL, may be repeated */
+			server_urls = realloc (server_urls, (url_count + 1) * sizeof (char *));
+			if (server_urls == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			server_urls[url_count++] = optarg;
 			break;
 		case 'p':									/* port */
 			if (is_intpos (optarg)) {
@@ -423,7 +438,8 @@ print_help (void)
 	printf (UT_HOST_PORT, 'p', myport);
 
 	printf (" %s\n", "-u, --url=STRING");
-  printf ("    %s\n", _("Connect to this url"));
+  printf ("    %s\n", _("Connect to this url. May be repeated to check many streams of the"));
+  printf ("    %s\n", _("server, with all requests pipelined on one connection"));
   printf (" %s\n", "-e, --expect=STRING");
   printf (_("String to expect in first line of server response (default: %s)\n"),
 	       EXPECT);
@@ -450,5 +466,5 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host [-e expect] [-p port] [-w warn] [-c crit] [-t timeout] [-v]\n", progname);
+	printf ("%s -H host [-u url]... [-e expect] [-p port] [-w warn] [-c crit] [-t timeout] [-v]\n", progname);
 }
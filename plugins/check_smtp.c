@@ -39,15 +39,19 @@ const char *email = "devel@monitoring-plugins.org";
 
 #include <ctype.h>
 
+#ifdef HAVE_RES_NSEND
+# include <arpa/nameser.h>
+# include <resolv.h>
+#endif
+
 #ifdef HAVE_SSL
 int check_cert = FALSE;
 int days_till_exp_warn, days_till_exp_crit;
-#  define my_recv(buf, len) ((use_ssl && ssl_established) ? np_net_ssl_read(buf, len) : read(sd, buf, len))
 #  define my_send(buf, len) ((use_ssl && ssl_established) ? np_net_ssl_write(buf, len) : send(sd, buf, len, 0))
 #else /* ifndef HAVE_SSL */
-#  define my_recv(buf, len) read(sd, buf, len)
 #  define my_send(buf, len) send(sd, buf, len, 0)
 #endif
+#define recvlines(buf, len) np_net_recvlines(&reader, buf, len)
 
 enum {
 	SMTP_PORT	= 25
@@ -60,14 +64,16 @@ enum {
 #define SMTP_AUTH_LOGIN "AUTH LOGIN\r\n"
 
 #define EHLO_SUPPORTS_STARTTLS 1
+#define DEFAULT_CONCURRENCY 64
 
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 void smtp_quit(void);
-int recvline(char *, size_t);
-int recvlines(char *, size_t);
+static int pipeline_end (int);
+static int check_response (int, int);
+static int run_multi_target (const char *);
 int my_close(void);
 
 #include "regex.h"
@@ -103,25 +109,32 @@ int verbose = 0;
 int use_ssl = FALSE;
 short use_ehlo = FALSE;
 short ssl_established = 0;
+int use_pipelining = TRUE;
 char *localhostname = NULL;
 int sd;
+np_net_reader reader;
 char buffer[MAX_INPUT_BUFFER];
 enum {
   TCP_PROTOCOL = 1,
   UDP_PROTOCOL = 2,
 };
 int ignore_send_quit_failure = FALSE;
+char *mx_domain = NULL;
+char *targets_file = NULL;
+int concurrency = DEFAULT_CONCURRENCY;
 
 
 int
 main (int argc, char **argv)
 {
 	short supports_tls=FALSE;
-	int n = 0;
+	short supports_pipelining=FALSE;
+	int n = 0, first, last, i;
 	double elapsed_time;
 	long microsec;
 	int result = STATE_UNKNOWN;
 	char *cmd_str = NULL;
+	char *mail_buffer = NULL;
 	char *helocmd = NULL;
 	char *error_msg = "";
 	char *server_response = NULL;
@@ -130,9 +143,7 @@ main (int argc, char **argv)
 	/* Catch pipe errors in read/write - sometimes occurs when writing QUIT */
 	(void) signal (SIGPIPE, SIG_IGN);
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -160,6 +171,12 @@ main (int argc, char **argv)
 	if (verbose)
 		printf("HELOCMD: %s", helocmd);
 
+	/* STARTTLS is looked for in every MX, which takes EHLO */
+	if (mx_domain != NULL || targets_file != NULL) {
+		xasprintf (&helocmd, "%s%s%s", SMTP_EHLO, localhostname, "\r\n");
+		return run_multi_target (helocmd);
+	}
+
 	/* initialize the MAIL command with optional FROM command  */
 	xasprintf (&cmd_str, "%sFROM:<%s>%s", mail_command, from_arg, "\r\n");
 
@@ -179,6 +196,7 @@ main (int argc, char **argv)
 	result = my_tcp_connect (server_address, server_port, &sd);
 
 	if (result == STATE_OK) { /* we connected */
+		np_net_reader_init (&reader, sd, NULL);
 
 		/* watch for the SMTP connection string and */
 		/* return a WARNING status if we couldn't read any data */
@@ -202,6 +220,8 @@ main (int argc, char **argv)
 			   strstr(buffer, "250-STARTTLS") != NULL){
 				supports_tls=TRUE;
 			}
+			supports_pipelining = strstr(buffer, "250 PIPELINING") != NULL ||
+			                      strstr(buffer, "250-PIPELINING") != NULL;
 		}
 
 		if(use_ssl && ! supports_tls){
@@ -229,6 +249,8 @@ main (int argc, char **argv)
 		    return STATE_CRITICAL;
 		  } else {
 			ssl_established = 1;
+			/* nothing the server sent before the handshake counts */
+			np_net_reader_init (&reader, sd, np_net_ssl_read);
 		  }
 
 		/*
@@ -257,6 +279,8 @@ main (int argc, char **argv)
 		if (verbose) {
 			printf("%s", buffer);
 		}
+		supports_pipelining = strstr(buffer, "250 PIPELINING") != NULL ||
+		                      strstr(buffer, "250-PIPELINING") != NULL;
 
 #  ifdef USE_OPENSSL
 		  if ( check_cert ) {
@@ -287,42 +311,33 @@ main (int argc, char **argv)
 			return STATE_WARNING;
 		}
 
-		if (send_mail_from) {
-		  my_send(cmd_str, strlen(cmd_str));
-		  if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
-		    printf("%s", buffer);
-		}
-
-		n = 0;
-		while (n < ncommands) {
-			xasprintf (&cmd_str, "%s%s", commands[n], "\r\n");
-			my_send(cmd_str, strlen(cmd_str));
-			if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
-				printf("%s", buffer);
-			strip (buffer);
-			if (n < nresponses) {
-				cflags |= REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
-				errcode = regcomp (&preg, responses[n], cflags);
-				if (errcode != 0) {
-					regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
-					printf (_("Could Not Compile Regular Expression"));
+		/* Command -1 is the MAIL command. If the server offers PIPELINING
+		 * (RFC 2920), send them in groups and read the replies after */
+		first = send_mail_from ? -1 : 0;
+		for (n = first; n < ncommands; n = last) {
+			last = n + 1;
+			if (use_pipelining && supports_pipelining)
+				while (last < ncommands && !pipeline_end (last - 1))
+					last++;
+
+			free (mail_buffer);
+			mail_buffer = NULL;
+			for (i = n; i < last; i++) {
+				if (i < 0)
+					xasprintf (&mail_buffer, "%s", cmd_str);
+				else
+					xasprintf (&mail_buffer, "%s%s\r\n", mail_buffer ? mail_buffer : "", commands[i]);
+			}
+			if (verbose && last - n > 1)
+				printf (_("sent %d commands at once\n"), last - n);
+			my_send(mail_buffer, strlen(mail_buffer));
+
+			for (i = n; i < last; i++) {
+				if (recvlines(buffer, MAX_INPUT_BUFFER) >= 1 && verbose)
+					printf("%s", buffer);
+				if (i >= 0 && (result = check_response (i, result)) == ERROR)
 					return ERROR;
-				}
-				excode = regexec (&preg, buffer, 10, pmatch, eflags);
-				if (excode == 0) {
-					result = STATE_OK;
-				}
-				else if (excode == REG_NOMATCH) {
-					result = STATE_WARNING;
-					printf (_("SMTP %s - Invalid response '%s' to command '%s'\n"), state_text (result), buffer, commands[n]);
-				}
-				else {
-					regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
-					printf (_("Execute Error: %s\n"), errbuf);
-					result = STATE_UNKNOWN;
-				}
 			}
-			n++;
 		}
 
 		if (authtype != NULL) {
@@ -443,6 +458,395 @@ main (int argc, char **argv)
 
 
 
+/* Multi-target mode: np_conn_run() connects to every MX of a domain, or
+ * every target of a list, and mx_dialogue() takes each one through the
+ * greeting, EHLO and, where it is offered, STARTTLS as the handshake of
+ * the engine. The sockets do not block, so a reply is put together in the
+ * session of its connection instead of with the np_net_reader of a single
+ * check. */
+enum mx_step {
+	MX_GREETING,
+	MX_EHLO,
+	MX_STARTTLS,
+	MX_TLS,
+	MX_EHLO_TLS
+};
+struct mx_session {
+	enum mx_step step;
+	char reply[MAX_INPUT_BUFFER];
+	size_t len;
+	double greeting;	/* seconds until the 220, -1 until then */
+	double handshake;	/* seconds the TLS handshake took, -1 if none */
+	int starttls;		/* offered in the reply to EHLO */
+	struct timeval tls_start;
+#ifdef HAVE_SSL
+	SSL *ssl;
+#endif
+};
+static const char *mx_ehlo;
+
+#ifdef HAVE_RES_NSEND
+/* The MX hosts of domain by preference, as targets for np_conn_run(). A
+ * domain without MX records is its own mail exchanger (RFC 5321, 5.1). */
+static np_conn *
+mx_lookup (const char *domain, size_t *count)
+{
+	struct __res_state res;
+	ns_msg handle;
+	ns_rr rr;
+	char name[NS_MAXDNAME];
+	u_char query[NS_PACKETSZ];
+	u_char answer[NS_MAXMSG];
+	np_conn *conns;
+	int *prefs;
+	int len, pref, i, j;
+
+	memset (&res, 0, sizeof (res));
+	if (res_ninit (&res) != 0)
+		die (STATE_UNKNOWN, _("Could not initialize the resolver\n"));
+	res.retry = 1;
+	res.retrans = socket_timeout > 2 ? socket_timeout - 1 : 1;
+
+	len = res_nmkquery (&res, ns_o_query, domain, ns_c_in, ns_t_mx, NULL, 0, NULL,
+	                    query, sizeof (query));
+	if (len < 0)
+		die (STATE_UNKNOWN, _("SMTP UNKNOWN - Cannot build a query for %s\n"), domain);
+	if ((len = res_nsend (&res, query, len, answer, sizeof (answer))) < 0)
+		die (STATE_CRITICAL, _("SMTP CRITICAL - No answer to the MX query for %s\n"), domain);
+	if (ns_initparse (answer, len, &handle) < 0)
+		die (STATE_CRITICAL, _("SMTP CRITICAL - Invalid answer to the MX query for %s\n"), domain);
+	if (ns_msg_getflag (handle, ns_f_rcode) == ns_r_nxdomain)
+		die (STATE_CRITICAL, _("SMTP CRITICAL - Domain %s was not found\n"), domain);
+	if (ns_msg_getflag (handle, ns_f_rcode) != ns_r_noerror)
+		die (STATE_CRITICAL, _("SMTP CRITICAL - The MX query for %s failed\n"), domain);
+
+	len = ns_msg_count (handle, ns_s_an);
+	conns = calloc (len ? len : 1, sizeof (np_conn));
+	prefs = calloc (len ? len : 1, sizeof (int));
+	if (conns == NULL || prefs == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	*count = 0;
+	for (i = 0; i < len; i++) {
+		if (ns_parserr (&handle, ns_s_an, i, &rr) < 0)
+			break;
+		if (ns_rr_type (rr) != ns_t_mx || ns_rr_rdlen (rr) < 3 ||
+		    ns_name_uncompress (ns_msg_base (handle), ns_msg_end (handle), ns_rr_rdata (rr) + 2,
+		                        name, sizeof (name)) < 0)
+			continue;
+		pref = (ns_rr_rdata (rr)[0] << 8) | ns_rr_rdata (rr)[1];
+		/* the null MX of RFC 7505 */
+		if (name[0] == '\0' || strcmp (name, ".") == 0)
+			die (STATE_CRITICAL, _("SMTP CRITICAL - %s accepts no mail (null MX)\n"), domain);
+		if (verbose)
+			printf ("MX %d %s\n", pref, name);
+
+		for (j = *count; j > 0 && prefs[j - 1] > pref; j--) {
+			conns[j] = conns[j - 1];
+			prefs[j] = prefs[j - 1];
+		}
+		memset (&conns[j], 0, sizeof (np_conn));
+		conns[j].host = strdup (name);
+		prefs[j] = pref;
+		(*count)++;
+	}
+	res_nclose (&res);
+	free (prefs);
+
+	if (*count == 0) {
+		memset (&conns[0], 0, sizeof (np_conn));
+		conns[0].host = strdup (domain);
+		*count = 1;
+	}
+	for (i = 0; i < (int)*count; i++) {
+		conns[i].port = server_port;
+		conns[i].fd = -1;
+		conns[i].match = -1;
+	}
+	return conns;
+}
+#endif /* HAVE_RES_NSEND */
+
+/* Read what the socket has. Returns 1 once a whole reply is there, 0 to
+ * wait for more and -1 if the connection broke. */
+static int
+mx_read (np_conn *t, struct mx_session *mx)
+{
+	char *line, *next;
+	int n;
+
+	for (;;) {
+		if (mx->len >= sizeof (mx->reply) - 1)
+			return -1;
+#ifdef HAVE_SSL
+		if (mx->ssl != NULL)
+			n = np_net_ssl_handshake_read (mx->ssl, mx->reply + mx->len, sizeof (mx->reply) - 1 - mx->len);
+		else
+#endif
+			n = recv (t->fd, mx->reply + mx->len, sizeof (mx->reply) - 1 - mx->len, 0);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			break;
+		if (n <= 0)
+			return -1;
+		mx->len += n;
+	}
+	mx->reply[mx->len] = '\0';
+
+	/* every line but the last one of a reply has a '-' after the code */
+	for (line = mx->reply; (next = strchr (line, '\n')) != NULL; line = next + 1)
+		if (!(isdigit ((int)line[0]) && isdigit ((int)line[1]) && isdigit ((int)line[2]) &&
+		      line[3] == '-'))
+			return 1;
+	return 0;
+}
+
+static int
+mx_send (np_conn *t, struct mx_session *mx, const char *cmd)
+{
+	int len = strlen (cmd);
+
+	if (verbose)
+		printf ("%s:%d > %s", t->host, t->port, cmd);
+#ifdef HAVE_SSL
+	if (mx->ssl != NULL)
+		return np_net_ssl_handshake_write (mx->ssl, cmd, len) == len;
+#endif
+	return send (t->fd, cmd, len, 0) == len;
+}
+
+/* the dialogue is over, judge it like a single check would */
+static void
+mx_judge (np_conn *t, struct mx_session *mx)
+{
+	int result = STATE_OK;
+	char *message = NULL;
+#ifdef HAVE_SSL
+	char *cert_message = NULL;
+#endif
+
+	mx_send (t, mx, SMTP_QUIT);
+	t->elapsed = (double)deltime (t->start) / 1.0e6;
+
+	if (check_critical_time && t->elapsed > critical_time)
+		result = STATE_CRITICAL;
+	else if (check_warning_time && t->elapsed > warning_time)
+		result = STATE_WARNING;
+
+	if (mx->handshake >= 0)
+		xasprintf (&message, _("%.3f sec. response time, greeting after %.3f sec., %.3f sec. STARTTLS handshake"),
+		           t->elapsed, mx->greeting, mx->handshake);
+	else
+		xasprintf (&message, _("%.3f sec. response time, greeting after %.3f sec., %s"),
+		           t->elapsed, mx->greeting, mx->starttls ? _("STARTTLS offered") : _("no STARTTLS"));
+
+	if (use_ssl && !mx->starttls) {
+		result = max_state (result, STATE_WARNING);
+		xasprintf (&message, "%s - %s", message, _("TLS not supported by server"));
+	}
+#ifdef HAVE_SSL
+	if (check_cert && mx->ssl != NULL) {
+		result = max_state (result, np_net_ssl_handshake_cert (mx->ssl, days_till_exp_warn,
+		                                                       days_till_exp_crit, &cert_message));
+		xasprintf (&message, "%s, %s", message, cert_message);
+		free (cert_message);
+	}
+#endif
+
+	np_conn_finish (t, result, message);
+}
+
+/* fail the connection with the reply that was not expected */
+static int
+mx_fail (np_conn *t, struct mx_session *mx, int result, const char *what)
+{
+	char *message = NULL;
+
+	xasprintf (&message, "%s: %s", what, mx->reply);
+	np_conn_finish (t, result, message);
+	return 0;
+}
+
+static int
+mx_dialogue (np_conn *t)
+{
+	struct mx_session *mx = t->session;
+	char *message = NULL;
+	int n;
+
+	if (mx == NULL) {
+		if ((mx = t->session = calloc (1, sizeof (struct mx_session))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		mx->step = MX_GREETING;
+		mx->greeting = mx->handshake = -1;
+		return POLLIN;
+	}
+
+#ifdef HAVE_SSL
+	if (mx->step == MX_TLS) {
+		if ((n = np_net_ssl_handshake_continue (mx->ssl, &message)) > 0)
+			return n;
+		if (n < 0) {
+			np_conn_finish (t, STATE_CRITICAL, message);
+			return 0;
+		}
+		mx->handshake = (double)deltime (mx->tls_start) / 1.0e6;
+
+		/* RFC 3207, 4.2: what was learnt before TLS is forgotten, and
+		 * EHLO is sent again */
+		if (!mx_send (t, mx, mx_ehlo)) {
+			np_conn_finish (t, STATE_UNKNOWN, strdup (_("Cannot send EHLO command via TLS")));
+			return 0;
+		}
+		mx->step = MX_EHLO_TLS;
+		return POLLIN;
+	}
+#endif
+
+	if ((n = mx_read (t, mx)) == 0)
+		return POLLIN;
+	if (n < 0) {
+		xasprintf (&message, _("Connection closed by server: %s"), mx->len ? mx->reply : _("no reply"));
+		np_conn_finish (t, mx->step == MX_GREETING ? STATE_WARNING : STATE_CRITICAL, message);
+		return 0;
+	}
+	strip (mx->reply);
+	mx->len = 0;
+	if (verbose)
+		printf ("%s:%d < %s\n", t->host, t->port, mx->reply);
+
+	switch (mx->step) {
+	case MX_GREETING:
+		mx->greeting = (double)deltime (t->start) / 1.0e6;
+		if (!strstr (mx->reply, server_expect))
+			return mx_fail (t, mx, STATE_WARNING, _("Invalid SMTP response received from host"));
+		if (!mx_send (t, mx, mx_ehlo))
+			return mx_fail (t, mx, STATE_CRITICAL, _("Cannot send EHLO command"));
+		mx->step = MX_EHLO;
+		return POLLIN;
+
+	case MX_EHLO:
+		if (strncmp (mx->reply, "250", 3) != 0)
+			return mx_fail (t, mx, STATE_WARNING, _("Invalid response to EHLO"));
+		mx->starttls = strstr (mx->reply, "250 STARTTLS") != NULL ||
+		               strstr (mx->reply, "250-STARTTLS") != NULL;
+#ifdef HAVE_SSL
+		if (mx->starttls) {
+			if (!mx_send (t, mx, SMTP_STARTTLS))
+				return mx_fail (t, mx, STATE_CRITICAL, _("Cannot send STARTTLS command"));
+			mx->step = MX_STARTTLS;
+			return POLLIN;
+		}
+#endif
+		mx_judge (t, mx);
+		return 0;
+
+#ifdef HAVE_SSL
+	case MX_STARTTLS:
+		if (strncmp (mx->reply, SMTP_EXPECT, 3) != 0)
+			return mx_fail (t, mx, STATE_UNKNOWN, _("Server does not support STARTTLS"));
+		if ((mx->ssl = np_net_ssl_handshake_start (t->fd, t->sni ? t->sni : t->host)) == NULL) {
+			np_conn_finish (t, STATE_CRITICAL, strdup (_("Cannot initiate SSL handshake.")));
+			return 0;
+		}
+		gettimeofday (&mx->tls_start, NULL);
+		mx->step = MX_TLS;
+		return mx_dialogue (t);
+#endif
+
+	case MX_EHLO_TLS:
+		if (strncmp (mx->reply, "250", 3) != 0)
+			return mx_fail (t, mx, STATE_WARNING, _("Invalid response to EHLO via TLS"));
+		mx_judge (t, mx);
+		return 0;
+
+	default:
+		break;
+	}
+	return 0;
+}
+
+static int
+run_multi_target (const char *ehlo)
+{
+	np_conn *targets;
+	np_conn_ops ops;
+	size_t count, i;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int result = STATE_OK;
+	char *perf = NULL;
+	const char **names;
+
+#ifdef HAVE_RES_NSEND
+	if (mx_domain != NULL)
+		targets = mx_lookup (mx_domain, &count);
+	else
+#endif
+		targets = np_conn_read_list (targets_file, server_port, &count);
+
+	if ((names = calloc (count, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < count; i++)
+		names[i] = targets[i].host;
+	np_resolve_prefetch (names, count, address_family, concurrency);
+	free (names);
+
+	mx_ehlo = ehlo;
+	memset (&ops, 0, sizeof (ops));
+	ops.handshake = mx_dialogue;
+	np_conn_run (targets, count, concurrency, &ops);
+
+	for (i = 0; i < count; i++) {
+		result = max_state (result, targets[i].result);
+		if (targets[i].result >= STATE_OK && targets[i].result <= STATE_DEPENDENT)
+			states[targets[i].result]++;
+	}
+
+	if (mx_domain != NULL)
+		printf (_("SMTP %s - %lu MX of %s: %d ok, %d warning, %d critical, %d unknown"),
+		        state_text (result), (unsigned long)count, mx_domain, states[STATE_OK],
+		        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+	else
+		printf (_("SMTP %s - %lu targets: %d ok, %d warning, %d critical, %d unknown"),
+		        state_text (result), (unsigned long)count, states[STATE_OK],
+		        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+	printf ("|");
+	for (i = 0; i < count; i++) {
+		struct mx_session *mx = targets[i].session;
+
+		xasprintf (&perf, "%s:%d", targets[i].host, targets[i].port);
+		printf ("%s%s", i ? " " : "",
+		        fperfdata (perf, targets[i].elapsed, "s",
+		                   (int)check_warning_time, warning_time,
+		                   (int)check_critical_time, critical_time,
+		                   TRUE, 0, TRUE, socket_timeout));
+		free (perf);
+		if (mx == NULL)
+			continue;
+		if (mx->handshake >= 0) {
+			xasprintf (&perf, "%s:%d_handshake", targets[i].host, targets[i].port);
+			printf (" %s", fperfdata (perf, mx->handshake, "s", FALSE, 0, FALSE, 0,
+			                          TRUE, 0, TRUE, socket_timeout));
+			free (perf);
+		}
+#ifdef HAVE_SSL
+		if (mx->ssl != NULL)
+			np_net_ssl_handshake_free (mx->ssl);
+#endif
+		free (mx);
+	}
+	putchar ('\n');
+
+	for (i = 0; i < count; i++)
+		printf ("%s %s:%d: %s\n", state_text (targets[i].result),
+		        targets[i].host, targets[i].port,
+		        targets[i].message ? targets[i].message : "");
+
+	return result;
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -451,6 +855,12 @@ process_arguments (int argc, char **argv)
 	char* temp;
 
 	int option = 0;
+	enum {
+		NO_PIPELINING_OPTION = CHAR_MAX + 1,
+		MX_OPTION,
+		TARGETS_OPTION,
+		CONCURRENCY_OPTION
+	};
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
 		{"expect", required_argument, 0, 'e'},
@@ -473,6 +883,10 @@ process_arguments (int argc, char **argv)
 		{"starttls",no_argument,0,'S'},
 		{"certificate",required_argument,0,'D'},
 		{"ignore-quit-failure",no_argument,0,'q'},
+		{"no-pipelining",no_argument,0,NO_PIPELINING_OPTION},
+		{"mx",required_argument,0,MX_OPTION},
+		{"targets",required_argument,0,TARGETS_OPTION},
+		{"concurrency",required_argument,0,CONCURRENCY_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -578,6 +992,24 @@ process_arguments (int argc, char **argv)
 		case 'q':
 			ignore_send_quit_failure++;             /* ignore problem sending QUIT */
 			break;
+		case NO_PIPELINING_OPTION:
+			use_pipelining = FALSE;
+			break;
+		case MX_OPTION:
+#ifdef HAVE_RES_NSEND
+			mx_domain = optarg;
+#else
+			usage4 (_("--mx is not available, use --targets"));
+#endif
+			break;
+		case TARGETS_OPTION:
+			targets_file = optarg;
+			break;
+		case CONCURRENCY_OPTION:
+			if (!is_intpos (optarg))
+				usage4 (_("Concurrency must be a positive integer"));
+			concurrency = atoi (optarg);
+			break;
 		case 't':									/* timeout */
 			if (is_intnonneg (optarg)) {
 				socket_timeout = atoi (optarg);
@@ -667,6 +1099,11 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
+	if (mx_domain != NULL && targets_file != NULL)
+		usage4 (_("--mx and --targets cannot be used together"));
+	if ((mx_domain != NULL || targets_file != NULL) &&
+	    (ncommands || send_mail_from || authtype != NULL))
+		usage4 (_("-C, -f and -A cannot be used with --mx or --targets"));
 	return OK;
 }
 
@@ -707,61 +1144,53 @@ smtp_quit(void)
 }
 
 
-/*
- * Receive one line, copy it into buf and nul-terminate it.  Returns the
- * number of bytes written to buf (excluding the '\0') or 0 on EOF or <0 on
- * error.
- *
- * TODO: Reading one byte at a time is very inefficient.  Replace this by a
- * function which buffers the data, move that to netutils.c and change
- * check_smtp and other plugins to use that.  Also, remove (\r)\n.
- */
-int
-recvline(char *buf, size_t bufsize)
+/* RFC 2920, 3.1: these commands can only be the last one of a group */
+static int
+pipeline_end (int n)
 {
-	int result;
-	unsigned i;
-
-	for (i = result = 0; i < bufsize - 1; i++) {
-		if ((result = my_recv(&buf[i], 1)) != 1)
-			break;
-		if (buf[i] == '\n') {
-			buf[++i] = '\0';
-			return i;
-		}
-	}
-	return (result == 1 || i == 0) ? -2 : result;	/* -2 if out of space */
+	static const char *last[] = { "EHLO", "HELO", "DATA", "VRFY", "EXPN", "TURN",
+	                              "QUIT", "NOOP", "STARTTLS", "AUTH", NULL };
+	int i;
+
+	if (n < 0)
+		return FALSE;
+	for (i = 0; last[i] != NULL; i++)
+		if (strncasecmp (commands[n], last[i], strlen (last[i])) == 0 &&
+		    (commands[n][strlen (last[i])] == '\0' || isspace ((int)commands[n][strlen (last[i])])))
+			return TRUE;
+	return FALSE;
 }
 
 
-/*
- * Receive one or more lines, copy them into buf and nul-terminate it.  Returns
- * the number of bytes written to buf (excluding the '\0') or 0 on EOF or <0 on
- * error.  Works for all protocols which format multiline replies as follows:
- *
- * ``The format for multiline replies requires that every line, except the last,
- * begin with the reply code, followed immediately by a hyphen, `-' (also known
- * as minus), followed by text.  The last line will begin with the reply code,
- * followed immediately by <SP>, optionally some text, and <CRLF>.  As noted
- * above, servers SHOULD send the <SP> if subsequent text is not sent, but
- * clients MUST be prepared for it to be omitted.'' (RFC 2821, 4.2.1)
- *
- * TODO: Move this to netutils.c.  Also, remove \r and possibly the final \n.
- */
-int
-recvlines(char *buf, size_t bufsize)
+/* Check the reply in buffer to commands[n] against responses[n], if any */
+static int
+check_response (int n, int result)
 {
-	int result, i;
-
-	for (i = 0; /* forever */; i += result)
-		if (!((result = recvline(buf + i, bufsize - i)) > 3 &&
-		    isdigit((int)buf[i]) &&
-		    isdigit((int)buf[i + 1]) &&
-		    isdigit((int)buf[i + 2]) &&
-		    buf[i + 3] == '-'))
-			break;
-
-	return (result <= 0) ? result : result + i;
+	strip (buffer);
+	if (n >= nresponses)
+		return result;
+
+	cflags |= REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
+	errcode = regcomp (&preg, responses[n], cflags);
+	if (errcode != 0) {
+		regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+		printf (_("Could Not Compile Regular Expression"));
+		return ERROR;
+	}
+	excode = regexec (&preg, buffer, 10, pmatch, eflags);
+	if (excode == 0) {
+		result = STATE_OK;
+	}
+	else if (excode == REG_NOMATCH) {
+		result = STATE_WARNING;
+		printf (_("SMTP %s - Invalid response '%s' to command '%s'\n"), state_text (result), buffer, commands[n]);
+	}
+	else {
+		regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
+		printf (_("Execute Error: %s\n"), errbuf);
+		result = STATE_UNKNOWN;
+	}
+	return result;
 }
 
 
@@ -826,6 +1255,19 @@ print_help (void)
   printf ("    %s\n", _("SMTP AUTH password"));
   printf (" %s\n", "-q, --ignore-quit-failure");
   printf ("    %s\n", _("Ignore failure when sending QUIT command to server"));
+  printf (" %s\n", "--no-pipelining");
+  printf ("    %s\n", _("Wait for the reply to each command even if the server offers PIPELINING"));
+  printf ("    %s\n", _("in its reply to EHLO (sent with -A or -S)"));
+  printf (" %s\n", "--mx=DOMAIN");
+  printf ("    %s\n", _("Check every MX of DOMAIN concurrently at the port given with -p. Each one"));
+  printf ("    %s\n", _("is taken through EHLO and, where it is offered, STARTTLS, and reported with"));
+  printf ("    %s\n", _("its response time and TLS status; the worst state is returned"));
+  printf (" %s\n", "--targets=FILE");
+  printf ("    %s\n", _("The same for all targets listed in FILE (\"-\" for stdin), one \"host port\","));
+  printf ("    %s\n", _("\"host:port\" or \"[address]:port\" per line"));
+  printf (" %s\n", "--concurrency=INTEGER");
+  printf ("    %s\n", _("Maximum number of connections in flight with --mx or --targets"));
+  printf ("    %s %d\n", _("Default:"), DEFAULT_CONCURRENCY);
    
 	printf (UT_WARN_CRIT);
 
@@ -850,6 +1292,8 @@ print_usage (void)
   printf ("%s\n", _("Usage:"));
   printf ("%s -H host [-p port] [-4|-6] [-e expect] [-C command] [-R response] [-f from addr]\n", progname);
   printf ("[-A authtype -U authuser -P authpass] [-w warn] [-c crit] [-t timeout] [-q]\n");
-  printf ("[-F fqdn] [-S] [-D warn days cert expire[,crit days cert expire]] [-v] \n");
+  printf ("[-F fqdn] [-S] [-D warn days cert expire[,crit days cert expire]] [--no-pipelining] [-v] \n");
+  printf ("%s --mx=domain|--targets=file [--concurrency=n] [-p port] [-4|-6] [-e expect]\n", progname);
+  printf ("[-w warn] [-c crit] [-t timeout] [-F fqdn] [-S] [-D warn days[,crit days]] [-v]\n");
 }
 
@@ -36,6 +36,9 @@ const char *email = "devel@monitoring-plugins.org";
 #include "runcmd.h"
 #include "utils.h"
 #include "utils_cmd.h"
+#include "utils_targets.h"
+
+#include "snmputils.h"
 
 #define DEFAULT_COMMUNITY "public"
 #define DEFAULT_PORT "161"
@@ -58,12 +61,31 @@ const char *email = "devel@monitoring-plugins.org";
 #define WARN_REGEX 32
 
 #define OID_COUNT_STEP 8
+/* the data version of the --rate state, 1 was the text format */
+#define RATE_STATE_VERSION 2
+#define DEFAULT_CONCURRENCY 64
+#define TABLE_REPETITIONS 16
+/* the data version of the --table-cache state */
+#define TABLE_STATE_VERSION 1
+/* varbinds per GET of the columns that change, with --table-cache */
+#define TABLE_GET_VARBINDS 32
+#define SYS_UPTIME_OID ".1.3.6.1.2.1.1.3.0"
+#define IF_TABLE_LAST_CHANGE_OID ".1.3.6.1.2.1.31.1.5.0"
 
 /* Longopts only arguments */
 #define L_CALCULATE_RATE CHAR_MAX+1
 #define L_RATE_MULTIPLIER CHAR_MAX+2
 #define L_INVERT_SEARCH CHAR_MAX+3
 #define L_OFFSET CHAR_MAX+4
+#define L_NATIVE CHAR_MAX+5
+#define L_TARGETS CHAR_MAX+6
+#define L_CONCURRENCY CHAR_MAX+7
+#define L_TABLE CHAR_MAX+8
+#define L_CACHE CHAR_MAX+9
+#define L_MIB_INDEX CHAR_MAX+10
+#define L_SHARD CHAR_MAX+11
+#define L_CHANGES CHAR_MAX+12
+#define L_TABLE_CACHE CHAR_MAX+13
 
 /* Gobble to string - stop incrementing c when c[0] match one of the
  * characters in s */
@@ -91,12 +113,12 @@ char *nextarg (char *str);
 void print_usage (void);
 void print_help (void);
 
-#include "regex.h"
+#include "utils_regex.h"
 char regex_expect[MAX_INPUT_BUFFER] = "";
-regex_t preg;
+np_regex_t preg;
 regmatch_t pmatch[10];
 char errbuf[MAX_INPUT_BUFFER] = "";
-char perfstr[MAX_INPUT_BUFFER] = "| ";
+perf_buffer perfstr = PERF_BUFFER_INIT;
 int cflags = REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
 int eflags = 0;
 int errcode, excode;
@@ -149,10 +171,94 @@ int calculate_rate = 0;
 double offset = 0.0;
 int rate_multiplier = 1;
 state_data *previous_state;
+time_t current_time;
+double current_clock;
+double previous_clock;
 double *previous_value;
 size_t previous_size = OID_COUNT_STEP;
+
+/* What --rate keeps from one run to the next, followed by the value of
+ * each OID as a double. The state is read and written in one go. */
+typedef struct rate_state {
+	double clock;	/* np_clock() of the run */
+	uint32_t count;
+	uint32_t unused;
+} rate_state;
 int perf_labels = 1;
 char* ip_version = "";
+#if defined(HAVE_NETSNMP) && !defined(PATH_TO_SNMPGET)
+int use_native = TRUE;
+#else
+int use_native = FALSE;
+#endif
+char *targets_file = NULL;
+int sharded = FALSE;
+long changes_refresh = -1;	/* --changes */
+int table_mode = FALSE;
+/* --table-cache, with the columns kept in the state, NULL for all but the
+ * counters */
+int table_cache = FALSE;
+char *table_static = NULL;
+int concurrency = DEFAULT_CONCURRENCY;
+char *perf_prefix = NULL;
+#ifdef HAVE_NETSNMP
+double *native_value = NULL;
+int *native_numeric = NULL;
+/* the variables as rendered, one for each OID, when native_get() is asked to keep them */
+char **native_text = NULL;
+int cache_ttl = 0;
+/* --mib-index: the OIDs requested, and the names they are printed with */
+int mib_index = FALSE;
+char **native_oids = NULL;
+char **native_names = NULL;
+
+/* One agent polled with --targets */
+typedef struct snmp_target {
+	char *host;
+	char *port;
+	netsnmp_session *ss;
+	output out;
+	output err;
+	double *value;
+	int *numeric;
+	int return_code;
+	int done;
+	int result;
+	np_str message;
+	np_str mult_resp;
+	char *perf;
+} snmp_target;
+
+/* One column walked with --table. The values of all rows are kept side
+ * by side so the thresholds of a column are checked in one pass. */
+typedef struct snmp_column {
+	oid root[MAX_OID_LEN];
+	size_t root_len;
+	oid last[MAX_OID_LEN];
+	size_t last_len;
+	int done;
+	int counter;
+	double *value;
+	int *numeric;
+	char **text;
+	int *state;
+} snmp_column;
+
+int native_get (output *, output *);
+int cached_get (output *, output *);
+int check_targets (void);
+int check_table (void);
+#endif
+
+/* Seconds since the previous run. The monotonic clock does not jump with
+ * the wall clock, but it starts over when the host boots. */
+static double
+rate_duration (void)
+{
+	if (previous_clock > 0 && current_clock > previous_clock)
+		return current_clock - previous_clock;
+	return (double) (current_time - previous_state->time);
+}
 
 static char *fix_snmp_range(char *th)
 {
@@ -175,213 +281,34 @@ static char *fix_snmp_range(char *th)
 	return ret;
 }
 
-int
-main (int argc, char **argv)
+/* Evaluate the lines snmpget printed (or native_get() rendered) for each
+ * OID, appending to outbuff, mult_resp and perfstr. Returns the worst state
+ * and stores the number of OIDs seen in total_oids. */
+static int
+process_response (output *chld_out, np_str *outbuff, np_str *mult_resp, int *total_oids)
 {
-	int i, len, line, total_oids;
+	int i, line;
 	unsigned int bk_count = 0, dq_count = 0;
 	int iresult = STATE_UNKNOWN;
 	int result = STATE_UNKNOWN;
-	int return_code = 0;
-	int external_error = 0;
-	char **command_line = NULL;
-	char *cl_hidden_auth = NULL;
 	char *oidname = NULL;
 	char *response = NULL;
-	char *mult_resp = NULL;
-	char *outbuff;
 	char *ptr = NULL;
 	char *show = NULL;
-	char *th_warn=NULL;
-	char *th_crit=NULL;
 	char type[8] = "";
-	output chld_out, chld_err;
-	char *previous_string=NULL;
-	char *ap=NULL;
-	char *state_string=NULL;
-	size_t response_length, current_length, string_length;
 	char *temp_string=NULL;
-	char *quote_string=NULL;
-	time_t current_time;
 	double temp_double;
-	time_t duration;
+	double duration;
 	char *conv = "12345678";
 	int is_counter=0;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
-
-	labels = malloc (labels_size * sizeof(*labels));
-	unitv = malloc (unitv_size * sizeof(*unitv));
-	thlds = malloc (thlds_size * sizeof(*thlds));
-	response_value = malloc (response_size * sizeof(*response_value));
-	previous_value = malloc (previous_size * sizeof(*previous_value));
-	eval_method = calloc (eval_size, sizeof(*eval_method));
-	oids = calloc(oids_size, sizeof (char *));
-
-	label = strdup ("SNMP");
-	units = strdup ("");
-	port = strdup (DEFAULT_PORT);
-	outbuff = strdup ("");
-	delimiter = strdup (" = ");
-	output_delim = strdup (DEFAULT_OUTPUT_DELIMITER);
-	timeout_interval = DEFAULT_SOCKET_TIMEOUT;
-	retries = DEFAULT_RETRIES;
-
-	np_init( (char *) progname, argc, argv );
-
-	/* Parse extra opts if any */
-	argv=np_extra_opts (&argc, argv, progname);
-
-	np_set_args(argc, argv);
-
-	time(&current_time);
-
-	if (process_arguments (argc, argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
-
-	if(calculate_rate) {
-		if (!strcmp(label, "SNMP"))
-			label = strdup("SNMP RATE");
-		i=0;
-		previous_state = np_state_read();
-		if(previous_state!=NULL) {
-			/* Split colon separated values */
-			previous_string = strdup((char *) previous_state->data);
-			while((ap = strsep(&previous_string, ":")) != NULL) {
-				if(verbose>2)
-					printf("State for %d=%s\n", i, ap);
-				while (i >= previous_size) {
-					previous_size += OID_COUNT_STEP;
-					previous_value = realloc(previous_value, previous_size * sizeof(*previous_value));
-				}
-				previous_value[i++]=strtod(ap,NULL);
-			}
-		}
-	}
-
-	/* Populate the thresholds */
-	th_warn=warning_thresholds;
-	th_crit=critical_thresholds;
-	for (i=0; i<numoids; i++) {
-		char *w = th_warn ? strndup(th_warn, strcspn(th_warn, ",")) : NULL;
-		char *c = th_crit ? strndup(th_crit, strcspn(th_crit, ",")) : NULL;
-		/* translate "2:1" to "@1:2" for backwards compatibility */
-		w = w ? fix_snmp_range(w) : NULL;
-		c = c ? fix_snmp_range(c) : NULL;
-
-		while (i >= thlds_size) {
-			thlds_size += OID_COUNT_STEP;
-			thlds = realloc(thlds, thlds_size * sizeof(*thlds));
-		}
-
-		/* Skip empty thresholds, while avoiding segfault */
-		set_thresholds(&thlds[i],
-		               w ? strpbrk(w, NP_THRESHOLDS_CHARS) : NULL,
-		               c ? strpbrk(c, NP_THRESHOLDS_CHARS) : NULL);
-		if (w) {
-			th_warn=strchr(th_warn, ',');
-			if (th_warn) th_warn++;
-			free(w);
-		}
-		if (c) {
-			th_crit=strchr(th_crit, ',');
-			if (th_crit) th_crit++;
-			free(c);
-		}
-	}
-
-	/* Create the command array to execute */
-	if(usesnmpgetnext == TRUE) {
-		snmpcmd = strdup (PATH_TO_SNMPGETNEXT);
-	}else{
-		snmpcmd = strdup (PATH_TO_SNMPGET);
-	}
-
-	/* 10 arguments to pass before context and authpriv options + 1 for host and numoids. Add one for terminating NULL */
-	command_line = calloc (10 + numcontext + numauthpriv + 1 + numoids + 1, sizeof (char *));
-	command_line[0] = snmpcmd;
-	command_line[1] = strdup ("-Le");
-	command_line[2] = strdup ("-t");
-	xasprintf (&command_line[3], "%d", timeout_interval);
-	command_line[4] = strdup ("-r");
-	xasprintf (&command_line[5], "%d", retries);
-	command_line[6] = strdup ("-m");
-	command_line[7] = strdup (miblist);
-	command_line[8] = "-v";
-	command_line[9] = strdup (proto);
-
-	for (i = 0; i < numcontext; i++) {
-		command_line[10 + i] = contextargs[i];
-	}
-	
-	for (i = 0; i < numauthpriv; i++) {
-		command_line[10 + numcontext + i] = authpriv[i];
-	}
-
-	xasprintf (&command_line[10 + numcontext + numauthpriv], "%s:%s", server_address, port);
-
-	/* This is just for display purposes, so it can remain a string */
-	xasprintf(&cl_hidden_auth, "%s -Le -t %d -r %d -m %s -v %s %s %s %s:%s",
-		snmpcmd, timeout_interval, retries, strlen(miblist) ? miblist : "''", proto, "[context]", "[authpriv]",
-		server_address, port);
-
-	for (i = 0; i < numoids; i++) {
-		command_line[10 + numcontext + numauthpriv + 1 + i] = oids[i];
-		xasprintf(&cl_hidden_auth, "%s %s", cl_hidden_auth, oids[i]);	
-	}
-
-	command_line[10 + numcontext + numauthpriv + 1 + numoids] = NULL;
-
-	if (verbose)
-		printf ("%s\n", cl_hidden_auth);
-
-	/* Set signal handling and alarm */
-	if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR) {
-		usage4 (_("Cannot catch SIGALRM"));
-	}
-	alarm(timeout_interval * retries + 5);
-
-	/* Run the command */
-	return_code = cmd_run_array (command_line, &chld_out, &chld_err, 0);
-
-	/* disable alarm again */
-	alarm(0);
-
-	/* Due to net-snmp sometimes showing stderr messages with poorly formed MIBs,
-	   only return state unknown if return code is non zero or there is no stdout.
-	   Do this way so that if there is stderr, will get added to output, which helps problem diagnosis
-	*/
-	if (return_code != 0)
-		external_error=1;
-	if (chld_out.lines == 0)
-		external_error=1;
-	if (external_error) {
-		if (chld_err.lines > 0) {
-			printf (_("External command error: %s\n"), chld_err.line[0]);
-			for (i = 1; i < chld_err.lines; i++) {
-				printf ("%s\n", chld_err.line[i]);
-			}
-		} else {
-			printf(_("External command error with no output (return code: %d)\n"), return_code);
-		}
-		exit (STATE_UNKNOWN);
-	}
-
-	if (verbose) {
-		for (i = 0; i < chld_out.lines; i++) {
-			printf ("%s\n", chld_out.line[i]);
-		}
-	}
-
-	for (line=0, i=0; line < chld_out.lines; line++, i++) {
+	for (line=0, i=0; line < chld_out->lines; line++, i++) {
 		if(calculate_rate)
 			conv = "%.10g";
 		else
 			conv = "%.0f";
 
-		ptr = chld_out.line[line];
+		ptr = chld_out->line[line];
 		oidname = strpcpy (oidname, ptr, delimiter);
 		response = strstr (ptr, delimiter);
 		if (response == NULL)
@@ -394,6 +321,7 @@ main (int argc, char **argv)
 		/* Clean up type array - Sol10 does not necessarily zero it out */
 		bzero(type, sizeof(type));
 
+		/* the width of a counter, for its wraps */
 		is_counter=0;
 		/* We strip out the datatype indicator for PHBs */
 		if (strstr (response, "Gauge: ")) {
@@ -404,13 +332,13 @@ main (int argc, char **argv)
 		} 
 		else if (strstr (response, "Counter32: ")) {
 			show = strstr (response, "Counter32: ") + 11;
-			is_counter=1;
+			is_counter=32;
 			if(!calculate_rate) 
 				strcpy(type, "c");
 		}
 		else if (strstr (response, "Counter64: ")) {
 			show = strstr (response, "Counter64: ") + 11;
-			is_counter=1;
+			is_counter=64;
 			if(!calculate_rate)
 				strcpy(type, "c");
 		}
@@ -435,15 +363,14 @@ main (int argc, char **argv)
 
 			if (dq_count) { /* unfinished line */
 				/* copy show verbatim first */
-				if (!mult_resp) mult_resp = strdup("");
-				xasprintf (&mult_resp, "%s%s:\n%s\n", mult_resp, oids[i], show);
+				np_str_printf (mult_resp, "%s:\n%s\n", oids[i], show);
 				/* then strip out unmatched double-quote from single-line output */
 				if (show[0] == '"') show++;
 
 				/* Keep reading until we match end of double-quoted string */
-				for (line++; line < chld_out.lines; line++) {
-					ptr = chld_out.line[line];
-					xasprintf (&mult_resp, "%s%s\n", mult_resp, ptr);
+				for (line++; line < chld_out->lines; line++) {
+					ptr = chld_out->line[line];
+					np_str_printf (mult_resp, "%s\n", ptr);
 
 					COUNT_SEQ(ptr, bk_count, dq_count)
 					while (dq_count && ptr[0] != '\n' && ptr[0] != '\0') {
@@ -468,28 +395,34 @@ main (int argc, char **argv)
 		/* Process this block for numeric comparisons */
 		/* Make some special values,like Timeticks numeric only if a threshold is defined */
 		if (thlds[i]->warning || thlds[i]->critical || calculate_rate) {
-			ptr = strpbrk (show, "-0123456789");
-			if (ptr == NULL)
-				die (STATE_UNKNOWN,_("No valid data returned (%s)\n"), show);
 			while (i >= response_size) {
 				response_size += OID_COUNT_STEP;
 				response_value = realloc(response_value, response_size * sizeof(*response_value));
 			}
-			response_value[i] = strtod (ptr, NULL) + offset;
+#ifdef HAVE_NETSNMP
+			/* The native request already decoded numeric varbinds */
+			if (native_numeric != NULL && i < numoids && native_numeric[i])
+				response_value[i] = native_value[i] + offset;
+			else
+#endif
+			{
+				ptr = strpbrk (show, "-0123456789");
+				if (ptr == NULL)
+					die (STATE_UNKNOWN,_("No valid data returned (%s)\n"), show);
+				response_value[i] = np_strtod (ptr, NULL) + offset;
+			}
 
 			if(calculate_rate) {
 				if (previous_state!=NULL) {
-					duration = current_time-previous_state->time;
+					duration = rate_duration();
 					if(duration<=0)
 						die(STATE_UNKNOWN,_("Time duration between plugin calls is invalid"));
 					temp_double = response_value[i]-previous_value[i];
-					/* Simple overflow catcher (same as in rrdtool, rrd_update.c) */
-					if(is_counter) {
-						if(temp_double<(double)0.0)
-							temp_double+=(double)4294967296.0; /* 2^32 */
-						if(temp_double<(double)0.0)
-							temp_double+=(double)18446744069414584320.0; /* 2^64-2^32 */;
-					}
+					/* A counter that went back has wrapped around its width */
+					if(is_counter==32 && temp_double<(double)0.0)
+						temp_double+=(double)4294967296.0; /* 2^32 */
+					else if(is_counter==64 && temp_double<(double)0.0)
+						temp_double+=(double)18446744073709551616.0; /* 2^64 */
 					/* Convert to per second, then use multiplier */
 					temp_double = temp_double/duration*rate_multiplier;
 					iresult = get_status(temp_double, thlds[i]);
@@ -511,12 +444,12 @@ main (int argc, char **argv)
 
 		/* Process this block for regex matching */
 		else if (eval_size > i && eval_method[i] & CRIT_REGEX) {
-			excode = regexec (&preg, response, 10, pmatch, eflags);
+			excode = np_regexec (&preg, response, 10, pmatch, eflags);
 			if (excode == 0) {
 				iresult = (invert_search==0) ? STATE_OK : STATE_CRITICAL;
 			}
 			else if (excode != REG_NOMATCH) {
-				regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
+				np_regerror (excode, &preg, errbuf, MAX_INPUT_BUFFER);
 				printf (_("Execute Error: %s\n"), errbuf);
 				exit (STATE_CRITICAL);
 			}
@@ -541,164 +474,358 @@ main (int argc, char **argv)
 
 		/* Prepend a label for this OID if there is one */
 		if (nlabels >= (size_t)1 && (size_t)i < nlabels && labels[i] != NULL)
-			xasprintf (&outbuff, "%s%s%s %s%s%s", outbuff,
+			np_str_printf (outbuff, "%s%s %s%s%s",
 				(i == 0) ? " " : output_delim,
 				labels[i], mark (iresult), show, mark (iresult));
 		else
-			xasprintf (&outbuff, "%s%s%s%s%s", outbuff, (i == 0) ? " " : output_delim,
+			np_str_printf (outbuff, "%s%s%s%s", (i == 0) ? " " : output_delim,
 				mark (iresult), show, mark (iresult));
 
 		/* Append a unit string for this OID if there is one */
 		if (nunits > (size_t)0 && (size_t)i < nunits && unitv[i] != NULL)
-			xasprintf (&outbuff, "%s %s", outbuff, unitv[i]);
+			np_str_printf (outbuff, " %s", unitv[i]);
 
-		/* Write perfdata with whatever can be parsed by strtod, if possible */
+		/* Write perfdata with whatever can be parsed as a number, if possible */
 		ptr = NULL;
-		strtod(show, &ptr);
+		np_strtod(show, &ptr);
 		if (ptr > show) {
 			if (perf_labels && nlabels >= (size_t)1 && (size_t)i < nlabels && labels[i] != NULL)
 				temp_string=labels[i];
 			else
 				temp_string=oidname;
-			if (strpbrk (temp_string, " ='\"") == NULL) {
-				strncat(perfstr, temp_string, sizeof(perfstr)-strlen(perfstr)-1);
-			} else {
-				if (strpbrk (temp_string, "'") == NULL) {
-					quote_string="'";
-				} else {
-					quote_string="\"";
-				}
-				strncat(perfstr, quote_string, sizeof(perfstr)-strlen(perfstr)-1);
-				strncat(perfstr, temp_string, sizeof(perfstr)-strlen(perfstr)-1);
-				strncat(perfstr, quote_string, sizeof(perfstr)-strlen(perfstr)-1);
-			}
-			strncat(perfstr, "=", sizeof(perfstr)-strlen(perfstr)-1);
-			len = sizeof(perfstr)-strlen(perfstr)-1;
-			strncat(perfstr, show, len>ptr-show ? ptr-show : len);
+			if (perf_prefix)
+				xasprintf (&temp_string, "%s:%s", perf_prefix, temp_string);
+			perf_label(&perfstr, temp_string);
+			perf_append(&perfstr, show, ptr-show);
 
 			if (warning_thresholds) {
-				strncat(perfstr, ";", sizeof(perfstr)-strlen(perfstr)-1);
-				strncat(perfstr, warning_thresholds, sizeof(perfstr)-strlen(perfstr)-1);
+				perf_append(&perfstr, ";", 1);
+				perf_puts(&perfstr, warning_thresholds);
 			}
 
 			if (critical_thresholds) {
 				if (!warning_thresholds)
-					strncat(perfstr, ";", sizeof(perfstr)-strlen(perfstr)-1);
-				strncat(perfstr, ";", sizeof(perfstr)-strlen(perfstr)-1);
-				strncat(perfstr, critical_thresholds, sizeof(perfstr)-strlen(perfstr)-1);
+					perf_append(&perfstr, ";", 1);
+				perf_append(&perfstr, ";", 1);
+				perf_puts(&perfstr, critical_thresholds);
 			}
 
 			if (type)
-				strncat(perfstr, type, sizeof(perfstr)-strlen(perfstr)-1);
-			strncat(perfstr, " ", sizeof(perfstr)-strlen(perfstr)-1);
-		}
-	}
-	total_oids=i;
-
-	/* Save state data, as all data collected now */
-	if(calculate_rate) {
-		string_length=1024;
-		state_string=malloc(string_length);
-		if(state_string==NULL)
-			die(STATE_UNKNOWN, _("Cannot malloc"));
-		
-		current_length=0;
-		for(i=0; i<total_oids; i++) {
-			xasprintf(&temp_string,"%.0f",response_value[i]);
-			if(temp_string==NULL)
-				die(STATE_UNKNOWN,_("Cannot asprintf()"));
-			response_length = strlen(temp_string);
-			if(current_length+response_length>string_length) {
-				string_length=current_length+1024;
-				state_string=realloc(state_string,string_length);
-				if(state_string==NULL)
-					die(STATE_UNKNOWN, _("Cannot realloc()"));
-			}
-			strcpy(&state_string[current_length],temp_string);
-			current_length=current_length+response_length;
-			state_string[current_length]=':';
-			current_length++;
-			free(temp_string);
-		}
-		state_string[--current_length]='\0';
-		if (verbose > 2)
-			printf("State string=%s\n",state_string);
-		
-		/* This is not strictly the same as time now, but any subtle variations will cancel out */
-		np_state_write_string(current_time, state_string );
-		if(previous_state==NULL) {
-			/* Or should this be highest state? */
-			die( STATE_OK, _("No previous data to calculate rate - assume okay" ) );
+				perf_puts(&perfstr, type);
 		}
 	}
-
-	printf ("%s %s -%s %s\n", label, state_text (result), outbuff, perfstr);
-	if (mult_resp) printf ("%s", mult_resp);
+	*total_oids=i;
 
 	return result;
 }
 
 
 
-/* process command-line arguments */
 int
-process_arguments (int argc, char **argv)
+main (int argc, char **argv)
 {
-	char *ptr;
-	int c = 1;
-	int j = 0, jj = 0, ii = 0;
-
-	int option = 0;
-	static struct option longopts[] = {
-		STD_LONG_OPTS,
-		{"community", required_argument, 0, 'C'},
-		{"oid", required_argument, 0, 'o'},
-		{"object", required_argument, 0, 'o'},
-		{"delimiter", required_argument, 0, 'd'},
-		{"output-delimiter", required_argument, 0, 'D'},
-		{"string", required_argument, 0, 's'},
-		{"timeout", required_argument, 0, 't'},
-		{"regex", required_argument, 0, 'r'},
-		{"ereg", required_argument, 0, 'r'},
-		{"eregi", required_argument, 0, 'R'},
-		{"label", required_argument, 0, 'l'},
-		{"units", required_argument, 0, 'u'},
-		{"port", required_argument, 0, 'p'},
-		{"retries", required_argument, 0, 'e'},
-		{"miblist", required_argument, 0, 'm'},
-		{"protocol", required_argument, 0, 'P'},
-		{"context", required_argument, 0, 'N'},
-		{"seclevel", required_argument, 0, 'L'},
-		{"secname", required_argument, 0, 'U'},
-		{"authproto", required_argument, 0, 'a'},
-		{"privproto", required_argument, 0, 'x'},
-		{"authpasswd", required_argument, 0, 'A'},
-		{"privpasswd", required_argument, 0, 'X'},
-		{"next", no_argument, 0, 'n'},
-		{"rate", no_argument, 0, L_CALCULATE_RATE},
-		{"rate-multiplier", required_argument, 0, L_RATE_MULTIPLIER},
-		{"offset", required_argument, 0, L_OFFSET},
-		{"invert-search", no_argument, 0, L_INVERT_SEARCH},
-		{"perf-oids", no_argument, 0, 'O'},
-		{"ipv4", no_argument, 0, '4'},
-		{"ipv6", no_argument, 0, '6'},
-		{0, 0, 0, 0}
-	};
+	int i, total_oids;
+	int result = STATE_UNKNOWN;
+	int return_code = 0;
+	int external_error = 0;
+#ifdef PATH_TO_SNMPGET
+	char **command_line = NULL;
+	char *cl_hidden_auth = NULL;
+#endif
+	np_str mult_resp = NP_STR_INIT;
+	np_str outbuff = NP_STR_INIT;
+	char *th_warn=NULL;
+	char *th_crit=NULL;
+	output chld_out, chld_err;
+	rate_state *state = NULL;
+	size_t state_length;
 
-	if (argc < 2)
-		return ERROR;
+	np_locale_init ();
 
-	/* reverse compatibility for very old non-POSIX usage forms */
-	for (c = 1; c < argc; c++) {
-		if (strcmp ("-to", argv[c]) == 0)
-			strcpy (argv[c], "-t");
-		if (strcmp ("-wv", argv[c]) == 0)
-			strcpy (argv[c], "-w");
-		if (strcmp ("-cv", argv[c]) == 0)
-			strcpy (argv[c], "-c");
-	}
+	labels = malloc (labels_size * sizeof(*labels));
+	unitv = malloc (unitv_size * sizeof(*unitv));
+	thlds = malloc (thlds_size * sizeof(*thlds));
+	response_value = malloc (response_size * sizeof(*response_value));
+	previous_value = malloc (previous_size * sizeof(*previous_value));
+	eval_method = calloc (eval_size, sizeof(*eval_method));
+	oids = calloc(oids_size, sizeof (char *));
 
-	while (1) {
+	label = strdup ("SNMP");
+	units = strdup ("");
+	port = strdup (DEFAULT_PORT);
+	delimiter = strdup (" = ");
+	output_delim = strdup (DEFAULT_OUTPUT_DELIMITER);
+	timeout_interval = DEFAULT_SOCKET_TIMEOUT;
+	retries = DEFAULT_RETRIES;
+
+	np_init( (char *) progname, argc, argv );
+
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
+
+	np_set_args(argc, argv);
+
+	time(&current_time);
+	current_clock = np_clock ();
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	if(calculate_rate) {
+		if (!strcmp(label, "SNMP"))
+			label = strdup("SNMP RATE");
+		previous_state = np_state_read();
+		state = previous_state ? previous_state->data : NULL;
+		/* a value for every OID, or no previous state */
+		if(state!=NULL && ((size_t)previous_state->length < sizeof(*state) ||
+		   state->count != (uint32_t)numoids ||
+		   (size_t)previous_state->length != sizeof(*state) + state->count * sizeof(double)))
+			previous_state = NULL;
+		if(previous_state!=NULL) {
+			while (state->count > previous_size) {
+				previous_size += OID_COUNT_STEP;
+				previous_value = realloc(previous_value, previous_size * sizeof(*previous_value));
+				if(previous_value==NULL)
+					die(STATE_UNKNOWN, _("Cannot realloc()"));
+			}
+			memcpy(previous_value, state + 1, state->count * sizeof(double));
+			previous_clock = state->clock;
+			if(verbose>2)
+				for(i=0; i<numoids; i++)
+					printf("State for %d=%.0f\n", i, previous_value[i]);
+		}
+	}
+
+	/* Populate the thresholds */
+	th_warn=warning_thresholds;
+	th_crit=critical_thresholds;
+	for (i=0; i<numoids; i++) {
+		char *w = th_warn ? strndup(th_warn, strcspn(th_warn, ",")) : NULL;
+		char *c = th_crit ? strndup(th_crit, strcspn(th_crit, ",")) : NULL;
+		/* translate "2:1" to "@1:2" for backwards compatibility */
+		w = w ? fix_snmp_range(w) : NULL;
+		c = c ? fix_snmp_range(c) : NULL;
+
+		while (i >= thlds_size) {
+			thlds_size += OID_COUNT_STEP;
+			thlds = realloc(thlds, thlds_size * sizeof(*thlds));
+		}
+
+		/* Skip empty thresholds, while avoiding segfault */
+		set_thresholds(&thlds[i],
+		               w ? strpbrk(w, NP_THRESHOLDS_CHARS) : NULL,
+		               c ? strpbrk(c, NP_THRESHOLDS_CHARS) : NULL);
+		if (w) {
+			th_warn=strchr(th_warn, ',');
+			if (th_warn) th_warn++;
+			free(w);
+		}
+		if (c) {
+			th_crit=strchr(th_crit, ',');
+			if (th_crit) th_crit++;
+			free(c);
+		}
+	}
+
+#ifdef HAVE_NETSNMP
+	if (targets_file != NULL)
+		return check_targets ();
+	if (table_mode)
+		return check_table ();
+#endif
+
+#ifdef PATH_TO_SNMPGET
+	/* Create the command array to execute */
+	if(usesnmpgetnext == TRUE) {
+		snmpcmd = strdup (PATH_TO_SNMPGETNEXT);
+	}else{
+		snmpcmd = strdup (PATH_TO_SNMPGET);
+	}
+
+	/* 10 arguments to pass before context and authpriv options + 1 for host and numoids. Add one for terminating NULL */
+	command_line = calloc (10 + numcontext + numauthpriv + 1 + numoids + 1, sizeof (char *));
+	command_line[0] = snmpcmd;
+	command_line[1] = strdup ("-Le");
+	command_line[2] = strdup ("-t");
+	xasprintf (&command_line[3], "%d", timeout_interval);
+	command_line[4] = strdup ("-r");
+	xasprintf (&command_line[5], "%d", retries);
+	command_line[6] = strdup ("-m");
+	command_line[7] = strdup (miblist);
+	command_line[8] = "-v";
+	command_line[9] = strdup (proto);
+
+	for (i = 0; i < numcontext; i++) {
+		command_line[10 + i] = contextargs[i];
+	}
+	
+	for (i = 0; i < numauthpriv; i++) {
+		command_line[10 + numcontext + i] = authpriv[i];
+	}
+
+	xasprintf (&command_line[10 + numcontext + numauthpriv], "%s:%s", server_address, port);
+
+	/* This is just for display purposes, so it can remain a string */
+	xasprintf(&cl_hidden_auth, "%s -Le -t %d -r %d -m %s -v %s %s %s %s:%s",
+		snmpcmd, timeout_interval, retries, strlen(miblist) ? miblist : "''", proto, "[context]", "[authpriv]",
+		server_address, port);
+
+	for (i = 0; i < numoids; i++) {
+		command_line[10 + numcontext + numauthpriv + 1 + i] = oids[i];
+		xasprintf(&cl_hidden_auth, "%s %s", cl_hidden_auth, oids[i]);	
+	}
+
+	command_line[10 + numcontext + numauthpriv + 1 + numoids] = NULL;
+
+	if (verbose && use_native == FALSE)
+		printf ("%s\n", cl_hidden_auth);
+#endif
+
+	/* Set signal handling and alarm */
+	if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR) {
+		usage4 (_("Cannot catch SIGALRM"));
+	}
+	alarm(timeout_interval * retries + 5);
+
+	/* Run the command, or do the request ourselves */
+#ifdef HAVE_NETSNMP
+	if (use_native == TRUE && cache_ttl > 0)
+		return_code = cached_get (&chld_out, &chld_err);
+	else if (use_native == TRUE)
+		return_code = native_get (&chld_out, &chld_err);
+#endif
+#ifdef PATH_TO_SNMPGET
+	if (use_native == FALSE)
+		return_code = cmd_run_array (command_line, &chld_out, &chld_err, 0);
+#endif
+
+	/* disable alarm again */
+	alarm(0);
+
+	/* Due to net-snmp sometimes showing stderr messages with poorly formed MIBs,
+	   only return state unknown if return code is non zero or there is no stdout.
+	   Do this way so that if there is stderr, will get added to output, which helps problem diagnosis
+	*/
+	if (return_code != 0)
+		external_error=1;
+	if (chld_out.lines == 0)
+		external_error=1;
+	if (external_error) {
+		if (chld_err.lines > 0) {
+			printf (_("External command error: %s\n"), chld_err.line[0]);
+			for (i = 1; i < chld_err.lines; i++) {
+				printf ("%s\n", chld_err.line[i]);
+			}
+		} else {
+			printf(_("External command error with no output (return code: %d)\n"), return_code);
+		}
+		exit (STATE_UNKNOWN);
+	}
+
+	if (verbose) {
+		for (i = 0; i < chld_out.lines; i++) {
+			printf ("%s\n", chld_out.line[i]);
+		}
+	}
+
+	result = process_response (&chld_out, &outbuff, &mult_resp, &total_oids);
+
+	/* Save state data, as all data collected now */
+	if(calculate_rate) {
+		state_length=sizeof(*state)+total_oids*sizeof(double);
+		state=calloc(1, state_length);
+		if(state==NULL)
+			die(STATE_UNKNOWN, _("Cannot malloc"));
+		state->clock=current_clock;
+		state->count=total_oids;
+		memcpy(state+1, response_value, total_oids*sizeof(double));
+
+		/* This is not strictly the same as time now, but any subtle variations will cancel out */
+		np_state_write_binary(current_time, state, state_length);
+		free(state);
+		if(previous_state==NULL) {
+			/* Or should this be highest state? */
+			die( STATE_OK, _("No previous data to calculate rate - assume okay" ) );
+		}
+	}
+
+	printf ("%s %s -%s | %s%s\n", label, state_text (result), np_str_string (&outbuff),
+	        perf_string (&perfstr), perfstr.len ? " " : "");
+	printf ("%s", np_str_string (&mult_resp));
+
+	return result;
+}
+
+
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	char *ptr;
+	int c = 1;
+	int j = 0, jj = 0, ii = 0;
+
+	int option = 0;
+	static struct option longopts[] = {
+		STD_LONG_OPTS,
+		{"community", required_argument, 0, 'C'},
+		{"oid", required_argument, 0, 'o'},
+		{"object", required_argument, 0, 'o'},
+		{"delimiter", required_argument, 0, 'd'},
+		{"output-delimiter", required_argument, 0, 'D'},
+		{"string", required_argument, 0, 's'},
+		{"timeout", required_argument, 0, 't'},
+		{"regex", required_argument, 0, 'r'},
+		{"ereg", required_argument, 0, 'r'},
+		{"eregi", required_argument, 0, 'R'},
+		{"label", required_argument, 0, 'l'},
+		{"units", required_argument, 0, 'u'},
+		{"port", required_argument, 0, 'p'},
+		{"retries", required_argument, 0, 'e'},
+		{"miblist", required_argument, 0, 'm'},
+		{"protocol", required_argument, 0, 'P'},
+		{"context", required_argument, 0, 'N'},
+		{"seclevel", required_argument, 0, 'L'},
+		{"secname", required_argument, 0, 'U'},
+		{"authproto", required_argument, 0, 'a'},
+		{"privproto", required_argument, 0, 'x'},
+		{"authpasswd", required_argument, 0, 'A'},
+		{"privpasswd", required_argument, 0, 'X'},
+		{"next", no_argument, 0, 'n'},
+		{"rate", no_argument, 0, L_CALCULATE_RATE},
+		{"rate-multiplier", required_argument, 0, L_RATE_MULTIPLIER},
+		{"offset", required_argument, 0, L_OFFSET},
+		{"invert-search", no_argument, 0, L_INVERT_SEARCH},
+		{"perf-oids", no_argument, 0, 'O'},
+		{"ipv4", no_argument, 0, '4'},
+		{"ipv6", no_argument, 0, '6'},
+		{"native", no_argument, 0, L_NATIVE},
+		{"targets", required_argument, 0, L_TARGETS},
+		{"shard", required_argument, 0, L_SHARD},
+		{"changes", optional_argument, 0, L_CHANGES},
+		{"concurrency", required_argument, 0, L_CONCURRENCY},
+		{"table", no_argument, 0, L_TABLE},
+		{"table-cache", optional_argument, 0, L_TABLE_CACHE},
+		{"cache", required_argument, 0, L_CACHE},
+		{"mib-index", no_argument, 0, L_MIB_INDEX},
+		{0, 0, 0, 0}
+	};
+
+	if (argc < 2)
+		return ERROR;
+
+	/* reverse compatibility for very old non-POSIX usage forms */
+	for (c = 1; c < argc; c++) {
+		if (strcmp ("-to", argv[c]) == 0)
+			strcpy (argv[c], "-t");
+		if (strcmp ("-wv", argv[c]) == 0)
+			strcpy (argv[c], "-w");
+		if (strcmp ("-cv", argv[c]) == 0)
+			strcpy (argv[c], "-c");
+	}
+
+	while (1) {
 		c = getopt_long (argc, argv, "nhvVO46t:c:w:H:C:o:e:E:d:D:s:t:R:r:l:u:p:m:P:N:L:U:a:x:A:X:",
 									 longopts, &option);
 
@@ -827,9 +954,9 @@ process_arguments (int argc, char **argv)
 			cflags |= REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
 			strncpy (regex_expect, optarg, sizeof (regex_expect) - 1);
 			regex_expect[sizeof (regex_expect) - 1] = 0;
-			errcode = regcomp (&preg, regex_expect, cflags);
+			errcode = np_regcomp (&preg, regex_expect, cflags);
 			if (errcode != 0) {
-				regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
+				np_regerror (errcode, &preg, errbuf, MAX_INPUT_BUFFER);
 				printf (_("Could Not Compile Regular Expression"));
 				return ERROR;
 			}
@@ -908,7 +1035,7 @@ process_arguments (int argc, char **argv)
 			break;
 		case L_CALCULATE_RATE:
 			if(calculate_rate==0)
-				np_enable_state(NULL, 1);
+				np_enable_state(NULL, RATE_STATE_VERSION);
 			calculate_rate = 1;
 			break;
 		case L_RATE_MULTIPLIER:
@@ -924,6 +1051,82 @@ process_arguments (int argc, char **argv)
 		case 'O':
 			perf_labels=0;
 			break;
+		case L_NATIVE:
+#ifdef HAVE_NETSNMP
+			use_native = TRUE;
+#else
+			usage4 (_("check_snmp was built without the Net-SNMP library"));
+#endif
+			break;
+		case L_TARGETS:
+#ifdef HAVE_NETSNMP
+			targets_file = optarg;
+			use_native = TRUE;
+#else
+			usage4 (_("check_snmp was built without the Net-SNMP library"));
+#endif
+			break;
+		case L_CHANGES:
+			changes_refresh = DEFAULT_CHANGES_REFRESH;
+			if (optarg != NULL) {
+				if (!is_integer (optarg) || atol (optarg) < 0)
+					usage2 (_("The full report interval must be a number of seconds"), optarg);
+				changes_refresh = atol (optarg);
+			}
+			break;
+		case L_SHARD:
+			if (np_targets_shard (optarg) == ERROR)
+				usage2 (_("Shard must be I/N, I from 1 to N"), optarg);
+			sharded = TRUE;
+			break;
+		case L_TABLE:
+#ifdef HAVE_NETSNMP
+			table_mode = TRUE;
+			use_native = TRUE;
+#else
+			usage4 (_("check_snmp was built without the Net-SNMP library"));
+#endif
+			break;
+		case L_TABLE_CACHE:
+#ifdef HAVE_NETSNMP
+			if (optarg != NULL && optarg[strspn (optarg, "0123456789,")] != '\0')
+				usage2 (_("Columns must be a comma separated list of numbers"), optarg);
+			if (!table_cache)
+				np_enable_state (NULL, TABLE_STATE_VERSION);
+			table_cache = TRUE;
+			table_static = optarg;
+			table_mode = TRUE;
+			use_native = TRUE;
+#else
+			usage4 (_("check_snmp was built without the Net-SNMP library"));
+#endif
+			break;
+		case L_CACHE:
+#ifdef HAVE_NETSNMP
+			if (!is_intpos (optarg))
+				usage4 (_("Cache time must be a positive integer"));
+			cache_ttl = atoi (optarg);
+			use_native = TRUE;
+#else
+			usage4 (_("check_snmp was built without the Net-SNMP library"));
+#endif
+			break;
+		case L_MIB_INDEX:
+#ifdef HAVE_NETSNMP
+			mib_index = TRUE;
+			use_native = TRUE;
+#else
+			usage4 (_("check_snmp was built without the Net-SNMP library"));
+#endif
+			break;
+		case L_CONCURRENCY:
+			if (!is_intpos (optarg))
+				usage4 (_("Concurrency must be a positive integer"));
+			concurrency = atoi (optarg);
+			/* libnetsnmp waits on an fd_set */
+			if (concurrency >= FD_SETSIZE)
+				die (STATE_UNKNOWN, _("Concurrency must be below %d\n"), FD_SETSIZE);
+			break;
 		case '4':
 			break;
 		case '6':
@@ -977,9 +1180,23 @@ validate_arguments ()
 	}
 
 	/* Check server_address is given */
-	if (server_address == NULL)
+	if ((sharded || changes_refresh >= 0) && targets_file == NULL)
+		usage4 (_("--shard and --changes need --targets"));
+	if (server_address == NULL && targets_file == NULL)
 		die(STATE_UNKNOWN, _("No host specified\n"));
 
+	if (targets_file != NULL && calculate_rate)
+		usage4 (_("--rate is not supported together with --targets"));
+
+	if (table_mode && (targets_file != NULL || calculate_rate))
+		usage4 (_("--table cannot be combined with --targets or --rate"));
+
+#ifdef HAVE_NETSNMP
+	/* a rate needs values measured when it is taken */
+	if (cache_ttl > 0 && (targets_file != NULL || table_mode || calculate_rate))
+		usage4 (_("--cache cannot be combined with --targets, --table or --rate"));
+#endif
+
 	/* Check oid is given */
 	if (numoids == 0)
 		die(STATE_UNKNOWN, _("No OIDs specified\n"));
@@ -1070,6 +1287,1211 @@ validate_arguments ()
 
 
 
+#ifdef HAVE_NETSNMP
+/* Append len bytes of str to the buffer of an output struct */
+static void
+native_append (output *op, const char *str, size_t len)
+{
+	op->buf = realloc (op->buf, op->buflen + len + 1);
+	if (op->buf == NULL)
+		die (STATE_UNKNOWN, _("Cannot realloc()"));
+	memcpy (op->buf + op->buflen, str, len);
+	op->buflen += len;
+	op->buf[op->buflen] = '\0';
+}
+
+static void
+native_appendf (output *op, const char *fmt, ...)
+{
+	va_list ap;
+	char *str = NULL;
+
+	va_start (ap, fmt);
+	if (vasprintf (&str, fmt, ap) < 0)
+		die (STATE_UNKNOWN, _("Cannot asprintf()"));
+	va_end (ap);
+	native_append (op, str, strlen (str));
+	free (str);
+}
+
+/* Split the buffer into lines the same way cmd_run_array() does */
+static void
+native_index (output *op)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < op->buflen; i++)
+		if (op->buf[i] == '\n')
+			n++;
+	if (op->buflen && op->buf[op->buflen - 1] != '\n')
+		n++;
+
+	op->line = calloc (n ? n : 1, sizeof (char *));
+	op->lens = calloc (n ? n : 1, sizeof (size_t));
+	if (op->line == NULL || op->lens == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+
+	op->lines = 0;
+	for (i = 0; i < op->buflen; i++) {
+		op->line[op->lines] = &op->buf[i];
+		while (i < op->buflen && op->buf[i] != '\n')
+			i++;
+		op->buf[i] = '\0';
+		op->lens[op->lines] = &op->buf[i] - op->line[op->lines];
+		op->lines++;
+	}
+}
+
+/* Keep the decoded value of integer-like varbinds, so thresholds need not
+ * parse it back out of the text. Values with a DISPLAY-HINT are left to the
+ * text path since snmpget would print them scaled. */
+static void
+native_decode (double *value, int *numeric, netsnmp_variable_list *vars)
+{
+	struct tree *tp;
+
+	*numeric = 0;
+	tp = get_tree (vars->name, vars->name_length, get_tree_head ());
+	if (tp != NULL && tp->hint != NULL)
+		return;
+
+	switch (vars->type) {
+	case ASN_INTEGER:
+		*value = (double) *vars->val.integer;
+		break;
+	case ASN_GAUGE:
+	case ASN_COUNTER:
+	case ASN_TIMETICKS:
+	case ASN_UINTEGER:
+		*value = (double) (unsigned long) *vars->val.integer;
+		break;
+	case ASN_COUNTER64:
+		*value = (double) vars->val.counter64->high * 4294967296.0
+			+ (double) vars->val.counter64->low;
+		break;
+	default:
+		return;
+	}
+	*numeric = 1;
+}
+
+/* Fill in a session for peer from the command line arguments */
+static void
+native_session (netsnmp_session *session, char *peer)
+{
+	snmp_sess_init (session);
+	session->peername = peer;
+	session->timeout = timeout_interval * 1000000L;
+	session->retries = retries;
+
+	if (strcmp (proto, "1") == 0 || strcmp (proto, "2c") == 0) {
+		session->version = (strcmp (proto, "1") == 0) ? SNMP_VERSION_1 : SNMP_VERSION_2c;
+		session->community = (u_char *) community;
+		session->community_len = strlen (community);
+		return;
+	}
+
+	session->version = SNMP_VERSION_3;
+	session->securityName = secname;
+	session->securityNameLen = strlen (secname);
+	if (context) {
+		session->contextName = context;
+		session->contextNameLen = strlen (context);
+	}
+
+	if (strcmp (seclevel, "noAuthNoPriv") == 0)
+		session->securityLevel = SNMP_SEC_LEVEL_NOAUTH;
+	else if (strcmp (seclevel, "authNoPriv") == 0)
+		session->securityLevel = SNMP_SEC_LEVEL_AUTHNOPRIV;
+	else
+		session->securityLevel = SNMP_SEC_LEVEL_AUTHPRIV;
+
+	if (session->securityLevel != SNMP_SEC_LEVEL_NOAUTH) {
+		if (strcasecmp (authproto, "MD5") == 0) {
+			session->securityAuthProto = usmHMACMD5AuthProtocol;
+			session->securityAuthProtoLen = USM_AUTH_PROTO_MD5_LEN;
+		} else if (strcasecmp (authproto, "SHA") == 0) {
+			session->securityAuthProto = usmHMACSHA1AuthProtocol;
+			session->securityAuthProtoLen = USM_AUTH_PROTO_SHA_LEN;
+		} else
+			usage2 (_("Invalid authproto"), authproto);
+
+		session->securityAuthKeyLen = USM_AUTH_KU_LEN;
+		if (generate_Ku (session->securityAuthProto, session->securityAuthProtoLen,
+		                 (u_char *) authpasswd, strlen (authpasswd),
+		                 session->securityAuthKey, &session->securityAuthKeyLen) != SNMPERR_SUCCESS)
+			die (STATE_UNKNOWN, _("Could not generate the SNMPv3 authentication key\n"));
+	}
+
+	if (session->securityLevel == SNMP_SEC_LEVEL_AUTHPRIV) {
+		if (strcasecmp (privproto, "DES") == 0) {
+			session->securityPrivProto = usmDESPrivProtocol;
+			session->securityPrivProtoLen = USM_PRIV_PROTO_DES_LEN;
+		} else if (strcasecmp (privproto, "AES") == 0) {
+			session->securityPrivProto = usmAESPrivProtocol;
+			session->securityPrivProtoLen = USM_PRIV_PROTO_AES_LEN;
+		} else
+			usage2 (_("Invalid privproto"), privproto);
+
+		session->securityPrivKeyLen = USM_PRIV_KU_LEN;
+		if (generate_Ku (session->securityAuthProto, session->securityAuthProtoLen,
+		                 (u_char *) privpasswd, strlen (privpasswd),
+		                 session->securityPrivKey, &session->securityPrivKeyLen) != SNMPERR_SUCCESS)
+			die (STATE_UNKNOWN, _("Could not generate the SNMPv3 privacy key\n"));
+	}
+}
+
+/* Load the MIBs, or with --mib-index look the OIDs up in the index and
+ * load none if all of them are there */
+static void
+native_init (void)
+{
+	if (mib_index && np_snmp_mib_index (miblist, oids, numoids, &native_oids, &native_names)) {
+		if (verbose)
+			printf ("%d OIDs from the MIB index, no MIBs loaded\n", numoids);
+		np_snmp_init ("");
+		return;
+	}
+	native_oids = native_names = NULL;
+	np_snmp_init (miblist);
+}
+
+/* Move the messages snmputils.c worded to err */
+static void
+native_errors (output *err, char *errors)
+{
+	if (errors == NULL)
+		return;
+	native_append (err, errors, strlen (errors));
+	free (errors);
+}
+
+/* Build the GET or GETNEXT request for all oids[]. Returns NULL after
+ * writing snmpget's message to err if an OID cannot be parsed. */
+static netsnmp_pdu *
+native_pdu (output *err)
+{
+	netsnmp_pdu *pdu;
+	char *errors = NULL;
+
+	pdu = np_snmp_pdu (usesnmpgetnext ? SNMP_MSG_GETNEXT : SNMP_MSG_GET,
+	                   native_oids ? native_oids : oids, numoids, &errors);
+	native_errors (err, errors);
+	return pdu;
+}
+
+/* Render the outcome of a request the way snmpget would print it and return
+ * its exit status. value and numeric take the decoded varbinds. */
+static int
+native_response (int status, netsnmp_session *ss, netsnmp_pdu *response,
+                 output *out, output *err, double *value, int *numeric)
+{
+	netsnmp_variable_list *vars;
+	u_char *vbuf = NULL;
+	size_t vbuf_len = 0, vout_len;
+	char *errors = NULL;
+	int i, ret = 0;
+
+	if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOERROR) {
+		for (i = 0, vars = response->variables; vars; vars = vars->next_variable, i++) {
+			vout_len = 0;
+			/* without the MIBs the name comes from the index */
+			if (native_names != NULL && !usesnmpgetnext && i < numoids && native_names[i] != NULL) {
+				if (snmp_strcat (&vbuf, &vbuf_len, &vout_len, 1, (u_char *) native_names[i]) == 0 ||
+				    snmp_strcat (&vbuf, &vbuf_len, &vout_len, 1, (const u_char *) " = ") == 0 ||
+				    sprint_realloc_value (&vbuf, &vbuf_len, &vout_len, 1,
+				                          vars->name, vars->name_length, vars) == 0)
+					die (STATE_UNKNOWN, _("Cannot realloc()"));
+			} else if (sprint_realloc_variable (&vbuf, &vbuf_len, &vout_len, 1,
+			                                    vars->name, vars->name_length, vars) == 0)
+				die (STATE_UNKNOWN, _("Cannot realloc()"));
+			native_append (out, (char *) vbuf, vout_len);
+			native_append (out, "\n", 1);
+			if (i < numoids)
+				native_decode (&value[i], &numeric[i], vars);
+			if (native_text != NULL && i < numoids &&
+			    (native_text[i] = strndup ((char *) vbuf, vout_len)) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		}
+	} else {
+		ret = np_snmp_error (status, ss, response, &errors);
+		native_errors (err, errors);
+	}
+
+	free (vbuf);
+	return ret;
+}
+
+/* Fetch all oids[] with a single request through libnetsnmp. The text
+ * written to out and err is what snmpget or snmpgetnext would have printed,
+ * and the return value mirrors their exit status. */
+int
+native_get (output *out, output *err)
+{
+	netsnmp_session session, *ss;
+	netsnmp_pdu *pdu, *response = NULL;
+	char *peer = NULL;
+	char *liberr = NULL;
+	int status, ret, engine;
+
+	memset (out, 0, sizeof (output));
+	memset (err, 0, sizeof (output));
+
+	native_value = calloc (numoids, sizeof (*native_value));
+	native_numeric = calloc (numoids, sizeof (*native_numeric));
+	if (native_value == NULL || native_numeric == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+
+	native_init ();
+	xasprintf (&peer, "%s%s:%s", ip_version, server_address, port);
+	native_session (&session, peer);
+
+	engine = np_snmp_engine_load (&session, peer);
+
+	if (verbose)
+		printf ("libnetsnmp %s request for %d OIDs to %s%s\n",
+		        usesnmpgetnext ? "GETNEXT" : "GET", numoids, session.peername,
+		        engine ? ", SNMPv3 engine from the last run" : "");
+
+	while (1) {
+		if ((pdu = native_pdu (err)) == NULL) {
+			native_index (err);
+			return 1;
+		}
+
+		ss = snmp_open (&session);
+		if (ss == NULL) {
+			snmp_error (&session, NULL, NULL, &liberr);
+			native_appendf (err, "snmpget: %s\n", liberr);
+			free (liberr);
+			snmp_free_pdu (pdu);
+			native_index (err);
+			return 1;
+		}
+
+		status = snmp_synch_response (ss, pdu, &response);
+		/* the agent rebooted or is another one now, so learn it again */
+		if (!engine || status != STAT_ERROR || !np_snmp_engine_stale (ss))
+			break;
+		if (verbose)
+			printf ("SNMPv3 engine of %s changed, discovering it again\n", peer);
+		if (response)
+			snmp_free_pdu (response);
+		response = NULL;
+		snmp_close (ss);
+		np_snmp_engine_forget (&session);
+		engine = FALSE;
+	}
+	ret = native_response (status, ss, response, out, err, native_value, native_numeric);
+	if (status == STAT_SUCCESS)
+		np_snmp_engine_save (ss, &session, peer);
+
+	if (response)
+		snmp_free_pdu (response);
+	snmp_close (ss);
+
+	native_index (out);
+	native_index (err);
+	return ret;
+}
+
+/* What the answers of the agent depend on. The secrets only go in hashed,
+ * the key ends up in the cache file. */
+static char *
+cache_key (void)
+{
+	char *key = NULL, *secrets = NULL;
+
+	xasprintf (&secrets, "%s|%s|%s", community ? community : "",
+	           authpasswd ? authpasswd : "", privpasswd ? privpasswd : "");
+	xasprintf (&key, "%s%s:%s|%s|%s|%s|%s|%s|%s|%s|%016llx", ip_version, server_address, port,
+	           proto, seclevel ? seclevel : "", secname ? secname : "",
+	           context ? context : "", authproto ? authproto : "",
+	           privproto ? privproto : "", miblist, np_snmp_cache_hash (secrets));
+	free (secrets);
+	return key;
+}
+
+/* native_get() through the response cache: the OIDs another check of the
+ * same agent fetched within cache_ttl seconds are taken from the cache and
+ * only the others are requested. Checks of the agent running at the same
+ * time wait for the cache, and so for this request, instead of making
+ * their own. */
+int
+cached_get (output *out, output *err)
+{
+	np_snmp_cache cache;
+	np_snmp_cached *hit;
+	output fetched;
+	char **all_oids = oids, **missing, **text, **keys;
+	double *value;
+	int *numeric, *from;
+	int all = numoids, nmissing = 0, i, ret;
+
+	if (!np_snmp_cache_open (&cache, cache_key ())) {
+		if (verbose)
+			printf ("No SNMP cache, requesting all OIDs\n");
+		return native_get (out, err);
+	}
+
+	text = calloc (all, sizeof (char *));
+	keys = calloc (all, sizeof (char *));
+	missing = calloc (all, sizeof (char *));
+	from = calloc (all, sizeof (int));
+	value = calloc (all, sizeof (double));
+	numeric = calloc (all, sizeof (int));
+	if (!text || !keys || !missing || !from || !value || !numeric)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	/* the same OID asked with GETNEXT is another answer */
+	for (i = 0; i < all; i++) {
+		xasprintf (&keys[i], "%s%s", usesnmpgetnext ? "next:" : "", oids[i]);
+		if ((hit = np_snmp_cache_find (&cache, keys[i], cache_ttl)) != NULL) {
+			text[i] = strdup (hit->text);
+			value[i] = hit->value;
+			numeric[i] = hit->numeric;
+		} else {
+			from[i] = nmissing;
+			missing[nmissing++] = oids[i];
+		}
+	}
+	if (verbose)
+		printf ("%d of %d OIDs from the SNMP cache\n", all - nmissing, all);
+
+	memset (err, 0, sizeof (output));
+	if (nmissing > 0) {
+		oids = missing;
+		numoids = nmissing;
+		if ((native_text = calloc (nmissing, sizeof (char *))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		ret = native_get (&fetched, err);
+		oids = all_oids;
+		numoids = all;
+		if (ret != 0) {
+			np_snmp_cache_close (&cache);
+			*out = fetched;
+			return ret;
+		}
+		for (i = 0; i < all; i++) {
+			if (text[i] != NULL || native_text[from[i]] == NULL)
+				continue;
+			text[i] = native_text[from[i]];
+			value[i] = native_value[from[i]];
+			numeric[i] = native_numeric[from[i]];
+			np_snmp_cache_store (&cache, keys[i], text[i], value[i], numeric[i]);
+		}
+	}
+	np_snmp_cache_close (&cache);
+
+	/* the answers in the order of the OIDs, as one request would give them */
+	memset (out, 0, sizeof (output));
+	for (i = 0; i < all; i++) {
+		if (text[i] == NULL)
+			continue;
+		native_append (out, text[i], strlen (text[i]));
+		native_append (out, "\n", 1);
+	}
+	native_index (out);
+	native_value = value;
+	native_numeric = numeric;
+	return 0;
+}
+
+/* Read "host", "host:port", "host port" or "[v6addr]:port" lines, one per
+ * agent, of the shard given with --shard. The port defaults to the one
+ * given with -p. */
+static snmp_target *
+read_targets (const char *filename, size_t *count)
+{
+	np_targets *list;
+	char *host, *port_str, *p;
+	snmp_target *targets = NULL;
+	size_t size = 0;
+
+	*count = 0;
+	if ((list = np_targets_open (filename)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open target list %s: %s\n"), filename, strerror (errno));
+
+	while ((host = np_targets_next (list)) != NULL) {
+		port_str = NULL;
+		if (*host == '[' && (p = strchr (host, ']')) != NULL) {
+			*p++ = '\0';
+			host++;
+			if (*p == ':')
+				port_str = p + 1;
+		}
+		else if ((p = strpbrk (host, " \t")) != NULL) {
+			*p++ = '\0';
+			port_str = p + strspn (p, " \t");
+		}
+		else if ((p = strchr (host, ':')) != NULL && strchr (p + 1, ':') == NULL) {
+			*p++ = '\0';
+			port_str = p;
+		}
+
+		if (port_str != NULL && *port_str != '\0' && !is_intpos (port_str))
+			die (STATE_UNKNOWN, _("Invalid port in target list: %s\n"), port_str);
+
+		if (*count >= size) {
+			size = size ? size * 2 : OID_COUNT_STEP;
+			targets = realloc (targets, size * sizeof (snmp_target));
+			if (targets == NULL)
+				die (STATE_UNKNOWN, _("Cannot realloc()"));
+		}
+		memset (&targets[*count], 0, sizeof (snmp_target));
+		targets[*count].host = strdup (host);
+		targets[*count].port = strdup (port_str != NULL && *port_str != '\0' ? port_str : port);
+		(*count)++;
+	}
+
+	if (list->lines == 0)
+		die (STATE_UNKNOWN, _("No targets found in %s\n"), filename);
+	np_targets_close (list);
+
+	return targets;
+}
+
+static int
+target_callback (int operation, netsnmp_session *ss, int reqid, netsnmp_pdu *pdu, void *magic)
+{
+	snmp_target *t = magic;
+
+	if (operation == NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE)
+		t->return_code = native_response (STAT_SUCCESS, ss, pdu, &t->out, &t->err, t->value, t->numeric);
+	else
+		t->return_code = native_response (STAT_TIMEOUT, ss, NULL, &t->out, &t->err, t->value, t->numeric);
+	t->done = TRUE;
+	return 1;
+}
+
+/* Open a session to the agent and send its request without waiting */
+static void
+target_start (snmp_target *t)
+{
+	netsnmp_session session;
+	netsnmp_pdu *pdu;
+	char *peer = NULL;
+	char *liberr = NULL;
+
+	t->value = calloc (numoids, sizeof (double));
+	t->numeric = calloc (numoids, sizeof (int));
+	if (t->value == NULL || t->numeric == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+
+	xasprintf (&peer, "%s%s:%s", ip_version, t->host, t->port);
+	native_session (&session, peer);
+
+	t->done = TRUE;
+	t->return_code = 1;
+	if ((pdu = native_pdu (&t->err)) == NULL)
+		return;
+
+	if ((t->ss = snmp_open (&session)) == NULL) {
+		snmp_error (&session, NULL, NULL, &liberr);
+		native_appendf (&t->err, "snmpget: %s\n", liberr);
+		free (liberr);
+		snmp_free_pdu (pdu);
+		return;
+	}
+
+	if (snmp_async_send (t->ss, pdu, target_callback, t) == 0) {
+		snmp_error (t->ss, NULL, NULL, &liberr);
+		native_appendf (&t->err, "snmpget: %s\n", liberr);
+		free (liberr);
+		snmp_free_pdu (pdu);
+		return;
+	}
+
+	t->done = FALSE;
+	t->return_code = 0;
+}
+
+/* Evaluate one agent's answer with the same code as a single check */
+static void
+target_finish (snmp_target *t)
+{
+	int total_oids;
+	size_t i;
+
+	if (t->ss) {
+		snmp_close (t->ss);
+		t->ss = NULL;
+	}
+	native_index (&t->out);
+	native_index (&t->err);
+
+	if (t->return_code != 0 || t->out.lines == 0) {
+		t->result = STATE_UNKNOWN;
+		if (t->err.lines > 0) {
+			np_str_printf (&t->message, " %s%s", _("External command error: "), t->err.line[0]);
+			for (i = 1; i < t->err.lines; i++)
+				np_str_printf (&t->message, " %s", t->err.line[i]);
+		} else
+			np_str_printf (&t->message, _(" External command error with no output (return code: %d)"),
+			               t->return_code);
+		return;
+	}
+
+	native_value = t->value;
+	native_numeric = t->numeric;
+	xasprintf (&perf_prefix, "%s:%s", t->host, t->port);
+	perfstr.len = 0;
+	t->result = process_response (&t->out, &t->message, &t->mult_resp, &total_oids);
+	t->perf = strdup (perf_string (&perfstr));
+	free (perf_prefix);
+	perf_prefix = NULL;
+}
+
+/* Poll every agent listed in targets_file, with at most `concurrency`
+ * requests in flight. Per agent the -t timeout and -e retries apply as in
+ * the single host case. */
+int
+check_targets (void)
+{
+	snmp_target *targets;
+	snmp_target **active;
+	size_t count, next = 0, nactive = 0, i, j;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int result = STATE_OK;
+	int fds, block, n;
+	fd_set fdset;
+	struct timeval tv;
+	np_changes *changes = NULL;
+	char *shown = NULL, *name = NULL;
+
+	targets = read_targets (targets_file, &count);
+	active = calloc (concurrency, sizeof (*active));
+	if (active == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+
+	native_init ();
+
+	/* each wave of requests may take the single host worst case */
+	if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR)
+		usage4 (_("Cannot catch SIGALRM"));
+	alarm (((count + concurrency - 1) / concurrency) * timeout_interval * (retries + 1) + 5);
+
+	while (next < count || nactive > 0) {
+		while (nactive < (size_t)concurrency && next < count) {
+			target_start (&targets[next]);
+			if (targets[next].done)
+				target_finish (&targets[next]);
+			else
+				active[nactive++] = &targets[next];
+			next++;
+		}
+		if (nactive == 0)
+			continue;
+
+		fds = 0;
+		block = 1;
+		FD_ZERO (&fdset);
+		timerclear (&tv);
+		snmp_select_info (&fds, &fdset, &tv, &block);
+		n = select (fds, &fdset, NULL, NULL, block ? NULL : &tv);
+		if (n > 0)
+			snmp_read (&fdset);
+		else if (n == 0)
+			snmp_timeout ();
+		else if (errno != EINTR)
+			die (STATE_UNKNOWN, _("select() failed: %s\n"), strerror (errno));
+
+		for (i = 0, j = 0; i < nactive; i++) {
+			if (active[i]->done)
+				target_finish (active[i]);
+			else
+				active[j++] = active[i];
+		}
+		nactive = j;
+	}
+
+	for (i = 0; i < count; i++) {
+		result = max_state (result, targets[i].result);
+		states[targets[i].result]++;
+	}
+
+	/* with --changes only the agents whose state changed are listed */
+	if (changes_refresh >= 0) {
+		changes = np_changes_load (changes_refresh);
+		if ((shown = calloc (count ? count : 1, 1)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot malloc"));
+		for (i = 0; i < count; i++) {
+			xasprintf (&name, "%s:%s", targets[i].host, targets[i].port);
+			shown[i] = np_changes_check (changes, name, targets[i].result);
+			free (name);
+		}
+	}
+
+	printf (_("%s %s - %lu targets: %d ok, %d warning, %d critical, %d unknown"),
+	        label, state_text (result), (unsigned long)count, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+	if (changes != NULL)
+		printf (changes->full ? _(", %lu changed, all listed") : _(", %lu changed"), changes->changed);
+	printf ("\n");
+
+	for (i = 0; i < count; i++) {
+		if (shown != NULL && !shown[i])
+			continue;
+		printf ("%s %s:%s:%s\n", state_text (targets[i].result),
+		        targets[i].host, targets[i].port,
+		        np_str_string (&targets[i].message));
+		printf ("%s", np_str_string (&targets[i].mult_resp));
+	}
+
+	for (i = 0, n = 0; i < count; i++) {
+		if (targets[i].perf == NULL || targets[i].perf[0] == '\0' || (shown != NULL && !shown[i]))
+			continue;
+		printf ("%s%s\n", n++ ? "" : "| ", targets[i].perf);
+	}
+
+	if (changes != NULL)
+		np_changes_save (changes);
+	free (shown);
+
+	return result;
+}
+
+static char **table_index = NULL;
+static size_t table_rows = 0, table_size = 0;
+
+/* The row of index, added to every column if it is new. Walks return the
+ * rows of all columns in the same order, so hint is nearly always it. */
+static size_t
+table_row (snmp_column *cols, const char *index, size_t hint)
+{
+	size_t row, c;
+
+	if (hint < table_rows && strcmp (table_index[hint], index) == 0)
+		return hint;
+	for (row = 0; row < table_rows; row++)
+		if (strcmp (table_index[row], index) == 0)
+			return row;
+
+	if (table_rows >= table_size) {
+		table_size = table_size ? table_size * 2 : 64;
+		table_index = realloc (table_index, table_size * sizeof (*table_index));
+		if (table_index == NULL)
+			die (STATE_UNKNOWN, _("Cannot realloc()"));
+		for (c = 0; c < (size_t)numoids; c++) {
+			cols[c].value = realloc (cols[c].value, table_size * sizeof (double));
+			cols[c].numeric = realloc (cols[c].numeric, table_size * sizeof (int));
+			cols[c].text = realloc (cols[c].text, table_size * sizeof (char *));
+			cols[c].state = realloc (cols[c].state, table_size * sizeof (int));
+			if (!cols[c].value || !cols[c].numeric || !cols[c].text || !cols[c].state)
+				die (STATE_UNKNOWN, _("Cannot realloc()"));
+		}
+	}
+	table_index[table_rows] = np_arena_strdup (index);
+	for (c = 0; c < (size_t)numoids; c++) {
+		cols[c].value[table_rows] = 0;
+		cols[c].numeric[table_rows] = 0;
+		cols[c].text[table_rows] = NULL;
+	}
+	return table_rows++;
+}
+
+/* File one varbind of the walk under its column and row */
+static void
+table_cell (snmp_column *cols, snmp_column *col, size_t *hint, netsnmp_variable_list *vars)
+{
+	char index[MAX_OID_LEN * 11], buf[MAX_INPUT_BUFFER];
+	char *show, *end;
+	size_t i, len = 0, row;
+
+	index[0] = '\0';
+	for (i = col->root_len; i < vars->name_length && len < sizeof (index) - 22; i++)
+		len += sprintf (index + len, "%s%lu", len ? "." : "", (unsigned long) vars->name[i]);
+	row = table_row (cols, index, *hint);
+	*hint = row + 1;
+
+	if (vars->type == ASN_COUNTER || vars->type == ASN_COUNTER64)
+		col->counter = TRUE;
+	native_decode (&col->value[row], &col->numeric[row], vars);
+	if (col->numeric[row]) {
+		col->value[row] += offset;
+		col->text[row] = np_arena_printf ("%.0f", col->value[row]);
+		return;
+	}
+
+	/* the rest is shown as snmpget shows it, without the type */
+	snprint_value (buf, sizeof (buf), vars->name, vars->name_length, vars);
+	show = strstr (buf, ": ") ? strstr (buf, ": ") + 2 : buf;
+	col->text[row] = np_arena_strdup (show);
+	col->value[row] = np_strtod (show, &end);
+	if (end > show) {
+		col->numeric[row] = 1;
+		col->value[row] += offset;
+	}
+}
+
+/* Walk all columns side by side until each has left its subtree. Returns
+ * what snmpbulkwalk would exit with after writing its message to err. */
+static int
+table_walk (netsnmp_session *ss, snmp_column *cols, output *err)
+{
+	netsnmp_pdu *pdu, *response;
+	netsnmp_variable_list *vars;
+	snmp_column *col;
+	size_t *hint;
+	int *active;
+	char *errors = NULL;
+	int bulk = ss->version != SNMP_VERSION_1;
+	int c, i, nactive, status, ret, requests = 0;
+
+	active = calloc (numoids, sizeof (*active));
+	hint = calloc (numoids, sizeof (*hint));
+	if (active == NULL || hint == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+
+	while (1) {
+		pdu = snmp_pdu_create (bulk ? SNMP_MSG_GETBULK : SNMP_MSG_GETNEXT);
+		for (c = 0, nactive = 0; c < numoids; c++) {
+			if (cols[c].done)
+				continue;
+			snmp_add_null_var (pdu, cols[c].last, cols[c].last_len);
+			active[nactive++] = c;
+		}
+		if (nactive == 0) {
+			snmp_free_pdu (pdu);
+			break;
+		}
+		if (bulk) {
+			pdu->non_repeaters = 0;
+			pdu->max_repetitions = TABLE_REPETITIONS;
+		}
+
+		requests++;
+		response = NULL;
+		status = snmp_synch_response (ss, pdu, &response);
+
+		/* SNMPv1 agents end the walk of a column with noSuchName */
+		if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOSUCHNAME &&
+		    response->errindex > 0 && response->errindex <= nactive) {
+			cols[active[response->errindex - 1]].done = TRUE;
+			snmp_free_pdu (response);
+			continue;
+		}
+		if ((ret = np_snmp_error (status, ss, response, &errors)) != 0) {
+			native_errors (err, errors);
+			if (response)
+				snmp_free_pdu (response);
+			free (active);
+			free (hint);
+			return ret;
+		}
+
+		/* the repetitions take turns over the columns asked for */
+		for (i = 0, vars = response->variables; vars; vars = vars->next_variable, i++) {
+			c = active[i % nactive];
+			col = &cols[c];
+			if (col->done)
+				continue;
+			if (vars->type == SNMP_ENDOFMIBVIEW || vars->type == SNMP_NOSUCHOBJECT ||
+			    vars->type == SNMP_NOSUCHINSTANCE || vars->name_length <= col->root_len ||
+			    netsnmp_oid_is_subtree (col->root, col->root_len, vars->name, vars->name_length) != 0 ||
+			    snmp_oid_compare (vars->name, vars->name_length, col->last, col->last_len) <= 0) {
+				col->done = TRUE;
+				continue;
+			}
+			memcpy (col->last, vars->name, vars->name_length * sizeof (oid));
+			col->last_len = vars->name_length;
+			table_cell (cols, col, &hint[c], vars);
+		}
+		snmp_free_pdu (response);
+	}
+
+	if (verbose)
+		printf ("%lu rows in %d requests\n", (unsigned long) table_rows, requests);
+	free (active);
+	free (hint);
+	return 0;
+}
+
+/* With --table-cache, the walk of ifTable and ifXTable is only made again
+ * once the agent has rebooted or ifTableLastChange moved on. Until then
+ * the rows are the ones of the last walk, the static columns such as names,
+ * speeds and aliases are taken from the state, and only the others fetched
+ * with a GET of every cell of them. */
+
+/* sysUpTime and ifTableLastChange. Returns FALSE if the agent has no
+ * ifTableLastChange, and the table has to be walked every time. */
+static int
+table_probe (netsnmp_session *ss, unsigned long *uptime, unsigned long *last_change)
+{
+	netsnmp_pdu *pdu, *response = NULL;
+	netsnmp_variable_list *vars;
+	oid name[MAX_OID_LEN];
+	size_t name_len;
+	int status, found = FALSE;
+
+	pdu = snmp_pdu_create (SNMP_MSG_GET);
+	name_len = MAX_OID_LEN;
+	snmp_parse_oid (SYS_UPTIME_OID, name, &name_len);
+	snmp_add_null_var (pdu, name, name_len);
+	name_len = MAX_OID_LEN;
+	snmp_parse_oid (IF_TABLE_LAST_CHANGE_OID, name, &name_len);
+	snmp_add_null_var (pdu, name, name_len);
+
+	status = snmp_synch_response (ss, pdu, &response);
+	if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOERROR &&
+	    (vars = response->variables) != NULL && vars->type == ASN_TIMETICKS &&
+	    vars->next_variable != NULL && vars->next_variable->type == ASN_TIMETICKS) {
+		*uptime = (unsigned long) *vars->val.integer;
+		*last_change = (unsigned long) *vars->next_variable->val.integer;
+		found = TRUE;
+	}
+	if (response)
+		snmp_free_pdu (response);
+	return found;
+}
+
+/* the text of a cell in the state, without tabs and newlines */
+static void
+table_escape (np_str *out, const char *text)
+{
+	for (; *text; text++) {
+		if (*text == '\\')
+			np_str_puts (out, "\\\\");
+		else if (*text == '\t')
+			np_str_puts (out, "\\t");
+		else if (*text == '\n')
+			np_str_puts (out, "\\n");
+		else
+			np_str_append (out, text, 1);
+	}
+}
+
+static char *
+table_unescape (char *text)
+{
+	char *r, *w;
+
+	for (r = w = text; *r; r++, w++) {
+		if (*r == '\\' && r[1] != '\0') {
+			r++;
+			*w = *r == 't' ? '\t' : *r == 'n' ? '\n' : *r;
+		}
+		else
+			*w = *r;
+	}
+	*w = '\0';
+	return text;
+}
+
+/* TRUE if column c is kept in the state */
+static int
+table_is_static (snmp_column *cols, int c)
+{
+	const char *p;
+
+	if (table_static == NULL)
+		return !cols[c].counter;
+	for (p = table_static; *p; p += strspn (p, ","))
+		if (strtol (p, (char **) &p, 10) == c + 1)
+			return TRUE;
+	return FALSE;
+}
+
+/* Keep the rows of a full walk and their static cells, one line each after
+ * a line with sysUpTime, ifTableLastChange and which columns are counters:
+ * "index<TAB>cell..." with a cell "-" for none or one not kept, "s<text>"
+ * for text and "n<value> <text>" for a number. */
+static void
+table_save (snmp_column *cols, unsigned long uptime, unsigned long last_change)
+{
+	np_str out = NP_STR_INIT;
+	size_t row;
+	int c;
+
+	np_str_printf (&out, "%lu %lu %d ", uptime, last_change, numoids);
+	for (c = 0; c < numoids; c++)
+		np_str_append (&out, cols[c].counter ? "1" : "0", 1);
+	np_str_puts (&out, "\n");
+	for (row = 0; row < table_rows; row++) {
+		np_str_puts (&out, table_index[row]);
+		for (c = 0; c < numoids; c++) {
+			np_str_puts (&out, "\t");
+			if (!table_is_static (cols, c) || cols[c].text[row] == NULL)
+				np_str_puts (&out, "-");
+			else {
+				if (cols[c].numeric[row])
+					np_str_printf (&out, "n%.17g ", cols[c].value[row]);
+				else
+					np_str_puts (&out, "s");
+				table_escape (&out, cols[c].text[row]);
+			}
+		}
+		np_str_puts (&out, "\n");
+	}
+	np_state_write_binary (current_time, np_str_string (&out), out.len);
+}
+
+/* The rows and static cells of the last walk, if the table did not change
+ * since. Returns FALSE with no rows if it has to be walked. */
+static int
+table_load (snmp_column *cols, unsigned long uptime, unsigned long last_change)
+{
+	state_data *state;
+	unsigned long saved_uptime, saved_change;
+	char *text, *line, *next, *cell, *end;
+	size_t row;
+	int saved_cols, c, n;
+
+	if ((state = np_state_read ()) == NULL || state->data == NULL || state->length <= 0)
+		return FALSE;
+	if ((text = malloc (state->length + 1)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	memcpy (text, state->data, state->length);
+	text[state->length] = '\0';
+
+	/* an agent that rebooted may have numbered its interfaces anew */
+	if ((next = strchr (text, '\n')) == NULL ||
+	    sscanf (text, "%lu %lu %d %n", &saved_uptime, &saved_change, &saved_cols, &n) != 3 ||
+	    saved_cols != numoids || (int) strspn (text + n, "01") != numoids ||
+	    uptime < saved_uptime || last_change != saved_change) {
+		free (text);
+		return FALSE;
+	}
+	for (c = 0; c < numoids; c++)
+		cols[c].counter = text[n + c] == '1';
+
+	for (line = next + 1; *line; line = next) {
+		if ((next = strchr (line, '\n')) == NULL)
+			next = line + strlen (line);
+		else
+			*next++ = '\0';
+		if ((end = strchr (line, '\t')) == NULL)
+			continue;
+		*end = '\0';
+		row = table_row (cols, line, table_rows);
+		for (c = 0, cell = end + 1; c < numoids && cell != NULL; c++, cell = end) {
+			if ((end = strchr (cell, '\t')) != NULL)
+				*end++ = '\0';
+			if (!table_is_static (cols, c) || *cell == '-')
+				continue;
+			if (*cell == 'n') {
+				cols[c].numeric[row] = 1;
+				cols[c].value[row] = strtod (cell + 1, &cell);
+				cell += *cell == ' ';
+			}
+			else
+				cell++;
+			cols[c].text[row] = np_arena_strdup (table_unescape (cell));
+		}
+	}
+	free (text);
+	return table_rows > 0;
+}
+
+/* GET the cells of the columns not kept in the state for the rows known.
+ * Returns 0, -1 if a row is no longer there, or what table_walk() would
+ * with a failed request. */
+static int
+table_fetch (netsnmp_session *ss, snmp_column *cols, output *err)
+{
+	netsnmp_pdu *pdu, *response;
+	netsnmp_variable_list *vars;
+	oid name[MAX_OID_LEN];
+	size_t name_len, row = 0, first, hint;
+	char *errors = NULL, *p;
+	int c = 0, first_c, n, status, ret, requests = 0;
+
+	while (row < table_rows) {
+		pdu = snmp_pdu_create (SNMP_MSG_GET);
+		first = row;
+		first_c = c;
+		/* the columns of a row, then the next row */
+		for (n = 0; n < TABLE_GET_VARBINDS && row < table_rows; c = (c + 1) % numoids, row += c == 0) {
+			if (table_is_static (cols, c))
+				continue;
+			memcpy (name, cols[c].root, cols[c].root_len * sizeof (oid));
+			name_len = cols[c].root_len;
+			for (p = table_index[row]; *p && name_len < MAX_OID_LEN; p += *p == '.')
+				name[name_len++] = strtoul (p, &p, 10);
+			snmp_add_null_var (pdu, name, name_len);
+			n++;
+		}
+		if (n == 0) {
+			snmp_free_pdu (pdu);
+			break;
+		}
+
+		requests++;
+		response = NULL;
+		status = snmp_synch_response (ss, pdu, &response);
+		if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOSUCHNAME) {
+			snmp_free_pdu (response);
+			return -1;
+		}
+		if ((ret = np_snmp_error (status, ss, response, &errors)) != 0) {
+			native_errors (err, errors);
+			if (response)
+				snmp_free_pdu (response);
+			return ret;
+		}
+
+		/* in the order asked for */
+		for (vars = response->variables, row = first, c = first_c; vars; c = (c + 1) % numoids, row += c == 0) {
+			if (table_is_static (cols, c))
+				continue;
+			if (vars->type == SNMP_ENDOFMIBVIEW || vars->type == SNMP_NOSUCHOBJECT ||
+			    vars->type == SNMP_NOSUCHINSTANCE) {
+				snmp_free_pdu (response);
+				return -1;
+			}
+			hint = row;
+			table_cell (cols, &cols[c], &hint, vars);
+			vars = vars->next_variable;
+		}
+		snmp_free_pdu (response);
+	}
+
+	if (verbose)
+		printf ("%lu rows from the state, their other columns in %d requests\n",
+		        (unsigned long) table_rows, requests);
+	return 0;
+}
+
+/* The n-th comma separated range of list as given, for the perfdata */
+static char *
+table_threshold (const char *list, int n)
+{
+	for (; list != NULL && n > 0; n--)
+		if ((list = strchr (list, ',')) != NULL)
+			list++;
+	if (list == NULL || *list == '\0' || *list == ',')
+		return NULL;
+	return np_arena_printf ("%.*s", (int) strcspn (list, ","), list);
+}
+
+/* Walk the oids[] as the columns of a table and check every row against
+ * the thresholds of its column. */
+int
+check_table (void)
+{
+	netsnmp_session session, *ss;
+	snmp_column *cols;
+	output err;
+	char *peer = NULL, *liberr = NULL, *name, *w, *c_th;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int result = STATE_OK, row_state, ret = -1, c, probed = FALSE;
+	unsigned long uptime = 0, last_change = 0;
+	size_t row;
+
+	memset (&err, 0, sizeof (err));
+	cols = calloc (numoids, sizeof (*cols));
+	if (cols == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+
+	np_snmp_init (miblist);
+	for (c = 0; c < numoids; c++) {
+		cols[c].root_len = MAX_OID_LEN;
+		if (snmp_parse_oid (oids[c], cols[c].root, &cols[c].root_len) == NULL)
+			die (STATE_UNKNOWN, "%s: %s\n", oids[c], snmp_api_errstring (snmp_errno));
+		memcpy (cols[c].last, cols[c].root, cols[c].root_len * sizeof (oid));
+		cols[c].last_len = cols[c].root_len;
+	}
+
+	xasprintf (&peer, "%s%s:%s", ip_version, server_address, port);
+	native_session (&session, peer);
+	if (verbose)
+		printf ("libnetsnmp walk of %d columns on %s\n", numoids, session.peername);
+
+	if (signal (SIGALRM, runcmd_timeout_alarm_handler) == SIG_ERR)
+		usage4 (_("Cannot catch SIGALRM"));
+	alarm (timeout_interval * retries + 5);
+
+	if ((ss = snmp_open (&session)) == NULL) {
+		snmp_error (&session, NULL, NULL, &liberr);
+		die (STATE_UNKNOWN, _("External command error: snmpget: %s\n"), liberr);
+	}
+	if (table_cache && (probed = table_probe (ss, &uptime, &last_change)) &&
+	    table_load (cols, uptime, last_change))
+		ret = table_fetch (ss, cols, &err);
+	else if (verbose && table_cache)
+		printf (probed ? _("The table changed, or no walk of it is kept\n")
+		        : _("No ifTableLastChange, walking the table\n"));
+	if (ret < 0) {
+		/* gone over to the walk, without what came from the state */
+		table_rows = 0;
+		for (c = 0; c < numoids; c++)
+			cols[c].counter = FALSE;
+		ret = table_walk (ss, cols, &err);
+		if (probed && ret == 0 && table_rows > 0)
+			table_save (cols, uptime, last_change);
+	}
+	snmp_close (ss);
+	alarm (0);
+
+	native_index (&err);
+	if (ret != 0 || table_rows == 0) {
+		if (err.lines > 0)
+			die (STATE_UNKNOWN, _("External command error: %s\n"), err.line[0]);
+		die (STATE_UNKNOWN, _("No rows found under %s\n"), oids[0]);
+	}
+
+	/* one pass over each column, then the cells that are no numbers */
+	for (c = 0; c < numoids; c++) {
+		if (thlds[c]->warning || thlds[c]->critical)
+			get_status_batch (cols[c].value, cols[c].state, table_rows, thlds[c]);
+		else
+			memset (cols[c].state, 0, table_rows * sizeof (int));
+		for (row = 0; row < table_rows; row++)
+			if (cols[c].text[row] == NULL ||
+			    (!cols[c].numeric[row] && (thlds[c]->warning || thlds[c]->critical)))
+				cols[c].state[row] = STATE_UNKNOWN;
+	}
+
+	for (row = 0; row < table_rows; row++) {
+		for (c = 0, row_state = STATE_OK; c < numoids; c++)
+			row_state = max_state (row_state, cols[c].state[row]);
+		result = max_state (result, row_state);
+		states[row_state]++;
+	}
+
+	printf (_("%s %s - %lu rows: %d ok, %d warning, %d critical, %d unknown"),
+	        label, state_text (result), (unsigned long) table_rows, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+	for (c = 0; c < numoids; c++) {
+		name = (perf_labels && (size_t)c < nlabels && labels[c] != NULL) ? labels[c] : oids[c];
+		w = table_threshold (warning_thresholds, c);
+		c_th = table_threshold (critical_thresholds, c);
+		for (row = 0; row < table_rows; row++) {
+			if (!cols[c].numeric[row])
+				continue;
+			perf_label (&perfstr, np_arena_printf ("%s.%s", name, table_index[row]));
+			perf_double (&perfstr, cols[c].value[row]);
+			if (cols[c].counter)
+				perf_puts (&perfstr, "c");
+			if (w || c_th)
+				perf_puts (&perfstr, np_arena_printf (";%s;%s", w ? w : "", c_th ? c_th : ""));
+		}
+	}
+	printf (" | %s\n", perf_string (&perfstr));
+
+	for (row = 0; row < table_rows; row++) {
+		for (c = 0, row_state = STATE_OK; c < numoids; c++)
+			row_state = max_state (row_state, cols[c].state[row]);
+		printf ("%s %s:", state_text (row_state), table_index[row]);
+		for (c = 0; c < numoids; c++) {
+			printf ("%s", c == 0 ? " " : output_delim);
+			if ((size_t)c < nlabels && labels[c] != NULL)
+				printf ("%s ", labels[c]);
+			printf ("%s%s%s", mark (cols[c].state[row]),
+			        cols[c].text[row] ? cols[c].text[row] : "-", mark (cols[c].state[row]));
+			if ((size_t)c < nunits && unitv[c] != NULL)
+				printf (" %s", unitv[c]);
+		}
+		printf ("\n");
+	}
+
+	return result;
+}
+#endif
+
+
+
 /* trim leading whitespace
 	 if there is a leading quote, make sure it balances */
 
@@ -1213,6 +2635,49 @@ print_help (void)
 
 	printf (" %s\n", "-O, --perf-oids");
 	printf ("    %s\n", _("Label performance data with OIDs instead of --label's"));
+#ifdef HAVE_NETSNMP
+	printf (" %s\n", "--native");
+	printf ("    %s\n", _("Send the request through libnetsnmp instead of running snmpget; all"));
+	printf ("    %s\n", _("OIDs are fetched with one request and the output is the same"));
+	printf ("    %s\n", _("With SNMPv3 the engine ID, boots and time of the agent are kept in the"));
+	printf ("    %s\n", _("state directory per agent and user, and the next run skips the discovery"));
+	printf (" %s\n", "--targets=FILE");
+	printf ("    %s\n", _("Poll all agents listed in FILE (\"-\" for stdin, unix:PATH or tcp:HOST:PORT"));
+	printf ("    %s\n", _("for a socket) asynchronously, one \"host\", \"host:port\" or \"[v6addr]:port\""));
+	printf ("    %s\n", _("per line. Implies --native. -t and -e apply to each agent, --rate is not"));
+	printf ("    %s\n", _("supported"));
+	printf (" %s\n", "--shard=I/N");
+	printf ("    %s\n", _("Poll only the agents of shard I of N, so that N pollers given the same list"));
+	printf ("    %s\n", _("poll each agent once"));
+	printf (" %s\n", "--changes[=SECONDS]");
+	printf ("    %s\n", _("List only the agents whose state changed since the last run, or that are"));
+	printf ("    %s\n", _("new, and all of them every SECONDS, 0 for never. The first line still counts"));
+	printf ("    %s\n", _("all agents, and the state returned is the worst of all of them"));
+	printf ("    %s %d\n", _("Default:"), DEFAULT_CHANGES_REFRESH);
+	printf (" %s\n", "--concurrency=INTEGER");
+	printf ("    %s\n", _("Maximum number of agents with a request in flight with --targets"));
+	printf ("    %s %d\n", _("Default:"), DEFAULT_CONCURRENCY);
+	printf (" %s\n", "--table");
+	printf ("    %s\n", _("Walk the OIDs as the columns of a table (GETBULK, GETNEXT with -P 1)"));
+	printf ("    %s\n", _("and check -w and -c on every row. Perfdata is labelled <label>.<index>."));
+	printf ("    %s\n", _("Implies --native"));
+	printf (" %s\n", "--table-cache[=LIST]");
+	printf ("    %s\n", _("For ifTable and ifXTable: --table, but walk the table only when the agent"));
+	printf ("    %s\n", _("rebooted or ifTableLastChange moved since the last walk. Until then, GET only"));
+	printf ("    %s\n", _("the counter columns of the rows known and take the others (names, speeds,"));
+	printf ("    %s\n", _("aliases) from the state, or only those of LIST, column numbers from 1"));
+	printf (" %s\n", "--cache=SECONDS");
+	printf ("    %s\n", _("Share the answers of the agent with the other checks of it for this many"));
+	printf ("    %s\n", _("seconds: OIDs one of them fetched that recently are not requested again,"));
+	printf ("    %s\n", _("and checks running at the same time wait for one request. The cache is"));
+	printf ("    %s\n", _("kept in the state directory, per agent and credentials. Implies --native"));
+	printf (" %s\n", "--mib-index");
+	printf ("    %s\n", _("Look the OIDs up in an index of the names in the MIBs of -m instead of"));
+	printf ("    %s\n", _("loading the MIBs, which takes most of the time of a run with -m ALL."));
+	printf ("    %s\n", _("The index is kept in the state directory and built again when a MIB"));
+	printf ("    %s\n", _("directory changes. Without the MIBs enumerations and DISPLAY-HINTs show"));
+	printf ("    %s\n", _("as plain numbers and GETNEXT answers as numeric OIDs. Implies --native"));
+#endif
 
 	printf (UT_VERBOSE);
 
@@ -1257,4 +2722,9 @@ print_usage (void)
 	printf ("[-l label] [-u units] [-p port-number] [-d delimiter] [-D output-delimiter]\n");
 	printf ("[-m miblist] [-P snmp version] [-N context] [-L seclevel] [-U secname]\n");
 	printf ("[-a authproto] [-A authpasswd] [-x privproto] [-X privpasswd] [-4|6]\n");
+#ifdef HAVE_NETSNMP
+	printf ("[--native] [--table] [--table-cache[=<columns>]] [--cache=<seconds>]\n");
+	printf ("[--mib-index]\n");
+	printf ("%s --targets=<file> [--concurrency=<agents>] [--shard=<i/n>] [--changes[=<seconds>]] -o <OID> [options]\n", progname);
+#endif
 }
@@ -28,6 +28,8 @@
 * 
 *****************************************************************************/
 
+#include "np_entry.h"
+
 const char *progname = "check_ssh";
 const char *copyright = "2000-2007";
 const char *email = "devel@monitoring-plugins.org";
@@ -42,6 +44,8 @@ const char *email = "devel@monitoring-plugins.org";
 
 #define SSH_DFL_PORT    22
 #define BUFF_SZ         256
+/* for a server that sends lines without ever identifying itself */
+#define BANNER_MAX      8192
 
 int port = -1;
 char *server_name = NULL;
@@ -49,12 +53,19 @@ char *remote_version = NULL;
 char *remote_protocol = NULL;
 int verbose = FALSE;
 
+/* multi-target mode */
+#define DEFAULT_CONCURRENCY 64
+char *targets_file = NULL;
+int concurrency = DEFAULT_CONCURRENCY;
+char *passive_service = NULL;
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 
 int ssh_connect (char *haddr, int hport, char *remote_version, char *remote_protocol);
+int run_multi_target (void);
 
 
 
@@ -63,9 +74,7 @@ main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -73,6 +82,9 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (targets_file != NULL)
+		return run_multi_target ();
+
 	/* initialize alarm signal handling */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 
@@ -95,6 +107,11 @@ process_arguments (int argc, char **argv)
 	int c;
 
 	int option = 0;
+	enum {
+		TARGETS_OPTION = CHAR_MAX + 1,
+		CONCURRENCY_OPTION,
+		PASSIVE_OPTION
+	};
 	static struct option longopts[] = {
 		{"help", no_argument, 0, 'h'},
 		{"version", no_argument, 0, 'V'},
@@ -107,6 +124,9 @@ process_arguments (int argc, char **argv)
 		{"verbose", no_argument, 0, 'v'},
 		{"remote-version", required_argument, 0, 'r'},
 		{"remote-protcol", required_argument, 0, 'P'},
+		{"targets", required_argument, 0, TARGETS_OPTION},
+		{"concurrency", required_argument, 0, CONCURRENCY_OPTION},
+		{"passive", optional_argument, 0, PASSIVE_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -169,6 +189,18 @@ process_arguments (int argc, char **argv)
 			else {
 				usage2 (_("Port number must be a positive integer"), optarg);
 			}
+			break;
+		case TARGETS_OPTION:
+			targets_file = optarg;
+			break;
+		case CONCURRENCY_OPTION:
+			if (!is_intpos (optarg))
+				usage4 (_("Concurrency must be a positive integer"));
+			concurrency = atoi (optarg);
+			break;
+		case PASSIVE_OPTION:
+			passive_service = optarg ? optarg : "SSH";
+			break;
 		}
 	}
 
@@ -195,7 +227,9 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
-	if (server_name == NULL)
+	if (passive_service != NULL && targets_file == NULL)
+		usage4 (_("--passive needs --targets"));
+	if (server_name == NULL && targets_file == NULL)
 		return ERROR;
 	if (port == -1)								/* funky, but allows -p to override stray integer in args */
 		port = SSH_DFL_PORT;
@@ -280,6 +314,143 @@ ssh_connect (char *haddr, int hport, char *remote_version, char *remote_protocol
 
 
 
+/* Multi-target mode: np_conn_run() connects to every target of the list,
+ * and each one is judged like a single check_ssh run would judge it */
+
+/* the identification line, which the server may send after other lines */
+static char *
+target_banner (np_conn *t)
+{
+	char *line;
+
+	for (line = t->data; line != NULL; line = strchr (line, '\n')) {
+		if (*line == '\n')
+			line++;
+		if (strncmp (line, "SSH-", 4) == 0)
+			return line;
+	}
+	return NULL;
+}
+
+static void
+target_judge (np_conn *t)
+{
+	char *line, *ssh_proto, *ssh_server, *message = NULL;
+	char *buffer = NULL;
+
+	if (t->len == 0) {
+		np_conn_finish (t, STATE_CRITICAL, strdup (_("No data received from host")));
+		return;
+	}
+	if ((line = target_banner (t)) == NULL) {
+		line = t->data;
+		line[strcspn (line, "\r\n")] = '\0';
+		xasprintf (&message, _("Server answer: %s"), line);
+		np_conn_finish (t, STATE_CRITICAL, message);
+		return;
+	}
+
+	line[strcspn (line, "\r\n")] = '\0';
+	ssh_proto = line + 4;
+	ssh_server = ssh_proto + strspn (ssh_proto, "-0123456789. ");
+	ssh_proto[strspn (ssh_proto, "0123456789. ")] = 0;
+
+	xasprintf (&buffer, "SSH-%s-check_ssh_%s\r\n", ssh_proto, VERSION);
+	send (t->fd, buffer, strlen (buffer), MSG_DONTWAIT);
+	free (buffer);
+
+	if (remote_version && strcmp (remote_version, ssh_server)) {
+		xasprintf (&message, _("%s (protocol %s) version mismatch, expected '%s'"),
+		           ssh_server, ssh_proto, remote_version);
+		np_conn_finish (t, STATE_CRITICAL, message);
+	}
+	else if (remote_protocol && strcmp (remote_protocol, ssh_proto)) {
+		xasprintf (&message, _("%s (protocol %s) protocol version mismatch, expected '%s'"),
+		           ssh_server, ssh_proto, remote_protocol);
+		np_conn_finish (t, STATE_CRITICAL, message);
+	}
+	else {
+		xasprintf (&message, _("%s (protocol %s)"), ssh_server, ssh_proto);
+		np_conn_finish (t, STATE_OK, message);
+	}
+}
+
+static void
+target_received (np_conn *t)
+{
+	char *line = target_banner (t);
+
+	if ((line != NULL && strchr (line, '\n') != NULL) || t->len >= BANNER_MAX)
+		target_judge (t);
+}
+
+int
+run_multi_target (void)
+{
+	np_conn *targets;
+	np_conn_ops ops;
+	size_t count, i;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int result = STATE_OK;
+	char *perf = NULL;
+	const char **names;
+
+	targets = np_conn_read_list (targets_file, port, &count);
+
+	if ((names = calloc (count, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < count; i++)
+		names[i] = targets[i].host;
+	np_resolve_prefetch (names, count, address_family, concurrency);
+	free (names);
+
+	memset (&ops, 0, sizeof (ops));
+	ops.received = target_received;
+	ops.judge = target_judge;
+	np_conn_run (targets, count, concurrency, &ops);
+
+	for (i = 0; i < count; i++) {
+		result = max_state (result, targets[i].result);
+		if (targets[i].result >= STATE_OK && targets[i].result <= STATE_DEPENDENT)
+			states[targets[i].result]++;
+	}
+
+	/* an external command per target, as a single check would report it */
+	if (passive_service != NULL) {
+		for (i = 0; i < count; i++)
+			printf ("[%lu] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;SSH %s - %s|%s\n",
+			        (unsigned long) time (NULL), targets[i].host, passive_service,
+			        targets[i].result, state_text (targets[i].result),
+			        targets[i].message ? targets[i].message : "",
+			        fperfdata ("time", targets[i].elapsed, "s",
+			                   FALSE, 0, FALSE, 0, TRUE, 0, TRUE, (int)socket_timeout));
+		return result;
+	}
+
+	printf (_("SSH %s - %lu targets: %d ok, %d warning, %d critical, %d unknown"),
+	        state_text (result), (unsigned long)count, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+
+	printf ("|");
+	for (i = 0; i < count; i++) {
+		xasprintf (&perf, "%s:%d", targets[i].host, targets[i].port);
+		printf ("%s%s", i ? " " : "",
+		        fperfdata (perf, targets[i].elapsed, "s",
+		                   FALSE, 0, FALSE, 0, TRUE, 0, TRUE, (int)socket_timeout));
+		free (perf);
+	}
+	putchar ('\n');
+
+	for (i = 0; i < count; i++)
+		printf ("%s %s:%d: %s\n", state_text (targets[i].result),
+		        targets[i].host, targets[i].port,
+		        targets[i].message ? targets[i].message : "");
+
+	return result;
+}
+
+
+
 void
 print_help (void)
 {
@@ -312,6 +483,20 @@ print_help (void)
 	printf (" %s\n", "-P, --remote-protocol=STRING");
   printf ("    %s\n", _("Alert if protocol doesn't match expected protocol version (ex: 2.0)"));
 
+	printf (" %s\n", "--targets=FILE");
+  printf ("    %s\n", _("Check all targets listed in FILE (\"-\" for stdin) concurrently, one"));
+  printf ("    %s\n", _("\"host port\", \"host:port\" or \"[address]:port\" per line. The port"));
+  printf ("    %s\n", _("defaults to the one given with -p. Each target is judged like a single"));
+  printf ("    %s\n", _("check, the worst state is returned"));
+
+	printf (" %s\n", "--concurrency=INTEGER");
+  printf ("    %s\n", _("Maximum number of connections in flight with --targets"));
+  printf ("    %s %d\n", _("Default:"), DEFAULT_CONCURRENCY);
+
+	printf (" %s\n", "--passive[=SERVICE]");
+  printf ("    %s\n", _("With --targets, print a PROCESS_SERVICE_CHECK_RESULT command per target,"));
+  printf ("    %s\n", _("for SERVICE (default: SSH) on the host of the target"));
+
 	printf (UT_VERBOSE);
 
 	printf (UT_SUPPORT);
@@ -324,5 +509,6 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
 	printf ("%s  [-4|-6] [-t <timeout>] [-r <remote version>] [-p <port>] <host>\n", progname);
+	printf ("%s  --targets=<file> [--concurrency=<connections>] [--passive[=<service>]] [options]\n", progname);
 }
 
@@ -47,9 +47,43 @@ const char *email = "devel@monitoring-plugins.org";
 # endif
 #endif
 
+#if !defined(HAVE_PROC_MEMINFO) && (defined(__FreeBSD__) || defined(__DragonFly__))
+# include <sys/param.h>
+# include <sys/sysctl.h>
+# include <vm/vm_param.h>
+# define CHECK_SWAP_SYSCTL 1
+#endif
+
 #ifndef SWAP_CONVERSION
 # define SWAP_CONVERSION 1
 #endif
+#ifndef SWAPCTL_CONVERSION
+# define SWAPCTL_CONVERSION SWAP_CONVERSION
+#endif
+
+#ifdef HAVE_PROC_MEMINFO
+# ifndef PROC_SWAPS
+#  define PROC_SWAPS "/proc/swaps"
+# endif
+# ifndef PROC_VMSTAT
+#  define PROC_VMSTAT "/proc/vmstat"
+# endif
+#endif
+
+/* --swap-in, --swap-out and --major-faults: pages a second since the
+ * last run, from the counters of PROC_VMSTAT */
+enum { RATE_SWAP_IN, RATE_SWAP_OUT, RATE_MAJOR_FAULTS, SWAP_RATES };
+static const char *rate_name[SWAP_RATES] = { "swap_in", "swap_out", "major_faults" };
+static const char *rate_counter[SWAP_RATES] = { "pswpin ", "pswpout ", "pgmajfault " };
+
+/* what the backends add up */
+typedef struct swap_totals {
+	float total_mb;
+	float used_mb;
+	float free_mb;
+	int result;
+	char *status;
+} swap_totals;
 
 int check_swap (int usp, float free_swap_mb, float total_swap_mb);
 int process_arguments (int argc, char **argv);
@@ -64,107 +98,290 @@ float crit_size_bytes = 0;
 int verbose;
 int allswaps;
 int no_swap_state = STATE_CRITICAL;
+int check_rates = FALSE;
+char *rate_warn[SWAP_RATES];
+char *rate_crit[SWAP_RATES];
+thresholds *rate_thresholds[SWAP_RATES];
+
+/* Count one swap device in, and with -a check it by itself */
+static void
+add_swap_device (swap_totals *t, float dsktotal_mb, float dskfree_mb)
+{
+	float dskused_mb = dsktotal_mb - dskfree_mb;
+	int percent;
 
-int
-main (int argc, char **argv)
+	if (verbose >= 3)
+		printf ("dsktotal_mb=%.0f dskfree_mb=%.0f dskused_mb=%.0f\n", dsktotal_mb, dskfree_mb, dskused_mb);
+
+	t->total_mb += dsktotal_mb;
+	t->used_mb += dskused_mb;
+	t->free_mb += dskfree_mb;
+	if (allswaps && dsktotal_mb > 0) {
+		percent = 100 * (((double) dskused_mb) / ((double) dsktotal_mb));
+		t->result = max_state (t->result, check_swap (percent, dskfree_mb, dsktotal_mb));
+		if (verbose)
+			xasprintf (&t->status, "%s [%.0f (%d%%)]", t->status, dskfree_mb, 100 - percent);
+	}
+}
+
+#ifdef HAVE_PROC_MEMINFO
+/* Only the totals are wanted from meminfo, so stop reading once both
+ * SwapTotal and SwapFree have gone by. Kernels before 2.6 list every
+ * device on a "Swap:" line before that, in bytes. */
+static void
+read_proc_meminfo (swap_totals *t)
 {
-	int percent_used, percent;
-	float total_swap_mb = 0, used_swap_mb = 0, free_swap_mb = 0;
-	float dsktotal_mb = 0, dskused_mb = 0, dskfree_mb = 0, tmp_mb = 0;
-	int result = STATE_UNKNOWN;
 	char input_buffer[MAX_INPUT_BUFFER];
-#ifdef HAVE_PROC_MEMINFO
+	float dsktotal_mb = 0, dskused_mb = 0, dskfree_mb = 0;
+	int have_total = FALSE, have_free = FALSE;
 	FILE *fp;
-#else
-	int conv_factor = SWAP_CONVERSION;
-# ifdef HAVE_SWAP
-	char *temp_buffer;
-	char *swap_command;
-	char *swap_format;
-# else
-#  ifdef HAVE_DECL_SWAPCTL
+
+	if (verbose >= 3)
+		printf("Reading PROC_MEMINFO at %s\n", PROC_MEMINFO);
+	if ((fp = fopen (PROC_MEMINFO, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open %s: %s\n"), PROC_MEMINFO, strerror (errno));
+
+	while (!(have_total && have_free) && fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
+		if (strncmp (input_buffer, "SwapTotal:", 10) == 0) {
+			/* this part is always in kB */
+			dsktotal_mb = np_strtod (input_buffer + 10, NULL) / 1024;
+			have_total = TRUE;
+		} else if (strncmp (input_buffer, "SwapFree:", 9) == 0) {
+			dskfree_mb = np_strtod (input_buffer + 9, NULL) / 1024;
+			have_free = TRUE;
+		} else if (allswaps && sscanf (input_buffer, "Swap: %f %f %f", &dsktotal_mb, &dskused_mb, &dskfree_mb) == 3) {
+			add_swap_device (t, dsktotal_mb / 1048576, dskfree_mb / 1048576);
+		}
+	}
+	fclose (fp);
+
+	if (verbose >= 3)
+		printf("Got SwapTotal=%.0f SwapFree=%.0f\n", dsktotal_mb, dskfree_mb);
+	t->total_mb = dsktotal_mb;
+	t->free_mb = dskfree_mb;
+	t->used_mb = dsktotal_mb - dskfree_mb;
+}
+
+/* One device per line after the header, sizes in kB:
+ * Filename Type Size Used Priority */
+static int
+read_proc_swaps (swap_totals *t)
+{
+	char input_buffer[MAX_INPUT_BUFFER];
+	float dsktotal_kb, dskused_kb;
+	FILE *fp;
+
+	if ((fp = fopen (PROC_SWAPS, "r")) == NULL)
+		return FALSE;
+	if (verbose >= 3)
+		printf("Reading %s\n", PROC_SWAPS);
+	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
+		if (sscanf (input_buffer, "%*s %*s %f %f", &dsktotal_kb, &dskused_kb) == 2)
+			add_swap_device (t, dsktotal_kb / 1024, (dsktotal_kb - dskused_kb) / 1024);
+	}
+	fclose (fp);
+	return TRUE;
+}
+
+/* The counters are spread over the file, stop once all of them were seen */
+static int
+read_proc_vmstat (unsigned long long *count)
+{
+	char input_buffer[MAX_INPUT_BUFFER];
+	int i, seen = 0;
+	FILE *fp;
+
+	if ((fp = fopen (PROC_VMSTAT, "r")) == NULL)
+		return FALSE;
+	if (verbose >= 3)
+		printf("Reading %s\n", PROC_VMSTAT);
+	while (seen < SWAP_RATES && fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
+		for (i = 0; i < SWAP_RATES; i++)
+			if (strncmp (input_buffer, rate_counter[i], strlen (rate_counter[i])) == 0) {
+				count[i] = np_strtoull (input_buffer + strlen (rate_counter[i]), NULL);
+				seen++;
+			}
+	}
+	fclose (fp);
+	return seen == SWAP_RATES;
+}
+
+/* The rates since the counters of the last run, kept in the state as
+ * "time pswpin pswpout pgmajfault". Adds to the status and perfdata. */
+static int
+check_swap_rates (char **status, char **perf)
+{
+	unsigned long long count[SWAP_RATES] = { 0 }, old[SWAP_RATES];
+	struct timeval tv;
+	state_data *previous;
+	char *data;
+	double now, then = 0, rate;
+	int result = STATE_OK, i;
+
+	if (!read_proc_vmstat (count)) {
+		xasprintf (status, _("%s- Cannot read swap activity from %s "), *status, PROC_VMSTAT);
+		return STATE_UNKNOWN;
+	}
+
+	np_enable_state (NULL, 1);
+	previous = np_state_read ();
+	gettimeofday (&tv, NULL);
+	now = tv.tv_sec + tv.tv_usec / 1.0e6;
+	xasprintf (&data, "%.6f %llu %llu %llu", now, count[RATE_SWAP_IN], count[RATE_SWAP_OUT],
+	           count[RATE_MAJOR_FAULTS]);
+	np_state_write_string (0, data);
+	free (data);
+
+	/* nothing to compare with the first time, or after a reboot */
+	if (previous == NULL || previous->data == NULL ||
+	    sscanf (previous->data, "%lf %llu %llu %llu", &then, &old[RATE_SWAP_IN], &old[RATE_SWAP_OUT],
+	            &old[RATE_MAJOR_FAULTS]) != 4 || now <= then ||
+	    count[RATE_SWAP_IN] < old[RATE_SWAP_IN] || count[RATE_SWAP_OUT] < old[RATE_SWAP_OUT] ||
+	    count[RATE_MAJOR_FAULTS] < old[RATE_MAJOR_FAULTS]) {
+		xasprintf (status, "%s- %s ", *status, _("no previous swap activity to compare with, assuming OK"));
+		return STATE_OK;
+	}
+
+	xasprintf (status, "%s-", *status);
+	for (i = 0; i < SWAP_RATES; i++) {
+		rate = (count[i] - old[i]) / (now - then);
+		if (rate_thresholds[i])
+			result = max_state (result, get_status (rate, rate_thresholds[i]));
+		xasprintf (status, "%s %s %.1f/s", *status, rate_name[i], rate);
+		xasprintf (perf, "%s %s=%.2f;%s;%s;0;", *perf, rate_name[i], rate,
+		           rate_warn[i] ? rate_warn[i] : "", rate_crit[i] ? rate_crit[i] : "");
+	}
+	xasprintf (status, "%s ", *status);
+	return result;
+}
+#endif /* HAVE_PROC_MEMINFO */
+
+#ifdef CHECK_SWAP_SWAPCTL_SVR4
+static void
+read_swapctl (swap_totals *t)
+{
 	int i=0, nswaps=0, swapctl_res=0;
-#   ifdef CHECK_SWAP_SWAPCTL_SVR4
 	swaptbl_t *tbl=NULL;
-	swapent_t *ent=NULL;
-#   else
-#    ifdef CHECK_SWAP_SWAPCTL_BSD
-	struct swapent *ent;
-#    endif /* CHECK_SWAP_SWAPCTL_BSD */
-#   endif /* CHECK_SWAP_SWAPCTL_SVR4 */
-#  endif /* HAVE_DECL_SWAPCTL */
-# endif
-#endif
-	char str[32];
-	char *status;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	/* get the number of active swap devices */
+	if((nswaps=swapctl(SC_GETNSWP, NULL))== -1)
+		die(STATE_UNKNOWN, _("Error getting swap devices\n") );
+
+	if(nswaps == 0)
+		die(STATE_OK, _("SWAP OK: No swap devices defined\n"));
 
-	status = strdup ("");
+	if(verbose >= 3)
+		printf("Found %d swap device(s)\n", nswaps);
 
-	/* Parse extra opts if any */
-	argv=np_extra_opts (&argc, argv, progname);
+	/* initialize swap table + entries */
+	tbl=(swaptbl_t*)malloc(sizeof(swaptbl_t)+(sizeof(swapent_t)*nswaps));
 
-	if (process_arguments (argc, argv) == ERROR)
-		usage4 (_("Could not parse arguments"));
+	if(tbl==NULL)
+		die(STATE_UNKNOWN, _("malloc() failed!\n"));
 
-#ifdef HAVE_PROC_MEMINFO
-	if (verbose >= 3) {
-		printf("Reading PROC_MEMINFO at %s\n", PROC_MEMINFO);
+	memset(tbl, 0, sizeof(swaptbl_t)+(sizeof(swapent_t)*nswaps));
+	tbl->swt_n=nswaps;
+	for(i=0;i<nswaps;i++){
+		if((tbl->swt_ent[i].ste_path=(char*)malloc(sizeof(char)*MAXPATHLEN)) == NULL)
+			die(STATE_UNKNOWN, _("malloc() failed!\n"));
 	}
-	fp = fopen (PROC_MEMINFO, "r");
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, fp)) {
-		if (sscanf (input_buffer, "%*[S]%*[w]%*[a]%*[p]%*[:] %f %f %f", &dsktotal_mb, &dskused_mb, &dskfree_mb) == 3) {
-			dsktotal_mb = dsktotal_mb / 1048576;	/* Apply conversion */
-			dskused_mb = dskused_mb / 1048576;
-			dskfree_mb = dskfree_mb / 1048576;
-			total_swap_mb += dsktotal_mb;
-			used_swap_mb += dskused_mb;
-			free_swap_mb += dskfree_mb;
-			if (allswaps) {
-				if (dsktotal_mb == 0)
-					percent=100.0;
-				else
-					percent = 100 * (((double) dskused_mb) / ((double) dsktotal_mb));
-				result = max_state (result, check_swap (percent, dskfree_mb, dsktotal_mb));
-				if (verbose)
-					xasprintf (&status, "%s [%.0f (%d%%)]", status, dskfree_mb, 100 - percent);
-			}
-		}
-		else if (sscanf (input_buffer, "%*[S]%*[w]%*[a]%*[p]%[TotalFre]%*[:] %f %*[k]%*[B]", str, &tmp_mb)) {
-			if (verbose >= 3) {
-				printf("Got %s with %f\n", str, tmp_mb);
-			}
-			/* I think this part is always in Kb, so convert to mb */
-			if (strcmp ("Total", str) == 0) {
-				dsktotal_mb = tmp_mb / 1024;
-			}
-			else if (strcmp ("Free", str) == 0) {
-				dskfree_mb = tmp_mb / 1024;
-			}
-		}
+
+	/* and now, tally 'em up */
+	swapctl_res=swapctl(SC_LIST, tbl);
+	if(swapctl_res < 0){
+		perror(_("swapctl failed: "));
+		die(STATE_UNKNOWN, _("Error in swapctl call\n"));
+	}
+
+	for(i=0;i<nswaps;i++)
+		add_swap_device (t, (float) tbl->swt_ent[i].ste_pages / SWAPCTL_CONVERSION,
+		                 (float) tbl->swt_ent[i].ste_free / SWAPCTL_CONVERSION);
+
+	/* and clean up after ourselves */
+	for(i=0;i<nswaps;i++){
+		free(tbl->swt_ent[i].ste_path);
+	}
+	free(tbl);
+}
+#elif defined(CHECK_SWAP_SWAPCTL_BSD)
+static void
+read_swapctl (swap_totals *t)
+{
+	int i=0, nswaps=0, swapctl_res=0;
+	struct swapent *ent;
+
+	/* get the number of active swap devices */
+	if((nswaps=swapctl(SWAP_NSWAP, NULL, 0)) <= 0)
+		return;
+
+	/* initialize swap table + entries */
+	if((ent=(struct swapent*)malloc(sizeof(struct swapent)*nswaps)) == NULL)
+		die(STATE_UNKNOWN, _("malloc() failed!\n"));
+
+	/* and now, tally 'em up */
+	swapctl_res=swapctl(SWAP_STATS, ent, nswaps);
+	if(swapctl_res < 0){
+		perror(_("swapctl failed: "));
+		die(STATE_UNKNOWN, _("Error in swapctl call\n"));
+	}
+
+	for(i=0;i<swapctl_res;i++)
+		add_swap_device (t, (float) ent[i].se_nblks / SWAPCTL_CONVERSION,
+		                 (float) (ent[i].se_nblks - ent[i].se_inuse) / SWAPCTL_CONVERSION);
+
+	/* and clean up after ourselves */
+	free(ent);
+}
+#elif defined(CHECK_SWAP_SYSCTL)
+/* vm.swap_info holds one struct xswdev per device, sizes in pages */
+static void
+read_swapctl (swap_totals *t)
+{
+	int mib[16];
+	size_t mibsize = sizeof (mib) / sizeof (mib[0]) - 1, size;
+	struct xswdev xsw;
+	float page_mb = (float) getpagesize () / 1048576;
+	int n;
+
+	if (sysctlnametomib ("vm.swap_info", mib, &mibsize) == -1)
+		die (STATE_UNKNOWN, _("Cannot get vm.swap_info: %s\n"), strerror (errno));
+	for (n = 0; ; n++) {
+		mib[mibsize] = n;
+		size = sizeof (xsw);
+		if (sysctl (mib, mibsize + 1, &xsw, &size, NULL, 0) == -1)
+			break;
+		add_swap_device (t, xsw.xsw_nblks * page_mb, (xsw.xsw_nblks - xsw.xsw_used) * page_mb);
 	}
-	fclose(fp);
-	dskused_mb = dsktotal_mb - dskfree_mb;
-	total_swap_mb = dsktotal_mb;
-	used_swap_mb = dskused_mb;
-	free_swap_mb = dskfree_mb;
-#else
-# ifdef HAVE_SWAP
+}
+#endif
+
+#if defined(HAVE_SWAP) && !defined(HAVE_PROC_MEMINFO) && \
+    !defined(CHECK_SWAP_SWAPCTL_SVR4) && !defined(CHECK_SWAP_SWAPCTL_BSD) && !defined(CHECK_SWAP_SYSCTL)
+# define CHECK_SWAP_COMMAND 1
+/* Without a way to ask the kernel, parse what SWAP_COMMAND prints */
+static void
+read_swap_command (swap_totals *t)
+{
+	char input_buffer[MAX_INPUT_BUFFER];
+	int conv_factor = SWAP_CONVERSION;
+	float dsktotal_mb = 0, dskfree_mb = 0;
+	char *temp_buffer;
+	char *swap_command;
+	char *swap_format;
+	char str[32];
+
 	xasprintf(&swap_command, "%s", SWAP_COMMAND);
 	xasprintf(&swap_format, "%s", SWAP_FORMAT);
 
 /* These override the command used if a summary (and thus ! allswaps) is required */
 /* The summary flag returns more accurate information about swap usage on these OSes */
-#  ifdef _AIX
+# ifdef _AIX
 	if (!allswaps) {
 		xasprintf(&swap_command, "%s", "/usr/sbin/lsps -s");
 		xasprintf(&swap_format, "%s", "%f%*s %f");
 		conv_factor = 1;
 	}
-#  endif
+# endif
 
 	if (verbose >= 2)
 		printf (_("Command: %s\n"), swap_command);
@@ -172,12 +389,10 @@ main (int argc, char **argv)
 		printf (_("Format: %s\n"), swap_format);
 
 	child_process = spopen (swap_command);
-	if (child_process == NULL) {
-		printf (_("Could not open pipe: %s\n"), swap_command);
-		return STATE_UNKNOWN;
-	}
+	if (child_process == NULL)
+		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), swap_command);
 
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
+	child_stderr = fdopen (spopen_stderr (child_process), "r");
 	if (child_stderr == NULL)
 		printf (_("Could not open stderr for %s\n"), swap_command);
 
@@ -198,173 +413,101 @@ main (int argc, char **argv)
 	}
 
 /* If different swap command is used for summary switch, need to read format differently */
-#  ifdef _AIX
+# ifdef _AIX
 	if (!allswaps) {
 		fgets(input_buffer, MAX_INPUT_BUFFER - 1, child_process);	/* Ignore first line */
-		sscanf (input_buffer, swap_format, &total_swap_mb, &used_swap_mb);
-		free_swap_mb = total_swap_mb * (100 - used_swap_mb) /100;
-		used_swap_mb = total_swap_mb - free_swap_mb;
+		sscanf (input_buffer, swap_format, &t->total_mb, &t->used_mb);
+		t->free_mb = t->total_mb * (100 - t->used_mb) /100;
+		t->used_mb = t->total_mb - t->free_mb;
 		if (verbose >= 3)
-			printf (_("total=%.0f, used=%.0f, free=%.0f\n"), total_swap_mb, used_swap_mb, free_swap_mb);
+			printf (_("total=%.0f, used=%.0f, free=%.0f\n"), t->total_mb, t->used_mb, t->free_mb);
 	} else {
-#  endif
+# endif
 		while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process)) {
 			sscanf (input_buffer, swap_format, &dsktotal_mb, &dskfree_mb);
 
 			dsktotal_mb = dsktotal_mb / conv_factor;
 			/* AIX lists percent used, so this converts to dskfree in MBs */
-#  ifdef _AIX
+# ifdef _AIX
 			dskfree_mb = dsktotal_mb * (100 - dskfree_mb) / 100;
-#  else
+# else
 			dskfree_mb = dskfree_mb / conv_factor;
-#  endif
-			if (verbose >= 3)
-				printf (_("total=%.0f, free=%.0f\n"), dsktotal_mb, dskfree_mb);
-
-			dskused_mb = dsktotal_mb - dskfree_mb;
-			total_swap_mb += dsktotal_mb;
-			used_swap_mb += dskused_mb;
-			free_swap_mb += dskfree_mb;
-			if (allswaps) {
-				percent = 100 * (((double) dskused_mb) / ((double) dsktotal_mb));
-				result = max_state (result, check_swap (percent, dskfree_mb, dsktotal_mb));
-				if (verbose)
-					xasprintf (&status, "%s [%.0f (%d%%)]", status, dskfree_mb, 100 - percent);
-			}
+# endif
+			add_swap_device (t, dsktotal_mb, dskfree_mb);
 		}
-#  ifdef _AIX
+# ifdef _AIX
 	}
-#  endif
+# endif
 
 	/* If we get anything on STDERR, at least set warning */
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_stderr))
-		result = max_state (result, STATE_WARNING);
+	while (child_stderr && fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_stderr))
+		t->result = max_state (t->result, STATE_WARNING);
 
 	/* close stderr */
-	(void) fclose (child_stderr);
+	if (child_stderr)
+		(void) fclose (child_stderr);
 
 	/* close the pipe */
 	if (spclose (child_process))
-		result = max_state (result, STATE_WARNING);
-# else
-#  ifdef CHECK_SWAP_SWAPCTL_SVR4
-
-	/* get the number of active swap devices */
-	if((nswaps=swapctl(SC_GETNSWP, NULL))== -1)
-		die(STATE_UNKNOWN, _("Error getting swap devices\n") );
-
-	if(nswaps == 0)
-		die(STATE_OK, _("SWAP OK: No swap devices defined\n"));
-
-	if(verbose >= 3)
-		printf("Found %d swap device(s)\n", nswaps);
-
-	/* initialize swap table + entries */
-	tbl=(swaptbl_t*)malloc(sizeof(swaptbl_t)+(sizeof(swapent_t)*nswaps));
-
-	if(tbl==NULL)
-		die(STATE_UNKNOWN, _("malloc() failed!\n"));
-
-	memset(tbl, 0, sizeof(swaptbl_t)+(sizeof(swapent_t)*nswaps));
-	tbl->swt_n=nswaps;
-	for(i=0;i<nswaps;i++){
-		if((tbl->swt_ent[i].ste_path=(char*)malloc(sizeof(char)*MAXPATHLEN)) == NULL)
-			die(STATE_UNKNOWN, _("malloc() failed!\n"));
-	}
-
-	/* and now, tally 'em up */
-	swapctl_res=swapctl(SC_LIST, tbl);
-	if(swapctl_res < 0){
-		perror(_("swapctl failed: "));
-		die(STATE_UNKNOWN, _("Error in swapctl call\n"));
-	}
-
-	for(i=0;i<nswaps;i++){
-		dsktotal_mb = (float) tbl->swt_ent[i].ste_pages / SWAP_CONVERSION;
-		dskfree_mb = (float) tbl->swt_ent[i].ste_free /  SWAP_CONVERSION;
-		dskused_mb = ( dsktotal_mb - dskfree_mb );
-
-		if (verbose >= 3)
-			printf ("dsktotal_mb=%.0f dskfree_mb=%.0f dskused_mb=%.0f\n", dsktotal_mb, dskfree_mb, dskused_mb);
-
-		if(allswaps && dsktotal_mb > 0){
-			percent = 100 * (((double) dskused_mb) / ((double) dsktotal_mb));
-			result = max_state (result, check_swap (percent, dskfree_mb, dsktotal_mb));
-			if (verbose) {
-				xasprintf (&status, "%s [%.0f (%d%%)]", status, dskfree_mb, 100 - percent);
-			}
-		}
-
-		total_swap_mb += dsktotal_mb;
-		free_swap_mb += dskfree_mb;
-		used_swap_mb += dskused_mb;
-	}
+		t->result = max_state (t->result, STATE_WARNING);
+}
+#endif
 
-	/* and clean up after ourselves */
-	for(i=0;i<nswaps;i++){
-		free(tbl->swt_ent[i].ste_path);
-	}
-	free(tbl);
-#  else
-#   ifdef CHECK_SWAP_SWAPCTL_BSD
+int
+main (int argc, char **argv)
+{
+	int percent_used;
+	swap_totals t = { 0, 0, 0, STATE_UNKNOWN, NULL };
+	char *rate_perf = "";
+	int result;
 
-	/* get the number of active swap devices */
-	nswaps=swapctl(SWAP_NSWAP, NULL, 0);
+	np_locale_init ();
 
-	/* initialize swap table + entries */
-	ent=(struct swapent*)malloc(sizeof(struct swapent)*nswaps);
+	t.status = strdup ("");
 
-	/* and now, tally 'em up */
-	swapctl_res=swapctl(SWAP_STATS, ent, nswaps);
-	if(swapctl_res < 0){
-		perror(_("swapctl failed: "));
-		die(STATE_UNKNOWN, _("Error in swapctl call\n"));
-	}
-
-	for(i=0;i<nswaps;i++){
-		dsktotal_mb = (float) ent[i].se_nblks / conv_factor;
-		dskused_mb = (float) ent[i].se_inuse / conv_factor;
-		dskfree_mb = ( dsktotal_mb - dskused_mb );
-
-		if(allswaps && dsktotal_mb > 0){
-			percent = 100 * (((double) dskused_mb) / ((double) dsktotal_mb));
-			result = max_state (result, check_swap (percent, dskfree_mb, dsktotal_mb));
-			if (verbose) {
-				xasprintf (&status, "%s [%.0f (%d%%)]", status, dskfree_mb, 100 - percent);
-			}
-		}
+	/* Parse extra opts if any */
+	argv=np_extra_opts (&argc, argv, progname);
 
-		total_swap_mb += dsktotal_mb;
-		free_swap_mb += dskfree_mb;
-		used_swap_mb += dskused_mb;
-	}
+	np_init ((char *) progname, argc, argv);
 
-	/* and clean up after ourselves */
-	free(ent);
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
 
-#   endif /* CHECK_SWAP_SWAPCTL_BSD */
-#  endif /* CHECK_SWAP_SWAPCTL_SVR4 */
-# endif /* HAVE_SWAP */
-#endif /* HAVE_PROC_MEMINFO */
+	/* The kernel is asked directly where it can be: /proc on Linux (with
+	 * /proc/swaps for the devices), swapctl() on SVR4 and the BSDs, or
+	 * sysctl() on FreeBSD. Only the rest runs SWAP_COMMAND. */
+#ifdef HAVE_PROC_MEMINFO
+	if (!allswaps || !read_proc_swaps (&t))
+		read_proc_meminfo (&t);
+#elif defined(CHECK_SWAP_SWAPCTL_SVR4) || defined(CHECK_SWAP_SWAPCTL_BSD) || defined(CHECK_SWAP_SYSCTL)
+	read_swapctl (&t);
+#elif defined(CHECK_SWAP_COMMAND)
+	read_swap_command (&t);
+#endif
+	result = t.result;
 
 	/* if total_swap_mb == 0, let's not divide by 0 */
-	if(total_swap_mb) {
-		percent_used = 100 * ((double) used_swap_mb) / ((double) total_swap_mb);
+	if(t.total_mb) {
+		percent_used = 100 * ((double) t.used_mb) / ((double) t.total_mb);
 	} else {
 		percent_used = 100;
-		status = "- Swap is either disabled, not present, or of zero size. ";
+		t.status = "- Swap is either disabled, not present, or of zero size. ";
 	}
 
-	result = max_state (result, check_swap (percent_used, free_swap_mb, total_swap_mb));
+	result = max_state (result, check_swap (percent_used, t.free_mb, t.total_mb));
+#ifdef HAVE_PROC_MEMINFO
+	if (check_rates)
+		result = max_state (result, check_swap_rates (&t.status, &rate_perf));
+#endif
 	printf (_("SWAP %s - %d%% free (%d MB out of %d MB) %s|"),
 			state_text (result),
-			(100 - percent_used), (int) free_swap_mb, (int) total_swap_mb, status);
+			(100 - percent_used), (int) t.free_mb, (int) t.total_mb, t.status);
 
-	puts (perfdata ("swap", (long) free_swap_mb, "MB",
-	                TRUE, (long) max (warn_size_bytes/(1024 * 1024), warn_percent/100.0*total_swap_mb),
-	                TRUE, (long) max (crit_size_bytes/(1024 * 1024), crit_percent/100.0*total_swap_mb),
+	printf ("%s%s\n", perfdata ("swap", (long) t.free_mb, "MB",
+	                TRUE, (long) max (warn_size_bytes/(1024 * 1024), warn_percent/100.0*t.total_mb),
+	                TRUE, (long) max (crit_size_bytes/(1024 * 1024), crit_percent/100.0*t.total_mb),
 	                TRUE, 0,
-	                TRUE, (long) total_swap_mb));
+	                TRUE, (long) t.total_mb), rate_perf);
 
 	return result;
 }
@@ -399,6 +542,8 @@ int
 process_arguments (int argc, char **argv)
 {
 	int c = 0;  /* option character */
+	int rate;
+	char *crit;
 
 	int option = 0;
 	static struct option longopts[] = {
@@ -409,6 +554,9 @@ process_arguments (int argc, char **argv)
 		{"verbose", no_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
+		{"swap-in", required_argument, 0, CHAR_MAX+1},
+		{"swap-out", required_argument, 0, CHAR_MAX+2},
+		{"major-faults", required_argument, 0, CHAR_MAX+3},
 		{0, 0, 0, 0}
 	};
 
@@ -476,6 +624,24 @@ process_arguments (int argc, char **argv)
 			exit (STATE_UNKNOWN);
 		case '?':									/* error */
 			usage5 ();
+		case CHAR_MAX+1:					/* rate thresholds, WARN[,CRIT] */
+		case CHAR_MAX+2:
+		case CHAR_MAX+3:
+#ifndef HAVE_PROC_MEMINFO
+			usage4 (_("Swap activity can only be checked with /proc/vmstat"));
+#endif
+			rate = c - (CHAR_MAX+1);
+			rate_warn[rate] = strdup (optarg);
+			if ((crit = strchr (rate_warn[rate], ',')) != NULL) {
+				*crit++ = '\0';
+				rate_crit[rate] = *crit ? crit : NULL;
+			}
+			if (*rate_warn[rate] == '\0')
+				rate_warn[rate] = NULL;
+			if (_set_thresholds (&rate_thresholds[rate], rate_warn[rate], rate_crit[rate]) != 0)
+				usage2 (_("Invalid swap activity threshold"), optarg);
+			check_rates = TRUE;
+			break;
 		}
 	}
 
@@ -509,7 +675,7 @@ int
 validate_arguments (void)
 {
 	if (warn_percent == 0 && crit_percent == 0 && warn_size_bytes == 0
-			&& crit_size_bytes == 0) {
+			&& crit_size_bytes == 0 && !check_rates) {
 		return ERROR;
 	}
 	else if (warn_percent < crit_percent) {
@@ -551,8 +717,21 @@ print_help (void)
   printf ("    %s\n", _("Exit with CRITICAL status if less than PERCENT of swap space is free"));
   printf (" %s\n", "-a, --allswaps");
   printf ("    %s\n", _("Conduct comparisons for all swap partitions, one by one"));
+#ifdef HAVE_PROC_MEMINFO
+  printf ("    %s\n", _("(as listed in /proc/swaps)"));
+#endif
   printf (" %s\n", "-n, --no-swap=<ok|warning|critical|unknown>");
   printf ("    %s %s\n", _("Resulting state when there is no swap regardless of thresholds. Default:"), state_text(no_swap_state));
+#ifdef HAVE_PROC_MEMINFO
+  printf (" %s\n", "--swap-in=WARN[,CRIT]");
+  printf ("    %s\n", _("Pages swapped in a second since the last run above which to warn"));
+  printf (" %s\n", "--swap-out=WARN[,CRIT]");
+  printf ("    %s\n", _("Pages swapped out a second since the last run"));
+  printf (" %s\n", "--major-faults=WARN[,CRIT]");
+  printf ("    %s\n", _("Page faults a second since the last run that had to wait for the disk"));
+  printf ("    %s\n", _("The counters of the last run are kept in the state; any of these reports"));
+  printf ("    %s\n", _("all three rates"));
+#endif
 	printf (UT_VERBOSE);
 
 	printf ("\n");
@@ -571,4 +750,5 @@ print_usage (void)
 	printf ("%s\n", _("Usage:"));
   printf (" %s [-av] -w <percent_free>%% -c <percent_free>%%\n",progname);
   printf ("  -w <bytes_free> -c <bytes_free> [-n <state>]\n");
+  printf ("  [--swap-in=warn[,crit]] [--swap-out=warn[,crit]] [--major-faults=warn[,crit]]\n");
 }
@@ -27,6 +27,8 @@
 *
 *****************************************************************************/
 
+#include "np_entry.h"
+
 /* progname "check_tcp" changes depending on symlink called */
 char *progname;
 const char *copyright = "1999-2008";
@@ -36,6 +38,7 @@ const char *email = "devel@monitoring-plugins.org";
 #include "netutils.h"
 #include "utils.h"
 #include "utils_tcp.h"
+#include "utils_targets.h"
 
 #include <ctype.h>
 #include <sys/select.h>
@@ -52,6 +55,8 @@ static int days_till_exp_warn, days_till_exp_crit;
 
 /* int my_recv(char *, size_t); */
 static int process_arguments (int, char **);
+static int run_multi_target (void);
+static char *mail_dialogue (void);
 void print_help (void);
 void print_usage (void);
 
@@ -98,23 +103,63 @@ static int sni_specified = FALSE;
 #define FLAG_HIDE_OUTPUT 0x10
 static size_t flags;
 
+/* multi-target mode */
+#define DEFAULT_CONCURRENCY 64
+#define DEFAULT_UDP_RETRIES 2
+#define DEFAULT_UDP_RETRY_INTERVAL 0.5
+static char *targets_file = NULL;
+static int sharded = FALSE;
+/* seconds between full reports with --changes, -1 without it */
+static long changes_refresh = -1;
+static int udp_retries = DEFAULT_UDP_RETRIES;
+static double udp_retry_interval = DEFAULT_UDP_RETRY_INTERVAL;
+static int concurrency = DEFAULT_CONCURRENCY;
+
+/* seconds to keep host name lookups for the next run, 0 to not keep them */
+static long dns_cache_age = 0;
+/* connects get this many times their usual time, 0 for socket_timeout */
+static double adaptive_factor = 0;
+static int ssl_session_cache = FALSE;
+static int cert_cache_ttl = 0;
+/* the provider or engine the handshakes offload their crypto to, or NULL */
+static char *tls_offload = NULL;
+
+/* what the kernel measured of the connection, with --tcp-info */
+static int tcp_info = FALSE;
+static int fast_open = FALSE;
+
+/* the dialogue of check_imap and check_pop, with --starttls or --authuser */
+#define MAIL_NONE 0
+#define MAIL_IMAP 1
+#define MAIL_POP 2
+static int mail_protocol = MAIL_NONE;
+static int mail_dialogue_mode = FALSE;
+static int starttls = FALSE;
+static char *authuser = NULL;
+static char *authpass = NULL;
+static np_net_reader reader;
+static double banner_time = 0;
+static double login_time = -1;
+
 int
 main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
 	int i;
 	char *status = NULL;
+	char *timing;
 	struct timeval tv;
 	struct timeval timeout;
-	size_t len;
+	size_t len, size = 0;
+	np_expect_state expect = NP_EXPECT_STATE_INIT;
 	int match = -1;
 	fd_set rfds;
+	np_tcp_info tcp_connected, tcp_done;
+	int have_tcp_info = FALSE;
 
 	FD_ZERO(&rfds);
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* determine program- and service-name quickly */
 	progname = strrchr(argv[0], '/');
@@ -144,6 +189,7 @@ main (int argc, char **argv)
 	else if (!strncmp(SERVICE, "POP", 3) || !strncmp(SERVICE, "POP3", 4)) {
 		EXPECT = "+OK";
 		QUIT = "QUIT\r\n";
+		mail_protocol = MAIL_POP;
 		PORT = 110;
 	}
 	else if (!strncmp(SERVICE, "SMTP", 4)) {
@@ -154,18 +200,21 @@ main (int argc, char **argv)
 	else if (!strncmp(SERVICE, "IMAP", 4)) {
 		EXPECT = "* OK";
 		QUIT = "a1 LOGOUT\r\n";
+		mail_protocol = MAIL_IMAP;
 		PORT = 143;
 	}
 #ifdef HAVE_SSL
 	else if (!strncmp(SERVICE, "SIMAP", 5)) {
 		EXPECT = "* OK";
 		QUIT = "a1 LOGOUT\r\n";
+		mail_protocol = MAIL_IMAP;
 		flags |= FLAG_SSL;
 		PORT = 993;
 	}
 	else if (!strncmp(SERVICE, "SPOP", 4)) {
 		EXPECT = "+OK";
 		QUIT = "QUIT\r\n";
+		mail_protocol = MAIL_POP;
 		flags |= FLAG_SSL;
 		PORT = 995;
 	}
@@ -221,6 +270,19 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (dns_cache_age > 0 || ssl_session_cache || cert_cache_ttl > 0 || adaptive_factor > 0 ||
+	    changes_refresh >= 0) {
+		np_init ((char *) progname, argc, argv);
+		if (dns_cache_age > 0)
+			np_resolve_cache_load (dns_cache_age);
+		if (adaptive_factor > 0)
+			np_net_adaptive_load (adaptive_factor);
+#ifdef HAVE_SSL
+		if (cert_cache_ttl > 0)
+			np_net_ssl_cert_cache (cert_cache_ttl);
+#endif
+	}
+
 	if(flags & FLAG_VERBOSE) {
 		printf("Using service %s\n", SERVICE);
 		printf("Port: %d\n", server_port);
@@ -234,18 +296,34 @@ main (int argc, char **argv)
 		usage(_("With UDP checks, a send/expect string must be specified."));
 	}
 
+	if (targets_file != NULL)
+		return run_multi_target ();
+
 	/* set up the timer */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 	alarm (socket_timeout);
 
 	/* try to connect to the host at the given port number */
+	np_net_tcp_fast_open (fast_open);
 	gettimeofday (&tv, NULL);
 
 	result = np_net_connect (server_address, server_port, &sd, PROTOCOL);
+	if (dns_cache_age > 0)
+		np_resolve_cache_save ();
+	if (adaptive_factor > 0)
+		np_net_adaptive_save ();
 	if (result == STATE_CRITICAL) return econn_refuse_state;
+	if (flags & FLAG_VERBOSE && PROTOCOL == IPPROTO_TCP && server_address[0] != '/')
+		printf ("Connected over %s in %.3f seconds\n",
+		        np_net_connect_family () == AF_INET6 ? "IPv6" : "IPv4", np_net_connect_time ());
+	/* right after the handshake the smoothed RTT is the one of the SYN */
+	if (tcp_info)
+		have_tcp_info = np_net_tcp_info (sd, &tcp_connected);
 
 #ifdef HAVE_SSL
 	if (flags & FLAG_SSL){
+		if (ssl_session_cache)
+			np_net_ssl_session_cache (server_address, server_port, (sni_specified ? sni : NULL));
 		result = np_net_ssl_init_with_hostname(sd, (sni_specified ? sni : NULL));
 		if (result == STATE_OK && check_cert == TRUE) {
 			result = np_net_ssl_check_cert(days_till_exp_warn, days_till_exp_crit);
@@ -258,8 +336,14 @@ main (int argc, char **argv)
 	}
 #endif /* HAVE_SSL */
 
-	if (server_send != NULL) {		/* Something to send? */
+	if (mail_dialogue_mode) {
+		status = mail_dialogue ();
+		match = NP_MATCH_SUCCESS;
+	}
+	else if (server_send != NULL) {		/* Something to send? */
+		np_span_begin ("request");
 		my_send(server_send, strlen(server_send));
+		np_span_end ();
 	}
 
 	if (delay > 0) {
@@ -280,12 +364,20 @@ main (int argc, char **argv)
 	}
 
 	/* if(len) later on, we know we have a non-NULL response */
-	len = 0;
-	if (server_expect_count) {
+	len = mail_dialogue_mode ? strlen (status) : 0;
+	if (server_expect_count && !mail_dialogue_mode) {
 
 		/* watch for the expect string */
+		np_span_begin ("response");
 		while ((i = my_recv(buffer, sizeof(buffer))) > 0) {
-			status = realloc(status, len + i + 1);
+			if (len + i + 1 > size) {
+				/* double it, a slow server sends a few bytes at a time */
+				size = size ? size : sizeof(buffer);
+				while (len + i + 1 > size)
+					size *= 2;
+				if ((status = realloc(status, size)) == NULL)
+					die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			}
 			memcpy(&status[len], buffer, i);
 			len += i;
 			status[len] = '\0';
@@ -294,7 +386,9 @@ main (int argc, char **argv)
 			if (maxbytes && len >= maxbytes)
 				break;
 
-			if ((match = np_expect_match(status,
+			/* only what just came in is looked at */
+			if ((match = np_expect_match_more(&expect,
+			    status, len,
 			    server_expect,
 			    server_expect_count,
 			    match_flags)) != NP_MATCH_RETRY)
@@ -307,6 +401,8 @@ main (int argc, char **argv)
 			if(select(sd + 1, &rfds, NULL, NULL, &timeout) <= 0)
 				break;
 		}
+		np_span_end ();
+		np_expect_free(&expect);
 		if (match == NP_MATCH_RETRY)
 			match = NP_MATCH_FAILURE;
 
@@ -323,6 +419,13 @@ main (int argc, char **argv)
 			status[len] = '\0';
 	}
 
+	if (have_tcp_info)
+		have_tcp_info = np_net_tcp_info (sd, &tcp_done);
+	if (have_tcp_info && flags & FLAG_VERBOSE)
+		printf ("TCP round trip %.6f seconds (+/- %.6f), %u retransmits%s\n",
+		        tcp_done.rtt, tcp_done.rttvar, tcp_done.retransmits,
+		        tcp_done.fast_open ? ", data sent with the SYN" : "");
+
 	if (server_quit != NULL) {
 		my_send(server_quit, strlen(server_quit));
 	}
@@ -392,12 +495,569 @@ main (int argc, char **argv)
 				TRUE, socket_timeout)
 			);
 
+	if (mail_dialogue_mode)
+		printf (" %s", fperfdata ("time_banner", banner_time, "s",
+		        FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout));
+
+	if (adaptive_factor > 0)
+		printf (" %s", fperfdata ("connect_timeout", np_net_connect_timeout (), "s",
+		        FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout));
+
+#ifdef HAVE_SSL
+	/* a resumed handshake is much cheaper, keep it apart from a full one */
+	if (ssl_session_cache)
+		printf (" %s",
+				fperfdata (np_net_ssl_session_reused () ? "time_tls_resumed" : "time_tls",
+				np_net_ssl_handshake_time (), "s",
+				FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout)
+			);
+	/* the handshake after STARTTLS, or of check_simap and check_spop */
+	if (mail_dialogue_mode && flags & FLAG_SSL && !ssl_session_cache)
+		printf (" %s", fperfdata ("time_tls", np_net_ssl_handshake_time (), "s",
+		        FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout));
+	/* of that, the time the device took */
+	if (tls_offload)
+		printf (" %s", fperfdata ("time_tls_crypto_wait", np_net_ssl_crypto_wait_time (), "s",
+		        FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout));
+#endif
+	if (login_time >= 0)
+		printf (" %s", fperfdata ("time_login", login_time, "s",
+		        FALSE, 0, FALSE, 0, TRUE, 0, TRUE, socket_timeout));
+
+	/* the same as the kernel measured it, without the scheduling delays of
+	 * this process */
+	if (have_tcp_info) {
+		if (tcp_connected.established)
+			printf (" %s", fperfdata ("tcp_established", tcp_connected.rtt, "s",
+			        FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+		printf (" %s", fperfdata ("tcp_rtt", tcp_done.rtt, "s",
+		        FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+		printf (" %s", perfdata ("tcp_retransmits", tcp_done.retransmits, "",
+		        FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+	}
+
+	/* where the time went, with --timing-perfdata */
+	timing = np_timing_perfdata ();
+	if (*timing)
+		printf (" %s", timing);
+
 	putchar('\n');
 	return result;
 }
 
 
 
+/* The dialogue of check_imap and check_pop with --starttls or --authuser:
+ * the greeting, the capabilities, STARTTLS and the login, read through the
+ * buffered line reader. Anything that goes wrong ends the check. */
+
+static void
+mail_fail (int state, const char *what, const char *reply)
+{
+	if (sd) close (sd);
+#ifdef HAVE_SSL
+	np_net_ssl_cleanup ();
+#endif
+	if (reply != NULL)
+		die (state, "%s %s - %s: %s\n", SERVICE, state_text (state), what, reply);
+	die (state, "%s %s - %s\n", SERVICE, state_text (state), what);
+}
+
+static void
+mail_send (const char *cmd)
+{
+	if (my_send (cmd, strlen (cmd)) <= 0)
+		mail_fail (STATE_CRITICAL, _("Cannot send to host"), NULL);
+}
+
+/* the next line from the server, without the line break */
+static char *
+mail_line (void)
+{
+	static char line[MAX_INPUT_BUFFER];
+	int n;
+
+	/* the rest of an overlong line is taken for a line of its own, which
+	 * no reply looked for starts like */
+	if ((n = np_net_recvline (&reader, line, sizeof (line))) == -2)
+		line[sizeof (line) - 1] = '\0';
+	else if (n == 0)
+		mail_fail (STATE_CRITICAL, _("Connection closed by host"), NULL);
+	else if (n < 0)
+		mail_fail (STATE_CRITICAL, _("No data received from host"), NULL);
+
+	n = strlen (line);
+	while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+		line[--n] = '\0';
+	if (flags & FLAG_VERBOSE)
+		printf ("< %s\n", line);
+	return line;
+}
+
+/* whether the space separated list caps has the capability name */
+static int
+mail_capable (const char *caps, const char *name)
+{
+	size_t len = strlen (name);
+	const char *p;
+
+	for (p = caps; p != NULL && (p = strcasestr (p, name)) != NULL; p += len)
+		if ((p == caps || p[-1] == ' ') && (p[len] == '\0' || p[len] == ' '))
+			return TRUE;
+	return FALSE;
+}
+
+#ifdef HAVE_SSL
+static void
+mail_starttls (void)
+{
+	int result;
+
+	if (ssl_session_cache)
+		np_net_ssl_session_cache (server_address, server_port, (sni_specified ? sni : NULL));
+	result = np_net_ssl_init_with_hostname (sd, (sni_specified ? sni : NULL));
+	if (result == STATE_OK && check_cert == TRUE)
+		result = np_net_ssl_check_cert (days_till_exp_warn, days_till_exp_crit);
+	if (result != STATE_OK) {
+		close (sd);
+		np_net_ssl_cleanup ();
+		exit (result);
+	}
+	flags |= FLAG_SSL;
+	/* nothing the server sent before the handshake counts */
+	np_net_reader_init (&reader, sd, np_net_ssl_read);
+}
+#endif
+
+/* Read up to the tagged reply to tag and return whether it is OK, with the
+ * line of it in reply. The untagged CAPABILITY response goes to caps. */
+static int
+imap_reply (const char *tag, char **caps, char **reply)
+{
+	size_t len = strlen (tag);
+	char *line;
+
+	do {
+		line = mail_line ();
+		if (caps != NULL && !strncasecmp (line, "* CAPABILITY ", 13)) {
+			free (*caps);
+			*caps = strdup (line + 13);
+		}
+	} while (strncmp (line, tag, len) || line[len] != ' ');
+
+	*reply = line;
+	return !strncasecmp (line + len + 1, "OK", 2);
+}
+
+/* s as an IMAP quoted string */
+static char *
+imap_quote (const char *s)
+{
+	char *quoted, *p;
+
+	if ((quoted = p = malloc (2 * strlen (s) + 3)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	*p++ = '"';
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			*p++ = '\\';
+		*p++ = *s;
+	}
+	*p++ = '"';
+	*p = '\0';
+	return quoted;
+}
+
+/* IMAP tags every command, so they go out together, but for STARTTLS, after
+ * which nothing may be sent before the handshake: CAPABILITY and STARTTLS in
+ * one round trip, then CAPABILITY, LOGIN and LOGOUT in another */
+static void
+imap_dialogue (void)
+{
+	char *caps = NULL, *reply, *cmds = NULL, *user, *pass;
+	struct timeval tv;
+	int ok;
+
+#ifdef HAVE_SSL
+	if (starttls) {
+		mail_send ("a1 CAPABILITY\r\na2 STARTTLS\r\n");
+		imap_reply ("a1", &caps, &reply);
+		if (!imap_reply ("a2", NULL, &reply)) {
+			if (mail_capable (caps, "STARTTLS"))
+				mail_fail (STATE_CRITICAL, _("STARTTLS refused"), reply);
+			mail_fail (STATE_WARNING, _("TLS not supported by server"), NULL);
+		}
+		mail_starttls ();
+		/* what the server said before the handshake does not count
+		 * (RFC 3501, 6.2.1) */
+		free (caps);
+		caps = NULL;
+	}
+#endif
+
+	xasprintf (&cmds, "a3 CAPABILITY\r\n");
+	if (authuser != NULL) {
+		user = imap_quote (authuser);
+		pass = imap_quote (authpass);
+		xasprintf (&cmds, "%sa4 LOGIN %s %s\r\n", cmds, user, pass);
+		free (user);
+		free (pass);
+	}
+	xasprintf (&cmds, "%sa5 LOGOUT\r\n", cmds);
+
+	gettimeofday (&tv, NULL);
+	mail_send (cmds);
+	free (cmds);
+	if (!imap_reply ("a3", &caps, &reply))
+		mail_fail (STATE_CRITICAL, _("CAPABILITY failed"), reply);
+	if (authuser != NULL) {
+		ok = imap_reply ("a4", NULL, &reply);
+		login_time = delta_time (tv);
+		if (!ok)
+			mail_fail (STATE_CRITICAL, mail_capable (caps, "LOGINDISABLED") ?
+			           _("Login disabled") : _("Login failed"), reply);
+	}
+	free (caps);
+	/* the reply to LOGOUT is not waited for, like the quit string's */
+}
+
+/* POP3 commands go out one by one: they may only be pipelined once CAPA
+ * listed PIPELINING (RFC 2449), and what CAPA said before STLS does not count
+ * after it (RFC 2595, 4), so asking again would cost what pipelining saves */
+static void
+pop_dialogue (void)
+{
+	char *line, *cmd = NULL;
+	struct timeval tv;
+
+#ifdef HAVE_SSL
+	if (starttls) {
+		int capable = FALSE;
+
+		mail_send ("CAPA\r\n");
+		if (!strncmp (mail_line (), "+OK", 3))
+			while (strcmp (line = mail_line (), "."))
+				if (!strcasecmp (line, "STLS"))
+					capable = TRUE;
+		if (!capable)
+			mail_fail (STATE_WARNING, _("TLS not supported by server"), NULL);
+		mail_send ("STLS\r\n");
+		if (strncmp (line = mail_line (), "+OK", 3))
+			mail_fail (STATE_CRITICAL, _("STLS refused"), line);
+		mail_starttls ();
+	}
+#endif
+
+	if (authuser != NULL) {
+		gettimeofday (&tv, NULL);
+		xasprintf (&cmd, "USER %s\r\n", authuser);
+		mail_send (cmd);
+		free (cmd);
+		if (strncmp (line = mail_line (), "+OK", 3))
+			mail_fail (STATE_CRITICAL, _("Login failed"), line);
+		xasprintf (&cmd, "PASS %s\r\n", authpass);
+		mail_send (cmd);
+		free (cmd);
+		line = mail_line ();
+		login_time = delta_time (tv);
+		if (strncmp (line, "+OK", 3))
+			mail_fail (STATE_CRITICAL, _("Login failed"), line);
+	}
+	mail_send ("QUIT\r\n");
+}
+
+/* Returns the greeting, which goes into the output like a response would */
+static char *
+mail_dialogue (void)
+{
+	const char *expect = mail_protocol == MAIL_IMAP ? "* OK" : "+OK";
+	struct timeval tv;
+	char *banner;
+
+	gettimeofday (&tv, NULL);
+#ifdef HAVE_SSL
+	np_net_reader_init (&reader, sd, (flags & FLAG_SSL) ? np_net_ssl_read : NULL);
+#else
+	np_net_reader_init (&reader, sd, NULL);
+#endif
+	banner = mail_line ();
+	banner_time = delta_time (tv);
+	if (strncmp (banner, expect, strlen (expect)))
+		mail_fail (expect_mismatch_state, _("Unexpected response from host/socket"), banner);
+	banner = strdup (banner);
+
+	if (mail_protocol == MAIL_IMAP)
+		imap_dialogue ();
+	else
+		pop_dialogue ();
+	return banner;
+}
+
+
+
+/* Multi-target mode: every target from the target list gets its own
+ * connection from np_conn_run(), and is judged exactly like a single
+ * check_tcp run would judge it. */
+
+/* judge a target that got connected, the same way main() does */
+static void
+target_judge (np_conn *t)
+{
+	int result = STATE_OK;
+	char *message = NULL;
+
+	t->elapsed = (double)deltime (t->start) / 1.0e6;
+
+	if (server_expect_count) {
+		if (t->match == NP_MATCH_RETRY || t->match == -1)
+			t->match = NP_MATCH_FAILURE;
+		if (t->len == 0) {
+			np_conn_finish (t, STATE_CRITICAL, strdup (_("No data received from host")));
+			return;
+		}
+		while (--t->len > 0 && isspace (t->data[t->len]))
+			t->data[t->len] = '\0';
+	}
+
+	if (flags & FLAG_TIME_CRIT && t->elapsed > critical_time)
+		result = STATE_CRITICAL;
+	else if (flags & FLAG_TIME_WARN && t->elapsed > warning_time)
+		result = STATE_WARNING;
+
+	if (t->match == NP_MATCH_FAILURE && result != STATE_CRITICAL)
+		result = expect_mismatch_state;
+
+	if (t->match == NP_MATCH_FAILURE && t->len && !(flags & FLAG_HIDE_OUTPUT))
+		xasprintf (&message, _("Unexpected response from host/socket: %s"), t->data);
+	else if (t->match == NP_MATCH_FAILURE)
+		xasprintf (&message, "%s", _("Unexpected response from host/socket"));
+	else if (!(flags & FLAG_HIDE_OUTPUT) && t->len)
+		xasprintf (&message, _("%.3f second response time [%s]"), t->elapsed, t->data);
+	else
+		xasprintf (&message, _("%.3f second response time"), t->elapsed);
+
+	np_conn_finish (t, result, message);
+}
+
+static void
+target_connected (np_conn *t)
+{
+	if (server_send != NULL)
+		send (t->fd, server_send, strlen (server_send), 0);
+
+	if (!server_expect_count)
+		target_judge (t);
+}
+
+/* how far the response of each target has been matched, by its index */
+static np_conn *target_list;
+static np_expect_state *target_expect;
+
+static void
+target_received (np_conn *t)
+{
+	np_expect_state *expect = &target_expect[t - target_list];
+
+	if ((maxbytes && t->len >= maxbytes) ||
+	    (t->match = np_expect_match_more (expect, t->data, t->len, server_expect,
+	                                      server_expect_count, match_flags)) != NP_MATCH_RETRY) {
+		np_expect_free (expect);
+		target_judge (t);
+	}
+}
+
+#ifdef HAVE_SSL
+/* With SSL, a target is only taken as far as the TLS handshake, and its
+ * certificate is judged right there with -D. */
+struct target_tls {
+	SSL *ssl;
+	double handshake;	/* seconds, -1 until it is done */
+	double crypto_wait;	/* of them waiting on the offload device */
+};
+
+static int
+target_handshake (np_conn *t)
+{
+	struct target_tls *tls = t->session;
+	char *message = NULL, *cert_message = NULL;
+	int result = STATE_OK, events;
+
+	if (tls == NULL) {
+		if ((tls = t->session = malloc (sizeof (struct target_tls))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		tls->handshake = -1;
+		tls->ssl = np_net_ssl_handshake_start (t->fd, t->sni ? t->sni : (sni_specified ? sni : NULL));
+		if (tls->ssl == NULL) {
+			np_conn_finish (t, STATE_CRITICAL, strdup (_("Cannot initiate SSL handshake.")));
+			return 0;
+		}
+	}
+
+	if ((events = np_net_ssl_handshake_continue (tls->ssl, &message)) > 0) {
+		/* the socket, or the device while it has the crypto */
+		t->wait_fd = np_net_ssl_handshake_wait_fd (tls->ssl);
+		return events;
+	}
+	if (events < 0) {
+		np_conn_finish (t, STATE_CRITICAL, message);
+		return 0;
+	}
+
+	tls->handshake = (double)deltime (t->connected) / 1.0e6;
+	tls->crypto_wait = np_net_ssl_handshake_crypto_wait (tls->ssl);
+	t->elapsed = (double)deltime (t->start) / 1.0e6;
+
+	if (flags & FLAG_TIME_CRIT && t->elapsed > critical_time)
+		result = STATE_CRITICAL;
+	else if (flags & FLAG_TIME_WARN && t->elapsed > warning_time)
+		result = STATE_WARNING;
+
+	if (check_cert == TRUE) {
+		result = max_state (result, np_net_ssl_handshake_cert (tls->ssl, days_till_exp_warn,
+		                                                       days_till_exp_crit, &cert_message));
+		xasprintf (&message, _("%.3f second handshake, %s"), tls->handshake, cert_message);
+		free (cert_message);
+	}
+	else
+		xasprintf (&message, _("%.3f second response time, %.3f second handshake"),
+		           t->elapsed, tls->handshake);
+
+	np_conn_finish (t, result, message);
+	return 0;
+}
+#endif /* HAVE_SSL */
+
+static int
+run_multi_target (void)
+{
+	np_conn *targets;
+	np_conn_ops ops;
+	size_t count, i;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int result = STATE_OK;
+	char *perf = NULL, *shown = NULL;
+	const char **names;
+	np_changes *changes = NULL;
+
+	targets = np_conn_read_list (targets_file, server_port, &count);
+	target_list = targets;
+	if ((target_expect = calloc (count ? count : 1, sizeof (np_expect_state))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	/* look up all host names at once rather than one by one as the
+	 * targets start */
+	if ((names = calloc (count ? count : 1, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < count; i++)
+		names[i] = targets[i].host;
+	np_resolve_prefetch (names, count, address_family, concurrency);
+	free (names);
+	if (dns_cache_age > 0)
+		np_resolve_cache_save ();
+
+	memset (&ops, 0, sizeof (ops));
+	ops.connected = target_connected;
+	ops.received = target_received;
+	ops.judge = target_judge;
+	ops.quit = server_quit;
+	ops.read_timeout = READ_TIMEOUT;
+#ifdef HAVE_SSL
+	if (flags & FLAG_SSL)
+		ops.handshake = target_handshake;
+#endif
+	if (PROTOCOL == IPPROTO_UDP) {
+		/* one socket for all of them, answers are told apart by
+		 * their source address */
+		ops.request = server_send;
+		ops.retries = udp_retries;
+		ops.retry_interval = udp_retry_interval;
+		np_udp_run (targets, count, &ops);
+	}
+	else {
+		double start = np_clock (), elapsed;
+
+		np_conn_run (targets, count, concurrency, &ops);
+		elapsed = np_clock () - start;
+		if (adaptive_factor > 0)
+			np_net_adaptive_save ();
+		if (flags & FLAG_VERBOSE)
+			printf (_("%lu targets in %.3f seconds, %.0f per second, with %s\n"),
+			        (unsigned long)count, elapsed, elapsed > 0 ? count / elapsed : 0.0,
+			        np_conn_engine_name ());
+	}
+
+	for (i = 0; i < count; i++) {
+		result = max_state (result, targets[i].result);
+		if (targets[i].result >= STATE_OK && targets[i].result <= STATE_DEPENDENT)
+			states[targets[i].result]++;
+	}
+
+	/* with --changes only the targets whose state changed are listed */
+	if (changes_refresh >= 0) {
+		changes = np_changes_load (changes_refresh);
+		if ((shown = calloc (count ? count : 1, 1)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		for (i = 0; i < count; i++) {
+			xasprintf (&perf, "%s:%d", targets[i].host, targets[i].port);
+			shown[i] = np_changes_check (changes, perf, targets[i].result);
+			free (perf);
+		}
+	}
+
+	printf (_("%s %s - %lu targets: %d ok, %d warning, %d critical, %d unknown"),
+	        SERVICE, state_text (result), (unsigned long)count, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+	if (changes != NULL)
+		printf (changes->full ? _(", %lu changed, all listed") : _(", %lu changed"), changes->changed);
+
+	printf ("|");
+	for (i = 0; i < count; i++) {
+		if (shown != NULL && !shown[i])
+			continue;
+		xasprintf (&perf, "%s:%d", targets[i].host, targets[i].port);
+		printf ("%s%s", i ? " " : "",
+		        fperfdata (perf, targets[i].elapsed, "s",
+		                   (flags & FLAG_TIME_WARN ? TRUE : FALSE), warning_time,
+		                   (flags & FLAG_TIME_CRIT ? TRUE : FALSE), critical_time,
+		                   TRUE, 0, TRUE, socket_timeout));
+		free (perf);
+#ifdef HAVE_SSL
+		if (targets[i].session != NULL) {
+			struct target_tls *tls = targets[i].session;
+			if (tls->handshake >= 0) {
+				xasprintf (&perf, "%s:%d_handshake", targets[i].host, targets[i].port);
+				printf (" %s", fperfdata (perf, tls->handshake, "s", FALSE, 0, FALSE, 0,
+				                          TRUE, 0, TRUE, socket_timeout));
+				free (perf);
+				if (tls_offload) {
+					xasprintf (&perf, "%s:%d_crypto_wait", targets[i].host, targets[i].port);
+					printf (" %s", fperfdata (perf, tls->crypto_wait, "s", FALSE, 0, FALSE, 0,
+					                          TRUE, 0, TRUE, socket_timeout));
+					free (perf);
+				}
+			}
+			if (tls->ssl != NULL)
+				np_net_ssl_handshake_free (tls->ssl);
+			free (tls);
+		}
+#endif
+	}
+	putchar ('\n');
+
+	for (i = 0; i < count; i++)
+		if (shown == NULL || shown[i])
+			printf ("%s %s:%d: %s\n", state_text (targets[i].result),
+			        targets[i].host, targets[i].port,
+			        targets[i].message ? targets[i].message : "");
+
+	if (changes != NULL)
+		np_changes_save (changes);
+	free (shown);
+
+	return result;
+}
+
+
 /* process command-line arguments */
 static int
 process_arguments (int argc, char **argv)
@@ -407,7 +1067,24 @@ process_arguments (int argc, char **argv)
 	char *temp;
 
 	enum {
-		SNI_OPTION = CHAR_MAX + 1
+		SNI_OPTION = CHAR_MAX + 1,
+		TARGETS_OPTION,
+		CONCURRENCY_OPTION,
+		DNS_CACHE_OPTION,
+		SSL_SESSION_CACHE_OPTION,
+		CERT_CACHE_OPTION,
+		TCP_INFO_OPTION,
+		FAST_OPEN_OPTION,
+		RETRIES_OPTION,
+		RETRY_INTERVAL_OPTION,
+		ENGINE_OPTION,
+		ADAPTIVE_TIMEOUT_OPTION,
+		SHARD_OPTION,
+		CHANGES_OPTION,
+		TLS_OFFLOAD_OPTION,
+		STARTTLS_OPTION,
+		AUTHUSER_OPTION,
+		AUTHPASS_OPTION
 	};
 
 	int option = 0;
@@ -438,6 +1115,23 @@ process_arguments (int argc, char **argv)
 		{"ssl", no_argument, 0, 'S'},
 		{"sni", required_argument, 0, SNI_OPTION},
 		{"certificate", required_argument, 0, 'D'},
+		{"targets", required_argument, 0, TARGETS_OPTION},
+		{"shard", required_argument, 0, SHARD_OPTION},
+		{"changes", optional_argument, 0, CHANGES_OPTION},
+		{"concurrency", required_argument, 0, CONCURRENCY_OPTION},
+		{"dns-cache", required_argument, 0, DNS_CACHE_OPTION},
+		{"ssl-session-cache", no_argument, 0, SSL_SESSION_CACHE_OPTION},
+		{"cert-cache", required_argument, 0, CERT_CACHE_OPTION},
+		{"tls-offload", required_argument, 0, TLS_OFFLOAD_OPTION},
+		{"tcp-info", no_argument, 0, TCP_INFO_OPTION},
+		{"fast-open", no_argument, 0, FAST_OPEN_OPTION},
+		{"retries", required_argument, 0, RETRIES_OPTION},
+		{"retry-interval", required_argument, 0, RETRY_INTERVAL_OPTION},
+		{"engine", required_argument, 0, ENGINE_OPTION},
+		{"adaptive-timeout", optional_argument, 0, ADAPTIVE_TIMEOUT_OPTION},
+		{"starttls", no_argument, 0, STARTTLS_OPTION},
+		{"authuser", required_argument, 0, AUTHUSER_OPTION},
+		{"authpass", required_argument, 0, AUTHPASS_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -626,9 +1320,138 @@ process_arguments (int argc, char **argv)
 		case 'A':
 			match_flags |= NP_MATCH_ALL;
 			break;
+		case TARGETS_OPTION:
+			targets_file = optarg;
+			break;
+		case CHANGES_OPTION:
+			changes_refresh = DEFAULT_CHANGES_REFRESH;
+			if (optarg != NULL) {
+				if (!is_integer (optarg) || atol (optarg) < 0)
+					usage2 (_("The full report interval must be a number of seconds"), optarg);
+				changes_refresh = atol (optarg);
+			}
+			break;
+		case SHARD_OPTION:
+			if (np_targets_shard (optarg) == ERROR)
+				usage2 (_("Shard must be I/N, I from 1 to N"), optarg);
+			sharded = TRUE;
+			break;
+		case ENGINE_OPTION:
+			if (np_conn_engine (optarg) == ERROR)
+				usage2 (_("Unknown or unsupported engine"), optarg);
+			break;
+		case CONCURRENCY_OPTION:
+			if (!is_intpos (optarg))
+				usage4 (_("Concurrency must be a positive integer"));
+			concurrency = atoi (optarg);
+			break;
+		case ADAPTIVE_TIMEOUT_OPTION:
+			adaptive_factor = DEFAULT_ADAPTIVE_FACTOR;
+			if (optarg != NULL) {
+				if (!is_positive (optarg))
+					usage2 (_("Adaptive timeout factor must be a positive number"), optarg);
+				adaptive_factor = strtod (optarg, NULL);
+			}
+			break;
+		case DNS_CACHE_OPTION:
+			if (!is_intpos (optarg))
+				usage4 (_("DNS cache time must be a positive integer"));
+			dns_cache_age = atol (optarg);
+			break;
+		case SSL_SESSION_CACHE_OPTION:
+#ifdef HAVE_SSL
+			flags |= FLAG_SSL;
+			ssl_session_cache = TRUE;
+#else
+			die (STATE_UNKNOWN, _("Invalid option - SSL is not available"));
+#endif
+			break;
+		case CERT_CACHE_OPTION:
+#ifdef HAVE_SSL
+			if (!is_intpos (optarg))
+				usage2 (_("Certificate cache time must be a positive integer"), optarg);
+			cert_cache_ttl = atoi (optarg);
+#else
+			die (STATE_UNKNOWN, _("Invalid option - SSL is not available"));
+#endif
+			break;
+		case TLS_OFFLOAD_OPTION:
+#ifdef HAVE_SSL
+			if (np_net_ssl_offload (optarg) != OK)
+				die (STATE_UNKNOWN, _("Cannot load the crypto provider or engine %s\n"), optarg);
+			flags |= FLAG_SSL;
+			tls_offload = optarg;
+#else
+			die (STATE_UNKNOWN, _("Invalid option - SSL is not available"));
+#endif
+			break;
+		case STARTTLS_OPTION:
+#ifdef HAVE_SSL
+			starttls = TRUE;
+#else
+			die (STATE_UNKNOWN, _("Invalid option - SSL is not available"));
+#endif
+			break;
+		case AUTHUSER_OPTION:
+			authuser = optarg;
+			break;
+		case AUTHPASS_OPTION:
+			authpass = optarg;
+			break;
+		case TCP_INFO_OPTION:
+			tcp_info = TRUE;
+			break;
+		case FAST_OPEN_OPTION:
+			fast_open = TRUE;
+			break;
+		case RETRIES_OPTION:
+			if (!is_integer (optarg) || atoi (optarg) < 0 || atoi (optarg) > 10)
+				usage4 (_("Retries must be an integer between 0 and 10"));
+			udp_retries = atoi (optarg);
+			break;
+		case RETRY_INTERVAL_OPTION:
+			if (!is_intpos (optarg))
+				usage4 (_("Retry interval must be a positive integer"));
+			udp_retry_interval = atoi (optarg) / 1000.0;
+			break;
 		}
 	}
 
+	if ((tcp_info || fast_open) && PROTOCOL != IPPROTO_TCP)
+		usage4 (_("--tcp-info and --fast-open only apply to TCP"));
+	/* with nothing to send, the SYN would wait for the first write */
+	if (fast_open && server_send == NULL && !(flags & FLAG_SSL))
+		usage4 (_("--fast-open needs a string to send"));
+
+	if (starttls || authuser != NULL) {
+		if (mail_protocol == MAIL_NONE)
+			usage4 (_("--starttls and --authuser only apply to check_imap and check_pop"));
+		if (authuser != NULL && authpass == NULL)
+			usage4 (_("--authuser needs --authpass"));
+		if (strpbrk (authuser ? authuser : "", "\r\n") || strpbrk (authpass ? authpass : "", "\r\n"))
+			usage4 (_("User name and password must not contain line breaks"));
+		if (targets_file != NULL)
+			usage4 (_("--starttls and --authuser are not supported together with --targets"));
+		/* the handshake comes after STARTTLS, not right after connecting */
+		if (starttls)
+			flags &= ~FLAG_SSL;
+		server_quit = NULL;
+		mail_dialogue_mode = TRUE;
+	}
+
+	if ((sharded || changes_refresh >= 0) && targets_file == NULL)
+		usage4 (_("--shard and --changes need --targets"));
+
+	if (targets_file != NULL) {
+		if (PROTOCOL == IPPROTO_UDP && (flags & FLAG_SSL))
+			usage4 (_("SSL is not supported for UDP targets"));
+		if (delay > 0)
+			usage4 (_("A delay is not supported together with --targets"));
+		if (tcp_info || fast_open)
+			usage4 (_("--tcp-info and --fast-open are not supported together with --targets"));
+		return TRUE;
+	}
+
 	c = optind;
 	if(host_specified == FALSE && c < argc)
 		server_address = strdup (argv[c++]);
@@ -657,6 +1480,7 @@ print_help (void)
 
 	printf (UT_HELP_VRSN);
 	printf (UT_EXTRA_OPTS);
+	printf (UT_TIMING);
 
 	printf (UT_HOST_PORT, 'p', "none");
 
@@ -683,16 +1507,89 @@ print_help (void)
   printf ("    %s\n", _("Close connection once more than this number of bytes are received"));
   printf (" %s\n", "-d, --delay=INTEGER");
   printf ("    %s\n", _("Seconds to wait between sending string and polling for response"));
+  printf (" %s\n", "--targets=FILE");
+  printf ("    %s\n", _("Check all targets listed in FILE (\"-\" for stdin, unix:PATH or"));
+  printf ("    %s\n", _("tcp:HOST:PORT to read it from a socket) concurrently, one"));
+  printf ("    %s\n", _("\"host port\", \"host:port\" or \"[address]:port\" per line. The port"));
+  printf ("    %s\n", _("defaults to the one given with -p. Each target is judged like a single"));
+  printf ("    %s\n", _("check, the worst state is returned. With SSL, each target is only taken"));
+  printf ("    %s\n", _("through the TLS handshake, with the server name from \"host:port:sni\""));
+  printf ("    %s\n", _("or \"host port sni\" lines, and nothing is sent or expected"));
+  printf (" %s\n", "--shard=I/N");
+  printf ("    %s\n", _("Check only the targets of shard I of N, so that N pollers given the same"));
+  printf ("    %s\n", _("list check each target once. Which shard a target is in depends only on"));
+  printf ("    %s\n", _("its line and N"));
+  printf (" %s\n", "--changes[=SECONDS]");
+  printf ("    %s\n", _("List only the targets whose state changed since the last run, or that are"));
+  printf ("    %s\n", _("new, and all of them every SECONDS, 0 for never. The first line still counts"));
+  printf ("    %s\n", _("all targets, and the state returned is the worst of all of them. The states"));
+  printf ("    %s\n", _("are kept in the state directory, apart for every command line"));
+  printf ("    %s %d\n", _("Default:"), DEFAULT_CHANGES_REFRESH);
+  printf (" %s\n", "--concurrency=INTEGER");
+  printf ("    %s\n", _("Maximum number of connections in flight with --targets"));
+  printf ("    %s %d\n", _("Default:"), DEFAULT_CONCURRENCY);
+  printf (" %s\n", "--engine=auto|io_uring|epoll|poll");
+  printf ("    %s\n", _("What the connections of --targets are waited on with; auto takes io_uring"));
+  printf ("    %s\n", _("where the kernel allows it and epoll otherwise. -v prints the one used"));
+  printf ("    %s\n", _("and the targets checked per second"));
+  printf (" %s\n", "--retries=INTEGER");
+  printf ("    %s\n", _("For UDP targets, the number of times the request is sent again to a"));
+  printf ("    %s\n", _("target that did not answer yet. All targets are probed at once over"));
+  printf ("    %s\n", _("one socket, regardless of --concurrency"));
+  printf ("    %s %d\n", _("Default:"), DEFAULT_UDP_RETRIES);
+  printf (" %s\n", "--retry-interval=MILLISECONDS");
+  printf ("    %s\n", _("Wait this long before the first of them, twice as long before the next"));
+  printf ("    %s %d\n", _("Default:"), (int)(DEFAULT_UDP_RETRY_INTERVAL * 1000));
+  printf (" %s\n", "--dns-cache=SECONDS");
+  printf ("    %s\n", _("Keep host name lookups in the state directory and use them for this"));
+  printf ("    %s\n", _("many seconds in the next runs"));
+  printf (" %s\n", "--adaptive-timeout[=FACTOR]");
+  printf ("    %s\n", _("Keep how long connecting to each host and port took in the state"));
+  printf ("    %s\n", _("directory, and give up connecting after FACTOR times the usual time, or"));
+  printf ("    %s\n", _("its 95th percentile if that is longer, but after at least one second and"));
+  printf ("    %s\n", _("at most the timeout. The timeout used is in the output and as connect_timeout"));
+  printf ("    %s %.0f\n", _("in the performance data. Default:"), DEFAULT_ADAPTIVE_FACTOR);
+  printf (" %s\n", "--tcp-info");
+  printf ("    %s\n", _("Add the round trip of the handshake, the smoothed round trip time and"));
+  printf ("    %s\n", _("the retransmits as the kernel measured them to the performance data,"));
+  printf ("    %s\n", _("as tcp_established, tcp_rtt and tcp_retransmits (Linux only)"));
+  printf (" %s\n", "--fast-open");
+  printf ("    %s\n", _("Send the first data with the SYN (TCP Fast Open) once the server handed"));
+  printf ("    %s\n", _("out a cookie in an earlier run, saving a round trip. Needs -s or SSL"));
 
 #ifdef HAVE_SSL
 	printf (" %s\n", "-D, --certificate=INTEGER[,INTEGER]");
   printf ("    %s\n", _("Minimum number of days a certificate has to be valid."));
   printf ("    %s\n", _("1st is #days for warning, 2nd is critical (if not specified - 0)."));
+  printf (" %s\n", "--cert-cache=SECONDS");
+  printf ("    %s\n", _("With -D, keep the expiry of the certificate in the state directory for"));
+  printf ("    %s\n", _("SECONDS, keyed by its fingerprint, and only fingerprint it until then"));
   printf (" %s\n", "-S, --ssl");
   printf ("    %s\n", _("Use SSL for the connection."));
   printf (" %s\n", "--sni=STRING");
   printf ("    %s\n", _("SSL server_name"));
+  printf (" %s\n", "--ssl-session-cache");
+  printf ("    %s\n", _("Keep the TLS session in the state directory and resume it in the next"));
+  printf ("    %s\n", _("runs. The handshake time is added to the performance data, as"));
+  printf ("    %s\n", _("time_tls_resumed when the session was resumed (implies -S)"));
+  printf (" %s\n", "--tls-offload=NAME");
+  printf ("    %s\n", _("Hand the crypto of the handshakes to an offload device such as QAT, through"));
+  printf ("    %s\n", _("the OpenSSL provider (engine before OpenSSL 3) NAME. With --targets, the"));
+  printf ("    %s\n", _("other handshakes go on while one waits for the device. How long each one"));
+  printf ("    %s\n", _("waited is added to the performance data (implies -S)"));
+	printf (" %s\n", "--starttls");
+  printf ("    %s\n", _("For check_imap and check_pop, ask for the capabilities and upgrade the"));
+  printf ("    %s\n", _("connection with STARTTLS (STLS for POP3) after the greeting. -D, --sni and"));
+  printf ("    %s\n", _("--ssl-session-cache apply to that handshake"));
 #endif
+	printf (" %s\n", "--authuser=STRING");
+  printf ("    %s\n", _("For check_imap and check_pop, log in as this user after the greeting and"));
+  printf ("    %s\n", _("any STARTTLS. IMAP takes the capabilities, the login and the logout in"));
+  printf ("    %s\n", _("one round trip. With this or --starttls, -s, -e and -q are not used, and"));
+  printf ("    %s\n", _("the time to the greeting, of the handshake and of the login are added to"));
+  printf ("    %s\n", _("the performance data as time_banner, time_tls and time_login"));
+	printf (" %s\n", "--authpass=STRING");
+  printf ("    %s\n", _("The password to log in with"));
 
 	printf (UT_WARN_CRIT);
 
@@ -712,4 +1609,9 @@ print_usage (void)
   printf ("[-e <expect string>] [-q <quit string>][-m <maximum bytes>] [-d <delay>]\n");
   printf ("[-t <timeout seconds>] [-r <refuse state>] [-M <mismatch state>] [-v] [-4|-6] [-j]\n");
   printf ("[-D <warn days cert expire>[,<crit days cert expire>]] [-S <use SSL>] [-E]\n");
+  printf ("[--tcp-info] [--fast-open] [--adaptive-timeout[=<factor>]]\n");
+  printf ("[--starttls] [--authuser=<user> --authpass=<password>]\n");
+  printf ("%s --targets=<file> [--concurrency=<connections>] [--dns-cache=<seconds>] [options]\n", progname);
+  printf ("[--retries=<count>] [--retry-interval=<milliseconds>] [--engine=<engine>] [--shard=<i/n>]\n");
+  printf ("[--changes[=<seconds>]] [--tls-offload=<name>]\n");
 }
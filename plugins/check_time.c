@@ -56,7 +56,15 @@ int server_port = TIME_PORT;
 char *server_address = NULL;
 int use_udp = FALSE;
 
+/* multi-server mode */
+#define DEFAULT_CONCURRENCY 64
+#define DEFAULT_OUTLIER 2.0
+char *targets_file = NULL;
+int concurrency = DEFAULT_CONCURRENCY;
+double outlier_limit = DEFAULT_OUTLIER;
+
 int process_arguments (int, char **);
+int run_multi_target (void);
 void print_help (void);
 void print_usage (void);
 
@@ -67,9 +75,7 @@ main (int argc, char **argv)
 	int result = STATE_UNKNOWN;
 	time_t conntime;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -77,6 +83,9 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
+	if (targets_file != NULL)
+		return run_multi_target ();
+
 	/* initialize alarm signal handling */
 	signal (SIGALRM, socket_timeout_alarm_handler);
 
@@ -182,6 +191,176 @@ main (int argc, char **argv)
 
 
 
+/* Multi-server mode: np_conn_run() queries all servers of the list at
+ * once. The server reads its clock somewhere between the start of the
+ * query and the arrival of the answer, and rounds it down to the second,
+ * so the offset of each server is the middle of the range that leaves,
+ * and the error is half its width. */
+
+typedef struct time_result {
+	int answered;
+	double offset;
+	double error;
+	int outlier;
+} time_result;
+
+static np_conn *targets;
+static time_result *results;
+
+/* the state of a failed query, the same as in main() */
+static int
+no_answer_state (void)
+{
+	if (check_critical_time == TRUE)
+		return STATE_CRITICAL;
+	else if (check_warning_time == TRUE)
+		return STATE_WARNING;
+	return STATE_UNKNOWN;
+}
+
+static void
+target_judge (np_conn *t)
+{
+	time_result *r = &results[t - targets];
+	double sent, received, server;
+	uint32_t raw;
+	int result = STATE_OK;
+	char *message = NULL;
+
+	t->elapsed = (double)deltime (t->start) / 1.0e6;
+	if (t->len < sizeof (raw)) {
+		np_conn_finish (t, no_answer_state (), strdup (_("No data received from server")));
+		return;
+	}
+
+	memcpy (&raw, t->data, sizeof (raw));
+	server = (double)(ntohl (raw) - UNIX_EPOCH);
+	sent = t->start.tv_sec + (double)t->start.tv_usec / 1.0e6;
+	received = sent + t->elapsed;
+	r->answered = TRUE;
+	r->offset = (server + server + 1.0) / 2.0 - (sent + received) / 2.0;
+	r->error = (1.0 + t->elapsed) / 2.0;
+
+	if (check_critical_time == TRUE && t->elapsed > critical_time)
+		result = STATE_CRITICAL;
+	else if (check_warning_time == TRUE && t->elapsed > warning_time)
+		result = STATE_WARNING;
+	if (check_critical_diff == TRUE && fabs (r->offset) > critical_diff)
+		result = STATE_CRITICAL;
+	else if (check_warning_diff == TRUE && fabs (r->offset) > warning_diff)
+		result = max_state (result, STATE_WARNING);
+
+	xasprintf (&message, _("%+.3f second offset (+/- %.3f), %.3f second response time"),
+	           r->offset, r->error, t->elapsed);
+	np_conn_finish (t, result, message);
+}
+
+static void
+target_connected (np_conn *t)
+{
+	if (use_udp && send (t->fd, "", 0, 0) < 0)
+		np_conn_finish (t, no_answer_state (), strdup (_("Could not send UDP request")));
+}
+
+static void
+target_received (np_conn *t)
+{
+	if (t->len >= sizeof (uint32_t))
+		target_judge (t);
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+int
+run_multi_target (void)
+{
+	np_conn_ops ops;
+	size_t count, answered = 0, outliers = 0, i;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	int result = STATE_OK;
+	double *offsets, median = 0;
+	char *perf = NULL;
+	const char **names;
+
+	targets = np_conn_read_list (targets_file, server_port, &count);
+	results = calloc (count, sizeof (time_result));
+	offsets = calloc (count, sizeof (double));
+	names = calloc (count, sizeof (char *));
+	if (results == NULL || offsets == NULL || names == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < count; i++)
+		names[i] = targets[i].host;
+	np_resolve_prefetch (names, count, address_family, concurrency);
+	free (names);
+
+	memset (&ops, 0, sizeof (ops));
+	ops.connected = target_connected;
+	ops.received = target_received;
+	ops.judge = target_judge;
+	ops.socktype = use_udp ? SOCK_DGRAM : SOCK_STREAM;
+	np_conn_run (targets, count, concurrency, &ops);
+
+	for (i = 0; i < count; i++) {
+		result = max_state (result, targets[i].result);
+		if (targets[i].result >= STATE_OK && targets[i].result <= STATE_DEPENDENT)
+			states[targets[i].result]++;
+		if (results[i].answered)
+			offsets[answered++] = results[i].offset;
+	}
+
+	/* servers further from the median than their own error allows */
+	if (answered > 0) {
+		qsort (offsets, answered, sizeof (double), cmp_double);
+		median = (answered % 2) ? offsets[answered / 2] :
+		         (offsets[answered / 2 - 1] + offsets[answered / 2]) / 2.0;
+		for (i = 0; i < count; i++) {
+			if (results[i].answered &&
+			    fabs (results[i].offset - median) > results[i].error + outlier_limit) {
+				results[i].outlier = TRUE;
+				outliers++;
+			}
+		}
+	}
+
+	printf (_("TIME %s - %lu servers: %d ok, %d warning, %d critical, %d unknown"),
+	        state_text (result), (unsigned long)count, states[STATE_OK],
+	        states[STATE_WARNING], states[STATE_CRITICAL], states[STATE_UNKNOWN]);
+	if (answered > 0)
+		printf (_(", median offset %+.3f seconds, %lu outliers"), median, (unsigned long)outliers);
+
+	printf ("|%s", answered > 0 ? fperfdata ("median", median, "s",
+	                                          check_warning_diff, warning_diff,
+	                                          check_critical_diff, critical_diff,
+	                                          FALSE, 0, FALSE, 0) : "");
+	for (i = 0; i < count; i++) {
+		if (!results[i].answered)
+			continue;
+		xasprintf (&perf, "%s:%d", targets[i].host, targets[i].port);
+		printf (" %s", fperfdata (perf, results[i].offset, "s",
+		                          check_warning_diff, warning_diff,
+		                          check_critical_diff, critical_diff,
+		                          FALSE, 0, FALSE, 0));
+		free (perf);
+	}
+	putchar ('\n');
+
+	for (i = 0; i < count; i++)
+		printf ("%s %s:%d: %s%s\n", state_text (targets[i].result),
+		        targets[i].host, targets[i].port,
+		        targets[i].message ? targets[i].message : "",
+		        results[i].outlier ? _(", outlier") : "");
+
+	return result;
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
@@ -189,6 +368,11 @@ process_arguments (int argc, char **argv)
 	int c;
 
 	int option = 0;
+	enum {
+		TARGETS_OPTION = CHAR_MAX + 1,
+		CONCURRENCY_OPTION,
+		OUTLIER_OPTION
+	};
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
 		{"warning-variance", required_argument, 0, 'w'},
@@ -197,6 +381,9 @@ process_arguments (int argc, char **argv)
 		{"critical-connect", required_argument, 0, 'C'},
 		{"port", required_argument, 0, 'p'},
 		{"udp", no_argument, 0, 'u'},
+		{"targets", required_argument, 0, TARGETS_OPTION},
+		{"concurrency", required_argument, 0, CONCURRENCY_OPTION},
+		{"outlier", required_argument, 0, OUTLIER_OPTION},
 		{"timeout", required_argument, 0, 't'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
@@ -305,11 +492,25 @@ process_arguments (int argc, char **argv)
 			break;
 		case 'u':									/* udp */
 			use_udp = TRUE;
+			break;
+		case TARGETS_OPTION:
+			targets_file = optarg;
+			break;
+		case CONCURRENCY_OPTION:
+			if (!is_intpos (optarg))
+				usage4 (_("Concurrency must be a positive integer"));
+			concurrency = atoi (optarg);
+			break;
+		case OUTLIER_OPTION:
+			if (!is_nonnegative (optarg))
+				usage4 (_("Outlier limit must be a non-negative number"));
+			outlier_limit = strtod (optarg, NULL);
+			break;
 		}
 	}
 
 	c = optind;
-	if (server_address == NULL) {
+	if (server_address == NULL && targets_file == NULL) {
 		if (argc > c) {
 			if (is_host (argv[c]) == FALSE)
 				usage2 (_("Invalid hostname/address"), optarg);
@@ -357,6 +558,18 @@ print_help (void)
   printf ("   %s\n", _("Response time (sec.) necessary to result in warning status"));
   printf (" %s\n", "-C, --critical-connect=INTEGER");
   printf ("   %s\n", _("Response time (sec.) necessary to result in critical status"));
+  printf (" %s\n", "--targets=FILE");
+  printf ("   %s\n", _("Query all servers listed in FILE (\"-\" for stdin) at once, one \"host port\","));
+  printf ("   %s\n", _("\"host:port\" or \"[address]:port\" per line, and report the offset of each"));
+  printf ("   %s\n", _("with its error, the median offset and the outliers. The thresholds apply"));
+  printf ("   %s\n", _("to every server, the worst state is returned"));
+  printf (" %s\n", "--concurrency=INTEGER");
+  printf ("   %s\n", _("Maximum number of queries in flight with --targets"));
+  printf ("   %s %d\n", _("Default:"), DEFAULT_CONCURRENCY);
+  printf (" %s\n", "--outlier=SECONDS");
+  printf ("   %s\n", _("With --targets, a server whose offset is further from the median than"));
+  printf ("   %s\n", _("its error plus SECONDS is an outlier"));
+  printf ("   %s %.0f\n", _("Default:"), DEFAULT_OUTLIER);
 
 	printf (UT_CONN_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
@@ -371,4 +584,5 @@ print_usage (void)
   printf ("%s\n", _("Usage:"));
 	printf ("%s -H <host_address> [-p port] [-u] [-w variance] [-c variance]\n",progname);
   printf (" [-W connect_time] [-C connect_time] [-t timeout]\n");
+	printf ("%s --targets=<file> [--concurrency=<queries>] [--outlier=<seconds>] [options]\n",progname);
 }
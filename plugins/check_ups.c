@@ -70,6 +70,17 @@ enum {
 
 enum { NOSUCHVAR = ERROR-1 };
 
+/* the variables asked for, all in one session with upsd */
+static const char *ups_varnames[] = {
+	"ups.status", "input.voltage", "battery.charge", "ups.load", "ups.temperature"
+};
+#define UPS_VARS (sizeof (ups_varnames) / sizeof (ups_varnames[0]))
+
+typedef struct ups_unit {
+	char *name;
+	char *reply[UPS_VARS];  /* upsd's answer to GET VAR, without the newline */
+} ups_unit;
+
 int server_port = PORT;
 char *server_address;
 char *ups_name = NULL;
@@ -87,9 +98,19 @@ double ups_load_percent = 0.0;
 double ups_temperature = 0.0;
 char *ups_status;
 int temp_output_c = 0;
+int check_all = FALSE;
+char *ups_error = NULL;
+char *perf_prefix = "";
+
+static ups_unit *units = NULL;
+static int n_units = 0;
+static ups_unit *current = NULL;  /* the one get_ups_variable() answers for */
 
 int determine_status (void);
 int get_ups_variable (const char *, char *, size_t);
+static int fetch_ups_variables (void);
+static int check_ups (char **, char **);
+static char *ups_perf_label (const char *);
 
 int process_arguments (int, char **);
 int validate_arguments (void);
@@ -100,20 +121,14 @@ int
 main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
+	int states[STATE_DEPENDENT + 1] = { 0 };
+	char **messages;
 	char *message;
 	char *data;
-	char *tunits;
-	char temp_buffer[MAX_INPUT_BUFFER];
-	double ups_utility_deviation = 0.0;
-	int res;
-
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	char *perf = NULL;
+	int i, res;
 
-	ups_status = strdup ("N/A");
-	data = strdup ("");
-	message = strdup ("");
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv=np_extra_opts (&argc, argv, progname);
@@ -127,9 +142,82 @@ main (int argc, char **argv)
 	/* set socket timeout */
 	alarm (socket_timeout);
 
+	if (fetch_ups_variables () != OK) {
+		printf ("%s\n", _("Invalid response received from host"));
+		return STATE_CRITICAL;
+	}
+
+	if (!check_all) {
+		current = &units[0];
+		if ((result = check_ups (&message, &data)) == ERROR) {
+			printf ("%s\n", ups_error);
+			return STATE_CRITICAL;
+		}
+
+		/* reset timeout */
+		alarm (0);
+
+		printf ("UPS %s - %s|%s\n", state_text(result), message, data);
+		return result;
+	}
+
+	/* one line per UPS after the summary, as with check_tcp --targets */
+	if ((messages = calloc (n_units, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	result = STATE_OK;
+	for (i = 0; i < n_units; i++) {
+		current = &units[i];
+		ups_name = current->name;
+		xasprintf (&perf_prefix, "%s_", ups_name);
+		if ((res = check_ups (&message, &data)) == ERROR) {
+			res = STATE_CRITICAL;
+			message = ups_error;
+			message[strcspn (message, "\n")] = '\0';
+		} else {
+			xasprintf (&perf, "%s%s%s", perf ? perf : "", perf ? " " : "", data);
+		}
+		strip (message);
+		xasprintf (&messages[i], "%s %s: %s", state_text (res), ups_name, message);
+		result = max_state_alt (result, res);
+		states[res]++;
+	}
+
+	/* reset timeout */
+	alarm (0);
+
+	printf (_("UPS %s - %d UPS: %d ok, %d warning, %d critical, %d unknown|%s\n"),
+	        state_text (result), n_units, states[STATE_OK], states[STATE_WARNING],
+	        states[STATE_CRITICAL], states[STATE_UNKNOWN], perf ? perf : "");
+	for (i = 0; i < n_units; i++)
+		printf ("%s\n", messages[i]);
+	return result;
+}
+
+
+
+/* Check the UPS current points to. Returns its state, with the plugin
+ * output and perfdata in *msg and *perf, or ERROR with the reason in
+ * ups_error. */
+static int
+check_ups (char **msg, char **perf)
+{
+	int result = STATE_UNKNOWN;
+	char *message;
+	char *data;
+	char *tunits;
+	char temp_buffer[MAX_INPUT_BUFFER];
+	double ups_utility_deviation = 0.0;
+	int res;
+
+	supported_options = UPS_NONE;
+	status = UPSSTATUS_NONE;
+	ups_status = strdup ("N/A");
+	data = strdup ("");
+	message = strdup ("");
+
 	/* get the ups status if possible */
 	if (determine_status () != OK)
-		return STATE_CRITICAL;
+		return ERROR;
 	if (supported_options & UPS_STATUS) {
 
 		ups_status = strdup ("");
@@ -192,7 +280,7 @@ main (int argc, char **argv)
 	res=get_ups_variable ("input.voltage", temp_buffer, sizeof (temp_buffer));
 	if (res == NOSUCHVAR) supported_options &= ~UPS_UTILITY;
 	else if (res != OK)
-		return STATE_CRITICAL;
+		return ERROR;
 	else {
 		supported_options |= UPS_UTILITY;
 
@@ -212,13 +300,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s",
-			          perfdata ("voltage", (long)(1000*ups_utility_voltage), "mV",
+			          perfdata (ups_perf_label ("voltage"), (long)(1000*ups_utility_voltage), "mV",
 			                    check_warn, (long)(1000*warning_value),
 			                    check_crit, (long)(1000*critical_value),
 			                    TRUE, 0, FALSE, 0));
 		} else {
 			xasprintf (&data, "%s",
-			          perfdata ("voltage", (long)(1000*ups_utility_voltage), "mV",
+			          perfdata (ups_perf_label ("voltage"), (long)(1000*ups_utility_voltage), "mV",
 			                    FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
 		}
 	}
@@ -227,7 +315,7 @@ main (int argc, char **argv)
 	res=get_ups_variable ("battery.charge", temp_buffer, sizeof (temp_buffer));
 	if (res == NOSUCHVAR) supported_options &= ~UPS_BATTPCT;
 	else if ( res != OK)
-		return STATE_CRITICAL;
+		return ERROR;
 	else {
 		supported_options |= UPS_BATTPCT;
 		ups_battery_percent = atof (temp_buffer);
@@ -241,13 +329,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s %s", data,
-			          perfdata ("battery", (long)ups_battery_percent, "%",
+			          perfdata (ups_perf_label ("battery"), (long)ups_battery_percent, "%",
 			                    check_warn, (long)(warning_value),
 			                    check_crit, (long)(critical_value),
 			                    TRUE, 0, TRUE, 100));
 		} else {
 			xasprintf (&data, "%s %s", data,
-			          perfdata ("battery", (long)ups_battery_percent, "%",
+			          perfdata (ups_perf_label ("battery"), (long)ups_battery_percent, "%",
 			                    FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 100));
 		}
 	}
@@ -256,7 +344,7 @@ main (int argc, char **argv)
 	res=get_ups_variable ("ups.load", temp_buffer, sizeof (temp_buffer));
 	if ( res == NOSUCHVAR ) supported_options &= ~UPS_LOADPCT;
 	else if ( res != OK)
-		return STATE_CRITICAL;
+		return ERROR;
 	else {
 		supported_options |= UPS_LOADPCT;
 		ups_load_percent = atof (temp_buffer);
@@ -270,13 +358,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s %s", data,
-			          perfdata ("load", (long)ups_load_percent, "%",
+			          perfdata (ups_perf_label ("load"), (long)ups_load_percent, "%",
 			                    check_warn, (long)(warning_value),
 			                    check_crit, (long)(critical_value),
 			                    TRUE, 0, TRUE, 100));
 		} else {
 			xasprintf (&data, "%s %s", data,
-			          perfdata ("load", (long)ups_load_percent, "%",
+			          perfdata (ups_perf_label ("load"), (long)ups_load_percent, "%",
 			                    FALSE, 0, FALSE, 0, TRUE, 0, TRUE, 100));
 		}
 	}
@@ -285,7 +373,7 @@ main (int argc, char **argv)
 	res=get_ups_variable ("ups.temperature", temp_buffer, sizeof (temp_buffer));
 	if ( res == NOSUCHVAR ) supported_options &= ~UPS_TEMP;
 	else if ( res != OK)
-		return STATE_CRITICAL;
+		return ERROR;
 	else {
  		supported_options |= UPS_TEMP;
 		if (temp_output_c) {
@@ -307,13 +395,13 @@ main (int argc, char **argv)
 				result = max_state (result, STATE_WARNING);
 			}
 			xasprintf (&data, "%s %s", data,
-			          perfdata ("temp", (long)ups_temperature, tunits,
+			          perfdata (ups_perf_label ("temp"), (long)ups_temperature, tunits,
 			                    check_warn, (long)(warning_value),
 			                    check_crit, (long)(critical_value),
 			                    TRUE, 0, FALSE, 0));
 		} else {
 			xasprintf (&data, "%s %s", data,
-			          perfdata ("temp", (long)ups_temperature, tunits,
+			          perfdata (ups_perf_label ("temp"), (long)ups_temperature, tunits,
 			                    FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
 		}
 	}
@@ -324,15 +412,25 @@ main (int argc, char **argv)
 		xasprintf (&message, _("UPS does not support any available options\n"));
 	}
 
-	/* reset timeout */
-	alarm (0);
-
-	printf ("UPS %s - %s|%s\n", state_text(result), message, data);
+	*msg = message;
+	*perf = data;
 	return result;
 }
 
 
 
+/* "voltage" and so on, after the name of the UPS with --all */
+static char *
+ups_perf_label (const char *label)
+{
+	char *l;
+
+	xasprintf (&l, "%s%s", perf_prefix, label);
+	return l;
+}
+
+
+
 /* determines what options are supported by the UPS */
 int
 determine_status (void)
@@ -345,7 +443,7 @@ determine_status (void)
 	res=get_ups_variable ("ups.status", recv_buffer, sizeof (recv_buffer));
 	if (res == NOSUCHVAR) return OK;
 	if (res != STATE_OK) {
-		printf ("%s\n", _("Invalid response received from host"));
+		xasprintf (&ups_error, "%s\n%s", ups_error, _("Invalid response received from host"));
 		return ERROR;
 	}
 
@@ -386,38 +484,104 @@ determine_status (void)
 }
 
 
-/* gets a variable value for a specific UPS  */
+/* Ask upsd for all variables of every UPS in one session: LIST UPS first
+ * with --all, then one GET VAR per UPS and variable, all sent at once and
+ * answered in order, then LOGOUT to avoid read failure logs */
+static int
+fetch_ups_variables (void)
+{
+	np_net_reader reader;
+	char line[MAX_INPUT_BUFFER];
+	char name[MAX_INPUT_BUFFER];
+	char *send_buffer = NULL;
+	size_t size = 0, v;
+	int sd, i, len;
+
+	if (my_tcp_connect (server_address, server_port, &sd) != STATE_OK)
+		return ERROR;
+	np_net_reader_init (&reader, sd, NULL);
+
+	if (check_all) {
+		if (send (sd, "LIST UPS\n", 9, 0) != 9 ||
+		    np_net_recvline (&reader, line, sizeof (line)) <= 0 ||
+		    strncmp (line, "BEGIN LIST UPS", 14) != 0) {
+			close (sd);
+			return ERROR;
+		}
+		while ((len = np_net_recvline (&reader, line, sizeof (line))) > 0 &&
+		       strncmp (line, "END LIST UPS", 12) != 0) {
+			if (sscanf (line, "UPS %s", name) != 1)
+				continue;
+			if ((size_t) n_units >= size) {
+				size = size ? size * 2 : 8;
+				if ((units = realloc (units, size * sizeof (ups_unit))) == NULL)
+					die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			}
+			memset (&units[n_units], 0, sizeof (ups_unit));
+			units[n_units++].name = strdup (name);
+		}
+		if (len <= 0) {
+			close (sd);
+			return ERROR;
+		}
+		if (n_units == 0)
+			die (STATE_UNKNOWN, _("UPS UNKNOWN - No UPS on %s\n"), server_address);
+	} else {
+		if ((units = calloc (1, sizeof (ups_unit))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		units[0].name = ups_name;
+		n_units = 1;
+	}
+
+	for (i = 0; i < n_units; i++)
+		for (v = 0; v < UPS_VARS; v++)
+			xasprintf (&send_buffer, "%sGET VAR %s %s\n", send_buffer ? send_buffer : "",
+			           units[i].name, ups_varnames[v]);
+	xasprintf (&send_buffer, "%sLOGOUT\n", send_buffer);
+	len = strlen (send_buffer);
+	if (send (sd, send_buffer, len, 0) != len) {
+		close (sd);
+		return ERROR;
+	}
+	free (send_buffer);
+
+	for (i = 0; i < n_units; i++)
+		for (v = 0; v < UPS_VARS; v++) {
+			if (np_net_recvline (&reader, line, sizeof (line)) <= 0) {
+				close (sd);
+				return ERROR;
+			}
+			len = strlen (line);
+			if (len > 0 && line[len-1] == '\n') line[--len] = 0;
+			if (len > 0 && line[len-1] == '\r') line[--len] = 0;
+			units[i].reply[v] = strdup (line);
+		}
+
+	close (sd);
+	return OK;
+}
+
+
+/* gets a variable value for the current UPS  */
 int
 get_ups_variable (const char *varname, char *buf, size_t buflen)
 {
-	/*  char command[MAX_INPUT_BUFFER]; */
-	char temp_buffer[MAX_INPUT_BUFFER];
-	char send_buffer[MAX_INPUT_BUFFER];
-	char *ptr;
-	char *logout = "OK Goodbye\n";
-	int logout_len = strlen(logout);
+	char *ptr = NULL;
+	size_t v;
 	int len;
 
 	*buf=0;
 
-	/* create the command string to send to the UPS daemon */
-	/* Add LOGOUT to avoid read failure logs */
-	sprintf (send_buffer, "GET VAR %s %s\nLOGOUT\n", ups_name, varname);
-
-	/* send the command to the daemon and get a response back */
-	if (process_tcp_request
-			(server_address, server_port, send_buffer, temp_buffer,
-			 sizeof (temp_buffer)) != STATE_OK) {
-		printf ("%s\n", _("Invalid response received from host"));
+	for (v = 0; v < UPS_VARS; v++)
+		if (strcmp (varname, ups_varnames[v]) == 0)
+			ptr = current->reply[v];
+	if (ptr == NULL) {
+		xasprintf (&ups_error, "%s", _("Invalid response received from host"));
 		return ERROR;
 	}
 
-	ptr = temp_buffer;
-	len = strlen(ptr);
-	if (len > logout_len && strcmp (ptr + len - logout_len, logout) == 0) len -= logout_len;
-	if (len > 0 && ptr[len-1] == '\n') ptr[len-1]=0;
 	if (strcmp (ptr, "ERR UNKNOWN-UPS") == 0) {
-		printf (_("CRITICAL - no such UPS '%s' on that host\n"), ups_name);
+		xasprintf (&ups_error, _("CRITICAL - no such UPS '%s' on that host"), current->name);
 		return ERROR;
 	}
 
@@ -427,19 +591,24 @@ get_ups_variable (const char *varname, char *buf, size_t buflen)
 	}
 
 	if (strcmp (ptr, "ERR DATA-STALE") == 0) {
-		printf ("%s\n", _("CRITICAL - UPS data is stale"));
+		xasprintf (&ups_error, "%s", _("CRITICAL - UPS data is stale"));
 		return ERROR;
 	}
 
 	if (strncmp (ptr, "ERR", 3) == 0) {
-		printf (_("Unknown error: %s\n"), ptr);
+		xasprintf (&ups_error, _("Unknown error: %s"), ptr);
 		return ERROR;
 	}
 
-	ptr = temp_buffer + strlen (varname) + strlen (ups_name) + 6;
+	/* VAR <ups> <variable> "<value>" */
+	if ((int) strlen (ptr) < (int) (strlen (varname) + strlen (current->name) + 6)) {
+		xasprintf (&ups_error, "%s", _("Error: unable to parse variable"));
+		return ERROR;
+	}
+	ptr += strlen (varname) + strlen (current->name) + 6;
 	len = strlen(ptr);
-	if (len < 2 || ptr[0] != '"' || ptr[len-1] != '"') {
-		printf ("%s\n", _("Error: unable to parse variable"));
+	if (len < 2 || ptr[0] != '"' || ptr[len-1] != '"' || (size_t) len - 1 > buflen) {
+		xasprintf (&ups_error, "%s", _("Error: unable to parse variable"));
 		return ERROR;
 	}
 	strncpy (buf, ptr+1, len - 2);
@@ -460,6 +629,9 @@ process_arguments (int argc, char **argv)
 	int c;
 
 	int option = 0;
+	enum {
+		ALL_OPTION = CHAR_MAX + 1
+	};
 	static struct option longopts[] = {
 		{"hostname", required_argument, 0, 'H'},
 		{"ups", required_argument, 0, 'u'},
@@ -471,6 +643,7 @@ process_arguments (int argc, char **argv)
 		{"variable", required_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
+		{"all", no_argument, 0, ALL_OPTION},
 		{0, 0, 0, 0}
 	};
 
@@ -562,6 +735,9 @@ process_arguments (int argc, char **argv)
 		case 'h':									/* help */
 			print_help ();
 			exit (STATE_UNKNOWN);
+		case ALL_OPTION:
+			check_all = TRUE;
+			break;
 		}
 	}
 
@@ -583,10 +759,14 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
-	if (! ups_name) {
+	if (! ups_name && ! check_all) {
 		printf ("%s\n", _("Error : no UPS indicated"));
 		return ERROR;
 	}
+	if (ups_name && check_all) {
+		printf ("%s\n", _("Error : --all cannot be used with --ups"));
+		return ERROR;
+	}
 	return OK;
 }
 
@@ -618,6 +798,9 @@ print_help (void)
 
 	printf (" %s\n", "-u, --ups=STRING");
   printf ("    %s\n", _("Name of UPS"));
+  printf (" %s\n", "--all");
+  printf ("    %s\n", _("Check every UPS the server knows of instead, with one line for each"));
+  printf ("    %s\n", _("after a summary and perfdata labels starting with the UPS name"));
   printf (" %s\n", "-T, --temperature");
   printf ("    %s\n", _("Output of temperatures in Celsius"));
   printf (" %s\n", "-v, --variable=STRING");
@@ -658,5 +841,5 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host -u ups [-p port] [-v variable] [-w warn_value] [-c crit_value] [-to to_sec] [-T]\n", progname);
+	printf ("%s -H host -u ups|--all [-p port] [-v variable] [-w warn_value] [-c crit_value] [-to to_sec] [-T]\n", progname);
 }
@@ -30,12 +30,15 @@
 * 
 *****************************************************************************/
 
+#include "np_entry.h"
+
 const char *progname = "check_users";
 const char *copyright = "2000-2007";
 const char *email = "devel@monitoring-plugins.org";
 
 #include "common.h"
 #include "utils.h"
+#include <ctype.h>
 
 #if HAVE_WTSAPI32_H
 # include <windows.h>
@@ -44,19 +47,39 @@ const char *email = "devel@monitoring-plugins.org";
 # define ERROR -1
 #elif HAVE_UTMPX_H
 # include <utmpx.h>
+#elif HAVE_UTMP_H && HAVE_DECL__PATH_UTMP
+# include <utmp.h>
+# include <fcntl.h>
+# define USE_UTMP_FILE 1
 #else
 # include "popen.h"
 #endif
 
 #define possibly_set(a,b) ((a) == 0 ? (b) : 0)
 
+enum {
+	GROUP_NONE,
+	GROUP_USER,
+	GROUP_TTY
+};
+
 int process_arguments (int, char **);
 void print_help (void);
 void print_usage (void);
+static void add_session (const char *, size_t, const char *, size_t);
+static int check_groups (char **, int *);
 
 char *warning_range = NULL;
 char *critical_range = NULL;
 thresholds *thlds = NULL;
+char *group_warning_range = NULL;
+char *group_critical_range = NULL;
+thresholds *group_thlds = NULL;
+int group_by = GROUP_NONE;
+
+/* with --group-by, the user or terminal of each session */
+static char **sessions = NULL;
+static int nsessions = 0;
 
 int
 main (int argc, char **argv)
@@ -69,13 +92,18 @@ main (int argc, char **argv)
 	DWORD index;
 #elif HAVE_UTMPX_H
 	struct utmpx *putmpx;
+#elif USE_UTMP_FILE
+	struct utmp ut;
+	int fd;
 #else
 	char input_buffer[MAX_INPUT_BUFFER];
+	char *name, *tty, *saveptr;
+	int who_q = strstr (WHO_COMMAND, " -q") != NULL;
 #endif
+	char *group_status = NULL;
+	int group_max = 0;
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Parse extra opts if any */
 	argv = np_extra_opts (&argc, argv, progname);
@@ -103,14 +131,14 @@ main (int argc, char **argv)
 
 		len = lstrlen(username);
 
-		WTSFreeMemory(username);
-
-		if (len == 0)
-			continue;
-
-		if (wtsinfo[index].State == WTSActive ||
-		  wtsinfo[index].State == WTSDisconnected)
+		if (len > 0 && (wtsinfo[index].State == WTSActive ||
+		  wtsinfo[index].State == WTSDisconnected)) {
 			users++;
+			add_session(username, len, wtsinfo[index].pWinStationName,
+			  lstrlen(wtsinfo[index].pWinStationName));
+		}
+
+		WTSFreeMemory(username);
 	}
 
 	WTSFreeMemory(wtsinfo);
@@ -119,10 +147,26 @@ main (int argc, char **argv)
 	setutxent ();
 
 	while ((putmpx = getutxent ()) != NULL)
-		if (putmpx->ut_type == USER_PROCESS)
+		if (putmpx->ut_type == USER_PROCESS) {
 			users++;
+			add_session (putmpx->ut_user, sizeof (putmpx->ut_user),
+			             putmpx->ut_line, sizeof (putmpx->ut_line));
+		}
 
 	endutxent ();
+#elif USE_UTMP_FILE
+	/* no utmpx(3), so read the utmp records, where a slot with a name is
+	 * a session and an empty one a terminal nobody is logged in on */
+	if ((fd = open (_PATH_UTMP, O_RDONLY)) < 0)
+		die (STATE_UNKNOWN, _("Cannot open %s: %s\n"), _PATH_UTMP, strerror (errno));
+
+	while (read (fd, &ut, sizeof (ut)) == sizeof (ut))
+		if (ut.ut_name[0] != '\0') {
+			users++;
+			add_session (ut.ut_name, sizeof (ut.ut_name), ut.ut_line, sizeof (ut.ut_line));
+		}
+
+	close (fd);
 #else
 	/* run the command */
 	child_process = spopen (WHO_COMMAND);
@@ -131,7 +175,7 @@ main (int argc, char **argv)
 		return STATE_UNKNOWN;
 	}
 
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
+	child_stderr = fdopen (spopen_stderr (child_process), "r");
 	if (child_stderr == NULL)
 		printf (_("Could not open stderr for %s\n"), WHO_COMMAND);
 
@@ -139,6 +183,16 @@ main (int argc, char **argv)
 		/* increment 'users' on all lines except total user count */
 		if (input_buffer[0] != '#') {
 			users++;
+			/* "who -q" lists the names of all users on one line, plain
+			 * "who" a session per line starting with the name and tty */
+			if (who_q) {
+				for (name = strtok_r (input_buffer, " \t\n", &saveptr); name;
+				     name = strtok_r (NULL, " \t\n", &saveptr))
+					add_session (name, strlen (name), "", 0);
+			} else if ((name = strtok_r (input_buffer, " \t\n", &saveptr)) != NULL) {
+				tty = strtok_r (NULL, " \t\n", &saveptr);
+				add_session (name, strlen (name), tty ? tty : "", tty ? strlen (tty) : 0);
+			}
 			continue;
 		}
 
@@ -159,10 +213,20 @@ main (int argc, char **argv)
 
 	/* check the user count against warning and critical thresholds */
 	result = get_status((double)users, thlds);
+	if (group_by != GROUP_NONE)
+		result = max_state (result, check_groups (&group_status, &group_max));
 
 	if (result == STATE_UNKNOWN)
 		printf ("%s\n", _("Unable to read output"));
-	else {
+	else if (group_by != GROUP_NONE) {
+		printf (_("USERS %s - %d users currently logged in%s |%s %s\n"),
+				state_text(result), users, group_status,
+				sperfdata_int("users", users, "", warning_range,
+							critical_range, TRUE, 0, FALSE, 0),
+				sperfdata_int(group_by == GROUP_USER ? "max_per_user" : "max_per_tty",
+							group_max, "", group_warning_range,
+							group_critical_range, TRUE, 0, FALSE, 0));
+	} else {
 		printf (_("USERS %s - %d users currently logged in |%s\n"), 
 				state_text(result), users,
 				sperfdata_int("users", users, "", warning_range,
@@ -172,15 +236,97 @@ main (int argc, char **argv)
 	return result;
 }
 
+/* Remember who a session belongs to, or the terminal class it is on (the
+ * line without its number, "pts/3" is "pts"), for --group-by. The names
+ * from utmp need not be terminated, so the lengths are the field sizes. */
+static void
+add_session (const char *user, size_t userlen, const char *tty, size_t ttylen)
+{
+	static int size = 0;
+	const char *name = group_by == GROUP_USER ? user : tty;
+	size_t len = group_by == GROUP_USER ? userlen : ttylen;
+	const char *end;
+	char *copy;
+
+	if (group_by == GROUP_NONE)
+		return;
+
+	if ((end = memchr (name, '\0', len)) != NULL)
+		len = end - name;
+	if (group_by == GROUP_TTY) {
+		while (len > 0 && isdigit ((unsigned char) name[len - 1]))
+			len--;
+		while (len > 1 && name[len - 1] == '/')
+			len--;
+		if (len == 0)
+			name = "?", len = 1;
+	}
+
+	if (nsessions == size) {
+		size = size ? size * 2 : 64;
+		if ((sessions = realloc (sessions, size * sizeof (char *))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	if ((copy = malloc (len + 1)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	memcpy (copy, name, len);
+	copy[len] = '\0';
+	sessions[nsessions++] = copy;
+}
+
+static int
+cmp_session (const void *a, const void *b)
+{
+	return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+/* Count the sessions of each user or terminal class after sorting them
+ * together, and check each count against the group thresholds */
+static int
+check_groups (char **status, int *biggest)
+{
+	int result = STATE_OK, state;
+	int i, j;
+
+	*status = "";
+	*biggest = 0;
+	qsort (sessions, nsessions, sizeof (char *), cmp_session);
+	for (i = 0; i < nsessions; i = j) {
+		for (j = i + 1; j < nsessions && strcmp (sessions[i], sessions[j]) == 0; j++)
+			;
+		if (j - i > *biggest)
+			*biggest = j - i;
+		if (group_thlds == NULL)
+			continue;
+		state = get_status ((double) (j - i), group_thlds);
+		if (state != STATE_OK)
+			xasprintf (status, "%s%s%s: %d", *status, **status ? ", " : " (",
+			           sessions[i], j - i);
+		result = max_state (result, state);
+	}
+	if (**status)
+		xasprintf (status, "%s)", *status);
+	return result;
+}
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
 	int c;
 	int option = 0;
+
+	enum {
+		GROUP_WARNING_OPTION = CHAR_MAX + 1,
+		GROUP_CRITICAL_OPTION
+	};
+
 	static struct option longopts[] = {
 		{"critical", required_argument, 0, 'c'},
 		{"warning", required_argument, 0, 'w'},
+		{"group-by", required_argument, 0, 'g'},
+		{"group-warning", required_argument, 0, GROUP_WARNING_OPTION},
+		{"group-critical", required_argument, 0, GROUP_CRITICAL_OPTION},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
@@ -190,7 +336,7 @@ process_arguments (int argc, char **argv)
 		usage ("\n");
 
 	while (1) {
-		c = getopt_long (argc, argv, "+hVvc:w:", longopts, &option);
+		c = getopt_long (argc, argv, "+hVvc:w:g:", longopts, &option);
 
 		if (c == -1 || c == EOF || c == 1)
 			break;
@@ -210,6 +356,20 @@ process_arguments (int argc, char **argv)
 		case 'w':									/* warning */
 			warning_range = optarg;
 			break;
+		case 'g':									/* group by user or tty */
+			if (strcmp (optarg, "user") == 0)
+				group_by = GROUP_USER;
+			else if (strcmp (optarg, "tty") == 0)
+				group_by = GROUP_TTY;
+			else
+				usage2 (_("Group by must be one of \"user\" or \"tty\""), optarg);
+			break;
+		case GROUP_WARNING_OPTION:
+			group_warning_range = optarg;
+			break;
+		case GROUP_CRITICAL_OPTION:
+			group_critical_range = optarg;
+			break;
 		}
 	}
 
@@ -227,6 +387,12 @@ process_arguments (int argc, char **argv)
 	if (thlds->critical->end < 0)
 		usage4 (_("Critical threshold must be a positive integer"));
 
+	if (group_warning_range || group_critical_range) {
+		if (group_by == GROUP_NONE)
+			usage4 (_("Group thresholds need -g/--group-by"));
+		set_thresholds (&group_thlds, group_warning_range, group_critical_range);
+	}
+
 	return OK;
 }
 
@@ -252,6 +418,13 @@ print_help (void)
 	printf ("    %s\n", _("Set WARNING status if more than INTEGER users are logged in"));
 	printf (" %s\n", "-c, --critical=INTEGER");
 	printf ("    %s\n", _("Set CRITICAL status if more than INTEGER users are logged in"));
+	printf (" %s\n", "-g, --group-by=user|tty");
+	printf ("    %s\n", _("Count the sessions of each user, or on each kind of terminal (the line"));
+	printf ("    %s\n", _("without its number, so pts/3 counts for pts)"));
+	printf (" %s\n", "--group-warning=RANGE");
+	printf ("    %s\n", _("Set WARNING status if the sessions of any group are outside RANGE"));
+	printf (" %s\n", "--group-critical=RANGE");
+	printf ("    %s\n", _("Set CRITICAL status if the sessions of any group are outside RANGE"));
 
 	printf (UT_SUPPORT);
 }
@@ -260,5 +433,6 @@ void
 print_usage (void)
 {
 	printf ("%s\n", _("Usage:"));
-	printf ("%s -w <users> -c <users>\n", progname);
+	printf ("%s -w <users> -c <users> [-g user|tty]\n", progname);
+	printf ("[--group-warning=<range>] [--group-critical=<range>]\n");
 }
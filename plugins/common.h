@@ -212,7 +212,9 @@ enum {
  *
  */
 #include "gettext.h"
-#define _(String) gettext (String)
+/* np_gettext binds the catalog on first use, after np_locale_init */
+char *np_gettext (const char *);
+#define _(String) np_gettext (String)
 #if ! ENABLE_NLS
 # undef textdomain
 # define textdomain(Domainname) /* empty */
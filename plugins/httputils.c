@@ -0,0 +1,102 @@
+/*****************************************************************************
+*
+* Monitoring Plugins HTTP utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains the parsing of HTTP response headers shared by
+* check_http and check_curl. A response is parsed once, possibly while it
+* is still being received, and its headers are looked up in the resulting
+* array afterwards.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "httputils.h"
+
+void
+http_response_init (http_response *response)
+{
+  memset (response, 0, sizeof (*response));
+  response->length = HTTP_RESPONSE_PARTIAL;
+}
+
+/* Parses the response in the first len bytes of buf, which need not be
+ * complete. Call it again with the same response when more data has
+ * arrived: only the new data is searched for the end of the headers until
+ * it is there. Once complete, calling it again just parses the headers
+ * anew, which is needed if buf has moved since. Returns the length of the
+ * status line and headers, HTTP_RESPONSE_PARTIAL or HTTP_RESPONSE_INVALID. */
+int
+http_response_parse (http_response *response, const char *buf, size_t len)
+{
+  int res;
+
+  if (response->length == HTTP_RESPONSE_INVALID)
+    return response->length;
+
+  response->nof_headers = HTTP_MAX_HEADERS;
+  res = phr_parse_response (buf, len, &response->http_minor, &response->http_code,
+    &response->msg, &response->msg_len, response->headers, &response->nof_headers,
+    response->last_len);
+  if (res == -2) {
+    response->last_len = len;
+    response->nof_headers = 0;
+  } else if (res < 0) {
+    response->nof_headers = 0;
+  }
+  response->length = res;
+  return res;
+}
+
+/* Returns the value of the first header called name, ignoring case, and
+ * its length in *len, or NULL if there is no such header */
+const char *
+http_header_find (const http_response *response, const char *name, size_t *len)
+{
+  size_t name_len = strlen (name);
+  size_t i;
+
+  for (i = 0; i < response->nof_headers; i++) {
+    /* continuation lines of the previous header have no name */
+    if (response->headers[i].name == NULL || response->headers[i].name_len != name_len)
+      continue;
+    if (strncasecmp (response->headers[i].name, name, name_len) == 0) {
+      *len = response->headers[i].value_len;
+      return response->headers[i].value;
+    }
+  }
+  return NULL;
+}
+
+/* Same as http_header_find, but returns a copy of the value to be freed
+ * by the caller */
+char *
+http_header_value (const http_response *response, const char *name)
+{
+  const char *value;
+  size_t len;
+
+  value = http_header_find (response, name, &len);
+  if (value == NULL)
+    return NULL;
+  return strndup (value, len);
+}
@@ -0,0 +1,61 @@
+/*****************************************************************************
+*
+* Monitoring Plugins HTTP utilities include file
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains the parsing of HTTP response headers shared by
+* check_http and check_curl.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef _HTTPUTILS_H_
+#define _HTTPUTILS_H_
+
+#include <stddef.h>
+#include "picohttpparser.h"
+
+#define HTTP_MAX_HEADERS 255
+
+/* The status line and headers of a response, parsed once by
+ * http_response_parse(). The pointers point into the parsed buffer. */
+typedef struct http_response {
+  int http_minor;
+  int http_code;
+  const char *msg;
+  size_t msg_len;
+  struct phr_header headers[HTTP_MAX_HEADERS];
+  size_t nof_headers;
+  /* bytes of status line and headers; HTTP_RESPONSE_PARTIAL until they
+   * have all been received, HTTP_RESPONSE_INVALID if they can't be parsed */
+  int length;
+  size_t last_len;
+} http_response;
+
+#define HTTP_RESPONSE_INVALID -1
+#define HTTP_RESPONSE_PARTIAL -2
+
+void http_response_init (http_response *response);
+int http_response_parse (http_response *response, const char *buf, size_t len);
+const char *http_header_find (const http_response *response, const char *name, size_t *len);
+char *http_header_value (const http_response *response, const char *name);
+
+#endif /* _HTTPUTILS_H_ */
@@ -0,0 +1,660 @@
+/*****************************************************************************
+*
+* Monitoring Plugins ICMP utilities
+*
+* License: GPL
+* Copyright (c) 2005-2008 Andreas Ericsson <ae@op5.se>
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains the ICMP echo send and receive core of check_icmp:
+* building echo requests, taking in replies in batches with the kernel's
+* receive timestamps, and picking them apart. np_icmp_ping() builds on it
+* to ping many hosts from one process for check_fping and check_ping.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils.h"
+#include "icmputils.h"
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+
+/* Open an ICMP socket for family. Raw sockets need privileges; with
+ * allow_dgram, fall back to the datagram ICMP sockets Linux gives to the
+ * groups in net.ipv4.ping_group_range. Those deliver replies without an IP
+ * header, and the kernel picks the echo id, so *dgram tells which it got. */
+int
+np_icmp_socket (int family, int allow_dgram, int *dgram)
+{
+	int proto = (family == AF_INET6) ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+	int sock, raw_errno;
+
+	if (dgram != NULL)
+		*dgram = FALSE;
+	if ((sock = socket (family, SOCK_RAW, proto)) >= 0 || !allow_dgram)
+		return sock;
+	raw_errno = errno;
+
+	if ((sock = socket (family, SOCK_DGRAM, proto)) >= 0) {
+		if (dgram != NULL)
+			*dgram = TRUE;
+		return sock;
+	}
+	errno = raw_errno;
+	return -1;
+}
+
+/* ask for receive timestamps, see np_icmp_packet_time() */
+void
+np_icmp_timestamps (int sock, int verbose)
+{
+#if defined(SO_TIMESTAMPNS) || defined(SO_TIMESTAMP)
+	int on = 1;
+#endif
+
+#if defined(SO_TIMESTAMPNS)
+	if (setsockopt (sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof (on)))
+		if (verbose) printf ("Warning: no SO_TIMESTAMPNS support\n");
+#elif defined(SO_TIMESTAMP)
+	if (setsockopt (sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof (on)))
+		if (verbose) printf ("Warning: no SO_TIMESTAMP support\n");
+#endif
+}
+
+unsigned short
+np_icmp_checksum (unsigned short *p, int n)
+{
+	const unsigned char *b = (const unsigned char *)p;
+	unsigned char odd[2] = { 0, 0 };
+	uint64_t sum = 0;
+	uint32_t word;
+	unsigned short half;
+
+	/* RFC 1071: the ones-complement sum can be taken over wider words, the
+	 * carries collect in the upper half of the sum and are folded in at the
+	 * end. 32 bits at a time halves the additions, and the compiler is free
+	 * to vectorise the loop for large payloads. */
+	for (; n >= 4; b += 4, n -= 4) {
+		memcpy (&word, b, 4);
+		sum += word;
+	}
+	if (n >= 2) {
+		memcpy (&half, b, 2);
+		sum += half;
+		b += 2;
+		n -= 2;
+	}
+	/* mop up the occasional odd byte, padded with a zero byte */
+	if (n == 1) {
+		odd[0] = *b;
+		memcpy (&half, odd, 2);
+		sum += half;
+	}
+
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+
+	return (unsigned short)~sum;
+}
+
+/* The checksum after one 16 bit word of the packet changed from old to
+ * new, without summing the rest again: RFC 1624, eqn. 3 */
+unsigned short
+np_icmp_checksum_update (unsigned short cksum, unsigned short old, unsigned short new)
+{
+	unsigned long sum;
+
+	sum = (unsigned short)~cksum + (unsigned long)(unsigned short)~old + new;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+
+	return (unsigned short)~sum;
+}
+
+void
+np_icmp_echo_request (void *buf, size_t len, int family,
+                      unsigned short id, unsigned short seq, np_icmp_echo_data *data)
+{
+	if (len >= NP_ICMP_HDR_LEN + sizeof (*data))
+		memcpy ((unsigned char *)buf + NP_ICMP_HDR_LEN, data, sizeof (*data));
+
+	if (family == AF_INET) {
+		struct icmp *icp = (struct icmp *)buf;
+
+		icp->icmp_type = ICMP_ECHO;
+		icp->icmp_code = 0;
+		icp->icmp_cksum = 0;
+		icp->icmp_id = htons (id);
+		icp->icmp_seq = htons (seq);
+		icp->icmp_cksum = np_icmp_checksum ((unsigned short *)buf, len);
+	}
+	else {
+		struct icmp6_hdr *icp6 = (struct icmp6_hdr *)buf;
+
+		icp6->icmp6_type = ICMP6_ECHO_REQUEST;
+		icp6->icmp6_code = 0;
+		icp6->icmp6_cksum = 0;
+		icp6->icmp6_id = htons (id);
+		icp6->icmp6_seq = htons (seq);
+	}
+}
+
+/* Turn an echo request built by np_icmp_echo_request() into the next one,
+ * with id, seq and data. Only the words that change are rewritten, and the
+ * checksum follows them with np_icmp_checksum_update(), so the payload is
+ * not touched again however large it is. */
+void
+np_icmp_echo_update (void *buf, size_t len, int family,
+                     unsigned short id, unsigned short seq, np_icmp_echo_data *data)
+{
+	unsigned short words[(NP_ICMP_HDR_LEN + sizeof (*data)) / 2];
+	unsigned short *cksum, old;
+	size_t i, n;
+
+	if (family != AF_INET) {
+		/* the ICMPv6 checksum is calculated by the kernel */
+		((struct icmp6_hdr *)buf)->icmp6_id = htons (id);
+		((struct icmp6_hdr *)buf)->icmp6_seq = htons (seq);
+		if (len >= NP_ICMP_HDR_LEN + sizeof (*data))
+			memcpy ((unsigned char *)buf + NP_ICMP_HDR_LEN, data, sizeof (*data));
+		return;
+	}
+
+	/* the new header and data, then word by word into the packet */
+	n = (len >= NP_ICMP_HDR_LEN + sizeof (*data)) ? sizeof (words) : NP_ICMP_HDR_LEN;
+	memcpy (words, buf, NP_ICMP_HDR_LEN);
+	((struct icmp *)words)->icmp_id = htons (id);
+	((struct icmp *)words)->icmp_seq = htons (seq);
+	if (n > NP_ICMP_HDR_LEN)
+		memcpy ((unsigned char *)words + NP_ICMP_HDR_LEN, data, sizeof (*data));
+
+	cksum = &((struct icmp *)buf)->icmp_cksum;
+	for (i = 0; i < n / 2; i++) {
+		if (&((unsigned short *)buf)[i] == cksum)
+			continue;
+		memcpy (&old, (unsigned char *)buf + i * 2, 2);
+		if (old == words[i])
+			continue;
+		*cksum = np_icmp_checksum_update (*cksum, old, words[i]);
+		memcpy ((unsigned char *)buf + i * 2, &words[i], 2);
+	}
+}
+
+/* Send count requests of len bytes, bufs[i] to to[i], with a single
+ * sendmmsg() where it is available. errors[i] gets the errno of a request
+ * that could not be sent, 0 otherwise. Returns the number sent. */
+int
+np_icmp_send_batch (int sock, unsigned char **bufs, size_t len,
+                    struct sockaddr_storage **to, int count, int *errors)
+{
+	int i, sent = 0;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[NP_ICMP_SEND_BATCH];
+	struct iovec iov[NP_ICMP_SEND_BATCH];
+	int n, done = 0, flags = 0;
+
+# ifdef MSG_CONFIRM
+	flags = MSG_CONFIRM;
+# endif
+	while (done < count) {
+		n = min (count - done, NP_ICMP_SEND_BATCH);
+		memset (msgs, 0, sizeof (msgs));
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = bufs[done + i];
+			iov[i].iov_len = len;
+			msgs[i].msg_hdr.msg_name = (struct sockaddr *)to[done + i];
+			msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		errno = 0;
+		/* the kernel stops at the first request it cannot send, which is
+		 * then skipped with its error */
+		if ((n = sendmmsg (sock, msgs, n, flags)) <= 0) {
+			errors[done++] = errno ? errno : EIO;
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			errors[done + i] = 0;
+		done += n;
+		sent += n;
+	}
+#else
+	for (i = 0; i < count; i++) {
+		if (np_icmp_send (sock, bufs[i], len, to[i]) < 0)
+			errors[i] = errno ? errno : EIO;
+		else {
+			errors[i] = 0;
+			sent++;
+		}
+	}
+#endif /* HAVE_SENDMMSG */
+
+	return sent;
+}
+
+/* Returns the number of bytes sent, or -1 */
+int
+np_icmp_send (int sock, void *buf, size_t len, struct sockaddr_storage *to)
+{
+	struct msghdr hdr;
+	struct iovec iov;
+
+	memset (&iov, 0, sizeof (iov));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	memset (&hdr, 0, sizeof (hdr));
+	hdr.msg_name = (struct sockaddr *)to;
+	hdr.msg_namelen = sizeof (struct sockaddr_storage);
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+
+	errno = 0;
+
+/* MSG_CONFIRM is a linux thing and only available on linux kernels >= 2.3.15, see send(2) */
+#ifdef MSG_CONFIRM
+	return sendmsg (sock, &hdr, MSG_CONFIRM);
+#else
+	return sendmsg (sock, &hdr, 0);
+#endif
+}
+
+/* Pick apart a received packet, behind an IPv4 header if ip_header is set.
+ * Returns TRUE for an echo reply, FALSE for any other ICMP message and -1
+ * if the packet is too short for ICMP. */
+int
+np_icmp_parse_reply (unsigned char *buf, int len, int family, int ip_header, np_icmp_reply *reply)
+{
+	memset (reply, 0, sizeof (*reply));
+
+	if (family == AF_INET && ip_header) {
+		struct ip *ip = (struct ip *)buf;
+
+		if (len < (int)sizeof (struct ip))
+			return -1;
+		reply->hlen = ip->ip_hl << 2;
+		reply->ttl = ip->ip_ttl;
+	}
+	if (len < reply->hlen + ICMP_MINLEN)
+		return -1;
+
+	reply->icmp = buf + reply->hlen;
+	reply->len = len - reply->hlen;
+
+	if (family == AF_INET) {
+		struct icmp *icp = (struct icmp *)reply->icmp;
+
+		reply->type = icp->icmp_type;
+		reply->code = icp->icmp_code;
+		reply->id = ntohs (icp->icmp_id);
+		reply->seq = ntohs (icp->icmp_seq);
+	}
+	else {
+		struct icmp6_hdr *icp6 = (struct icmp6_hdr *)reply->icmp;
+
+		reply->type = icp6->icmp6_type;
+		reply->code = icp6->icmp6_code;
+		reply->id = ntohs (icp6->icmp6_id);
+		reply->seq = ntohs (icp6->icmp6_seq);
+	}
+
+	if (reply->type != (family == AF_INET ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY))
+		return FALSE;
+
+	if (reply->len >= NP_ICMP_HDR_LEN + (int)sizeof (reply->data))
+		memcpy (&reply->data, reply->icmp + NP_ICMP_HDR_LEN, sizeof (reply->data));
+	return TRUE;
+}
+
+/* the kernel's receive timestamp of a packet if it gave us one (nanosecond
+ * resolution with SO_TIMESTAMPNS), the current time otherwise */
+void
+np_icmp_packet_time (struct msghdr *hdr, struct timeval *tv)
+{
+#if defined(SO_TIMESTAMPNS) || defined(SO_TIMESTAMP)
+	struct cmsghdr* chdr;
+
+	for (chdr = CMSG_FIRSTHDR (hdr); chdr; chdr = CMSG_NXTHDR (hdr, chdr)) {
+		if (chdr->cmsg_level != SOL_SOCKET)
+			continue;
+#ifdef SCM_TIMESTAMPNS
+		if (chdr->cmsg_type == SCM_TIMESTAMPNS
+		    && chdr->cmsg_len >= CMSG_LEN (sizeof (struct timespec))) {
+			struct timespec ts;
+			memcpy (&ts, CMSG_DATA (chdr), sizeof (ts));
+			tv->tv_sec = ts.tv_sec;
+			tv->tv_usec = ts.tv_nsec / 1000;
+			return;
+		}
+#endif /* SCM_TIMESTAMPNS */
+#ifdef SO_TIMESTAMP
+		if (chdr->cmsg_type == SO_TIMESTAMP
+		    && chdr->cmsg_len >= CMSG_LEN (sizeof (struct timeval))) {
+			memcpy (tv, CMSG_DATA (chdr), sizeof (*tv));
+			return;
+		}
+#endif /* SO_TIMESTAMP */
+	}
+#endif /* SO_TIMESTAMPNS || SO_TIMESTAMP */
+	gettimeofday (tv, NULL);
+}
+
+/* Wait up to usecs for replies, then pass everything that is queued to
+ * handler, NP_ICMP_RECV_BATCH packets per system call where recvmmsg() is
+ * available. Returns the number of packets taken in. Threads may drain
+ * sockets of their own at the same time. */
+int
+np_icmp_drain (int sock, unsigned int usecs, np_icmp_handler handler, void *arg)
+{
+	static NP_THREAD_LOCAL unsigned char bufs[NP_ICMP_RECV_BATCH][4096];
+	static NP_THREAD_LOCAL char ctrl[NP_ICMP_RECV_BATCH][512];
+	struct sockaddr_storage addrs[NP_ICMP_RECV_BATCH];
+	struct iovec iov[NP_ICMP_RECV_BATCH];
+	struct timeval to, now;
+	fd_set rd;
+	int i, n, total = 0;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[NP_ICMP_RECV_BATCH];
+#else
+	struct msghdr hdr;
+	int len;
+#endif
+
+	to.tv_sec = usecs / 1000000;
+	to.tv_usec = usecs % 1000000;
+	FD_ZERO (&rd);
+	FD_SET (sock, &rd);
+	n = select (sock + 1, &rd, NULL, NULL, &to);
+	if (n < 0 && errno != EINTR)
+		die (STATE_UNKNOWN, _("select() failed: %s\n"), strerror (errno));
+	if (n <= 0)
+		return 0;
+
+	do {
+		for (i = 0; i < NP_ICMP_RECV_BATCH; i++) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = sizeof (bufs[i]);
+		}
+#ifdef HAVE_RECVMMSG
+		memset (msgs, 0, sizeof (msgs));
+		for (i = 0; i < NP_ICMP_RECV_BATCH; i++) {
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof (addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = ctrl[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof (ctrl[i]);
+		}
+		n = recvmmsg (sock, msgs, NP_ICMP_RECV_BATCH, MSG_DONTWAIT, NULL);
+		for (i = 0; i < n; i++) {
+			np_icmp_packet_time (&msgs[i].msg_hdr, &now);
+			handler (bufs[i], msgs[i].msg_len, &addrs[i], &now, arg);
+		}
+#else
+		for (n = 0; n < NP_ICMP_RECV_BATCH; n++) {
+			memset (&hdr, 0, sizeof (hdr));
+			hdr.msg_name = &addrs[n];
+			hdr.msg_namelen = sizeof (addrs[n]);
+			hdr.msg_iov = &iov[n];
+			hdr.msg_iovlen = 1;
+			hdr.msg_control = ctrl[n];
+			hdr.msg_controllen = sizeof (ctrl[n]);
+			if ((len = recvmsg (sock, &hdr, MSG_DONTWAIT)) < 0)
+				break;
+			np_icmp_packet_time (&hdr, &now);
+			handler (bufs[n], len, &addrs[n], &now, arg);
+		}
+#endif /* HAVE_RECVMMSG */
+		if (n > 0)
+			total += n;
+	} while (n == NP_ICMP_RECV_BATCH);
+
+	return total;
+}
+
+/* what the reply handler of np_icmp_ping() works with */
+typedef struct icmp_ping_run {
+	const np_icmp_probe *probe;
+	np_icmp_target *targets;
+	size_t count;
+	unsigned short id;
+	unsigned char *replied;   /* by sequence number, see below */
+	unsigned int replies;
+	unsigned int answered;    /* requests with a reply or an error */
+} icmp_ping_run;
+
+#define PING_REPLIED 1
+#define PING_ERROR 2
+
+static int
+same_address (struct sockaddr_storage *a, struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return FALSE;
+	if (a->ss_family == AF_INET)
+		return ((struct sockaddr_in *)a)->sin_addr.s_addr == ((struct sockaddr_in *)b)->sin_addr.s_addr;
+	return !memcmp (&((struct sockaddr_in6 *)a)->sin6_addr, &((struct sockaddr_in6 *)b)->sin6_addr,
+	                sizeof (struct in6_addr));
+}
+
+/* the target one of our requests went to, or NULL */
+static np_icmp_target *
+ping_target (icmp_ping_run *run, unsigned short seq)
+{
+	np_icmp_target *t;
+
+	if (seq / run->probe->packets >= run->count)
+		return NULL;
+	t = &run->targets[seq / run->probe->packets];
+	if (seq % run->probe->packets >= t->sent)
+		return NULL;
+	return t;
+}
+
+/* An ICMP error carries the start of the request it is about: its IP
+ * header and the echo header after that. */
+static void
+ping_error (icmp_ping_run *run, np_icmp_reply *reply)
+{
+	int family = run->probe->family;
+	unsigned char *orig = reply->icmp + NP_ICMP_HDR_LEN;
+	int len = reply->len - NP_ICMP_HDR_LEN, hlen;
+	unsigned short id, seq;
+	np_icmp_target *t;
+
+	if (family == AF_INET) {
+		if (reply->type != ICMP_UNREACH && reply->type != ICMP_TIMXCEED)
+			return;
+		if (len < (int)sizeof (struct ip))
+			return;
+		hlen = ((struct ip *)orig)->ip_hl << 2;
+		if (len < hlen + NP_ICMP_HDR_LEN || ((struct icmp *)(orig + hlen))->icmp_type != ICMP_ECHO)
+			return;
+		id = ntohs (((struct icmp *)(orig + hlen))->icmp_id);
+		seq = ntohs (((struct icmp *)(orig + hlen))->icmp_seq);
+	}
+	else {
+		if (reply->type != ICMP6_DST_UNREACH && reply->type != ICMP6_TIME_EXCEEDED)
+			return;
+		hlen = sizeof (struct ip6_hdr);
+		if (len < hlen + NP_ICMP_HDR_LEN || ((struct icmp6_hdr *)(orig + hlen))->icmp6_type != ICMP6_ECHO_REQUEST)
+			return;
+		id = ntohs (((struct icmp6_hdr *)(orig + hlen))->icmp6_id);
+		seq = ntohs (((struct icmp6_hdr *)(orig + hlen))->icmp6_seq);
+	}
+	if (id != run->id || (t = ping_target (run, seq)) == NULL)
+		return;
+
+	if (!run->replied[seq]) {
+		run->replied[seq] = PING_ERROR;
+		run->answered++;
+	}
+	t->error = TRUE;
+	t->error_type = reply->type;
+	t->error_code = reply->code;
+	if (run->probe->verbose)
+		printf (_("%s : [%d], ICMP error type %u code %u\n"), t->name,
+		        seq % run->probe->packets, reply->type, reply->code);
+}
+
+static void
+ping_reply (unsigned char *buf, int len, struct sockaddr_storage *from, struct timeval *now, void *arg)
+{
+	icmp_ping_run *run = arg;
+	const np_icmp_probe *probe = run->probe;
+	np_icmp_reply reply;
+	np_icmp_target *t;
+	double rtt;
+	int echo;
+
+	echo = np_icmp_parse_reply (buf, len, probe->family, probe->family == AF_INET && !probe->dgram, &reply);
+	if (echo < 0)
+		return;
+	/* datagram sockets are not handed errors this way */
+	if (echo == FALSE) {
+		if (!probe->dgram)
+			ping_error (run, &reply);
+		return;
+	}
+	/* the kernel picks the id for datagram sockets and only hands us ours */
+	if (!probe->dgram && reply.id != run->id)
+		return;
+	if ((t = ping_target (run, reply.seq)) == NULL || !same_address (from, &t->addr))
+		return;
+	if (run->replied[reply.seq] == PING_REPLIED) {
+		t->duplicates++;
+		return;
+	}
+	if (!run->replied[reply.seq])
+		run->answered++;
+	run->replied[reply.seq] = PING_REPLIED;
+
+	rtt = (double)(now->tv_sec - reply.data.stime.tv_sec) * 1.0e3 +
+	      (double)(now->tv_usec - reply.data.stime.tv_usec) / 1.0e3;
+	if (rtt < 0)
+		rtt = 0;
+	if (t->received == 0 || rtt < t->rtmin)
+		t->rtmin = rtt;
+	if (rtt > t->rtmax)
+		t->rtmax = rtt;
+	t->rtt_total += rtt;
+	t->received++;
+	run->replies++;
+
+	if (probe->verbose)
+		printf ("%s : [%d], %.2f ms\n", t->name, reply.seq % probe->packets, rtt);
+}
+
+/* Ping all resolved targets in rounds, one request to each per round and
+ * probe->interval apart, then wait up to probe->timeout for what is still
+ * out. Packet n to target i carries the sequence number
+ * i * probe->packets + n, so that one socket serves all of them. Returns
+ * once every request got a reply or an error, or could not be sent, or the
+ * time is up, with the number of replies. */
+unsigned int
+np_icmp_ping (const np_icmp_probe *probe, np_icmp_target *targets, size_t count)
+{
+	icmp_ping_run run;
+	struct timeval round_start;
+	np_icmp_echo_data data;
+	unsigned char *packet, *packets[NP_ICMP_SEND_BATCH];
+	struct sockaddr_storage *to[NP_ICMP_SEND_BATCH];
+	size_t packet_len, stride, i, t, batch[NP_ICMP_SEND_BATCH], sendable = 0;
+	int errors[NP_ICMP_SEND_BATCH], b, k;
+	unsigned int n;
+	double left;
+
+	if ((unsigned long)count * probe->packets > 65536)
+		die (STATE_UNKNOWN, _("Cannot send more than 65536 packets, got %lu targets with %u packets each\n"),
+		     (unsigned long)count, probe->packets);
+
+	memset (&run, 0, sizeof (run));
+	run.probe = probe;
+	run.targets = targets;
+	run.count = count;
+	run.id = getpid () & 0xffff;
+
+	packet_len = NP_ICMP_HDR_LEN + probe->size;
+	if (packet_len < NP_ICMP_HDR_LEN + sizeof (data))
+		packet_len = NP_ICMP_HDR_LEN + sizeof (data);
+	/* a request per slot of a batch, built once and updated for each send */
+	stride = (packet_len + 7) & ~(size_t)7;
+	if ((packet = calloc (NP_ICMP_SEND_BATCH, stride)) == NULL ||
+	    (run.replied = calloc (count * probe->packets + 1, 1)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	memset (&data, 0, sizeof (data));
+	for (k = 0; k < NP_ICMP_SEND_BATCH; k++) {
+		packets[k] = packet + k * stride;
+		np_icmp_echo_request (packets[k], packet_len, probe->family, run.id, 0, &data);
+	}
+
+	for (i = 0; i < count; i++)
+		if (targets[i].resolved)
+			sendable++;
+
+	for (n = 0; n < probe->packets; n++) {
+		gettimeofday (&round_start, NULL);
+		for (i = 0; i < count; ) {
+			for (b = 0; i < count && b < NP_ICMP_SEND_BATCH; i++) {
+				if (!targets[i].resolved)
+					continue;
+				gettimeofday (&data.stime, NULL);
+				np_icmp_echo_update (packets[b], packet_len, probe->family, run.id, i * probe->packets + n, &data);
+				to[b] = &targets[i].addr;
+				batch[b++] = i;
+			}
+			np_icmp_send_batch (probe->sock, packets, packet_len, to, b, errors);
+
+			for (k = 0; k < b; k++) {
+				t = batch[k];
+				if (errors[k]) {
+					targets[t].send_errno = errors[k];
+					run.replied[t * probe->packets + n] = PING_ERROR;
+					run.answered++;
+					if (probe->verbose)
+						printf (_("Failed to send ping to %s: %s\n"), targets[t].name, strerror (errors[k]));
+				}
+				targets[t].sent++;
+			}
+
+			/* take in what came back meanwhile so the socket buffer does not fill up */
+			if (b > 0)
+				np_icmp_drain (probe->sock, 0, ping_reply, &run);
+		}
+
+		/* wait for the next round, or for the last replies */
+		while (run.answered < sendable * (n + 1) || n < probe->packets - 1) {
+			left = (double)((n < probe->packets - 1) ? probe->interval : probe->timeout) - (double)deltime (round_start);
+			if (left <= 0)
+				break;
+			np_icmp_drain (probe->sock, (unsigned int)left, ping_reply, &run);
+		}
+	}
+
+	free (packet);
+	free (run.replied);
+	return run.replies;
+}
@@ -0,0 +1,109 @@
+/*****************************************************************************
+*
+* Monitoring Plugins ICMP utilities include file
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* The ICMP echo send and receive core of check_icmp, and a prober for
+* many hosts at once on top of it, which check_fping and check_ping use.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef _ICMPUTILS_H_
+#define _ICMPUTILS_H_
+
+#include "common.h"
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* the payload of our echo requests, right after the 8 byte ICMP header */
+typedef struct np_icmp_echo_data {
+	struct timeval stime;	/* when the request was sent */
+	unsigned short ping_id;
+} np_icmp_echo_data;
+
+/* what np_icmp_parse_reply() found in a received packet */
+typedef struct np_icmp_reply {
+	unsigned char type;
+	unsigned char code;
+	unsigned short id;
+	unsigned short seq;
+	unsigned char ttl;        /* 0 if the packet came without an IP header */
+	int hlen;                 /* length of the IP header in front of the ICMP one */
+	unsigned char *icmp;      /* the ICMP header */
+	int len;                  /* bytes from there on */
+	np_icmp_echo_data data;   /* only for echo replies */
+} np_icmp_reply;
+
+/* one host pinged by np_icmp_ping() */
+typedef struct np_icmp_target {
+	const char *name;
+	struct sockaddr_storage addr;
+	int resolved;             /* hosts that were not resolved are skipped */
+	unsigned int sent;
+	unsigned int received;
+	unsigned int duplicates;
+	double rtt_total;         /* ms, over all replies */
+	double rtmin;
+	double rtmax;
+	int error;                /* TRUE if an ICMP error came back about it */
+	unsigned char error_type; /* the last one, seen on raw sockets only */
+	unsigned char error_code;
+	int send_errno;           /* of the last request that could not be sent */
+} np_icmp_target;
+
+/* how np_icmp_ping() pings */
+typedef struct np_icmp_probe {
+	int sock;                 /* from np_icmp_socket() */
+	int family;
+	int dgram;                /* TRUE for a datagram socket */
+	unsigned int packets;     /* per target */
+	size_t size;              /* bytes of data after the ICMP header */
+	unsigned int interval;    /* usecs from one round of requests to the next */
+	unsigned int timeout;     /* usecs to wait for replies after the last round */
+	int verbose;
+} np_icmp_probe;
+
+/* called for every packet np_icmp_drain() takes in, with the receive time */
+typedef void (*np_icmp_handler) (unsigned char *, int, struct sockaddr_storage *, struct timeval *, void *);
+
+#define NP_ICMP_HDR_LEN 8
+#define NP_ICMP_RECV_BATCH 32	/* replies taken in per system call */
+#define NP_ICMP_SEND_BATCH 32	/* requests handed over per system call */
+
+int np_icmp_socket (int family, int allow_dgram, int *dgram);
+void np_icmp_timestamps (int sock, int verbose);
+unsigned short np_icmp_checksum (unsigned short *, int);
+unsigned short np_icmp_checksum_update (unsigned short cksum, unsigned short old, unsigned short new);
+void np_icmp_echo_request (void *buf, size_t len, int family,
+  unsigned short id, unsigned short seq, np_icmp_echo_data *data);
+void np_icmp_echo_update (void *buf, size_t len, int family,
+  unsigned short id, unsigned short seq, np_icmp_echo_data *data);
+int np_icmp_send (int sock, void *buf, size_t len, struct sockaddr_storage *to);
+int np_icmp_send_batch (int sock, unsigned char **bufs, size_t len,
+  struct sockaddr_storage **to, int count, int *errors);
+int np_icmp_parse_reply (unsigned char *buf, int len, int family, int ip_header, np_icmp_reply *reply);
+void np_icmp_packet_time (struct msghdr *, struct timeval *);
+int np_icmp_drain (int sock, unsigned int usecs, np_icmp_handler handler, void *arg);
+unsigned int np_icmp_ping (const np_icmp_probe *probe, np_icmp_target *targets, size_t count);
+
+#endif /* _ICMPUTILS_H_ */
@@ -0,0 +1,92 @@
+/*****************************************************************************
+*
+* Monitoring Plugins MRTG log utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains the MRTG log reader shared by check_mrtg and
+* check_mrtgtraf.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils.h"
+#include "mrtgutils.h"
+#include <fcntl.h>
+
+/* Reads the newest entry, "timestamp avg1 avg2 max1 max2" on the second
+ * line, with a single pread of the head of the log */
+int
+mrtg_read_latest (const char *log_file, mrtg_entry *entry)
+{
+	char buffer[MRTG_HEAD_SIZE + 1], *line, *end;
+	long long fields[5];
+	ssize_t len;
+	int fd, n, i;
+
+	if ((fd = open (log_file, O_RDONLY)) < 0)
+		return MRTG_LOG_OPEN_ERROR;
+	len = pread (fd, buffer, MRTG_HEAD_SIZE, 0);
+	close (fd);
+	if (len <= 0)
+		return MRTG_LOG_PARSE_ERROR;
+	buffer[len] = '\0';
+
+	/* skip the first line of the log file */
+	if ((line = strchr (buffer, '\n')) == NULL)
+		return MRTG_LOG_PARSE_ERROR;
+	line++;
+	/* the entry must be complete, unless the log ends with it */
+	if ((end = strchr (line, '\n')) == NULL && len == MRTG_HEAD_SIZE)
+		return MRTG_LOG_PARSE_ERROR;
+	if (end != NULL)
+		*end = '\0';
+
+	/* the fields which are there, at least the timestamp */
+	memset (entry, 0, sizeof (mrtg_entry));
+	if ((n = np_strtoll_fields (line, fields, 5, NULL)) < 1)
+		return MRTG_LOG_PARSE_ERROR;
+	entry->timestamp = (time_t) fields[0];
+	for (i = 1; i < n; i++) {
+		if (i < 3)
+			entry->average[i - 1] = (unsigned long) fields[i];
+		else
+			entry->maximum[i - 3] = (unsigned long) fields[i];
+	}
+
+	return MRTG_LOG_OK;
+}
+
+/* The name of a log in the output and the performance data labels, its
+ * file name without the directory and the .log extension */
+char *
+mrtg_log_name (const char *log_file)
+{
+	const char *base = strrchr (log_file, '/');
+	char *name;
+	size_t len;
+
+	name = strdup (base ? base + 1 : log_file);
+	len = strlen (name);
+	if (len > 4 && strcmp (name + len - 4, ".log") == 0)
+		name[len - 4] = '\0';
+	return name;
+}
@@ -0,0 +1,55 @@
+/*****************************************************************************
+*
+* Monitoring Plugins MRTG log utilities include file
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* The MRTG log reader of check_mrtg and check_mrtgtraf, which only reads
+* the head of the log where MRTG keeps its newest entry.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef _MRTGUTILS_H_
+#define _MRTGUTILS_H_
+
+#include "common.h"
+
+/* MRTG writes the current counters on the first line of the log and the
+ * newest averaged entry on the second one, both well within this */
+#define MRTG_HEAD_SIZE 4096
+
+enum {
+	MRTG_LOG_OK = 0,
+	MRTG_LOG_OPEN_ERROR = -1,	/* errno tells why */
+	MRTG_LOG_PARSE_ERROR = -2
+};
+
+/* the newest entry of a log, for both variables */
+typedef struct mrtg_entry {
+	time_t timestamp;
+	unsigned long average[2];
+	unsigned long maximum[2];
+} mrtg_entry;
+
+int mrtg_read_latest (const char *log_file, mrtg_entry *entry);
+char *mrtg_log_name (const char *log_file);
+
+#endif /* _MRTGUTILS_H_ */
@@ -29,6 +29,8 @@
 * 
 *****************************************************************************/
 
+#include "np_entry.h"
+
 const char *progname = "negate";
 const char *copyright = "2002-2008";
 const char *email = "devel@monitoring-plugins.org";
@@ -45,9 +47,10 @@ const char *email = "devel@monitoring-plugins.org";
 
 static const char **process_arguments (int, char **);
 void validate_arguments (char **);
+static void print_output (const char *, int);
 void print_help (void);
 void print_usage (void);
-int subst_text = FALSE;
+static int subst_text = FALSE;
 
 static int state[4] = {
 	STATE_OK,
@@ -60,14 +63,15 @@ int
 main (int argc, char **argv)
 {
 	int result = STATE_UNKNOWN;
-	char *sub;
 	char **command_line;
 	output chld_out, chld_err;
 	int i;
+#ifdef NP_ENTRY_PREFIX
+	char *text;
+	size_t len;
+#endif
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	timeout_interval = DEFAULT_TIMEOUT;
 
@@ -79,6 +83,20 @@ main (int argc, char **argv)
 
 	(void) alarm ((unsigned) timeout_interval);
 
+#ifdef NP_ENTRY_PREFIX
+	/* inside np-executor, a wrapped plugin that is an entry as well runs
+	 * in-process instead of as a child */
+	if (command_line[1] != NULL &&
+	    (result = np_entry_run (command_line, &text, &len)) >= 0) {
+		if (len == 0)
+			die (max_state_alt (result, STATE_UNKNOWN), _("No data returned from command\n"));
+		print_output (text, result);
+		if (text[len - 1] != '\n')
+			putchar ('\n');
+		exit (state[result]);
+	}
+#endif
+
 	/* catch when the command is quoted */
 	if(command_line[1] == NULL) {
 		result = cmd_run (command_line[0], &chld_out, &chld_err, 0);
@@ -96,17 +114,8 @@ main (int argc, char **argv)
 		die (max_state_alt (result, STATE_UNKNOWN), _("No data returned from command\n"));
 
 	for (i = 0; i < chld_out.lines; i++) {
-		if (subst_text && result >= 0 && result <= 4 && result != state[result])  {
-			/* Loop over each match found */
-			while ((sub = strstr (chld_out.line[i], state_text (result)))) {
-				/* Terminate the first part and skip over the string we'll substitute */
-				*sub = '\0';
-				sub += strlen (state_text (result));
-				/* then put everything back together */
-				xasprintf (&chld_out.line[i], "%s%s%s", chld_out.line[i], state_text (state[result]), sub);
-			}
-		}
-		printf ("%s\n", chld_out.line[i]);
+		print_output (chld_out.line[i], result);
+		putchar ('\n');
 	}
 
 	if (result >= 0 && result <= 4) {
@@ -117,6 +126,30 @@ main (int argc, char **argv)
 }
 
 
+/* Print what the wrapped plugin printed, with the status words of its
+ * state replaced by those of the new state in the same pass if asked to */
+static void
+print_output (const char *text, int result)
+{
+	const char *old, *sub;
+	size_t old_len;
+
+	if (!subst_text || result < 0 || result > 3 || result == state[result]) {
+		fputs (text, stdout);
+		return;
+	}
+
+	old = state_text (result);
+	old_len = strlen (old);
+	while ((sub = strstr (text, old)) != NULL) {
+		fwrite (text, 1, sub - text, stdout);
+		fputs (state_text (state[result]), stdout);
+		text = sub + old_len;
+	}
+	fputs (text, stdout);
+}
+
+
 /* process command-line arguments */
 static const char **
 process_arguments (int argc, char **argv)
@@ -29,6 +29,25 @@
 
 #include "common.h"
 #include "netutils.h"
+#include "utils_targets.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+# include <sys/epoll.h>
+# define CONN_EPOLL 1
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_NODROP)
+#  define CONN_URING 1
+# endif
+#endif
 
 unsigned int socket_timeout = DEFAULT_SOCKET_TIMEOUT;
 unsigned int socket_timeout_state = STATE_CRITICAL;
@@ -50,7 +69,7 @@ socket_timeout_alarm_handler (int sig)
 	else
 		printf (_("%s - Abnormal timeout after %d seconds\n"), state_text(socket_timeout_state), socket_timeout);
 
-	exit (socket_timeout_state);
+	np_exit (socket_timeout_state);
 }
 
 
@@ -157,6 +176,209 @@ process_request (const char *server_address, int server_port, int proto,
 }
 
 
+/* Happy Eyeballs (RFC 8305) for TCP: the addresses are tried in turn, with
+ * the address families interleaved. A new attempt starts as soon as the last
+ * one failed, or after CONNECT_ATTEMPT_DELAY milliseconds without an answer,
+ * while the earlier ones stay in flight. The first connection made wins, so
+ * a dead IPv6 path costs 250ms rather than the whole socket timeout. */
+#define CONNECT_ATTEMPT_DELAY 250
+
+static int connect_family = AF_UNSPEC;
+static double connect_time = 0;
+static double last_connect_timeout = 0;
+static int tcp_fast_open = FALSE;
+static void adapt_sample (const char *host, int port, double seconds);
+static void adapt_timed_out (const char *host, int port);
+
+/* the address family of the last connection np_net_connect() made */
+int
+np_net_connect_family (void)
+{
+	return connect_family;
+}
+
+/* how long the last np_net_connect() took to connect, in seconds */
+double
+np_net_connect_time (void)
+{
+	return connect_time;
+}
+
+void
+np_net_tcp_fast_open (int on)
+{
+	tcp_fast_open = on;
+}
+
+int
+np_net_tcp_info (int sd, np_tcp_info *info)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info ti;
+	socklen_t len = sizeof (ti);
+
+	memset (&ti, 0, sizeof (ti));
+	if (getsockopt (sd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+		return FALSE;
+	info->established = ti.tcpi_state == TCP_ESTABLISHED;
+	info->rtt = ti.tcpi_rtt / 1.0e6;
+	info->rttvar = ti.tcpi_rttvar / 1.0e6;
+	info->retransmits = ti.tcpi_total_retrans;
+	info->fast_open = (ti.tcpi_options & TCPI_OPT_SYN_DATA) ? TRUE : FALSE;
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+int
+np_net_idle_alive (int sd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = sd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (sd < 0 || poll (&pfd, 1, 0) < 0)
+		return FALSE;
+	/* nothing is due on an idle connection but the end of it, or an error
+	 * the server sends before closing it */
+	return pfd.revents == 0;
+}
+
+/* Returns the connected, blocking socket, or -1 with errno from the last
+ * attempt that failed, ETIMEDOUT once the deadline passes. */
+static int
+connect_staggered (struct addrinfo *res, int socktype, double deadline)
+{
+	struct addrinfo *r, *first, *other, **order, **pending;
+	struct pollfd *pfds;
+	struct timeval start;
+	size_t count = 0, next = 0, nactive = 0, i, j;
+	int sd = -1, error = ETIMEDOUT, start_next = TRUE, timeout, left;
+	socklen_t optlen;
+	double last = 0;
+
+	for (r = res; r != NULL; r = r->ai_next)
+		count++;
+	order = calloc (count, sizeof (struct addrinfo *));
+	pending = calloc (count, sizeof (struct addrinfo *));
+	pfds = calloc (count, sizeof (struct pollfd));
+	if (order == NULL || pending == NULL || pfds == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	/* the family getaddrinfo() put first, then the others, in turns */
+	for (i = 0, first = other = res; i < count; ) {
+		while (first != NULL && first->ai_family != res->ai_family)
+			first = first->ai_next;
+		if (first != NULL) {
+			order[i++] = first;
+			first = first->ai_next;
+		}
+		while (other != NULL && other->ai_family == res->ai_family)
+			other = other->ai_next;
+		if (other != NULL) {
+			order[i++] = other;
+			other = other->ai_next;
+		}
+	}
+
+	gettimeofday (&start, NULL);
+	while (sd < 0 && (next < count || nactive > 0)) {
+		if (next < count && (start_next || nactive == 0 ||
+		                     (double)deltime (start) / 1.0e3 - last >= CONNECT_ATTEMPT_DELAY)) {
+			r = order[next++];
+			start_next = FALSE;
+			last = (double)deltime (start) / 1.0e3;
+			if ((pfds[nactive].fd = socket (r->ai_family, socktype, r->ai_protocol)) < 0) {
+				error = errno;
+				start_next = TRUE;
+				continue;
+			}
+			fcntl (pfds[nactive].fd, F_SETFL, fcntl (pfds[nactive].fd, F_GETFL) | O_NONBLOCK);
+#ifdef TCP_FASTOPEN_CONNECT
+			/* with a cookie connect() returns at once, and the SYN
+			 * goes out with the first write */
+			if (tcp_fast_open)
+				setsockopt (pfds[nactive].fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+				            &tcp_fast_open, sizeof (tcp_fast_open));
+#endif
+			if (connect (pfds[nactive].fd, r->ai_addr, r->ai_addrlen) == 0) {
+				sd = pfds[nactive].fd;
+				connect_family = r->ai_family;
+				break;
+			}
+			if (errno == EINPROGRESS) {
+				pfds[nactive].events = POLLOUT;
+				pending[nactive++] = r;
+				continue;
+			}
+			error = errno;
+			if (error == ECONNREFUSED)
+				was_refused = TRUE;
+			close (pfds[nactive].fd);
+			start_next = TRUE;
+			continue;
+		}
+
+		if (next < count) {
+			timeout = CONNECT_ATTEMPT_DELAY - (int)((double)deltime (start) / 1.0e3 - last);
+			if (timeout < 0)
+				timeout = 0;
+		}
+		else
+			timeout = -1;
+		if ((left = np_deadline_ms (deadline)) == 0) {
+			error = ETIMEDOUT;
+			break;
+		}
+		if (left > 0 && (timeout < 0 || left < timeout))
+			timeout = left;
+		for (i = 0; i < nactive; i++)
+			pfds[i].revents = 0;
+		if (poll (pfds, nactive, timeout) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+
+		for (i = j = 0; i < nactive; i++) {
+			if (sd < 0 && pfds[i].revents) {
+				optlen = sizeof (error);
+				if (getsockopt (pfds[i].fd, SOL_SOCKET, SO_ERROR, &error, &optlen) < 0)
+					error = errno;
+				if (error == 0) {
+					sd = pfds[i].fd;
+					connect_family = pending[i]->ai_family;
+					continue;
+				}
+				if (error == ECONNREFUSED)
+					was_refused = TRUE;
+				close (pfds[i].fd);
+				start_next = TRUE;
+				continue;
+			}
+			pfds[j] = pfds[i];
+			pending[j++] = pending[i];
+		}
+		nactive = j;
+	}
+
+	/* the attempts that lost */
+	for (i = 0; i < nactive; i++)
+		if (pfds[i].fd != sd)
+			close (pfds[i].fd);
+	free (order);
+	free (pending);
+	free (pfds);
+
+	if (sd < 0) {
+		errno = error;
+		return -1;
+	}
+	fcntl (sd, F_SETFL, fcntl (sd, F_GETFL) & ~O_NONBLOCK);
+	connect_time = (double)deltime (start) / 1.0e6;
+	was_refused = FALSE;
+	return sd;
+}
+
 /* opens a tcp or udp connection to a remote host or local socket */
 int
 np_net_connect (const char *host_name, int port, int *sd, int proto)
@@ -170,9 +392,10 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 	struct sockaddr_un su;
 	char port_str[6], host[MAX_HOST_ADDRESS_LENGTH];
 	size_t len;
-	int socktype, result;
+	int socktype, result, saved, adapted_out = FALSE;
 	short is_socket = (host_name[0] == '/');
 
+	last_connect_timeout = socket_timeout;
 	socktype = (proto == IPPROTO_UDP) ? SOCK_DGRAM : SOCK_STREAM;
 
 	/* as long as it doesn't start with a '/', it's assumed a host or ip */
@@ -193,43 +416,62 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 		memcpy (host, host_name, len);
 		host[len] = '\0';
 		snprintf (port_str, sizeof (port_str), "%d", port);
-		result = getaddrinfo (host, port_str, &hints, &res);
+		np_span_begin ("dns");
+		result = np_getaddrinfo (host, port_str, &hints, &res);
+		np_span_end ();
 
 		if (result != 0) {
 			printf ("%s\n", gai_strerror (result));
 			return STATE_UNKNOWN;
 		}
 
-		r = res;
-		while (r) {
-			/* attempt to create a socket */
-			*sd = socket (r->ai_family, socktype, r->ai_protocol);
-
-			if (*sd < 0) {
-				printf ("%s\n", _("Socket creation failed"));
-				freeaddrinfo (r);
-				return STATE_UNKNOWN;
+		np_span_begin ("connect");
+		if (socktype == SOCK_STREAM) {
+			last_connect_timeout = np_net_adaptive_timeout (host, port);
+			result = ((*sd = connect_staggered (res, socktype, np_deadline (last_connect_timeout))) < 0) ? -1 : 0;
+			saved = errno;
+			if (result == 0)
+				adapt_sample (host, port, connect_time);
+			else if (len == ETIMEDOUT && last_connect_timeout < socket_timeout) {
+				adapt_timed_out (host, port);
+				adapted_out = TRUE;
 			}
+			errno = saved;
+		}
+		else {
+			r = res;
+			while (r) {
+				/* attempt to create a socket */
+				*sd = socket (r->ai_family, socktype, r->ai_protocol);
 
-			/* attempt to open a connection */
-			result = connect (*sd, r->ai_addr, r->ai_addrlen);
+				if (*sd < 0) {
+					printf ("%s\n", _("Socket creation failed"));
+					freeaddrinfo (r);
+					return STATE_UNKNOWN;
+				}
 
-			if (result == 0) {
-				was_refused = FALSE;
-				break;
-			}
+				/* attempt to open a connection */
+				result = connect (*sd, r->ai_addr, r->ai_addrlen);
 
-			if (result < 0) {
-				switch (errno) {
-				case ECONNREFUSED:
-					was_refused = TRUE;
+				if (result == 0) {
+					was_refused = FALSE;
+					connect_family = r->ai_family;
 					break;
 				}
-			}
 
-			close (*sd);
-			r = r->ai_next;
+				if (result < 0) {
+					switch (errno) {
+					case ECONNREFUSED:
+						was_refused = TRUE;
+						break;
+					}
+				}
+
+				close (*sd);
+				r = r->ai_next;
+			}
 		}
+		np_span_end ();
 		freeaddrinfo (res);
 	}
 	/* else the hostname is interpreted as a path to a unix socket */
@@ -271,6 +513,9 @@ np_net_connect (const char *host_name, int port, int *sd, int proto)
 	else {
 		if (is_socket)
 			printf("connect to file socket %s: %s\n", host_name, strerror(errno));
+		else if (adapted_out)
+			printf(_("connect to address %s and port %d: no connection after %.3f seconds, the adaptive timeout (limit %d)\n"),
+			       host_name, port, last_connect_timeout, socket_timeout);
 		else
 			printf("connect to address %s and port %d: %s\n",
 			       host_name, port, strerror(errno));
@@ -326,6 +571,112 @@ send_request (int sd, int proto, const char *send_buffer, char *recv_buffer, int
 }
 
 
+/* Start reading from sd, or through ssl_read once TLS is up. Anything
+ * still buffered is dropped, as it must be after STARTTLS. Taking
+ * np_net_ssl_read() as an argument keeps plugins without TLS from having
+ * to link sslutils.o. */
+void
+np_net_reader_init (np_net_reader *r, int sd, int (*ssl_read) (void *, int))
+{
+	r->sd = sd;
+	r->ssl_read = ssl_read;
+	r->start = r->end = 0;
+	r->deadline = 0;
+}
+
+/* Give up reading at the deadline (see np_deadline()), the read then fails
+ * with ETIMEDOUT. Reads through TLS are left to the socket timeout, as the
+ * library may have buffered what poll() can not see. */
+void
+np_net_reader_deadline (np_net_reader *r, double deadline)
+{
+	r->deadline = deadline;
+}
+
+static int
+reader_fill (np_net_reader *r)
+{
+	struct pollfd pfd;
+	int n;
+
+	if (r->ssl_read != NULL)
+		n = r->ssl_read (r->buf, sizeof (r->buf));
+	else {
+		pfd.fd = r->sd;
+		pfd.events = POLLIN;
+		while ((n = poll (&pfd, 1, np_deadline_ms (r->deadline))) < 0 && errno == EINTR)
+			;
+		if (n == 0)
+			errno = ETIMEDOUT;
+		n = (n > 0) ? read (r->sd, r->buf, sizeof (r->buf)) : -1;
+	}
+	r->start = 0;
+	r->end = n > 0 ? (size_t)n : 0;
+	return n;
+}
+
+/*
+ * Receive one line, copy it into buf and nul-terminate it.  Returns the
+ * number of bytes written to buf (excluding the '\0'), 0 on EOF, -2 if the
+ * line does not fit into buf or another value <0 on error.  The socket is
+ * read as much at a time as there is, and what follows the line is kept for
+ * the next call.
+ */
+int
+np_net_recvline (np_net_reader *r, char *buf, size_t bufsize)
+{
+	size_t i = 0, len;
+	char *nl;
+	int n;
+
+	while (i < bufsize - 1) {
+		if (r->start == r->end && (n = reader_fill (r)) <= 0)
+			return n;
+		len = r->end - r->start;
+		if ((nl = memchr (r->buf + r->start, '\n', len)) != NULL)
+			len = nl - (r->buf + r->start) + 1;
+		if (len > bufsize - 1 - i)
+			len = bufsize - 1 - i;
+		memcpy (buf + i, r->buf + r->start, len);
+		r->start += len;
+		i += len;
+		if (buf[i - 1] == '\n') {
+			buf[i] = '\0';
+			return i;
+		}
+	}
+	return -2;
+}
+
+/*
+ * Receive one or more lines, copy them into buf and nul-terminate it.  Returns
+ * the number of bytes written to buf (excluding the '\0') or 0 on EOF or <0 on
+ * error.  Works for all protocols which format multiline replies as follows:
+ *
+ * ``The format for multiline replies requires that every line, except the last,
+ * begin with the reply code, followed immediately by a hyphen, `-' (also known
+ * as minus), followed by text.  The last line will begin with the reply code,
+ * followed immediately by <SP>, optionally some text, and <CRLF>.  As noted
+ * above, servers SHOULD send the <SP> if subsequent text is not sent, but
+ * clients MUST be prepared for it to be omitted.'' (RFC 2821, 4.2.1)
+ */
+int
+np_net_recvlines (np_net_reader *r, char *buf, size_t bufsize)
+{
+	int result, i;
+
+	for (i = 0; /* forever */; i += result)
+		if (!((result = np_net_recvline (r, buf + i, bufsize - i)) > 3 &&
+		    isdigit((int)buf[i]) &&
+		    isdigit((int)buf[i + 1]) &&
+		    isdigit((int)buf[i + 2]) &&
+		    buf[i + 3] == '-'))
+			break;
+
+	return (result <= 0) ? result : result + i;
+}
+
+
 int
 is_host (const char *address)
 {
@@ -368,7 +719,7 @@ dns_lookup (const char *in, struct sockaddr_storage *ss, int family)
 	memset (&hints, 0, sizeof(struct addrinfo));
 	hints.ai_family = family;
 
-	retval = getaddrinfo (in, NULL, &hints, &res);
+	retval = np_getaddrinfo (in, NULL, &hints, &res);
 	if (retval != 0)
 		return FALSE;
 
@@ -377,3 +728,1587 @@ dns_lookup (const char *in, struct sockaddr_storage *ss, int family)
 	freeaddrinfo (res);
 	return TRUE;
 }
+
+/* Resolver cache. Every name is looked up once per run, however many
+ * times plugins validate it and connect to it, and np_resolve_prefetch()
+ * looks up a whole list of names at once. An entry stores the numeric
+ * addresses; np_getaddrinfo() turns them back into an addrinfo list the
+ * caller frees with freeaddrinfo() as usual. */
+typedef struct resolve_entry {
+	char *name;
+	int family;
+	int error;		/* from getaddrinfo */
+	char **addrs;		/* numeric */
+	size_t naddrs;
+	time_t resolved;
+	struct resolve_entry *next;
+} resolve_entry;
+
+#define RESOLVE_BUCKETS 256
+
+static resolve_entry *resolve_cache[RESOLVE_BUCKETS];
+static int resolve_cache_dirty = FALSE;
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static unsigned int
+resolve_hash (const char *name)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *name; name++)
+		h = (h ^ (unsigned char) tolower ((unsigned char) *name)) * 16777619U;
+	return h % RESOLVE_BUCKETS;
+}
+
+static resolve_entry *
+resolve_find (const char *name, int family)
+{
+	resolve_entry *e;
+
+	for (e = resolve_cache[resolve_hash (name)]; e; e = e->next)
+		if (e->family == family && !strcasecmp (e->name, name))
+			return e;
+	return NULL;
+}
+
+static void
+resolve_insert (resolve_entry *e)
+{
+	unsigned int h = resolve_hash (e->name);
+
+	e->next = resolve_cache[h];
+	resolve_cache[h] = e;
+}
+
+/* Ask the resolver, outside of any lock */
+static resolve_entry *
+resolve_lookup (const char *name, int family)
+{
+	struct addrinfo hints, *res, *r;
+	resolve_entry *e;
+	char addr[INET6_ADDRSTRLEN];
+	size_t i;
+
+	if ((e = calloc (1, sizeof (resolve_entry))) == NULL ||
+	    (e->name = strdup (name)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	e->family = family;
+	time (&e->resolved);
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_STREAM;	/* one answer per address */
+	if ((e->error = getaddrinfo (name, NULL, &hints, &res)) != 0)
+		return e;
+
+	for (r = res; r; r = r->ai_next)
+		e->naddrs++;
+	if ((e->addrs = calloc (e->naddrs, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (r = res, i = 0; r; r = r->ai_next) {
+		if (getnameinfo (r->ai_addr, r->ai_addrlen, addr, sizeof (addr),
+		                 NULL, 0, NI_NUMERICHOST) != 0)
+			continue;
+		if ((e->addrs[i++] = strdup (addr)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	e->naddrs = i;
+	freeaddrinfo (res);
+	if (e->naddrs == 0)
+		e->error = EAI_NONAME;
+	return e;
+}
+
+/* The entry for name, looking it up now if no one has yet */
+static resolve_entry *
+resolve (const char *name, int family)
+{
+	resolve_entry *e;
+
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock (&resolve_lock);
+#endif
+	e = resolve_find (name, family);
+	/* an answer for any family will do, np_getaddrinfo() picks out of it */
+	if (e == NULL && family != AF_UNSPEC)
+		e = resolve_find (name, AF_UNSPEC);
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock (&resolve_lock);
+#endif
+	if (e)
+		return e;
+
+	e = resolve_lookup (name, family);
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock (&resolve_lock);
+#endif
+	resolve_insert (e);
+	resolve_cache_dirty = TRUE;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock (&resolve_lock);
+#endif
+	return e;
+}
+
+/* Like getaddrinfo(), with host names answered from the cache */
+int
+np_getaddrinfo (const char *name, const char *service,
+                const struct addrinfo *hints, struct addrinfo **res)
+{
+	struct addrinfo numeric, *head = NULL, **tail = &head, *r;
+	resolve_entry *e;
+	int family = hints ? hints->ai_family : AF_UNSPEC;
+	int result = EAI_NONAME;
+	size_t i;
+
+	/* nothing to resolve, or flags the cache does not know about */
+	if (name == NULL || (hints && (hints->ai_flags & (AI_NUMERICHOST | AI_PASSIVE | AI_CANONNAME))))
+		return getaddrinfo (name, service, hints, res);
+
+	e = resolve (name, family);
+	if (e->error != 0 && e->family == family)
+		return e->error;
+
+	if (hints)
+		numeric = *hints;
+	else
+		memset (&numeric, 0, sizeof (numeric));
+	numeric.ai_flags |= AI_NUMERICHOST;
+	for (i = 0; i < e->naddrs; i++) {
+		/* addresses of other families when the entry is for AF_UNSPEC */
+		if ((result = getaddrinfo (e->addrs[i], service, &numeric, &r)) != 0)
+			continue;
+		*tail = r;
+		while (r->ai_next)
+			r = r->ai_next;
+		tail = &r->ai_next;
+	}
+	if (head == NULL) {
+		if (e->family == family)
+			return result;
+		/* the AF_UNSPEC entry had nothing of this family */
+		return getaddrinfo (name, service, hints, res);
+	}
+	*res = head;
+	return 0;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static const char **prefetch_names;
+static size_t prefetch_count, prefetch_next;
+static int prefetch_family;
+
+static void *
+resolve_worker (void *arg)
+{
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock (&resolve_lock);
+		i = prefetch_next++;
+		pthread_mutex_unlock (&resolve_lock);
+		if (i >= prefetch_count)
+			return NULL;
+		resolve (prefetch_names[i], prefetch_family);
+	}
+}
+#endif
+
+/* Look up the names that are no addresses with up to threads lookups in
+ * flight, so that the resolver waits for all of them at the same time */
+void
+np_resolve_prefetch (const char **names, size_t count, int family, int threads)
+{
+	struct addrinfo hints, *res;
+	const char **todo;
+	size_t i, j, n = 0;
+#ifdef HAVE_LIBPTHREAD
+	pthread_t *tids;
+	int started = 0;
+#endif
+
+	if ((todo = calloc (count ? count : 1, sizeof (char *))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = family;
+	hints.ai_flags = AI_NUMERICHOST;
+	for (i = 0; i < count; i++) {
+		if (names[i] == NULL || names[i][0] == '/' || names[i][0] == '[')
+			continue;
+		if (getaddrinfo (names[i], NULL, &hints, &res) == 0) {
+			freeaddrinfo (res);
+			continue;
+		}
+		/* once is enough */
+		if (resolve_find (names[i], family))
+			continue;
+		for (j = 0; j < n && strcasecmp (todo[j], names[i]); j++)
+			;
+		if (j == n)
+			todo[n++] = names[i];
+	}
+
+#ifdef HAVE_LIBPTHREAD
+	if (threads > 1 && n > 1) {
+		if ((size_t) threads > n)
+			threads = n;
+		if ((tids = calloc (threads, sizeof (pthread_t))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		prefetch_names = todo;
+		prefetch_count = n;
+		prefetch_next = 0;
+		prefetch_family = family;
+		for (started = 0; started < threads; started++)
+			if (pthread_create (&tids[started], NULL, resolve_worker, NULL) != 0)
+				break;
+		/* whatever the threads did not take is done here */
+		resolve_worker (NULL);
+		while (started > 0)
+			pthread_join (tids[--started], NULL);
+		free (tids);
+		free (todo);
+		return;
+	}
+#endif
+	for (i = 0; i < n; i++)
+		resolve (todo[i], family);
+	free (todo);
+}
+
+void _get_monitoring_plugin (monitoring_plugin **);
+
+/* Keep the successful lookups in the state file "dns_cache" of the plugin,
+ * and take those not older than max_age seconds from it. getaddrinfo() does
+ * not tell the records' TTL, so max_age stands in for it. The plugin's own
+ * state, if any, is left as it is. */
+void
+np_resolve_cache_load (time_t max_age)
+{
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	state_data *data;
+	resolve_entry *e;
+	char *text, *word, *saveptr = NULL;
+	time_t now;
+	size_t i;
+
+	_get_monitoring_plugin (&this_monitoring_plugin);
+	if (this_monitoring_plugin == NULL)
+		die (STATE_UNKNOWN, _("This requires np_init to be called"));
+	own = this_monitoring_plugin->state;
+	np_enable_state ("dns_cache", 1);
+	data = np_state_read ();
+	this_monitoring_plugin->state = own;
+	if (data == NULL || data->data == NULL)
+		return;
+
+	/* name family time count address... */
+	time (&now);
+	text = (char *) data->data;
+	while ((word = strtok_r (text, " ", &saveptr)) != NULL) {
+		text = NULL;
+		if ((e = calloc (1, sizeof (resolve_entry))) == NULL ||
+		    (e->name = strdup (word)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		if ((word = strtok_r (NULL, " ", &saveptr)) == NULL)
+			break;
+		e->family = atoi (word);
+		if ((word = strtok_r (NULL, " ", &saveptr)) == NULL)
+			break;
+		e->resolved = (time_t) strtol (word, NULL, 10);
+		if ((word = strtok_r (NULL, " ", &saveptr)) == NULL)
+			break;
+		e->naddrs = strtoul (word, NULL, 10);
+		if ((e->addrs = calloc (e->naddrs ? e->naddrs : 1, sizeof (char *))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		for (i = 0; i < e->naddrs && (word = strtok_r (NULL, " ", &saveptr)) != NULL; i++)
+			e->addrs[i] = strdup (word);
+		if (i < e->naddrs)
+			break;
+		if (e->naddrs > 0 && e->resolved <= now && now - e->resolved <= max_age &&
+		    resolve_find (e->name, e->family) == NULL)
+			resolve_insert (e);
+	}
+	resolve_cache_dirty = FALSE;
+}
+
+void
+np_resolve_cache_save (void)
+{
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	resolve_entry *e;
+	char *text = NULL;
+	size_t i;
+	int b;
+
+	_get_monitoring_plugin (&this_monitoring_plugin);
+	if (this_monitoring_plugin == NULL || !resolve_cache_dirty)
+		return;
+	own = this_monitoring_plugin->state;
+	for (b = 0; b < RESOLVE_BUCKETS; b++) {
+		for (e = resolve_cache[b]; e; e = e->next) {
+			if (e->error != 0 || e->naddrs == 0)
+				continue;
+			xasprintf (&text, "%s%s%s %d %ld %lu", text ? text : "", text ? " " : "",
+			           e->name, e->family, (long) e->resolved, (unsigned long) e->naddrs);
+			for (i = 0; i < e->naddrs; i++)
+				xasprintf (&text, "%s %s", text, e->addrs[i]);
+		}
+	}
+	np_enable_state ("dns_cache", 1);
+	np_state_write_string (0, text ? text : "");
+	this_monitoring_plugin->state = own;
+	free (text);
+	resolve_cache_dirty = FALSE;
+}
+
+
+/* Adaptive connect timeouts. After np_net_adaptive_load(), how long the
+ * connects to every host and port took is kept in the state file "latency"
+ * of the plugin: their exponentially weighted average and an estimate of
+ * their 95th percentile. A connect is then given factor times the larger of
+ * the two, at least ADAPT_MIN_TIMEOUT and at most socket_timeout, so a host
+ * that stopped answering fails once it is clearly late instead of after the
+ * whole timeout. Only connecting is cut short, a server that accepted has
+ * the rest of socket_timeout to answer. A timeout widens the estimate by
+ * half, so that a host that got slower for good is not failed early for
+ * long; one that stays down gets back to the full timeout after some runs. */
+typedef struct adapt_entry {
+	char *key;		/* host:port */
+	unsigned long samples;
+	double ewma;		/* seconds */
+	double quantile;
+	time_t updated;
+	struct adapt_entry *next;
+} adapt_entry;
+
+#define ADAPT_MIN_SAMPLES 5	/* before the history is trusted */
+#define ADAPT_WEIGHT 0.2	/* of a new connect time in the average */
+#define ADAPT_QUANTILE 0.95
+#define ADAPT_MIN_TIMEOUT 1.0	/* a lost SYN is sent again after a second */
+#define ADAPT_MAX_AGE (7 * 86400)	/* entries not updated longer are dropped */
+
+static adapt_entry *adapt_table[RESOLVE_BUCKETS];
+static double adapt_factor = 0;
+static int adapt_dirty = FALSE;
+
+static adapt_entry *
+adapt_find (const char *key, int create)
+{
+	adapt_entry *e;
+	unsigned int b = resolve_hash (key);
+
+	for (e = adapt_table[b]; e; e = e->next)
+		if (!strcasecmp (e->key, key))
+			return e;
+	if (!create)
+		return NULL;
+	if ((e = calloc (1, sizeof (adapt_entry))) == NULL || (e->key = strdup (key)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	e->next = adapt_table[b];
+	adapt_table[b] = e;
+	return e;
+}
+
+static adapt_entry *
+adapt_lookup (const char *host, int port, int create)
+{
+	char key[MAX_HOST_ADDRESS_LENGTH + 8];
+
+	if (adapt_factor <= 0)
+		return NULL;
+	snprintf (key, sizeof (key), "%s:%d", host, port);
+	return adapt_find (key, create);
+}
+
+/* a connect that took that long */
+static void
+adapt_sample (const char *host, int port, double seconds)
+{
+	adapt_entry *e;
+	double step;
+
+	if ((e = adapt_lookup (host, port, TRUE)) == NULL)
+		return;
+	if (e->samples++ == 0)
+		e->ewma = e->quantile = seconds;
+	else {
+		e->ewma += ADAPT_WEIGHT * (seconds - e->ewma);
+		/* steps of the size of a typical connect, nineteen times
+		 * larger up than down: the estimate settles where one connect
+		 * in twenty takes longer */
+		step = ADAPT_WEIGHT * max (e->ewma, seconds / 4);
+		if (seconds > e->quantile)
+			e->quantile += step * ADAPT_QUANTILE;
+		else if ((e->quantile -= step * (1 - ADAPT_QUANTILE)) < 0)
+			e->quantile = 0;
+	}
+	time (&e->updated);
+	adapt_dirty = TRUE;
+}
+
+/* a connect that did not finish within what the history gave it */
+static void
+adapt_timed_out (const char *host, int port)
+{
+	adapt_entry *e;
+
+	if ((e = adapt_lookup (host, port, FALSE)) == NULL)
+		return;
+	e->quantile = max (e->ewma, e->quantile) * 1.5;
+	time (&e->updated);
+	adapt_dirty = TRUE;
+}
+
+double
+np_net_adaptive_timeout (const char *host, int port)
+{
+	adapt_entry *e;
+	double timeout;
+
+	if ((e = adapt_lookup (host, port, FALSE)) == NULL || e->samples < ADAPT_MIN_SAMPLES)
+		return socket_timeout;
+	timeout = adapt_factor * max (e->ewma, e->quantile);
+	if (timeout < ADAPT_MIN_TIMEOUT)
+		timeout = ADAPT_MIN_TIMEOUT;
+	return timeout < socket_timeout ? timeout : socket_timeout;
+}
+
+double
+np_net_connect_timeout (void)
+{
+	return last_connect_timeout;
+}
+
+void
+np_net_adaptive_load (double factor)
+{
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	state_data *data;
+	adapt_entry *e;
+	char *text, *word, *value[4], *saveptr = NULL;
+	time_t now, updated;
+	int i;
+
+	_get_monitoring_plugin (&this_monitoring_plugin);
+	if (this_monitoring_plugin == NULL)
+		die (STATE_UNKNOWN, _("This requires np_init to be called"));
+	adapt_factor = factor;
+	own = this_monitoring_plugin->state;
+	np_enable_state ("latency", 1);
+	data = np_state_read ();
+	this_monitoring_plugin->state = own;
+	if (data == NULL || data->data == NULL)
+		return;
+
+	/* host:port samples ewma quantile updated, times in microseconds */
+	time (&now);
+	text = (char *) data->data;
+	while ((word = strtok_r (text, " ", &saveptr)) != NULL) {
+		text = NULL;
+		for (i = 0; i < 4 && (value[i] = strtok_r (NULL, " ", &saveptr)) != NULL; i++)
+			;
+		if (i < 4)
+			break;
+		updated = (time_t) strtol (value[3], NULL, 10);
+		if (updated > now || now - updated > ADAPT_MAX_AGE)
+			continue;
+		e = adapt_find (word, TRUE);
+		e->samples = strtoul (value[0], NULL, 10);
+		e->ewma = strtoul (value[1], NULL, 10) / 1.0e6;
+		e->quantile = strtoul (value[2], NULL, 10) / 1.0e6;
+		e->updated = updated;
+	}
+	adapt_dirty = FALSE;
+}
+
+void
+np_net_adaptive_save (void)
+{
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	adapt_entry *e;
+	char *text = NULL;
+	int b;
+
+	_get_monitoring_plugin (&this_monitoring_plugin);
+	if (this_monitoring_plugin == NULL || !adapt_dirty)
+		return;
+	own = this_monitoring_plugin->state;
+	for (b = 0; b < RESOLVE_BUCKETS; b++)
+		for (e = adapt_table[b]; e; e = e->next)
+			xasprintf (&text, "%s%s%s %lu %lu %lu %ld", text ? text : "", text ? " " : "",
+			           e->key, e->samples, (unsigned long) (e->ewma * 1.0e6),
+			           (unsigned long) (e->quantile * 1.0e6), (long) e->updated);
+	np_enable_state ("latency", 1);
+	np_state_write_string (0, text ? text : "");
+	this_monitoring_plugin->state = own;
+	free (text);
+	adapt_dirty = FALSE;
+}
+
+
+/* Connections to many hosts. Every host of the list gets its own
+ * non-blocking connection, and all of them are driven from a single poll()
+ * loop with at most `concurrency` connections in flight. The plugin sends
+ * and judges what came back through the np_conn_ops callbacks. */
+
+static void
+conn_add (np_conn **conns, size_t *count, size_t *size, char *host, int port, char *sni)
+{
+	if (*count >= *size) {
+		*size = *size ? *size * 2 : 64;
+		*conns = realloc (*conns, *size * sizeof (np_conn));
+		if (*conns == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	memset (&(*conns)[*count], 0, sizeof (np_conn));
+	(*conns)[*count].host = host;
+	(*conns)[*count].port = port;
+	(*conns)[*count].sni = sni;
+	(*conns)[*count].fd = -1;
+	(*conns)[*count].match = -1;
+	(*count)++;
+}
+
+/* Read "host port", "host:port" or "[v6addr]:port" lines, one per target,
+ * from any source np_targets_open() takes, keeping those of the shard of
+ * np_targets_shard(). The port defaults to default_port. A server name for
+ * TLS may follow the port, as in "host:port:sni" or "host port sni". */
+np_conn *
+np_conn_read_list (const char *filename, int default_port, size_t *count)
+{
+	np_targets *list;
+	char *host, *port_str, *sni, *p, *q = NULL;
+	np_conn *conns = NULL;
+	size_t size = 0;
+	int port;
+
+	*count = 0;
+	if ((list = np_targets_open (filename)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot open target list %s: %s\n"), filename, strerror (errno));
+
+	while ((host = np_targets_next (list)) != NULL) {
+		port_str = sni = NULL;
+		if (*host == '[' && (p = strchr (host, ']')) != NULL) {
+			*p++ = '\0';
+			host++;
+			if (*p == ':')
+				port_str = p + 1;
+		}
+		else if ((p = strpbrk (host, " \t")) != NULL) {
+			*p++ = '\0';
+			port_str = p + strspn (p, " \t");
+		}
+		else if ((p = strchr (host, ':')) != NULL && (q = strchr (p + 1, ':')) == NULL) {
+			*p++ = '\0';
+			port_str = p;
+		}
+		else if (p != NULL && p > host && q > p + 1 && strchr (q + 1, ':') == NULL &&
+		         strspn (p + 1, "0123456789") == (size_t)(q - p - 1)) {
+			/* "host:port:sni", other names with colons are IPv6 addresses */
+			*p++ = '\0';
+			port_str = p;
+		}
+
+		if (port_str != NULL && (p = strpbrk (port_str, ": \t")) != NULL) {
+			*p++ = '\0';
+			sni = p + strspn (p, " \t");
+		}
+
+		if (port_str != NULL && *port_str != '\0') {
+			if (!is_intpos (port_str))
+				die (STATE_UNKNOWN, _("Invalid port in target list: %s\n"), port_str);
+			port = atoi (port_str);
+		}
+		else
+			port = default_port;
+
+		if (port <= 0)
+			die (STATE_UNKNOWN, _("No port given for target %s\n"), host);
+
+		conn_add (&conns, count, &size, strdup (host), port,
+		          (sni != NULL && *sni != '\0') ? strdup (sni) : NULL);
+	}
+
+	/* a shard may well have none of them */
+	if (list->lines == 0)
+		die (STATE_UNKNOWN, _("No targets found in %s\n"), filename);
+	np_targets_close (list);
+
+	return conns;
+}
+
+static const char *conn_quit;
+static int conn_engine = NP_CONN_ENGINE_AUTO;
+static int conn_engine_used = NP_CONN_ENGINE_POLL;
+static int conn_epfd = -1;	/* of the epoll engine */
+
+#ifdef CONN_URING
+/* The io_uring engine. Waiting on a connection is a one-shot poll request
+ * on the ring, so arming and disarming all that changed and the wait itself
+ * go to the kernel in one io_uring_enter() per round instead of an
+ * epoll_ctl() for each of them. The user data of a request is the index of
+ * the connection and a generation, which tells the completions of requests
+ * that were since replaced or withdrawn from those of the current one. */
+#define URING_TAG_IGNORE 0xffffffffffffffffULL
+
+typedef struct conn_uring {
+	int fd;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned queued;	/* requests not yet submitted */
+	unsigned *generation;	/* of each connection */
+	np_conn *conns;
+	struct __kernel_timespec ts;
+} conn_uring;
+
+static conn_uring *conn_ring = NULL;
+static int conn_events (const np_conn *);
+static int conn_fd (const np_conn *);
+static int conn_rewatch (const np_conn *);
+
+static int
+uring_enter (conn_uring *u, unsigned min_complete, unsigned flags)
+{
+	int ret = syscall (__NR_io_uring_enter, u->fd, u->queued, min_complete, flags, NULL, 0);
+
+	if (ret > 0)
+		u->queued -= min ((unsigned) ret, u->queued);
+	return ret;
+}
+
+static struct io_uring_sqe *
+uring_sqe (conn_uring *u)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail = *u->sq_tail, index;
+
+	/* a full queue goes to the kernel before the next request */
+	while (tail - __atomic_load_n (u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+		if (uring_enter (u, 0, 0) < 0 && errno != EINTR && errno != EAGAIN)
+			die (STATE_UNKNOWN, _("io_uring_enter() failed: %s\n"), strerror (errno));
+	index = tail & *u->sq_mask;
+	sqe = &u->sqes[index];
+	memset (sqe, 0, sizeof (*sqe));
+	u->sq_array[index] = index;
+	__atomic_store_n (u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->queued++;
+	return sqe;
+}
+
+static unsigned long long
+uring_tag (conn_uring *u, const np_conn *c)
+{
+	size_t i = c - u->conns;
+
+	return ((unsigned long long) i << 32) | u->generation[i];
+}
+
+/* withdraw the poll request of a connection, if it has one */
+static void
+uring_unwatch (conn_uring *u, np_conn *c)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!c->polled)
+		return;
+	sqe = uring_sqe (u);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_tag (u, c);
+	sqe->user_data = URING_TAG_IGNORE;
+	u->generation[c - u->conns]++;
+	c->polled = 0;
+}
+
+/* Returns FALSE if the kernel has no io_uring, or not one recent enough */
+static int
+uring_init (conn_uring *u, np_conn *conns, size_t count, int concurrency)
+{
+	struct io_uring_params p;
+	unsigned entries = 8;
+
+	memset (u, 0, sizeof (*u));
+	while (entries < (unsigned) concurrency + 2 && entries < 4096)
+		entries <<= 1;
+	memset (&p, 0, sizeof (p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * 2;
+	if ((u->fd = syscall (__NR_io_uring_setup, entries, &p)) < 0)
+		return FALSE;
+	if (!(p.features & IORING_FEAT_NODROP)) {
+		close (u->fd);
+		return FALSE;
+	}
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->sq_ring_size = u->cq_ring_size = max (u->sq_ring_size, u->cq_ring_size);
+	u->sq_ring = mmap (NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                   u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED)
+		die (STATE_UNKNOWN, _("Cannot map the io_uring: %s\n"), strerror (errno));
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else if ((u->cq_ring = mmap (NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+	                             MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+		die (STATE_UNKNOWN, _("Cannot map the io_uring: %s\n"), strerror (errno));
+	u->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+	u->sqes = mmap (NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		die (STATE_UNKNOWN, _("Cannot map the io_uring: %s\n"), strerror (errno));
+
+	u->sq_head = (unsigned *) ((char *) u->sq_ring + p.sq_off.head);
+	u->sq_tail = (unsigned *) ((char *) u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (unsigned *) ((char *) u->sq_ring + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *) ((char *) u->sq_ring + p.sq_off.array);
+	u->sq_entries = p.sq_entries;
+	u->cq_head = (unsigned *) ((char *) u->cq_ring + p.cq_off.head);
+	u->cq_tail = (unsigned *) ((char *) u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (unsigned *) ((char *) u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ring + p.cq_off.cqes);
+
+	if ((u->generation = calloc (count ? count : 1, sizeof (unsigned))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	u->conns = conns;
+	return TRUE;
+}
+
+static void
+uring_free (conn_uring *u)
+{
+	munmap (u->sqes, u->sqes_size);
+	if (u->cq_ring != u->sq_ring)
+		munmap (u->cq_ring, u->cq_ring_size);
+	munmap (u->sq_ring, u->sq_ring_size);
+	close (u->fd);
+	free (u->generation);
+}
+
+static void
+uring_wait (conn_uring *u, size_t *active, size_t nactive, int timeout_ms)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	unsigned long long tag;
+	size_t i;
+	int want;
+
+	for (i = 0; i < nactive; i++) {
+		np_conn *c = &u->conns[active[i]];
+		if ((want = conn_events (c)) == c->polled && !conn_rewatch (c))
+			continue;
+		uring_unwatch (u, c);
+		sqe = uring_sqe (u);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = c->watched = conn_fd (c);
+		sqe->poll32_events = want;
+		sqe->user_data = uring_tag (u, c);
+		c->polled = want;
+	}
+	if (timeout_ms > 0) {
+		/* over at the first completion, or when the time is up */
+		u->ts.tv_sec = timeout_ms / 1000;
+		u->ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		sqe = uring_sqe (u);
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = (unsigned long) &u->ts;
+		sqe->len = 1;
+		sqe->off = 1;
+		sqe->user_data = URING_TAG_IGNORE;
+	}
+
+	if (uring_enter (u, timeout_ms == 0 ? 0 : 1, timeout_ms == 0 ? 0 : IORING_ENTER_GETEVENTS) < 0 &&
+	    errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME)
+		die (STATE_UNKNOWN, _("io_uring_enter() failed: %s\n"), strerror (errno));
+
+	head = *u->cq_head;
+	tail = __atomic_load_n (u->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &u->cqes[head & *u->cq_mask];
+		tag = cqe->user_data;
+		if (tag == URING_TAG_IGNORE || cqe->res == -ECANCELED ||
+		    (unsigned) tag != u->generation[tag >> 32])
+			continue;
+		/* done with, a poll request has to be made again */
+		u->conns[tag >> 32].polled = 0;
+		u->conns[tag >> 32].ready = TRUE;
+	}
+	__atomic_store_n (u->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif /* CONN_URING */
+
+int
+np_conn_engine (const char *name)
+{
+	if (strcmp (name, "auto") == 0)
+		conn_engine = NP_CONN_ENGINE_AUTO;
+	else if (strcmp (name, "poll") == 0)
+		conn_engine = NP_CONN_ENGINE_POLL;
+#ifdef CONN_EPOLL
+	else if (strcmp (name, "epoll") == 0)
+		conn_engine = NP_CONN_ENGINE_EPOLL;
+#endif
+#ifdef CONN_URING
+	else if (strcmp (name, "io_uring") == 0)
+		conn_engine = NP_CONN_ENGINE_URING;
+#endif
+	else
+		return ERROR;
+	return OK;
+}
+
+const char *
+np_conn_engine_name (void)
+{
+	switch (conn_engine_used) {
+	case NP_CONN_ENGINE_URING:
+		return "io_uring";
+	case NP_CONN_ENGINE_EPOLL:
+		return "epoll";
+	default:
+		return "poll";
+	}
+}
+
+/* the descriptor a connection waits on: its socket, or in the handshake
+ * the one the plugin named, such as that of crypto still being worked on
+ * by an offload device */
+static int
+conn_fd (const np_conn *c)
+{
+	return c->phase == NP_CONN_HANDSHAKE && c->wait_fd >= 0 ? c->wait_fd : c->fd;
+}
+
+/* TRUE if the engine waits on the socket but should on the other one, or
+ * the other way round */
+static int
+conn_rewatch (const np_conn *c)
+{
+	return c->polled && (c->watched != c->fd) != (conn_fd (c) != c->fd);
+}
+
+/* Stop waiting on a connection. epoll is handed a copy of a descriptor
+ * that is not the socket, which several connections may share, and that
+ * copy is closed here. */
+static void
+conn_unwatch (np_conn *c)
+{
+#ifdef CONN_URING
+	if (conn_ring != NULL) {
+		uring_unwatch (conn_ring, c);
+		return;
+	}
+#endif
+#ifdef CONN_EPOLL
+	if (conn_epfd >= 0 && c->polled) {
+		epoll_ctl (conn_epfd, EPOLL_CTL_DEL, c->watched, NULL);
+		if (c->watched != c->fd)
+			close (c->watched);
+	}
+#endif
+	c->polled = 0;
+}
+
+void
+np_conn_finish (np_conn *c, int result, char *message)
+{
+	if (c->fd >= 0) {
+		if (c->phase == NP_CONN_READING && conn_quit != NULL)
+			send (c->fd, conn_quit, strlen (conn_quit), 0);
+		/* closing the socket takes it out of epoll, but neither a request
+		 * on the ring nor the copy of another descriptor */
+#ifdef CONN_URING
+		if (conn_ring != NULL)
+			uring_unwatch (conn_ring, c);
+		else
+#endif
+		if (c->polled && c->watched != c->fd)
+			conn_unwatch (c);
+		close (c->fd);
+		c->fd = -1;
+		c->polled = 0;
+	}
+	if (c->addrs != NULL) {
+		freeaddrinfo (c->addrs);
+		c->addrs = c->next_addr = NULL;
+	}
+	if (c->elapsed == 0)
+		c->elapsed = (double)deltime (c->start) / 1.0e6;
+	c->result = result;
+	c->message = message;
+	c->phase = NP_CONN_DONE;
+}
+
+/* drive the handshake of the plugin until it has to wait, and go on to the
+ * reading phase once it is done */
+/* Add what came in to c->data. The buffer doubles, so a response that
+ * trickles in a few bytes at a time is not copied over and over. */
+static void
+conn_append (np_conn *c, const char *buf, size_t len)
+{
+	if (c->len + len + 1 > c->size) {
+		c->size = c->size ? c->size : 256;
+		while (c->len + len + 1 > c->size)
+			c->size *= 2;
+		if ((c->data = realloc (c->data, c->size)) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	memcpy (&c->data[c->len], buf, len);
+	c->len += len;
+	c->data[c->len] = '\0';
+}
+
+static void
+conn_handshake (np_conn *c, const np_conn_ops *ops)
+{
+	/* what the handshake waited on last time, if not the socket, may not
+	 * be the one it waits on next */
+	if (c->wait_fd >= 0) {
+		if (c->polled && c->watched != c->fd)
+			conn_unwatch (c);
+		c->wait_fd = -1;
+	}
+	c->events = ops->handshake (c);
+	if (c->phase != NP_CONN_HANDSHAKE || c->events != 0)
+		return;
+	c->phase = NP_CONN_READING;
+	if (ops->connected != NULL)
+		ops->connected (c);
+}
+
+static void
+conn_connected (np_conn *c, const np_conn_ops *ops)
+{
+	double elapsed;
+
+	freeaddrinfo (c->addrs);
+	c->addrs = c->next_addr = NULL;
+
+	gettimeofday (&c->connected, NULL);
+	if (ops->socktype != SOCK_DGRAM) {
+		elapsed = (double)deltime (c->start) / 1.0e6;
+		adapt_sample (c->host, c->port, elapsed);
+		/* the rest of socket_timeout for the handshake and the answer */
+		if (c->timeout < socket_timeout)
+			c->deadline = np_deadline (socket_timeout - elapsed);
+	}
+
+	if (ops->handshake != NULL) {
+		c->phase = NP_CONN_HANDSHAKE;
+		c->wait_fd = -1;
+		conn_handshake (c, ops);
+		return;
+	}
+	c->phase = NP_CONN_READING;
+	if (ops->connected != NULL)
+		ops->connected (c);
+}
+
+/* try the remaining addresses of a host until one connects or blocks */
+static void
+conn_connect_next (np_conn *c, const np_conn_ops *ops)
+{
+	struct addrinfo *r;
+	int result, saved;
+
+	while ((r = c->next_addr) != NULL) {
+		c->next_addr = r->ai_next;
+
+		if ((c->fd = socket (r->ai_family, r->ai_socktype, r->ai_protocol)) < 0) {
+			np_conn_finish (c, STATE_UNKNOWN, strdup (_("Socket creation failed")));
+			return;
+		}
+		fcntl (c->fd, F_SETFL, fcntl (c->fd, F_GETFL) | O_NONBLOCK);
+
+		result = connect (c->fd, r->ai_addr, r->ai_addrlen);
+		if (result == 0) {
+			conn_connected (c, ops);
+			return;
+		}
+		if (errno == EINPROGRESS) {
+			c->phase = NP_CONN_CONNECTING;
+			return;
+		}
+		saved = errno;
+		if (saved == ECONNREFUSED)
+			c->refused = TRUE;
+		close (c->fd);
+		c->fd = -1;
+		errno = saved;
+	}
+
+	np_conn_finish (c, c->refused ? econn_refuse_state : STATE_CRITICAL,
+	                strdup (strerror (errno)));
+}
+
+static void
+conn_start (np_conn *c, const np_conn_ops *ops)
+{
+	struct addrinfo hints;
+	char port_str[6];
+	int result;
+
+	/* connecting, the handshake and the first answer all share one
+	 * deadline, which only ends this connection */
+	gettimeofday (&c->start, NULL);
+	c->timeout = ops->socktype == SOCK_DGRAM ? socket_timeout : np_net_adaptive_timeout (c->host, c->port);
+	c->deadline = np_deadline (c->timeout);
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	if (ops->socktype == SOCK_DGRAM) {
+		hints.ai_protocol = IPPROTO_UDP;
+		hints.ai_socktype = SOCK_DGRAM;
+	}
+	else {
+		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_socktype = SOCK_STREAM;
+	}
+	snprintf (port_str, sizeof (port_str), "%d", c->port);
+
+	if ((result = np_getaddrinfo (c->host, port_str, &hints, &c->addrs)) != 0) {
+		c->addrs = NULL;
+		np_conn_finish (c, STATE_UNKNOWN, strdup (gai_strerror (result)));
+		return;
+	}
+	c->next_addr = c->addrs;
+	conn_connect_next (c, ops);
+}
+
+static void
+conn_handle_event (np_conn *c, const np_conn_ops *ops)
+{
+	char buf[MAX_INPUT_BUFFER];
+	socklen_t optlen;
+	int error = 0;
+	ssize_t i;
+
+	if (c->phase == NP_CONN_CONNECTING) {
+		optlen = sizeof (error);
+		if (getsockopt (c->fd, SOL_SOCKET, SO_ERROR, &error, &optlen) < 0)
+			error = errno;
+		if (error == 0) {
+			conn_connected (c, ops);
+			return;
+		}
+		if (error == ECONNREFUSED)
+			c->refused = TRUE;
+#ifdef CONN_URING
+		if (conn_ring != NULL)
+			uring_unwatch (conn_ring, c);
+#endif
+		close (c->fd);
+		c->fd = -1;
+		c->polled = 0;
+		errno = error;
+		conn_connect_next (c, ops);
+		return;
+	}
+
+	if (c->phase == NP_CONN_HANDSHAKE) {
+		conn_handshake (c, ops);
+		return;
+	}
+
+	/* NP_CONN_READING */
+	i = recv (c->fd, buf, sizeof (buf), 0);
+	if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (i <= 0) {
+		ops->judge (c);
+		return;
+	}
+
+	conn_append (c, buf, i);
+
+	if (ops->received != NULL)
+		ops->received (c);
+
+	/* some protocols wait for further input, so only wait read_timeout more */
+	if (c->phase != NP_CONN_DONE && ops->read_timeout > 0 &&
+	    (c->deadline == 0 || np_deadline (ops->read_timeout) < c->deadline))
+		c->deadline = np_deadline (ops->read_timeout);
+}
+
+static void
+conn_handle_timeout (np_conn *c, const np_conn_ops *ops)
+{
+	char *message = NULL;
+
+	if (c->phase == NP_CONN_READING && c->len > 0) {
+		ops->judge (c);
+		return;
+	}
+	if (c->phase <= NP_CONN_CONNECTING && c->timeout < socket_timeout) {
+		adapt_timed_out (c->host, c->port);
+		xasprintf (&message, _("No connection after %.3f seconds, the adaptive timeout (limit %d)"),
+		           c->timeout, socket_timeout);
+	}
+	else
+		xasprintf (&message, _("Socket timeout after %d seconds"), socket_timeout);
+	np_conn_finish (c, socket_timeout_state, message);
+}
+
+/* what a connection waits for in its phase */
+static int
+conn_events (const np_conn *c)
+{
+	if (c->phase == NP_CONN_CONNECTING)
+		return POLLOUT;
+	else if (c->phase == NP_CONN_HANDSHAKE)
+		return c->events;
+	return POLLIN;
+}
+
+/* Wait up to timeout_ms for the connections in flight, and mark the ones
+ * that are ready. With epoll, a connection is only registered again when
+ * what it waits for changes, so a wait costs the same for ten connections as
+ * for ten thousand; poll() has to be handed all of them every time. */
+static void
+conn_wait (int epfd, np_conn *conns, size_t *active, size_t nactive, struct pollfd *pfds,
+           int timeout_ms)
+{
+	size_t i;
+	int n, want;
+
+#ifdef CONN_EPOLL
+	if (epfd >= 0) {
+		struct epoll_event ev, *events = (struct epoll_event *)pfds;
+
+		for (i = 0; i < nactive; i++) {
+			np_conn *c = &conns[active[i]];
+			if (conn_rewatch (c))
+				conn_unwatch (c);
+			if ((want = conn_events (c)) == c->polled)
+				continue;
+			if (!c->polled && (c->watched = conn_fd (c)) != c->fd &&
+			    (c->watched = dup (c->watched)) < 0)
+				die (STATE_UNKNOWN, _("dup() failed: %s\n"), strerror (errno));
+			memset (&ev, 0, sizeof (ev));
+			ev.events = ((want & POLLIN) ? EPOLLIN : 0) | ((want & POLLOUT) ? EPOLLOUT : 0);
+			ev.data.ptr = c;
+			if (epoll_ctl (epfd, c->polled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->watched, &ev) < 0)
+				die (STATE_UNKNOWN, _("epoll_ctl() failed: %s\n"), strerror (errno));
+			c->polled = want;
+		}
+		if ((n = epoll_wait (epfd, events, nactive, timeout_ms)) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, _("epoll_wait() failed: %s\n"), strerror (errno));
+		for (i = 0; n > 0 && i < (size_t)n; i++)
+			((np_conn *)events[i].data.ptr)->ready = TRUE;
+		return;
+	}
+#endif
+
+	for (i = 0; i < nactive; i++) {
+		pfds[i].fd = conn_fd (&conns[active[i]]);
+		pfds[i].events = conn_events (&conns[active[i]]);
+		pfds[i].revents = 0;
+	}
+	if ((n = poll (pfds, nactive, timeout_ms)) < 0 && errno != EINTR)
+		die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+	for (i = 0; n > 0 && i < nactive; i++)
+		if (pfds[i].revents)
+			conns[active[i]].ready = TRUE;
+}
+
+void
+np_conn_run (np_conn *conns, size_t count, int concurrency, const np_conn_ops *ops)
+{
+	struct pollfd *pfds;
+	size_t *active;
+	size_t next = 0, nactive = 0, i, j;
+	int timeout_ms, ms, epfd = -1;
+#ifdef CONN_URING
+	conn_uring ring;
+#endif
+
+	conn_quit = ops->quit;
+	conn_engine_used = NP_CONN_ENGINE_POLL;
+	active = calloc (concurrency, sizeof (size_t));
+	/* also the room for what epoll_wait() returns */
+#ifdef CONN_EPOLL
+	pfds = calloc (concurrency, max (sizeof (struct pollfd), sizeof (struct epoll_event)));
+#else
+	pfds = calloc (concurrency, sizeof (struct pollfd));
+#endif
+	if (active == NULL || pfds == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	/* the engine asked for, or the best there is; io_uring falls back to
+	 * epoll where the kernel does not have it or does not allow it */
+#ifdef CONN_URING
+	if ((conn_engine == NP_CONN_ENGINE_AUTO || conn_engine == NP_CONN_ENGINE_URING) &&
+	    uring_init (&ring, conns, count, concurrency)) {
+		conn_ring = &ring;
+		conn_engine_used = NP_CONN_ENGINE_URING;
+	}
+#endif
+#ifdef CONN_EPOLL
+	if (conn_engine != NP_CONN_ENGINE_POLL && conn_engine_used == NP_CONN_ENGINE_POLL &&
+	    (epfd = epoll_create1 (EPOLL_CLOEXEC)) >= 0)
+		conn_engine_used = NP_CONN_ENGINE_EPOLL;
+	conn_epfd = epfd;
+#endif
+
+	while (next < count || nactive > 0) {
+		/* top up the set of connections in flight */
+		while (nactive < (size_t)concurrency && next < count) {
+			conn_start (&conns[next], ops);
+			if (conns[next].phase != NP_CONN_DONE)
+				active[nactive++] = next;
+			next++;
+		}
+		if (nactive == 0)
+			continue;
+
+		/* wait no longer than the first deadline */
+		timeout_ms = -1;
+		for (i = 0; i < nactive; i++) {
+			ms = np_deadline_ms (conns[active[i]].deadline);
+			if (ms >= 0 && (timeout_ms < 0 || ms < timeout_ms))
+				timeout_ms = ms;
+		}
+
+#ifdef CONN_URING
+		if (conn_ring != NULL)
+			uring_wait (conn_ring, active, nactive, timeout_ms);
+		else
+#endif
+		conn_wait (epfd, conns, active, nactive, pfds, timeout_ms);
+
+		for (i = 0; i < nactive; i++) {
+			np_conn *c = &conns[active[i]];
+			if (c->ready) {
+				c->ready = FALSE;
+				conn_handle_event (c, ops);
+			}
+			else if (np_deadline_ms (c->deadline) == 0)
+				conn_handle_timeout (c, ops);
+		}
+
+		/* drop finished connections from the active set */
+		for (i = j = 0; i < nactive; i++)
+			if (conns[active[i]].phase != NP_CONN_DONE)
+				active[j++] = active[i];
+		nactive = j;
+	}
+
+	if (epfd >= 0)
+		close (epfd);
+	conn_epfd = -1;
+#ifdef CONN_URING
+	if (conn_ring != NULL) {
+		uring_free (conn_ring);
+		conn_ring = NULL;
+	}
+#endif
+	free (active);
+	free (pfds);
+	conn_quit = NULL;
+}
+
+/* np_udp_run() sends with sendmmsg() and receives with recvmmsg() where
+ * they are available, this many datagrams per system call */
+#define UDP_BATCH 64
+#define UDP_REPLY_MAX 4096
+
+typedef struct udp_target {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int sock;		/* 0 for IPv4, 1 for IPv6 */
+	int tries;		/* requests sent */
+	double next_send;	/* np_clock() of the next request, 0 for none */
+	size_t chain;		/* the next target in the same bucket */
+} udp_target;
+
+static size_t
+udp_hash (const struct sockaddr_storage *a)
+{
+	const unsigned char *p;
+	size_t len, h = 5381;
+
+	if (a->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)a;
+		h = h * 33 + in6->sin6_port;
+		p = (const unsigned char *)&in6->sin6_addr;
+		len = sizeof (in6->sin6_addr);
+	}
+	else {
+		const struct sockaddr_in *in = (const struct sockaddr_in *)a;
+		h = h * 33 + in->sin_port;
+		p = (const unsigned char *)&in->sin_addr;
+		len = sizeof (in->sin_addr);
+	}
+	while (len-- > 0)
+		h = h * 33 + *p++;
+	return h;
+}
+
+static int
+udp_same (const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return FALSE;
+	if (a->ss_family == AF_INET6)
+		return ((const struct sockaddr_in6 *)a)->sin6_port == ((const struct sockaddr_in6 *)b)->sin6_port &&
+		       !memcmp (&((const struct sockaddr_in6 *)a)->sin6_addr,
+		                &((const struct sockaddr_in6 *)b)->sin6_addr, sizeof (struct in6_addr));
+	return ((const struct sockaddr_in *)a)->sin_port == ((const struct sockaddr_in *)b)->sin_port &&
+	       ((const struct sockaddr_in *)a)->sin_addr.s_addr == ((const struct sockaddr_in *)b)->sin_addr.s_addr;
+}
+
+/* Send the request to the n targets in idx. The ones the socket has no
+ * room for stay due, and TRUE is returned for them. */
+static int
+udp_send_batch (int sock, np_conn *conns, udp_target *t, size_t *idx, size_t n,
+                const np_conn_ops *ops)
+{
+	struct iovec iov;
+	size_t i, done = 0;
+	int error, blocked = FALSE;
+	double now = np_clock ();
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[UDP_BATCH];
+	int sent;
+#endif
+
+	iov.iov_base = (void *)ops->request;
+	iov.iov_len = ops->request_len ? ops->request_len : strlen (ops->request);
+	while (done < n) {
+#ifdef HAVE_SENDMMSG
+		memset (msgs, 0, sizeof (msgs));
+		for (i = 0; i < n - done && i < UDP_BATCH; i++) {
+			msgs[i].msg_hdr.msg_name = &t[idx[done + i]].addr;
+			msgs[i].msg_hdr.msg_namelen = t[idx[done + i]].addrlen;
+			msgs[i].msg_hdr.msg_iov = &iov;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		errno = 0;
+		/* the kernel stops at the first datagram it cannot send */
+		sent = sendmmsg (sock, msgs, i, 0);
+		error = (sent <= 0) ? (errno ? errno : EIO) : 0;
+		if (sent <= 0)
+			sent = 0;
+#else
+		error = (sendto (sock, iov.iov_base, iov.iov_len, 0, (struct sockaddr *)&t[idx[done]].addr,
+		                 t[idx[done]].addrlen) < 0) ? errno : 0;
+		sent = error ? 0 : 1;
+#endif
+		for (i = done; i < done + sent; i++) {
+			udp_target *u = &t[idx[i]];
+			if (u->tries++ == 0)
+				gettimeofday (&conns[idx[i]].start, NULL);
+			u->next_send = (u->tries > ops->retries) ? 0 :
+			               now + ops->retry_interval * (double)(1 << (u->tries - 1));
+		}
+		done += sent;
+		if (error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS) {
+			blocked = TRUE;
+			break;
+		}
+		if (error != 0)
+			np_conn_finish (&conns[idx[done++]], STATE_CRITICAL, strdup (strerror (error)));
+	}
+
+	return blocked;
+}
+
+static void
+udp_received (np_conn *c, udp_target *t, const char *buf, size_t len, const np_conn_ops *ops)
+{
+	conn_append (c, buf, len);
+	/* it answered, asking again would only confuse things */
+	t->next_send = 0;
+
+	if (ops->received != NULL)
+		ops->received (c);
+	else
+		ops->judge (c);
+
+	if (c->phase != NP_CONN_DONE && ops->read_timeout > 0 &&
+	    np_deadline (ops->read_timeout) < c->deadline)
+		c->deadline = np_deadline (ops->read_timeout);
+}
+
+/* take in whatever is queued on the socket */
+static void
+udp_drain (int sock, np_conn *conns, udp_target *t, size_t count,
+           const size_t *buckets, size_t mask, const np_conn_ops *ops)
+{
+	static char bufs[UDP_BATCH][UDP_REPLY_MAX];
+	struct sockaddr_storage addrs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	size_t i, j;
+	int n;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[UDP_BATCH];
+#else
+	socklen_t addrlen;
+	ssize_t len;
+#endif
+
+	do {
+#ifdef HAVE_RECVMMSG
+		memset (msgs, 0, sizeof (msgs));
+		for (i = 0; i < UDP_BATCH; i++) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = sizeof (bufs[i]);
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof (addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		n = recvmmsg (sock, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+#else
+		for (n = 0; n < UDP_BATCH; n++) {
+			addrlen = sizeof (addrs[n]);
+			if ((len = recvfrom (sock, bufs[n], sizeof (bufs[n]), MSG_DONTWAIT,
+			                     (struct sockaddr *)&addrs[n], &addrlen)) < 0)
+				break;
+			iov[n].iov_len = len;
+		}
+#endif
+		for (i = 0; n > 0 && i < (size_t)n; i++) {
+			/* the first target at that address still waiting */
+			for (j = buckets[udp_hash (&addrs[i]) & mask]; j < count; j = t[j].chain)
+				if (conns[j].phase != NP_CONN_DONE && udp_same (&t[j].addr, &addrs[i]))
+					break;
+			if (j < count && t[j].tries > 0)
+#ifdef HAVE_RECVMMSG
+				udp_received (&conns[j], &t[j], bufs[i], msgs[i].msg_len, ops);
+#else
+				udp_received (&conns[j], &t[j], bufs[i], iov[i].iov_len, ops);
+#endif
+		}
+	} while (n == UDP_BATCH);
+}
+
+void
+np_udp_run (np_conn *conns, size_t count, const np_conn_ops *ops)
+{
+	struct addrinfo hints, *res;
+	struct pollfd pfds[2];
+	udp_target *t;
+	size_t *buckets, *idx, mask, i, n, active;
+	char port_str[6], *message;
+	int socks[2] = { -1, -1 }, blocked[2] = { FALSE, FALSE };
+	int s, result, timeout_ms, ms;
+	double now;
+
+	for (mask = 1; mask < count; mask <<= 1)
+		;
+	t = calloc (count, sizeof (udp_target));
+	idx = calloc (count, sizeof (size_t));
+	buckets = malloc (mask * sizeof (size_t));
+	if (t == NULL || idx == NULL || buckets == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < mask; i++)
+		buckets[i] = count;
+	mask--;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = address_family;
+	hints.ai_protocol = IPPROTO_UDP;
+	hints.ai_socktype = SOCK_DGRAM;
+	for (i = 0; i < count; i++) {
+		np_conn *c = &conns[i];
+
+		gettimeofday (&c->start, NULL);
+		snprintf (port_str, sizeof (port_str), "%d", c->port);
+		if ((result = np_getaddrinfo (c->host, port_str, &hints, &res)) != 0) {
+			np_conn_finish (c, STATE_UNKNOWN, strdup (gai_strerror (result)));
+			continue;
+		}
+		memcpy (&t[i].addr, res->ai_addr, res->ai_addrlen);
+		t[i].addrlen = res->ai_addrlen;
+		freeaddrinfo (res);
+
+		s = t[i].sock = (t[i].addr.ss_family == AF_INET6);
+		if (socks[s] < 0) {
+			if ((socks[s] = socket (t[i].addr.ss_family, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+				np_conn_finish (c, STATE_UNKNOWN, strdup (_("Socket creation failed")));
+				continue;
+			}
+			fcntl (socks[s], F_SETFL, fcntl (socks[s], F_GETFL) | O_NONBLOCK);
+		}
+		t[i].chain = buckets[udp_hash (&t[i].addr) & mask];
+		buckets[udp_hash (&t[i].addr) & mask] = i;
+		t[i].next_send = np_clock ();
+		c->deadline = np_deadline (socket_timeout);
+		c->phase = NP_CONN_READING;
+	}
+
+	for (;;) {
+		/* whatever is due goes out, one batch per socket */
+		now = np_clock ();
+		for (s = 0; s < 2; s++) {
+			for (i = n = 0; i < count; i++)
+				if (conns[i].phase != NP_CONN_DONE && t[i].sock == s &&
+				    t[i].next_send > 0 && t[i].next_send <= now)
+					idx[n++] = i;
+			blocked[s] = n > 0 && udp_send_batch (socks[s], conns, t, idx, n, ops);
+		}
+
+		/* wait no longer than the next request or deadline */
+		timeout_ms = -1;
+		for (i = active = 0; i < count; i++) {
+			if (conns[i].phase == NP_CONN_DONE)
+				continue;
+			active++;
+			ms = np_deadline_ms (conns[i].deadline);
+			if (ms >= 0 && (timeout_ms < 0 || ms < timeout_ms))
+				timeout_ms = ms;
+			ms = np_deadline_ms (t[i].next_send);
+			if (ms >= 0 && !blocked[t[i].sock] && (timeout_ms < 0 || ms < timeout_ms))
+				timeout_ms = ms;
+		}
+		if (active == 0)
+			break;
+
+		for (s = 0; s < 2; s++) {
+			pfds[s].fd = socks[s];
+			pfds[s].events = POLLIN | (blocked[s] ? POLLOUT : 0);
+			pfds[s].revents = 0;
+		}
+		if (poll (pfds, 2, timeout_ms) < 0 && errno != EINTR)
+			die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+		for (s = 0; s < 2; s++)
+			if (pfds[s].revents & POLLIN)
+				udp_drain (socks[s], conns, t, count, buckets, mask, ops);
+
+		for (i = 0; i < count; i++) {
+			np_conn *c = &conns[i];
+			if (c->phase == NP_CONN_DONE || np_deadline_ms (c->deadline) != 0)
+				continue;
+			if (c->len > 0)
+				ops->judge (c);
+			else {
+				message = NULL;
+				xasprintf (&message, _("No answer to %d requests in %d seconds"),
+				           t[i].tries, socket_timeout);
+				np_conn_finish (c, socket_timeout_state, message);
+			}
+		}
+	}
+
+	for (s = 0; s < 2; s++)
+		if (socks[s] >= 0)
+			close (socks[s]);
+	free (t);
+	free (idx);
+	free (buckets);
+}
@@ -63,6 +63,24 @@ int process_request (const char *address, int port, int proto,
 #define my_tcp_connect(addr, port, s) np_net_connect(addr, port, s, IPPROTO_TCP)
 #define my_udp_connect(addr, port, s) np_net_connect(addr, port, s, IPPROTO_UDP)
 int np_net_connect(const char *address, int port, int *sd, int proto);
+int np_net_connect_family(void);
+double np_net_connect_time(void);
+/* What the kernel knows about a TCP connection. Not available on every
+ * system, np_net_tcp_info() returns FALSE there and for other sockets. */
+typedef struct np_tcp_info {
+	int established;	/* the handshake is done */
+	double rtt;		/* smoothed round trip time in seconds */
+	double rttvar;
+	unsigned int retransmits;	/* segments sent again so far */
+	int fast_open;		/* the SYN carried data that was acknowledged */
+} np_tcp_info;
+int np_net_tcp_info(int sd, np_tcp_info *info);
+/* Let TCP connections send their first data with the SYN, where the
+ * kernel has a Fast Open cookie of the server from an earlier connection */
+void np_net_tcp_fast_open(int on);
+/* TRUE if a connection kept idle between requests has neither been closed
+ * by the other side nor been sent anything it did not ask for */
+int np_net_idle_alive(int sd);
 
 /* send_request and wrapper macros */
 #define send_tcp_request(s, sbuf, rbuf, rsize) \
@@ -71,12 +89,42 @@ int np_net_connect(const char *address, int port, int *sd, int proto);
 	send_request(s, IPPROTO_UDP, sbuf, rbuf, rsize)
 int send_request (int sd, int proto, const char *send_buffer, char *recv_buffer, int recv_size);
 
+/* buffered reading for line based protocols, see netutils.c */
+typedef struct np_net_reader {
+	int sd;
+	int (*ssl_read) (void *, int);  /* np_net_ssl_read(), or NULL for plain reads */
+	size_t start;     /* of what was read but not handed out yet */
+	size_t end;
+	double deadline;  /* see np_deadline(), 0 for none */
+	char buf[MAX_INPUT_BUFFER];
+} np_net_reader;
+void np_net_reader_init (np_net_reader *, int sd, int (*ssl_read) (void *, int));
+void np_net_reader_deadline (np_net_reader *, double deadline);
+int np_net_recvline (np_net_reader *, char *buf, size_t bufsize);
+int np_net_recvlines (np_net_reader *, char *buf, size_t bufsize);
+
 
 /* "is_*" wrapper macros and functions */
 int is_host (const char *);
 int is_addr (const char *);
 int dns_lookup (const char *, struct sockaddr_storage *, int);
 void host_or_die(const char *str);
+
+/* resolver cache, see netutils.c */
+#define DEFAULT_RESOLVE_THREADS 16
+int np_getaddrinfo (const char *, const char *, const struct addrinfo *, struct addrinfo **);
+void np_resolve_prefetch (const char **, size_t, int, int);
+void np_resolve_cache_load (time_t);
+void np_resolve_cache_save (void);
+/* adaptive connect timeouts from the history of each host, see netutils.c */
+#define DEFAULT_ADAPTIVE_FACTOR 4.0
+void np_net_adaptive_load (double factor);
+void np_net_adaptive_save (void);
+/* seconds connecting to host and port is given, socket_timeout if there
+ * is no history of it or the adaptive timeouts are not on */
+double np_net_adaptive_timeout (const char *host, int port);
+/* what the last np_net_connect() was given */
+double np_net_connect_timeout (void);
 #define resolve_host_or_addr(addr, family) dns_lookup(addr, NULL, family)
 #define is_inet_addr(addr) resolve_host_or_addr(addr, AF_INET)
 #ifdef USE_IPV6
@@ -86,6 +134,76 @@ void host_or_die(const char *str);
 #  define is_hostname(addr) resolve_host_or_addr(addr, AF_INET)
 #endif
 
+/* non-blocking connections to many hosts from one poll() loop, see netutils.c */
+enum np_conn_phase {
+	NP_CONN_PENDING,
+	NP_CONN_CONNECTING,
+	NP_CONN_HANDSHAKE,
+	NP_CONN_READING,
+	NP_CONN_DONE
+};
+typedef struct np_conn {
+	char *host;
+	int port;
+	char *sni;		/* server name from the target list, or NULL */
+	int fd;
+	enum np_conn_phase phase;
+	struct addrinfo *addrs;
+	struct addrinfo *next_addr;
+	int refused;
+	struct timeval start;
+	struct timeval connected;
+	int events;		/* what the handshake waits for */
+	int wait_fd;		/* in the handshake, what to wait on instead of fd, or -1 */
+	int polled;		/* what the engine waits for, 0 if nothing yet */
+	int watched;		/* the descriptor it waits on for that */
+	int ready;
+	void *session;		/* handshake state, for the plugin */
+	double deadline;	/* see np_deadline(), ends only this connection */
+	double timeout;		/* seconds it was given to connect */
+	double elapsed;
+	char *data;		/* what was received, '\0' terminated */
+	size_t len;
+	size_t size;		/* allocated for data, grows by doubling */
+	int match;		/* for the plugin, -1 at first */
+	int result;
+	char *message;
+} np_conn;
+typedef struct np_conn_ops {
+	int (*handshake) (np_conn *);	/* returns POLLIN/POLLOUT to wait, or 0 when done,
+					 * may set wait_fd for the next wait */
+	void (*connected) (np_conn *);	/* may send, or finish the connection */
+	void (*received) (np_conn *);	/* after more data came in, may finish it */
+	void (*judge) (np_conn *);	/* at the end of the data, must finish it */
+	const char *quit;	/* sent before closing in the reading phase */
+	int read_timeout;	/* seconds to wait for more data, 0 for no limit */
+	int socktype;		/* SOCK_DGRAM for connected UDP sockets, 0 for TCP */
+	/* for np_udp_run() */
+	const char *request;	/* the datagram sent to every target */
+	size_t request_len;	/* its length if it is binary, 0 for strlen() */
+	int retries;		/* requests sent again without an answer */
+	double retry_interval;	/* seconds before the first of them, doubling */
+} np_conn_ops;
+np_conn *np_conn_read_list (const char *filename, int default_port, size_t *count);
+void np_conn_finish (np_conn *, int result, char *message);
+void np_conn_run (np_conn *, size_t count, int concurrency, const np_conn_ops *);
+/* What np_conn_run() waits with: "auto" for the best the system has, or
+ * "io_uring", "epoll" or "poll". Returns ERROR for an engine not built in;
+ * io_uring falls back to epoll at run time where the kernel lacks it. */
+enum {
+	NP_CONN_ENGINE_AUTO,
+	NP_CONN_ENGINE_POLL,
+	NP_CONN_ENGINE_EPOLL,
+	NP_CONN_ENGINE_URING
+};
+int np_conn_engine (const char *name);
+/* the engine the last np_conn_run() used */
+const char *np_conn_engine_name (void);
+/* The same for UDP targets, all over one socket per address family: the
+ * request goes out to every target in batches, the answers are matched to
+ * the targets by their source address and handed to ops->received(). */
+void np_udp_run (np_conn *, size_t count, const np_conn_ops *);
+
 extern unsigned int socket_timeout;
 extern unsigned int socket_timeout_state;
 extern int econn_refuse_state;
@@ -106,15 +224,49 @@ RETSIGTYPE socket_timeout_alarm_handler (int) __attribute__((noreturn));
 #  define MP_TLSv1_OR_NEWER 8
 #  define MP_TLSv1_1_OR_NEWER 9
 #  define MP_TLSv1_2_OR_NEWER 10
+/* A TLS connection of its own over a connected socket; any number of them
+ * can be open at once, sharing the context of their version and client
+ * certificate. The np_net_ssl_* functions below handle one at a time. */
+typedef struct np_tls {
+	SSL *ssl;
+	int session_reused;     /* TRUE if an earlier session was resumed */
+	double handshake_time;  /* seconds */
+	double crypto_wait;     /* seconds of it waiting on an offload device */
+} np_tls;
+int np_net_tls_prepare(int version);
+int np_net_tls_connect(np_tls **tls, int sd, const char *host_name, int version, const char *cert, const char *privkey);
+void np_net_tls_close(np_tls *tls);
+int np_net_tls_write(np_tls *tls, const void *buf, int num);
+int np_net_tls_read(np_tls *tls, void *buf, int num);
+int np_net_tls_check_cert(np_tls *tls, int days_till_exp_warn, int days_till_exp_crit);
+int np_net_tls_check_ocsp(np_tls *tls, char **message);
 /* maybe this could be merged with the above np_net_connect, via some flags */
 int np_net_ssl_init(int sd);
 int np_net_ssl_init_with_hostname(int sd, char *host_name);
 int np_net_ssl_init_with_hostname_and_version(int sd, char *host_name, int version);
 int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int version, char *cert, char *privkey);
 void np_net_ssl_cleanup();
+void np_net_ssl_session_cache(const char *host, int port, const char *sni);
+void np_net_ssl_cert_cache(int ttl);
+void np_net_ssl_ocsp_stapling(void);
+int np_net_ssl_session_reused(void);
+double np_net_ssl_handshake_time(void);
+int np_net_ssl_offload(const char *name);
+double np_net_ssl_crypto_wait_time(void);
 int np_net_ssl_write(const void *buf, int num);
 int np_net_ssl_read(void *buf, int num);
 int np_net_ssl_check_cert(int days_till_exp_warn, int days_till_exp_crit);
+int np_net_ssl_check_ocsp(char **message);
+/* non-blocking handshakes for np_conn_run(), see sslutils.c */
+SSL *np_net_ssl_handshake_start(int sd, const char *host_name);
+int np_net_ssl_handshake_continue(SSL *ssl, char **message);
+int np_net_ssl_handshake_cert(SSL *ssl, int days_till_exp_warn, int days_till_exp_crit, char **message);
+int np_net_ssl_handshake_ocsp(SSL *ssl, char **message);
+int np_net_ssl_handshake_wait_fd(SSL *ssl);
+double np_net_ssl_handshake_crypto_wait(SSL *ssl);
+void np_net_ssl_handshake_free(SSL *ssl);
+int np_net_ssl_handshake_read(SSL *ssl, void *buf, int num);
+int np_net_ssl_handshake_write(SSL *ssl, const void *buf, int num);
 #endif /* HAVE_SSL */
 
 #endif /* _NETUTILS_H_ */
@@ -0,0 +1,427 @@
+/*****************************************************************************
+*
+* Monitoring np-bench startup cost benchmark
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains np-bench, which measures what it costs to start a
+* plugin, for "make bench" to track startup regressions with.
+*
+* It runs check_dummy, check_tcp against a listener of its own on the
+* loopback interface and check_disk in a tight loop, and takes the wall
+* time from fork() to the end of the child for each run. One more run of
+* each under LD_DEBUG=statistics gives the time spent in the dynamic
+* loader where the loader reports it. The pieces of startup that every
+* plugin shares, locale and gettext setup, np_init() and np_extra_opts(),
+* are timed in-process. The report is a plugin status line with all of
+* the numbers as performance data.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "np-bench";
+const char *copyright = "2026";
+const char *email = "devel@monitoring-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+#include "extra_opts.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
+
+#define DEFAULT_RUNS 200
+#define BENCH_INI "[bench]\ntimeout=10\nwarning=5\ncritical=10\n"
+
+int process_arguments (int, char **);
+void print_help (void);
+void print_usage (void);
+
+static int runs = DEFAULT_RUNS;
+static char *plugin_dir = ".";
+static int verbose = 0;
+
+static char *perf = NULL;
+static char *summary = NULL;
+static int result = STATE_OK;
+
+static double
+now_us (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec * 1.0e6 + tv.tv_usec;
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+add_perf (const char *label, double value)
+{
+	xasprintf (&perf, "%s%s%s", perf ? perf : "", perf ? " " : "",
+	           fperfdata (label, value, "us", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+}
+
+static void
+add_perf_count (const char *label, long value)
+{
+	xasprintf (&perf, "%s%s%s", perf ? perf : "", perf ? " " : "",
+	           perfdata (label, value, "c", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+}
+
+/* One run of the plugin from fork() to its end, in microseconds, or -1 if
+ * it could not be started. With loader set, the statistics of the dynamic
+ * loader are read from its stderr instead, in cycles. */
+static double
+run_once (char **argv, int loader)
+{
+	char line[MAX_INPUT_BUFFER], *p;
+	double start, cycles = -1;
+	int fd, pipefd[2], status;
+	pid_t pid;
+	FILE *fp;
+
+	if (loader && pipe (pipefd) < 0)
+		return -1;
+
+	start = now_us ();
+	if ((pid = fork ()) == 0) {
+		if ((fd = open ("/dev/null", O_RDWR)) >= 0) {
+			dup2 (fd, STDIN_FILENO);
+			dup2 (fd, STDOUT_FILENO);
+			dup2 (loader ? pipefd[1] : fd, STDERR_FILENO);
+		}
+		if (loader) {
+			close (pipefd[0]);
+			setenv ("LD_DEBUG", "statistics", 1);
+		}
+		execv (argv[0], argv);
+		_exit (127);
+	}
+	if (pid < 0)
+		return -1;
+
+	if (loader) {
+		close (pipefd[1]);
+		fp = fdopen (pipefd[0], "r");
+		/* the first report, the one for the startup of the program */
+		while (fp != NULL && fgets (line, sizeof (line), fp) != NULL)
+			if (cycles < 0 && (p = strstr (line, "total startup time in dynamic loader:")) != NULL)
+				cycles = strtod (p + 37, NULL);
+		if (fp != NULL)
+			fclose (fp);
+	}
+
+	if (waitpid (pid, &status, 0) < 0 ||
+	    (WIFEXITED (status) && WEXITSTATUS (status) == 127))
+		return -1;
+
+	return loader ? cycles : now_us () - start;
+}
+
+static void
+bench_plugin (const char *name, char **argv)
+{
+	double *samples, cycles;
+	char *label = NULL;
+	int i;
+
+	if ((samples = calloc (runs, sizeof (double))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	for (i = 0; i < runs; i++) {
+		if ((samples[i] = run_once (argv, FALSE)) < 0) {
+			result = max_state_alt (result, STATE_UNKNOWN);
+			xasprintf (&summary, "%s%s%s could not be run", summary ? summary : "",
+			           summary ? ", " : "", name);
+			free (samples);
+			return;
+		}
+	}
+	qsort (samples, runs, sizeof (double), cmp_double);
+
+	if (verbose)
+		printf ("%s: min %.0f us, median %.0f us, 95%% %.0f us\n", name,
+		        samples[0], samples[runs / 2], samples[(runs * 95) / 100]);
+	xasprintf (&summary, "%s%s%s %.0f us", summary ? summary : "", summary ? ", " : "",
+	           name, samples[runs / 2]);
+
+	xasprintf (&label, "%s_min", name);
+	add_perf (label, samples[0]);
+	xasprintf (&label, "%s_median", name);
+	add_perf (label, samples[runs / 2]);
+	xasprintf (&label, "%s_p95", name);
+	add_perf (label, samples[(runs * 95) / 100]);
+
+	if ((cycles = run_once (argv, TRUE)) >= 0) {
+		xasprintf (&label, "%s_loader", name);
+		add_perf_count (label, (long) cycles);
+	}
+
+	free (label);
+	free (samples);
+}
+
+/* The startup steps every plugin shares, timed in-process, in
+ * microseconds per call */
+
+static double
+bench_locale (void)
+{
+	double start = now_us ();
+	int i;
+
+	for (i = 0; i < runs; i++) {
+		setlocale (LC_ALL, "");
+		bindtextdomain (PACKAGE, LOCALEDIR);
+		textdomain (PACKAGE);
+	}
+	return (now_us () - start) / runs;
+}
+
+static double
+bench_init (char **argv)
+{
+	double start = now_us ();
+	int i;
+
+	for (i = 0; i < runs; i++) {
+		np_init ((char *) progname, 1, argv);
+		np_cleanup ();
+	}
+	return (now_us () - start) / runs;
+}
+
+static double
+bench_extra_opts (void)
+{
+	char ini[] = "/tmp/np-bench.XXXXXX";
+	char *option = NULL, *args[3];
+	double start;
+	int fd, argc, i;
+
+	if ((fd = mkstemp (ini)) < 0)
+		return -1;
+	if (write (fd, BENCH_INI, strlen (BENCH_INI)) != (ssize_t) strlen (BENCH_INI)) {
+		close (fd);
+		unlink (ini);
+		return -1;
+	}
+	close (fd);
+	xasprintf (&option, "--extra-opts=bench@%s", ini);
+
+	start = now_us ();
+	for (i = 0; i < runs; i++) {
+		args[0] = (char *) progname;
+		args[1] = option;
+		args[2] = NULL;
+		argc = 2;
+		np_extra_opts (&argc, args, progname);
+	}
+	start = (now_us () - start) / runs;
+
+	unlink (ini);
+	free (option);
+	return start;
+}
+
+/* accepts and closes connections for check_tcp until it is killed */
+static pid_t
+start_listener (int *port)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof (sin);
+	int fd, conn;
+	pid_t pid;
+
+	memset (&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	if ((fd = socket (AF_INET, SOCK_STREAM, 0)) < 0 ||
+	    bind (fd, (struct sockaddr *) &sin, sizeof (sin)) < 0 ||
+	    listen (fd, SOMAXCONN) < 0 ||
+	    getsockname (fd, (struct sockaddr *) &sin, &len) < 0)
+		die (STATE_UNKNOWN, _("Cannot listen on the loopback interface: %s\n"), strerror (errno));
+	*port = ntohs (sin.sin_port);
+
+	if ((pid = fork ()) == 0) {
+		while (1)
+			if ((conn = accept (fd, NULL, NULL)) >= 0)
+				close (conn);
+	}
+	close (fd);
+	if (pid < 0)
+		die (STATE_UNKNOWN, _("Cannot fork: %s\n"), strerror (errno));
+	return pid;
+}
+
+int
+main (int argc, char **argv)
+{
+	char *dummy[3], *tcp[6], *disk[8];
+	char port_str[8];
+	double t;
+	int port;
+	pid_t listener;
+
+	np_locale_init ();
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	signal (SIGPIPE, SIG_IGN);
+
+	xasprintf (&dummy[0], "%s/check_dummy", plugin_dir);
+	dummy[1] = "0";
+	dummy[2] = NULL;
+	bench_plugin ("check_dummy", dummy);
+
+	listener = start_listener (&port);
+	snprintf (port_str, sizeof (port_str), "%d", port);
+	xasprintf (&tcp[0], "%s/check_tcp", plugin_dir);
+	tcp[1] = "-H";
+	tcp[2] = "127.0.0.1";
+	tcp[3] = "-p";
+	tcp[4] = port_str;
+	tcp[5] = NULL;
+	bench_plugin ("check_tcp", tcp);
+	kill (listener, SIGTERM);
+	waitpid (listener, NULL, 0);
+
+	xasprintf (&disk[0], "%s/check_disk", plugin_dir);
+	disk[1] = "-w";
+	disk[2] = "0%";
+	disk[3] = "-c";
+	disk[4] = "0%";
+	disk[5] = "-p";
+	disk[6] = "/";
+	disk[7] = NULL;
+	bench_plugin ("check_disk", disk);
+
+	add_perf ("locale", bench_locale ());
+	add_perf ("np_init", bench_init (argv));
+	if ((t = bench_extra_opts ()) >= 0)
+		add_perf ("np_extra_opts", t);
+
+	printf ("BENCH %s - %d runs each: %s|%s\n", state_text (result), runs,
+	        summary ? summary : "", perf ? perf : "");
+	return result;
+}
+
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+	int option = 0;
+	static struct option longopts[] = {
+		{"runs", required_argument, 0, 'n'},
+		{"directory", required_argument, 0, 'd'},
+		{"verbose", no_argument, 0, 'v'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvn:d:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':									/* print short usage statement if args not parsable */
+			usage5 ();
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_UNKNOWN);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_UNKNOWN);
+		case 'v':									/* verbose */
+			verbose++;
+			break;
+		case 'n':									/* runs */
+			if (!is_intpos (optarg))
+				usage2 (_("Runs must be a positive integer"), optarg);
+			runs = atoi (optarg);
+			break;
+		case 'd':									/* plugin directory */
+			plugin_dir = optarg;
+			break;
+		}
+	}
+
+	return OK;
+}
+
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("Measure the startup cost of the plugins: the time from fork() to the end"));
+	printf ("%s\n", _("of check_dummy, check_tcp against a local listener and check_disk, the time"));
+	printf ("%s\n", _("in the dynamic loader, and the locale setup, np_init() and np_extra_opts()"));
+	printf ("%s\n", _("steps they share. The numbers are reported as performance data."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+
+	printf (" %s\n", "-n, --runs=INTEGER");
+	printf ("    %s %d\n", _("Runs of each plugin and step, default:"), DEFAULT_RUNS);
+	printf (" %s\n", "-d, --directory=PATH");
+	printf ("    %s\n", _("Directory of the plugins, default: the current one"));
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("The loader time is in cycles, as the dynamic loader reports it with"));
+	printf (" %s\n", _("LD_DEBUG=statistics, and left out where it does not."));
+
+	printf (UT_SUPPORT);
+}
+
+
+void
+print_usage (void)
+{
+	printf ("%s\n", _("Usage:"));
+	printf ("%s [-n runs] [-d directory] [-v]\n", progname);
+}
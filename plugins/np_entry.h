@@ -0,0 +1,67 @@
+/*****************************************************************************
+*
+* Monitoring Plugins in-process entry point include file
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* A plugin that includes this file before anything else can be compiled a
+* second time as an entry point for np-executor. With NP_ENTRY_PREFIX
+* defined (see the libentry_*.a targets in plugins/Makefile.am) the public
+* symbols every plugin defines are prefixed so several plugins can share
+* one binary, and exit() is routed through np_exit() so that a finished
+* check returns control to the executor instead of terminating it.
+*
+* Without NP_ENTRY_PREFIX this file does nothing.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef _NP_ENTRY_H_
+#define _NP_ENTRY_H_
+
+#ifdef NP_ENTRY_PREFIX
+
+#include "config.h"
+#include <stdlib.h>
+
+#define NP_ENTRY_PASTE2(prefix, name) prefix ## _ ## name
+#define NP_ENTRY_PASTE(prefix, name) NP_ENTRY_PASTE2(prefix, name)
+#define NP_ENTRY_SYMBOL(name) NP_ENTRY_PASTE(NP_ENTRY_PREFIX, name)
+
+#define main NP_ENTRY_SYMBOL(main)
+#define progname NP_ENTRY_SYMBOL(progname)
+#define copyright NP_ENTRY_SYMBOL(copyright)
+#define email NP_ENTRY_SYMBOL(email)
+#define print_help NP_ENTRY_SYMBOL(print_help)
+#define print_usage NP_ENTRY_SYMBOL(print_usage)
+#define process_arguments NP_ENTRY_SYMBOL(process_arguments)
+#define validate_arguments NP_ENTRY_SYMBOL(validate_arguments)
+#define verbose NP_ENTRY_SYMBOL(verbose)
+
+void np_exit (int) __attribute__((noreturn));
+#define exit(result) np_exit(result)
+
+/* for wrappers such as negate: runs the plugin argv[0] in-process if it is
+ * an entry of np-executor as well, see np_executor.c */
+int np_entry_run (char **argv, char **output, size_t *len);
+
+#endif /* NP_ENTRY_PREFIX */
+
+#endif /* _NP_ENTRY_H_ */
@@ -0,0 +1,2035 @@
+/*****************************************************************************
+*
+* Monitoring np-executor daemon
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains np-executor, a long-running process which runs plugin
+* checks in-process on behalf of clients connecting over a Unix socket.
+*
+* Plugins listed in the entry table below are linked into this binary as
+* in-process entry points (see np_entry.h), so a check costs neither a
+* fork/exec nor the dynamic linking and initialisation of a new process.
+* Checks are served by a pool of pre-forked workers. Plugins that keep
+* global state between runs are not reentrant: the worker that ran one
+* exits afterwards and is replaced by a fresh fork of the master.
+* With --zygote the master instead forks a child per request, after having
+* done the library initialisation every check shares, so that each check
+* starts from a clean, already warmed up copy of it.
+*
+* Given limits on how many checks may run at once against one target or of
+* one plugin, or a pool for the plugins that block on child processes, the
+* master reads the requests itself and hands them out over a channel to
+* each worker as it becomes idle, holding back those over their limit
+* without keeping the ones behind them waiting. With --coalesce the same
+* request made again while it runs, or within --result-ttl of it, is
+* answered with the response of the one run instead.
+*
+* With --metrics, what the workers run and how long it takes is kept in
+* memory the master shares with them, and a process of its own serves it
+* in the OpenMetrics text format to whoever connects to a second socket.
+* It reads the counters without locking them, so a reader never holds up a
+* worker, at the cost of seeing a worker's figures as of its last request.
+*
+* Called under the name of one of its entries, through a link, or with the
+* name of an entry as its first argument, it runs that plugin directly like
+* the plugin's own binary would. "make multicall" links it statically as
+* the monitoring-plugins binary to be used that way.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+const char *progname = "np-executor";
+const char *copyright = "2026";
+const char *email = "devel@monitoring-plugins.org";
+
+#include "common.h"
+#include "utils.h"
+#include "netutils.h"
+#include "utils_frame.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
+
+#define DEFAULT_WORKERS 4
+#define DEFAULT_MAX_REQUESTS 1000
+#define MAX_REQUEST_ARGS 256
+
+#ifndef MAP_ANONYMOUS
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* the entry keeps no state between runs and may be run again by the same
+ * worker */
+#define NP_ENTRY_REENTRANT 0x01
+/* the entry waits on child processes it runs, see --blocking-workers */
+#define NP_ENTRY_BLOCKING 0x02
+
+typedef struct np_entry_struct {
+	const char *name;
+	int (*main) (int, char **);
+	void (*print_usage) (void);
+	int flags;
+} np_entry;
+
+#define NP_ENTRY_DECLARE(plugin) \
+	int plugin ## _main (int, char **); \
+	void plugin ## _print_usage (void)
+
+NP_ENTRY_DECLARE(check_dummy);
+NP_ENTRY_DECLARE(check_nagios);
+NP_ENTRY_DECLARE(check_ssh);
+NP_ENTRY_DECLARE(check_tcp);
+NP_ENTRY_DECLARE(check_users);
+NP_ENTRY_DECLARE(negate);
+NP_ENTRY_DECLARE(urlize);
+#ifdef HAVE_MYSQLCLIENT
+NP_ENTRY_DECLARE(check_mysql_query);
+#endif
+#ifdef HAVE_PGSQL
+NP_ENTRY_DECLARE(check_pgsql);
+#endif
+
+static const np_entry entries[] = {
+	{"check_dummy", check_dummy_main, check_dummy_print_usage, NP_ENTRY_REENTRANT},
+	{"check_nagios", check_nagios_main, check_nagios_print_usage, 0},
+	{"check_ssh", check_ssh_main, check_ssh_print_usage, 0},
+	{"check_users", check_users_main, check_users_print_usage, NP_ENTRY_BLOCKING},
+	/* run the plugin they wrap in-process too if that is an entry */
+	{"negate", negate_main, negate_print_usage, NP_ENTRY_BLOCKING},
+	{"urlize", urlize_main, urlize_print_usage, NP_ENTRY_BLOCKING},
+	/* reentrant so that a worker can keep --persistent connections */
+#ifdef HAVE_MYSQLCLIENT
+	{"check_mysql_query", check_mysql_query_main, check_mysql_query_print_usage, NP_ENTRY_REENTRANT},
+#endif
+#ifdef HAVE_PGSQL
+	{"check_pgsql", check_pgsql_main, check_pgsql_print_usage, NP_ENTRY_REENTRANT},
+#endif
+	/* check_tcp derives its service from the name it was called as */
+	{"check_tcp", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_clamd", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_ftp", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_imap", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_nntp", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_pop", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_udp", check_tcp_main, check_tcp_print_usage, 0},
+#ifdef HAVE_SSL
+	{"check_jabber", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_nntps", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_simap", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_spop", check_tcp_main, check_tcp_print_usage, 0},
+	{"check_ssmtp", check_tcp_main, check_tcp_print_usage, 0},
+#endif
+	{NULL, NULL, NULL, 0}
+};
+
+/* a request run for every client that made it, see --coalesce */
+typedef struct np_flight_struct {
+	char key[41];           /* np_argv_digest() of the arguments */
+	char *args;             /* and the arguments, apart by their NULs */
+	size_t args_len;
+	int *conns;             /* the clients waiting for it */
+	int nconns;
+	int response;           /* a file holding it once done, else -1 */
+	double done;
+	struct np_flight_struct *next;
+} np_flight;
+
+/* a worker of the dispatcher, see dispatch_loop() */
+typedef struct np_worker_struct {
+	pid_t pid;
+	int channel;            /* -1 while there is no worker */
+	int blocking;           /* TRUE if of the pool for blocking entries */
+	int busy;
+	const np_entry *entry;  /* of the request it runs */
+	char *target;
+	np_flight *flight;
+} np_worker;
+
+/* a connection the dispatcher accepted, and its request once read */
+typedef struct np_pending_struct {
+	int conn;
+	char request[MAX_INPUT_BUFFER];
+	size_t len;
+	int ready;
+	const np_entry *entry;
+	char *target;
+	char key[41];
+	char *args;
+	size_t args_len;
+	struct np_pending_struct *next;
+} np_pending;
+
+/* what --metrics shows, in the shared mapping */
+#define METRICS_BUCKETS 14      /* of the histograms, the last for the rest */
+#define METRICS_PHASES 128      /* plugin and span name pairs */
+#define METRICS_TARGET_MAX 64
+#define METRICS_PHASE_MAX 24
+
+/* A worker writes its own slot between two increments of seq, which is odd
+ * meanwhile, and a reader tries again if seq changed under it */
+typedef struct np_metrics_worker_struct {
+	pid_t pid;              /* 0 while the slot is free */
+	unsigned int seq;
+	int entry;              /* index in entries[] of the check running, or -1 */
+	char target[METRICS_TARGET_MAX];
+	double user, system;    /* CPU seconds */
+	np_exec_stats stats;
+} np_metrics_worker;
+
+/* the time spent in a span of one plugin's checks, "check" for all of it */
+typedef struct np_metrics_phase_struct {
+	int state;              /* 0 free, 1 being taken, 2 in use */
+	int entry;
+	char name[METRICS_PHASE_MAX];
+	uint64_t buckets[METRICS_BUCKETS];
+	uint64_t sum_us;
+} np_metrics_phase;
+
+typedef struct np_metrics_struct {
+	unsigned int seq;       /* odd while the master retires a worker */
+	int nworkers;
+	uint64_t queue_depth;
+	uint64_t coalesce_hits;
+	uint64_t coalesce_misses;
+	/* what the workers that exited did */
+	double retired_user, retired_system;
+	np_exec_stats retired;
+	np_metrics_phase phases[METRICS_PHASES];
+	np_metrics_worker workers[];
+} np_metrics;
+
+/* the upper bounds of the buckets in seconds */
+static const double metrics_bounds[METRICS_BUCKETS - 1] = {
+	0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+int process_arguments (int, char **);
+void print_help (void);
+void print_usage (void);
+
+static int open_socket (const char *);
+static pid_t spawn_worker (int);
+static void warm_up (void);
+static void zygote_loop (int);
+static int worker_setup (void);
+static void worker_loop (int) __attribute__((noreturn));
+static void dispatch_loop (int);
+static void spawn_channel_worker (np_worker *, int);
+static void channel_worker_loop (int) __attribute__((noreturn));
+static int read_pending (np_pending *);
+static int dispatch (np_pending *, np_worker *, int);
+static void worker_done (np_worker *);
+static int coalesce_pending (np_pending *);
+static void flight_done (np_flight *, int);
+static void flight_free (np_flight *);
+static int copy_response (int, int);
+static int send_message (int, const void *, size_t, int);
+static ssize_t recv_message (int, void *, size_t, int *);
+static char *request_target (char **, int);
+static int serve_request (int, int);
+static int handle_request (int, char *, int);
+static int run_entry (const np_entry *, int, char **, int);
+static int run_direct (const np_entry *, int, char **);
+static const np_entry *find_entry (const char *);
+static int split_request (char *, char **, int);
+static ssize_t read_request (int, char *, size_t);
+static int write_all (int, const char *, size_t);
+static int send_response (int, int, int);
+static int send_frame (int, int, int);
+static void close_dispatcher_fds (void);
+static void metrics_open (int);
+static void metrics_spawn (void);
+static void metrics_serve (void) __attribute__((noreturn));
+static int metrics_reap (pid_t);
+static void metrics_close (void);
+static void metrics_claim (void);
+static void metrics_running (const np_entry *, char **, int);
+static void metrics_done (const np_entry *, double);
+static void metrics_observe (int, const char *, double);
+static void metrics_span (const char *, double, void *);
+static void metrics_write (FILE *);
+int np_entry_run (char **, char **, size_t *);
+
+static char *socket_path = NULL;
+static int workers = 0;
+static int max_requests = DEFAULT_MAX_REQUESTS;
+static int verbose = 0;
+static int list_entries = FALSE;
+static int framed = FALSE;
+static int zygote = FALSE;
+static int max_per_target = 0;
+static int max_per_plugin = 0;
+static int blocking_workers = 0;
+static int coalesce = FALSE;
+static double result_ttl = 0;
+/* the requests of --coalesce running, and done within --result-ttl */
+static np_flight *flights = NULL;
+/* of the dispatcher, for its workers to close */
+static np_pending *queue = NULL;
+static np_worker *pool = NULL;
+static int pool_size = 0;
+/* when the current request began, for the framed response */
+static double request_start, request_clock;
+/* --metrics, the process serving them and the slot of this worker */
+static char *metrics_path = NULL;
+static np_metrics *metrics = NULL;
+static size_t metrics_size;
+static int metrics_fd = -1, metrics_executor_fd = -1;
+static pid_t metrics_pid = 0;
+static np_metrics_worker *metrics_self = NULL;
+
+static const np_entry *current_entry = NULL;
+/* a wrapper ran an entry that is not reentrant */
+static int nested_not_reentrant = FALSE;
+static volatile sig_atomic_t terminating = 0;
+
+static void
+terminate_handler (int sig)
+{
+	terminating = sig;
+}
+
+/* only there to interrupt accept() */
+static void
+child_handler (int sig)
+{
+}
+
+int
+main (int argc, char **argv)
+{
+	struct sigaction sa;
+	pid_t *pool, pid;
+	const np_entry *entry;
+	const char *name;
+	int listen_fd, status, i;
+
+	name = strrchr (argv[0], '/');
+	name = (name != NULL) ? name + 1 : argv[0];
+	if ((entry = find_entry (name)) != NULL)
+		return run_direct (entry, argc, argv);
+	if (argc > 1 && (entry = find_entry (argv[1])) != NULL)
+		return run_direct (entry, argc - 1, argv + 1);
+
+	np_locale_init ();
+
+	if (process_arguments (argc, argv) == ERROR)
+		usage4 (_("Could not parse arguments"));
+
+	if (list_entries) {
+		for (i = 0; entries[i].name != NULL; i++)
+			printf ("%s%s\n", entries[i].name,
+			        (entries[i].flags & NP_ENTRY_REENTRANT) ? " (reentrant)" : "");
+		return STATE_OK;
+	}
+
+	listen_fd = open_socket (socket_path);
+	if (metrics_path != NULL)
+		metrics_open (listen_fd);
+
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_handler = terminate_handler;
+	sigemptyset (&sa.sa_mask);
+	/* no SA_RESTART, waitpid() below must return on termination */
+	sigaction (SIGTERM, &sa, NULL);
+	sigaction (SIGINT, &sa, NULL);
+	signal (SIGPIPE, SIG_IGN);
+
+	pool = calloc (workers, sizeof (pid_t));
+	if (pool == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	if (zygote) {
+		warm_up ();
+		if (verbose)
+			printf (_("%s: listening on %s, forking up to %d checks at once\n"),
+			        progname, socket_path, workers);
+		zygote_loop (listen_fd);
+	}
+	else if (max_per_target || max_per_plugin || blocking_workers || coalesce) {
+		if (verbose)
+			printf (_("%s: listening on %s with %d workers and %d for blocking checks\n"),
+			        progname, socket_path, workers, blocking_workers);
+		dispatch_loop (listen_fd);
+	}
+	else if (verbose)
+		printf (_("%s: listening on %s with %d workers\n"), progname, socket_path, workers);
+
+	while (!terminating && !zygote && !max_per_target && !max_per_plugin &&
+	       !blocking_workers && !coalesce) {
+		for (i = 0; i < workers; i++)
+			if (pool[i] == 0)
+				pool[i] = spawn_worker (listen_fd);
+
+		pid = waitpid (-1, &status, 0);
+		if (pid <= 0 || metrics_reap (pid))
+			continue;
+		for (i = 0; i < workers; i++)
+			if (pool[i] == pid)
+				pool[i] = 0;
+		if (verbose > 1)
+			printf (_("%s: worker %ld exited\n"), progname, (long) pid);
+	}
+
+	metrics_close ();
+	for (i = 0; i < workers; i++)
+		if (pool[i] > 0)
+			kill (pool[i], SIGTERM);
+	while (waitpid (-1, &status, 0) > 0 || errno == EINTR)
+		;
+
+	close (listen_fd);
+	unlink (socket_path);
+	free (pool);
+
+	return STATE_OK;
+}
+
+static int
+open_socket (const char *path)
+{
+	struct sockaddr_un su;
+	int fd;
+
+	if (strlen (path) >= sizeof (su.sun_path))
+		die (STATE_UNKNOWN, _("Supplied path too long unix domain socket"));
+
+	memset (&su, 0, sizeof (su));
+	su.sun_family = AF_UNIX;
+	strncpy (su.sun_path, path, sizeof (su.sun_path) - 1);
+
+	if ((fd = socket (PF_UNIX, SOCK_STREAM, 0)) < 0)
+		die (STATE_UNKNOWN, _("Socket creation failed"));
+
+	/* a stale socket left behind by a previous instance */
+	unlink (path);
+
+	if (bind (fd, (struct sockaddr *) &su, sizeof (su)) < 0)
+		die (STATE_UNKNOWN, _("Cannot bind to %s: %s\n"), path, strerror (errno));
+	if (listen (fd, SOMAXCONN) < 0)
+		die (STATE_UNKNOWN, _("Cannot listen on %s: %s\n"), path, strerror (errno));
+
+	return fd;
+}
+
+static pid_t
+spawn_worker (int listen_fd)
+{
+	pid_t pid;
+
+	fflush (stdout);
+	if ((pid = fork ()) < 0) {
+		printf (_("%s: cannot fork worker: %s\n"), progname, strerror (errno));
+		sleep (1);
+		return 0;
+	}
+	if (pid == 0)
+		worker_loop (listen_fd);
+
+	return pid;
+}
+
+/* Do in the zygote what every check would otherwise do on its own, so that
+ * the children inherit it done */
+static void
+warm_up (void)
+{
+	time_t now = time (NULL);
+	struct tm tm;
+
+	/* the time zone and the locale's date and message catalogs */
+	tzset ();
+	localtime_r (&now, &tm);
+	(void) _("Cannot allocate memory: %s\n");
+#ifdef HAVE_SSL
+	/* the library, its algorithms and error strings, and the context of
+	 * the default version that the TLS checks connect with */
+	np_net_tls_prepare (0);
+#endif
+}
+
+/* With --zygote, fork a child for every request accepted, running no more
+ * than workers of them at once */
+static void
+zygote_loop (int listen_fd)
+{
+	struct sigaction sa;
+	int conn, running = 0, status;
+	pid_t pid;
+
+	/* a check that is done is waited for at once, so that its slot in the
+	 * metrics does not stay taken until the next request */
+	if (metrics != NULL) {
+		memset (&sa, 0, sizeof (sa));
+		sa.sa_handler = child_handler;
+		sigemptyset (&sa.sa_mask);
+		sigaction (SIGCHLD, &sa, NULL);
+	}
+
+	while (!terminating) {
+		while (running > 0 && (pid = waitpid (-1, &status, running >= workers ? 0 : WNOHANG)) > 0)
+			if (!metrics_reap (pid))
+				running--;
+		if (running >= workers)
+			continue;
+
+		conn = accept (listen_fd, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			die (STATE_UNKNOWN, _("Cannot accept on %s: %s\n"), socket_path, strerror (errno));
+		}
+
+		fflush (stdout);
+		if ((pid = fork ()) < 0) {
+			printf (_("%s: cannot fork check: %s\n"), progname, strerror (errno));
+			close (conn);
+			sleep (1);
+			continue;
+		}
+		if (pid == 0) {
+			close (listen_fd);
+			serve_request (conn, worker_setup ());
+			close (conn);
+			_exit (STATE_OK);
+		}
+		close (conn);
+		running++;
+	}
+}
+
+/* Returns the descriptor the output of checks is captured in */
+static int
+worker_setup (void)
+{
+	FILE *capture;
+	int devnull;
+
+	signal (SIGTERM, SIG_DFL);
+	signal (SIGINT, SIG_DFL);
+	signal (SIGCHLD, SIG_DFL);
+	if (metrics != NULL) {
+		close (metrics_fd);
+		metrics_claim ();
+	}
+
+	/* checks get no input, and their output is captured per request */
+	if ((devnull = open ("/dev/null", O_RDONLY)) >= 0) {
+		dup2 (devnull, STDIN_FILENO);
+		close (devnull);
+	}
+	if ((capture = tmpfile ()) == NULL) {
+		printf (_("%s: cannot create capture file: %s\n"), progname, strerror (errno));
+		_exit (STATE_UNKNOWN);
+	}
+
+	return fileno (capture);
+}
+
+static void
+worker_loop (int listen_fd)
+{
+	int conn, served, capture_fd;
+
+	capture_fd = worker_setup ();
+
+	for (served = 0; served < max_requests; served++) {
+		conn = accept (listen_fd, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				served--;
+				continue;
+			}
+			_exit (STATE_UNKNOWN);
+		}
+		if (!serve_request (conn, capture_fd)) {
+			close (conn);
+			break;
+		}
+		close (conn);
+	}
+
+	_exit (STATE_OK);
+}
+
+/* The dispatcher: accept connections and read their requests, and hand
+ * each to an idle worker of its pool once the checks running against its
+ * target and of its plugin are below their limits. Requests held back
+ * leave the ones behind them free to go. */
+static void
+dispatch_loop (int listen_fd)
+{
+	np_pending **pp, *p;
+	struct pollfd *fds;
+	int nworkers = workers + blocking_workers;
+	int npending, nfds, i, status, response;
+	char done;
+	pid_t pid;
+
+	if ((pool = calloc (nworkers, sizeof (np_worker))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	pool_size = nworkers;
+	for (i = 0; i < nworkers; i++) {
+		pool[i].channel = -1;
+		pool[i].blocking = i >= workers;
+	}
+	fcntl (listen_fd, F_SETFL, fcntl (listen_fd, F_GETFL) | O_NONBLOCK);
+
+	while (!terminating) {
+		while ((pid = waitpid (-1, &status, WNOHANG)) > 0) {
+			if (metrics_reap (pid))
+				continue;
+			for (i = 0; i < nworkers; i++)
+				if (pool[i].pid == pid)
+					worker_done (&pool[i]);
+		}
+		for (i = 0; i < nworkers; i++)
+			if (pool[i].channel < 0)
+				spawn_channel_worker (&pool[i], listen_fd);
+
+		/* hand out what can go, oldest first */
+		for (pp = &queue; (p = *pp) != NULL;) {
+			if (p->ready && ((coalesce && coalesce_pending (p)) || dispatch (p, pool, nworkers))) {
+				*pp = p->next;
+				free (p->target);
+				free (p->args);
+				free (p);
+			}
+			else
+				pp = &p->next;
+		}
+
+		npending = 0;
+		for (p = queue; p != NULL; p = p->next)
+			npending++;
+		if (metrics != NULL)
+			__atomic_store_n (&metrics->queue_depth, npending, __ATOMIC_RELAXED);
+		if ((fds = calloc (1 + npending + nworkers, sizeof (struct pollfd))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		nfds = 1;
+		for (p = queue; p != NULL; p = p->next) {
+			fds[nfds].fd = p->ready ? -1 : p->conn;
+			fds[nfds++].events = POLLIN;
+		}
+		for (i = 0; i < nworkers; i++) {
+			fds[nfds].fd = pool[i].channel;
+			fds[nfds++].events = POLLIN;
+		}
+
+		if (poll (fds, nfds, -1) < 0) {
+			free (fds);
+			if (errno == EINTR)
+				continue;
+			die (STATE_UNKNOWN, _("Cannot poll: %s\n"), strerror (errno));
+		}
+
+		nfds = 1;
+		for (pp = &queue; (p = *pp) != NULL;) {
+			if (fds[nfds++].revents && !read_pending (p)) {
+				close (p->conn);
+				*pp = p->next;
+				free (p);
+			}
+			else
+				pp = &p->next;
+		}
+		for (i = 0; i < nworkers; i++, nfds++) {
+			if (!fds[nfds].revents)
+				continue;
+			/* a byte when it is done, '+' if it takes another request,
+			 * with the response if coalescing; the end when it exits */
+			if (recv_message (pool[i].channel, &done, 1, &response) == 1) {
+				if (pool[i].flight != NULL) {
+					flight_done (pool[i].flight, response);
+					pool[i].flight = NULL;
+				}
+				else if (response >= 0)
+					close (response);
+				pool[i].busy = FALSE;
+				free (pool[i].target);
+				pool[i].target = NULL;
+				if (done != '+')
+					worker_done (&pool[i]);
+			}
+			else
+				worker_done (&pool[i]);
+		}
+
+		if (fds[0].revents) {
+			int conn;
+
+			while ((conn = accept (listen_fd, NULL, NULL)) >= 0) {
+				if ((p = calloc (1, sizeof (np_pending))) == NULL)
+					die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+				p->conn = conn;
+				fcntl (conn, F_SETFL, fcntl (conn, F_GETFL) | O_NONBLOCK);
+				for (pp = &queue; *pp != NULL; pp = &(*pp)->next)
+					;
+				*pp = p;
+			}
+		}
+		free (fds);
+	}
+
+	for (i = 0; i < nworkers; i++)
+		if (pool[i].channel >= 0) {
+			kill (pool[i].pid, SIGTERM);
+			close (pool[i].channel);
+		}
+	while ((p = queue) != NULL) {
+		queue = p->next;
+		close (p->conn);
+		free (p->target);
+		free (p->args);
+		free (p);
+	}
+	while (flights != NULL)
+		flight_free (flights);
+	free (pool);
+	pool = NULL;
+}
+
+/* In a child of the dispatcher: clients see the end of the response only
+ * once every copy of their connection is closed */
+static void
+close_dispatcher_fds (void)
+{
+	np_pending *p;
+	np_flight *f;
+	int i;
+
+	for (p = queue; p != NULL; p = p->next)
+		close (p->conn);
+	for (f = flights; f != NULL; f = f->next) {
+		for (i = 0; i < f->nconns; i++)
+			close (f->conns[i]);
+		if (f->response >= 0)
+			close (f->response);
+	}
+	for (i = 0; i < pool_size; i++)
+		if (pool[i].channel >= 0)
+			close (pool[i].channel);
+}
+
+static void
+spawn_channel_worker (np_worker *worker, int listen_fd)
+{
+	int channel[2];
+	pid_t pid;
+
+	if (socketpair (AF_UNIX, SOCK_SEQPACKET, 0, channel) < 0)
+		die (STATE_UNKNOWN, _("Cannot create worker channel: %s\n"), strerror (errno));
+
+	fflush (stdout);
+	if ((pid = fork ()) < 0) {
+		printf (_("%s: cannot fork worker: %s\n"), progname, strerror (errno));
+		close (channel[0]);
+		close (channel[1]);
+		sleep (1);
+		return;
+	}
+	if (pid == 0) {
+		close_dispatcher_fds ();
+		close (listen_fd);
+		close (channel[0]);
+		channel_worker_loop (channel[1]);
+	}
+
+	close (channel[1]);
+	worker->pid = pid;
+	worker->channel = channel[0];
+	worker->busy = FALSE;
+}
+
+/* A worker of the dispatcher: run the requests it is handed, with the
+ * connection to answer on, and say when it is done with each */
+static void
+channel_worker_loop (int channel)
+{
+	char request[MAX_INPUT_BUFFER];
+	FILE *response = NULL;
+	ssize_t len;
+	int conn, served, capture_fd, more = TRUE;
+
+	capture_fd = worker_setup ();
+
+	for (served = 0; more && served < max_requests; served++) {
+		if ((len = recv_message (channel, request, sizeof (request) - 1, &conn)) < 0 && errno == EINTR) {
+			served--;
+			continue;
+		}
+		request[len > 0 ? len : 0] = '\0';
+		/* coalesced requests are answered by the dispatcher from a file of
+		 * the response, the others on the connection handed over */
+		if (coalesce && len > 0 && conn < 0) {
+			if ((response = tmpfile ()) == NULL)
+				_exit (STATE_UNKNOWN);
+			conn = dup (fileno (response));
+			fclose (response);
+		}
+		if (len <= 0 || conn < 0)
+			_exit (STATE_OK);
+
+		fcntl (conn, F_SETFL, fcntl (conn, F_GETFL) & ~O_NONBLOCK);
+		more = handle_request (conn, request, capture_fd) && served + 1 < max_requests;
+		if (send_message (channel, more ? "+" : "-", 1, coalesce ? conn : -1) == ERROR)
+			more = FALSE;
+		close (conn);
+	}
+
+	_exit (STATE_OK);
+}
+
+/* Read what has arrived of a request. Returns FALSE if the client went
+ * away without sending one. */
+static int
+read_pending (np_pending *p)
+{
+	char copy[MAX_INPUT_BUFFER];
+	char *args[MAX_REQUEST_ARGS + 1];
+	char *eol, *name;
+	ssize_t ret;
+	int argc;
+
+	ret = read (p->conn, p->request + p->len, sizeof (p->request) - 1 - p->len);
+	if (ret < 0)
+		return errno == EINTR || errno == EAGAIN;
+	p->len += ret;
+	p->request[p->len] = '\0';
+	if ((eol = strchr (p->request, '\n')) != NULL)
+		*eol = '\0';
+	else if (ret > 0 && p->len < sizeof (p->request) - 1)
+		return TRUE;
+	if (p->request[0] == '\0')
+		return FALSE;
+
+	/* what the limits apply to, from a copy split like the worker will */
+	p->ready = TRUE;
+	strcpy (copy, p->request);
+	if ((argc = split_request (copy, args, MAX_REQUEST_ARGS)) > 0) {
+		name = strrchr (args[0], '/');
+		p->entry = find_entry ((name != NULL) ? name + 1 : args[0]);
+		p->target = request_target (args, argc);
+		if (coalesce) {
+			int i;
+
+			np_argv_digest (argc, args, p->key);
+			/* the arguments end where copy ends, one NUL after each */
+			for (i = 0, p->args_len = 0; i < argc; i++)
+				p->args_len += strlen (args[i]) + 1;
+			if ((p->args = malloc (p->args_len)) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+			for (i = 0, p->args_len = 0; i < argc; i++) {
+				strcpy (p->args + p->args_len, args[i]);
+				p->args_len += strlen (args[i]) + 1;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/* Hand a request to a worker if one is idle and its limits allow it.
+ * Returns TRUE if it was handed out. */
+static int
+dispatch (np_pending *p, np_worker *pool, int nworkers)
+{
+	np_worker *idle = NULL;
+	int blocking, on_target = 0, of_plugin = 0, i;
+
+	blocking = blocking_workers > 0 && p->entry != NULL && (p->entry->flags & NP_ENTRY_BLOCKING);
+	for (i = 0; i < nworkers; i++) {
+		if (pool[i].channel < 0)
+			continue;
+		if (!pool[i].busy) {
+			if (idle == NULL && pool[i].blocking == blocking)
+				idle = &pool[i];
+			continue;
+		}
+		if (p->target != NULL && pool[i].target != NULL && strcmp (p->target, pool[i].target) == 0)
+			on_target++;
+		if (p->entry != NULL && pool[i].entry != NULL &&
+		    strcmp (p->entry->name, pool[i].entry->name) == 0)
+			of_plugin++;
+	}
+	if (idle == NULL || (max_per_target && on_target >= max_per_target) ||
+	    (max_per_plugin && of_plugin >= max_per_plugin))
+		return FALSE;
+
+	if (send_message (idle->channel, p->request, strlen (p->request) + 1,
+	                  (coalesce && p->args != NULL) ? -1 : p->conn) == ERROR) {
+		/* the worker is gone, the request waits for the next one */
+		worker_done (idle);
+		return FALSE;
+	}
+	if (verbose > 1)
+		printf (_("%s: handed %s to worker %ld\n"), progname, p->request, (long) idle->pid);
+
+	if (coalesce && p->args != NULL) {
+		np_flight *f;
+
+		if ((f = calloc (1, sizeof (np_flight))) == NULL ||
+		    (f->conns = malloc (sizeof (int))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		memcpy (f->key, p->key, sizeof (f->key));
+		if (metrics != NULL)
+			__atomic_fetch_add (&metrics->coalesce_misses, 1, __ATOMIC_RELAXED);
+		f->args = p->args;
+		f->args_len = p->args_len;
+		p->args = NULL;
+		f->conns[f->nconns++] = p->conn;
+		f->response = -1;
+		f->next = flights;
+		flights = f;
+		idle->flight = f;
+	}
+	else
+		close (p->conn);
+	idle->busy = TRUE;
+	idle->entry = p->entry;
+	idle->target = p->target;
+	p->target = NULL;
+
+	return TRUE;
+}
+
+/* The worker exited, whatever it was running is over */
+static void
+worker_done (np_worker *worker)
+{
+	if (worker->channel >= 0)
+		close (worker->channel);
+	worker->channel = -1;
+	worker->pid = 0;
+	worker->busy = FALSE;
+	free (worker->target);
+	worker->target = NULL;
+	/* its clients get no response, as they would from a worker of their own */
+	if (worker->flight != NULL)
+		flight_free (worker->flight);
+	worker->flight = NULL;
+}
+
+/* Answer a request from the same one running or done within --result-ttl.
+ * Returns TRUE if it was, or will be once the running one is done. */
+static int
+coalesce_pending (np_pending *p)
+{
+	np_flight *f, *next;
+	double now = np_clock ();
+	int *conns;
+
+	for (f = flights; f != NULL; f = next) {
+		next = f->next;
+		if (f->response >= 0 && now - f->done > result_ttl) {
+			flight_free (f);
+			continue;
+		}
+		if (p->args == NULL || strcmp (f->key, p->key) != 0 ||
+		    f->args_len != p->args_len || memcmp (f->args, p->args, p->args_len) != 0)
+			continue;
+
+		if (verbose > 1)
+			printf (_("%s: coalesced %s\n"), progname, p->request);
+		if (metrics != NULL)
+			__atomic_fetch_add (&metrics->coalesce_hits, 1, __ATOMIC_RELAXED);
+		if (f->response >= 0) {
+			fcntl (p->conn, F_SETFL, fcntl (p->conn, F_GETFL) & ~O_NONBLOCK);
+			copy_response (f->response, p->conn);
+			close (p->conn);
+			return TRUE;
+		}
+		if ((conns = realloc (f->conns, (f->nconns + 1) * sizeof (int))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		f->conns = conns;
+		f->conns[f->nconns++] = p->conn;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* The request ran, send every client waiting for it the response, and keep
+ * it for --result-ttl */
+static void
+flight_done (np_flight *f, int response)
+{
+	int i;
+
+	for (i = 0; i < f->nconns; i++) {
+		fcntl (f->conns[i], F_SETFL, fcntl (f->conns[i], F_GETFL) & ~O_NONBLOCK);
+		if (response >= 0)
+			copy_response (response, f->conns[i]);
+		close (f->conns[i]);
+	}
+	f->nconns = 0;
+	f->response = response;
+	f->done = np_clock ();
+	if (response < 0 || result_ttl <= 0)
+		flight_free (f);
+}
+
+static void
+flight_free (np_flight *f)
+{
+	np_flight **ff;
+	int i;
+
+	for (ff = &flights; *ff != NULL; ff = &(*ff)->next)
+		if (*ff == f) {
+			*ff = f->next;
+			break;
+		}
+	for (i = 0; i < f->nconns; i++)
+		close (f->conns[i]);
+	if (f->response >= 0)
+		close (f->response);
+	free (f->conns);
+	free (f->args);
+	free (f);
+}
+
+static int
+copy_response (int response, int conn)
+{
+	char buf[MAX_INPUT_BUFFER];
+	off_t offset = 0;
+	ssize_t len;
+
+	while ((len = pread (response, buf, sizeof (buf), offset)) > 0) {
+		if (write_all (conn, buf, len) == ERROR)
+			return ERROR;
+		offset += len;
+	}
+
+	return OK;
+}
+
+/* A message on a worker channel, with the descriptor fd if it is not -1 */
+static int
+send_message (int channel, const void *buf, size_t len, int fd)
+{
+	char control[CMSG_SPACE (sizeof (int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+
+	memset (&msg, 0, sizeof (msg));
+	memset (control, 0, sizeof (control));
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fd >= 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof (control);
+		cmsg = CMSG_FIRSTHDR (&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+		memcpy (CMSG_DATA (cmsg), &fd, sizeof (int));
+	}
+
+	return sendmsg (channel, &msg, 0) < 0 ? ERROR : OK;
+}
+
+/* Receive a message, and in *fd the descriptor sent with it or -1 */
+static ssize_t
+recv_message (int channel, void *buf, size_t size, int *fd)
+{
+	char control[CMSG_SPACE (sizeof (int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = buf;
+	iov.iov_len = size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof (control);
+
+	*fd = -1;
+	if ((len = recvmsg (channel, &msg, 0)) > 0 && (cmsg = CMSG_FIRSTHDR (&msg)) != NULL &&
+	    cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy (fd, CMSG_DATA (cmsg), sizeof (int));
+
+	return len;
+}
+
+/* The host a check is run against, as given with -H or --hostname */
+static char *
+request_target (char **args, int argc)
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp (args[i], "-H") == 0 || strcmp (args[i], "--hostname") == 0)
+			return (i + 1 < argc) ? strdup (args[i + 1]) : NULL;
+		if (strncmp (args[i], "--hostname=", 11) == 0)
+			return strdup (args[i] + 11);
+		if (strncmp (args[i], "-H", 2) == 0)
+			return strdup (args[i] + 2);
+		if (strcmp (args[i], "--") == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+/* Returns TRUE if the worker may serve further requests */
+static int
+serve_request (int conn, int capture_fd)
+{
+	char request[MAX_INPUT_BUFFER];
+
+	if (read_request (conn, request, sizeof (request)) <= 0)
+		return TRUE;
+
+	return handle_request (conn, request, capture_fd);
+}
+
+static int
+handle_request (int conn, char *request, int capture_fd)
+{
+	char *args[MAX_REQUEST_ARGS + 1];
+	char *name;
+	const np_entry *entry;
+	double start;
+	int argc, result;
+
+	argc = split_request (request, args, MAX_REQUEST_ARGS);
+	if (argc <= 0)
+		return TRUE;
+
+	name = strrchr (args[0], '/');
+	name = (name != NULL) ? name + 1 : args[0];
+
+	if (ftruncate (capture_fd, 0) < 0 || lseek (capture_fd, 0, SEEK_SET) < 0)
+		return FALSE;
+	if (framed) {
+		struct timeval tv;
+
+		gettimeofday (&tv, NULL);
+		request_start = tv.tv_sec + tv.tv_usec / 1e6;
+		request_clock = np_clock ();
+		np_frame_collect (TRUE);
+	}
+
+	if ((entry = find_entry (name)) == NULL) {
+		char message[MAX_INPUT_BUFFER];
+		int len = snprintf (message, sizeof (message),
+		                    _("UNKNOWN - %s is not available in %s\n"), name, progname);
+		if (len > 0 && write (capture_fd, message, min ((size_t) len, sizeof (message) - 1)) < 0)
+			return FALSE;
+		if (framed)
+			send_frame (conn, STATE_UNKNOWN, capture_fd);
+		else
+			send_response (conn, STATE_UNKNOWN, capture_fd);
+		return TRUE;
+	}
+
+	if (verbose > 1)
+		printf (_("%s: running %s\n"), progname, name);
+
+	nested_not_reentrant = FALSE;
+	if (metrics_self != NULL)
+		metrics_running (entry, args, argc);
+	start = np_clock ();
+	result = run_entry (entry, argc, args, capture_fd);
+	if (metrics_self != NULL)
+		metrics_done (entry, np_clock () - start);
+	if (framed)
+		send_frame (conn, result, capture_fd);
+	else
+		send_response (conn, result, capture_fd);
+
+	return ((entry->flags & NP_ENTRY_REENTRANT) && !nested_not_reentrant) ? TRUE : FALSE;
+}
+
+static int
+run_entry (const np_entry *entry, int argc, char **argv, int capture_fd)
+{
+	np_exec_context context;
+	const char *executor_name = progname;
+	int saved_stdout, result;
+
+	fflush (stdout);
+	if ((saved_stdout = dup (STDOUT_FILENO)) < 0)
+		return STATE_UNKNOWN;
+	dup2 (capture_fd, STDOUT_FILENO);
+
+	current_entry = entry;
+	progname = entry->name;
+	/* let getopt start over with the new argument vector */
+	optind = 0;
+
+	result = np_exec_run (&context, entry->main, argc, argv);
+
+	/* a check may have left its timeout armed */
+	alarm (0);
+	signal (SIGALRM, SIG_DFL);
+
+	fflush (stdout);
+	dup2 (saved_stdout, STDOUT_FILENO);
+	close (saved_stdout);
+
+	progname = executor_name;
+	current_entry = NULL;
+
+	if (result < STATE_OK || result > STATE_DEPENDENT)
+		result = STATE_UNKNOWN;
+
+	return result;
+}
+
+/* Run an entry as the whole process, for the multicall binary. No context
+ * is set up, so exit() and die() in the plugin end the process as usual. */
+static int
+run_direct (const np_entry *entry, int argc, char **argv)
+{
+	current_entry = entry;
+	progname = entry->name;
+
+	return entry->main (argc, argv);
+}
+
+/* Run the entry named by argv[0] for a wrapper such as negate, within the
+ * request of the wrapper. The output goes to the capture as usual, and is
+ * then taken back out of it into *output for the wrapper to rewrite.
+ * Returns the state, or -1 if argv[0] is no entry. */
+int
+np_entry_run (char **argv, char **output, size_t *len)
+{
+	np_exec_context context;
+	const np_entry *entry, *wrapper = current_entry;
+	const char *wrapper_name = progname, *name;
+	off_t start, end;
+	int argc, result;
+
+	name = strrchr (argv[0], '/');
+	name = (name != NULL) ? name + 1 : argv[0];
+	if (wrapper == NULL || (entry = find_entry (name)) == NULL)
+		return -1;
+	for (argc = 0; argv[argc] != NULL; argc++)
+		;
+
+	fflush (stdout);
+	if ((start = lseek (STDOUT_FILENO, 0, SEEK_CUR)) < 0)
+		return -1;
+
+	current_entry = entry;
+	progname = entry->name;
+	optind = 0;
+
+	result = np_exec_run (&context, entry->main, argc, argv);
+
+	alarm (0);
+	signal (SIGALRM, SIG_DFL);
+	fflush (stdout);
+	progname = wrapper_name;
+	current_entry = wrapper;
+	if (!(entry->flags & NP_ENTRY_REENTRANT))
+		nested_not_reentrant = TRUE;
+
+	if ((end = lseek (STDOUT_FILENO, 0, SEEK_CUR)) < start)
+		end = start;
+	*len = end - start;
+	if ((*output = malloc (*len + 1)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	if (pread (STDOUT_FILENO, *output, *len, start) != (ssize_t) *len)
+		*len = 0;
+	(*output)[*len] = '\0';
+	if (ftruncate (STDOUT_FILENO, start) < 0 || lseek (STDOUT_FILENO, start, SEEK_SET) < 0)
+		die (STATE_UNKNOWN, _("Cannot rewind the capture file: %s\n"), strerror (errno));
+
+	if (result < STATE_OK || result > STATE_DEPENDENT)
+		result = STATE_UNKNOWN;
+
+	return result;
+}
+
+static const np_entry *
+find_entry (const char *name)
+{
+	int i;
+
+	for (i = 0; entries[i].name != NULL; i++)
+		if (strcmp (entries[i].name, name) == 0)
+			return &entries[i];
+
+	return NULL;
+}
+
+/* Split a request line into arguments. Arguments are separated by white
+ * space, and may be enclosed in single quotes to contain white space. */
+static int
+split_request (char *line, char **args, int max_args)
+{
+	int argc = 0;
+	char *p = line, *q;
+
+	while (*p != '\0') {
+		while (isspace ((unsigned char) *p))
+			p++;
+		if (*p == '\0')
+			break;
+		if (argc >= max_args)
+			return -1;
+
+		if (*p == '\'') {
+			args[argc++] = ++p;
+			if ((q = strchr (p, '\'')) == NULL)
+				return -1;
+		}
+		else {
+			args[argc++] = p;
+			for (q = p; *q != '\0' && !isspace ((unsigned char) *q); q++)
+				;
+		}
+
+		if (*q == '\0')
+			break;
+		*q = '\0';
+		p = q + 1;
+	}
+	args[argc] = NULL;
+
+	return argc;
+}
+
+/* Read a single newline-terminated request */
+static ssize_t
+read_request (int conn, char *buf, size_t size)
+{
+	size_t len = 0;
+	ssize_t ret;
+	char *eol;
+
+	while (len < size - 1) {
+		ret = read (conn, buf + len, size - 1 - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+		buf[len] = '\0';
+		if ((eol = strchr (buf, '\n')) != NULL) {
+			*eol = '\0';
+			return eol - buf;
+		}
+	}
+	buf[len] = '\0';
+
+	return len;
+}
+
+static int
+write_all (int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write (fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ERROR;
+		buf += ret;
+		len -= ret;
+	}
+
+	return OK;
+}
+
+/* The response is the check's return code on a line of its own, followed
+ * by everything the check printed */
+static int
+send_response (int conn, int result, int capture_fd)
+{
+	char buf[MAX_INPUT_BUFFER];
+	ssize_t len;
+
+	len = snprintf (buf, sizeof (buf), "%d\n", result);
+	if (write_all (conn, buf, len) == ERROR)
+		return ERROR;
+
+	if (lseek (capture_fd, 0, SEEK_SET) < 0)
+		return ERROR;
+	while ((len = read (capture_fd, buf, sizeof (buf))) > 0)
+		if (write_all (conn, buf, len) == ERROR)
+			return ERROR;
+
+	return OK;
+}
+
+/* With --framed the response is the record of utils_frame.h instead,
+ * holding the output without the perfdata and the points of the perfdata
+ * functions the check called */
+static int
+send_frame (int conn, int result, int capture_fd)
+{
+	char *output, *frame;
+	size_t frame_len;
+	off_t len;
+	int ret;
+
+	if ((len = lseek (capture_fd, 0, SEEK_END)) < 0)
+		return ERROR;
+	if ((output = malloc (len + 1)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	if (pread (capture_fd, output, len, 0) != (ssize_t) len)
+		len = 0;
+
+	frame = np_frame_result (result, request_start, np_clock () - request_clock,
+	                         output, len, &frame_len);
+	np_frame_collect (FALSE);
+	free (output);
+	if (frame == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	ret = write_all (conn, frame, frame_len);
+	free (frame);
+
+	return ret;
+}
+
+/* Map the memory the workers keep their figures in, and start the process
+ * serving them on --metrics */
+static void
+metrics_open (int executor_fd)
+{
+	int nworkers = 2 * (workers + blocking_workers), i;
+
+	/* a worker gone but not waited for yet still has its slot */
+	metrics_size = sizeof (np_metrics) + nworkers * sizeof (np_metrics_worker);
+	metrics = mmap (NULL, metrics_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (metrics == MAP_FAILED)
+		die (STATE_UNKNOWN, _("Cannot map the metrics: %s\n"), strerror (errno));
+	memset (metrics, 0, metrics_size);
+	metrics->nworkers = nworkers;
+	for (i = 0; i < nworkers; i++)
+		metrics->workers[i].entry = -1;
+
+	metrics_fd = open_socket (metrics_path);
+	metrics_executor_fd = executor_fd;
+	metrics_spawn ();
+}
+
+static void
+metrics_spawn (void)
+{
+	fflush (stdout);
+	if ((metrics_pid = fork ()) < 0) {
+		printf (_("%s: cannot fork the metrics server: %s\n"), progname, strerror (errno));
+		metrics_pid = 0;
+		return;
+	}
+	if (metrics_pid == 0) {
+		close_dispatcher_fds ();
+		close (metrics_executor_fd);
+		metrics_serve ();
+	}
+}
+
+static void
+metrics_serve (void)
+{
+	struct timeval tv;
+	FILE *out;
+	int conn;
+
+	signal (SIGTERM, SIG_DFL);
+	signal (SIGINT, SIG_DFL);
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+
+	while (1) {
+		conn = accept (metrics_fd, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			_exit (STATE_UNKNOWN);
+		}
+		/* a client that does not read holds up the next one only */
+		setsockopt (conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+		if ((out = fdopen (conn, "w")) == NULL) {
+			close (conn);
+			continue;
+		}
+		metrics_write (out);
+		fclose (out);
+	}
+}
+
+/* A child of the master was waited for: add what a worker did to what the
+ * ones before it did and free its slot, or start the metrics server again.
+ * Returns TRUE if it was the metrics server. */
+static int
+metrics_reap (pid_t pid)
+{
+	np_metrics_worker *w;
+	np_exec_stats *r;
+	int i;
+
+	if (metrics == NULL)
+		return FALSE;
+	if (pid == metrics_pid) {
+		if (verbose)
+			printf (_("%s: metrics server %ld exited\n"), progname, (long) pid);
+		if (!terminating)
+			metrics_spawn ();
+		return TRUE;
+	}
+
+	for (i = 0; i < metrics->nworkers; i++) {
+		w = &metrics->workers[i];
+		if (w->pid != pid)
+			continue;
+		r = &metrics->retired;
+		__atomic_store_n (&metrics->seq, metrics->seq + 1, __ATOMIC_RELAXED);
+		__sync_synchronize ();
+		metrics->retired_user += w->user;
+		metrics->retired_system += w->system;
+		r->state_reads += w->stats.state_reads;
+		r->state_writes += w->stats.state_writes;
+		r->state_bytes_read += w->stats.state_bytes_read;
+		r->state_bytes_written += w->stats.state_bytes_written;
+		r->state_read_seconds += w->stats.state_read_seconds;
+		r->state_write_seconds += w->stats.state_write_seconds;
+		r->pool_opened += w->stats.pool_opened;
+		r->pool_reused += w->stats.pool_reused;
+		/* its connections went with it */
+		r->pool_closed += w->stats.pool_opened;
+		w->entry = -1;
+		w->target[0] = '\0';
+		w->user = w->system = 0;
+		memset (&w->stats, 0, sizeof (w->stats));
+		__sync_synchronize ();
+		__atomic_store_n (&metrics->seq, metrics->seq + 1, __ATOMIC_RELAXED);
+		__atomic_store_n (&w->pid, 0, __ATOMIC_RELEASE);
+		break;
+	}
+	return FALSE;
+}
+
+static void
+metrics_close (void)
+{
+	if (metrics == NULL)
+		return;
+	if (metrics_pid > 0)
+		kill (metrics_pid, SIGTERM);
+	close (metrics_fd);
+	unlink (metrics_path);
+}
+
+/* In a worker, take a free slot to keep its figures in */
+static void
+metrics_claim (void)
+{
+	pid_t none, self = getpid ();
+	int i;
+
+	for (i = 0; i < metrics->nworkers && metrics_self == NULL; i++) {
+		none = 0;
+		if (__atomic_compare_exchange_n (&metrics->workers[i].pid, &none, self, FALSE,
+		                                 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			metrics_self = &metrics->workers[i];
+	}
+	/* every span is kept, if not reported */
+	if (metrics_self != NULL)
+		np_timing_enable (NP_TIMING_SPANS);
+}
+
+static void
+metrics_running (const np_entry *entry, char **args, int argc)
+{
+	char *target = request_target (args, argc);
+
+	np_timing_reset ();
+	__atomic_store_n (&metrics_self->seq, metrics_self->seq + 1, __ATOMIC_RELAXED);
+	__sync_synchronize ();
+	metrics_self->entry = entry - entries;
+	strncpy (metrics_self->target, target ? target : "", METRICS_TARGET_MAX - 1);
+	metrics_self->target[METRICS_TARGET_MAX - 1] = '\0';
+	__sync_synchronize ();
+	__atomic_store_n (&metrics_self->seq, metrics_self->seq + 1, __ATOMIC_RELAXED);
+	free (target);
+}
+
+static void
+metrics_done (const np_entry *entry, double seconds)
+{
+	struct rusage ru;
+	int index = entry - entries;
+
+	metrics_observe (index, "check", seconds);
+	np_span_each (metrics_span, &index);
+
+	getrusage (RUSAGE_SELF, &ru);
+	__atomic_store_n (&metrics_self->seq, metrics_self->seq + 1, __ATOMIC_RELAXED);
+	__sync_synchronize ();
+	metrics_self->entry = -1;
+	metrics_self->target[0] = '\0';
+	metrics_self->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+	metrics_self->system = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	metrics_self->stats = np_exec_counters;
+	__sync_synchronize ();
+	__atomic_store_n (&metrics_self->seq, metrics_self->seq + 1, __ATOMIC_RELAXED);
+}
+
+static void
+metrics_span (const char *name, double seconds, void *index)
+{
+	metrics_observe (*(int *) index, name, seconds);
+}
+
+/* Count the seconds in the histogram of that phase of the entry, taking a
+ * free one for it the first time. Phases are taken in order, so a worker
+ * that loses the race for a free one finds the phase in it. */
+static void
+metrics_observe (int entry, const char *name, double seconds)
+{
+	np_metrics_phase *ph;
+	int i, b, state, spins;
+
+	for (i = 0; i < METRICS_PHASES; i++) {
+		ph = &metrics->phases[i];
+		state = __atomic_load_n (&ph->state, __ATOMIC_ACQUIRE);
+		if (state == 0) {
+			if (__atomic_compare_exchange_n (&ph->state, &state, 1, FALSE,
+			                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				ph->entry = entry;
+				strncpy (ph->name, name, METRICS_PHASE_MAX - 1);
+				__atomic_store_n (&ph->state, 2, __ATOMIC_RELEASE);
+				break;
+			}
+		}
+		/* the worker taking it is between two stores */
+		for (spins = 0; state == 1 && spins < 1000000; spins++)
+			state = __atomic_load_n (&ph->state, __ATOMIC_ACQUIRE);
+		if (state == 2 && ph->entry == entry && strncmp (ph->name, name, METRICS_PHASE_MAX - 1) == 0)
+			break;
+	}
+	if (i == METRICS_PHASES)
+		return;
+
+	for (b = 0; b < METRICS_BUCKETS - 1 && seconds > metrics_bounds[b]; b++)
+		;
+	__atomic_fetch_add (&ph->buckets[b], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&ph->sum_us, (uint64_t) (seconds * 1e6), __ATOMIC_RELAXED);
+}
+
+static void
+metrics_label (FILE *out, const char *value)
+{
+	for (; *value != '\0'; value++) {
+		if (*value == '\\' || *value == '"')
+			fputc ('\\', out);
+		if (*value == '\n')
+			fputs ("\\n", out);
+		else
+			fputc (*value, out);
+	}
+}
+
+/* what the workers did, as of the last request each ran */
+static void
+metrics_write (FILE *out)
+{
+	np_metrics_worker *w;
+	np_metrics_phase *ph;
+	np_exec_stats total;
+	double user, system, live_user = 0, live_system = 0;
+	unsigned long kept = 0;
+	unsigned int seq, wseq;
+	uint64_t count, n;
+	int nworkers = metrics->nworkers, live = 0, running, i, j, b, tries;
+
+	if ((w = calloc (nworkers, sizeof (np_metrics_worker))) == NULL)
+		return;
+	/* the slots of the workers and what the ones retired did, all of them
+	 * from between two retirements */
+	for (tries = 0; tries < 100; tries++) {
+		seq = __atomic_load_n (&metrics->seq, __ATOMIC_ACQUIRE);
+		for (i = 0; i < nworkers; i++) {
+			for (j = 0; j < 100; j++) {
+				wseq = __atomic_load_n (&metrics->workers[i].seq, __ATOMIC_ACQUIRE);
+				memcpy (&w[i], &metrics->workers[i], sizeof (np_metrics_worker));
+				__sync_synchronize ();
+				if (!(wseq & 1) && __atomic_load_n (&metrics->workers[i].seq, __ATOMIC_RELAXED) == wseq)
+					break;
+			}
+		}
+		total = metrics->retired;
+		user = metrics->retired_user;
+		system = metrics->retired_system;
+		__sync_synchronize ();
+		if (!(seq & 1) && __atomic_load_n (&metrics->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	for (i = 0; i < nworkers; i++) {
+		if (w[i].pid == 0)
+			continue;
+		live++;
+		live_user += w[i].user;
+		live_system += w[i].system;
+		total.state_reads += w[i].stats.state_reads;
+		total.state_writes += w[i].stats.state_writes;
+		total.state_bytes_read += w[i].stats.state_bytes_read;
+		total.state_bytes_written += w[i].stats.state_bytes_written;
+		total.state_read_seconds += w[i].stats.state_read_seconds;
+		total.state_write_seconds += w[i].stats.state_write_seconds;
+		total.pool_opened += w[i].stats.pool_opened;
+		total.pool_reused += w[i].stats.pool_reused;
+		total.pool_closed += w[i].stats.pool_closed;
+		kept += w[i].stats.pool_opened - w[i].stats.pool_closed;
+	}
+
+	fprintf (out, "# TYPE np_executor_workers gauge\n"
+	         "# HELP np_executor_workers Worker processes running.\n"
+	         "np_executor_workers %d\n", live);
+	fprintf (out, "# TYPE np_executor_queue_depth gauge\n"
+	         "# HELP np_executor_queue_depth Requests read by the dispatcher and not handed to a worker yet.\n"
+	         "np_executor_queue_depth %llu\n",
+	         (unsigned long long) __atomic_load_n (&metrics->queue_depth, __ATOMIC_RELAXED));
+
+	fprintf (out, "# TYPE np_executor_in_flight gauge\n"
+	         "# HELP np_executor_in_flight Checks running of a plugin.\n");
+	for (i = 0; entries[i].name != NULL; i++) {
+		for (j = running = 0; j < nworkers; j++)
+			if (w[j].pid != 0 && w[j].entry == i)
+				running++;
+		fprintf (out, "np_executor_in_flight{plugin=\"%s\"} %d\n", entries[i].name, running);
+	}
+	fprintf (out, "# TYPE np_executor_target_in_flight gauge\n"
+	         "# HELP np_executor_target_in_flight Checks running against a host given with -H.\n");
+	for (i = 0; i < nworkers; i++) {
+		if (w[i].pid == 0 || w[i].entry < 0 || w[i].target[0] == '\0')
+			continue;
+		/* once for every target, where it is first found */
+		for (j = running = 0; j < nworkers; j++)
+			if (w[j].pid != 0 && w[j].entry >= 0 && strcmp (w[j].target, w[i].target) == 0) {
+				if (j < i)
+					break;
+				running++;
+			}
+		if (j < i)
+			continue;
+		fputs ("np_executor_target_in_flight{target=\"", out);
+		metrics_label (out, w[i].target);
+		fprintf (out, "\"} %d\n", running);
+	}
+
+	fprintf (out, "# TYPE np_executor_phase_seconds histogram\n"
+	         "# UNIT np_executor_phase_seconds seconds\n"
+	         "# HELP np_executor_phase_seconds Time of the checks of a plugin, all of it or a span of it.\n");
+	for (i = 0; i < METRICS_PHASES; i++) {
+		ph = &metrics->phases[i];
+		if (__atomic_load_n (&ph->state, __ATOMIC_ACQUIRE) != 2)
+			continue;
+		for (b = 0, count = 0; b < METRICS_BUCKETS; b++) {
+			count += __atomic_load_n (&ph->buckets[b], __ATOMIC_RELAXED);
+			fprintf (out, "np_executor_phase_seconds_bucket{plugin=\"%s\",phase=\"", entries[ph->entry].name);
+			metrics_label (out, ph->name);
+			if (b < METRICS_BUCKETS - 1)
+				fprintf (out, "\",le=\"%g\"} %llu\n", metrics_bounds[b], (unsigned long long) count);
+			else
+				fprintf (out, "\",le=\"+Inf\"} %llu\n", (unsigned long long) count);
+		}
+		n = __atomic_load_n (&ph->sum_us, __ATOMIC_RELAXED);
+		fprintf (out, "np_executor_phase_seconds_count{plugin=\"%s\",phase=\"", entries[ph->entry].name);
+		metrics_label (out, ph->name);
+		fprintf (out, "\"} %llu\n", (unsigned long long) count);
+		fprintf (out, "np_executor_phase_seconds_sum{plugin=\"%s\",phase=\"", entries[ph->entry].name);
+		metrics_label (out, ph->name);
+		fprintf (out, "\"} %.6f\n", n / 1e6);
+	}
+
+	fprintf (out, "# TYPE np_executor_coalesced counter\n"
+	         "# HELP np_executor_coalesced Requests answered by the run of the same one, or run themselves.\n"
+	         "np_executor_coalesced_total{result=\"hit\"} %llu\n"
+	         "np_executor_coalesced_total{result=\"miss\"} %llu\n",
+	         (unsigned long long) __atomic_load_n (&metrics->coalesce_hits, __ATOMIC_RELAXED),
+	         (unsigned long long) __atomic_load_n (&metrics->coalesce_misses, __ATOMIC_RELAXED));
+
+	fprintf (out, "# TYPE np_executor_pool_connections counter\n"
+	         "# HELP np_executor_pool_connections Connections kept between checks opened, used again and closed.\n"
+	         "np_executor_pool_connections_total{event=\"opened\"} %lu\n"
+	         "np_executor_pool_connections_total{event=\"reused\"} %lu\n"
+	         "np_executor_pool_connections_total{event=\"closed\"} %lu\n",
+	         total.pool_opened, total.pool_reused, total.pool_closed);
+	fprintf (out, "# TYPE np_executor_pool_kept gauge\n"
+	         "# HELP np_executor_pool_kept Connections kept open by the workers.\n"
+	         "np_executor_pool_kept %lu\n", kept);
+
+	fprintf (out, "# TYPE np_executor_state_operations counter\n"
+	         "# HELP np_executor_state_operations Reads and writes of the state of checks.\n"
+	         "np_executor_state_operations_total{op=\"read\"} %lu\n"
+	         "np_executor_state_operations_total{op=\"write\"} %lu\n",
+	         total.state_reads, total.state_writes);
+	fprintf (out, "# TYPE np_executor_state_bytes counter\n"
+	         "# UNIT np_executor_state_bytes bytes\n"
+	         "# HELP np_executor_state_bytes State of checks read and written.\n"
+	         "np_executor_state_bytes_total{op=\"read\"} %llu\n"
+	         "np_executor_state_bytes_total{op=\"write\"} %llu\n",
+	         total.state_bytes_read, total.state_bytes_written);
+	fprintf (out, "# TYPE np_executor_state_seconds counter\n"
+	         "# UNIT np_executor_state_seconds seconds\n"
+	         "# HELP np_executor_state_seconds Time spent reading and writing the state of checks.\n"
+	         "np_executor_state_seconds_total{op=\"read\"} %.6f\n"
+	         "np_executor_state_seconds_total{op=\"write\"} %.6f\n",
+	         total.state_read_seconds, total.state_write_seconds);
+
+	fprintf (out, "# TYPE np_executor_worker_cpu_seconds counter\n"
+	         "# UNIT np_executor_worker_cpu_seconds seconds\n"
+	         "# HELP np_executor_worker_cpu_seconds CPU time of a worker running now.\n");
+	for (i = 0; i < nworkers; i++)
+		if (w[i].pid != 0)
+			fprintf (out, "np_executor_worker_cpu_seconds_total{worker=\"%ld\",mode=\"user\"} %.6f\n"
+			         "np_executor_worker_cpu_seconds_total{worker=\"%ld\",mode=\"system\"} %.6f\n",
+			         (long) w[i].pid, w[i].user, (long) w[i].pid, w[i].system);
+	fprintf (out, "# TYPE np_executor_cpu_seconds counter\n"
+	         "# UNIT np_executor_cpu_seconds seconds\n"
+	         "# HELP np_executor_cpu_seconds CPU time of all the workers, the ones that exited too.\n"
+	         "np_executor_cpu_seconds_total{mode=\"user\"} %.6f\n"
+	         "np_executor_cpu_seconds_total{mode=\"system\"} %.6f\n",
+	         user + live_user, system + live_system);
+	fputs ("# EOF\n", out);
+
+	free (w);
+}
+
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
+{
+	int c;
+	int option = 0;
+	static struct option longopts[] = {
+		{"socket", required_argument, 0, 's'},
+		{"workers", required_argument, 0, 'w'},
+		{"max-requests", required_argument, 0, 'm'},
+		{"list", no_argument, 0, 'l'},
+		{"framed", no_argument, 0, 'f'},
+		{"zygote", no_argument, 0, 'z'},
+		{"max-per-target", required_argument, 0, 't'},
+		{"max-per-plugin", required_argument, 0, 'p'},
+		{"blocking-workers", required_argument, 0, 'b'},
+		{"coalesce", no_argument, 0, 'c'},
+		{"result-ttl", required_argument, 0, 'r'},
+		{"metrics", required_argument, 0, 'M'},
+		{"verbose", no_argument, 0, 'v'},
+		{"version", no_argument, 0, 'V'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while (1) {
+		c = getopt_long (argc, argv, "hVvlfzcs:w:m:t:p:b:r:M:", longopts, &option);
+
+		if (c == -1 || c == EOF)
+			break;
+
+		switch (c) {
+		case '?':									/* print short usage statement if args not parsable */
+			usage5 ();
+		case 'h':									/* help */
+			print_help ();
+			exit (STATE_UNKNOWN);
+		case 'V':									/* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_UNKNOWN);
+		case 'v':									/* verbose */
+			verbose++;
+			break;
+		case 'l':									/* list entry points */
+			list_entries = TRUE;
+			break;
+		case 'f':									/* binary responses */
+			framed = TRUE;
+			break;
+		case 'z':									/* fork a child per request */
+			zygote = TRUE;
+			break;
+		case 't':									/* checks against one host at once */
+			if (!is_intpos (optarg))
+				usage2 (_("Max per target must be a positive integer"), optarg);
+			max_per_target = atoi (optarg);
+			break;
+		case 'p':									/* checks of one plugin at once */
+			if (!is_intpos (optarg))
+				usage2 (_("Max per plugin must be a positive integer"), optarg);
+			max_per_plugin = atoi (optarg);
+			break;
+		case 'b':									/* workers for blocking entries */
+			if (!is_intpos (optarg))
+				usage2 (_("Blocking workers must be a positive integer"), optarg);
+			blocking_workers = atoi (optarg);
+			break;
+		case 'c':									/* share the run of the same request */
+			coalesce = TRUE;
+			break;
+		case 'r':									/* and its response for so long */
+			if (!is_nonnegative (optarg))
+				usage2 (_("Result TTL must be a non-negative number of seconds"), optarg);
+			result_ttl = strtod (optarg, NULL);
+			coalesce = TRUE;
+			break;
+		case 'M':									/* socket for the metrics */
+			metrics_path = optarg;
+			break;
+		case 's':									/* socket path */
+			socket_path = optarg;
+			break;
+		case 'w':									/* workers */
+			if (!is_intpos (optarg))
+				usage2 (_("Workers must be a positive integer"), optarg);
+			workers = atoi (optarg);
+			break;
+		case 'm':									/* max requests per worker */
+			if (!is_intpos (optarg))
+				usage2 (_("Max requests must be a positive integer"), optarg);
+			max_requests = atoi (optarg);
+			break;
+		}
+	}
+
+	if (list_entries)
+		return OK;
+
+	if (zygote && (max_per_target || max_per_plugin || blocking_workers || coalesce))
+		usage4 (_("--zygote cannot be combined with limits, blocking workers or coalescing"));
+
+	if (socket_path == NULL)
+		usage4 (_("A socket path must be specified"));
+	if (metrics_path != NULL && strcmp (metrics_path, socket_path) == 0)
+		usage4 (_("The metrics need a socket of their own"));
+
+	if (workers == 0) {
+		workers = GET_NUMBER_OF_CPUS ();
+		if (workers <= 0)
+			workers = DEFAULT_WORKERS;
+	}
+
+	return OK;
+}
+
+void
+print_help (void)
+{
+	print_revision (progname, NP_VERSION);
+
+	printf (COPYRIGHT, copyright, email);
+
+	printf ("%s\n", _("This program runs plugin checks in-process on behalf of clients connecting"));
+	printf ("%s\n", _("to a Unix socket, saving the process startup cost of every check."));
+
+	printf ("\n\n");
+
+	print_usage ();
+
+	printf (UT_HELP_VRSN);
+
+	printf (" %s\n", "-s, --socket=PATH");
+	printf ("    %s\n", _("Unix socket to listen on for check requests"));
+	printf (" %s\n", "-w, --workers=INTEGER");
+	printf ("    %s\n", _("Number of worker processes, or with --zygote of checks run at once"));
+	printf ("    %s\n", _("(default: number of CPUs)"));
+	printf (" %s\n", "-m, --max-requests=INTEGER");
+	printf ("    %s (%s: %d)\n", _("Checks a worker runs before it is replaced"),
+	        _("default"), DEFAULT_MAX_REQUESTS);
+	printf (" %s\n", "-t, --max-per-target=INTEGER");
+	printf ("    %s\n", _("Checks run at once against the host given to a check with -H"));
+	printf (" %s\n", "-p, --max-per-plugin=INTEGER");
+	printf ("    %s\n", _("Checks run at once of any one plugin"));
+	printf (" %s\n", "-b, --blocking-workers=INTEGER");
+	printf ("    %s\n", _("Workers of their own for the plugins that wait on commands they run"));
+	printf (" %s\n", "-c, --coalesce");
+	printf ("    %s\n", _("Run a request made again while it runs once, answering all who made it"));
+	printf (" %s\n", "-r, --result-ttl=SECONDS");
+	printf ("    %s\n", _("Answer the same request with that response for so long after (implies -c)"));
+	printf (" %s\n", "-z, --zygote");
+	printf ("    %s\n", _("Fork a child of an initialised master for every check instead"));
+	printf (" %s\n", "-M, --metrics=PATH");
+	printf ("    %s\n", _("Unix socket to serve what the workers do on, in the OpenMetrics format"));
+	printf (" %s\n", "-f, --framed");
+	printf ("    %s\n", _("Respond with a binary record of the result instead of the text"));
+	printf (" %s\n", "-l, --list");
+	printf ("    %s\n", _("List the plugins that can be run and exit"));
+	printf (UT_VERBOSE);
+
+	printf ("\n");
+	printf ("%s\n", _("Notes:"));
+	printf (" %s\n", _("A request is a single line holding the plugin name followed by its"));
+	printf (" %s\n", _("arguments, separated by white space. Use single quotes around arguments"));
+	printf (" %s\n", _("that contain white space. The response is the plugin's return code on a"));
+	printf (" %s\n", _("line of its own followed by the plugin's output, after which the"));
+	printf (" %s\n", _("connection is closed."));
+	printf (" %s\n", _("With --framed, the response is a record of the state, the start time and"));
+	printf (" %s\n", _("duration, the output without the perfdata, and the perfdata as numbers"));
+	printf (" %s\n", _("and ranges, as laid out in lib/utils_frame.h."));
+	printf (" %s\n", _("With --metrics, a client connecting to that socket is sent the queue"));
+	printf (" %s\n", _("depth, the checks running of every plugin and against every host, the"));
+	printf (" %s\n", _("time of the checks of every plugin and of the spans --timing-perfdata"));
+	printf (" %s\n", _("shows in them, coalesced requests, pooled connections, state file I/O and"));
+	printf (" %s\n", _("the CPU time of the workers. The figures of a worker are those of the"));
+	printf (" %s\n", _("last request it ran, and reading them never holds up a check."));
+	printf (" %s\n", _("Called as one of the listed plugins, through a link to this program, or"));
+	printf (" %s\n", _("with the name of a plugin as its first argument, it runs that plugin"));
+	printf (" %s\n", _("directly instead."));
+	printf ("\n");
+	printf ("%s\n", _("Examples:"));
+	printf (" %s\n", "np-executor -s /run/np-executor.sock -w 8 -M /run/np-executor.metrics");
+	printf (" %s\n", "echo \"check_tcp -H localhost -p 22\" | socat - UNIX-CONNECT:/run/np-executor.sock");
+	printf (" %s\n", "np-executor check_tcp -H localhost -p 22");
+	printf (" %s\n", "socat - UNIX-CONNECT:/run/np-executor.metrics");
+
+	printf (UT_SUPPORT);
+}
+
+void
+print_usage (void)
+{
+	/* usage() and friends from utils.c end up here while a check runs */
+	if (current_entry != NULL) {
+		current_entry->print_usage ();
+		return;
+	}
+
+	printf ("%s\n", _("Usage:"));
+	printf ("%s -s <socket> [-w <workers>] [-m <max requests>] [-t <max per target>]\n", progname);
+	printf ("  [-p <max per plugin>] [-b <blocking workers>] [-c] [-r <result ttl>] [-z] [-f]\n");
+	printf ("  [-M <metrics socket>] [-v]\n");
+	printf ("%s -l\n", progname);
+	printf ("%s <plugin> [plugin arguments]\n", progname);
+}
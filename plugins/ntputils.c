@@ -0,0 +1,500 @@
+/*****************************************************************************
+*
+* Monitoring Plugins NTP utilities
+*
+* License: GPL
+* Copyright (c) 2006 Sean Finney <seanius@seanius.net>
+* Copyright (c) 2006-2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* The NTP client and control message code shared by check_ntp,
+* check_ntp_time and check_ntp_peer.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils.h"
+#include "netutils.h"
+#include "ntputils.h"
+
+/* calculate the offset of the local clock */
+double np_ntp_calc_offset(const ntp_message *m, const struct timeval *t){
+	double client_tx, peer_rx, peer_tx, client_rx;
+	client_tx = NTP64asDOUBLE(m->origts);
+	peer_rx = NTP64asDOUBLE(m->rxts);
+	peer_tx = NTP64asDOUBLE(m->txts);
+	client_rx=TVasDOUBLE((*t));
+	return (.5*((peer_tx-client_rx)+(peer_rx-client_tx)));
+}
+
+/* print out a ntp packet in human readable/debuggable format */
+void np_ntp_print_message(const ntp_message *p){
+	struct timeval ref, orig, rx, tx;
+
+	NTP64toTV(p->refts,ref);
+	NTP64toTV(p->origts,orig);
+	NTP64toTV(p->rxts,rx);
+	NTP64toTV(p->txts,tx);
+
+	printf("packet contents:\n");
+	printf("\tflags: 0x%.2x\n", p->flags);
+	printf("\t  li=%d (0x%.2x)\n", LI(p->flags), p->flags&LI_MASK);
+	printf("\t  vn=%d (0x%.2x)\n", VN(p->flags), p->flags&VN_MASK);
+	printf("\t  mode=%d (0x%.2x)\n", MODE(p->flags), p->flags&MODE_MASK);
+	printf("\tstratum = %d\n", p->stratum);
+	printf("\tpoll = %g\n", pow(2, p->poll));
+	printf("\tprecision = %g\n", pow(2, p->precision));
+	printf("\trtdelay = %-.16g\n", NTP32asDOUBLE(p->rtdelay));
+	printf("\trtdisp = %-.16g\n", NTP32asDOUBLE(p->rtdisp));
+	printf("\trefid = %x\n", p->refid);
+	printf("\trefts = %-.16g\n", NTP64asDOUBLE(p->refts));
+	printf("\torigts = %-.16g\n", NTP64asDOUBLE(p->origts));
+	printf("\trxts = %-.16g\n", NTP64asDOUBLE(p->rxts));
+	printf("\ttxts = %-.16g\n", NTP64asDOUBLE(p->txts));
+}
+
+void np_ntp_print_control_message(const ntp_control_message *p){
+	int i=0, numpeers=0;
+	const ntp_assoc_status_pair *peer=NULL;
+
+	printf("control packet contents:\n");
+	printf("\tflags: 0x%.2x , 0x%.2x\n", p->flags, p->op);
+	printf("\t  li=%d (0x%.2x)\n", LI(p->flags), p->flags&LI_MASK);
+	printf("\t  vn=%d (0x%.2x)\n", VN(p->flags), p->flags&VN_MASK);
+	printf("\t  mode=%d (0x%.2x)\n", MODE(p->flags), p->flags&MODE_MASK);
+	printf("\t  response=%d (0x%.2x)\n", (p->op&REM_RESP)>0, p->op&REM_RESP);
+	printf("\t  more=%d (0x%.2x)\n", (p->op&REM_MORE)>0, p->op&REM_MORE);
+	printf("\t  error=%d (0x%.2x)\n", (p->op&REM_ERROR)>0, p->op&REM_ERROR);
+	printf("\t  op=%d (0x%.2x)\n", p->op&OP_MASK, p->op&OP_MASK);
+	printf("\tsequence: %d (0x%.2x)\n", ntohs(p->seq), ntohs(p->seq));
+	printf("\tstatus: %d (0x%.2x)\n", ntohs(p->status), ntohs(p->status));
+	printf("\tassoc: %d (0x%.2x)\n", ntohs(p->assoc), ntohs(p->assoc));
+	printf("\toffset: %d (0x%.2x)\n", ntohs(p->offset), ntohs(p->offset));
+	printf("\tcount: %d (0x%.2x)\n", ntohs(p->count), ntohs(p->count));
+	numpeers=ntohs(p->count)/(sizeof(ntp_assoc_status_pair));
+	if(p->op&REM_RESP && p->op&OP_READSTAT){
+		peer=(ntp_assoc_status_pair*)p->data;
+		for(i=0;i<numpeers;i++){
+			printf("\tpeer id %.2x status %.2x",
+			       ntohs(peer[i].assoc), ntohs(peer[i].status));
+			if(PEER_SEL(peer[i].status) >= PEER_SYNCSOURCE){
+				printf(" <-- current sync source");
+			} else if(PEER_SEL(peer[i].status) >= PEER_INCLUDED){
+				printf(" <-- current sync candidate");
+			} else if(PEER_SEL(peer[i].status) >= PEER_TRUECHIMER){
+				printf(" <-- outlyer, but truechimer");
+			}
+			printf("\n");
+		}
+	}
+}
+
+void np_ntp_setup_request(ntp_message *p){
+	struct timeval t;
+
+	memset(p, 0, sizeof(ntp_message));
+	LI_SET(p->flags, LI_ALARM);
+	VN_SET(p->flags, 4);
+	MODE_SET(p->flags, MODE_CLIENT);
+	p->poll=4;
+	p->precision=(int8_t)0xfa;
+	L16(p->rtdelay)=htons(1);
+	L16(p->rtdisp)=htons(1);
+
+	gettimeofday(&t, NULL);
+	TVtoNTP64(t,p->txts);
+}
+
+void np_ntp_setup_control_request(ntp_control_message *p, uint8_t opcode, uint16_t seq){
+	memset(p, 0, sizeof(ntp_control_message));
+	LI_SET(p->flags, LI_NOWARNING);
+	VN_SET(p->flags, VN_RESERVED);
+	MODE_SET(p->flags, MODE_CONTROLMSG);
+	OP_SET(p->op, opcode);
+	p->seq = htons(seq);
+	/* Remaining fields are zero for requests */
+}
+
+/* select the "best" server from a list of servers, and return its index.
+ * this is done by filtering servers based on stratum, dispersion, and
+ * finally round-trip delay. */
+int np_ntp_best_server(const ntp_server_results *slist, int nservers, int verbose){
+	int cserver=0, best_server=-1;
+
+	/* for each server */
+	for(cserver=0; cserver<nservers; cserver++){
+		/* We don't want any servers that fails these tests */
+		/* Sort out servers that didn't respond or responede with a 0 stratum;
+		 * stratum 0 is for reference clocks so no NTP server should ever report
+		 * a stratum 0 */
+		if ( slist[cserver].stratum == 0){
+			if (verbose) printf("discarding peer %d: stratum=%d\n", cserver, slist[cserver].stratum);
+			continue;
+		}
+		/* Sort out servers with error flags */
+		if ( LI(slist[cserver].flags) == LI_ALARM ){
+			if (verbose) printf("discarding peer %d: flags=%d\n", cserver, LI(slist[cserver].flags));
+			continue;
+		}
+
+		/* If we don't have a server yet, use the first one */
+		if (best_server == -1) {
+			best_server = cserver;
+			DBG(printf("using peer %d as our first candidate\n", best_server));
+			continue;
+		}
+
+		/* compare the server to the best one we've seen so far */
+		/* does it have an equal or better stratum? */
+		DBG(printf("comparing peer %d with peer %d\n", cserver, best_server));
+		if(slist[cserver].stratum <= slist[best_server].stratum){
+			DBG(printf("stratum for peer %d <= peer %d\n", cserver, best_server));
+			/* does it have an equal or better dispersion? */
+			if(slist[cserver].rtdisp <= slist[best_server].rtdisp){
+				DBG(printf("dispersion for peer %d <= peer %d\n", cserver, best_server));
+				/* does it have a better rtdelay? */
+				if(slist[cserver].rtdelay < slist[best_server].rtdelay){
+					DBG(printf("rtdelay for peer %d < peer %d\n", cserver, best_server));
+					best_server = cserver;
+					DBG(printf("peer %d is now our best candidate\n", best_server));
+				}
+			}
+		}
+	}
+
+	if(best_server >= 0) {
+		DBG(printf("best server selected: peer %d\n", best_server));
+		return best_server;
+	} else {
+		DBG(printf("no peers meeting synchronization criteria :(\n"));
+		return -1;
+	}
+}
+
+/* Read a reply, with the time it arrived as the kernel stamped it if the
+ * socket was set up with SO_TIMESTAMP, which keeps our own scheduling
+ * delay out of the offset. */
+ssize_t np_ntp_recv_reply(int fd, ntp_message *m, struct timeval *t){
+#ifdef SO_TIMESTAMP
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(struct timeval))];
+	} control;
+	ssize_t len;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base=m;
+	iov.iov_len=sizeof(ntp_message);
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control.buf;
+	msg.msg_controllen=sizeof(control.buf);
+
+	len=recvmsg(fd, &msg, 0);
+	gettimeofday(t, NULL);
+	for(cmsg=CMSG_FIRSTHDR(&msg); len>0 && cmsg; cmsg=CMSG_NXTHDR(&msg, cmsg)){
+		if(cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_TIMESTAMP){
+			memcpy(t, CMSG_DATA(cmsg), sizeof(struct timeval));
+			break;
+		}
+	}
+	return len;
+#else
+	ssize_t len=read(fd, m, sizeof(ntp_message));
+	gettimeofday(t, NULL);
+	return len;
+#endif
+}
+
+int np_ntp_readstat(int conn, ntp_assoc_status_pair **peers, int *li_alarm, int verbose){
+	ntp_control_message req;
+	int peers_size=0, peer_offset=0;
+	void *tmp;
+
+	*peers=NULL;
+	*li_alarm=0;
+	do{
+		np_ntp_setup_control_request(&req, OP_READSTAT, 1);
+		DBG(printf("sending READSTAT request"));
+		write(conn, &req, SIZEOF_NTPCM(req));
+		DBG(np_ntp_print_control_message(&req));
+
+		/* replies to anything asked before on this port are dropped */
+		do {
+			/* Attempt to read the largest size packet possible */
+			req.count=htons(MAX_CM_SIZE);
+			DBG(printf("receiving READSTAT response"))
+			if(read(conn, &req, SIZEOF_NTPCM(req)) == -1)
+				die(STATE_CRITICAL, "NTP CRITICAL: No response from NTP server\n");
+			DBG(np_ntp_print_control_message(&req));
+			/* discard obviously invalid packets */
+			if (ntohs(req.count) > MAX_CM_SIZE)
+				die(STATE_CRITICAL, "NTP CRITICAL: Invalid packet received from NTP server\n");
+		} while (!(MODE(req.flags)==MODE_CONTROLMSG && req.op&OP_READSTAT && ntohs(req.seq) == 1));
+
+		if (LI(req.flags) == LI_ALARM) *li_alarm = 1;
+		/* Each peer identifier is 4 bytes in the data section, which
+		 * we represent as a ntp_assoc_status_pair datatype.
+		 */
+		peers_size+=ntohs(req.count);
+		if((tmp=realloc(*peers, peers_size)) == NULL)
+			free(*peers), die(STATE_UNKNOWN, "can not (re)allocate 'peers' buffer\n");
+		*peers=tmp;
+		memcpy((void*)((ptrdiff_t)*peers+peer_offset), (void*)req.data, ntohs(req.count));
+		peer_offset+=ntohs(req.count);
+	} while(req.op&REM_MORE);
+
+	return peers_size/sizeof(ntp_assoc_status_pair);
+}
+
+/* with --adaptive, a server is settled once its last ADAPTIVE_SAMPLES
+ * offsets are no further than stable_spread apart */
+static int server_settled(const ntp_server_results *s, double stable_spread){
+	double lo, hi;
+	int i;
+
+	if(s->num_responses < ADAPTIVE_SAMPLES) return 0;
+	lo=hi=s->offset[s->num_responses-1];
+	for(i=s->num_responses-ADAPTIVE_SAMPLES; i<s->num_responses; i++){
+		if(s->offset[i]<lo) lo=s->offset[i];
+		if(s->offset[i]>hi) hi=s->offset[i];
+	}
+	return hi-lo <= stable_spread;
+}
+
+/* do everything we need to get the total average offset of every host
+ * - we use a certain amount of parallelization with poll() to ensure
+ *   we don't waste time sitting around waiting for single packets.
+ * - we also "manually" handle resolving host names and connecting, because
+ *   we have to do it in a way that our lazy macros don't handle currently :(
+ * - with adaptive, every server gets its next request as soon as it has
+ *   answered, and a host is done once a quorum of its servers has settled
+ *   and the best of them is among those. */
+void np_ntp_offset(const np_ntp_probe *probe, np_ntp_host *hosts, int nhosts){
+	int i=0, h=0, ga_result=0, num_servers=0, respnum=0, best=0;
+	int hosts_done=0, servers_readable=0, settled=0, need=0, on=1;
+	int *first=NULL, *pending=NULL, *done=NULL, *owner=NULL;
+	int verbose=probe->verbose;
+	time_t now_time=0, start_ts=0;
+	char port_str[8];
+	struct timeval recv_time;
+	struct addrinfo *ai=NULL, *ai_tmp=NULL, hints;
+	struct pollfd *ufds=NULL;
+	ntp_server_results *servers=NULL, *s;
+	np_ntp_host *host;
+
+	/* setup hints to only return results from getaddrinfo that we'd like */
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = address_family;
+	hints.ai_protocol = IPPROTO_UDP;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	first=(int*)calloc(nhosts, sizeof(int));
+	pending=(int*)calloc(nhosts, sizeof(int));
+	done=(int*)calloc(nhosts, sizeof(int));
+	if(first==NULL || pending==NULL || done==NULL)
+		die(STATE_UNKNOWN, "can not allocate host arrays");
+
+	/* every address of every host is a server of its own */
+	for(h=0; h<nhosts; h++){
+		host=&hosts[h];
+		host->num_servers=host->responded=0;
+		host->best=-1;
+		host->offset=0.;
+		host->result=STATE_UNKNOWN;
+		host->message=NULL;
+		first[h]=num_servers;
+
+		snprintf(port_str, sizeof(port_str), "%d", host->port);
+		ga_result = getaddrinfo(host->name, port_str, &hints, &ai);
+		if(ga_result!=0){
+			xasprintf(&host->message, "error getting address for %s: %s",
+			          host->name, gai_strerror(ga_result));
+			done[h]=1;
+			hosts_done++;
+			continue;
+		}
+
+		for(ai_tmp=ai; ai_tmp!=NULL; ai_tmp=ai_tmp->ai_next){
+			servers=(ntp_server_results*)realloc(servers, sizeof(ntp_server_results)*(num_servers+1));
+			owner=(int*)realloc(owner, sizeof(int)*(num_servers+1));
+			if(servers==NULL || owner==NULL) die(STATE_UNKNOWN, "can not allocate server array");
+			s=&servers[num_servers];
+			memset(s, 0, sizeof(ntp_server_results));
+			owner[num_servers]=h;
+
+			s->fd=socket(ai_tmp->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+			if(s->fd == -1) {
+				perror(NULL);
+				die(STATE_UNKNOWN, "can not create new socket");
+			}
+			if(connect(s->fd, ai_tmp->ai_addr, ai_tmp->ai_addrlen)){
+				/* don't die here, because it is enough if there is one server
+				   answering in time. This also would break for dual ipv4/6 stacked
+				   ntp servers when the client only supports on of them.
+				 */
+				DBG(printf("can't create socket connection on %s peer %i: %s\n", host->name, host->num_servers, strerror(errno)));
+				close(s->fd);
+				s->fd=-1;
+			} else {
+#ifdef SO_TIMESTAMP
+				if(setsockopt(s->fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)))
+					DBG(printf("no kernel receive timestamps on %s peer %i: %s\n", host->name, host->num_servers, strerror(errno)));
+#endif
+				pending[h]++;
+			}
+			host->num_servers++;
+			num_servers++;
+		}
+		freeaddrinfo(ai);
+		if(pending[h]==0){
+			done[h]=1;
+			hosts_done++;
+		}
+		DBG(printf("Found %d peers to check for %s\n", host->num_servers, host->name));
+	}
+
+	ufds=(struct pollfd*)calloc(num_servers ? num_servers : 1, sizeof(struct pollfd));
+	if(ufds==NULL) die(STATE_UNKNOWN, "can not allocate socket array");
+	for(i=0; i<num_servers; i++){
+		ufds[i].fd=servers[i].fd;
+		ufds[i].events=POLLIN;
+	}
+
+	/* now do AVG_NUM checks to each host. We stop before timeout/2 seconds
+	 * have passed in order to ensure post-processing and jitter time. */
+	now_time=start_ts=time(NULL);
+	while(hosts_done<nhosts && now_time-start_ts <= probe->timeout/2){
+		/* loop through each server and find each one which hasn't
+		 * been touched in the past second or so and is still lacking
+		 * some responses. For each of these servers, send a new request,
+		 * and update the "waiting" timestamp with the current time.
+		 * Without adaptive, that is one server of each host at a time. */
+		now_time=time(NULL);
+
+		for(h=0; h<nhosts; h++){
+			for(i=first[h]; !done[h] && i<first[h]+hosts[h].num_servers; i++){
+				s=&servers[i];
+				if(s->fd>=0 && s->waiting<now_time && s->num_responses<AVG_NUM){
+					if(verbose && s->waiting != 0) printf("re-");
+					if(verbose) printf("sending request to %s peer %d\n", hosts[h].name, i-first[h]);
+					np_ntp_setup_request(&s->req);
+					write(s->fd, &s->req, sizeof(ntp_message));
+					s->waiting=now_time;
+					if(!probe->adaptive) break;
+				}
+			}
+		}
+
+		/* quickly poll for any sockets with pending data */
+		servers_readable=poll(ufds, num_servers, 100);
+		if(servers_readable==-1){
+			perror("polling ntp sockets");
+			die(STATE_UNKNOWN, "communication errors");
+		}
+
+		/* read from any sockets with pending data */
+		for(i=0; servers_readable && i<num_servers; i++){
+			s=&servers[i];
+			h=owner[i];
+			if(ufds[i].revents&POLLIN && s->num_responses < AVG_NUM){
+				if(verbose) {
+					printf("response from %s peer %d: ", hosts[h].name, i-first[h]);
+				}
+
+				np_ntp_recv_reply(s->fd, &s->req, &recv_time);
+				DBG(np_ntp_print_message(&s->req));
+				respnum=s->num_responses++;
+				s->offset[respnum]=np_ntp_calc_offset(&s->req, &recv_time)+probe->time_offset;
+				if(verbose) {
+					printf("offset %.10g\n", s->offset[respnum]);
+				}
+				s->stratum=s->req.stratum;
+				s->rtdisp=NTP32asDOUBLE(s->req.rtdisp);
+				s->rtdelay=NTP32asDOUBLE(s->req.rtdelay);
+				s->waiting=0;
+				s->flags=s->req.flags;
+				servers_readable--;
+				hosts[h].responded=1;
+				if(s->num_responses==AVG_NUM && --pending[h]==0 && !done[h]){
+					done[h]=1;
+					hosts_done++;
+				}
+			}
+		}
+
+		/* the best server could still be one that is not settled yet */
+		for(h=0; probe->adaptive && h<nhosts; h++){
+			if(done[h]) continue;
+			for(i=first[h], settled=0; i<first[h]+hosts[h].num_servers; i++)
+				settled+=server_settled(&servers[i], probe->stable_spread);
+			need=probe->quorum<hosts[h].num_servers ? probe->quorum : hosts[h].num_servers;
+			if(settled>=need){
+				best=np_ntp_best_server(&servers[first[h]], hosts[h].num_servers, verbose);
+				if(best>=0 && server_settled(&servers[first[h]+best], probe->stable_spread)){
+					if(verbose)
+						printf("%d of %d peers of %s settled\n", settled, hosts[h].num_servers, hosts[h].name);
+					done[h]=1;
+					hosts_done++;
+				}
+			}
+		}
+		/* lather, rinse, repeat. */
+	}
+
+	/* now, pick the best server of each host */
+	for(h=0; h<nhosts; h++){
+		host=&hosts[h];
+		if(host->message!=NULL)
+			continue;
+		if(!host->responded){
+			host->result=STATE_CRITICAL;
+			host->message=strdup("No response from NTP server");
+			continue;
+		}
+		host->best=np_ntp_best_server(&servers[first[h]], host->num_servers, verbose);
+		if(host->best<0){
+			host->message=strdup("No server meeting synchronization criteria");
+			continue;
+		}
+		/* finally, calculate the average offset */
+		s=&servers[first[h]+host->best];
+		for(i=0; i<s->num_responses; i++){
+			host->offset+=s->offset[i];
+		}
+		host->offset/=s->num_responses;
+		host->stratum=s->stratum;
+		host->rtdelay=s->rtdelay;
+		host->rtdisp=s->rtdisp;
+		host->result=STATE_OK;
+		if(verbose) printf("overall average offset of %s: %.10g\n", host->name, host->offset);
+	}
+
+	/* cleanup */
+	for(i=0; i<num_servers; i++){ if(servers[i].fd>=0) close(servers[i].fd); }
+	free(servers);
+	free(owner);
+	free(ufds);
+	free(first);
+	free(pending);
+	free(done);
+}
@@ -0,0 +1,243 @@
+/*****************************************************************************
+*
+* Monitoring Plugins NTP utilities include file
+*
+* License: GPL
+* Copyright (c) 2006 Sean Finney <seanius@seanius.net>
+* Copyright (c) 2006-2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* The NTP packet formats and the client and control message code shared by
+* check_ntp, check_ntp_time and check_ntp_peer, with an engine that takes
+* the offset of many hosts, and of every address of each, in one poll loop.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef _NTPUTILS_H_
+#define _NTPUTILS_H_
+
+#include "common.h"
+#include <sys/time.h>
+
+/* number of times to perform each request to get a good average. */
+#ifndef AVG_NUM
+#define AVG_NUM 4
+#endif
+
+/* samples that must agree before --adaptive takes a server as settled */
+#ifndef ADAPTIVE_SAMPLES
+#define ADAPTIVE_SAMPLES 3
+#endif
+
+/* max size of control message data */
+#define MAX_CM_SIZE 468
+
+/* this structure holds everything in an ntp request/response as per rfc1305 */
+typedef struct {
+	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
+	uint8_t stratum;     /* clock stratum */
+	int8_t poll;         /* polling interval */
+	int8_t precision;    /* precision of the local clock */
+	int32_t rtdelay;     /* total rt delay, as a fixed point num. see macros */
+	uint32_t rtdisp;     /* like above, but for max err to primary src */
+	uint32_t refid;      /* ref clock identifier */
+	uint64_t refts;      /* reference timestamp.  local time local clock */
+	uint64_t origts;     /* time at which request departed client */
+	uint64_t rxts;       /* time at which request arrived at server */
+	uint64_t txts;       /* time at which request departed server */
+} ntp_message;
+
+/* this structure holds everything in an ntp control message as per rfc1305 */
+typedef struct {
+	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
+	uint8_t op;          /* R,E,M bits and Opcode */
+	uint16_t seq;        /* Packet sequence */
+	uint16_t status;     /* Clock status */
+	uint16_t assoc;      /* Association */
+	uint16_t offset;     /* Similar to TCP sequence # */
+	uint16_t count;      /* # bytes of data */
+	char data[MAX_CM_SIZE]; /* ASCII data of the request */
+	                        /* NB: not necessarily NULL terminated! */
+} ntp_control_message;
+
+/* this is an association/status-word pair found in control packet reponses */
+typedef struct {
+	uint16_t assoc;
+	uint16_t status;
+} ntp_assoc_status_pair;
+
+/* bits 1,2 are the leap indicator */
+#define LI_MASK 0xc0
+#define LI(x) ((x&LI_MASK)>>6)
+#define LI_SET(x,y) do{ x |= ((y<<6)&LI_MASK); }while(0)
+/* and these are the values of the leap indicator */
+#define LI_NOWARNING 0x00
+#define LI_EXTRASEC 0x01
+#define LI_MISSINGSEC 0x02
+#define LI_ALARM 0x03
+/* bits 3,4,5 are the ntp version */
+#define VN_MASK 0x38
+#define VN(x)	((x&VN_MASK)>>3)
+#define VN_SET(x,y)	do{ x |= ((y<<3)&VN_MASK); }while(0)
+#define VN_RESERVED 0x02
+/* bits 6,7,8 are the ntp mode */
+#define MODE_MASK 0x07
+#define MODE(x) (x&MODE_MASK)
+#define MODE_SET(x,y)	do{ x |= (y&MODE_MASK); }while(0)
+/* here are some values */
+#define MODE_CLIENT 0x03
+#define MODE_CONTROLMSG 0x06
+/* In control message, bits 8-10 are R,E,M bits */
+#define REM_MASK 0xe0
+#define REM_RESP 0x80
+#define REM_ERROR 0x40
+#define REM_MORE 0x20
+/* In control message, bits 11 - 15 are opcode */
+#define OP_MASK 0x1f
+#define OP_SET(x,y)   do{ x |= (y&OP_MASK); }while(0)
+#define OP_READSTAT 0x01
+#define OP_READVAR  0x02
+/* In peer status bytes, bits 6,7,8 determine clock selection status */
+#define PEER_SEL(x) ((ntohs(x)>>8)&0x07)
+#define PEER_TRUECHIMER 0x02
+#define PEER_INCLUDED 0x04
+#define PEER_SYNCSOURCE 0x06
+
+/**
+ ** a note about the 32-bit "fixed point" numbers:
+ **
+ they are divided into halves, each being a 16-bit int in network byte order:
+ - the first 16 bits are an int on the left side of a decimal point.
+ - the second 16 bits represent a fraction n/(2^16)
+ likewise for the 64-bit "fixed point" numbers with everything doubled :)
+ **/
+
+/* macros to access the left/right 16 bits of a 32-bit ntp "fixed point"
+   number.  note that these can be used as lvalues too */
+#define L16(x) (((uint16_t*)&x)[0])
+#define R16(x) (((uint16_t*)&x)[1])
+/* macros to access the left/right 32 bits of a 64-bit ntp "fixed point"
+   number.  these too can be used as lvalues */
+#define L32(x) (((uint32_t*)&x)[0])
+#define R32(x) (((uint32_t*)&x)[1])
+
+/* ntp wants seconds since 1/1/00, epoch is 1/1/70.  this is the difference */
+#define EPOCHDIFF 0x83aa7e80UL
+
+/* extract a 32-bit ntp fixed point number into a double */
+#define NTP32asDOUBLE(x) (ntohs(L16(x)) + (double)ntohs(R16(x))/65536.0)
+
+/* likewise for a 64-bit ntp fp number */
+#define NTP64asDOUBLE(n) (double)(((uint64_t)n)?\
+                         (ntohl(L32(n))-EPOCHDIFF) + \
+                         (.00000001*(0.5+(double)(ntohl(R32(n))/42.94967296))):\
+                         0)
+
+/* convert a struct timeval to a double */
+#define TVasDOUBLE(x) (double)(x.tv_sec+(0.000001*x.tv_usec))
+
+/* convert an ntp 64-bit fp number to a struct timeval */
+#define NTP64toTV(n,t) \
+	do{ if(!n) t.tv_sec = t.tv_usec = 0; \
+	    else { \
+			t.tv_sec=ntohl(L32(n))-EPOCHDIFF; \
+			t.tv_usec=(int)(0.5+(double)(ntohl(R32(n))/4294.967296)); \
+		} \
+	}while(0)
+
+/* convert a struct timeval to an ntp 64-bit fp number */
+#define TVtoNTP64(t,n) \
+	do{ if(!t.tv_usec && !t.tv_sec) n=0x0UL; \
+		else { \
+			L32(n)=htonl(t.tv_sec + EPOCHDIFF); \
+			R32(n)=htonl((uint64_t)((4294.967296*t.tv_usec)+.5)); \
+		} \
+	} while(0)
+
+/* NTP control message header is 12 bytes, plus any data in the data
+ * field, plus null padding to the nearest 32-bit boundary per rfc.
+ */
+#define SIZEOF_NTPCM(m) (12+ntohs(m.count)+((ntohs(m.count)%4)?4-(ntohs(m.count)%4):0))
+
+/* finally, a little helper or two for debugging, with whatever verbose
+ * is where they are used: */
+#define DBG(x) do{if(verbose>1){ x; }}while(0);
+#define PRINTSOCKADDR(x) \
+	do{ \
+		printf("%u.%u.%u.%u", (x>>24)&0xff, (x>>16)&0xff, (x>>8)&0xff, x&0xff);\
+	}while(0);
+
+/* this structure holds data about results from querying offset from a peer,
+ * one address of a host given to np_ntp_offset() */
+typedef struct {
+	int fd;                 /* -1 if it could not be connected */
+	time_t waiting;         /* ts set when we started waiting for a response */
+	int num_responses;      /* number of successfully recieved responses */
+	uint8_t stratum;        /* copied verbatim from the ntp_message */
+	double rtdelay;         /* converted from the ntp_message */
+	double rtdisp;          /* converted from the ntp_message */
+	double offset[AVG_NUM]; /* offsets from each response */
+	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
+	ntp_message req;        /* the last request, and its reply */
+} ntp_server_results;
+
+/* a host whose offset np_ntp_offset() takes, and what it found */
+typedef struct np_ntp_host {
+	const char *name;
+	int port;
+	int num_servers;        /* the addresses it resolved to */
+	int responded;          /* TRUE once any of them answered */
+	int best;               /* the one used, -1 if none was fit */
+	double offset;          /* average of the best one */
+	uint8_t stratum;        /* and what it told about itself */
+	double rtdelay;
+	double rtdisp;
+	int result;             /* STATE_OK, or why there is no offset */
+	char *message;
+} np_ntp_host;
+
+/* how np_ntp_offset() asks */
+typedef struct np_ntp_probe {
+	int adaptive;           /* ask again as soon as answered, stop once settled */
+	int quorum;             /* addresses of a host that must settle */
+	double stable_spread;   /* seconds the last ADAPTIVE_SAMPLES may differ */
+	double time_offset;     /* added to every offset */
+	int timeout;            /* seconds, of which we use half */
+	int verbose;
+} np_ntp_probe;
+
+double np_ntp_calc_offset (const ntp_message *m, const struct timeval *t);
+void np_ntp_print_message (const ntp_message *p);
+void np_ntp_print_control_message (const ntp_control_message *p);
+void np_ntp_setup_request (ntp_message *p);
+void np_ntp_setup_control_request (ntp_control_message *p, uint8_t opcode, uint16_t seq);
+int np_ntp_best_server (const ntp_server_results *slist, int nservers, int verbose);
+ssize_t np_ntp_recv_reply (int fd, ntp_message *m, struct timeval *t);
+/* READSTAT over the connected socket until the server stops setting
+ * REM_MORE, returning the peers in *peers and their number, and in
+ * *li_alarm whether a reply had the leap indicator alarm set. */
+int np_ntp_readstat (int conn, ntp_assoc_status_pair **peers, int *li_alarm, int verbose);
+/* Take the offset of all hosts at once: every address of every host gets
+ * AVG_NUM requests, or with probe->adaptive as many as it takes for a
+ * quorum of them to settle, all in one poll loop over connected sockets
+ * with kernel receive timestamps. The best address of each host, by
+ * stratum, dispersion and delay, gives its offset. */
+void np_ntp_offset (const np_ntp_probe *probe, np_ntp_host *hosts, int nhosts);
+
+#endif /* _NTPUTILS_H_ */
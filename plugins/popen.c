@@ -13,6 +13,7 @@
 * 
 * FILE * spopen(const char *);
 * int spclose(FILE *);
+* int spopen_stderr(FILE *);
 * 
 * Code taken with liitle modification from "Advanced Programming for the Unix
 * Environment" by W. Richard Stevens
@@ -40,14 +41,17 @@
 
 #include "common.h"
 #include "utils.h"
+#include "utils_cmd.h"
 
-/* extern so plugin has pid to kill exec'd process on timeouts */
-extern pid_t *childpid;
-extern int *child_stderr_array;
 extern FILE *child_process;
 
+/* the children with their stdout and stderr, so the timeout handler can
+ * kill the exec'd process */
+static cmd_children spopen_children;
+
 FILE *spopen (const char *);
 int spclose (FILE *);
+int spopen_stderr (FILE *);
 #ifdef REDHAT_SPOPEN_ERROR
 RETSIGTYPE popen_sigchld_handler (int);
 #endif
@@ -177,19 +181,6 @@ spopen (const char *cmdstring)
 	}
 	argv[i] = NULL;
 
-	if(maxfd == 0)
-		maxfd = open_max();
-
-	if (childpid == NULL) {				/* first time through */
-		if ((childpid = calloc ((size_t)maxfd, sizeof (pid_t))) == NULL)
-			return (NULL);
-	}
-
-	if (child_stderr_array == NULL) {	/* first time through */
-		if ((child_stderr_array = calloc ((size_t)maxfd, sizeof (int))) == NULL)
-			return (NULL);
-	}
-
 	if (pipe (pfd) < 0)
 		return (NULL);							/* errno set by pipe() */
 
@@ -215,10 +206,8 @@ spopen (const char *cmdstring)
 			dup2 (pfderr[1], STDERR_FILENO);
 			close (pfderr[1]);
 		}
-		/* close all descriptors in childpid[] */
-		for (i = 0; i < maxfd; i++)
-			if (childpid[i] > 0)
-				close (i);
+		/* close the descriptors of the other children */
+		cmd_close_inherited (&spopen_children);
 
 		execve (argv[0], argv, env);
 		_exit (0);
@@ -229,8 +218,8 @@ spopen (const char *cmdstring)
 		return (NULL);
 	close (pfderr[1]);
 
-	childpid[fileno (child_process)] = pid;	/* remember child pid for this fd */
-	child_stderr_array[fileno (child_process)] = pfderr[0];	/* remember STDERR */
+	/* remember child pid and STDERR for this fd */
+	cmd_child_add (&spopen_children, fileno (child_process), pfderr[0], pid);
 	return (child_process);
 }
 
@@ -240,14 +229,10 @@ spclose (FILE * fp)
 	int fd, status;
 	pid_t pid;
 
-	if (childpid == NULL)
-		return (1);								/* popen() has never been called */
-
 	fd = fileno (fp);
-	if ((pid = childpid[fd]) == 0)
+	if ((pid = cmd_child_remove (&spopen_children, fd)) == 0)
 		return (1);								/* fp wasn't opened by popen() */
 
-	childpid[fd] = 0;
 	if (fclose (fp) == EOF)
 		return (1);
 
@@ -265,6 +250,17 @@ spclose (FILE * fp)
 	return (1);
 }
 
+/* the read end of the stderr of the child spopen() returned fp for */
+int
+spopen_stderr (FILE * fp)
+{
+	struct cmd_child *child;
+
+	if ((child = cmd_child_find (&spopen_children, fileno (fp))) == NULL)
+		return -1;
+	return child->err_fd;
+}
+
 #ifdef REDHAT_SPOPEN_ERROR
 RETSIGTYPE
 popen_sigchld_handler (int signo)
@@ -277,18 +273,18 @@ popen_sigchld_handler (int signo)
 RETSIGTYPE
 popen_timeout_alarm_handler (int signo)
 {
-	int fh;
+	struct cmd_child *child;
 	if (signo == SIGALRM) {
 		if (child_process != NULL) {
-			fh=fileno (child_process);
-			if(fh >= 0){
-				kill (childpid[fh], SIGKILL);
+			child = cmd_child_find (&spopen_children, fileno (child_process));
+			if(child != NULL){
+				kill (child->pid, SIGKILL);
 			}
 			printf (_("CRITICAL - Plugin timed out after %d seconds\n"),
 						timeout_interval);
 		} else {
 			printf ("%s\n", _("CRITICAL - popen timeout received, but no child process"));
 		}
-		exit (STATE_CRITICAL);
+		np_exit (STATE_CRITICAL);
 	}
 }
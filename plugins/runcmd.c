@@ -40,6 +40,7 @@
 
 /** includes **/
 #include "runcmd.h"
+#include "utils.h"
 #ifdef HAVE_SYS_WAIT_H
 # include <sys/wait.h>
 #endif
@@ -65,10 +66,10 @@
  *
  * The check for initialized values is atomic and can
  * occur in any number of threads simultaneously. */
-static pid_t *np_pids = NULL;
+static cmd_children np_children;
 
 /** prototypes **/
-static int np_runcmd_open(const char *, int *, int *)
+static int np_runcmd_open(const char *, int *, int *, int)
 	__attribute__((__nonnull__(1, 2, 3)));
 
 static int np_fetch_output(int, output *, int)
@@ -86,15 +87,13 @@ extern void die (int, const char *, ...)
  * through this api and thus achieve async-safeness throughout the api */
 void np_runcmd_init(void)
 {
-	if(maxfd == 0)
-		maxfd = open_max();
-	if(!np_pids) np_pids = calloc(maxfd, sizeof(pid_t));
+	if(!np_children.size) cmd_children_init(&np_children);
 }
 
 
 /* Start running a command */
 static int
-np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr)
+np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr, int flags)
 {
 	char *env[2];
 	char *cmd = NULL;
@@ -103,13 +102,10 @@ np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr)
 	int argc;
 	size_t cmdlen;
 	pid_t pid;
-#ifdef RLIMIT_CORE
-	struct rlimit limit;
-#endif
 
 	int i = 0;
 
-	if(!np_pids) NP_RUNCMD_INIT;
+	if(!np_children.size) NP_RUNCMD_INIT;
 
 	env[0] = strdup("LC_ALL=C");
 	env[1] = '\0';
@@ -169,46 +165,17 @@ np_runcmd_open(const char *cmdstring, int *pfd, int *pfderr)
 		argv[i++] = str;
 	}
 
-	if (pipe(pfd) < 0 || pipe(pfderr) < 0 || (pid = fork()) < 0)
+	if (pipe(pfd) < 0 || pipe(pfderr) < 0 ||
+	    (pid = cmd_spawn(argv, env, pfd, pfderr, &np_children, flags)) < 0)
 		return -1; /* errno set by the failing function */
 
-	/* child runs exceve() and _exit. */
-	if (pid == 0) {
-#ifdef 	RLIMIT_CORE
-		/* the program we execve shouldn't leave core files */
-		getrlimit (RLIMIT_CORE, &limit);
-		limit.rlim_cur = 0;
-		setrlimit (RLIMIT_CORE, &limit);
-#endif
-		close (pfd[0]);
-		if (pfd[1] != STDOUT_FILENO) {
-			dup2 (pfd[1], STDOUT_FILENO);
-			close (pfd[1]);
-		}
-		close (pfderr[0]);
-		if (pfderr[1] != STDERR_FILENO) {
-			dup2 (pfderr[1], STDERR_FILENO);
-			close (pfderr[1]);
-		}
-
-		/* close all descriptors in np_pids[]
-		 * This is executed in a separate address space (pure child),
-		 * so we don't have to worry about async safety */
-		for (i = 0; i < maxfd; i++)
-			if(np_pids[i] > 0)
-				close (i);
-
-		execve (argv[0], argv, env);
-		_exit (STATE_UNKNOWN);
-	}
-
 	/* parent picks up execution here */
 	/* close childs descriptors in our address space */
 	close(pfd[1]);
 	close(pfderr[1]);
 
 	/* tag our file's entry in the pid-list and return it */
-	np_pids[pfd[0]] = pid;
+	cmd_child_add(&np_children, pfd[0], pfderr[0], pid);
 
 	return pfd[0];
 }
@@ -221,10 +188,9 @@ np_runcmd_close(int fd)
 	pid_t pid;
 
 	/* make sure this fd was opened by popen() */
-	if(fd < 0 || fd > maxfd || !np_pids || (pid = np_pids[fd]) == 0)
+	if((pid = cmd_child_remove(&np_children, fd)) == 0)
 		return -1;
 
-	np_pids[fd] = 0;
 	if (close (fd) == -1) return -1;
 
 	/* EINTR is ok (sort of), everything else is bad */
@@ -239,88 +205,22 @@ np_runcmd_close(int fd)
 void
 runcmd_timeout_alarm_handler (int signo)
 {
-	size_t i;
-
 	if (signo == SIGALRM)
 		puts(_("CRITICAL - Plugin timed out while executing system call"));
 
-	if(np_pids) for(i = 0; i < maxfd; i++) {
-		if(np_pids[i] != 0) kill(np_pids[i], SIGKILL);
-	}
+	cmd_child_kill_all(&np_children, SIGKILL);
 
-	exit (STATE_CRITICAL);
+	np_exit (STATE_CRITICAL);
 }
 
 
+/* reading and splitting the output is shared with cmd_run() */
 static int
 np_fetch_output(int fd, output *op, int flags)
 {
-	size_t len = 0, i = 0, lineno = 0;
-	size_t rsf = 6, ary_size = 0; /* rsf = right shift factor, dec'ed uncond once */
-	char *buf = NULL;
-	int ret;
-	char tmpbuf[4096];
-
-	op->buf = NULL;
-	op->buflen = 0;
-	while((ret = read(fd, tmpbuf, sizeof(tmpbuf))) > 0) {
-		len = (size_t)ret;
-		op->buf = realloc(op->buf, op->buflen + len + 1);
-		memcpy(op->buf + op->buflen, tmpbuf, len);
-		op->buflen += len;
-		i++;
-	}
-
-	if(ret < 0) {
-		printf("read() returned %d: %s\n", ret, strerror(errno));
-		return ret;
-	}
-
-	/* some plugins may want to keep output unbroken, and some commands
-	 * will yield no output, so return here for those */
-	if(flags & RUNCMD_NO_ARRAYS || !op->buf || !op->buflen)
-		return op->buflen;
-
-	/* and some may want both */
-	if(flags & RUNCMD_NO_ASSOC) {
-		buf = malloc(op->buflen);
-		memcpy(buf, op->buf, op->buflen);
-	}
-	else buf = op->buf;
-
-	op->line = NULL;
-	op->lens = NULL;
-	i = 0;
-	while(i < op->buflen) {
-		/* make sure we have enough memory */
-		if(lineno >= ary_size) {
-			/* ary_size must never be zero */
-			do {
-				ary_size = op->buflen >> --rsf;
-			} while(!ary_size);
-
-			op->line = realloc(op->line, ary_size * sizeof(char *));
-			op->lens = realloc(op->lens, ary_size * sizeof(size_t));
-		}
-
-		/* set the pointer to the string */
-		op->line[lineno] = &buf[i];
-
-		/* hop to next newline or end of buffer */
-		while(buf[i] != '\n' && i < op->buflen) i++;
-		buf[i] = '\0';
-
-		/* calculate the string length using pointer difference */
-		op->lens[lineno] = (size_t)&buf[i] - (size_t)op->line[lineno];
-
-		lineno++;
-		i++;
-	}
-
-	return lineno;
+	return cmd_fetch_output(fd, op, flags);
 }
 
-
 int
 np_runcmd(const char *cmd, output *out, output *err, int flags)
 {
@@ -330,7 +230,7 @@ np_runcmd(const char *cmd, output *out, output *err, int flags)
 	if(out) memset(out, 0, sizeof(output));
 	if(err) memset(err, 0, sizeof(output));
 
-	if((fd = np_runcmd_open(cmd, pfd_out, pfd_err)) == -1)
+	if((fd = np_runcmd_open(cmd, pfd_out, pfd_err, flags)) == -1)
 		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), cmd);
 
 	if(out) out->lines = np_fetch_output(pfd_out[0], out, flags);
@@ -338,3 +238,25 @@ np_runcmd(const char *cmd, output *out, output *err, int flags)
 
 	return np_runcmd_close(fd);
 }
+
+/* np_runcmd() a line of stdout at a time, as cmd_run_array_lines() does:
+ * on_line gets each line as it arrives, and the command is killed and
+ * CMD_STOPPED returned once it returns non-zero */
+int
+np_runcmd_lines(const char *cmd, int (*on_line)(char *, void *), void *data,
+                output *err, int flags)
+{
+	int fd, pfd_out[2], pfd_err[2], stopped, result;
+
+	if(err) memset(err, 0, sizeof(output));
+
+	if((fd = np_runcmd_open(cmd, pfd_out, pfd_err, flags)) == -1)
+		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), cmd);
+
+	stopped = cmd_fetch_lines(pfd_out[0], pfd_err[0],
+	                          cmd_child_find(&np_children, fd)->pid,
+	                          on_line, data, err, flags);
+	close(pfd_err[0]);
+	result = np_runcmd_close(fd);
+	return stopped ? CMD_STOPPED : result;
+}
@@ -29,6 +29,7 @@
 
 /** prototypes **/
 int np_runcmd(const char *, output *, output *, int);
+int np_runcmd_lines(const char *, int (*)(char *, void *), void *, output *, int);
 void runcmd_timeout_alarm_handler(int)
 	__attribute__((__noreturn__));
 
@@ -39,5 +40,6 @@ void np_runcmd_init(void);
 /* possible flags for np_runcmd()'s fourth argument */
 #define RUNCMD_NO_ARRAYS 0x01 /* don't populate arrays at all */
 #define RUNCMD_NO_ASSOC 0x02  /* output.line won't point to buf */
+#define RUNCMD_FORK 0x04      /* start the command with fork(), not posix_spawn() */
 
 #endif /* NAGIOSPLUG_RUNCMD_H */
@@ -0,0 +1,824 @@
+/*****************************************************************************
+*
+* Monitoring Plugins SNMP utilities
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* This file contains the libnetsnmp request code shared by check_snmp and
+* check_hpjd: the library set up the way snmpget sets it up, one GET or
+* GETNEXT PDU for all OIDs, and errors worded the way snmpget prints them.
+* The response cache lets checks of the same agent share their answers.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils.h"
+#include "snmputils.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#ifdef HAVE_NETSNMP
+# include <net-snmp/library/lcd_time.h>
+
+static void
+append_error (char **errors, const char *fmt, const char *arg)
+{
+	char *line = NULL;
+
+	xasprintf (&line, fmt, arg);
+	xasprintf (errors, "%s%s", *errors ? *errors : "", line);
+	free (line);
+}
+
+/* same as "snmpget -Le -m mibs" */
+void
+np_snmp_init (const char *mibs)
+{
+	static int initialized = FALSE;
+
+	if (initialized)
+		return;
+	setenv ("MIBS", mibs, 1);
+	snmp_enable_stderrlog ();
+	init_snmp ("snmpapp");
+	initialized = TRUE;
+}
+
+/* Build the request for all oids. Returns NULL if one of them cannot be
+ * parsed. */
+netsnmp_pdu *
+np_snmp_pdu (int command, char **oids, int count, char **errors)
+{
+	netsnmp_pdu *pdu;
+	oid name[MAX_OID_LEN];
+	size_t name_length;
+	char *line = NULL;
+	int i, failures = 0;
+
+	pdu = snmp_pdu_create (command);
+	for (i = 0; i < count; i++) {
+		name_length = MAX_OID_LEN;
+		if (snmp_parse_oid (oids[i], name, &name_length) == NULL) {
+			xasprintf (&line, "%s: %s\n", oids[i], snmp_api_errstring (snmp_errno));
+			append_error (errors, "%s", line);
+			free (line);
+			line = NULL;
+			failures++;
+		} else
+			snmp_add_null_var (pdu, name, name_length);
+	}
+	if (failures) {
+		snmp_free_pdu (pdu);
+		return NULL;
+	}
+	return pdu;
+}
+
+/* Word what went wrong with a request. Returns 0 if nothing did. */
+int
+np_snmp_error (int status, netsnmp_session *ss, netsnmp_pdu *response, char **errors)
+{
+	netsnmp_variable_list *vars;
+	u_char *vbuf = NULL;
+	size_t vbuf_len = 0, vout_len = 0;
+	char *liberr = NULL;
+	int count;
+
+	if (status == STAT_SUCCESS && response->errstat == SNMP_ERR_NOERROR)
+		return 0;
+
+	if (status == STAT_SUCCESS) {
+		append_error (errors, "Error in packet\nReason: %s\n", snmp_errstring (response->errstat));
+		if (response->errindex != 0) {
+			for (count = 1, vars = response->variables;
+			     vars && count != response->errindex;
+			     vars = vars->next_variable, count++)
+				;
+			if (vars && sprint_realloc_objid (&vbuf, &vbuf_len, &vout_len, 1,
+			                                  vars->name, vars->name_length))
+				append_error (errors, "Failed object: %s\n", (char *) vbuf);
+			free (vbuf);
+		}
+		return 2;
+	}
+
+	if (status == STAT_TIMEOUT)
+		append_error (errors, "Timeout: No Response from %s.\n", ss->peername);
+	else {
+		snmp_error (ss, NULL, NULL, &liberr);
+		append_error (errors, "snmpget: %s\n", liberr);
+		free (liberr);
+	}
+	return 1;
+}
+
+/* Open a session, send one request for all oids and wait for the reply.
+ * *response is left for the caller to free if it is not NULL. */
+int
+np_snmp_get (netsnmp_session *session, int command, char **oids, int count,
+             netsnmp_pdu **response, char **errors)
+{
+	netsnmp_session *ss;
+	netsnmp_pdu *pdu;
+	char *liberr = NULL;
+	int status, ret;
+
+	*response = NULL;
+	if ((pdu = np_snmp_pdu (command, oids, count, errors)) == NULL)
+		return 1;
+
+	if ((ss = snmp_open (session)) == NULL) {
+		snmp_error (session, NULL, NULL, &liberr);
+		append_error (errors, "snmpget: %s\n", liberr);
+		free (liberr);
+		snmp_free_pdu (pdu);
+		return 1;
+	}
+
+	status = snmp_synch_response (ss, pdu, response);
+	ret = np_snmp_error (status, ss, *response, errors);
+	snmp_close (ss);
+	return ret;
+}
+
+void _get_monitoring_plugin (monitoring_plugin **);
+
+/* The engine of an agent is kept in a state of the plugin named after the
+ * agent and the user, with the boots and time it had when written */
+#define SNMP_ENGINE_STATE_VERSION 1
+#define SNMP_ENGINE_ID_MAX 32	/* octets, RFC 3411 */
+
+typedef struct snmp_engine_state {
+	uint32_t boots;
+	uint32_t time;
+	uint32_t id_len;
+	u_char id[SNMP_ENGINE_ID_MAX];
+} snmp_engine_state;
+
+/* the state of agent and user in place of the plugin's own, which is
+ * returned */
+static state_key *
+engine_state (monitoring_plugin *plugin, const char *agent, const char *user)
+{
+	state_key *own = plugin->state;
+	char *args[2], key[41], *name = NULL;
+
+	args[0] = (char *) agent;
+	args[1] = (char *) (user ? user : "");
+	np_argv_digest (2, args, key);
+	xasprintf (&name, "snmp_engine_%s", key);
+	np_enable_state (name, SNMP_ENGINE_STATE_VERSION);
+	free (name);
+	return own;
+}
+
+int
+np_snmp_engine_load (netsnmp_session *session, const char *agent)
+{
+	monitoring_plugin *plugin;
+	state_key *own;
+	state_data *data;
+	snmp_engine_state *e;
+
+	_get_monitoring_plugin (&plugin);
+	if (plugin == NULL || session->version != SNMP_VERSION_3)
+		return FALSE;
+	own = engine_state (plugin, agent, session->securityName);
+	data = np_state_read ();
+	plugin->state = own;
+	if (data == NULL || data->data == NULL || (size_t) data->length != sizeof (*e))
+		return FALSE;
+	e = data->data;
+	if (e->id_len == 0 || e->id_len > SNMP_ENGINE_ID_MAX)
+		return FALSE;
+
+	session->securityEngineID = malloc (e->id_len);
+	session->contextEngineID = malloc (e->id_len);
+	if (session->securityEngineID == NULL || session->contextEngineID == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	memcpy (session->securityEngineID, e->id, e->id_len);
+	memcpy (session->contextEngineID, e->id, e->id_len);
+	session->securityEngineIDLen = session->contextEngineIDLen = e->id_len;
+	/* without authentication the agent tells neither */
+	if (e->boots || e->time) {
+		session->engineBoots = e->boots;
+		session->engineTime = e->time + (time (NULL) - data->time);
+	}
+	return TRUE;
+}
+
+void
+np_snmp_engine_forget (netsnmp_session *session)
+{
+	free (session->securityEngineID);
+	free (session->contextEngineID);
+	session->securityEngineID = session->contextEngineID = NULL;
+	session->securityEngineIDLen = session->contextEngineIDLen = 0;
+	session->engineBoots = session->engineTime = 0;
+}
+
+int
+np_snmp_engine_stale (netsnmp_session *ss)
+{
+	return ss->s_snmp_errno == SNMPERR_UNKNOWN_ENG_ID ||
+	       ss->s_snmp_errno == SNMPERR_NOT_IN_TIME_WINDOW;
+}
+
+void
+np_snmp_engine_save (netsnmp_session *ss, netsnmp_session *session, const char *agent)
+{
+	monitoring_plugin *plugin;
+	state_key *own;
+	snmp_engine_state e;
+	u_int boots = 0, etime = 0;
+
+	_get_monitoring_plugin (&plugin);
+	if (plugin == NULL || ss->version != SNMP_VERSION_3 ||
+	    ss->securityEngineIDLen == 0 || ss->securityEngineIDLen > SNMP_ENGINE_ID_MAX)
+		return;
+	if (get_enginetime (ss->securityEngineID, ss->securityEngineIDLen,
+	                    &boots, &etime, TRUE) != SNMPERR_SUCCESS)
+		boots = etime = 0;
+	/* what came from the state and still holds is not written again */
+	if (session->securityEngineIDLen == ss->securityEngineIDLen &&
+	    memcmp (session->securityEngineID, ss->securityEngineID, ss->securityEngineIDLen) == 0 &&
+	    session->engineBoots == boots)
+		return;
+
+	memset (&e, 0, sizeof (e));
+	e.boots = boots;
+	e.time = etime;
+	e.id_len = ss->securityEngineIDLen;
+	memcpy (e.id, ss->securityEngineID, e.id_len);
+	own = engine_state (plugin, agent, ss->securityName);
+	np_state_write_binary (time (NULL), &e, sizeof (e));
+	plugin->state = own;
+}
+#endif /* HAVE_NETSNMP */
+
+/* The cache file is a magic, the length and text of the key, then one
+ * record for each answer: time, value, numeric, and the lengths and text
+ * of the oid and of the variable. It is only read on this host, so the
+ * numbers are as they are in memory. */
+#define SNMP_CACHE_MAGIC "NPSNMPC1"
+
+unsigned long long
+np_snmp_cache_hash (const char *s)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	for (; *s; s++) {
+		h ^= (unsigned char) *s;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static int
+cache_get (const char **p, const char *end, void *data, size_t len)
+{
+	if ((size_t) (end - *p) < len)
+		return FALSE;
+	memcpy (data, *p, len);
+	*p += len;
+	return TRUE;
+}
+
+static char *
+cache_get_string (const char **p, const char *end)
+{
+	uint32_t len;
+	char *s;
+
+	if (!cache_get (p, end, &len, sizeof (len)) || (size_t) (end - *p) < len)
+		return NULL;
+	if ((s = strndup (*p, len)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	*p += len;
+	return s;
+}
+
+static void
+cache_put (np_str *buf, const void *data, size_t len)
+{
+	np_str_append (buf, (const char *) data, len);
+}
+
+static void
+cache_put_string (np_str *buf, const char *s)
+{
+	uint32_t len = strlen (s);
+
+	cache_put (buf, &len, sizeof (len));
+	cache_put (buf, s, len);
+}
+
+static void
+cache_set (np_snmp_cache *cache, const char *oid, const char *text,
+           double value, int numeric, time_t t)
+{
+	np_snmp_cached *e = NULL;
+	size_t i;
+
+	for (i = 0; i < cache->count; i++)
+		if (!strcmp (cache->entries[i].oid, oid)) {
+			e = &cache->entries[i];
+			free (e->text);
+			break;
+		}
+	if (e == NULL) {
+		if (cache->count == cache->size) {
+			cache->size = cache->size ? cache->size * 2 : 16;
+			cache->entries = realloc (cache->entries, cache->size * sizeof (np_snmp_cached));
+			if (cache->entries == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		}
+		e = &cache->entries[cache->count++];
+		e->oid = strdup (oid);
+	}
+	e->text = strdup (text);
+	if (e->oid == NULL || e->text == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	e->value = value;
+	e->numeric = numeric;
+	e->time = t;
+}
+
+/* The directory name of this user in the state directory, created if
+ * need be, or NULL */
+static char *
+state_dir (const char *name)
+{
+	char *path = NULL, *p;
+
+	xasprintf (&path, "%s/%lu/%s", _np_state_calculate_location_prefix (),
+	           (unsigned long) geteuid (), name);
+	for (p = path + 1; *p; p++) {
+		if (*p == '/') {
+			*p = '\0';
+			if (access (path, F_OK) != 0 && mkdir (path, S_IRWXU) != 0) {
+				*p = '/';
+				break;
+			}
+			*p = '/';
+		}
+	}
+	if (access (path, F_OK) != 0 && mkdir (path, S_IRWXU) != 0) {
+		free (path);
+		return NULL;
+	}
+	return path;
+}
+
+int
+np_snmp_cache_open (np_snmp_cache *cache, const char *key)
+{
+	struct flock lock;
+	struct stat st;
+	char *path = NULL, *data, *file_key;
+	const char *q, *end;
+	np_snmp_cached e;
+	int64_t t;
+	int32_t numeric;
+
+	memset (cache, 0, sizeof (*cache));
+	cache->fd = -1;
+	if ((cache->key = strdup (key)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+
+	if ((path = state_dir ("snmp_cache")) == NULL) {
+		free (cache->key);
+		return FALSE;
+	}
+	xasprintf (&path, "%s/%016llx", path, np_snmp_cache_hash (key));
+	cache->fd = open (path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	free (path);
+	if (cache->fd < 0) {
+		free (cache->key);
+		return FALSE;
+	}
+	fcntl (cache->fd, F_SETFD, FD_CLOEXEC);
+
+	memset (&lock, 0, sizeof (lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	if (fcntl (cache->fd, F_SETLKW, &lock) != 0 || fstat (cache->fd, &st) != 0) {
+		close (cache->fd);
+		cache->fd = -1;
+		free (cache->key);
+		return FALSE;
+	}
+
+	if (st.st_size == 0)
+		return TRUE;
+	if ((data = malloc (st.st_size)) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	if (pread (cache->fd, data, st.st_size, 0) != st.st_size) {
+		free (data);
+		return TRUE;
+	}
+
+	/* anything that does not read back is dropped with the next write */
+	q = data;
+	end = data + st.st_size;
+	file_key = NULL;
+	if ((size_t) (end - q) >= strlen (SNMP_CACHE_MAGIC) &&
+	    !memcmp (q, SNMP_CACHE_MAGIC, strlen (SNMP_CACHE_MAGIC))) {
+		q += strlen (SNMP_CACHE_MAGIC);
+		file_key = cache_get_string (&q, end);
+	}
+	if (file_key != NULL && !strcmp (file_key, key)) {
+		while (q < end) {
+			if (!cache_get (&q, end, &t, sizeof (t)) ||
+			    !cache_get (&q, end, &e.value, sizeof (e.value)) ||
+			    !cache_get (&q, end, &numeric, sizeof (numeric)) ||
+			    (e.oid = cache_get_string (&q, end)) == NULL)
+				break;
+			if ((e.text = cache_get_string (&q, end)) == NULL) {
+				free (e.oid);
+				break;
+			}
+			cache_set (cache, e.oid, e.text, e.value, numeric, t);
+			free (e.oid);
+			free (e.text);
+		}
+	}
+	/* a file of another key or with a broken end is written anew */
+	cache->changed = (file_key == NULL || strcmp (file_key, key) != 0 || q < end);
+	free (file_key);
+	free (data);
+	return TRUE;
+}
+
+np_snmp_cached *
+np_snmp_cache_find (np_snmp_cache *cache, const char *oid, time_t max_age)
+{
+	time_t now = time (NULL);
+	size_t i;
+
+	for (i = 0; i < cache->count; i++)
+		if (!strcmp (cache->entries[i].oid, oid))
+			return (now - cache->entries[i].time <= max_age &&
+			        cache->entries[i].time <= now) ? &cache->entries[i] : NULL;
+	return NULL;
+}
+
+void
+np_snmp_cache_store (np_snmp_cache *cache, const char *oid, const char *text,
+                     double value, int numeric)
+{
+	cache_set (cache, oid, text, value, numeric, time (NULL));
+	cache->changed = TRUE;
+}
+
+void
+np_snmp_cache_close (np_snmp_cache *cache)
+{
+	np_str buf = NP_STR_INIT;
+	time_t now = time (NULL);
+	int64_t t;
+	int32_t numeric;
+	size_t i;
+
+	if (cache->fd < 0)
+		return;
+	if (cache->changed) {
+		cache_put (&buf, SNMP_CACHE_MAGIC, strlen (SNMP_CACHE_MAGIC));
+		cache_put_string (&buf, cache->key);
+		for (i = 0; i < cache->count; i++) {
+			if (now - cache->entries[i].time > NP_SNMP_CACHE_KEEP)
+				continue;
+			t = cache->entries[i].time;
+			numeric = cache->entries[i].numeric;
+			cache_put (&buf, &t, sizeof (t));
+			cache_put (&buf, &cache->entries[i].value, sizeof (double));
+			cache_put (&buf, &numeric, sizeof (numeric));
+			cache_put_string (&buf, cache->entries[i].oid);
+			cache_put_string (&buf, cache->entries[i].text);
+		}
+		/* still locked, nobody reads it half written */
+		if (ftruncate (cache->fd, 0) != 0 ||
+		    pwrite (cache->fd, np_str_string (&buf), buf.len, 0) != (ssize_t) buf.len)
+			ftruncate (cache->fd, 0);
+	}
+	/* closing releases the lock */
+	close (cache->fd);
+	cache->fd = -1;
+	for (i = 0; i < cache->count; i++) {
+		free (cache->entries[i].oid);
+		free (cache->entries[i].text);
+	}
+	free (cache->entries);
+	free (cache->key);
+	cache->entries = NULL;
+	cache->count = cache->size = 0;
+}
+
+#ifdef HAVE_NETSNMP
+/* The MIB index is mapped, not parsed: a header, the entries sorted by
+ * name, the names and the subidentifiers. Each name, plain and qualified
+ * by its module, has the OID and the name snmpget prints for it. */
+#define MIB_INDEX_MAGIC "NPMIBX01"
+
+typedef struct mib_index_header {
+	char magic[8];
+	int64_t stamp;		/* the newest MIB directory, see mib_stamp() */
+	uint32_t count;
+	uint32_t names;		/* offsets in the file */
+	uint32_t subids;
+	uint32_t size;
+} mib_index_header;
+
+typedef struct mib_index_entry {
+	uint32_t name;		/* offsets in the names */
+	uint32_t display;
+	uint32_t subid;		/* the first of len in the subidentifiers */
+	uint32_t len;
+} mib_index_entry;
+
+typedef struct mib_index_build {
+	mib_index_entry *entries;
+	size_t count, size;
+	np_str names;
+	uint32_t *subids;
+	size_t nsubids, subids_size;
+	const char *base;	/* of the names, for sorting */
+} mib_index_build;
+
+/* Adding a MIB to a directory, or taking one out, changes the directory */
+static int64_t
+mib_stamp (void)
+{
+	struct stat st;
+	char *dirs, *dir, *saveptr = NULL, *path;
+	const char *home = getenv ("HOME");
+	int64_t stamp = 0;
+
+	if ((dirs = strdup (netsnmp_get_mib_directory ())) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (dir = strtok_r (dirs, ":", &saveptr); dir; dir = strtok_r (NULL, ":", &saveptr)) {
+		if (*dir == '+' || *dir == '-')
+			dir++;
+		path = NULL;
+		if (!strncmp (dir, "$HOME", 5))
+			xasprintf (&path, "%s%s", home ? home : "", dir + 5);
+		if (stat (path ? path : dir, &st) == 0 && (int64_t) st.st_mtime > stamp)
+			stamp = st.st_mtime;
+		free (path);
+	}
+	free (dirs);
+	return stamp;
+}
+
+static uint32_t
+mib_name (mib_index_build *b, const char *name)
+{
+	uint32_t off = b->names.len;
+
+	np_str_append (&b->names, name, strlen (name) + 1);
+	return off;
+}
+
+static void
+mib_add (mib_index_build *b, uint32_t name, uint32_t display, size_t subid, size_t len)
+{
+	if (b->count == b->size) {
+		b->size = b->size ? b->size * 2 : 4096;
+		if ((b->entries = realloc (b->entries, b->size * sizeof (*b->entries))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	}
+	b->entries[b->count].name = name;
+	b->entries[b->count].display = display;
+	b->entries[b->count].subid = subid;
+	b->entries[b->count].len = len;
+	b->count++;
+}
+
+static void
+mib_walk (mib_index_build *b, struct tree *tp, oid *path, size_t depth)
+{
+	char module[256], *qualified = NULL;
+	uint32_t name, display;
+	size_t i, subid;
+
+	for (; tp; tp = tp->next_peer) {
+		if (depth >= MAX_OID_LEN)
+			return;
+		path[depth] = tp->subid;
+		if (b->nsubids + depth + 1 > b->subids_size) {
+			b->subids_size = (b->subids_size + depth + 1) * 2;
+			if ((b->subids = realloc (b->subids, b->subids_size * sizeof (uint32_t))) == NULL)
+				die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+		}
+		subid = b->nsubids;
+		for (i = 0; i <= depth; i++)
+			b->subids[b->nsubids++] = path[i];
+
+		module_name (tp->modid, module);
+		xasprintf (&qualified, "%s::%s", module, tp->label);
+		display = mib_name (b, qualified);
+		name = mib_name (b, tp->label);
+		mib_add (b, name, display, subid, depth + 1);
+		mib_add (b, display, display, subid, depth + 1);
+		free (qualified);
+
+		mib_walk (b, tp->child_list, path, depth + 1);
+	}
+}
+
+static NP_THREAD_LOCAL const char *mib_sort_base;
+
+static int
+mib_order (const void *a, const void *b)
+{
+	const mib_index_entry *x = a, *y = b;
+	int c = strcmp (mib_sort_base + x->name, mib_sort_base + y->name);
+
+	/* of the same plain name in several modules the one found first wins */
+	if (c == 0)
+		return x->subid < y->subid ? -1 : x->subid > y->subid;
+	return c;
+}
+
+/* Write the index of the loaded MIBs, through a file of its own so that
+ * checks mapping the old one at the same time are not disturbed */
+static void
+mib_index_write (const char *path, int64_t stamp)
+{
+	mib_index_build b;
+	mib_index_header h;
+	oid root[MAX_OID_LEN];
+	char *tmp = NULL;
+	size_t i, n;
+	int fd;
+
+	memset (&b, 0, sizeof (b));
+	mib_walk (&b, get_tree_head (), root, 0);
+
+	/* the names are in place, keep the first of each */
+	mib_sort_base = np_str_string (&b.names);
+	qsort (b.entries, b.count, sizeof (*b.entries), mib_order);
+	for (i = n = 0; i < b.count; i++)
+		if (n == 0 || strcmp (mib_sort_base + b.entries[n - 1].name, mib_sort_base + b.entries[i].name))
+			b.entries[n++] = b.entries[i];
+
+	memset (&h, 0, sizeof (h));
+	memcpy (h.magic, MIB_INDEX_MAGIC, sizeof (h.magic));
+	h.stamp = stamp;
+	h.count = n;
+	h.names = sizeof (h) + n * sizeof (*b.entries);
+	h.subids = (h.names + b.names.len + 3) & ~3U;
+	h.size = h.subids + b.nsubids * sizeof (uint32_t);
+
+	xasprintf (&tmp, "%s.%lu", path, (unsigned long) getpid ());
+	if ((fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) >= 0) {
+		if (write (fd, &h, sizeof (h)) == sizeof (h) &&
+		    write (fd, b.entries, n * sizeof (*b.entries)) == (ssize_t) (n * sizeof (*b.entries)) &&
+		    write (fd, np_str_string (&b.names), b.names.len) == (ssize_t) b.names.len &&
+		    lseek (fd, h.subids, SEEK_SET) == (off_t) h.subids &&
+		    write (fd, b.subids, b.nsubids * sizeof (uint32_t)) == (ssize_t) (b.nsubids * sizeof (uint32_t)) &&
+		    close (fd) == 0)
+			rename (tmp, path);
+		else {
+			close (fd);
+			unlink (tmp);
+		}
+	}
+	free (tmp);
+	free (b.entries);
+	free (b.subids);
+}
+
+static const mib_index_entry *
+mib_find (const char *map, const char *name)
+{
+	const mib_index_header *h = (const mib_index_header *) map;
+	const mib_index_entry *e = (const mib_index_entry *) (map + sizeof (*h));
+	size_t lo = 0, hi = h->count, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		c = strcmp (name, map + h->names + e[mid].name);
+		if (c == 0)
+			return &e[mid];
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+/* "name.1.2" with the name in the index, or a numeric OID, as the OID
+ * and the name snmpget would print. FALSE for anything else, such as
+ * indexes given as strings. */
+static int
+mib_resolve (const char *map, const char *o, char **numeric, char **display)
+{
+	const mib_index_header *h = (const mib_index_header *) map;
+	const mib_index_entry *e;
+	const uint32_t *subids;
+	const char *suffix, *p;
+	char *name;
+	uint32_t i;
+
+	/* the index is made of names, the rest must be numbers */
+	suffix = strstr (o, "::") ? strchr (strstr (o, "::"), '.') : strchr (o, '.');
+	if (isdigit ((unsigned char) *o) || *o == '.')
+		suffix = o;
+	for (p = suffix ? suffix : ""; *p; p++)
+		if (!isdigit ((unsigned char) *p) && *p != '.')
+			return FALSE;
+	if (suffix == o) {
+		*numeric = strdup (o);
+		*display = NULL;
+		return *numeric != NULL;
+	}
+
+	if ((name = strndup (o, suffix ? (size_t) (suffix - o) : strlen (o))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	e = mib_find (map, name);
+	free (name);
+	if (e == NULL || h->subids + ((size_t) e->subid + e->len) * sizeof (uint32_t) > h->size)
+		return FALSE;
+
+	subids = (const uint32_t *) (map + h->subids) + e->subid;
+	*numeric = NULL;
+	for (i = 0; i < e->len; i++)
+		xasprintf (numeric, "%s.%lu", *numeric ? *numeric : "", (unsigned long) subids[i]);
+	xasprintf (numeric, "%s%s", *numeric, suffix ? suffix : "");
+	xasprintf (display, "%s%s", map + h->names + e->display, suffix ? suffix : "");
+	return TRUE;
+}
+
+int
+np_snmp_mib_index (const char *mibs, char **oids, int count, char ***numeric, char ***display)
+{
+#ifdef HAVE_MMAP
+	mib_index_header h;
+	struct stat st;
+	char *path, *map;
+	int64_t stamp;
+	int fd, i, ok = TRUE;
+
+	if ((path = state_dir ("snmp_mib_index")) == NULL)
+		return FALSE;
+	xasprintf (&path, "%s/%016llx", path, np_snmp_cache_hash (mibs));
+	stamp = mib_stamp ();
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0 || fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (h) ||
+	    read (fd, &h, sizeof (h)) != sizeof (h) ||
+	    memcmp (h.magic, MIB_INDEX_MAGIC, sizeof (h.magic)) || h.stamp != stamp ||
+	    h.size != (uint32_t) st.st_size || h.names > h.subids || h.subids > h.size ||
+	    sizeof (h) + (size_t) h.count * sizeof (mib_index_entry) > h.names) {
+		/* this time the MIBs are loaded, to build the index for the next */
+		if (fd >= 0)
+			close (fd);
+		np_snmp_init (mibs);
+		mib_index_write (path, stamp);
+		free (path);
+		return FALSE;
+	}
+	free (path);
+	map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+		return FALSE;
+
+	*numeric = calloc (count ? count : 1, sizeof (char *));
+	*display = calloc (count ? count : 1, sizeof (char *));
+	if (*numeric == NULL || *display == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+	for (i = 0; i < count && ok; i++)
+		ok = mib_resolve (map, oids[i], &(*numeric)[i], &(*display)[i]);
+	munmap (map, st.st_size);
+	return ok;
+#else
+	return FALSE;
+#endif
+}
+#endif /* HAVE_NETSNMP */
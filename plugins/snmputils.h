@@ -0,0 +1,111 @@
+/*****************************************************************************
+*
+* Monitoring Plugins SNMP utilities include file
+*
+* License: GPL
+* Copyright (c) 2026 Monitoring Plugins Development Team
+*
+* Description:
+*
+* The in-process libnetsnmp request code check_snmp --native started out
+* with, shared with check_hpjd.
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#ifndef _SNMPUTILS_H_
+#define _SNMPUTILS_H_
+
+#include "common.h"
+
+#ifdef HAVE_NETSNMP
+/* net-snmp-config.h carries its own autoconf package macros */
+# undef PACKAGE_BUGREPORT
+# undef PACKAGE_NAME
+# undef PACKAGE_STRING
+# undef PACKAGE_TARNAME
+# undef PACKAGE_VERSION
+# include <net-snmp/net-snmp-config.h>
+# include <net-snmp/net-snmp-includes.h>
+
+/* The functions below word their errors the way snmpget does and append
+ * them to *errors, and return what snmpget would exit with. */
+void np_snmp_init (const char *mibs);
+netsnmp_pdu *np_snmp_pdu (int command, char **oids, int count, char **errors);
+int np_snmp_error (int status, netsnmp_session *ss, netsnmp_pdu *response, char **errors);
+int np_snmp_get (netsnmp_session *session, int command, char **oids, int count,
+  netsnmp_pdu **response, char **errors);
+
+/* SNMPv3 engine discovery across runs: the engine ID, boots and time an
+ * agent told are kept in the state directory by agent and user, and set on
+ * the next session for it, which then skips the discovery round trip.
+ * np_snmp_engine_load() returns TRUE if it found them. */
+int np_snmp_engine_load (netsnmp_session *session, const char *agent);
+void np_snmp_engine_forget (netsnmp_session *session);
+/* TRUE if the request failed on a notInTimeWindow or unknownEngineID
+ * report, after which the engine has to be discovered again */
+int np_snmp_engine_stale (netsnmp_session *ss);
+/* keep the engine of the open session ss, if it is not what session was
+ * loaded with already */
+void np_snmp_engine_save (netsnmp_session *ss, netsnmp_session *session, const char *agent);
+
+/* Resolve the count oids from an index of the names in mibs, kept mapped
+ * in the state directory, instead of loading the MIBs. Gives the numeric
+ * OIDs and the names snmpget prints for them (NULL for numeric ones) and
+ * returns TRUE if all of them resolved. The index is built from the MIBs,
+ * which are then loaded, when there is none or a MIB directory changed. */
+int np_snmp_mib_index (const char *mibs, char **oids, int count,
+  char ***numeric, char ***display);
+#endif
+
+/* A response cache in the state directory shared by the checks of one
+ * agent, one file for each key of agent and credentials. The file stays
+ * locked from np_snmp_cache_open() to np_snmp_cache_close(), so checks of
+ * the same agent running at the same time wait for each other's request
+ * and find its answers instead of making their own. */
+typedef struct np_snmp_cached {
+	char *oid;		/* as requested */
+	char *text;		/* the variable as snmpget prints it */
+	double value;
+	int numeric;
+	time_t time;
+} np_snmp_cached;
+
+typedef struct np_snmp_cache {
+	char *key;
+	int fd;
+	np_snmp_cached *entries;
+	size_t count;
+	size_t size;
+	int changed;
+} np_snmp_cache;
+
+/* how long answers are kept whatever the freshness the checks ask for */
+#define NP_SNMP_CACHE_KEEP 3600
+
+/* FNV-1a, for keys that must not carry the secrets in them */
+unsigned long long np_snmp_cache_hash (const char *);
+/* FALSE if there is no cache to be had, the request goes out as usual */
+int np_snmp_cache_open (np_snmp_cache *, const char *key);
+/* the answer for oid if it is at most max_age seconds old, or NULL */
+np_snmp_cached *np_snmp_cache_find (np_snmp_cache *, const char *oid, time_t max_age);
+void np_snmp_cache_store (np_snmp_cache *, const char *oid, const char *text,
+                          double value, int numeric);
+/* writes what was stored and lets the next check in */
+void np_snmp_cache_close (np_snmp_cache *);
+
+#endif /* _SNMPUTILS_H_ */
@@ -31,30 +31,339 @@
 #include "netutils.h"
 
 #ifdef HAVE_SSL
-static SSL_CTX *c=NULL;
-static SSL *s=NULL;
+#ifdef USE_OPENSSL
+#include <openssl/ocsp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/provider.h>
+#elif !defined(OPENSSL_NO_ENGINE)
+#include <openssl/engine.h>
+#endif
+#if defined(SSL_MODE_ASYNC) && defined(SSL_ERROR_WANT_ASYNC_JOB)
+#define TLS_ASYNC
+#endif
+#endif
+static np_tls *tls=NULL;	/* the connection of np_net_ssl_init() */
 static int initialized=0;
 
-int np_net_ssl_init(int sd) {
-	return np_net_ssl_init_with_hostname(sd, NULL);
+/* TLS session resumption, see np_net_ssl_session_cache() */
+static char *session_key=NULL;
+static int session_reused=FALSE;
+static double handshake_time=0;
+
+/* Certificate results, see np_net_ssl_cert_cache() */
+static int cert_cache_ttl=0;
+#ifdef USE_OPENSSL
+static int cert_evaluate(X509 *, int, int, char **);
+#endif
+
+/* Stapled OCSP responses, see np_net_ssl_ocsp_stapling() */
+static int ocsp_stapling=FALSE;
+#ifdef USE_OPENSSL
+static int ocsp_evaluate(SSL *, char **);
+#endif
+
+/* Crypto offload, see np_net_ssl_offload() */
+static int offload=FALSE;
+static double crypto_wait_time=0;
+#ifdef TLS_ASYNC
+/* How long a handshake of np_conn_run() waited on the device so far, kept
+ * with its SSL object */
+struct tls_async {
+	struct timeval since;
+	int waiting;
+	double total;		/* seconds */
+};
+static int async_index=-1;
+#endif
+
+void _get_monitoring_plugin(monitoring_plugin **);
+
+/* Keep the session of every successful handshake in a state file of its
+ * own, keyed by host, port and SNI name, and offer it to the server on the
+ * next run. This must be called after np_init() and before the connection is
+ * set up; without it no session is stored, and tickets stay disabled. */
+void np_net_ssl_session_cache(const char *host, int port, const char *sni) {
+	monitoring_plugin *this_monitoring_plugin;
+	struct sha1_ctx ctx;
+	unsigned char result[20];
+	char *id=NULL;
+	int i;
+
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	if (this_monitoring_plugin == NULL)
+		die(STATE_UNKNOWN, _("This requires np_init to be called"));
+
+	xasprintf(&id, "%s:%d:%s", host ? host : "", port, sni ? sni : "");
+	sha1_init_ctx(&ctx);
+	sha1_process_bytes(id, strlen(id), &ctx);
+	sha1_finish_ctx(&ctx, &result);
+	free(id);
+
+	free(session_key);
+	if ((session_key = malloc(4 + 2 * sizeof(result) + 1)) == NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
+	strcpy(session_key, "tls_");
+	for (i = 0; i < 20; i++)
+		sprintf(&session_key[4 + 2 * i], "%02x", result[i]);
 }
 
-int np_net_ssl_init_with_hostname(int sd, char *host_name) {
-	return np_net_ssl_init_with_hostname_and_version(sd, host_name, 0);
+/* Keep the subject CN and expiry np_net_ssl_check_certificate() takes out of
+ * a certificate for ttl seconds, in a state file keyed by the certificate's
+ * SHA-1 fingerprint, so that servers sharing a certificate share the entry
+ * too. A certificate seen again within that time is only fingerprinted, not
+ * picked apart again; its expiry is still held against the current time.
+ * This must be called after np_init(). */
+void np_net_ssl_cert_cache(int ttl) {
+	monitoring_plugin *this_monitoring_plugin;
+
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	if (this_monitoring_plugin == NULL)
+		die(STATE_UNKNOWN, _("This requires np_init to be called"));
+
+	cert_cache_ttl = ttl;
 }
 
-int np_net_ssl_init_with_hostname_and_version(int sd, char *host_name, int version) {
-	return np_net_ssl_init_with_hostname_version_and_cert(sd, host_name, version, NULL, NULL);
+/* Ask the server for the OCSP response on its certificate in the handshake
+ * (the status_request extension), to be judged by np_net_ssl_check_ocsp().
+ * A response found good, revoked or unknown is kept in a state file keyed by
+ * the issuer and serial number of the certificate until its nextUpdate, and
+ * later runs take the verdict from there instead of verifying the response
+ * again. This must be called after np_init(). */
+void np_net_ssl_ocsp_stapling(void) {
+	monitoring_plugin *this_monitoring_plugin;
+
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	if (this_monitoring_plugin == NULL)
+		die(STATE_UNKNOWN, _("This requires np_init to be called"));
+
+	ocsp_stapling = TRUE;
 }
 
-int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int version, char *cert, char *privkey) {
+int np_net_ssl_session_reused(void) {
+	return session_reused;
+}
+
+/* Seconds spent in the last handshake */
+double np_net_ssl_handshake_time(void) {
+	return handshake_time;
+}
+
+/* Hand the public key operations of the handshakes to an offload device
+ * such as QAT, through the OpenSSL 3 provider of that name, or the engine
+ * with older versions. The contexts built from then on run the handshakes
+ * as async jobs: one that waits for the device gives way, and np_conn_run()
+ * goes on with the other connections in the meantime. Returns OK, or ERROR
+ * if there is no such provider or engine. */
+int np_net_ssl_offload(const char *name) {
+#if defined(USE_OPENSSL) && OPENSSL_VERSION_NUMBER >= 0x30000000L
+	char *query=NULL;
+
+	/* the default provider stays, for all the device does not do */
+	if (OSSL_PROVIDER_try_load(NULL, name, 1) == NULL) {
+		ERR_clear_error();
+		return ERROR;
+	}
+	xasprintf(&query, "?provider=%s", name);
+	EVP_set_default_properties(NULL, query);
+	free(query);
+	offload = TRUE;
+	return OK;
+#elif defined(USE_OPENSSL) && !defined(OPENSSL_NO_ENGINE)
+	ENGINE *e;
+
+	ENGINE_load_builtin_engines();
+	if ((e = ENGINE_by_id(name)) == NULL) {
+		ERR_clear_error();
+		return ERROR;
+	}
+	if (!ENGINE_init(e)) {
+		ENGINE_free(e);
+		ERR_clear_error();
+		return ERROR;
+	}
+	/* only the handshake, the records are not worth a trip to the device */
+	ENGINE_set_default(e, ENGINE_METHOD_RSA | ENGINE_METHOD_DSA | ENGINE_METHOD_DH |
+	                   ENGINE_METHOD_EC | ENGINE_METHOD_PKEY_METHS);
+	ENGINE_free(e);
+	offload = TRUE;
+	return OK;
+#else
+	return ERROR;
+#endif
+}
+
+/* Seconds the last handshake of np_net_tls_connect() waited on the device */
+double np_net_ssl_crypto_wait_time(void) {
+	return crypto_wait_time;
+}
+
+#ifdef TLS_ASYNC
+static struct tls_async *async_state(SSL *ssl, int create) {
+	struct tls_async *a;
+
+	if (async_index < 0) {
+		if (!create)
+			return NULL;
+		async_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+	}
+	if ((a = SSL_get_ex_data(ssl, async_index)) == NULL && create) {
+		if ((a = calloc(1, sizeof(struct tls_async))) == NULL)
+			die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
+		SSL_set_ex_data(ssl, async_index, a);
+	}
+	return a;
+}
+
+/* What to wait on for the job of a connection, or -1 if the engine gives
+ * nothing to wait on. Engines have one descriptor per job, the first one
+ * is taken should there be more. */
+static int async_fd(SSL *ssl) {
+	OSSL_ASYNC_FD fds[4];
+	size_t n=0;
+
+	if (!SSL_get_all_async_fds(ssl, NULL, &n) || n == 0 || n > 4 ||
+	    !SSL_get_all_async_fds(ssl, fds, &n))
+		return -1;
+	return fds[0];
+}
+#endif /* TLS_ASYNC */
+
+/* After result from SSL_connect(), SSL_read() or SSL_write() on a blocking
+ * socket, wait for the device if that is what it came from, adding the
+ * time to *waited. Returns TRUE if the call is to be made again. */
+static int tls_async_wait(SSL *ssl, int result, double *waited) {
+#ifdef TLS_ASYNC
+	struct pollfd pfd;
+	struct timeval tv;
+
+	switch (SSL_get_error(ssl, result)) {
+	case SSL_ERROR_WANT_ASYNC:
+		gettimeofday(&tv, NULL);
+		/* an engine without anything to wait on is asked every millisecond */
+		pfd.fd = async_fd(ssl);
+		pfd.events = POLLIN;
+		poll(&pfd, pfd.fd >= 0 ? 1 : 0, pfd.fd >= 0 ? -1 : 1);
+		*waited += (double) deltime(tv) / 1.0e6;
+		return TRUE;
+	case SSL_ERROR_WANT_ASYNC_JOB:
+		poll(NULL, 0, 1);
+		return TRUE;
+	}
+#endif
+	return FALSE;
+}
+
+#ifdef USE_OPENSSL
+static void session_load(SSL *ssl) {
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	state_data *data;
+	SSL_SESSION *session;
+	const unsigned char *p;
+	unsigned char *der;
+	const char *hex;
+	size_t i, len;
+	unsigned int byte;
+
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	own = this_monitoring_plugin->state;
+	np_enable_state(session_key, 1);
+	data = np_state_read();
+	this_monitoring_plugin->state = own;
+	if (data == NULL || data->data == NULL)
+		return;
+
+	hex = (const char *) data->data;
+	len = strlen(hex) / 2;
+	if (len == 0 || (der = malloc(len)) == NULL)
+		return;
+	for (i = 0; i < len; i++) {
+		if (sscanf(&hex[2 * i], "%2x", &byte) != 1)
+			break;
+		der[i] = byte;
+	}
+	p = der;
+	if (i == len && (session = d2i_SSL_SESSION(NULL, &p, (long) len)) != NULL) {
+		SSL_set_session(ssl, session);
+		SSL_SESSION_free(session);
+	}
+	free(der);
+}
+
+static void session_save(SSL *ssl) {
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	SSL_SESSION *session;
+	unsigned char *der, *p;
+	char *hex;
+	int i, len;
+
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	if ((session = SSL_get1_session(ssl)) == NULL)
+		return;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (!SSL_SESSION_is_resumable(session)) {
+		SSL_SESSION_free(session);
+		return;
+	}
+#endif
+	len = i2d_SSL_SESSION(session, NULL);
+	if (len <= 0 || (der = malloc(len)) == NULL || (hex = malloc(2 * len + 1)) == NULL) {
+		SSL_SESSION_free(session);
+		return;
+	}
+	p = der;
+	i2d_SSL_SESSION(session, &p);
+	SSL_SESSION_free(session);
+	for (i = 0; i < len; i++)
+		sprintf(&hex[2 * i], "%02x", der[i]);
+	hex[2 * len] = '\0';
+
+	own = this_monitoring_plugin->state;
+	np_enable_state(session_key, 1);
+	np_state_write_string(0, hex);
+	this_monitoring_plugin->state = own;
+	free(der);
+	free(hex);
+}
+#endif /* USE_OPENSSL */
+
+/* The client contexts, one for every protocol version and client
+ * certificate asked for, built on first use and shared by all connections
+ * made with them for as long as the plugin runs */
+struct tls_context {
+	int version;
+	char *cert;
+	char *privkey;
+	SSL_CTX *ctx;
+	struct tls_context *next;
+};
+static struct tls_context *contexts=NULL;
+
+static int same_file(const char *a, const char *b) {
+	return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+/* The context for a version, and a client certificate if cert and privkey
+ * are set. Returns OK, or the state with what went wrong in *message. */
+static int tls_context(SSL_CTX **ctx, int version, const char *cert, const char *privkey, char **message) {
+	struct tls_context *t;
 	const SSL_METHOD *method = NULL;
 	long options = 0;
 
+	if (!(cert && privkey))
+		cert = privkey = NULL;
+	for (t = contexts; t; t = t->next) {
+		if (t->version == version && same_file(t->cert, cert) && same_file(t->privkey, privkey)) {
+			*ctx = t->ctx;
+			return OK;
+		}
+	}
+
 	switch (version) {
 	case MP_SSLv2: /* SSLv2 protocol */
 #if defined(USE_GNUTLS) || defined(OPENSSL_NO_SSL2)
-		printf("%s\n", _("UNKNOWN - SSL protocol version 2 is not supported by your SSL library."));
+		xasprintf(message, "%s", _("UNKNOWN - SSL protocol version 2 is not supported by your SSL library."));
 		return STATE_UNKNOWN;
 #else
 		method = SSLv2_client_method();
@@ -62,7 +371,7 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 #endif
 	case MP_SSLv3: /* SSLv3 protocol */
 #if defined(OPENSSL_NO_SSL3)
-		printf("%s\n", _("UNKNOWN - SSL protocol version 3 is not supported by your SSL library."));
+		xasprintf(message, "%s", _("UNKNOWN - SSL protocol version 3 is not supported by your SSL library."));
 		return STATE_UNKNOWN;
 #else
 		method = SSLv3_client_method();
@@ -70,7 +379,7 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 #endif
 	case MP_TLSv1: /* TLSv1 protocol */
 #if defined(OPENSSL_NO_TLS1)
-		printf("%s\n", _("UNKNOWN - TLS protocol version 1 is not supported by your SSL library."));
+		xasprintf(message, "%s", _("UNKNOWN - TLS protocol version 1 is not supported by your SSL library."));
 		return STATE_UNKNOWN;
 #else
 		method = TLSv1_client_method();
@@ -78,7 +387,7 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 #endif
 	case MP_TLSv1_1: /* TLSv1.1 protocol */
 #if !defined(SSL_OP_NO_TLSv1_1)
-		printf("%s\n", _("UNKNOWN - TLS protocol version 1.1 is not supported by your SSL library."));
+		xasprintf(message, "%s", _("UNKNOWN - TLS protocol version 1.1 is not supported by your SSL library."));
 		return STATE_UNKNOWN;
 #else
 		method = TLSv1_1_client_method();
@@ -86,7 +395,7 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 #endif
 	case MP_TLSv1_2: /* TLSv1.2 protocol */
 #if !defined(SSL_OP_NO_TLSv1_2)
-		printf("%s\n", _("UNKNOWN - TLS protocol version 1.2 is not supported by your SSL library."));
+		xasprintf(message, "%s", _("UNKNOWN - TLS protocol version 1.2 is not supported by your SSL library."));
 		return STATE_UNKNOWN;
 #else
 		method = TLSv1_2_client_method();
@@ -94,7 +403,7 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 #endif
 	case MP_TLSv1_2_OR_NEWER:
 #if !defined(SSL_OP_NO_TLSv1_1)
-		printf("%s\n", _("UNKNOWN - Disabling TLSv1.1 is not supported by your SSL library."));
+		xasprintf(message, "%s", _("UNKNOWN - Disabling TLSv1.1 is not supported by your SSL library."));
 		return STATE_UNKNOWN;
 #else
 		options |= SSL_OP_NO_TLSv1_1;
@@ -102,7 +411,7 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 		/* FALLTHROUGH */
 	case MP_TLSv1_1_OR_NEWER:
 #if !defined(SSL_OP_NO_TLSv1)
-		printf("%s\n", _("UNKNOWN - Disabling TLSv1 is not supported by your SSL library."));
+		xasprintf(message, "%s", _("UNKNOWN - Disabling TLSv1 is not supported by your SSL library."));
 		return STATE_UNKNOWN;
 #else
 		options |= SSL_OP_NO_TLSv1;
@@ -129,112 +438,441 @@ int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int
 		OpenSSL_add_all_algorithms();
 		initialized = 1;
 	}
-	if ((c = SSL_CTX_new(method)) == NULL) {
-		printf("%s\n", _("CRITICAL - Cannot create SSL context."));
+	if ((*ctx = SSL_CTX_new(method)) == NULL) {
+		xasprintf(message, "%s", _("CRITICAL - Cannot create SSL context."));
 		return STATE_CRITICAL;
 	}
-	if (cert && privkey) {
-		SSL_CTX_use_certificate_file(c, cert, SSL_FILETYPE_PEM);
-		SSL_CTX_use_PrivateKey_file(c, privkey, SSL_FILETYPE_PEM);
+	if (cert) {
+		SSL_CTX_use_certificate_file(*ctx, cert, SSL_FILETYPE_PEM);
+		SSL_CTX_use_PrivateKey_file(*ctx, privkey, SSL_FILETYPE_PEM);
 #ifdef USE_OPENSSL
-		if (!SSL_CTX_check_private_key(c)) {
-			printf ("%s\n", _("CRITICAL - Private key does not seem to match certificate!\n"));
+		if (!SSL_CTX_check_private_key(*ctx)) {
+			xasprintf(message, "%s", _("CRITICAL - Private key does not seem to match certificate!\n"));
+			SSL_CTX_free(*ctx);
 			return STATE_CRITICAL;
 		}
 #endif
 	}
+	SSL_CTX_set_options(*ctx, options);
+#ifdef TLS_ASYNC
+	if (offload)
+		SSL_CTX_set_mode(*ctx, SSL_MODE_ASYNC);
+#endif
+
+	if ((t = malloc(sizeof(struct tls_context))) == NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
+	t->version = version;
+	t->cert = cert ? strdup(cert) : NULL;
+	t->privkey = privkey ? strdup(privkey) : NULL;
+	t->ctx = *ctx;
+	t->next = contexts;
+	contexts = t;
+	return OK;
+}
+
+/* Build the context of a version before the first connection needs it, for
+ * a process that forks its checks off and would otherwise build it again in
+ * every child. Returns OK, or the state after printing what went wrong. */
+int np_net_tls_prepare(int version) {
+	SSL_CTX *ctx;
+	char *message = NULL;
+	int result;
+
+	if ((result = tls_context(&ctx, version, NULL, NULL, &message)) != OK) {
+		printf("%s\n", message);
+		free(message);
+	}
+	return result;
+}
+
+/* Set up a TLS connection over the connected socket sd, with an SSL object
+ * of its own on the shared context, so that a plugin can have as many of
+ * them open at once as it likes. Returns OK with the connection in *tls, or
+ * the state after printing what went wrong. */
+int np_net_tls_connect(np_tls **tls, int sd, const char *host_name, int version, const char *cert, const char *privkey) {
+	SSL_CTX *ctx;
+	np_tls *conn;
+	char *message = NULL;
+	struct timeval tv;
+	int result;
+
+	*tls = NULL;
+	if ((result = tls_context(&ctx, version, cert, privkey, &message)) != OK) {
+		printf("%s\n", message);
+		free(message);
+		return result;
+	}
+	if ((conn = calloc(1, sizeof(np_tls))) == NULL)
+		die(STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror(errno));
+	if ((conn->ssl = SSL_new(ctx)) == NULL) {
+		printf("%s\n", _("CRITICAL - Cannot initiate SSL handshake."));
+		free(conn);
+		return STATE_CRITICAL;
+	}
+	SSL_set_mode(conn->ssl, SSL_MODE_AUTO_RETRY);
 #ifdef SSL_OP_NO_TICKET
-	options |= SSL_OP_NO_TICKET;
+	if (session_key == NULL)
+		SSL_set_options(conn->ssl, SSL_OP_NO_TICKET);
 #endif
-	SSL_CTX_set_options(c, options);
-	SSL_CTX_set_mode(c, SSL_MODE_AUTO_RETRY);
-	if ((s = SSL_new(c)) != NULL) {
 #ifdef SSL_set_tlsext_host_name
-		if (host_name != NULL)
-			SSL_set_tlsext_host_name(s, host_name);
+	if (host_name != NULL)
+		SSL_set_tlsext_host_name(conn->ssl, (char *) host_name);
 #endif
-		SSL_set_fd(s, sd);
-		if (SSL_connect(s) == 1) {
-			return OK;
-		} else {
-			printf("%s\n", _("CRITICAL - Cannot make SSL connection."));
+	SSL_set_fd(conn->ssl, sd);
+#ifdef USE_OPENSSL
+	if (session_key != NULL)
+		session_load(conn->ssl);
+	if (ocsp_stapling)
+		SSL_set_tlsext_status_type(conn->ssl, TLSEXT_STATUSTYPE_ocsp);
+#endif
+	gettimeofday(&tv, NULL);
+	np_span_begin("tls");
+	while ((result = SSL_connect(conn->ssl)) != 1 && tls_async_wait(conn->ssl, result, &conn->crypto_wait))
+		;
+	crypto_wait_time = conn->crypto_wait;
+	if (result != 1) {
+		np_span_end();
+		printf("%s\n", _("CRITICAL - Cannot make SSL connection."));
 #  ifdef USE_OPENSSL /* XXX look into ERR_error_string */
-			ERR_print_errors_fp(stdout);
+		ERR_print_errors_fp(stdout);
 #  endif /* USE_OPENSSL */
-		}
-	} else {
-			printf("%s\n", _("CRITICAL - Cannot initiate SSL handshake."));
+		SSL_free(conn->ssl);
+		free(conn);
+		return STATE_CRITICAL;
 	}
-	return STATE_CRITICAL;
+	np_span_end();
+	conn->handshake_time = handshake_time = (double) deltime(tv) / 1.0e6;
+#ifdef USE_OPENSSL
+	conn->session_reused = session_reused = SSL_session_reused(conn->ssl) ? TRUE : FALSE;
+#endif
+	*tls = conn;
+	return OK;
 }
 
-void np_net_ssl_cleanup() {
-	if (s) {
+void np_net_tls_close(np_tls *tls) {
+	if (tls == NULL)
+		return;
+#ifdef USE_OPENSSL
+	/* Only now, TLSv1.3 sends its tickets after the handshake */
+	if (session_key != NULL)
+		session_save(tls->ssl);
+#endif
 #ifdef SSL_set_tlsext_host_name
-		SSL_set_tlsext_host_name(s, NULL);
+	SSL_set_tlsext_host_name(tls->ssl, NULL);
 #endif
-		SSL_shutdown(s);
-		SSL_free(s);
-		if (c) {
-			SSL_CTX_free(c);
-			c=NULL;
-		}
-		s=NULL;
-	}
+	SSL_shutdown(tls->ssl);
+	SSL_free(tls->ssl);
+	free(tls);
+}
+
+int np_net_tls_write(np_tls *tls, const void *buf, int num) {
+	int result;
+
+	while ((result = SSL_write(tls->ssl, buf, num)) <= 0 && tls_async_wait(tls->ssl, result, &tls->crypto_wait))
+		;
+	return result;
+}
+
+int np_net_tls_read(np_tls *tls, void *buf, int num) {
+	int result;
+
+	while ((result = SSL_read(tls->ssl, buf, num)) <= 0 && tls_async_wait(tls->ssl, result, &tls->crypto_wait))
+		;
+	return result;
+}
+
+/* The functions of one connection at a time, on top of the above */
+int np_net_ssl_init(int sd) {
+	return np_net_ssl_init_with_hostname(sd, NULL);
+}
+
+int np_net_ssl_init_with_hostname(int sd, char *host_name) {
+	return np_net_ssl_init_with_hostname_and_version(sd, host_name, 0);
+}
+
+int np_net_ssl_init_with_hostname_and_version(int sd, char *host_name, int version) {
+	return np_net_ssl_init_with_hostname_version_and_cert(sd, host_name, version, NULL, NULL);
+}
+
+int np_net_ssl_init_with_hostname_version_and_cert(int sd, char *host_name, int version, char *cert, char *privkey) {
+	np_net_ssl_cleanup();
+	return np_net_tls_connect(&tls, sd, host_name, version, cert, privkey);
+}
+
+void np_net_ssl_cleanup() {
+	np_net_tls_close(tls);
+	tls=NULL;
 }
 
 int np_net_ssl_write(const void *buf, int num) {
-	return SSL_write(s, buf, num);
+	return np_net_tls_write(tls, buf, num);
 }
 
 int np_net_ssl_read(void *buf, int num) {
-	return SSL_read(s, buf, num);
+	return np_net_tls_read(tls, buf, num);
 }
 
-int np_net_ssl_check_cert(int days_till_exp_warn, int days_till_exp_crit){
-#  ifdef USE_OPENSSL
-	X509 *certificate = NULL;
-	certificate=SSL_get_peer_certificate(s);
-	return(np_net_ssl_check_certificate(certificate, days_till_exp_warn, days_till_exp_crit));
-#  else /* ifndef USE_OPENSSL */
-	printf("%s\n", _("WARNING - Plugin does not support checking certificates."));
+/* Handshakes with many hosts at once, from the poll() loop of np_conn_run().
+ * Every connection gets an SSL object of its own on the default context,
+ * and goes no further than the certificate. */
+SSL *np_net_ssl_handshake_start(int sd, const char *host_name) {
+	SSL_CTX *ctx;
+	SSL *ssl;
+	char *message = NULL;
+
+	if (tls_context(&ctx, 0, NULL, NULL, &message) != OK) {
+		free(message);
+		return NULL;
+	}
+	if ((ssl = SSL_new(ctx)) == NULL)
+		return NULL;
+#ifdef SSL_OP_NO_TICKET
+	SSL_set_options(ssl, SSL_OP_NO_TICKET);
+#endif
+#ifdef SSL_set_tlsext_host_name
+	if (host_name != NULL)
+		SSL_set_tlsext_host_name(ssl, (char *) host_name);
+#endif
+	SSL_set_fd(ssl, sd);
+#ifdef USE_OPENSSL
+	if (ocsp_stapling)
+		SSL_set_tlsext_status_type(ssl, TLSEXT_STATUSTYPE_ocsp);
+#endif
+	SSL_set_connect_state(ssl);
+	return ssl;
+}
+
+/* Take the handshake as far as the socket allows. Returns 0 once it is done,
+ * POLLIN or POLLOUT for what to wait for before calling again, or -1 with
+ * what went wrong in *message. With np_net_ssl_offload(), what to wait for
+ * may be the device rather than the socket, see
+ * np_net_ssl_handshake_wait_fd(). */
+int np_net_ssl_handshake_continue(SSL *ssl, char **message) {
+	int result;
+	const char *reason=NULL;
+#ifdef USE_OPENSSL
+	unsigned long error;
+#endif
+#ifdef TLS_ASYNC
+	struct tls_async *a;
+
+	if ((a = async_state(ssl, FALSE)) != NULL && a->waiting) {
+		a->total += (double) deltime(a->since) / 1.0e6;
+		a->waiting = FALSE;
+	}
+#endif
+
+	if ((result = SSL_connect(ssl)) == 1)
+		return 0;
+	switch (SSL_get_error(ssl, result)) {
+	case SSL_ERROR_WANT_READ:
+		return POLLIN;
+	case SSL_ERROR_WANT_WRITE:
+		return POLLOUT;
+#ifdef TLS_ASYNC
+	case SSL_ERROR_WANT_ASYNC:
+		a = async_state(ssl, TRUE);
+		gettimeofday(&a->since, NULL);
+		a->waiting = TRUE;
+		/* without a descriptor, as soon as the socket allows, which is
+		 * right away */
+		return async_fd(ssl) >= 0 ? POLLIN : POLLOUT;
+	case SSL_ERROR_WANT_ASYNC_JOB:
+		return POLLOUT;
+#endif
+	}
+#ifdef USE_OPENSSL
+	if ((error = ERR_get_error()) != 0)
+		reason = ERR_reason_error_string(error);
+	ERR_clear_error();
+#endif
+	if (reason != NULL)
+		xasprintf(message, _("Cannot make SSL connection: %s"), reason);
+	else
+		xasprintf(message, "%s", _("Cannot make SSL connection."));
+	return -1;
+}
+
+/* Judge the certificate of a finished handshake like np_net_ssl_check_cert(),
+ * but leave printing what was found in *message to the caller. */
+int np_net_ssl_handshake_cert(SSL *ssl, int days_till_exp_warn, int days_till_exp_crit, char **message) {
+#ifdef USE_OPENSSL
+	X509 *certificate;
+	int status;
+
+	certificate = SSL_get_peer_certificate(ssl);
+	status = cert_evaluate(certificate, days_till_exp_warn, days_till_exp_crit, message);
+	if (certificate)
+		X509_free(certificate);
+	return status;
+#else /* ifndef USE_OPENSSL */
+	xasprintf(message, "%s", _("Plugin does not support checking certificates."));
 	return STATE_WARNING;
-#  endif /* USE_OPENSSL */
+#endif /* USE_OPENSSL */
 }
 
-int np_net_ssl_check_certificate(X509 *certificate, int days_till_exp_warn, int days_till_exp_crit){
-#  ifdef USE_OPENSSL
+/* Judge the stapled OCSP response of a finished handshake like
+ * np_net_ssl_check_ocsp() */
+int np_net_ssl_handshake_ocsp(SSL *ssl, char **message) {
+#ifdef USE_OPENSSL
+	return ocsp_evaluate(ssl, message);
+#else /* ifndef USE_OPENSSL */
+	xasprintf(message, "%s", _("Plugin does not support checking OCSP responses."));
+	return STATE_WARNING;
+#endif /* USE_OPENSSL */
+}
+
+/* What the engine of np_conn_run() is to wait on instead of the socket,
+ * for the np_conn's wait_fd, or -1 */
+int np_net_ssl_handshake_wait_fd(SSL *ssl) {
+#ifdef TLS_ASYNC
+	struct tls_async *a;
+
+	if ((a = async_state(ssl, FALSE)) != NULL && a->waiting)
+		return async_fd(ssl);
+#endif
+	return -1;
+}
+
+/* Seconds the handshake waited on the device */
+double np_net_ssl_handshake_crypto_wait(SSL *ssl) {
+#ifdef TLS_ASYNC
+	struct tls_async *a;
+
+	if ((a = async_state(ssl, FALSE)) != NULL)
+		return a->total;
+#endif
+	return 0;
+}
+
+void np_net_ssl_handshake_free(SSL *ssl) {
+#ifdef TLS_ASYNC
+	if (async_index >= 0)
+		free(SSL_get_ex_data(ssl, async_index));
+#endif
+	SSL_free(ssl);
+}
+
+/* Read and write over a finished handshake on the non-blocking socket of
+ * np_conn_run(). Returns what SSL_read() and SSL_write() do, or -1 with
+ * errno set to EAGAIN when the socket has to be waited for first. */
+int np_net_ssl_handshake_read(SSL *ssl, void *buf, int num) {
+	double waited=0;
+	int result;
+
+	/* the device is not waited for by np_conn_run() past the handshake */
+	while ((result = SSL_read(ssl, buf, num)) <= 0 && tls_async_wait(ssl, result, &waited))
+		;
+	if (result <= 0) {
+		switch (SSL_get_error(ssl, result)) {
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+		}
+	}
+	return result;
+}
+
+int np_net_ssl_handshake_write(SSL *ssl, const void *buf, int num) {
+	double waited=0;
+	int result;
+
+	while ((result = SSL_write(ssl, buf, num)) <= 0 && tls_async_wait(ssl, result, &waited))
+		;
+	if (result <= 0) {
+		switch (SSL_get_error(ssl, result)) {
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+	return result;
+}
+
+#ifdef USE_OPENSSL
+/* The state key of a certificate, from its fingerprint, or NULL */
+static char *cert_key(X509 *certificate) {
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int i, len;
+	char *key;
+
+	if (!X509_digest(certificate, EVP_sha1(), md, &len))
+		return NULL;
+	if ((key = malloc(5 + 2 * len + 1)) == NULL)
+		return NULL;
+	strcpy(key, "cert_");
+	for (i = 0; i < len; i++)
+		sprintf(&key[5 + 2 * i], "%02x", md[i]);
+	return key;
+}
+
+/* The entry is "expiry<TAB>timestamp<TAB>CN", see cert_save() */
+static int cert_load(const char *key, char *cn, size_t cnlen, time_t *expiry, char *timestamp, size_t tslen) {
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	state_data *data;
+	char *p, *q;
+
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	own = this_monitoring_plugin->state;
+	np_enable_state((char *) key, 1);
+	data = np_state_read();
+	this_monitoring_plugin->state = own;
+	if (data == NULL || data->data == NULL || time(NULL) - data->time >= cert_cache_ttl)
+		return FALSE;
+
+	*expiry = (time_t) strtoll((char *) data->data, &p, 10);
+	if (*p != '\t' || (q = strchr(++p, '\t')) == NULL)
+		return FALSE;
+	*q++ = '\0';
+	snprintf(timestamp, tslen, "%s", p);
+	snprintf(cn, cnlen, "%s", q);
+	return TRUE;
+}
+
+static void cert_save(const char *key, const char *cn, time_t expiry, const char *timestamp) {
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	char *entry = NULL;
+
+	/* the state file holds the entry on a line of its own */
+	if (strpbrk(cn, "\t\n") != NULL || strpbrk(timestamp, "\t\n") != NULL)
+		return;
+	xasprintf(&entry, "%lld\t%s\t%s", (long long) expiry, timestamp, cn);
+
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	own = this_monitoring_plugin->state;
+	np_enable_state((char *) key, 1);
+	np_state_write_string(0, entry);
+	this_monitoring_plugin->state = own;
+	free(entry);
+}
+
+/* Take the subject CN and expiry out of a certificate. Returns STATE_OK, or
+ * STATE_CRITICAL with what is wrong with it in *message. */
+static int cert_parse(X509 *certificate, char *cn, size_t cnlen, time_t *expiry, char *timestamp, size_t tslen, char **message) {
 	X509_NAME *subj=NULL;
-	char timestamp[50] = "";
-	char cn[MAX_CN_LENGTH]= "";
 	char *tz;
-
-	int cnlen =-1;
-	int status=STATE_UNKNOWN;
+	int cnlen_found =-1;
 
 	ASN1_STRING *tm;
 	int offset;
 	struct tm stamp;
-	float time_left;
-	int days_left;
-	int time_remaining;
-	time_t tm_t;
-
-	if (!certificate) {
-		printf("%s\n",_("CRITICAL - Cannot retrieve server certificate."));
-		return STATE_CRITICAL;
-	}
 
 	/* Extract CN from certificate subject */
 	subj=X509_get_subject_name(certificate);
 
 	if (!subj) {
-		printf("%s\n",_("CRITICAL - Cannot retrieve certificate subject."));
+		xasprintf(message, "%s", _("Cannot retrieve certificate subject."));
 		return STATE_CRITICAL;
 	}
-	cnlen = X509_NAME_get_text_by_NID(subj, NID_commonName, cn, sizeof(cn));
-	if (cnlen == -1)
-		strcpy(cn, _("Unknown CN"));
+	cnlen_found = X509_NAME_get_text_by_NID(subj, NID_commonName, cn, cnlen);
+	if (cnlen_found == -1)
+		snprintf(cn, cnlen, "%s", _("Unknown CN"));
 
 	/* Retrieve timestamp of certificate */
 	tm = X509_get_notAfter(certificate);
@@ -242,7 +880,7 @@ int np_net_ssl_check_certificate(X509 *certificate, int days_till_exp_warn, int
 	/* Generate tm structure to process timestamp */
 	if (tm->type == V_ASN1_UTCTIME) {
 		if (tm->length < 10) {
-			printf("%s\n", _("CRITICAL - Wrong time format in certificate."));
+			xasprintf(message, "%s", _("Wrong time format in certificate."));
 			return STATE_CRITICAL;
 		} else {
 			stamp.tm_year = (tm->data[0] - '0') * 10 + (tm->data[1] - '0');
@@ -252,7 +890,7 @@ int np_net_ssl_check_certificate(X509 *certificate, int days_till_exp_warn, int
 		}
 	} else {
 		if (tm->length < 12) {
-			printf("%s\n", _("CRITICAL - Wrong time format in certificate."));
+			xasprintf(message, "%s", _("Wrong time format in certificate."));
 			return STATE_CRITICAL;
 		} else {
 			stamp.tm_year =
@@ -274,21 +912,74 @@ int np_net_ssl_check_certificate(X509 *certificate, int days_till_exp_warn, int
 		(tm->data[10 + offset] - '0') * 10 + (tm->data[11 + offset] - '0');
 	stamp.tm_isdst = -1;
 
-	tm_t = timegm(&stamp);
-	time_left = difftime(tm_t, time(NULL));
-	days_left = time_left / 86400;
+	*expiry = timegm(&stamp);
 	tz = getenv("TZ");
 	setenv("TZ", "GMT", 1);
 	tzset();
-	strftime(timestamp, 50, "%c %z", localtime(&tm_t));
+	strftime(timestamp, tslen, "%c %z", localtime(expiry));
 	if (tz)
 		setenv("TZ", tz, 1);
 	else
 		unsetenv("TZ");
 	tzset();
 
+	return STATE_OK;
+}
+#endif /* USE_OPENSSL */
+
+int np_net_ssl_check_cert(int days_till_exp_warn, int days_till_exp_crit){
+	return np_net_tls_check_cert(tls, days_till_exp_warn, days_till_exp_crit);
+}
+
+int np_net_tls_check_cert(np_tls *conn, int days_till_exp_warn, int days_till_exp_crit){
+#  ifdef USE_OPENSSL
+	X509 *certificate = NULL;
+	certificate=SSL_get_peer_certificate(conn->ssl);
+	return(np_net_ssl_check_certificate(certificate, days_till_exp_warn, days_till_exp_crit));
+#  else /* ifndef USE_OPENSSL */
+	printf("%s\n", _("WARNING - Plugin does not support checking certificates."));
+	return STATE_WARNING;
+#  endif /* USE_OPENSSL */
+}
+
+#ifdef USE_OPENSSL
+/* Judge the expiry of a certificate against the thresholds. Returns the
+ * state, and what was found in *message, without the state in front. */
+static int cert_evaluate(X509 *certificate, int days_till_exp_warn, int days_till_exp_crit, char **message){
+	char timestamp[50] = "";
+	char cn[MAX_CN_LENGTH]= "";
+	char *key=NULL;
+
+	int status=STATE_UNKNOWN;
+
+	float time_left;
+	int days_left;
+	int time_remaining;
+	time_t tm_t;
+
+	*message = NULL;
+	if (!certificate) {
+		xasprintf(message, "%s", _("Cannot retrieve server certificate."));
+		return STATE_CRITICAL;
+	}
+
+	if (cert_cache_ttl > 0)
+		key = cert_key(certificate);
+	if (key == NULL || !cert_load(key, cn, sizeof(cn), &tm_t, timestamp, sizeof(timestamp))) {
+		if ((status = cert_parse(certificate, cn, sizeof(cn), &tm_t, timestamp, sizeof(timestamp), message)) != STATE_OK) {
+			free(key);
+			return status;
+		}
+		if (key != NULL)
+			cert_save(key, cn, tm_t, timestamp);
+	}
+	free(key);
+
+	time_left = difftime(tm_t, time(NULL));
+	days_left = time_left / 86400;
+
 	if (days_left > 0 && days_left <= days_till_exp_warn) {
-		printf (_("%s - Certificate '%s' expires in %d day(s) (%s).\n"), (days_left>days_till_exp_crit)?"WARNING":"CRITICAL", cn, days_left, timestamp);
+		xasprintf (message, _("Certificate '%s' expires in %d day(s) (%s)."), cn, days_left, timestamp);
 		if (days_left > days_till_exp_crit)
 			status = STATE_WARNING;
 		else
@@ -299,28 +990,251 @@ int np_net_ssl_check_certificate(X509 *certificate, int days_till_exp_warn, int
 		else
 			time_remaining = (int) time_left / 60;
 
-		printf (_("%s - Certificate '%s' expires in %u %s (%s)\n"),
-			(days_left>days_till_exp_crit) ? "WARNING" : "CRITICAL", cn, time_remaining,
-			time_left >= 3600 ? "hours" : "minutes", timestamp);
+		xasprintf (message, _("Certificate '%s' expires in %u %s (%s)"),
+			cn, time_remaining, time_left >= 3600 ? "hours" : "minutes", timestamp);
 
 		if ( days_left > days_till_exp_crit)
 			status = STATE_WARNING;
 		else
 			status = STATE_CRITICAL;
 	} else if (time_left < 0) {
-		printf(_("CRITICAL - Certificate '%s' expired on %s.\n"), cn, timestamp);
+		xasprintf (message, _("Certificate '%s' expired on %s."), cn, timestamp);
 		status=STATE_CRITICAL;
 	} else if (days_left == 0) {
-		printf (_("%s - Certificate '%s' just expired (%s).\n"), (days_left>days_till_exp_crit)?"WARNING":"CRITICAL", cn, timestamp);
+		xasprintf (message, _("Certificate '%s' just expired (%s)."), cn, timestamp);
 		if (days_left > days_till_exp_crit)
 			status = STATE_WARNING;
 		else
 			status = STATE_CRITICAL;
 	} else {
-		printf(_("OK - Certificate '%s' will expire on %s.\n"), cn, timestamp);
+		xasprintf (message, _("Certificate '%s' will expire on %s."), cn, timestamp);
 		status = STATE_OK;
 	}
+	return status;
+}
+#endif /* USE_OPENSSL */
+
+#ifdef USE_OPENSSL
+/* The state key of an OCSP verdict, from the issuer and the serial number
+ * the responder knows the certificate by, or NULL */
+static char *ocsp_key(X509 *certificate) {
+	BIGNUM *bn;
+	char *hex, *key=NULL;
+
+	if ((bn = ASN1_INTEGER_to_BN(X509_get_serialNumber(certificate), NULL)) == NULL)
+		return NULL;
+	if ((hex = BN_bn2hex(bn)) != NULL) {
+		xasprintf(&key, "ocsp_%08lx_%s", X509_issuer_name_hash(certificate), hex);
+		OPENSSL_free(hex);
+	}
+	BN_free(bn);
+	return key;
+}
+
+/* The entry is "nextUpdate<TAB>status<TAB>reason<TAB>revocation time" */
+static int ocsp_load(const char *key, int *status, int *reason, char *revoked, size_t revlen) {
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	state_data *data;
+	long long next_update;
+	int n = 0;
+
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	own = this_monitoring_plugin->state;
+	np_enable_state((char *) key, 1);
+	data = np_state_read();
+	this_monitoring_plugin->state = own;
+	if (data == NULL || data->data == NULL)
+		return FALSE;
+	if (sscanf((char *) data->data, "%lld\t%d\t%d\t%n", &next_update, status, reason, &n) < 3 || n == 0)
+		return FALSE;
+	if (time(NULL) >= (time_t) next_update)
+		return FALSE;
+	snprintf(revoked, revlen, "%s", (char *) data->data + n);
+	return TRUE;
+}
+
+static void ocsp_save(const char *key, time_t next_update, int status, int reason, const char *revoked) {
+	monitoring_plugin *this_monitoring_plugin;
+	state_key *own;
+	char *entry = NULL;
+
+	xasprintf(&entry, "%lld\t%d\t%d\t%s", (long long) next_update, status, reason, revoked);
+	_get_monitoring_plugin(&this_monitoring_plugin);
+	own = this_monitoring_plugin->state;
+	np_enable_state((char *) key, 1);
+	np_state_write_string(0, entry);
+	this_monitoring_plugin->state = own;
+	free(entry);
+}
+
+/* The system's trusted certificates, read once for all connections */
+static X509_STORE *ocsp_store(void) {
+	static X509_STORE *store = NULL;
+
+	if (store == NULL && (store = X509_STORE_new()) != NULL && !X509_STORE_set_default_paths(store)) {
+		X509_STORE_free(store);
+		store = NULL;
+	}
+	return store;
+}
+
+/* Verify the stapled response: signed by the issuer of the certificate (or
+ * a responder it delegated to), about this certificate, and current. Returns
+ * STATE_OK with the status it gives the certificate, or the state and what
+ * is wrong with the response in *message. */
+static int ocsp_verify(SSL *ssl, X509 *certificate, time_t *next_update, int *status, int *reason, char *revoked, size_t revlen, char **message) {
+	const unsigned char *der;
+	long len;
+	OCSP_RESPONSE *response = NULL;
+	OCSP_BASICRESP *basic = NULL;
+	OCSP_CERTID *id = NULL;
+	STACK_OF(X509) *chain;
+	X509_STORE *store = NULL;
+	X509 *issuer = NULL;
+	ASN1_GENERALIZEDTIME *revtime, *thisupd, *nextupd;
+	BIO *bio;
+	int i, n, days, secs, result = STATE_CRITICAL;
+
+	len = SSL_get_tlsext_status_ocsp_resp(ssl, &der);
+	if (der == NULL || len <= 0) {
+		xasprintf(message, "%s", _("No OCSP response stapled."));
+		return STATE_WARNING;
+	}
+	if ((response = d2i_OCSP_RESPONSE(NULL, &der, len)) == NULL) {
+		xasprintf(message, "%s", _("Cannot parse the stapled OCSP response."));
+		return STATE_CRITICAL;
+	}
+	if (OCSP_response_status(response) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+		xasprintf(message, _("OCSP responder error: %s."), OCSP_response_status_str(OCSP_response_status(response)));
+		goto out;
+	}
+	if ((basic = OCSP_response_get1_basic(response)) == NULL) {
+		xasprintf(message, "%s", _("Cannot parse the stapled OCSP response."));
+		goto out;
+	}
+
+	chain = SSL_get_peer_cert_chain(ssl);
+	for (i = 0; chain != NULL && i < sk_X509_num(chain); i++)
+		if (X509_check_issued(sk_X509_value(chain, i), certificate) == X509_V_OK) {
+			issuer = sk_X509_value(chain, i);
+			break;
+		}
+	if (issuer == NULL) {
+		xasprintf(message, "%s", _("The server did not send the issuer of its certificate, cannot verify the OCSP response."));
+		result = STATE_UNKNOWN;
+		goto out;
+	}
+
+	/* the issuer from the chain signs directly, a delegated responder must
+	 * chain up to the system's trusted certificates */
+	if ((store = ocsp_store()) == NULL ||
+	    OCSP_basic_verify(basic, chain, store, OCSP_TRUSTOTHER) <= 0) {
+		ERR_clear_error();
+		xasprintf(message, "%s", _("The signature of the stapled OCSP response does not verify."));
+		goto out;
+	}
+	if ((id = OCSP_cert_to_id(NULL, certificate, issuer)) == NULL ||
+	    !OCSP_resp_find_status(basic, id, status, reason, &revtime, &thisupd, &nextupd)) {
+		xasprintf(message, "%s", _("The stapled OCSP response is not about the server certificate."));
+		goto out;
+	}
+	if (!OCSP_check_validity(thisupd, nextupd, 300, -1)) {
+		ERR_clear_error();
+		xasprintf(message, "%s", _("The stapled OCSP response is out of date."));
+		goto out;
+	}
+
+	*next_update = 0;
+	if (nextupd != NULL && ASN1_TIME_diff(&days, &secs, NULL, nextupd))
+		*next_update = time(NULL) + (time_t) days * 86400 + secs;
+	revoked[0] = '\0';
+	if (*status == V_OCSP_CERTSTATUS_REVOKED && revtime != NULL && (bio = BIO_new(BIO_s_mem())) != NULL) {
+		if (ASN1_GENERALIZEDTIME_print(bio, revtime) > 0 && (n = BIO_read(bio, revoked, revlen - 1)) > 0)
+			revoked[n] = '\0';
+		BIO_free(bio);
+	}
+	result = STATE_OK;
+
+out:
+	OCSP_CERTID_free(id);
+	OCSP_BASICRESP_free(basic);
+	OCSP_RESPONSE_free(response);
+	return result;
+}
+
+/* Judge the certificate by the OCSP response the server stapled to the
+ * handshake, or by the verdict kept from an earlier run */
+static int ocsp_evaluate(SSL *ssl, char **message) {
+	X509 *certificate;
+	char revoked[64] = "";
+	char *key;
+	time_t next_update;
+	int status, reason, result;
+
+	*message = NULL;
+	if ((certificate = SSL_get_peer_certificate(ssl)) == NULL) {
+		xasprintf(message, "%s", _("Cannot retrieve server certificate."));
+		return STATE_CRITICAL;
+	}
+
+	key = ocsp_key(certificate);
+	if (key == NULL || !ocsp_load(key, &status, &reason, revoked, sizeof(revoked))) {
+		result = ocsp_verify(ssl, certificate, &next_update, &status, &reason, revoked, sizeof(revoked), message);
+		if (result != STATE_OK) {
+			free(key);
+			X509_free(certificate);
+			return result;
+		}
+		if (key != NULL && next_update > 0)
+			ocsp_save(key, next_update, status, reason, revoked);
+	}
+	free(key);
 	X509_free(certificate);
+
+	switch (status) {
+	case V_OCSP_CERTSTATUS_GOOD:
+		xasprintf(message, "%s", _("OCSP status of the certificate is good."));
+		return STATE_OK;
+	case V_OCSP_CERTSTATUS_REVOKED:
+		if (reason >= 0)
+			xasprintf(message, _("Certificate was revoked on %s (%s)."), revoked, OCSP_crl_reason_str(reason));
+		else
+			xasprintf(message, _("Certificate was revoked on %s."), revoked);
+		return STATE_CRITICAL;
+	default:
+		xasprintf(message, "%s", _("OCSP status of the certificate is unknown."));
+		return STATE_WARNING;
+	}
+}
+#endif /* USE_OPENSSL */
+
+/* Judge the certificate of the connection by its stapled OCSP response, see
+ * np_net_ssl_ocsp_stapling(). Returns the state, and what was found in
+ * *message, without the state in front. */
+int np_net_ssl_check_ocsp(char **message) {
+	return np_net_tls_check_ocsp(tls, message);
+}
+
+int np_net_tls_check_ocsp(np_tls *conn, char **message) {
+#ifdef USE_OPENSSL
+	return ocsp_evaluate(conn->ssl, message);
+#else /* ifndef USE_OPENSSL */
+	xasprintf(message, "%s", _("Plugin does not support checking OCSP responses."));
+	return STATE_WARNING;
+#endif /* USE_OPENSSL */
+}
+
+int np_net_ssl_check_certificate(X509 *certificate, int days_till_exp_warn, int days_till_exp_crit){
+#  ifdef USE_OPENSSL
+	char *message=NULL;
+	int status;
+
+	status = cert_evaluate(certificate, days_till_exp_warn, days_till_exp_crit, &message);
+	printf("%s - %s\n", state_text(status), message);
+	free(message);
+	if (certificate)
+		X509_free(certificate);
 	return status;
 #  else /* ifndef USE_OPENSSL */
 	printf("%s\n", _("WARNING - Plugin does not support checking certificates."));
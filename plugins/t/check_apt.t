@@ -7,6 +7,8 @@
 use strict;
 use Test::More;
 use NPTest;
+use File::Copy;
+use File::Temp qw(tempdir);
 
 sub make_result_regexp {
     my ($warning, $critical) = @_;
@@ -23,7 +25,7 @@ sub make_result_regexp {
 }
 
 if (-x "./check_apt") {
-	plan tests => 36;
+	plan tests => 42;
 } else {
 	plan skip_all => "No check_apt compiled";
 }
@@ -104,3 +106,26 @@ $result = NPTest->testCmd( sprintf($testfile_command, "", "ubuntu2") );
 is( $result->return_code, 2, "Ubuntu apt output, some critical" );
 like( $result->output, make_result_regexp(25, 14), "Output correct" );
 
+
+SKIP: {
+	skip "No dpkg status or apt lists to cache against", 6 unless (-f "/var/lib/dpkg/status" && -d "/var/lib/apt/lists");
+
+	my $state_dir = tempdir(CLEANUP => 1);
+	local $ENV{MP_STATE_PATH} = $state_dir;
+
+	$result = NPTest->testCmd( sprintf($testfile_command, "--cache", "debian3") );
+	like( $result->output, make_result_regexp(19, 4), "First run with --cache reads the output" );
+
+	$result = NPTest->testCmd( sprintf($testfile_command, "--cache", "debian1") );
+	is( $result->return_code, 2, "Second run with --cache uses the cached output" );
+	like( $result->output, make_result_regexp(19, 4), "Output correct" );
+
+	copy("t/check_apt_input/debian3", "$state_dir/summary");
+	$result = NPTest->testCmd( "./check_apt --summary-file=$state_dir/summary" );
+	is( $result->return_code, 2, "Summary file read instead of running apt-get" );
+	like( $result->output, make_result_regexp(19, 4), "Output correct" );
+
+	utime(0, 946684800, "$state_dir/summary");
+	$result = NPTest->testCmd( "./check_apt --summary-file=$state_dir/summary" );
+	is( $result->return_code, 3, "Summary file older than the package lists is UNKNOWN" );
+}
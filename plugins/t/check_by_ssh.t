@@ -16,7 +16,7 @@ my $ssh_conf    = getTestParameter( "NP_SSH_CONFIGFILE", "A config file with ssh
 
 plan skip_all => "SSH_HOST and SSH_IDENTITY must be defined" unless ($ssh_service && $ssh_key);
 
-plan tests => 42;
+plan tests => 49;
 
 # Some random check strings/response
 my @responce = ('OK: Everything is fine',
@@ -151,3 +151,18 @@ for (0, 1, 2, 3, 4) {
 }
 unlink("/tmp/check_by_ssh.$$") or die("Unable to unlink '/tmp/check_by_ssh.$$': $!");
 
+
+# the same in sessions of their own, side by side
+$result = NPTest->testCmd(
+	"./check_by_ssh -i $ssh_key -H $ssh_service -n flint -s c0:c1:c2:c3:c4 -C '$check[0];sh -c exit\\ 0' -C '$check[1];sh -c exit\\ 1' -C '$check[2];sh -c exit\\ 2' -C '$check[3];sh -c exit\\ 3' -C '$check[4];sh -c exit\\ 9' -O /tmp/check_by_ssh.$$ --parallel=3"
+	);
+cmp_ok($result->return_code, '==', 0, "Exit always ok on parallel passive checks");
+open(PASV, "/tmp/check_by_ssh.$$") or die("Unable to open '/tmp/check_by_ssh.$$': $!");
+@pasv = <PASV>;
+close(PASV) or die("Unable to close '/tmp/check_by_ssh.$$': $!");
+cmp_ok(scalar(@pasv), '==', 5, 'Five passive results for five parallel checks');
+for (0, 1, 2, 3, 4) {
+	my $ret = $_ == 4 ? 9 : $_;
+	like($pasv[$_] // '', '/^\[\d+\] PROCESS_SERVICE_CHECK_RESULT;flint;c' . $_ . ';' . $ret . ';' . $responce_re[$_] . '$/', "proper result for parallel passive check $_");
+}
+unlink("/tmp/check_by_ssh.$$") or die("Unable to unlink '/tmp/check_by_ssh.$$': $!");
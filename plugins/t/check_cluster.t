@@ -5,8 +5,9 @@
 #
 
 use strict;
-use Test::More tests => 15;
+use Test::More tests => 20;
 use NPTest;
+use File::Temp qw(tempfile);
 
 my $result;
 
@@ -80,3 +81,31 @@ $result = NPTest->testCmd(
 	"./check_cluster -h -w 0 -c 1 -d 0,0,1,1"
 	);
 cmp_ok( $result->return_code, '==', 2, "Exit Critical if non-ok hosts exceed critical warning (no ranges)" );
+
+#
+# Member states read from a feed
+#
+my ($fh, $feed) = tempfile(UNLINK => 1);
+print $fh "web 0\nweb 1\nweb 2\ndb;0\ndb;1\nother 2\n";
+close $fh;
+
+$result = NPTest->testCmd(
+	"./check_cluster -s -w 0 -c 1 -f $feed --cluster web"
+	);
+cmp_ok( $result->return_code, '==', 2, "Exit CRITICAL if non-ok services in the feed exceed critical" );
+
+$result = NPTest->testCmd(
+	"./check_cluster -s -w 0 -c 2 -f $feed --cluster web"
+	);
+cmp_ok( $result->return_code, '==', 1, "Only members of the named cluster are counted" );
+
+$result = NPTest->testCmd(
+	"./check_cluster -h -w 0 -c 2 -f $feed --cluster web -w 0 -c 0 -l Databases --cluster db"
+	);
+cmp_ok( $result->return_code, '==', 2, "Each cluster is checked against its own thresholds" );
+like( $result->output, qr/2 clusters/, "Output counts the clusters" );
+
+$result = NPTest->testCmd(
+	"./check_cluster -s -w 0 -c 0 -f - --cluster web < $feed"
+	);
+cmp_ok( $result->return_code, '==', 2, "Feed can be read from stdin" );
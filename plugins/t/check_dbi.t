@@ -15,7 +15,7 @@ use vars qw($tests);
 
 plan skip_all => "check_dbi not compiled" unless (-x "check_dbi");
 
-$tests = 20;
+$tests = 23;
 plan tests => $tests;
 
 my $missing_driver_output = "failed to open DBI driver 'sqlite3'";
@@ -96,6 +96,20 @@ SKIP: {
 	cmp_ok($result->return_code, '==', 0, "QUERY_TIME metric okay");
 	like($result->output, $query_time_output, "QUERY_TIME metric output okay");
 
+	my $queries = File::Temp->new(
+		TEMPLATE => "/tmp/check_dbi_queries.XXXXXXX",
+		UNLINK   => 1,
+	);
+	print $queries "# two queries over one connection\n";
+	print $queries "-q 'SELECT COUNT(*) FROM test' -w 1 -l rows\n";
+	print $queries "-q 'SELECT b FROM test' -e text1\n";
+	close $queries;
+
+	$result = NPTest->testCmd("$check_cmd --queries=" . $queries->filename);
+	cmp_ok($result->return_code, '==', 1, "Worst state of all queries");
+	like($result->output, "/^WARNING - connection time: [0-9\.]+s, 2 queries: 1 ok, 1 warning, 0 critical, 0 unknown \\| .* rows=2.000000;1;;; rows_time=[0-9\.]+s;;;0; query2_time=/", "Summary with perfdata of each query");
+	like($result->output, "/^OK query2: 'SELECT b FROM test' returned 'text1' in [0-9\.]+s\$/m", "Line per query");
+
 	$result = NPTest->testCmd("./check_dbi -d nodriver -q ''");
 	cmp_ok($result->return_code, '==', 3, "Unknown DBI driver");
 	like($result->output, $bad_driver_output, "Correct error message");
@@ -23,7 +23,7 @@ my $mountpoint2_valid = getTestParameter( "NP_MOUNTPOINT2_VALID", "Path to anoth
 if ($mountpoint_valid eq "" or $mountpoint2_valid eq "") {
 	plan skip_all => "Need 2 mountpoints to test";
 } else {
-	plan tests => 78;
+	plan tests => 83;
 }
 
 $result = NPTest->testCmd( 
@@ -350,3 +350,28 @@ unlike( $result->output, qr/$mountpoint2_valid/, "output data does not have $mou
 $result = NPTest->testCmd( "./check_disk -w 0% -c 0% -p $mountpoint_valid -p $mountpoint2_valid -i '^barbazJodsf\$'");
 like( $result->output, qr/$mountpoint_valid/, "ignore: output data does have $mountpoint_valid when regex doesn't match");
 like( $result->output, qr/$mountpoint2_valid/,"ignore: output data does have $mountpoint2_valid when regex doesn't match");
+
+# threads: the result does not depend on how the file systems are queried
+$result = NPTest->testCmd( "./check_disk -w 0% -c 0% -p $mountpoint_valid -p $mountpoint2_valid --stat-threads=0" );
+my $serial_output = $result->output;
+$result = NPTest->testCmd( "./check_disk -w 0% -c 0% -p $mountpoint_valid -p $mountpoint2_valid --stat-threads=1" );
+is( $result->output, $serial_output, "--stat-threads=1 gives the same output as --stat-threads=0");
+
+$result = NPTest->testCmd( "./check_disk -w 0% -c 0% -p $mountpoint_valid --mount-timeout-state=foo" );
+cmp_ok( $result->return_code, '==', 3, "Invalid --mount-timeout-state");
+
+$result = NPTest->testCmd( "./check_disk -w 0% -c 0% -p $mountpoint_valid --mount-timeout=0" );
+cmp_ok( $result->return_code, '==', 3, "Invalid --mount-timeout");
+
+# mount cache: a cached run gives the same output as an uncached one
+$ENV{MP_STATE_PATH} = "/tmp/check_disk_state.$$";
+$result = NPTest->testCmd( "./check_disk --mount-cache -w 0% -c 0% -r '^$mountpoint_valid\$' -p $mountpoint2_valid" );
+$result = NPTest->testCmd( "./check_disk --mount-cache -w 0% -c 0% -r '^$mountpoint_valid\$' -p $mountpoint2_valid" );
+my $cached_output = $result->output;
+$result = NPTest->testCmd( "./check_disk -w 0% -c 0% -r '^$mountpoint_valid\$' -p $mountpoint2_valid" );
+is( $cached_output, $result->output, "--mount-cache gives the same output from the cache");
+system( "rm -rf $ENV{MP_STATE_PATH}" );
+delete $ENV{MP_STATE_PATH};
+
+$result = NPTest->testCmd( "./check_disk -w 0% -c 0% -p $mountpoint_valid --mount-cache" );
+cmp_ok( $result->return_code, '==', 3, "--mount-cache after a path is refused");
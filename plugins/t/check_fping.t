@@ -10,10 +10,11 @@ use NPTest;
 
 use vars qw($tests);
 
-BEGIN {$tests = 4; plan tests => $tests}
+BEGIN {$tests = 6; plan tests => $tests}
 
 my $successOutput = '/^FPING OK - /';
 my $failureOutput = '/^FPING CRITICAL - /';
+my $targetsOutput = '/^FPING CRITICAL - 2 targets: 1 ok, 0 warning, 1 critical, 0 unknown\|/';
 
 my $host_responsive    = getTestParameter("NP_HOST_RESPONSIVE", "The hostname of system responsive to network requests", "localhost");
 my $host_nonresponsive = getTestParameter("NP_HOST_NONRESPONSIVE", "The hostname of system not responsive to network requests", "10.0.0.1");
@@ -32,6 +33,18 @@ elsif ( $> != 0 && (!$fping || ! -u $fping)) {
   $t += checkCmd( "./check_fping $host_responsive",    0,       $successOutput );
   $t += checkCmd( "./check_fping $host_nonresponsive", [ 1, 2 ] );
   $t += checkCmd( "./check_fping $hostname_invalid",   [ 1, 2 ] );
+
+  # --targets pings from the plugin itself
+  if ( $> != 0 ) {
+    $t += skipMsg( "./check_fping --targets needs root", 2 );
+  } else {
+    my $targets = "/tmp/check_fping_targets.$$";
+    open(my $fh, '>', $targets) or die "Cannot write $targets: $!";
+    print $fh "# one up, one down\n$host_responsive\n$host_nonresponsive\n";
+    close($fh);
+    $t += checkCmd( "./check_fping --targets=$targets -T 500", 2, $targetsOutput );
+    unlink($targets);
+  }
 }
 
 exit(0) if defined($Test::Harness::VERSION);
@@ -5,7 +5,7 @@
 #
 
 use strict;
-use Test::More tests => 7;
+use Test::More tests => 9;
 use NPTest;
 
 my $host_tcp_smtp      = getTestParameter("NP_HOST_TCP_SMTP", "A host providing an STMP Service (a mail server)", "mailhost");
@@ -36,3 +36,9 @@ cmp_ok( $t->return_code, '==', 1, "Got warning with bad response" );
 $t = NPTest->testCmd( "./check_imap -H $host_tcp_imap -e unlikely_string -M crit");
 cmp_ok( $t->return_code, '==', 2, "Got critical error with bad response" );
 
+
+$t = NPTest->testCmd( "./check_imap -H $host_tcp_imap --starttls" );
+like( $t->output, '/time_banner=[\d\.]+s;.* time_tls=[\d\.]+s;/', "Greeting and STARTTLS handshake timed apart" );
+
+$t = NPTest->testCmd( "./check_imap -H $host_tcp_imap --authuser=nobody" );
+cmp_ok( $t->return_code, '==', 3, "Login needs a password" );
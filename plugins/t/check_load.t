@@ -14,7 +14,7 @@ my $loadValue = "[0-9]+\.?[0-9]+";
 my $successOutput = "/^OK - load average: $loadValue, $loadValue, $loadValue/";
 my $failureOutput = "/^CRITICAL - load average: $loadValue, $loadValue, $loadValue/";
 
-plan tests => 11;
+plan tests => 18;
 
 $res = NPTest->testCmd( "./check_load -w 100,100,100 -c 100,100,100" );
 cmp_ok( $res->return_code, 'eq', 0, "load not over 100");
@@ -34,3 +34,26 @@ like( $res->output, $successOutput, "Output OK");
 like( $res->perf_output, "/load1=$loadValue;100.000;100.000/", "Test handling of non triplet thresholds (load1)");
 like( $res->perf_output, "/load5=$loadValue;100.000;110.000/", "Test handling of non triplet thresholds (load5)");
 like( $res->perf_output, "/load15=$loadValue;100.000;110.000/", "Test handling of non triplet thresholds (load15)");
+
+SKIP: {
+	skip "no pressure stall information", 3 unless -r "/proc/pressure/cpu";
+
+	$res = NPTest->testCmd( "./check_load -w 100 -c 100 --pressure-warning=100,100,100 --pressure-critical=100,100,100" );
+	cmp_ok( $res->return_code, 'eq', 0, "pressure not over 100%");
+	like( $res->perf_output, "/cpu_pressure=[0-9.]+%;100.0+;100.0+;/", "Pressure in perfdata");
+
+	$res = NPTest->testCmd( "./check_load -w 100 -c 100 --pressure-warning=20 --pressure-critical=10" );
+	cmp_ok( $res->return_code, 'eq', 3, "Pressure warning over critical is refused");
+}
+
+SKIP: {
+	skip "no /proc/meminfo", 4 unless -r "/proc/meminfo";
+
+	$res = NPTest->testCmd( "./check_load --vitals -w 100 -c 100 --zombies-warning=1000000" );
+	cmp_ok( $res->return_code, 'eq', 0, "vitals within their thresholds");
+	like( $res->output, "/^OK - load average: $loadValue, $loadValue, $loadValue, memory [0-9]+% available .* zombies of [0-9]+ processes/", "All parts in the output");
+	like( $res->perf_output, "/memory=[0-9]+MB;;;0;[0-9]+ .*zombies=[0-9]+;1000000;;0 procs=[0-9]+/", "Memory and zombies in perfdata");
+
+	$res = NPTest->testCmd( "./check_load --vitals --memory-critical=100%" );
+	cmp_ok( $res->return_code, 'eq', 2, "Memory available at most 100% is critical");
+}
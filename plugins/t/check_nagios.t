@@ -11,7 +11,7 @@ use NPTest;
 if (`uname -s` eq "SunOS\n") {
         plan skip_all => "Ignoring tests on solaris because of pst3";
 } else {
-        plan tests => 13;
+        plan tests => 15;
 }
 
 my $successOutput = '/^NAGIOS OK: /';
@@ -55,6 +55,13 @@ cmp_ok( $result->return_code, "==", 1, "Log correctly seen as over 1 minute old"
 my ($age) = ($_ = $result->output) =~ /status log updated (\d+) seconds ago/;
 like( $age, '/^6[0-9]$/', "Log correctly seen as between 60-69 seconds old" );
 
+$result = NPTest->testCmd(
+        "./check_nagios -F $nagios1.tmp -e 1 -B -C $procname"
+        );
+cmp_ok( $result->return_code, "==", 1, "Log read backwards seen as over 1 minute old" );
+($age) = ($_ = $result->output) =~ /status log updated (\d+) seconds ago/;
+like( $age, '/^6[0-9]$/', "Last entry is between 60-69 seconds old" );
+
 $result = NPTest->testCmd(
 	"./check_nagios -F $nagios1.tmp -e 5 -C unlikely_command_string"
 	);
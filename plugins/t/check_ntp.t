@@ -10,8 +10,9 @@ use NPTest;
 
 my @PLUGINS1 = ('check_ntp', 'check_ntp_peer', 'check_ntp_time');
 my @PLUGINS2 = ('check_ntp_peer');
+my @PLUGINS3 = ('check_ntp', 'check_ntp_time');
 
-plan tests => (12 * scalar(@PLUGINS1)) + (6 * scalar(@PLUGINS2));
+plan tests => (12 * scalar(@PLUGINS1)) + (8 * scalar(@PLUGINS2)) + (2 * scalar(@PLUGINS3));
 
 my $res;
 
@@ -88,7 +89,7 @@ foreach my $plugin (@PLUGINS1) {
 
 foreach my $plugin (@PLUGINS2) {
 	SKIP: {
-		skip "No NTP server defined", 6 unless $ntp_service;
+		skip "No NTP server defined", 8 unless $ntp_service;
 		$res = NPTest->testCmd(
 			"./$plugin -H $ntp_service -w 1000 -c 2000 -W 20 -C 21 -j 100000 -k 200000 -m 1: -n 0:"
 			);
@@ -106,5 +107,22 @@ foreach my $plugin (@PLUGINS2) {
 			);
 		cmp_ok( $res->return_code, '==', 2, "$plugin: Critical NTP result with jitter, stratum, and truechimers check" );
 		like( $res->output, $ntp_critmatch2, "$plugin: Output match CRITICAL with jitter, stratum, and truechimers" );
+
+		$res = NPTest->testCmd(
+			"./$plugin -H $ntp_service -w 1000 -c 2000 -W 20 -C 21 -j 100000 -k 200000 -m 1: -n 0: --pipeline=8"
+			);
+		cmp_ok( $res->return_code, '==', 0, "$plugin: Good NTP result with pipelined requests" );
+		like( $res->output, $ntp_okmatch2, "$plugin: Output match OK with pipelined requests" );
+	}
+}
+
+foreach my $plugin (@PLUGINS3) {
+	SKIP: {
+		skip "No NTP server defined", 2 unless $ntp_service;
+		$res = NPTest->testCmd(
+			"./$plugin -H $ntp_service -w 1000 -c 2000 --adaptive --stable=1"
+			);
+		cmp_ok( $res->return_code, '==', 0, "$plugin: Good NTP result (adaptive)" );
+		like( $res->output, $ntp_okmatch1, "$plugin: Output match OK (adaptive)" );
 	}
 }
@@ -8,7 +8,7 @@ use strict;
 use Test::More;
 use NPTest;
 
-plan tests => 20;
+plan tests => 26;
 
 my $successOutput = '/PING (ok|OK) - Packet loss = +[0-9]{1,2}\%, +RTA = [\.0-9]+ ms/';
 my $failureOutput = '/Packet loss = +[0-9]{1,2}\%, +RTA = [\.0-9]+ ms/';
@@ -107,3 +107,26 @@ $res = NPTest->testCmd(
 is( $res->return_code, 3, "No hostname" );
 like( $res->output, '/You must specify a server address or host name/', "Output with appropriate error message");
 
+
+# --native pings from the plugin itself, over a raw socket as root
+SKIP: {
+	skip "check_ping --native needs root", 6 if $> != 0;
+
+	$res = NPTest->testCmd(
+		"./check_ping -H $host_responsive -w 10,100% -c 10,100% -p 2 --native"
+		);
+	is( $res->return_code, 0, "Native: syntax ok" );
+	like( $res->output, $successOutput, "Native: output OK" );
+
+	$res = NPTest->testCmd(
+		"./check_ping -H $host_responsive -w 0,0% -c 0,0% -p 1 --native"
+		);
+	is( $res->return_code, 2, "Native: forced critical" );
+	like( $res->output, $failureOutput, "Native: output OK" );
+
+	$res = NPTest->testCmd(
+		"./check_ping -H $host_nonresponsive -w 10,100% -c 10,100% -p 1 -t 5 --native"
+		);
+	is( $res->return_code, 2, "Native: host nonresponsive" );
+	like( $res->output, '/100%|Unreachable/', "Native: 100% packet loss or unreachable" );
+}
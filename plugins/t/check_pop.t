@@ -8,7 +8,7 @@ use strict;
 use Test::More;
 use NPTest;
 
-plan tests => 5;
+plan tests => 6;
 
 my $host_tcp_smtp = getTestParameter( 
 			"NP_HOST_TCP_SMTP",
@@ -53,3 +53,6 @@ cmp_ok( $res->return_code, '==', 2, "Non responsive host");
 
 $res = NPTest->testCmd( "./check_pop $hostname_invalid" );
 cmp_ok( $res->return_code, '==', 2, "Invalid host");
+
+$res = NPTest->testCmd( "./check_pop -H $host_tcp_pop --authuser=nobody --authpass=none" );
+cmp_ok( $res->return_code, '==', 2, "Login with a wrong password");
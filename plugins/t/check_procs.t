@@ -13,7 +13,7 @@ my $t;
 if (`uname -s` eq "SunOS\n" && ! -x "/usr/local/nagios/libexec/pst3") {
 	plan skip_all => "Ignoring tests on solaris because of pst3";
 } else {
-	plan tests => 14;
+	plan tests => 17;
 }
 
 my $result;
@@ -47,3 +47,7 @@ $result = NPTest->testCmd( "./check_procs -w 0 -c 100000 -p 1" );
 is( $result->return_code, 1, "Checking warning for processes by parentid = 1" );
 like( $result->output, '/^PROCS WARNING: [0-9]+ process(es)? with PPID = 1/', "Output correct" );
 
+$result = NPTest->testCmd( "./check_procs --debug -C init" );
+is( $result->return_code, 0, "Checking --debug" );
+like( $result->output, '/^PROCS OK: [0-9]+ process(es)? with command name \'init\'/', "Output correct" );
+like( $result->output, '/^[0-9]+ files opened for [0-9]+ processes: [0-9]+ stat, 0 status, 0 cmdline, 0 io, [0-9]+ exe$/m', "Only stat and exe opened for -C" );
@@ -15,7 +15,7 @@ my $hostname_invalid   = getTestParameter("NP_HOSTNAME_INVALID", "An invalid (no
 
 
 plan skip_all => "SSH_HOST must be defined" unless $ssh_host;
-plan tests    => 6;
+plan tests    => 10;
 
 
 my $result = NPTest->testCmd(
@@ -39,3 +39,16 @@ $result = NPTest->testCmd(
 cmp_ok($result->return_code, '==', 3, "Exit with return code 0 (OK)");
 like($result->output, '/^check_ssh: Invalid hostname/', "Status text if command returned none (OK)");
 
+
+$result = NPTest->testCmd(
+    "printf '$ssh_host\\n$host_nonresponsive\\n' | ./check_ssh --targets=- -t 2"
+    );
+cmp_ok($result->return_code, '==', 2, "One target down is critical");
+like($result->output, '/^SSH CRITICAL - 2 targets: 1 ok, 0 warning, 1 critical, 0 unknown\|/', "Summary of all targets");
+
+
+$result = NPTest->testCmd(
+    "printf '$ssh_host\\n' | ./check_ssh --targets=- --passive=sshd"
+    );
+cmp_ok($result->return_code, '==', 0, "Passive results for all targets are OK");
+like($result->output, "/^\\[\\d+\\] PROCESS_SERVICE_CHECK_RESULT;$ssh_host;sshd;0;SSH OK - /", "External command per target");
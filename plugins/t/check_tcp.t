@@ -11,7 +11,7 @@ use vars qw($tests $has_ipv6);
 BEGIN {
     use NPTest;
     $has_ipv6 = NPTest::has_ipv6();
-    $tests = $has_ipv6 ? 14 : 11;
+    $tests = $has_ipv6 ? 19 : 16;
 }
 
 
@@ -27,24 +27,31 @@ my $failedExpect = '/^TCP WARNING\s-\sUnexpected response from host/socket on po
 
 my $t;
 
-$tests = $tests - 4 if $internet_access eq "no";
+$tests = $tests - 6 if $internet_access eq "no";
 plan tests => $tests;
 
 $t += checkCmd( "./check_tcp $host_tcp_http      -p 80 -wt 300 -ct 600",       0, $successOutput );
 $t += checkCmd( "./check_tcp $host_tcp_http      -p 81 -wt   0 -ct   0 -to 1", 2 ); # use invalid port for this test
 $t += checkCmd( "./check_tcp $host_nonresponsive -p 80 -wt   0 -ct   0 -to 1", 2 );
 $t += checkCmd( "./check_tcp $hostname_invalid   -p 80 -wt   0 -ct   0 -to 1", 2 );
+$t += checkCmd( "./check_tcp $host_tcp_http      -p 80 --adaptive-timeout=3",  0, '/ connect_timeout=[0-9.]+s;/' );
 if($internet_access ne "no") {
     $t += checkCmd( "./check_tcp -S -D 1 -H $host_tls_http -p 443",              0 );
     $t += checkCmd( "./check_tcp -S -D 9000,1    -H $host_tls_http -p 443",      1 );
     $t += checkCmd( "./check_tcp -S -D 9000      -H $host_tls_http -p 443",      1 );
     $t += checkCmd( "./check_tcp -S -D 9000,8999 -H $host_tls_http -p 443",      2 );
+    $t += checkCmd( "printf '$host_tls_http:443:$host_tls_http\\n' | ./check_tcp --targets=- -D 1", 0, '/^TCP OK - 1 targets: 1 ok, .*_handshake=/' );
+    $t += checkCmd( "printf '$host_tls_http 443\\n' | ./check_tcp --targets=- -D 9000,8999", 2, '/second handshake, Certificate /' );
 }
 
 # Need the \r\n to make it more standards compliant with web servers. Need the various quotes
 # so that perl doesn't interpret the \r\n and is passed onto command line correctly
 $t += checkCmd( "./check_tcp $host_tcp_http      -p 80 -E -s ".'"GET / HTTP/1.1\r\n\r\n"'." -e 'ThisShouldntMatch' -j", 1, $failedExpect );
 
+# Multi-target mode
+$t += checkCmd( "printf '$host_tcp_http\\n' | ./check_tcp --targets=- -p 80 -wt 300 -ct 600", 0, '/^TCP OK - 1 targets: 1 ok, 0 warning, 0 critical, 0 unknown\|/' );
+$t += checkCmd( "printf '$host_tcp_http 80\\n$host_tcp_http:81\\n' | ./check_tcp --targets=- -to 1", 2, '/^TCP CRITICAL - 2 targets: 1 ok, 0 warning, 1 critical, 0 unknown\|/' );
+
 # IPv6 checks
 if($has_ipv6) {
   $t += checkCmd( "./check_tcp $host_tcp_http      -p 80 -wt 300 -ct 600 -6 ",   0, $successOutput );
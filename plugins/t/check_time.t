@@ -9,7 +9,7 @@ use Test;
 use NPTest;
 
 use vars qw($tests);
-BEGIN {$tests = 8; plan tests => $tests}
+BEGIN {$tests = 10; plan tests => $tests}
 
 my $host_udp_time      = getTestParameter("NP_HOST_UDP_TIME", "A host providing the UDP Time Service", "localhost");
 my $host_nonresponsive = getTestParameter("NP_HOST_NONRESPONSIVE", "The hostname of system not responsive to network requests", "10.0.0.1");
@@ -28,6 +28,9 @@ $t += checkCmd( "./check_time -H $host_udp_time -w 999999    -W 59 -c 999999
 # reverse compatibility mode
 $t += checkCmd( "./check_time    $host_udp_time -wt 59 -ct 59 -cd 999999 -wd 999999 -to 60",  0, $successOutput, %exceptions );
 
+# several servers at once
+$t += checkCmd( "printf '$host_udp_time\\n' | ./check_time --targets=- -w 999999 -c 999999 -t 60", 0, '/^TIME OK - 1 servers: 1 ok, 0 warning, 0 critical, 0 unknown, median offset [-+][0-9.]+ seconds, 0 outliers\|/', %exceptions );
+
 # failure mode
 $t += checkCmd( "./check_time -H $host_nonresponsive -t 1", 2 );
 $t += checkCmd( "./check_time -H $hostname_invalid   -t 1", 3 );
@@ -13,7 +13,7 @@ use Test;
 use NPTest;
 
 use vars qw($tests);
-BEGIN {$tests = 8; plan tests => $tests}
+BEGIN {$tests = 12; plan tests => $tests}
 
 my $successOutput = '/^USERS OK - [0-9]+ users currently logged in/';
 my $failureOutput = '/^USERS CRITICAL - [0-9]+ users currently logged in/';
@@ -24,6 +24,8 @@ $t += checkCmd( "./check_users 1000 1000", 0, $successOutput );
 $t += checkCmd( "./check_users    0    0", 2, $failureOutput );
 $t += checkCmd( "./check_users -w 0:1000 -c 0:1000", 0, $successOutput );
 $t += checkCmd( "./check_users -w 0:0 -c 0:0", 2, $failureOutput );
+$t += checkCmd( "./check_users -w 1000 -c 1000 -g user --group-warning=1000", 0, $successOutput );
+$t += checkCmd( "./check_users -w 1000 -c 1000 -g tty --group-critical=0", 2, '/^USERS CRITICAL - [0-9]+ users currently logged in \(/' );
 
 exit(0) if defined($Test::Harness::VERSION);
 exit($tests - $t);
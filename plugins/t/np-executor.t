@@ -0,0 +1,127 @@
+#! /usr/bin/perl -w -I ..
+#
+# np-executor tests
+#
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use IO::Socket::UNIX;
+use POSIX ":sys_wait_h";
+use Cwd;
+
+plan tests => 31;
+
+my $res;
+my $socket = "/tmp/np-executor.$$.sock";
+
+$res = NPTest->testCmd("./np-executor");
+is( $res->return_code, 3, "No socket" );
+like( $res->output, "/A socket path must be specified/", "Correct usage message");
+
+$res = NPTest->testCmd("./np-executor -l");
+is( $res->return_code, 0, "List entries" );
+like( $res->output, "/^check_dummy \\(reentrant\\)\$/m", "check_dummy is listed");
+
+$res = NPTest->testCmd("./np-executor check_dummy 1 'run directly'");
+is( $res->return_code, 1, "Entry named as first argument runs directly" );
+is( $res->output, "WARNING: run directly", "With the plugin's output" );
+
+my $linkdir = "/tmp/np-executor.$$.d";
+mkdir $linkdir;
+symlink(Cwd::abs_path("./np-executor"), "$linkdir/check_dummy");
+$res = NPTest->testCmd("$linkdir/check_dummy 2 'through a link'");
+is( $res->return_code, 2, "Called as an entry through a link" );
+is( $res->output, "CRITICAL: through a link", "Runs that entry" );
+unlink "$linkdir/check_dummy";
+rmdir $linkdir;
+
+my $pid = fork();
+if ($pid == 0) {
+	exec("./np-executor", "-s", $socket, "-w", "2");
+	exit 3;
+}
+for (my $i = 0; $i < 50 && ! -S $socket; $i++) {
+	select(undef, undef, undef, 0.1);
+}
+
+sub request {
+	my $line = shift;
+	my $client = IO::Socket::UNIX->new(Type => SOCK_STREAM, Peer => $socket)
+		or return (undef, undef);
+	print $client "$line\n";
+	my $rc = <$client>;
+	chomp $rc if defined $rc;
+	my $output = do { local $/; <$client> };
+	close $client;
+	$output = "" unless defined $output;
+	chomp $output;
+	return ($rc, $output);
+}
+
+my ($rc, $output) = request("check_dummy 0");
+is( $rc, 0, "OK state returned");
+is( $output, "OK", "Says 'OK'");
+
+($rc, $output) = request("check_dummy 1 'more stuff'");
+is( $rc, 1, "Warning with quoted text");
+is( $output, "WARNING: more stuff", "optional text okay" );
+
+($rc, $output) = request("check_dummy");
+is( $rc, 3, "die() inside a check returns UNKNOWN");
+like( $output, "/Could not parse arguments/", "Correct usage message");
+
+($rc, $output) = request("check_dummy 2 'still alive'");
+is( $rc, 2, "Worker survived the usage error");
+is( $output, "CRITICAL: still alive", "Output of next check is clean" );
+
+($rc, $output) = request("negate /usr/lib/check_dummy 0 'fine'");
+is( $rc, 2, "negate runs an entry in-process");
+is( $output, "OK: fine", "Output unchanged without -s" );
+
+($rc, $output) = request("negate -s /usr/lib/check_dummy 2 'CRITICAL twice'");
+is( $rc, 0, "negate -s inverts CRITICAL");
+is( $output, "OK: OK twice", "Status words replaced" );
+
+($rc, $output) = request("negate -o WARNING ./check_dummy 0 'next'");
+is( $rc, 1, "Worker after negate serves the next request");
+is( $output, "OK: next", "With clean output" );
+
+($rc, $output) = request("urlize http://example.com/ ./check_dummy 1 'in anchor'");
+is( $rc, 1, "urlize runs an entry in-process");
+is( $output, '<A href="http://example.com/">WARNING: in anchor</A>', "First line wrapped in the anchor" );
+
+($rc, $output) = request("check_nonexistent");
+is( $rc, 3, "Unknown plugin" );
+like( $output, "/check_nonexistent is not available/", "With appropriate error message");
+
+kill 'TERM', $pid;
+waitpid($pid, 0);
+unlink $socket;
+
+my $metrics = "/tmp/np-executor.$$.metrics";
+$pid = fork();
+if ($pid == 0) {
+	exec("./np-executor", "-s", $socket, "-w", "2", "-M", $metrics);
+	exit 3;
+}
+for (my $i = 0; $i < 50 && ! -S $metrics; $i++) {
+	select(undef, undef, undef, 0.1);
+}
+request("check_dummy 0") for (1..3);
+request("check_dummy 1 'once more'");
+
+my $client = IO::Socket::UNIX->new(Type => SOCK_STREAM, Peer => $metrics);
+my $text = defined $client ? do { local $/; <$client> } : "";
+$text = "" unless defined $text;
+like( $text, "/^np_executor_workers 2\$/m", "Metrics of the workers");
+like( $text, '/^np_executor_phase_seconds_count\{plugin="check_dummy",phase="check"\} 4$/m',
+	"Every check of a plugin in its histogram");
+like( $text, '/^np_executor_phase_seconds_bucket\{plugin="check_dummy",phase="check",le="\+Inf"\} 4$/m',
+	"With all of them in the last bucket");
+like( $text, '/^np_executor_in_flight\{plugin="check_dummy"\} 0$/m', "None running now");
+like( $text, "/# EOF\n\\z/", "The end of the exposition");
+
+kill 'TERM', $pid;
+waitpid($pid, 0);
@@ -0,0 +1,259 @@
+#! /usr/bin/perl -w
+#
+# Scale benchmarks of the network plugins against target_farm.pl
+#
+# Every plugin that is built is run against thousands of mock endpoints,
+# once per target with a number of checks in flight at the same time, and
+# in its multi-target mode with all of the targets in one list. For each
+# scenario the checks per second, the 99th percentile of the time a check
+# took and the largest resident set of a plugin process are reported, the
+# way np-bench reports: a status line with all of the numbers as
+# performance data.
+#
+# check_icmp needs real addresses to answer echo requests, so it is only
+# run as root: a network namespace behind a veth pair takes all of
+# 198.18.0.0/15, and netem on the link adds the latency and the loss.
+#
+# Usage: perl bench_scale.pl [-d plugindir] [-r rootplugindir] [-e endpoints]
+#        [-n checks] [-c concurrency] [-l latency_ms] [-j jitter_ms]
+#        [-L loss_pct] [-s scenario_regex] [-v]
+#
+
+use strict;
+use Getopt::Long;
+use Socket;
+use IO::Select;
+use File::Temp qw(tempfile);
+use FindBin;
+use Time::HiRes qw(time);
+
+Getopt::Long::Configure("no_ignore_case");
+
+my %opt = (
+	d => "..",
+	r => "../../plugins-root",
+	e => 1000,
+	n => 500,
+	c => 50,
+	l => 5,
+	j => 1,
+	L => 0,
+	s => ".",
+);
+GetOptions(\%opt, "d=s", "r=s", "e=i", "n=i", "c=i", "l=f", "j=f", "L=f", "s=s", "v")
+	or die "Usage: $0 [-d plugindir] [-r rootplugindir] [-e endpoints] [-n checks] [-c concurrency]\n"
+	. "       [-l latency_ms] [-j jitter_ms] [-L loss_pct] [-s scenario_regex] [-v]\n";
+
+my %port = (tcp => 15001, http => 15080, snmp => 15161, ntp => 15123, dns => 15053);
+my $base = "127.77.0.1";
+my $udp = $opt{e} < 256 ? $opt{e} : 256;
+my $timeout = int(($opt{l} + $opt{j}) / 1000) + 10;
+
+my $farm = open(my $farm_out, "-|", $^X, "$FindBin::Bin/target_farm.pl",
+	"--endpoints=$opt{e}", "--udp-endpoints=$udp", "--base=$base",
+	"--latency=$opt{l}", "--jitter=$opt{j}", "--loss=$opt{L}",
+	map { "--$_=$port{$_}" } sort keys %port)
+	or die "Cannot start the target farm: $!\n";
+my $ready = <$farm_out>;
+die "The target farm did not start\n" unless defined $ready && $ready =~ /^READY/;
+my $netns;
+# before the pipe from the farm is closed, which waits for it
+END {
+	local $?;
+	kill "TERM", $farm if $farm;
+	close $farm_out;
+	system("ip netns del $netns 2>/dev/null; ip link del npfarm0 2>/dev/null") if $netns;
+}
+$SIG{INT} = $SIG{TERM} = sub { exit 1 };
+
+# the address of endpoint i of the first n
+sub address {
+	my ($i, $n) = @_;
+	return inet_ntoa(pack("N", unpack("N", inet_aton($base)) + $i % $n));
+}
+
+sub percentile {
+	my ($p, @v) = @_;
+	return 0 unless @v;
+	@v = sort { $a <=> $b } @v;
+	return $v[int($p / 100 * $#v + 0.5)];
+}
+
+sub maxrss {
+	my $text = shift;
+	return $text =~ /rusage_maxrss=(\d+)KB/ ? $1 : 0;
+}
+
+my (@results, @perf, $failed);
+
+sub report {
+	my ($name, $checks, $seconds, $times, $rss, $errors) = @_;
+	my $rate = $seconds > 0 ? $checks / $seconds : 0;
+	my $p99 = percentile(99, @$times);
+
+	# no p99 for the plugins that do not time each target, no RSS for the
+	# ones that do not report it
+	push @results, sprintf("%s %.0f/s%s%s%s", $name, $rate,
+		@$times ? sprintf(" p99 %.3fms", $p99 * 1000) : "", $rss ? " ${rss}KB" : "",
+		$errors ? " ($errors not ok)" : "");
+	push @perf, sprintf("%s_rate=%.1f;;;0;", $name, $rate);
+	push @perf, sprintf("%s_p99=%.6fs;;;0;", $name, $p99) if @$times;
+	push @perf, sprintf("%s_rss=%dKB;;;0;", $name, $rss) if $rss;
+	$failed++ if $errors;
+	print STDERR "$results[-1]\n" if $opt{v};
+}
+
+# A check per target, $opt{c} of them running at once
+sub single {
+	my ($name, $n, $command) = @_;
+	my (%running, @times, $rss, $errors);
+	my $select = IO::Select->new;
+	my ($started, $done) = (0, 0);
+	my $start = time;
+
+	$rss = $errors = 0;
+	while ($done < $opt{n}) {
+		while ($started < $opt{n} && keys %running < $opt{c}) {
+			my @argv = $command->(address($started, $n));
+			my $pid = open(my $fh, "-|");
+			die "Cannot fork: $!\n" unless defined $pid;
+			if (!$pid) {
+				open(STDERR, ">&STDOUT");
+				$ENV{MP_RESOURCE_USAGE} = 1;
+				exec @argv or exit 3;
+			}
+			$running{fileno $fh} = { fh => $fh, pid => $pid, start => time, out => "" };
+			$select->add($fh);
+			$started++;
+		}
+		for my $fh ($select->can_read(1)) {
+			my $r = $running{fileno $fh};
+			next if sysread($fh, $r->{out}, 65536, length $r->{out});
+			$select->remove($fh);
+			delete $running{fileno $fh};
+			close $fh;
+			push @times, time - $r->{start};
+			$errors++ if $?;
+			print STDERR $r->{out} if $? && $opt{v};
+			my $kb = maxrss($r->{out});
+			$rss = $kb if $kb > $rss;
+			$done++;
+		}
+	}
+	report($name, $opt{n}, time - $start, \@times, $rss, $errors);
+}
+
+# All targets from one list. The times per target are taken from the
+# performance data with a label matching $timed, where the plugin has them.
+sub multi {
+	my ($name, $lines, $timed, $command) = @_;
+	my ($fh, $list) = tempfile("bench_scale_XXXXXX", TMPDIR => 1, UNLINK => 1);
+	print $fh "$_\n" for @$lines;
+	close $fh;
+
+	my $start = time;
+	local $ENV{MP_RESOURCE_USAGE} = 1;
+	my @argv = $command->($list);
+	my $out = `@argv 2>&1`;
+	my $seconds = time - $start;
+	my $status = $? >> 8;
+	print STDERR $out if $status && $opt{v};
+
+	my @times;
+	while ($timed && $out =~ /(?:'([^']*)'|([^\s'=|]+))=([\d.]+)(ms|s)?;/g) {
+		my ($label, $value, $unit) = ($1 // $2, $3, $4);
+		next unless defined $unit && $label =~ $timed;
+		push @times, $unit eq "ms" ? $value / 1000 : $value;
+	}
+	report($name, scalar @$lines, $seconds, \@times, maxrss($out), $status ? 1 : 0);
+}
+
+sub plugin {
+	my $path = "$opt{d}/$_[0]";
+	return -x $path ? $path : undef;
+}
+
+sub endpoints {
+	my ($n, $format) = @_;
+	return [ map { sprintf($format, address($_, $n)) } 0 .. $opt{e} - 1 ];
+}
+
+my $oid = "1.3.6.1.2.1.1.3.0";
+my @scenarios = (
+	[ "tcp", "check_tcp", sub {
+		my $p = shift;
+		single("tcp", $opt{e}, sub { ($p, "-H", shift, "-p", $port{tcp}, "-e", "220", "-t", $timeout) });
+		multi("tcp_targets", endpoints($opt{e}, "%s:$port{tcp}"), qr/^[\d.]+:\d+$/, sub {
+			($p, "--targets=$_[0]", "--concurrency=$opt{c}", "-e", "220", "-t", $timeout) });
+	} ],
+	[ "http", "check_http", sub {
+		my $p = shift;
+		single("http", $opt{e}, sub { ($p, "-I", shift, "-p", $port{http}, "-u", "/", "-t", $timeout) });
+	} ],
+	[ "curl", "check_curl", sub {
+		my $p = shift;
+		single("curl", $opt{e}, sub { ($p, "-I", shift, "-p", $port{http}, "-u", "/", "-t", $timeout) });
+		single("curl_h2", $opt{e}, sub {
+			($p, "-I", shift, "-p", $port{http}, "-u", "/", "--http-version=2", "-t", $timeout) });
+		multi("curl_batch", endpoints($opt{e}, "http://%s:$port{http}/"), qr{^http://\S+$}, sub {
+			($p, "--batch=$_[0]", "-t", $timeout) });
+	} ],
+	[ "snmp", "check_snmp", sub {
+		my $p = shift;
+		single("snmp", $udp, sub {
+			($p, "-H", shift, "-p", $port{snmp}, "-C", "public", "-o", $oid, "-t", $timeout) });
+		multi("snmp_targets", endpoints($udp, "%s:$port{snmp}"), undef, sub {
+			($p, "--targets=$_[0]", "--concurrency=$opt{c}", "-C", "public", "-o", $oid, "-t", $timeout) });
+	} ],
+	[ "ntp", "check_ntp_time", sub {
+		my $p = shift;
+		single("ntp", $udp, sub { ($p, "-H", shift, "-p", $port{ntp}, "-t", $timeout) });
+		multi("ntp_targets", endpoints($udp, "%s:$port{ntp}"), undef, sub {
+			($p, "--targets=$_[0]", "-t", $timeout) });
+	} ],
+	[ "dns", "check_dig", sub {
+		my $p = shift;
+		my @records = map { "\@" . address($_, $udp) . " host$_.farm.test A" } 0 .. $opt{e} - 1;
+		multi("dns_records", \@records, qr/\/A@/, sub {
+			($p, "--records=$_[0]", "-H", $base, "-p", $port{dns}, "--concurrency=$opt{c}", "-t", $timeout) });
+	} ],
+);
+
+for my $s (@scenarios) {
+	my ($name, $program, $run) = @$s;
+	next unless $name =~ /$opt{s}/;
+	my $p = plugin($program) or next;
+	$run->($p);
+}
+
+# Echo requests into a namespace that answers for all of 198.18.0.0/15,
+# over a link of its own. Without netem, the latency is the one of the link.
+if ("icmp" =~ /$opt{s}/ && $> == 0 && -x "$opt{r}/check_icmp"
+		&& system("ip netns add npfarm$$ 2>/dev/null") == 0) {
+	$netns = "npfarm$$";
+	my $setup = join(" && ",
+		"ip link add npfarm0 type veth peer name npfarm1",
+		"ip link set npfarm1 netns $netns",
+		"ip addr add 169.254.77.1/30 dev npfarm0",
+		"ip link set npfarm0 up",
+		"ip -n $netns addr add 169.254.77.2/30 dev npfarm1",
+		"ip -n $netns link set npfarm1 up",
+		"ip -n $netns link set lo up",
+		"ip -n $netns route add local 198.18.0.0/15 dev lo",
+		"ip route add 198.18.0.0/15 via 169.254.77.2");
+	my $netem = "delay $opt{l}ms" . ($opt{j} ? " $opt{j}ms" : "") . ($opt{L} ? " loss $opt{L}%" : "");
+	if (system("($setup) 2>/dev/null") == 0) {
+		print STDERR "No netem, icmp without latency and loss\n"
+			if system("tc qdisc add dev npfarm0 root netem $netem limit 100000 2>/dev/null") && $opt{v};
+		my $first = unpack("N", inet_aton("198.18.0.1"));
+		my @hosts = map { inet_ntoa(pack("N", $first + $_)) } 0 .. $opt{e} - 1;
+		multi("icmp", \@hosts, qr/rta$/, sub {
+			("$opt{r}/check_icmp", "-f", $_[0], "-n", "1", "-r", "10000",
+				"-w", "1000,100%", "-c", "2000,100%", "-t", $timeout) });
+	}
+}
+
+my $status = $failed ? "WARNING" : "OK";
+print "BENCH $status - $opt{e} endpoints, $opt{l}ms latency, $opt{L}% loss: "
+	. (@results ? join(", ", @results) : "no plugins to run") . "|@perf\n";
+exit($failed ? 1 : 0);
@@ -21,8 +21,13 @@ use FindBin qw($Bin);
 
 $ENV{'LC_TIME'} = "C";
 
-my $common_tests = 70;
+my $common_tests = 78;
 my $ssl_only_tests = 8;
+my $batch_tests = 4;
+my $assets_tests = 6;
+my $throughput_tests = 6;
+my $metric_tests = 6;
+my $body_file_tests = 6;
 # Check that all dependent modules are available
 eval "use HTTP::Daemon 6.01;";
 plan skip_all => 'HTTP::Daemon >= 6.01 required' if $@;
@@ -63,7 +68,7 @@ if ($@) {
 	plan skip_all => "Missing required module for test: $@";
 } else {
 	if (-x "./$plugin") {
-		plan tests => $common_tests * 2 + $ssl_only_tests + $advanced_checks;
+		plan tests => $common_tests * 2 + $ssl_only_tests + $advanced_checks + $batch_tests + $assets_tests + $throughput_tests + $metric_tests + $body_file_tests;
 	} else {
 		plan skip_all => "No $plugin compiled";
 	}
@@ -188,6 +193,32 @@ sub run_server {
 				$c->send_basic_header;
 				$c->send_header('foo');
 				$c->send_crlf;
+			} elsif ($r->url->path eq "/assets") {
+				$c->send_basic_header;
+				$c->send_crlf;
+				$c->send_response(HTTP::Response->new( 200, 'OK', undef,
+					'<html><head><link rel="stylesheet" href="/file/root"><script src="file/root"></script></head>'
+					. '<body><img src="/statuscode/200"><img src="http://169.254.169.254/x.png">'
+					. '<!-- <img src="/nothere"> --></body></html>' ));
+			} elsif ($r->url->path eq "/assets_broken") {
+				$c->send_basic_header;
+				$c->send_crlf;
+				$c->send_response(HTTP::Response->new( 200, 'OK', undef, '<img src="/statuscode/404">' ));
+			} elsif ($r->url->path eq "/range") {
+				my $body = "0123456789" x 100;
+				if (($r->header('Range') || '') =~ m/^bytes=(\d+)-(\d+)$/) {
+					if ($1 < length ($body)) {
+						$c->send_response(HTTP::Response->new( 206, 'Partial Content', undef, substr ($body, $1, $2 - $1 + 1) ));
+					} else {
+						$c->send_error(416);
+					}
+				} else {
+					$c->send_response(HTTP::Response->new( 200, 'OK', undef, $body ));
+				}
+			} elsif ($r->url->path eq "/metrics") {
+				my $body = "# TYPE up gauge\nup 1\nother_total{a=\"b\"} 5\n";
+				$body .= "queue_depth{name=\"$_\",shard=\"1\"} $_\n" foreach (1 .. 50);
+				$c->send_response(HTTP::Response->new( 200, 'OK', undef, $body . "queue_depth{name=\"last\"} 75\n# EOF\n" ));
 			} elsif ($r->url->path eq "/virtual_port") {
 				# return sent Host header
 				$c->send_basic_header;
@@ -289,6 +320,113 @@ SKIP: {
 	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct: ".$result->output );
 }
 
+# batch mode, all URLs share one multi handle
+SKIP: {
+	skip "--batch is check_curl only", $batch_tests unless $plugin eq 'check_curl';
+	my $urls = "/tmp/check_curl_batch.$$";
+	open (my $out, '>', $urls) or die "Cannot write $urls: $!";
+	print $out "# comment and blank lines are skipped\n\n";
+	print $out "http://127.0.0.1:$port_http/file/root\n";
+	print $out "http://127.0.0.1:$port_http/redirect\n";
+	close ($out);
+
+	$cmd = "./$plugin --batch=$urls -f follow";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	like( $result->output, '/^HTTP OK - 2 URLs: 2 ok, 0 warning, 0 critical, 0 unknown\|.*\nOK http:\/\/127.0.0.1:\d+\/file\/root: HTTP\/1.1 200 OK/s', "Output correct: ".$result->output );
+
+	open ($out, '>>', $urls) or die "Cannot write $urls: $!";
+	print $out "http://127.0.0.1:$port_http/statuscode/500\n";
+	close ($out);
+
+	$cmd = "./$plugin --batch=$urls --batch-connections=1";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 2, $cmd);
+	like( $result->output, '/^HTTP CRITICAL - 3 URLs: 2 ok, 0 warning, 1 critical, 0 unknown\|.*\nCRITICAL http:\/\/127.0.0.1:\d+\/statuscode\/500: HTTP\/1.1 500/s', "Output correct: ".$result->output );
+	unlink ($urls);
+}
+
+# page assets, the ones of other origins and in comments are not fetched
+SKIP: {
+	skip "--assets is check_curl only", $assets_tests unless $plugin eq 'check_curl';
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /assets --assets";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	like( $result->output, '/^HTTP OK: HTTP\/1.1 200 OK - 3 requests, \d+ bytes, critical path [\d\.]+ seconds, slowest asset http:\/\/127.0.0.1:\d+\/\S+ in [\d\.]+ seconds - \d+ bytes in [\d\.]+ second response time .*requests=3;/', "Output correct: ".$result->output );
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /assets --assets --assets-critical=,2";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 2, $cmd);
+	like( $result->output, '/^HTTP CRITICAL: .* 3 requests, .*requests=3;;2;0/', "Output correct: ".$result->output );
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /assets_broken --assets";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 1, $cmd);
+	like( $result->output, '/^HTTP WARNING: HTTP\/1.1 200 OK - 1 of 1 assets failed, 2 requests, /', "Output correct: ".$result->output );
+}
+
+# throughput with range requests
+SKIP: {
+	skip "--throughput is check_curl only", $throughput_tests unless $plugin eq 'check_curl';
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /range --throughput=100,4";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	like( $result->output, '/^HTTP OK - 4 chunks of 100 bytes: [\d\.]+ MB\/s, 400 bytes in [\d\.]+ seconds, slowest chunk \d at [\d\.]+ MB\/s\|throughput=[\d\.]+;;;[\d\.]+ .*\nOK chunk 4 bytes 300-399: 100 bytes in /s', "Output correct: ".$result->output );
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /range --throughput=100,4 --throughput-critical=1000000:";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 2, $cmd);
+	like( $result->output, '/^HTTP CRITICAL - 4 chunks of 100 bytes: /', "Output correct: ".$result->output );
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /file/root --throughput=1K";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 3, $cmd);
+	like( $result->output, '/\nUNKNOWN chunk 1 bytes 0-1023: the server ignored the Range request \(HTTP 200\)/', "Output correct: ".$result->output );
+}
+
+# samples of an OpenMetrics exposition picked by selector
+SKIP: {
+	skip "--metric is check_curl only", $metric_tests unless $plugin eq 'check_curl';
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /metrics --metric=up,1:,1: --metric='queue_depth{name=\"7\"}'";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	like( $result->output, '/^HTTP OK: HTTP\/1.1 200 OK - .*up=1.000000;1:;1: \'queue_depth\{name="7",shard="1"\}\'=7.000000;;/', "Output correct: ".$result->output );
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /metrics --metric='queue_depth{shard!=\"2\"},40,60'";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 2, $cmd);
+	like( $result->output, '/^HTTP CRITICAL: HTTP\/1.1 200 OK - metric \'queue_depth\{name="last"\}\' is 75, /', "Output correct: ".$result->output );
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /metrics --metric='other_total{a=\"c\"}'";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 2, $cmd);
+	like( $result->output, '/^HTTP CRITICAL: HTTP\/1.1 200 OK - metric \'other_total\{a="c"\}\' not found, /', "Output correct: ".$result->output );
+}
+
+# request bodies sent from a file, larger than what is let go at once
+SKIP: {
+	skip "--post-file and --put-file are check_curl only", $body_file_tests unless $plugin eq 'check_curl';
+	my $body = "/tmp/check_curl_body.$$";
+	open (my $out, '>', $body) or die "Cannot write $body: $!";
+	print $out "stufftoinclude" . ("x" x (2 * 1024 * 1024));
+	close ($out);
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /postdata --post-file=$body -s POST:stufftoinclude";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	like( $result->output, '/^HTTP OK: HTTP\/1.1 200 OK - 20971\d\d bytes in [\d\.]+ second/', "Output correct: ".$result->output );
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /postdata --put-file=$body -s PUT:stufftoinclude";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd);
+	like( $result->output, '/^HTTP OK: HTTP\/1.1 200 OK - 20971\d\d bytes in [\d\.]+ second/', "Output correct: ".$result->output );
+	unlink ($body);
+
+	$cmd = "./$plugin -H 127.0.0.1 -p $port_http -u /postdata --post-file=$body";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 3, $cmd);
+	like( $result->output, '/^HTTP UNKNOWN - Cannot read \/tmp\/check_curl_body.\d+: No such file or directory/', "Output correct: ".$result->output );
+}
 
 sub run_common_tests {
 	my ($opts) = @_;
@@ -309,10 +447,26 @@ sub run_common_tests {
 	is( $result->return_code, 2, "Missing string check");
 	like( $result->output, qr%^HTTP CRITICAL: HTTP/1\.1 200 OK - string 'NonRoot' not found on 'https?://127\.0\.0\.1:\d+/file/root'%, "Shows search string and location");
 
+	$result = NPTest->testCmd( "$command -u /file/root -s Root --stream-body" );
+	is( $result->return_code, 0, "/file/root search for string while streaming");
+	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct" );
+
+	$result = NPTest->testCmd( "$command -u /file/root -s NonRoot --stream-body" );
+	is( $result->return_code, 2, "Missing string check while streaming");
+	like( $result->output, qr%^HTTP CRITICAL: HTTP/1\.1 200 OK - string 'NonRoot' not found on 'https?://127\.0\.0\.1:\d+/file/root'%, "Shows search string and location");
+
 	$result = NPTest->testCmd( "$command -u /file/root -s NonRootWithOver30charsAndMoreFunThanAWetFish" );
 	is( $result->return_code, 2, "Missing string check");
 	like( $result->output, qr%HTTP CRITICAL: HTTP/1\.1 200 OK - string 'NonRootWithOver30charsAndM...' not found on 'https?://127\.0\.0\.1:\d+/file/root'%, "Shows search string and location");
 
+	$result = NPTest->testCmd( "$command -u /file/root -s Root -s oot -s NonRoot -s Other" );
+	is( $result->return_code, 2, "Several strings, some missing");
+	like( $result->output, qr%^HTTP CRITICAL: HTTP/1\.1 200 OK - string 'NonRoot', 'Other' not found on 'https?://127\.0\.0\.1:\d+/file/root'%, "Shows the missing ones");
+
+	$result = NPTest->testCmd( "$command -u /file/root -s Root -s oot" );
+	is( $result->return_code, 0, "Several strings, all found");
+	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - 274 bytes in [\d\.]+ second/', "Output correct" );
+
 	$result = NPTest->testCmd( "$command -u /header_check -d foo" );
 	is( $result->return_code, 0, "header_check search for string");
 	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - 96 bytes in [\d\.]+ second/', "Output correct" );
@@ -0,0 +1,133 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_dig --records against a stub DNS server
+#
+
+use strict;
+use Test::More;
+use NPTest;
+
+use IO::Socket;
+use IO::Select;
+use File::Temp qw(tempfile);
+
+my $port = 50000 + int(rand(1000));
+
+# name => [ rcode, [ type, ttl, rdata ]... ]
+my %zone = (
+	"www.example.test" => [ 0,
+		[ 1, 300, pack("C4", 192, 0, 2, 2) ],
+		[ 1, 60, pack("C4", 192, 0, 2, 1) ],
+		[ 28, 600, pack("n8", 0x2001, 0xdb8, 0, 0, 0, 0, 0, 1) ] ],
+	"example.test" => [ 0, [ 15, 3600, pack("n", 10) . "\4mail\7example\4test\0" ] ],
+	"big.example.test" => [ 0, map { [ 16, 60, "\x3f" . ("x" x 63) . "\x04tail" ] } 1..12 ],
+	"nx.example.test" => [ 3 ],
+);
+
+sub labels {
+	my ($packet, $offset) = @_;
+	my @labels;
+	while (my $len = unpack("C", substr($packet, $offset, 1))) {
+		push @labels, substr($packet, $offset + 1, $len);
+		$offset += $len + 1;
+	}
+	return (join(".", @labels), $offset + 1);
+}
+
+sub reply {
+	my ($packet, $tcp) = @_;
+	my ($id) = unpack("n", $packet);
+	my ($name, $end) = labels($packet, 12);
+	return undef if $name eq "slow.example.test";
+	my ($qtype) = unpack("n", substr($packet, $end, 2));
+	my $question = substr($packet, 12, $end + 4 - 12);
+	my ($rcode, @records) = @{ $zone{$name} || [ 3 ] };
+	@records = grep { $_->[0] == $qtype } @records;
+	my $answers = "";
+	foreach my $rr (@records) {
+		$answers .= pack("nnnNn", 0xc00c, $rr->[0], 1, $rr->[1], length($rr->[2])) . $rr->[2];
+	}
+	# does not fit in 512 bytes, retry over TCP
+	if (!$tcp && length($question) + length($answers) > 500) {
+		return pack("nnnnnn", $id, 0x8580 | 0x200 | $rcode, 1, 0, 0, 0) . $question;
+	}
+	return pack("nnnnnn", $id, 0x8580 | $rcode, 1, scalar(@records), 0, 0) . $question . $answers;
+}
+
+my $pid = fork();
+if ($pid) {
+	# Parent
+	# give our server some time to startup
+	sleep(1);
+} else {
+	# Child
+	my $udp = IO::Socket::INET->new(
+		LocalAddr => "127.0.0.1",
+		LocalPort => $port,
+		Proto => "udp",
+	) or die "Cannot be a udp server on port $port: $@";
+	my $tcp = IO::Socket::INET->new(
+		LocalAddr => "127.0.0.1",
+		LocalPort => $port,
+		Proto => "tcp",
+		Reuse => 1,
+		Listen => 10,
+	) or die "Cannot be a tcp server on port $port: $@";
+
+	my $select = IO::Select->new($udp, $tcp);
+	while (my @ready = $select->can_read) {
+		foreach my $fh (@ready) {
+			if ($fh == $udp) {
+				$udp->recv(my $packet, 512);
+				my $r = reply($packet, 0);
+				$udp->send($r) if defined $r;
+			} else {
+				my $client = $tcp->accept or next;
+				sysread($client, my $len, 2);
+				sysread($client, my $packet, unpack("n", $len));
+				my $r = reply($packet, 1);
+				print $client pack("n", length($r)) . $r if defined $r;
+				close $client;
+			}
+		}
+	}
+	exit;
+}
+
+END { if ($pid) { kill "INT", $pid } };
+
+if ($ARGV[0] && $ARGV[0] eq "-d") {
+	sleep 1000;
+}
+
+plan tests => 10;
+
+my $res;
+
+my ($fh, $filename) = tempfile(UNLINK => 1);
+print $fh <<EOF;
+# comments and empty lines are skipped
+
+www.example.test
+www.example.test AAAA 2001:db8::1
+example.test MX mail.example.test
+big.example.test TXT tail
+www.example.test A 192.0.2.77
+nx.example.test
+slow.example.test
+EOF
+close $fh;
+
+$res = NPTest->testCmd( "./check_dig --records=$filename -H 127.0.0.1 -p $port -t 2" );
+is( $res->return_code, 2, "Records with failures" );
+like( $res->output, '/^DNS CRITICAL - 7 records: 4 ok, 1 warning, 2 critical, 0 unknown\|www.example.test\/A=[\d.]+s;;;[\d.]+ www.example.test\/AAAA=/', "Summary" );
+like( $res->output, '/^OK www.example.test A: [\d.]+ seconds response time \(www.example.test. 300 IN A 192.0.2.2\)$/m', "First answer matching the name" );
+like( $res->output, '/^OK www.example.test AAAA: .*\(www.example.test. 600 IN AAAA 2001:db8::1\)$/m', "Expected answer" );
+like( $res->output, '/^OK example.test MX: .*\(example.test. 3600 IN MX 10 mail.example.test.\)$/m', "MX" );
+like( $res->output, '/^OK big.example.test TXT: .*"x{63}" "tail"\)$/m', "Truncated reply retried over TCP" );
+like( $res->output, '/^WARNING www.example.test A: .*\(Server not found in ANSWER SECTION\)$/m', "Unexpected answer" );
+like( $res->output, '/^CRITICAL nx.example.test A: .*\(No ANSWER SECTION found, status NXDOMAIN\)$/m', "NXDOMAIN" );
+like( $res->output, '/^CRITICAL slow.example.test A: .*\(No response from 127.0.0.1 after 2 tries\)$/m', "No reply" );
+
+$res = NPTest->testCmd( "./check_dig --records=$filename -H 127.0.0.1 -p $port -t 2 --concurrency=1 -w 0.000001" );
+like( $res->output, '/^DNS CRITICAL - 7 records: 0 ok, 5 warning, 2 critical, 0 unknown\|/', "One query at a time, with a time threshold" );
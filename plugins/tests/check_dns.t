@@ -0,0 +1,103 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_dns --native against a stub DNS server
+#
+
+use strict;
+use Test::More;
+use NPTest;
+
+use IO::Socket;
+
+my $port = 50000 + int(rand(1000));
+
+# name => [ rcode, authoritative, [ type, ttl, rdata ]... ]
+my %zone = (
+	"www.example.test" => [ 0, 1,
+		[ 1, 300, pack("C4", 192, 0, 2, 2) ],
+		[ 1, 60, pack("C4", 192, 0, 2, 1) ],
+		[ 28, 600, pack("n8", 0x2001, 0xdb8, 0, 0, 0, 0, 0, 1) ] ],
+	"cache.example.test" => [ 0, 0, [ 1, 30, pack("C4", 192, 0, 2, 9) ] ],
+	"empty.example.test" => [ 0, 1 ],
+	"refused.example.test" => [ 5, 0 ],
+	"1.2.0.192.in-addr.arpa" => [ 0, 1, [ 12, 3600, "\4host\7example\4test\0" ] ],
+);
+
+sub labels {
+	my ($packet, $offset) = @_;
+	my @labels;
+	while (my $len = unpack("C", substr($packet, $offset, 1))) {
+		push @labels, substr($packet, $offset + 1, $len);
+		$offset += $len + 1;
+	}
+	return (join(".", @labels), $offset + 1);
+}
+
+my $pid = fork();
+if ($pid) {
+	# Parent
+	# give our server some time to startup
+	sleep(1);
+} else {
+	# Child
+	my $server = IO::Socket::INET->new(
+		LocalAddr => "127.0.0.1",
+		LocalPort => $port,
+		Proto => "udp",
+	) or die "Cannot be a udp server on port $port: $@";
+
+	while ($server->recv(my $packet, 512)) {
+		my ($id) = unpack("n", $packet);
+		my ($name, $end) = labels($packet, 12);
+		my ($qtype) = unpack("n", substr($packet, $end, 2));
+		my $question = substr($packet, 12, $end + 4 - 12);
+		my ($rcode, $aa, @records) = @{ $zone{$name} || [ 3, 1 ] };
+		@records = grep { $_->[0] == $qtype } @records;
+		my $reply = pack("nnnnnn", $id, 0x8180 | ($aa ? 0x400 : 0) | $rcode, 1, scalar(@records), 0, 0) . $question;
+		foreach my $rr (@records) {
+			$reply .= pack("nnnNn", 0xc00c, $rr->[0], 1, $rr->[1], length($rr->[2])) . $rr->[2];
+		}
+		$server->send($reply);
+	}
+	exit;
+}
+
+END { if ($pid) { kill "INT", $pid } };
+
+if ($ARGV[0] && $ARGV[0] eq "-d") {
+	sleep 1000;
+}
+
+plan tests => 13;
+
+my $res;
+my $dns = "./check_dns --native -s 127.0.0.1 -p $port -t 5";
+
+$res = NPTest->testCmd( "$dns -H www.example.test" );
+is( $res->return_code, 0, "A and AAAA records" );
+like( $res->output, '/^DNS OK: [\d.]+ seconds? response time\. www\.example\.test returns 192\.0\.2\.1,192\.0\.2\.2,2001:db8::1\|time=[\d.]+s;;;[\d.]+ ttl=60s;;;0$/', "Sorted answers, shortest TTL" );
+
+$res = NPTest->testCmd( "$dns -H www.example.test -a 192.0.2.0/24" );
+is( $res->return_code, 0, "Expected address in a CIDR range" );
+
+$res = NPTest->testCmd( "$dns -H www.example.test -a 192.0.2.1 -L" );
+is( $res->return_code, 2, "Not all addresses expected" );
+like( $res->output, "/expected '192.0.2.1' but got '192.0.2.1,192.0.2.2,2001:db8::1'/", "Output OK" );
+
+$res = NPTest->testCmd( "$dns -H cache.example.test -A" );
+is( $res->return_code, 2, "Not authoritative" );
+like( $res->output, '/server 127.0.0.1 is not authoritative for cache.example.test/', "Output OK" );
+
+$res = NPTest->testCmd( "$dns -H 192.0.2.1 -a host.example.test." );
+is( $res->return_code, 0, "Reverse lookup" );
+like( $res->output, '/192\.0\.2\.1 returns host\.example\.test\./', "Output OK" );
+
+$res = NPTest->testCmd( "$dns -H nx.example.test" );
+is( $res->return_code, 2, "NXDOMAIN" );
+like( $res->output, '/Domain nx.example.test was not found by the server/', "Output OK" );
+
+$res = NPTest->testCmd( "$dns -H empty.example.test" );
+is( $res->return_code, 2, "No address" );
+
+$res = NPTest->testCmd( "$dns -H refused.example.test" );
+is( $res->return_code, 2, "Refused" );
@@ -21,9 +21,10 @@ use FindBin qw($Bin);
 
 $ENV{'LC_TIME'} = "C";
 
-my $common_tests = 70;
+my $common_tests = 78;
 my $virtual_port_tests = 8;
-my $ssl_only_tests = 8;
+my $ssl_only_tests = 12;
+my $large_page_tests = 8;
 # Check that all dependent modules are available
 eval "use HTTP::Daemon 6.01;";
 plan skip_all => 'HTTP::Daemon >= 6.01 required' if $@;
@@ -39,7 +40,7 @@ if ($@) {
 	plan skip_all => "Missing required module for test: $@";
 } else {
 	if (-x "./$plugin") {
-		plan tests => $common_tests * 2 + $ssl_only_tests + $virtual_port_tests;
+		plan tests => $common_tests * 2 + $ssl_only_tests + $virtual_port_tests + $large_page_tests;
 	} else {
 		plan skip_all => "No $plugin compiled";
 	}
@@ -160,10 +161,25 @@ sub run_server {
 				unshift @persist, $c;
 				delete($persist[1000]);
 				next MAINLOOP;
+			} elsif ($r->url->path eq "/keepalive_chunked") {
+				# The body is complete, but the connection stays open
+				print $c "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n";
+				unshift @persist, $c;
+				delete($persist[1000]);
+				next MAINLOOP;
+			} elsif ($r->url->path eq "/keepalive_length") {
+				print $c "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world";
+				unshift @persist, $c;
+				delete($persist[1000]);
+				next MAINLOOP;
 			} elsif ($r->url->path eq "/header_check") {
 				$c->send_basic_header;
 				$c->send_header('foo');
 				$c->send_crlf;
+			} elsif ($r->method eq "GET" and $r->url->path =~ m^/large/(\d+)^) {
+				$c->send_basic_header;
+				$c->send_crlf;
+				print $c (("x" x 79 . "\n") x ($1 / 80));
 			} elsif ($r->url->path eq "/virtual_port") {
 				# return sent Host header
 				$c->send_basic_header;
@@ -216,6 +232,16 @@ SKIP: {
 		'CRITICAL - Certificate \'Monitoring Plugins\' expired on Wed Jan  2 11:00:26 2008 +0000.',
 		"output ok" );
 
+	# The second run takes the expiry from the cache
+	local $ENV{'MP_STATE_PATH'} = "/tmp/check_http_cert_cache.$$";
+	$result = NPTest->testCmd( "$command -p $port_https -S -C 14 --cert-cache=300" );
+	is( $result->return_code, 0, "$command -p $port_https -S -C 14 --cert-cache=300" );
+	is( $result->output, "OK - Certificate 'Monitoring Plugins' will expire on Fri Feb 16 15:31:44 2029 +0000.", "output ok" );
+	$result = NPTest->testCmd( "$command -p $port_https -S -C 14 --cert-cache=300" );
+	is( $result->return_code, 0, "$command -p $port_https -S -C 14 --cert-cache=300 from the cache" );
+	is( $result->output, "OK - Certificate 'Monitoring Plugins' will expire on Fri Feb 16 15:31:44 2029 +0000.", "output ok" );
+	system( "rm", "-rf", $ENV{'MP_STATE_PATH'} );
+
 }
 
 my $cmd;
@@ -248,6 +274,21 @@ SKIP: {
 	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct: ".$result->output );
 }
 
+# large pages, the time taken has to grow linearly with the page size
+foreach my $size (80 * 1024, 80 * 16384, 80 * 65536) {
+	$cmd = "$command -p $port_http -u /large/$size -t 20";
+	$result = NPTest->testCmd( $cmd );
+	is( $result->return_code, 0, $cmd );
+	my ($bytes, $time) = $result->output =~ m%^HTTP OK: HTTP/1.1 200 OK - (\d+) bytes in ([\d\.]+) second%;
+	cmp_ok( $bytes, '>', $size, "Whole page of $size bytes read" );
+	diag sprintf("%d bytes in %.3f seconds, %.1f MB/s", $bytes, $time, $time > 0 ? $bytes / $time / 1048576 : 0);
+}
+
+$cmd = "$command -p $port_http -u /large/" . (80 * 65536) . " -N";
+$result = NPTest->testCmd( $cmd );
+is( $result->return_code, 0, $cmd );
+like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct: ".$result->output );
+
 
 sub run_common_tests {
 	my ($opts) = @_;
@@ -272,6 +313,22 @@ sub run_common_tests {
 	is( $result->return_code, 2, "Missing string check");
 	like( $result->output, qr%HTTP CRITICAL: HTTP/1\.1 200 OK - string 'NonRootWithOver30charsAndM...' not found on 'https?://127\.0\.0\.1:\d+/file/root'%, "Shows search string and location");
 
+	$result = NPTest->testCmd( "$command -u /file/root -s Root -s oot -s NonRoot -s Other" );
+	is( $result->return_code, 2, "Several strings, some missing");
+	like( $result->output, qr%^HTTP CRITICAL: HTTP/1\.1 200 OK - string 'NonRoot', 'Other' not found on 'https?://127\.0\.0\.1:\d+/file/root'%, "Shows the missing ones");
+
+	$result = NPTest->testCmd( "$command -u /file/root -s Root -s oot" );
+	is( $result->return_code, 0, "Several strings, all found");
+	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - 274 bytes in [\d\.]+ second/', "Output correct" );
+
+	$result = NPTest->testCmd( "$command -u /keepalive_chunked -s 'hello world' -t 2" );
+	is( $result->return_code, 0, "Chunked body decoded, read stops after the last chunk");
+	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct" );
+
+	$result = NPTest->testCmd( "$command -u /keepalive_length -r 'world\$' -t 2" );
+	is( $result->return_code, 0, "Read stops after Content-Length bytes");
+	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - \d+ bytes in [\d\.]+ second/', "Output correct" );
+
 	$result = NPTest->testCmd( "$command -u /header_check -d foo" );
 	is( $result->return_code, 0, "header_check search for string");
 	like( $result->output, '/^HTTP OK: HTTP/1.1 200 OK - 96 bytes in [\d\.]+ second/', "Output correct" );
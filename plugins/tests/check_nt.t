@@ -47,6 +47,8 @@ if ($pid) {
 			} elsif ($arg eq "d") {
 				print $client "UNKNOWN: Drive is not a fixed drive";
 			}
+		} elsif ($command eq "3") {
+			print $client "90061";
 		}
 	}
 	exit;
@@ -59,7 +61,7 @@ if ($ARGV[0] && $ARGV[0] eq "-d") {
 }
 
 if (-x "./check_nt") {
-	plan tests => 5;
+	plan tests => 10;
 } else {
 	plan skip_all => "No check_nt compiled";
 }
@@ -78,3 +80,18 @@ is( $result->output, "Free disk space : Invalid drive", "Output right" );
 $result = NPTest->testCmd( "./check_nt -v USEDDISKSPACE -l d" );
 is( $result->return_code, 3, "Fail if -H missing");
 
+
+$result = NPTest->testCmd( "$command -v UPTIME -l hours -w 100 -c 10 -v USEDDISKSPACE -l c -w 5 -c 95" );
+is( $result->return_code, 1, "UPTIME and USEDDISKSPACE at once");
+is( $result->output, q{System Uptime - 1 day(s) 1 hour(s) 1 minute(s); c:\ - total: 0.93 Gb - used: 0.07 Gb (7%) - free 0.87 Gb (93%) | uptime=25 'c:\ Used Space'=0.07Gb;0.05;0.88;0.00;0.93}, "Messages and perfdata joined" );
+
+my $targets = "/tmp/check_nt_targets.$$";
+open(my $fh, ">", $targets) or die "Cannot write $targets: $!";
+print $fh "# host port\n127.0.0.1 $port\n127.0.0.1 1\n";
+close($fh);
+
+$result = NPTest->testCmd( "./check_nt --targets=$targets -v USEDDISKSPACE -l c" );
+is( $result->return_code, 2, "Several hosts");
+like( $result->output, "/^NSClient CRITICAL - 2 hosts: 1 ok, 0 warning, 1 critical, 0 unknown\\|'127.0.0.1:c:\\\\ Used Space'=0.07Gb;/", "Summary with perfdata of all hosts" );
+like( $result->output, "/^CRITICAL 127.0.0.1: could not fetch information from server \\(connect to address 127.0.0.1 and port 1: Connection refused\\)\$/m", "One line per host" );
+unlink $targets;
@@ -0,0 +1,98 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_nwstat against a stub MRTGEXT NLM
+#
+
+use strict;
+use Test::More;
+use NPTest;
+
+use IO::Socket;
+use POSIX;
+
+my $port = 50000 + int(rand(1000));
+
+# what the stub knows of
+my %replies = (
+	"S19" => "5.70",
+	"UTIL5" => "42",
+	"UPTIME" => "12 Days 3 Hours 4 Minutes 5 Seconds",
+	"VKFSYS" => "1048576",
+	"VKSSYS" => "4194304",
+	"VKFNOPE" => "-1",
+	"S24:TSANDS.NLM" => "1.2.3",
+);
+
+my $pid = fork();
+if ($pid) {
+	# Parent
+	# give our server some time to startup
+	sleep(1);
+} else {
+	# Child
+	my $server = IO::Socket::INET->new(
+		LocalAddr => "127.0.0.1",
+		LocalPort => $port,
+		Type => SOCK_STREAM,
+		Reuse => 1,
+		Proto => "tcp",
+		Listen => 10,
+	) or die "Cannot be a tcp server on port $port: $@";
+
+	while (my $client = $server->accept) {
+		my $data = "";
+		while (sysread($client, my $chunk, POSIX::BUFSIZ)) {
+			$data .= $chunk;
+			my @lines;
+			push @lines, $1 while ($data =~ s/^([^\n]*)\n//);
+			my $reply = "";
+			foreach my $line (@lines) {
+				$line =~ s/\r$//;
+				if ($line eq "CONNECT") {
+					# how many commands came in with this one
+					$reply .= scalar(@lines) . "\n";
+				} elsif ($line eq "VKSNOPE") {
+					# asked for ahead, the reply must be skipped
+					$reply .= "0\n";
+				} else {
+					$reply .= (exists $replies{$line} ? $replies{$line} : "-1") . "\n";
+				}
+			}
+			print $client $reply if $reply;
+		}
+		close $client;
+	}
+	exit;
+}
+
+END { if ($pid) { kill "INT", $pid } };
+
+if ($ARGV[0] && $ARGV[0] eq "-d") {
+	sleep 1000;
+}
+
+plan tests => 10;
+
+my $res;
+
+$res = NPTest->testCmd( "./check_nwstat -H 127.0.0.1 -p $port -v LOAD5 -w 50 -c 80" );
+is( $res->return_code, 0, "Load" );
+like( $res->output, '/^Load OK - Up 12 Days 3 Hours 4 Minutes 5 Seconds, 5-min load average = 42%\|load5=42;50;80;0;100$/', "Output OK" );
+
+$res = NPTest->testCmd( "./check_nwstat -H 127.0.0.1 -p $port -o -v VPFSYS -w 30 -c 20" );
+is( $res->return_code, 1, "Percent free space" );
+like( $res->output, '/^NetWare 5.70: 1024 MB \(25%\) free on volume SYS - total 4096 MB\|FreeMBSYS=25;30;20;0;100$/', "Output OK" );
+
+$res = NPTest->testCmd( "./check_nwstat -H 127.0.0.1 -p $port -v VPFNOPE -v CONNS" );
+is( $res->return_code, 2, "Volume that does not exist" );
+like( $res->output, "/^CRITICAL - Volume 'NOPE' does not exist!; Conns OK - 3 current connections\\|Conns=3;0;0;;\$/", "Reply asked for ahead is skipped" );
+
+$res = NPTest->testCmd( "./check_nwstat -H 127.0.0.1 -p $port -w 1000 -v CONNS -v LOAD5 -w 40 -c 60 -v NLM:TSANDS.NLM" );
+is( $res->return_code, 1, "Several variables at once" );
+like( $res->output, '/^Conns OK - 4 current connections; Load WARNING - .* = 42%; Module TSANDS.NLM version 1.2.3 is loaded\|Conns=4;1000;0;; load5=42;40;60;0;100$/', "All commands in one go, thresholds per variable" );
+
+$res = NPTest->testCmd( "./check_nwstat -H 127.0.0.1 -p $port -v NOSUCHVAR" );
+is( $res->return_code, 3, "Unknown variable" );
+
+$res = NPTest->testCmd( "./check_nwstat -H 127.0.0.1 -p $port" );
+is( $res->return_code, 3, "Nothing to check" );
@@ -0,0 +1,194 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_pgsql --persistent against a stub PostgreSQL server
+#
+
+use strict;
+use Test::More;
+use NPTest;
+
+use IO::Socket;
+use IO::Select;
+use IO::Socket::UNIX;
+
+my $port = 50000 + int(rand(1000));
+
+# Every query returns the number of the connection it came in on, counting
+# from 1, except those containing "broken" which fail
+my $connections = 0;
+
+sub message {
+	my ($type, $body) = @_;
+	return $type . pack("N", length($body) + 4) . $body;
+}
+
+sub description {
+	return message("T", pack("n", 1) . "value\0" . pack("NnNnNn", 0, 0, 25, 0xffff, 0xffffffff, 0));
+}
+
+sub rows {
+	my $id = shift;
+	return message("D", pack("nN", 1, length($id)) . $id)
+		. message("C", "SELECT 1\0");
+}
+
+sub error {
+	return message("E", "SERROR\0C42601\0Msyntax error at or near \"broken\"\0\0");
+}
+
+# Returns the reply to one message, and sets $state->{failed} until the next
+# Sync after an error in the extended query protocol
+sub reply {
+	my ($state, $type, $body) = @_;
+	if ($type eq "S") {
+		$state->{failed} = 0;
+		return message("Z", "I");
+	}
+	return "" if $state->{failed};
+	if ($type eq "Q") {
+		return ($body =~ /broken/ ? error() : description() . rows($state->{id})) . message("Z", "I");
+	}
+	if ($type eq "P") {
+		my (undef, $query) = unpack("Z*Z*", $body);
+		if ($query =~ /broken/) {
+			$state->{failed} = 1;
+			return error();
+		}
+		return message("1", "");
+	}
+	return message("2", "") if $type eq "B";
+	return description() if $type eq "D";
+	return rows($state->{id}) if $type eq "E";
+	return "";
+}
+
+my $pid = fork();
+if ($pid) {
+	# Parent
+	# give our server some time to startup
+	sleep(1);
+} else {
+	# Child
+	my $server = IO::Socket::INET->new(
+		LocalAddr => "127.0.0.1",
+		LocalPort => $port,
+		Proto => "tcp",
+		Reuse => 1,
+		Listen => 10,
+	) or die "Cannot be a tcp server on port $port: $@";
+
+	my $select = IO::Select->new($server);
+	my %clients;
+	while (my @ready = $select->can_read) {
+		foreach my $fh (@ready) {
+			if ($fh == $server) {
+				my $client = $server->accept or next;
+				$select->add($client);
+				$clients{$client} = { buffer => "", started => 0, failed => 0 };
+				next;
+			}
+			my $state = $clients{$fh};
+			my $data;
+			if (!sysread($fh, $data, 8192)) {
+				$select->remove($fh);
+				delete $clients{$fh};
+				close $fh;
+				next;
+			}
+			$state->{buffer} .= $data;
+			my $out = "";
+			while (1) {
+				if (!$state->{started}) {
+					last if length($state->{buffer}) < 8;
+					my ($len, $code) = unpack("NN", $state->{buffer});
+					last if length($state->{buffer}) < $len;
+					substr($state->{buffer}, 0, $len) = "";
+					if ($code == 196608) {
+						$connections++;
+						$state->{started} = 1;
+						$state->{id} = $connections;
+						$out .= message("R", pack("N", 0))
+							. message("S", "server_version\0" . "14.0\0")
+							. message("S", "client_encoding\0UTF8\0")
+							. message("K", pack("NN", $connections, 0))
+							. message("Z", "I");
+					} else {
+						# no SSL or GSS encryption
+						$out .= "N";
+					}
+					next;
+				}
+				last if length($state->{buffer}) < 5;
+				my ($type, $len) = unpack("aN", $state->{buffer});
+				last if length($state->{buffer}) < $len + 1;
+				my $body = substr($state->{buffer}, 5, $len - 4);
+				substr($state->{buffer}, 0, $len + 1) = "";
+				$out .= reply($state, $type, $body);
+			}
+			syswrite($fh, $out) if length($out);
+		}
+	}
+	exit;
+}
+
+END { if ($pid) { kill "INT", $pid } };
+
+if ($ARGV[0] && $ARGV[0] eq "-d") {
+	sleep 1000;
+}
+
+plan tests => 11;
+
+my $res;
+my $pgsql = "./check_pgsql -H 127.0.0.1 -P $port -l nagios -t 5";
+
+$res = NPTest->testCmd( "$pgsql -q 'SELECT connections'" );
+is( $res->return_code, 0, "Plain query" );
+like( $res->output, "/'SELECT connections' returned 1.000000/", "Output OK" );
+
+$res = NPTest->testCmd( "$pgsql --persistent -q 'SELECT connections'" );
+is( $res->return_code, 0, "Prepared query" );
+like( $res->output, '/^ OK - database template1 \([\d.]+ sec.\)\|time=[\d.]+s;2.000000;8.000000;0.000000\n'
+	. "QUERY OK - 'SELECT connections' returned 2.000000\\|query=2.000000;;;;\$/", "Output OK" );
+
+$res = NPTest->testCmd( "$pgsql --persistent -q 'SELECT broken'" );
+is( $res->return_code, 2, "Query error" );
+like( $res->output, "/QUERY CRITICAL - Error with query: .*syntax error/", "Output OK" );
+
+# a worker keeps the connection for the next run of the same check
+my $socket = "/tmp/np-executor.$$.sock";
+my $executor = fork();
+if ($executor == 0) {
+	exec("./np-executor", "-s", $socket, "-w", "1");
+	exit 3;
+}
+for (my $i = 0; $i < 50 && ! -S $socket; $i++) {
+	select(undef, undef, undef, 0.1);
+}
+
+sub request {
+	my $line = shift;
+	my $client = IO::Socket::UNIX->new(Type => SOCK_STREAM, Peer => $socket)
+		or return (undef, undef);
+	print $client "$line\n";
+	my $rc = <$client>;
+	chomp $rc if defined $rc;
+	my $output = do { local $/; <$client> };
+	close $client;
+	return ($rc, defined $output ? $output : "");
+}
+
+my $check = "check_pgsql -H 127.0.0.1 -P $port -l nagios --persistent -q 'SELECT connections'";
+my ($rc, $output) = request($check);
+is( $rc, 0, "Persistent check in np-executor" );
+like( $output, "/returned 4.000000/", "Opened a connection" );
+($rc, $output) = request($check);
+like( $output, "/returned 4.000000/", "Reused the connection" );
+($rc, $output) = request("check_pgsql -H 127.0.0.1 -P $port -l nagios -q 'SELECT connections'");
+like( $output, "/returned 5.000000/", "Without --persistent a new connection is used" );
+($rc, $output) = request($check);
+like( $output, "/returned 4.000000/", "The kept connection is still used" );
+
+kill 'TERM', $executor;
+waitpid($executor, 0);
+unlink $socket;
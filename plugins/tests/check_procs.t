@@ -8,7 +8,7 @@ use Test::More;
 use NPTest;
 
 if (-x "./check_procs") {
-	plan tests => 50;
+	plan tests => 55;
 } else {
 	plan skip_all => "No check_procs compiled";
 }
@@ -130,3 +130,16 @@ $result = NPTest->testCmd( "$command --ereg-argument-array='(nosuchname|nosuch2n
 is( $result->return_code, 0, "Checking no pipe symbol in output" );
 is( $result->output, "PROCS OK: 0 processes with regex args '(nosuchname,nosuch2name)' | procs=0;;;0;", "Output correct" );
 
+$result = NPTest->testCmd( "$command --rules=tests/var/procs-rules" );
+is( $result->return_code, 2, "Checking rules file" );
+is( $result->output, "PROCS CRITICAL - 3 rules: 2 ok, 0 warning, 1 critical, 0 unknown | all=95;100;200;0; launchd=6;;5;0; 'no pipes'=0;;;0;
+OK all: PROCS OK: 95 processes
+CRITICAL launchd: PROCS CRITICAL: 6 processes with command name 'launchd'
+OK no pipes: PROCS OK: 0 processes with regex args '(nosuchname,nosuch2name)'", "Output correct" );
+
+$result = NPTest->testCmd( "$command --rules=tests/var/procs-rules --passive=host1" );
+is( $result->return_code, 2, "Checking rules file as passive checks" );
+like( $result->output, "/^\\[[0-9]+\\] PROCESS_SERVICE_CHECK_RESULT;host1;launchd;2;PROCS CRITICAL: 6 processes with command name 'launchd' \\| procs=6;;5;0;\$/m", "Output correct" );
+
+$result = NPTest->testCmd( "$command --rules=tests/var/procs-rules -C launchd" );
+is( $result->return_code, 3, "Filters are not allowed with a rules file" );
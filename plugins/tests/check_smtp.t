@@ -0,0 +1,104 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_smtp against a stub SMTP server
+#
+
+use strict;
+use Test::More;
+use NPTest;
+
+use IO::Socket;
+use POSIX;
+
+my $port = 50000 + int(rand(1000));
+
+my $pid = fork();
+if ($pid) {
+	# Parent
+	# give our server some time to startup
+	sleep(1);
+} else {
+	# Child
+	my $server = IO::Socket::INET->new(
+		LocalAddr => "127.0.0.1",
+		LocalPort => $port,
+		Type => SOCK_STREAM,
+		Reuse => 1,
+		Proto => "tcp",
+		Listen => 10,
+	) or die "Cannot be a tcp server on port $port: $@";
+
+	while (my $client = $server->accept) {
+		my ($pipelining, $auth, $data) = (1, 0, "");
+		print $client "220 stub ESMTP\r\n";
+		while (sysread($client, my $chunk, POSIX::BUFSIZ)) {
+			$data .= $chunk;
+			# all complete lines that came in at once
+			my @lines;
+			push @lines, $1 while ($data =~ s/^([^\n]*)\n//);
+			my $reply = "";
+			for (my $i = 0; $i < @lines; $i++) {
+				my $line = $lines[$i];
+				$line =~ s/\r$//;
+				if ($auth) {
+					$reply .= (--$auth) ? "334 UGFzc3dvcmQ6\r\n" : "235 2.7.0 ok\r\n";
+				} elsif ($line =~ /^EHLO (\S+)/i) {
+					$pipelining = ($1 ne "nopipe");
+					$reply .= "250-stub\r\n";
+					$reply .= "250-X-LINE-$_ a long reply\r\n" for (1..60);
+					$reply .= "250-PIPELINING\r\n" if $pipelining;
+					$reply .= "250 AUTH LOGIN\r\n";
+				} elsif ($line =~ /^HELO/i) {
+					$reply .= "250 stub\r\n";
+				} elsif ($line =~ /^AUTH LOGIN/i) {
+					$auth = 2;
+					$reply .= "334 VXNlcm5hbWU6\r\n";
+				} elsif ($line =~ /^MAIL/i) {
+					$reply .= "250 2.1.0 ok\r\n";
+				} elsif ($line =~ /^RCPT/i) {
+					# did another command come in with this one?
+					$reply .= ($i > 0) ? "250 pipelined\r\n" : "250 waited\r\n";
+				} elsif ($line =~ /^QUIT/i) {
+					$reply .= "221 bye\r\n";
+				} else {
+					$reply .= "500 unknown\r\n";
+				}
+			}
+			print $client $reply if $reply;
+			last if grep { /^QUIT/i } @lines;
+		}
+		close $client;
+	}
+	exit;
+}
+
+END { if ($pid) { kill "INT", $pid } };
+
+if ($ARGV[0] && $ARGV[0] eq "-d") {
+	sleep 1000;
+}
+
+plan tests => 8;
+
+my $res;
+my $auth = "-A LOGIN -U user -P pass";
+
+$res = NPTest->testCmd( "./check_smtp -H 127.0.0.1 -p $port" );
+is( $res->return_code, 0, "HELO" );
+like( $res->output, '/^SMTP OK - /', "Output OK" );
+
+$res = NPTest->testCmd( "./check_smtp -H 127.0.0.1 -p $port $auth" );
+is( $res->return_code, 0, "Long EHLO reply and AUTH LOGIN" );
+
+$res = NPTest->testCmd( "./check_smtp -H 127.0.0.1 -p $port $auth -f a\@example.com -C 'RCPT TO:<b\@example.com>' -R '^250 pipelined' -C 'RCPT TO:<c\@example.com>' -R '^250 waited'" );
+is( $res->return_code, 1, "MAIL and RCPT go out at once with PIPELINING" );
+like( $res->output, "/Invalid response '250 pipelined' to command 'RCPT TO:<c\@example.com>'/", "and the replies are read in order" );
+
+$res = NPTest->testCmd( "./check_smtp -H 127.0.0.1 -p $port $auth -f a\@example.com -C 'RCPT TO:<b\@example.com>' -R '^250 waited' --no-pipelining" );
+is( $res->return_code, 0, "One command at a time with --no-pipelining" );
+
+$res = NPTest->testCmd( "./check_smtp -H 127.0.0.1 -p $port $auth -F nopipe -f a\@example.com -C 'RCPT TO:<b\@example.com>' -R '^250 waited'" );
+is( $res->return_code, 0, "One command at a time without PIPELINING" );
+
+$res = NPTest->testCmd( "./check_smtp -H 127.0.0.1 -p $port $auth -C 'NOOP' -R '^500' -C 'RCPT TO:<b\@example.com>' -R '^250 waited'" );
+is( $res->return_code, 0, "NOOP ends a group" );
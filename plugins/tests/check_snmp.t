@@ -9,7 +9,7 @@ use NPTest;
 use FindBin qw($Bin);
 use POSIX qw/strftime/;
 
-my $tests = 67;
+my $tests = 73;
 # Check that all dependent modules are available
 eval {
 	require NetSNMP::OID;
@@ -257,3 +257,32 @@ $res = NPTest->testCmd( "./check_snmp -H 127.0.0.1 -C public -p $port_snmp -o .1
 is($res->return_code, 1, "Negative float WARNING" );
 is($res->output, 'SNMP WARNING - *-6.6* | iso.3.6.1.4.1.8072.3.2.67.18=-6.6;~:-6.65;~:-6.55 ', "Negative float WARNING output" );
 
+
+# The libnetsnmp backend must print exactly what the snmpget path prints
+SKIP: {
+    skip "check_snmp built without --native", 4 if `./check_snmp --help` !~ /--native/;
+
+    foreach my $oids (".1.3.6.1.4.1.8072.3.2.67.0",
+                      ".1.3.6.1.4.1.8072.3.2.67.0 -o sysContact.0 -o .1.3.6.1.4.1.8072.3.2.67.1",
+                      ".1.3.6.1.4.1.8072.3.2.67.2 -w 1:",
+                      "sysContact.0 -s Alice -l contact") {
+        my $exec = NPTest->testCmd( "./check_snmp -H 127.0.0.1 -C public -p $port_snmp -o $oids" );
+        $res = NPTest->testCmd( "./check_snmp -H 127.0.0.1 -C public -p $port_snmp -o $oids --native" );
+        is($res->output, $exec->output, "--native output matches snmpget for -o $oids");
+    }
+}
+
+SKIP: {
+    skip "check_snmp built without --native", 2 if `./check_snmp --help` !~ /--targets/;
+
+    my $list = "/tmp/check_snmp_targets.$$";
+    open(my $fh, '>', $list) or die "Cannot write $list: $!";
+    print $fh "# two agents\n127.0.0.1:$port_snmp\n127.0.0.1 $port_snmp\n";
+    close($fh);
+    $res = NPTest->testCmd( "./check_snmp --targets=$list -C public -o sysContact.0 -s '\"Alice\"'" );
+    unlink($list);
+    is($res->return_code, 0, "--targets with two agents returns OK");
+    is($res->output, "SNMP OK - 2 targets: 2 ok, 0 warning, 0 critical, 0 unknown
+OK 127.0.0.1:$port_snmp: \"Alice\"
+OK 127.0.0.1:$port_snmp: \"Alice\"", "--targets prints one line per agent");
+}
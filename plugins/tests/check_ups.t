@@ -0,0 +1,105 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_ups against a stub upsd
+#
+
+use strict;
+use Test::More;
+use NPTest;
+
+use IO::Socket;
+use POSIX;
+
+my $port = 50000 + int(rand(1000));
+
+# what the stub knows of
+my %ups = (
+	ups1 => { "ups.status" => "OL", "input.voltage" => "230.0", "ups.load" => "25", "ups.temperature" => "30.0" },
+	ups2 => { "ups.status" => "OB LB", "input.voltage" => "0.0", "ups.load" => "60" },
+	stale => undef,
+);
+
+my $pid = fork();
+if ($pid) {
+	# Parent
+	# give our server some time to startup
+	sleep(1);
+} else {
+	# Child
+	my $server = IO::Socket::INET->new(
+		LocalAddr => "127.0.0.1",
+		LocalPort => $port,
+		Type => SOCK_STREAM,
+		Reuse => 1,
+		Proto => "tcp",
+		Listen => 10,
+	) or die "Cannot be a tcp server on port $port: $@";
+
+	while (my $client = $server->accept) {
+		my $data = "";
+		my $done = 0;
+		while (!$done && sysread($client, my $chunk, POSIX::BUFSIZ)) {
+			$data .= $chunk;
+			my @lines;
+			push @lines, $1 while ($data =~ s/^([^\n]*)\n//);
+			my $reply = "";
+			foreach my $line (@lines) {
+				if ($line eq "LIST UPS") {
+					$reply .= "BEGIN LIST UPS\n";
+					$reply .= "UPS $_ \"stub\"\n" foreach (sort keys %ups);
+					$reply .= "END LIST UPS\n";
+				} elsif ($line =~ /^GET VAR (\S+) (\S+)$/) {
+					my ($name, $var) = ($1, $2);
+					if (!exists $ups{$name}) {
+						$reply .= "ERR UNKNOWN-UPS\n";
+					} elsif (!defined $ups{$name}) {
+						$reply .= "ERR DATA-STALE\n";
+					} elsif ($var eq "battery.charge") {
+						# how many commands came in with this one
+						$reply .= "VAR $name $var \"" . scalar(@lines) . "\"\n";
+					} elsif (exists $ups{$name}{$var}) {
+						$reply .= "VAR $name $var \"$ups{$name}{$var}\"\n";
+					} else {
+						$reply .= "ERR VAR-NOT-SUPPORTED\n";
+					}
+				} elsif ($line eq "LOGOUT") {
+					$reply .= "OK Goodbye\n";
+					$done = 1;
+				} else {
+					$reply .= "ERR UNKNOWN-COMMAND\n";
+				}
+			}
+			print $client $reply if $reply;
+		}
+		close $client;
+	}
+	exit;
+}
+
+END { if ($pid) { kill "INT", $pid } };
+
+if ($ARGV[0] && $ARGV[0] eq "-d") {
+	sleep 1000;
+}
+
+plan tests => 10;
+
+my $res;
+
+$res = NPTest->testCmd( "./check_ups -H 127.0.0.1 -p $port -u ups1 -T" );
+is( $res->return_code, 0, "Online UPS" );
+like( $res->output, '/^UPS OK - Status=Online Utility=230.0V Batt=6.0% Load=25.0% Temp=30.0C\|/', "All variables asked for at once" );
+
+$res = NPTest->testCmd( "./check_ups -H 127.0.0.1 -p $port -u ups2 -v LOADPCT -w 50 -c 70" );
+is( $res->return_code, 2, "On battery, low battery" );
+like( $res->output, '/^UPS CRITICAL - Status=On Battery, Low Battery .*Load=60.0% \|.*load=60%;50;70;0;100/', "Output OK" );
+
+$res = NPTest->testCmd( "./check_ups -H 127.0.0.1 -p $port -u nosuchups" );
+is( $res->return_code, 2, "Unknown UPS" );
+like( $res->output, "/^CRITICAL - no such UPS 'nosuchups' on that host/", "Output OK" );
+
+$res = NPTest->testCmd( "./check_ups -H 127.0.0.1 -p $port --all -T" );
+is( $res->return_code, 2, "Every UPS" );
+like( $res->output, '/^UPS CRITICAL - 3 UPS: 1 ok, 0 warning, 2 critical, 0 unknown\|.*ups1_voltage=.*ups2_load=/', "Summary" );
+like( $res->output, '/^CRITICAL stale: CRITICAL - UPS data is stale$/m', "One line per UPS" );
+like( $res->output, '/^OK ups1: Status=Online Utility=230.0V Batt=16.0% Load=25.0% Temp=30.0C$/m', "All UPS asked for at once" );
@@ -0,0 +1,373 @@
+#! /usr/bin/perl -w
+#
+# A farm of mock targets for the scale benchmarks of bench_scale.pl
+#
+# One process answers for thousands of endpoints, the loopback addresses
+# from --base on, each of them a TCP banner service, an HTTP/1.1 and HTTP/2
+# server, an SNMP agent, an NTP server and a DNS server. Every answer is
+# held back by --latency milliseconds, give or take --jitter, and dropped
+# altogether for --loss percent of the requests, so that the plugins wait
+# on the network as they would and not on the farm.
+#
+# TCP is taken on the wildcard address, where Linux routes all of 127/8,
+# and connections to anything but an endpoint are closed at once. The UDP
+# services need a socket for every endpoint for the answers to come from
+# the address asked, so --udp-endpoints of them (the first ones) get them,
+# within the limit of open files.
+#
+# HTTP/2 is spoken over cleartext, with prior knowledge or after an
+# "Upgrade: h2c" request. Only what a client needs for GET requests is
+# there: the responses are always 200, the request headers are not decoded.
+#
+# Prints "READY" once it listens, and runs until it is killed.
+#
+
+use strict;
+use Getopt::Long;
+use Socket;
+use IO::Socket::INET;
+use IO::Poll qw(POLLIN POLLOUT POLLERR POLLHUP);
+use Time::HiRes qw(time);
+
+my %opt = (
+	base => "127.77.0.1",
+	endpoints => 1000,
+	"udp-endpoints" => 256,
+	latency => 0,
+	jitter => 0,
+	loss => 0,
+	tcp => 5001,
+	http => 5080,
+	snmp => 5161,
+	ntp => 5123,
+	dns => 5053,
+);
+GetOptions(\%opt, "base=s", "endpoints=i", "udp-endpoints=i", "latency=f", "jitter=f",
+	"loss=f", "tcp=i", "http=i", "snmp=i", "ntp=i", "dns=i") or die "Bad options\n";
+
+my $base = unpack("N", inet_aton($opt{base}));
+die "The endpoints must be loopback addresses\n"
+	if ($base >> 24) != 127 || (($base + $opt{endpoints} - 1) >> 24) != 127;
+$opt{"udp-endpoints"} = $opt{endpoints} if $opt{"udp-endpoints"} > $opt{endpoints};
+
+my $poll = IO::Poll->new;
+my %handler;	# fileno => sub called when it is readable
+my %conn;	# fileno => state of a TCP connection
+my @timers;	# a heap of [due, sub]
+
+sub endpoint {
+	my $n = unpack("N", shift);
+	return $n >= $base && $n < $base + $opt{endpoints};
+}
+
+# after the latency, or never for the lost ones
+sub later {
+	my $sub = shift;
+	return if $opt{loss} > 0 && rand(100) < $opt{loss};
+	my $delay = $opt{latency} + ($opt{jitter} ? (rand(2) - 1) * $opt{jitter} : 0);
+	$delay = 0 if $delay < 0;
+	my $t = [time + $delay / 1000, $sub];
+	push @timers, $t;
+	for (my $i = $#timers; $i > 0; ) {
+		my $p = ($i - 1) >> 1;
+		last if $timers[$p][0] <= $timers[$i][0];
+		@timers[$p, $i] = @timers[$i, $p];
+		$i = $p;
+	}
+}
+
+sub next_timer {
+	my $top = $timers[0];
+	my $last = pop @timers;
+	if (@timers) {
+		$timers[0] = $last;
+		for (my $i = 0; ; ) {
+			my ($l, $r, $m) = (2 * $i + 1, 2 * $i + 2, $i);
+			$m = $l if $l < @timers && $timers[$l][0] < $timers[$m][0];
+			$m = $r if $r < @timers && $timers[$r][0] < $timers[$m][0];
+			last if $m == $i;
+			@timers[$m, $i] = @timers[$i, $m];
+			$i = $m;
+		}
+	}
+	return $top;
+}
+
+sub listen_tcp {
+	my ($port, $accepted) = @_;
+	my $s = IO::Socket::INET->new(LocalAddr => "0.0.0.0", LocalPort => $port, Proto => "tcp",
+		Listen => SOMAXCONN, ReuseAddr => 1, Blocking => 0)
+		or die "Cannot listen on port $port: $!\n";
+	$poll->mask($s => POLLIN);
+	$handler{fileno $s} = sub {
+		while (my $c = $s->accept) {
+			if (!endpoint((sockaddr_in(getsockname($c)))[1])) {
+				close $c;
+				next;
+			}
+			$c->blocking(0);
+			$conn{fileno $c} = { sock => $c, in => "", out => "" };
+			$poll->mask($c => POLLIN);
+			$accepted->($conn{fileno $c});
+		}
+	};
+}
+
+sub send_tcp {
+	my ($c, $data) = @_;
+	return if $c->{closed};
+	$c->{out} .= $data;
+	flush_tcp($c);
+}
+
+sub flush_tcp {
+	my $c = shift;
+	my $n = syswrite($c->{sock}, $c->{out});
+	substr($c->{out}, 0, $n) = "" if defined $n;
+	$poll->mask($c->{sock} => length $c->{out} ? POLLIN | POLLOUT : POLLIN);
+}
+
+sub close_tcp {
+	my $c = shift;
+	$c->{closed} = 1;
+	$poll->remove($c->{sock});
+	delete $conn{fileno $c->{sock}};
+	close $c->{sock};
+}
+
+# the banner, then whatever is sent is read until the client closes
+sub banner {
+	my $c = shift;
+	$c->{read} = sub { $_[0]{in} = "" };
+	later(sub { send_tcp($c, "220 target-farm ready\r\n") });
+}
+
+sub http_response {
+	my $body = "ok\n";
+	return "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: "
+		. length($body) . "\r\n\r\n$body";
+}
+
+sub http {
+	my $c = shift;
+	$c->{read} = sub {
+		my $c = shift;
+		return h2($c) if $c->{h2};
+		if (substr($c->{in}, 0, 3) eq "PRI") {
+			return if length $c->{in} < 24;
+			h2_start($c);
+			return h2($c);
+		}
+		while ($c->{in} =~ s/^(.*?)\r\n\r\n//s) {
+			my $head = $1;
+			if ($head =~ /^upgrade:\s*h2c/im) {
+				# the request becomes stream 1 of the connection
+				$c->{in} =~ s/^PRI \* HTTP\/2\.0\r\n\r\nSM\r\n\r\n//;
+				later(sub {
+					send_tcp($c, "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+					h2_start($c);
+					h2_respond($c, 1);
+				});
+				$c->{h2} = 1;
+				$c->{preface} = 1;
+				return h2($c);
+			}
+			later(sub { send_tcp($c, http_response()) });
+		}
+	};
+}
+
+sub h2_frame {
+	my ($type, $flags, $stream, $payload) = @_;
+	my $len = length $payload;
+	return pack("CnCCN", $len >> 16, $len & 0xffff, $type, $flags, $stream) . $payload;
+}
+
+sub h2_start {
+	my $c = shift;
+	$c->{h2} = 1;
+	send_tcp($c, h2_frame(4, 0, 0, ""));
+}
+
+# ":status: 200" from the static table, and a body
+sub h2_respond {
+	my ($c, $stream) = @_;
+	send_tcp($c, h2_frame(1, 0x4, $stream, "\x88") . h2_frame(0, 0x1, $stream, "ok\n"));
+}
+
+sub h2 {
+	my $c = shift;
+	if (!$c->{preface} || $c->{in} =~ /^PRI/) {
+		return if length $c->{in} < 24;
+		substr($c->{in}, 0, 24) = "" if substr($c->{in}, 0, 3) eq "PRI";
+		$c->{preface} = 1;
+	}
+	while (length $c->{in} >= 9) {
+		my ($hi, $lo, $type, $flags, $stream) = unpack("CnCCN", $c->{in});
+		my $len = ($hi << 16) | $lo;
+		last if length $c->{in} < 9 + $len;
+		my $payload = substr($c->{in}, 9, $len);
+		substr($c->{in}, 0, 9 + $len) = "";
+		$stream &= 0x7fffffff;
+		if ($type == 4 && !($flags & 0x1)) {
+			send_tcp($c, h2_frame(4, 0x1, 0, ""));
+		} elsif ($type == 6 && !($flags & 0x1)) {
+			send_tcp($c, h2_frame(6, 0x1, 0, $payload));
+		} elsif ($type == 7) {
+			close_tcp($c);
+			return;
+		} elsif ($type == 1 || $type == 9 || $type == 0) {
+			# a request is complete with its headers and the end of the stream
+			$c->{headers}{$stream} = 1 if $type != 0 && ($flags & 0x4);
+			$c->{ended}{$stream} = 1 if $type != 9 && ($flags & 0x1);
+			if ($c->{headers}{$stream} && $c->{ended}{$stream}) {
+				delete $c->{headers}{$stream};
+				delete $c->{ended}{$stream};
+				later(sub { h2_respond($c, $stream) });
+			}
+		}
+	}
+}
+
+listen_tcp($opt{tcp}, \&banner);
+listen_tcp($opt{http}, \&http);
+
+# UDP: one socket for every endpoint, and what answers a datagram
+sub listen_udp {
+	my ($port, $answer) = @_;
+	for my $i (0 .. $opt{"udp-endpoints"} - 1) {
+		my $addr = inet_ntoa(pack("N", $base + $i));
+		my $s = IO::Socket::INET->new(LocalAddr => $addr, LocalPort => $port, Proto => "udp",
+			ReuseAddr => 1, Blocking => 0)
+			or die "Cannot bind $addr:$port: $! (raise ulimit -n or lower --udp-endpoints)\n";
+		$poll->mask($s => POLLIN);
+		$handler{fileno $s} = sub {
+			while (defined(my $peer = recv($s, my $data, 65535, 0))) {
+				last if $data eq "";
+				my $reply = $answer->($data, $addr);
+				later(sub { send($s, $reply, 0, $peer) }) if defined $reply;
+			}
+		};
+	}
+}
+
+# BER, as much as SNMP GetRequests need
+sub ber_len {
+	my $len = shift;
+	return chr($len) if $len < 0x80;
+	my $bytes = "";
+	for (; $len; $len >>= 8) {
+		$bytes = chr($len & 0xff) . $bytes;
+	}
+	return chr(0x80 | length $bytes) . $bytes;
+}
+
+sub ber {
+	my ($tag, $value) = @_;
+	return chr($tag) . ber_len(length $value) . $value;
+}
+
+# the tag, the value and the whole TLV at pos
+sub ber_read {
+	my ($buf, $pos) = @_;
+	return if $pos + 2 > length $buf;
+	my $tag = ord substr($buf, $pos, 1);
+	my $len = ord substr($buf, $pos + 1, 1);
+	my $head = 2;
+	if ($len & 0x80) {
+		my $n = $len & 0x7f;
+		$len = 0;
+		$len = ($len << 8) | ord substr($buf, $pos + 2 + $_, 1) for 0 .. $n - 1;
+		$head += $n;
+	}
+	return if $pos + $head + $len > length $buf;
+	return ($tag, substr($buf, $pos + $head, $len), substr($buf, $pos, $head + $len));
+}
+
+# Every OID asked for is an INTEGER of 42, for v1 and v2c
+sub snmp {
+	my $data = shift;
+	my (undef, $msg) = ber_read($data, 0) or return;
+	my ($vtag, undef, $version) = ber_read($msg, 0) or return;
+	my ($ctag, undef, $community) = ber_read($msg, length $version) or return;
+	my ($ptag, $pdu) = ber_read($msg, length($version) + length($community)) or return;
+	return if $ptag != 0xa0 && $ptag != 0xa1;
+	my (undef, undef, $reqid) = ber_read($pdu, 0) or return;
+	my $pos = length $reqid;
+	(undef, undef, my $err) = ber_read($pdu, $pos) or return;
+	$pos += length $err;
+	(undef, undef, $err) = ber_read($pdu, $pos) or return;
+	$pos += length $err;
+	my (undef, $list) = ber_read($pdu, $pos) or return;
+	my $binds = "";
+	for (my $p = 0; $p < length $list; ) {
+		my (undef, $bind, $whole) = ber_read($list, $p) or return;
+		my (undef, undef, $oid) = ber_read($bind, 0) or return;
+		$binds .= ber(0x30, $oid . ber(0x02, chr(42)));
+		$p += length $whole;
+	}
+	return ber(0x30, $version . $community .
+		ber(0xa2, $reqid . ber(0x02, "\0") . ber(0x02, "\0") . ber(0x30, $binds)));
+}
+
+# a server of stratum 2 answering client mode requests
+sub ntp {
+	my $data = shift;
+	return if length $data < 48 || (ord($data) & 0x7) != 3;
+	my $now = time + 2208988800;
+	my $ts = pack("NN", int($now), ($now - int($now)) * 4294967296);
+	return pack("CCCc", (0 << 6) | (4 << 3) | 4, 2, 6, -20) . pack("NN", 0, 0) . "FARM"
+		. $ts . substr($data, 40, 8) . $ts . $ts;
+}
+
+# an A record of the endpoint for any name, no records of other types
+sub dns {
+	my ($data, $addr) = @_;
+	return if length $data < 12;
+	my ($id, $flags, $qd) = unpack("nnn", $data);
+	return if $flags & 0x8000 || $qd != 1;
+	my $pos = 12;
+	while ($pos < length $data && (my $l = ord substr($data, $pos, 1))) {
+		$pos += $l + 1;
+	}
+	return if $pos + 5 > length $data;
+	my $question = substr($data, 12, $pos + 5 - 12);
+	my $type = unpack("n", substr($data, $pos + 1, 2));
+	my $answer = $type == 1 ? pack("nnnNn", 0xc00c, 1, 1, 60, 4) . inet_aton($addr) : "";
+	return pack("nnnnnn", $id, 0x8180 | ($flags & 0x0100), 1, $type == 1 ? 1 : 0, 0, 0)
+		. $question . $answer;
+}
+
+listen_udp($opt{snmp}, \&snmp);
+listen_udp($opt{ntp}, \&ntp);
+listen_udp($opt{dns}, \&dns);
+
+$SIG{PIPE} = "IGNORE";
+$| = 1;
+print "READY\n";
+
+while (1) {
+	my $timeout = @timers ? $timers[0][0] - time : 1;
+	$poll->poll($timeout > 0 ? $timeout : 0);
+	for my $fh ($poll->handles(POLLIN | POLLOUT | POLLERR | POLLHUP)) {
+		my $events = $poll->events($fh);
+		my $fd = fileno $fh;
+		if ($handler{$fd}) {
+			$handler{$fd}->();
+			next;
+		}
+		my $c = $conn{$fd} or next;
+		flush_tcp($c) if $events & POLLOUT && length $c->{out};
+		next unless $events & (POLLIN | POLLERR | POLLHUP);
+		my $n = sysread($fh, my $buf, 65536);
+		if (!$n) {
+			close_tcp($c) unless !defined $n && $!{EAGAIN};
+			next;
+		}
+		$c->{in} .= $buf;
+		$c->{read}->($c);
+	}
+	while (@timers && $timers[0][0] <= time) {
+		next_timer()->[1]->();
+	}
+}
@@ -29,6 +29,8 @@
 * 
 *****************************************************************************/
 
+#include "np_entry.h"
+
 const char *progname = "urlize";
 const char *copyright = "2000-2006";
 const char *email = "devel@monitoring-plugins.org";
@@ -37,21 +39,67 @@ const char *email = "devel@monitoring-plugins.org";
 #include "utils.h"
 #include "popen.h"
 
-#define PERF_CHARACTER "|"
+#define PERF_CHARACTER '|'
 #define NEWLINE_CHARACTER '\n'
 
 void print_help (void);
 void print_usage (void);
 
+/* Where urlize_write() is in the output of the plugin: the text of the
+ * first line goes into the anchor, its perfdata after it, and the lines
+ * after that are written through unchanged */
+enum {
+	IN_ANCHOR,
+	IN_PERFDATA,
+	IN_LONG_OUTPUT
+};
+static int phase;
+static size_t found;
+
+static void
+urlize_write (const char *buf, size_t len)
+{
+	size_t n;
+
+	found += len;
+	while (len > 0) {
+		if (phase == IN_LONG_OUTPUT) {
+			fwrite (buf, 1, len, stdout);
+			return;
+		}
+		for (n = 0; n < len; n++)
+			if (buf[n] == NEWLINE_CHARACTER || (phase == IN_ANCHOR && buf[n] == PERF_CHARACTER))
+				break;
+		fwrite (buf, 1, n, stdout);
+		if (n == len)
+			return;
+		if (buf[n] == PERF_CHARACTER) {
+			printf ("</A> | ");
+			phase = IN_PERFDATA;
+		}
+		else {
+			if (phase == IN_ANCHOR)
+				printf ("</A>");
+			putchar (NEWLINE_CHARACTER);
+			phase = IN_LONG_OUTPUT;
+		}
+		buf += n + 1;
+		len -= n + 1;
+	}
+}
+
 int
 main (int argc, char **argv)
 {
-	int found = 0, result = STATE_UNKNOWN;
+	int result = STATE_UNKNOWN;
 	char *url = NULL;
 	char *cmd;
-	char *buf;
-	char *nstr;
-	char tstr[MAX_INPUT_BUFFER];
+	char buf[MAX_INPUT_BUFFER];
+	ssize_t len;
+#ifdef NP_ENTRY_PREFIX
+	char *text;
+	size_t text_len;
+#endif
 
 	int c;
 	int option = 0;
@@ -62,9 +110,7 @@ main (int argc, char **argv)
 		{0, 0, 0, 0}
 	};
 
-	setlocale (LC_ALL, "");
-	bindtextdomain (PACKAGE, LOCALEDIR);
-	textdomain (PACKAGE);
+	np_locale_init ();
 
 	/* Need at least 2 args */
 	if (argc < 3) {
@@ -88,7 +134,7 @@ main (int argc, char **argv)
 			exit (EXIT_SUCCESS);
 			break;
 		case 'u':
-			url = strdup (argv[optind]);
+			url = strdup (optarg);
 			break;
 		case '?':
 		default:
@@ -98,6 +144,29 @@ main (int argc, char **argv)
 
 	if (url == NULL)
 		url = strdup (argv[optind++]);
+	if (optind >= argc)
+		usage4 (_("Could not parse arguments"));
+
+	phase = IN_ANCHOR;
+	found = 0;
+	printf ("<A href=\"%s\">", url);
+
+#ifdef NP_ENTRY_PREFIX
+	/* inside np-executor, a plugin that is an entry as well runs
+	 * in-process instead of as a child */
+	if (optind + 1 < argc &&
+	    (result = np_entry_run (&argv[optind], &text, &text_len)) >= 0) {
+		urlize_write (text, text_len);
+		free (text);
+		if (!found)
+			die (STATE_UNKNOWN,
+			     _("%s UNKNOWN - No data received from host\nCMD: %s</A>\n"),
+			     progname, argv[optind]);
+		if (phase == IN_ANCHOR)
+			printf ("</A>");
+		return result;
+	}
+#endif
 
 	cmd = strdup (argv[optind++]);
 	for (c = optind; c < argc; c++) {
@@ -110,18 +179,19 @@ main (int argc, char **argv)
 		exit (STATE_UNKNOWN);
 	}
 
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
+	child_stderr = fdopen (spopen_stderr (child_process), "r");
 	if (child_stderr == NULL) {
 		printf (_("Could not open stderr for %s\n"), cmd);
 	}
 
-	bzero(tstr, sizeof(tstr));
-	buf = malloc(MAX_INPUT_BUFFER);
-	printf ("<A href=\"%s\">", argv[1]);
-	while (fgets (buf, MAX_INPUT_BUFFER - 1, child_process)) {
-		found++;
-		/* Collect the string in temp str so we can tokenize */
-		strcat(tstr, buf);
+	/* write through as the output comes in */
+	while ((len = read (fileno (child_process), buf, sizeof (buf))) != 0) {
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			break;
+		urlize_write (buf, len);
+		fflush (stdout);
 	}
 
 	if (!found)
@@ -129,28 +199,19 @@ main (int argc, char **argv)
 		     _("%s UNKNOWN - No data received from host\nCMD: %s</A>\n"),
 		     argv[0], cmd);
 
-
-	/* chop the newline character */
-	if ((nstr = strchr(tstr, NEWLINE_CHARACTER)) != NULL)
-		*nstr = '\0';
-
-	/* tokenize the string for Perfdata if there is some */
-	nstr = strtok(tstr, PERF_CHARACTER);
-	printf ("%s", nstr);
-	printf ("</A>");
-	nstr = strtok(NULL, PERF_CHARACTER);
-	if (nstr != NULL)
-		printf (" | %s", nstr);
+	if (phase == IN_ANCHOR)
+		printf ("</A>");
 
 	/* close the pipe */
 	result = spclose (child_process);
 
 	/* WARNING if output found on stderr */
-	if (fgets (buf, MAX_INPUT_BUFFER - 1, child_stderr))
+	if (child_stderr != NULL && fgets (buf, MAX_INPUT_BUFFER - 1, child_stderr))
 		result = max_state (result, STATE_WARNING);
 
 	/* close stderr */
-	(void) fclose (child_stderr);
+	if (child_stderr != NULL)
+		(void) fclose (child_stderr);
 
 	return result;
 }
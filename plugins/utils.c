@@ -25,6 +25,8 @@
 #include "common.h"
 #include "utils.h"
 #include "utils_base.h"
+#include "utils_metrics.h"
+#include "utils_frame.h"
 #include <stdarg.h>
 #include <limits.h>
 
@@ -94,7 +96,7 @@ void usage (const char *msg)
 {
 	printf ("%s\n", msg);
 	print_usage ();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void usage_va (const char *fmt, ...)
@@ -105,14 +107,14 @@ void usage_va (const char *fmt, ...)
 	vprintf(fmt, ap);
 	va_end(ap);
 	printf("\n");
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void usage2(const char *msg, const char *arg)
 {
 	printf ("%s: %s - %s\n", progname, msg, arg?arg:"(null)" );
 	print_usage ();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void
@@ -120,7 +122,7 @@ usage3 (const char *msg, int arg)
 {
 	printf ("%s: %s - %c\n", progname, msg, arg);
 	print_usage();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void
@@ -128,14 +130,14 @@ usage4 (const char *msg)
 {
 	printf ("%s: %s\n", progname, msg);
 	print_usage();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void
 usage5 (void)
 {
 	print_usage();
-	exit (STATE_UNKNOWN);
+	np_exit (STATE_UNKNOWN);
 }
 
 void
@@ -517,7 +519,158 @@ xasprintf (char **strp, const char *fmt, ...)
  *
  ******************************************************************************/
 
-char *perfdata (const char *label,
+/* Make room for len more bytes and a terminating NUL */
+static void
+perf_reserve (perf_buffer *p, size_t len)
+{
+	if (p->len + len + 1 <= p->size)
+		return;
+	p->size = p->size ? p->size : 256;
+	while (p->len + len + 1 > p->size)
+		p->size *= 2;
+	p->buf = realloc (p->buf, p->size);
+	if (p->buf == NULL)
+		die (STATE_UNKNOWN, _("Cannot allocate memory: %s\n"), strerror (errno));
+}
+
+void
+perf_append (perf_buffer *p, const char *s, size_t len)
+{
+	perf_reserve (p, len);
+	memcpy (p->buf + p->len, s, len);
+	p->len += len;
+	p->buf[p->len] = '\0';
+}
+
+void
+perf_puts (perf_buffer *p, const char *s)
+{
+	perf_append (p, s, strlen (s));
+}
+
+/* Start a new item: a space unless it is the first one, then the label,
+ * in single quotes if it needs quoting, in double quotes if it has a
+ * single quote itself */
+void
+perf_label (perf_buffer *p, const char *label)
+{
+	const char *quote = NULL;
+
+	if (strpbrk (label, "'= \""))
+		quote = strchr (label, '\'') ? "\"" : "'";
+	if (p->len > 0)
+		perf_append (p, " ", 1);
+	if (quote)
+		perf_append (p, quote, 1);
+	perf_puts (p, label);
+	if (quote)
+		perf_append (p, quote, 1);
+	perf_append (p, "=", 1);
+}
+
+void
+perf_long (perf_buffer *p, long int value)
+{
+	char digits[24], *d = digits + sizeof (digits);
+	unsigned long int u = value < 0 ? 0UL - (unsigned long int) value : (unsigned long int) value;
+
+	do {
+		*--d = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+	if (value < 0)
+		*--d = '-';
+	perf_append (p, d, digits + sizeof (digits) - d);
+}
+
+/* A double with up to six decimals like %f, without the trailing zeros */
+void
+perf_double (perf_buffer *p, double value)
+{
+	char digits[40], *d = digits + sizeof (digits);
+	long long int scaled;
+	unsigned long long int u;
+	int i, n = 0;
+
+	/* too large to scale into a long long, or not a number */
+	if (! (value < 9e12 && value > -9e12)) {
+		n = snprintf (digits, sizeof (digits), isfinite (value) ? "%.0f" : "%f", value);
+		perf_append (p, digits, n);
+		return;
+	}
+
+	/* rounded half away from zero, without needing libm */
+	scaled = (long long int) (value * 1e6 + (value < 0 ? -0.5 : 0.5));
+	u = scaled < 0 ? 0ULL - (unsigned long long int) scaled : (unsigned long long int) scaled;
+	for (i = 0; i < 6; i++, u /= 10) {
+		if (n > 0 || u % 10 != 0) {
+			*--d = '0' + u % 10;
+			n++;
+		}
+	}
+	if (n > 0)
+		*--d = '.';
+	do {
+		*--d = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+	if (scaled < 0)
+		*--d = '-';
+	perf_append (p, d, digits + sizeof (digits) - d);
+}
+
+/* %f, as the char * functions below have always printed doubles */
+static void
+perf_fixed (perf_buffer *p, double value)
+{
+	char digits[512];
+
+	perf_append (p, digits, snprintf (digits, sizeof (digits), "%f", value));
+}
+
+const char *
+perf_string (perf_buffer *p)
+{
+	return p->len ? p->buf : "";
+}
+
+/* a threshold printed as a number n is the range 0:n */
+static range *
+perf_range (range *r, const char *s, range **parsed, int p, double n)
+{
+	if (s != NULL && *s != '\0')
+		return *parsed = parse_range_string ((char *) s);
+	if (!p)
+		return NULL;
+	memset (r, 0, sizeof (*r));
+	r->end = n;
+	r->alert_on = OUTSIDE;
+	return r;
+}
+
+/* every point goes to the metrics sink and the framed record of the run
+ * as well */
+static void
+perf_record (const char *label, double val, const char *uom,
+ int warnp, double warn, const char *warns,
+ int critp, double crit, const char *crits,
+ int minp, double minv, int maxp, double maxv)
+{
+	range w, c, *wparsed = NULL, *cparsed = NULL;
+
+	np_metrics_record (label, val, uom);
+	if (!np_frame_collecting ())
+		return;
+	np_frame_point (label, val, uom, perf_range (&w, warns, &wparsed, warnp, warn),
+	                perf_range (&c, crits, &cparsed, critp, crit),
+	                minp, minv, maxp, maxv);
+	free (wparsed);
+	free (cparsed);
+}
+
+void
+perfdata_append (perf_buffer *p,
+ const char *label,
  long int val,
  const char *uom,
  int warnp,
@@ -529,77 +682,88 @@ char *perfdata (const char *label,
  int maxp,
  long int maxv)
 {
-	char *data = NULL;
-
-	if (strpbrk (label, "'= "))
-		xasprintf (&data, "'%s'=%ld%s;", label, val, uom);
-	else
-		xasprintf (&data, "%s=%ld%s;", label, val, uom);
-
+	perf_record (label, (double) val, uom, warnp, (double) warn, NULL,
+	             critp, (double) crit, NULL, minp, (double) minv, maxp, (double) maxv);
+	perf_label (p, label);
+	perf_long (p, val);
+	perf_puts (p, uom);
+	perf_append (p, ";", 1);
 	if (warnp)
-		xasprintf (&data, "%s%ld;", data, warn);
-	else
-		xasprintf (&data, "%s;", data);
-
+		perf_long (p, warn);
+	perf_append (p, ";", 1);
 	if (critp)
-		xasprintf (&data, "%s%ld;", data, crit);
-	else
-		xasprintf (&data, "%s;", data);
-
+		perf_long (p, crit);
+	perf_append (p, ";", 1);
 	if (minp)
-		xasprintf (&data, "%s%ld", data, minv);
-
-	if (maxp)
-		xasprintf (&data, "%s;%ld", data, maxv);
-
-	return data;
+		perf_long (p, minv);
+	if (maxp) {
+		perf_append (p, ";", 1);
+		perf_long (p, maxv);
+	}
 }
 
-
-char *fperfdata (const char *label,
+/* fperfdata and sperfdata, printing doubles with fmt */
+static void
+perf_doubles (perf_buffer *p, void (*fmt) (perf_buffer *, double),
+ const char *label,
  double val,
  const char *uom,
  int warnp,
  double warn,
+ const char *warns,
  int critp,
  double crit,
+ const char *crits,
  int minp,
  double minv,
  int maxp,
  double maxv)
 {
-	char *data = NULL;
-
-	if (strpbrk (label, "'= "))
-		xasprintf (&data, "'%s'=", label);
-	else
-		xasprintf (&data, "%s=", label);
-
-	xasprintf (&data, "%s%f", data, val);
-	xasprintf (&data, "%s%s;", data, uom);
-
-	if (warnp)
-		xasprintf (&data, "%s%f", data, warn);
-
-	xasprintf (&data, "%s;", data);
-
-	if (critp)
-		xasprintf (&data, "%s%f", data, crit);
-
-	xasprintf (&data, "%s;", data);
-
+	perf_record (label, val, uom, warnp, warn, warns, critp, crit, crits,
+	             minp, minv, maxp, maxv);
+	perf_label (p, label);
+	fmt (p, val);
+	perf_puts (p, uom);
+	perf_append (p, ";", 1);
+	if (warns)
+		perf_puts (p, warns);
+	else if (warnp)
+		fmt (p, warn);
+	perf_append (p, ";", 1);
+	if (crits)
+		perf_puts (p, crits);
+	else if (critp)
+		fmt (p, crit);
+	perf_append (p, ";", 1);
 	if (minp)
-		xasprintf (&data, "%s%f", data, minv);
-
+		fmt (p, minv);
 	if (maxp) {
-		xasprintf (&data, "%s;", data);
-		xasprintf (&data, "%s%f", data, maxv);
+		perf_append (p, ";", 1);
+		fmt (p, maxv);
 	}
+}
 
-	return data;
+void
+fperfdata_append (perf_buffer *p,
+ const char *label,
+ double val,
+ const char *uom,
+ int warnp,
+ double warn,
+ int critp,
+ double crit,
+ int minp,
+ double minv,
+ int maxp,
+ double maxv)
+{
+	perf_doubles (p, perf_double, label, val, uom, warnp, warn, NULL,
+	              critp, crit, NULL, minp, minv, maxp, maxv);
 }
 
-char *sperfdata (const char *label,
+void
+sperfdata_append (perf_buffer *p,
+ const char *label,
  double val,
  const char *uom,
  char *warn,
@@ -609,34 +773,64 @@ char *sperfdata (const char *label,
  int maxp,
  double maxv)
 {
-	char *data = NULL;
-	if (strpbrk (label, "'= "))
-		xasprintf (&data, "'%s'=", label);
-	else
-		xasprintf (&data, "%s=", label);
-
-	xasprintf (&data, "%s%f", data, val);
-	xasprintf (&data, "%s%s;", data, uom);
+	perf_doubles (p, perf_double, label, val, uom, FALSE, 0, warn,
+	              FALSE, 0, crit, minp, minv, maxp, maxv);
+}
 
-	if (warn!=NULL)
-		xasprintf (&data, "%s%s", data, warn);
+char *perfdata (const char *label,
+ long int val,
+ const char *uom,
+ int warnp,
+ long int warn,
+ int critp,
+ long int crit,
+ int minp,
+ long int minv,
+ int maxp,
+ long int maxv)
+{
+	perf_buffer data = PERF_BUFFER_INIT;
 
-	xasprintf (&data, "%s;", data);
+	perfdata_append (&data, label, val, uom, warnp, warn, critp, crit,
+	                 minp, minv, maxp, maxv);
+	return data.buf;
+}
 
-	if (crit!=NULL)
-		xasprintf (&data, "%s%s", data, crit);
 
-	xasprintf (&data, "%s;", data);
+char *fperfdata (const char *label,
+ double val,
+ const char *uom,
+ int warnp,
+ double warn,
+ int critp,
+ double crit,
+ int minp,
+ double minv,
+ int maxp,
+ double maxv)
+{
+	perf_buffer data = PERF_BUFFER_INIT;
 
-	if (minp)
-		xasprintf (&data, "%s%f", data, minv);
+	perf_doubles (&data, perf_fixed, label, val, uom, warnp, warn, NULL,
+	              critp, crit, NULL, minp, minv, maxp, maxv);
+	return data.buf;
+}
 
-	if (maxp) {
-		xasprintf (&data, "%s;", data);
-		xasprintf (&data, "%s%f", data, maxv);
-	}
+char *sperfdata (const char *label,
+ double val,
+ const char *uom,
+ char *warn,
+ char *crit,
+ int minp,
+ double minv,
+ int maxp,
+ double maxv)
+{
+	perf_buffer data = PERF_BUFFER_INIT;
 
-	return data;
+	perf_doubles (&data, perf_fixed, label, val, uom, FALSE, 0, warn,
+	              FALSE, 0, crit, minp, minv, maxp, maxv);
+	return data.buf;
 }
 
 char *sperfdata_int (const char *label,
@@ -649,34 +843,27 @@ char *sperfdata_int (const char *label,
  int maxp,
  int maxv)
 {
-	char *data = NULL;
-	if (strpbrk (label, "'= "))
-		xasprintf (&data, "'%s'=", label);
-	else
-		xasprintf (&data, "%s=", label);
-
-	xasprintf (&data, "%s%d", data, val);
-	xasprintf (&data, "%s%s;", data, uom);
-
-	if (warn!=NULL)
-		xasprintf (&data, "%s%s", data, warn);
-
-	xasprintf (&data, "%s;", data);
-
-	if (crit!=NULL)
-		xasprintf (&data, "%s%s", data, crit);
-
-	xasprintf (&data, "%s;", data);
-
+	perf_buffer data = PERF_BUFFER_INIT;
+
+	perf_record (label, (double) val, uom, FALSE, 0, warn, FALSE, 0, crit,
+	             minp, (double) minv, maxp, (double) maxv);
+	perf_label (&data, label);
+	perf_long (&data, val);
+	perf_puts (&data, uom);
+	perf_append (&data, ";", 1);
+	if (warn != NULL)
+		perf_puts (&data, warn);
+	perf_append (&data, ";", 1);
+	if (crit != NULL)
+		perf_puts (&data, crit);
+	perf_append (&data, ";", 1);
 	if (minp)
-		xasprintf (&data, "%s%d", data, minv);
-
+		perf_long (&data, minv);
 	if (maxp) {
-		xasprintf (&data, "%s;", data);
-		xasprintf (&data, "%s%d", data, maxv);
+		perf_append (&data, ";", 1);
+		perf_long (&data, maxv);
 	}
-
-	return data;
+	return data.buf;
 }
 
 int
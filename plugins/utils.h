@@ -15,13 +15,16 @@ suite of plugins. */
 
 /* now some functions etc are being defined in ../lib/utils_base.c */
 #include "utils_base.h"
+#include "utils_timing.h"
+#include "utils_arena.h"
+#include "utils_num.h"
 
 #ifdef NP_EXTRA_OPTS
 /* Include extra-opts functions if compiled in */
 #include "extra_opts.h"
 #else
-/* else, fake np_extra_opts */
-#define np_extra_opts(acptr,av,pr) av
+/* else, fake np_extra_opts, which still takes the timing options */
+#define np_extra_opts(acptr,av,pr) np_timing_opts(acptr,av)
 #endif
 
 /* Standardize version information, termination */
@@ -97,6 +100,31 @@ char *sperfdata (const char *, double, const char *, char *, char *,
 char *sperfdata_int (const char *, int, const char *, char *, char *,
                      int, int, int, int);
 
+/* Perfdata appended to one growing buffer, for plugins that print a lot of
+ * it. Start from perf_buffer p = PERF_BUFFER_INIT; perf_string(&p) is the
+ * text so far, space separated, and free(p.buf) releases it. */
+typedef struct perf_buffer_struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} perf_buffer;
+
+#define PERF_BUFFER_INIT { NULL, 0, 0 }
+
+void perf_append (perf_buffer *, const char *, size_t);
+void perf_puts (perf_buffer *, const char *);
+void perf_label (perf_buffer *, const char *);
+void perf_long (perf_buffer *, long int);
+void perf_double (perf_buffer *, double);
+const char *perf_string (perf_buffer *);
+
+void perfdata_append (perf_buffer *, const char *, long int, const char *,
+                      int, long int, int, long int, int, long int, int, long int);
+void fperfdata_append (perf_buffer *, const char *, double, const char *,
+                       int, double, int, double, int, double, int, double);
+void sperfdata_append (perf_buffer *, const char *, double, const char *,
+                       char *, char *, int, double, int, double);
+
 int open_max (void);
 
 /* The idea here is that, although not every plugin will use all of these, 
@@ -163,6 +191,21 @@ int open_max (void);
  -t, --timeout=INTEGER\n\
     Seconds before plugin times out (default: %d)\n")
 
+#define UT_PS_CACHE _("\
+ --ps-cache=SECONDS\n\
+    Share the process table with the plugins that run ps on this host within\n\
+    this many seconds (default: 0, do not share)\n")
+
+#define UT_TIMING _("\
+ --timing-perfdata\n\
+    Add the time of every phase of the check (name resolution, connect, TLS,\n\
+    request, response) to the performance data\n\
+ --trace-timing\n\
+    Print the time of every phase of the check to stderr\n\
+ --resource-usage\n\
+    Print the CPU time, memory and context switches of the run to stderr,\n\
+    as does setting MP_RESOURCE_USAGE, and add them to --timing-perfdata\n")
+
 #ifdef NP_EXTRA_OPTS
 #define UT_EXTRA_OPTS _("\
  --extra-opts=[section][@file]\n\